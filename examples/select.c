@@ -5,31 +5,12 @@
  * SPDX-License-Identifier: BSD-2-Clause
  */
 
-#include <errno.h>
 #include <fido.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <time.h>
 
 #include "../openbsd-compat/openbsd-compat.h"
 
-#define FIDO_POLL_MS	50
-
-#if defined(_MSC_VER)
-static int
-nanosleep(const struct timespec *rqtp, struct timespec *rmtp)
-{
-	if (rmtp != NULL) {
-		errno = EINVAL;
-		return (-1);
-	}
-
-	Sleep((DWORD)(rqtp->tv_sec * 1000) + (DWORD)(rqtp->tv_nsec / 1000000));
-
-	return (0);
-}
-#endif
-
 static fido_dev_t *
 open_dev(const fido_dev_info_t *di)
 {
@@ -61,14 +42,8 @@ select_dev(const fido_dev_info_t *devlist, size_t ndevs, fido_dev_t **dev,
 {
 	const fido_dev_info_t	 *di;
 	fido_dev_t		**devtab;
-	struct timespec		  ts_start;
-	struct timespec		  ts_now;
-	struct timespec		  ts_delta;
-	struct timespec		  ts_pause;
 	size_t			  nopen = 0;
-	int			  touched;
 	int			  r;
-	long			  ms_remain;
 
 	*dev = NULL;
 	*idx = 0;
@@ -100,66 +75,21 @@ select_dev(const fido_dev_info_t *devlist, size_t ndevs, fido_dev_t **dev,
 		goto out;
 	}
 
-	for (size_t i = 0; i < ndevs; i++) {
-		di = fido_dev_info_ptr(devlist, i);
-		if (devtab[i] == NULL)
-			continue; /* failed to open */
-		if ((r = fido_dev_get_touch_begin(devtab[i])) != FIDO_OK) {
-			warnx("%s: fido_dev_get_touch_begin %s: %s", __func__,
-			    fido_dev_info_path(di), fido_strerr(r));
-			r = -1;
-			goto out;
-		}
-	}
-
-	if (clock_gettime(CLOCK_MONOTONIC, &ts_start) != 0) {
-		warn("%s: clock_gettime", __func__);
+	/* devices that failed to open are NULL, and skipped */
+	switch ((r = fido_dev_select(devtab, ndevs, secs * 1000, idx))) {
+	case FIDO_OK:
+		*dev = devtab[*idx];
+		r = 0;
+		break;
+	case FIDO_ERR_TIMEOUT:
+		printf("timeout after %d seconds\n", secs);
 		r = -1;
-		goto out;
+		break;
+	default:
+		warnx("%s: fido_dev_select: %s", __func__, fido_strerr(r));
+		r = -1;
+		break;
 	}
-
-	ts_pause.tv_sec = 0;
-	ts_pause.tv_nsec = 200000000; /* 200ms */
-
-	do {
-		nanosleep(&ts_pause, NULL);
-
-		for (size_t i = 0; i < ndevs; i++) {
-			di = fido_dev_info_ptr(devlist, i);
-			if (devtab[i] == NULL) {
-				/* failed to open or discarded */
-				continue;
-			}
-			if ((r = fido_dev_get_touch_status(devtab[i], &touched,
-			    FIDO_POLL_MS)) != FIDO_OK) {
-				warnx("%s: fido_dev_get_touch_status %s: %s",
-				    __func__, fido_dev_info_path(di),
-				    fido_strerr(r));
-				fido_dev_close(devtab[i]);
-				fido_dev_free(&devtab[i]);
-				continue; /* discard */
-			}
-			if (touched) {
-				*dev = devtab[i];
-				*idx = i;
-				r = 0;
-				goto out;
-			}
-		}
-
-		if (clock_gettime(CLOCK_MONOTONIC, &ts_now) != 0) {
-			warn("%s: clock_gettime", __func__);
-			r = -1;
-			goto out;
-		}
-
-		timespecsub(&ts_now, &ts_start, &ts_delta);
-		ms_remain = (secs * 1000) - ((long)ts_delta.tv_sec * 1000) +
-		    ((long)ts_delta.tv_nsec / 1000000);
-	} while (ms_remain > FIDO_POLL_MS);
-
-	printf("timeout after %d seconds\n", secs);
-	r = -1;
 out:
 	if (r != 0) {
 		*dev = NULL;
@@ -168,7 +98,6 @@ out:
 
 	for (size_t i = 0; i < ndevs; i++) {
 		if (devtab[i] && devtab[i] != *dev) {
-			fido_dev_cancel(devtab[i]);
 			fido_dev_close(devtab[i]);
 			fido_dev_free(&devtab[i]);
 		}
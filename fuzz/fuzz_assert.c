@@ -245,8 +245,7 @@ get_assert(fido_assert_t *assert, uint8_t opt, const struct blob *cdh,
 	fido_dev_get_assert(dev, assert, (opt & 1) ? NULL : pin);
 
 	fido_dev_cancel(dev);
-	fido_dev_close(dev);
-	fido_dev_free(&dev);
+	close_dev(&dev);
 }
 
 static void
@@ -394,7 +393,7 @@ test(const struct param *p)
 
 	prng_init((unsigned int)p->seed);
 	fuzz_clock_reset();
-	fido_init(FIDO_DEBUG);
+	fido_init(fuzz_init_flags);
 	fido_set_log_handler(consume_str);
 
 	switch (p->type & 3) {
@@ -263,10 +263,7 @@ get_info(const struct param *p)
 	consume(&max_samples, sizeof(max_samples));
 
 done:
-	if (dev)
-		fido_dev_close(dev);
-
-	fido_dev_free(&dev);
+	close_dev(&dev);
 	fido_bio_info_free(&i);
 }
 
@@ -316,10 +313,7 @@ enroll(const struct param *p)
 	}
 
 done:
-	if (dev)
-		fido_dev_close(dev);
-
-	fido_dev_free(&dev);
+	close_dev(&dev);
 	fido_bio_template_free(&t);
 	fido_bio_enroll_free(&e);
 }
@@ -337,18 +331,22 @@ list(const struct param *p)
 	    (ta = fido_bio_template_array_new()) == NULL)
 		goto done;
 
+	if (p->seed & 1)
+		fido_dev_set_bio_cache(dev, true);
+
 	fido_bio_dev_get_template_array(dev, ta, p->pin);
 
+	/* served from the cache, if the first read succeeded */
+	if (p->seed & 1)
+		fido_bio_dev_get_template_array(dev, ta, p->pin);
+
 	/* +1 on purpose */
 	for (size_t i = 0; i < fido_bio_template_array_count(ta) + 1; i++)
 		if ((t = fido_bio_template(ta, i)) != NULL)
 			consume_template(t);
 
 done:
-	if (dev)
-		fido_dev_close(dev);
-
-	fido_dev_free(&dev);
+	close_dev(&dev);
 	fido_bio_template_array_free(&ta);
 }
 
@@ -371,10 +369,7 @@ set_name(const struct param *p)
 	fido_bio_dev_set_template_name(dev, t, p->pin);
 
 done:
-	if (dev)
-		fido_dev_close(dev);
-
-	fido_dev_free(&dev);
+	close_dev(&dev);
 	fido_bio_template_free(&t);
 }
 
@@ -398,10 +393,7 @@ del(const struct param *p)
 	fido_bio_dev_enroll_remove(dev, t, p->pin);
 
 done:
-	if (dev)
-		fido_dev_close(dev);
-
-	fido_dev_free(&dev);
+	close_dev(&dev);
 	fido_bio_template_free(&t);
 }
 
@@ -410,7 +402,7 @@ test(const struct param *p)
 {
 	prng_init((unsigned int)p->seed);
 	fuzz_clock_reset();
-	fido_init(FIDO_DEBUG);
+	fido_init(fuzz_init_flags);
 	fido_set_log_handler(consume_str);
 
 	get_info(p);
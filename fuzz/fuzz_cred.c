@@ -262,8 +262,7 @@ make_cred(fido_cred_t *cred, uint8_t opt, int type, const struct blob *cdh,
 	fido_dev_make_cred(dev, cred, (opt & 1) ? NULL : pin);
 
 	fido_dev_cancel(dev);
-	fido_dev_close(dev);
-	fido_dev_free(&dev);
+	close_dev(&dev);
 }
 
 static void
@@ -412,8 +411,7 @@ test_touch(const struct param *p)
 	consume(&touched, sizeof(touched));
 
 	fido_dev_cancel(dev);
-	fido_dev_close(dev);
-	fido_dev_free(&dev);
+	close_dev(&dev);
 }
 
 static void
@@ -435,7 +433,7 @@ test(const struct param *p)
 {
 	prng_init((unsigned int)p->seed);
 	fuzz_clock_reset();
-	fido_init(FIDO_DEBUG);
+	fido_init(fuzz_init_flags);
 	fido_set_log_handler(consume_str);
 
 	test_cred(p);
@@ -234,8 +234,7 @@ get_metadata(const struct param *p)
 		return;
 
 	if ((metadata = fido_credman_metadata_new()) == NULL) {
-		fido_dev_close(dev);
-		fido_dev_free(&dev);
+		close_dev(&dev);
 		return;
 	}
 
@@ -247,8 +246,7 @@ get_metadata(const struct param *p)
 	consume(&remaining, sizeof(remaining));
 
 	fido_credman_metadata_free(&metadata);
-	fido_dev_close(dev);
-	fido_dev_free(&dev);
+	close_dev(&dev);
 }
 
 static void
@@ -263,8 +261,7 @@ get_rp_list(const struct param *p)
 		return;
 
 	if ((rp = fido_credman_rp_new()) == NULL) {
-		fido_dev_close(dev);
-		fido_dev_free(&dev);
+		close_dev(&dev);
 		return;
 	}
 
@@ -279,8 +276,7 @@ get_rp_list(const struct param *p)
 	}
 
 	fido_credman_rp_free(&rp);
-	fido_dev_close(dev);
-	fido_dev_free(&dev);
+	close_dev(&dev);
 }
 
 static void
@@ -297,8 +293,7 @@ get_rk_list(const struct param *p)
 		return;
 
 	if ((rk = fido_credman_rk_new()) == NULL) {
-		fido_dev_close(dev);
-		fido_dev_free(&dev);
+		close_dev(&dev);
 		return;
 	}
 
@@ -323,8 +318,7 @@ get_rk_list(const struct param *p)
 	}
 
 	fido_credman_rk_free(&rk);
-	fido_dev_close(dev);
-	fido_dev_free(&dev);
+	close_dev(&dev);
 }
 
 static void
@@ -338,8 +332,7 @@ del_rk(const struct param *p)
 		return;
 
 	fido_credman_del_dev_rk(dev, p->cred_id.body, p->cred_id.len, p->pin);
-	fido_dev_close(dev);
-	fido_dev_free(&dev);
+	close_dev(&dev);
 }
 
 static void
@@ -366,8 +359,7 @@ set_rk(const struct param *p)
 	consume(&r1, sizeof(r1));
 	consume(&r2, sizeof(r2));
 out:
-	fido_dev_close(dev);
-	fido_dev_free(&dev);
+	close_dev(&dev);
 	fido_cred_free(&cred);
 }
 
@@ -376,7 +368,7 @@ test(const struct param *p)
 {
 	prng_init((unsigned int)p->seed);
 	fuzz_clock_reset();
-	fido_init(FIDO_DEBUG);
+	fido_init(fuzz_init_flags);
 	fido_set_log_handler(consume_str);
 
 	get_metadata(p);
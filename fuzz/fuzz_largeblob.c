@@ -201,8 +201,7 @@ get_blob(const struct param *p, int array)
 	consume(ptr, len);
 	free(ptr);
 
-	fido_dev_close(dev);
-	fido_dev_free(&dev);
+	close_dev(&dev);
 }
 
 
@@ -235,8 +234,7 @@ set_blob(const struct param *p, int op)
 		    p->get_wiredata.len, pin);
 	}
 
-	fido_dev_close(dev);
-	fido_dev_free(&dev);
+	close_dev(&dev);
 }
 
 void
@@ -244,7 +242,7 @@ test(const struct param *p)
 {
 	prng_init((unsigned int)p->seed);
 	fuzz_clock_reset();
-	fido_init(FIDO_DEBUG);
+	fido_init(fuzz_init_flags);
 	fido_set_log_handler(consume_str);
 
 	get_blob(p, 0);
@@ -213,8 +213,7 @@ dev_reset(const struct param *p)
 		return;
 
 	fido_dev_reset(dev);
-	fido_dev_close(dev);
-	fido_dev_free(&dev);
+	close_dev(&dev);
 }
 
 static void
@@ -316,8 +315,7 @@ dev_get_cbor_info(const struct param *p)
 	consume(&v, sizeof(v));
 
 out:
-	fido_dev_close(dev);
-	fido_dev_free(&dev);
+	close_dev(&dev);
 
 	fido_cbor_info_free(&ci);
 }
@@ -333,8 +331,7 @@ dev_set_pin(const struct param *p)
 		return;
 
 	fido_dev_set_pin(dev, p->pin1, NULL);
-	fido_dev_close(dev);
-	fido_dev_free(&dev);
+	close_dev(&dev);
 }
 
 static void
@@ -348,8 +345,7 @@ dev_change_pin(const struct param *p)
 		return;
 
 	fido_dev_set_pin(dev, p->pin2, p->pin1);
-	fido_dev_close(dev);
-	fido_dev_free(&dev);
+	close_dev(&dev);
 }
 
 static void
@@ -365,8 +361,7 @@ dev_get_retry_count(const struct param *p)
 
 	fido_dev_get_retry_count(dev, &n);
 	consume(&n, sizeof(n));
-	fido_dev_close(dev);
-	fido_dev_free(&dev);
+	close_dev(&dev);
 }
 
 static void
@@ -382,8 +377,7 @@ dev_get_uv_retry_count(const struct param *p)
 
 	fido_dev_get_uv_retry_count(dev, &n);
 	consume(&n, sizeof(n));
-	fido_dev_close(dev);
-	fido_dev_free(&dev);
+	close_dev(&dev);
 }
 
 static void
@@ -401,8 +395,7 @@ dev_enable_entattest(const struct param *p)
 		pin = NULL;
 	r = fido_dev_enable_entattest(dev, pin);
 	consume_str(fido_strerr(r));
-	fido_dev_close(dev);
-	fido_dev_free(&dev);
+	close_dev(&dev);
 }
 
 static void
@@ -420,8 +413,7 @@ dev_toggle_always_uv(const struct param *p)
 		pin = NULL;
 	r = fido_dev_toggle_always_uv(dev, pin);
 	consume_str(fido_strerr(r));
-	fido_dev_close(dev);
-	fido_dev_free(&dev);
+	close_dev(&dev);
 }
 
 static void
@@ -439,8 +431,7 @@ dev_force_pin_change(const struct param *p)
 		pin = NULL;
 	r = fido_dev_force_pin_change(dev, pin);
 	consume_str(fido_strerr(r));
-	fido_dev_close(dev);
-	fido_dev_free(&dev);
+	close_dev(&dev);
 }
 
 static void
@@ -458,8 +449,7 @@ dev_set_pin_minlen(const struct param *p)
 		pin = NULL;
 	r = fido_dev_set_pin_minlen(dev, strlen(p->pin2), pin);
 	consume_str(fido_strerr(r));
-	fido_dev_close(dev);
-	fido_dev_free(&dev);
+	close_dev(&dev);
 }
 
 static void
@@ -482,8 +472,45 @@ dev_set_pin_minlen_rpid(const struct param *p)
 		pin = NULL;
 	r = fido_dev_set_pin_minlen_rpid(dev, rpid, n, pin);
 	consume_str(fido_strerr(r));
-	fido_dev_close(dev);
-	fido_dev_free(&dev);
+	close_dev(&dev);
+}
+
+static void
+dev_config_apply(const struct param *p)
+{
+	fido_dev_t *dev;
+	fido_config_t *cfg;
+	const char *rpid[MAXRPID];
+	const char *pin;
+	size_t n;
+	int r;
+
+	set_wire_data(p->config_wire_data.body, p->config_wire_data.len);
+	if ((dev = open_dev(0)) == NULL)
+		return;
+	if ((cfg = fido_config_new()) == NULL) {
+		close_dev(&dev);
+		return;
+	}
+	n = uniform_random(MAXRPID);
+	for (size_t i = 0; i < n; i++)
+		rpid[i] = dummy_rp_id;
+	fido_config_set_always_uv(cfg, (fido_opt_t)uniform_random(3));
+	fido_config_set_entattest(cfg, p->seed & 1);
+	fido_config_set_force_pin_change(cfg, p->seed & 2);
+	fido_config_set_pin_minlen(cfg, strlen(p->pin2));
+	fido_config_set_pin_minlen_rpid(cfg, rpid, n);
+	pin = p->pin1;
+	if (strlen(pin) == 0)
+		pin = NULL;
+	r = fido_dev_config_apply(dev, cfg, pin);
+	consume_str(fido_strerr(r));
+	for (int i = FIDO_CONFIG_ENTATTEST; i <= FIDO_CONFIG_PIN_MINLEN; i++) {
+		r = fido_config_status(cfg, i);
+		consume(&r, sizeof(r));
+	}
+	fido_config_free(&cfg);
+	close_dev(&dev);
 }
 
 void
@@ -491,7 +518,7 @@ test(const struct param *p)
 {
 	prng_init((unsigned int)p->seed);
 	fuzz_clock_reset();
-	fido_init(FIDO_DEBUG);
+	fido_init(fuzz_init_flags);
 	fido_set_log_handler(consume_str);
 
 	dev_reset(p);
@@ -505,6 +532,7 @@ test(const struct param *p)
 	dev_force_pin_change(p);
 	dev_set_pin_minlen(p);
 	dev_set_pin_minlen_rpid(p);
+	dev_config_apply(p);
 }
 
 void
@@ -128,7 +128,7 @@ test(const struct param *p)
 
 	prng_init((unsigned int)p->seed);
 	fuzz_clock_reset();
-	fido_init(FIDO_DEBUG);
+	fido_init(fuzz_init_flags);
 	fido_set_log_handler(consume_str);
 
 	set_netlink_io_functions(fd_read, fd_write);
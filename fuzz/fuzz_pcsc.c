@@ -226,7 +226,7 @@ test(const struct param *p)
 
 	prng_init((unsigned int)p->seed);
 	fuzz_clock_reset();
-	fido_init(FIDO_DEBUG);
+	fido_init(fuzz_init_flags);
 	fido_set_log_handler(consume_str);
 
 	set_pcsc_parameters(&p->pcsc_list);
@@ -20,6 +20,8 @@
 
 extern int fuzz_save_corpus;
 
+int fuzz_init_flags = FIDO_DEBUG;
+
 static bool debug;
 static unsigned int flags = MUTATE_ALL;
 static unsigned long long test_fail;
@@ -278,8 +278,23 @@ fd_write(int fd, const void *ptr, size_t len)
 	return buf_write(ptr, len);
 }
 
-fido_dev_t *
-open_dev(int nfc)
+/*
+ * Harnesses get their devices from open_dev() and hand them back with
+ * close_dev(). One device per transport is allocated for the life of the
+ * process, and is reset rather than freed between uses; a device asked
+ * for while that one is in use is allocated afresh. Devices are set up
+ * with the prng held back, so that no input draws from it for that, and
+ * each input behaves as it would on its own.
+ */
+static struct dev_slot {
+	fido_dev_t	*dev;
+	bool		 busy;
+} dev_slot[2]; /* hid, nfc */
+
+int fido_dev_fuzz_reset(fido_dev_t *);
+
+static fido_dev_t *
+new_dev(int nfc)
 {
 	fido_dev_t *dev;
 	fido_dev_io_t io;
@@ -313,17 +328,76 @@ open_dev(int nfc)
 			goto fail;
 	}
 
+	return dev;
+fail:
+	fido_dev_free(&dev);
+
+	return NULL;
+}
+
+static struct dev_slot *
+dev_slot_get(const fido_dev_t *dev)
+{
+	for (size_t i = 0; i < sizeof(dev_slot) / sizeof(dev_slot[0]); i++)
+		if (dev_slot[i].dev == dev)
+			return &dev_slot[i];
+
+	return NULL;
+}
+
+fido_dev_t *
+open_dev(int nfc)
+{
+	struct dev_slot *slot = &dev_slot[nfc != 0];
+	fido_dev_t *dev;
+	int up = prng_up;
+
+	if (slot->dev == NULL) {
+		prng_up = 0;
+		if ((slot->dev = new_dev(nfc)) != NULL &&
+		    fido_dev_fuzz_reset(slot->dev) != 0)
+			fido_dev_free(&slot->dev);
+		prng_up = up;
+	}
+
+	if (slot->dev != NULL && !slot->busy) {
+		dev = slot->dev;
+		slot->busy = true;
+	} else if ((dev = new_dev(nfc)) == NULL)
+		return NULL;
+
 	if (fido_dev_set_timeout(dev, 300) != FIDO_OK ||
 	    fido_dev_open(dev, "nodev") != FIDO_OK)
 		goto fail;
 
 	return dev;
 fail:
-	fido_dev_free(&dev);
+	close_dev(&dev);
 
 	return NULL;
 }
 
+void
+close_dev(fido_dev_t **dev_p)
+{
+	struct dev_slot *slot;
+
+	if (*dev_p == NULL)
+		return;
+
+	if ((slot = dev_slot_get(*dev_p)) == NULL) {
+		fido_dev_close(*dev_p);
+		fido_dev_free(dev_p);
+		return;
+	}
+
+	/* the receive buffer is kept, so nothing is allocated */
+	if (fido_dev_fuzz_reset(slot->dev) != 0)
+		fido_dev_free(&slot->dev);
+	slot->busy = false;
+	*dev_p = NULL;
+}
+
 void
 set_wire_data(const uint8_t *ptr, size_t len)
 {
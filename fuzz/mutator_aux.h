@@ -65,6 +65,8 @@ struct blob {
 
 struct param;
 
+extern int fuzz_init_flags; /* passed to fido_init() by the harnesses */
+
 struct param *unpack(const uint8_t *, size_t);
 size_t pack(uint8_t *, size_t, const struct param *);
 size_t pack_dummy(uint8_t *, size_t);
@@ -96,6 +98,7 @@ int nfc_read(void *, unsigned char *, size_t, int);
 int nfc_write(void *, const unsigned char *, size_t);
 
 fido_dev_t *open_dev(int);
+void close_dev(fido_dev_t **);
 void set_wire_data(const uint8_t *, size_t);
 
 void fuzz_clock_reset(void);
@@ -25,6 +25,8 @@ LONG __wrap_SCardReleaseContext(SCARDCONTEXT);
 LONG __wrap_SCardConnect(SCARDCONTEXT, LPCSTR, DWORD, DWORD, LPSCARDHANDLE,
     LPDWORD);
 LONG __wrap_SCardDisconnect(SCARDHANDLE, DWORD);
+LONG __wrap_SCardStatus(SCARDHANDLE, LPSTR, LPDWORD, LPDWORD, LPDWORD,
+    LPBYTE, LPDWORD);
 LONG __wrap_SCardTransmit(SCARDHANDLE, const SCARD_IO_REQUEST *, LPCBYTE,
     DWORD, SCARD_IO_REQUEST *, LPBYTE, LPDWORD);
 
@@ -113,6 +115,37 @@ __wrap_SCardDisconnect(SCARDHANDLE hCard, DWORD dwDisposition)
 	return SCARD_S_SUCCESS;
 }
 
+LONG
+__wrap_SCardStatus(SCARDHANDLE hCard, LPSTR szReaderName, LPDWORD pcchReaderLen,
+    LPDWORD pdwState, LPDWORD pdwProtocol, LPBYTE pbAtr, LPDWORD pcbAtrLen)
+{
+	/* a card advertising extended lc/le in its card capabilities */
+	static const uint8_t atr[] = {
+		0x3b, 0x8d, 0x80, 0x01, 0x80, 0x73, 0xc0, 0x21, 0xc0, 0x57,
+		0x59, 0x75, 0x62, 0x69, 0x4b, 0x65, 0x79, 0xf9,
+	};
+
+	assert(hCard == 1);
+	assert(szReaderName == NULL);
+	assert(pcchReaderLen != NULL);
+	assert(pdwState != NULL);
+	assert(pdwProtocol != NULL);
+	assert(pbAtr != NULL);
+	assert(pcbAtrLen != NULL);
+
+	if (uniform_random(400) < 1)
+		return SCARD_E_UNEXPECTED;
+	if (*pcbAtrLen < sizeof(atr))
+		return SCARD_E_INSUFFICIENT_BUFFER;
+
+	memcpy(pbAtr, atr, sizeof(atr));
+	*pcbAtrLen = (DWORD)sizeof(atr);
+	if (uniform_random(2) < 1)
+		pbAtr[8] = 0x00; /* short apdus only */
+
+	return SCARD_S_SUCCESS;
+}
+
 extern void consume(const void *body, size_t len);
 
 LONG
@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Replay a harness's corpus, without mutation, timing each input.
+ *
+ * If libfido2 and the harness are built with -finstrument-functions, the
+ * time spent in each instrumented function is also accounted for, and
+ * reported by -p. Functions not exported by their object are named by
+ * object and offset, which addr2line(1) can resolve.
+ */
+
+#define _GNU_SOURCE /* dladdr */
+
+#include <sys/stat.h>
+
+#include <dirent.h>
+#include <dlfcn.h>
+#include <err.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mutator_aux.h"
+
+#define NO_INSTRUMENT	__attribute__((no_instrument_function))
+
+#define PROF_SLOTS	8192	/* distinct functions; a power of two */
+#define PROF_DEPTH	512	/* call depth */
+
+int LLVMFuzzerInitialize(int *, char ***);
+int LLVMFuzzerTestOneInput(const uint8_t *, size_t);
+size_t LLVMFuzzerMutate(uint8_t *, size_t, size_t);
+
+struct input {
+	char		*path;
+	uint64_t	 ns;
+};
+
+struct prof_fn {
+	void		*fn;
+	uint64_t	 calls;
+	uint64_t	 incl;
+	uint64_t	 self;
+};
+
+struct prof_frame {
+	void		*fn;
+	uint64_t	 start;
+	uint64_t	 child;
+};
+
+static struct input	*inputs;
+static size_t		 ninputs;
+static struct prof_fn	 prof_fn[PROF_SLOTS];
+static struct prof_frame prof_stack[PROF_DEPTH];
+static size_t		 prof_depth;
+static size_t		 prof_lost;
+static bool		 prof_on;
+
+void __cyg_profile_func_enter(void *, void *) NO_INSTRUMENT;
+void __cyg_profile_func_exit(void *, void *) NO_INSTRUMENT;
+
+static uint64_t NO_INSTRUMENT
+now_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		err(1, "clock_gettime");
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static struct prof_fn * NO_INSTRUMENT
+prof_lookup(void *fn)
+{
+	size_t i = ((uintptr_t)fn >> 4) & (PROF_SLOTS - 1);
+
+	for (size_t n = 0; n < PROF_SLOTS; n++) {
+		if (prof_fn[i].fn == fn || prof_fn[i].fn == NULL) {
+			prof_fn[i].fn = fn;
+			return &prof_fn[i];
+		}
+		i = (i + 1) & (PROF_SLOTS - 1);
+	}
+
+	return NULL;
+}
+
+void NO_INSTRUMENT
+__cyg_profile_func_enter(void *fn, void *site)
+{
+	(void)site;
+
+	if (!prof_on)
+		return;
+	if (prof_depth == PROF_DEPTH) {
+		prof_lost++;
+		return;
+	}
+	prof_stack[prof_depth].fn = fn;
+	prof_stack[prof_depth].child = 0;
+	prof_stack[prof_depth++].start = now_ns();
+}
+
+void NO_INSTRUMENT
+__cyg_profile_func_exit(void *fn, void *site)
+{
+	struct prof_frame	*f;
+	struct prof_fn		*p;
+	uint64_t		 incl;
+
+	(void)site;
+
+	if (!prof_on)
+		return;
+	/* frames left by functions that did not return normally */
+	while (prof_depth > 0 && prof_stack[prof_depth - 1].fn != fn)
+		prof_depth--;
+	if (prof_depth == 0)
+		return;
+	f = &prof_stack[--prof_depth];
+	incl = now_ns() - f->start;
+	if (prof_depth > 0)
+		prof_stack[prof_depth - 1].child += incl;
+	if ((p = prof_lookup(fn)) == NULL) {
+		prof_lost++;
+		return;
+	}
+	p->calls++;
+	p->incl += incl;
+	p->self += incl - f->child;
+}
+
+/* referenced by mutator_aux.c; inputs are replayed as recorded */
+size_t
+LLVMFuzzerMutate(uint8_t *data, size_t size, size_t maxsize)
+{
+	(void)data;
+	(void)maxsize;
+
+	return size;
+}
+
+static void
+add_input(const char *path)
+{
+	struct input *p;
+
+	if ((p = realloc(inputs, (ninputs + 1) * sizeof(*p))) == NULL)
+		err(1, "realloc");
+	inputs = p;
+	if ((inputs[ninputs].path = strdup(path)) == NULL)
+		err(1, "strdup");
+	inputs[ninputs++].ns = 0;
+}
+
+static int
+cmp_name(const void *a, const void *b)
+{
+	return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/* a directory's files, in name order, so that runs are comparable */
+static void
+add_path(const char *path)
+{
+	struct stat	 st;
+	struct dirent	*de;
+	DIR		*dir;
+	char		**names = NULL, **p, buf[PATH_MAX];
+	size_t		 n = 0;
+	int		 r;
+
+	if (stat(path, &st) < 0)
+		err(1, "stat %s", path);
+	if (!S_ISDIR(st.st_mode)) {
+		add_input(path);
+		return;
+	}
+	if ((dir = opendir(path)) == NULL)
+		err(1, "opendir %s", path);
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.')
+			continue;
+		if ((p = realloc(names, (n + 1) * sizeof(*p))) == NULL)
+			err(1, "realloc");
+		names = p;
+		if ((names[n++] = strdup(de->d_name)) == NULL)
+			err(1, "strdup");
+	}
+	closedir(dir);
+	qsort(names, n, sizeof(*names), cmp_name);
+	for (size_t i = 0; i < n; i++) {
+		if ((r = snprintf(buf, sizeof(buf), "%s/%s", path,
+		    names[i])) < 0 || (size_t)r >= sizeof(buf))
+			errx(1, "snprintf");
+		if (stat(buf, &st) == 0 && S_ISREG(st.st_mode))
+			add_input(buf);
+		free(names[i]);
+	}
+	free(names);
+}
+
+static size_t
+read_input(const char *path, uint8_t *buf, size_t len)
+{
+	ssize_t	n;
+	int	fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		err(1, "open %s", path);
+	if ((n = read(fd, buf, len)) < 0)
+		err(1, "read %s", path);
+	close(fd);
+
+	return (size_t)n;
+}
+
+static int
+cmp_input(const void *a, const void *b)
+{
+	const struct input *x = a, *y = b;
+
+	return (x->ns < y->ns) - (x->ns > y->ns);
+}
+
+static int
+cmp_self(const void *a, const void *b)
+{
+	const struct prof_fn *x = a, *y = b;
+
+	return (x->self < y->self) - (x->self > y->self);
+}
+
+static void
+print_name(const void *fn)
+{
+	Dl_info info;
+
+	if (dladdr(fn, &info) == 0 || info.dli_fname == NULL) {
+		printf("%p\n", fn);
+		return;
+	}
+	if (info.dli_sname != NULL && info.dli_saddr == fn) {
+		printf("%s\n", info.dli_sname);
+		return;
+	}
+	printf("%s+0x%zx\n", info.dli_fname,
+	    (size_t)((const char *)fn - (const char *)info.dli_fbase));
+}
+
+static void
+report(uint64_t total, unsigned int reps, size_t top)
+{
+	size_t nfn = 0;
+
+	qsort(inputs, ninputs, sizeof(*inputs), cmp_input);
+	printf("%12s %6s  %s\n", "ns/run", "%", "input");
+	for (size_t i = 0; i < ninputs && i < top; i++)
+		printf("%12llu %6.2f  %s\n",
+		    (unsigned long long)(inputs[i].ns / reps),
+		    100.0 * (double)inputs[i].ns / (double)total,
+		    inputs[i].path);
+	printf("%12llu %6.2f  total (%zu inputs, %u runs each)\n",
+	    (unsigned long long)(total / reps), 100.0, ninputs, reps);
+
+	for (size_t i = 0; i < PROF_SLOTS; i++)
+		if (prof_fn[i].fn != NULL)
+			prof_fn[nfn++] = prof_fn[i];
+	if (nfn == 0)
+		return;
+
+	qsort(prof_fn, nfn, sizeof(*prof_fn), cmp_self);
+	printf("\n%12s %12s %12s %6s  %s\n", "calls/run", "self ns", "incl ns",
+	    "self%", "function");
+	for (size_t i = 0; i < nfn && i < top; i++) {
+		printf("%12llu %12llu %12llu %6.2f  ",
+		    (unsigned long long)(prof_fn[i].calls / reps),
+		    (unsigned long long)(prof_fn[i].self / reps),
+		    (unsigned long long)(prof_fn[i].incl / reps),
+		    100.0 * (double)prof_fn[i].self / (double)total);
+		print_name(prof_fn[i].fn);
+	}
+	if (prof_lost)
+		printf("%zu calls not accounted for\n", prof_lost);
+}
+
+static void
+usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [-dp] [-n runs] [-t top] path ...\n",
+	    progname);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	static uint8_t	 buf[MAXCORPUS];
+	uint64_t	 t0, total = 0;
+	size_t		 len, top = 20;
+	unsigned int	 reps = 10;
+	bool		 debug = false, profile = false;
+	int		 ch, lfargc = 1, n;
+	char		*progname = argv[0], **lfargv = argv;
+
+	while ((ch = getopt(argc, argv, "dn:pt:")) != -1) {
+		switch (ch) {
+		case 'd':
+			debug = true;
+			break;
+		case 'n':
+			if ((n = atoi(optarg)) < 1)
+				usage(progname);
+			reps = (unsigned int)n;
+			break;
+		case 'p':
+			profile = true;
+			break;
+		case 't':
+			if ((n = atoi(optarg)) < 1)
+				usage(progname);
+			top = (size_t)n;
+			break;
+		default:
+			usage(progname);
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc < 1)
+		usage(progname);
+
+	for (int i = 0; i < argc; i++)
+		add_path(argv[i]);
+	if (ninputs == 0)
+		errx(1, "no inputs");
+
+	LLVMFuzzerInitialize(&lfargc, &lfargv);
+	/* harnesses log at FIDO_DEBUG when fuzzing; not when timed */
+	fuzz_init_flags = debug ? FIDO_DEBUG : 0;
+
+	for (size_t i = 0; i < ninputs; i++) {
+		len = read_input(inputs[i].path, buf, sizeof(buf));
+		LLVMFuzzerTestOneInput(buf, len); /* warm up */
+		prof_on = profile;
+		t0 = now_ns();
+		for (unsigned int r = 0; r < reps; r++)
+			LLVMFuzzerTestOneInput(buf, len);
+		inputs[i].ns = now_ns() - t0;
+		prof_on = false;
+		total += inputs[i].ns;
+	}
+
+	report(total, reps, top);
+
+	for (size_t i = 0; i < ninputs; i++)
+		free(inputs[i].path);
+	free(inputs);
+
+	exit(0);
+}
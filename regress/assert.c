@@ -16,6 +16,9 @@
 #include <fido/es256.h>
 #include <fido/rs256.h>
 #include <fido/eddsa.h>
+#include <fido/verify.h>
+
+#define VERIFIER_NJOBS	16
 
 static int fake_dev_handle;
 
@@ -93,6 +96,19 @@ static const unsigned char sig[72] = {
 	0xab, 0x4a, 0x91, 0xc0, 0x7d, 0x2d, 0x23, 0x1e,
 };
 
+/* authdata and sig above, and clientDataJSON {"type":"webauthn.get"} */
+#define WEBAUTHN_AUTHDATA	"SZYN5YgOjGh0NBcPZHZgW4_krrmihjLHmVzzuoMdl2MAAAAAAw"
+#define WEBAUTHN_SIG		"MEYCIQD20aPVJCve7qCQic34nr1rTVV55MFCJ7ebm6QK" \
+				"4kdkDgIhAOXJwoNHMccm5SWytDmn_D1wvumBDUpiqatKkcB9LSMe"
+#define WEBAUTHN_CD		"eyJ0eXBlIjoid2ViYXV0aG4uZ2V0In0"
+
+static const unsigned char webauthn_cdh[32] = {
+	0x0f, 0xbc, 0xf5, 0xf3, 0x47, 0x4f, 0x82, 0x96,
+	0xa8, 0x7c, 0xc6, 0x80, 0x4a, 0x0d, 0xc7, 0x7a,
+	0x05, 0x5e, 0x4a, 0x1f, 0x05, 0x1f, 0x6a, 0xbf,
+	0x2a, 0x3e, 0x3c, 0xd4, 0x1f, 0x7c, 0xf5, 0x97,
+};
+
 static void *
 dummy_open(const char *path)
 {
@@ -342,6 +358,641 @@ valid_assert(void)
 	free_eddsa_pk(eddsa);
 }
 
+static void
+borrow_take(void)
+{
+	fido_assert_t *a;
+	es256_pk_t *es256;
+	unsigned char *s;
+
+	s = malloc(sizeof(sig));
+	assert(s != NULL);
+	memcpy(s, sig, sizeof(sig));
+
+	a = alloc_assert();
+	es256 = alloc_es256_pk();
+	assert(es256_pk_from_ptr(es256, es256_pk, sizeof(es256_pk)) == FIDO_OK);
+	assert(fido_assert_set_clientdata_hash_borrow(a, NULL,
+	    sizeof(cdh)) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_set_clientdata_hash_borrow(a, cdh,
+	    sizeof(cdh)) == FIDO_OK);
+	assert(fido_assert_clientdata_hash_ptr(a) == cdh);
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_assert_set_count(a, 1) == FIDO_OK);
+	assert(fido_assert_set_authdata_raw(a, 0, authdata + 2,
+	    sizeof(authdata) - 2) == FIDO_OK);
+	assert(fido_assert_authdata_len(a, 0) == sizeof(authdata));
+	assert(memcmp(fido_assert_authdata_ptr(a, 0), authdata,
+	    sizeof(authdata)) == 0);
+	assert(fido_assert_set_up(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_uv(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_sig_take(a, 1, s,
+	    sizeof(sig)) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_set_sig_take(a, 0, s, sizeof(sig)) == FIDO_OK);
+	assert(fido_assert_sig_ptr(a, 0) == s);
+	assert(fido_assert_verify(a, 0, COSE_ES256, es256) == FIDO_OK);
+	/* a borrowed value is replaced, not written over */
+	assert(fido_assert_set_sig_borrow(a, 0, sig, sizeof(sig)) == FIDO_OK);
+	assert(fido_assert_set_sig(a, 0, sig, sizeof(sig) - 1) == FIDO_OK);
+	assert(fido_assert_sig_ptr(a, 0) != sig);
+	assert(fido_assert_verify(a, 0, COSE_ES256,
+	    es256) == FIDO_ERR_INVALID_SIG);
+	free_assert(a);
+	free_es256_pk(es256);
+}
+
+static void
+batch_assert(void)
+{
+	fido_assert_t *a1, *a2;
+	es256_pk_t *es256;
+	rs256_pk_t *rs256;
+	fido_assert_verify_item_t item[4];
+	int result[4];
+
+	a1 = alloc_assert();
+	a2 = alloc_assert();
+	es256 = alloc_es256_pk();
+	rs256 = alloc_rs256_pk();
+	assert(es256_pk_from_ptr(es256, es256_pk, sizeof(es256_pk)) == FIDO_OK);
+	assert(fido_assert_set_clientdata_hash(a1, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_assert_set_rp(a1, "localhost") == FIDO_OK);
+	assert(fido_assert_set_count(a1, 1) == FIDO_OK);
+	assert(fido_assert_set_authdata(a1, 0, authdata,
+	    sizeof(authdata)) == FIDO_OK);
+	assert(fido_assert_set_up(a1, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_uv(a1, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_sig(a1, 0, sig, sizeof(sig)) == FIDO_OK);
+	assert(fido_assert_set_rp(a2, "localhost") == FIDO_OK);
+	assert(fido_assert_set_count(a2, 1) == FIDO_OK);
+
+	memset(item, 0, sizeof(item));
+	memset(result, 0xff, sizeof(result));
+	item[0].assert = a1;
+	item[0].cose_alg = COSE_ES256;
+	item[0].pk = es256;
+	item[1] = item[0];
+	item[2] = item[0];
+	item[2].cose_alg = COSE_RS256;
+	item[2].pk = rs256;
+	item[3] = item[0];
+	item[3].assert = a2;
+
+	assert(fido_assert_verify_batch(NULL, 4, result) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_verify_batch(item, 4, NULL) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_verify_batch(item, 0, result) == FIDO_OK);
+	assert(fido_assert_verify_batch(item, 2, result) == FIDO_OK);
+	assert(result[0] == FIDO_OK);
+	assert(result[1] == FIDO_OK);
+	assert(fido_assert_verify_batch(item, 4, result) ==
+	    FIDO_ERR_INVALID_SIG);
+	assert(result[0] == FIDO_OK);
+	assert(result[1] == FIDO_OK);
+	assert(result[2] == FIDO_ERR_INVALID_SIG);
+	assert(result[3] == FIDO_ERR_INVALID_ARGUMENT);
+	item[0].assert = NULL;
+	assert(fido_assert_verify_batch(item, 2, result) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(result[0] == FIDO_ERR_INVALID_ARGUMENT);
+	assert(result[1] == FIDO_OK);
+
+	free_assert(a1);
+	free_assert(a2);
+	free_es256_pk(es256);
+	free_rs256_pk(rs256);
+}
+
+static void
+verify_key(void)
+{
+	fido_assert_t *a;
+	fido_verify_key_t *key;
+	es256_pk_t *es256;
+	rs256_pk_t *rs256;
+	unsigned char cose[77];
+	unsigned char *p = cose;
+
+	a = alloc_assert();
+	es256 = alloc_es256_pk();
+	rs256 = alloc_rs256_pk();
+	key = fido_verify_key_new();
+	assert(key != NULL);
+	assert(fido_verify_key_type(key) == COSE_UNSPEC);
+	assert(fido_assert_verify_with_key(a, 0, NULL) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_verify_with_key(a, 0, key) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(es256_pk_from_ptr(es256, es256_pk, sizeof(es256_pk)) == FIDO_OK);
+	assert(fido_verify_key_from_pk(key, COSE_ES256, NULL) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_verify_key_from_pk(key, -1, es256) ==
+	    FIDO_ERR_UNSUPPORTED_OPTION);
+	assert(fido_verify_key_from_pk(key, COSE_RS256, rs256) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_verify_key_type(key) == COSE_UNSPEC);
+	assert(fido_verify_key_from_pk(key, COSE_ES256, es256) == FIDO_OK);
+	assert(fido_verify_key_type(key) == COSE_ES256);
+	assert(fido_assert_verify_with_key(a, 0, key) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_set_clientdata_hash(a, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_assert_set_count(a, 1) == FIDO_OK);
+	assert(fido_assert_set_authdata(a, 0, authdata,
+	    sizeof(authdata)) == FIDO_OK);
+	assert(fido_assert_set_up(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_uv(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_sig(a, 0, sig, sizeof(sig)) == FIDO_OK);
+	assert(fido_assert_verify_with_key(a, 0, key) == FIDO_OK);
+	assert(fido_assert_verify_with_key(a, 0, key) == FIDO_OK);
+	assert(fido_assert_verify_with_key(a, 1, key) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	fido_verify_key_free(&key);
+	assert(key == NULL);
+	fido_verify_key_free(&key);
+	fido_verify_key_free(NULL);
+
+	/* cose key: kty=ec2, alg=es256, crv=p256, x, y */
+	memcpy(p, "\xa5\x01\x02\x03\x26\x20\x01\x21\x58\x20", 10);
+	p += 10;
+	memcpy(p, es256_pk, 32);
+	p += 32;
+	memcpy(p, "\x22\x58\x20", 3);
+	p += 3;
+	memcpy(p, es256_pk + 32, 32);
+	key = fido_verify_key_new();
+	assert(key != NULL);
+	assert(fido_verify_key_from_cose(key, NULL, 0) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_verify_key_from_cose(key, cose, sizeof(cose) - 1) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_verify_key_from_cose(key, cose, sizeof(cose)) == FIDO_OK);
+	assert(fido_verify_key_type(key) == COSE_ES256);
+	assert(fido_assert_verify_with_key(a, 0, key) == FIDO_OK);
+	assert(fido_assert_set_sig(a, 0, sig, sizeof(sig) - 1) == FIDO_OK);
+	assert(fido_assert_verify_with_key(a, 0, key) == FIDO_ERR_INVALID_SIG);
+	fido_verify_key_free(&key);
+
+	free_assert(a);
+	free_es256_pk(es256);
+	free_rs256_pk(rs256);
+}
+
+static void
+verifier_cb(void *cookie, size_t idx, int result)
+{
+	int *seen = cookie;
+
+	assert(idx < VERIFIER_NJOBS);
+	assert(result == (idx % 2 ? FIDO_ERR_INVALID_SIG : FIDO_OK));
+	seen[idx]++;
+}
+
+static void
+verifier(void)
+{
+	fido_verifier_t *v;
+	fido_assert_t *a;
+	es256_pk_t *es256;
+	rs256_pk_t *rs256;
+	fido_assert_verify_item_t item[VERIFIER_NJOBS];
+	int seen[VERIFIER_NJOBS];
+	void *cookie;
+	size_t idx;
+	int result;
+
+	a = alloc_assert();
+	es256 = alloc_es256_pk();
+	rs256 = alloc_rs256_pk();
+	assert(es256_pk_from_ptr(es256, es256_pk, sizeof(es256_pk)) == FIDO_OK);
+	assert(fido_assert_set_clientdata_hash(a, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_assert_set_count(a, 1) == FIDO_OK);
+	assert(fido_assert_set_authdata(a, 0, authdata,
+	    sizeof(authdata)) == FIDO_OK);
+	assert(fido_assert_set_up(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_uv(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_sig(a, 0, sig, sizeof(sig)) == FIDO_OK);
+
+	/* odd entries carry the wrong key and must fail */
+	memset(item, 0, sizeof(item));
+	for (size_t i = 0; i < VERIFIER_NJOBS; i++) {
+		item[i].assert = a;
+		item[i].cose_alg = i % 2 ? COSE_RS256 : COSE_ES256;
+		item[i].pk = i % 2 ? (const void *)rs256 : (const void *)es256;
+	}
+
+	assert(fido_verifier_new(257) == NULL);
+	v = fido_verifier_new(4);
+	assert(v != NULL);
+	assert(fido_verifier_pending(v) == 0);
+	assert(fido_verifier_poll(v, &cookie, &idx, &result, -1) ==
+	    FIDO_ERR_NOTFOUND);
+	assert(fido_verifier_poll(v, NULL, &idx, &result, 0) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_verifier_submit_assert(v, NULL, 1, NULL) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_verifier_submit_assert(v, item, 0, NULL) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+
+	/* poll for results */
+	memset(seen, 0, sizeof(seen));
+	assert(fido_verifier_submit_assert(v, item, VERIFIER_NJOBS,
+	    seen) == FIDO_OK);
+	for (size_t i = 0; i < VERIFIER_NJOBS; i++) {
+		assert(fido_verifier_poll(v, &cookie, &idx, &result,
+		    -1) == FIDO_OK);
+		assert(cookie == seen);
+		verifier_cb(cookie, idx, result);
+	}
+	assert(fido_verifier_pending(v) == 0);
+	assert(fido_verifier_poll(v, &cookie, &idx, &result, 10) ==
+	    FIDO_ERR_NOTFOUND);
+	for (size_t i = 0; i < VERIFIER_NJOBS; i++)
+		assert(seen[i] == 1);
+
+	/* callback delivery; poll waits for completion */
+	memset(seen, 0, sizeof(seen));
+	assert(fido_verifier_set_callback(v, verifier_cb) == FIDO_OK);
+	assert(fido_verifier_submit_assert(v, item, VERIFIER_NJOBS,
+	    seen) == FIDO_OK);
+	assert(fido_verifier_poll(v, &cookie, &idx, &result, -1) ==
+	    FIDO_ERR_NOTFOUND);
+	assert(fido_verifier_pending(v) == 0);
+	for (size_t i = 0; i < VERIFIER_NJOBS; i++)
+		assert(seen[i] == 1);
+
+	/* outstanding work is drained on free */
+	memset(seen, 0, sizeof(seen));
+	assert(fido_verifier_submit_assert(v, item, VERIFIER_NJOBS,
+	    seen) == FIDO_OK);
+	fido_verifier_free(&v);
+	assert(v == NULL);
+	fido_verifier_free(&v);
+	fido_verifier_free(NULL);
+	for (size_t i = 0; i < VERIFIER_NJOBS; i++)
+		assert(seen[i] == 1);
+
+	free_assert(a);
+	free_es256_pk(es256);
+	free_rs256_pk(rs256);
+}
+
+static void
+authdata_view(void)
+{
+	fido_authdata_view_t view;
+	fido_assert_t *a;
+	fido_verify_key_t *key;
+	es256_pk_t *es256;
+	unsigned char junk[sizeof(sig)];
+	unsigned char ext[37 + 27];
+
+	a = alloc_assert();
+	es256 = alloc_es256_pk();
+	key = fido_verify_key_new();
+	assert(key != NULL);
+	assert(es256_pk_from_ptr(es256, es256_pk, sizeof(es256_pk)) == FIDO_OK);
+	assert(fido_verify_key_from_pk(key, COSE_ES256, es256) == FIDO_OK);
+
+	memset(&view, 0, sizeof(view));
+	assert(fido_authdata_view_set(&view, NULL, 37) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_authdata_view_set(&view, authdata + 2, 36) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_authdata_view_set_cbor(&view, authdata,
+	    sizeof(authdata) - 1) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_authdata_view_set_cbor(&view, authdata + 2, 37) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(view.ptr == NULL);
+	assert(fido_authdata_view_set_cbor(&view, authdata,
+	    sizeof(authdata)) == FIDO_OK);
+	assert(view.ptr == authdata + 2);
+	assert(view.len == 37);
+	assert(view.rp_id_hash == authdata + 2);
+	assert(view.flags == authdata[2 + 32]);
+	assert(view.sigcount == ((uint32_t)authdata[2 + 33] << 24 |
+	    (uint32_t)authdata[2 + 34] << 16 |
+	    (uint32_t)authdata[2 + 35] << 8 | authdata[2 + 36]));
+	assert(view.ext_ptr == NULL);
+	assert(view.ext == 0);
+
+	/* the assertion only carries the expected cdh, rp and options */
+	assert(fido_assert_set_clientdata_hash(a, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_assert_verify_view(a, &view, sig, sizeof(sig), NULL) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_verify_view(a, &view, NULL, sizeof(sig), key) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_verify_view(a, &view, sig, sizeof(sig), key) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_assert_set_up(a, FIDO_OPT_TRUE) == FIDO_OK);
+	assert(fido_assert_verify_view(a, &view, sig, sizeof(sig), key) ==
+	    FIDO_ERR_INVALID_PARAM);
+	assert(fido_assert_set_up(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_uv(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_verify_view(a, &view, sig, sizeof(sig), key) ==
+	    FIDO_OK);
+	memcpy(junk, sig, sizeof(sig));
+	junk[sizeof(junk) - 1] ^= 0xff;
+	assert(fido_assert_verify_view(a, &view, junk, sizeof(junk), key) ==
+	    FIDO_ERR_INVALID_SIG);
+	assert(fido_assert_set_rp(a, "example.com") == FIDO_OK);
+	assert(fido_assert_verify_view(a, &view, sig, sizeof(sig), key) ==
+	    FIDO_ERR_INVALID_PARAM);
+
+	/* extensions: {"hmac-secret": h'00', "x": [1, {2: 3}]} */
+	memcpy(ext, authdata + 2, 37);
+	ext[32] |= CTAP_AUTHDATA_EXT_DATA;
+	memcpy(ext + 37, "\xa2\x6b" "hmac-secret" "\x41\x00"
+	    "\x61" "x" "\x82\x01\xa1\x02\x03" "\x00\x00\x00\x00\x00\x00", 27);
+	assert(fido_authdata_view_set(&view, ext, sizeof(ext)) == FIDO_OK);
+	assert(view.ext_ptr == ext + 37);
+	assert(view.ext_len == 22);
+	assert(view.ext == FIDO_EXT_HMAC_SECRET);
+	ext[37 + 13] = 0x01; /* hmac-secret as an integer */
+	assert(fido_authdata_view_set(&view, ext, sizeof(ext)) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	ext[37 + 13] = 0x41;
+	ext[37] = 0xa3; /* more entries than data */
+	assert(fido_authdata_view_set(&view, ext, 37 + 22) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	ext[37] = 0xbf; /* indefinite map */
+	assert(fido_authdata_view_set(&view, ext, sizeof(ext)) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	ext[37] = 0xa2;
+	ext[32] |= CTAP_AUTHDATA_ATT_CRED;
+	assert(fido_authdata_view_set(&view, ext, sizeof(ext)) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+
+	free_assert(a);
+	free_es256_pk(es256);
+	fido_verify_key_free(&key);
+}
+
+static void
+rp_verifier(void)
+{
+	fido_rp_verifier_t *v;
+	fido_verify_key_t *key;
+	es256_pk_t *es256;
+	fido_verify_cache_t *c;
+	const char *path = "regress_vcache";
+	unsigned char junk[sizeof(sig)];
+	unsigned char trail[38];
+	uint64_t hits, misses;
+	int r;
+
+	es256 = alloc_es256_pk();
+	key = fido_verify_key_new();
+	assert(key != NULL);
+	assert(es256_pk_from_ptr(es256, es256_pk, sizeof(es256_pk)) == FIDO_OK);
+	assert(fido_verify_key_from_pk(key, COSE_ES256, es256) == FIDO_OK);
+	v = fido_rp_verifier_new();
+	assert(v != NULL);
+
+	/* no rp */
+	assert(fido_rp_verifier_verify(v, authdata + 2, 37, cdh, sizeof(cdh),
+	    sig, sizeof(sig), key) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_rp_verifier_set_rp(v, NULL) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_rp_verifier_set_rp(v, "example.com") == FIDO_OK);
+	assert(fido_rp_verifier_verify(v, authdata + 2, 37, cdh, sizeof(cdh),
+	    sig, sizeof(sig), key) == FIDO_ERR_INVALID_PARAM);
+	assert(fido_rp_verifier_set_rp(v, "localhost") == FIDO_OK);
+	assert(fido_rp_verifier_verify(v, authdata + 2, 37, cdh, sizeof(cdh),
+	    sig, sizeof(sig), NULL) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_rp_verifier_verify(v, authdata + 2, 37, NULL, 0, sig,
+	    sizeof(sig), key) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_rp_verifier_verify(v, authdata + 2, 36, cdh, sizeof(cdh),
+	    sig, sizeof(sig), key) == FIDO_ERR_INVALID_ARGUMENT);
+
+	/* options and extensions */
+	assert(fido_rp_verifier_set_up(v, -1) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_rp_verifier_set_up(v, FIDO_OPT_TRUE) == FIDO_OK);
+	assert(fido_rp_verifier_verify(v, authdata + 2, 37, cdh, sizeof(cdh),
+	    sig, sizeof(sig), key) == FIDO_ERR_INVALID_PARAM);
+	assert(fido_rp_verifier_set_up(v, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_rp_verifier_set_uv(v, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_rp_verifier_set_extensions(v, -1) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_rp_verifier_set_extensions(v, FIDO_EXT_HMAC_SECRET) ==
+	    FIDO_OK);
+	assert(fido_rp_verifier_verify(v, authdata + 2, 37, cdh, sizeof(cdh),
+	    sig, sizeof(sig), key) == FIDO_ERR_INVALID_PARAM);
+	assert(fido_rp_verifier_set_extensions(v, 0) == FIDO_OK);
+	assert(fido_rp_verifier_verify(v, authdata + 2, 37, cdh, sizeof(cdh),
+	    sig, sizeof(sig), key) == FIDO_OK);
+	memcpy(junk, sig, sizeof(sig));
+	junk[sizeof(junk) - 1] ^= 0xff;
+	assert(fido_rp_verifier_verify(v, authdata + 2, 37, cdh, sizeof(cdh),
+	    junk, sizeof(junk), key) == FIDO_ERR_INVALID_SIG);
+
+	/* structure, without a key */
+	assert(fido_rp_verifier_precheck(v, authdata + 2, 37, sig,
+	    sizeof(sig), COSE_ES256) == FIDO_OK);
+	assert(fido_rp_verifier_precheck(v, authdata + 2, 37, junk,
+	    sizeof(junk), COSE_ES256) == FIDO_OK);
+	assert(fido_rp_verifier_precheck(v, authdata + 2, 37, NULL, 0,
+	    COSE_ES256) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_rp_verifier_precheck(v, authdata + 2, 36, sig,
+	    sizeof(sig), COSE_ES256) == FIDO_ERR_INVALID_ARGUMENT);
+	memcpy(trail, authdata + 2, 37);
+	trail[37] = 0;
+	assert(fido_rp_verifier_precheck(v, trail, sizeof(trail), sig,
+	    sizeof(sig), COSE_ES256) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_rp_verifier_verify(v, trail, sizeof(trail), cdh,
+	    sizeof(cdh), sig, sizeof(sig), key) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_rp_verifier_precheck(v, authdata + 2, 37, sig,
+	    sizeof(sig) - 1, COSE_ES256) == FIDO_ERR_INVALID_SIG);
+	assert(fido_rp_verifier_precheck(v, authdata + 2, 37, sig,
+	    sizeof(sig), COSE_ES384) == FIDO_OK);
+	assert(fido_rp_verifier_precheck(v, authdata + 2, 37, sig,
+	    sizeof(sig), COSE_EDDSA) == FIDO_ERR_INVALID_SIG);
+	assert(fido_rp_verifier_precheck(v, authdata + 2, 37, sig,
+	    sizeof(sig), COSE_RS256) == FIDO_ERR_INVALID_SIG);
+	junk[0] = 0x31;
+	assert(fido_rp_verifier_precheck(v, authdata + 2, 37, junk,
+	    sizeof(junk), COSE_ES256) == FIDO_ERR_INVALID_SIG);
+	assert(fido_rp_verifier_verify(v, authdata + 2, 37, cdh, sizeof(cdh),
+	    junk, sizeof(junk), key) == FIDO_ERR_INVALID_SIG);
+
+	/* algorithms */
+	assert(fido_rp_verifier_allow_type(v, -1) ==
+	    FIDO_ERR_UNSUPPORTED_OPTION);
+	assert(fido_rp_verifier_allow_type(v, COSE_EDDSA) == FIDO_OK);
+	assert(fido_rp_verifier_verify(v, authdata + 2, 37, cdh, sizeof(cdh),
+	    sig, sizeof(sig), key) == FIDO_ERR_UNSUPPORTED_ALGORITHM);
+	assert(fido_rp_verifier_precheck(v, authdata + 2, 37, sig,
+	    sizeof(sig), COSE_ES256) == FIDO_ERR_UNSUPPORTED_ALGORITHM);
+	assert(fido_rp_verifier_allow_type(v, COSE_ES256) == FIDO_OK);
+	assert(fido_rp_verifier_allow_type(v, COSE_ES256) == FIDO_OK);
+	assert(fido_rp_verifier_verify(v, authdata + 2, 37, cdh, sizeof(cdh),
+	    sig, sizeof(sig), key) == FIDO_OK);
+
+	/* cached results; the policy is still applied */
+	assert((c = fido_verify_cache_new()) != NULL);
+	assert(fido_verify_cache_alloc(c, 2, 1000) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_verify_cache_alloc(c, 12, 1000) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_verify_cache_alloc(c, 16, 0) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_verify_cache_alloc(c, 16, 60000) == FIDO_OK);
+	assert(fido_rp_verifier_set_cache(v, c) == FIDO_OK);
+	memcpy(junk, sig, sizeof(sig));
+	junk[sizeof(junk) - 1] ^= 0xff;
+	for (int i = 0; i < 2; i++) {
+		assert(fido_rp_verifier_verify(v, authdata + 2, 37, cdh,
+		    sizeof(cdh), sig, sizeof(sig), key) == FIDO_OK);
+		assert(fido_rp_verifier_verify(v, authdata + 2, 37, cdh,
+		    sizeof(cdh), junk, sizeof(junk), key) ==
+		    FIDO_ERR_INVALID_SIG);
+	}
+	fido_verify_cache_stats(c, &hits, &misses);
+	assert(hits == 2 && misses == 2);
+	assert(fido_rp_verifier_set_up(v, FIDO_OPT_TRUE) == FIDO_OK);
+	assert(fido_rp_verifier_verify(v, authdata + 2, 37, cdh, sizeof(cdh),
+	    sig, sizeof(sig), key) == FIDO_ERR_INVALID_PARAM);
+	assert(fido_rp_verifier_set_up(v, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_rp_verifier_set_cache(v, NULL) == FIDO_OK);
+	fido_verify_cache_free(&c);
+	assert(c == NULL);
+	fido_verify_cache_free(&c);
+
+	/* a result stored through one mapping is found through another */
+	assert((c = fido_verify_cache_new()) != NULL);
+	(void)remove(path);
+	r = fido_verify_cache_map(c, path, 0, 60000);
+	if (r != FIDO_ERR_UNSUPPORTED_OPTION) {
+		assert(r == FIDO_ERR_INVALID_ARGUMENT);
+		assert(fido_verify_cache_map(c, path, 12, 60000) ==
+		    FIDO_ERR_INVALID_ARGUMENT);
+		assert(fido_verify_cache_map(c, path, 16, 0) ==
+		    FIDO_ERR_INVALID_ARGUMENT);
+		assert(fido_verify_cache_map(c, path, 16, 60000) == FIDO_OK);
+		assert(fido_rp_verifier_set_cache(v, c) == FIDO_OK);
+		assert(fido_rp_verifier_verify(v, authdata + 2, 37, cdh,
+		    sizeof(cdh), sig, sizeof(sig), key) == FIDO_OK);
+		assert(fido_rp_verifier_set_cache(v, NULL) == FIDO_OK);
+		fido_verify_cache_free(&c);
+		assert((c = fido_verify_cache_new()) != NULL);
+		assert(fido_verify_cache_map(c, path, 32, 60000) ==
+		    FIDO_ERR_INVALID_ARGUMENT);
+		assert(fido_verify_cache_map(c, path, 0, 60000) == FIDO_OK);
+		assert(fido_rp_verifier_set_cache(v, c) == FIDO_OK);
+		assert(fido_rp_verifier_verify(v, authdata + 2, 37, cdh,
+		    sizeof(cdh), sig, sizeof(sig), key) == FIDO_OK);
+		fido_verify_cache_stats(c, &hits, &misses);
+		assert(hits == 1 && misses == 0);
+		assert(fido_rp_verifier_set_cache(v, NULL) == FIDO_OK);
+		assert(remove(path) == 0);
+	}
+	fido_verify_cache_free(&c);
+	assert(fido_rp_verifier_verify(v, authdata + 2, 37, cdh, sizeof(cdh),
+	    sig, sizeof(sig), key) == FIDO_OK);
+
+	fido_rp_verifier_free(&v);
+	assert(v == NULL);
+	fido_rp_verifier_free(&v);
+	fido_rp_verifier_free(NULL);
+	fido_verify_key_free(&key);
+	free_es256_pk(es256);
+}
+
+static void
+webauthn_json(void)
+{
+	static const char json[] =
+	    "{\"id\":\"AQ\",\"rawId\":\"AQ\",\"type\":\"public-key\","
+	    " \"response\": {\"clientDataJSON\":\"" WEBAUTHN_CD "\","
+	    "\"authenticatorData\":\"" WEBAUTHN_AUTHDATA "\","
+	    "\"signature\":\"" WEBAUTHN_SIG "\",\"userHandle\":null},"
+	    "\"authenticatorAttachment\":\"cross-platform\","
+	    "\"clientExtensionResults\":{\"x\":[1,-2.5e3,true,false,null,"
+	    "\"\\\"\",{\"response\":{}}]}}\n";
+	static const char *bad[] = {
+		"",
+		"{",
+		"[]",
+		"{}",
+		"{\"response\":{\"clientDataJSON\":\"" WEBAUTHN_CD "\","
+		    "\"authenticatorData\":\"" WEBAUTHN_AUTHDATA "\"}}",
+		"{\"response\":{\"clientDataJSON\":\"" WEBAUTHN_CD "\","
+		    "\"authenticatorData\":\"" WEBAUTHN_AUTHDATA "\","
+		    "\"signature\":\"" WEBAUTHN_SIG "\"}} x",
+		"{\"response\":{\"clientDataJSON\":\"" WEBAUTHN_CD "\","
+		    "\"authenticatorData\":\"" WEBAUTHN_AUTHDATA "\","
+		    "\"signature\":\"" WEBAUTHN_SIG "\","
+		    "\"signature\":\"" WEBAUTHN_SIG "\"}}",
+		"{\"type\":\"password\",\"response\":{"
+		    "\"clientDataJSON\":\"" WEBAUTHN_CD "\","
+		    "\"authenticatorData\":\"" WEBAUTHN_AUTHDATA "\","
+		    "\"signature\":\"" WEBAUTHN_SIG "\"}}",
+		"{\"response\":{\"clientDataJSON\":\"" WEBAUTHN_CD "\","
+		    "\"authenticatorData\":\"" WEBAUTHN_AUTHDATA "\","
+		    "\"signature\":\"MEYC*QD2\"}}",
+		"{\"response\":{\"clientDataJSON\":\"" WEBAUTHN_CD "\","
+		    "\"authenticatorData\":\"SZYN5Yg\","
+		    "\"signature\":\"" WEBAUTHN_SIG "\"}}",
+		"{\"response\":{\"clientDataJSON\":\"" WEBAUTHN_CD "\","
+		    "\"authenticatorData\":\"" WEBAUTHN_AUTHDATA "\","
+		    "\"signature\":\"" WEBAUTHN_SIG "\"},"
+		    "\"x\":[[[[[[[[[[[[[[[[[[1]]]]]]]]]]]]]]]]]}",
+	};
+	fido_assert_t *a;
+	es256_pk_t *pk;
+
+	a = alloc_assert();
+	pk = alloc_es256_pk();
+	assert(es256_pk_from_ptr(pk, es256_pk, sizeof(es256_pk)) == FIDO_OK);
+
+	for (size_t i = 0; i < nitems(bad); i++) {
+		assert(fido_assert_from_webauthn_json(a, bad[i],
+		    strlen(bad[i])) == FIDO_ERR_INVALID_ARGUMENT);
+		assert(fido_assert_count(a) == 0);
+	}
+	assert(fido_assert_from_webauthn_json(a, json, strlen(json) - 2) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+
+	/* twice: the second replaces the first */
+	for (int i = 0; i < 2; i++) {
+		assert(fido_assert_from_webauthn_json(a, json,
+		    strlen(json)) == FIDO_OK);
+		assert(fido_assert_count(a) == 1);
+		assert(fido_assert_authdata_len(a, 0) == sizeof(authdata));
+		assert(memcmp(fido_assert_authdata_ptr(a, 0), authdata,
+		    sizeof(authdata)) == 0);
+		assert(fido_assert_sig_len(a, 0) == sizeof(sig));
+		assert(memcmp(fido_assert_sig_ptr(a, 0), sig,
+		    sizeof(sig)) == 0);
+		assert(fido_assert_clientdata_hash_len(a) ==
+		    sizeof(webauthn_cdh));
+		assert(memcmp(fido_assert_clientdata_hash_ptr(a),
+		    webauthn_cdh, sizeof(webauthn_cdh)) == 0);
+		assert(fido_assert_id_len(a, 0) == 1);
+		assert(fido_assert_id_ptr(a, 0)[0] == 0x01);
+		assert(fido_assert_user_id_len(a, 0) == 0);
+		assert(fido_assert_sigcount(a, 0) == 3);
+	}
+
+	/* sig was made over a different cdh */
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_assert_verify(a, 0, COSE_ES256, pk) ==
+	    FIDO_ERR_INVALID_SIG);
+	assert(fido_assert_set_clientdata_hash(a, cdh, sizeof(cdh)) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	free_assert(a);
+
+	/* not into an assertion of more than one statement */
+	a = alloc_assert();
+	assert(fido_assert_set_count(a, 2) == FIDO_OK);
+	assert(fido_assert_from_webauthn_json(a, json, strlen(json)) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	free_assert(a);
+
+	free_es256_pk(pk);
+}
+
 static void
 no_cdh(void)
 {
@@ -573,6 +1224,45 @@ bad_cbor_serialize(void)
 	free_assert(a);
 }
 
+/* values set over one another, as when an assertion is reused */
+static void
+reuse_assert(void)
+{
+	fido_assert_t *a;
+	es256_pk_t *es256;
+
+	a = alloc_assert();
+	es256 = alloc_es256_pk();
+	assert(es256_pk_from_ptr(es256, es256_pk, sizeof(es256_pk)) == FIDO_OK);
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_assert_set_count(a, 1) == FIDO_OK);
+	assert(fido_assert_set_up(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_uv(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_clientdata_hash(a, sig, sizeof(sig)) == FIDO_OK);
+	assert(fido_assert_set_clientdata_hash(a, cdh, 16) == FIDO_OK);
+	assert(fido_assert_clientdata_hash_len(a) == 16);
+	assert(memcmp(fido_assert_clientdata_hash_ptr(a), cdh, 16) == 0);
+	assert(fido_assert_set_clientdata_hash(a, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_assert_clientdata_hash_len(a) == sizeof(cdh));
+	assert(memcmp(fido_assert_clientdata_hash_ptr(a), cdh,
+	    sizeof(cdh)) == 0);
+	assert(fido_assert_set_authdata(a, 0, authdata,
+	    sizeof(authdata)) == FIDO_OK);
+	assert(fido_assert_set_sig(a, 0, sig, sizeof(sig)) == FIDO_OK);
+	assert(fido_assert_verify(a, 0, COSE_ES256, es256) == FIDO_OK);
+	assert(fido_assert_set_sig(a, 0, sig, sizeof(sig) - 1) == FIDO_OK);
+	assert(fido_assert_verify(a, 0, COSE_ES256,
+	    es256) == FIDO_ERR_INVALID_SIG);
+	assert(fido_assert_set_sig(a, 0, sig, sizeof(sig)) == FIDO_OK);
+	assert(fido_assert_verify(a, 0, COSE_ES256, es256) == FIDO_OK);
+	assert(fido_assert_set_clientdata_hash(a, NULL, 0) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_clientdata_hash_ptr(a) == NULL);
+	assert(fido_assert_clientdata_hash_len(a) == 0);
+	free_assert(a);
+	free_es256_pk(es256);
+}
+
 /* rs256 <-> EVP_PKEY transformations */
 static void
 rs256_PKEY(void)
@@ -613,6 +1303,177 @@ es256_PKEY(void)
 	EVP_PKEY_free(pkey);
 }
 
+static void
+libctx(void)
+{
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+	OSSL_LIB_CTX *ctx;
+	fido_assert_t *a;
+	es256_pk_t *es256;
+
+	assert((ctx = OSSL_LIB_CTX_new()) != NULL);
+	assert(fido_set_libctx(ctx, NULL) == FIDO_OK);
+	valid_assert();
+
+	/* no provider matches, so nothing verifies */
+	assert(fido_set_libctx(ctx, "provider=none") == FIDO_OK);
+	a = alloc_assert();
+	es256 = alloc_es256_pk();
+	assert(es256_pk_from_ptr(es256, es256_pk, sizeof(es256_pk)) == FIDO_OK);
+	assert(fido_assert_set_clientdata_hash(a, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_assert_set_count(a, 1) == FIDO_OK);
+	assert(fido_assert_set_authdata(a, 0, authdata,
+	    sizeof(authdata)) == FIDO_OK);
+	assert(fido_assert_set_up(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_uv(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_assert_set_sig(a, 0, sig, sizeof(sig)) == FIDO_OK);
+	assert(fido_assert_verify(a, 0, COSE_ES256, es256) != FIDO_OK);
+	free_assert(a);
+	free_es256_pk(es256);
+
+	assert(fido_set_libctx(NULL, NULL) == FIDO_OK);
+	OSSL_LIB_CTX_free(ctx);
+	valid_assert();
+#else
+	assert(fido_set_libctx(NULL, "provider=none") ==
+	    FIDO_ERR_UNSUPPORTED_OPTION);
+	assert(fido_set_libctx(NULL, NULL) == FIDO_OK);
+#endif
+}
+
+static void
+sigcount(void)
+{
+	fido_sigcount_table_t *t;
+	const char *path = "regress_sigcount";
+	unsigned char id[16];
+	uint32_t n;
+	int r;
+
+	memset(id, 0, sizeof(id));
+	t = fido_sigcount_table_new();
+	assert(t != NULL);
+	assert(fido_sigcount_table_advance(t, id, sizeof(id), 1) ==
+	    FIDO_ERR_INTERNAL);
+	assert(fido_sigcount_table_alloc(t, 3) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_sigcount_table_alloc(t, 2) == FIDO_OK);
+	assert(fido_sigcount_table_get(t, id, sizeof(id), &n) ==
+	    FIDO_ERR_NOTFOUND);
+	assert(fido_sigcount_table_advance(t, NULL, sizeof(id), 1) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	/* authenticators without a counter always return zero */
+	assert(fido_sigcount_table_advance(t, id, sizeof(id), 0) == FIDO_OK);
+	assert(fido_sigcount_table_advance(t, id, sizeof(id), 0) == FIDO_OK);
+	assert(fido_sigcount_table_advance(t, id, sizeof(id), 7) == FIDO_OK);
+	assert(fido_sigcount_table_advance(t, id, sizeof(id), 7) ==
+	    FIDO_ERR_SIGCOUNT);
+	assert(fido_sigcount_table_advance(t, id, sizeof(id), 0) ==
+	    FIDO_ERR_SIGCOUNT);
+	assert(fido_sigcount_table_get(t, id, sizeof(id), &n) == FIDO_OK);
+	assert(n == 7);
+	id[0] = 1;
+	assert(fido_sigcount_table_advance(t, id, sizeof(id), 1) == FIDO_OK);
+	id[0] = 2;
+	assert(fido_sigcount_table_advance(t, id, sizeof(id), 1) ==
+	    FIDO_ERR_INTERNAL);
+
+	(void)remove(path);
+	r = fido_sigcount_table_map(t, path, 0);
+	if (r == FIDO_ERR_UNSUPPORTED_OPTION) {
+		fido_sigcount_table_free(&t);
+		return;
+	}
+	assert(r == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_sigcount_table_map(t, path, 64) == FIDO_OK);
+	assert(fido_sigcount_table_advance(t, id, sizeof(id), 9) == FIDO_OK);
+	fido_sigcount_table_free(&t);
+	t = fido_sigcount_table_new();
+	assert(t != NULL);
+	assert(fido_sigcount_table_map(t, path, 128) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_sigcount_table_map(t, path, 0) == FIDO_OK);
+	assert(fido_sigcount_table_get(t, id, sizeof(id), &n) == FIDO_OK);
+	assert(n == 9);
+	assert(fido_sigcount_table_advance(t, id, sizeof(id), 8) ==
+	    FIDO_ERR_SIGCOUNT);
+	fido_sigcount_table_free(&t);
+	assert(remove(path) == 0);
+}
+
+static void
+clientdata_checked(void)
+{
+	static const unsigned char chal[] = { 0x00, 0x01, 0x02, 0x03, 0x04 };
+	static const char get[] = "{\"type\":\"webauthn.get\","
+	    "\"challenge\":\"AAECAwQ\",\"origin\":\"https://example.com\","
+	    "\"crossOrigin\":false,\"extra\":[\"\\\"quoted\\\"\",{}]}";
+	static const char cross[] = "{\"type\":\"webauthn.get\","
+	    "\"challenge\":\"AAECAwQ\",\"origin\":\"https://example.com\","
+	    "\"crossOrigin\":true}";
+	static const char create[] = "{\"type\":\"webauthn.create\","
+	    "\"challenge\":\"AAECAwQ\",\"origin\":\"https://example.com\"}";
+	static const char *bad[] = {
+		"{\"type\":\"webauthn.get\",\"challenge\":\"AAECAwU\","
+		    "\"origin\":\"https://example.com\"}",
+		"{\"type\":\"webauthn.get\",\"challenge\":\"AAECAw\","
+		    "\"origin\":\"https://example.com\"}",
+		"{\"type\":\"webauthn.get\",\"challenge\":\"AAECAwQ\","
+		    "\"origin\":\"https://example.org\"}",
+		"{\"type\":\"webauthn.get\",\"challenge\":\"AAECAwQ\"}",
+		"{\"type\":\"webauthn.get\",\"challenge\":\"AAECAwQ\","
+		    "\"origin\":\"https://example.com\",\"origin\":\"x\"}",
+		"{\"type\":\"webauthn.get\",\"challenge\":\"AAECAwQ\","
+		    "\"origin\":\"https:\\/\\/example.com\"}",
+		"{\"type\":\"webauthn.get\",\"challenge\":\"AAECAwQ\","
+		    "\"origin\":\"https://example.com\"",
+		create,
+		cross,
+	};
+	fido_assert_t	*a, *b;
+	fido_cred_t	*c;
+
+	a = alloc_assert();
+	b = alloc_assert();
+	assert(fido_assert_set_clientdata_checked(a, (const u_char *)get,
+	    strlen(get), chal, sizeof(chal), "https://example.com", 0x80) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++)
+		assert(fido_assert_set_clientdata_checked(a,
+		    (const u_char *)bad[i], strlen(bad[i]), chal, sizeof(chal),
+		    "https://example.com", 0) == FIDO_ERR_CLIENTDATA);
+	assert(fido_assert_clientdata_hash_len(a) == 0);
+	/* the same hash as the unchecked setter */
+	assert(fido_assert_set_clientdata_checked(a, (const u_char *)get,
+	    strlen(get), chal, sizeof(chal), "https://example.com", 0) ==
+	    FIDO_OK);
+	assert(fido_assert_set_clientdata(b, (const u_char *)get,
+	    strlen(get)) == FIDO_OK);
+	assert(fido_assert_clientdata_hash_len(a) ==
+	    fido_assert_clientdata_hash_len(b));
+	assert(memcmp(fido_assert_clientdata_hash_ptr(a),
+	    fido_assert_clientdata_hash_ptr(b),
+	    fido_assert_clientdata_hash_len(b)) == 0);
+	free_assert(a);
+	free_assert(b);
+
+	a = alloc_assert();
+	assert(fido_assert_set_clientdata_checked(a, (const u_char *)cross,
+	    strlen(cross), chal, sizeof(chal), "https://example.com",
+	    FIDO_CLIENTDATA_CROSS_ORIGIN) == FIDO_OK);
+	free_assert(a);
+
+	assert((c = fido_cred_new()) != NULL);
+	assert(fido_cred_set_clientdata_checked(c, (const u_char *)get,
+	    strlen(get), chal, sizeof(chal), "https://example.com", 0) ==
+	    FIDO_ERR_CLIENTDATA);
+	assert(fido_cred_set_clientdata_checked(c, (const u_char *)create,
+	    strlen(create), chal, sizeof(chal), "https://example.com", 0) ==
+	    FIDO_OK);
+	assert(fido_cred_clientdata_hash_len(c) == 32);
+	fido_cred_free(&c);
+}
+
 int
 main(void)
 {
@@ -620,6 +1481,13 @@ main(void)
 
 	empty_assert_tests();
 	valid_assert();
+	borrow_take();
+	batch_assert();
+	verify_key();
+	verifier();
+	authdata_view();
+	rp_verifier();
+	webauthn_json();
 	no_cdh();
 	no_rp();
 	no_authdata();
@@ -630,8 +1498,12 @@ main(void)
 	junk_sig();
 	wrong_options();
 	bad_cbor_serialize();
+	reuse_assert();
 	rs256_PKEY();
 	es256_PKEY();
+	libctx();
+	sigcount();
+	clientdata_checked();
 
 	exit(0);
 }
@@ -0,0 +1,1337 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+#include <openssl/x509.h>
+
+#define _FIDO_INTERNAL
+
+#include <fido.h>
+#include <fido/es256.h>
+#include <fido/es384.h>
+#include <fido/rs256.h>
+#include <fido/verify.h>
+#include <fido/eddsa.h>
+
+#include "../fuzz/wiredata_fido2.h"
+
+/*
+ * Microbenchmarks for libfido2's hot paths. Each benchmark runs its loop
+ * with a growing number of iterations until one run takes at least the
+ * minimum time (-m, in milliseconds), and reports the time per iteration
+ * of that run. With -m 0, each loop runs once, which is how ctest uses it.
+ *
+ * usage: regress_bench [-m min_ms] [prefix ...]
+ */
+
+#define BENCH_MIN_MS	500
+#define BENCH_MAX_ITER	100000000
+#define HID_MAXMSG	2048
+#define COMPRESS_LEN	16384
+
+struct bench {
+	const char	*name;
+	int		 param;
+	void		*(*setup)(int);
+	void		 (*run)(void *, size_t);
+	void		 (*teardown)(void *);
+};
+
+enum {
+	CRED_PACKED,
+	CRED_PACKED_CACHED,
+	CRED_U2F,
+	CRED_TPM,
+};
+
+enum {
+	REPLY_INFO,
+	REPLY_ASSERT,
+	REPLY_CRED,
+};
+
+struct assert_bench {
+	fido_assert_t	*assert;
+	int		 cose_alg;
+	void		*pk;
+};
+
+struct blob_bench {
+	fido_blob_t	 in;
+	fido_blob_t	 out;
+};
+
+struct hid_bench {
+	fido_dev_t	*dev;
+	unsigned char	 msg[HID_MAXMSG];
+	size_t		 len;
+};
+
+/* the in-memory authenticator behind struct hid_bench */
+struct hid {
+	unsigned char	 cid[4];
+	unsigned char	 req[HID_MAXMSG];
+	size_t		 req_len;
+	size_t		 req_got;
+	uint8_t		 req_cmd;
+	unsigned char	 rep[HID_MAXMSG];
+	size_t		 rep_len;
+	size_t		 rep_off;
+	uint8_t		 rep_cmd;
+	uint8_t		 rep_seq;
+};
+
+static struct hid hid;
+
+static const char rp_id[] = "localhost";
+
+static const unsigned char wire_info[] = { WIREDATA_CTAP_CBOR_INFO };
+static const unsigned char wire_assert[] = { WIREDATA_CTAP_CBOR_ASSERT };
+static const unsigned char wire_cred[] = { WIREDATA_CTAP_CBOR_CRED };
+
+static const unsigned char cdh[32] = {
+	0xf9, 0x64, 0x57, 0xe7, 0x2d, 0x97, 0xf6, 0xbb,
+	0xdd, 0xd7, 0xfb, 0x06, 0x37, 0x62, 0xea, 0x26,
+	0x20, 0x44, 0x8e, 0x69, 0x7c, 0x03, 0xf2, 0x31,
+	0x2f, 0x99, 0xdc, 0xaf, 0x3e, 0x8a, 0x91, 0x6b,
+};
+
+
+static const unsigned char authdata_tpm_es256[166] = {
+	0x58, 0xa4, 0x49, 0x96, 0x0d, 0xe5, 0x88, 0x0e,
+	0x8c, 0x68, 0x74, 0x34, 0x17, 0x0f, 0x64, 0x76,
+	0x60, 0x5b, 0x8f, 0xe4, 0xae, 0xb9, 0xa2, 0x86,
+	0x32, 0xc7, 0x99, 0x5c, 0xf3, 0xba, 0x83, 0x1d,
+	0x97, 0x63, 0x45, 0x00, 0x00, 0x00, 0x00, 0x08,
+	0x98, 0x70, 0x58, 0xca, 0xdc, 0x4b, 0x81, 0xb6,
+	0xe1, 0x30, 0xde, 0x50, 0xdc, 0xbe, 0x96, 0x00,
+	0x20, 0xa8, 0xdf, 0x03, 0xf7, 0xbf, 0x39, 0x51,
+	0x94, 0x95, 0x8f, 0xa4, 0x84, 0x97, 0x30, 0xbc,
+	0x3c, 0x7e, 0x1c, 0x99, 0x91, 0x4d, 0xae, 0x6d,
+	0xfb, 0xdf, 0x53, 0xb5, 0xb6, 0x1f, 0x3a, 0x4e,
+	0x6a, 0xa5, 0x01, 0x02, 0x03, 0x26, 0x20, 0x01,
+	0x21, 0x58, 0x20, 0xfb, 0xd6, 0xba, 0x74, 0xe6,
+	0x6e, 0x5c, 0x87, 0xef, 0x89, 0xa2, 0xe8, 0x3d,
+	0x0b, 0xe9, 0x69, 0x2c, 0x07, 0x07, 0x7a, 0x8a,
+	0x1e, 0xce, 0x12, 0xea, 0x3b, 0xb3, 0xf1, 0xf3,
+	0xd9, 0xc3, 0xe6, 0x22, 0x58, 0x20, 0x3c, 0x68,
+	0x51, 0x94, 0x54, 0x8d, 0xeb, 0x9f, 0xb2, 0x2c,
+	0x66, 0x75, 0xb6, 0xb7, 0x55, 0x22, 0x0d, 0x87,
+	0x59, 0xc4, 0x39, 0x91, 0x62, 0x17, 0xc2, 0xc3,
+	0x53, 0xa5, 0x26, 0x97, 0x4f, 0x2d
+};
+
+static const unsigned char attstmt_tpm_es256[3841] = {
+	0xa6, 0x63, 0x61, 0x6c, 0x67, 0x39, 0xff, 0xfe,
+	0x63, 0x73, 0x69, 0x67, 0x59, 0x01, 0x00, 0x6d,
+	0x11, 0x61, 0x1f, 0x45, 0xb9, 0x7f, 0x65, 0x6f,
+	0x97, 0x46, 0xfe, 0xbb, 0x8a, 0x98, 0x07, 0xa3,
+	0xbc, 0x67, 0x5c, 0xd7, 0x65, 0xa4, 0xf4, 0x6c,
+	0x5b, 0x37, 0x75, 0xa4, 0x7f, 0x08, 0x52, 0xeb,
+	0x1e, 0x12, 0xe2, 0x78, 0x8c, 0x7d, 0x94, 0xab,
+	0x7b, 0xed, 0x05, 0x17, 0x67, 0x7e, 0xaa, 0x02,
+	0x89, 0x6d, 0xe8, 0x6d, 0x43, 0x30, 0x99, 0xc6,
+	0xf9, 0x59, 0xe5, 0x82, 0x3c, 0x56, 0x4e, 0x77,
+	0x11, 0x25, 0xe4, 0x43, 0x6a, 0xae, 0x92, 0x4f,
+	0x60, 0x92, 0x50, 0xf9, 0x65, 0x0e, 0x44, 0x38,
+	0x3d, 0xf7, 0xaf, 0x66, 0x89, 0xc7, 0xe6, 0xe6,
+	0x01, 0x07, 0x9e, 0x90, 0xfd, 0x6d, 0xaa, 0x35,
+	0x51, 0x51, 0xbf, 0x54, 0x13, 0x95, 0xc2, 0x17,
+	0xfa, 0x32, 0x0f, 0xa7, 0x82, 0x17, 0x58, 0x6c,
+	0x3d, 0xea, 0x88, 0xd8, 0x64, 0xc7, 0xf8, 0xc2,
+	0xd6, 0x1c, 0xbb, 0xea, 0x1e, 0xb3, 0xd9, 0x4c,
+	0xa7, 0xce, 0x18, 0x1e, 0xcb, 0x42, 0x5f, 0xbf,
+	0x44, 0xe7, 0xf1, 0x22, 0xe0, 0x5b, 0xeb, 0xff,
+	0xb6, 0x1e, 0x6f, 0x60, 0x12, 0x16, 0x63, 0xfe,
+	0xab, 0x5e, 0x31, 0x13, 0xdb, 0x72, 0xc6, 0x9a,
+	0xf8, 0x8f, 0x19, 0x6b, 0x2e, 0xaf, 0x7d, 0xca,
+	0x9f, 0xbc, 0x6b, 0x1a, 0x8b, 0x5e, 0xe3, 0x9e,
+	0xaa, 0x8c, 0x79, 0x9c, 0x4e, 0xed, 0xe4, 0xff,
+	0x3d, 0x12, 0x79, 0x90, 0x09, 0x61, 0x97, 0x67,
+	0xbf, 0x04, 0xac, 0x37, 0xea, 0xa9, 0x1f, 0x9f,
+	0x52, 0x64, 0x0b, 0xeb, 0xc3, 0x61, 0xd4, 0x13,
+	0xb0, 0x84, 0xf1, 0x3c, 0x74, 0x83, 0xcc, 0xa8,
+	0x1c, 0x14, 0xe6, 0x9d, 0xfe, 0xec, 0xee, 0xa1,
+	0xd2, 0xc2, 0x0a, 0xa6, 0x36, 0x08, 0xbb, 0x17,
+	0xa5, 0x7b, 0x53, 0x34, 0x0e, 0xc9, 0x09, 0xe5,
+	0x10, 0xa6, 0x85, 0x01, 0x71, 0x66, 0xff, 0xd0,
+	0x6d, 0x4b, 0x93, 0xdb, 0x81, 0x25, 0x01, 0x63,
+	0x76, 0x65, 0x72, 0x63, 0x32, 0x2e, 0x30, 0x63,
+	0x78, 0x35, 0x63, 0x82, 0x59, 0x05, 0xc4, 0x30,
+	0x82, 0x05, 0xc0, 0x30, 0x82, 0x03, 0xa8, 0xa0,
+	0x03, 0x02, 0x01, 0x02, 0x02, 0x10, 0x30, 0xcd,
+	0xf2, 0x7e, 0x81, 0xc0, 0x43, 0x85, 0xa2, 0xd7,
+	0x29, 0xef, 0xf7, 0x9f, 0xa5, 0x2b, 0x30, 0x0d,
+	0x06, 0x09, 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d,
+	0x01, 0x01, 0x0b, 0x05, 0x00, 0x30, 0x41, 0x31,
+	0x3f, 0x30, 0x3d, 0x06, 0x03, 0x55, 0x04, 0x03,
+	0x13, 0x36, 0x45, 0x55, 0x53, 0x2d, 0x53, 0x54,
+	0x4d, 0x2d, 0x4b, 0x45, 0x59, 0x49, 0x44, 0x2d,
+	0x31, 0x41, 0x44, 0x42, 0x39, 0x39, 0x34, 0x41,
+	0x42, 0x35, 0x38, 0x42, 0x45, 0x35, 0x37, 0x41,
+	0x30, 0x43, 0x43, 0x39, 0x42, 0x39, 0x30, 0x30,
+	0x45, 0x37, 0x38, 0x35, 0x31, 0x45, 0x31, 0x41,
+	0x34, 0x33, 0x43, 0x30, 0x38, 0x36, 0x36, 0x30,
+	0x30, 0x1e, 0x17, 0x0d, 0x32, 0x31, 0x31, 0x31,
+	0x30, 0x32, 0x31, 0x35, 0x30, 0x36, 0x35, 0x33,
+	0x5a, 0x17, 0x0d, 0x32, 0x37, 0x30, 0x36, 0x30,
+	0x33, 0x31, 0x39, 0x34, 0x30, 0x31, 0x36, 0x5a,
+	0x30, 0x00, 0x30, 0x82, 0x01, 0x22, 0x30, 0x0d,
+	0x06, 0x09, 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d,
+	0x01, 0x01, 0x01, 0x05, 0x00, 0x03, 0x82, 0x01,
+	0x0f, 0x00, 0x30, 0x82, 0x01, 0x0a, 0x02, 0x82,
+	0x01, 0x01, 0x00, 0xdb, 0xd5, 0x9a, 0xfc, 0x09,
+	0xa7, 0xc4, 0xa5, 0x5f, 0xbe, 0x5f, 0xa2, 0xeb,
+	0xd6, 0x8e, 0xed, 0xc5, 0x67, 0xa6, 0xa7, 0xd9,
+	0xb2, 0x46, 0xc6, 0xe0, 0xae, 0x0c, 0x02, 0x25,
+	0x0a, 0xf2, 0xc5, 0x96, 0xdc, 0xb7, 0x0e, 0xb9,
+	0x86, 0xd3, 0x51, 0xbb, 0x63, 0xf0, 0x4f, 0x8a,
+	0x5e, 0xd7, 0xf7, 0xff, 0xbb, 0x29, 0xbd, 0x58,
+	0xcf, 0x75, 0x02, 0x39, 0xcb, 0x80, 0xf1, 0xd4,
+	0xb6, 0x75, 0x67, 0x2f, 0x27, 0x4d, 0x0c, 0xcc,
+	0x18, 0x59, 0x87, 0xfa, 0x51, 0xd1, 0x80, 0xb5,
+	0x1a, 0xac, 0xac, 0x29, 0x51, 0xcf, 0x27, 0xaa,
+	0x74, 0xac, 0x3e, 0x59, 0x56, 0x67, 0xe4, 0x42,
+	0xe8, 0x30, 0x35, 0xb2, 0xf6, 0x27, 0x91, 0x62,
+	0x60, 0x42, 0x42, 0x12, 0xde, 0xfe, 0xdd, 0xee,
+	0xe8, 0xa8, 0x82, 0xf9, 0xb1, 0x08, 0xd5, 0x8d,
+	0x57, 0x9a, 0x29, 0xb9, 0xb4, 0xe9, 0x19, 0x1e,
+	0x33, 0x7d, 0x37, 0xa0, 0xce, 0x2e, 0x53, 0x13,
+	0x39, 0xb6, 0x12, 0x61, 0x63, 0xbf, 0xd3, 0x42,
+	0xeb, 0x6f, 0xed, 0xc1, 0x8e, 0x26, 0xba, 0x7d,
+	0x8b, 0x37, 0x7c, 0xbb, 0x42, 0x1e, 0x56, 0x76,
+	0xda, 0xdb, 0x35, 0x6b, 0x80, 0xe1, 0x8e, 0x00,
+	0xac, 0xd2, 0xfc, 0x22, 0x96, 0x14, 0x0c, 0xf4,
+	0xe4, 0xc5, 0xad, 0x14, 0xb7, 0x4d, 0x46, 0x63,
+	0x30, 0x79, 0x3a, 0x7c, 0x33, 0xb5, 0xe5, 0x2e,
+	0xbb, 0x5f, 0xca, 0xf2, 0x75, 0xe3, 0x4e, 0x99,
+	0x64, 0x1b, 0x26, 0x99, 0x60, 0x1a, 0x79, 0xcc,
+	0x30, 0x2c, 0xb3, 0x4c, 0x59, 0xf7, 0x77, 0x59,
+	0xd5, 0x90, 0x70, 0x21, 0x79, 0x8c, 0x1f, 0x79,
+	0x0a, 0x12, 0x8b, 0x3b, 0x37, 0x2d, 0x97, 0x39,
+	0x89, 0x92, 0x0c, 0x44, 0x7c, 0xe9, 0x9f, 0xce,
+	0x6d, 0xad, 0xc5, 0xae, 0xea, 0x8e, 0x50, 0x22,
+	0x37, 0xe0, 0xd1, 0x9e, 0xd6, 0xe6, 0xa8, 0xcc,
+	0x21, 0xfb, 0xff, 0x02, 0x03, 0x01, 0x00, 0x01,
+	0xa3, 0x82, 0x01, 0xf3, 0x30, 0x82, 0x01, 0xef,
+	0x30, 0x0e, 0x06, 0x03, 0x55, 0x1d, 0x0f, 0x01,
+	0x01, 0xff, 0x04, 0x04, 0x03, 0x02, 0x07, 0x80,
+	0x30, 0x0c, 0x06, 0x03, 0x55, 0x1d, 0x13, 0x01,
+	0x01, 0xff, 0x04, 0x02, 0x30, 0x00, 0x30, 0x6d,
+	0x06, 0x03, 0x55, 0x1d, 0x20, 0x01, 0x01, 0xff,
+	0x04, 0x63, 0x30, 0x61, 0x30, 0x5f, 0x06, 0x09,
+	0x2b, 0x06, 0x01, 0x04, 0x01, 0x82, 0x37, 0x15,
+	0x1f, 0x30, 0x52, 0x30, 0x50, 0x06, 0x08, 0x2b,
+	0x06, 0x01, 0x05, 0x05, 0x07, 0x02, 0x02, 0x30,
+	0x44, 0x1e, 0x42, 0x00, 0x54, 0x00, 0x43, 0x00,
+	0x50, 0x00, 0x41, 0x00, 0x20, 0x00, 0x20, 0x00,
+	0x54, 0x00, 0x72, 0x00, 0x75, 0x00, 0x73, 0x00,
+	0x74, 0x00, 0x65, 0x00, 0x64, 0x00, 0x20, 0x00,
+	0x20, 0x00, 0x50, 0x00, 0x6c, 0x00, 0x61, 0x00,
+	0x74, 0x00, 0x66, 0x00, 0x6f, 0x00, 0x72, 0x00,
+	0x6d, 0x00, 0x20, 0x00, 0x20, 0x00, 0x49, 0x00,
+	0x64, 0x00, 0x65, 0x00, 0x6e, 0x00, 0x74, 0x00,
+	0x69, 0x00, 0x74, 0x00, 0x79, 0x30, 0x10, 0x06,
+	0x03, 0x55, 0x1d, 0x25, 0x04, 0x09, 0x30, 0x07,
+	0x06, 0x05, 0x67, 0x81, 0x05, 0x08, 0x03, 0x30,
+	0x59, 0x06, 0x03, 0x55, 0x1d, 0x11, 0x01, 0x01,
+	0xff, 0x04, 0x4f, 0x30, 0x4d, 0xa4, 0x4b, 0x30,
+	0x49, 0x31, 0x16, 0x30, 0x14, 0x06, 0x05, 0x67,
+	0x81, 0x05, 0x02, 0x01, 0x0c, 0x0b, 0x69, 0x64,
+	0x3a, 0x35, 0x33, 0x35, 0x34, 0x34, 0x44, 0x32,
+	0x30, 0x31, 0x17, 0x30, 0x15, 0x06, 0x05, 0x67,
+	0x81, 0x05, 0x02, 0x02, 0x0c, 0x0c, 0x53, 0x54,
+	0x33, 0x33, 0x48, 0x54, 0x50, 0x48, 0x41, 0x48,
+	0x42, 0x34, 0x31, 0x16, 0x30, 0x14, 0x06, 0x05,
+	0x67, 0x81, 0x05, 0x02, 0x03, 0x0c, 0x0b, 0x69,
+	0x64, 0x3a, 0x30, 0x30, 0x34, 0x39, 0x30, 0x30,
+	0x30, 0x34, 0x30, 0x1f, 0x06, 0x03, 0x55, 0x1d,
+	0x23, 0x04, 0x18, 0x30, 0x16, 0x80, 0x14, 0x45,
+	0x1a, 0xec, 0xfc, 0x91, 0x70, 0xf8, 0x83, 0x8b,
+	0x9c, 0x47, 0x2f, 0x0b, 0x9f, 0x07, 0xf3, 0x2f,
+	0x7c, 0xa2, 0x8a, 0x30, 0x1d, 0x06, 0x03, 0x55,
+	0x1d, 0x0e, 0x04, 0x16, 0x04, 0x14, 0x55, 0xa6,
+	0xee, 0xe3, 0x28, 0xdd, 0x40, 0x7f, 0x21, 0xd2,
+	0x7b, 0x8c, 0x69, 0x2f, 0x8c, 0x08, 0x29, 0xbc,
+	0x95, 0xb8, 0x30, 0x81, 0xb2, 0x06, 0x08, 0x2b,
+	0x06, 0x01, 0x05, 0x05, 0x07, 0x01, 0x01, 0x04,
+	0x81, 0xa5, 0x30, 0x81, 0xa2, 0x30, 0x81, 0x9f,
+	0x06, 0x08, 0x2b, 0x06, 0x01, 0x05, 0x05, 0x07,
+	0x30, 0x02, 0x86, 0x81, 0x92, 0x68, 0x74, 0x74,
+	0x70, 0x3a, 0x2f, 0x2f, 0x61, 0x7a, 0x63, 0x73,
+	0x70, 0x72, 0x6f, 0x64, 0x65, 0x75, 0x73, 0x61,
+	0x69, 0x6b, 0x70, 0x75, 0x62, 0x6c, 0x69, 0x73,
+	0x68, 0x2e, 0x62, 0x6c, 0x6f, 0x62, 0x2e, 0x63,
+	0x6f, 0x72, 0x65, 0x2e, 0x77, 0x69, 0x6e, 0x64,
+	0x6f, 0x77, 0x73, 0x2e, 0x6e, 0x65, 0x74, 0x2f,
+	0x65, 0x75, 0x73, 0x2d, 0x73, 0x74, 0x6d, 0x2d,
+	0x6b, 0x65, 0x79, 0x69, 0x64, 0x2d, 0x31, 0x61,
+	0x64, 0x62, 0x39, 0x39, 0x34, 0x61, 0x62, 0x35,
+	0x38, 0x62, 0x65, 0x35, 0x37, 0x61, 0x30, 0x63,
+	0x63, 0x39, 0x62, 0x39, 0x30, 0x30, 0x65, 0x37,
+	0x38, 0x35, 0x31, 0x65, 0x31, 0x61, 0x34, 0x33,
+	0x63, 0x30, 0x38, 0x36, 0x36, 0x30, 0x2f, 0x62,
+	0x36, 0x63, 0x30, 0x64, 0x39, 0x38, 0x64, 0x2d,
+	0x35, 0x37, 0x38, 0x61, 0x2d, 0x34, 0x62, 0x66,
+	0x62, 0x2d, 0x61, 0x32, 0x64, 0x33, 0x2d, 0x65,
+	0x64, 0x66, 0x65, 0x35, 0x66, 0x38, 0x32, 0x30,
+	0x36, 0x30, 0x31, 0x2e, 0x63, 0x65, 0x72, 0x30,
+	0x0d, 0x06, 0x09, 0x2a, 0x86, 0x48, 0x86, 0xf7,
+	0x0d, 0x01, 0x01, 0x0b, 0x05, 0x00, 0x03, 0x82,
+	0x02, 0x01, 0x00, 0x2a, 0x08, 0x30, 0x1f, 0xfd,
+	0x8f, 0x80, 0x9b, 0x4b, 0x37, 0x82, 0x61, 0x86,
+	0x36, 0x57, 0x90, 0xb5, 0x1d, 0x1f, 0xa3, 0xae,
+	0x68, 0xac, 0xa7, 0x96, 0x6a, 0x25, 0x5e, 0xc5,
+	0x82, 0x7c, 0x36, 0x64, 0x58, 0x11, 0xcb, 0xa5,
+	0xee, 0xbf, 0xc4, 0xdb, 0xa0, 0xc7, 0x82, 0x3b,
+	0xa3, 0x85, 0x9b, 0xc4, 0xee, 0x07, 0x36, 0xd7,
+	0xc7, 0xb6, 0x23, 0xed, 0xc2, 0x73, 0xab, 0xbe,
+	0xbe, 0xee, 0x63, 0x17, 0xf9, 0xd7, 0x7a, 0x23,
+	0x7b, 0xf8, 0x09, 0x7a, 0xaa, 0x7f, 0x67, 0xc3,
+	0x04, 0x84, 0x71, 0x9b, 0x06, 0x9c, 0x07, 0x42,
+	0x4b, 0x65, 0x41, 0x56, 0x58, 0x14, 0x92, 0xb0,
+	0xb9, 0xaf, 0xa1, 0x39, 0xd4, 0x08, 0x2d, 0x71,
+	0xd5, 0x6c, 0x56, 0xb9, 0x2b, 0x1e, 0xf3, 0x93,
+	0xa5, 0xe9, 0xb2, 0x9b, 0x4d, 0x05, 0x2b, 0xbc,
+	0xd2, 0x20, 0x57, 0x3b, 0xa4, 0x01, 0x68, 0x8c,
+	0x23, 0x20, 0x7d, 0xbb, 0x71, 0xe4, 0x2a, 0x24,
+	0xba, 0x75, 0x0c, 0x89, 0x54, 0x22, 0xeb, 0x0e,
+	0xb2, 0xf4, 0xc2, 0x1f, 0x02, 0xb7, 0xe3, 0x06,
+	0x41, 0x15, 0x6b, 0xf3, 0xc8, 0x2d, 0x5b, 0xc2,
+	0x21, 0x82, 0x3e, 0xe8, 0x95, 0x40, 0x39, 0x9e,
+	0x91, 0x68, 0x33, 0x0c, 0x3d, 0x45, 0xef, 0x99,
+	0x79, 0xe6, 0x32, 0xc9, 0x00, 0x84, 0x36, 0xfb,
+	0x0a, 0x8d, 0x41, 0x1c, 0x32, 0x64, 0x06, 0x9e,
+	0x0f, 0xb5, 0x04, 0xcc, 0x08, 0xb1, 0xb6, 0x2b,
+	0xcf, 0x36, 0x0f, 0x73, 0x14, 0x8e, 0x25, 0x44,
+	0xb3, 0x0c, 0x34, 0x14, 0x96, 0x0c, 0x8a, 0x65,
+	0xa1, 0xde, 0x8e, 0xc8, 0x9d, 0xbe, 0x66, 0xdf,
+	0x06, 0x91, 0xca, 0x15, 0x0f, 0x92, 0xd5, 0x2a,
+	0x0b, 0xdc, 0x4c, 0x6a, 0xf3, 0x16, 0x4a, 0x3e,
+	0xb9, 0x76, 0xbc, 0xfe, 0x62, 0xd4, 0xa8, 0xcd,
+	0x94, 0x78, 0x0d, 0xdd, 0x94, 0xfd, 0x5e, 0x63,
+	0x57, 0x27, 0x05, 0x9c, 0xd0, 0x80, 0x91, 0x91,
+	0x79, 0xe8, 0x5e, 0x18, 0x64, 0x22, 0xe4, 0x2c,
+	0x13, 0x65, 0xa4, 0x51, 0x5a, 0x1e, 0x3b, 0x71,
+	0x2e, 0x70, 0x9f, 0xc4, 0xa5, 0x20, 0xcd, 0xef,
+	0xd8, 0x3f, 0xa4, 0xf5, 0x89, 0x8a, 0xa5, 0x4f,
+	0x76, 0x2d, 0x49, 0x56, 0x00, 0x8d, 0xde, 0x40,
+	0xba, 0x24, 0x46, 0x51, 0x38, 0xad, 0xdb, 0xc4,
+	0x04, 0xf4, 0x6e, 0xc0, 0x29, 0x48, 0x07, 0x6a,
+	0x1b, 0x26, 0x32, 0x0a, 0xfb, 0xea, 0x71, 0x2a,
+	0x11, 0xfc, 0x98, 0x7c, 0x44, 0x87, 0xbc, 0x06,
+	0x3a, 0x4d, 0xbd, 0x91, 0x63, 0x4f, 0x26, 0x48,
+	0x54, 0x47, 0x1b, 0xbd, 0xf0, 0xf1, 0x56, 0x05,
+	0xc5, 0x0f, 0x8f, 0x20, 0xa5, 0xcc, 0xfb, 0x76,
+	0xb0, 0xbd, 0x83, 0xde, 0x7f, 0x39, 0x4f, 0xcf,
+	0x61, 0x74, 0x52, 0xa7, 0x1d, 0xf6, 0xb5, 0x5e,
+	0x4a, 0x82, 0x20, 0xc1, 0x94, 0xaa, 0x2c, 0x33,
+	0xd6, 0x0a, 0xf9, 0x8f, 0x92, 0xc6, 0x29, 0x80,
+	0xf5, 0xa2, 0xb1, 0xff, 0xb6, 0x2b, 0xaa, 0x04,
+	0x00, 0x72, 0xb4, 0x12, 0xbb, 0xb1, 0xf1, 0x3c,
+	0x88, 0xa3, 0xab, 0x49, 0x17, 0x90, 0x80, 0x59,
+	0xa2, 0x96, 0x41, 0x69, 0x74, 0x33, 0x8a, 0x28,
+	0x33, 0x7e, 0xb3, 0x19, 0x92, 0x28, 0xc1, 0xf0,
+	0xd1, 0x82, 0xd5, 0x42, 0xff, 0xe7, 0xa5, 0x3f,
+	0x1e, 0xb6, 0x4a, 0x23, 0xcc, 0x6a, 0x7f, 0x15,
+	0x15, 0x52, 0x25, 0xb1, 0xca, 0x21, 0x95, 0x11,
+	0x53, 0x3e, 0x1f, 0x50, 0x33, 0x12, 0x7a, 0x62,
+	0xce, 0xcc, 0x71, 0xc2, 0x5f, 0x34, 0x47, 0xc6,
+	0x7c, 0x71, 0xfa, 0xa0, 0x54, 0x00, 0xb2, 0xdf,
+	0xc5, 0x54, 0xac, 0x6c, 0x53, 0xef, 0x64, 0x6b,
+	0x08, 0x82, 0xd8, 0x16, 0x1e, 0xca, 0x40, 0xf3,
+	0x1f, 0xdf, 0x56, 0x63, 0x10, 0xbc, 0xd7, 0xa0,
+	0xeb, 0xee, 0xd1, 0x95, 0xe5, 0xef, 0xf1, 0x6a,
+	0x83, 0x2d, 0x5a, 0x59, 0x06, 0xef, 0x30, 0x82,
+	0x06, 0xeb, 0x30, 0x82, 0x04, 0xd3, 0xa0, 0x03,
+	0x02, 0x01, 0x02, 0x02, 0x13, 0x33, 0x00, 0x00,
+	0x05, 0x23, 0xbf, 0xe8, 0xa1, 0x1a, 0x2a, 0x68,
+	0xbd, 0x09, 0x00, 0x00, 0x00, 0x00, 0x05, 0x23,
+	0x30, 0x0d, 0x06, 0x09, 0x2a, 0x86, 0x48, 0x86,
+	0xf7, 0x0d, 0x01, 0x01, 0x0b, 0x05, 0x00, 0x30,
+	0x81, 0x8c, 0x31, 0x0b, 0x30, 0x09, 0x06, 0x03,
+	0x55, 0x04, 0x06, 0x13, 0x02, 0x55, 0x53, 0x31,
+	0x13, 0x30, 0x11, 0x06, 0x03, 0x55, 0x04, 0x08,
+	0x13, 0x0a, 0x57, 0x61, 0x73, 0x68, 0x69, 0x6e,
+	0x67, 0x74, 0x6f, 0x6e, 0x31, 0x10, 0x30, 0x0e,
+	0x06, 0x03, 0x55, 0x04, 0x07, 0x13, 0x07, 0x52,
+	0x65, 0x64, 0x6d, 0x6f, 0x6e, 0x64, 0x31, 0x1e,
+	0x30, 0x1c, 0x06, 0x03, 0x55, 0x04, 0x0a, 0x13,
+	0x15, 0x4d, 0x69, 0x63, 0x72, 0x6f, 0x73, 0x6f,
+	0x66, 0x74, 0x20, 0x43, 0x6f, 0x72, 0x70, 0x6f,
+	0x72, 0x61, 0x74, 0x69, 0x6f, 0x6e, 0x31, 0x36,
+	0x30, 0x34, 0x06, 0x03, 0x55, 0x04, 0x03, 0x13,
+	0x2d, 0x4d, 0x69, 0x63, 0x72, 0x6f, 0x73, 0x6f,
+	0x66, 0x74, 0x20, 0x54, 0x50, 0x4d, 0x20, 0x52,
+	0x6f, 0x6f, 0x74, 0x20, 0x43, 0x65, 0x72, 0x74,
+	0x69, 0x66, 0x69, 0x63, 0x61, 0x74, 0x65, 0x20,
+	0x41, 0x75, 0x74, 0x68, 0x6f, 0x72, 0x69, 0x74,
+	0x79, 0x20, 0x32, 0x30, 0x31, 0x34, 0x30, 0x1e,
+	0x17, 0x0d, 0x32, 0x31, 0x30, 0x36, 0x30, 0x33,
+	0x31, 0x39, 0x34, 0x30, 0x31, 0x36, 0x5a, 0x17,
+	0x0d, 0x32, 0x37, 0x30, 0x36, 0x30, 0x33, 0x31,
+	0x39, 0x34, 0x30, 0x31, 0x36, 0x5a, 0x30, 0x41,
+	0x31, 0x3f, 0x30, 0x3d, 0x06, 0x03, 0x55, 0x04,
+	0x03, 0x13, 0x36, 0x45, 0x55, 0x53, 0x2d, 0x53,
+	0x54, 0x4d, 0x2d, 0x4b, 0x45, 0x59, 0x49, 0x44,
+	0x2d, 0x31, 0x41, 0x44, 0x42, 0x39, 0x39, 0x34,
+	0x41, 0x42, 0x35, 0x38, 0x42, 0x45, 0x35, 0x37,
+	0x41, 0x30, 0x43, 0x43, 0x39, 0x42, 0x39, 0x30,
+	0x30, 0x45, 0x37, 0x38, 0x35, 0x31, 0x45, 0x31,
+	0x41, 0x34, 0x33, 0x43, 0x30, 0x38, 0x36, 0x36,
+	0x30, 0x30, 0x82, 0x02, 0x22, 0x30, 0x0d, 0x06,
+	0x09, 0x2a, 0x86, 0x48, 0x86, 0xf7, 0x0d, 0x01,
+	0x01, 0x01, 0x05, 0x00, 0x03, 0x82, 0x02, 0x0f,
+	0x00, 0x30, 0x82, 0x02, 0x0a, 0x02, 0x82, 0x02,
+	0x01, 0x00, 0xdb, 0x03, 0x34, 0x82, 0xfa, 0x81,
+	0x1c, 0x84, 0x0b, 0xa0, 0x0e, 0x60, 0xd8, 0x9d,
+	0x84, 0xf4, 0x81, 0xc4, 0xe9, 0xff, 0xcf, 0xe9,
+	0xa3, 0x57, 0x53, 0x60, 0xa8, 0x19, 0xce, 0xbe,
+	0xe1, 0x97, 0xee, 0x5d, 0x8c, 0x9f, 0xe4, 0xbd,
+	0xef, 0xbd, 0x94, 0x14, 0xe4, 0x74, 0x41, 0x02,
+	0xe9, 0x03, 0x19, 0x9f, 0xdd, 0x48, 0x2d, 0xbd,
+	0xca, 0x26, 0x47, 0x2c, 0x01, 0x31, 0x5f, 0x34,
+	0xef, 0x59, 0x35, 0x48, 0x36, 0x3d, 0x1e, 0xdf,
+	0xd8, 0x13, 0xf0, 0xd0, 0x67, 0xc1, 0xb0, 0x47,
+	0x67, 0xa2, 0xd6, 0x62, 0xc8, 0xe1, 0x00, 0x36,
+	0x8b, 0x45, 0xf6, 0x3b, 0x96, 0x60, 0xa0, 0x45,
+	0x26, 0xcb, 0xc7, 0x0b, 0x5b, 0x97, 0xd1, 0xaf,
+	0x54, 0x25, 0x7a, 0x67, 0xe4, 0x2a, 0xd8, 0x9d,
+	0x53, 0x05, 0xbd, 0x12, 0xac, 0xa2, 0x8e, 0x95,
+	0xb4, 0x2a, 0xca, 0x89, 0x93, 0x64, 0x97, 0x25,
+	0xdc, 0x1f, 0xa9, 0xe0, 0x55, 0x07, 0x38, 0x1d,
+	0xee, 0x02, 0x90, 0x22, 0xf5, 0xad, 0x4e, 0x5c,
+	0xf8, 0xc5, 0x1f, 0x9e, 0x84, 0x7e, 0x13, 0x47,
+	0x52, 0xa2, 0x36, 0xf9, 0xf6, 0xbf, 0x76, 0x9e,
+	0x0f, 0xdd, 0x14, 0x99, 0xb9, 0xd8, 0x5a, 0x42,
+	0x3d, 0xd8, 0xbf, 0xdd, 0xb4, 0x9b, 0xbf, 0x6a,
+	0x9f, 0x89, 0x13, 0x75, 0xaf, 0x96, 0xd2, 0x72,
+	0xdf, 0xb3, 0x80, 0x6f, 0x84, 0x1a, 0x9d, 0x06,
+	0x55, 0x09, 0x29, 0xea, 0xa7, 0x05, 0x31, 0xec,
+	0x47, 0x3a, 0xcf, 0x3f, 0x9c, 0x2c, 0xbd, 0xd0,
+	0x7d, 0xe4, 0x75, 0x5b, 0x33, 0xbe, 0x12, 0x86,
+	0x09, 0xcf, 0x66, 0x9a, 0xeb, 0xf8, 0xf8, 0x72,
+	0x91, 0x88, 0x4a, 0x5e, 0x89, 0x62, 0x6a, 0x94,
+	0xdc, 0x48, 0x37, 0x13, 0xd8, 0x91, 0x02, 0xe3,
+	0x42, 0x41, 0x7c, 0x2f, 0xe3, 0xb6, 0x0f, 0xb4,
+	0x96, 0x06, 0x80, 0xca, 0x28, 0x01, 0x6f, 0x4b,
+	0xcd, 0x28, 0xd4, 0x2c, 0x94, 0x7e, 0x40, 0x7e,
+	0xdf, 0x01, 0xe5, 0xf2, 0x33, 0xd4, 0xda, 0xf4,
+	0x1a, 0x17, 0xf7, 0x5d, 0xcb, 0x66, 0x2c, 0x2a,
+	0xeb, 0xe1, 0xb1, 0x4a, 0xc3, 0x85, 0x63, 0xb2,
+	0xac, 0xd0, 0x3f, 0x1a, 0x8d, 0xa5, 0x0c, 0xee,
+	0x4f, 0xde, 0x74, 0x9c, 0xe0, 0x5a, 0x10, 0xc7,
+	0xb8, 0xe4, 0xec, 0xe7, 0x73, 0xa6, 0x41, 0x42,
+	0x37, 0xe1, 0xdf, 0xb9, 0xc7, 0xb5, 0x14, 0xa8,
+	0x80, 0x95, 0xa0, 0x12, 0x67, 0x99, 0xf5, 0xba,
+	0x25, 0x0a, 0x74, 0x86, 0x71, 0x9c, 0x7f, 0x59,
+	0x97, 0xd2, 0x3f, 0x10, 0xfe, 0x6a, 0xb9, 0xe4,
+	0x47, 0x36, 0xfb, 0x0f, 0x50, 0xee, 0xfc, 0x87,
+	0x99, 0x7e, 0x36, 0x64, 0x1b, 0xc7, 0x13, 0xb3,
+	0x33, 0x18, 0x71, 0xa4, 0xc3, 0xb0, 0xfc, 0x45,
+	0x37, 0x11, 0x40, 0xb3, 0xde, 0x2c, 0x9f, 0x0a,
+	0xcd, 0xaf, 0x5e, 0xfb, 0xd5, 0x9c, 0xea, 0xd7,
+	0x24, 0x19, 0x3a, 0x92, 0x80, 0xa5, 0x63, 0xc5,
+	0x3e, 0xdd, 0x51, 0xd0, 0x9f, 0xb8, 0x5e, 0xd5,
+	0xf1, 0xfe, 0xa5, 0x93, 0xfb, 0x7f, 0xd9, 0xb8,
+	0xb7, 0x0e, 0x0d, 0x12, 0x71, 0xf0, 0x52, 0x9d,
+	0xe9, 0xd0, 0xd2, 0x8b, 0x38, 0x8b, 0x85, 0x83,
+	0x98, 0x24, 0x88, 0xe8, 0x42, 0x30, 0x83, 0x12,
+	0xef, 0x09, 0x96, 0x2f, 0x21, 0x81, 0x05, 0x30,
+	0x0c, 0xbb, 0xba, 0x21, 0x39, 0x16, 0x12, 0xe8,
+	0x4b, 0x7b, 0x7a, 0x66, 0xb8, 0x22, 0x2c, 0x71,
+	0xaf, 0x59, 0xa1, 0xfc, 0x61, 0xf1, 0xb4, 0x5e,
+	0xfc, 0x43, 0x19, 0x45, 0x6e, 0xa3, 0x45, 0xe4,
+	0xcb, 0x66, 0x5f, 0xe0, 0x57, 0xf6, 0x0a, 0x30,
+	0xa3, 0xd6, 0x51, 0x24, 0xc9, 0x07, 0x55, 0x82,
+	0x4a, 0x66, 0x0e, 0x9d, 0xb2, 0x2f, 0x84, 0x56,
+	0x6c, 0x3e, 0x71, 0xef, 0x9b, 0x35, 0x4d, 0x72,
+	0xdc, 0x46, 0x2a, 0xe3, 0x7b, 0x13, 0x20, 0xbf,
+	0xab, 0x77, 0x02, 0x03, 0x01, 0x00, 0x01, 0xa3,
+	0x82, 0x01, 0x8e, 0x30, 0x82, 0x01, 0x8a, 0x30,
+	0x0e, 0x06, 0x03, 0x55, 0x1d, 0x0f, 0x01, 0x01,
+	0xff, 0x04, 0x04, 0x03, 0x02, 0x02, 0x84, 0x30,
+	0x1b, 0x06, 0x03, 0x55, 0x1d, 0x25, 0x04, 0x14,
+	0x30, 0x12, 0x06, 0x09, 0x2b, 0x06, 0x01, 0x04,
+	0x01, 0x82, 0x37, 0x15, 0x24, 0x06, 0x05, 0x67,
+	0x81, 0x05, 0x08, 0x03, 0x30, 0x16, 0x06, 0x03,
+	0x55, 0x1d, 0x20, 0x04, 0x0f, 0x30, 0x0d, 0x30,
+	0x0b, 0x06, 0x09, 0x2b, 0x06, 0x01, 0x04, 0x01,
+	0x82, 0x37, 0x15, 0x1f, 0x30, 0x12, 0x06, 0x03,
+	0x55, 0x1d, 0x13, 0x01, 0x01, 0xff, 0x04, 0x08,
+	0x30, 0x06, 0x01, 0x01, 0xff, 0x02, 0x01, 0x00,
+	0x30, 0x1d, 0x06, 0x03, 0x55, 0x1d, 0x0e, 0x04,
+	0x16, 0x04, 0x14, 0x45, 0x1a, 0xec, 0xfc, 0x91,
+	0x70, 0xf8, 0x83, 0x8b, 0x9c, 0x47, 0x2f, 0x0b,
+	0x9f, 0x07, 0xf3, 0x2f, 0x7c, 0xa2, 0x8a, 0x30,
+	0x1f, 0x06, 0x03, 0x55, 0x1d, 0x23, 0x04, 0x18,
+	0x30, 0x16, 0x80, 0x14, 0x7a, 0x8c, 0x0a, 0xce,
+	0x2f, 0x48, 0x62, 0x17, 0xe2, 0x94, 0xd1, 0xae,
+	0x55, 0xc1, 0x52, 0xec, 0x71, 0x74, 0xa4, 0x56,
+	0x30, 0x70, 0x06, 0x03, 0x55, 0x1d, 0x1f, 0x04,
+	0x69, 0x30, 0x67, 0x30, 0x65, 0xa0, 0x63, 0xa0,
+	0x61, 0x86, 0x5f, 0x68, 0x74, 0x74, 0x70, 0x3a,
+	0x2f, 0x2f, 0x77, 0x77, 0x77, 0x2e, 0x6d, 0x69,
+	0x63, 0x72, 0x6f, 0x73, 0x6f, 0x66, 0x74, 0x2e,
+	0x63, 0x6f, 0x6d, 0x2f, 0x70, 0x6b, 0x69, 0x6f,
+	0x70, 0x73, 0x2f, 0x63, 0x72, 0x6c, 0x2f, 0x4d,
+	0x69, 0x63, 0x72, 0x6f, 0x73, 0x6f, 0x66, 0x74,
+	0x25, 0x32, 0x30, 0x54, 0x50, 0x4d, 0x25, 0x32,
+	0x30, 0x52, 0x6f, 0x6f, 0x74, 0x25, 0x32, 0x30,
+	0x43, 0x65, 0x72, 0x74, 0x69, 0x66, 0x69, 0x63,
+	0x61, 0x74, 0x65, 0x25, 0x32, 0x30, 0x41, 0x75,
+	0x74, 0x68, 0x6f, 0x72, 0x69, 0x74, 0x79, 0x25,
+	0x32, 0x30, 0x32, 0x30, 0x31, 0x34, 0x2e, 0x63,
+	0x72, 0x6c, 0x30, 0x7d, 0x06, 0x08, 0x2b, 0x06,
+	0x01, 0x05, 0x05, 0x07, 0x01, 0x01, 0x04, 0x71,
+	0x30, 0x6f, 0x30, 0x6d, 0x06, 0x08, 0x2b, 0x06,
+	0x01, 0x05, 0x05, 0x07, 0x30, 0x02, 0x86, 0x61,
+	0x68, 0x74, 0x74, 0x70, 0x3a, 0x2f, 0x2f, 0x77,
+	0x77, 0x77, 0x2e, 0x6d, 0x69, 0x63, 0x72, 0x6f,
+	0x73, 0x6f, 0x66, 0x74, 0x2e, 0x63, 0x6f, 0x6d,
+	0x2f, 0x70, 0x6b, 0x69, 0x6f, 0x70, 0x73, 0x2f,
+	0x63, 0x65, 0x72, 0x74, 0x73, 0x2f, 0x4d, 0x69,
+	0x63, 0x72, 0x6f, 0x73, 0x6f, 0x66, 0x74, 0x25,
+	0x32, 0x30, 0x54, 0x50, 0x4d, 0x25, 0x32, 0x30,
+	0x52, 0x6f, 0x6f, 0x74, 0x25, 0x32, 0x30, 0x43,
+	0x65, 0x72, 0x74, 0x69, 0x66, 0x69, 0x63, 0x61,
+	0x74, 0x65, 0x25, 0x32, 0x30, 0x41, 0x75, 0x74,
+	0x68, 0x6f, 0x72, 0x69, 0x74, 0x79, 0x25, 0x32,
+	0x30, 0x32, 0x30, 0x31, 0x34, 0x2e, 0x63, 0x72,
+	0x74, 0x30, 0x0d, 0x06, 0x09, 0x2a, 0x86, 0x48,
+	0x86, 0xf7, 0x0d, 0x01, 0x01, 0x0b, 0x05, 0x00,
+	0x03, 0x82, 0x02, 0x01, 0x00, 0x48, 0x24, 0x32,
+	0xe8, 0xd6, 0x38, 0xda, 0x65, 0xec, 0x1b, 0x18,
+	0x8e, 0x37, 0x07, 0xd5, 0x18, 0x5a, 0xc8, 0xb9,
+	0xbb, 0x24, 0x8a, 0x4d, 0xa1, 0x3c, 0x9e, 0x46,
+	0x76, 0xcf, 0xa5, 0xdf, 0xd7, 0x61, 0xba, 0x05,
+	0x89, 0x3c, 0x13, 0xc2, 0x1f, 0x71, 0xe3, 0xec,
+	0x5d, 0x54, 0x9e, 0xd9, 0x01, 0x5a, 0x10, 0x3b,
+	0x17, 0x75, 0xde, 0xa1, 0x45, 0xbf, 0x1d, 0x1b,
+	0x41, 0x21, 0x42, 0x68, 0x22, 0x6b, 0xbb, 0xcb,
+	0x11, 0x04, 0xd2, 0xae, 0x86, 0xcf, 0x73, 0x5a,
+	0xf2, 0x80, 0x18, 0x00, 0xf0, 0xd6, 0x6c, 0x5a,
+	0x1e, 0xb3, 0x4d, 0x30, 0x02, 0x4a, 0x6a, 0x03,
+	0x36, 0x42, 0xde, 0xb2, 0x52, 0x55, 0xff, 0x71,
+	0xeb, 0x7b, 0x8b, 0x55, 0x6c, 0xdf, 0x05, 0x35,
+	0x47, 0x70, 0x53, 0xfb, 0x6c, 0xba, 0x06, 0xb2,
+	0x61, 0x86, 0xdc, 0x2a, 0x64, 0x81, 0x24, 0x79,
+	0x46, 0x73, 0x04, 0x55, 0x59, 0xed, 0xd6, 0x06,
+	0x61, 0x15, 0xf9, 0x8d, 0x78, 0x39, 0x7b, 0x84,
+	0x7a, 0x40, 0x45, 0x13, 0x1a, 0x91, 0x71, 0x8f,
+	0xd1, 0x4f, 0x78, 0x10, 0x68, 0x9b, 0x15, 0x79,
+	0x3f, 0x79, 0x2d, 0x9b, 0xc7, 0x5d, 0xa3, 0xcf,
+	0xa9, 0x14, 0xb0, 0xc4, 0xdb, 0xa9, 0x45, 0x6a,
+	0x6e, 0x60, 0x45, 0x0b, 0x14, 0x25, 0xc7, 0x74,
+	0xd0, 0x36, 0xaf, 0xc5, 0xbd, 0x4f, 0x7b, 0xc0,
+	0x04, 0x43, 0x85, 0xbb, 0x06, 0x36, 0x77, 0x26,
+	0x02, 0x23, 0x0b, 0xf8, 0x57, 0x8f, 0x1f, 0x27,
+	0x30, 0x95, 0xff, 0x83, 0x23, 0x2b, 0x49, 0x33,
+	0x43, 0x62, 0x87, 0x5d, 0x27, 0x12, 0x1a, 0x68,
+	0x7b, 0xba, 0x2d, 0xf6, 0xed, 0x2c, 0x26, 0xb5,
+	0xbb, 0xe2, 0x6f, 0xc2, 0x61, 0x17, 0xfc, 0x72,
+	0x14, 0x57, 0x2c, 0x2c, 0x5a, 0x92, 0x13, 0x41,
+	0xc4, 0x7e, 0xb5, 0x64, 0x5b, 0x86, 0x57, 0x13,
+	0x14, 0xff, 0xf5, 0x04, 0xb9, 0x3d, 0x2d, 0xc3,
+	0xe9, 0x75, 0x1f, 0x68, 0x0b, 0xb5, 0x76, 0xe1,
+	0x7d, 0xe3, 0xb0, 0x14, 0xa8, 0x45, 0x05, 0x98,
+	0x81, 0x32, 0xc1, 0xf5, 0x49, 0x4d, 0x58, 0xa4,
+	0xee, 0xd8, 0x84, 0xba, 0x65, 0x07, 0x8d, 0xf7,
+	0x9a, 0xff, 0x7d, 0xa5, 0xbc, 0x9a, 0xed, 0x4a,
+	0x5d, 0xa4, 0x97, 0x4b, 0x4d, 0x31, 0x90, 0xb5,
+	0x7d, 0x28, 0x77, 0x25, 0x88, 0x1c, 0xbf, 0x78,
+	0x22, 0xb2, 0xb5, 0x5c, 0x9a, 0xc9, 0x63, 0x17,
+	0x96, 0xe9, 0xc2, 0x52, 0x30, 0xb8, 0x9b, 0x37,
+	0x69, 0x1a, 0x6a, 0x66, 0x76, 0x18, 0xac, 0xc0,
+	0x48, 0xee, 0x46, 0x5b, 0xbe, 0x6a, 0xd5, 0x72,
+	0x07, 0xdc, 0x7d, 0x05, 0xbe, 0x76, 0x7d, 0xa5,
+	0x5e, 0x53, 0xb5, 0x47, 0x80, 0x58, 0xf0, 0xaf,
+	0x6f, 0x4e, 0xc0, 0xf1, 0x1e, 0x37, 0x64, 0x15,
+	0x42, 0x96, 0x18, 0x3a, 0x89, 0xc8, 0x14, 0x48,
+	0x89, 0x5c, 0x12, 0x88, 0x98, 0x0b, 0x7b, 0x4e,
+	0xce, 0x1c, 0xda, 0xd5, 0xa4, 0xd3, 0x32, 0x32,
+	0x74, 0x5b, 0xcc, 0xfd, 0x2b, 0x02, 0xfb, 0xae,
+	0xd0, 0x5a, 0x4c, 0xc9, 0xc1, 0x35, 0x19, 0x90,
+	0x5f, 0xca, 0x14, 0xeb, 0x4c, 0x17, 0xd7, 0xe3,
+	0xe2, 0x5d, 0xb4, 0x49, 0xaa, 0xf0, 0x50, 0x87,
+	0xc3, 0x20, 0x00, 0xda, 0xe9, 0x04, 0x80, 0x64,
+	0xac, 0x9f, 0xcd, 0x26, 0x41, 0x48, 0xe8, 0x4c,
+	0x46, 0xcc, 0x5b, 0xd7, 0xca, 0x4c, 0x1b, 0x43,
+	0x43, 0x1e, 0xbd, 0x94, 0xe7, 0xa7, 0xa6, 0x86,
+	0xe5, 0xd1, 0x78, 0x29, 0xa2, 0x40, 0xc5, 0xc5,
+	0x47, 0xb6, 0x6d, 0x53, 0xde, 0xac, 0x97, 0x74,
+	0x24, 0x57, 0xcc, 0x05, 0x93, 0xfd, 0x52, 0x35,
+	0x29, 0xd5, 0xe0, 0xfa, 0x23, 0x0d, 0xd7, 0xaa,
+	0x8b, 0x07, 0x4b, 0xf6, 0x64, 0xc7, 0xad, 0x3c,
+	0xa1, 0xb5, 0xc5, 0x70, 0xaf, 0x46, 0xfe, 0x9a,
+	0x82, 0x4d, 0x75, 0xb8, 0x6d, 0x67, 0x70, 0x75,
+	0x62, 0x41, 0x72, 0x65, 0x61, 0x58, 0x76, 0x00,
+	0x23, 0x00, 0x0b, 0x00, 0x04, 0x00, 0x72, 0x00,
+	0x20, 0x9d, 0xff, 0xcb, 0xf3, 0x6c, 0x38, 0x3a,
+	0xe6, 0x99, 0xfb, 0x98, 0x68, 0xdc, 0x6d, 0xcb,
+	0x89, 0xd7, 0x15, 0x38, 0x84, 0xbe, 0x28, 0x03,
+	0x92, 0x2c, 0x12, 0x41, 0x58, 0xbf, 0xad, 0x22,
+	0xae, 0x00, 0x10, 0x00, 0x10, 0x00, 0x03, 0x00,
+	0x10, 0x00, 0x20, 0xfb, 0xd6, 0xba, 0x74, 0xe6,
+	0x6e, 0x5c, 0x87, 0xef, 0x89, 0xa2, 0xe8, 0x3d,
+	0x0b, 0xe9, 0x69, 0x2c, 0x07, 0x07, 0x7a, 0x8a,
+	0x1e, 0xce, 0x12, 0xea, 0x3b, 0xb3, 0xf1, 0xf3,
+	0xd9, 0xc3, 0xe6, 0x00, 0x20, 0x3c, 0x68, 0x51,
+	0x94, 0x54, 0x8d, 0xeb, 0x9f, 0xb2, 0x2c, 0x66,
+	0x75, 0xb6, 0xb7, 0x55, 0x22, 0x0d, 0x87, 0x59,
+	0xc4, 0x39, 0x91, 0x62, 0x17, 0xc2, 0xc3, 0x53,
+	0xa5, 0x26, 0x97, 0x4f, 0x2d, 0x68, 0x63, 0x65,
+	0x72, 0x74, 0x49, 0x6e, 0x66, 0x6f, 0x58, 0xa1,
+	0xff, 0x54, 0x43, 0x47, 0x80, 0x17, 0x00, 0x22,
+	0x00, 0x0b, 0x73, 0xbe, 0xb7, 0x40, 0x82, 0xc0,
+	0x49, 0x9a, 0xf7, 0xf2, 0xd0, 0x79, 0x6c, 0x88,
+	0xf3, 0x56, 0x7b, 0x7a, 0x7d, 0xcd, 0x70, 0xd1,
+	0xbc, 0x41, 0x88, 0x48, 0x51, 0x03, 0xf3, 0x58,
+	0x3e, 0xb8, 0x00, 0x14, 0x9f, 0x57, 0x39, 0x67,
+	0xa8, 0x7b, 0xd8, 0xf6, 0x9e, 0x75, 0xc9, 0x85,
+	0xab, 0xe3, 0x55, 0xc7, 0x9c, 0xf6, 0xd8, 0x4f,
+	0x00, 0x00, 0x00, 0x00, 0x00, 0x36, 0x1c, 0x12,
+	0xfd, 0xc6, 0x05, 0xc6, 0x2b, 0xf5, 0xe9, 0x88,
+	0x01, 0x1f, 0x70, 0x8d, 0x98, 0x2a, 0x04, 0x21,
+	0x30, 0x00, 0x22, 0x00, 0x0b, 0xf4, 0xfd, 0x9a,
+	0x33, 0x55, 0x21, 0x08, 0x27, 0x48, 0x55, 0x01,
+	0x56, 0xf9, 0x0b, 0x4e, 0x47, 0x55, 0x08, 0x2e,
+	0x3c, 0x91, 0x3d, 0x6e, 0x53, 0xcf, 0x08, 0xe9,
+	0x0a, 0x4b, 0xc9, 0x7e, 0x99, 0x00, 0x22, 0x00,
+	0x0b, 0x51, 0xd3, 0x38, 0xfe, 0xaa, 0xda, 0xc6,
+	0x68, 0x84, 0x39, 0xe7, 0xb1, 0x03, 0x22, 0x5e,
+	0xc4, 0xd3, 0xf1, 0x0c, 0xec, 0x35, 0x5d, 0x50,
+	0xa3, 0x9d, 0xab, 0xa1, 0x7b, 0x61, 0x51, 0x8f,
+	0x4e
+};
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	assert(fido_time_now(&ts) == 0);
+
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+}
+
+static EVP_PKEY *
+keygen(int type, int arg)
+{
+	EVP_PKEY_CTX	*ctx;
+	EVP_PKEY	*pkey = NULL;
+
+	assert((ctx = EVP_PKEY_CTX_new_id(type, NULL)) != NULL);
+	assert(EVP_PKEY_keygen_init(ctx) > 0);
+	if (type == EVP_PKEY_EC)
+		assert(EVP_PKEY_CTX_set_ec_paramgen_curve_nid(ctx, arg) > 0);
+	else if (type == EVP_PKEY_RSA)
+		assert(EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, arg) > 0);
+	assert(EVP_PKEY_keygen(ctx, &pkey) > 0);
+	EVP_PKEY_CTX_free(ctx);
+
+	return (pkey);
+}
+
+/* sign msg, hashing it with md unless md is NULL (eddsa) */
+static void
+sign(EVP_PKEY *pkey, const EVP_MD *md, const unsigned char *msg, size_t len,
+    fido_blob_t *sig)
+{
+	EVP_MD_CTX	*mdctx;
+	unsigned char	*ptr;
+	size_t		 siglen;
+
+	assert((mdctx = EVP_MD_CTX_new()) != NULL);
+	assert(EVP_DigestSignInit(mdctx, NULL, md, NULL, pkey) == 1);
+	assert(EVP_DigestSign(mdctx, NULL, &siglen, msg, len) == 1);
+	assert((ptr = malloc(siglen)) != NULL);
+	assert(EVP_DigestSign(mdctx, ptr, &siglen, msg, len) == 1);
+	assert(fido_blob_set(sig, ptr, siglen) == 0);
+	free(ptr);
+	EVP_MD_CTX_free(mdctx);
+}
+
+/* a self-signed certificate for pkey, in DER */
+static void
+x509_self(EVP_PKEY *pkey, fido_blob_t *der)
+{
+	X509		*x509;
+	X509_NAME	*name;
+	unsigned char	*ptr = NULL;
+	int		 len;
+
+	assert((x509 = X509_new()) != NULL);
+	assert(X509_set_version(x509, 2) == 1);
+	assert(ASN1_INTEGER_set(X509_get_serialNumber(x509), 1) == 1);
+	assert(X509_gmtime_adj(X509_getm_notBefore(x509), 0) != NULL);
+	assert(X509_gmtime_adj(X509_getm_notAfter(x509), 86400) != NULL);
+	assert(X509_set_pubkey(x509, pkey) == 1);
+	assert((name = X509_get_subject_name(x509)) != NULL);
+	assert(X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+	    (const unsigned char *)"libfido2 bench", -1, -1, 0) == 1);
+	assert(X509_set_issuer_name(x509, name) == 1);
+	assert(X509_sign(x509, pkey, EVP_sha256()) > 0);
+	assert((len = i2d_X509(x509, &ptr)) > 0);
+	assert(fido_blob_set(der, ptr, (size_t)len) == 0);
+	OPENSSL_free(ptr);
+	X509_free(x509);
+}
+
+/* reassemble the message carried by ctaphid reports */
+static void
+deframe(const unsigned char *wire, size_t len, fido_blob_t *msg)
+{
+	unsigned char	*ptr;
+	size_t		 bcnt, hdr, n, off = 0;
+
+	assert(len >= CTAP_MAX_REPORT_LEN && (wire[4] & CTAP_FRAME_INIT));
+	bcnt = (size_t)((wire[5] << 8) | wire[6]);
+	assert((ptr = calloc(1, bcnt)) != NULL);
+
+	for (hdr = CTAP_INIT_HEADER_LEN; off < bcnt; off += n) {
+		assert(len >= CTAP_MAX_REPORT_LEN);
+		n = CTAP_MAX_REPORT_LEN - hdr;
+		n = bcnt - off < n ? bcnt - off : n;
+		memcpy(ptr + off, wire + hdr, n);
+		wire += CTAP_MAX_REPORT_LEN;
+		len -= CTAP_MAX_REPORT_LEN;
+		hdr = CTAP_CONT_HEADER_LEN;
+	}
+
+	assert(fido_blob_set(msg, ptr, bcnt) == 0);
+	free(ptr);
+}
+
+static void *
+setup_assert(int cose_alg)
+{
+	struct assert_bench	*b;
+	unsigned char		 authdata[37];
+	unsigned char		 msg[sizeof(authdata) + sizeof(cdh)];
+	fido_blob_t		 sig;
+	EVP_PKEY		*pkey = NULL;
+	const EVP_MD		*md = NULL;
+
+	assert((b = calloc(1, sizeof(*b))) != NULL);
+	b->cose_alg = cose_alg;
+
+	switch (cose_alg) {
+	case COSE_ES256:
+		pkey = keygen(EVP_PKEY_EC, NID_X9_62_prime256v1);
+		md = EVP_sha256();
+		assert((b->pk = es256_pk_new()) != NULL);
+		assert(es256_pk_from_EVP_PKEY(b->pk, pkey) == FIDO_OK);
+		break;
+	case COSE_ES384:
+		pkey = keygen(EVP_PKEY_EC, NID_secp384r1);
+		md = EVP_sha384();
+		assert((b->pk = es384_pk_new()) != NULL);
+		assert(es384_pk_from_EVP_PKEY(b->pk, pkey) == FIDO_OK);
+		break;
+	case COSE_RS256:
+		pkey = keygen(EVP_PKEY_RSA, 2048);
+		md = EVP_sha256();
+		assert((b->pk = rs256_pk_new()) != NULL);
+		assert(rs256_pk_from_EVP_PKEY(b->pk, pkey) == FIDO_OK);
+		break;
+#ifdef EVP_PKEY_ED25519
+	case COSE_EDDSA:
+		pkey = keygen(EVP_PKEY_ED25519, 0);
+		assert((b->pk = eddsa_pk_new()) != NULL);
+		assert(eddsa_pk_from_EVP_PKEY(b->pk, pkey) == FIDO_OK);
+		break;
+#endif
+	default:
+		abort();
+	}
+
+	/* rpIdHash, flags (up), signCount */
+	memset(authdata, 0, sizeof(authdata));
+	assert(SHA256((const unsigned char *)rp_id, strlen(rp_id),
+	    authdata) != NULL);
+	authdata[32] = CTAP_AUTHDATA_USER_PRESENT;
+	authdata[36] = 1;
+	memcpy(msg, authdata, sizeof(authdata));
+	memcpy(msg + sizeof(authdata), cdh, sizeof(cdh));
+	memset(&sig, 0, sizeof(sig));
+	sign(pkey, md, msg, sizeof(msg), &sig);
+
+	assert((b->assert = fido_assert_new()) != NULL);
+	assert(fido_assert_set_rp(b->assert, rp_id) == FIDO_OK);
+	assert(fido_assert_set_clientdata_hash(b->assert, cdh,
+	    sizeof(cdh)) == FIDO_OK);
+	assert(fido_assert_set_count(b->assert, 1) == FIDO_OK);
+	assert(fido_assert_set_authdata_raw(b->assert, 0, authdata,
+	    sizeof(authdata)) == FIDO_OK);
+	assert(fido_assert_set_sig(b->assert, 0, sig.ptr,
+	    sig.len) == FIDO_OK);
+
+	fido_blob_reset(&sig);
+	EVP_PKEY_free(pkey);
+
+	return (b);
+}
+
+static void
+run_assert(void *arg, size_t n)
+{
+	struct assert_bench *b = arg;
+
+	for (size_t i = 0; i < n; i++)
+		assert(fido_assert_verify(b->assert, 0, b->cose_alg,
+		    b->pk) == FIDO_OK);
+}
+
+static void
+teardown_assert(void *arg)
+{
+	struct assert_bench *b = arg;
+
+	switch (b->cose_alg) {
+	case COSE_ES256:
+		es256_pk_free((es256_pk_t **)&b->pk);
+		break;
+	case COSE_ES384:
+		es384_pk_free((es384_pk_t **)&b->pk);
+		break;
+	case COSE_RS256:
+		rs256_pk_free((rs256_pk_t **)&b->pk);
+		break;
+	case COSE_EDDSA:
+		eddsa_pk_free((eddsa_pk_t **)&b->pk);
+		break;
+	}
+	fido_assert_free(&b->assert);
+	free(b);
+}
+
+/* packed and fido-u2f attestation, made by a fresh self-signed key */
+static void
+make_cred(fido_cred_t *cred, const char *fmt)
+{
+	unsigned char	 authdata[37 + 16 + 2 + 32 + 77];
+	unsigned char	*id = &authdata[37 + 16 + 2];
+	unsigned char	*cose = &authdata[37 + 16 + 2 + 32];
+	unsigned char	 u2f[1 + 32 + sizeof(cdh) + 32 + 65];
+	EVP_PKEY	*attkey, *credkey;
+	es256_pk_t	*pk;
+	fido_blob_t	 sig, x509;
+
+	attkey = keygen(EVP_PKEY_EC, NID_X9_62_prime256v1);
+	credkey = keygen(EVP_PKEY_EC, NID_X9_62_prime256v1);
+	assert((pk = es256_pk_new()) != NULL);
+	assert(es256_pk_from_EVP_PKEY(pk, credkey) == FIDO_OK);
+
+	/* rpIdHash, flags (up, at), signCount, aaguid, credential */
+	memset(authdata, 0, sizeof(authdata));
+	assert(SHA256((const unsigned char *)rp_id, strlen(rp_id),
+	    authdata) != NULL);
+	authdata[32] = CTAP_AUTHDATA_USER_PRESENT | CTAP_AUTHDATA_ATT_CRED;
+	authdata[37 + 16 + 1] = 32;
+	memset(id, 0x2a, 32);
+	/* {1: 2, 3: -7, -1: 1, -2: x, -3: y} */
+	memcpy(cose, "\xa5\x01\x02\x03\x26\x20\x01\x21\x58\x20", 10);
+	memcpy(cose + 10, pk->x, sizeof(pk->x));
+	memcpy(cose + 42, "\x22\x58\x20", 3);
+	memcpy(cose + 45, pk->y, sizeof(pk->y));
+
+	memset(&sig, 0, sizeof(sig));
+	memset(&x509, 0, sizeof(x509));
+	if (strcmp(fmt, "fido-u2f") == 0) {
+		u2f[0] = 0x00;
+		memcpy(&u2f[1], authdata, 32);
+		memcpy(&u2f[33], cdh, sizeof(cdh));
+		memcpy(&u2f[33 + sizeof(cdh)], id, 32);
+		u2f[65 + sizeof(cdh)] = 0x04;
+		memcpy(&u2f[66 + sizeof(cdh)], pk->x, sizeof(pk->x));
+		memcpy(&u2f[98 + sizeof(cdh)], pk->y, sizeof(pk->y));
+		sign(attkey, EVP_sha256(), u2f, sizeof(u2f), &sig);
+	} else {
+		unsigned char msg[sizeof(authdata) + sizeof(cdh)];
+
+		memcpy(msg, authdata, sizeof(authdata));
+		memcpy(msg + sizeof(authdata), cdh, sizeof(cdh));
+		sign(attkey, EVP_sha256(), msg, sizeof(msg), &sig);
+	}
+	x509_self(attkey, &x509);
+
+	assert(fido_cred_set_clientdata_hash(cred, cdh,
+	    sizeof(cdh)) == FIDO_OK);
+	assert(fido_cred_set_type(cred, COSE_ES256) == FIDO_OK);
+	assert(fido_cred_set_authdata_raw(cred, authdata,
+	    sizeof(authdata)) == FIDO_OK);
+	assert(fido_cred_set_x509(cred, x509.ptr, x509.len) == FIDO_OK);
+	assert(fido_cred_set_sig(cred, sig.ptr, sig.len) == FIDO_OK);
+	assert(fido_cred_set_fmt(cred, fmt) == FIDO_OK);
+
+	fido_blob_reset(&sig);
+	fido_blob_reset(&x509);
+	es256_pk_free(&pk);
+	EVP_PKEY_free(credkey);
+	EVP_PKEY_free(attkey);
+}
+
+static void *
+setup_cred(int fmt)
+{
+	fido_cred_t *cred;
+
+	assert((cred = fido_cred_new()) != NULL);
+	assert(fido_cred_set_rp(cred, rp_id, NULL) == FIDO_OK);
+
+	switch (fmt) {
+	case CRED_PACKED:
+		make_cred(cred, "packed");
+		break;
+	case CRED_PACKED_CACHED:
+		assert(fido_x5c_cache_set_size(1) == FIDO_OK);
+		make_cred(cred, "packed");
+		break;
+	case CRED_U2F:
+		make_cred(cred, "fido-u2f");
+		break;
+	case CRED_TPM:
+		/* the vector was made over the hash of cdh */
+		assert(fido_cred_set_clientdata(cred, cdh,
+		    sizeof(cdh)) == FIDO_OK);
+		assert(fido_cred_set_type(cred, COSE_ES256) == FIDO_OK);
+		assert(fido_cred_set_authdata(cred, authdata_tpm_es256,
+		    sizeof(authdata_tpm_es256)) == FIDO_OK);
+		assert(fido_cred_set_fmt(cred, "tpm") == FIDO_OK);
+		assert(fido_cred_set_attstmt(cred, attstmt_tpm_es256,
+		    sizeof(attstmt_tpm_es256)) == FIDO_OK);
+		break;
+	default:
+		abort();
+	}
+
+	return (cred);
+}
+
+static void
+run_cred(void *arg, size_t n)
+{
+	const fido_cred_t *cred = arg;
+
+	for (size_t i = 0; i < n; i++)
+		assert(fido_cred_verify(cred) == FIDO_OK);
+}
+
+static void
+teardown_cred(void *arg)
+{
+	fido_cred_t *cred = arg;
+
+	fido_cred_free(&cred);
+	fido_x5c_cache_clear();
+	assert(fido_x5c_cache_set_size(0) == FIDO_OK);
+}
+
+static void *
+setup_reply(int which)
+{
+	struct blob_bench *b;
+
+	assert((b = calloc(1, sizeof(*b))) != NULL);
+
+	switch (which) {
+	case REPLY_INFO:
+		deframe(wire_info, sizeof(wire_info), &b->in);
+		break;
+	case REPLY_ASSERT:
+		deframe(wire_assert, sizeof(wire_assert), &b->in);
+		break;
+	case REPLY_CRED:
+		deframe(wire_cred, sizeof(wire_cred), &b->in);
+		break;
+	default:
+		abort();
+	}
+
+	return (b);
+}
+
+static int
+count_keys(const cbor_item_t *key, const cbor_item_t *val, void *arg)
+{
+	size_t *n = arg;
+
+	(void)key;
+	(void)val;
+	(*n)++;
+
+	return (0);
+}
+
+static void
+run_reply(void *arg, size_t n)
+{
+	struct blob_bench	*b = arg;
+	size_t			 nkeys;
+
+	for (size_t i = 0; i < n; i++) {
+		nkeys = 0;
+		assert(cbor_parse_reply(b->in.ptr, b->in.len, &nkeys,
+		    count_keys) == FIDO_OK);
+		assert(nkeys > 0);
+	}
+}
+
+static void
+teardown_blob(void *arg)
+{
+	struct blob_bench *b = arg;
+
+	fido_blob_reset(&b->in);
+	fido_blob_reset(&b->out);
+	free(b);
+}
+
+/* a large blob array stand-in: attestation objects back to back */
+static void *
+setup_compress(int unused)
+{
+	struct blob_bench	*b;
+	fido_blob_t		 cred;
+	unsigned char		*ptr;
+
+	(void)unused;
+
+	assert((b = calloc(1, sizeof(*b))) != NULL);
+	assert((ptr = malloc(COMPRESS_LEN)) != NULL);
+	memset(&cred, 0, sizeof(cred));
+	deframe(wire_cred, sizeof(wire_cred), &cred);
+	for (size_t off = 0, n; off < COMPRESS_LEN; off += n) {
+		n = COMPRESS_LEN - off < cred.len ? COMPRESS_LEN - off :
+		    cred.len;
+		memcpy(ptr + off, cred.ptr, n);
+	}
+	assert(fido_blob_set(&b->in, ptr, COMPRESS_LEN) == 0);
+	free(ptr);
+	fido_blob_reset(&cred);
+	assert(fido_compress(&b->out, &b->in) == FIDO_OK);
+
+	return (b);
+}
+
+static void
+run_compress(void *arg, size_t n)
+{
+	struct blob_bench	*b = arg;
+	fido_blob_t		 out;
+
+	for (size_t i = 0; i < n; i++) {
+		memset(&out, 0, sizeof(out));
+		assert(fido_compress(&out, &b->in) == FIDO_OK);
+		fido_blob_reset(&out);
+	}
+}
+
+static void
+run_uncompress(void *arg, size_t n)
+{
+	struct blob_bench	*b = arg;
+	fido_blob_t		 out;
+
+	for (size_t i = 0; i < n; i++) {
+		memset(&out, 0, sizeof(out));
+		assert(fido_uncompress(&out, &b->out, b->in.len) == FIDO_OK);
+		assert(out.len == b->in.len);
+		fido_blob_reset(&out);
+	}
+}
+
+/*
+ * The in-memory authenticator answers CTAPHID_INIT, replies to
+ * authenticatorGetInfo with the reply in wire_info, and echoes any
+ * other message, one report per call.
+ */
+static void
+hid_respond(void)
+{
+	fido_blob_t info;
+
+	hid.rep_off = 0;
+	hid.rep_seq = 0;
+	hid.rep_cmd = hid.req_cmd;
+
+	if (hid.req_cmd == CTAP_CMD_INIT) {
+		assert(hid.req_len == 8);
+		memcpy(hid.rep, hid.req, 8);
+		memcpy(&hid.rep[8], "\x01\x02\x03\x04", 4);
+		memcpy(&hid.rep[12], "\x02\x05\x02\x01", 4);
+		hid.rep[16] = FIDO_CAP_CBOR | FIDO_CAP_NMSG;
+		hid.rep_len = 17;
+	} else if (hid.req_cmd == CTAP_CMD_CBOR && hid.req_len == 1 &&
+	    hid.req[0] == CTAP_CBOR_GETINFO) {
+		memset(&info, 0, sizeof(info));
+		deframe(wire_info, sizeof(wire_info), &info);
+		assert(info.len <= sizeof(hid.rep));
+		memcpy(hid.rep, info.ptr, info.len);
+		hid.rep_len = info.len;
+		fido_blob_reset(&info);
+	} else {
+		memcpy(hid.rep, hid.req, hid.req_len);
+		hid.rep_len = hid.req_len;
+	}
+}
+
+static void *
+hid_open(const char *path)
+{
+	(void)path;
+
+	memset(&hid, 0, sizeof(hid));
+
+	return (&hid);
+}
+
+static void
+hid_close(void *handle)
+{
+	assert(handle == &hid);
+}
+
+static int
+hid_read(void *handle, unsigned char *buf, size_t len, int ms)
+{
+	size_t hdr, n;
+
+	(void)ms;
+
+	assert(handle == &hid && len == CTAP_MAX_REPORT_LEN);
+	if (hid.rep_len == 0)
+		return (-1);
+
+	memset(buf, 0, len);
+	memcpy(buf, hid.cid, sizeof(hid.cid));
+	if (hid.rep_off == 0 && hid.rep_seq == 0) {
+		buf[4] = CTAP_FRAME_INIT | hid.rep_cmd;
+		buf[5] = (hid.rep_len >> 8) & 0xff;
+		buf[6] = hid.rep_len & 0xff;
+		hdr = CTAP_INIT_HEADER_LEN;
+	} else {
+		buf[4] = hid.rep_seq++;
+		hdr = CTAP_CONT_HEADER_LEN;
+	}
+	n = hid.rep_len - hid.rep_off < len - hdr ?
+	    hid.rep_len - hid.rep_off : len - hdr;
+	memcpy(buf + hdr, hid.rep + hid.rep_off, n);
+	if ((hid.rep_off += n) == hid.rep_len)
+		hid.rep_len = 0;
+
+	return ((int)len);
+}
+
+static int
+hid_write(void *handle, const unsigned char *buf, size_t len)
+{
+	const unsigned char	*frame = buf + 1; /* report id */
+	size_t			 n;
+
+	assert(handle == &hid && len == CTAP_MAX_REPORT_LEN + 1);
+
+	if (frame[4] & CTAP_FRAME_INIT) {
+		memcpy(hid.cid, frame, sizeof(hid.cid));
+		hid.req_cmd = frame[4] & ~CTAP_FRAME_INIT;
+		hid.req_len = (size_t)((frame[5] << 8) | frame[6]);
+		hid.req_got = 0;
+		assert(hid.req_len <= sizeof(hid.req));
+		frame += CTAP_INIT_HEADER_LEN;
+		n = CTAP_MAX_REPORT_LEN - CTAP_INIT_HEADER_LEN;
+	} else {
+		frame += CTAP_CONT_HEADER_LEN;
+		n = CTAP_MAX_REPORT_LEN - CTAP_CONT_HEADER_LEN;
+	}
+	n = hid.req_len - hid.req_got < n ? hid.req_len - hid.req_got : n;
+	memcpy(hid.req + hid.req_got, frame, n);
+	if ((hid.req_got += n) == hid.req_len)
+		hid_respond();
+
+	return ((int)len);
+}
+
+static void *
+setup_hid(int len)
+{
+	struct hid_bench	*b;
+	fido_dev_io_t		 io = {
+		hid_open,
+		hid_close,
+		hid_read,
+		hid_write,
+	};
+
+	assert((b = calloc(1, sizeof(*b))) != NULL);
+	assert((b->dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(b->dev, &io) == FIDO_OK);
+	assert(fido_dev_open(b->dev, "bench") == FIDO_OK);
+	assert(fido_dev_is_fido2(b->dev));
+
+	assert(len > 0 && (size_t)len <= sizeof(b->msg));
+	b->len = (size_t)len;
+	for (size_t i = 0; i < b->len; i++)
+		b->msg[i] = (unsigned char)(0x80 | i);
+
+	return (b);
+}
+
+static void
+run_hid(void *arg, size_t n)
+{
+	struct hid_bench	*b = arg;
+	unsigned char		 buf[HID_MAXMSG];
+	int			 ms;
+
+	for (size_t i = 0; i < n; i++) {
+		ms = -1;
+		assert(fido_tx(b->dev, CTAP_CMD_CBOR, b->msg, b->len,
+		    &ms) >= 0);
+		assert(fido_rx(b->dev, CTAP_CMD_CBOR, buf, sizeof(buf),
+		    &ms) == (int)b->len);
+	}
+}
+
+static void
+run_hid_info(void *arg, size_t n)
+{
+	struct hid_bench	*b = arg;
+	fido_cbor_info_t	*ci;
+
+	for (size_t i = 0; i < n; i++) {
+		assert((ci = fido_cbor_info_new()) != NULL);
+		assert(fido_dev_get_cbor_info(b->dev, ci) == FIDO_OK);
+		fido_cbor_info_free(&ci);
+	}
+}
+
+static void
+teardown_hid(void *arg)
+{
+	struct hid_bench *b = arg;
+
+	assert(fido_dev_close(b->dev) == FIDO_OK);
+	fido_dev_free(&b->dev);
+	free(b);
+}
+
+static const struct bench benches[] = {
+	{ "assert_verify/es256", COSE_ES256, setup_assert, run_assert,
+	    teardown_assert },
+	{ "assert_verify/es384", COSE_ES384, setup_assert, run_assert,
+	    teardown_assert },
+	{ "assert_verify/rs256", COSE_RS256, setup_assert, run_assert,
+	    teardown_assert },
+#ifdef EVP_PKEY_ED25519
+	{ "assert_verify/eddsa", COSE_EDDSA, setup_assert, run_assert,
+	    teardown_assert },
+#endif
+	{ "cred_verify/packed", CRED_PACKED, setup_cred, run_cred,
+	    teardown_cred },
+	{ "cred_verify/packed_x5c_cache", CRED_PACKED_CACHED, setup_cred,
+	    run_cred, teardown_cred },
+	{ "cred_verify/fido-u2f", CRED_U2F, setup_cred, run_cred,
+	    teardown_cred },
+	{ "cred_verify/tpm", CRED_TPM, setup_cred, run_cred, teardown_cred },
+	{ "cbor_parse_reply/info", REPLY_INFO, setup_reply, run_reply,
+	    teardown_blob },
+	{ "cbor_parse_reply/assert", REPLY_ASSERT, setup_reply, run_reply,
+	    teardown_blob },
+	{ "cbor_parse_reply/cred", REPLY_CRED, setup_reply, run_reply,
+	    teardown_blob },
+	{ "compress/16k", 0, setup_compress, run_compress, teardown_blob },
+	{ "uncompress/16k", 0, setup_compress, run_uncompress,
+	    teardown_blob },
+	{ "hid_tx_rx/57", 57, setup_hid, run_hid, teardown_hid },
+	{ "hid_tx_rx/1024", 1024, setup_hid, run_hid, teardown_hid },
+	{ "hid_get_cbor_info", 1, setup_hid, run_hid_info, teardown_hid },
+};
+
+static void
+run_bench(const struct bench *b, uint64_t min_ns)
+{
+	void		*arg;
+	uint64_t	 t0, ns, want;
+	size_t		 n = 1;
+
+	arg = b->setup(b->param);
+	for (;;) {
+		t0 = now_ns();
+		b->run(arg, n);
+		ns = now_ns() - t0;
+		if (ns >= min_ns || n >= BENCH_MAX_ITER)
+			break;
+		/* aim past the minimum, growing by at most 100x per run */
+		want = ns > 0 ? min_ns / ns * n + min_ns / ns * n / 5 : n * 100;
+		if (want > n * 100)
+			want = n * 100;
+		if (want <= n)
+			want = n + 1;
+		n = want > BENCH_MAX_ITER ? BENCH_MAX_ITER : (size_t)want;
+	}
+	b->teardown(arg);
+
+	printf("%-32s %12.0f ns %12zu\n", b->name, (double)ns / (double)n, n);
+	fflush(stdout);
+}
+
+static int
+selected(const char *name, int argc, char **argv)
+{
+	if (argc == 0)
+		return (1);
+	for (int i = 0; i < argc; i++)
+		if (strncmp(name, argv[i], strlen(argv[i])) == 0)
+			return (1);
+
+	return (0);
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: regress_bench [-m min_ms] [prefix ...]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	char	*ep;
+	long	 min_ms = BENCH_MIN_MS;
+
+	argc--;
+	argv++;
+	if (argc > 0 && strcmp(argv[0], "-m") == 0) {
+		if (argc < 2)
+			usage();
+		min_ms = strtol(argv[1], &ep, 10);
+		if (*argv[1] == '\0' || *ep != '\0' || min_ms < 0 ||
+		    min_ms > 3600000)
+			usage();
+		argc -= 2;
+		argv += 2;
+	}
+
+	fido_init(0);
+
+	printf("%-32s %15s %12s\n", "Benchmark", "Time", "Iterations");
+	for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++)
+		if (selected(benches[i].name, argc, argv))
+			run_bench(&benches[i], (uint64_t)min_ms * 1000000ULL);
+
+	exit(0);
+}
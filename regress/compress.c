@@ -255,6 +255,193 @@ rfc1951_reinflate(void)
 	free(out.ptr);
 }
 
+static void
+inflate_buf(void)
+{
+	unsigned char buf[sizeof(random_words)];
+	fido_blob_t in, out;
+
+	memset(&in, 0, sizeof(in));
+	memset(&out, 0, sizeof(out));
+	in.ptr = random_words;
+	in.len = sizeof(random_words);
+
+	assert(fido_compress(&out, &in) == FIDO_OK);
+	assert(fido_uncompress_buf(buf, sizeof(buf), &out) == FIDO_OK);
+	assert(memcmp(buf, random_words, sizeof(buf)) == 0);
+	/* the buffer must be filled exactly */
+	assert(fido_uncompress_buf(buf, sizeof(buf) - 1,
+	    &out) == FIDO_ERR_COMPRESS);
+	free(out.ptr);
+
+	in.ptr = rfc1950_blob;
+	in.len = sizeof(rfc1950_blob);
+	assert(fido_uncompress_buf(buf, sizeof(buf), &in) == FIDO_ERR_COMPRESS);
+	assert(fido_uncompress(&out, &in, rfc1950_blob_origsiz) == FIDO_OK);
+	free(out.ptr);
+}
+
+struct stream {
+	const unsigned char	*ptr;
+	size_t			 len;
+	size_t			 off;
+	size_t			 max; /* bytes per call */
+	fido_blob_t		 out;
+};
+
+static int
+stream_read(void *arg, unsigned char *ptr, size_t len)
+{
+	struct stream *st = arg;
+	size_t n;
+
+	if ((n = st->len - st->off) > len)
+		n = len;
+	if (n > st->max)
+		n = st->max;
+	memcpy(ptr, st->ptr + st->off, n);
+	st->off += n;
+
+	return (int)n;
+}
+
+static int
+stream_write(void *arg, const unsigned char *ptr, size_t len)
+{
+	struct stream *st = arg;
+
+	assert(len > 0);
+
+	return fido_blob_append(&st->out, ptr, len);
+}
+
+static void
+rfc1950_stream(void)
+{
+	struct stream st;
+	fido_blob_t in, dgst;
+
+	memset(&st, 0, sizeof(st));
+	memset(&in, 0, sizeof(in));
+	memset(&dgst, 0, sizeof(dgst));
+	in.ptr = rfc1950_blob;
+	in.len = sizeof(rfc1950_blob);
+
+	assert(fido_uncompress_stream(&in, rfc1950_blob_origsiz, stream_write,
+	    &st) == FIDO_OK);
+	assert(st.out.len == rfc1950_blob_origsiz);
+	assert(fido_sha256(&dgst, st.out.ptr, st.out.len) == 0);
+	assert(memcmp(rfc1950_blob_hash, dgst.ptr, dgst.len) == 0);
+
+	/* nothing is written if the size does not match */
+	free(st.out.ptr);
+	memset(&st, 0, sizeof(st));
+	assert(fido_uncompress_stream(&in, rfc1950_blob_origsiz - 1,
+	    stream_write, &st) == FIDO_ERR_COMPRESS);
+	assert(st.out.len == 0);
+
+	free(dgst.ptr);
+}
+
+static void
+rfc1951_stream(void)
+{
+	struct stream st;
+	fido_blob_t out;
+	unsigned char noise[8192];
+	uint32_t seed = 1;
+	size_t origsiz;
+
+	memset(&out, 0, sizeof(out));
+
+	for (size_t max = 1; max <= sizeof(random_words); max *= 7) {
+		memset(&st, 0, sizeof(st));
+		st.ptr = random_words;
+		st.len = sizeof(random_words);
+		st.max = max;
+		assert(fido_compress_stream(&out, &origsiz, -1, stream_read,
+		    &st) == FIDO_OK);
+		assert(origsiz == sizeof(random_words));
+		assert(fido_uncompress_stream(&out, origsiz, stream_write,
+		    &st) == FIDO_OK);
+		assert(st.out.len == sizeof(random_words));
+		assert(memcmp(st.out.ptr, random_words, st.out.len) == 0);
+		free(st.out.ptr);
+		free(out.ptr);
+	}
+
+	/* incompressible data, spanning several output buffers */
+	for (size_t i = 0; i < sizeof(noise); i++)
+		noise[i] = (unsigned char)((seed = seed * 1103515245 +
+		    12345) >> 16);
+	memset(&st, 0, sizeof(st));
+	st.ptr = noise;
+	st.len = sizeof(noise);
+	st.max = sizeof(noise);
+	assert(fido_compress_stream(&out, &origsiz, -1, stream_read,
+	    &st) == FIDO_OK);
+	assert(origsiz == sizeof(noise));
+	assert(out.len > sizeof(noise) / 2);
+	assert(fido_uncompress_stream(&out, origsiz, stream_write,
+	    &st) == FIDO_OK);
+	assert(st.out.len == sizeof(noise));
+	assert(memcmp(st.out.ptr, noise, st.out.len) == 0);
+	free(st.out.ptr);
+	free(out.ptr);
+}
+
+static void
+rfc1951_seal(void)
+{
+	static unsigned char aad_data[] = "blob";
+	unsigned char k[32], n[12], noise[8192];
+	fido_blob_t key, nonce, aad, in, out, plaintext, body;
+	EVP_CIPHER_CTX *ctx;
+	uint32_t seed = 1;
+
+	memset(&key, 0, sizeof(key));
+	memset(&nonce, 0, sizeof(nonce));
+	memset(&aad, 0, sizeof(aad));
+	memset(&in, 0, sizeof(in));
+	memset(k, 0x42, sizeof(k));
+	memset(n, 0x24, sizeof(n));
+	key.ptr = k;
+	key.len = sizeof(k);
+	nonce.ptr = n;
+	nonce.len = sizeof(n);
+	aad.ptr = aad_data;
+	aad.len = sizeof(aad_data) - 1;
+	for (size_t i = 0; i < sizeof(noise); i++)
+		noise[i] = (unsigned char)((seed = seed * 1103515245 +
+		    12345) >> 16);
+
+	/* compressible, and incompressible over several windows */
+	for (int i = 0; i < 2; i++) {
+		in.ptr = i == 0 ? random_words : noise;
+		in.len = i == 0 ? sizeof(random_words) : sizeof(noise);
+		memset(&out, 0, sizeof(out));
+		memset(&plaintext, 0, sizeof(plaintext));
+		memset(&body, 0, sizeof(body));
+		assert((ctx = aes256_gcm_enc_begin(&key, &nonce,
+		    &aad)) != NULL);
+		assert(fido_compress_seal(&out, &in, -1, ctx) == FIDO_OK);
+		EVP_CIPHER_CTX_free(ctx);
+		assert(aes256_gcm_dec(&key, &nonce, &aad, &out,
+		    &plaintext) == 0);
+		assert(fido_uncompress(&body, &plaintext, in.len) == FIDO_OK);
+		assert(body.len == in.len);
+		assert(memcmp(body.ptr, in.ptr, body.len) == 0);
+		/* the tag covers the aad */
+		aad.len--;
+		free(plaintext.ptr);
+		assert(aes256_gcm_dec(&key, &nonce, &aad, &out,
+		    &plaintext) < 0);
+		aad.len++;
+		free(out.ptr);
+		free(body.ptr);
+	}
+}
+
 int
 main(void)
 {
@@ -263,6 +450,10 @@ main(void)
 	rfc1950_inflate();
 	rfc1951_inflate();
 	rfc1951_reinflate();
+	inflate_buf();
+	rfc1950_stream();
+	rfc1951_stream();
+	rfc1951_seal();
 
 	exit(0);
 }
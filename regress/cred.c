@@ -13,6 +13,7 @@
 #define _FIDO_INTERNAL
 
 #include <fido.h>
+#include <fido/verify.h>
 
 static int fake_dev_handle;
 
@@ -1381,6 +1382,345 @@ const unsigned char aaguid_tpm[16] = {
 	0xb6, 0xe1, 0x30, 0xde, 0x50, 0xdc, 0xbe, 0x96,
 };
 
+static const unsigned char trust_root[427] = {
+	0x30, 0x82, 0x01, 0xa7, 0x30, 0x82, 0x01, 0x4d,
+	0xa0, 0x03, 0x02, 0x01, 0x02, 0x02, 0x14, 0x4b,
+	0xbb, 0xa0, 0x03, 0xd8, 0xc9, 0xd1, 0x9a, 0x2f,
+	0x97, 0xf3, 0x1e, 0xf7, 0x88, 0x31, 0x0f, 0xcd,
+	0xd0, 0x5c, 0x8f, 0x30, 0x0a, 0x06, 0x08, 0x2a,
+	0x86, 0x48, 0xce, 0x3d, 0x04, 0x03, 0x02, 0x30,
+	0x20, 0x31, 0x1e, 0x30, 0x1c, 0x06, 0x03, 0x55,
+	0x04, 0x03, 0x0c, 0x15, 0x6c, 0x69, 0x62, 0x66,
+	0x69, 0x64, 0x6f, 0x32, 0x20, 0x54, 0x65, 0x73,
+	0x74, 0x20, 0x52, 0x6f, 0x6f, 0x74, 0x20, 0x43,
+	0x41, 0x30, 0x20, 0x17, 0x0d, 0x32, 0x36, 0x31,
+	0x30, 0x31, 0x34, 0x31, 0x39, 0x33, 0x33, 0x33,
+	0x35, 0x5a, 0x18, 0x0f, 0x32, 0x31, 0x32, 0x36,
+	0x30, 0x39, 0x32, 0x30, 0x31, 0x39, 0x33, 0x33,
+	0x33, 0x35, 0x5a, 0x30, 0x20, 0x31, 0x1e, 0x30,
+	0x1c, 0x06, 0x03, 0x55, 0x04, 0x03, 0x0c, 0x15,
+	0x6c, 0x69, 0x62, 0x66, 0x69, 0x64, 0x6f, 0x32,
+	0x20, 0x54, 0x65, 0x73, 0x74, 0x20, 0x52, 0x6f,
+	0x6f, 0x74, 0x20, 0x43, 0x41, 0x30, 0x59, 0x30,
+	0x13, 0x06, 0x07, 0x2a, 0x86, 0x48, 0xce, 0x3d,
+	0x02, 0x01, 0x06, 0x08, 0x2a, 0x86, 0x48, 0xce,
+	0x3d, 0x03, 0x01, 0x07, 0x03, 0x42, 0x00, 0x04,
+	0x82, 0xb4, 0x31, 0x80, 0x6d, 0x2a, 0x88, 0xc9,
+	0x2c, 0x63, 0x2b, 0x0b, 0xb0, 0x47, 0xd2, 0x1c,
+	0x24, 0x1a, 0x96, 0x43, 0x1e, 0x3d, 0x03, 0x01,
+	0xc5, 0x1d, 0xe2, 0x7c, 0xd8, 0xba, 0x29, 0x5f,
+	0x3f, 0x1f, 0x6c, 0x8b, 0x24, 0xf9, 0x4b, 0x7f,
+	0xe8, 0xef, 0x3d, 0xbc, 0x66, 0xd5, 0xde, 0xad,
+	0x17, 0x17, 0xc7, 0x1c, 0x71, 0xcf, 0x50, 0x82,
+	0x7f, 0x57, 0xa1, 0x43, 0x28, 0xe3, 0x41, 0x7f,
+	0xa3, 0x63, 0x30, 0x61, 0x30, 0x1d, 0x06, 0x03,
+	0x55, 0x1d, 0x0e, 0x04, 0x16, 0x04, 0x14, 0x3d,
+	0x4c, 0x90, 0xb7, 0x81, 0x77, 0x1d, 0x07, 0x7a,
+	0x86, 0xab, 0x6b, 0xeb, 0xcc, 0xb2, 0xe3, 0x3d,
+	0xf7, 0xbb, 0x4b, 0x30, 0x1f, 0x06, 0x03, 0x55,
+	0x1d, 0x23, 0x04, 0x18, 0x30, 0x16, 0x80, 0x14,
+	0x3d, 0x4c, 0x90, 0xb7, 0x81, 0x77, 0x1d, 0x07,
+	0x7a, 0x86, 0xab, 0x6b, 0xeb, 0xcc, 0xb2, 0xe3,
+	0x3d, 0xf7, 0xbb, 0x4b, 0x30, 0x0f, 0x06, 0x03,
+	0x55, 0x1d, 0x13, 0x01, 0x01, 0xff, 0x04, 0x05,
+	0x30, 0x03, 0x01, 0x01, 0xff, 0x30, 0x0e, 0x06,
+	0x03, 0x55, 0x1d, 0x0f, 0x01, 0x01, 0xff, 0x04,
+	0x04, 0x03, 0x02, 0x01, 0x06, 0x30, 0x0a, 0x06,
+	0x08, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x04, 0x03,
+	0x02, 0x03, 0x48, 0x00, 0x30, 0x45, 0x02, 0x21,
+	0x00, 0x8f, 0xd5, 0x5e, 0x17, 0x90, 0x24, 0xfc,
+	0xcf, 0x6f, 0xfb, 0x7c, 0x98, 0xad, 0x93, 0x8b,
+	0x28, 0x28, 0x83, 0x0b, 0xf9, 0x05, 0xf4, 0x93,
+	0xa1, 0xd5, 0x85, 0x7c, 0xed, 0xe9, 0x02, 0x72,
+	0xf2, 0x02, 0x20, 0x17, 0x44, 0xb1, 0x8e, 0x7e,
+	0x4a, 0xc0, 0x7c, 0x86, 0x6b, 0xe9, 0x53, 0xf6,
+	0xcd, 0xdb, 0x19, 0xa8, 0x53, 0x77, 0x5a, 0x03,
+	0x5a, 0x82, 0x74, 0xc1, 0x79, 0x8f, 0x2e, 0x53,
+	0x14, 0xe3, 0x57,
+};
+
+static const unsigned char attstmt_trust_a[908] = {
+	0xa3, 0x63, 0x61, 0x6c, 0x67, 0x26, 0x63, 0x73,
+	0x69, 0x67, 0x58, 0x47, 0x30, 0x45, 0x02, 0x21,
+	0x00, 0xef, 0x94, 0x52, 0xa2, 0x19, 0x20, 0x64,
+	0x8e, 0xe1, 0x3e, 0x39, 0x22, 0x28, 0xe8, 0xda,
+	0x72, 0x88, 0x3f, 0x74, 0xe5, 0x88, 0xef, 0x33,
+	0xfe, 0xa8, 0x42, 0x14, 0xcf, 0xe2, 0x4b, 0x5f,
+	0x06, 0x02, 0x20, 0x7b, 0x3d, 0x72, 0x76, 0x45,
+	0xd0, 0x21, 0xda, 0xe0, 0xf8, 0xe8, 0xf0, 0x05,
+	0x06, 0x12, 0x35, 0x1d, 0x2e, 0x28, 0xfb, 0x1f,
+	0x02, 0x6d, 0x90, 0x41, 0x3a, 0x21, 0x37, 0x18,
+	0x2c, 0x71, 0x81, 0x63, 0x78, 0x35, 0x63, 0x82,
+	0x59, 0x01, 0x8a, 0x30, 0x82, 0x01, 0x86, 0x30,
+	0x82, 0x01, 0x2c, 0xa0, 0x03, 0x02, 0x01, 0x02,
+	0x02, 0x01, 0x0a, 0x30, 0x0a, 0x06, 0x08, 0x2a,
+	0x86, 0x48, 0xce, 0x3d, 0x04, 0x03, 0x02, 0x30,
+	0x28, 0x31, 0x26, 0x30, 0x24, 0x06, 0x03, 0x55,
+	0x04, 0x03, 0x0c, 0x1d, 0x6c, 0x69, 0x62, 0x66,
+	0x69, 0x64, 0x6f, 0x32, 0x20, 0x54, 0x65, 0x73,
+	0x74, 0x20, 0x49, 0x6e, 0x74, 0x65, 0x72, 0x6d,
+	0x65, 0x64, 0x69, 0x61, 0x74, 0x65, 0x20, 0x43,
+	0x41, 0x30, 0x20, 0x17, 0x0d, 0x32, 0x36, 0x31,
+	0x30, 0x31, 0x34, 0x31, 0x39, 0x33, 0x33, 0x33,
+	0x35, 0x5a, 0x18, 0x0f, 0x32, 0x31, 0x32, 0x36,
+	0x30, 0x39, 0x32, 0x30, 0x31, 0x39, 0x33, 0x33,
+	0x33, 0x35, 0x5a, 0x30, 0x1d, 0x31, 0x1b, 0x30,
+	0x19, 0x06, 0x03, 0x55, 0x04, 0x03, 0x0c, 0x12,
+	0x6c, 0x69, 0x62, 0x66, 0x69, 0x64, 0x6f, 0x32,
+	0x20, 0x54, 0x65, 0x73, 0x74, 0x20, 0x45, 0x45,
+	0x20, 0x61, 0x30, 0x59, 0x30, 0x13, 0x06, 0x07,
+	0x2a, 0x86, 0x48, 0xce, 0x3d, 0x02, 0x01, 0x06,
+	0x08, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x03, 0x01,
+	0x07, 0x03, 0x42, 0x00, 0x04, 0xd5, 0xc3, 0xff,
+	0x26, 0xea, 0xa0, 0xdd, 0xf8, 0x87, 0x3c, 0xe1,
+	0x3d, 0x32, 0x14, 0xf7, 0x17, 0x4c, 0x92, 0x7a,
+	0xf5, 0xa1, 0x6c, 0x4d, 0xc1, 0x6d, 0xae, 0x14,
+	0xee, 0x44, 0x8f, 0x06, 0xe8, 0x61, 0xaa, 0xf6,
+	0x09, 0xd7, 0x70, 0x6a, 0x37, 0xcc, 0xca, 0x0c,
+	0x93, 0x70, 0x8c, 0x36, 0x7d, 0xcf, 0xe7, 0x65,
+	0x33, 0xf0, 0xcc, 0xdb, 0x29, 0x3b, 0xab, 0x18,
+	0x6a, 0xa0, 0x4a, 0xa6, 0x70, 0xa3, 0x50, 0x30,
+	0x4e, 0x30, 0x0c, 0x06, 0x03, 0x55, 0x1d, 0x13,
+	0x01, 0x01, 0xff, 0x04, 0x02, 0x30, 0x00, 0x30,
+	0x1d, 0x06, 0x03, 0x55, 0x1d, 0x0e, 0x04, 0x16,
+	0x04, 0x14, 0xb6, 0x91, 0xe2, 0xb3, 0xf6, 0x7a,
+	0xda, 0x98, 0xb8, 0xd2, 0xb7, 0xf7, 0x17, 0x8b,
+	0x91, 0xfb, 0xde, 0x83, 0xda, 0xcc, 0x30, 0x1f,
+	0x06, 0x03, 0x55, 0x1d, 0x23, 0x04, 0x18, 0x30,
+	0x16, 0x80, 0x14, 0x6b, 0x1c, 0x7f, 0xb3, 0x8f,
+	0x28, 0x53, 0x17, 0x79, 0xc6, 0xa6, 0x31, 0x5f,
+	0xe0, 0xaa, 0xa8, 0x03, 0x00, 0xca, 0xf0, 0x30,
+	0x0a, 0x06, 0x08, 0x2a, 0x86, 0x48, 0xce, 0x3d,
+	0x04, 0x03, 0x02, 0x03, 0x48, 0x00, 0x30, 0x45,
+	0x02, 0x21, 0x00, 0x95, 0xf5, 0x1a, 0x14, 0x5f,
+	0x4d, 0xae, 0xd3, 0xde, 0xf9, 0x7a, 0x91, 0x5a,
+	0x96, 0xa3, 0xc7, 0xfe, 0x26, 0x90, 0xe2, 0xf6,
+	0xca, 0xc4, 0xd3, 0xa3, 0xe9, 0xbe, 0x33, 0x8f,
+	0xeb, 0xe0, 0x16, 0x02, 0x20, 0x15, 0xdb, 0xe3,
+	0x5a, 0x1e, 0x1b, 0x89, 0x93, 0x16, 0xe2, 0x25,
+	0xf3, 0x26, 0x39, 0x6c, 0x4e, 0x9e, 0x2a, 0x2f,
+	0x98, 0xbc, 0x2a, 0x82, 0xc1, 0x79, 0x3b, 0x86,
+	0xed, 0x4c, 0xda, 0xaf, 0xd4, 0x59, 0x01, 0xa4,
+	0x30, 0x82, 0x01, 0xa0, 0x30, 0x82, 0x01, 0x45,
+	0xa0, 0x03, 0x02, 0x01, 0x02, 0x02, 0x01, 0x02,
+	0x30, 0x0a, 0x06, 0x08, 0x2a, 0x86, 0x48, 0xce,
+	0x3d, 0x04, 0x03, 0x02, 0x30, 0x20, 0x31, 0x1e,
+	0x30, 0x1c, 0x06, 0x03, 0x55, 0x04, 0x03, 0x0c,
+	0x15, 0x6c, 0x69, 0x62, 0x66, 0x69, 0x64, 0x6f,
+	0x32, 0x20, 0x54, 0x65, 0x73, 0x74, 0x20, 0x52,
+	0x6f, 0x6f, 0x74, 0x20, 0x43, 0x41, 0x30, 0x20,
+	0x17, 0x0d, 0x32, 0x36, 0x31, 0x30, 0x31, 0x34,
+	0x31, 0x39, 0x33, 0x33, 0x33, 0x35, 0x5a, 0x18,
+	0x0f, 0x32, 0x31, 0x32, 0x36, 0x30, 0x39, 0x32,
+	0x30, 0x31, 0x39, 0x33, 0x33, 0x33, 0x35, 0x5a,
+	0x30, 0x28, 0x31, 0x26, 0x30, 0x24, 0x06, 0x03,
+	0x55, 0x04, 0x03, 0x0c, 0x1d, 0x6c, 0x69, 0x62,
+	0x66, 0x69, 0x64, 0x6f, 0x32, 0x20, 0x54, 0x65,
+	0x73, 0x74, 0x20, 0x49, 0x6e, 0x74, 0x65, 0x72,
+	0x6d, 0x65, 0x64, 0x69, 0x61, 0x74, 0x65, 0x20,
+	0x43, 0x41, 0x30, 0x59, 0x30, 0x13, 0x06, 0x07,
+	0x2a, 0x86, 0x48, 0xce, 0x3d, 0x02, 0x01, 0x06,
+	0x08, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x03, 0x01,
+	0x07, 0x03, 0x42, 0x00, 0x04, 0xc0, 0xdc, 0x14,
+	0x0c, 0x17, 0x0e, 0x73, 0xe3, 0x85, 0x89, 0x7c,
+	0xb0, 0xc0, 0xb0, 0x16, 0xd2, 0x36, 0xc9, 0x6b,
+	0x14, 0x45, 0xad, 0x6b, 0x75, 0xb5, 0x49, 0xc3,
+	0x5b, 0xf5, 0x5e, 0x0a, 0x03, 0x13, 0x34, 0xfc,
+	0x0a, 0x24, 0xd6, 0x60, 0x99, 0x5f, 0xcb, 0x02,
+	0x06, 0x41, 0x4d, 0xe5, 0x83, 0xee, 0xc6, 0x51,
+	0xa3, 0x73, 0x5e, 0x9d, 0x21, 0x3a, 0x0d, 0x26,
+	0x95, 0xea, 0x55, 0xe2, 0x95, 0xa3, 0x66, 0x30,
+	0x64, 0x30, 0x12, 0x06, 0x03, 0x55, 0x1d, 0x13,
+	0x01, 0x01, 0xff, 0x04, 0x08, 0x30, 0x06, 0x01,
+	0x01, 0xff, 0x02, 0x01, 0x00, 0x30, 0x0e, 0x06,
+	0x03, 0x55, 0x1d, 0x0f, 0x01, 0x01, 0xff, 0x04,
+	0x04, 0x03, 0x02, 0x01, 0x06, 0x30, 0x1d, 0x06,
+	0x03, 0x55, 0x1d, 0x0e, 0x04, 0x16, 0x04, 0x14,
+	0x6b, 0x1c, 0x7f, 0xb3, 0x8f, 0x28, 0x53, 0x17,
+	0x79, 0xc6, 0xa6, 0x31, 0x5f, 0xe0, 0xaa, 0xa8,
+	0x03, 0x00, 0xca, 0xf0, 0x30, 0x1f, 0x06, 0x03,
+	0x55, 0x1d, 0x23, 0x04, 0x18, 0x30, 0x16, 0x80,
+	0x14, 0x3d, 0x4c, 0x90, 0xb7, 0x81, 0x77, 0x1d,
+	0x07, 0x7a, 0x86, 0xab, 0x6b, 0xeb, 0xcc, 0xb2,
+	0xe3, 0x3d, 0xf7, 0xbb, 0x4b, 0x30, 0x0a, 0x06,
+	0x08, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x04, 0x03,
+	0x02, 0x03, 0x49, 0x00, 0x30, 0x46, 0x02, 0x21,
+	0x00, 0xe2, 0x99, 0xa1, 0xa7, 0xe5, 0xea, 0x62,
+	0x19, 0xdd, 0x66, 0x21, 0x32, 0x08, 0xd3, 0xea,
+	0xb4, 0xdb, 0xf4, 0x2d, 0x28, 0xb2, 0xed, 0xba,
+	0xa4, 0x59, 0x62, 0x46, 0x14, 0xa0, 0x60, 0xe5,
+	0x43, 0x02, 0x21, 0x00, 0xe1, 0xc6, 0xf2, 0x28,
+	0xd4, 0xa2, 0xca, 0x9b, 0xcc, 0x83, 0xa9, 0xe5,
+	0x0f, 0x95, 0x0e, 0x75, 0x42, 0x0f, 0xe4, 0x3d,
+	0x5c, 0xb5, 0xaa, 0x50, 0xce, 0xfd, 0xbd, 0x28,
+	0x4d, 0xac, 0xdf, 0x83,
+};
+
+static const unsigned char x509_trust_b[394] = {
+	0x30, 0x82, 0x01, 0x86, 0x30, 0x82, 0x01, 0x2c,
+	0xa0, 0x03, 0x02, 0x01, 0x02, 0x02, 0x01, 0x0b,
+	0x30, 0x0a, 0x06, 0x08, 0x2a, 0x86, 0x48, 0xce,
+	0x3d, 0x04, 0x03, 0x02, 0x30, 0x28, 0x31, 0x26,
+	0x30, 0x24, 0x06, 0x03, 0x55, 0x04, 0x03, 0x0c,
+	0x1d, 0x6c, 0x69, 0x62, 0x66, 0x69, 0x64, 0x6f,
+	0x32, 0x20, 0x54, 0x65, 0x73, 0x74, 0x20, 0x49,
+	0x6e, 0x74, 0x65, 0x72, 0x6d, 0x65, 0x64, 0x69,
+	0x61, 0x74, 0x65, 0x20, 0x43, 0x41, 0x30, 0x20,
+	0x17, 0x0d, 0x32, 0x36, 0x31, 0x30, 0x31, 0x34,
+	0x31, 0x39, 0x33, 0x33, 0x33, 0x35, 0x5a, 0x18,
+	0x0f, 0x32, 0x31, 0x32, 0x36, 0x30, 0x39, 0x32,
+	0x30, 0x31, 0x39, 0x33, 0x33, 0x33, 0x35, 0x5a,
+	0x30, 0x1d, 0x31, 0x1b, 0x30, 0x19, 0x06, 0x03,
+	0x55, 0x04, 0x03, 0x0c, 0x12, 0x6c, 0x69, 0x62,
+	0x66, 0x69, 0x64, 0x6f, 0x32, 0x20, 0x54, 0x65,
+	0x73, 0x74, 0x20, 0x45, 0x45, 0x20, 0x62, 0x30,
+	0x59, 0x30, 0x13, 0x06, 0x07, 0x2a, 0x86, 0x48,
+	0xce, 0x3d, 0x02, 0x01, 0x06, 0x08, 0x2a, 0x86,
+	0x48, 0xce, 0x3d, 0x03, 0x01, 0x07, 0x03, 0x42,
+	0x00, 0x04, 0x8c, 0x26, 0xc3, 0xed, 0xb0, 0xa8,
+	0x32, 0x58, 0x1f, 0x50, 0x2a, 0x3c, 0xf7, 0x5e,
+	0x5e, 0x67, 0x49, 0x25, 0x3f, 0x71, 0x6f, 0x65,
+	0xd6, 0x4b, 0x7f, 0x88, 0xea, 0xf2, 0x72, 0x81,
+	0xed, 0xe1, 0xb7, 0x77, 0xb4, 0xff, 0x9b, 0x9c,
+	0x9a, 0x7d, 0xb9, 0x53, 0x18, 0x70, 0x82, 0x5c,
+	0x60, 0xe0, 0xc5, 0xb5, 0x2c, 0x7f, 0xbb, 0xf4,
+	0x75, 0x34, 0x87, 0xf9, 0xe9, 0x99, 0x19, 0xa5,
+	0x6e, 0x52, 0xa3, 0x50, 0x30, 0x4e, 0x30, 0x0c,
+	0x06, 0x03, 0x55, 0x1d, 0x13, 0x01, 0x01, 0xff,
+	0x04, 0x02, 0x30, 0x00, 0x30, 0x1d, 0x06, 0x03,
+	0x55, 0x1d, 0x0e, 0x04, 0x16, 0x04, 0x14, 0xb2,
+	0xbe, 0x0b, 0x40, 0xbb, 0x38, 0xed, 0x46, 0xdc,
+	0x87, 0x7d, 0x01, 0x59, 0xa5, 0xd4, 0xaa, 0xb1,
+	0x1d, 0x89, 0x6a, 0x30, 0x1f, 0x06, 0x03, 0x55,
+	0x1d, 0x23, 0x04, 0x18, 0x30, 0x16, 0x80, 0x14,
+	0x6b, 0x1c, 0x7f, 0xb3, 0x8f, 0x28, 0x53, 0x17,
+	0x79, 0xc6, 0xa6, 0x31, 0x5f, 0xe0, 0xaa, 0xa8,
+	0x03, 0x00, 0xca, 0xf0, 0x30, 0x0a, 0x06, 0x08,
+	0x2a, 0x86, 0x48, 0xce, 0x3d, 0x04, 0x03, 0x02,
+	0x03, 0x48, 0x00, 0x30, 0x45, 0x02, 0x21, 0x00,
+	0xd5, 0xae, 0x9c, 0xc4, 0xea, 0x7d, 0x30, 0x77,
+	0x2e, 0x55, 0x68, 0x09, 0xde, 0x2c, 0xa9, 0x46,
+	0x1e, 0x0c, 0xbf, 0x12, 0xfe, 0xdf, 0xfc, 0xda,
+	0x5b, 0xf8, 0xee, 0xea, 0x93, 0x8c, 0x24, 0xb5,
+	0x02, 0x20, 0x75, 0x3d, 0x37, 0x55, 0x43, 0x60,
+	0x7e, 0xd3, 0x35, 0xeb, 0x5a, 0xb3, 0x21, 0x29,
+	0xef, 0x19, 0xe2, 0x04, 0xd8, 0x1c, 0xb0, 0x13,
+	0x32, 0xf1, 0xa7, 0x34, 0x9c, 0xec, 0x99, 0xbf,
+	0xdb, 0xb4,
+};
+
+static const unsigned char sig_trust_b[71] = {
+	0x30, 0x45, 0x02, 0x21, 0x00, 0xdf, 0x1f, 0x78,
+	0x94, 0x6d, 0x2a, 0x00, 0xd6, 0x90, 0xc1, 0x49,
+	0x83, 0x67, 0x07, 0xfa, 0x2c, 0x3d, 0x2a, 0x09,
+	0x94, 0x12, 0x6c, 0xa4, 0xf6, 0x60, 0xb3, 0xdc,
+	0x1e, 0xcf, 0x88, 0xf1, 0x86, 0x02, 0x20, 0x10,
+	0x3f, 0x1a, 0xf5, 0xce, 0x63, 0xec, 0xf9, 0xf4,
+	0xd1, 0x90, 0xd2, 0x4d, 0x3b, 0xab, 0xc4, 0x67,
+	0xb2, 0x2c, 0xa1, 0x9a, 0xe7, 0x0d, 0xcf, 0xef,
+	0xfe, 0xc3, 0xf8, 0x10, 0xda, 0x7f, 0x0b,
+};
+
+static const char trust_root_pem[] =
+	"-----BEGIN CERTIFICATE-----\n"
+	"MIIBpzCCAU2gAwIBAgIUS7ugA9jJ0Zovl/Me94gxD83QXI8wCgYIKoZIzj0EAwIw\n"
+	"IDEeMBwGA1UEAwwVbGliZmlkbzIgVGVzdCBSb290IENBMCAXDTI2MTAxNDE5MzMz\n"
+	"NVoYDzIxMjYwOTIwMTkzMzM1WjAgMR4wHAYDVQQDDBVsaWJmaWRvMiBUZXN0IFJv\n"
+	"b3QgQ0EwWTATBgcqhkjOPQIBBggqhkjOPQMBBwNCAASCtDGAbSqIySxjKwuwR9Ic\n"
+	"JBqWQx49AwHFHeJ82LopXz8fbIsk+Ut/6O89vGbV3q0XF8cccc9Qgn9XoUMo40F/\n"
+	"o2MwYTAdBgNVHQ4EFgQUPUyQt4F3HQd6hqtr68yy4z33u0swHwYDVR0jBBgwFoAU\n"
+	"PUyQt4F3HQd6hqtr68yy4z33u0swDwYDVR0TAQH/BAUwAwEB/zAOBgNVHQ8BAf8E\n"
+	"BAMCAQYwCgYIKoZIzj0EAwIDSAAwRQIhAI/VXheQJPzPb/t8mK2Tiygogwv5BfST\n"
+	"odWFfO3pAnLyAiAXRLGOfkrAfIZr6VP2zdsZqFN3WgNagnTBeY8uUxTjVw==\n"
+	"-----END CERTIFICATE-----\n";
+
+static const char mds_blob[] =
+	"eyJhbGciOiJFUzI1NiIsInR5cCI6IkpXVCIsIng1YyI6WyJNSUlCakRDQ0FUS2dB"
+	"d0lCQWdJQkZEQUtCZ2dxaGtqT1BRUURBakFvTVNZd0pBWURWUVFEREIxc2FXSm1h"
+	"V1J2TWlCVVpYTjBJRWx1ZEdWeWJXVmthV0YwWlNCRFFUQWdGdzB5TmpFd01UUXhP"
+	"VFF3TURkYUdBOHlNVEkyTURreU1ERTVOREF3TjFvd0l6RWhNQjhHQTFVRUF3d1li"
+	"R2xpWm1sa2J6SWdWR1Z6ZENCTlJGTWdVMmxuYm1WeU1Ga3dFd1lIS29aSXpqMENB"
+	"UVlJS29aSXpqMERBUWNEUWdBRTFzbU9weUJHTGNiOERqd2FZeC9Na2loY2tTd1Vx"
+	"eWdEbmRXU3lodmZKMTEzc1R1ZHVsbTdZMkNhdW43cFg1OVdUTHp1aCtQOE5PL1RS"
+	"eW1hQnJsbDhxTlFNRTR3REFZRFZSMFRBUUgvQkFJd0FEQWRCZ05WSFE0RUZnUVVL"
+	"a2huMzVsU2JzWnA4Ny81MDNEZDNDRkdkUll3SHdZRFZSMGpCQmd3Rm9BVWF4eC9z"
+	"NDhvVXhkNXhxWXhYK0NxcUFNQXl2QXdDZ1lJS29aSXpqMEVBd0lEU0FBd1JRSWdT"
+	"RjdFbFo0QjNTeWtIeHoxcFQ5Y0Fia2JDM0M0cWF4V21UZVVBL3A0OG1FQ0lRRDdr"
+	"ZW4raDBsZElwdFl5cloxM1p2VGJIZi90dCtUbnNYdnhva3EweStYTGc9PSIsIk1J"
+	"SUJvRENDQVVXZ0F3SUJBZ0lCQWpBS0JnZ3Foa2pPUFFRREFqQWdNUjR3SEFZRFZR"
+	"UUREQlZzYVdKbWFXUnZNaUJVWlhOMElGSnZiM1FnUTBFd0lCY05Nall4TURFME1U"
+	"a3pNek0xV2hnUE1qRXlOakE1TWpBeE9UTXpNelZhTUNneEpqQWtCZ05WQkFNTUhX"
+	"eHBZbVpwWkc4eUlGUmxjM1FnU1c1MFpYSnRaV1JwWVhSbElFTkJNRmt3RXdZSEtv"
+	"Wkl6ajBDQVFZSUtvWkl6ajBEQVFjRFFnQUV3TndVREJjT2MrT0ZpWHl3d0xBVzBq"
+	"YkpheFJGcld0MXRVbkRXL1ZlQ2dNVE5Qd0tKTlpnbVYvTEFnWkJUZVdEN3NaUm8z"
+	"TmVuU0U2RFNhVjZsWGlsYU5tTUdRd0VnWURWUjBUQVFIL0JBZ3dCZ0VCL3dJQkFE"
+	"QU9CZ05WSFE4QkFmOEVCQU1DQVFZd0hRWURWUjBPQkJZRUZHc2NmN09QS0ZNWGVj"
+	"YW1NVi9ncXFnREFNcndNQjhHQTFVZEl3UVlNQmFBRkQxTWtMZUJkeDBIZW9hcmEr"
+	"dk1zdU05OTd0TE1Bb0dDQ3FHU000OUJBTUNBMGtBTUVZQ0lRRGltYUduNWVwaUdk"
+	"MW1JVElJMCtxMDIvUXRLTEx0dXFSWllrWVVvR0RsUXdJaEFPSEc4aWpVb3NxYnpJ"
+	"T3A1UStWRG5WQ0QrUTlYTFdxVU03OXZTaE5yTitEIl19.eyJsZWdhbEhlYWRlciI"
+	"6IlRlc3Qgb25seS4iLCJubyI6NDIsIm5leHRVcGRhdGUiOiIyMDk5LTAxLTAxIiw"
+	"iZW50cmllcyI6W3siYXR0ZXN0YXRpb25DZXJ0aWZpY2F0ZUtleUlkZW50aWZpZXJ"
+	"zIjpbIjkyMzg4MWZlMmYyMTRlZTQ2NTQ4NDM3MWFlYjcyZTk3ZjVhNThlMGEiXSw"
+	"ic3RhdHVzUmVwb3J0cyI6W3sic3RhdHVzIjoiRklET19DRVJUSUZJRUQiLCJlZmZ"
+	"lY3RpdmVEYXRlIjoiMjAxOC0wNS0wMSJ9XX0seyJhYWd1aWQiOiJmOGEwMTFmMy0"
+	"4YzBhLTRkMTUtODAwNi0xNzExMWY5ZWRjN2QiLCJtZXRhZGF0YVN0YXRlbWVudCI"
+	"6eyJkZXNjcmlwdGlvbiI6IlRlc3QgQXV0aGVudGljYXRvciBcdTAwZTkiLCJzY2h"
+	"lbWEiOjMsImtleVByb3RlY3Rpb24iOlsiaGFyZHdhcmUiLCJzZWN1cmVfZWxlbWV"
+	"udCJdLCJhdHRlc3RhdGlvblJvb3RDZXJ0aWZpY2F0ZXMiOlsiTUlJQnB6Q0NBVTJ"
+	"nQXdJQkFnSVVTN3VnQTlqSjBab3ZsL01lOTRneEQ4M1FYSTh3Q2dZSUtvWkl6ajB"
+	"FQXdJd0lERWVNQndHQTFVRUF3d1ZiR2xpWm1sa2J6SWdWR1Z6ZENCU2IyOTBJRU5"
+	"CTUNBWERUSTJNVEF4TkRFNU16TXpOVm9ZRHpJeE1qWXdPVEl3TVRrek16TTFXakF"
+	"nTVI0d0hBWURWUVFEREJWc2FXSm1hV1J2TWlCVVpYTjBJRkp2YjNRZ1EwRXdXVEF"
+	"UQmdjcWhrak9QUUlCQmdncWhrak9QUU1CQndOQ0FBU0N0REdBYlNxSXlTeGpLd3V"
+	"3UjlJY0pCcVdReDQ5QXdIRkhlSjgyTG9wWHo4ZmJJc2srVXQvNk84OXZHYlYzcTB"
+	"YRjhjY2NjOVFnbjlYb1VNbzQwRi9vMk13WVRBZEJnTlZIUTRFRmdRVVBVeVF0NEY"
+	"zSFFkNmhxdHI2OHl5NHozM3Uwc3dId1lEVlIwakJCZ3dGb0FVUFV5UXQ0RjNIUWQ"
+	"2aHF0cjY4eXk0ejMzdTBzd0R3WURWUjBUQVFIL0JBVXdBd0VCL3pBT0JnTlZIUTh"
+	"CQWY4RUJBTUNBUVl3Q2dZSUtvWkl6ajBFQXdJRFNBQXdSUUloQUkvVlhoZVFKUHp"
+	"QYi90OG1LMlRpeWdvZ3d2NUJmU1RvZFdGZk8zcEFuTHlBaUFYUkxHT2ZrckFmSVp"
+	"yNlZQMnpkc1pxRk4zV2dOYWduVEJlWTh1VXhUalZ3PT0iXSwiYXV0aGVudGljYXR"
+	"vckdldEluZm8iOnsidmVyc2lvbnMiOlsiRklET18yXzAiXSwib3B0aW9ucyI6eyJ"
+	"yayI6dHJ1ZX19fSwic3RhdHVzUmVwb3J0cyI6W3sic3RhdHVzIjoiRklET19DRVJ"
+	"USUZJRUQiLCJlZmZlY3RpdmVEYXRlIjoiMjAyMC0wMS0wMSJ9LHsic3RhdHVzIjo"
+	"iRklET19DRVJUSUZJRURfTDEiLCJlZmZlY3RpdmVEYXRlIjoiMjAyMS0wNi0wMSJ"
+	"9LHsic3RhdHVzIjoiTk9UX0ZJRE9fQ0VSVElGSUVEIiwiZWZmZWN0aXZlRGF0ZSI"
+	"6IjIwMTktMDEtMDEifV0sInRpbWVPZkxhc3RTdGF0dXNDaGFuZ2UiOiIyMDIxLTA"
+	"2LTAxIn0seyJhYWd1aWQiOiIwMDAwMDAwMC0wMDAwLTAwMDAtMDAwMC0wMDAwMDA"
+	"wMDAwMDEiLCJtZXRhZGF0YVN0YXRlbWVudCI6eyJkZXNjcmlwdGlvbiI6IlJldm9"
+	"rZWQgQXV0aGVudGljYXRvciIsImtleVByb3RlY3Rpb24iOlsic29mdHdhcmUiXX0"
+	"sInN0YXR1c1JlcG9ydHMiOlt7InN0YXR1cyI6IlJFVk9LRUQiLCJlZmZlY3RpdmV"
+	"EYXRlIjoiMjAyMi0wMS0wMSJ9XX1dfQ.-iFppdtm5cdQVmN9b6xMGPut1OlgLWiE"
+	"O4LyW95q1rNztnY07srRaPODbQRIpx-vYEbMiITIEw91PpgxccYjQA";
+
+static const char mds_blob_old[] =
+	"eyJhbGciOiJFUzI1NiIsInR5cCI6IkpXVCIsIng1YyI6WyJNSUlCakRDQ0FUS2dB"
+	"d0lCQWdJQkZEQUtCZ2dxaGtqT1BRUURBakFvTVNZd0pBWURWUVFEREIxc2FXSm1h"
+	"V1J2TWlCVVpYTjBJRWx1ZEdWeWJXVmthV0YwWlNCRFFUQWdGdzB5TmpFd01UUXhP"
+	"VFF3TURkYUdBOHlNVEkyTURreU1ERTVOREF3TjFvd0l6RWhNQjhHQTFVRUF3d1li"
+	"R2xpWm1sa2J6SWdWR1Z6ZENCTlJGTWdVMmxuYm1WeU1Ga3dFd1lIS29aSXpqMENB"
+	"UVlJS29aSXpqMERBUWNEUWdBRTFzbU9weUJHTGNiOERqd2FZeC9Na2loY2tTd1Vx"
+	"eWdEbmRXU3lodmZKMTEzc1R1ZHVsbTdZMkNhdW43cFg1OVdUTHp1aCtQOE5PL1RS"
+	"eW1hQnJsbDhxTlFNRTR3REFZRFZSMFRBUUgvQkFJd0FEQWRCZ05WSFE0RUZnUVVL"
+	"a2huMzVsU2JzWnA4Ny81MDNEZDNDRkdkUll3SHdZRFZSMGpCQmd3Rm9BVWF4eC9z"
+	"NDhvVXhkNXhxWXhYK0NxcUFNQXl2QXdDZ1lJS29aSXpqMEVBd0lEU0FBd1JRSWdT"
+	"RjdFbFo0QjNTeWtIeHoxcFQ5Y0Fia2JDM0M0cWF4V21UZVVBL3A0OG1FQ0lRRDdr"
+	"ZW4raDBsZElwdFl5cloxM1p2VGJIZi90dCtUbnNYdnhva3EweStYTGc9PSIsIk1J"
+	"SUJvRENDQVVXZ0F3SUJBZ0lCQWpBS0JnZ3Foa2pPUFFRREFqQWdNUjR3SEFZRFZR"
+	"UUREQlZzYVdKbWFXUnZNaUJVWlhOMElGSnZiM1FnUTBFd0lCY05Nall4TURFME1U"
+	"a3pNek0xV2hnUE1qRXlOakE1TWpBeE9UTXpNelZhTUNneEpqQWtCZ05WQkFNTUhX"
+	"eHBZbVpwWkc4eUlGUmxjM1FnU1c1MFpYSnRaV1JwWVhSbElFTkJNRmt3RXdZSEtv"
+	"Wkl6ajBDQVFZSUtvWkl6ajBEQVFjRFFnQUV3TndVREJjT2MrT0ZpWHl3d0xBVzBq"
+	"YkpheFJGcld0MXRVbkRXL1ZlQ2dNVE5Qd0tKTlpnbVYvTEFnWkJUZVdEN3NaUm8z"
+	"TmVuU0U2RFNhVjZsWGlsYU5tTUdRd0VnWURWUjBUQVFIL0JBZ3dCZ0VCL3dJQkFE"
+	"QU9CZ05WSFE4QkFmOEVCQU1DQVFZd0hRWURWUjBPQkJZRUZHc2NmN09QS0ZNWGVj"
+	"YW1NVi9ncXFnREFNcndNQjhHQTFVZEl3UVlNQmFBRkQxTWtMZUJkeDBIZW9hcmEr"
+	"dk1zdU05OTd0TE1Bb0dDQ3FHU000OUJBTUNBMGtBTUVZQ0lRRGltYUduNWVwaUdk"
+	"MW1JVElJMCtxMDIvUXRLTEx0dXFSWllrWVVvR0RsUXdJaEFPSEc4aWpVb3NxYnpJ"
+	"T3A1UStWRG5WQ0QrUTlYTFdxVU03OXZTaE5yTitEIl19.eyJubyI6NDEsImVudHJ"
+	"pZXMiOltdfQ.K585aLflVoFtWBJCkERt5fq6km582MNg2Iom0ssFvR9OlhAfM8-C"
+	"MgLaJzEYsVQjS91kuJDP02OGyXSDUMCYsQ";
+
 const char rp_id[] = "localhost";
 const char rp_name[] = "sweet home localhost";
 
@@ -1537,6 +1877,39 @@ valid_cred(void)
 	free_cred(c);
 }
 
+static void
+borrow_take(void)
+{
+	fido_cred_t *c;
+	unsigned char *x;
+
+	x = malloc(sizeof(x509));
+	assert(x != NULL);
+	memcpy(x, x509, sizeof(x509));
+
+	c = alloc_cred();
+	assert(fido_cred_set_type(c, COSE_ES256) == FIDO_OK);
+	assert(fido_cred_set_clientdata_hash(c, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_cred_set_rp(c, rp_id, rp_name) == FIDO_OK);
+	assert(fido_cred_set_authdata_raw(c, authdata + 2,
+	    sizeof(authdata) - 2) == FIDO_OK);
+	assert(fido_cred_authdata_len(c) == sizeof(authdata));
+	assert(memcmp(fido_cred_authdata_ptr(c), authdata,
+	    sizeof(authdata)) == 0);
+	assert(fido_cred_set_rk(c, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_cred_set_uv(c, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_cred_set_x509_take(c, NULL,
+	    sizeof(x509)) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_cred_set_x509_take(c, x, sizeof(x509)) == FIDO_OK);
+	assert(fido_cred_set_sig_borrow(c, sig, sizeof(sig)) == FIDO_OK);
+	assert(fido_cred_sig_ptr(c) == sig);
+	assert(fido_cred_set_fmt(c, "packed") == FIDO_OK);
+	assert(fido_cred_verify(c) == FIDO_OK);
+	assert(fido_cred_x5c_len(c) == sizeof(x509));
+	assert(memcmp(fido_cred_x5c_ptr(c), x509, sizeof(x509)) == 0);
+	free_cred(c);
+}
+
 static void
 no_cdh(void)
 {
@@ -2143,6 +2516,425 @@ valid_tpm_es256_cred(void)
 	free_cred(c);
 }
 
+static void
+bad_tpm_es256_cred(void)
+{
+	static const unsigned char magic[4] = { 0xff, 0x54, 0x43, 0x47 };
+	const unsigned char *field[2] = { magic, pubkey_tpm_es256 };
+	const size_t field_len[2] = { sizeof(magic), 32 };
+	unsigned char *attstmt;
+	fido_cred_t *c;
+	size_t off;
+
+	/* certinfo's magic; pubarea's x coordinate */
+	for (size_t i = 0; i < 2; i++) {
+		assert((attstmt = malloc(sizeof(attstmt_tpm_es256))) != NULL);
+		memcpy(attstmt, attstmt_tpm_es256, sizeof(attstmt_tpm_es256));
+		for (off = 0; off + field_len[i] <= sizeof(attstmt_tpm_es256);
+		    off++)
+			if (memcmp(attstmt + off, field[i], field_len[i]) == 0)
+				break;
+		assert(off + field_len[i] <= sizeof(attstmt_tpm_es256));
+		attstmt[off + field_len[i] - 1] ^= 1;
+		c = alloc_cred();
+		assert(fido_cred_set_type(c, COSE_ES256) == FIDO_OK);
+		assert(fido_cred_set_clientdata(c, cdh, sizeof(cdh)) == FIDO_OK);
+		assert(fido_cred_set_rp(c, rp_id, rp_name) == FIDO_OK);
+		assert(fido_cred_set_authdata(c, authdata_tpm_es256, sizeof(authdata_tpm_es256)) == FIDO_OK);
+		assert(fido_cred_set_rk(c, FIDO_OPT_FALSE) == FIDO_OK);
+		assert(fido_cred_set_uv(c, FIDO_OPT_TRUE) == FIDO_OK);
+		assert(fido_cred_set_fmt(c, "tpm") == FIDO_OK);
+		assert(fido_cred_set_attstmt(c, attstmt, sizeof(attstmt_tpm_es256)) == FIDO_OK);
+		assert(fido_cred_verify(c) == FIDO_ERR_INTERNAL);
+		free_cred(c);
+		free(attstmt);
+	}
+}
+
+/* attested by a leaf of trust_root, sent with its intermediate */
+static fido_cred_t *
+alloc_trust_cred(void)
+{
+	fido_cred_t *c;
+
+	c = alloc_cred();
+	assert(fido_cred_set_type(c, COSE_ES256) == FIDO_OK);
+	assert(fido_cred_set_clientdata_hash(c, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_cred_set_rp(c, rp_id, rp_name) == FIDO_OK);
+	assert(fido_cred_set_authdata(c, authdata, sizeof(authdata)) == FIDO_OK);
+	assert(fido_cred_set_rk(c, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_cred_set_uv(c, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_cred_set_fmt(c, "packed") == FIDO_OK);
+	assert(fido_cred_set_attstmt(c, attstmt_trust_a, sizeof(attstmt_trust_a)) == FIDO_OK);
+	assert(fido_cred_verify(c) == FIDO_OK);
+
+	return (c);
+}
+
+static void
+trust_store(void)
+{
+	fido_trust_store_t *ts, *ts_pem;
+	fido_cred_t *a, *b, *c;
+
+	a = alloc_trust_cred();
+
+	/* signed by a sibling of a's leaf, but sent without the intermediate */
+	b = alloc_cred();
+	assert(fido_cred_set_type(b, COSE_ES256) == FIDO_OK);
+	assert(fido_cred_set_clientdata_hash(b, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_cred_set_rp(b, rp_id, rp_name) == FIDO_OK);
+	assert(fido_cred_set_authdata(b, authdata, sizeof(authdata)) == FIDO_OK);
+	assert(fido_cred_set_rk(b, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_cred_set_uv(b, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_cred_set_x509(b, x509_trust_b, sizeof(x509_trust_b)) == FIDO_OK);
+	assert(fido_cred_set_sig(b, sig_trust_b, sizeof(sig_trust_b)) == FIDO_OK);
+	assert(fido_cred_set_fmt(b, "packed") == FIDO_OK);
+	assert(fido_cred_verify(b) == FIDO_OK);
+
+	/* chains to a root we do not have */
+	c = alloc_cred();
+	assert(fido_cred_set_type(c, COSE_ES256) == FIDO_OK);
+	assert(fido_cred_set_clientdata_hash(c, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_cred_set_rp(c, rp_id, rp_name) == FIDO_OK);
+	assert(fido_cred_set_authdata(c, authdata, sizeof(authdata)) == FIDO_OK);
+	assert(fido_cred_set_rk(c, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_cred_set_uv(c, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_cred_set_x509(c, x509, sizeof(x509)) == FIDO_OK);
+	assert(fido_cred_set_sig(c, sig, sizeof(sig)) == FIDO_OK);
+	assert(fido_cred_set_fmt(c, "packed") == FIDO_OK);
+	assert(fido_cred_verify(c) == FIDO_OK);
+
+	assert((ts = fido_trust_store_new()) != NULL);
+	assert(fido_cred_verify_trust(a, NULL) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_cred_verify_trust(a, ts) == FIDO_ERR_INVALID_SIG);
+	assert(fido_trust_store_add_der(ts, NULL, 0) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_trust_store_add_der(ts, trust_root, sizeof(trust_root) - 1) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_trust_store_add_pem(ts, "junk", 4) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_trust_store_add_der(ts, trust_root, sizeof(trust_root)) == FIDO_OK);
+	assert(fido_cred_verify_trust(b, ts) == FIDO_ERR_INVALID_SIG);
+	assert(fido_cred_verify_trust(a, ts) == FIDO_OK);
+	assert(fido_cred_verify_trust(a, ts) == FIDO_OK);
+	assert(fido_cred_verify_trust(b, ts) == FIDO_OK);
+	assert(fido_cred_verify_trust(c, ts) == FIDO_ERR_INVALID_SIG);
+
+	assert((ts_pem = fido_trust_store_new()) != NULL);
+	assert(fido_trust_store_add_pem(ts_pem, trust_root_pem, strlen(trust_root_pem)) == FIDO_OK);
+	assert(fido_cred_verify_trust(b, ts_pem) == FIDO_ERR_INVALID_SIG);
+	assert(fido_cred_verify_trust(a, ts_pem) == FIDO_OK);
+
+	fido_trust_store_free(&ts);
+	fido_trust_store_free(&ts_pem);
+	assert(ts == NULL && ts_pem == NULL);
+	fido_trust_store_free(&ts);
+	fido_trust_store_free(NULL);
+	free_cred(a);
+	free_cred(b);
+	free_cred(c);
+}
+
+static void
+mds(void)
+{
+	const unsigned char revoked[16] = {
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+	};
+	fido_trust_store_t *ts, *ts_empty;
+	fido_mds_t *m;
+	fido_mds_entry_t *e, *r;
+	fido_cred_t *a;
+	char *bad;
+
+	assert((ts = fido_trust_store_new()) != NULL);
+	assert((ts_empty = fido_trust_store_new()) != NULL);
+	assert(fido_trust_store_add_der(ts, trust_root, sizeof(trust_root)) == FIDO_OK);
+	assert((m = fido_mds_new()) != NULL);
+	assert(fido_mds_no(m) == -1);
+	assert(fido_mds_len(m) == 0);
+	assert(fido_mds_lookup(m, aaguid, sizeof(aaguid)) == NULL);
+
+	assert(fido_mds_load(m, mds_blob, strlen(mds_blob), NULL) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_mds_load(m, "junk", 4, ts) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_mds_load(m, mds_blob, strlen(mds_blob), ts_empty) == FIDO_ERR_INVALID_SIG);
+	assert((bad = strdup(mds_blob)) != NULL);
+	bad[strlen(bad) - 200] ^= 1;
+	assert(fido_mds_load(m, bad, strlen(bad), ts) == FIDO_ERR_INVALID_SIG);
+	free(bad);
+	assert(fido_mds_no(m) == -1);
+
+	assert(fido_mds_load(m, mds_blob, strlen(mds_blob), ts) == FIDO_OK);
+	assert(fido_mds_no(m) == 42);
+	assert(fido_mds_len(m) == 2);
+	assert(fido_mds_lookup(m, aaguid, sizeof(aaguid) - 1) == NULL);
+	assert(fido_mds_lookup(m, aaguid_tpm, sizeof(aaguid_tpm)) == NULL);
+	assert((e = fido_mds_lookup(m, aaguid, sizeof(aaguid))) != NULL);
+	assert(strcmp(fido_mds_entry_status(e), "FIDO_CERTIFIED_L1") == 0);
+	assert(strcmp(fido_mds_entry_description(e), "Test Authenticator \xc3\xa9") == 0);
+	assert(fido_mds_entry_key_protection(e) == (FIDO_MDS_KEY_HARDWARE | FIDO_MDS_KEY_SECURE_ELEMENT));
+	assert((r = fido_mds_lookup(m, revoked, sizeof(revoked))) != NULL);
+	assert(strcmp(fido_mds_entry_status(r), "REVOKED") == 0);
+	assert(fido_mds_entry_key_protection(r) == FIDO_MDS_KEY_SOFTWARE);
+
+	a = alloc_trust_cred();
+	assert(fido_cred_verify_trust(a, fido_mds_entry_trust_store(e)) == FIDO_OK);
+	assert(fido_cred_verify_trust(a, fido_mds_entry_trust_store(r)) == FIDO_ERR_INVALID_SIG);
+
+	/* older blobs are refused; entries outlive reloads */
+	assert(fido_mds_load(m, mds_blob_old, strlen(mds_blob_old), ts) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_mds_no(m) == 42);
+	assert(fido_mds_load(m, mds_blob, strlen(mds_blob), ts) == FIDO_OK);
+	fido_mds_free(&m);
+	assert(m == NULL);
+	assert(strcmp(fido_mds_entry_status(e), "FIDO_CERTIFIED_L1") == 0);
+	fido_mds_entry_free(&e);
+	fido_mds_entry_free(&r);
+	assert(e == NULL && r == NULL);
+	fido_mds_entry_free(&e);
+	fido_mds_free(&m);
+
+	free_cred(a);
+	fido_trust_store_free(&ts);
+	fido_trust_store_free(&ts_empty);
+}
+
+static void
+x5c_cache(void)
+{
+	assert(fido_x5c_cache_size() == 0);
+	assert(fido_x5c_cache_set_size(1025) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_x5c_cache_set_size(1) == FIDO_OK);
+	assert(fido_x5c_cache_size() == 1);
+	assert(fido_x5c_cache_len() == 0);
+
+	valid_cred();
+	assert(fido_x5c_cache_len() == 1);
+	assert(fido_x5c_cache_hits() == 0);
+	assert(fido_x5c_cache_misses() == 1);
+	valid_cred();
+	junk_sig();
+	assert(fido_x5c_cache_hits() == 2);
+	assert(fido_x5c_cache_misses() == 1);
+
+	/* unparseable certificates are not cached */
+	junk_x509();
+	assert(fido_x5c_cache_len() == 1);
+	assert(fido_x5c_cache_misses() == 2);
+
+	/* a new certificate evicts the old one */
+	valid_tpm_rs256_cred();
+	valid_cred();
+	assert(fido_x5c_cache_len() == 1);
+	assert(fido_x5c_cache_hits() == 2);
+	assert(fido_x5c_cache_misses() == 4);
+
+	assert(fido_x5c_cache_set_size(2) == FIDO_OK);
+	valid_tpm_rs256_cred();
+	valid_cred();
+	assert(fido_x5c_cache_len() == 2);
+	assert(fido_x5c_cache_hits() == 3);
+	assert(fido_x5c_cache_misses() == 5);
+
+	fido_x5c_cache_clear();
+	assert(fido_x5c_cache_size() == 2);
+	assert(fido_x5c_cache_len() == 0);
+	assert(fido_x5c_cache_hits() == 0);
+	assert(fido_x5c_cache_misses() == 0);
+
+	assert(fido_x5c_cache_set_size(0) == FIDO_OK);
+	valid_cred();
+	assert(fido_x5c_cache_size() == 0);
+	assert(fido_x5c_cache_len() == 0);
+	assert(fido_x5c_cache_misses() == 0);
+}
+
+static size_t nalloc; /* live allocations */
+static size_t nalloc_total;
+
+static void *
+count_malloc(size_t n)
+{
+	void *p;
+
+	if ((p = malloc(n)) != NULL) {
+		nalloc++;
+		nalloc_total++;
+	}
+
+	return p;
+}
+
+static void *
+count_realloc(void *p, size_t n)
+{
+	void *q;
+
+	if ((q = realloc(p, n)) != NULL && p == NULL) {
+		nalloc++;
+		nalloc_total++;
+	}
+
+	return q;
+}
+
+static void
+count_free(void *p)
+{
+	if (p != NULL)
+		nalloc--;
+	free(p);
+}
+
+static void
+record(void)
+{
+	fido_cred_t *c;
+	fido_verify_key_t *key;
+	fido_cred_store_t *store;
+	const char *path = "regress_cred_store";
+	const unsigned char *rec, *recs[1];
+	unsigned char *ptr, *junk;
+	size_t len, rec_len;
+
+	c = alloc_cred();
+	assert(fido_cred_export_record(c, &ptr, &len) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(ptr == NULL && len == 0);
+	free_cred(c);
+
+	c = alloc_trust_cred();
+	assert(fido_cred_export_record(c, &ptr, &len) == FIDO_OK);
+	assert(len == FIDO_CRED_RECORD_HDRLEN + sizeof(pubkey) + sizeof(id));
+	assert(memcmp(ptr, FIDO_CRED_RECORD_MAGIC, 4) == 0);
+	assert(ptr[4] == FIDO_CRED_RECORD_VERSION);
+	assert(ptr[5] == fido_cred_flags(c));
+	assert(memcmp(ptr + 16, aaguid, sizeof(aaguid)) == 0);
+	assert(memcmp(ptr + FIDO_CRED_RECORD_HDRLEN, pubkey,
+	    sizeof(pubkey)) == 0);
+	assert(memcmp(ptr + FIDO_CRED_RECORD_HDRLEN + sizeof(pubkey), id,
+	    sizeof(id)) == 0);
+	free_cred(c);
+
+	key = fido_verify_key_new();
+	assert(key != NULL);
+	assert(fido_verify_key_from_record(key, NULL, len) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_verify_key_from_record(key, ptr, len - 1) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_verify_key_type(key) == COSE_UNSPEC);
+	/* unaligned */
+	assert((junk = malloc(len + 1)) != NULL);
+	memcpy(junk + 1, ptr, len);
+	assert(fido_verify_key_from_record(key, junk + 1, len) == FIDO_OK);
+	assert(fido_verify_key_type(key) == COSE_ES256);
+	junk[1 + 4] = FIDO_CRED_RECORD_VERSION + 1;
+	assert(fido_verify_key_from_record(key, junk + 1, len) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	memcpy(junk + 1, ptr, len);
+	junk[1 + 11] = 0x01; /* type */
+	assert(fido_verify_key_from_record(key, junk + 1, len) ==
+	    FIDO_ERR_UNSUPPORTED_OPTION);
+	assert(fido_verify_key_type(key) == COSE_ES256);
+	free(junk);
+	fido_verify_key_free(&key);
+
+	recs[0] = ptr;
+	store = fido_cred_store_new();
+	assert(store != NULL);
+	assert(fido_cred_store_len(store) == 0);
+	assert(fido_cred_store_lookup(store, id, sizeof(id), &rec,
+	    &rec_len) == FIDO_ERR_NOTFOUND);
+	assert(fido_cred_store_write(path, NULL, recs, &len, 1) == FIDO_OK);
+	assert(fido_cred_store_open(store, path) == FIDO_OK);
+	assert(fido_cred_store_len(store) == 1);
+	assert(fido_cred_store_lookup(store, id, sizeof(id), &rec,
+	    &rec_len) == FIDO_OK);
+	assert(rec_len == len && memcmp(rec, ptr, len) == 0);
+	assert(fido_cred_store_lookup(store, aaguid, sizeof(aaguid), &rec,
+	    &rec_len) == FIDO_ERR_NOTFOUND);
+	/* same id again: replaced, not duplicated */
+	assert(fido_cred_store_write(path, store, recs, &len, 1) == FIDO_OK);
+	assert(fido_cred_store_open(store, path) == FIDO_OK);
+	assert(fido_cred_store_len(store) == 1);
+	assert(fido_cred_store_get(store, 0, &rec, &rec_len) == FIDO_OK);
+	assert(rec_len == len && memcmp(rec, ptr, len) == 0);
+	assert(fido_cred_store_get(store, 1, &rec, &rec_len) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	ptr[4] = FIDO_CRED_RECORD_VERSION + 1;
+	assert(fido_cred_store_write(path, store, recs, &len, 1) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	fido_cred_store_free(&store);
+	assert(remove(path) == 0);
+	free(ptr);
+}
+
+static void
+allocator(void)
+{
+	assert(fido_set_allocator(count_malloc, NULL, NULL) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	/* libcbor may lack custom allocators */
+	if (fido_set_allocator(count_malloc, count_realloc,
+	    count_free) != FIDO_OK)
+		return;
+	valid_cred();
+	fido_x5c_cache_clear();
+	assert(fido_set_allocator(NULL, NULL, NULL) == FIDO_OK);
+	assert(nalloc_total > 0);
+	assert(nalloc == 0);
+}
+
+static void
+heap(void)
+{
+	static unsigned char	 region[256 * 1024];
+	size_t			 inuse, peak;
+
+	assert(fido_set_heap(NULL, 1) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_set_heap(region, 16) == FIDO_ERR_INVALID_ARGUMENT);
+	/* libcbor may lack custom allocators */
+	if (fido_set_heap(region + 1, sizeof(region) - 1) != FIDO_OK)
+		return;
+	valid_cred();
+	fido_x5c_cache_clear();
+	fido_heap_stats(&inuse, &peak);
+	assert(fido_set_heap(NULL, 0) == FIDO_OK);
+	assert(inuse == 0);
+	assert(peak > 0 && peak < sizeof(region));
+}
+
+static void
+mem_stats(void)
+{
+	uint64_t	allocs, frees;
+	size_t		live, peak;
+
+	assert(fido_mem_stats(FIDO_MEM_NCLASSES, NULL, NULL, NULL, NULL) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	/* libcbor may lack custom allocators */
+	if (fido_set_mem_stats(true) != FIDO_OK)
+		return;
+	valid_cred();
+	borrow_take();
+	record(); /* frees an exported record with free(3) */
+	fido_x5c_cache_clear();
+	assert(fido_mem_stats(FIDO_MEM_ALL, &allocs, &frees, &live,
+	    &peak) == FIDO_OK);
+	assert(allocs > 0 && allocs == frees);
+	assert(live == 0 && peak > 0);
+	assert(fido_mem_stats(FIDO_MEM_CBOR, &allocs, NULL, NULL,
+	    NULL) == FIDO_OK);
+	assert(allocs > 0);
+	assert(fido_mem_stats(FIDO_MEM_BLOB, &allocs, NULL, NULL,
+	    NULL) == FIDO_OK);
+	assert(allocs > 0);
+	fido_mem_stats_reset();
+	assert(fido_mem_stats(FIDO_MEM_ALL, &allocs, &frees, &live,
+	    &peak) == FIDO_OK);
+	assert(allocs == 0 && frees == 0 && peak == live);
+	assert(fido_set_mem_stats(false) == FIDO_OK);
+}
+
 int
 main(void)
 {
@@ -2150,6 +2942,7 @@ main(void)
 
 	empty_cred();
 	valid_cred();
+	borrow_take();
 	no_cdh();
 	no_rp_id();
 	no_rp_name();
@@ -2174,6 +2967,14 @@ main(void)
 	fmt_none();
 	valid_tpm_rs256_cred();
 	valid_tpm_es256_cred();
+	bad_tpm_es256_cred();
+	trust_store();
+	mds();
+	x5c_cache();
+	record();
+	allocator();
+	heap();
+	mem_stats();
 
 	exit(0);
 }
@@ -10,12 +10,20 @@
 #include <assert.h>
 #include <string.h>
 #include <time.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 
 #define _FIDO_INTERNAL
 
 #include <fido.h>
+#include <fido/credman.h>
+#include <fido/loop.h>
+#include <fido/monitor.h>
+#include <fido/stats.h>
 
 #include "../fuzz/wiredata_fido2.h"
+#include "../fuzz/wiredata_u2f.h"
 
 #define REPORT_LEN	(64 + 1)
 
@@ -25,6 +33,10 @@ static size_t	 wiredata_len;
 static int	 fake_dev_handle;
 static int	 initialised;
 static long	 interval_ms;
+static size_t	 writev_calls;
+static size_t	 writev_max;
+static uint8_t	 chan_nonce[8];
+static int	 chan_closed;
 
 #if defined(_MSC_VER)
 static int
@@ -124,6 +136,21 @@ dummy_write(void *handle, const unsigned char *ptr, size_t len)
 	return ((int)len);
 }
 
+static int
+dummy_writev(void *handle, const unsigned char *ptr, size_t len, size_t n)
+{
+	assert(n > 0);
+
+	writev_calls++;
+	if (n > writev_max)
+		writev_max = n;
+
+	for (size_t i = 0; i < n; i++)
+		assert(dummy_write(handle, ptr + i * len, len) == (int)len);
+
+	return ((int)(len * n));
+}
+
 static uint8_t *
 wiredata_setup(const uint8_t *data, size_t len)
 {
@@ -420,20 +447,2890 @@ timeout_misc(void)
 	fido_dev_free(&dev);
 }
 
-int
-main(void)
+/* the fuzzing corpus does not keep channel ids consistent across frames */
+static void
+wiredata_fix_cid(uint8_t *ptr, size_t len)
 {
-	fido_init(0);
+	const uint8_t	 ctap_init_data[] = { WIREDATA_CTAP_INIT };
+	const size_t	 frame_len = REPORT_LEN - 1;
 
-	open_iff_ok();
-	reopen();
-	double_open();
-	double_close();
-	is_fido2();
-	has_pin();
-	timeout_rx();
-	timeout_ok();
-	timeout_misc();
+	for (size_t off = sizeof(ctap_init_data) + frame_len;
+	    off + frame_len <= sizeof(ctap_init_data) + len; off += frame_len)
+		memcpy(ptr + off, ptr + sizeof(ctap_init_data), sizeof(uint32_t));
+}
+
+static void
+async_assert(void)
+{
+	const uint8_t	 assert_data[] = {
+			    WIREDATA_CTAP_CBOR_INFO,
+			    WIREDATA_CTAP_KEEPALIVE,
+			    WIREDATA_CTAP_CBOR_ASSERT
+			 };
+	const uint8_t	 cdh[32] = { 0 };
+	uint8_t		*wiredata;
+	fido_dev_t	*dev = NULL;
+	fido_assert_t	*a = NULL;
+	fido_dev_io_t	 io;
+	int		 done;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	wiredata = wiredata_setup(assert_data, sizeof(assert_data));
+	wiredata_fix_cid(wiredata, sizeof(assert_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert((a = fido_assert_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_dev_poll_fd(dev) == -1);
+	assert(fido_dev_get_assert_step(dev, a, &done,
+	    -1) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(done == 0);
+	assert(fido_dev_get_assert_begin(dev, a,
+	    NULL) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_assert_set_clientdata_hash(a, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_dev_get_assert_begin(dev, a, NULL) == FIDO_OK);
+	assert(fido_dev_get_assert_begin(dev, a,
+	    NULL) == FIDO_ERR_INVALID_ARGUMENT);
+	interval_ms = 100;
+	assert(fido_dev_get_assert_step(dev, a, &done, 10) == FIDO_OK);
+	assert(done == 0);
+	assert(fido_dev_get_assert_step(dev, a, &done, -1) == FIDO_OK);
+	assert(done == 1);
+	interval_ms = 0;
+	assert(fido_assert_count(a) == 1);
+	assert(fido_assert_sig_len(a, 0) != 0);
+	assert(fido_dev_get_assert_step(dev, a, &done,
+	    -1) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	fido_assert_free(&a);
+	wiredata_clear(&wiredata);
+}
+
+static void
+prepared_assert(void)
+{
+	const uint8_t	 assert_data[] = {
+			    WIREDATA_CTAP_CBOR_INFO,
+			    WIREDATA_CTAP_CBOR_ASSERT,
+			    WIREDATA_CTAP_CBOR_ASSERT
+			 };
+	uint8_t		 cdh[32] = { 0 };
+	uint8_t		*wiredata;
+	fido_dev_t	*dev = NULL;
+	fido_assert_t	*a = NULL;
+	fido_dev_io_t	 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	assert((a = fido_assert_new()) != NULL);
+	assert(fido_assert_prepare(a) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_assert_set_extensions(a, FIDO_EXT_HMAC_SECRET) == FIDO_OK);
+	assert(fido_assert_prepare(a) == FIDO_ERR_UNSUPPORTED_EXTENSION);
+	assert(fido_assert_set_extensions(a, 0) == FIDO_OK);
+	assert(fido_assert_prepare(a) == FIDO_OK);
+	assert(fido_assert_set_clientdata_hash(a, cdh, sizeof(cdh)) == FIDO_OK);
+
+	wiredata = wiredata_setup(assert_data, sizeof(assert_data));
+	wiredata_fix_cid(wiredata, sizeof(assert_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+	assert(fido_assert_count(a) == 1);
+	/* the prepared request, under another client data hash */
+	cdh[0] = 1;
+	assert(fido_assert_set_clientdata_hash(a, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+	assert(fido_assert_count(a) == 1);
+	assert(fido_assert_sig_len(a, 0) != 0);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	fido_assert_free(&a);
+	wiredata_clear(&wiredata);
+}
+
+static void
+async_cred(void)
+{
+	const uint8_t	 cred_data[] = {
+			    WIREDATA_CTAP_CBOR_INFO,
+			    WIREDATA_CTAP_KEEPALIVE,
+			    WIREDATA_CTAP_CBOR_CRED
+			 };
+	const uint8_t	 cdh[32] = { 0 };
+	const uint8_t	 user_id[1] = { 1 };
+	uint8_t		*wiredata;
+	fido_dev_t	*dev = NULL;
+	fido_cred_t	*c = NULL;
+	fido_dev_io_t	 io;
+	int		 done;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	wiredata = wiredata_setup(cred_data, sizeof(cred_data));
+	wiredata_fix_cid(wiredata, sizeof(cred_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert((c = fido_cred_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_cred_set_type(c, COSE_ES256) == FIDO_OK);
+	assert(fido_cred_set_clientdata_hash(c, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_cred_set_rp(c, "localhost", NULL) == FIDO_OK);
+	assert(fido_cred_set_user(c, user_id, sizeof(user_id), "dummy", NULL,
+	    NULL) == FIDO_OK);
+	assert(fido_dev_make_cred_step(dev, c, &done,
+	    -1) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_make_cred_begin(dev, c, NULL) == FIDO_OK);
+	assert(fido_dev_make_cred_begin(dev, c,
+	    NULL) == FIDO_ERR_INVALID_ARGUMENT);
+	do {
+		assert(fido_dev_make_cred_step(dev, c, &done, -1) == FIDO_OK);
+	} while (done == 0);
+	assert(fido_cred_fmt(c) != NULL);
+	assert(fido_cred_id_len(c) != 0);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	fido_cred_free(&c);
+	wiredata_clear(&wiredata);
+}
+
+static void
+writev_cred(void)
+{
+	const uint8_t	 cred_data[] = {
+			    WIREDATA_CTAP_CBOR_INFO,
+			    WIREDATA_CTAP_CBOR_CRED
+			 };
+	const uint8_t	 cdh[32] = { 0 };
+	const uint8_t	 user_id[1] = { 1 };
+	uint8_t		*wiredata;
+	fido_dev_t	*dev = NULL;
+	fido_cred_t	*c = NULL;
+	fido_dev_io_t	 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	wiredata = wiredata_setup(cred_data, sizeof(cred_data));
+	wiredata_fix_cid(wiredata, sizeof(cred_data));
+	writev_calls = 0;
+	writev_max = 0;
+	assert((dev = fido_dev_new()) != NULL);
+	assert((c = fido_cred_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_set_io_writev(dev, dummy_writev) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_dev_set_io_writev(dev, NULL) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(writev_calls == 2); /* CTAPHID_INIT, authenticatorGetInfo */
+	assert(writev_max == 1);
+	assert(fido_cred_set_type(c, COSE_ES256) == FIDO_OK);
+	assert(fido_cred_set_clientdata_hash(c, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_cred_set_rp(c, "localhost", NULL) == FIDO_OK);
+	assert(fido_cred_set_user(c, user_id, sizeof(user_id), "dummy", NULL,
+	    NULL) == FIDO_OK);
+	assert(fido_dev_make_cred(dev, c, NULL) == FIDO_OK);
+	assert(writev_calls == 3);
+	assert(writev_max > 1);
+	assert(fido_cred_fmt(c) != NULL);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	fido_cred_free(&c);
+	wiredata_clear(&wiredata);
+}
+
+static void
+rx_buf(void)
+{
+	const uint8_t	 cbor_info_data[] = {
+			    WIREDATA_CTAP_CBOR_INFO,
+			    WIREDATA_CTAP_CBOR_INFO
+			 };
+	uint8_t		*wiredata;
+	fido_dev_t	*dev = NULL;
+	fido_cbor_info_t *ci = NULL;
+	fido_dev_io_t	 io;
+	unsigned char	*buf;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	wiredata = wiredata_setup(cbor_info_data, sizeof(cbor_info_data));
+	wiredata_fix_cid(wiredata, sizeof(cbor_info_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert((ci = fido_cbor_info_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert((buf = dev->rx_buf) != NULL);
+	assert(dev->rx_buf_len >= FIDO_MAXMSG);
+	assert(dev->rx_buf_busy == false);
+	assert(dev->rx_buf_used == 0);
+	for (size_t i = 0; i < dev->rx_buf_len; i++)
+		assert(buf[i] == 0);
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_OK);
+	assert(dev->rx_buf == buf); /* reused */
+	assert(dev->rx_buf_busy == false);
+	for (size_t i = 0; i < dev->rx_buf_len; i++)
+		assert(buf[i] == 0);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	fido_cbor_info_free(&ci);
+	wiredata_clear(&wiredata);
+}
+
+static void
+chan_close(void *handle)
+{
+	dummy_close(handle);
+	chan_closed++;
+}
+
+/* patch the nonce of the last CTAPHID_INIT request into its reply */
+static int
+chan_read(void *handle, unsigned char *ptr, size_t len, int ms)
+{
+	int n;
+
+	if ((n = dummy_read(handle, ptr, len, ms)) == (int)len &&
+	    ptr[4] == (CTAP_FRAME_INIT | CTAP_CMD_INIT))
+		memcpy(&ptr[7], &chan_nonce, sizeof(chan_nonce));
+
+	return (n);
+}
+
+static int
+chan_write(void *handle, const unsigned char *ptr, size_t len)
+{
+	if (len == REPORT_LEN && ptr[5] == (CTAP_FRAME_INIT | CTAP_CMD_INIT))
+		memcpy(&chan_nonce, &ptr[8], sizeof(chan_nonce));
+
+	return (dummy_write(handle, ptr, len));
+}
+
+static void
+channel(void)
+{
+	const uint8_t	 ctap_init_data[] = { WIREDATA_CTAP_INIT };
+	const uint8_t	 cbor_info_data[] = { WIREDATA_CTAP_CBOR_INFO };
+	const uint8_t	 chan_cid[4] = { 0x00, 0x22, 0x00, 0x03 };
+	const size_t	 frame_len = REPORT_LEN - 1;
+	uint8_t		 data[sizeof(cbor_info_data) * 3 +
+			    sizeof(ctap_init_data)];
+	uint8_t		*wiredata, *ptr;
+	fido_dev_t	*dev = NULL;
+	fido_dev_t	*chan = NULL;
+	fido_cbor_info_t *ci = NULL;
+	fido_dev_io_t	 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = chan_close;
+	io.read = chan_read;
+	io.write = chan_write;
+
+	/*
+	 * parent's getinfo, the channel's init, then the replies to getinfo
+	 * on both; the parent's arrives first and is queued for it
+	 */
+	ptr = data;
+	memcpy(ptr, cbor_info_data, sizeof(cbor_info_data));
+	ptr += sizeof(cbor_info_data);
+	memcpy(ptr, ctap_init_data, sizeof(ctap_init_data));
+	memcpy(ptr + 15, chan_cid, sizeof(chan_cid));
+	ptr += sizeof(ctap_init_data);
+	memcpy(ptr, cbor_info_data, sizeof(cbor_info_data));
+	ptr += sizeof(cbor_info_data);
+	memcpy(ptr, cbor_info_data, sizeof(cbor_info_data));
+	for (size_t off = 0; off < sizeof(cbor_info_data); off += frame_len)
+		memcpy(ptr + off, chan_cid, sizeof(chan_cid));
+
+	chan_closed = 0;
+	wiredata = wiredata_setup(data, sizeof(data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert((chan = fido_dev_new()) != NULL);
+	assert((ci = fido_cbor_info_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open_channel(chan, dev) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_dev_open_channel(dev, dev) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_open_channel(chan, dev) == FIDO_OK);
+	assert(fido_dev_open_channel(chan, dev) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(chan->cid != dev->cid);
+	assert(memcmp(&chan->cid, chan_cid, sizeof(chan_cid)) == 0);
+	assert(fido_dev_is_fido2(chan));
+	assert(fido_dev_get_cbor_info(chan, ci) == FIDO_OK);
+	assert(wiredata_len == 0);
+	/* served from the queue */
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_OK);
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_ERR_RX);
+	assert(fido_dev_close(chan) == FIDO_OK);
+	assert(chan_closed == 0);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	assert(chan_closed == 1);
+	fido_dev_free(&chan);
+	fido_dev_free(&dev);
+	fido_cbor_info_free(&ci);
+	wiredata_clear(&wiredata);
+}
+
+#define MANY_DEVS	3
+
+static struct many_handle {
+	uint8_t		*data;
+	size_t		 len;
+	size_t		 off;
+	uint8_t		 nonce[8];
+	int		 nwrites;
+} many[MANY_DEVS];
+static int many_writes;
+
+static void *
+many_open(const char *path)
+{
+	return (&many[path[0] - '0']);
+}
+
+static void
+many_close(void *handle)
+{
+	(void)handle;
+}
+
+static int
+many_read(void *handle, unsigned char *ptr, size_t len, int ms)
+{
+	struct many_handle *h = handle;
+
+	(void)ms;
+	assert(len == REPORT_LEN - 1);
+	/* every init, then every getinfo, is out before a reply is read */
+	if (h->nwrites == 1)
+		assert(many_writes >= MANY_DEVS);
+	else
+		assert(many_writes == 2 * MANY_DEVS - 1); /* one never inits */
+	if (h->off >= h->len)
+		return (-1);
+	if (h->off == 0)
+		memcpy(&h->data[7], h->nonce, sizeof(h->nonce));
+	memcpy(ptr, h->data + h->off, len);
+	h->off += len;
+
+	return ((int)len);
+}
+
+static int
+many_write(void *handle, const unsigned char *ptr, size_t len)
+{
+	struct many_handle *h = handle;
+
+	assert(len == REPORT_LEN);
+	if (h->nwrites++ == 0)
+		memcpy(h->nonce, &ptr[8], sizeof(h->nonce));
+	many_writes++;
+
+	return ((int)len);
+}
+
+static void
+open_many(void)
+{
+	const uint8_t	 ctap_init_data[] = { WIREDATA_CTAP_INIT };
+	const uint8_t	 cbor_info_data[] = { WIREDATA_CTAP_CBOR_INFO };
+	const char	*path[MANY_DEVS] = { "0", "1", "2" };
+	fido_dev_t	*dev[MANY_DEVS];
+	int		 result[MANY_DEVS];
+	fido_dev_io_t	 io;
+
+	memset(&io, 0, sizeof(io));
+	memset(many, 0, sizeof(many));
+	many_writes = 0;
+
+	io.open = many_open;
+	io.close = many_close;
+	io.read = many_read;
+	io.write = many_write;
+
+	/* the last device never answers */
+	for (size_t i = 0; i < MANY_DEVS - 1; i++) {
+		many[i].len = sizeof(ctap_init_data) + sizeof(cbor_info_data);
+		assert((many[i].data = malloc(many[i].len)) != NULL);
+		memcpy(many[i].data, ctap_init_data, sizeof(ctap_init_data));
+		memcpy(many[i].data + sizeof(ctap_init_data), cbor_info_data,
+		    sizeof(cbor_info_data));
+	}
+	for (size_t i = 0; i < MANY_DEVS; i++) {
+		assert((dev[i] = fido_dev_new()) != NULL);
+		assert(fido_dev_set_io_functions(dev[i], &io) == FIDO_OK);
+		assert(fido_dev_set_timeout(dev[i], 100) == FIDO_OK);
+		result[i] = -1;
+	}
+
+	assert(fido_dev_open_many(NULL, path, MANY_DEVS,
+	    result) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_open_many(dev, path, 0, result) == FIDO_OK);
+	assert(result[0] == -1);
+	assert(fido_dev_open_many(dev, path, MANY_DEVS, result) == FIDO_OK);
+	for (size_t i = 0; i < MANY_DEVS - 1; i++) {
+		assert(result[i] == FIDO_OK);
+		assert(fido_dev_is_fido2(dev[i]));
+		assert(many[i].off == many[i].len);
+		assert(many[i].nwrites == 2);
+	}
+	assert(result[MANY_DEVS - 1] == FIDO_ERR_RX);
+	assert(fido_dev_close(dev[MANY_DEVS - 1]) == FIDO_ERR_INVALID_ARGUMENT);
+
+	for (size_t i = 0; i < MANY_DEVS; i++) {
+		if (result[i] == FIDO_OK)
+			assert(fido_dev_close(dev[i]) == FIDO_OK);
+		fido_dev_free(&dev[i]);
+		free(many[i].data);
+	}
+}
+
+#ifdef HAVE_PTHREAD
+static void
+scheduler(void)
+{
+	const uint8_t	 cbor_info_data[] = {
+			    WIREDATA_CTAP_CBOR_INFO,
+			    WIREDATA_CTAP_CBOR_INFO
+			 };
+	uint8_t		*wiredata;
+	fido_dev_t	*dev = NULL;
+	fido_cbor_info_t *ci = NULL;
+	fido_dev_io_t	 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	assert(fido_thread_priority() == FIDO_PRIO_NORMAL);
+	assert(fido_set_thread_priority(FIDO_PRIO_BACKGROUND - 1) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_set_thread_priority(FIDO_PRIO_INTERACTIVE + 1) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_set_thread_priority(FIDO_PRIO_INTERACTIVE) == FIDO_OK);
+	assert(fido_thread_priority() == FIDO_PRIO_INTERACTIVE);
+
+	wiredata = wiredata_setup(cbor_info_data, sizeof(cbor_info_data));
+	wiredata_fix_cid(wiredata, sizeof(cbor_info_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert((ci = fido_cbor_info_new()) != NULL);
+	assert(fido_dev_set_scheduler(dev, true) == FIDO_OK);
+	assert(fido_dev_set_scheduler(dev, true) == FIDO_OK);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	/* released after each operation */
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_OK);
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_ERR_RX);
+	assert(wiredata_len == 0);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	assert(fido_dev_set_scheduler(dev, false) == FIDO_OK);
+	fido_dev_free(&dev);
+	fido_cbor_info_free(&ci);
+	wiredata_clear(&wiredata);
+
+	/* freed with the device */
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_scheduler(dev, true) == FIDO_OK);
+	fido_dev_free(&dev);
+	assert(fido_set_thread_priority(FIDO_PRIO_NORMAL) == FIDO_OK);
+}
+#endif
+
+static void
+session_cache(void)
+{
+	const uint8_t	 cbor_info_data[] = { WIREDATA_CTAP_CBOR_INFO };
+	uint8_t		*wiredata;
+	fido_dev_t	*dev = NULL;
+	fido_dev_io_t	 io;
+	int		 flags;
+	uint64_t	 maxmsgsize;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	assert(fido_session_cache_set_size(257) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_session_cache_set_size(2) == FIDO_OK);
+	assert(fido_session_cache_size() == 2);
+	assert(fido_session_cache_len() == 0);
+
+	/* first open issues getinfo */
+	wiredata = wiredata_setup(cbor_info_data, sizeof(cbor_info_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_session_cache_len() == 1);
+	assert(fido_session_cache_misses() == 1);
+	assert(fido_session_cache_hits() == 0);
+	flags = dev->flags;
+	maxmsgsize = dev->maxmsgsize;
+	assert(fido_dev_close(dev) == FIDO_OK);
+	wiredata_clear(&wiredata);
+
+	/* reopen with only a CTAPHID_INIT reply on the wire */
+	wiredata = wiredata_setup(NULL, 0);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(wiredata_len == 0);
+	assert(fido_session_cache_hits() == 1);
+	assert(dev->flags == flags);
+	assert(dev->maxmsgsize == maxmsgsize);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	wiredata_clear(&wiredata);
+
+	/* a failed open drops the entry */
+	assert(fido_dev_open(dev, "dummy") == FIDO_ERR_RX);
+	assert(fido_session_cache_len() == 0);
+
+	fido_session_cache_clear();
+	assert(fido_session_cache_hits() == 0);
+	assert(fido_session_cache_misses() == 0);
+	assert(fido_session_cache_set_size(0) == FIDO_OK);
+	fido_dev_free(&dev);
+}
+
+static void
+legacy_cache(void)
+{
+	const uint8_t	 cbor_info_data[] = { WIREDATA_CTAP_CBOR_INFO };
+	const char	*path = "regress_legacy";
+	uint8_t		*wiredata;
+	fido_dev_t	*dev = NULL;
+	fido_dev_t	*model = NULL;
+	fido_dev_info_t	*di = NULL;
+	fido_dev_io_t	 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	assert(fido_legacy_cache_set_size(257) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_legacy_cache_set_size(2) == FIDO_OK);
+	assert(fido_legacy_cache_len() == 0);
+
+	/* getinfo fails; the device is opened as u2f and remembered */
+	wiredata = wiredata_setup(NULL, 0);
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_dev_is_fido2(dev) == false);
+	assert(fido_legacy_cache_len() == 1);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	wiredata_clear(&wiredata);
+
+	/* reopen without asking; the getinfo reply on the wire is not read */
+	wiredata = wiredata_setup(cbor_info_data, sizeof(cbor_info_data));
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_dev_is_fido2(dev) == false);
+	assert(wiredata_len == sizeof(cbor_info_data));
+	assert(fido_dev_close(dev) == FIDO_OK);
+	wiredata_clear(&wiredata);
+
+	/* without vendor and product ids, another path is another device */
+	wiredata = wiredata_setup(cbor_info_data, sizeof(cbor_info_data));
+	assert(fido_dev_open(dev, "other") == FIDO_OK);
+	assert(fido_dev_is_fido2(dev) == true);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	wiredata_clear(&wiredata);
+
+	/* a device with ids is remembered by them */
+	assert((di = fido_dev_info_new(1)) != NULL);
+	assert(fido_dev_info_set(di, 0, "dummy", "manufacturer", "product",
+	    &io, NULL) == FIDO_OK);
+	di->vendor_id = 0x1050;
+	di->product_id = 0x0407;
+	assert((model = fido_dev_new_with_info(di)) != NULL);
+	/* the dummy io is ours, not the hid backend's; see fido_dev_open() */
+	assert(fido_dev_set_io_functions(model, &io) == FIDO_OK);
+	wiredata = wiredata_setup(NULL, 0);
+	assert(fido_dev_open(model, "dummy") == FIDO_OK);
+	assert(fido_dev_is_fido2(model) == false);
+	assert(fido_legacy_cache_len() == 2);
+	assert(fido_dev_close(model) == FIDO_OK);
+	wiredata_clear(&wiredata);
+
+	/* only it survives a save and load */
+	assert(fido_legacy_cache_save(path) == FIDO_OK);
+	fido_legacy_cache_clear();
+	assert(fido_legacy_cache_len() == 0);
+	assert(fido_legacy_cache_load(path) == FIDO_OK);
+	assert(fido_legacy_cache_len() == 1);
+	wiredata = wiredata_setup(cbor_info_data, sizeof(cbor_info_data));
+	assert(fido_dev_open(model, "elsewhere") == FIDO_OK);
+	assert(fido_dev_is_fido2(model) == false);
+	assert(wiredata_len == sizeof(cbor_info_data));
+	assert(fido_dev_close(model) == FIDO_OK);
+	wiredata_clear(&wiredata);
+
+	/* a disabled cache loads nothing */
+	assert(fido_legacy_cache_set_size(0) == FIDO_OK);
+	assert(fido_legacy_cache_load(path) == FIDO_OK);
+	assert(fido_legacy_cache_len() == 0);
+	assert(fido_legacy_cache_load(NULL) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(remove(path) == 0);
+
+	fido_dev_info_free(&di, 1);
+	fido_dev_free(&model);
+	fido_dev_free(&dev);
+}
+
+static void
+cbor_info_retained(void)
+{
+	const uint8_t	 cbor_info_data[] = {
+			    WIREDATA_CTAP_CBOR_INFO,
+			    WIREDATA_CTAP_CBOR_INFO
+			 };
+	uint8_t		*wiredata;
+	fido_dev_t	*dev = NULL;
+	const fido_cbor_info_t *ci;
+	fido_dev_io_t	 io;
+	int		 flags;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	wiredata = wiredata_setup(cbor_info_data, sizeof(cbor_info_data));
+	wiredata_fix_cid(wiredata, sizeof(cbor_info_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_cbor_info(dev) == NULL);
+	assert(fido_dev_refresh_cbor_info(dev) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert((ci = fido_dev_cbor_info(dev)) != NULL);
+	assert(fido_cbor_info_aaguid_len(ci) == 16);
+	assert(fido_cbor_info_maxmsgsiz(ci) == dev->maxmsgsize);
+	flags = dev->flags;
+	assert(fido_dev_refresh_cbor_info(dev) == FIDO_OK);
+	assert(wiredata_len == 0);
+	assert((ci = fido_dev_cbor_info(dev)) != NULL);
+	assert(fido_cbor_info_aaguid_len(ci) == 16);
+	assert(dev->flags == flags);
+	assert(fido_dev_refresh_cbor_info(dev) == FIDO_ERR_RX);
+	assert(fido_dev_cbor_info(dev) == ci);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	assert(fido_dev_cbor_info(dev) == NULL);
+	fido_dev_free(&dev);
+	wiredata_clear(&wiredata);
+}
+
+static void
+uv_token_cache(void)
+{
+	uint8_t			 uv_token_data[] = {
+				    WIREDATA_CTAP_CBOR_INFO,
+				    WIREDATA_CTAP_CBOR_AUTHKEY,
+				    WIREDATA_CTAP_CBOR_PINTOKEN,
+				    WIREDATA_CTAP_CBOR_CREDMAN_META,
+				    WIREDATA_CTAP_CBOR_CREDMAN_META,
+				    WIREDATA_CTAP_CBOR_STATUS,
+				    WIREDATA_CTAP_CBOR_AUTHKEY,
+				    WIREDATA_CTAP_CBOR_PINTOKEN,
+				    WIREDATA_CTAP_CBOR_CREDMAN_META
+				 };
+	const uint8_t		 tail[] = {
+				    WIREDATA_CTAP_CBOR_STATUS,
+				    WIREDATA_CTAP_CBOR_AUTHKEY,
+				    WIREDATA_CTAP_CBOR_PINTOKEN,
+				    WIREDATA_CTAP_CBOR_CREDMAN_META
+				 };
+	uint8_t			*wiredata;
+	fido_dev_t		*dev = NULL;
+	fido_credman_metadata_t	*meta = NULL;
+	fido_dev_io_t		 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	/* the cached token is rejected once */
+	uv_token_data[sizeof(uv_token_data) - sizeof(tail) + 7] =
+	    FIDO_ERR_PIN_AUTH_INVALID;
+
+	wiredata = wiredata_setup(uv_token_data, sizeof(uv_token_data));
+	wiredata_fix_cid(wiredata, sizeof(uv_token_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert((meta = fido_credman_metadata_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_dev_set_uv_token_cache(dev, true) == FIDO_OK);
+	assert(fido_dev_set_uv_token_cache(dev, true) == FIDO_OK);
+	/* key agreement and token only once */
+	assert(fido_credman_get_dev_metadata(dev, meta, "1234") == FIDO_OK);
+	assert(fido_credman_rk_existing(meta) == 0);
+	assert(fido_credman_rk_remaining(meta) == 25);
+	assert(fido_credman_get_dev_metadata(dev, meta, "1234") == FIDO_OK);
+	/* a rejected token is replaced transparently */
+	assert(fido_credman_get_dev_metadata(dev, meta, "1234") == FIDO_OK);
+	assert(wiredata_len == 0);
+	/* a different pin does not reuse the token */
+	assert(fido_credman_get_dev_metadata(dev, meta,
+	    "4321") == FIDO_ERR_INTERNAL);
+	assert(fido_dev_set_uv_token_cache(dev, false) == FIDO_OK);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	fido_credman_metadata_free(&meta);
+	wiredata_clear(&wiredata);
+}
+
+static void
+credman_snapshot(void)
+{
+	uint8_t			 snapshot_data[] = {
+				    WIREDATA_CTAP_CBOR_INFO,
+				    WIREDATA_CTAP_CBOR_AUTHKEY,
+				    WIREDATA_CTAP_CBOR_PINTOKEN,
+				    WIREDATA_CTAP_CBOR_CREDMAN_META,
+				    WIREDATA_CTAP_CBOR_CREDMAN_META,
+				    WIREDATA_CTAP_CBOR_CREDMAN_META,
+				    WIREDATA_CTAP_CBOR_CREDMAN_META,
+				    WIREDATA_CTAP_CBOR_STATUS
+				 };
+	const size_t		 end = sizeof(snapshot_data);
+	uint8_t			*wiredata;
+	fido_dev_t		*dev = NULL;
+	fido_credman_snapshot_t	*snap = NULL;
+	fido_dev_io_t		 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	/* one rk fewer remaining, then one rk existing */
+	snapshot_data[end - 3 * 64 + 13] = 0x18;
+	snapshot_data[end - 2 * 64 + 10] = 0x01;
+	snapshot_data[end - 2 * 64 + 13] = 0x18;
+	/* rp enumeration fails */
+	snapshot_data[end - 64 + 7] = FIDO_ERR_NO_CREDENTIALS;
+
+	wiredata = wiredata_setup(snapshot_data, sizeof(snapshot_data));
+	wiredata_fix_cid(wiredata, sizeof(snapshot_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert((snap = fido_credman_snapshot_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_dev_set_uv_token_cache(dev, true) == FIDO_OK);
+	assert(fido_credman_rp_count(fido_credman_snapshot_rp(snap)) == 0);
+	assert(fido_credman_snapshot_rk(snap, 0) == NULL);
+	/* no rks; the rps are not enumerated */
+	assert(fido_credman_snapshot_refresh(dev, snap, "1234") == FIDO_OK);
+	assert(fido_credman_rk_remaining(fido_credman_snapshot_metadata(snap))
+	    == 25);
+	assert(fido_credman_snapshot_walked(snap) == 0);
+	/* unchanged counts; only the metadata is fetched */
+	assert(fido_credman_snapshot_refresh(dev, snap, "1234") == FIDO_OK);
+	assert(fido_credman_rk_remaining(fido_credman_snapshot_metadata(snap))
+	    == 25);
+	/* changed counts */
+	assert(fido_credman_snapshot_refresh(dev, snap, "1234") == FIDO_OK);
+	assert(fido_credman_rk_remaining(fido_credman_snapshot_metadata(snap))
+	    == 24);
+	/* a failed refresh keeps the snapshot */
+	assert(fido_credman_snapshot_refresh(dev, snap,
+	    "1234") == FIDO_ERR_NO_CREDENTIALS);
+	assert(fido_credman_rk_existing(fido_credman_snapshot_metadata(snap))
+	    == 0);
+	assert(fido_credman_rk_remaining(fido_credman_snapshot_metadata(snap))
+	    == 24);
+	assert(wiredata_len == 0);
+	fido_credman_snapshot_clear(snap);
+	assert(fido_credman_rk_remaining(fido_credman_snapshot_metadata(snap))
+	    == 0);
+	assert(fido_dev_set_uv_token_cache(dev, false) == FIDO_OK);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	fido_credman_snapshot_free(&snap);
+	assert(snap == NULL);
+	wiredata_clear(&wiredata);
+}
+
+static void
+credman_all_rk(void)
+{
+	const uint8_t		 all_rk_data[] = {
+				    WIREDATA_CTAP_CBOR_INFO,
+				    WIREDATA_CTAP_CBOR_AUTHKEY,
+				    WIREDATA_CTAP_CBOR_PINTOKEN,
+				    WIREDATA_CTAP_CBOR_CREDMAN_RPLIST,
+				    WIREDATA_CTAP_CBOR_CREDMAN_RKLIST,
+				    WIREDATA_CTAP_CBOR_CREDMAN_RKLIST,
+				    WIREDATA_CTAP_CBOR_CREDMAN_RKLIST
+				 };
+	uint8_t			*wiredata;
+	fido_dev_t		*dev = NULL;
+	fido_credman_rp_t	*rp = NULL;
+	fido_credman_rk_t	*rk = NULL;
+	fido_dev_io_t		 io;
+	size_t			 n;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	wiredata = wiredata_setup(all_rk_data, sizeof(all_rk_data));
+	wiredata_fix_cid(wiredata, sizeof(all_rk_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert((rp = fido_credman_rp_new()) != NULL);
+	assert((rk = fido_credman_rk_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_credman_rk_rp_idx(rk, 0) == SIZE_MAX);
+	/* key agreement and token only once, without the token cache */
+	assert(fido_credman_get_dev_all_rk(dev, rp, rk, "1234") == FIDO_OK);
+	assert(wiredata_len == 0);
+	assert(fido_credman_rp_count(rp) == 3);
+	assert((n = fido_credman_rk_count(rk)) % 3 == 0 && n > 0);
+	for (size_t i = 0; i < n; i++) {
+		assert(fido_credman_rk(rk, i) != NULL);
+		assert(fido_credman_rk_rp_idx(rk, i) == i / (n / 3));
+	}
+	assert(fido_credman_rk_rp_idx(rk, n) == SIZE_MAX);
+	assert(fido_credman_rk(rk, n) == NULL);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	fido_credman_rp_free(&rp);
+	fido_credman_rk_free(&rk);
+	wiredata_clear(&wiredata);
+}
+
+static void
+credman_del_batch(void)
+{
+	uint8_t			 del_data[] = {
+				    WIREDATA_CTAP_CBOR_INFO,
+				    WIREDATA_CTAP_CBOR_AUTHKEY,
+				    WIREDATA_CTAP_CBOR_PINTOKEN,
+				    WIREDATA_CTAP_CBOR_STATUS,
+				    WIREDATA_CTAP_CBOR_STATUS,
+				    WIREDATA_CTAP_CBOR_STATUS
+				 };
+	const unsigned char	 id0[] = { 0x01 }, id1[] = { 0x02, 0x03 };
+	const unsigned char	*id[] = { id0, id1, id0 };
+	const size_t		 id_len[] = { sizeof(id0), sizeof(id1),
+				    sizeof(id0) };
+	int			 result[3];
+	uint8_t			*wiredata;
+	fido_dev_t		*dev = NULL;
+	fido_dev_io_t		 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	/* the second credential is not found */
+	del_data[sizeof(del_data) - 2 * 64 + 7] = FIDO_ERR_NO_CREDENTIALS;
+
+	wiredata = wiredata_setup(del_data, sizeof(del_data));
+	wiredata_fix_cid(wiredata, sizeof(del_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_credman_del_dev_rk_batch(dev, NULL, NULL, 1, NULL,
+	    "1234") == FIDO_ERR_INVALID_ARGUMENT);
+	/* key agreement and token only once, without the token cache */
+	assert(fido_credman_del_dev_rk_batch(dev, id, id_len,
+	    sizeof(id) / sizeof(id[0]), result,
+	    "1234") == FIDO_ERR_NO_CREDENTIALS);
+	assert(result[0] == FIDO_OK);
+	assert(result[1] == FIDO_ERR_NO_CREDENTIALS);
+	assert(result[2] == FIDO_OK);
+	assert(wiredata_len == 0);
+	/* the batch ends at the first other error */
+	assert(fido_credman_del_dev_rk_batch(dev, id, id_len,
+	    sizeof(id) / sizeof(id[0]), result, "1234") == FIDO_ERR_INTERNAL);
+	assert(result[0] == FIDO_ERR_INTERNAL);
+	assert(result[2] == FIDO_ERR_INTERNAL);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	wiredata_clear(&wiredata);
+}
+
+static void
+credman_set_batch(void)
+{
+	uint8_t			 set_data[] = {
+				    WIREDATA_CTAP_CBOR_INFO,
+				    WIREDATA_CTAP_CBOR_AUTHKEY,
+				    WIREDATA_CTAP_CBOR_PINTOKEN,
+				    WIREDATA_CTAP_CBOR_STATUS,
+				    WIREDATA_CTAP_CBOR_STATUS,
+				    WIREDATA_CTAP_CBOR_STATUS
+				 };
+	const unsigned char	 id[] = { 0x01 }, user_id[] = { 0x02 };
+	fido_cred_t		*cred[3];
+	int			 result[3];
+	uint8_t			*wiredata;
+	fido_dev_t		*dev = NULL;
+	fido_dev_io_t		 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	for (size_t i = 0; i < sizeof(cred) / sizeof(cred[0]); i++) {
+		assert((cred[i] = fido_cred_new()) != NULL);
+		assert(fido_cred_set_id(cred[i], id, sizeof(id)) == FIDO_OK);
+		assert(fido_cred_set_user(cred[i], user_id, sizeof(user_id),
+		    "user", "User", NULL) == FIDO_OK);
+	}
+
+	/* the second credential is not found */
+	set_data[sizeof(set_data) - 2 * 64 + 7] = FIDO_ERR_NO_CREDENTIALS;
+
+	wiredata = wiredata_setup(set_data, sizeof(set_data));
+	wiredata_fix_cid(wiredata, sizeof(set_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_credman_set_dev_rk_batch(dev, NULL, 1, NULL,
+	    "1234") == FIDO_ERR_INVALID_ARGUMENT);
+	/* key agreement and token only once, without the token cache */
+	assert(fido_credman_set_dev_rk_batch(dev, cred,
+	    sizeof(cred) / sizeof(cred[0]), result,
+	    "1234") == FIDO_ERR_NO_CREDENTIALS);
+	assert(result[0] == FIDO_OK);
+	assert(result[1] == FIDO_ERR_NO_CREDENTIALS);
+	assert(result[2] == FIDO_OK);
+	assert(wiredata_len == 0);
+	/* the batch ends at the first other error */
+	assert(fido_credman_set_dev_rk_batch(dev, cred,
+	    sizeof(cred) / sizeof(cred[0]), result,
+	    "1234") == FIDO_ERR_INTERNAL);
+	assert(result[0] == FIDO_ERR_INTERNAL);
+	assert(result[2] == FIDO_ERR_INTERNAL);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	wiredata_clear(&wiredata);
+	for (size_t i = 0; i < sizeof(cred) / sizeof(cred[0]); i++)
+		fido_cred_free(&cred[i]);
+}
+
+static void
+ecdh_cache(void)
+{
+	uint8_t			 ecdh_data[] = {
+				    WIREDATA_CTAP_CBOR_INFO,
+				    WIREDATA_CTAP_CBOR_AUTHKEY,
+				    WIREDATA_CTAP_CBOR_ASSERT,
+				    WIREDATA_CTAP_CBOR_ASSERT,
+				    WIREDATA_CTAP_CBOR_STATUS,
+				    WIREDATA_CTAP_CBOR_AUTHKEY,
+				    WIREDATA_CTAP_CBOR_ASSERT
+				 };
+	const uint8_t		 tail[] = {
+				    WIREDATA_CTAP_CBOR_STATUS,
+				    WIREDATA_CTAP_CBOR_AUTHKEY,
+				    WIREDATA_CTAP_CBOR_ASSERT
+				 };
+	const unsigned char	 cdh[32] = { 0x01 };
+	const unsigned char	 salt[32] = { 0x02 };
+	uint8_t			*wiredata;
+	fido_dev_t		*dev = NULL;
+	fido_assert_t		*a = NULL;
+	fido_dev_io_t		 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	/* the third assertion fails under the kept secret */
+	ecdh_data[sizeof(ecdh_data) - sizeof(tail) + 7] =
+	    FIDO_ERR_PIN_AUTH_INVALID;
+
+	wiredata = wiredata_setup(ecdh_data, sizeof(ecdh_data));
+	wiredata_fix_cid(wiredata, sizeof(ecdh_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert((a = fido_assert_new()) != NULL);
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_assert_set_clientdata_hash(a, cdh,
+	    sizeof(cdh)) == FIDO_OK);
+	assert(fido_assert_set_extensions(a, FIDO_EXT_HMAC_SECRET) == FIDO_OK);
+	assert(fido_assert_set_hmac_salt(a, salt, sizeof(salt)) == FIDO_OK);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_dev_set_ecdh_cache(dev, true) == FIDO_OK);
+	assert(fido_dev_set_ecdh_cache(dev, true) == FIDO_OK);
+	/* key agreement only once */
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+	/* a failure drops the secret */
+	assert(fido_dev_get_assert(dev, a,
+	    NULL) == FIDO_ERR_PIN_AUTH_INVALID);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+	assert(wiredata_len == 0);
+	assert(fido_dev_set_ecdh_cache(dev, false) == FIDO_OK);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	fido_assert_free(&a);
+	wiredata_clear(&wiredata);
+}
+
+static void
+keypool(void)
+{
+	const uint8_t		 assert_data[] = {
+				    WIREDATA_CTAP_CBOR_INFO,
+				    WIREDATA_CTAP_CBOR_AUTHKEY,
+				    WIREDATA_CTAP_CBOR_ASSERT
+				 };
+	const unsigned char	 cdh[32] = { 0x01 };
+	const unsigned char	 salt[32] = { 0x02 };
+	const struct timespec	 tv = { 0, 10000000 };
+	uint8_t			*wiredata;
+	fido_dev_t		*dev = NULL;
+	fido_assert_t		*a = NULL;
+	fido_dev_io_t		 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	assert(fido_keypool_set_size(65) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_keypool_size() == 0);
+	assert(fido_keypool_len() == 0);
+	assert(fido_keypool_set_size(4) == FIDO_OK);
+	assert(fido_keypool_size() == 4);
+	for (int i = 0; i < 1000 && fido_keypool_len() < 4; i++)
+		if (nanosleep(&tv, NULL) == -1)
+			err(1, "nanosleep");
+	assert(fido_keypool_len() == 4);
+
+	/* key agreement with a pregenerated key */
+	wiredata = wiredata_setup(assert_data, sizeof(assert_data));
+	wiredata_fix_cid(wiredata, sizeof(assert_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert((a = fido_assert_new()) != NULL);
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_assert_set_clientdata_hash(a, cdh,
+	    sizeof(cdh)) == FIDO_OK);
+	assert(fido_assert_set_extensions(a, FIDO_EXT_HMAC_SECRET) == FIDO_OK);
+	assert(fido_assert_set_hmac_salt(a, salt, sizeof(salt)) == FIDO_OK);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+	assert(wiredata_len == 0);
+	assert(fido_keypool_len() <= 4);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	fido_assert_free(&a);
+	wiredata_clear(&wiredata);
+
+	assert(fido_keypool_set_size(2) == FIDO_OK);
+	assert(fido_keypool_len() <= 2);
+	assert(fido_keypool_set_size(0) == FIDO_OK);
+	assert(fido_keypool_size() == 0);
+	assert(fido_keypool_len() == 0);
+}
+
+static void
+secure_pool(void)
+{
+	const uint8_t		 assert_data[] = {
+				    WIREDATA_CTAP_CBOR_INFO,
+				    WIREDATA_CTAP_CBOR_AUTHKEY,
+				    WIREDATA_CTAP_CBOR_ASSERT
+				 };
+	const unsigned char	 cdh[32] = { 0x01 };
+	const unsigned char	 salt[32] = { 0x02 };
+	uint8_t			*wiredata;
+	fido_dev_t		*dev = NULL;
+	fido_assert_t		*a = NULL;
+	fido_dev_io_t		 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	assert(fido_secure_pool_set_size(4097) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_secure_pool_size() == 0);
+	assert(fido_secure_pool_len() == 0);
+	/* mlock(2) may be restricted */
+	if (fido_secure_pool_set_size(8) != FIDO_OK)
+		return;
+	assert(fido_secure_pool_size() == 8);
+	assert(fido_secure_pool_len() == 0);
+
+	/* the shared secret and the hmac-secret output live in the pool */
+	wiredata = wiredata_setup(assert_data, sizeof(assert_data));
+	wiredata_fix_cid(wiredata, sizeof(assert_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert((a = fido_assert_new()) != NULL);
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_assert_set_clientdata_hash(a, cdh,
+	    sizeof(cdh)) == FIDO_OK);
+	assert(fido_assert_set_extensions(a, FIDO_EXT_HMAC_SECRET) == FIDO_OK);
+	assert(fido_assert_set_hmac_salt(a, salt, sizeof(salt)) == FIDO_OK);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_dev_set_ecdh_cache(dev, true) == FIDO_OK);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+	assert(wiredata_len == 0);
+	assert(fido_secure_pool_len() > 0);
+	assert(fido_secure_pool_set_size(0) == FIDO_ERR_INTERNAL);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	fido_assert_free(&a);
+	wiredata_clear(&wiredata);
+
+	assert(fido_secure_pool_len() == 0);
+	assert(fido_secure_pool_set_size(0) == FIDO_OK);
+	assert(fido_secure_pool_size() == 0);
+}
+
+static void
+largeblob_cache(void)
+{
+	/* an empty array and its digest */
+	const uint8_t		 full[] = {
+				    0x00, 0x22, 0x00, 0x02, 0x90, 0x00, 0x15, 0x00,
+				    0xa1, 0x01, 0x51, 0x80, 0x76, 0xbe, 0x8b, 0x52,
+				    0x8d, 0x00, 0x75, 0xf7, 0xaa, 0xe9, 0x8d, 0x6f,
+				    0xa5, 0x7a, 0x6d, 0x3c, 0x00, 0x00, 0x00, 0x00,
+				    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+				    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+				    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+				    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+				 };
+	/* the digest alone */
+	const uint8_t		 tail[] = {
+				    0x00, 0x22, 0x00, 0x02, 0x90, 0x00, 0x14, 0x00,
+				    0xa1, 0x01, 0x50, 0x76, 0xbe, 0x8b, 0x52, 0x8d,
+				    0x00, 0x75, 0xf7, 0xaa, 0xe9, 0x8d, 0x6f, 0xa5,
+				    0x7a, 0x6d, 0x3c, 0x00, 0x00, 0x00, 0x00, 0x00,
+				    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+				    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+				    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+				    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+				 };
+	const uint8_t		 info[] = { WIREDATA_CTAP_CBOR_INFO };
+	uint8_t			 data[sizeof(info) + 5 * sizeof(full)];
+	uint8_t			*p = data;
+	uint8_t			*wiredata;
+	fido_dev_t		*dev = NULL;
+	fido_dev_io_t		 io;
+	unsigned char		*cbor;
+	size_t			 cbor_len;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	memcpy(p, info, sizeof(info));
+	p += sizeof(info);
+	memcpy(p, full, sizeof(full)); /* first read */
+	p += sizeof(full);
+	memcpy(p, tail, sizeof(tail)); /* unchanged */
+	p += sizeof(tail);
+	memcpy(p, tail, sizeof(tail)); /* changed */
+	p[26] ^= 0x01;
+	p += sizeof(tail);
+	memcpy(p, full, sizeof(full)); /* second read */
+	p += sizeof(full);
+	memcpy(p, tail, sizeof(tail)); /* longer */
+	p[6] = 0x15;
+	p[10] = 0x51;
+
+	wiredata = wiredata_setup(data, sizeof(data));
+	wiredata_fix_cid(wiredata, sizeof(data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	for (int i = 0; i < 3; i++) {
+		assert(fido_dev_largeblob_get_array(dev, &cbor,
+		    &cbor_len) == FIDO_OK);
+		assert(cbor_len == 1 && cbor[0] == 0x80);
+		free(cbor);
+	}
+	assert(wiredata_len == sizeof(tail));
+	/* a longer array is noticed; the next reply is not a full read */
+	assert(fido_dev_largeblob_get_array(dev, &cbor,
+	    &cbor_len) == FIDO_ERR_RX);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	wiredata_clear(&wiredata);
+}
+
+static void
+largeblob_session(void)
+{
+	/* an empty array and its digest */
+	const uint8_t		 full[] = {
+				    0x00, 0x22, 0x00, 0x02, 0x90, 0x00, 0x15, 0x00,
+				    0xa1, 0x01, 0x51, 0x80, 0x76, 0xbe, 0x8b, 0x52,
+				    0x8d, 0x00, 0x75, 0xf7, 0xaa, 0xe9, 0x8d, 0x6f,
+				    0xa5, 0x7a, 0x6d, 0x3c, 0x00, 0x00, 0x00, 0x00,
+				    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+				    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+				    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+				    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+				 };
+	/* the digest alone */
+	const uint8_t		 tail[] = {
+				    0x00, 0x22, 0x00, 0x02, 0x90, 0x00, 0x14, 0x00,
+				    0xa1, 0x01, 0x50, 0x76, 0xbe, 0x8b, 0x52, 0x8d,
+				    0x00, 0x75, 0xf7, 0xaa, 0xe9, 0x8d, 0x6f, 0xa5,
+				    0x7a, 0x6d, 0x3c, 0x00, 0x00, 0x00, 0x00, 0x00,
+				    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+				    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+				    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+				    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+				 };
+	const uint8_t		 info[] = { WIREDATA_CTAP_CBOR_INFO };
+	uint8_t			 data[sizeof(info) + sizeof(full)];
+	uint8_t			*wiredata;
+	fido_dev_t		*dev = NULL;
+	fido_dev_io_t		 io;
+	unsigned char		*cbor;
+	size_t			 cbor_len;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	assert(fido_session_cache_set_size(1) == FIDO_OK);
+
+	/* first open reads the whole array */
+	memcpy(data, info, sizeof(info));
+	memcpy(data + sizeof(info), full, sizeof(full));
+	wiredata = wiredata_setup(data, sizeof(data));
+	wiredata_fix_cid(wiredata, sizeof(data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_dev_largeblob_get_array(dev, &cbor, &cbor_len) == FIDO_OK);
+	assert(cbor_len == 1 && cbor[0] == 0x80);
+	free(cbor);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	wiredata_clear(&wiredata);
+
+	/* after a reopen, only the digest is read */
+	wiredata = wiredata_setup(tail, sizeof(tail));
+	wiredata_fix_cid(wiredata, sizeof(tail));
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_dev_largeblob_get_array(dev, &cbor, &cbor_len) == FIDO_OK);
+	assert(cbor_len == 1 && cbor[0] == 0x80);
+	free(cbor);
+	assert(wiredata_len == 0);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	wiredata_clear(&wiredata);
+
+	fido_session_cache_clear();
+	assert(fido_session_cache_set_size(0) == FIDO_OK);
+	fido_dev_free(&dev);
+}
+
+static void
+largeblob_chunks(void)
+{
+	const uint8_t		 info[] = { WIREDATA_CTAP_CBOR_INFO };
+	const uint8_t		 status[] = { WIREDATA_CTAP_CBOR_STATUS };
+	uint8_t			 data[sizeof(info) + 3 * sizeof(status)];
+	uint8_t			 cbor[4 + 1500];
+	uint8_t			*wiredata;
+	fido_dev_t		*dev = NULL;
+	fido_dev_io_t		 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	/* an array holding a byte string longer than a chunk */
+	memset(cbor, 0x2a, sizeof(cbor));
+	cbor[0] = 0x81;
+	cbor[1] = 0x59;
+	cbor[2] = 0x05;
+	cbor[3] = 0xdc;
+
+	/* two chunks of the array and one of its digest */
+	memcpy(data, info, sizeof(info));
+	for (size_t i = 0; i < 3; i++)
+		memcpy(data + sizeof(info) + i * sizeof(status), status,
+		    sizeof(status));
+
+	wiredata = wiredata_setup(data, sizeof(data));
+	wiredata_fix_cid(wiredata, sizeof(data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(dev->maxmsgsize - 64 < sizeof(cbor));
+	assert(fido_dev_largeblob_set_array(dev, cbor, sizeof(cbor),
+	    NULL) == FIDO_OK);
+	assert(wiredata_len == 0);
+	assert(dev->largeblob != NULL);
+	assert(dev->largeblob->len == sizeof(cbor) + 16);
+	assert(memcmp(dev->largeblob->ptr, cbor, sizeof(cbor)) == 0);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	wiredata_clear(&wiredata);
+}
+
+static void
+largeblob_level(void)
+{
+	unsigned char	 blob[4096];
+	fido_dev_t	*dev = NULL;
+	size_t		 stored, fast, best;
+
+	memset(blob, 'x', sizeof(blob));
+
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_largeblob_level(dev,
+	    -2) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_set_largeblob_level(dev,
+	    10) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_largeblob_entry_len(dev, NULL, sizeof(blob),
+	    &stored) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_set_largeblob_level(dev, 0) == FIDO_OK);
+	assert(fido_dev_largeblob_entry_len(dev, blob, sizeof(blob),
+	    &stored) == FIDO_OK);
+	assert(fido_dev_set_largeblob_level(dev, 1) == FIDO_OK);
+	assert(fido_dev_largeblob_entry_len(dev, blob, sizeof(blob),
+	    &fast) == FIDO_OK);
+	assert(fido_dev_set_largeblob_level(dev, 9) == FIDO_OK);
+	assert(fido_dev_largeblob_entry_len(dev, blob, sizeof(blob),
+	    &best) == FIDO_OK);
+	assert(stored > sizeof(blob));
+	assert(fast < stored);
+	assert(best <= fast);
+	fido_dev_free(&dev);
+}
+
+struct trace_count {
+	int		n[FIDO_TRACE_SPAN_END + 1];
+	int		keepalive;  /* status of the last keepalive */
+	int		end_result; /* result of the last CMD_END */
+	uint8_t		end_cbor;   /* ctap2 command of the last CMD_END */
+	uint64_t	ns;         /* time of the last event */
+	bool		backwards;
+};
+
+static void
+trace_handler(void *arg, const fido_trace_event_t *ev)
+{
+	struct trace_count *tc = arg;
+
+	assert(ev->type > 0 && ev->type <= FIDO_TRACE_SPAN_END);
+	tc->n[ev->type]++;
+	if (ev->ns < tc->ns)
+		tc->backwards = true;
+	tc->ns = ev->ns;
+	if (ev->type == FIDO_TRACE_KEEPALIVE)
+		tc->keepalive = ev->result;
+	if (ev->type == FIDO_TRACE_CMD_END) {
+		tc->end_result = ev->result;
+		tc->end_cbor = ev->cbor;
+	}
+}
+
+static void
+trace(void)
+{
+	const uint8_t		 trace_data[] = {
+				    WIREDATA_CTAP_CBOR_INFO,
+				    WIREDATA_CTAP_KEEPALIVE,
+				    WIREDATA_CTAP_CBOR_INFO
+				 };
+	uint8_t			*wiredata;
+	fido_dev_t		*dev = NULL;
+	fido_cbor_info_t	*ci = NULL;
+	fido_dev_io_t		 io;
+	struct trace_count	 tc;
+
+	memset(&io, 0, sizeof(io));
+	memset(&tc, 0, sizeof(tc));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	wiredata = wiredata_setup(trace_data, sizeof(trace_data));
+	wiredata_fix_cid(wiredata, sizeof(trace_data));
+	fido_set_trace_handler(trace_handler, &tc);
+	assert((dev = fido_dev_new()) != NULL);
+	assert((ci = fido_cbor_info_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	/* init and getinfo */
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(tc.n[FIDO_TRACE_CMD_START] == 2);
+	assert(tc.n[FIDO_TRACE_CMD_END] == 2);
+	assert(tc.n[FIDO_TRACE_TX] >= 2);
+	assert(tc.n[FIDO_TRACE_RX] >= 2);
+	assert(tc.n[FIDO_TRACE_KEEPALIVE] == 0);
+	assert(tc.end_cbor == CTAP_CBOR_GETINFO && tc.end_result == FIDO_OK);
+	/* a keepalive precedes the reply */
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_OK);
+	assert(tc.n[FIDO_TRACE_CMD_START] == 3);
+	assert(tc.n[FIDO_TRACE_CMD_END] == 3);
+	assert(tc.n[FIDO_TRACE_KEEPALIVE] == 1);
+	assert(tc.keepalive == 2); /* user presence needed */
+	assert(tc.backwards == false && tc.ns > 0);
+	/* disabled */
+	fido_set_trace_handler(NULL, NULL);
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_ERR_RX);
+	assert(tc.n[FIDO_TRACE_CMD_START] == 3);
+	assert(wiredata_len == 0);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	fido_cbor_info_free(&ci);
+	wiredata_clear(&wiredata);
+}
+
+struct span_log {
+	int		 n;
+	int		 ev[4];     /* FIDO_TRACE_SPAN_* */
+	int		 span[4];   /* FIDO_SPAN_* */
+	uint64_t	 id[4];
+	uint64_t	 parent[4];
+	size_t		 len[4];
+	int		 result[4];
+	const char	*transport;
+	uint64_t	 cmd_span;  /* span of the last CMD_START */
+};
+
+static void
+span_handler(void *arg, const fido_trace_event_t *ev)
+{
+	struct span_log *sl = arg;
+
+	if (ev->type == FIDO_TRACE_CMD_START)
+		sl->cmd_span = ev->span_id;
+	if (ev->type != FIDO_TRACE_SPAN_BEGIN &&
+	    ev->type != FIDO_TRACE_SPAN_END)
+		return;
+	assert(sl->n < (int)(sizeof(sl->ev) / sizeof(sl->ev[0])));
+	sl->ev[sl->n] = ev->type;
+	sl->span[sl->n] = ev->span;
+	sl->id[sl->n] = ev->span_id;
+	sl->parent[sl->n] = ev->parent_id;
+	sl->len[sl->n] = ev->len;
+	sl->result[sl->n] = ev->result;
+	sl->transport = ev->transport;
+	sl->n++;
+}
+
+static void
+trace_span(void)
+{
+	const uint8_t	 span_data[] = {
+			    WIREDATA_CTAP_CBOR_INFO,
+			    WIREDATA_CTAP_KEEPALIVE,
+			    WIREDATA_CTAP_CBOR_ASSERT
+			 };
+	uint8_t		 cdh[32] = { 0 };
+	uint8_t		*wiredata;
+	fido_dev_t	*dev = NULL;
+	fido_assert_t	*a = NULL;
+	fido_dev_io_t	 io;
+	struct span_log	 sl;
+
+	memset(&io, 0, sizeof(io));
+	memset(&sl, 0, sizeof(sl));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	assert((a = fido_assert_new()) != NULL);
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_assert_set_clientdata_hash(a, cdh, sizeof(cdh)) == FIDO_OK);
+	wiredata = wiredata_setup(span_data, sizeof(span_data));
+	wiredata_fix_cid(wiredata, sizeof(span_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	fido_set_trace_handler(span_handler, &sl);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+	fido_set_trace_handler(NULL, NULL);
+	/* the assertion, and the wait for the user nested in it */
+	assert(sl.n == 4);
+	assert(sl.ev[0] == FIDO_TRACE_SPAN_BEGIN);
+	assert(sl.span[0] == FIDO_SPAN_GET_ASSERT);
+	assert(sl.id[0] != 0 && sl.parent[0] == 0);
+	assert(sl.ev[1] == FIDO_TRACE_SPAN_BEGIN);
+	assert(sl.span[1] == FIDO_SPAN_UP);
+	assert(sl.parent[1] == sl.id[0] && sl.id[1] != sl.id[0]);
+	assert(sl.ev[2] == FIDO_TRACE_SPAN_END);
+	assert(sl.span[2] == FIDO_SPAN_UP && sl.id[2] == sl.id[1]);
+	assert(sl.ev[3] == FIDO_TRACE_SPAN_END);
+	assert(sl.span[3] == FIDO_SPAN_GET_ASSERT && sl.id[3] == sl.id[0]);
+	assert(sl.result[3] == FIDO_OK && sl.len[3] > 0);
+	assert(sl.cmd_span == sl.id[0]);
+	assert(sl.transport != NULL && strcmp(sl.transport, "usb") == 0);
+	assert(wiredata_len == 0);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	fido_assert_free(&a);
+	wiredata_clear(&wiredata);
+}
+
+static void
+record_replay(void)
+{
+	const uint8_t	 rec_data[] = {
+			    WIREDATA_CTAP_CBOR_INFO,
+			    WIREDATA_CTAP_CBOR_ASSERT
+			 };
+	const uint8_t	 cbor_info_data[] = { WIREDATA_CTAP_CBOR_INFO };
+	const char	*path = "regress_dev_record.bin";
+	uint8_t		 cdh[32] = { 0 };
+	uint8_t		*wiredata;
+	fido_dev_t	*dev = NULL;
+	fido_assert_t	*a[2] = { NULL, NULL };
+	fido_dev_io_t	 io;
+	int		 retries;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	for (size_t i = 0; i < 2; i++) {
+		assert((a[i] = fido_assert_new()) != NULL);
+		assert(fido_assert_set_rp(a[i], "localhost") == FIDO_OK);
+		assert(fido_assert_set_clientdata_hash(a[i], cdh,
+		    sizeof(cdh)) == FIDO_OK);
+	}
+
+	/* record an assertion */
+	wiredata = wiredata_setup(rec_data, sizeof(rec_data));
+	wiredata_fix_cid(wiredata, sizeof(rec_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_set_record(dev, path) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_dev_get_assert(dev, a[0], NULL) == FIDO_OK);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	assert(fido_dev_set_record(dev, NULL) == FIDO_OK);
+	assert(wiredata_len == 0);
+	fido_dev_free(&dev);
+	wiredata_clear(&wiredata);
+
+	/* replay it */
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_replay(dev, 0) == FIDO_OK);
+	assert(fido_dev_open(dev, path) == FIDO_OK);
+	assert(fido_dev_is_fido2(dev));
+	assert(fido_dev_get_assert(dev, a[1], NULL) == FIDO_OK);
+	assert(fido_assert_count(a[1]) == fido_assert_count(a[0]));
+	assert(fido_assert_sig_len(a[1], 0) == fido_assert_sig_len(a[0], 0));
+	assert(memcmp(fido_assert_sig_ptr(a[1], 0), fido_assert_sig_ptr(a[0],
+	    0), fido_assert_sig_len(a[0], 0)) == 0);
+	/* the recording is over */
+	assert(fido_dev_get_assert(dev, a[1], NULL) == FIDO_ERR_TX);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+
+	/* a replay must follow the recording */
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_replay(dev, 0) == FIDO_OK);
+	assert(fido_dev_open(dev, path) == FIDO_OK);
+	assert(fido_dev_get_uv_retry_count(dev, &retries) == FIDO_ERR_TX);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+
+	/* replays are set up before opening */
+	wiredata = wiredata_setup(cbor_info_data, sizeof(cbor_info_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_dev_set_replay(dev, 1) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	wiredata_clear(&wiredata);
+
+	assert(remove(path) == 0);
+	fido_assert_free(&a[0]);
+	fido_assert_free(&a[1]);
+}
+
+static uint64_t
+stats_sum(const fido_dev_stats_t *st, size_t idx, bool up_wait)
+{
+	uint64_t sum = 0;
+
+	for (size_t i = 0; i < FIDO_STATS_NBUCKETS; i++)
+		sum += up_wait ? fido_dev_stats_up_wait(st, i) :
+		    fido_dev_stats_rtt(st, idx, i);
+
+	return (sum);
+}
+
+static void
+stats(void)
+{
+	const uint8_t		 stats_data[] = {
+				    WIREDATA_CTAP_CBOR_INFO,
+				    WIREDATA_CTAP_KEEPALIVE,
+				    WIREDATA_CTAP_CBOR_INFO
+				 };
+	uint8_t			*wiredata;
+	fido_dev_t		*dev = NULL;
+	fido_dev_stats_t	*st = NULL;
+	fido_cbor_info_t	*ci = NULL;
+	fido_dev_io_t		 io;
+	size_t			 init = SIZE_MAX, info = SIZE_MAX;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	wiredata = wiredata_setup(stats_data, sizeof(stats_data));
+	wiredata_fix_cid(wiredata, sizeof(stats_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert((st = fido_dev_stats_new()) != NULL);
+	assert((ci = fido_cbor_info_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_stats(dev, st) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_set_stats(dev, true) == FIDO_OK);
+	/* init, getinfo, and getinfo after a keepalive */
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_OK);
+	assert(fido_dev_stats(dev, st) == FIDO_OK);
+	assert(fido_dev_stats_counter(st, FIDO_STATS_COMMANDS) == 3);
+	assert(fido_dev_stats_counter(st, FIDO_STATS_REPLIES) == 3);
+	assert(fido_dev_stats_counter(st, FIDO_STATS_RX_ERRORS) == 0);
+	assert(fido_dev_stats_counter(st, FIDO_STATS_KEEPALIVES) == 1);
+	assert(fido_dev_stats_counter(st, FIDO_STATS_TX_REPORTS) >= 3);
+	assert(fido_dev_stats_counter(st, FIDO_STATS_RX_REPORTS) >=
+	    fido_dev_stats_counter(st, FIDO_STATS_REPLIES) + 1);
+	assert(fido_dev_stats_counter(st, FIDO_STATS_TX_BYTES) ==
+	    fido_dev_stats_counter(st, FIDO_STATS_TX_REPORTS) *
+	    (dev->tx_len + 1));
+	assert(fido_dev_stats_counter(st, FIDO_STATS_RX_BYTES) ==
+	    fido_dev_stats_counter(st, FIDO_STATS_RX_REPORTS) * dev->rx_len);
+	assert(fido_dev_stats_counter(st, FIDO_STATS_NCOUNTERS) == 0);
+	assert(fido_dev_stats_cmd_len(st) == 2);
+	for (size_t i = 0; i < fido_dev_stats_cmd_len(st); i++) {
+		if (fido_dev_stats_cmd_ctaphid(st, i) == CTAP_CMD_INIT)
+			init = i;
+		if (fido_dev_stats_cmd_ctaphid(st, i) == CTAP_CMD_CBOR &&
+		    fido_dev_stats_cmd_cbor(st, i) == CTAP_CBOR_GETINFO)
+			info = i;
+	}
+	assert(init != SIZE_MAX && info != SIZE_MAX);
+	assert(stats_sum(st, init, false) == 1);
+	assert(stats_sum(st, info, false) == 2);
+	assert(stats_sum(st, 0, true) == 1);
+	assert(fido_dev_stats_rtt(st, 2, 0) == 0);
+	assert(fido_dev_stats_up_wait(st, FIDO_STATS_NBUCKETS) == 0);
+	/* no reply */
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_ERR_RX);
+	assert(fido_dev_stats(dev, st) == FIDO_OK);
+	assert(fido_dev_stats_counter(st, FIDO_STATS_COMMANDS) == 4);
+	assert(fido_dev_stats_counter(st, FIDO_STATS_REPLIES) == 3);
+	assert(fido_dev_stats_counter(st, FIDO_STATS_RX_ERRORS) == 1);
+	assert(stats_sum(st, info, false) == 2);
+	/* re-enabling resets */
+	assert(fido_dev_set_stats(dev, true) == FIDO_OK);
+	assert(fido_dev_stats(dev, st) == FIDO_OK);
+	assert(fido_dev_stats_counter(st, FIDO_STATS_COMMANDS) == 0);
+	assert(fido_dev_stats_cmd_len(st) == 0);
+	assert(fido_dev_set_stats(dev, false) == FIDO_OK);
+	assert(fido_dev_stats(dev, st) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(wiredata_len == 0);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	fido_dev_stats_free(&st);
+	fido_dev_stats_free(&st);
+	fido_cbor_info_free(&ci);
+	wiredata_clear(&wiredata);
+}
+
+struct keepalive_count {
+	int	n;
+	int	status[4];
+	int	elapsed;
+	int	cancel; /* value to return */
+};
+
+static int	cancel_writes;
+
+static int
+keepalive_cb(void *arg, int status, int elapsed_ms)
+{
+	struct keepalive_count *kc = arg;
+
+	if (kc->n < (int)(sizeof(kc->status) / sizeof(kc->status[0])))
+		kc->status[kc->n] = status;
+	kc->n++;
+	kc->elapsed = elapsed_ms;
+
+	return (kc->cancel);
+}
+
+static int
+keepalive_write(void *handle, const unsigned char *ptr, size_t len)
+{
+	if (len > 5 && ptr[5] == (CTAP_FRAME_INIT | CTAP_CMD_CANCEL))
+		cancel_writes++;
+
+	return (dummy_write(handle, ptr, len));
+}
+
+static void
+keepalive(void)
+{
+	const uint8_t		 info_data[] = { WIREDATA_CTAP_CBOR_INFO };
+	uint8_t			 keepalive_data[] = {
+				    WIREDATA_CTAP_CBOR_INFO,
+				    WIREDATA_CTAP_KEEPALIVE,
+				    WIREDATA_CTAP_KEEPALIVE,
+				    WIREDATA_CTAP_CBOR_INFO,
+				    WIREDATA_CTAP_KEEPALIVE,
+				    WIREDATA_CTAP_KEEPALIVE,
+				    WIREDATA_CTAP_KEEPALIVE
+				 };
+	const size_t		 end = sizeof(keepalive_data);
+	uint8_t			*wiredata;
+	fido_dev_t		*dev = NULL;
+	fido_cbor_info_t	*ci = NULL;
+	fido_dev_io_t		 io;
+	struct keepalive_count	 kc;
+
+	memset(&io, 0, sizeof(io));
+	memset(&kc, 0, sizeof(kc));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = keepalive_write;
+
+	/* the first keepalive reports processing */
+	keepalive_data[sizeof(info_data) + 7] = FIDO_KEEPALIVE_PROCESSING;
+	/* the last frame is a CTAP2_ERR_KEEPALIVE_CANCEL reply */
+	keepalive_data[end - 64 + 4] = CTAP_FRAME_INIT | CTAP_CMD_CBOR;
+	keepalive_data[end - 64 + 5] = 0;
+	keepalive_data[end - 64 + 6] = 1;
+	keepalive_data[end - 64 + 7] = FIDO_ERR_KEEPALIVE_CANCEL;
+
+	wiredata = wiredata_setup(keepalive_data, sizeof(keepalive_data));
+	wiredata_fix_cid(wiredata, sizeof(keepalive_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert((ci = fido_cbor_info_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_set_keepalive_cb(dev, keepalive_cb, &kc) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(kc.n == 0);
+	/* keepalives are reported */
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_OK);
+	assert(kc.n == 2);
+	assert(kc.status[0] == FIDO_KEEPALIVE_PROCESSING);
+	assert(kc.status[1] == FIDO_KEEPALIVE_UPNEEDED);
+	assert(kc.elapsed >= 0);
+	assert(cancel_writes == 0);
+	/* cancel once */
+	kc.cancel = 1;
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_ERR_KEEPALIVE_CANCEL);
+	assert(kc.n == 4);
+	assert(cancel_writes == 1);
+	/* disabled */
+	assert(fido_dev_set_keepalive_cb(dev, NULL, NULL) == FIDO_OK);
+	assert(wiredata_len == 0);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	fido_cbor_info_free(&ci);
+	wiredata_clear(&wiredata);
+}
+
+static int	read_ms[8];
+static size_t	read_n;
+
+static int
+budget_read(void *handle, unsigned char *ptr, size_t len, int ms)
+{
+	if (read_n < sizeof(read_ms) / sizeof(read_ms[0]))
+		read_ms[read_n++] = ms;
+
+	return (dummy_read(handle, ptr, len, ms));
+}
+
+static void
+cmd_timeout(void)
+{
+	uint8_t			 timeout_data[] = {
+				    WIREDATA_CTAP_CBOR_INFO,
+				    WIREDATA_CTAP_CBOR_INFO,
+				    WIREDATA_CTAP_KEEPALIVE,
+				    WIREDATA_CTAP_CBOR_INFO,
+				    WIREDATA_CTAP_CBOR_INFO,
+				    WIREDATA_CTAP_CBOR_INFO
+				 };
+	uint8_t			*wiredata;
+	fido_dev_t		*dev = NULL;
+	fido_cbor_info_t	*ci = NULL;
+	fido_dev_io_t		 io;
+	int			 ms;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = budget_read;
+	io.write = dummy_write;
+
+	wiredata = wiredata_setup(timeout_data, sizeof(timeout_data));
+	wiredata_fix_cid(wiredata, sizeof(timeout_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert((ci = fido_cbor_info_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_cmd_timeout(dev, FIDO_TIMEOUT_INFO) == -1);
+	assert(fido_dev_cmd_timeout(dev, FIDO_TIMEOUT_NCLASS) == -1);
+	assert(fido_dev_set_cmd_timeout(dev, -1, 100) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_set_cmd_timeout(dev, FIDO_TIMEOUT_NCLASS, 100) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_set_cmd_timeout(dev, FIDO_TIMEOUT_INFO, -2) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_set_cmd_timeout(dev, FIDO_TIMEOUT_INFO, 100) ==
+	    FIDO_OK);
+	assert(fido_dev_cmd_timeout(dev, FIDO_TIMEOUT_INFO) == 100);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	/* the budget bounds each read */
+	read_n = 0;
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_OK);
+	assert(read_n > 1 && read_ms[0] == 100 && read_ms[1] == 100);
+	/* ... until user presence is requested */
+	read_n = 0;
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_OK);
+	assert(read_n > 2 && read_ms[0] == 100 && read_ms[1] == -1);
+	/* the tighter of the budget and the timeout applies */
+	assert(fido_dev_set_timeout(dev, 50) == FIDO_OK);
+	read_n = 0;
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_OK);
+	assert(read_n > 1 && read_ms[0] > 0 && read_ms[0] <= 50);
+	assert(fido_dev_set_timeout(dev, -1) == FIDO_OK);
+	/* an expired budget fails the command */
+	interval_ms = 300;
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_ERR_RX);
+	interval_ms = 0;
+	/* adaptive budgets start from the configured ones */
+	assert(fido_dev_set_cmd_timeout(dev, FIDO_TIMEOUT_INFO, -1) == FIDO_OK);
+	assert(fido_dev_set_adaptive_timeout(dev, true) == FIDO_OK);
+	assert(fido_dev_cmd_timeout(dev, FIDO_TIMEOUT_INFO) == -1);
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_OK);
+	ms = fido_dev_cmd_timeout(dev, FIDO_TIMEOUT_INFO);
+	assert(ms >= 250 && ms < 1000);
+	assert(fido_dev_cmd_timeout(dev, FIDO_TIMEOUT_CBOR) == -1);
+	assert(fido_dev_cmd_timeout(dev, FIDO_TIMEOUT_UP) == -1);
+	/* and are capped by them */
+	assert(fido_dev_set_cmd_timeout(dev, FIDO_TIMEOUT_INFO, 100) ==
+	    FIDO_OK);
+	assert(fido_dev_cmd_timeout(dev, FIDO_TIMEOUT_INFO) == 100);
+	assert(fido_dev_set_adaptive_timeout(dev, false) == FIDO_OK);
+	assert(fido_dev_cmd_timeout(dev, FIDO_TIMEOUT_INFO) == 100);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	fido_cbor_info_free(&ci);
+	wiredata_clear(&wiredata);
+}
+
+static const unsigned char transport_info[] = {
+	0x00, 0xa2, 0x01, 0x81, 0x68, 'F', 'I', 'D', 'O', '_', '2', '_', '0',
+	0x03, 0x50, 0xf8, 0xa0, 0x11, 0xf3, 0x8c, 0x0a, 0x4d, 0x15, 0x80, 0x06,
+	0x17, 0x11, 0x1f, 0x9e, 0xdc, 0x7d,
+};
+static uint64_t	 transport_nonce;
+static size_t	 transport_rx_calls;
+static size_t	 borrow_calls;
+static size_t	 release_calls;
+static int	 borrow_fail;
+
+static int
+transport_tx(fido_dev_t *dev, uint8_t cmd, const unsigned char *ptr,
+    size_t len)
+{
+	(void)dev;
+
+	if (cmd == CTAP_CMD_INIT) {
+		assert(len == sizeof(transport_nonce));
+		memcpy(&transport_nonce, ptr, len);
+	}
+
+	return (0);
+}
+
+static int
+transport_rx(fido_dev_t *dev, uint8_t cmd, unsigned char *ptr, size_t len,
+    int ms)
+{
+	(void)dev;
+	(void)ms;
+
+	transport_rx_calls++;
+	if (cmd == CTAP_CMD_INIT) {
+		assert(len >= 17);
+		memset(ptr, 0, 17);
+		memcpy(ptr, &transport_nonce, sizeof(transport_nonce));
+		ptr[12] = 2; /* protocol */
+		ptr[16] = 0x04; /* cbor */
+		return (17);
+	}
+	assert(cmd == CTAP_CMD_CBOR && len >= sizeof(transport_info));
+	memcpy(ptr, transport_info, sizeof(transport_info));
+
+	return ((int)sizeof(transport_info));
+}
+
+static int
+transport_borrow(fido_dev_t *dev, uint8_t cmd, const unsigned char **ptr,
+    size_t *len, int ms)
+{
+	(void)dev;
+	(void)ms;
+
+	assert(cmd == CTAP_CMD_CBOR);
+	assert(release_calls == borrow_calls);
+	borrow_calls++;
+	if (borrow_fail)
+		return (-1);
+	*ptr = transport_info;
+	*len = sizeof(transport_info);
+
+	return (0);
+}
+
+static void
+transport_release(fido_dev_t *dev, const unsigned char *ptr, size_t len)
+{
+	(void)dev;
+
+	assert(ptr == transport_info);
+	assert(len == sizeof(transport_info));
+	release_calls++;
+}
+
+static void
+transport_lend(void)
+{
+	fido_dev_t		*dev = NULL;
+	fido_cbor_info_t	*ci = NULL;
+	fido_dev_io_t		 io;
+	fido_dev_transport_t	 t;
+
+	memset(&io, 0, sizeof(io));
+	memset(&t, 0, sizeof(t));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+	t.rx = transport_rx;
+	t.tx = transport_tx;
+
+	assert((dev = fido_dev_new()) != NULL);
+	assert((ci = fido_cbor_info_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	/* lending needs transport functions, and both hooks */
+	assert(fido_dev_set_transport_borrow(dev, transport_borrow,
+	    transport_release) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_set_transport_functions(dev, &t) == FIDO_OK);
+	assert(fido_dev_set_transport_borrow(dev, transport_borrow,
+	    NULL) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_set_transport_borrow(dev, NULL,
+	    transport_release) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_set_transport_borrow(dev, transport_borrow,
+	    transport_release) == FIDO_OK);
+
+	/* ctaphid_init is copied, getinfo is parsed in place */
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_dev_is_fido2(dev));
+	assert(transport_rx_calls == 1);
+	assert(borrow_calls == 1 && release_calls == 1);
+	assert(fido_dev_set_transport_borrow(dev, NULL,
+	    NULL) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_OK);
+	assert(fido_cbor_info_versions_len(ci) == 1);
+	assert(transport_rx_calls == 1);
+	assert(borrow_calls == 2 && release_calls == 2);
+	/* nothing is released if nothing was lent */
+	borrow_fail = 1;
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_ERR_RX);
+	assert(borrow_calls == 3 && release_calls == 2);
+	borrow_fail = 0;
+	assert(fido_dev_close(dev) == FIDO_OK);
+
+	/* without lending, replies are copied */
+	assert(fido_dev_set_transport_borrow(dev, NULL, NULL) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_OK);
+	assert(fido_cbor_info_versions_len(ci) == 1);
+	assert(transport_rx_calls == 4);
+	assert(borrow_calls == 3);
+	assert(fido_dev_close(dev) == FIDO_OK);
+
+	fido_dev_free(&dev);
+	fido_cbor_info_free(&ci);
+}
+
+#define BLE_CP_LEN	20
+
+static unsigned char	 ble_req[256];  /* reassembled request */
+static size_t		 ble_req_len;   /* its length */
+static size_t		 ble_req_want;  /* its announced length */
+static uint8_t		 ble_req_cmd;
+static int		 ble_req_seq;
+static size_t		 ble_nreq;      /* complete requests */
+static unsigned char	 ble_rsp[8][BLE_CP_LEN]; /* queued fragments */
+static size_t		 ble_rsp_len[8];
+static size_t		 ble_rsp_head, ble_rsp_tail;
+
+static void
+ble_queue(const unsigned char *frag, size_t len)
+{
+	assert(ble_rsp_tail < nitems(ble_rsp) && len <= BLE_CP_LEN);
+	memcpy(ble_rsp[ble_rsp_tail], frag, len);
+	ble_rsp_len[ble_rsp_tail++] = len;
+}
+
+static void
+ble_reply(uint8_t cmd, const unsigned char *ptr, size_t len)
+{
+	unsigned char	frag[BLE_CP_LEN];
+	size_t		n;
+
+	frag[0] = cmd;
+	frag[1] = (uint8_t)(len >> 8);
+	frag[2] = (uint8_t)len;
+	n = len < BLE_CP_LEN - 3 ? len : BLE_CP_LEN - 3;
+	memcpy(&frag[3], ptr, n);
+	ble_queue(frag, 3 + n);
+	for (uint8_t seq = 0; n < len; seq++) {
+		size_t m = len - n < BLE_CP_LEN - 1 ? len - n : BLE_CP_LEN - 1;
+		frag[0] = seq;
+		memcpy(&frag[1], ptr + n, m);
+		ble_queue(frag, 1 + m);
+		n += m;
+	}
+}
+
+/* what a ble authenticator would answer */
+static void
+ble_answer(void)
+{
+	const unsigned char keepalive[] = { 0x82, 0x00, 0x01, 0x01 };
+	const unsigned char no_credentials[] = { FIDO_ERR_NO_CREDENTIALS };
+
+	assert(ble_req_cmd == 0x83); /* msg */
+	switch (ble_req[0]) {
+	case 0x04: /* getinfo */
+		ble_queue(keepalive, sizeof(keepalive));
+		ble_reply(0x83, transport_info, sizeof(transport_info));
+		break;
+	case 0x02: /* getassert */
+		ble_reply(0x83, no_credentials, sizeof(no_credentials));
+		break;
+	default:
+		assert(0);
+	}
+}
+
+static int
+ble_read(void *handle, unsigned char *ptr, size_t len, int ms)
+{
+	size_t n;
+
+	assert(handle == &fake_dev_handle);
+	(void)ms;
+
+	if (ble_rsp_head == ble_rsp_tail)
+		return (-1);
+	n = ble_rsp_len[ble_rsp_head];
+	assert(len >= n);
+	memcpy(ptr, ble_rsp[ble_rsp_head++], n);
+	if (ble_rsp_head == ble_rsp_tail)
+		ble_rsp_head = ble_rsp_tail = 0;
+
+	return ((int)n);
+}
+
+static int
+ble_write(void *handle, const unsigned char *ptr, size_t len)
+{
+	size_t n;
+
+	assert(handle == &fake_dev_handle);
+	assert(len >= 1 && len <= BLE_CP_LEN);
+
+	if (ble_req_want == ble_req_len) { /* new request */
+		assert(len >= 3 && (ptr[0] & 0x80));
+		ble_req_cmd = ptr[0];
+		ble_req_want = (size_t)(ptr[1] << 8 | ptr[2]);
+		ble_req_len = 0;
+		ble_req_seq = 0;
+		n = len - 3;
+		ptr += 3;
+	} else {
+		assert(ptr[0] == ble_req_seq++);
+		n = len - 1;
+		ptr += 1;
+	}
+	assert(ble_req_len + n <= ble_req_want &&
+	    ble_req_want <= sizeof(ble_req));
+	memcpy(ble_req + ble_req_len, ptr, n);
+	if ((ble_req_len += n) == ble_req_want) {
+		ble_nreq++;
+		ble_answer();
+	}
+
+	return ((int)len);
+}
+
+static void
+ble_transport(void)
+{
+	const unsigned char	 cdh[32] = { 0 };
+	fido_dev_t		*dev = NULL;
+	fido_cbor_info_t	*ci = NULL;
+	fido_assert_t		*a = NULL;
+	fido_dev_io_t		 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = ble_read;
+	io.write = ble_write;
+
+	assert((dev = fido_dev_new()) != NULL);
+	assert((ci = fido_cbor_info_new()) != NULL);
+	assert((a = fido_assert_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_set_ble_transport(dev, 19) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_set_ble_transport(dev, 513) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_set_ble_transport(dev, BLE_CP_LEN) == FIDO_OK);
+
+	/* getinfo fits one fragment; its reply takes two and a keepalive */
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(ble_nreq == 1 && ble_req_len == 1);
+	assert(fido_dev_is_fido2(dev));
+	assert(fido_dev_set_ble_transport(dev, BLE_CP_LEN) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_OK);
+	assert(fido_cbor_info_versions_len(ci) == 1);
+	assert(ble_nreq == 2);
+
+	/* a request spanning several fragments */
+	assert(fido_assert_set_clientdata_hash(a, cdh, sizeof(cdh)) ==
+	    FIDO_OK);
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_ERR_NO_CREDENTIALS);
+	assert(ble_nreq == 3 && ble_req_len > 2 * BLE_CP_LEN);
+	assert(fido_dev_close(dev) == FIDO_OK);
+
+	fido_dev_free(&dev);
+	fido_cbor_info_free(&ci);
+	fido_assert_free(&a);
+}
+
+static void
+manifest_parallel(void)
+{
+	fido_dev_info_t	*devlist = NULL;
+	size_t		 ndevs, nfound;
+
+	assert((devlist = fido_dev_info_new(64)) != NULL);
+	assert(fido_dev_info_manifest(devlist, 64, &ndevs) == FIDO_OK);
+	fido_dev_info_free(&devlist, 64);
+
+	assert((devlist = fido_dev_info_new(64)) != NULL);
+	assert(fido_dev_info_manifest_parallel(devlist, 64, &nfound,
+	    -1) == FIDO_OK);
+	assert(nfound == ndevs);
+	for (size_t i = 0; i < nfound; i++)
+		assert(fido_dev_info_path(fido_dev_info_ptr(devlist,
+		    i)) != NULL);
+	fido_dev_info_free(&devlist, 64);
+
+	assert(fido_dev_info_manifest_parallel(NULL, 0, &nfound,
+	    0) == FIDO_OK);
+	assert(nfound == 0);
+}
+
+struct manifest_count {
+	size_t	n;
+	size_t	stop; /* stop after this many devices, if not 0 */
+};
+
+static int
+manifest_count_cb(const fido_dev_info_t *di, void *arg)
+{
+	struct manifest_count *mc = arg;
+
+	assert(fido_dev_info_path(di) != NULL);
+	mc->n++;
+
+	return (mc->stop != 0 && mc->n == mc->stop);
+}
+
+static void
+manifest_cb(void)
+{
+	fido_dev_info_t		*devlist = NULL;
+	struct manifest_count	 mc;
+	size_t			 ndevs;
+
+	assert((devlist = fido_dev_info_new(64)) != NULL);
+	assert(fido_dev_info_manifest(devlist, 64, &ndevs) == FIDO_OK);
+	fido_dev_info_free(&devlist, 64);
+
+	memset(&mc, 0, sizeof(mc));
+	assert(fido_dev_info_manifest_cb(manifest_count_cb, &mc,
+	    -1) == FIDO_OK);
+	assert(mc.n == ndevs);
+
+	memset(&mc, 0, sizeof(mc));
+	mc.stop = 1;
+	assert(fido_dev_info_manifest_cb(manifest_count_cb, &mc,
+	    -1) == FIDO_OK);
+	assert(mc.n == (ndevs > 0 ? 1 : 0));
+
+	assert(fido_dev_info_manifest_cb(NULL, NULL,
+	    -1) == FIDO_ERR_INVALID_ARGUMENT);
+}
+
+static void
+manifest_diff(void)
+{
+	fido_dev_info_t	*devlist = NULL;
+	fido_dev_info_t	*added = NULL;
+	fido_dev_io_t	 io;
+	size_t		 ndevs, nadded, gone[65], ngone;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	assert((devlist = fido_dev_info_new(65)) != NULL);
+	assert((added = fido_dev_info_new(8)) != NULL);
+	assert(fido_dev_info_manifest(devlist, 64, &ndevs) == FIDO_OK);
+	assert(fido_dev_info_manifest_diff(devlist, ndevs, added, 8, &nadded,
+	    gone, &ngone) == FIDO_OK);
+	assert(nadded == 0);
+	assert(ngone == 0);
+	/* a device not found by enumeration is reported as gone */
+	assert(fido_dev_info_set(devlist, ndevs, "dummy", "manufacturer",
+	    "product", &io, NULL) == FIDO_OK);
+	assert(fido_dev_info_manifest_diff(devlist, ndevs + 1, added, 8,
+	    &nadded, gone, &ngone) == FIDO_OK);
+	assert(nadded == 0);
+	assert(ngone == 1);
+	assert(gone[0] == ndevs);
+	/* without a previous list, every device is new */
+	assert(fido_dev_info_manifest_diff(NULL, 0, added, 8, &nadded,
+	    NULL, &ngone) == FIDO_OK);
+	assert(nadded == (ndevs < 8 ? ndevs : 8));
+	assert(ngone == 0);
+	assert(fido_dev_info_manifest_diff(NULL, 1, added, 8, &nadded,
+	    gone, &ngone) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_info_manifest_diff(devlist, 1, added, 8, &nadded,
+	    NULL, &ngone) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_info_manifest_diff(NULL, 0, NULL, 1, &nadded,
+	    NULL, &ngone) == FIDO_ERR_INVALID_ARGUMENT);
+	fido_dev_info_free(&added, 8);
+	fido_dev_info_free(&devlist, 65);
+}
+
+static void
+monitor(void)
+{
+	fido_dev_monitor_t	*mon = NULL;
+	fido_dev_info_t		*di = NULL;
+	int			 event;
+
+	assert((mon = fido_dev_monitor_new()) != NULL);
+	assert((di = fido_dev_info_new(1)) != NULL);
+	assert(fido_dev_monitor_read(mon, di, &event) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_monitor_get_fd(mon) == -1);
+	assert(fido_dev_monitor_get_pcsc_fd(mon) == -1);
+	assert(fido_dev_monitor_set_pcsc(mon, false) == FIDO_OK);
+	if (fido_dev_monitor_start(mon) == FIDO_OK) {
+		/* devices already present are reported as added */
+		do {
+			assert(fido_dev_monitor_read(mon, di,
+			    &event) == FIDO_OK);
+			assert(event == 0 || event == FIDO_DEV_MONITOR_ADD);
+			assert(event == 0 || fido_dev_info_path(di) != NULL);
+		} while (event != 0);
+	}
+	assert(fido_dev_monitor_start(mon) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_monitor_set_pcsc(mon, true) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_monitor_get_pcsc_fd(mon) == -1);
+	assert(fido_dev_monitor_read(mon, NULL, &event) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_monitor_read(mon, di, NULL) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	fido_dev_info_free(&di, 1);
+	fido_dev_monitor_free(&mon);
+	assert(mon == NULL);
+	fido_dev_monitor_free(&mon);
+	fido_dev_monitor_free(NULL);
+}
+
+static void
+loop_cb(fido_dev_t *dev, void *cookie, int r)
+{
+	int *result = cookie;
+
+	assert(dev != NULL);
+	*result = r;
+}
+
+static void
+async_u2f(void)
+{
+	const uint8_t	 assert_data[] = {
+			    WIREDATA_CTAP_CBOR_INFO,
+			    WIREDATA_CTAP_U2F_6985,
+			    WIREDATA_CTAP_U2F_6985,
+			    WIREDATA_CTAP_U2F_AUTH
+			 };
+	const uint8_t	 cancel_data[] = {
+			    WIREDATA_CTAP_CBOR_INFO,
+			    WIREDATA_CTAP_U2F_6985,
+			    WIREDATA_CTAP_U2F_6985
+			 };
+	const uint8_t	 cdh[32] = { 0 };
+	const uint8_t	 key_id[4] = { 1, 2, 3, 4 };
+	uint8_t		*wiredata;
+	fido_dev_t	*dev = NULL;
+	fido_assert_t	*a = NULL;
+	fido_dev_io_t	 io;
+	int		 done, t;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	/* found, then presence awaited once */
+	wiredata = wiredata_setup(assert_data, sizeof(assert_data));
+	wiredata_fix_cid(wiredata, sizeof(assert_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert((a = fido_assert_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	fido_dev_force_u2f(dev);
+	assert(fido_dev_poll_timeout(dev) == -1);
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_assert_set_clientdata_hash(a, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_assert_allow_cred(a, key_id, sizeof(key_id)) == FIDO_OK);
+	assert(fido_dev_get_assert_begin(dev, a, NULL) == FIDO_OK);
+	assert(fido_dev_poll_timeout(dev) == -1);
+	assert(fido_dev_get_assert_step(dev, a, &done, 0) == FIDO_OK);
+	assert(done == 0);
+	assert((t = fido_dev_poll_timeout(dev)) >= 0 && t <= 10);
+	assert(fido_dev_get_assert_step(dev, a, &done, -1) == FIDO_OK);
+	assert(done == 1);
+	assert(fido_dev_poll_timeout(dev) == -1);
+	assert(fido_assert_count(a) == 1);
+	assert(fido_assert_id_len(a, 0) == sizeof(key_id));
+	assert(fido_assert_sig_len(a, 0) != 0);
+	assert(fido_assert_authdata_len(a, 0) != 0);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	wiredata_clear(&wiredata);
+
+	/* cancelled while waiting for presence */
+	wiredata = wiredata_setup(cancel_data, sizeof(cancel_data));
+	wiredata_fix_cid(wiredata, sizeof(cancel_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	fido_dev_force_u2f(dev);
+	assert(fido_dev_cancel(dev) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_get_assert_begin(dev, a, NULL) == FIDO_OK);
+	assert(fido_dev_get_assert_step(dev, a, &done, 0) == FIDO_OK);
+	assert(done == 0);
+	assert(fido_dev_cancel(dev) == FIDO_OK);
+	assert(fido_dev_poll_timeout(dev) == 0);
+	assert(fido_dev_get_assert_step(dev, a, &done,
+	    -1) == FIDO_ERR_KEEPALIVE_CANCEL);
+	assert(done == 0);
+	assert(fido_dev_poll_timeout(dev) == -1);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	fido_assert_free(&a);
+	wiredata_clear(&wiredata);
+}
+
+static void
+u2f_register_reply(void)
+{
+	const uint8_t	 reg_data[] = {
+			    WIREDATA_CTAP_CBOR_INFO,
+			    WIREDATA_CTAP_U2F_REGISTER
+			 };
+	const uint8_t	 cdh[32] = { 0 };
+	uint8_t		*wiredata;
+	fido_dev_t	*dev = NULL;
+	fido_cred_t	*c = NULL;
+	fido_dev_io_t	 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	wiredata = wiredata_setup(reg_data, sizeof(reg_data));
+	wiredata_fix_cid(wiredata, sizeof(reg_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert((c = fido_cred_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	fido_dev_force_u2f(dev);
+	assert(fido_cred_set_type(c, COSE_ES256) == FIDO_OK);
+	assert(fido_cred_set_rp(c, "localhost", NULL) == FIDO_OK);
+	assert(fido_cred_set_clientdata_hash(c, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_dev_make_cred(dev, c, NULL) == FIDO_OK);
+	assert(strcmp(fido_cred_fmt(c), "fido-u2f") == 0);
+	/* SEQUENCE of 0x24f bytes, delimited by its header alone */
+	assert(fido_cred_x5c_len(c) == 4 + 0x24f);
+	assert(fido_cred_x5c_ptr(c)[0] == 0x30);
+	assert(fido_cred_sig_len(c) != 0);
+	assert(fido_cred_pubkey_len(c) == 64);
+	assert(fido_cred_id_len(c) != 0);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	fido_cred_free(&c);
+	wiredata_clear(&wiredata);
+}
+
+static void
+select_touch(void)
+{
+	const uint8_t	 touch_data[] = {
+			    WIREDATA_CTAP_CBOR_INFO,
+			    WIREDATA_CTAP_KEEPALIVE,
+			    WIREDATA_CTAP_CBOR_STATUS
+			 };
+	const uint8_t	 cbor_info_data[] = { WIREDATA_CTAP_CBOR_INFO };
+	uint8_t		*wiredata;
+	fido_dev_t	*dev[2] = { NULL, NULL };
+	fido_dev_io_t	 io;
+	size_t		 idx;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	assert(fido_dev_select(NULL, 1, 0, &idx) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_select(dev, 0, 0, &idx) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_select(dev, 2, 0, &idx) == FIDO_ERR_INVALID_ARGUMENT);
+
+	/* touched */
+	wiredata = wiredata_setup(touch_data, sizeof(touch_data));
+	wiredata_fix_cid(wiredata, sizeof(touch_data));
+	assert((dev[1] = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev[1], &io) == FIDO_OK);
+	assert(fido_dev_open(dev[1], "dummy") == FIDO_OK);
+	assert(fido_dev_select(dev, 2, 0, NULL) == FIDO_ERR_INVALID_ARGUMENT);
+	idx = 0;
+	assert(fido_dev_select(dev, 2, -1, &idx) == FIDO_OK);
+	assert(idx == 1);
+	assert(fido_dev_close(dev[1]) == FIDO_OK);
+	fido_dev_free(&dev[1]);
+	wiredata_clear(&wiredata);
+
+	/* not touched */
+	wiredata = wiredata_setup(cbor_info_data, sizeof(cbor_info_data));
+	assert((dev[0] = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev[0], &io) == FIDO_OK);
+	assert(fido_dev_open(dev[0], "dummy") == FIDO_OK);
+	assert(fido_dev_select(dev, 1, 50, &idx) == FIDO_ERR_TIMEOUT);
+	assert(fido_dev_close(dev[0]) == FIDO_OK);
+	fido_dev_free(&dev[0]);
+	wiredata_clear(&wiredata);
+}
+
+/* wink is acknowledged without waiting for the user */
+static void
+wink(void)
+{
+	const uint8_t	 cbor_info_data[] = { WIREDATA_CTAP_CBOR_INFO };
+	uint8_t		 data[sizeof(cbor_info_data) + REPORT_LEN - 1];
+	uint8_t		*wiredata;
+	fido_dev_t	*dev = NULL;
+	fido_dev_io_t	 io;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	memset(data, 0, sizeof(data));
+	memcpy(data, cbor_info_data, sizeof(cbor_info_data));
+	memcpy(data + sizeof(cbor_info_data), cbor_info_data, 4); /* cid */
+	data[sizeof(cbor_info_data) + 4] = 0x88; /* CTAPHID_WINK */
+
+	wiredata = wiredata_setup(data, sizeof(data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_wink(dev) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_dev_wink(dev) == FIDO_OK);
+	assert(wiredata_len == 0);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	wiredata_clear(&wiredata);
+}
+
+static void
+loop_assert(void)
+{
+	const uint8_t	 assert_data[] = {
+			    WIREDATA_CTAP_CBOR_INFO,
+			    WIREDATA_CTAP_KEEPALIVE,
+			    WIREDATA_CTAP_CBOR_ASSERT
+			 };
+	const uint8_t	 cdh[32] = { 0 };
+	uint8_t		*wiredata;
+	fido_loop_t	*loop = NULL;
+	fido_dev_t	*dev = NULL;
+	fido_assert_t	*a = NULL;
+	fido_dev_io_t	 io;
+	int		 result = -1;
+
+	memset(&io, 0, sizeof(io));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	wiredata = wiredata_setup(assert_data, sizeof(assert_data));
+	wiredata_fix_cid(wiredata, sizeof(assert_data));
+	assert((loop = fido_loop_new()) != NULL);
+	assert((dev = fido_dev_new()) != NULL);
+	assert((a = fido_assert_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(fido_loop_run(loop, -1) == FIDO_OK);
+	assert(fido_loop_add_assert(loop, dev, a, NULL, loop_cb,
+	    &result) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_loop_pending(loop) == 0);
+	assert(fido_assert_set_rp(a, "localhost") == FIDO_OK);
+	assert(fido_assert_set_clientdata_hash(a, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_loop_add_assert(loop, dev, a, NULL, NULL,
+	    &result) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_loop_add_assert(loop, dev, a, NULL, loop_cb,
+	    &result) == FIDO_OK);
+	assert(fido_loop_pending(loop) == 1);
+	interval_ms = 100;
+	assert(fido_loop_run(loop, 10) == FIDO_ERR_TIMEOUT);
+	assert(fido_loop_pending(loop) == 1);
+	assert(result == -1);
+	interval_ms = 0;
+	assert(fido_loop_run(loop, -1) == FIDO_OK);
+	assert(fido_loop_pending(loop) == 0);
+	assert(result == FIDO_OK);
+	assert(fido_assert_count(a) == 1);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	fido_assert_free(&a);
+	fido_loop_free(&loop);
+	wiredata_clear(&wiredata);
+}
+
+#ifdef HAVE_PTHREAD
+#define THREADS_N	8
+#define THREADS_ITER	64
+
+struct thread_arg {
+	const fido_cbor_info_t	*ci;
+	size_t			 ntransports;
+	size_t			 nalgorithms;
+};
+
+static int thread_handle;
+static int thread_trace_a;
+static int thread_trace_b;
+
+static void *
+thread_open(const char *path)
+{
+	(void)path;
+
+	return (&thread_handle);
+}
+
+static void
+thread_close(void *handle)
+{
+	assert(handle == &thread_handle);
+}
+
+static int
+thread_read(void *handle, unsigned char *ptr, size_t len, int ms)
+{
+	(void)handle;
+	(void)ptr;
+	(void)len;
+	(void)ms;
+
+	return (-1);
+}
+
+static int
+thread_write(void *handle, const unsigned char *ptr, size_t len)
+{
+	(void)handle;
+	(void)ptr;
+
+	return ((int)len);
+}
+
+/* the argument always comes with the handler it was installed with */
+static void
+thread_trace_handler_a(void *arg, const fido_trace_event_t *ev)
+{
+	assert(arg == &thread_trace_a);
+	assert(ev->type > 0 && ev->type <= FIDO_TRACE_SPAN_END);
+}
+
+static void
+thread_trace_handler_b(void *arg, const fido_trace_event_t *ev)
+{
+	assert(arg == &thread_trace_b);
+	assert(ev->type > 0 && ev->type <= FIDO_TRACE_SPAN_END);
+}
+
+static void *
+thread_worker(void *arg)
+{
+	struct thread_arg	*ta = arg;
+	fido_dev_t		*dev = NULL;
+	fido_dev_io_t		 io;
+
+	fido_init(0);
+	memset(&io, 0, sizeof(io));
+
+	io.open = thread_open;
+	io.close = thread_close;
+	io.read = thread_read;
+	io.write = thread_write;
+
+	/* the first read decodes the deferred fields of the shared ci */
+	ta->ntransports = fido_cbor_info_transports_len(ta->ci);
+	ta->nalgorithms = fido_cbor_info_algorithm_count(ta->ci);
+	for (size_t i = 0; i < THREADS_ITER; i++) {
+		assert((dev = fido_dev_new()) != NULL);
+		assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+		assert(fido_dev_open(dev, "thread") != FIDO_OK);
+		fido_dev_free(&dev);
+		assert(fido_secure_pool_len() <= fido_secure_pool_size());
+	}
+
+	return (NULL);
+}
+
+static void
+threads(void)
+{
+	const uint8_t		 cbor_info_data[] = { WIREDATA_CTAP_CBOR_INFO };
+	uint8_t			*wiredata;
+	fido_dev_t		*dev = NULL;
+	fido_dev_io_t		 io;
+	pthread_t		 thread[THREADS_N];
+	struct thread_arg	 ta[THREADS_N];
+
+	memset(&io, 0, sizeof(io));
+	memset(&ta, 0, sizeof(ta));
+
+	io.open = dummy_open;
+	io.close = dummy_close;
+	io.read = dummy_read;
+	io.write = dummy_write;
+
+	wiredata = wiredata_setup(cbor_info_data, sizeof(cbor_info_data));
+	wiredata_fix_cid(wiredata, sizeof(cbor_info_data));
+	assert((dev = fido_dev_new()) != NULL);
+	assert(fido_dev_set_io_functions(dev, &io) == FIDO_OK);
+	assert(fido_dev_open(dev, "dummy") == FIDO_OK);
+	assert(wiredata_len == 0);
+
+	for (size_t i = 0; i < THREADS_N; i++) {
+		assert((ta[i].ci = fido_dev_cbor_info(dev)) != NULL);
+		assert(pthread_create(&thread[i], NULL, thread_worker,
+		    &ta[i]) == 0);
+	}
+	/* swap the trace handler while the workers trace */
+	for (size_t i = 0; i < THREADS_N * THREADS_ITER; i++) {
+		if (i % 2)
+			fido_set_trace_handler(thread_trace_handler_a,
+			    &thread_trace_a);
+		else
+			fido_set_trace_handler(thread_trace_handler_b,
+			    &thread_trace_b);
+	}
+	for (size_t i = 0; i < THREADS_N; i++)
+		assert(pthread_join(thread[i], NULL) == 0);
+	fido_set_trace_handler(NULL, NULL);
+
+	for (size_t i = 1; i < THREADS_N; i++) {
+		assert(ta[i].ntransports == ta[0].ntransports);
+		assert(ta[i].nalgorithms == ta[0].nalgorithms);
+	}
+	assert(fido_dev_close(dev) == FIDO_OK);
+	fido_dev_free(&dev);
+	wiredata_clear(&wiredata);
+}
+#endif
+
+int
+main(void)
+{
+	fido_init(0);
+
+	open_iff_ok();
+	reopen();
+	double_open();
+	double_close();
+	is_fido2();
+	has_pin();
+	timeout_rx();
+	timeout_ok();
+	timeout_misc();
+	async_assert();
+	prepared_assert();
+	async_cred();
+	async_u2f();
+	u2f_register_reply();
+	select_touch();
+	wink();
+	loop_assert();
+	writev_cred();
+	rx_buf();
+	channel();
+	open_many();
+	session_cache();
+	legacy_cache();
+	cbor_info_retained();
+	uv_token_cache();
+	credman_snapshot();
+	credman_all_rk();
+	credman_del_batch();
+	credman_set_batch();
+	ecdh_cache();
+	keypool();
+	secure_pool();
+	largeblob_cache();
+	largeblob_session();
+	largeblob_chunks();
+	largeblob_level();
+	transport_lend();
+	ble_transport();
+	manifest_parallel();
+	manifest_cb();
+	manifest_diff();
+	monitor();
+	trace();
+	trace_span();
+	record_replay();
+	stats();
+	keepalive();
+	cmd_timeout();
+#ifdef HAVE_PTHREAD
+	threads();
+	scheduler();
+#endif
 
 	exit(0);
 }
@@ -182,6 +182,33 @@ valid_curve(const unsigned char *raw, size_t raw_len)
 	es256_pk_free(&pkB);
 }
 
+static void
+compressed(void)
+{
+	es256_pk_t *pkA;
+	es256_pk_t *pkB;
+	unsigned char c[32 + 1];
+
+	ASSERT_NOT_NULL((pkA = es256_pk_new()));
+	ASSERT_NOT_NULL((pkB = es256_pk_new()));
+	ASSERT_OK(es256_pk_from_ptr(pkA, p256v1_raw, sizeof(p256v1_raw)));
+	ASSERT_INVAL(es256_pk_to_compressed(pkA, c, sizeof(c) - 1));
+	ASSERT_OK(es256_pk_to_compressed(pkA, c, sizeof(c)));
+	assert(c[0] == 0x02 || c[0] == 0x03);
+	assert(memcmp(c + 1, p256v1_raw + 1, sizeof(c) - 1) == 0);
+	ASSERT_OK(es256_pk_from_ptr(pkB, c, sizeof(c)));
+	assert(memcmp(pkA, pkB, sizeof(*pkA)) == 0);
+	valid_curve(c, sizeof(c));
+	c[0] ^= 0x01; /* other y */
+	ASSERT_OK(es256_pk_from_ptr(pkB, c, sizeof(c)));
+	assert(memcmp(pkA, pkB, sizeof(*pkA)) != 0);
+	c[0] = 0x05;
+	ASSERT_INVAL(es256_pk_from_ptr(pkB, c, sizeof(c)));
+
+	es256_pk_free(&pkA);
+	es256_pk_free(&pkB);
+}
+
 int
 main(void)
 {
@@ -194,6 +221,7 @@ main(void)
 	invalid_curve(p256k1_raw + 1, sizeof(p256k1_raw) - 1); /* libfido2 */
 	valid_curve(p256v1_raw, sizeof(p256v1_raw)); /* uncompressed */
 	valid_curve(p256v1_raw + 1, sizeof(p256v1_raw) - 1); /* libfido2 */
+	compressed();
 
 	exit(0);
 }
@@ -196,6 +196,33 @@ valid_curve(const unsigned char *raw, size_t raw_len)
 	es384_pk_free(&pkB);
 }
 
+static void
+compressed(void)
+{
+	es384_pk_t *pkA;
+	es384_pk_t *pkB;
+	unsigned char c[48 + 1];
+
+	ASSERT_NOT_NULL((pkA = es384_pk_new()));
+	ASSERT_NOT_NULL((pkB = es384_pk_new()));
+	ASSERT_OK(es384_pk_from_ptr(pkA, secp384r1_raw, sizeof(secp384r1_raw)));
+	ASSERT_INVAL(es384_pk_to_compressed(pkA, c, sizeof(c) - 1));
+	ASSERT_OK(es384_pk_to_compressed(pkA, c, sizeof(c)));
+	assert(c[0] == 0x02 || c[0] == 0x03);
+	assert(memcmp(c + 1, secp384r1_raw + 1, sizeof(c) - 1) == 0);
+	ASSERT_OK(es384_pk_from_ptr(pkB, c, sizeof(c)));
+	assert(memcmp(pkA, pkB, sizeof(*pkA)) == 0);
+	valid_curve(c, sizeof(c));
+	c[0] ^= 0x01; /* other y */
+	ASSERT_OK(es384_pk_from_ptr(pkB, c, sizeof(c)));
+	assert(memcmp(pkA, pkB, sizeof(*pkA)) != 0);
+	c[0] = 0x05;
+	ASSERT_INVAL(es384_pk_from_ptr(pkB, c, sizeof(c)));
+
+	es384_pk_free(&pkA);
+	es384_pk_free(&pkB);
+}
+
 int
 main(void)
 {
@@ -208,6 +235,7 @@ main(void)
 	invalid_curve(brainpoolP384r1_raw + 1, sizeof(brainpoolP384r1_raw) - 1); /* libfido2 */
 	valid_curve(secp384r1_raw, sizeof(secp384r1_raw)); /* uncompressed */
 	valid_curve(secp384r1_raw + 1, sizeof(secp384r1_raw) - 1); /* libfido2 */
+	compressed();
 
 	exit(0);
 }
@@ -0,0 +1,2338 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <openssl/bn.h>
+#include <openssl/crypto.h>
+#include <openssl/ec.h>
+#include <openssl/ecdh.h>
+#include <openssl/ecdsa.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/obj_mac.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+#include <cbor.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "vauth.h"
+
+#define VAUTH_MAGIC		0x76617574
+#define VAUTH_MAXMSG		2048
+#define VAUTH_MAXRK		64
+#define VAUTH_MAXALLOW		16
+#define VAUTH_MAXLARGEBLOB	4096
+#define VAUTH_CREDID_LEN	32
+#define VAUTH_USERID_LEN	64
+#define VAUTH_PIN_RETRIES	8
+#define VAUTH_MIN_PINLEN	4
+
+#define FLAG_UP			0x01
+#define FLAG_UV			0x04
+#define FLAG_AT			0x40
+#define FLAG_ED			0x80
+
+#define PERM_MAKECRED		0x01
+#define PERM_ASSERT		0x02
+#define PERM_CRED_MGMT		0x04
+#define PERM_LARGEBLOB		0x10
+
+#define CTAP_CBOR_CRED_MGMT	0x0a
+
+/* not in fido/err.h */
+#define ERR_INTEGRITY_FAILURE	0x3d
+#define ERR_INVALID_SUBCOMMAND	0x3e
+
+#define ITER_NONE		0
+#define ITER_ASSERT		1
+#define ITER_RP			2
+#define ITER_RK			3
+
+/* credential ids: nonce (flags in the first byte), then a tag */
+#define CREDID_RK		0x01
+#define CREDID_PROT(id)		(((id)[0] >> 1) & 0x03)
+
+
+struct vauth_rk {
+	unsigned char	 id[VAUTH_CREDID_LEN];
+	unsigned char	 rp_hash[SHA256_DIGEST_LENGTH];
+	char		*rp_id;
+	char		*rp_name;
+	unsigned char	 user_id[VAUTH_USERID_LEN];
+	size_t		 user_id_len;
+	char		*user_name;
+	char		*user_display;
+};
+
+struct vauth_token {
+	unsigned char	 key[32];
+	uint8_t		 prot;   /* pin protocol it was issued under */
+	uint8_t		 perm;   /* PERM_* */
+	char		*rp_id;  /* rp it is bound to, if any */
+	int		 valid;
+};
+
+struct vauth {
+	uint32_t		 magic;
+	char			 path[32];
+	int			 open;
+	unsigned char		 master[32]; /* derives credentials */
+	uint64_t		 nonce_ctr;  /* credentials made */
+	uint32_t		 counter;    /* signature counter */
+	int			 latency_ms;
+	size_t			 ncmd;
+	/* u2f sign requests polled before one is served */
+	int			 u2f_touch;
+	int			 u2f_polls;
+	/* assertions carry user ids as text strings */
+	int			 bad_user;
+	uint64_t		 init_nonce;
+	/* clientPIN */
+	EC_KEY			*ka;
+	int			 pin_set;
+	unsigned char		 pin_hash[16];
+	int			 pin_retries;
+	struct vauth_token	 token;
+	/* discoverable credentials, oldest first */
+	struct vauth_rk		 rk[VAUTH_MAXRK];
+	size_t			 nrk;
+	/* getNextAssertion and credential management enumeration */
+	int			 iter;
+	int			 iter_prev;
+	unsigned char		 iter_id[VAUTH_MAXRK][VAUTH_CREDID_LEN];
+	size_t			 iter_len;
+	size_t			 iter_pos;
+	unsigned char		 iter_rp_hash[SHA256_DIGEST_LENGTH];
+	unsigned char		 iter_cdh[SHA256_DIGEST_LENGTH];
+	uint8_t			 iter_flags;
+	int			 iter_lbk;
+	/* hmac-secret: shared secret and decrypted salts */
+	int			 iter_hmac;
+	uint64_t		 iter_hmac_prot;
+	unsigned char		 iter_hmac_key[64];
+	unsigned char		 iter_hmac_salt[64];
+	size_t			 iter_hmac_salt_len;
+	/* large-blob array, and the one being written */
+	unsigned char		 lb[VAUTH_MAXLARGEBLOB];
+	size_t			 lb_len;
+	unsigned char		 lb_new[VAUTH_MAXLARGEBLOB];
+	size_t			 lb_new_len;
+	size_t			 lb_new_want;
+	/* reply to the last request: status, then cbor */
+	unsigned char		 reply[VAUTH_MAXMSG];
+	size_t			 reply_len;
+};
+
+struct vbuf {
+	unsigned char	ptr[512];
+	size_t		len;
+};
+
+static const unsigned char vauth_aaguid[16] = {
+	0x76, 0x61, 0x75, 0x74, 0x68, 0x2d, 0x6c, 0x69,
+	0x62, 0x66, 0x69, 0x64, 0x6f, 0x32, 0x00, 0x01,
+};
+
+#if defined(_MSC_VER)
+static int
+nanosleep(const struct timespec *rqtp, struct timespec *rmtp)
+{
+	if (rmtp != NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	Sleep((DWORD)(rqtp->tv_sec * 1000) + (DWORD)(rqtp->tv_nsec / 1000000));
+
+	return (0);
+}
+#endif
+
+static int
+vbuf_add(struct vbuf *b, const void *ptr, size_t len)
+{
+	if (len > sizeof(b->ptr) - b->len)
+		return (-1);
+	if (len > 0)
+		memcpy(b->ptr + b->len, ptr, len);
+	b->len += len;
+
+	return (0);
+}
+
+/*
+ * cbor helpers
+ */
+
+static const cbor_item_t *
+map_get(const cbor_item_t *map, int64_t key)
+{
+	const struct cbor_pair	*p;
+	const cbor_item_t	*k;
+
+	if (map == NULL || cbor_isa_map(map) == false)
+		return (NULL);
+	p = cbor_map_handle(map);
+	for (size_t i = 0; i < cbor_map_size(map); i++) {
+		k = p[i].key;
+		if (key >= 0 && cbor_isa_uint(k) &&
+		    cbor_get_int(k) == (uint64_t)key)
+			return (p[i].value);
+		if (key < 0 && cbor_isa_negint(k) &&
+		    cbor_get_int(k) == (uint64_t)(-1 - key))
+			return (p[i].value);
+	}
+
+	return (NULL);
+}
+
+static const cbor_item_t *
+map_get_str(const cbor_item_t *map, const char *key)
+{
+	const struct cbor_pair	*p;
+	const cbor_item_t	*k;
+	size_t			 len = strlen(key);
+
+	if (map == NULL || cbor_isa_map(map) == false)
+		return (NULL);
+	p = cbor_map_handle(map);
+	for (size_t i = 0; i < cbor_map_size(map); i++) {
+		k = p[i].key;
+		if (cbor_isa_string(k) && cbor_string_is_definite(k) &&
+		    cbor_string_length(k) == len &&
+		    memcmp(cbor_string_handle(k), key, len) == 0)
+			return (p[i].value);
+	}
+
+	return (NULL);
+}
+
+static int
+get_uint(const cbor_item_t *item, uint64_t *v)
+{
+	if (item == NULL || cbor_isa_uint(item) == false)
+		return (-1);
+	*v = cbor_get_int(item);
+
+	return (0);
+}
+
+static int
+get_bool(const cbor_item_t *item, int *v)
+{
+	if (item == NULL || cbor_is_bool(item) == false)
+		return (-1);
+	*v = cbor_get_bool(item);
+
+	return (0);
+}
+
+/* a definite byte string of at most *len bytes */
+static int
+get_bytes(const cbor_item_t *item, unsigned char *ptr, size_t *len)
+{
+	size_t n;
+
+	if (item == NULL || cbor_isa_bytestring(item) == false ||
+	    cbor_bytestring_is_definite(item) == false ||
+	    (n = cbor_bytestring_length(item)) > *len)
+		return (-1);
+	if (n > 0)
+		memcpy(ptr, cbor_bytestring_handle(item), n);
+	*len = n;
+
+	return (0);
+}
+
+static int
+get_fixed(const cbor_item_t *item, unsigned char *ptr, size_t len)
+{
+	size_t n = len;
+
+	if (get_bytes(item, ptr, &n) < 0 || n != len)
+		return (-1);
+
+	return (0);
+}
+
+/* a copy of a definite text string; *s is left alone if absent */
+static int
+get_string(const cbor_item_t *item, char **s)
+{
+	size_t len;
+
+	if (item == NULL)
+		return (0);
+	if (cbor_isa_string(item) == false ||
+	    cbor_string_is_definite(item) == false ||
+	    (len = cbor_string_length(item)) == SIZE_MAX ||
+	    (*s = calloc(1, len + 1)) == NULL)
+		return (-1);
+	if (len > 0)
+		memcpy(*s, cbor_string_handle(item), len);
+
+	return (0);
+}
+
+static cbor_item_t *
+build_uint(uint64_t v)
+{
+	if (v <= UINT8_MAX)
+		return (cbor_build_uint8((uint8_t)v));
+	if (v <= UINT16_MAX)
+		return (cbor_build_uint16((uint16_t)v));
+	if (v <= UINT32_MAX)
+		return (cbor_build_uint32((uint32_t)v));
+
+	return (cbor_build_uint64(v));
+}
+
+/* a negative integer between -256 and -1 */
+static cbor_item_t *
+build_negint(int v)
+{
+	return (cbor_build_negint8((uint8_t)(-1 - v)));
+}
+
+/* add key and val to map, consuming both */
+static int
+put(cbor_item_t *map, cbor_item_t *key, cbor_item_t *val)
+{
+	struct cbor_pair	p;
+	int			ok = -1;
+
+	if (key != NULL && val != NULL) {
+		p.key = key;
+		p.value = val;
+		if (cbor_map_add(map, p))
+			ok = 0;
+	}
+	if (key != NULL)
+		cbor_decref(&key);
+	if (val != NULL)
+		cbor_decref(&val);
+
+	return (ok);
+}
+
+static int
+put_uint(cbor_item_t *map, uint64_t key, cbor_item_t *val)
+{
+	return (put(map, build_uint(key), val));
+}
+
+static int
+put_str(cbor_item_t *map, const char *key, cbor_item_t *val)
+{
+	return (put(map, cbor_build_string(key), val));
+}
+
+/* push item onto array, consuming it */
+static int
+push(cbor_item_t *array, cbor_item_t *item)
+{
+	int ok = -1;
+
+	if (item != NULL) {
+		if (cbor_array_push(array, item))
+			ok = 0;
+		cbor_decref(&item);
+	}
+
+	return (ok);
+}
+
+static cbor_item_t *
+build_descriptor(const unsigned char *id, size_t len)
+{
+	cbor_item_t *map;
+
+	if ((map = cbor_new_definite_map(2)) == NULL)
+		return (NULL);
+	if (put_str(map, "id", cbor_build_bytestring(id, len)) < 0 ||
+	    put_str(map, "type", cbor_build_string("public-key")) < 0)
+		cbor_decref(&map);
+
+	return (map);
+}
+
+/*
+ * crypto helpers
+ */
+
+/* HMAC-SHA256 of label || a || b, keyed with the instance's secret */
+static int
+derive(const vauth_t *v, const char *label, const unsigned char *a,
+    size_t alen, const unsigned char *b, size_t blen, unsigned char out[32])
+{
+	unsigned char	buf[16 + 32 + 32];
+	unsigned int	len = 32;
+	size_t		n = strlen(label);
+
+	if (n > 16 || alen > 32 || blen > 32)
+		return (-1);
+	memcpy(buf, label, n);
+	if (alen > 0)
+		memcpy(buf + n, a, alen);
+	if (blen > 0)
+		memcpy(buf + n + alen, b, blen);
+	if (HMAC(EVP_sha256(), v->master, sizeof(v->master), buf,
+	    n + alen + blen, out, &len) == NULL || len != 32)
+		return (-1);
+
+	return (0);
+}
+
+static EC_KEY *
+ec_new(const unsigned char *d, size_t dlen)
+{
+	EC_KEY		*ec = NULL;
+	EC_POINT	*q = NULL;
+	BIGNUM		*bn = NULL;
+	BN_CTX		*ctx = NULL;
+	const EC_GROUP	*g;
+	int		 ok = -1;
+
+	if ((ec = EC_KEY_new_by_curve_name(NID_X9_62_prime256v1)) == NULL ||
+	    (g = EC_KEY_get0_group(ec)) == NULL)
+		goto fail;
+	if (d == NULL) {
+		if (EC_KEY_generate_key(ec) == 0)
+			goto fail;
+	} else {
+		if ((ctx = BN_CTX_new()) == NULL ||
+		    (bn = BN_bin2bn(d, (int)dlen, NULL)) == NULL ||
+		    BN_nnmod(bn, bn, EC_GROUP_get0_order(g), ctx) == 0 ||
+		    BN_is_zero(bn) || EC_KEY_set_private_key(ec, bn) == 0 ||
+		    (q = EC_POINT_new(g)) == NULL ||
+		    EC_POINT_mul(g, q, bn, NULL, NULL, ctx) == 0 ||
+		    EC_KEY_set_public_key(ec, q) == 0)
+			goto fail;
+	}
+
+	ok = 0;
+fail:
+	BN_clear_free(bn);
+	BN_CTX_free(ctx);
+	EC_POINT_free(q);
+	if (ok < 0) {
+		EC_KEY_free(ec);
+		ec = NULL;
+	}
+
+	return (ec);
+}
+
+static cbor_item_t *
+cose_encode(const EC_KEY *ec, int alg)
+{
+	unsigned char	 q[65];
+	cbor_item_t	*map;
+
+	if (EC_POINT_point2oct(EC_KEY_get0_group(ec), EC_KEY_get0_public_key(ec),
+	    POINT_CONVERSION_UNCOMPRESSED, q, sizeof(q), NULL) != sizeof(q) ||
+	    (map = cbor_new_definite_map(5)) == NULL)
+		return (NULL);
+	if (put_uint(map, 1, cbor_build_uint8(2)) < 0 ||
+	    put_uint(map, 3, build_negint(alg)) < 0 ||
+	    put(map, build_negint(-1), cbor_build_uint8(1)) < 0 ||
+	    put(map, build_negint(-2), cbor_build_bytestring(&q[1], 32)) < 0 ||
+	    put(map, build_negint(-3), cbor_build_bytestring(&q[33], 32)) < 0)
+		cbor_decref(&map);
+
+	return (map);
+}
+
+static int
+hkdf_sha256(const unsigned char *z, size_t zlen, const char *info,
+    unsigned char out[32])
+{
+	unsigned char	salt[32];
+	unsigned char	prk[32];
+	unsigned char	buf[32];
+	unsigned int	len = 32;
+	size_t		n = strlen(info);
+
+	memset(salt, 0, sizeof(salt));
+	if (n >= sizeof(buf))
+		return (-1);
+	memcpy(buf, info, n);
+	buf[n] = 0x01;
+	if (HMAC(EVP_sha256(), salt, sizeof(salt), z, zlen, prk,
+	    &len) == NULL || len != 32 ||
+	    HMAC(EVP_sha256(), prk, sizeof(prk), buf, n + 1, out,
+	    &len) == NULL || len != 32)
+		return (-1);
+
+	return (0);
+}
+
+/*
+ * Agree on a shared secret with the platform key in cose: 32 bytes for
+ * pin protocol one, a 32-byte hmac key and a 32-byte aes key for two.
+ */
+static int
+shared_secret(const vauth_t *v, uint64_t prot, const cbor_item_t *cose,
+    unsigned char key[64])
+{
+	unsigned char	 q[65];
+	unsigned char	 z[32];
+	const EC_GROUP	*g = EC_KEY_get0_group(v->ka);
+	EC_POINT	*pk = NULL;
+	int		 ok = -1;
+
+	q[0] = POINT_CONVERSION_UNCOMPRESSED;
+	if (get_fixed(map_get(cose, -2), &q[1], 32) < 0 ||
+	    get_fixed(map_get(cose, -3), &q[33], 32) < 0 ||
+	    (pk = EC_POINT_new(g)) == NULL ||
+	    EC_POINT_oct2point(g, pk, q, sizeof(q), NULL) == 0 ||
+	    ECDH_compute_key(z, sizeof(z), pk, v->ka, NULL) != sizeof(z))
+		goto fail;
+
+	if (prot == CTAP_PIN_PROTOCOL1) {
+		if (SHA256(z, sizeof(z), key) != key)
+			goto fail;
+	} else if (hkdf_sha256(z, sizeof(z), "CTAP2 HMAC key", key) < 0 ||
+	    hkdf_sha256(z, sizeof(z), "CTAP2 AES key", key + 32) < 0)
+		goto fail;
+
+	ok = 0;
+fail:
+	EC_POINT_free(pk);
+	OPENSSL_cleanse(z, sizeof(z));
+
+	return (ok);
+}
+
+static int
+aes256_cbc(int enc, const unsigned char *key, const unsigned char *iv,
+    const unsigned char *in, size_t len, unsigned char *out)
+{
+	EVP_CIPHER_CTX	*ctx;
+	int		 ok = -1;
+
+	if (len == 0 || len % 16 != 0 || len > 1024 ||
+	    (ctx = EVP_CIPHER_CTX_new()) == NULL)
+		return (-1);
+	if (EVP_CipherInit_ex(ctx, EVP_aes_256_cbc(), NULL, key, iv,
+	    enc) == 0 || EVP_CIPHER_CTX_set_padding(ctx, 0) == 0 ||
+	    EVP_Cipher(ctx, out, in, (unsigned int)len) < 0)
+		goto fail;
+
+	ok = 0;
+fail:
+	EVP_CIPHER_CTX_free(ctx);
+
+	return (ok);
+}
+
+/* encrypt len bytes of in; out has room for len + 16 bytes */
+static int
+pin_encrypt(uint64_t prot, const unsigned char *key, const unsigned char *in,
+    size_t len, unsigned char *out, size_t *outlen)
+{
+	unsigned char iv[16];
+
+	if (prot == CTAP_PIN_PROTOCOL1) {
+		memset(iv, 0, sizeof(iv));
+		*outlen = len;
+		return (aes256_cbc(1, key, iv, in, len, out));
+	}
+	if (RAND_bytes(iv, sizeof(iv)) != 1)
+		return (-1);
+	memcpy(out, iv, sizeof(iv));
+	*outlen = sizeof(iv) + len;
+
+	return (aes256_cbc(1, key + 32, iv, in, len, out + sizeof(iv)));
+}
+
+static int
+pin_decrypt(uint64_t prot, const unsigned char *key, const unsigned char *in,
+    size_t len, unsigned char *out, size_t *outlen)
+{
+	unsigned char iv[16];
+
+	if (prot == CTAP_PIN_PROTOCOL1) {
+		memset(iv, 0, sizeof(iv));
+		*outlen = len;
+		return (aes256_cbc(0, key, iv, in, len, out));
+	}
+	if (len <= sizeof(iv))
+		return (-1);
+	*outlen = len - sizeof(iv);
+
+	return (aes256_cbc(0, key + 32, in, in + sizeof(iv), *outlen, out));
+}
+
+/* compare param with the pin protocol's mac of msg under key */
+static int
+pin_verify(uint64_t prot, const unsigned char *key, const unsigned char *msg,
+    size_t len, const cbor_item_t *param)
+{
+	unsigned char	mac[32];
+	unsigned int	maclen = 32;
+	size_t		n = prot == CTAP_PIN_PROTOCOL1 ? 16 : 32;
+
+	if (param == NULL || cbor_isa_bytestring(param) == false ||
+	    cbor_bytestring_is_definite(param) == false ||
+	    cbor_bytestring_length(param) != n)
+		return (-1);
+	if (HMAC(EVP_sha256(), key, 32, msg, len, mac, &maclen) == NULL ||
+	    maclen != 32)
+		return (-1);
+
+	return (CRYPTO_memcmp(mac, cbor_bytestring_handle(param), n) == 0 ?
+	    0 : -1);
+}
+
+static int
+get_protocol(const cbor_item_t *item, uint64_t *prot)
+{
+	if (get_uint(item, prot) < 0)
+		return (FIDO_ERR_MISSING_PARAMETER);
+	if (*prot != CTAP_PIN_PROTOCOL1 && *prot != CTAP_PIN_PROTOCOL2)
+		return (FIDO_ERR_INVALID_PARAMETER);
+
+	return (FIDO_OK);
+}
+
+/* check a pinUvAuthParam over msg, and the token's permissions */
+static int
+token_check(vauth_t *v, const cbor_item_t *prot_item,
+    const cbor_item_t *param, const unsigned char *msg, size_t len,
+    uint8_t perm, const char *rp_id)
+{
+	uint64_t	prot;
+	int		r;
+
+	if ((r = get_protocol(prot_item, &prot)) != FIDO_OK)
+		return (r);
+	if (v->token.valid == 0 || v->token.prot != prot ||
+	    pin_verify(prot, v->token.key, msg, len, param) < 0)
+		return (FIDO_ERR_PIN_AUTH_INVALID);
+	if ((v->token.perm & perm) == 0)
+		return (FIDO_ERR_UNAUTHORIZED_PERM);
+	if (rp_id != NULL && v->token.rp_id != NULL &&
+	    strcmp(rp_id, v->token.rp_id) != 0)
+		return (FIDO_ERR_UNAUTHORIZED_PERM);
+	/* the first use binds a token to an rp */
+	if (rp_id != NULL && v->token.rp_id == NULL &&
+	    (v->token.rp_id = strdup(rp_id)) == NULL)
+		return (FIDO_ERR_ERR_OTHER);
+
+	return (FIDO_OK);
+}
+
+static void
+token_reset(vauth_t *v)
+{
+	free(v->token.rp_id);
+	OPENSSL_cleanse(&v->token, sizeof(v->token));
+}
+
+static int
+ka_reset(vauth_t *v)
+{
+	EC_KEY_free(v->ka);
+
+	return ((v->ka = ec_new(NULL, 0)) == NULL ? -1 : 0);
+}
+
+/*
+ * credentials
+ */
+
+static int
+cred_tag(const vauth_t *v, const unsigned char *rp_hash,
+    const unsigned char *nonce, unsigned char tag[32])
+{
+	return (derive(v, "id", rp_hash, 32, nonce, 16, tag));
+}
+
+static int
+cred_new(vauth_t *v, const unsigned char *rp_hash, int rk, uint8_t prot,
+    unsigned char id[VAUTH_CREDID_LEN])
+{
+	unsigned char	ctr[8];
+	unsigned char	buf[32];
+
+	for (size_t i = 0; i < sizeof(ctr); i++)
+		ctr[i] = (uint8_t)(v->nonce_ctr >> (56 - 8 * i));
+	v->nonce_ctr++;
+	if (derive(v, "nonce", ctr, sizeof(ctr), NULL, 0, buf) < 0)
+		return (-1);
+	buf[0] = (uint8_t)((buf[0] & 0xf8) | (rk ? CREDID_RK : 0) |
+	    (prot << 1));
+	memcpy(id, buf, 16);
+	if (cred_tag(v, rp_hash, id, buf) < 0)
+		return (-1);
+	memcpy(id + 16, buf, 16);
+
+	return (0);
+}
+
+static struct vauth_rk *
+rk_find(vauth_t *v, const unsigned char *id, size_t len)
+{
+	if (len != VAUTH_CREDID_LEN)
+		return (NULL);
+	for (size_t i = 0; i < v->nrk; i++)
+		if (memcmp(v->rk[i].id, id, len) == 0)
+			return (&v->rk[i]);
+
+	return (NULL);
+}
+
+/* whether id is a live credential of ours for rp_hash */
+static int
+cred_valid(vauth_t *v, const unsigned char *rp_hash, const unsigned char *id,
+    size_t len)
+{
+	unsigned char tag[32];
+
+	if (len != VAUTH_CREDID_LEN || cred_tag(v, rp_hash, id, tag) < 0 ||
+	    CRYPTO_memcmp(tag, id + 16, 16) != 0)
+		return (0);
+	/* deleted discoverable credentials stay deleted */
+	if ((id[0] & CREDID_RK) && rk_find(v, id, len) == NULL)
+		return (0);
+
+	return (1);
+}
+
+static EC_KEY *
+cred_key(const vauth_t *v, const unsigned char *id)
+{
+	unsigned char	 d[32];
+	EC_KEY		*ec;
+
+	if (derive(v, "key", id, 16, NULL, 0, d) < 0)
+		return (NULL);
+	ec = ec_new(d, sizeof(d));
+	OPENSSL_cleanse(d, sizeof(d));
+
+	return (ec);
+}
+
+static cbor_item_t *
+cred_largeblob_key(const vauth_t *v, const unsigned char *id)
+{
+	unsigned char	 key[32];
+	cbor_item_t	*item;
+
+	if (derive(v, "lbk", id, VAUTH_CREDID_LEN, NULL, 0, key) < 0)
+		return (NULL);
+	item = cbor_build_bytestring(key, sizeof(key));
+	OPENSSL_cleanse(key, sizeof(key));
+
+	return (item);
+}
+
+static void
+rk_reset(struct vauth_rk *rk)
+{
+	free(rk->rp_id);
+	free(rk->rp_name);
+	free(rk->user_name);
+	free(rk->user_display);
+	memset(rk, 0, sizeof(*rk));
+}
+
+static void
+rk_remove(vauth_t *v, struct vauth_rk *rk)
+{
+	size_t i = (size_t)(rk - v->rk);
+
+	rk_reset(rk);
+	memmove(&v->rk[i], &v->rk[i + 1], (v->nrk - i - 1) * sizeof(*rk));
+	memset(&v->rk[--v->nrk], 0, sizeof(*rk));
+}
+
+static cbor_item_t *
+rk_user(const struct vauth_rk *rk, int full, int bad)
+{
+	cbor_item_t *map, *id;
+
+	if ((map = cbor_new_definite_map(3)) == NULL)
+		return (NULL);
+	id = bad ? cbor_build_stringn((const char *)rk->user_id,
+	    rk->user_id_len) : cbor_build_bytestring(rk->user_id,
+	    rk->user_id_len);
+	if (put_str(map, "id", id) < 0 ||
+	    (full && rk->user_name != NULL && put_str(map, "name",
+	    cbor_build_string(rk->user_name)) < 0) ||
+	    (full && rk->user_display != NULL && put_str(map, "displayName",
+	    cbor_build_string(rk->user_display)) < 0))
+		cbor_decref(&map);
+
+	return (map);
+}
+
+static int
+authdata(vauth_t *v, const unsigned char *rp_hash, uint8_t flags,
+    struct vbuf *ad)
+{
+	unsigned char counter[4];
+
+	v->counter++;
+	counter[0] = (uint8_t)(v->counter >> 24);
+	counter[1] = (uint8_t)(v->counter >> 16);
+	counter[2] = (uint8_t)(v->counter >> 8);
+	counter[3] = (uint8_t)v->counter;
+
+	ad->len = 0;
+	if (vbuf_add(ad, rp_hash, 32) < 0 || vbuf_add(ad, &flags, 1) < 0 ||
+	    vbuf_add(ad, counter, sizeof(counter)) < 0)
+		return (-1);
+
+	return (0);
+}
+
+/* ES256 signature over authdata || cdh */
+static cbor_item_t *
+sign(EC_KEY *ec, const struct vbuf *ad, const unsigned char *cdh)
+{
+	unsigned char	dgst[SHA256_DIGEST_LENGTH];
+	unsigned char	sig[80];
+	unsigned int	siglen = sizeof(sig);
+	SHA256_CTX	ctx;
+
+	if (ECDSA_size(ec) > (int)sizeof(sig) || SHA256_Init(&ctx) == 0 ||
+	    SHA256_Update(&ctx, ad->ptr, ad->len) == 0 ||
+	    SHA256_Update(&ctx, cdh, SHA256_DIGEST_LENGTH) == 0 ||
+	    SHA256_Final(dgst, &ctx) == 0 ||
+	    ECDSA_sign(0, dgst, sizeof(dgst), sig, &siglen, ec) == 0)
+		return (NULL);
+
+	return (cbor_build_bytestring(sig, siglen));
+}
+
+static int
+options(const cbor_item_t *map, int *rk, int *up, int *uv)
+{
+	if (map == NULL)
+		return (FIDO_OK);
+	if (cbor_isa_map(map) == false)
+		return (FIDO_ERR_CBOR_UNEXPECTED_TYPE);
+	if ((map_get_str(map, "rk") != NULL &&
+	    (rk == NULL || get_bool(map_get_str(map, "rk"), rk) < 0)) ||
+	    (map_get_str(map, "up") != NULL &&
+	    get_bool(map_get_str(map, "up"), up) < 0) ||
+	    (map_get_str(map, "uv") != NULL &&
+	    get_bool(map_get_str(map, "uv"), uv) < 0))
+		return (FIDO_ERR_UNSUPPORTED_OPTION);
+	/* no built-in user verification */
+	if (*uv)
+		return (FIDO_ERR_INVALID_OPTION);
+
+	return (FIDO_OK);
+}
+
+/*
+ * authenticatorGetInfo
+ */
+
+static cbor_item_t *
+info_strings(const char * const *s, size_t n)
+{
+	cbor_item_t *array;
+
+	if ((array = cbor_new_definite_array(n)) == NULL)
+		return (NULL);
+	for (size_t i = 0; i < n; i++)
+		if (push(array, cbor_build_string(s[i])) < 0) {
+			cbor_decref(&array);
+			return (NULL);
+		}
+
+	return (array);
+}
+
+static cbor_item_t *
+info_options(const vauth_t *v)
+{
+	cbor_item_t *map;
+
+	if ((map = cbor_new_definite_map(6)) == NULL)
+		return (NULL);
+	/* canonical order: shorter keys first */
+	if (put_str(map, "rk", cbor_build_bool(true)) < 0 ||
+	    put_str(map, "up", cbor_build_bool(true)) < 0 ||
+	    put_str(map, "credMgmt", cbor_build_bool(true)) < 0 ||
+	    put_str(map, "clientPin", cbor_build_bool(v->pin_set)) < 0 ||
+	    put_str(map, "largeBlobs", cbor_build_bool(true)) < 0 ||
+	    put_str(map, "pinUvAuthToken", cbor_build_bool(true)) < 0)
+		cbor_decref(&map);
+
+	return (map);
+}
+
+static cbor_item_t *
+info_algorithms(void)
+{
+	cbor_item_t *array, *map;
+
+	if ((array = cbor_new_definite_array(1)) == NULL)
+		return (NULL);
+	if ((map = cbor_new_definite_map(2)) == NULL ||
+	    put_str(map, "alg", build_negint(COSE_ES256)) < 0 ||
+	    put_str(map, "type", cbor_build_string("public-key")) < 0 ||
+	    push(array, map) < 0) {
+		cbor_decref(&array);
+		return (NULL);
+	}
+
+	return (array);
+}
+
+static int
+vauth_getinfo(vauth_t *v, cbor_item_t **rsp)
+{
+	const char * const	 versions[] = { "FIDO_2_0", "FIDO_2_1" };
+	const char * const	 extensions[] = { "credProtect", "hmac-secret",
+	    "largeBlobKey" };
+	cbor_item_t		*protocols;
+
+	if ((*rsp = cbor_new_definite_map(13)) == NULL ||
+	    (protocols = cbor_new_definite_array(2)) == NULL)
+		return (FIDO_ERR_ERR_OTHER);
+	if (push(protocols, cbor_build_uint8(CTAP_PIN_PROTOCOL2)) < 0 ||
+	    push(protocols, cbor_build_uint8(CTAP_PIN_PROTOCOL1)) < 0) {
+		cbor_decref(&protocols);
+		return (FIDO_ERR_ERR_OTHER);
+	}
+	if (put_uint(*rsp, 1, info_strings(versions, 2)) < 0 ||
+	    put_uint(*rsp, 2, info_strings(extensions, 3)) < 0 ||
+	    put_uint(*rsp, 3, cbor_build_bytestring(vauth_aaguid,
+	    sizeof(vauth_aaguid))) < 0 ||
+	    put_uint(*rsp, 4, info_options(v)) < 0 ||
+	    put_uint(*rsp, 5, build_uint(VAUTH_MAXMSG)) < 0 ||
+	    put_uint(*rsp, 6, protocols) < 0 ||
+	    put_uint(*rsp, 7, build_uint(VAUTH_MAXALLOW)) < 0 ||
+	    put_uint(*rsp, 8, build_uint(VAUTH_CREDID_LEN)) < 0 ||
+	    put_uint(*rsp, 10, info_algorithms()) < 0 ||
+	    put_uint(*rsp, 11, build_uint(VAUTH_MAXLARGEBLOB)) < 0 ||
+	    put_uint(*rsp, 13, build_uint(VAUTH_MIN_PINLEN)) < 0 ||
+	    put_uint(*rsp, 20, build_uint(VAUTH_MAXRK - v->nrk)) < 0)
+		return (FIDO_ERR_ERR_OTHER);
+
+	return (FIDO_OK);
+}
+
+/*
+ * authenticatorMakeCredential
+ */
+
+static int
+makecred_alg(const cbor_item_t *params)
+{
+	const cbor_item_t	*alg;
+	cbor_item_t		**v;
+
+	if (params == NULL)
+		return (FIDO_ERR_MISSING_PARAMETER);
+	if (cbor_isa_array(params) == false)
+		return (FIDO_ERR_CBOR_UNEXPECTED_TYPE);
+	v = cbor_array_handle(params);
+	for (size_t i = 0; i < cbor_array_size(params); i++)
+		if ((alg = map_get_str(v[i], "alg")) != NULL &&
+		    cbor_isa_negint(alg) &&
+		    cbor_get_int(alg) == (uint64_t)(-1 - COSE_ES256))
+			return (FIDO_OK);
+
+	return (FIDO_ERR_UNSUPPORTED_ALGORITHM);
+}
+
+static int
+makecred_excluded(vauth_t *v, const unsigned char *rp_hash,
+    const cbor_item_t *list)
+{
+	unsigned char	  id[VAUTH_CREDID_LEN];
+	size_t		  len;
+	cbor_item_t	**p;
+
+	if (list == NULL)
+		return (0);
+	if (cbor_isa_array(list) == false)
+		return (-1);
+	p = cbor_array_handle(list);
+	for (size_t i = 0; i < cbor_array_size(list); i++) {
+		len = sizeof(id);
+		if (get_bytes(map_get_str(p[i], "id"), id, &len) == 0 &&
+		    cred_valid(v, rp_hash, id, len))
+			return (1);
+	}
+
+	return (0);
+}
+
+static int
+rk_store(vauth_t *v, const unsigned char *id, const unsigned char *rp_hash,
+    const cbor_item_t *rp, const cbor_item_t *user)
+{
+	struct vauth_rk	n, *rk = NULL;
+
+	memset(&n, 0, sizeof(n));
+	memcpy(n.id, id, sizeof(n.id));
+	memcpy(n.rp_hash, rp_hash, sizeof(n.rp_hash));
+	n.user_id_len = sizeof(n.user_id);
+	if (get_string(map_get_str(rp, "id"), &n.rp_id) < 0 ||
+	    get_string(map_get_str(rp, "name"), &n.rp_name) < 0 ||
+	    get_bytes(map_get_str(user, "id"), n.user_id,
+	    &n.user_id_len) < 0 ||
+	    get_string(map_get_str(user, "name"), &n.user_name) < 0 ||
+	    get_string(map_get_str(user, "displayName"),
+	    &n.user_display) < 0) {
+		rk_reset(&n);
+		return (FIDO_ERR_INVALID_PARAMETER);
+	}
+
+	/* a new credential of the same user replaces the old one */
+	for (size_t i = 0; i < v->nrk; i++)
+		if (memcmp(v->rk[i].rp_hash, rp_hash, 32) == 0 &&
+		    v->rk[i].user_id_len == n.user_id_len &&
+		    memcmp(v->rk[i].user_id, n.user_id, n.user_id_len) == 0) {
+			rk = &v->rk[i];
+			break;
+		}
+	if (rk != NULL)
+		rk_remove(v, rk);
+	if (v->nrk == VAUTH_MAXRK) {
+		rk_reset(&n);
+		return (FIDO_ERR_KEY_STORE_FULL);
+	}
+	v->rk[v->nrk++] = n;
+
+	return (FIDO_OK);
+}
+
+static int
+makecred_authdata(vauth_t *v, const unsigned char *rp_hash, uint8_t flags,
+    const unsigned char *id, const EC_KEY *ec, uint8_t prot, struct vbuf *ad)
+{
+	cbor_item_t	*pk = NULL, *ext = NULL;
+	unsigned char	*pk_ptr = NULL, *ext_ptr = NULL;
+	size_t		 pk_len = 0, ext_len = 0, alloc;
+	const uint8_t	 id_len[2] = { 0, VAUTH_CREDID_LEN };
+	int		 ok = -1;
+
+	if ((pk = cose_encode(ec, COSE_ES256)) == NULL ||
+	    (pk_len = cbor_serialize_alloc(pk, &pk_ptr, &alloc)) == 0)
+		goto fail;
+	if (prot) {
+		if ((ext = cbor_new_definite_map(1)) == NULL ||
+		    put_str(ext, "credProtect", cbor_build_uint8(prot)) < 0 ||
+		    (ext_len = cbor_serialize_alloc(ext, &ext_ptr,
+		    &alloc)) == 0)
+			goto fail;
+		flags |= FLAG_ED;
+	}
+	if (authdata(v, rp_hash, flags | FLAG_AT, ad) < 0 ||
+	    vbuf_add(ad, vauth_aaguid, sizeof(vauth_aaguid)) < 0 ||
+	    vbuf_add(ad, id_len, sizeof(id_len)) < 0 ||
+	    vbuf_add(ad, id, VAUTH_CREDID_LEN) < 0 ||
+	    vbuf_add(ad, pk_ptr, pk_len) < 0 ||
+	    vbuf_add(ad, ext_ptr, ext_len) < 0)
+		goto fail;
+
+	ok = 0;
+fail:
+	if (pk != NULL)
+		cbor_decref(&pk);
+	if (ext != NULL)
+		cbor_decref(&ext);
+	free(pk_ptr);
+	free(ext_ptr);
+
+	return (ok);
+}
+
+static cbor_item_t *
+makecred_attstmt(cbor_item_t *sig)
+{
+	cbor_item_t *map;
+
+	if (sig == NULL)
+		return (NULL);
+	if ((map = cbor_new_definite_map(2)) == NULL ||
+	    put_str(map, "alg", build_negint(COSE_ES256)) < 0) {
+		if (map != NULL)
+			cbor_decref(&map);
+		cbor_decref(&sig);
+		return (NULL);
+	}
+	if (put_str(map, "sig", sig) < 0)
+		cbor_decref(&map);
+
+	return (map);
+}
+
+static int
+vauth_makecred(vauth_t *v, const cbor_item_t *req, cbor_item_t **rsp)
+{
+	unsigned char		 cdh[SHA256_DIGEST_LENGTH];
+	unsigned char		 rp_hash[SHA256_DIGEST_LENGTH];
+	unsigned char		 id[VAUTH_CREDID_LEN];
+	const cbor_item_t	*rp, *user, *ext, *auth;
+	char			*rp_id = NULL;
+	struct vbuf		 ad;
+	EC_KEY			*ec = NULL;
+	uint64_t		 prot = 0;
+	uint8_t			 flags = FLAG_UP;
+	int			 rk = 0, up = 1, uv = 0, lbk = 0, r;
+
+	rp = map_get(req, 2);
+	user = map_get(req, 3);
+	ext = map_get(req, 6);
+	auth = map_get(req, 8);
+
+	if (get_fixed(map_get(req, 1), cdh, sizeof(cdh)) < 0 ||
+	    get_string(map_get_str(rp, "id"), &rp_id) < 0 || rp_id == NULL ||
+	    map_get_str(user, "id") == NULL) {
+		r = FIDO_ERR_MISSING_PARAMETER;
+		goto fail;
+	}
+	if ((r = makecred_alg(map_get(req, 4))) != FIDO_OK ||
+	    (r = options(map_get(req, 7), &rk, &up, &uv)) != FIDO_OK)
+		goto fail;
+	if (up == 0) {
+		r = FIDO_ERR_INVALID_OPTION;
+		goto fail;
+	}
+	if (auth != NULL) {
+		if ((r = token_check(v, map_get(req, 9), auth, cdh,
+		    sizeof(cdh), PERM_MAKECRED, rp_id)) != FIDO_OK)
+			goto fail;
+		flags |= FLAG_UV;
+	} else if (v->pin_set) {
+		r = FIDO_ERR_PIN_REQUIRED;
+		goto fail;
+	}
+	if (ext != NULL) {
+		if (map_get_str(ext, "credProtect") != NULL &&
+		    (get_uint(map_get_str(ext, "credProtect"), &prot) < 0 ||
+		    prot < 1 || prot > 3)) {
+			r = FIDO_ERR_INVALID_PARAMETER;
+			goto fail;
+		}
+		if (map_get_str(ext, "largeBlobKey") != NULL &&
+		    (get_bool(map_get_str(ext, "largeBlobKey"), &lbk) < 0 ||
+		    (lbk && rk == 0))) {
+			r = FIDO_ERR_INVALID_OPTION;
+			goto fail;
+		}
+	}
+
+	if (SHA256((const unsigned char *)rp_id, strlen(rp_id),
+	    rp_hash) != rp_hash) {
+		r = FIDO_ERR_ERR_OTHER;
+		goto fail;
+	}
+	if ((r = makecred_excluded(v, rp_hash, map_get(req, 5))) != 0) {
+		r = r < 0 ? FIDO_ERR_CBOR_UNEXPECTED_TYPE :
+		    FIDO_ERR_CREDENTIAL_EXCLUDED;
+		goto fail;
+	}
+
+	if (cred_new(v, rp_hash, rk, (uint8_t)prot, id) < 0 ||
+	    (ec = cred_key(v, id)) == NULL) {
+		r = FIDO_ERR_ERR_OTHER;
+		goto fail;
+	}
+	if (rk && (r = rk_store(v, id, rp_hash, rp, user)) != FIDO_OK)
+		goto fail;
+
+	r = FIDO_ERR_ERR_OTHER;
+	if (makecred_authdata(v, rp_hash, flags, id, ec, (uint8_t)prot,
+	    &ad) < 0 || (*rsp = cbor_new_definite_map(4)) == NULL ||
+	    put_uint(*rsp, 1, cbor_build_string("packed")) < 0 ||
+	    put_uint(*rsp, 2, cbor_build_bytestring(ad.ptr, ad.len)) < 0 ||
+	    put_uint(*rsp, 3, makecred_attstmt(sign(ec, &ad, cdh))) < 0 ||
+	    (lbk && put_uint(*rsp, 5, cred_largeblob_key(v, id)) < 0))
+		goto fail;
+
+	r = FIDO_OK;
+fail:
+	EC_KEY_free(ec);
+	free(rp_id);
+
+	return (r);
+}
+
+/*
+ * authenticatorGetAssertion, authenticatorGetNextAssertion
+ */
+
+/* decrypt the salts of an hmac-secret request */
+static int
+assert_hmac_secret(vauth_t *v, const cbor_item_t *param)
+{
+	const cbor_item_t	*enc;
+	uint64_t		 prot = CTAP_PIN_PROTOCOL1;
+	size_t			 len, iv;
+	int			 r;
+
+	if ((enc = map_get(param, 2)) == NULL ||
+	    cbor_isa_bytestring(enc) == false ||
+	    cbor_bytestring_is_definite(enc) == false)
+		return (FIDO_ERR_MISSING_PARAMETER);
+	if (map_get(param, 4) != NULL &&
+	    (r = get_protocol(map_get(param, 4), &prot)) != FIDO_OK)
+		return (r);
+	len = cbor_bytestring_length(enc);
+	iv = prot == CTAP_PIN_PROTOCOL1 ? 0 : 16;
+	if (len != iv + 32 && len != iv + 64)
+		return (FIDO_ERR_INVALID_LENGTH);
+	if (shared_secret(v, prot, map_get(param, 1), v->iter_hmac_key) < 0 ||
+	    pin_verify(prot, v->iter_hmac_key, cbor_bytestring_handle(enc),
+	    len, map_get(param, 3)) < 0 ||
+	    pin_decrypt(prot, v->iter_hmac_key, cbor_bytestring_handle(enc),
+	    len, v->iter_hmac_salt, &v->iter_hmac_salt_len) < 0)
+		return (FIDO_ERR_INVALID_PARAMETER);
+	v->iter_hmac_prot = prot;
+	v->iter_hmac = 1;
+
+	return (FIDO_OK);
+}
+
+/* append the encrypted hmac-secret outputs of id to ad */
+static int
+assert_hmac_output(vauth_t *v, const unsigned char *id, struct vbuf *ad)
+{
+	unsigned char	 cred_random[32], out[64], enc[80];
+	unsigned char	*ptr = NULL;
+	unsigned int	 len = 32;
+	size_t		 enc_len, ptr_len, alloc;
+	cbor_item_t	*ext = NULL;
+	int		 ok = -1;
+
+	if (derive(v, (v->iter_flags & FLAG_UV) ? "hmac-uv" : "hmac", id, 16,
+	    NULL, 0, cred_random) < 0)
+		return (-1);
+	for (size_t i = 0; i < v->iter_hmac_salt_len; i += 32)
+		if (HMAC(EVP_sha256(), cred_random, sizeof(cred_random),
+		    v->iter_hmac_salt + i, 32, out + i, &len) == NULL ||
+		    len != 32)
+			goto fail;
+	if (pin_encrypt(v->iter_hmac_prot, v->iter_hmac_key, out,
+	    v->iter_hmac_salt_len, enc, &enc_len) < 0 ||
+	    (ext = cbor_new_definite_map(1)) == NULL ||
+	    put_str(ext, "hmac-secret", cbor_build_bytestring(enc,
+	    enc_len)) < 0 ||
+	    (ptr_len = cbor_serialize_alloc(ext, &ptr, &alloc)) == 0 ||
+	    vbuf_add(ad, ptr, ptr_len) < 0)
+		goto fail;
+
+	ok = 0;
+fail:
+	OPENSSL_cleanse(cred_random, sizeof(cred_random));
+	OPENSSL_cleanse(out, sizeof(out));
+	if (ext != NULL)
+		cbor_decref(&ext);
+	free(ptr);
+
+	return (ok);
+}
+
+static int
+assert_reply(vauth_t *v, const unsigned char *id, size_t ncred,
+    cbor_item_t **rsp)
+{
+	const struct vauth_rk	*rk;
+	struct vbuf		 ad;
+	EC_KEY			*ec;
+	int			 uv = (v->iter_flags & FLAG_UV) != 0;
+	int			 ok = -1;
+
+	rk = rk_find(v, id, VAUTH_CREDID_LEN);
+	if ((ec = cred_key(v, id)) == NULL)
+		return (FIDO_ERR_ERR_OTHER);
+	if (authdata(v, v->iter_rp_hash, (uint8_t)(v->iter_flags |
+	    (v->iter_hmac ? FLAG_ED : 0)), &ad) < 0 ||
+	    (v->iter_hmac && assert_hmac_output(v, id, &ad) < 0) ||
+	    (*rsp = cbor_new_definite_map(6)) == NULL ||
+	    put_uint(*rsp, 1, build_descriptor(id, VAUTH_CREDID_LEN)) < 0 ||
+	    put_uint(*rsp, 2, cbor_build_bytestring(ad.ptr, ad.len)) < 0 ||
+	    put_uint(*rsp, 3, sign(ec, &ad, v->iter_cdh)) < 0 ||
+	    (rk != NULL && put_uint(*rsp, 4, rk_user(rk, uv,
+	    v->bad_user)) < 0) ||
+	    (ncred > 1 && put_uint(*rsp, 5, build_uint(ncred)) < 0) ||
+	    (rk != NULL && v->iter_lbk && put_uint(*rsp, 7,
+	    cred_largeblob_key(v, id)) < 0))
+		goto fail;
+
+	ok = 0;
+fail:
+	EC_KEY_free(ec);
+
+	return (ok < 0 ? FIDO_ERR_ERR_OTHER : FIDO_OK);
+}
+
+static int
+assert_allowed(vauth_t *v, const unsigned char *id, size_t len, int uv,
+    int listed)
+{
+	uint8_t prot;
+
+	if (cred_valid(v, v->iter_rp_hash, id, len) == 0)
+		return (0);
+	prot = CREDID_PROT(id);
+	if (uv == 0 && (prot == 3 || (prot == 2 && listed == 0)))
+		return (0);
+
+	return (1);
+}
+
+static int
+vauth_assert(vauth_t *v, const cbor_item_t *req, cbor_item_t **rsp)
+{
+	unsigned char		  id[VAUTH_CREDID_LEN];
+	const cbor_item_t	 *list, *ext, *auth;
+	cbor_item_t		**p;
+	char			 *rp_id = NULL;
+	size_t			  len;
+	int			  up = 1, uv = 0, r;
+
+	list = map_get(req, 3);
+	ext = map_get(req, 4);
+	auth = map_get(req, 6);
+	v->iter_len = v->iter_pos = 0;
+	v->iter_lbk = 0;
+	v->iter_hmac = 0;
+
+	if (get_string(map_get(req, 1), &rp_id) < 0 || rp_id == NULL ||
+	    get_fixed(map_get(req, 2), v->iter_cdh, sizeof(v->iter_cdh)) < 0) {
+		r = FIDO_ERR_MISSING_PARAMETER;
+		goto fail;
+	}
+	if ((r = options(map_get(req, 5), NULL, &up, &uv)) != FIDO_OK)
+		goto fail;
+	if (auth != NULL) {
+		if ((r = token_check(v, map_get(req, 7), auth, v->iter_cdh,
+		    sizeof(v->iter_cdh), PERM_ASSERT, rp_id)) != FIDO_OK)
+			goto fail;
+		uv = 1;
+	}
+	if (ext != NULL && map_get_str(ext, "largeBlobKey") != NULL &&
+	    get_bool(map_get_str(ext, "largeBlobKey"), &v->iter_lbk) < 0) {
+		r = FIDO_ERR_INVALID_OPTION;
+		goto fail;
+	}
+	if (ext != NULL && map_get_str(ext, "hmac-secret") != NULL &&
+	    (r = assert_hmac_secret(v, map_get_str(ext,
+	    "hmac-secret"))) != FIDO_OK)
+		goto fail;
+	if (SHA256((const unsigned char *)rp_id, strlen(rp_id),
+	    v->iter_rp_hash) != v->iter_rp_hash) {
+		r = FIDO_ERR_ERR_OTHER;
+		goto fail;
+	}
+	v->iter_flags = (uint8_t)((up ? FLAG_UP : 0) | (uv ? FLAG_UV : 0));
+
+	if (list != NULL) {
+		if (cbor_isa_array(list) == false) {
+			r = FIDO_ERR_CBOR_UNEXPECTED_TYPE;
+			goto fail;
+		}
+		if (cbor_array_size(list) > VAUTH_MAXALLOW) {
+			r = FIDO_ERR_LIMIT_EXCEEDED;
+			goto fail;
+		}
+		p = cbor_array_handle(list);
+		for (size_t i = 0; i < cbor_array_size(list); i++) {
+			len = sizeof(id);
+			if (get_bytes(map_get_str(p[i], "id"), id, &len) == 0 &&
+			    assert_allowed(v, id, len, uv, 1)) {
+				memcpy(v->iter_id[v->iter_len++], id, len);
+				break;
+			}
+		}
+	} else {
+		/* most recent first */
+		for (size_t i = v->nrk; i > 0; i--)
+			if (memcmp(v->rk[i - 1].rp_hash, v->iter_rp_hash,
+			    32) == 0 && assert_allowed(v, v->rk[i - 1].id,
+			    VAUTH_CREDID_LEN, uv, 0))
+				memcpy(v->iter_id[v->iter_len++],
+				    v->rk[i - 1].id, VAUTH_CREDID_LEN);
+	}
+	if (v->iter_len == 0) {
+		r = FIDO_ERR_NO_CREDENTIALS;
+		goto fail;
+	}
+
+	if ((r = assert_reply(v, v->iter_id[0], list == NULL ? v->iter_len :
+	    1, rsp)) != FIDO_OK)
+		goto fail;
+	if (++v->iter_pos < v->iter_len)
+		v->iter = ITER_ASSERT;
+fail:
+	free(rp_id);
+
+	return (r);
+}
+
+static int
+vauth_next_assert(vauth_t *v, cbor_item_t **rsp)
+{
+	int r;
+
+	if (v->iter_prev != ITER_ASSERT || v->iter_pos >= v->iter_len)
+		return (FIDO_ERR_NOT_ALLOWED);
+	if ((r = assert_reply(v, v->iter_id[v->iter_pos], 0,
+	    rsp)) != FIDO_OK)
+		return (r);
+	if (++v->iter_pos < v->iter_len)
+		v->iter = ITER_ASSERT;
+
+	return (FIDO_OK);
+}
+
+/*
+ * authenticatorClientPIN
+ */
+
+static int
+pin_hash_check(vauth_t *v, uint64_t prot, const unsigned char *key,
+    const cbor_item_t *enc)
+{
+	unsigned char	buf[48];
+	unsigned char	ph[32];
+	size_t		len = sizeof(buf);
+
+	if (v->pin_set == 0)
+		return (FIDO_ERR_PIN_NOT_SET);
+	if (v->pin_retries == 0)
+		return (FIDO_ERR_PIN_BLOCKED);
+	if (get_bytes(enc, buf, &len) < 0 ||
+	    pin_decrypt(prot, key, buf, len, ph, &len) < 0 || len != 16)
+		return (FIDO_ERR_INVALID_PARAMETER);
+
+	v->pin_retries--;
+	if (CRYPTO_memcmp(ph, v->pin_hash, sizeof(v->pin_hash)) != 0) {
+		if (ka_reset(v) < 0)
+			return (FIDO_ERR_ERR_OTHER);
+		return (v->pin_retries == 0 ? FIDO_ERR_PIN_BLOCKED :
+		    FIDO_ERR_PIN_INVALID);
+	}
+	v->pin_retries = VAUTH_PIN_RETRIES;
+
+	return (FIDO_OK);
+}
+
+static int
+pin_new(vauth_t *v, uint64_t prot, const unsigned char *key,
+    const unsigned char *enc, size_t enc_len)
+{
+	unsigned char	buf[64];
+	size_t		len, n;
+
+	if (enc_len > sizeof(buf) + 16 ||
+	    pin_decrypt(prot, key, enc, enc_len, buf, &len) < 0 ||
+	    len != sizeof(buf))
+		return (FIDO_ERR_INVALID_PARAMETER);
+	for (n = 0; n < sizeof(buf) && buf[n] != 0; n++)
+		continue;
+	if (n < VAUTH_MIN_PINLEN || n == sizeof(buf))
+		return (FIDO_ERR_PIN_POLICY_VIOLATION);
+	if (SHA256(buf, n, buf) != buf)
+		return (FIDO_ERR_ERR_OTHER);
+	memcpy(v->pin_hash, buf, sizeof(v->pin_hash));
+	OPENSSL_cleanse(buf, sizeof(buf));
+	v->pin_set = 1;
+	v->pin_retries = VAUTH_PIN_RETRIES;
+	token_reset(v);
+
+	return (FIDO_OK);
+}
+
+static int
+pin_change(vauth_t *v, const cbor_item_t *req, uint64_t prot,
+    const unsigned char *key, int change)
+{
+	unsigned char		 msg[80 + 48];
+	size_t			 enc_len = 80, ph_len = 48;
+	const cbor_item_t	*auth = map_get(req, 4);
+	int			 r;
+
+	if (change == 0 && v->pin_set)
+		return (FIDO_ERR_NOT_ALLOWED);
+	if (auth == NULL || map_get(req, 5) == NULL ||
+	    (change && map_get(req, 6) == NULL))
+		return (FIDO_ERR_MISSING_PARAMETER);
+	if (get_bytes(map_get(req, 5), msg, &enc_len) < 0 ||
+	    (change && get_bytes(map_get(req, 6), msg + enc_len,
+	    &ph_len) < 0))
+		return (FIDO_ERR_INVALID_PARAMETER);
+	if (pin_verify(prot, key, msg, enc_len + (change ? ph_len : 0),
+	    auth) < 0)
+		return (FIDO_ERR_PIN_AUTH_INVALID);
+	if (change && (r = pin_hash_check(v, prot, key,
+	    map_get(req, 6))) != FIDO_OK)
+		return (r);
+
+	return (pin_new(v, prot, key, msg, enc_len));
+}
+
+static int
+pin_token(vauth_t *v, const cbor_item_t *req, uint64_t prot,
+    const unsigned char *key, int legacy, cbor_item_t **rsp)
+{
+	unsigned char	 enc[48];
+	size_t		 enc_len;
+	uint64_t	 perm = PERM_MAKECRED|PERM_ASSERT;
+	char		*rp_id = NULL;
+	int		 r;
+
+	if (legacy == 0 && (get_uint(map_get(req, 9), &perm) < 0 ||
+	    perm == 0 || perm > UINT8_MAX ||
+	    get_string(map_get(req, 10), &rp_id) < 0)) {
+		free(rp_id);
+		return (FIDO_ERR_INVALID_PARAMETER);
+	}
+	if ((r = pin_hash_check(v, prot, key, map_get(req, 6))) != FIDO_OK) {
+		free(rp_id);
+		return (r);
+	}
+
+	token_reset(v);
+	if (RAND_bytes(v->token.key, sizeof(v->token.key)) != 1) {
+		free(rp_id);
+		return (FIDO_ERR_ERR_OTHER);
+	}
+	v->token.prot = (uint8_t)prot;
+	v->token.perm = (uint8_t)perm;
+	v->token.rp_id = rp_id;
+	v->token.valid = 1;
+
+	if (pin_encrypt(prot, key, v->token.key, sizeof(v->token.key), enc,
+	    &enc_len) < 0 || (*rsp = cbor_new_definite_map(1)) == NULL ||
+	    put_uint(*rsp, 2, cbor_build_bytestring(enc, enc_len)) < 0)
+		return (FIDO_ERR_ERR_OTHER);
+
+	return (FIDO_OK);
+}
+
+static int
+vauth_client_pin(vauth_t *v, const cbor_item_t *req, cbor_item_t **rsp)
+{
+	unsigned char	key[64];
+	uint64_t	subcmd, prot;
+	int		r;
+
+	if (get_uint(map_get(req, 2), &subcmd) < 0)
+		return (FIDO_ERR_MISSING_PARAMETER);
+	if (subcmd == 1) { /* getPINRetries */
+		if ((*rsp = cbor_new_definite_map(1)) == NULL ||
+		    put_uint(*rsp, 3, build_uint((uint64_t)v->pin_retries)) < 0)
+			return (FIDO_ERR_ERR_OTHER);
+		return (FIDO_OK);
+	}
+	if ((r = get_protocol(map_get(req, 1), &prot)) != FIDO_OK)
+		return (r);
+	if (subcmd == 2) { /* getKeyAgreement */
+		if ((*rsp = cbor_new_definite_map(1)) == NULL ||
+		    put_uint(*rsp, 1, cose_encode(v->ka, COSE_ECDH_ES256)) < 0)
+			return (FIDO_ERR_ERR_OTHER);
+		return (FIDO_OK);
+	}
+	if (subcmd != 3 && subcmd != 4 && subcmd != 5 && subcmd != 9)
+		return (ERR_INVALID_SUBCOMMAND);
+	if (map_get(req, 3) == NULL)
+		return (FIDO_ERR_MISSING_PARAMETER);
+	if (shared_secret(v, prot, map_get(req, 3), key) < 0)
+		return (FIDO_ERR_INVALID_PARAMETER);
+
+	switch (subcmd) {
+	case 3: /* setPIN */
+		r = pin_change(v, req, prot, key, 0);
+		break;
+	case 4: /* changePIN */
+		r = pin_change(v, req, prot, key, 1);
+		break;
+	case 5: /* getPinToken */
+		r = pin_token(v, req, prot, key, 1, rsp);
+		break;
+	default: /* getPinUvAuthTokenUsingPinWithPermissions */
+		r = pin_token(v, req, prot, key, 0, rsp);
+		break;
+	}
+	OPENSSL_cleanse(key, sizeof(key));
+
+	return (r);
+}
+
+/*
+ * authenticatorCredentialManagement
+ */
+
+static int
+credman_auth(vauth_t *v, uint64_t subcmd, const cbor_item_t *req)
+{
+	const cbor_item_t	*params = map_get(req, 2);
+	unsigned char		*ptr = NULL;
+	size_t			 len = 0, alloc;
+	struct vbuf		 msg;
+	int			 r;
+
+	if (map_get(req, 4) == NULL)
+		return (FIDO_ERR_PIN_REQUIRED);
+	msg.len = 0;
+	msg.ptr[msg.len++] = (uint8_t)subcmd;
+	if (params != NULL && ((len = cbor_serialize_alloc(params, &ptr,
+	    &alloc)) == 0 || vbuf_add(&msg, ptr, len) < 0)) {
+		free(ptr);
+		return (FIDO_ERR_INVALID_LENGTH);
+	}
+	free(ptr);
+	r = token_check(v, map_get(req, 3), map_get(req, 4), msg.ptr, msg.len,
+	    PERM_CRED_MGMT, NULL);
+
+	return (r);
+}
+
+static cbor_item_t *
+credman_rp(const struct vauth_rk *rk)
+{
+	cbor_item_t *map;
+
+	if ((map = cbor_new_definite_map(2)) == NULL)
+		return (NULL);
+	if ((rk->rp_id != NULL && put_str(map, "id",
+	    cbor_build_string(rk->rp_id)) < 0) ||
+	    (rk->rp_name != NULL && put_str(map, "name",
+	    cbor_build_string(rk->rp_name)) < 0))
+		cbor_decref(&map);
+
+	return (map);
+}
+
+static int
+credman_rp_reply(vauth_t *v, size_t total, cbor_item_t **rsp)
+{
+	const struct vauth_rk *rk = NULL;
+
+	for (size_t i = 0; i < v->nrk; i++)
+		if (memcmp(v->rk[i].rp_hash, v->iter_id[v->iter_pos],
+		    32) == 0) {
+			rk = &v->rk[i];
+			break;
+		}
+	if (rk == NULL)
+		return (FIDO_ERR_NOT_ALLOWED);
+	if ((*rsp = cbor_new_definite_map(3)) == NULL ||
+	    put_uint(*rsp, 3, credman_rp(rk)) < 0 ||
+	    put_uint(*rsp, 4, cbor_build_bytestring(rk->rp_hash, 32)) < 0 ||
+	    (total && put_uint(*rsp, 5, build_uint(total)) < 0))
+		return (FIDO_ERR_ERR_OTHER);
+	if (++v->iter_pos < v->iter_len)
+		v->iter = ITER_RP;
+
+	return (FIDO_OK);
+}
+
+static int
+credman_rk_reply(vauth_t *v, size_t total, cbor_item_t **rsp)
+{
+	const struct vauth_rk	*rk;
+	EC_KEY			*ec;
+	uint8_t			 prot;
+	int			 ok = -1;
+
+	if ((rk = rk_find(v, v->iter_id[v->iter_pos],
+	    VAUTH_CREDID_LEN)) == NULL)
+		return (FIDO_ERR_NOT_ALLOWED);
+	if ((ec = cred_key(v, rk->id)) == NULL)
+		return (FIDO_ERR_ERR_OTHER);
+	prot = CREDID_PROT(rk->id);
+	if ((*rsp = cbor_new_definite_map(6)) == NULL ||
+	    put_uint(*rsp, 6, rk_user(rk, 1, 0)) < 0 ||
+	    put_uint(*rsp, 7, build_descriptor(rk->id, VAUTH_CREDID_LEN)) < 0 ||
+	    put_uint(*rsp, 8, cose_encode(ec, COSE_ES256)) < 0 ||
+	    (total && put_uint(*rsp, 9, build_uint(total)) < 0) ||
+	    put_uint(*rsp, 10, cbor_build_uint8(prot ? prot : 1)) < 0 ||
+	    put_uint(*rsp, 11, cred_largeblob_key(v, rk->id)) < 0)
+		goto fail;
+	if (++v->iter_pos < v->iter_len)
+		v->iter = ITER_RK;
+
+	ok = 0;
+fail:
+	EC_KEY_free(ec);
+
+	return (ok < 0 ? FIDO_ERR_ERR_OTHER : FIDO_OK);
+}
+
+static int
+credman_rp_begin(vauth_t *v, cbor_item_t **rsp)
+{
+	size_t j;
+
+	v->iter_len = v->iter_pos = 0;
+	for (size_t i = 0; i < v->nrk; i++) {
+		for (j = 0; j < v->iter_len; j++)
+			if (memcmp(v->iter_id[j], v->rk[i].rp_hash, 32) == 0)
+				break;
+		if (j == v->iter_len)
+			memcpy(v->iter_id[v->iter_len++], v->rk[i].rp_hash, 32);
+	}
+	if (v->iter_len == 0)
+		return (FIDO_ERR_NO_CREDENTIALS);
+
+	return (credman_rp_reply(v, v->iter_len, rsp));
+}
+
+static int
+credman_rk_begin(vauth_t *v, const cbor_item_t *params, cbor_item_t **rsp)
+{
+	unsigned char rp_hash[32];
+
+	if (get_fixed(map_get(params, 1), rp_hash, sizeof(rp_hash)) < 0)
+		return (FIDO_ERR_MISSING_PARAMETER);
+	v->iter_len = v->iter_pos = 0;
+	for (size_t i = 0; i < v->nrk; i++)
+		if (memcmp(v->rk[i].rp_hash, rp_hash, 32) == 0)
+			memcpy(v->iter_id[v->iter_len++], v->rk[i].id,
+			    VAUTH_CREDID_LEN);
+	if (v->iter_len == 0)
+		return (FIDO_ERR_NO_CREDENTIALS);
+
+	return (credman_rk_reply(v, v->iter_len, rsp));
+}
+
+static struct vauth_rk *
+credman_find(vauth_t *v, const cbor_item_t *params)
+{
+	unsigned char	id[VAUTH_CREDID_LEN];
+	size_t		len = sizeof(id);
+
+	if (get_bytes(map_get_str(map_get(params, 2), "id"), id, &len) < 0)
+		return (NULL);
+
+	return (rk_find(v, id, len));
+}
+
+static int
+credman_update(vauth_t *v, const cbor_item_t *params)
+{
+	struct vauth_rk		*rk;
+	const cbor_item_t	*user = map_get(params, 3);
+	unsigned char		 user_id[VAUTH_USERID_LEN];
+	size_t			 len = sizeof(user_id);
+	char			*name = NULL, *display = NULL;
+
+	if ((rk = credman_find(v, params)) == NULL)
+		return (FIDO_ERR_NO_CREDENTIALS);
+	if (get_bytes(map_get_str(user, "id"), user_id, &len) < 0 ||
+	    len != rk->user_id_len || memcmp(user_id, rk->user_id, len) != 0 ||
+	    get_string(map_get_str(user, "name"), &name) < 0 ||
+	    get_string(map_get_str(user, "displayName"), &display) < 0) {
+		free(name);
+		free(display);
+		return (FIDO_ERR_INVALID_PARAMETER);
+	}
+	free(rk->user_name);
+	free(rk->user_display);
+	rk->user_name = name;
+	rk->user_display = display;
+
+	return (FIDO_OK);
+}
+
+static int
+vauth_credman(vauth_t *v, const cbor_item_t *req, cbor_item_t **rsp)
+{
+	const cbor_item_t	*params = map_get(req, 2);
+	struct vauth_rk		*rk;
+	uint64_t		 subcmd;
+	int			 r;
+
+	if (get_uint(map_get(req, 1), &subcmd) < 0)
+		return (FIDO_ERR_MISSING_PARAMETER);
+	if (subcmd == 3 || subcmd == 5) {
+		if (v->iter_prev != (subcmd == 3 ? ITER_RP : ITER_RK))
+			return (FIDO_ERR_NOT_ALLOWED);
+		return (subcmd == 3 ? credman_rp_reply(v, 0, rsp) :
+		    credman_rk_reply(v, 0, rsp));
+	}
+	if (subcmd < 1 || subcmd > 7)
+		return (ERR_INVALID_SUBCOMMAND);
+	if ((r = credman_auth(v, subcmd, req)) != FIDO_OK)
+		return (r);
+
+	switch (subcmd) {
+	case 1: /* getCredsMetadata */
+		if ((*rsp = cbor_new_definite_map(2)) == NULL ||
+		    put_uint(*rsp, 1, build_uint(v->nrk)) < 0 ||
+		    put_uint(*rsp, 2, build_uint(VAUTH_MAXRK - v->nrk)) < 0)
+			return (FIDO_ERR_ERR_OTHER);
+		return (FIDO_OK);
+	case 2: /* enumerateRPsBegin */
+		return (credman_rp_begin(v, rsp));
+	case 4: /* enumerateCredentialsBegin */
+		return (credman_rk_begin(v, params, rsp));
+	case 6: /* deleteCredential */
+		if ((rk = credman_find(v, params)) == NULL)
+			return (FIDO_ERR_NO_CREDENTIALS);
+		rk_remove(v, rk);
+		return (FIDO_OK);
+	default: /* updateUserInformation */
+		return (credman_update(v, params));
+	}
+}
+
+/*
+ * authenticatorLargeBlobs
+ */
+
+static void
+largeblob_reset(vauth_t *v)
+{
+	/* an empty array, followed by its truncated digest */
+	v->lb[0] = 0x80;
+	SHA256(v->lb, 1, v->lb + 1);
+	v->lb_len = 17;
+	v->lb_new_len = v->lb_new_want = 0;
+}
+
+static int
+largeblob_auth(vauth_t *v, const cbor_item_t *req, uint64_t offset,
+    const unsigned char *frag, size_t len)
+{
+	unsigned char msg[32 + 2 + 4 + SHA256_DIGEST_LENGTH];
+
+	if (map_get(req, 5) == NULL)
+		return (FIDO_ERR_PIN_REQUIRED);
+	memset(msg, 0xff, 32);
+	msg[32] = CTAP_CBOR_LARGEBLOB;
+	msg[33] = 0x00;
+	for (size_t i = 0; i < 4; i++)
+		msg[34 + i] = (uint8_t)(offset >> (8 * i));
+	if (SHA256(frag, len, msg + 38) != msg + 38)
+		return (FIDO_ERR_ERR_OTHER);
+
+	return (token_check(v, map_get(req, 6), map_get(req, 5), msg,
+	    sizeof(msg), PERM_LARGEBLOB, NULL));
+}
+
+static int
+largeblob_set(vauth_t *v, const cbor_item_t *req, uint64_t offset)
+{
+	const cbor_item_t	*set = map_get(req, 2);
+	unsigned char		 dgst[SHA256_DIGEST_LENGTH];
+	const unsigned char	*frag;
+	uint64_t		 len;
+	size_t			 n;
+	int			 r;
+
+	if (cbor_isa_bytestring(set) == false ||
+	    cbor_bytestring_is_definite(set) == false)
+		return (FIDO_ERR_CBOR_UNEXPECTED_TYPE);
+	frag = cbor_bytestring_handle(set);
+	if ((n = cbor_bytestring_length(set)) > VAUTH_MAXMSG - 64)
+		return (FIDO_ERR_INVALID_LENGTH);
+	if (offset == 0) {
+		if (get_uint(map_get(req, 4), &len) < 0)
+			return (FIDO_ERR_INVALID_PARAMETER);
+		if (len > VAUTH_MAXLARGEBLOB)
+			return (FIDO_ERR_LARGEBLOB_STORAGE_FULL);
+		if (len < 17)
+			return (FIDO_ERR_INVALID_PARAMETER);
+		v->lb_new_want = (size_t)len;
+		v->lb_new_len = 0;
+	} else if (map_get(req, 4) != NULL)
+		return (FIDO_ERR_INVALID_PARAMETER);
+	if (v->lb_new_want == 0 || offset != v->lb_new_len)
+		return (FIDO_ERR_INVALID_SEQ);
+	if (v->pin_set && (r = largeblob_auth(v, req, offset, frag,
+	    n)) != FIDO_OK)
+		return (r);
+	if (n > v->lb_new_want - v->lb_new_len)
+		return (FIDO_ERR_INVALID_PARAMETER);
+
+	if (n > 0)
+		memcpy(v->lb_new + v->lb_new_len, frag, n);
+	v->lb_new_len += n;
+	if (v->lb_new_len < v->lb_new_want)
+		return (FIDO_OK);
+
+	n = v->lb_new_len - 16;
+	v->lb_new_want = 0;
+	if (SHA256(v->lb_new, n, dgst) != dgst ||
+	    memcmp(dgst, v->lb_new + n, 16) != 0)
+		return (ERR_INTEGRITY_FAILURE);
+	memcpy(v->lb, v->lb_new, v->lb_new_len);
+	v->lb_len = v->lb_new_len;
+
+	return (FIDO_OK);
+}
+
+static int
+vauth_largeblob(vauth_t *v, const cbor_item_t *req, cbor_item_t **rsp)
+{
+	const cbor_item_t	*get = map_get(req, 1);
+	uint64_t		 offset, len;
+
+	if ((get == NULL) == (map_get(req, 2) == NULL))
+		return (FIDO_ERR_INVALID_PARAMETER);
+	if (get_uint(map_get(req, 3), &offset) < 0)
+		return (FIDO_ERR_MISSING_PARAMETER);
+	if (get == NULL)
+		return (largeblob_set(v, req, offset));
+
+	if (get_uint(get, &len) < 0)
+		return (FIDO_ERR_CBOR_UNEXPECTED_TYPE);
+	if (len > VAUTH_MAXMSG - 64)
+		return (FIDO_ERR_INVALID_LENGTH);
+	if (offset > v->lb_len)
+		return (FIDO_ERR_INVALID_PARAMETER);
+	if (len > v->lb_len - offset)
+		len = v->lb_len - offset;
+	if ((*rsp = cbor_new_definite_map(1)) == NULL ||
+	    put_uint(*rsp, 1, cbor_build_bytestring(v->lb + offset,
+	    (size_t)len)) < 0)
+		return (FIDO_ERR_ERR_OTHER);
+
+	return (FIDO_OK);
+}
+
+/*
+ * authenticatorReset
+ */
+
+static int
+vauth_wipe(vauth_t *v)
+{
+	for (size_t i = 0; i < v->nrk; i++)
+		rk_reset(&v->rk[i]);
+	v->nrk = 0;
+	v->pin_set = 0;
+	v->pin_retries = VAUTH_PIN_RETRIES;
+	OPENSSL_cleanse(v->pin_hash, sizeof(v->pin_hash));
+	token_reset(v);
+	largeblob_reset(v);
+	v->iter = ITER_NONE;
+
+	return (ka_reset(v));
+}
+
+static int
+vauth_reset(vauth_t *v)
+{
+	unsigned char master[32];
+
+	/* credentials made before are no longer recognised */
+	if (derive(v, "reset", NULL, 0, NULL, 0, master) < 0)
+		return (FIDO_ERR_ERR_OTHER);
+	memcpy(v->master, master, sizeof(v->master));
+	OPENSSL_cleanse(master, sizeof(master));
+
+	return (vauth_wipe(v) < 0 ? FIDO_ERR_ERR_OTHER : FIDO_OK);
+}
+
+/*
+ * U2F authenticate, over CTAPHID_MSG: check-only and sign requests for
+ * the credentials made with authenticatorMakeCredential.
+ */
+
+static void
+vauth_msg(vauth_t *v, const unsigned char *buf, size_t len)
+{
+	const unsigned char	*cdh, *rp_hash, *id;
+	struct vbuf		 ad;
+	cbor_item_t		*sig = NULL;
+	EC_KEY			*ec = NULL;
+	uint16_t		 sw;
+	size_t			 id_len;
+
+	v->ncmd++;
+	v->reply_len = 0;
+
+	/* cla ins p1 p2 lc[3] cdh rp_hash id_len id le[2] */
+	if (len < 7 + 32 + 32 + 1 + 2 || buf[1] != U2F_CMD_AUTH ||
+	    buf[4] != 0 || (size_t)((buf[5] << 8) | buf[6]) != len - 9 ||
+	    (id_len = buf[71]) != len - 74) {
+		sw = SW_WRONG_LENGTH;
+		goto out;
+	}
+	cdh = buf + 7;
+	rp_hash = buf + 39;
+	id = buf + 72;
+
+	if (cred_valid(v, rp_hash, id, id_len) == 0 || CREDID_PROT(id) == 3) {
+		sw = SW_WRONG_DATA;
+		goto out;
+	}
+	if (buf[2] != U2F_AUTH_SIGN || v->u2f_polls++ < v->u2f_touch) {
+		sw = SW_CONDITIONS_NOT_SATISFIED;
+		goto out;
+	}
+
+	v->u2f_polls = 0;
+	if ((ec = cred_key(v, id)) == NULL ||
+	    authdata(v, rp_hash, FLAG_UP, &ad) < 0 ||
+	    (sig = sign(ec, &ad, cdh)) == NULL ||
+	    ad.len - 32 + cbor_bytestring_length(sig) > sizeof(v->reply) - 2) {
+		sw = SW_WRONG_DATA;
+		goto out;
+	}
+	/* flags, counter, signature */
+	memcpy(v->reply, ad.ptr + 32, ad.len - 32);
+	memcpy(v->reply + ad.len - 32, cbor_bytestring_handle(sig),
+	    cbor_bytestring_length(sig));
+	v->reply_len = ad.len - 32 + cbor_bytestring_length(sig);
+	sw = SW_NO_ERROR;
+out:
+	v->reply[v->reply_len++] = (uint8_t)(sw >> 8);
+	v->reply[v->reply_len++] = (uint8_t)sw;
+
+	EC_KEY_free(ec);
+	if (sig != NULL)
+		cbor_decref(&sig);
+}
+
+/*
+ * dispatch
+ */
+
+static void
+vauth_cmd(vauth_t *v, const unsigned char *buf, size_t len)
+{
+	struct cbor_load_result	 cbor;
+	cbor_item_t		*req = NULL, *rsp = NULL;
+	unsigned char		*ptr = NULL;
+	size_t			 n = 0, alloc;
+	int			 r;
+
+	v->ncmd++;
+	v->iter_prev = v->iter;
+	v->iter = ITER_NONE;
+
+	if (len == 0) {
+		r = FIDO_ERR_INVALID_LENGTH;
+		goto out;
+	}
+	if (len > 1 && ((req = cbor_load(buf + 1, len - 1, &cbor)) == NULL ||
+	    cbor_isa_map(req) == false)) {
+		r = FIDO_ERR_INVALID_CBOR;
+		goto out;
+	}
+
+	switch (buf[0]) {
+	case CTAP_CBOR_GETINFO:
+		r = vauth_getinfo(v, &rsp);
+		break;
+	case CTAP_CBOR_MAKECRED:
+		r = vauth_makecred(v, req, &rsp);
+		break;
+	case CTAP_CBOR_ASSERT:
+		r = vauth_assert(v, req, &rsp);
+		break;
+	case CTAP_CBOR_NEXT_ASSERT:
+		r = vauth_next_assert(v, &rsp);
+		break;
+	case CTAP_CBOR_CLIENT_PIN:
+		r = vauth_client_pin(v, req, &rsp);
+		break;
+	case CTAP_CBOR_CRED_MGMT:
+	case CTAP_CBOR_CRED_MGMT_PRE:
+		r = vauth_credman(v, req, &rsp);
+		break;
+	case CTAP_CBOR_LARGEBLOB:
+		r = vauth_largeblob(v, req, &rsp);
+		break;
+	case CTAP_CBOR_RESET:
+		r = vauth_reset(v);
+		break;
+	default:
+		r = FIDO_ERR_INVALID_COMMAND;
+		break;
+	}
+
+	if (r == FIDO_OK && rsp != NULL &&
+	    ((n = cbor_serialize_alloc(rsp, &ptr, &alloc)) == 0 ||
+	    n > sizeof(v->reply) - 1))
+		r = FIDO_ERR_ERR_OTHER;
+out:
+	if (r != FIDO_OK) {
+		n = 0;
+		v->iter = ITER_NONE;
+	}
+	v->reply[0] = (uint8_t)r;
+	if (n > 0)
+		memcpy(v->reply + 1, ptr, n);
+	v->reply_len = 1 + n;
+
+	free(ptr);
+	if (req != NULL)
+		cbor_decref(&req);
+	if (rsp != NULL)
+		cbor_decref(&rsp);
+}
+
+/*
+ * transport
+ */
+
+static void *
+vauth_open(const char *path)
+{
+	void	*p = NULL;
+	vauth_t	*v;
+
+	if (sscanf(path, "vauth:%p", &p) != 1 || (v = p) == NULL ||
+	    v->magic != VAUTH_MAGIC || v->open)
+		return (NULL);
+	v->open = 1;
+	v->reply_len = 0;
+	v->iter = ITER_NONE;
+
+	return (v);
+}
+
+static void
+vauth_close(void *handle)
+{
+	vauth_t *v = handle;
+
+	v->open = 0;
+}
+
+static int
+vauth_read(void *handle, unsigned char *ptr, size_t len, int ms)
+{
+	(void)handle;
+	(void)ptr;
+	(void)len;
+	(void)ms;
+
+	return (-1);
+}
+
+static int
+vauth_write(void *handle, const unsigned char *ptr, size_t len)
+{
+	(void)handle;
+	(void)ptr;
+	(void)len;
+
+	return (-1);
+}
+
+static int
+vauth_tx(fido_dev_t *dev, uint8_t cmd, const unsigned char *buf, size_t len)
+{
+	vauth_t *v = fido_dev_io_handle(dev);
+
+	switch (cmd) {
+	case CTAP_CMD_INIT:
+		if (len != sizeof(v->init_nonce))
+			return (-1);
+		memcpy(&v->init_nonce, buf, len);
+		return (0);
+	case CTAP_CMD_CBOR:
+		vauth_cmd(v, buf, len);
+		return (0);
+	case CTAP_CMD_MSG:
+		vauth_msg(v, buf, len);
+		return (0);
+	case CTAP_CMD_CANCEL:
+		return (0);
+	default:
+		return (-1);
+	}
+}
+
+/* sleep for the configured latency; a reply later than ms times out */
+static int
+vauth_wait(const vauth_t *v, int ms)
+{
+	struct timespec	ts;
+	int		t = v->latency_ms;
+
+	if (t <= 0)
+		return (0);
+	if (ms >= 0 && ms < t)
+		t = ms;
+	ts.tv_sec = t / 1000;
+	ts.tv_nsec = (t % 1000) * 1000000L;
+	while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+		continue;
+
+	return (t < v->latency_ms ? -1 : 0);
+}
+
+static int
+vauth_rx(fido_dev_t *dev, uint8_t cmd, unsigned char *buf, size_t len, int ms)
+{
+	vauth_t	*v = fido_dev_io_handle(dev);
+	size_t	 n;
+
+	switch (cmd) {
+	case CTAP_CMD_INIT:
+		if (len < 17)
+			return (-1);
+		memset(buf, 0, 17);
+		memcpy(buf, &v->init_nonce, sizeof(v->init_nonce));
+		buf[12] = 2; /* ctaphid protocol */
+		buf[13] = 1; /* major */
+		buf[16] = FIDO_CAP_CBOR | FIDO_CAP_NMSG;
+		return (17);
+	case CTAP_CMD_CBOR:
+	case CTAP_CMD_MSG:
+		if ((n = v->reply_len) == 0 || n > len ||
+		    vauth_wait(v, ms) < 0)
+			return (-1);
+		memcpy(buf, v->reply, n);
+		v->reply_len = 0;
+		return ((int)n);
+	default:
+		return (-1);
+	}
+}
+
+/* lend out the reply; it stays put until the next request */
+static int
+vauth_borrow(fido_dev_t *dev, uint8_t cmd, const unsigned char **ptr,
+    size_t *len, int ms)
+{
+	vauth_t *v = fido_dev_io_handle(dev);
+
+	if ((cmd != CTAP_CMD_CBOR && cmd != CTAP_CMD_MSG) ||
+	    v->reply_len == 0 || vauth_wait(v, ms) < 0)
+		return (-1);
+	*ptr = v->reply;
+	*len = v->reply_len;
+	v->reply_len = 0;
+
+	return (0);
+}
+
+static void
+vauth_release(fido_dev_t *dev, const unsigned char *ptr, size_t len)
+{
+	(void)dev;
+	(void)ptr;
+	(void)len;
+}
+
+vauth_t *
+vauth_new(void)
+{
+	vauth_t *v;
+
+	if ((v = calloc(1, sizeof(*v))) == NULL)
+		return (NULL);
+	v->magic = VAUTH_MAGIC;
+	snprintf(v->path, sizeof(v->path), "vauth:%p", (void *)v);
+	if (RAND_bytes(v->master, sizeof(v->master)) != 1 ||
+	    vauth_wipe(v) < 0) {
+		vauth_free(&v);
+		return (NULL);
+	}
+
+	return (v);
+}
+
+void
+vauth_free(vauth_t **v_p)
+{
+	vauth_t *v;
+
+	if (v_p == NULL || (v = *v_p) == NULL)
+		return;
+	for (size_t i = 0; i < v->nrk; i++)
+		rk_reset(&v->rk[i]);
+	token_reset(v);
+	EC_KEY_free(v->ka);
+	OPENSSL_cleanse(v, sizeof(*v));
+	free(v);
+	*v_p = NULL;
+}
+
+void
+vauth_set_seed(vauth_t *v, const unsigned char *seed, size_t len)
+{
+	SHA256(seed, len, v->master);
+	v->nonce_ctr = 0;
+	v->counter = 0;
+	(void)vauth_wipe(v);
+}
+
+void
+vauth_set_latency(vauth_t *v, int ms)
+{
+	v->latency_ms = ms;
+}
+
+void
+vauth_set_u2f_touch(vauth_t *v, int n)
+{
+	v->u2f_touch = n;
+	v->u2f_polls = 0;
+}
+
+void
+vauth_set_bad_user(vauth_t *v, int bad)
+{
+	v->bad_user = bad;
+}
+
+int
+vauth_dev_open(vauth_t *v, fido_dev_t *dev)
+{
+	fido_dev_io_t		io;
+	fido_dev_transport_t	t;
+	int			r;
+
+	io.open = vauth_open;
+	io.close = vauth_close;
+	io.read = vauth_read;
+	io.write = vauth_write;
+	t.rx = vauth_rx;
+	t.tx = vauth_tx;
+
+	if ((r = fido_dev_set_io_functions(dev, &io)) != FIDO_OK ||
+	    (r = fido_dev_set_transport_functions(dev, &t)) != FIDO_OK ||
+	    (r = fido_dev_set_transport_borrow(dev, vauth_borrow,
+	    vauth_release)) != FIDO_OK)
+		return (r);
+
+	return (fido_dev_open(dev, v->path));
+}
+
+const char *
+vauth_path(const vauth_t *v)
+{
+	return (v->path);
+}
+
+uint32_t
+vauth_counter(const vauth_t *v)
+{
+	return (v->counter);
+}
+
+size_t
+vauth_cmd_count(const vauth_t *v)
+{
+	return (v->ncmd);
+}
+
+size_t
+vauth_rk_count(const vauth_t *v)
+{
+	return (v->nrk);
+}
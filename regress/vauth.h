@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef _VAUTH_H
+#define _VAUTH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <fido.h>
+
+/*
+ * A virtual CTAP 2.1 authenticator, driven through a fido_dev_t's transport
+ * functions. It implements authenticatorGetInfo, MakeCredential,
+ * GetAssertion, GetNextAssertion, ClientPIN (protocols one and two),
+ * CredentialManagement, LargeBlobs and Reset, and U2F authenticate,
+ * without user presence or built-in user verification. Keys live in process memory; it is meant for
+ * tests and load generation only.
+ *
+ * An instance serves one open fido_dev_t at a time and is not thread-safe;
+ * concurrent callers use one instance each.
+ */
+
+typedef struct vauth vauth_t;
+
+vauth_t *vauth_new(void);
+void vauth_free(vauth_t **);
+
+/* derive credentials deterministically from seed, and wipe state */
+void vauth_set_seed(vauth_t *, const unsigned char *, size_t);
+/* delay each reply by ms milliseconds */
+void vauth_set_latency(vauth_t *, int);
+/* have u2f sign requests polled n times, as if for a touch */
+void vauth_set_u2f_touch(vauth_t *, int);
+/* if set, reply to assertions with malformed user entities */
+void vauth_set_bad_user(vauth_t *, int);
+
+/* point dev's i/o and transport functions at the instance, and open it */
+int vauth_dev_open(vauth_t *, fido_dev_t *);
+/* the path vauth_dev_open() opens */
+const char *vauth_path(const vauth_t *);
+
+uint32_t vauth_counter(const vauth_t *);
+size_t vauth_cmd_count(const vauth_t *);
+size_t vauth_rk_count(const vauth_t *);
+
+#endif /* !_VAUTH_H */
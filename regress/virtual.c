@@ -0,0 +1,1474 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#undef NDEBUG
+
+#include <openssl/sha.h>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cbor.h>
+
+#include <fido.h>
+#include <fido/credman.h>
+#include <fido/config.h>
+#include <fido/es256.h>
+#include <fido/loop.h>
+#include <fido/pool.h>
+
+#include "vauth.h"
+
+#define THROUGHPUT_NASSERT	2000
+#define LOOP_GROUP_NDEV		4
+
+static const unsigned char cdh[32] = {
+	0xec, 0x8d, 0x8f, 0x78, 0x42, 0x4a, 0x2b, 0xb7,
+	0x82, 0x34, 0xaa, 0xca, 0x07, 0xa1, 0xf6, 0x56,
+	0x42, 0x1c, 0xb6, 0xf6, 0xb3, 0x00, 0x86, 0x52,
+	0x35, 0x2d, 0xa2, 0x62, 0x4a, 0xbe, 0x89, 0x76,
+};
+
+static const unsigned char user_a[] = { 0x01, 0x02, 0x03, 0x04 };
+static const unsigned char user_b[] = { 0x05, 0x06, 0x07, 0x08 };
+
+static fido_dev_t *
+dev_open(vauth_t *v)
+{
+	fido_dev_t *dev;
+
+	assert((dev = fido_dev_new()) != NULL);
+	assert(vauth_dev_open(v, dev) == FIDO_OK);
+
+	return (dev);
+}
+
+static void
+dev_close(fido_dev_t **dev)
+{
+	assert(fido_dev_close(*dev) == FIDO_OK);
+	fido_dev_free(dev);
+}
+
+static fido_cred_t *
+cred_new(const char *rp, const unsigned char *user, size_t user_len,
+    const char *name, fido_opt_t rk)
+{
+	fido_cred_t *cred;
+
+	assert((cred = fido_cred_new()) != NULL);
+	assert(fido_cred_set_type(cred, COSE_ES256) == FIDO_OK);
+	assert(fido_cred_set_clientdata_hash(cred, cdh,
+	    sizeof(cdh)) == FIDO_OK);
+	assert(fido_cred_set_rp(cred, rp, NULL) == FIDO_OK);
+	assert(fido_cred_set_user(cred, user, user_len, name, NULL,
+	    NULL) == FIDO_OK);
+	assert(fido_cred_set_rk(cred, rk) == FIDO_OK);
+
+	return (cred);
+}
+
+static fido_assert_t *
+assert_new(const char *rp, const fido_cred_t *allow)
+{
+	fido_assert_t *a;
+
+	assert((a = fido_assert_new()) != NULL);
+	assert(fido_assert_set_clientdata_hash(a, cdh, sizeof(cdh)) == FIDO_OK);
+	assert(fido_assert_set_rp(a, rp) == FIDO_OK);
+	if (allow != NULL)
+		assert(fido_assert_allow_cred(a, fido_cred_id_ptr(allow),
+		    fido_cred_id_len(allow)) == FIDO_OK);
+
+	return (a);
+}
+
+static void
+assert_check(const fido_assert_t *a, size_t idx, const fido_cred_t *cred)
+{
+	es256_pk_t *pk;
+
+	assert((pk = es256_pk_new()) != NULL);
+	assert(es256_pk_from_ptr(pk, fido_cred_pubkey_ptr(cred),
+	    fido_cred_pubkey_len(cred)) == FIDO_OK);
+	assert(fido_assert_verify(a, idx, COSE_ES256, pk) == FIDO_OK);
+	es256_pk_free(&pk);
+}
+
+static char *
+b64url(const unsigned char *ptr, size_t len)
+{
+	static const char enc[] =
+	    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+	char *s;
+	size_t o = 0;
+	uint32_t v;
+
+	assert((s = malloc(len / 3 * 4 + 5)) != NULL);
+	for (size_t i = 0; i < len; i += 3) {
+		v = (uint32_t)ptr[i] << 16;
+		if (i + 1 < len)
+			v |= (uint32_t)ptr[i + 1] << 8;
+		if (i + 2 < len)
+			v |= ptr[i + 2];
+		s[o++] = enc[v >> 18];
+		s[o++] = enc[(v >> 12) & 0x3f];
+		if (i + 1 < len)
+			s[o++] = enc[(v >> 6) & 0x3f];
+		if (i + 2 < len)
+			s[o++] = enc[v & 0x3f];
+	}
+	s[o] = '\0';
+
+	return (s);
+}
+
+/* the bytes of a cbor byte string */
+static char *
+b64url_cbor_bytes(const unsigned char *ptr, size_t len)
+{
+	cbor_item_t *item;
+	struct cbor_load_result res;
+	char *s;
+
+	assert((item = cbor_load(ptr, len, &res)) != NULL);
+	assert(cbor_isa_bytestring(item));
+	s = b64url(cbor_bytestring_handle(item), cbor_bytestring_length(item));
+	cbor_decref(&item);
+
+	return (s);
+}
+
+static char *
+attobj_json(const fido_cred_t *cred, const char *cd)
+{
+	cbor_item_t *map, *attstmt, *authdata;
+	struct cbor_load_result res;
+	struct cbor_pair pair;
+	unsigned char *buf = NULL;
+	size_t buflen, n;
+	char *json, *attobj, *b64cd;
+
+	assert((attstmt = cbor_load(fido_cred_attstmt_ptr(cred),
+	    fido_cred_attstmt_len(cred), &res)) != NULL);
+	assert((authdata = cbor_load(fido_cred_authdata_ptr(cred),
+	    fido_cred_authdata_len(cred), &res)) != NULL);
+	assert((map = cbor_new_definite_map(3)) != NULL);
+	pair.key = cbor_move(cbor_build_string("fmt"));
+	pair.value = cbor_move(cbor_build_string(fido_cred_fmt(cred)));
+	assert(cbor_map_add(map, pair));
+	pair.key = cbor_move(cbor_build_string("attStmt"));
+	pair.value = cbor_move(attstmt);
+	assert(cbor_map_add(map, pair));
+	pair.key = cbor_move(cbor_build_string("authData"));
+	pair.value = cbor_move(authdata);
+	assert(cbor_map_add(map, pair));
+	assert((n = cbor_serialize_alloc(map, &buf, &buflen)) != 0);
+	cbor_decref(&map);
+
+	attobj = b64url(buf, n);
+	b64cd = b64url((const unsigned char *)cd, strlen(cd));
+	n = strlen(attobj) + strlen(b64cd) + 256;
+	assert((json = malloc(n)) != NULL);
+	assert(snprintf(json, n, "{\"type\":\"public-key\",\"response\":{"
+	    "\"clientDataJSON\":\"%s\",\"attestationObject\":\"%s\","
+	    "\"transports\":[\"usb\"],\"publicKeyAlgorithm\":%d}}", b64cd,
+	    attobj, fido_cred_type(cred)) < (int)n);
+	free(attobj);
+	free(b64cd);
+	free(buf);
+
+	return (json);
+}
+
+static char *
+assert_json(const fido_assert_t *a, const char *cd)
+{
+	char *json, *id, *b64cd, *authdata, *sig;
+	size_t n;
+
+	id = b64url(fido_assert_id_ptr(a, 0), fido_assert_id_len(a, 0));
+	b64cd = b64url((const unsigned char *)cd, strlen(cd));
+	authdata = b64url_cbor_bytes(fido_assert_authdata_ptr(a, 0),
+	    fido_assert_authdata_len(a, 0));
+	sig = b64url(fido_assert_sig_ptr(a, 0), fido_assert_sig_len(a, 0));
+	n = strlen(id) * 2 + strlen(b64cd) + strlen(authdata) + strlen(sig) +
+	    256;
+	assert((json = malloc(n)) != NULL);
+	assert(snprintf(json, n, "{\"id\":\"%s\",\"rawId\":\"%s\","
+	    "\"type\":\"public-key\",\"response\":{"
+	    "\"clientDataJSON\":\"%s\",\"authenticatorData\":\"%s\","
+	    "\"signature\":\"%s\",\"userHandle\":null},"
+	    "\"clientExtensionResults\":{}}", id, id, b64cd, authdata,
+	    sig) < (int)n);
+	free(id);
+	free(b64cd);
+	free(authdata);
+	free(sig);
+
+	return (json);
+}
+
+static void
+getinfo(void)
+{
+	vauth_t			*v;
+	fido_dev_t		*dev;
+	fido_cbor_info_t	*ci;
+
+	assert((v = vauth_new()) != NULL);
+	assert((ci = fido_cbor_info_new()) != NULL);
+	dev = dev_open(v);
+	assert(fido_dev_is_fido2(dev));
+	assert(fido_dev_supports_credman(dev));
+	assert(fido_dev_supports_permissions(dev));
+	assert(fido_dev_supports_pin(dev));
+	assert(fido_dev_has_pin(dev) == false);
+	assert(fido_dev_supports_uv(dev) == false);
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_OK);
+	assert(fido_cbor_info_versions_len(ci) == 2);
+	assert(fido_cbor_info_protocols_len(ci) == 2);
+	assert(fido_cbor_info_maxmsgsiz(ci) == 2048);
+	assert(fido_cbor_info_maxlargeblob(ci) == 4096);
+	assert(fido_cbor_info_algorithm_count(ci) == 1);
+	assert(fido_cbor_info_algorithm_cose(ci, 0) == COSE_ES256);
+	dev_close(&dev);
+	fido_cbor_info_free(&ci);
+	vauth_free(&v);
+}
+
+static void
+cred_assert(void)
+{
+	vauth_t		*v;
+	fido_dev_t	*dev;
+	fido_cred_t	*cred, *excl;
+	fido_assert_t	*a;
+
+	assert((v = vauth_new()) != NULL);
+	dev = dev_open(v);
+	cred = cred_new("example.com", user_a, sizeof(user_a), "a",
+	    FIDO_OPT_OMIT);
+	assert(fido_dev_make_cred(dev, cred, NULL) == FIDO_OK);
+	assert(fido_cred_verify_self(cred) == FIDO_OK);
+	assert(fido_cred_id_len(cred) == 32);
+	assert(vauth_rk_count(v) == 0);
+
+	/* with the credential in the allow list */
+	a = assert_new("example.com", cred);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+	assert(fido_assert_count(a) == 1);
+	assert(fido_assert_sigcount(a, 0) == 2);
+	assert(fido_assert_flags(a, 0) == 0x01);
+	assert_check(a, 0, cred);
+	fido_assert_free(&a);
+
+	/* bound to its rp, and not discoverable */
+	a = assert_new("example.org", cred);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_ERR_NO_CREDENTIALS);
+	fido_assert_free(&a);
+	a = assert_new("example.com", NULL);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_ERR_NO_CREDENTIALS);
+	fido_assert_free(&a);
+
+	/* no built-in uv */
+	a = assert_new("example.com", cred);
+	assert(fido_assert_set_uv(a, FIDO_OPT_TRUE) == FIDO_OK);
+	assert(fido_dev_get_assert(dev, a, NULL) != FIDO_OK);
+	fido_assert_free(&a);
+
+	excl = cred_new("example.com", user_b, sizeof(user_b), "b",
+	    FIDO_OPT_OMIT);
+	assert(fido_cred_exclude(excl, fido_cred_id_ptr(cred),
+	    fido_cred_id_len(cred)) == FIDO_OK);
+	assert(fido_dev_make_cred(dev, excl, NULL) ==
+	    FIDO_ERR_CREDENTIAL_EXCLUDED);
+
+	fido_cred_free(&excl);
+	fido_cred_free(&cred);
+	dev_close(&dev);
+	vauth_free(&v);
+}
+
+static void
+cred_list(void)
+{
+	vauth_t			*v;
+	fido_dev_t		*dev;
+	fido_cred_t		*cred, *excl;
+	fido_assert_t		*a;
+	fido_cred_list_t	*l;
+	unsigned char		 id[200];
+	size_t			 i;
+	int			 r = FIDO_ERR_NO_CREDENTIALS;
+
+	assert((v = vauth_new()) != NULL);
+	dev = dev_open(v);
+	cred = cred_new("example.com", user_a, sizeof(user_a), "a",
+	    FIDO_OPT_OMIT);
+	assert(fido_dev_make_cred(dev, cred, NULL) == FIDO_OK);
+
+	/* five unknown ids, the credential's, and one too long */
+	assert((l = fido_cred_list_new()) != NULL);
+	assert(fido_cred_list_batch_count(l) == 0);
+	assert(fido_cred_list_add(l, NULL, 0) == FIDO_ERR_INVALID_ARGUMENT);
+	for (i = 0; i < 5; i++) {
+		memset(id, (int)i + 1, 32);
+		assert(fido_cred_list_add(l, id, 32) == FIDO_OK);
+	}
+	assert(fido_cred_list_add(l, fido_cred_id_ptr(cred),
+	    fido_cred_id_len(cred)) == FIDO_OK);
+	memset(id, 0xff, sizeof(id));
+	assert(fido_cred_list_add(l, id, sizeof(id)) == FIDO_OK);
+	assert(fido_cred_list_len(l) == 7);
+	assert(fido_cred_list_batch_count(l) == 1);
+	assert(fido_cred_list_batch_len(l, 0) == 7);
+	assert(fido_cred_list_split(l, 2, 64) == FIDO_OK);
+	assert(fido_cred_list_batch_count(l) == 3);
+	assert(fido_cred_list_batch_len(l, 0) == 2);
+	assert(fido_cred_list_batch_len(l, 2) == 2);
+	assert(fido_cred_list_batch_len(l, 3) == 0);
+
+	/* the same assertion, tried with each batch in turn */
+	a = assert_new("example.com", NULL);
+	assert(fido_assert_set_allow_list(a, l, 3) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	for (i = 0; i < fido_cred_list_batch_count(l); i++) {
+		assert(fido_assert_set_allow_list(a, l, i) == FIDO_OK);
+		assert(fido_assert_allow_cred(a, id, 32) ==
+		    FIDO_ERR_INVALID_ARGUMENT);
+		if ((r = fido_dev_get_assert(dev, a, NULL)) !=
+		    FIDO_ERR_NO_CREDENTIALS)
+			break;
+	}
+	assert(r == FIDO_OK && i == 2);
+	assert(fido_assert_count(a) == 1);
+	assert(fido_assert_id_len(a, 0) == fido_cred_id_len(cred));
+	assert_check(a, 0, cred);
+	/* detached */
+	assert(fido_assert_set_allow_list(a, NULL, 0) == FIDO_OK);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_ERR_NO_CREDENTIALS);
+	assert(fido_assert_allow_cred(a, fido_cred_id_ptr(cred),
+	    fido_cred_id_len(cred)) == FIDO_OK);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+	fido_assert_free(&a);
+
+	/* as an exclude list */
+	excl = cred_new("example.com", user_b, sizeof(user_b), "b",
+	    FIDO_OPT_OMIT);
+	assert(fido_cred_set_exclude_list(excl, l, 2) == FIDO_OK);
+	assert(fido_dev_make_cred(dev, excl, NULL) ==
+	    FIDO_ERR_CREDENTIAL_EXCLUDED);
+	assert(fido_cred_set_exclude_list(excl, l, 0) == FIDO_OK);
+	assert(fido_dev_make_cred(dev, excl, NULL) == FIDO_OK);
+	fido_cred_free(&excl);
+
+	fido_cred_list_free(&l);
+	fido_cred_list_free(&l);
+	fido_cred_free(&cred);
+	dev_close(&dev);
+	vauth_free(&v);
+}
+
+/* the same list, added in bulk, copied and borrowed */
+static void
+cred_list_array(void)
+{
+	vauth_t			*v;
+	fido_dev_t		*dev;
+	fido_cred_t		*cred;
+	fido_assert_t		*a;
+	fido_cred_list_t	*l;
+	unsigned char		 id[6][32];
+	const unsigned char	*ptr[7];
+	size_t			 len[7];
+	size_t			 i;
+	int			 flags[] = { 0, FIDO_CRED_LIST_BORROW };
+
+	assert((v = vauth_new()) != NULL);
+	dev = dev_open(v);
+	cred = cred_new("example.com", user_a, sizeof(user_a), "a",
+	    FIDO_OPT_OMIT);
+	assert(fido_dev_make_cred(dev, cred, NULL) == FIDO_OK);
+
+	for (i = 0; i < 6; i++) {
+		memset(id[i], (int)i + 1, sizeof(id[i]));
+		ptr[i] = id[i];
+		len[i] = sizeof(id[i]);
+	}
+	ptr[6] = fido_cred_id_ptr(cred);
+	len[6] = fido_cred_id_len(cred);
+
+	for (size_t f = 0; f < sizeof(flags) / sizeof(flags[0]); f++) {
+		assert((l = fido_cred_list_new()) != NULL);
+		assert(fido_cred_list_add_array(l, NULL, NULL, 0,
+		    flags[f]) == FIDO_OK);
+		assert(fido_cred_list_add_array(l, NULL, len, 1,
+		    flags[f]) == FIDO_ERR_INVALID_ARGUMENT);
+		assert(fido_cred_list_add_array(l, ptr, len, 7,
+		    0x80) == FIDO_ERR_INVALID_ARGUMENT);
+		len[3] = 0;
+		assert(fido_cred_list_add_array(l, ptr, len, 7,
+		    flags[f]) == FIDO_ERR_INVALID_ARGUMENT);
+		assert(fido_cred_list_len(l) == 0);
+		len[3] = sizeof(id[3]);
+		/* one id first, so that the bulk ids follow it */
+		assert(fido_cred_list_add(l, ptr[0], len[0]) == FIDO_OK);
+		assert(fido_cred_list_add_array(l, ptr + 1, len + 1, 6,
+		    flags[f]) == FIDO_OK);
+		assert(fido_cred_list_len(l) == 7);
+		assert(fido_cred_list_split(l, 3, 0) == FIDO_OK);
+		assert(fido_cred_list_batch_count(l) == 3);
+		assert(fido_cred_list_batch_len(l, 2) == 1);
+		/* the copies do not depend on the caller's ids */
+		if (flags[f] == 0)
+			memset(id, 0, sizeof(id));
+		a = assert_new("example.com", NULL);
+		assert(fido_assert_set_allow_list(a, l, 1) == FIDO_OK);
+		assert(fido_dev_get_assert(dev, a, NULL) ==
+		    FIDO_ERR_NO_CREDENTIALS);
+		assert(fido_assert_set_allow_list(a, l, 2) == FIDO_OK);
+		assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+		assert_check(a, 0, cred);
+		fido_assert_free(&a);
+		fido_cred_list_free(&l);
+		for (i = 0; i < 6; i++)
+			memset(id[i], (int)i + 1, sizeof(id[i]));
+	}
+
+	fido_cred_free(&cred);
+	dev_close(&dev);
+	vauth_free(&v);
+}
+
+static void
+allow_batching(void)
+{
+	vauth_t		*v;
+	fido_dev_t	*dev;
+	fido_cred_t	*cred;
+	fido_assert_t	*a;
+	unsigned char	 id[64];
+	size_t		 ncmd;
+
+	assert((v = vauth_new()) != NULL);
+	dev = dev_open(v);
+	cred = cred_new("example.com", user_a, sizeof(user_a), "a",
+	    FIDO_OPT_OMIT);
+	assert(fido_dev_make_cred(dev, cred, NULL) == FIDO_OK);
+	assert(fido_cbor_info_maxcredcntlst(fido_dev_cbor_info(dev)) == 16);
+
+	/* 40 unknown ids, then the credential's, in three batches */
+	a = assert_new("example.com", NULL);
+	for (size_t i = 0; i < 40; i++) {
+		memset(id, (int)i + 1, 32);
+		assert(fido_assert_allow_cred(a, id, 32) == FIDO_OK);
+	}
+	assert(fido_assert_allow_cred(a, fido_cred_id_ptr(cred),
+	    fido_cred_id_len(cred)) == FIDO_OK);
+	/* longer than the authenticator takes */
+	memset(id, 0xff, sizeof(id));
+	assert(fido_assert_allow_cred(a, id, sizeof(id)) == FIDO_OK);
+	ncmd = vauth_cmd_count(v);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+	/* three silent requests, one with user presence */
+	assert(vauth_cmd_count(v) == ncmd + 4);
+	assert(fido_assert_count(a) == 1);
+	assert(fido_assert_flags(a, 0) == 0x01);
+	assert(fido_assert_id_len(a, 0) == fido_cred_id_len(cred));
+	assert_check(a, 0, cred);
+	fido_assert_free(&a);
+
+	/* none of the batches holds it */
+	a = assert_new("example.com", NULL);
+	for (size_t i = 0; i < 20; i++) {
+		memset(id, (int)i + 1, 32);
+		assert(fido_assert_allow_cred(a, id, 32) == FIDO_OK);
+	}
+	ncmd = vauth_cmd_count(v);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_ERR_NO_CREDENTIALS);
+	assert(vauth_cmd_count(v) == ncmd + 2);
+	fido_assert_free(&a);
+
+	/* only ids too long for the authenticator */
+	a = assert_new("example.com", NULL);
+	assert(fido_assert_allow_cred(a, id, sizeof(id)) == FIDO_OK);
+	ncmd = vauth_cmd_count(v);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_ERR_NO_CREDENTIALS);
+	assert(vauth_cmd_count(v) == ncmd);
+	fido_assert_free(&a);
+
+	fido_cred_free(&cred);
+	dev_close(&dev);
+	vauth_free(&v);
+}
+
+static void
+hmac_secrets(void)
+{
+	vauth_t		*v;
+	fido_dev_t	*dev;
+	fido_cred_t	*cred;
+	fido_assert_t	*a;
+	unsigned char	 salt[5 * 32], secret[5 * 32], uv_secret[5 * 32];
+	size_t		 ncmd;
+
+	assert((v = vauth_new()) != NULL);
+	dev = dev_open(v);
+	cred = cred_new("example.com", user_a, sizeof(user_a), "a",
+	    FIDO_OPT_OMIT);
+	assert(fido_dev_make_cred(dev, cred, NULL) == FIDO_OK);
+	for (size_t i = 0; i < sizeof(salt); i++)
+		salt[i] = (unsigned char)i;
+
+	/* one key agreement, then two salts per request */
+	a = assert_new("example.com", cred);
+	ncmd = vauth_cmd_count(v);
+	assert(fido_dev_get_hmac_secrets(dev, a, salt, sizeof(salt), secret,
+	    sizeof(secret), NULL) == FIDO_OK);
+	assert(vauth_cmd_count(v) == ncmd + 4);
+	assert(fido_assert_count(a) == 0);
+	fido_assert_free(&a);
+
+	/* the same outputs as one assertion per salt */
+	for (size_t i = 0; i < 5; i++) {
+		a = assert_new("example.com", cred);
+		assert(fido_assert_set_extensions(a,
+		    FIDO_EXT_HMAC_SECRET) == FIDO_OK);
+		assert(fido_assert_set_hmac_salt(a, &salt[i * 32],
+		    32) == FIDO_OK);
+		assert(fido_assert_set_up(a, FIDO_OPT_FALSE) == FIDO_OK);
+		assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+		assert(fido_assert_hmac_secret_len(a, 0) == 32);
+		assert(memcmp(fido_assert_hmac_secret_ptr(a, 0),
+		    &secret[i * 32], 32) == 0);
+		fido_assert_free(&a);
+	}
+
+	/* one credential, whole salts */
+	a = assert_new("example.com", NULL);
+	assert(fido_dev_get_hmac_secrets(dev, a, salt, sizeof(salt), secret,
+	    sizeof(secret), NULL) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_allow_cred(a, fido_cred_id_ptr(cred),
+	    fido_cred_id_len(cred)) == FIDO_OK);
+	assert(fido_dev_get_hmac_secrets(dev, a, salt, 48, secret, 48,
+	    NULL) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_get_hmac_secrets(dev, a, salt, 64, secret, 32,
+	    NULL) == FIDO_ERR_INVALID_ARGUMENT);
+	fido_assert_free(&a);
+
+	/* with a pin: one token for all requests, and other outputs */
+	assert(fido_dev_set_pin(dev, "1234", NULL) == FIDO_OK);
+	a = assert_new("example.com", cred);
+	ncmd = vauth_cmd_count(v);
+	assert(fido_dev_get_hmac_secrets(dev, a, salt, sizeof(salt),
+	    uv_secret, sizeof(uv_secret), "1234") == FIDO_OK);
+	assert(vauth_cmd_count(v) == ncmd + 5);
+	assert(memcmp(secret, uv_secret, sizeof(secret)) != 0);
+	assert(fido_dev_get_hmac_secrets(dev, a, salt, sizeof(salt),
+	    uv_secret, sizeof(uv_secret), "4321") == FIDO_ERR_PIN_INVALID);
+	fido_assert_free(&a);
+
+	fido_cred_free(&cred);
+	dev_close(&dev);
+	vauth_free(&v);
+}
+
+/* the hmac-secret salt of a prf input */
+static void
+prf_salt(const char *in, unsigned char salt[32])
+{
+	unsigned char	buf[64];
+	size_t		len = strlen(in);
+
+	assert(sizeof("WebAuthn PRF") + len <= sizeof(buf));
+	memcpy(buf, "WebAuthn PRF", sizeof("WebAuthn PRF"));
+	memcpy(buf + sizeof("WebAuthn PRF"), in, len);
+	assert(SHA256(buf, sizeof("WebAuthn PRF") + len, salt) == salt);
+}
+
+/* the hmac-secret output of cred for salt */
+static void
+hmac_output(fido_dev_t *dev, const fido_cred_t *cred,
+    const unsigned char salt[32], unsigned char out[32])
+{
+	fido_assert_t *a;
+
+	a = assert_new("example.com", cred);
+	assert(fido_assert_set_extensions(a, FIDO_EXT_HMAC_SECRET) == FIDO_OK);
+	assert(fido_assert_set_hmac_salt(a, salt, 32) == FIDO_OK);
+	assert(fido_assert_set_up(a, FIDO_OPT_FALSE) == FIDO_OK);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+	assert(fido_assert_hmac_secret_len(a, 0) == 32);
+	memcpy(out, fido_assert_hmac_secret_ptr(a, 0), 32);
+	fido_assert_free(&a);
+}
+
+static void
+prf(void)
+{
+	vauth_t		*v;
+	fido_dev_t	*dev;
+	fido_cred_t	*cred_a, *cred_b;
+	fido_assert_t	*a;
+	unsigned char	 salt[32], out_a[32], out_b[32], out_c[32];
+	size_t		 ncmd;
+
+	assert((v = vauth_new()) != NULL);
+	dev = dev_open(v);
+	cred_a = cred_new("example.com", user_a, sizeof(user_a), "a",
+	    FIDO_OPT_OMIT);
+	cred_b = cred_new("example.com", user_b, sizeof(user_b), "b",
+	    FIDO_OPT_OMIT);
+	assert(fido_dev_make_cred(dev, cred_a, NULL) == FIDO_OK);
+	assert(fido_dev_make_cred(dev, cred_b, NULL) == FIDO_OK);
+	prf_salt("first", salt);
+	hmac_output(dev, cred_a, salt, out_a);
+	prf_salt("second", salt);
+	hmac_output(dev, cred_a, salt, out_b);
+	prf_salt("b", salt);
+	hmac_output(dev, cred_b, salt, out_c);
+
+	/* eval, both inputs */
+	a = assert_new("example.com", cred_a);
+	assert(fido_assert_set_extensions(a, FIDO_EXT_HMAC_SECRET) == FIDO_OK);
+	assert(fido_assert_set_prf(a, NULL, 0, NULL, 0) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_assert_set_prf(a, (const unsigned char *)"first", 5,
+	    (const unsigned char *)"second", 6) == FIDO_OK);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+	assert(fido_assert_hmac_secret_len(a, 0) == 64);
+	assert(memcmp(fido_assert_hmac_secret_ptr(a, 0), out_a, 32) == 0);
+	assert(memcmp(fido_assert_hmac_secret_ptr(a, 0) + 32, out_b, 32) == 0);
+	fido_assert_free(&a);
+
+	/* evalByCredential: the authenticator is asked which it holds */
+	a = assert_new("example.com", cred_b);
+	assert(fido_assert_allow_cred(a, fido_cred_id_ptr(cred_a),
+	    fido_cred_id_len(cred_a)) == FIDO_OK);
+	assert(fido_assert_set_extensions(a, FIDO_EXT_HMAC_SECRET) == FIDO_OK);
+	assert(fido_assert_set_prf(a, (const unsigned char *)"first", 5,
+	    NULL, 0) == FIDO_OK);
+	assert(fido_assert_set_prf_cred(a, fido_cred_id_ptr(cred_b),
+	    fido_cred_id_len(cred_b), (const unsigned char *)"a", 1, NULL,
+	    0) == FIDO_OK);
+	/* replaced */
+	assert(fido_assert_set_prf_cred(a, fido_cred_id_ptr(cred_b),
+	    fido_cred_id_len(cred_b), (const unsigned char *)"b", 1, NULL,
+	    0) == FIDO_OK);
+	ncmd = vauth_cmd_count(v);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+	assert(vauth_cmd_count(v) == ncmd + 3);
+	assert(fido_assert_id_len(a, 0) == fido_cred_id_len(cred_b));
+	assert(fido_assert_hmac_secret_len(a, 0) == 32);
+	assert(memcmp(fido_assert_hmac_secret_ptr(a, 0), out_c, 32) == 0);
+	fido_assert_free(&a);
+
+	/* with a kept shared secret, one request per evaluation */
+	assert(fido_dev_set_ecdh_cache(dev, true) == FIDO_OK);
+	a = assert_new("example.com", cred_a);
+	assert(fido_assert_set_extensions(a, FIDO_EXT_HMAC_SECRET) == FIDO_OK);
+	assert(fido_assert_set_prf(a, (const unsigned char *)"first", 5,
+	    NULL, 0) == FIDO_OK);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+	ncmd = vauth_cmd_count(v);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+	assert(vauth_cmd_count(v) == ncmd + 1);
+	assert(memcmp(fido_assert_hmac_secret_ptr(a, 0), out_a, 32) == 0);
+	fido_assert_free(&a);
+
+	fido_cred_free(&cred_a);
+	fido_cred_free(&cred_b);
+	dev_close(&dev);
+	vauth_free(&v);
+}
+
+static void
+pin(void)
+{
+	vauth_t		*v;
+	fido_dev_t	*dev;
+	fido_cred_t	*cred;
+	int		 retries;
+
+	assert((v = vauth_new()) != NULL);
+	dev = dev_open(v);
+	assert(fido_dev_set_pin(dev, "123", NULL) ==
+	    FIDO_ERR_PIN_POLICY_VIOLATION);
+	assert(fido_dev_set_pin(dev, "1234", NULL) == FIDO_OK);
+	assert(fido_dev_set_pin(dev, "1234", NULL) == FIDO_ERR_NOT_ALLOWED);
+	assert(fido_dev_get_retry_count(dev, &retries) == FIDO_OK);
+	assert(retries == 8);
+	dev_close(&dev);
+
+	dev = dev_open(v);
+	assert(fido_dev_has_pin(dev));
+	cred = cred_new("example.com", user_a, sizeof(user_a), "a",
+	    FIDO_OPT_OMIT);
+	assert(fido_dev_make_cred(dev, cred, NULL) == FIDO_ERR_PIN_REQUIRED);
+	assert(fido_dev_make_cred(dev, cred, "4321") == FIDO_ERR_PIN_INVALID);
+	assert(fido_dev_get_retry_count(dev, &retries) == FIDO_OK);
+	assert(retries == 7);
+	assert(fido_dev_make_cred(dev, cred, "1234") == FIDO_OK);
+	assert(fido_dev_get_retry_count(dev, &retries) == FIDO_OK);
+	assert(retries == 8);
+	assert((fido_cred_flags(cred) & 0x04) != 0); /* uv */
+	assert(fido_cred_verify_self(cred) == FIDO_OK);
+
+	assert(fido_dev_set_pin(dev, "abcdef", "4321") == FIDO_ERR_PIN_INVALID);
+	assert(fido_dev_set_pin(dev, "abcdef", "1234") == FIDO_OK);
+	assert(fido_dev_make_cred(dev, cred, "1234") == FIDO_ERR_PIN_INVALID);
+	assert(fido_dev_make_cred(dev, cred, "abcdef") == FIDO_OK);
+
+	fido_cred_free(&cred);
+	dev_close(&dev);
+	vauth_free(&v);
+}
+
+static void
+resident(void)
+{
+	vauth_t			*v;
+	fido_dev_t		*dev;
+	fido_cred_t		*ca, *cb, *cc;
+	fido_assert_t		*a;
+	fido_credman_metadata_t	*meta;
+	fido_credman_rp_t	*rp;
+	fido_credman_rk_t	*rk;
+
+	assert((v = vauth_new()) != NULL);
+	assert((meta = fido_credman_metadata_new()) != NULL);
+	assert((rp = fido_credman_rp_new()) != NULL);
+	assert((rk = fido_credman_rk_new()) != NULL);
+	dev = dev_open(v);
+	assert(fido_dev_set_pin(dev, "1234", NULL) == FIDO_OK);
+
+	ca = cred_new("a.example", user_a, sizeof(user_a), "a", FIDO_OPT_TRUE);
+	cb = cred_new("a.example", user_b, sizeof(user_b), "b", FIDO_OPT_TRUE);
+	cc = cred_new("b.example", user_a, sizeof(user_a), "a", FIDO_OPT_TRUE);
+	assert(fido_dev_make_cred(dev, ca, "1234") == FIDO_OK);
+	assert(fido_dev_make_cred(dev, cb, "1234") == FIDO_OK);
+	assert(fido_dev_make_cred(dev, cc, "1234") == FIDO_OK);
+	assert(vauth_rk_count(v) == 3);
+
+	/* discoverable, most recent first */
+	a = assert_new("a.example", NULL);
+	assert(fido_dev_get_assert(dev, a, "1234") == FIDO_OK);
+	assert(fido_assert_count(a) == 2);
+	assert(fido_assert_user_id_len(a, 0) == sizeof(user_b));
+	assert(memcmp(fido_assert_user_id_ptr(a, 0), user_b,
+	    sizeof(user_b)) == 0);
+	assert(strcmp(fido_assert_user_name(a, 0), "b") == 0);
+	assert(strcmp(fido_assert_user_name(a, 1), "a") == 0);
+	assert_check(a, 0, cb);
+	assert_check(a, 1, ca);
+	/* reply fields may be replaced, and the assertion reused */
+	assert(fido_assert_set_sig(a, 1, fido_assert_sig_ptr(a, 0),
+	    fido_assert_sig_len(a, 0)) == FIDO_OK);
+	assert(fido_assert_sig_ptr(a, 1) != fido_assert_sig_ptr(a, 0));
+	assert_check(a, 0, cb);
+	assert(fido_dev_get_assert(dev, a, "1234") == FIDO_OK);
+	assert(fido_assert_count(a) == 2);
+	assert_check(a, 0, cb);
+	assert_check(a, 1, ca);
+	fido_assert_free(&a);
+	/* without uv, users are only identified by id */
+	a = assert_new("a.example", NULL);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+	assert(fido_assert_count(a) == 2);
+	assert(fido_assert_user_name(a, 0) == NULL);
+	fido_assert_free(&a);
+	/* a malformed user entity fails the assertion */
+	vauth_set_bad_user(v, 1);
+	a = assert_new("a.example", NULL);
+	assert(fido_dev_get_assert(dev, a,
+	    "1234") == FIDO_ERR_RX_INVALID_CBOR);
+	assert(fido_assert_count(a) == 0);
+	fido_assert_free(&a);
+	vauth_set_bad_user(v, 0);
+
+	assert(fido_credman_get_dev_metadata(dev, meta, "1234") == FIDO_OK);
+	assert(fido_credman_rk_existing(meta) == 3);
+	assert(fido_credman_rk_remaining(meta) == 61);
+	assert(fido_credman_get_dev_rp(dev, rp, "1234") == FIDO_OK);
+	assert(fido_credman_rp_count(rp) == 2);
+	assert(fido_credman_get_dev_rk(dev, "a.example", rk, "1234") ==
+	    FIDO_OK);
+	assert(fido_credman_rk_count(rk) == 2);
+	assert(fido_credman_get_dev_rk(dev, "c.example", rk, "1234") ==
+	    FIDO_ERR_NO_CREDENTIALS);
+
+	/* deleted credentials are gone, even when listed */
+	assert(fido_credman_del_dev_rk(dev, fido_cred_id_ptr(ca),
+	    fido_cred_id_len(ca), "1234") == FIDO_OK);
+	assert(fido_credman_del_dev_rk(dev, fido_cred_id_ptr(ca),
+	    fido_cred_id_len(ca), "1234") == FIDO_ERR_NO_CREDENTIALS);
+	assert(vauth_rk_count(v) == 2);
+	a = assert_new("a.example", ca);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_ERR_NO_CREDENTIALS);
+	fido_assert_free(&a);
+
+	/* a user's new credential replaces the old one */
+	assert(fido_dev_make_cred(dev, cb, "1234") == FIDO_OK);
+	assert(vauth_rk_count(v) == 2);
+	assert(fido_credman_get_dev_metadata(dev, meta, "1234") == FIDO_OK);
+	assert(fido_credman_rk_existing(meta) == 2);
+
+	fido_cred_free(&ca);
+	fido_cred_free(&cb);
+	fido_cred_free(&cc);
+	fido_credman_metadata_free(&meta);
+	fido_credman_rp_free(&rp);
+	fido_credman_rk_free(&rk);
+	dev_close(&dev);
+	vauth_free(&v);
+}
+
+static void
+largeblob(void)
+{
+	const unsigned char	 data[] = "hello, large blob";
+	vauth_t			*v;
+	fido_dev_t		*dev;
+	fido_cred_t		*cred;
+	unsigned char		*ptr = NULL;
+	size_t			 len = 0;
+
+	assert((v = vauth_new()) != NULL);
+	dev = dev_open(v);
+	assert(fido_dev_set_pin(dev, "1234", NULL) == FIDO_OK);
+	cred = cred_new("example.com", user_a, sizeof(user_a), "a",
+	    FIDO_OPT_TRUE);
+	assert(fido_cred_set_extensions(cred, FIDO_EXT_LARGEBLOB_KEY) ==
+	    FIDO_OK);
+	assert(fido_dev_make_cred(dev, cred, "1234") == FIDO_OK);
+	assert(fido_cred_largeblob_key_len(cred) == 32);
+
+	assert(fido_dev_largeblob_get(dev, fido_cred_largeblob_key_ptr(cred),
+	    32, &ptr, &len) == FIDO_ERR_NOTFOUND);
+	assert(fido_dev_largeblob_set(dev, fido_cred_largeblob_key_ptr(cred),
+	    32, data, sizeof(data), NULL) != FIDO_OK);
+	assert(fido_dev_largeblob_set(dev, fido_cred_largeblob_key_ptr(cred),
+	    32, data, sizeof(data), "1234") == FIDO_OK);
+	assert(fido_dev_largeblob_get(dev, fido_cred_largeblob_key_ptr(cred),
+	    32, &ptr, &len) == FIDO_OK);
+	assert(len == sizeof(data) && memcmp(ptr, data, len) == 0);
+	free(ptr);
+	ptr = NULL;
+	assert(fido_dev_largeblob_remove(dev, fido_cred_largeblob_key_ptr(cred),
+	    32, "1234") == FIDO_OK);
+	assert(fido_dev_largeblob_get(dev, fido_cred_largeblob_key_ptr(cred),
+	    32, &ptr, &len) == FIDO_ERR_NOTFOUND);
+
+	fido_cred_free(&cred);
+	dev_close(&dev);
+	vauth_free(&v);
+}
+
+static void
+largeblob_batch(void)
+{
+	const unsigned char	 data_a[] = "blob a", data_b[] = "blob b";
+	const unsigned char	 badkey[16] = { 0 };
+	const unsigned char	*key[3];
+	size_t			 key_len[3];
+	unsigned char		*ptr[3] = { NULL, NULL, NULL };
+	size_t			 len[3] = { 0, 0, 0 };
+	int			 result[3];
+	vauth_t			*v;
+	fido_dev_t		*dev;
+	fido_cred_t		*ca, *cb;
+
+	assert((v = vauth_new()) != NULL);
+	dev = dev_open(v);
+	assert(fido_dev_set_pin(dev, "1234", NULL) == FIDO_OK);
+	ca = cred_new("example.com", user_a, sizeof(user_a), "a",
+	    FIDO_OPT_TRUE);
+	cb = cred_new("example.com", user_b, sizeof(user_b), "b",
+	    FIDO_OPT_TRUE);
+	assert(fido_cred_set_extensions(ca, FIDO_EXT_LARGEBLOB_KEY) == FIDO_OK);
+	assert(fido_cred_set_extensions(cb, FIDO_EXT_LARGEBLOB_KEY) == FIDO_OK);
+	assert(fido_dev_make_cred(dev, ca, "1234") == FIDO_OK);
+	assert(fido_dev_make_cred(dev, cb, "1234") == FIDO_OK);
+
+	key[0] = fido_cred_largeblob_key_ptr(ca);
+	key[1] = fido_cred_largeblob_key_ptr(cb);
+	key[2] = badkey;
+	key_len[0] = key_len[1] = 32;
+	key_len[2] = sizeof(badkey);
+
+	assert(fido_dev_largeblob_get_batch(dev, key, key_len, 3, ptr, len,
+	    result) == FIDO_OK);
+	assert(result[0] == FIDO_ERR_NOTFOUND);
+	assert(result[1] == FIDO_ERR_NOTFOUND);
+	assert(result[2] == FIDO_ERR_INVALID_ARGUMENT);
+
+	assert(fido_dev_largeblob_set(dev, key[0], 32, data_a, sizeof(data_a),
+	    "1234") == FIDO_OK);
+	assert(fido_dev_largeblob_set(dev, key[1], 32, data_b, sizeof(data_b),
+	    "1234") == FIDO_OK);
+
+	/* twice, the second time through the index */
+	for (int i = 0; i < 2; i++) {
+		assert(fido_dev_largeblob_get_batch(dev, key, key_len, 3, ptr,
+		    len, result) == FIDO_OK);
+		assert(result[0] == FIDO_OK && result[1] == FIDO_OK);
+		assert(result[2] == FIDO_ERR_INVALID_ARGUMENT);
+		assert(len[0] == sizeof(data_a) &&
+		    memcmp(ptr[0], data_a, len[0]) == 0);
+		assert(len[1] == sizeof(data_b) &&
+		    memcmp(ptr[1], data_b, len[1]) == 0);
+		free(ptr[0]);
+		free(ptr[1]);
+		ptr[0] = ptr[1] = NULL;
+	}
+
+	fido_cred_free(&ca);
+	fido_cred_free(&cb);
+	dev_close(&dev);
+	vauth_free(&v);
+}
+
+static void
+reset(void)
+{
+	vauth_t		*v;
+	fido_dev_t	*dev;
+	fido_cred_t	*cred;
+	fido_assert_t	*a;
+
+	assert((v = vauth_new()) != NULL);
+	dev = dev_open(v);
+	cred = cred_new("example.com", user_a, sizeof(user_a), "a",
+	    FIDO_OPT_OMIT);
+	assert(fido_dev_make_cred(dev, cred, NULL) == FIDO_OK);
+	assert(fido_dev_set_pin(dev, "1234", NULL) == FIDO_OK);
+	assert(fido_dev_reset(dev) == FIDO_OK);
+	dev_close(&dev);
+
+	/* no pin, and no credentials */
+	dev = dev_open(v);
+	assert(fido_dev_has_pin(dev) == false);
+	a = assert_new("example.com", cred);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_ERR_NO_CREDENTIALS);
+	fido_assert_free(&a);
+
+	fido_cred_free(&cred);
+	dev_close(&dev);
+	vauth_free(&v);
+}
+
+static void
+seed(void)
+{
+	const unsigned char	 s[] = "regress";
+	vauth_t			*v1, *v2;
+	fido_dev_t		*d1, *d2;
+	fido_cred_t		*c1, *c2;
+
+	assert((v1 = vauth_new()) != NULL);
+	assert((v2 = vauth_new()) != NULL);
+	vauth_set_seed(v1, s, sizeof(s));
+	vauth_set_seed(v2, s, sizeof(s));
+	d1 = dev_open(v1);
+	d2 = dev_open(v2);
+	c1 = cred_new("example.com", user_a, sizeof(user_a), "a",
+	    FIDO_OPT_OMIT);
+	c2 = cred_new("example.com", user_a, sizeof(user_a), "a",
+	    FIDO_OPT_OMIT);
+	assert(fido_dev_make_cred(d1, c1, NULL) == FIDO_OK);
+	assert(fido_dev_make_cred(d2, c2, NULL) == FIDO_OK);
+	assert(fido_cred_id_len(c1) == fido_cred_id_len(c2));
+	assert(memcmp(fido_cred_id_ptr(c1), fido_cred_id_ptr(c2),
+	    fido_cred_id_len(c1)) == 0);
+	assert(fido_cred_pubkey_len(c1) == fido_cred_pubkey_len(c2));
+	assert(memcmp(fido_cred_pubkey_ptr(c1), fido_cred_pubkey_ptr(c2),
+	    fido_cred_pubkey_len(c1)) == 0);
+
+	fido_cred_free(&c1);
+	fido_cred_free(&c2);
+	dev_close(&d1);
+	dev_close(&d2);
+	vauth_free(&v1);
+	vauth_free(&v2);
+}
+
+static void
+latency(void)
+{
+	vauth_t			*v;
+	fido_dev_t		*dev;
+	fido_cbor_info_t	*ci;
+
+	assert((v = vauth_new()) != NULL);
+	assert((ci = fido_cbor_info_new()) != NULL);
+	dev = dev_open(v);
+	vauth_set_latency(v, 20);
+	assert(fido_dev_set_timeout(dev, 5) == FIDO_OK);
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_ERR_RX);
+	assert(fido_dev_set_timeout(dev, -1) == FIDO_OK);
+	assert(fido_dev_get_cbor_info(dev, ci) == FIDO_OK);
+	dev_close(&dev);
+	fido_cbor_info_free(&ci);
+	vauth_free(&v);
+}
+
+/* one request per assertion, and a fresh signature count each time */
+static void
+throughput(void)
+{
+	vauth_t		*v;
+	fido_dev_t	*dev;
+	fido_cred_t	*cred;
+	fido_assert_t	*a;
+	size_t		 ncmd;
+	uint32_t	 counter;
+
+	assert((v = vauth_new()) != NULL);
+	dev = dev_open(v);
+	cred = cred_new("example.com", user_a, sizeof(user_a), "a",
+	    FIDO_OPT_OMIT);
+	assert(fido_dev_make_cred(dev, cred, NULL) == FIDO_OK);
+	a = assert_new("example.com", cred);
+	ncmd = vauth_cmd_count(v);
+	counter = vauth_counter(v);
+	for (size_t i = 0; i < THROUGHPUT_NASSERT; i++) {
+		assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+		assert(fido_assert_sigcount(a, 0) == counter + i + 1);
+	}
+	assert(vauth_cmd_count(v) == ncmd + THROUGHPUT_NASSERT);
+	assert_check(a, 0, cred);
+
+	fido_assert_free(&a);
+	fido_cred_free(&cred);
+	dev_close(&dev);
+	vauth_free(&v);
+}
+
+/* status codes seen by u2f_keepalive(), and the count at which to cancel */
+struct u2f_ka {
+	int	n;
+	int	cancel;
+};
+
+static int
+u2f_keepalive(void *arg, int status, int elapsed_ms)
+{
+	struct u2f_ka *ka = arg;
+
+	assert(status == FIDO_KEEPALIVE_UPNEEDED);
+	assert(elapsed_ms >= 0);
+
+	return (++ka->n == ka->cancel);
+}
+
+static fido_assert_t *
+u2f_assert_new(const fido_cred_t *cred)
+{
+	fido_assert_t	*a;
+	unsigned char	 junk[32];
+
+	a = assert_new("example.com", NULL);
+	for (int i = 0; i < 6; i++) {
+		memset(junk, i, sizeof(junk));
+		if (i == 3 && cred != NULL)
+			assert(fido_assert_allow_cred(a, fido_cred_id_ptr(cred),
+			    fido_cred_id_len(cred)) == FIDO_OK);
+		else
+			assert(fido_assert_allow_cred(a, junk,
+			    sizeof(junk)) == FIDO_OK);
+	}
+
+	return (a);
+}
+
+/* the allow list is probed first; presence is only awaited on a match */
+static void
+u2f_assert(void)
+{
+	vauth_t		*v;
+	fido_dev_t	*dev;
+	fido_cred_t	*cred;
+	fido_assert_t	*a;
+	struct u2f_ka	 ka;
+	size_t		 ncmd;
+
+	assert((v = vauth_new()) != NULL);
+	dev = dev_open(v);
+	cred = cred_new("example.com", user_a, sizeof(user_a), "a",
+	    FIDO_OPT_OMIT);
+	assert(fido_dev_make_cred(dev, cred, NULL) == FIDO_OK);
+	fido_dev_force_u2f(dev);
+	memset(&ka, 0, sizeof(ka));
+	assert(fido_dev_set_keepalive_cb(dev, u2f_keepalive, &ka) == FIDO_OK);
+
+	/* six check-only requests, three polls, one signature */
+	vauth_set_u2f_touch(v, 3);
+	a = u2f_assert_new(cred);
+	ncmd = vauth_cmd_count(v);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+	assert(vauth_cmd_count(v) == ncmd + 6 + 4);
+	assert(ka.n == 3);
+	assert(fido_assert_count(a) == 1);
+	assert(fido_assert_id_len(a, 0) == fido_cred_id_len(cred));
+	assert(memcmp(fido_assert_id_ptr(a, 0), fido_cred_id_ptr(cred),
+	    fido_cred_id_len(cred)) == 0);
+	assert(fido_assert_flags(a, 0) == 0x01);
+	assert(fido_assert_sigcount(a, 0) == vauth_counter(v));
+	assert_check(a, 0, cred);
+
+	/* without user presence, existence only */
+	assert(fido_assert_set_up(a, FIDO_OPT_FALSE) == FIDO_OK);
+	ncmd = vauth_cmd_count(v);
+	assert(fido_dev_get_assert(dev, a, NULL) ==
+	    FIDO_ERR_USER_PRESENCE_REQUIRED);
+	assert(vauth_cmd_count(v) == ncmd + 6);
+	assert(fido_assert_count(a) == 1);
+	fido_assert_free(&a);
+
+	/* the keepalive callback gives up */
+	vauth_set_u2f_touch(v, 3);
+	ka.n = 0;
+	ka.cancel = 2;
+	a = u2f_assert_new(cred);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_ERR_KEEPALIVE_CANCEL);
+	assert(ka.n == 2);
+	fido_assert_free(&a);
+
+	/* the wait for presence is bounded by FIDO_TIMEOUT_UP */
+	vauth_set_u2f_touch(v, 1000);
+	ka.cancel = 0;
+	assert(fido_dev_set_cmd_timeout(dev, FIDO_TIMEOUT_UP, 50) == FIDO_OK);
+	a = u2f_assert_new(cred);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_ERR_RX);
+	fido_assert_free(&a);
+
+	/* no handle of ours */
+	a = u2f_assert_new(NULL);
+	ncmd = vauth_cmd_count(v);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_ERR_NO_CREDENTIALS);
+	assert(vauth_cmd_count(v) == ncmd + 6);
+	fido_assert_free(&a);
+
+	fido_cred_free(&cred);
+	dev_close(&dev);
+	vauth_free(&v);
+}
+
+/* devices provisioned in parallel, each from scratch */
+static void
+provision(void)
+{
+	vauth_t			*v[4];
+	fido_dev_t		*dev[4];
+	fido_cred_t		*cred[4];
+	fido_provision_t	*p;
+	int			 result[4];
+
+	assert((p = fido_provision_new()) != NULL);
+	assert(fido_provision_set_reset(p, true) == FIDO_OK);
+	assert(fido_provision_set_pin(p, "1234") == FIDO_OK);
+	assert(fido_provision_set_pin_minlen(p, 256) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	for (size_t i = 0; i < 4; i++) {
+		assert((v[i] = vauth_new()) != NULL);
+		dev[i] = dev_open(v[i]);
+		cred[i] = cred_new("example.com", user_a, sizeof(user_a), "a",
+		    FIDO_OPT_OMIT);
+		result[i] = -1;
+	}
+	assert(fido_dev_provision_batch(dev, 4, p, cred, result) == FIDO_OK);
+	for (size_t i = 0; i < 4; i++) {
+		assert(result[i] == FIDO_OK);
+		assert((fido_cred_flags(cred[i]) & 0x04) != 0); /* uv */
+		assert(fido_cred_verify_self(cred[i]) == FIDO_OK);
+		assert(fido_dev_make_cred(dev[i], cred[i],
+		    NULL) == FIDO_ERR_PIN_REQUIRED);
+	}
+
+	/* no authenticatorConfig here; the pin is already set */
+	assert(fido_provision_set_reset(p, false) == FIDO_OK);
+	assert(fido_provision_set_pin_minlen(p, 6) == FIDO_OK);
+	assert(fido_dev_provision(dev[0], p, NULL) ==
+	    FIDO_ERR_INVALID_COMMAND);
+
+	for (size_t i = 0; i < 4; i++) {
+		fido_cred_free(&cred[i]);
+		dev_close(&dev[i]);
+		vauth_free(&v[i]);
+	}
+	fido_provision_free(&p);
+	assert(p == NULL);
+}
+
+/* a liveness check is a single exchange */
+static void
+ping(void)
+{
+	vauth_t		*v;
+	fido_dev_t	*dev;
+	size_t		 ncmd;
+
+	assert((v = vauth_new()) != NULL);
+	dev = dev_open(v);
+	ncmd = vauth_cmd_count(v);
+	assert(fido_dev_ping(dev, 100) == FIDO_OK);
+	assert(vauth_cmd_count(v) == ncmd + 1);
+	assert(fido_dev_close(dev) == FIDO_OK);
+	assert(fido_dev_ping(dev, 100) == FIDO_ERR_INVALID_ARGUMENT);
+	fido_dev_free(&dev);
+	vauth_free(&v);
+}
+
+/* devices are lent out in turn, and reopened after a transport error */
+static void
+pool(void)
+{
+	vauth_t		*v[2];
+	fido_dev_t	*dev[2], *a, *b, *c;
+	fido_dev_pool_t	*p;
+	size_t		 ncmd;
+
+	assert((p = fido_dev_pool_new()) != NULL);
+	assert(fido_dev_pool_get(p, &a, 0) == FIDO_ERR_NOTFOUND);
+	for (size_t i = 0; i < 2; i++) {
+		assert((v[i] = vauth_new()) != NULL);
+		dev[i] = dev_open(v[i]);
+		assert(fido_dev_pool_add(p, dev[i],
+		    vauth_path(v[i])) == FIDO_OK);
+	}
+	assert(fido_dev_pool_add(p, dev[0], vauth_path(v[0])) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_pool_len(p) == 2);
+	assert(fido_dev_pool_idle(p) == 2);
+
+	assert(fido_dev_pool_get(p, &a, 0) == FIDO_OK);
+	assert(fido_dev_pool_get(p, &b, 0) == FIDO_OK);
+	assert(a == dev[0] && b == dev[1]);
+	assert(fido_dev_pool_get(p, &c, 0) == FIDO_ERR_TIMEOUT);
+	assert(c == NULL);
+	assert(fido_dev_pool_get(p, &c, 10) == FIDO_ERR_TIMEOUT);
+	assert(fido_dev_pool_idle(p) == 0);
+
+	/* no reopen after a status from the authenticator */
+	ncmd = vauth_cmd_count(v[0]);
+	assert(fido_dev_pool_put(p, a, FIDO_ERR_PIN_INVALID) == FIDO_OK);
+	assert(fido_dev_pool_put(p, a, FIDO_OK) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_dev_pool_get(p, &c, 0) == FIDO_OK);
+	assert(c == a);
+	assert(vauth_cmd_count(v[0]) == ncmd);
+
+	/* reopened, and so asked for its info again */
+	assert(fido_dev_pool_put(p, a, FIDO_ERR_RX) == FIDO_OK);
+	assert(fido_dev_pool_get(p, &c, 0) == FIDO_OK);
+	assert(c == a);
+	assert(vauth_cmd_count(v[0]) == ncmd + 1);
+	assert(fido_dev_is_fido2(c));
+
+	assert(fido_dev_pool_put(p, a, FIDO_OK) == FIDO_OK);
+	assert(fido_dev_pool_put(p, b, FIDO_OK) == FIDO_OK);
+	assert(fido_dev_pool_idle(p) == 2);
+	assert(fido_dev_pool_check(p) == FIDO_OK);
+	assert(fido_dev_pool_idle(p) == 2);
+
+	fido_dev_pool_free(&p);
+	assert(p == NULL);
+	for (size_t i = 0; i < 2; i++)
+		vauth_free(&v[i]);
+}
+
+static void
+loop_group_cb(fido_dev_t *dev, void *cookie, int r)
+{
+	(void)dev;
+
+	*(int *)cookie = r;
+}
+
+static void
+loop_group(void)
+{
+	vauth_t			*v[LOOP_GROUP_NDEV];
+	fido_dev_t		*dev[LOOP_GROUP_NDEV];
+	fido_cred_t		*cred[LOOP_GROUP_NDEV];
+	fido_assert_t		*a[LOOP_GROUP_NDEV];
+	int			 r[LOOP_GROUP_NDEV];
+	fido_loop_group_t	*g;
+
+	assert(fido_loop_group_new(257) == NULL);
+	assert((g = fido_loop_group_new(2)) != NULL);
+	assert(fido_loop_group_pending(g) == 0);
+	assert(fido_loop_group_wait(g, 0) == FIDO_OK);
+
+	for (size_t i = 0; i < LOOP_GROUP_NDEV; i++) {
+		assert((v[i] = vauth_new()) != NULL);
+		dev[i] = dev_open(v[i]);
+		cred[i] = cred_new("example.com", user_a, sizeof(user_a), "a",
+		    FIDO_OPT_OMIT);
+		r[i] = -1;
+		assert(fido_loop_group_add_cred(g, dev[i], cred[i], NULL,
+		    loop_group_cb, &r[i]) == FIDO_OK);
+	}
+	assert(fido_loop_group_add_cred(g, dev[0], NULL, NULL, loop_group_cb,
+	    NULL) == FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_loop_group_wait(g, -1) == FIDO_OK);
+	assert(fido_loop_group_pending(g) == 0);
+
+	for (size_t i = 0; i < LOOP_GROUP_NDEV; i++) {
+		assert(r[i] == FIDO_OK);
+		assert(fido_cred_verify_self(cred[i]) == FIDO_OK);
+		a[i] = assert_new("example.com", cred[i]);
+		r[i] = -1;
+		assert(fido_loop_group_add_assert(g, dev[i], a[i], NULL,
+		    loop_group_cb, &r[i]) == FIDO_OK);
+	}
+	assert(fido_loop_group_wait(g, -1) == FIDO_OK);
+
+	for (size_t i = 0; i < LOOP_GROUP_NDEV; i++) {
+		assert(r[i] == FIDO_OK);
+		assert_check(a[i], 0, cred[i]);
+		fido_assert_free(&a[i]);
+		fido_cred_free(&cred[i]);
+		dev_close(&dev[i]);
+		vauth_free(&v[i]);
+	}
+
+	fido_loop_group_free(&g);
+	assert(g == NULL);
+	fido_loop_group_free(&g);
+}
+
+static void
+webauthn_json(void)
+{
+	static const char create[] = "{\"type\":\"webauthn.create\","
+	    "\"challenge\":\"AAEC\",\"origin\":\"https://example.com\"}";
+	static const char get[] = "{\"type\":\"webauthn.get\","
+	    "\"challenge\":\"AwQF\",\"origin\":\"https://example.com\"}";
+	vauth_t		*v;
+	fido_dev_t	*dev;
+	fido_cred_t	*cred, *c;
+	fido_assert_t	*a, *b;
+	es256_pk_t	*pk;
+	char		*json;
+
+	assert((v = vauth_new()) != NULL);
+	dev = dev_open(v);
+
+	assert((cred = fido_cred_new()) != NULL);
+	assert(fido_cred_set_type(cred, COSE_ES256) == FIDO_OK);
+	assert(fido_cred_set_clientdata(cred, (const unsigned char *)create,
+	    strlen(create)) == FIDO_OK);
+	assert(fido_cred_set_rp(cred, "example.com", NULL) == FIDO_OK);
+	assert(fido_cred_set_user(cred, user_a, sizeof(user_a), "a", NULL,
+	    NULL) == FIDO_OK);
+	assert(fido_dev_make_cred(dev, cred, NULL) == FIDO_OK);
+
+	/* the type comes from publicKeyAlgorithm */
+	json = attobj_json(cred, create);
+	assert((c = fido_cred_new()) != NULL);
+	assert(fido_cred_set_rp(c, "example.com", NULL) == FIDO_OK);
+	assert(fido_cred_from_webauthn_json(c, json, strlen(json)) == FIDO_OK);
+	assert(fido_cred_type(c) == COSE_ES256);
+	assert(strcmp(fido_cred_fmt(c), fido_cred_fmt(cred)) == 0);
+	assert(fido_cred_id_len(c) == fido_cred_id_len(cred));
+	assert(memcmp(fido_cred_id_ptr(c), fido_cred_id_ptr(cred),
+	    fido_cred_id_len(c)) == 0);
+	assert(fido_cred_pubkey_len(c) == fido_cred_pubkey_len(cred));
+	assert(memcmp(fido_cred_pubkey_ptr(c), fido_cred_pubkey_ptr(cred),
+	    fido_cred_pubkey_len(c)) == 0);
+	assert(fido_cred_clientdata_hash_len(c) ==
+	    fido_cred_clientdata_hash_len(cred));
+	assert(memcmp(fido_cred_clientdata_hash_ptr(c),
+	    fido_cred_clientdata_hash_ptr(cred),
+	    fido_cred_clientdata_hash_len(c)) == 0);
+	assert(fido_cred_verify_self(c) == FIDO_OK);
+	fido_cred_free(&c);
+
+	/* a type that disagrees with the attested key */
+	assert((c = fido_cred_new()) != NULL);
+	assert(fido_cred_set_type(c, COSE_RS256) == FIDO_OK);
+	assert(fido_cred_from_webauthn_json(c, json, strlen(json)) ==
+	    FIDO_ERR_INVALID_ARGUMENT);
+	assert(fido_cred_authdata_len(c) == 0);
+	assert(fido_cred_fmt(c) == NULL);
+	fido_cred_free(&c);
+	free(json);
+
+	assert((a = fido_assert_new()) != NULL);
+	assert(fido_assert_set_clientdata(a, (const unsigned char *)get,
+	    strlen(get)) == FIDO_OK);
+	assert(fido_assert_set_rp(a, "example.com") == FIDO_OK);
+	assert(fido_assert_allow_cred(a, fido_cred_id_ptr(cred),
+	    fido_cred_id_len(cred)) == FIDO_OK);
+	assert(fido_dev_get_assert(dev, a, NULL) == FIDO_OK);
+
+	json = assert_json(a, get);
+	assert((b = fido_assert_new()) != NULL);
+	assert(fido_assert_set_rp(b, "example.com") == FIDO_OK);
+	assert(fido_assert_from_webauthn_json(b, json, strlen(json)) ==
+	    FIDO_OK);
+	assert(fido_assert_count(b) == 1);
+	assert(fido_assert_id_len(b, 0) == fido_cred_id_len(cred));
+	assert(memcmp(fido_assert_id_ptr(b, 0), fido_cred_id_ptr(cred),
+	    fido_cred_id_len(cred)) == 0);
+	assert_check(b, 0, cred);
+	fido_assert_free(&b);
+	free(json);
+
+	/* the signature does not cover another clientDataJSON */
+	json = assert_json(a, create);
+	assert((b = fido_assert_new()) != NULL);
+	assert(fido_assert_set_rp(b, "example.com") == FIDO_OK);
+	assert(fido_assert_from_webauthn_json(b, json, strlen(json)) ==
+	    FIDO_OK);
+	assert((pk = es256_pk_new()) != NULL);
+	assert(es256_pk_from_ptr(pk, fido_cred_pubkey_ptr(cred),
+	    fido_cred_pubkey_len(cred)) == FIDO_OK);
+	assert(fido_assert_verify(b, 0, COSE_ES256, pk) ==
+	    FIDO_ERR_INVALID_SIG);
+	es256_pk_free(&pk);
+	fido_assert_free(&b);
+	free(json);
+	fido_assert_free(&a);
+
+	fido_cred_free(&cred);
+	dev_close(&dev);
+	vauth_free(&v);
+}
+
+int
+main(void)
+{
+	fido_init(0);
+
+	getinfo();
+	cred_assert();
+	cred_list();
+	cred_list_array();
+	allow_batching();
+	hmac_secrets();
+	prf();
+	pin();
+	resident();
+	largeblob();
+	largeblob_batch();
+	reset();
+	seed();
+	latency();
+	throughput();
+	u2f_assert();
+	provision();
+	ping();
+	pool();
+	loop_group();
+	webauthn_json();
+
+	exit(0);
+}
@@ -26,12 +26,14 @@ aes256_cbc(const fido_blob_t *key, const u_char *iv, const fido_blob_t *in,
 		goto fail;
 	}
 	out->len = in->len;
-	if ((out->ptr = calloc(1, out->len)) == NULL) {
+	/* decrypted tokens and pins */
+	if ((out->ptr = encrypt ? fido_calloc(1, out->len) :
+	    fido_secure_alloc(out->len)) == NULL) {
 		fido_log_debug("%s: calloc", __func__);
 		goto fail;
 	}
 	if ((ctx = EVP_CIPHER_CTX_new()) == NULL ||
-	    (cipher = EVP_aes_256_cbc()) == NULL) {
+	    (cipher = fido_evp_aes_256_cbc()) == NULL) {
 		fido_log_debug("%s: EVP_CIPHER_CTX_new", __func__);
 		goto fail;
 	}
@@ -96,8 +98,8 @@ aes256_cbc_fips(const fido_blob_t *secret, const fido_blob_t *in,
 	if (aes256_cbc(&key, iv, &cin, &cout, encrypt) < 0)
 		return -1;
 	if (encrypt) {
-		if (cout.len > SIZE_MAX - sizeof(iv) ||
-		    (out->ptr = calloc(1, sizeof(iv) + cout.len)) == NULL) {
+		if (cout.len > SIZE_MAX - sizeof(iv) || (out->ptr =
+		    fido_calloc(1, sizeof(iv) + cout.len)) == NULL) {
 			fido_blob_reset(&cout);
 			return -1;
 		}
@@ -134,12 +136,12 @@ aes256_gcm(const fido_blob_t *key, const fido_blob_t *nonce,
 	}
 	/* add tag to (on encrypt) or trim tag from the output (on decrypt) */
 	out->len = encrypt ? in->len + 16 : in->len - 16;
-	if ((out->ptr = calloc(1, out->len)) == NULL) {
+	if ((out->ptr = fido_calloc(1, out->len)) == NULL) {
 		fido_log_debug("%s: calloc", __func__);
 		goto fail;
 	}
 	if ((ctx = EVP_CIPHER_CTX_new()) == NULL ||
-	    (cipher = EVP_aes_256_gcm()) == NULL) {
+	    (cipher = fido_evp_aes_256_gcm()) == NULL) {
 		fido_log_debug("%s: EVP_CIPHER_CTX_new", __func__);
 		goto fail;
 	}
@@ -214,3 +216,68 @@ aes256_gcm_dec(const fido_blob_t *key, const fido_blob_t *nonce,
 {
 	return aes256_gcm(key, nonce, aad, in, out, 0);
 }
+
+/*
+ * AES-256-GCM encryption of data produced piece by piece, such as the
+ * output of deflate, in place. aes256_gcm_enc_end() writes the 16-byte
+ * mac tag; the context is then freed by the caller.
+ */
+EVP_CIPHER_CTX *
+aes256_gcm_enc_begin(const fido_blob_t *key, const fido_blob_t *nonce,
+    const fido_blob_t *aad)
+{
+	EVP_CIPHER_CTX *ctx = NULL;
+	const EVP_CIPHER *cipher;
+
+	if (nonce->len != 12 || key->len != 32 || aad->len > UINT_MAX) {
+		fido_log_debug("%s: invalid params %zu, %zu, %zu", __func__,
+		    nonce->len, key->len, aad->len);
+		return NULL;
+	}
+	if ((ctx = EVP_CIPHER_CTX_new()) == NULL ||
+	    (cipher = fido_evp_aes_256_gcm()) == NULL) {
+		fido_log_debug("%s: EVP_CIPHER_CTX_new", __func__);
+		goto fail;
+	}
+	if (EVP_CipherInit(ctx, cipher, key->ptr, nonce->ptr, 1) == 0 ||
+	    EVP_Cipher(ctx, NULL, aad->ptr, (u_int)aad->len) < 0) {
+		fido_log_debug("%s: EVP_CipherInit", __func__);
+		goto fail;
+	}
+
+	return ctx;
+fail:
+	if (ctx != NULL)
+		EVP_CIPHER_CTX_free(ctx);
+
+	return NULL;
+}
+
+int
+aes256_gcm_enc_update(EVP_CIPHER_CTX *ctx, u_char *ptr, size_t len)
+{
+	if (len == 0)
+		return 0;
+	if (len > UINT_MAX) {
+		fido_log_debug("%s: invalid input len %zu", __func__, len);
+		return -1;
+	}
+	if (EVP_Cipher(ctx, ptr, ptr, (u_int)len) < 0) {
+		fido_log_debug("%s: EVP_Cipher", __func__);
+		return -1;
+	}
+
+	return 0;
+}
+
+int
+aes256_gcm_enc_end(EVP_CIPHER_CTX *ctx, u_char *tag)
+{
+	if (EVP_Cipher(ctx, NULL, NULL, 0) < 0 ||
+	    EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, 16, tag) == 0) {
+		fido_log_debug("%s: EVP_Cipher", __func__);
+		return -1;
+	}
+
+	return 0;
+}
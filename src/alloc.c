@@ -0,0 +1,696 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#include <stdarg.h>
+#include <stdio.h>
+
+#include "fido.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/*
+ * Every allocation made by libfido2, and by libcbor on its behalf, goes
+ * through these hooks; NULL stands for the C library's. They are
+ * process-wide and may only be changed while no libfido2 objects are
+ * alive.
+ */
+static fido_malloc_t	*alloc_malloc;
+static fido_realloc_t	*alloc_realloc;
+static fido_free_t	*alloc_free;
+
+#if defined(CBOR_CUSTOM_ALLOC) || CBOR_MAJOR_VERSION > 0 || \
+    CBOR_MINOR_VERSION >= 10
+#define HAVE_CBOR_SET_ALLOCS
+#endif
+
+/*
+ * With statistics enabled, every block is preceded by a header holding
+ * its size and class; see fido_set_mem_stats(). The last entry of
+ * mem_stats[] sums the others.
+ */
+#define MEM_HDRLEN	16
+
+struct mem_hdr {
+	size_t	size;  /* as requested */
+	int	class; /* FIDO_MEM_* */
+};
+
+#define MEM_NONE	SIZE_MAX /* no block; see mem_count() */
+
+struct mem_stats {
+	uint64_t	allocs;
+	uint64_t	frees;
+	size_t		live;
+	size_t		peak;
+};
+
+static bool		mem_enabled;
+static struct mem_stats	mem_stats[FIDO_MEM_NCLASSES + 1];
+
+#if defined(HAVE_PTHREAD)
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+#define MEM_LOCK()	pthread_mutex_lock(&mem_lock)
+#define MEM_UNLOCK()	pthread_mutex_unlock(&mem_lock)
+#elif defined(_WIN32)
+static SRWLOCK mem_lock = SRWLOCK_INIT;
+#define MEM_LOCK()	AcquireSRWLockExclusive(&mem_lock)
+#define MEM_UNLOCK()	ReleaseSRWLockExclusive(&mem_lock)
+#else
+#define MEM_LOCK()	do { } while (0)
+#define MEM_UNLOCK()	do { } while (0)
+#endif
+
+#ifdef HAVE_CBOR_SET_ALLOCS
+static void *mem_cbor_malloc(size_t);
+static void *mem_cbor_realloc(void *, size_t);
+static void mem_cbor_free(void *);
+#endif
+
+/* point libcbor at the allocator in effect */
+static int
+alloc_set_cbor(void)
+{
+#ifdef HAVE_CBOR_SET_ALLOCS
+	if (mem_enabled)
+		cbor_set_allocs(mem_cbor_malloc, mem_cbor_realloc,
+		    mem_cbor_free);
+	else if (alloc_malloc != NULL)
+		cbor_set_allocs(alloc_malloc, alloc_realloc, alloc_free);
+	else
+		cbor_set_allocs(malloc, realloc, free);
+
+	return (0);
+#else
+	if (mem_enabled || alloc_malloc != NULL) {
+		fido_log_debug("%s: libcbor without custom allocators",
+		    __func__);
+		return (-1);
+	}
+
+	return (0);
+#endif
+}
+
+int
+fido_set_allocator(fido_malloc_t *m, fido_realloc_t *r, fido_free_t *f)
+{
+	fido_malloc_t	*old_m = alloc_malloc;
+	fido_realloc_t	*old_r = alloc_realloc;
+	fido_free_t	*old_f = alloc_free;
+
+	if ((m == NULL) != (r == NULL) || (m == NULL) != (f == NULL))
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	alloc_malloc = m;
+	alloc_realloc = r;
+	alloc_free = f;
+	if (alloc_set_cbor() < 0) {
+		alloc_malloc = old_m;
+		alloc_realloc = old_r;
+		alloc_free = old_f;
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	return (FIDO_OK);
+}
+
+/*
+ * A heap in a single region supplied by the caller, for hosts where
+ * memory may not be obtained after boot. Blocks are carved first-fit
+ * out of the region, each preceded by a header holding its size and
+ * that of the block before it, so that a freed block is merged with
+ * free neighbours at once. Sizes are multiples of HEAP_ALIGN; the low
+ * bit of a size marks a block in use.
+ */
+#define HEAP_ALIGN	16
+#define HEAP_USED	((size_t)1)
+#define HEAP_HDRLEN	HEAP_ALIGN
+
+struct heap_hdr {
+	size_t	size; /* of the block, header included */
+	size_t	prev; /* size of the block before, or 0 */
+};
+
+static struct {
+	unsigned char	*base;
+	size_t		 len;
+	size_t		 inuse; /* bytes in blocks in use, headers included */
+	size_t		 peak;  /* most bytes ever in use */
+} heap;
+
+#if defined(HAVE_PTHREAD)
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+#define HEAP_LOCK()	pthread_mutex_lock(&heap_lock)
+#define HEAP_UNLOCK()	pthread_mutex_unlock(&heap_lock)
+#elif defined(_WIN32)
+static SRWLOCK heap_lock = SRWLOCK_INIT;
+#define HEAP_LOCK()	AcquireSRWLockExclusive(&heap_lock)
+#define HEAP_UNLOCK()	ReleaseSRWLockExclusive(&heap_lock)
+#else
+#define HEAP_LOCK()	do { } while (0)
+#define HEAP_UNLOCK()	do { } while (0)
+#endif
+
+static struct heap_hdr *
+heap_hdr(size_t off)
+{
+	return ((struct heap_hdr *)(void *)(heap.base + off));
+}
+
+static size_t
+heap_off(const struct heap_hdr *h)
+{
+	return ((size_t)((const unsigned char *)h - heap.base));
+}
+
+static bool
+heap_owns(const void *ptr)
+{
+	const unsigned char *p = ptr;
+
+	return (p >= heap.base + HEAP_HDRLEN && p < heap.base + heap.len);
+}
+
+/* point the block after h, if any, back at h */
+static void
+heap_link(const struct heap_hdr *h)
+{
+	size_t next = heap_off(h) + (h->size & ~HEAP_USED);
+
+	if (next < heap.len)
+		heap_hdr(next)->prev = h->size & ~HEAP_USED;
+}
+
+static void *
+heap_malloc(size_t size)
+{
+	struct heap_hdr	*h, *rest;
+	size_t		 need, len;
+	void		*ptr = NULL;
+
+	if (size > SIZE_MAX - HEAP_HDRLEN - HEAP_ALIGN)
+		return (NULL);
+	need = HEAP_HDRLEN + ((size + HEAP_ALIGN - 1) &
+	    ~(size_t)(HEAP_ALIGN - 1));
+	if (need == HEAP_HDRLEN)
+		need += HEAP_ALIGN;
+
+	HEAP_LOCK();
+	for (size_t off = 0; off < heap.len; off += len) {
+		h = heap_hdr(off);
+		len = h->size & ~HEAP_USED;
+		if ((h->size & HEAP_USED) || len < need)
+			continue;
+		if (len - need >= HEAP_HDRLEN + HEAP_ALIGN) {
+			rest = heap_hdr(off + need);
+			rest->size = len - need;
+			rest->prev = need;
+			heap_link(rest);
+			len = need;
+		}
+		h->size = len | HEAP_USED;
+		heap.inuse += len;
+		if (heap.inuse > heap.peak)
+			heap.peak = heap.inuse;
+		ptr = (unsigned char *)h + HEAP_HDRLEN;
+		break;
+	}
+	HEAP_UNLOCK();
+
+	return (ptr);
+}
+
+static void
+heap_free(void *ptr)
+{
+	struct heap_hdr	*h, *next, *prev;
+	size_t		 off;
+
+	if (ptr == NULL)
+		return;
+	if (!heap_owns(ptr)) {
+		fido_log_debug("%s: %p not in heap", __func__, ptr);
+		return;
+	}
+
+	HEAP_LOCK();
+	h = (struct heap_hdr *)(void *)((unsigned char *)ptr - HEAP_HDRLEN);
+	h->size &= ~HEAP_USED;
+	heap.inuse -= h->size;
+	if ((off = heap_off(h) + h->size) < heap.len &&
+	    ((next = heap_hdr(off))->size & HEAP_USED) == 0)
+		h->size += next->size;
+	if (h->prev != 0 && ((prev = heap_hdr(heap_off(h) -
+	    h->prev))->size & HEAP_USED) == 0) {
+		prev->size += h->size;
+		h = prev;
+	}
+	heap_link(h);
+	HEAP_UNLOCK();
+}
+
+static void *
+heap_realloc(void *ptr, size_t size)
+{
+	const struct heap_hdr	*h;
+	void			*newptr;
+	size_t			 len;
+
+	if (ptr == NULL)
+		return (heap_malloc(size));
+	if (!heap_owns(ptr))
+		return (NULL);
+	h = (const struct heap_hdr *)(const void *)((unsigned char *)ptr -
+	    HEAP_HDRLEN);
+	len = (h->size & ~HEAP_USED) - HEAP_HDRLEN;
+	if (size <= len)
+		return (ptr);
+	if ((newptr = heap_malloc(size)) == NULL)
+		return (NULL);
+	memcpy(newptr, ptr, len);
+	heap_free(ptr);
+
+	return (newptr);
+}
+
+int
+fido_set_heap(void *mem, size_t len)
+{
+	uintptr_t	 addr = (uintptr_t)mem;
+	size_t		 skip;
+	int		 r;
+
+	if (mem == NULL) {
+		if (len != 0)
+			return (FIDO_ERR_INVALID_ARGUMENT);
+		if ((r = fido_set_allocator(NULL, NULL, NULL)) != FIDO_OK)
+			return (r);
+		memset(&heap, 0, sizeof(heap));
+		return (FIDO_OK);
+	}
+
+	skip = (HEAP_ALIGN - (size_t)(addr % HEAP_ALIGN)) % HEAP_ALIGN;
+	if (len < skip || (len - skip) / HEAP_ALIGN < 2)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	heap.base = (unsigned char *)mem + skip;
+	heap.len = (len - skip) & ~(size_t)(HEAP_ALIGN - 1);
+	heap.inuse = 0;
+	heap.peak = 0;
+	heap_hdr(0)->size = heap.len;
+	heap_hdr(0)->prev = 0;
+
+	if ((r = fido_set_allocator(heap_malloc, heap_realloc,
+	    heap_free)) != FIDO_OK)
+		memset(&heap, 0, sizeof(heap));
+
+	return (r);
+}
+
+void
+fido_heap_stats(size_t *inuse, size_t *peak)
+{
+	HEAP_LOCK();
+	if (inuse != NULL)
+		*inuse = heap.inuse;
+	if (peak != NULL)
+		*peak = heap.peak;
+	HEAP_UNLOCK();
+}
+
+static void *
+alloc_raw_malloc(size_t size)
+{
+	return (alloc_malloc != NULL ? alloc_malloc(size) : malloc(size));
+}
+
+static void *
+alloc_raw_realloc(void *ptr, size_t size)
+{
+	return (alloc_realloc != NULL ? alloc_realloc(ptr, size) :
+	    realloc(ptr, size));
+}
+
+static void
+alloc_raw_free(void *ptr)
+{
+	if (alloc_free != NULL)
+		alloc_free(ptr);
+	else
+		free(ptr);
+}
+
+static struct mem_hdr *
+mem_hdr(void *ptr)
+{
+	return ((struct mem_hdr *)(void *)((unsigned char *)ptr -
+	    MEM_HDRLEN));
+}
+
+/* count a block of alloc bytes obtained, and one of freed released */
+static void
+mem_count(int class, size_t alloc, size_t freed)
+{
+	struct mem_stats *s;
+
+	MEM_LOCK();
+	for (size_t i = 0; i < 2; i++) {
+		s = &mem_stats[i == 0 ? class : FIDO_MEM_NCLASSES];
+		if (freed != MEM_NONE) {
+			s->frees++;
+			s->live -= freed;
+		}
+		if (alloc != MEM_NONE) {
+			s->allocs++;
+			s->live += alloc;
+			if (s->live > s->peak)
+				s->peak = s->live;
+		}
+	}
+	MEM_UNLOCK();
+}
+
+static void *
+mem_malloc(int class, size_t size)
+{
+	struct mem_hdr	*h;
+	unsigned char	*p;
+
+	if (size > SIZE_MAX - MEM_HDRLEN ||
+	    (p = alloc_raw_malloc(MEM_HDRLEN + size)) == NULL)
+		return (NULL);
+	h = (struct mem_hdr *)(void *)p;
+	h->size = size;
+	h->class = class;
+	mem_count(class, size, MEM_NONE);
+
+	return (p + MEM_HDRLEN);
+}
+
+static void *
+mem_realloc(void *ptr, size_t size)
+{
+	struct mem_hdr	*h = mem_hdr(ptr);
+	unsigned char	*p;
+	size_t		 old = h->size;
+	int		 class = h->class;
+
+	if (size > SIZE_MAX - MEM_HDRLEN ||
+	    (p = alloc_raw_realloc(h, MEM_HDRLEN + size)) == NULL)
+		return (NULL);
+	h = (struct mem_hdr *)(void *)p;
+	h->size = size;
+	mem_count(class, size, old);
+
+	return (p + MEM_HDRLEN);
+}
+
+static void
+mem_free(void *ptr)
+{
+	struct mem_hdr *h = mem_hdr(ptr);
+
+	mem_count(h->class, MEM_NONE, h->size);
+	alloc_raw_free(h);
+}
+
+#ifdef HAVE_CBOR_SET_ALLOCS
+static void *
+mem_cbor_malloc(size_t size)
+{
+	return (mem_malloc(FIDO_MEM_CBOR, size));
+}
+
+static void *
+mem_cbor_realloc(void *ptr, size_t size)
+{
+	return (fido_realloc_as(FIDO_MEM_CBOR, ptr, size));
+}
+
+static void
+mem_cbor_free(void *ptr)
+{
+	fido_free(ptr);
+}
+#endif /* HAVE_CBOR_SET_ALLOCS */
+
+int
+fido_set_mem_stats(bool enable)
+{
+	bool old = mem_enabled;
+
+	mem_enabled = enable;
+	if (alloc_set_cbor() < 0) {
+		mem_enabled = old;
+		return (FIDO_ERR_INTERNAL);
+	}
+	MEM_LOCK();
+	memset(mem_stats, 0, sizeof(mem_stats));
+	MEM_UNLOCK();
+
+	return (FIDO_OK);
+}
+
+int
+fido_mem_stats(int class, uint64_t *allocs, uint64_t *frees, size_t *live,
+    size_t *peak)
+{
+	const struct mem_stats *s;
+
+	if (class == FIDO_MEM_ALL)
+		class = FIDO_MEM_NCLASSES;
+	else if (class < 0 || class >= FIDO_MEM_NCLASSES)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	MEM_LOCK();
+	s = &mem_stats[class];
+	if (allocs != NULL)
+		*allocs = s->allocs;
+	if (frees != NULL)
+		*frees = s->frees;
+	if (live != NULL)
+		*live = s->live;
+	if (peak != NULL)
+		*peak = s->peak;
+	MEM_UNLOCK();
+
+	return (FIDO_OK);
+}
+
+void
+fido_mem_stats_reset(void)
+{
+	MEM_LOCK();
+	for (size_t i = 0; i < nitems(mem_stats); i++) {
+		mem_stats[i].allocs = 0;
+		mem_stats[i].frees = 0;
+		mem_stats[i].peak = mem_stats[i].live;
+	}
+	MEM_UNLOCK();
+}
+
+/*
+ * Prepare memory for a caller who frees it without libfido2: the header,
+ * if any, is dropped by moving the len bytes at ptr to the start of the
+ * block, and what follows them is wiped.
+ */
+void *
+fido_mem_handover(void *ptr, size_t len)
+{
+	struct mem_hdr	*h;
+	size_t		 size;
+
+	if (ptr == NULL || mem_enabled == false || fido_secure_owns(ptr))
+		return (ptr);
+	h = mem_hdr(ptr);
+	size = h->size;
+	mem_count(h->class, MEM_NONE, size);
+	if (len > size)
+		len = size;
+	memmove(h, ptr, len);
+	explicit_bzero((unsigned char *)h + len, MEM_HDRLEN + size - len);
+
+	return (h);
+}
+
+/* the converse of fido_mem_handover(): adopt a caller's block */
+void *
+fido_mem_adopt(int class, void *ptr, size_t len)
+{
+	struct mem_hdr	*h;
+	unsigned char	*p;
+
+	if (ptr == NULL || mem_enabled == false)
+		return (ptr);
+	if (len > SIZE_MAX - MEM_HDRLEN ||
+	    (p = alloc_raw_realloc(ptr, MEM_HDRLEN + len)) == NULL)
+		return (NULL);
+	memmove(p + MEM_HDRLEN, p, len);
+	h = (struct mem_hdr *)(void *)p;
+	h->size = len;
+	h->class = class;
+	mem_count(class, len, MEM_NONE);
+
+	return (p + MEM_HDRLEN);
+}
+
+void *
+fido_malloc_as(int class, size_t size)
+{
+	if (mem_enabled)
+		return (mem_malloc(class, size));
+
+	return (alloc_raw_malloc(size));
+}
+
+void *
+fido_malloc(size_t size)
+{
+	return (fido_malloc_as(FIDO_MEM_OTHER, size));
+}
+
+void *
+fido_calloc_as(int class, size_t nmemb, size_t size)
+{
+	void *ptr;
+
+	if (size != 0 && nmemb > SIZE_MAX / size)
+		return (NULL);
+	if (alloc_malloc == NULL && mem_enabled == false)
+		return (calloc(nmemb, size));
+	if ((ptr = fido_malloc_as(class, nmemb * size)) != NULL)
+		memset(ptr, 0, nmemb * size);
+
+	return (ptr);
+}
+
+void *
+fido_calloc(size_t nmemb, size_t size)
+{
+	return (fido_calloc_as(FIDO_MEM_OTHER, nmemb, size));
+}
+
+/* a block keeps its class; ptr == NULL allocates one of the given class */
+void *
+fido_realloc_as(int class, void *ptr, size_t size)
+{
+	if (fido_secure_owns(ptr))
+		return (fido_secure_realloc(ptr, size));
+	if (mem_enabled == false)
+		return (alloc_raw_realloc(ptr, size));
+	if (ptr == NULL)
+		return (mem_malloc(class, size));
+
+	return (mem_realloc(ptr, size));
+}
+
+void *
+fido_realloc(void *ptr, size_t size)
+{
+	return (fido_realloc_as(FIDO_MEM_OTHER, ptr, size));
+}
+
+/* as recallocarray(3): the new memory is zeroed, the old memory wiped */
+void *
+fido_recallocarray_as(int class, void *ptr, size_t oldnmemb, size_t nmemb,
+    size_t size)
+{
+	void *newptr;
+
+	if (ptr == NULL)
+		return (fido_calloc_as(class, nmemb, size));
+	if (size != 0 && (nmemb > SIZE_MAX / size ||
+	    oldnmemb > SIZE_MAX / size))
+		return (NULL);
+	if ((newptr = fido_calloc_as(class, nmemb, size)) == NULL)
+		return (NULL);
+
+	memcpy(newptr, ptr, (nmemb < oldnmemb ? nmemb : oldnmemb) * size);
+	fido_freezero(ptr, oldnmemb * size);
+
+	return (newptr);
+}
+
+void *
+fido_recallocarray(void *ptr, size_t oldnmemb, size_t nmemb, size_t size)
+{
+	return (fido_recallocarray_as(FIDO_MEM_OTHER, ptr, oldnmemb, nmemb,
+	    size));
+}
+
+void
+fido_free(void *ptr)
+{
+	if (ptr == NULL)
+		return;
+	if (fido_secure_owns(ptr))
+		fido_secure_free(ptr);
+	else if (mem_enabled)
+		mem_free(ptr);
+	else
+		alloc_raw_free(ptr);
+}
+
+void
+fido_freezero(void *ptr, size_t size)
+{
+	if (ptr == NULL)
+		return;
+	explicit_bzero(ptr, size);
+	fido_free(ptr);
+}
+
+char *
+fido_strdup(const char *s)
+{
+	return (fido_strndup(s, strlen(s)));
+}
+
+char *
+fido_strndup(const char *s, size_t maxlen)
+{
+	char	*t;
+	size_t	 len;
+
+	len = strnlen(s, maxlen);
+	if (len == SIZE_MAX || (t = fido_malloc(len + 1)) == NULL)
+		return (NULL);
+	memcpy(t, s, len);
+	t[len] = '\0';
+
+	return (t);
+}
+
+int
+fido_asprintf(char **ret, const char *fmt, ...)
+{
+	va_list	ap;
+	int	n;
+
+	*ret = NULL;
+
+	va_start(ap, fmt);
+	n = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+	if (n < 0 || (*ret = fido_malloc((size_t)n + 1)) == NULL)
+		return (-1);
+
+	va_start(ap, fmt);
+	if (vsnprintf(*ret, (size_t)n + 1, fmt, ap) != n) {
+		fido_free(*ret);
+		*ret = NULL;
+		n = -1;
+	}
+	va_end(ap);
+
+	return (n);
+}
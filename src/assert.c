@@ -5,26 +5,119 @@
  * SPDX-License-Identifier: BSD-2-Clause
  */
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include <openssl/sha.h>
 
 #include "fido.h"
 #include "fido/es256.h"
+#include "fido/es384.h"
 #include "fido/rs256.h"
 #include "fido/eddsa.h"
+#include "fido/verify.h"
+#include "probe.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/* serialises the deferred decoding of assertion statements */
+#if defined(HAVE_PTHREAD)
+static pthread_mutex_t stmt_lock = PTHREAD_MUTEX_INITIALIZER;
+#define STMT_LOCK()		pthread_mutex_lock(&stmt_lock)
+#define STMT_UNLOCK()		pthread_mutex_unlock(&stmt_lock)
+#elif defined(_WIN32)
+static SRWLOCK stmt_lock = SRWLOCK_INIT;
+#define STMT_LOCK()		AcquireSRWLockExclusive(&stmt_lock)
+#define STMT_UNLOCK()		ReleaseSRWLockExclusive(&stmt_lock)
+#else
+#define STMT_LOCK()		do { } while (0)
+#define STMT_UNLOCK()		do { } while (0)
+#endif
+
+/*
+ * The user and large-blob key of a statement take the most allocations
+ * to decode, and are often not needed, as when one of several
+ * assertions is picked; they are validated when the reply is parsed,
+ * and decoded from the retained reply when first asked for, under a
+ * lock, so that a const fido_assert_t may be read by several threads
+ * at once.
+ */
+static int
+decode_deferred_user(const cbor_item_t *val, void *arg)
+{
+	fido_assert_stmt *stmt = arg;
+
+	return (cbor_decode_user(val, &stmt->user));
+}
 
 static int
-adjust_assert_count(const cbor_item_t *key, const cbor_item_t *val, void *arg)
+decode_deferred_largeblob_key(const cbor_item_t *val, void *arg)
 {
-	fido_assert_t	*assert = arg;
-	uint64_t	 n;
+	fido_assert_stmt *stmt = arg;
+
+	return (fido_blob_decode(val, &stmt->largeblob_key));
+}
+
+/* the remaining keys were decoded already */
+static const cbor_key_decoder_t deferred_reply[] = {
+	{ 4, decode_deferred_user },		/* user attributes */
+	{ 7, decode_deferred_largeblob_key },	/* large blob key */
+};
+
+static void
+stmt_reset_deferred(fido_assert_stmt *stmt)
+{
+	fido_free(stmt->user.icon);
+	fido_free(stmt->user.name);
+	fido_free(stmt->user.display_name);
+	fido_blob_reset(&stmt->user.id);
+	fido_blob_reset(&stmt->largeblob_key);
+	memset(&stmt->user, 0, sizeof(stmt->user));
+}
 
-	/* numberOfCredentials; see section 6.2 */
-	if (cbor_isa_uint(key) == false ||
-	    cbor_int_get_width(key) != CBOR_INT_8 ||
-	    cbor_get_uint8(key) != 5) {
-		fido_log_debug("%s: cbor_type", __func__);
-		return (0); /* ignore */
+static const fido_assert_stmt *
+stmt_decode_deferred(const fido_assert_t *assert, size_t idx)
+{
+	fido_assert_stmt *stmt;
+
+	if (idx >= assert->stmt_len)
+		return (NULL);
+	/* statements are allocated by libfido2, and never const */
+	stmt = (fido_assert_stmt *)(uintptr_t)&assert->stmt[idx];
+
+	STMT_LOCK();
+	if (stmt->deferred == false)
+		goto out;
+	stmt->deferred = false;
+	if (cbor_parse_reply_keys(stmt->raw.ptr, stmt->raw.len, stmt,
+	    deferred_reply, nitems(deferred_reply)) != FIDO_OK) {
+		fido_log_debug("%s: cbor_parse_reply_keys", __func__);
+		stmt_reset_deferred(stmt);
 	}
+	fido_blob_reset(&stmt->raw);
+out:
+	STMT_UNLOCK();
+
+	return (stmt);
+}
+
+/* forget the prepared request, if any, once the request changes */
+static void
+assert_reset_req(fido_assert_t *assert)
+{
+	fido_blob_reset(&assert->req);
+	assert->req_cdh = 0;
+}
+
+#ifndef FIDO_VERIFY_ONLY
+static int
+adjust_assert_count(const cbor_item_t *val, void *arg)
+{
+	fido_assert_t	*assert = arg;
+	uint64_t	 n;
 
 	if (cbor_decode_uint64(val, &n) < 0 || n > SIZE_MAX) {
 		fido_log_debug("%s: cbor_decode_uint64", __func__);
@@ -48,46 +141,194 @@ adjust_assert_count(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 	return (0);
 }
 
+/* numberOfCredentials; see section 6.2 */
+static const cbor_key_decoder_t assert_count_reply[] = {
+	{ 5, adjust_assert_count },
+};
+
+/*
+ * A statement being parsed from a reply. Its id, signature, authdata and
+ * any deferred reply are copied to the assertion's arena, and released
+ * with it by fido_assert_reset_rx().
+ */
+struct assert_rx {
+	fido_assert_stmt	*stmt;
+	fido_arena_t		*arena;
+};
+
 static int
-parse_assert_reply(const cbor_item_t *key, const cbor_item_t *val, void *arg)
+decode_assert_cred_id(const cbor_item_t *val, void *arg)
 {
-	fido_assert_stmt *stmt = arg;
+	struct assert_rx *rx = arg;
 
-	if (cbor_isa_uint(key) == false ||
-	    cbor_int_get_width(key) != CBOR_INT_8) {
-		fido_log_debug("%s: cbor type", __func__);
-		return (0); /* ignore */
-	}
-
-	switch (cbor_get_uint8(key)) {
-	case 1: /* credential id */
-		return (cbor_decode_cred_id(val, &stmt->id));
-	case 2: /* authdata */
-		return (cbor_decode_assert_authdata(val, &stmt->authdata_cbor,
-		    &stmt->authdata, &stmt->authdata_ext));
-	case 3: /* signature */
-		return (fido_blob_decode(val, &stmt->sig));
-	case 4: /* user attributes */
-		return (cbor_decode_user(val, &stmt->user));
-	case 7: /* large blob key */
-		return (fido_blob_decode(val, &stmt->largeblob_key));
-	default: /* ignore */
-		fido_log_debug("%s: cbor type", __func__);
-		return (0);
+	return (cbor_decode_cred_id(val, rx->arena, &rx->stmt->id));
+}
+
+static int
+decode_assert_authdata(const cbor_item_t *val, void *arg)
+{
+	struct assert_rx *rx = arg;
+
+	return (cbor_decode_assert_authdata(val, rx->arena,
+	    &rx->stmt->authdata_cbor, &rx->stmt->authdata,
+	    &rx->stmt->authdata_ext));
+}
+
+static int
+decode_assert_sig(const cbor_item_t *val, void *arg)
+{
+	struct assert_rx *rx = arg;
+
+	return (fido_blob_decode_arena(val, &rx->stmt->sig, rx->arena));
+}
+
+static int
+defer_assert_user(const cbor_item_t *val, void *arg)
+{
+	fido_assert_stmt *stmt = ((struct assert_rx *)arg)->stmt;
+
+	if (cbor_check_user(val) < 0) {
+		fido_log_debug("%s: user", __func__);
+		return (-1);
+	}
+	stmt->deferred = true;
+
+	return (0);
+}
+
+static int
+defer_assert_largeblob_key(const cbor_item_t *val, void *arg)
+{
+	fido_assert_stmt *stmt = ((struct assert_rx *)arg)->stmt;
+
+	if (cbor_isa_bytestring(val) == false ||
+	    cbor_bytestring_is_definite(val) == false) {
+		fido_log_debug("%s: largeblob_key", __func__);
+		return (-1);
+	}
+	stmt->deferred = true;
+
+	return (0);
+}
+
+static const cbor_key_decoder_t assert_reply[] = {
+	{ 1, decode_assert_cred_id },		/* credential id */
+	{ 2, decode_assert_authdata },		/* authdata */
+	{ 3, decode_assert_sig },		/* signature */
+	{ 4, defer_assert_user },		/* user attributes */
+	{ 7, defer_assert_largeblob_key },	/* large blob key */
+};
+
+/* keep msg, the reply stmt was parsed from, if anything was deferred */
+static int
+stmt_defer(const struct assert_rx *rx, const unsigned char *msg,
+    size_t msglen)
+{
+	if (rx->stmt->deferred == false)
+		return (FIDO_OK);
+	if (fido_blob_set_arena(&rx->stmt->raw, rx->arena, msg, msglen) < 0) {
+		fido_log_debug("%s: fido_blob_set_arena", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	return (FIDO_OK);
+}
+
+
+/* allowList and extensions, which follow the client data hash */
+static void
+cbor_write_assert_tail(cbor_writer_t *w, const fido_assert_t *assert,
+    const cbor_item_t *ext)
+{
+	if (assert->allow_cred_list != NULL) {
+		cbor_write_uint(w, 3);
+		cbor_write_cred_list(w, assert->allow_cred_list,
+		    assert->allow_batch);
+	} else if (assert->allow_list.len != 0) {
+		cbor_write_uint(w, 3);
+		cbor_write_pubkey_list(w, &assert->allow_list);
+	}
+	if (ext != NULL) {
+		cbor_write_uint(w, 4);
+		cbor_write_item(w, ext);
+	}
+}
+
+/*
+ * Encode the parts of the request that do not change from one device,
+ * or one try, to the next, once; the client data hash, options and
+ * PIN/UV auth parameters are filled in each time it is sent.
+ */
+int
+fido_assert_prepare(fido_assert_t *assert)
+{
+	cbor_item_t	*ext = NULL;
+	cbor_writer_t	 w;
+	fido_blob_t	 f;
+	size_t		 hole;
+	int		 r;
+
+	memset(&f, 0, sizeof(f));
+
+	assert_reset_req(assert);
+
+	if (assert->rp_id == NULL) {
+		fido_log_debug("%s: rp_id=NULL", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+	if (assert->ext.mask & FIDO_EXT_HMAC_SECRET) {
+		fido_log_debug("%s: hmac-secret", __func__);
+		return (FIDO_ERR_UNSUPPORTED_EXTENSION);
+	}
+	if (assert->ext.mask && (ext = cbor_encode_assert_ext(NULL,
+	    &assert->ext, NULL, NULL, NULL)) == NULL) {
+		fido_log_debug("%s: cbor_encode_assert_ext", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	/* everything but the command byte; the hole follows key 2 */
+	cbor_writer_init(&w, CTAP_CBOR_ASSERT);
+	cbor_write_uint(&w, 1);
+	cbor_write_text(&w, assert->rp_id);
+	cbor_write_uint(&w, 2);
+	hole = w.off - 1;
+	cbor_write_assert_tail(&w, assert, ext);
+	if (cbor_writer_finish(&w, &f) < 0) {
+		fido_log_debug("%s: cbor_writer_finish", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
 	}
+	memmove(f.ptr, f.ptr + 1, --f.len);
+
+	assert->req = f;
+	assert->req_cdh = hole;
+	f.ptr = NULL;
+
+	r = FIDO_OK;
+fail:
+	if (ext != NULL)
+		cbor_decref(&ext);
+	fido_free(f.ptr);
+
+	return (r);
 }
 
 static int
 fido_dev_get_assert_tx(fido_dev_t *dev, fido_assert_t *assert,
-    const es256_pk_t *pk, const fido_blob_t *ecdh, const char *pin, int *ms)
+    const es256_pk_t *pk, const fido_blob_t *ecdh, const char *pin,
+    const fido_blob_t *token, int *ms)
 {
 	fido_blob_t	 f;
 	fido_opt_t	 uv = assert->uv;
-	cbor_item_t	*argv[7];
+	cbor_item_t	*ext = NULL;
+	cbor_item_t	*auth = NULL;
+	cbor_item_t	*prot = NULL;
+	cbor_writer_t	 w;
 	const uint8_t	 cmd = CTAP_CBOR_ASSERT;
+	bool		 opt, allow, prepared, has_ext;
 	int		 r;
 
-	memset(argv, 0, sizeof(argv));
 	memset(&f, 0, sizeof(f));
 
 	/* do we have everything we need? */
@@ -97,53 +338,83 @@ fido_dev_get_assert_tx(fido_dev_t *dev, fido_assert_t *assert,
 		r = FIDO_ERR_INVALID_ARGUMENT;
 		goto fail;
 	}
-
-	if ((argv[0] = cbor_build_string(assert->rp_id)) == NULL ||
-	    (argv[1] = fido_blob_encode(&assert->cdh)) == NULL) {
-		fido_log_debug("%s: cbor encode", __func__);
-		r = FIDO_ERR_INTERNAL;
+	allow = assert->allow_list.len != 0 || assert->allow_cred_list != NULL;
+	if (assert->allow_cred_list != NULL && assert->allow_batch >=
+	    fido_cred_list_batch_count(assert->allow_cred_list)) {
+		fido_log_debug("%s: allow_batch=%zu", __func__,
+		    assert->allow_batch);
+		r = FIDO_ERR_INVALID_ARGUMENT;
 		goto fail;
 	}
 
-	/* allowed credentials */
-	if (assert->allow_list.len) {
-		const fido_blob_array_t *cl = &assert->allow_list;
-		if ((argv[2] = cbor_encode_pubkey_list(cl)) == NULL) {
-			fido_log_debug("%s: cbor_encode_pubkey_list", __func__);
+	/* hmac-secret depends on the key agreement, and is never prepared */
+	prepared = assert->req.ptr != NULL &&
+	    (assert->ext.mask & FIDO_EXT_HMAC_SECRET) == 0;
+	has_ext = assert->ext.mask != 0;
+
+	if (has_ext && !prepared)
+		if ((ext = cbor_encode_assert_ext(dev, &assert->ext,
+		    assert->allow_list.len == 1 ? &assert->allow_list.ptr[0] :
+		    NULL, ecdh, pk)) == NULL) {
+			fido_log_debug("%s: cbor_encode_assert_ext", __func__);
 			r = FIDO_ERR_INTERNAL;
 			goto fail;
 		}
-	}
 
-	if (assert->ext.mask)
-		if ((argv[3] = cbor_encode_assert_ext(dev, &assert->ext, ecdh,
-		    pk)) == NULL) {
-			fido_log_debug("%s: cbor_encode_assert_ext", __func__);
+	/* user verification, with the caller's token if given */
+	if (token != NULL) {
+		if ((auth = cbor_encode_pin_auth(dev, token,
+		    &assert->cdh)) == NULL ||
+		    (prot = cbor_encode_pin_opt(dev)) == NULL) {
+			fido_log_debug("%s: cbor_encode_pin", __func__);
 			r = FIDO_ERR_INTERNAL;
 			goto fail;
 		}
-
-	/* user verification */
-	if (pin != NULL || (uv == FIDO_OPT_TRUE &&
+		uv = FIDO_OPT_OMIT;
+	} else if (pin != NULL || (uv == FIDO_OPT_TRUE &&
 	    fido_dev_supports_permissions(dev))) {
 		if ((r = cbor_add_uv_params(dev, cmd, &assert->cdh, pk, ecdh,
-		    pin, assert->rp_id, &argv[5], &argv[6], ms)) != FIDO_OK) {
+		    pin, assert->rp_id, &auth, &prot, ms)) != FIDO_OK) {
 			fido_log_debug("%s: cbor_add_uv_params", __func__);
 			goto fail;
 		}
 		uv = FIDO_OPT_OMIT;
 	}
 
-	/* options */
-	if (assert->up != FIDO_OPT_OMIT || uv != FIDO_OPT_OMIT)
-		if ((argv[4] = cbor_encode_assert_opt(assert->up, uv)) == NULL) {
-			fido_log_debug("%s: cbor_encode_assert_opt", __func__);
-			r = FIDO_ERR_INTERNAL;
-			goto fail;
-		}
+	opt = assert->up != FIDO_OPT_OMIT || uv != FIDO_OPT_OMIT;
+
+	/* write the request directly; only ext and uv params are items */
+	cbor_writer_init(&w, cmd);
+	cbor_write_map(&w, 2 + (size_t)allow + (size_t)has_ext +
+	    (size_t)opt + (size_t)(auth != NULL) + (size_t)(prot != NULL));
+	if (prepared) {
+		/* keys 1 to 4, around the current client data hash */
+		cbor_write_raw(&w, assert->req.ptr, assert->req_cdh);
+		cbor_write_blob(&w, &assert->cdh);
+		cbor_write_raw(&w, assert->req.ptr + assert->req_cdh,
+		    assert->req.len - assert->req_cdh);
+	} else {
+		cbor_write_uint(&w, 1);
+		cbor_write_text(&w, assert->rp_id);
+		cbor_write_uint(&w, 2);
+		cbor_write_blob(&w, &assert->cdh);
+		cbor_write_assert_tail(&w, assert, ext);
+	}
+	if (opt) {
+		cbor_write_uint(&w, 5);
+		cbor_write_assert_opt(&w, assert->up, uv);
+	}
+	if (auth != NULL) {
+		cbor_write_uint(&w, 6);
+		cbor_write_item(&w, auth);
+	}
+	if (prot != NULL) {
+		cbor_write_uint(&w, 7);
+		cbor_write_item(&w, prot);
+	}
 
 	/* frame and transmit */
-	if (cbor_build_frame(cmd, argv, nitems(argv), &f) < 0 ||
+	if (cbor_writer_finish(&w, &f) < 0 ||
 	    fido_tx(dev, CTAP_CMD_CBOR, f.ptr, f.len, ms) < 0) {
 		fido_log_debug("%s: fido_tx", __func__);
 		r = FIDO_ERR_TX;
@@ -152,128 +423,189 @@ fido_dev_get_assert_tx(fido_dev_t *dev, fido_assert_t *assert,
 
 	r = FIDO_OK;
 fail:
-	cbor_vector_free(argv, nitems(argv));
-	free(f.ptr);
+	if (ext != NULL)
+		cbor_decref(&ext);
+	if (auth != NULL)
+		cbor_decref(&auth);
+	if (prot != NULL)
+		cbor_decref(&prot);
+	fido_free(f.ptr);
 
 	return (r);
 }
 
 static int
-fido_dev_get_assert_rx(fido_dev_t *dev, fido_assert_t *assert, int *ms)
+fido_get_next_assert_tx(fido_dev_t *dev, int *ms)
 {
-	unsigned char	*msg;
-	int		 msglen;
-	int		 r;
-
-	fido_assert_reset_rx(assert);
+	const unsigned char cbor[] = { CTAP_CBOR_NEXT_ASSERT };
 
-	if ((msg = malloc(FIDO_MAXMSG)) == NULL) {
-		r = FIDO_ERR_INTERNAL;
-		goto out;
+	if (fido_tx(dev, CTAP_CMD_CBOR, cbor, sizeof(cbor), ms) < 0) {
+		fido_log_debug("%s: fido_tx", __func__);
+		return (FIDO_ERR_TX);
 	}
 
-	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, FIDO_MAXMSG, ms)) < 0) {
+	return (FIDO_OK);
+}
+
+/*
+ * Read and discard the reply to a request sent ahead of a reply that
+ * turned out to be bad, so that it is not taken for the reply to the
+ * device's next request.
+ */
+static void
+fido_get_next_assert_drain(fido_dev_t *dev, int *ms)
+{
+	unsigned char	*msg;
+	size_t		 msgsiz;
+
+	if ((msg = fido_rx_buf_get(dev, FIDO_MAXMSG, &msgsiz)) == NULL)
+		return;
+	if (fido_rx(dev, CTAP_CMD_CBOR, msg, msgsiz, ms) < 0)
 		fido_log_debug("%s: fido_rx", __func__);
-		r = FIDO_ERR_RX;
-		goto out;
-	}
+	fido_rx_buf_put(dev, msg, msgsiz);
+}
+
+/*
+ * Parse the reply to authenticatorGetAssertion. If dev is not NULL and
+ * the reply announces more assertions, authenticatorGetNextAssertion is
+ * sent before the first assertion is parsed, so that the authenticator
+ * works on the next reply meanwhile; fido_dev_get_next_asserts() picks
+ * it up.
+ */
+static int
+parse_first_assert(fido_dev_t *dev, fido_assert_t *assert,
+    const unsigned char *msg, size_t msglen, int *ms)
+{
+	struct assert_rx	 rx;
+	cbor_item_t		*item = NULL;
+	bool			 sent = false;
+	int			 r;
 
 	/* start with room for a single assertion */
-	if ((assert->stmt = calloc(1, sizeof(fido_assert_stmt))) == NULL) {
+	if ((assert->stmt = fido_calloc(1, sizeof(fido_assert_stmt))) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto out;
 	}
 	assert->stmt_len = 0;
 	assert->stmt_cnt = 1;
 
+	/* decode the reply once; it carries the count and the first stmt */
+	if ((r = cbor_load_reply(msg, msglen, &item)) != FIDO_OK) {
+		fido_log_debug("%s: cbor_load_reply", __func__);
+		goto out;
+	}
+
 	/* adjust as needed */
-	if ((r = cbor_parse_reply(msg, (size_t)msglen, assert,
-	    adjust_assert_count)) != FIDO_OK) {
+	if ((r = cbor_parse_reply_item_keys(item, assert, assert_count_reply,
+	    nitems(assert_count_reply))) != FIDO_OK) {
 		fido_log_debug("%s: adjust_assert_count", __func__);
 		goto out;
 	}
 
+	if (dev != NULL && assert->stmt_cnt > 1) {
+		if ((r = fido_get_next_assert_tx(dev, ms)) != FIDO_OK)
+			goto out;
+		sent = true;
+	}
+
 	/* parse the first assertion */
-	if ((r = cbor_parse_reply(msg, (size_t)msglen, &assert->stmt[0],
-	    parse_assert_reply)) != FIDO_OK) {
-		fido_log_debug("%s: parse_assert_reply", __func__);
+	rx.stmt = &assert->stmt[0];
+	rx.arena = &assert->arena;
+	if ((r = cbor_parse_reply_item_keys(item, &rx, assert_reply,
+	    nitems(assert_reply))) != FIDO_OK ||
+	    (r = stmt_defer(&rx, msg, msglen)) != FIDO_OK) {
+		fido_log_debug("%s: cbor_parse_reply_item_keys", __func__);
 		goto out;
 	}
 	assert->stmt_len = 1;
 
 	r = FIDO_OK;
 out:
-	freezero(msg, FIDO_MAXMSG);
+	if (item != NULL)
+		cbor_decref(&item);
+	if (r != FIDO_OK && sent)
+		fido_get_next_assert_drain(dev, ms);
 
 	return (r);
 }
 
+/*
+ * msg is a buffer of msgsiz bytes owned by the caller; if next is true,
+ * the remaining assertions are asked for as in parse_first_assert().
+ */
 static int
-fido_get_next_assert_tx(fido_dev_t *dev, int *ms)
+fido_dev_get_assert_rx(fido_dev_t *dev, unsigned char *msg, size_t msgsiz,
+    fido_assert_t *assert, bool next, int *ms)
 {
-	const unsigned char cbor[] = { CTAP_CBOR_NEXT_ASSERT };
+	int msglen;
 
-	if (fido_tx(dev, CTAP_CMD_CBOR, cbor, sizeof(cbor), ms) < 0) {
-		fido_log_debug("%s: fido_tx", __func__);
-		return (FIDO_ERR_TX);
+	fido_assert_reset_rx(assert);
+
+	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, msgsiz, ms)) < 0) {
+		fido_log_debug("%s: fido_rx", __func__);
+		return (FIDO_ERR_RX);
 	}
 
-	return (FIDO_OK);
+	return (parse_first_assert(next ? dev : NULL, assert, msg,
+	    (size_t)msglen, ms));
 }
 
+/*
+ * msg is a buffer of msgsiz bytes owned by the caller. The request for
+ * the assertion after this one, if any, is sent before this one is
+ * parsed.
+ */
 static int
-fido_get_next_assert_rx(fido_dev_t *dev, fido_assert_t *assert, int *ms)
+fido_get_next_assert_rx(fido_dev_t *dev, unsigned char *msg, size_t msgsiz,
+    fido_assert_t *assert, int *ms)
 {
-	unsigned char	*msg;
-	int		 msglen;
-	int		 r;
-
-	if ((msg = malloc(FIDO_MAXMSG)) == NULL) {
-		r = FIDO_ERR_INTERNAL;
-		goto out;
-	}
+	struct assert_rx	rx;
+	int			msglen;
+	int			r;
 
-	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, FIDO_MAXMSG, ms)) < 0) {
+	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, msgsiz, ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		r = FIDO_ERR_RX;
-		goto out;
+		return (FIDO_ERR_RX);
 	}
 
 	/* sanity check */
 	if (assert->stmt_len >= assert->stmt_cnt) {
 		fido_log_debug("%s: stmt_len=%zu, stmt_cnt=%zu", __func__,
 		    assert->stmt_len, assert->stmt_cnt);
-		r = FIDO_ERR_INTERNAL;
-		goto out;
+		return (FIDO_ERR_INTERNAL);
 	}
 
-	if ((r = cbor_parse_reply(msg, (size_t)msglen,
-	    &assert->stmt[assert->stmt_len], parse_assert_reply)) != FIDO_OK) {
-		fido_log_debug("%s: parse_assert_reply", __func__);
-		goto out;
-	}
+	if (assert->stmt_len + 1 < assert->stmt_cnt &&
+	    (r = fido_get_next_assert_tx(dev, ms)) != FIDO_OK)
+		return (r);
 
-	r = FIDO_OK;
-out:
-	freezero(msg, FIDO_MAXMSG);
+	rx.stmt = &assert->stmt[assert->stmt_len];
+	rx.arena = &assert->arena;
+	if ((r = cbor_parse_reply_keys(msg, (size_t)msglen, &rx, assert_reply,
+	    nitems(assert_reply))) != FIDO_OK ||
+	    (r = stmt_defer(&rx, msg, (size_t)msglen)) != FIDO_OK) {
+		fido_log_debug("%s: cbor_parse_reply_keys", __func__);
+		if (assert->stmt_len + 1 < assert->stmt_cnt)
+			fido_get_next_assert_drain(dev, ms);
+		return (r);
+	}
 
-	return (r);
+	return (FIDO_OK);
 }
 
+/*
+ * Fetch the remaining assertions, the first of which has already been
+ * asked for by parse_first_assert(); msg is a buffer of msgsiz bytes.
+ */
 static int
-fido_dev_get_assert_wait(fido_dev_t *dev, fido_assert_t *assert,
-    const es256_pk_t *pk, const fido_blob_t *ecdh, const char *pin, int *ms)
+fido_dev_get_next_asserts(fido_dev_t *dev, unsigned char *msg, size_t msgsiz,
+    fido_assert_t *assert, int *ms)
 {
 	int r;
 
-	if ((r = fido_dev_get_assert_tx(dev, assert, pk, ecdh, pin,
-	    ms)) != FIDO_OK ||
-	    (r = fido_dev_get_assert_rx(dev, assert, ms)) != FIDO_OK)
-		return (r);
-
 	while (assert->stmt_len < assert->stmt_cnt) {
-		if ((r = fido_get_next_assert_tx(dev, ms)) != FIDO_OK ||
-		    (r = fido_get_next_assert_rx(dev, assert, ms)) != FIDO_OK)
+		if ((r = fido_get_next_assert_rx(dev, msg, msgsiz, assert,
+		    ms)) != FIDO_OK)
 			return (r);
 		assert->stmt_len++;
 	}
@@ -281,6 +613,36 @@ fido_dev_get_assert_wait(fido_dev_t *dev, fido_assert_t *assert,
 	return (FIDO_OK);
 }
 
+static int
+fido_dev_get_assert_wait(fido_dev_t *dev, fido_assert_t *assert,
+    const es256_pk_t *pk, const fido_blob_t *ecdh, const char *pin,
+    const fido_blob_t *token, int *ms)
+{
+	unsigned char	*msg;
+	size_t		 msgsiz;
+	int		 r;
+
+	if ((r = fido_dev_get_assert_tx(dev, assert, pk, ecdh, pin, token,
+	    ms)) != FIDO_OK)
+		return (r);
+
+	/* one receive buffer for the whole batch of assertions */
+	if ((msg = fido_rx_buf_get(dev, FIDO_MAXMSG, &msgsiz)) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	if ((r = fido_dev_get_assert_rx(dev, msg, msgsiz, assert, true,
+	    ms)) != FIDO_OK ||
+	    (r = fido_dev_get_next_asserts(dev, msg, msgsiz, assert,
+	    ms)) != FIDO_OK)
+		goto out;
+
+	r = FIDO_OK;
+out:
+	fido_rx_buf_put(dev, msg, msgsiz);
+
+	return (r);
+}
+
 static int
 decrypt_hmac_secrets(const fido_dev_t *dev, fido_assert_t *assert,
     const fido_blob_t *key)
@@ -301,41 +663,213 @@ decrypt_hmac_secrets(const fido_dev_t *dev, fido_assert_t *assert,
 	return (0);
 }
 
-int
-fido_dev_get_assert(fido_dev_t *dev, fido_assert_t *assert, const char *pin)
+static int
+assert_do_ecdh(fido_dev_t *dev, const fido_assert_t *assert, const char *pin,
+    es256_pk_t **pk, fido_blob_t **ecdh, int *ms)
 {
-	fido_blob_t	*ecdh = NULL;
-	es256_pk_t	*pk = NULL;
-	int		 ms = dev->timeout_ms;
-	int		 r;
+	if (pin != NULL || (assert->uv == FIDO_OPT_TRUE &&
+	    fido_dev_supports_permissions(dev)))
+		return (fido_do_ecdh(dev, pk, ecdh, ms));
 
-#ifdef USE_WINHELLO
-	if (dev->flags & FIDO_DEV_WINHELLO)
-		return (fido_winhello_get_assert(dev, assert, pin, ms));
-#endif
+	/* hmac-secret only; no pin is sent, so a kept secret will do */
+	if (assert->ext.mask & FIDO_EXT_HMAC_SECRET)
+		return (fido_do_ecdh_cached(dev, pk, ecdh, ms));
 
-	if (assert->rp_id == NULL || assert->cdh.ptr == NULL) {
-		fido_log_debug("%s: rp_id=%p, cdh.ptr=%p", __func__,
-		    (void *)assert->rp_id, (void *)assert->cdh.ptr);
-		return (FIDO_ERR_INVALID_ARGUMENT);
-	}
+	return (FIDO_OK);
+}
 
-	if (fido_dev_is_fido2(dev) == false) {
-		if (pin != NULL || assert->ext.mask != 0)
-			return (FIDO_ERR_UNSUPPORTED_OPTION);
-		return (u2f_authenticate(dev, assert, &ms));
-	}
+/*
+ * Silently look for a credential of ids[0..n-1]; on success, *idx is
+ * the credential's index, or n if the authenticator did not name it.
+ */
+static int
+assert_preflight_batch(fido_dev_t *dev, const fido_assert_t *assert,
+    const fido_blob_t *ids, size_t n, size_t *idx, int *ms)
+{
+	fido_assert_t	 pf;
+	unsigned char	*msg;
+	size_t		 msgsiz;
+	int		 r;
 
-	if (pin != NULL || (assert->uv == FIDO_OPT_TRUE &&
-	    fido_dev_supports_permissions(dev)) ||
-	    (assert->ext.mask & FIDO_EXT_HMAC_SECRET)) {
-		if ((r = fido_do_ecdh(dev, &pk, &ecdh, &ms)) != FIDO_OK) {
-			fido_log_debug("%s: fido_do_ecdh", __func__);
+	/* borrow the request's fields; only rx fields are released */
+	memset(&pf, 0, sizeof(pf));
+	pf.rp_id = assert->rp_id;
+	pf.cdh = assert->cdh;
+	pf.allow_list.ptr = (fido_blob_t *)(uintptr_t)ids;
+	pf.allow_list.len = n;
+	pf.up = FIDO_OPT_FALSE;
+	pf.uv = FIDO_OPT_OMIT;
+
+	if ((r = fido_dev_get_assert_tx(dev, &pf, NULL, NULL, NULL, NULL,
+	    ms)) != FIDO_OK)
+		return (r);
+	if ((msg = fido_rx_buf_get(dev, FIDO_MAXMSG, &msgsiz)) == NULL)
+		return (FIDO_ERR_INTERNAL);
+	r = fido_dev_get_assert_rx(dev, msg, msgsiz, &pf, false, ms);
+	fido_rx_buf_put(dev, msg, msgsiz);
+
+	if (r == FIDO_OK) {
+		for (*idx = 0; *idx < n; (*idx)++)
+			if (fido_blob_is_empty(&pf.stmt[0].id) == 0 &&
+			    pf.stmt[0].id.len == ids[*idx].len &&
+			    memcmp(pf.stmt[0].id.ptr, ids[*idx].ptr,
+			    ids[*idx].len) == 0)
+				break;
+	}
+	fido_assert_reset_rx(&pf);
+
+	return (r);
+}
+
+/*
+ * An allow list longer than the authenticator takes is tried batch by
+ * batch with up=false, and the assertion proper names the credential
+ * found, so that user presence is asked for once. The same is done for
+ * a shorter list if prf inputs depend on the credential. Ids longer
+ * than the authenticator takes are left out. On return, allow holds the
+ * list to send, sharing the ids of assert->allow_list, or is empty if
+ * the list can be sent as it is.
+ */
+static int
+assert_preflight(fido_dev_t *dev, const fido_assert_t *assert,
+    fido_blob_array_t *allow, int *ms)
+{
+	const fido_cbor_info_t	*ci = dev->info;
+	fido_blob_array_t	 ids;
+	size_t			 maxcnt, first, n, idx;
+	bool			 pick;
+	int			 r;
+
+	memset(allow, 0, sizeof(*allow));
+	memset(&ids, 0, sizeof(ids));
+
+	if (ci == NULL || assert->allow_list.len == 0)
+		return (FIDO_OK);
+	maxcnt = ci->maxcredcntlst > SIZE_MAX ? SIZE_MAX :
+	    (size_t)ci->maxcredcntlst;
+
+	if ((ids.ptr = fido_calloc(assert->allow_list.len,
+	    sizeof(*ids.ptr))) == NULL)
+		return (FIDO_ERR_INTERNAL);
+	for (size_t i = 0; i < assert->allow_list.len; i++)
+		if (ci->maxcredidlen == 0 ||
+		    assert->allow_list.ptr[i].len <= ci->maxcredidlen)
+			ids.ptr[ids.len++] = assert->allow_list.ptr[i];
+
+	if (ids.len == 0) {
+		fido_log_debug("%s: maxcredidlen=%llu", __func__,
+		    (unsigned long long)ci->maxcredidlen);
+		r = FIDO_ERR_NO_CREDENTIALS;
+		goto fail;
+	}
+	pick = ids.len > 1 && assert->ext.prf_id.len != 0 &&
+	    (assert->ext.mask & FIDO_EXT_HMAC_SECRET);
+	if (maxcnt == 0 || ids.len <= maxcnt) {
+		if (pick) {
+			maxcnt = ids.len;
+		} else if (ids.len == assert->allow_list.len) {
+			r = FIDO_OK; /* as it is */
+			goto fail;
+		} else {
+			*allow = ids;
+			return (FIDO_OK);
+		}
+	}
+
+	for (first = 0; first < ids.len; first += n) {
+		n = ids.len - first < maxcnt ? ids.len - first : maxcnt;
+		if ((r = assert_preflight_batch(dev, assert, &ids.ptr[first],
+		    n, &idx, ms)) == FIDO_ERR_NO_CREDENTIALS)
+			continue;
+		if (r != FIDO_OK) {
+			fido_log_debug("%s: assert_preflight_batch", __func__);
 			goto fail;
 		}
+		if (idx < n) {
+			ids.ptr[0] = ids.ptr[first + idx];
+			ids.len = 1;
+		} else {
+			memmove(ids.ptr, &ids.ptr[first], n * sizeof(*ids.ptr));
+			ids.len = n;
+		}
+		*allow = ids;
+		return (FIDO_OK);
+	}
+
+	r = FIDO_ERR_NO_CREDENTIALS;
+fail:
+	fido_free(ids.ptr);
+
+	return (r);
+}
+
+/* u2f and windows hello take the allow list id by id */
+static int
+assert_expand_allow_list(fido_assert_t *assert)
+{
+	int r;
+
+	if (assert->allow_cred_list == NULL)
+		return (FIDO_OK);
+	if ((r = fido_cred_list_expand(assert->allow_cred_list,
+	    assert->allow_batch, &assert->allow_list)) != FIDO_OK) {
+		fido_log_debug("%s: fido_cred_list_expand", __func__);
+		return (r);
+	}
+	assert->allow_cred_list = NULL;
+	assert->allow_batch = 0;
+
+	return (FIDO_OK);
+}
+
+static int
+dev_get_assert(fido_dev_t *dev, fido_assert_t *assert, const char *pin)
+{
+	fido_blob_t		*ecdh = NULL;
+	es256_pk_t		*pk = NULL;
+	fido_blob_array_t	 allow, saved;
+	fido_blob_t		 saved_req;
+	int			 ms = dev->timeout_ms;
+	int			 r;
+
+	if ((dev->flags & FIDO_DEV_WINHELLO || fido_dev_is_fido2(dev) ==
+	    false) && (r = assert_expand_allow_list(assert)) != FIDO_OK)
+		return (r);
+#ifdef USE_WINHELLO
+	if (dev->flags & FIDO_DEV_WINHELLO)
+		return (fido_winhello_get_assert(dev, assert, pin, ms));
+#endif
+
+	if (assert->rp_id == NULL || assert->cdh.ptr == NULL) {
+		fido_log_debug("%s: rp_id=%p, cdh.ptr=%p", __func__,
+		    (void *)assert->rp_id, (void *)assert->cdh.ptr);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	if (fido_dev_is_fido2(dev) == false) {
+		if (pin != NULL || assert->ext.mask != 0)
+			return (FIDO_ERR_UNSUPPORTED_OPTION);
+		return (u2f_authenticate(dev, assert, &ms));
+	}
+
+	if ((r = assert_preflight(dev, assert, &allow, &ms)) != FIDO_OK) {
+		fido_log_debug("%s: assert_preflight", __func__);
+		return (r);
+	}
+	saved = assert->allow_list;
+	saved_req = assert->req;
+	if (allow.ptr != NULL) {
+		assert->allow_list = allow;
+		/* the prepared request names the whole list */
+		memset(&assert->req, 0, sizeof(assert->req));
+	}
+
+	if ((r = assert_do_ecdh(dev, assert, pin, &pk, &ecdh, &ms)) != FIDO_OK) {
+		fido_log_debug("%s: assert_do_ecdh", __func__);
+		goto fail;
 	}
 
-	r = fido_dev_get_assert_wait(dev, assert, pk, ecdh, pin, &ms);
+	r = fido_dev_get_assert_wait(dev, assert, pk, ecdh, pin, NULL, &ms);
 	if (r == FIDO_OK && (assert->ext.mask & FIDO_EXT_HMAC_SECRET))
 		if (decrypt_hmac_secrets(dev, assert, ecdh) < 0) {
 			fido_log_debug("%s: decrypt_hmac_secrets", __func__);
@@ -344,12 +878,267 @@ fido_dev_get_assert(fido_dev_t *dev, fido_assert_t *assert, const char *pin)
 		}
 
 fail:
+	assert->allow_list = saved;
+	assert->req = saved_req;
+	fido_free(allow.ptr);
+	fido_dev_ecdh_result(dev, r);
+	es256_pk_free(&pk);
+	fido_blob_free(&ecdh);
+
+	return (r);
+}
+
+int
+fido_dev_get_assert(fido_dev_t *dev, fido_assert_t *assert, const char *pin)
+{
+	fido_trace_span_t span;
+	int r;
+
+	fido_sched_enter(dev);
+	fido_trace_span_begin(dev, &span, FIDO_SPAN_GET_ASSERT);
+	r = dev_get_assert(dev, assert, pin);
+	fido_trace_span_end(dev, &span, r);
+	fido_sched_leave(dev);
+
+	return (r);
+}
+
+/*
+ * Derive the hmac-secret outputs of salt, two salts per request, under
+ * one shared secret and, if user verification is wanted, one token.
+ */
+static int
+assert_hmac_secrets(fido_dev_t *dev, fido_assert_t *assert,
+    const fido_blob_t *salt, unsigned char *secret, const char *pin)
+{
+	fido_blob_t	*ecdh = NULL;
+	fido_blob_t	*token = NULL;
+	es256_pk_t	*pk = NULL;
+	fido_blob_t	*out;
+	size_t		 n;
+	int		 ms = dev->timeout_ms;
+	int		 r;
+
+	if ((r = assert_do_ecdh(dev, assert, pin, &pk, &ecdh, &ms)) != FIDO_OK) {
+		fido_log_debug("%s: assert_do_ecdh", __func__);
+		goto fail;
+	}
+	if (pin != NULL || (assert->uv == FIDO_OPT_TRUE &&
+	    fido_dev_supports_permissions(dev))) {
+		if ((token = fido_blob_new()) == NULL) {
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+		if ((r = fido_dev_get_uv_token(dev, CTAP_CBOR_ASSERT, pin, ecdh,
+		    pk, assert->rp_id, token, &ms)) != FIDO_OK) {
+			fido_log_debug("%s: fido_dev_get_uv_token", __func__);
+			goto fail;
+		}
+	}
+
+	for (size_t off = 0; off < salt->len; off += n) {
+		n = salt->len - off < 64 ? salt->len - off : 64;
+		/* each request gets a full timeout */
+		ms = dev->timeout_ms;
+		if (fido_blob_set(&assert->ext.hmac_salt, salt->ptr + off,
+		    n) < 0) {
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+		if ((r = fido_dev_get_assert_wait(dev, assert, pk, ecdh, NULL,
+		    token, &ms)) != FIDO_OK) {
+			fido_log_debug("%s: fido_dev_get_assert_wait", __func__);
+			goto fail;
+		}
+		if (decrypt_hmac_secrets(dev, assert, ecdh) < 0) {
+			fido_log_debug("%s: decrypt_hmac_secrets", __func__);
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+		out = &assert->stmt[0].hmac_secret;
+		if (assert->stmt_len != 1 || out->len != n) {
+			fido_log_debug("%s: stmt_len=%zu, len=%zu", __func__,
+			    assert->stmt_len, out->len);
+			r = FIDO_ERR_UNSUPPORTED_EXTENSION;
+			goto fail;
+		}
+		memcpy(secret + off, out->ptr, n);
+	}
+
+	r = FIDO_OK;
+fail:
+	fido_dev_ecdh_result(dev, r);
+	es256_pk_free(&pk);
+	fido_blob_free(&ecdh);
+	fido_blob_free(&token);
+
+	return (r);
+}
+
+int
+fido_dev_get_hmac_secrets(fido_dev_t *dev, fido_assert_t *assert,
+    const unsigned char *salt, size_t salt_len, unsigned char *secret,
+    size_t secret_len, const char *pin)
+{
+	fido_blob_t		s;
+	fido_assert_ext_t	saved_ext;
+	fido_opt_t		saved_up;
+	int			r;
+
+	if (salt == NULL || secret == NULL || salt_len == 0 ||
+	    salt_len % 32 != 0 || secret_len != salt_len) {
+		fido_log_debug("%s: salt_len=%zu, secret_len=%zu", __func__,
+		    salt_len, secret_len);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+	if (dev->flags & FIDO_DEV_WINHELLO || fido_dev_is_fido2(dev) == false)
+		return (FIDO_ERR_UNSUPPORTED_OPTION);
+	/* the outputs are those of one credential */
+	if (assert->rp_id == NULL || assert->cdh.ptr == NULL ||
+	    assert->allow_list.len != 1 || assert->allow_cred_list != NULL) {
+		fido_log_debug("%s: rp_id=%p, cdh.ptr=%p, allow_list.len=%zu",
+		    __func__, (void *)assert->rp_id, (void *)assert->cdh.ptr,
+		    assert->allow_list.len);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	s.ptr = (unsigned char *)(uintptr_t)salt;
+	s.len = salt_len;
+	saved_ext = assert->ext;
+	saved_up = assert->up;
+	memset(&assert->ext, 0, sizeof(assert->ext));
+	assert->ext.mask = saved_ext.mask | FIDO_EXT_HMAC_SECRET;
+	assert->up = FIDO_OPT_FALSE;
+
+	r = assert_hmac_secrets(dev, assert, &s, secret, pin);
+
+	fido_blob_reset(&assert->ext.hmac_salt);
+	assert->ext = saved_ext;
+	assert->up = saved_up;
+	fido_assert_reset_rx(assert);
+	if (r != FIDO_OK)
+		explicit_bzero(secret, secret_len);
+
+	return (r);
+}
+
+int
+fido_dev_get_assert_begin(fido_dev_t *dev, fido_assert_t *assert,
+    const char *pin)
+{
+	fido_blob_t	*ecdh = NULL;
+	es256_pk_t	*pk = NULL;
+	int		 ms = dev->timeout_ms;
+	int		 r;
+
+	if (assert->rp_id == NULL || assert->cdh.ptr == NULL) {
+		fido_log_debug("%s: rp_id=%p, cdh.ptr=%p", __func__,
+		    (void *)assert->rp_id, (void *)assert->cdh.ptr);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	if ((dev->flags & FIDO_DEV_WINHELLO || fido_dev_is_fido2(dev) ==
+	    false) && (r = assert_expand_allow_list(assert)) != FIDO_OK)
+		return (r);
+#ifdef USE_WINHELLO
+	if (dev->flags & FIDO_DEV_WINHELLO)
+		return (fido_winhello_get_assert_begin(dev, assert, pin));
+#endif
+
+	if (fido_dev_is_fido2(dev) == false) {
+		if (pin != NULL || assert->ext.mask != 0)
+			return (FIDO_ERR_UNSUPPORTED_OPTION);
+		return (u2f_authenticate_begin(dev, assert));
+	}
+
+	if ((r = fido_rx_async_begin(dev, FIDO_DEV_ASYNC_ASSERT, CTAP_CMD_CBOR,
+	    FIDO_MAXMSG)) != FIDO_OK) {
+		fido_log_debug("%s: fido_rx_async_begin", __func__);
+		return (r);
+	}
+
+	if ((r = assert_do_ecdh(dev, assert, pin, &pk, &ecdh, &ms)) != FIDO_OK) {
+		fido_log_debug("%s: assert_do_ecdh", __func__);
+		goto fail;
+	}
+
+	fido_assert_reset_rx(assert);
+
+	if ((r = fido_dev_get_assert_tx(dev, assert, pk, ecdh, pin, NULL,
+	    &ms)) != FIDO_OK) {
+		fido_log_debug("%s: fido_dev_get_assert_tx", __func__);
+		goto fail;
+	}
+
+	/* needed to decrypt hmac-secret outputs */
+	dev->async->ecdh = ecdh;
+	ecdh = NULL;
+
+	r = FIDO_OK;
+fail:
+	if (r != FIDO_OK) {
+		fido_dev_ecdh_result(dev, r);
+		fido_rx_async_end(dev);
+	}
 	es256_pk_free(&pk);
 	fido_blob_free(&ecdh);
 
 	return (r);
 }
 
+int
+fido_dev_get_assert_step(fido_dev_t *dev, fido_assert_t *assert, int *done,
+    int ms)
+{
+	struct fido_dev_async	*a = dev->async;
+	int			 ms_next = dev->timeout_ms;
+	int			 r;
+
+	*done = 0;
+
+	if (a == NULL || a->op != FIDO_DEV_ASYNC_ASSERT) {
+		fido_log_debug("%s: no assertion pending", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+	if (a->u2f != NULL)
+		return (u2f_authenticate_step(dev, assert, done, ms));
+#ifdef USE_WINHELLO
+	if (a->winhello != NULL)
+		return (fido_winhello_get_assert_step(dev, assert, done, ms));
+#endif
+
+	if ((r = fido_rx_async_step(dev, done, ms)) != FIDO_OK) {
+		fido_log_debug("%s: fido_rx_async_step", __func__);
+		goto fail;
+	}
+	if (*done == 0)
+		return (FIDO_OK); /* keep waiting */
+
+	/* user presence established; the remaining replies are immediate */
+	if ((r = parse_first_assert(dev, assert, a->buf, a->len,
+	    &ms_next)) != FIDO_OK ||
+	    (r = fido_dev_get_next_asserts(dev, a->buf, a->size, assert,
+	    &ms_next)) != FIDO_OK)
+		goto fail;
+
+	if ((assert->ext.mask & FIDO_EXT_HMAC_SECRET) &&
+	    decrypt_hmac_secrets(dev, assert, a->ecdh) < 0) {
+		fido_log_debug("%s: decrypt_hmac_secrets", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	r = FIDO_OK;
+fail:
+	fido_dev_ecdh_result(dev, r);
+	fido_rx_async_end(dev);
+	*done = r == FIDO_OK;
+
+	return (r);
+}
+
+#endif /* !FIDO_VERIFY_ONLY */
+
 int
 fido_check_flags(uint8_t flags, fido_opt_t up, fido_opt_t uv)
 {
@@ -386,49 +1175,38 @@ check_extensions(int authdata_ext, int ext)
 }
 
 static int
-get_es256_hash(fido_blob_t *dgst, const fido_blob_t *clientdata,
+get_md_hash(EVP_MD_CTX *ctx, const EVP_MD *md, size_t md_len,
+    fido_blob_t *dgst, const fido_blob_t *clientdata,
     const fido_blob_t *authdata)
 {
-	const EVP_MD	*md;
-	EVP_MD_CTX	*ctx = NULL;
-
-	if (dgst->len < SHA256_DIGEST_LENGTH ||
-	    (md = EVP_sha256()) == NULL ||
-	    (ctx = EVP_MD_CTX_new()) == NULL ||
+	if (dgst->len < md_len || md == NULL ||
 	    EVP_DigestInit_ex(ctx, md, NULL) != 1 ||
 	    EVP_DigestUpdate(ctx, authdata->ptr, authdata->len) != 1 ||
 	    EVP_DigestUpdate(ctx, clientdata->ptr, clientdata->len) != 1 ||
-	    EVP_DigestFinal_ex(ctx, dgst->ptr, NULL) != 1) {
-		EVP_MD_CTX_free(ctx);
+	    EVP_DigestFinal_ex(ctx, dgst->ptr, NULL) != 1)
 		return (-1);
-	}
-	dgst->len = SHA256_DIGEST_LENGTH;
-
-	EVP_MD_CTX_free(ctx);
+	dgst->len = md_len;
 
 	return (0);
 }
 
+/*
+ * SHA-256 over the low-level interface: the inputs are small, and the
+ * context lives on the stack, without the set-up cost of an EVP digest.
+ */
 static int
-get_es384_hash(fido_blob_t *dgst, const fido_blob_t *clientdata,
+get_sha256_hash(fido_blob_t *dgst, const fido_blob_t *clientdata,
     const fido_blob_t *authdata)
 {
-	const EVP_MD	*md;
-	EVP_MD_CTX	*ctx = NULL;
+	SHA256_CTX ctx;
 
-	if (dgst->len < SHA384_DIGEST_LENGTH ||
-	    (md = EVP_sha384()) == NULL ||
-	    (ctx = EVP_MD_CTX_new()) == NULL ||
-	    EVP_DigestInit_ex(ctx, md, NULL) != 1 ||
-	    EVP_DigestUpdate(ctx, authdata->ptr, authdata->len) != 1 ||
-	    EVP_DigestUpdate(ctx, clientdata->ptr, clientdata->len) != 1 ||
-	    EVP_DigestFinal_ex(ctx, dgst->ptr, NULL) != 1) {
-		EVP_MD_CTX_free(ctx);
+	if (dgst->len < SHA256_DIGEST_LENGTH ||
+	    SHA256_Init(&ctx) != 1 ||
+	    SHA256_Update(&ctx, authdata->ptr, authdata->len) != 1 ||
+	    SHA256_Update(&ctx, clientdata->ptr, clientdata->len) != 1 ||
+	    SHA256_Final(dgst->ptr, &ctx) != 1)
 		return (-1);
-	}
-	dgst->len = SHA384_DIGEST_LENGTH;
-
-	EVP_MD_CTX_free(ctx);
+	dgst->len = SHA256_DIGEST_LENGTH;
 
 	return (0);
 }
@@ -448,130 +1226,684 @@ get_eddsa_hash(fido_blob_t *dgst, const fido_blob_t *clientdata,
 	return (0);
 }
 
-int
-fido_get_signed_hash(int cose_alg, fido_blob_t *dgst,
-    const fido_blob_t *clientdata, const fido_blob_t *authdata_cbor)
+static int
+get_authdata_hash(EVP_MD_CTX *ctx, int cose_alg, fido_blob_t *dgst,
+    const fido_blob_t *clientdata, const fido_blob_t *authdata)
 {
-	cbor_item_t		*item = NULL;
-	fido_blob_t		 authdata;
-	struct cbor_load_result	 cbor;
-	int			 ok = -1;
+	int ok = -1;
 
 	fido_log_debug("%s: cose_alg=%d", __func__, cose_alg);
 
-	if ((item = cbor_load(authdata_cbor->ptr, authdata_cbor->len,
-	    &cbor)) == NULL || cbor_isa_bytestring(item) == false ||
-	    cbor_bytestring_is_definite(item) == false) {
-		fido_log_debug("%s: authdata", __func__);
-		goto fail;
-	}
-	authdata.ptr = cbor_bytestring_handle(item);
-	authdata.len = cbor_bytestring_length(item);
-
 	switch (cose_alg) {
 	case COSE_ES256:
 	case COSE_RS256:
-		ok = get_es256_hash(dgst, clientdata, &authdata);
+		ok = get_sha256_hash(dgst, clientdata, authdata);
 		break;
 	case COSE_ES384:
-		ok = get_es384_hash(dgst, clientdata, &authdata);
+		ok = get_md_hash(ctx, fido_evp_sha384(), SHA384_DIGEST_LENGTH,
+		    dgst, clientdata, authdata);
 		break;
 	case COSE_EDDSA:
-		ok = get_eddsa_hash(dgst, clientdata, &authdata);
+		ok = get_eddsa_hash(dgst, clientdata, authdata);
 		break;
 	default:
 		fido_log_debug("%s: unknown cose_alg", __func__);
 		break;
 	}
-fail:
-	if (item != NULL)
-		cbor_decref(&item);
 
 	return (ok);
 }
 
-int
-fido_assert_verify(const fido_assert_t *assert, size_t idx, int cose_alg,
-    const void *pk)
+/*
+ * The authenticator data inside authdata_cbor, which always holds a
+ * single definite-length byte string as serialised by libcbor; read in
+ * place, so that verification does not copy it.
+ */
+static int
+get_authdata(const fido_blob_t *authdata_cbor, fido_blob_t *authdata)
 {
-	unsigned char		 buf[1024]; /* XXX */
-	fido_blob_t		 dgst;
-	const fido_assert_stmt	*stmt = NULL;
-	int			 ok = -1;
+	const unsigned char	*p = authdata_cbor->ptr;
+	size_t			 len = authdata_cbor->len;
+	uint64_t		 n;
+	size_t			 w;
+
+	if (p == NULL || len < 1 || (p[0] >> 5) != CBOR_TYPE_BYTESTRING) {
+		fido_log_debug("%s: cbor type", __func__);
+		return (-1);
+	}
+
+	switch (p[0] & 0x1f) {
+	case 24:
+		w = 1;
+		break;
+	case 25:
+		w = 2;
+		break;
+	case 26:
+		w = 4;
+		break;
+	case 27:
+		w = 8;
+		break;
+	case 28:
+	case 29:
+	case 30:
+	case 31:
+		fido_log_debug("%s: ib=0x%02x", __func__, p[0]);
+		return (-1);
+	default:
+		w = 0;
+		break;
+	}
+
+	if (len - 1 < w) {
+		fido_log_debug("%s: len=%zu", __func__, len);
+		return (-1);
+	}
+
+	n = w ? 0 : (p[0] & 0x1f);
+	for (size_t i = 1; i <= w; i++)
+		n = (n << 8) | p[i];
+	p += 1 + w;
+	len -= 1 + w;
+
+	if (n != len) {
+		fido_log_debug("%s: n=%llu, len=%zu", __func__,
+		    (unsigned long long)n, len);
+		return (-1);
+	}
+
+	authdata->ptr = (unsigned char *)(uintptr_t)p;
+	authdata->len = len;
+
+	return (0);
+}
+
+static int
+get_signed_hash(EVP_MD_CTX *ctx, int cose_alg, fido_blob_t *dgst,
+    const fido_blob_t *clientdata, const fido_blob_t *authdata_cbor)
+{
+	fido_blob_t authdata;
+
+	if (get_authdata(authdata_cbor, &authdata) < 0) {
+		fido_log_debug("%s: authdata", __func__);
+		return (-1);
+	}
+
+	return (get_authdata_hash(ctx, cose_alg, dgst, clientdata, &authdata));
+}
+
+int
+fido_get_signed_hash(int cose_alg, fido_blob_t *dgst,
+    const fido_blob_t *clientdata, const fido_blob_t *authdata_cbor)
+{
+	EVP_MD_CTX	*ctx;
+	int		 ok;
+
+	if ((ctx = EVP_MD_CTX_new()) == NULL) {
+		fido_log_debug("%s: EVP_MD_CTX_new", __func__);
+		return (-1);
+	}
+
+	ok = get_signed_hash(ctx, cose_alg, dgst, clientdata, authdata_cbor);
+	EVP_MD_CTX_free(ctx);
+
+	return (ok);
+}
+
+/*
+ * State shared between consecutive assertion verifications: a digest
+ * context, and the decoded form of the last public key used. If 'fixed'
+ * is set, pkey is borrowed from a fido_verify_key_t and never replaced.
+ */
+typedef struct verify_ctx {
+	EVP_MD_CTX	*mdctx;    /* reusable digest context */
+	int		 cose_alg; /* cose algorithm of pk */
+	const void	*pk;       /* public key from which pkey was built */
+	EVP_PKEY	*pkey;     /* decoded public key */
+	bool		 fixed;    /* pkey is borrowed */
+} verify_ctx_t;
+
+static int
+verify_ctx_init(verify_ctx_t *ctx)
+{
+	memset(ctx, 0, sizeof(*ctx));
+
+	if ((ctx->mdctx = EVP_MD_CTX_new()) == NULL) {
+		fido_log_debug("%s: EVP_MD_CTX_new", __func__);
+		return (-1);
+	}
+
+	return (0);
+}
+
+static void
+verify_ctx_reset(verify_ctx_t *ctx)
+{
+	EVP_MD_CTX_free(ctx->mdctx);
+	if (ctx->fixed == false)
+		EVP_PKEY_free(ctx->pkey);
+	memset(ctx, 0, sizeof(*ctx));
+}
+
+static EVP_PKEY *
+verify_ctx_get_pkey(verify_ctx_t *ctx, int cose_alg, const void *pk)
+{
+	if (ctx->pkey != NULL && ctx->pk == pk && ctx->cose_alg == cose_alg)
+		return (ctx->pkey);
+	if (ctx->fixed)
+		return (NULL);
+
+	EVP_PKEY_free(ctx->pkey);
+	ctx->pkey = NULL;
+	ctx->pk = NULL;
+
+	switch (cose_alg) {
+	case COSE_ES256:
+		ctx->pkey = es256_pk_to_EVP_PKEY(pk);
+		break;
+	case COSE_ES384:
+		ctx->pkey = es384_pk_to_EVP_PKEY(pk);
+		break;
+	case COSE_RS256:
+		ctx->pkey = rs256_pk_to_EVP_PKEY(pk);
+		break;
+	case COSE_EDDSA:
+		ctx->pkey = eddsa_pk_to_EVP_PKEY(pk);
+		break;
+	}
+
+	if (ctx->pkey != NULL) {
+		ctx->cose_alg = cose_alg;
+		ctx->pk = pk;
+	}
+
+	return (ctx->pkey);
+}
+
+static int
+verify_sig(int cose_alg, const fido_blob_t *dgst, EVP_PKEY *pkey,
+    const fido_blob_t *sig)
+{
+	int ok;
+
+	switch (cose_alg) {
+	case COSE_ES256:
+		ok = es256_verify_sig(dgst, pkey, sig);
+		break;
+	case COSE_ES384:
+		ok = es384_verify_sig(dgst, pkey, sig);
+		break;
+	case COSE_RS256:
+		ok = rs256_verify_sig(dgst, pkey, sig);
+		break;
+	case COSE_EDDSA:
+		ok = eddsa_verify_sig(dgst, pkey, sig);
+		break;
+	default:
+		fido_log_debug("%s: unsupported cose_alg %d", __func__,
+		    cose_alg);
+		return (FIDO_ERR_UNSUPPORTED_OPTION);
+	}
+
+	return (ok < 0 ? FIDO_ERR_INVALID_SIG : FIDO_OK);
+}
+
+/*
+ * ES384: the digest of authdata || clientdata is fed to the verifier as
+ * it is computed, instead of being finalised into a buffer first.
+ */
+static int
+verify_ecdsa_sig(EVP_MD_CTX *ctx, const EVP_MD *md, EVP_PKEY *pkey,
+    const fido_blob_t *clientdata, const fido_blob_t *authdata,
+    const fido_blob_t *sig)
+{
+	int ok = -1;
+
+	if (md == NULL || EVP_PKEY_base_id(pkey) != EVP_PKEY_EC) {
+		fido_log_debug("%s: md=%p, pkey type", __func__,
+		    (const void *)md);
+		goto fail;
+	}
+
+	if (fido_evp_verify_init(ctx, md, pkey) != 1 ||
+	    EVP_DigestVerifyUpdate(ctx, authdata->ptr, authdata->len) != 1 ||
+	    EVP_DigestVerifyUpdate(ctx, clientdata->ptr,
+	    clientdata->len) != 1 ||
+	    EVP_DigestVerifyFinal(ctx, sig->ptr, sig->len) != 1) {
+		fido_log_debug("%s: EVP_DigestVerify", __func__);
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+	/* drop the key's context, so ctx may be reused for plain digests */
+	EVP_MD_CTX_reset(ctx);
+
+	return (ok);
+}
+
+static int
+verify_authdata_sig(EVP_MD_CTX *ctx, int cose_alg, EVP_PKEY *pkey,
+    const fido_blob_t *clientdata, const fido_blob_t *authdata,
+    const fido_blob_t *sig)
+{
+	unsigned char	buf[1024]; /* XXX */
+	fido_blob_t	dgst;
+	int		r;
+
+	/*
+	 * ES256 is hashed into dgst and verified by es256_verify_sig(),
+	 * whose direct route is cheaper than EVP_DigestVerify*().
+	 */
+	FIDO_PROBE2(verify__start, cose_alg, authdata->len);
+	switch (cose_alg) {
+	case COSE_ES384:
+		r = verify_ecdsa_sig(ctx, fido_evp_sha384(), pkey, clientdata,
+		    authdata, sig) < 0 ? FIDO_ERR_INVALID_SIG : FIDO_OK;
+		goto done;
+	}
+
+	dgst.ptr = buf;
+	dgst.len = sizeof(buf);
+
+	if (get_authdata_hash(ctx, cose_alg, &dgst, clientdata,
+	    authdata) < 0) {
+		fido_log_debug("%s: get_authdata_hash", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto out;
+	}
+
+	/* ed25519 reuses ctx, which a batch shares between signatures */
+	if (cose_alg == COSE_EDDSA)
+		r = eddsa_verify_sig_ctx(ctx, &dgst, pkey, sig) < 0 ?
+		    FIDO_ERR_INVALID_SIG : FIDO_OK;
+	else
+		r = verify_sig(cose_alg, &dgst, pkey, sig);
+out:
+	explicit_bzero(buf, sizeof(buf));
+done:
+	FIDO_PROBE2(verify__done, cose_alg, r);
+
+	return (r);
+}
+
+static int
+assert_verify(verify_ctx_t *ctx, const fido_assert_t *assert, size_t idx,
+    int cose_alg, const void *pk)
+{
+	fido_blob_t		 authdata;
+	const fido_assert_stmt	*stmt = NULL;
+	EVP_PKEY		*pkey;
+	int			 r;
+
+	if (idx >= assert->stmt_len || pk == NULL) {
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto out;
+	}
+
+	stmt = &assert->stmt[idx];
+
+	/* do we have everything we need? */
+	if (assert->cdh.ptr == NULL || assert->rp_id == NULL ||
+	    stmt->authdata_cbor.ptr == NULL || stmt->sig.ptr == NULL) {
+		fido_log_debug("%s: cdh=%p, rp_id=%s, authdata=%p, sig=%p",
+		    __func__, (void *)assert->cdh.ptr, assert->rp_id,
+		    (void *)stmt->authdata_cbor.ptr, (void *)stmt->sig.ptr);
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto out;
+	}
+
+	if (fido_check_flags(stmt->authdata.flags, assert->up,
+	    assert->uv) < 0) {
+		fido_log_debug("%s: fido_check_flags", __func__);
+		r = FIDO_ERR_INVALID_PARAM;
+		goto out;
+	}
+
+	if (check_extensions(stmt->authdata_ext.mask, assert->ext.mask) < 0) {
+		fido_log_debug("%s: check_extensions", __func__);
+		r = FIDO_ERR_INVALID_PARAM;
+		goto out;
+	}
+
+	if (fido_check_rp_id_hash(assert->rp_id_hash,
+	    stmt->authdata.rp_id_hash) != 0) {
+		fido_log_debug("%s: fido_check_rp_id_hash", __func__);
+		r = FIDO_ERR_INVALID_PARAM;
+		goto out;
+	}
+
+	if (get_authdata(&stmt->authdata_cbor, &authdata) < 0) {
+		fido_log_debug("%s: get_authdata", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto out;
+	}
+
+	if ((pkey = verify_ctx_get_pkey(ctx, cose_alg, pk)) == NULL) {
+		fido_log_debug("%s: verify_ctx_get_pkey", __func__);
+		r = FIDO_ERR_INVALID_SIG;
+		goto out;
+	}
+
+	r = verify_authdata_sig(ctx->mdctx, cose_alg, pkey, &assert->cdh,
+	    &authdata, &stmt->sig);
+out:
+	return (r);
+}
+
+int
+fido_assert_verify(const fido_assert_t *assert, size_t idx, int cose_alg,
+    const void *pk)
+{
+	verify_ctx_t	ctx;
+	int		r;
+
+	if (verify_ctx_init(&ctx) < 0)
+		return (FIDO_ERR_INTERNAL);
+
+	r = assert_verify(&ctx, assert, idx, cose_alg, pk);
+	verify_ctx_reset(&ctx);
+
+	return (r);
+}
+
+int
+fido_assert_verify_with_key(const fido_assert_t *assert, size_t idx,
+    const fido_verify_key_t *key)
+{
+	verify_ctx_t	ctx;
+	int		r;
+
+	if (key == NULL || key->pkey == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	if (verify_ctx_init(&ctx) < 0)
+		return (FIDO_ERR_INTERNAL);
+
+	ctx.cose_alg = key->type;
+	ctx.pk = key;
+	ctx.pkey = key->pkey;
+	ctx.fixed = true;
+
+	r = assert_verify(&ctx, assert, idx, key->type, key);
+	verify_ctx_reset(&ctx);
+
+	return (r);
+}
+
+int
+fido_assert_verify_view(const fido_assert_t *assert,
+    const fido_authdata_view_t *view, const unsigned char *sig, size_t sig_len,
+    const fido_verify_key_t *key)
+{
+	fido_blob_t	 authdata;
+	fido_blob_t	 sigblob;
+	EVP_MD_CTX	*mdctx = NULL;
+	int		 r;
+
+	if (view == NULL || view->ptr == NULL || sig == NULL || sig_len == 0 ||
+	    key == NULL || key->pkey == NULL) {
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto out;
+	}
+
+	/* do we have everything we need? */
+	if (assert->cdh.ptr == NULL || assert->rp_id == NULL) {
+		fido_log_debug("%s: cdh=%p, rp_id=%s", __func__,
+		    (void *)assert->cdh.ptr, assert->rp_id);
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto out;
+	}
+
+	if (fido_check_flags(view->flags, assert->up, assert->uv) < 0) {
+		fido_log_debug("%s: fido_check_flags", __func__);
+		r = FIDO_ERR_INVALID_PARAM;
+		goto out;
+	}
+
+	if (check_extensions(view->ext, assert->ext.mask) < 0) {
+		fido_log_debug("%s: check_extensions", __func__);
+		r = FIDO_ERR_INVALID_PARAM;
+		goto out;
+	}
+
+	if (fido_check_rp_id_hash(assert->rp_id_hash, view->rp_id_hash) != 0) {
+		fido_log_debug("%s: fido_check_rp_id_hash", __func__);
+		r = FIDO_ERR_INVALID_PARAM;
+		goto out;
+	}
+
+	authdata.ptr = (unsigned char *)(uintptr_t)view->ptr;
+	authdata.len = view->len;
+	sigblob.ptr = (unsigned char *)(uintptr_t)sig;
+	sigblob.len = sig_len;
+
+	if ((mdctx = EVP_MD_CTX_new()) == NULL) {
+		fido_log_debug("%s: EVP_MD_CTX_new", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto out;
+	}
+
+	r = verify_authdata_sig(mdctx, key->type, key->pkey, &assert->cdh,
+	    &authdata, &sigblob);
+out:
+	EVP_MD_CTX_free(mdctx);
+
+	return (r);
+}
+
+/*
+ * Whether sig is shaped like an ECDSA-Sig-Value in DER, SEQUENCE { INTEGER
+ * r, INTEGER s }, with positive, minimally encoded integers of at most n
+ * bytes. ECDSA_verify() only accepts signatures in DER.
+ */
+static bool
+ecdsa_sig_shape(const unsigned char *p, size_t len, size_t n)
+{
+	size_t ilen;
+
+	if (len < 8 || p[0] != 0x30 || p[1] != len - 2)
+		return (false);
+	p += 2;
+	len -= 2;
+
+	for (int i = 0; i < 2; i++) {
+		if (len < 3 || p[0] != 0x02 || (ilen = p[1]) == 0 ||
+		    ilen > len - 2 || ilen > n + 1 || (p[2] & 0x80) ||
+		    (ilen > 1 && p[2] == 0 && !(p[3] & 0x80)) ||
+		    (ilen == n + 1 && p[2] != 0))
+			return (false);
+		p += 2 + ilen;
+		len -= 2 + ilen;
+	}
+
+	return (len == 0);
+}
+
+static bool
+sig_shape(int cose_alg, const unsigned char *sig, size_t sig_len)
+{
+	switch (cose_alg) {
+	case COSE_ES256:
+		return (ecdsa_sig_shape(sig, sig_len, 32));
+	case COSE_ES384:
+		return (ecdsa_sig_shape(sig, sig_len, 48));
+	case COSE_EDDSA:
+		return (sig_len == 64);
+	case COSE_RS256:
+	case COSE_RS1:
+		/* the length of the modulus, from 1024 to 8192 bits */
+		return (sig_len >= 128 && sig_len <= 1024);
+	default:
+		return (false);
+	}
+}
+
+/*
+ * The checks of an assertion against a fido_rp_verifier_t that need no
+ * key: the algorithm, the authenticator data, which must hold nothing
+ * past its extensions, and the shape of the signature.
+ */
+static int
+rp_verifier_check(const fido_rp_verifier_t *v, fido_authdata_view_t *view,
+    const unsigned char *authdata_ptr, size_t authdata_len,
+    const unsigned char *sig_ptr, size_t sig_len, int cose_alg)
+{
+	bool	allowed;
+	int	r;
+
+	allowed = v->ntype == 0;
+	for (size_t i = 0; i < v->ntype && !allowed; i++)
+		allowed = v->type[i] == cose_alg;
+	if (!allowed) {
+		fido_log_debug("%s: cose_alg %d", __func__, cose_alg);
+		return (FIDO_ERR_UNSUPPORTED_ALGORITHM);
+	}
+
+	if ((r = fido_authdata_view_set(view, authdata_ptr,
+	    authdata_len)) != FIDO_OK) {
+		fido_log_debug("%s: fido_authdata_view_set", __func__);
+		return (r);
+	}
+
+	if (view->len != sizeof(fido_authdata_t) + view->ext_len) {
+		fido_log_debug("%s: len=%zu", __func__, view->len);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	if (fido_check_flags(view->flags, v->up, v->uv) < 0) {
+		fido_log_debug("%s: fido_check_flags", __func__);
+		return (FIDO_ERR_INVALID_PARAM);
+	}
+
+	if (check_extensions(view->ext, v->ext) < 0) {
+		fido_log_debug("%s: check_extensions", __func__);
+		return (FIDO_ERR_INVALID_PARAM);
+	}
+
+	if (fido_check_rp_id_hash(v->rp_id_hash, view->rp_id_hash) != 0) {
+		fido_log_debug("%s: fido_check_rp_id_hash", __func__);
+		return (FIDO_ERR_INVALID_PARAM);
+	}
+
+	if (!sig_shape(cose_alg, sig_ptr, sig_len)) {
+		fido_log_debug("%s: sig_shape", __func__);
+		return (FIDO_ERR_INVALID_SIG);
+	}
+
+	return (FIDO_OK);
+}
+
+/*
+ * Reject an assertion fido_rp_verifier_verify() would reject before its
+ * signature is verified, without a key, allocations or hashing.
+ */
+int
+fido_rp_verifier_precheck(const fido_rp_verifier_t *v,
+    const unsigned char *authdata_ptr, size_t authdata_len,
+    const unsigned char *sig_ptr, size_t sig_len, int cose_alg)
+{
+	fido_authdata_view_t view;
+
+	if (v->rp_id_set == false || sig_ptr == NULL || sig_len == 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	return (rp_verifier_check(v, &view, authdata_ptr, authdata_len,
+	    sig_ptr, sig_len, cose_alg));
+}
+
+/*
+ * Verify an assertion against a fido_rp_verifier_t. Nothing is copied or
+ * allocated, except for the digest context that ES384 and EdDSA need.
+ */
+int
+fido_rp_verifier_verify(const fido_rp_verifier_t *v,
+    const unsigned char *authdata_ptr, size_t authdata_len,
+    const unsigned char *cdh_ptr, size_t cdh_len,
+    const unsigned char *sig_ptr, size_t sig_len,
+    const fido_verify_key_t *key)
+{
+	fido_authdata_view_t	 view;
+	fido_blob_t		 authdata;
+	fido_blob_t		 cdh;
+	fido_blob_t		 sig;
+	EVP_MD_CTX		*mdctx = NULL;
+	unsigned char		 dgst[SHA256_DIGEST_LENGTH];
 	int			 r;
 
-	dgst.ptr = buf;
-	dgst.len = sizeof(buf);
-
-	if (idx >= assert->stmt_len || pk == NULL) {
+	if (v->rp_id_set == false || cdh_ptr == NULL || cdh_len == 0 ||
+	    sig_ptr == NULL || sig_len == 0 || key == NULL ||
+	    key->pkey == NULL) {
 		r = FIDO_ERR_INVALID_ARGUMENT;
 		goto out;
 	}
 
-	stmt = &assert->stmt[idx];
-
-	/* do we have everything we need? */
-	if (assert->cdh.ptr == NULL || assert->rp_id == NULL ||
-	    stmt->authdata_cbor.ptr == NULL || stmt->sig.ptr == NULL) {
-		fido_log_debug("%s: cdh=%p, rp_id=%s, authdata=%p, sig=%p",
-		    __func__, (void *)assert->cdh.ptr, assert->rp_id,
-		    (void *)stmt->authdata_cbor.ptr, (void *)stmt->sig.ptr);
-		r = FIDO_ERR_INVALID_ARGUMENT;
+	if ((r = rp_verifier_check(v, &view, authdata_ptr, authdata_len,
+	    sig_ptr, sig_len, key->type)) != FIDO_OK)
 		goto out;
-	}
 
-	if (fido_check_flags(stmt->authdata.flags, assert->up,
-	    assert->uv) < 0) {
-		fido_log_debug("%s: fido_check_flags", __func__);
-		r = FIDO_ERR_INVALID_PARAM;
-		goto out;
+	authdata.ptr = (unsigned char *)(uintptr_t)view.ptr;
+	authdata.len = view.len;
+	cdh.ptr = (unsigned char *)(uintptr_t)cdh_ptr;
+	cdh.len = cdh_len;
+	sig.ptr = (unsigned char *)(uintptr_t)sig_ptr;
+	sig.len = sig_len;
+
+	/* the policy is checked above; the cache only holds signatures */
+	if (v->cache != NULL) {
+		if (fido_verify_cache_digest(key, &authdata, &cdh, &sig,
+		    dgst) < 0) {
+			fido_log_debug("%s: fido_verify_cache_digest",
+			    __func__);
+			r = FIDO_ERR_INTERNAL;
+			goto out;
+		}
+		if (fido_verify_cache_get(v->cache, dgst, &r) == FIDO_OK)
+			goto out;
 	}
 
-	if (check_extensions(stmt->authdata_ext.mask, assert->ext.mask) < 0) {
-		fido_log_debug("%s: check_extensions", __func__);
-		r = FIDO_ERR_INVALID_PARAM;
+	if ((key->type == COSE_ES384 || key->type == COSE_EDDSA) &&
+	    (mdctx = EVP_MD_CTX_new()) == NULL) {
+		fido_log_debug("%s: EVP_MD_CTX_new", __func__);
+		r = FIDO_ERR_INTERNAL;
 		goto out;
 	}
 
-	if (fido_check_rp_id(assert->rp_id, stmt->authdata.rp_id_hash) != 0) {
-		fido_log_debug("%s: fido_check_rp_id", __func__);
-		r = FIDO_ERR_INVALID_PARAM;
-		goto out;
-	}
+	r = verify_authdata_sig(mdctx, key->type, key->pkey, &cdh, &authdata,
+	    &sig);
+	if (v->cache != NULL && (r == FIDO_OK || r == FIDO_ERR_INVALID_SIG))
+		fido_verify_cache_put(v->cache, dgst, r);
+out:
+	EVP_MD_CTX_free(mdctx);
 
-	if (fido_get_signed_hash(cose_alg, &dgst, &assert->cdh,
-	    &stmt->authdata_cbor) < 0) {
-		fido_log_debug("%s: fido_get_signed_hash", __func__);
-		r = FIDO_ERR_INTERNAL;
-		goto out;
-	}
+	return (r);
+}
 
-	switch (cose_alg) {
-	case COSE_ES256:
-		ok = es256_pk_verify_sig(&dgst, pk, &stmt->sig);
-		break;
-	case COSE_ES384:
-		ok = es384_pk_verify_sig(&dgst, pk, &stmt->sig);
-		break;
-	case COSE_RS256:
-		ok = rs256_pk_verify_sig(&dgst, pk, &stmt->sig);
-		break;
-	case COSE_EDDSA:
-		ok = eddsa_pk_verify_sig(&dgst, pk, &stmt->sig);
-		break;
-	default:
-		fido_log_debug("%s: unsupported cose_alg %d", __func__,
-		    cose_alg);
-		r = FIDO_ERR_UNSUPPORTED_OPTION;
-		goto out;
+int
+fido_assert_verify_batch(const fido_assert_verify_item_t *item, size_t n,
+    int *result)
+{
+	verify_ctx_t	ctx;
+	int		r = FIDO_OK;
+
+	if (item == NULL || result == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	if (verify_ctx_init(&ctx) < 0)
+		return (FIDO_ERR_INTERNAL);
+
+	for (size_t i = 0; i < n; i++) {
+		if (item[i].assert == NULL)
+			result[i] = FIDO_ERR_INVALID_ARGUMENT;
+		else
+			result[i] = assert_verify(&ctx, item[i].assert,
+			    item[i].idx, item[i].cose_alg, item[i].pk);
+		if (result[i] != FIDO_OK && r == FIDO_OK)
+			r = result[i];
 	}
 
-	if (ok < 0)
-		r = FIDO_ERR_INVALID_SIG;
-	else
-		r = FIDO_OK;
-out:
-	explicit_bzero(buf, sizeof(buf));
+	verify_ctx_reset(&ctx);
 
 	return (r);
 }
@@ -592,6 +1924,39 @@ fido_assert_set_clientdata(fido_assert_t *assert, const unsigned char *data,
 	return (FIDO_OK);
 }
 
+/*
+ * As fido_assert_set_clientdata(), once the client data has been checked
+ * against the expected challenge and origin.
+ */
+int
+fido_assert_set_clientdata_checked(fido_assert_t *assert,
+    const unsigned char *data, size_t data_len, const unsigned char *challenge,
+    size_t challenge_len, const char *origin, int flags)
+{
+	unsigned char	cdh[SHA256_DIGEST_LENGTH];
+	fido_blob_t	chal;
+	int		r;
+
+	if (!fido_blob_is_empty(&assert->cdh) || data == NULL ||
+	    data_len == 0 || challenge == NULL || challenge_len == 0 ||
+	    origin == NULL || (flags & ~FIDO_CLIENTDATA_CROSS_ORIGIN) != 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	chal.ptr = (unsigned char *)(uintptr_t)challenge;
+	chal.len = challenge_len;
+	if ((r = fido_json_clientdata(data, data_len, "webauthn.get", &chal,
+	    origin, flags, cdh)) != FIDO_OK)
+		return (r);
+	if (fido_blob_set(&assert->cd, data, data_len) < 0)
+		return (FIDO_ERR_INTERNAL);
+	if (fido_blob_set(&assert->cdh, cdh, sizeof(cdh)) < 0) {
+		fido_blob_reset(&assert->cd);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	return (FIDO_OK);
+}
+
 int
 fido_assert_set_clientdata_hash(fido_assert_t *assert,
     const unsigned char *hash, size_t hash_len)
@@ -603,6 +1968,28 @@ fido_assert_set_clientdata_hash(fido_assert_t *assert,
 	return (FIDO_OK);
 }
 
+int
+fido_assert_set_clientdata_hash_borrow(fido_assert_t *assert,
+    const unsigned char *hash, size_t hash_len)
+{
+	if (!fido_blob_is_empty(&assert->cd) ||
+	    fido_blob_borrow(&assert->cdh, hash, hash_len) < 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	return (FIDO_OK);
+}
+
+int
+fido_assert_set_clientdata_hash_take(fido_assert_t *assert,
+    unsigned char *hash, size_t hash_len)
+{
+	if (!fido_blob_is_empty(&assert->cd) ||
+	    fido_blob_take(&assert->cdh, hash, hash_len) < 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	return (FIDO_OK);
+}
+
 int
 fido_assert_set_hmac_salt(fido_assert_t *assert, const unsigned char *salt,
     size_t salt_len)
@@ -614,6 +2001,116 @@ fido_assert_set_hmac_salt(fido_assert_t *assert, const unsigned char *salt,
 	return (FIDO_OK);
 }
 
+/* the hmac-secret salt of a prf input: SHA-256("WebAuthn PRF" || 0 || in) */
+static int
+prf_salt(EVP_MD_CTX *ctx, const unsigned char *in, size_t in_len,
+    unsigned char *salt)
+{
+	static const unsigned char label[] = "WebAuthn PRF";
+
+	if (EVP_DigestInit_ex(ctx, fido_evp_sha256(), NULL) != 1 ||
+	    EVP_DigestUpdate(ctx, label, sizeof(label)) != 1 ||
+	    EVP_DigestUpdate(ctx, in, in_len) != 1 ||
+	    EVP_DigestFinal_ex(ctx, salt, NULL) != 1)
+		return (-1);
+
+	return (0);
+}
+
+static int
+prf_salts(const unsigned char *first, size_t first_len,
+    const unsigned char *second, size_t second_len, fido_blob_t *salt)
+{
+	EVP_MD_CTX	*ctx = NULL;
+	unsigned char	 buf[2 * SHA256_DIGEST_LENGTH];
+	int		 ok = -1;
+
+	if ((ctx = EVP_MD_CTX_new()) == NULL ||
+	    prf_salt(ctx, first, first_len, buf) < 0 ||
+	    (second != NULL && prf_salt(ctx, second, second_len,
+	    buf + SHA256_DIGEST_LENGTH) < 0) ||
+	    fido_blob_set(salt, buf, second != NULL ? sizeof(buf) :
+	    SHA256_DIGEST_LENGTH) < 0) {
+		fido_log_debug("%s: prf_salt", __func__);
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+	EVP_MD_CTX_free(ctx);
+	explicit_bzero(buf, sizeof(buf));
+
+	return (ok);
+}
+
+int
+fido_assert_set_prf(fido_assert_t *assert, const unsigned char *first,
+    size_t first_len, const unsigned char *second, size_t second_len)
+{
+	fido_blob_t salt;
+
+	memset(&salt, 0, sizeof(salt));
+
+	if (first == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if (prf_salts(first, first_len, second, second_len, &salt) < 0)
+		return (FIDO_ERR_INTERNAL);
+	fido_blob_reset(&assert->ext.hmac_salt);
+	assert->ext.hmac_salt = salt;
+
+	return (FIDO_OK);
+}
+
+int
+fido_assert_set_prf_cred(fido_assert_t *assert, const unsigned char *id,
+    size_t id_len, const unsigned char *first, size_t first_len,
+    const unsigned char *second, size_t second_len)
+{
+	fido_assert_ext_t	*ext = &assert->ext;
+	fido_blob_t		 cred_id, salt;
+	fido_blob_t		*ids, *salts;
+	size_t			 n = ext->prf_id.len;
+
+	memset(&cred_id, 0, sizeof(cred_id));
+	memset(&salt, 0, sizeof(salt));
+
+	if (id == NULL || id_len == 0 || first == NULL || n == SIZE_MAX)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if (prf_salts(first, first_len, second, second_len, &salt) < 0)
+		return (FIDO_ERR_INTERNAL);
+
+	/* a credential's inputs replace those it had */
+	for (size_t i = 0; i < n; i++)
+		if (ext->prf_id.ptr[i].len == id_len &&
+		    memcmp(ext->prf_id.ptr[i].ptr, id, id_len) == 0) {
+			fido_blob_reset(&ext->prf_salt.ptr[i]);
+			ext->prf_salt.ptr[i] = salt;
+			return (FIDO_OK);
+		}
+
+	if (fido_blob_set(&cred_id, id, id_len) < 0 ||
+	    (ids = fido_recallocarray(ext->prf_id.ptr, n, n + 1,
+	    sizeof(*ids))) == NULL) {
+		fido_blob_reset(&cred_id);
+		fido_blob_reset(&salt);
+		return (FIDO_ERR_INTERNAL);
+	}
+	ext->prf_id.ptr = ids;
+	if ((salts = fido_recallocarray(ext->prf_salt.ptr, n, n + 1,
+	    sizeof(*salts))) == NULL) {
+		fido_blob_reset(&cred_id);
+		fido_blob_reset(&salt);
+		return (FIDO_ERR_INTERNAL);
+	}
+	ext->prf_salt.ptr = salts;
+	ext->prf_id.ptr[n] = cred_id;
+	ext->prf_salt.ptr[n] = salt;
+	ext->prf_id.len++;
+	ext->prf_salt.len++;
+
+	return (FIDO_OK);
+}
+
 int
 fido_assert_set_hmac_secret(fido_assert_t *assert, size_t idx,
     const unsigned char *secret, size_t secret_len)
@@ -629,16 +2126,26 @@ fido_assert_set_hmac_secret(fido_assert_t *assert, size_t idx,
 int
 fido_assert_set_rp(fido_assert_t *assert, const char *id)
 {
+	assert_reset_req(assert);
+
 	if (assert->rp_id != NULL) {
-		free(assert->rp_id);
+		fido_free(assert->rp_id);
 		assert->rp_id = NULL;
 	}
 
 	if (id == NULL)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
-	if ((assert->rp_id = strdup(id)) == NULL)
+	if ((assert->rp_id = fido_strdup(id)) == NULL)
+		return (FIDO_ERR_INTERNAL);
+	/* hashed once, for every verification that follows */
+	if (SHA256((const unsigned char *)id, strlen(id),
+	    assert->rp_id_hash) != assert->rp_id_hash) {
+		fido_log_debug("%s: sha256", __func__);
+		fido_free(assert->rp_id);
+		assert->rp_id = NULL;
 		return (FIDO_ERR_INTERNAL);
+	}
 
 	return (FIDO_OK);
 }
@@ -653,13 +2160,14 @@ fido_assert_allow_cred(fido_assert_t *assert, const unsigned char *ptr,
 
 	memset(&id, 0, sizeof(id));
 
-	if (assert->allow_list.len == SIZE_MAX) {
+	if (assert->allow_list.len >= FIDO_MAXALLOW ||
+	    assert->allow_cred_list != NULL) {
 		r = FIDO_ERR_INVALID_ARGUMENT;
 		goto fail;
 	}
 
 	if (fido_blob_set(&id, ptr, len) < 0 || (list_ptr =
-	    recallocarray(assert->allow_list.ptr, assert->allow_list.len,
+	    fido_recallocarray(assert->allow_list.ptr, assert->allow_list.len,
 	    assert->allow_list.len + 1, sizeof(fido_blob_t))) == NULL) {
 		r = FIDO_ERR_INVALID_ARGUMENT;
 		goto fail;
@@ -667,15 +2175,31 @@ fido_assert_allow_cred(fido_assert_t *assert, const unsigned char *ptr,
 
 	list_ptr[assert->allow_list.len++] = id;
 	assert->allow_list.ptr = list_ptr;
+	assert_reset_req(assert);
 
 	return (FIDO_OK);
 fail:
-	free(id.ptr);
+	fido_free(id.ptr);
 
 	return (r);
 
 }
 
+int
+fido_assert_set_allow_list(fido_assert_t *assert, const fido_cred_list_t *l,
+    size_t batch)
+{
+	if (l != NULL && batch >= fido_cred_list_batch_count(l))
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	fido_free_blob_array(&assert->allow_list);
+	assert->allow_cred_list = l;
+	assert->allow_batch = l != NULL ? batch : 0;
+	assert_reset_req(assert);
+
+	return (FIDO_OK);
+}
+
 int
 fido_assert_set_extensions(fido_assert_t *assert, int ext)
 {
@@ -686,6 +2210,7 @@ fido_assert_set_extensions(fido_assert_t *assert, int ext)
 			return (FIDO_ERR_INVALID_ARGUMENT);
 		assert->ext.mask |= ext;
 	}
+	assert_reset_req(assert);
 
 	return (FIDO_OK);
 }
@@ -730,22 +2255,27 @@ fido_assert_clientdata_hash_len(const fido_assert_t *assert)
 fido_assert_t *
 fido_assert_new(void)
 {
-	return (calloc(1, sizeof(fido_assert_t)));
+	return (fido_calloc(1, sizeof(fido_assert_t)));
 }
 
 void
 fido_assert_reset_tx(fido_assert_t *assert)
 {
-	free(assert->rp_id);
+	fido_free(assert->rp_id);
 	fido_blob_reset(&assert->cd);
 	fido_blob_reset(&assert->cdh);
 	fido_blob_reset(&assert->ext.hmac_salt);
+	fido_free_blob_array(&assert->ext.prf_id);
+	fido_free_blob_array(&assert->ext.prf_salt);
 	fido_free_blob_array(&assert->allow_list);
 	memset(&assert->ext, 0, sizeof(assert->ext));
 	memset(&assert->allow_list, 0, sizeof(assert->allow_list));
+	assert->allow_cred_list = NULL;
+	assert->allow_batch = 0;
 	assert->rp_id = NULL;
 	assert->up = FIDO_OPT_OMIT;
 	assert->uv = FIDO_OPT_OMIT;
+	assert_reset_req(assert);
 }
 
 static void
@@ -760,19 +2290,17 @@ void
 fido_assert_reset_rx(fido_assert_t *assert)
 {
 	for (size_t i = 0; i < assert->stmt_cnt; i++) {
-		free(assert->stmt[i].user.icon);
-		free(assert->stmt[i].user.name);
-		free(assert->stmt[i].user.display_name);
-		fido_blob_reset(&assert->stmt[i].user.id);
+		stmt_reset_deferred(&assert->stmt[i]);
+		fido_blob_reset(&assert->stmt[i].raw);
 		fido_blob_reset(&assert->stmt[i].id);
 		fido_blob_reset(&assert->stmt[i].hmac_secret);
 		fido_blob_reset(&assert->stmt[i].authdata_cbor);
-		fido_blob_reset(&assert->stmt[i].largeblob_key);
 		fido_blob_reset(&assert->stmt[i].sig);
 		fido_assert_reset_extattr(&assert->stmt[i].authdata_ext);
 		memset(&assert->stmt[i], 0, sizeof(assert->stmt[i]));
 	}
-	free(assert->stmt);
+	fido_free(assert->stmt);
+	fido_arena_free(&assert->arena);
 	assert->stmt = NULL;
 	assert->stmt_len = 0;
 	assert->stmt_cnt = 0;
@@ -787,7 +2315,7 @@ fido_assert_free(fido_assert_t **assert_p)
 		return;
 	fido_assert_reset_tx(assert);
 	fido_assert_reset_rx(assert);
-	free(assert);
+	fido_free(assert);
 	*assert_p = NULL;
 }
 
@@ -878,46 +2406,56 @@ fido_assert_id_len(const fido_assert_t *assert, size_t idx)
 const unsigned char *
 fido_assert_user_id_ptr(const fido_assert_t *assert, size_t idx)
 {
-	if (idx >= assert->stmt_len)
+	const fido_assert_stmt *stmt;
+
+	if ((stmt = stmt_decode_deferred(assert, idx)) == NULL)
 		return (NULL);
 
-	return (assert->stmt[idx].user.id.ptr);
+	return (stmt->user.id.ptr);
 }
 
 size_t
 fido_assert_user_id_len(const fido_assert_t *assert, size_t idx)
 {
-	if (idx >= assert->stmt_len)
+	const fido_assert_stmt *stmt;
+
+	if ((stmt = stmt_decode_deferred(assert, idx)) == NULL)
 		return (0);
 
-	return (assert->stmt[idx].user.id.len);
+	return (stmt->user.id.len);
 }
 
 const char *
 fido_assert_user_icon(const fido_assert_t *assert, size_t idx)
 {
-	if (idx >= assert->stmt_len)
+	const fido_assert_stmt *stmt;
+
+	if ((stmt = stmt_decode_deferred(assert, idx)) == NULL)
 		return (NULL);
 
-	return (assert->stmt[idx].user.icon);
+	return (stmt->user.icon);
 }
 
 const char *
 fido_assert_user_name(const fido_assert_t *assert, size_t idx)
 {
-	if (idx >= assert->stmt_len)
+	const fido_assert_stmt *stmt;
+
+	if ((stmt = stmt_decode_deferred(assert, idx)) == NULL)
 		return (NULL);
 
-	return (assert->stmt[idx].user.name);
+	return (stmt->user.name);
 }
 
 const char *
 fido_assert_user_display_name(const fido_assert_t *assert, size_t idx)
 {
-	if (idx >= assert->stmt_len)
+	const fido_assert_stmt *stmt;
+
+	if ((stmt = stmt_decode_deferred(assert, idx)) == NULL)
 		return (NULL);
 
-	return (assert->stmt[idx].user.display_name);
+	return (stmt->user.display_name);
 }
 
 const unsigned char *
@@ -941,19 +2479,23 @@ fido_assert_hmac_secret_len(const fido_assert_t *assert, size_t idx)
 const unsigned char *
 fido_assert_largeblob_key_ptr(const fido_assert_t *assert, size_t idx)
 {
-	if (idx >= assert->stmt_len)
+	const fido_assert_stmt *stmt;
+
+	if ((stmt = stmt_decode_deferred(assert, idx)) == NULL)
 		return (NULL);
 
-	return (assert->stmt[idx].largeblob_key.ptr);
+	return (stmt->largeblob_key.ptr);
 }
 
 size_t
 fido_assert_largeblob_key_len(const fido_assert_t *assert, size_t idx)
 {
-	if (idx >= assert->stmt_len)
+	const fido_assert_stmt *stmt;
+
+	if ((stmt = stmt_decode_deferred(assert, idx)) == NULL)
 		return (0);
 
-	return (assert->stmt[idx].largeblob_key.len);
+	return (stmt->largeblob_key.len);
 }
 
 const unsigned char *
@@ -1003,7 +2545,7 @@ fido_assert_set_authdata(fido_assert_t *assert, size_t idx,
 		goto fail;
 	}
 
-	if (cbor_decode_assert_authdata(item, &stmt->authdata_cbor,
+	if (cbor_decode_assert_authdata(item, NULL, &stmt->authdata_cbor,
 	    &stmt->authdata, &stmt->authdata_ext) < 0) {
 		fido_log_debug("%s: cbor_decode_assert_authdata", __func__);
 		r = FIDO_ERR_INVALID_ARGUMENT;
@@ -1025,9 +2567,7 @@ int
 fido_assert_set_authdata_raw(fido_assert_t *assert, size_t idx,
     const unsigned char *ptr, size_t len)
 {
-	cbor_item_t		*item = NULL;
-	fido_assert_stmt	*stmt = NULL;
-	int			 r;
+	fido_assert_stmt *stmt = NULL;
 
 	if (idx >= assert->stmt_len || ptr == NULL || len == 0)
 		return (FIDO_ERR_INVALID_ARGUMENT);
@@ -1035,28 +2575,15 @@ fido_assert_set_authdata_raw(fido_assert_t *assert, size_t idx,
 	stmt = &assert->stmt[idx];
 	fido_assert_clean_authdata(stmt);
 
-	if ((item = cbor_build_bytestring(ptr, len)) == NULL) {
-		fido_log_debug("%s: cbor_build_bytestring", __func__);
-		r = FIDO_ERR_INTERNAL;
-		goto fail;
-	}
-
-	if (cbor_decode_assert_authdata(item, &stmt->authdata_cbor,
+	/* encode and decode straight from ptr, without a libcbor item */
+	if (cbor_decode_assert_authdata_raw(ptr, len, &stmt->authdata_cbor,
 	    &stmt->authdata, &stmt->authdata_ext) < 0) {
-		fido_log_debug("%s: cbor_decode_assert_authdata", __func__);
-		r = FIDO_ERR_INVALID_ARGUMENT;
-		goto fail;
-	}
-
-	r = FIDO_OK;
-fail:
-	if (item != NULL)
-		cbor_decref(&item);
-
-	if (r != FIDO_OK)
+		fido_log_debug("%s: cbor_decode_assert_authdata_raw", __func__);
 		fido_assert_clean_authdata(stmt);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
 
-	return (r);
+	return (FIDO_OK);
 }
 
 int
@@ -1071,6 +2598,30 @@ fido_assert_set_sig(fido_assert_t *a, size_t idx, const unsigned char *ptr,
 	return (FIDO_OK);
 }
 
+int
+fido_assert_set_sig_borrow(fido_assert_t *a, size_t idx,
+    const unsigned char *ptr, size_t len)
+{
+	if (idx >= a->stmt_len || ptr == NULL || len == 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if (fido_blob_borrow(&a->stmt[idx].sig, ptr, len) < 0)
+		return (FIDO_ERR_INTERNAL);
+
+	return (FIDO_OK);
+}
+
+int
+fido_assert_set_sig_take(fido_assert_t *a, size_t idx, unsigned char *ptr,
+    size_t len)
+{
+	if (idx >= a->stmt_len || ptr == NULL || len == 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if (fido_blob_take(&a->stmt[idx].sig, ptr, len) < 0)
+		return (FIDO_ERR_INTERNAL);
+
+	return (FIDO_OK);
+}
+
 /* XXX shrinking leaks memory; fortunately that shouldn't happen */
 int
 fido_assert_set_count(fido_assert_t *assert, size_t n)
@@ -1083,8 +2634,12 @@ fido_assert_set_count(fido_assert_t *assert, size_t n)
 		return (FIDO_ERR_INTERNAL);
 	}
 #endif
+	if (n > FIDO_MAXSTMT) {
+		fido_log_debug("%s: n=%zu", __func__, n);
+		return (FIDO_ERR_INTERNAL);
+	}
 
-	new_stmt = recallocarray(assert->stmt, assert->stmt_cnt, n,
+	new_stmt = fido_recallocarray(assert->stmt, assert->stmt_cnt, n,
 	    sizeof(fido_assert_stmt));
 	if (new_stmt == NULL)
 		return (FIDO_ERR_INTERNAL);
@@ -1095,3 +2650,115 @@ fido_assert_set_count(fido_assert_t *assert, size_t n)
 
 	return (FIDO_OK);
 }
+
+/*
+ * Sets the statement of a single-statement assertion, and the client data,
+ * from a WebAuthn AuthenticationResponseJSON. The decoded members are
+ * moved into the assertion, not copied.
+ */
+int
+fido_assert_from_webauthn_json(fido_assert_t *assert, const char *json,
+    size_t len)
+{
+	fido_blob_t		 id, type, cd, authdata, sig, user_id;
+	fido_json_field_t	 field[] = {
+		{ NULL, "rawId", FIDO_JSON_B64URL, &id, NULL, NULL, NULL,
+		    false },
+		{ NULL, "type", FIDO_JSON_STRING, &type, NULL, NULL, NULL,
+		    false },
+		{ "response", "clientDataJSON", FIDO_JSON_B64URL, &cd, NULL,
+		    NULL, NULL, false },
+		{ "response", "authenticatorData", FIDO_JSON_B64URL,
+		    &authdata, NULL, NULL, NULL, false },
+		{ "response", "signature", FIDO_JSON_B64URL, &sig, NULL, NULL,
+		    NULL, false },
+		{ "response", "userHandle", FIDO_JSON_B64URL, &user_id, NULL,
+		    NULL, NULL, false },
+	};
+	fido_assert_stmt	*stmt;
+	cbor_item_t		*item = NULL;
+	bool			 grown = false;
+	int			 r = FIDO_ERR_INVALID_ARGUMENT;
+
+	memset(&id, 0, sizeof(id));
+	memset(&type, 0, sizeof(type));
+	memset(&cd, 0, sizeof(cd));
+	memset(&authdata, 0, sizeof(authdata));
+	memset(&sig, 0, sizeof(sig));
+	memset(&user_id, 0, sizeof(user_id));
+
+	if (assert->stmt_len > 1) {
+		fido_log_debug("%s: stmt_len=%zu", __func__, assert->stmt_len);
+		goto fail;
+	}
+	if (fido_json_decode(json, len, field, nitems(field)) < 0 ||
+	    fido_blob_is_empty(&cd) || fido_blob_is_empty(&authdata) ||
+	    fido_blob_is_empty(&sig) || !fido_json_public_key(&type)) {
+		fido_log_debug("%s: fido_json_decode", __func__);
+		goto fail;
+	}
+	if (assert->stmt_len == 0) {
+		if ((r = fido_assert_set_count(assert, 1)) != FIDO_OK) {
+			fido_log_debug("%s: fido_assert_set_count", __func__);
+			goto fail;
+		}
+		grown = true;
+	}
+
+	/* user.id is replaced below */
+	(void)stmt_decode_deferred(assert, 0);
+	stmt = &assert->stmt[0];
+	fido_assert_clean_authdata(stmt);
+
+	/* authdata is handed to libcbor, which frees it with the item */
+	if ((item = cbor_new_definite_bytestring()) == NULL) {
+		fido_log_debug("%s: cbor_new_definite_bytestring", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+	cbor_bytestring_set_handle(item, authdata.ptr, authdata.len);
+	memset(&authdata, 0, sizeof(authdata));
+	if (cbor_decode_assert_authdata(item, NULL, &stmt->authdata_cbor,
+	    &stmt->authdata, &stmt->authdata_ext) < 0) {
+		fido_log_debug("%s: cbor_decode_assert_authdata", __func__);
+		fido_assert_clean_authdata(stmt);
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto fail;
+	}
+
+	fido_blob_reset(&assert->cdh);
+	if (fido_sha256(&assert->cdh, cd.ptr, cd.len) < 0) {
+		fido_log_debug("%s: fido_sha256", __func__);
+		fido_assert_clean_authdata(stmt);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+	fido_blob_reset(&assert->cd);
+	fido_blob_reset(&stmt->sig);
+	fido_blob_reset(&stmt->id);
+	fido_blob_reset(&stmt->user.id);
+	assert->cd = cd;
+	stmt->sig = sig;
+	stmt->id = id;
+	stmt->user.id = user_id;
+	memset(&cd, 0, sizeof(cd));
+	memset(&sig, 0, sizeof(sig));
+	memset(&id, 0, sizeof(id));
+	memset(&user_id, 0, sizeof(user_id));
+
+	r = FIDO_OK;
+fail:
+	if (item != NULL)
+		cbor_decref(&item);
+	if (r != FIDO_OK && grown)
+		(void)fido_assert_set_count(assert, 0);
+
+	fido_blob_reset(&id);
+	fido_blob_reset(&type);
+	fido_blob_reset(&cd);
+	fido_blob_reset(&authdata);
+	fido_blob_reset(&sig);
+	fido_blob_reset(&user_id);
+
+	return (r);
+}
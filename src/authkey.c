@@ -53,7 +53,7 @@ fido_dev_authkey_tx(fido_dev_t *dev, int *ms)
 	r = FIDO_OK;
 fail:
 	cbor_vector_free(argv, nitems(argv));
-	free(f.ptr);
+	fido_free(f.ptr);
 
 	return (r);
 }
@@ -61,29 +61,26 @@ fail:
 static int
 fido_dev_authkey_rx(fido_dev_t *dev, es256_pk_t *authkey, int *ms)
 {
-	unsigned char	*msg;
-	int		 msglen;
-	int		 r;
+	const unsigned char	*msg;
+	size_t			 msgsiz;
+	int			 msglen;
+	int			 r;
 
 	fido_log_debug("%s: dev=%p, authkey=%p, ms=%d", __func__, (void *)dev,
 	    (void *)authkey, *ms);
 
 	memset(authkey, 0, sizeof(*authkey));
 
-	if ((msg = malloc(FIDO_MAXMSG)) == NULL) {
-		r = FIDO_ERR_INTERNAL;
-		goto out;
-	}
-
-	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, FIDO_MAXMSG, ms)) < 0) {
-		fido_log_debug("%s: fido_rx", __func__);
+	if ((msglen = fido_rx_msg(dev, CTAP_CMD_CBOR, FIDO_MAXMSG, &msg,
+	    &msgsiz, ms)) < 0) {
+		fido_log_debug("%s: fido_rx_msg", __func__);
 		r = FIDO_ERR_RX;
 		goto out;
 	}
 
 	r = cbor_parse_reply(msg, (size_t)msglen, authkey, parse_authkey);
 out:
-	freezero(msg, FIDO_MAXMSG);
+	fido_rx_msg_put(dev, msg, msgsiz);
 
 	return (r);
 }
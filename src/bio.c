@@ -5,6 +5,7 @@
  * SPDX-License-Identifier: BSD-2-Clause
  */
 
+#include <openssl/sha.h>
 #include "fido.h"
 #include "fido/bio.h"
 #include "fido/es256.h"
@@ -17,6 +18,19 @@
 #define CMD_ENROLL_REMOVE	0x06
 #define CMD_GET_INFO		0x07
 
+/*
+ * Sensor info and the template list last read from the device. Templates
+ * are only handed out to a caller presenting the pin they were read with,
+ * and are forgotten whenever the handle is used to change them.
+ */
+struct fido_bio_cache {
+	bool				has_info;
+	fido_bio_info_t			info;
+	bool				has_ta;
+	fido_bio_template_array_t	ta;
+	unsigned char			pin_hash[SHA256_DIGEST_LENGTH];
+};
+
 static int
 bio_prepare_hmac(uint8_t cmd, cbor_item_t **argv, size_t argc,
     cbor_item_t **param, fido_blob_t *hmac_data)
@@ -41,7 +55,7 @@ bio_prepare_hmac(uint8_t cmd, cbor_item_t **argv, size_t argc,
 		goto fail;
 	}
 
-	if ((hmac_data->ptr = malloc(cbor_len + sizeof(prefix))) == NULL) {
+	if ((hmac_data->ptr = fido_malloc(cbor_len + sizeof(prefix))) == NULL) {
 		fido_log_debug("%s: malloc", __func__);
 		goto fail;
 	}
@@ -52,24 +66,21 @@ bio_prepare_hmac(uint8_t cmd, cbor_item_t **argv, size_t argc,
 
 	ok = 0;
 fail:
-	free(cbor);
+	fido_free(cbor);
 
 	return (ok);
 }
 
 static int
-bio_tx(fido_dev_t *dev, uint8_t subcmd, cbor_item_t **sub_argv, size_t sub_argc,
-    const char *pin, const fido_blob_t *token, int *ms)
+bio_frame(fido_dev_t *dev, uint8_t subcmd, cbor_item_t **sub_argv,
+    size_t sub_argc, const char *pin, const fido_blob_t *token,
+    fido_blob_t *f, int *ms)
 {
 	cbor_item_t	*argv[5];
-	es256_pk_t	*pk = NULL;
-	fido_blob_t	*ecdh = NULL;
-	fido_blob_t	 f;
 	fido_blob_t	 hmac;
 	const uint8_t	 cmd = CTAP_CBOR_BIO_ENROLL_PRE;
 	int		 r = FIDO_ERR_INTERNAL;
 
-	memset(&f, 0, sizeof(f));
 	memset(&hmac, 0, sizeof(hmac));
 	memset(&argv, 0, sizeof(argv));
 
@@ -91,11 +102,7 @@ bio_tx(fido_dev_t *dev, uint8_t subcmd, cbor_item_t **sub_argv, size_t sub_argc,
 
 	/* pinProtocol, pinAuth */
 	if (pin) {
-		if ((r = fido_do_ecdh(dev, &pk, &ecdh, ms)) != FIDO_OK) {
-			fido_log_debug("%s: fido_do_ecdh", __func__);
-			goto fail;
-		}
-		if ((r = cbor_add_uv_params(dev, cmd, &hmac, pk, ecdh, pin,
+		if ((r = cbor_add_uv_params(dev, cmd, &hmac, NULL, NULL, pin,
 		    NULL, &argv[4], &argv[3], ms)) != FIDO_OK) {
 			fido_log_debug("%s: cbor_add_uv_params", __func__);
 			goto fail;
@@ -108,9 +115,37 @@ bio_tx(fido_dev_t *dev, uint8_t subcmd, cbor_item_t **sub_argv, size_t sub_argc,
 		}
 	}
 
-	/* framing and transmission */
-	if (cbor_build_frame(cmd, argv, nitems(argv), &f) < 0 ||
-	    fido_tx(dev, CTAP_CMD_CBOR, f.ptr, f.len, ms) < 0) {
+	/* framing */
+	if (cbor_build_frame(cmd, argv, nitems(argv), f) < 0) {
+		fido_log_debug("%s: cbor_build_frame", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	r = FIDO_OK;
+fail:
+	cbor_vector_free(argv, nitems(argv));
+	fido_free(hmac.ptr);
+
+	return (r);
+}
+
+static int
+bio_tx(fido_dev_t *dev, uint8_t subcmd, cbor_item_t **sub_argv, size_t sub_argc,
+    const char *pin, const fido_blob_t *token, int *ms)
+{
+	fido_blob_t	f;
+	int		r;
+
+	memset(&f, 0, sizeof(f));
+
+	if ((r = bio_frame(dev, subcmd, sub_argv, sub_argc, pin, token, &f,
+	    ms)) != FIDO_OK) {
+		fido_log_debug("%s: bio_frame", __func__);
+		goto fail;
+	}
+
+	if (fido_tx(dev, CTAP_CMD_CBOR, f.ptr, f.len, ms) < 0) {
 		fido_log_debug("%s: fido_tx", __func__);
 		r = FIDO_ERR_TX;
 		goto fail;
@@ -118,11 +153,7 @@ bio_tx(fido_dev_t *dev, uint8_t subcmd, cbor_item_t **sub_argv, size_t sub_argc,
 
 	r = FIDO_OK;
 fail:
-	cbor_vector_free(argv, nitems(argv));
-	es256_pk_free(&pk);
-	fido_blob_free(&ecdh);
-	free(f.ptr);
-	free(hmac.ptr);
+	fido_free(f.ptr);
 
 	return (r);
 }
@@ -130,7 +161,7 @@ fail:
 static void
 bio_reset_template(fido_bio_template_t *t)
 {
-	free(t->name);
+	fido_free(t->name);
 	t->name = NULL;
 	fido_blob_reset(&t->id);
 }
@@ -141,11 +172,119 @@ bio_reset_template_array(fido_bio_template_array_t *ta)
 	for (size_t i = 0; i < ta->n_alloc; i++)
 		bio_reset_template(&ta->ptr[i]);
 
-	free(ta->ptr);
+	fido_free(ta->ptr);
 	ta->ptr = NULL;
 	memset(ta, 0, sizeof(*ta));
 }
 
+static int
+bio_copy_template_array(fido_bio_template_array_t *dst,
+    const fido_bio_template_array_t *src)
+{
+	const fido_bio_template_t	*t;
+
+	bio_reset_template_array(dst);
+	if (src->n_rx == 0)
+		return (0);
+	if ((dst->ptr = fido_calloc(src->n_rx, sizeof(*dst->ptr))) == NULL)
+		return (-1);
+	dst->n_alloc = src->n_rx;
+	for (size_t i = 0; i < src->n_rx; i++) {
+		t = &src->ptr[i];
+		if (fido_blob_set(&dst->ptr[i].id, t->id.ptr, t->id.len) < 0 ||
+		    (t->name != NULL &&
+		    (dst->ptr[i].name = fido_strdup(t->name)) == NULL)) {
+			bio_reset_template_array(dst);
+			return (-1);
+		}
+		dst->n_rx++;
+	}
+
+	return (0);
+}
+
+static void
+bio_cache_reset_templates(struct fido_bio_cache *c)
+{
+	bio_reset_template_array(&c->ta);
+	c->has_ta = false;
+	explicit_bzero(c->pin_hash, sizeof(c->pin_hash));
+}
+
+static bool
+bio_cache_get_templates(const struct fido_bio_cache *c, const char *pin,
+    fido_bio_template_array_t *ta)
+{
+	unsigned char	hash[SHA256_DIGEST_LENGTH];
+	bool		ok;
+
+	if (c->has_ta == false)
+		return (false);
+	if (SHA256((const unsigned char *)pin, strlen(pin), hash) != hash)
+		return (false);
+	ok = timingsafe_bcmp(hash, c->pin_hash, sizeof(hash)) == 0 &&
+	    bio_copy_template_array(ta, &c->ta) == 0;
+	explicit_bzero(hash, sizeof(hash));
+
+	return (ok);
+}
+
+static void
+bio_cache_put_templates(struct fido_bio_cache *c, const char *pin,
+    const fido_bio_template_array_t *ta)
+{
+	bio_cache_reset_templates(c);
+	if (SHA256((const unsigned char *)pin, strlen(pin),
+	    c->pin_hash) != c->pin_hash ||
+	    bio_copy_template_array(&c->ta, ta) < 0) {
+		fido_log_debug("%s: could not cache templates", __func__);
+		bio_cache_reset_templates(c);
+		return;
+	}
+	c->has_ta = true;
+}
+
+/* the templates on dev are about to change */
+static void
+bio_flush_templates(fido_dev_t *dev)
+{
+	if (dev->bio_cache != NULL)
+		bio_cache_reset_templates(dev->bio_cache);
+}
+
+void
+fido_dev_bio_flush(fido_dev_t *dev)
+{
+	if (dev->bio_cache == NULL)
+		return;
+	bio_cache_reset_templates(dev->bio_cache);
+	dev->bio_cache->has_info = false;
+}
+
+void
+fido_dev_bio_cache_free(fido_dev_t *dev)
+{
+	if (dev->bio_cache == NULL)
+		return;
+	fido_dev_bio_flush(dev);
+	fido_free(dev->bio_cache);
+	dev->bio_cache = NULL;
+}
+
+int
+fido_dev_set_bio_cache(fido_dev_t *dev, bool enable)
+{
+	if (enable == false) {
+		fido_dev_bio_cache_free(dev);
+		return (FIDO_OK);
+	}
+	if (dev->bio_cache == NULL &&
+	    (dev->bio_cache = fido_calloc(1, sizeof(*dev->bio_cache))) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	return (FIDO_OK);
+}
+
 static int
 decode_template(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 {
@@ -218,7 +357,8 @@ bio_parse_template_array(const cbor_item_t *key, const cbor_item_t *val,
 		return (-1);
 	}
 
-	if ((ta->ptr = calloc(cbor_array_size(val), sizeof(*ta->ptr))) == NULL)
+	if ((ta->ptr = fido_calloc(cbor_array_size(val),
+	    sizeof(*ta->ptr))) == NULL)
 		return (-1);
 
 	ta->n_alloc = cbor_array_size(val);
@@ -235,17 +375,18 @@ static int
 bio_rx_template_array(fido_dev_t *dev, fido_bio_template_array_t *ta, int *ms)
 {
 	unsigned char	*msg;
+	size_t		 msgsiz;
 	int		 msglen;
 	int		 r;
 
 	bio_reset_template_array(ta);
 
-	if ((msg = malloc(FIDO_MAXMSG)) == NULL) {
+	if ((msg = fido_rx_buf_get(dev, FIDO_MAXMSG, &msgsiz)) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto out;
 	}
 
-	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, FIDO_MAXMSG, ms)) < 0) {
+	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, msgsiz, ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
 		r = FIDO_ERR_RX;
 		goto out;
@@ -259,7 +400,7 @@ bio_rx_template_array(fido_dev_t *dev, fido_bio_template_array_t *ta, int *ms)
 
 	r = FIDO_OK;
 out:
-	freezero(msg, FIDO_MAXMSG);
+	fido_rx_buf_put(dev, msg, msgsiz);
 
 	return (r);
 }
@@ -282,11 +423,25 @@ fido_bio_dev_get_template_array(fido_dev_t *dev, fido_bio_template_array_t *ta,
     const char *pin)
 {
 	int ms = dev->timeout_ms;
+	int r;
 
 	if (pin == NULL)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
-	return (bio_get_template_array_wait(dev, ta, pin, &ms));
+	if (dev->bio_cache != NULL &&
+	    bio_cache_get_templates(dev->bio_cache, pin, ta)) {
+		fido_log_debug("%s: cached", __func__);
+		return (FIDO_OK);
+	}
+
+	do
+		r = bio_get_template_array_wait(dev, ta, pin, &ms);
+	while (fido_dev_uv_token_retry(dev, r));
+
+	if (r == FIDO_OK && dev->bio_cache != NULL)
+		bio_cache_put_templates(dev->bio_cache, pin, ta);
+
+	return (r);
 }
 
 static int
@@ -323,11 +478,18 @@ fido_bio_dev_set_template_name(fido_dev_t *dev, const fido_bio_template_t *t,
     const char *pin)
 {
 	int ms = dev->timeout_ms;
+	int r;
 
 	if (pin == NULL || t->name == NULL)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
-	return (bio_set_template_name_wait(dev, t, pin, &ms));
+	bio_flush_templates(dev);
+
+	do
+		r = bio_set_template_name_wait(dev, t, pin, &ms);
+	while (fido_dev_uv_token_retry(dev, r));
+
+	return (r);
 }
 
 static void
@@ -396,6 +558,7 @@ bio_rx_enroll_begin(fido_dev_t *dev, fido_bio_template_t *t,
     fido_bio_enroll_t *e, int *ms)
 {
 	unsigned char	*msg;
+	size_t		 msgsiz;
 	int		 msglen;
 	int		 r;
 
@@ -404,12 +567,12 @@ bio_rx_enroll_begin(fido_dev_t *dev, fido_bio_template_t *t,
 	e->remaining_samples = 0;
 	e->last_status = 0;
 
-	if ((msg = malloc(FIDO_MAXMSG)) == NULL) {
+	if ((msg = fido_rx_buf_get(dev, FIDO_MAXMSG, &msgsiz)) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto out;
 	}
 
-	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, FIDO_MAXMSG, ms)) < 0) {
+	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, msgsiz, ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
 		r = FIDO_ERR_RX;
 		goto out;
@@ -429,7 +592,7 @@ bio_rx_enroll_begin(fido_dev_t *dev, fido_bio_template_t *t,
 
 	r = FIDO_OK;
 out:
-	freezero(msg, FIDO_MAXMSG);
+	fido_rx_buf_put(dev, msg, msgsiz);
 
 	return (r);
 }
@@ -475,6 +638,8 @@ fido_bio_dev_enroll_begin(fido_dev_t *dev, fido_bio_template_t *t,
 	if (pin == NULL || e->token != NULL)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
+	bio_flush_templates(dev);
+
 	if ((token = fido_blob_new()) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
@@ -508,18 +673,19 @@ static int
 bio_rx_enroll_continue(fido_dev_t *dev, fido_bio_enroll_t *e, int *ms)
 {
 	unsigned char	*msg;
+	size_t		 msgsiz;
 	int		 msglen;
 	int		 r;
 
 	e->remaining_samples = 0;
 	e->last_status = 0;
 
-	if ((msg = malloc(FIDO_MAXMSG)) == NULL) {
+	if ((msg = fido_rx_buf_get(dev, FIDO_MAXMSG, &msgsiz)) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto out;
 	}
 
-	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, FIDO_MAXMSG, ms)) < 0) {
+	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, msgsiz, ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
 		r = FIDO_ERR_RX;
 		goto out;
@@ -533,7 +699,7 @@ bio_rx_enroll_continue(fido_dev_t *dev, fido_bio_enroll_t *e, int *ms)
 
 	r = FIDO_OK;
 out:
-	freezero(msg, FIDO_MAXMSG);
+	fido_rx_buf_put(dev, msg, msgsiz);
 
 	return (r);
 }
@@ -602,6 +768,76 @@ fido_bio_dev_enroll_cancel(fido_dev_t *dev)
 	return (bio_enroll_cancel_wait(dev, &ms));
 }
 
+/*
+ * The parameters of enrollNext, and hence its pinUvAuthParam, are the
+ * same for every sample; its frame is built once and sent as is.
+ */
+int
+fido_bio_dev_enroll(fido_dev_t *dev, fido_bio_template_t *t,
+    fido_bio_enroll_t *e, uint32_t timo_ms, const char *pin,
+    fido_bio_enroll_cb_t *cb, void *cb_arg)
+{
+	cbor_item_t	*argv[3];
+	fido_blob_t	 f;
+	int		 ms = dev->timeout_ms;
+	int		 r;
+
+	memset(&argv, 0, sizeof(argv));
+	memset(&f, 0, sizeof(f));
+
+	if ((r = fido_bio_dev_enroll_begin(dev, t, e, timo_ms,
+	    pin)) != FIDO_OK) {
+		fido_log_debug("%s: fido_bio_dev_enroll_begin", __func__);
+		goto fail;
+	}
+
+	if ((argv[0] = fido_blob_encode(&t->id)) == NULL ||
+	    (argv[2] = cbor_build_uint(timo_ms)) == NULL) {
+		fido_log_debug("%s: cbor encode", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	for (;;) {
+		if (cb != NULL && cb(e->last_status, e->remaining_samples,
+		    cb_arg) != 0) {
+			fido_log_debug("%s: cancelled", __func__);
+			r = FIDO_ERR_KEEPALIVE_CANCEL;
+			goto fail;
+		}
+		if (e->remaining_samples == 0)
+			break;
+		/* each sample waits on the user; give it a full timeout */
+		ms = dev->timeout_ms;
+		if (f.ptr == NULL && (r = bio_frame(dev, CMD_ENROLL_NEXT, argv,
+		    3, NULL, e->token, &f, &ms)) != FIDO_OK) {
+			fido_log_debug("%s: bio_frame", __func__);
+			goto fail;
+		}
+		if (fido_tx(dev, CTAP_CMD_CBOR, f.ptr, f.len, &ms) < 0) {
+			fido_log_debug("%s: fido_tx", __func__);
+			r = FIDO_ERR_TX;
+			goto fail;
+		}
+		if ((r = bio_rx_enroll_continue(dev, e, &ms)) != FIDO_OK) {
+			fido_log_debug("%s: bio_rx_enroll_continue", __func__);
+			goto fail;
+		}
+	}
+
+	r = FIDO_OK;
+fail:
+	if (r == FIDO_ERR_KEEPALIVE_CANCEL && e->remaining_samples > 0) {
+		ms = dev->timeout_ms;
+		if (bio_enroll_cancel_wait(dev, &ms) != FIDO_OK)
+			fido_log_debug("%s: bio_enroll_cancel_wait", __func__);
+	}
+	cbor_vector_free(argv, nitems(argv));
+	fido_free(f.ptr);
+
+	return (r);
+}
+
 static int
 bio_enroll_remove_wait(fido_dev_t *dev, const fido_bio_template_t *t,
     const char *pin, int *ms)
@@ -635,8 +871,15 @@ fido_bio_dev_enroll_remove(fido_dev_t *dev, const fido_bio_template_t *t,
     const char *pin)
 {
 	int ms = dev->timeout_ms;
+	int r;
+
+	bio_flush_templates(dev);
+
+	do
+		r = bio_enroll_remove_wait(dev, t, pin, &ms);
+	while (fido_dev_uv_token_retry(dev, r));
 
-	return (bio_enroll_remove_wait(dev, t, pin, &ms));
+	return (r);
 }
 
 static void
@@ -684,17 +927,18 @@ static int
 bio_rx_info(fido_dev_t *dev, fido_bio_info_t *i, int *ms)
 {
 	unsigned char	*msg;
+	size_t		 msgsiz;
 	int		 msglen;
 	int		 r;
 
 	bio_reset_info(i);
 
-	if ((msg = malloc(FIDO_MAXMSG)) == NULL) {
+	if ((msg = fido_rx_buf_get(dev, FIDO_MAXMSG, &msgsiz)) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto out;
 	}
 
-	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, FIDO_MAXMSG, ms)) < 0) {
+	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, msgsiz, ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
 		r = FIDO_ERR_RX;
 		goto out;
@@ -708,7 +952,7 @@ bio_rx_info(fido_dev_t *dev, fido_bio_info_t *i, int *ms)
 
 	r = FIDO_OK;
 out:
-	freezero(msg, FIDO_MAXMSG);
+	fido_rx_buf_put(dev, msg, msgsiz);
 
 	return (r);
 }
@@ -731,9 +975,22 @@ bio_get_info_wait(fido_dev_t *dev, fido_bio_info_t *i, int *ms)
 int
 fido_bio_dev_get_info(fido_dev_t *dev, fido_bio_info_t *i)
 {
-	int ms = dev->timeout_ms;
+	struct fido_bio_cache	*c = dev->bio_cache;
+	int			 ms = dev->timeout_ms;
+	int			 r;
+
+	if (c != NULL && c->has_info) {
+		fido_log_debug("%s: cached", __func__);
+		*i = c->info;
+		return (FIDO_OK);
+	}
+
+	if ((r = bio_get_info_wait(dev, i, &ms)) == FIDO_OK && c != NULL) {
+		c->info = *i;
+		c->has_info = true;
+	}
 
-	return (bio_get_info_wait(dev, i, &ms));
+	return (r);
 }
 
 const char *
@@ -763,13 +1020,13 @@ fido_bio_template_array_count(const fido_bio_template_array_t *ta)
 fido_bio_template_array_t *
 fido_bio_template_array_new(void)
 {
-	return (calloc(1, sizeof(fido_bio_template_array_t)));
+	return (fido_calloc(1, sizeof(fido_bio_template_array_t)));
 }
 
 fido_bio_template_t *
 fido_bio_template_new(void)
 {
-	return (calloc(1, sizeof(fido_bio_template_t)));
+	return (fido_calloc(1, sizeof(fido_bio_template_t)));
 }
 
 void
@@ -781,7 +1038,7 @@ fido_bio_template_array_free(fido_bio_template_array_t **tap)
 		return;
 
 	bio_reset_template_array(ta);
-	free(ta);
+	fido_free(ta);
 	*tap = NULL;
 }
 
@@ -794,17 +1051,17 @@ fido_bio_template_free(fido_bio_template_t **tp)
 		return;
 
 	bio_reset_template(t);
-	free(t);
+	fido_free(t);
 	*tp = NULL;
 }
 
 int
 fido_bio_template_set_name(fido_bio_template_t *t, const char *name)
 {
-	free(t->name);
+	fido_free(t->name);
 	t->name = NULL;
 
-	if (name && (t->name = strdup(name)) == NULL)
+	if (name && (t->name = fido_strdup(name)) == NULL)
 		return (FIDO_ERR_INTERNAL);
 
 	return (FIDO_OK);
@@ -834,13 +1091,13 @@ fido_bio_template(const fido_bio_template_array_t *ta, size_t idx)
 fido_bio_enroll_t *
 fido_bio_enroll_new(void)
 {
-	return (calloc(1, sizeof(fido_bio_enroll_t)));
+	return (fido_calloc(1, sizeof(fido_bio_enroll_t)));
 }
 
 fido_bio_info_t *
 fido_bio_info_new(void)
 {
-	return (calloc(1, sizeof(fido_bio_info_t)));
+	return (fido_calloc(1, sizeof(fido_bio_info_t)));
 }
 
 uint8_t
@@ -865,7 +1122,7 @@ fido_bio_enroll_free(fido_bio_enroll_t **ep)
 
 	bio_reset_enroll(e);
 
-	free(e);
+	fido_free(e);
 	*ep = NULL;
 }
 
@@ -877,7 +1134,7 @@ fido_bio_info_free(fido_bio_info_t **ip)
 	if (ip == NULL || (i = *ip) == NULL)
 		return;
 
-	free(i);
+	fido_free(i);
 	*ip = NULL;
 }
 
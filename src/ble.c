@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <string.h>
+
+#include "fido.h"
+#include "fido/param.h"
+
+/*
+ * CTAP over Bluetooth Low Energy (FIDO CTAP 2.1, section 11.4). Messages
+ * are framed much like CTAPHID messages, without a channel id, and in
+ * fragments of up to controlPointLength bytes. Each call to io.write
+ * sends one fragment to the control point; each call to io.read returns
+ * one fragment notified on the status characteristic.
+ */
+
+#define CTAPBLE_PING		0x81
+#define CTAPBLE_KEEPALIVE	0x82
+#define CTAPBLE_MSG		0x83
+#define CTAPBLE_CANCEL		0xbe
+#define CTAPBLE_ERROR		0xbf
+
+#define CTAPBLE_INIT_HEADER_LEN	3
+#define CTAPBLE_CONT_HEADER_LEN	1
+#define CTAPBLE_MIN_FRAME_LEN	20
+#define CTAPBLE_MAX_FRAME_LEN	512
+
+#ifndef MIN
+#define MIN(x, y) ((x) > (y) ? (y) : (x))
+#endif
+
+static size_t
+frame_len(const fido_dev_t *d)
+{
+	size_t len = d->ble_len;
+
+#ifdef USE_BLE
+	if (d->io.read == fido_ble_read)
+		len = fido_ble_cp_len(d->io_handle);
+#endif
+	if (len < CTAPBLE_MIN_FRAME_LEN || len > CTAPBLE_MAX_FRAME_LEN) {
+		fido_log_debug("%s: len=%zu", __func__, len);
+		return 0;
+	}
+
+	return len;
+}
+
+static int
+tx_frame(fido_dev_t *d, const unsigned char *frame, size_t len)
+{
+	int n;
+
+	n = d->io.write(d->io_handle, frame, len);
+	fido_trace(d, FIDO_TRACE_TX, d->trace_cmd, len, n);
+	if (n < 0 || (size_t)n != len) {
+		fido_log_debug("%s: write", __func__);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+tx_msg(fido_dev_t *d, uint8_t cmd, const unsigned char *buf, size_t count)
+{
+	unsigned char frame[CTAPBLE_MAX_FRAME_LEN];
+	size_t len, n, sent;
+	uint8_t seq = 0;
+	int ok = -1;
+
+	if ((len = frame_len(d)) == 0)
+		return -1;
+	/* maxMsgSize is only known once getinfo has been answered */
+	if (count > UINT16_MAX || (d->maxmsgsize > 0 &&
+	    count > d->maxmsgsize)) {
+		fido_log_debug("%s: count=%zu", __func__, count);
+		return -1;
+	}
+
+	memset(frame, 0, sizeof(frame));
+	frame[0] = cmd;
+	frame[1] = (count >> 8) & 0xff;
+	frame[2] = count & 0xff;
+	sent = MIN(count, len - CTAPBLE_INIT_HEADER_LEN);
+	if (sent > 0)
+		memcpy(&frame[CTAPBLE_INIT_HEADER_LEN], buf, sent);
+	if (tx_frame(d, frame, CTAPBLE_INIT_HEADER_LEN + sent) < 0)
+		goto fail;
+
+	for (; sent < count; sent += n) {
+		/* the sequence number wraps around after 0x7f */
+		frame[0] = seq++ & 0x7f;
+		n = MIN(count - sent, len - CTAPBLE_CONT_HEADER_LEN);
+		memcpy(&frame[CTAPBLE_CONT_HEADER_LEN], buf + sent, n);
+		if (tx_frame(d, frame, CTAPBLE_CONT_HEADER_LEN + n) < 0)
+			goto fail;
+	}
+
+	ok = 0;
+fail:
+	explicit_bzero(frame, sizeof(frame));
+
+	return ok;
+}
+
+int
+fido_ble_tx(fido_dev_t *d, uint8_t cmd, const unsigned char *buf, size_t count)
+{
+	switch (cmd) {
+	case CTAP_CMD_INIT: /* no channels; answered by fido_ble_rx() */
+		return 0;
+	case CTAP_CMD_CBOR: /* ctap2 commands and u2f apdus alike */
+	case CTAP_CMD_MSG:
+		return tx_msg(d, CTAPBLE_MSG, buf, count);
+	case CTAP_CMD_PING:
+		return tx_msg(d, CTAPBLE_PING, buf, count);
+	case CTAP_CMD_CANCEL:
+		return tx_msg(d, CTAPBLE_CANCEL, NULL, 0);
+	default:
+		fido_log_debug("%s: cmd=%02x", __func__, cmd);
+		return -1;
+	}
+}
+
+static int
+rx_init(fido_dev_t *d, unsigned char *buf, size_t count)
+{
+	fido_ctap_info_t *attr = (fido_ctap_info_t *)buf;
+
+	if (count != sizeof(*attr)) {
+		fido_log_debug("%s: count=%zu", __func__, count);
+		return -1;
+	}
+
+	/* a u2f-only authenticator fails getinfo and is treated as such */
+	memset(attr, 0, sizeof(*attr));
+	memcpy(&attr->nonce, &d->nonce, sizeof(attr->nonce));
+	attr->flags = FIDO_CAP_CBOR;
+
+	return (int)count;
+}
+
+/* read a fragment, waiting until dl */
+static int
+rx_frame(fido_dev_t *d, unsigned char *frame, size_t len,
+    const struct timespec *dl)
+{
+	int n, ms;
+
+	if (fido_time_left(dl, &ms) != 0)
+		return -1;
+
+	n = d->io.read(d->io_handle, frame, len, ms);
+	fido_trace(d, FIDO_TRACE_RX, d->trace_cmd, len, n);
+
+	return n;
+}
+
+static int
+rx_msg(fido_dev_t *d, uint8_t cmd, unsigned char *buf, size_t count, int ms)
+{
+	unsigned char frame[CTAPBLE_MAX_FRAME_LEN];
+	struct timespec dl;
+	size_t payload_len, r, n;
+	uint8_t seq = 0;
+	int len, ok = -1;
+
+	if (fido_time_deadline(&dl, ms) != 0)
+		return -1;
+
+	do {
+		if ((len = rx_frame(d, frame, sizeof(frame), &dl)) <
+		    CTAPBLE_INIT_HEADER_LEN) {
+			fido_log_debug("%s: rx_frame", __func__);
+			goto fail;
+		}
+		if (frame[0] == CTAPBLE_KEEPALIVE && len > 3)
+			fido_trace(d, FIDO_TRACE_KEEPALIVE, d->trace_cmd, 0,
+			    frame[3]);
+	} while (frame[0] == CTAPBLE_KEEPALIVE);
+
+	if (frame[0] == CTAPBLE_ERROR) {
+		fido_log_debug("%s: error 0x%02x", __func__, len > 3 ?
+		    frame[3] : 0);
+		goto fail;
+	}
+	if (frame[0] != cmd) {
+		fido_log_debug("%s: cmd (0x%02x, 0x%02x)", __func__, frame[0],
+		    cmd);
+		goto fail;
+	}
+
+	payload_len = (size_t)((frame[1] << 8) | frame[2]);
+	fido_log_io_debug("%s: payload_len=%zu", __func__, payload_len);
+	if (count < payload_len) {
+		fido_log_debug("%s: count < payload_len", __func__);
+		goto fail;
+	}
+
+	r = MIN(payload_len, (size_t)len - CTAPBLE_INIT_HEADER_LEN);
+	if (r > 0)
+		memcpy(buf, &frame[CTAPBLE_INIT_HEADER_LEN], r);
+
+	for (; r < payload_len; r += n) {
+		if ((len = rx_frame(d, frame, sizeof(frame), &dl)) <=
+		    CTAPBLE_CONT_HEADER_LEN) {
+			fido_log_debug("%s: rx_frame", __func__);
+			goto fail;
+		}
+		if (frame[0] != (seq & 0x7f)) {
+			fido_log_debug("%s: seq (%d, %d)", __func__, frame[0],
+			    seq & 0x7f);
+			goto fail;
+		}
+		seq++;
+		n = MIN(payload_len - r, (size_t)len - CTAPBLE_CONT_HEADER_LEN);
+		memcpy(buf + r, &frame[CTAPBLE_CONT_HEADER_LEN], n);
+	}
+
+	ok = (int)payload_len;
+fail:
+	explicit_bzero(frame, sizeof(frame));
+
+	return ok;
+}
+
+int
+fido_ble_rx(fido_dev_t *d, uint8_t cmd, unsigned char *buf, size_t count, int ms)
+{
+	switch (cmd) {
+	case CTAP_CMD_INIT:
+		return rx_init(d, buf, count);
+	case CTAP_CMD_CBOR:
+	case CTAP_CMD_MSG:
+		return rx_msg(d, CTAPBLE_MSG, buf, count, ms);
+	case CTAP_CMD_PING:
+		return rx_msg(d, CTAPBLE_PING, buf, count, ms);
+	default:
+		fido_log_debug("%s: cmd=%02x", __func__, cmd);
+		return -1;
+	}
+}
+
+int
+fido_dev_set_ble_transport(fido_dev_t *d, size_t cp_len)
+{
+	if (d->io_handle != NULL) {
+		fido_log_debug("%s: non-NULL handle", __func__);
+		return FIDO_ERR_INVALID_ARGUMENT;
+	}
+	if (cp_len < CTAPBLE_MIN_FRAME_LEN || cp_len > CTAPBLE_MAX_FRAME_LEN) {
+		fido_log_debug("%s: cp_len=%zu", __func__, cp_len);
+		return FIDO_ERR_INVALID_ARGUMENT;
+	}
+
+	d->ble_len = cp_len;
+	d->io_own = true;
+	d->transport = (fido_dev_transport_t) {
+		fido_ble_rx,
+		fido_ble_tx,
+	};
+
+	return FIDO_OK;
+}
+
+#ifdef USE_BLE
+bool
+fido_is_ble(const char *path)
+{
+	return strncmp(path, FIDO_BLE_PREFIX, strlen(FIDO_BLE_PREFIX)) == 0;
+}
+
+int
+fido_dev_set_ble(fido_dev_t *d)
+{
+	if (d->io_handle != NULL) {
+		fido_log_debug("%s: device open", __func__);
+		return -1;
+	}
+	d->io_own = true;
+	d->io = (fido_dev_io_t) {
+		fido_ble_open,
+		fido_ble_close,
+		fido_ble_read,
+		fido_ble_write,
+	};
+	d->transport = (fido_dev_transport_t) {
+		fido_ble_rx,
+		fido_ble_tx,
+	};
+
+	return 0;
+}
+#endif /* USE_BLE */
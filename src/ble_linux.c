@@ -0,0 +1,591 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <systemd/sd-bus.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "fido.h"
+#include "fido/param.h"
+
+/*
+ * BLE authenticators are reached through BlueZ, over D-Bus. Fragments
+ * are written to the control point with WriteValue; notifications of the
+ * status characteristic are received on a socket obtained with
+ * AcquireNotify (BlueZ 5.46 and later), one fragment per read.
+ */
+
+#define BLUEZ			"org.bluez"
+#define BLUEZ_DEVICE		"org.bluez.Device1"
+#define BLUEZ_CHRC		"org.bluez.GattCharacteristic1"
+#define DBUS_OBJMGR		"org.freedesktop.DBus.ObjectManager"
+
+#define FIDO_SERVICE_UUID	"0000fffd-0000-1000-8000-00805f9b34fb"
+#define FIDO_CP_UUID		"f1d0fff1-deaa-ecee-b42f-c9ba7ed623bb"
+#define FIDO_STATUS_UUID	"f1d0fff2-deaa-ecee-b42f-c9ba7ed623bb"
+#define FIDO_CP_LEN_UUID	"f1d0fff3-deaa-ecee-b42f-c9ba7ed623bb"
+#define FIDO_REV_UUID		"f1d0fff4-deaa-ecee-b42f-c9ba7ed623bb"
+
+#define REV_U2F_1_2		0x40
+#define REV_FIDO2		0x20
+
+#define RESOLVE_MS		10000 /* wait for gatt services this long */
+#define RESOLVE_STEP_MS		100
+
+struct ble_linux {
+	sd_bus		*bus;
+	char		*dev;     /* device object path */
+	char		*chrc[4]; /* cp, status, cp length, revision */
+	int		 fd;      /* status notifications */
+	size_t		 cp_len;
+	sigset_t	 sigmask;
+	const sigset_t	*sigmaskp;
+};
+
+enum { CHRC_CP, CHRC_STATUS, CHRC_CP_LEN, CHRC_REV };
+
+static const char *chrc_uuid[] = {
+	FIDO_CP_UUID,
+	FIDO_STATUS_UUID,
+	FIDO_CP_LEN_UUID,
+	FIDO_REV_UUID,
+};
+
+struct ble_props {
+	const char	*alias;    /* Device1 */
+	const char	*modalias; /* Device1 */
+	const char	*uuid;     /* GattCharacteristic1 */
+	bool		 fido;     /* Device1 offers the fido service */
+	int		 paired;   /* Device1 */
+};
+
+typedef int ble_walk_t(const char *, const struct ble_props *, void *);
+
+static int
+read_uuids(sd_bus_message *m, struct ble_props *p)
+{
+	const char *uuid;
+	int r;
+
+	if (sd_bus_message_enter_container(m, 'a', "s") < 0)
+		return -1;
+	while ((r = sd_bus_message_read(m, "s", &uuid)) > 0)
+		if (strcasecmp(uuid, FIDO_SERVICE_UUID) == 0)
+			p->fido = true;
+	if (r < 0 || sd_bus_message_exit_container(m) < 0)
+		return -1;
+
+	return 0;
+}
+
+/* parse the a{sv} of an interface's properties, keeping what we use */
+static int
+read_props(sd_bus_message *m, struct ble_props *p)
+{
+	const char *key;
+	int r;
+
+	memset(p, 0, sizeof(*p));
+
+	if (sd_bus_message_enter_container(m, 'a', "{sv}") < 0)
+		return -1;
+	while ((r = sd_bus_message_enter_container(m, 'e', "sv")) > 0) {
+		if (sd_bus_message_read(m, "s", &key) < 0)
+			return -1;
+		if (strcmp(key, "Alias") == 0)
+			r = sd_bus_message_read(m, "v", "s", &p->alias);
+		else if (strcmp(key, "Modalias") == 0)
+			r = sd_bus_message_read(m, "v", "s", &p->modalias);
+		else if (strcmp(key, "UUID") == 0)
+			r = sd_bus_message_read(m, "v", "s", &p->uuid);
+		else if (strcmp(key, "Paired") == 0)
+			r = sd_bus_message_read(m, "v", "b", &p->paired);
+		else if (strcmp(key, "UUIDs") == 0) {
+			if ((r = sd_bus_message_enter_container(m, 'v',
+			    "as")) >= 0 && (r = read_uuids(m, p)) >= 0)
+				r = sd_bus_message_exit_container(m);
+		} else
+			r = sd_bus_message_skip(m, "v");
+		if (r < 0 || sd_bus_message_exit_container(m) < 0)
+			return -1;
+	}
+	if (r < 0 || sd_bus_message_exit_container(m) < 0)
+		return -1;
+
+	return 0;
+}
+
+/* call cb for every object exported by bluez with interface iface */
+static int
+ble_walk(sd_bus *bus, const char *iface, ble_walk_t *cb, void *arg)
+{
+	sd_bus_error err = SD_BUS_ERROR_NULL;
+	sd_bus_message *m = NULL;
+	struct ble_props p;
+	const char *path, *name;
+	int r, ok = -1;
+
+	if ((r = sd_bus_call_method(bus, BLUEZ, "/", DBUS_OBJMGR,
+	    "GetManagedObjects", &err, &m, "")) < 0) {
+		fido_log_debug("%s: GetManagedObjects: %s", __func__,
+		    err.message != NULL ? err.message : strerror(-r));
+		goto fail;
+	}
+	if (sd_bus_message_enter_container(m, 'a', "{oa{sa{sv}}}") < 0)
+		goto fail;
+	while ((r = sd_bus_message_enter_container(m, 'e',
+	    "oa{sa{sv}}")) > 0) {
+		if (sd_bus_message_read(m, "o", &path) < 0 ||
+		    sd_bus_message_enter_container(m, 'a', "{sa{sv}}") < 0)
+			goto fail;
+		while ((r = sd_bus_message_enter_container(m, 'e',
+		    "sa{sv}")) > 0) {
+			if (sd_bus_message_read(m, "s", &name) < 0)
+				goto fail;
+			if (strcmp(name, iface) != 0)
+				r = sd_bus_message_skip(m, "a{sv}");
+			else if ((r = read_props(m, &p)) == 0 &&
+			    cb(path, &p, arg) < 0)
+				goto fail;
+			if (r < 0 || sd_bus_message_exit_container(m) < 0)
+				goto fail;
+		}
+		if (r < 0 || sd_bus_message_exit_container(m) < 0 ||
+		    sd_bus_message_exit_container(m) < 0)
+			goto fail;
+	}
+	if (r < 0 || sd_bus_message_exit_container(m) < 0)
+		goto fail;
+
+	ok = 0;
+fail:
+	sd_bus_message_unref(m);
+	sd_bus_error_free(&err);
+
+	return ok;
+}
+
+static int
+modalias_id(const char *modalias, int16_t *vendor_id, int16_t *product_id)
+{
+	unsigned int v, p;
+
+	/* e.g. usb:v1050p0407d0100 or bluetooth:v1050p0407d0100 */
+	if (modalias == NULL || (modalias = strchr(modalias, ':')) == NULL ||
+	    sscanf(modalias, ":v%4xp%4x", &v, &p) != 2)
+		return -1;
+
+	*vendor_id = (int16_t)v;
+	*product_id = (int16_t)p;
+
+	return 0;
+}
+
+struct manifest_arg {
+	fido_dev_info_t	*devlist;
+	size_t		 ilen;
+	size_t		*olen;
+};
+
+static int
+copy_info(const char *path, const struct ble_props *p, void *arg)
+{
+	struct manifest_arg *a = arg;
+	fido_dev_info_t *di;
+
+	if (*a->olen == a->ilen || p->fido == false || p->paired == 0)
+		return 0;
+
+	di = &a->devlist[*a->olen];
+	memset(di, 0, sizeof(*di));
+
+	if (fido_asprintf(&di->path, "%s%s", FIDO_BLE_PREFIX, path) == -1) {
+		di->path = NULL;
+		goto fail;
+	}
+	if ((di->manufacturer = fido_strdup("BLE")) == NULL ||
+	    (di->product = fido_strdup(p->alias != NULL ? p->alias :
+	    "")) == NULL)
+		goto fail;
+	(void)modalias_id(p->modalias, &di->vendor_id, &di->product_id);
+	di->io = (fido_dev_io_t) {
+		fido_ble_open,
+		fido_ble_close,
+		fido_ble_read,
+		fido_ble_write,
+	};
+	di->transport = (fido_dev_transport_t) {
+		fido_ble_rx,
+		fido_ble_tx,
+	};
+	(*a->olen)++;
+
+	return 0;
+fail:
+	fido_free(di->path);
+	fido_free(di->manufacturer);
+	fido_free(di->product);
+	explicit_bzero(di, sizeof(*di));
+
+	return -1;
+}
+
+int
+fido_ble_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
+{
+	struct manifest_arg a;
+	sd_bus *bus = NULL;
+	int r;
+
+	*olen = 0;
+
+	if (ilen == 0)
+		return FIDO_OK;
+	if (devlist == NULL)
+		return FIDO_ERR_INVALID_ARGUMENT;
+
+	if ((r = sd_bus_open_system(&bus)) < 0) {
+		fido_log_debug("%s: sd_bus_open_system: %s", __func__,
+		    strerror(-r));
+		return FIDO_OK; /* no system bus, no ble devices */
+	}
+
+	a.devlist = devlist;
+	a.ilen = ilen;
+	a.olen = olen;
+	/* bluez may not be running; suppress error */
+	if (ble_walk(bus, BLUEZ_DEVICE, copy_info, &a) < 0)
+		fido_log_debug("%s: ble_walk", __func__);
+
+	sd_bus_flush_close_unref(bus);
+
+	return FIDO_OK;
+}
+
+static void
+ble_free(struct ble_linux **ctx_p)
+{
+	struct ble_linux *ctx;
+
+	if (ctx_p == NULL || (ctx = *ctx_p) == NULL)
+		return;
+	if (ctx->fd != -1 && close(ctx->fd) == -1)
+		fido_log_error(errno, "%s: close", __func__);
+	for (size_t i = 0; i < nitems(ctx->chrc); i++)
+		fido_free(ctx->chrc[i]);
+	fido_free(ctx->dev);
+	sd_bus_flush_close_unref(ctx->bus);
+
+	fido_free(ctx);
+	*ctx_p = NULL;
+}
+
+static int
+find_chrc(const char *path, const struct ble_props *p, void *arg)
+{
+	struct ble_linux *ctx = arg;
+	size_t len = strlen(ctx->dev);
+
+	if (p->uuid == NULL || strncmp(path, ctx->dev, len) != 0 ||
+	    path[len] != '/')
+		return 0;
+
+	for (size_t i = 0; i < nitems(chrc_uuid); i++)
+		if (strcasecmp(p->uuid, chrc_uuid[i]) == 0 &&
+		    ctx->chrc[i] == NULL) {
+			if ((ctx->chrc[i] = fido_strdup(path)) == NULL)
+				return -1;
+			break;
+		}
+
+	return 0;
+}
+
+static void
+sleep_ms(int ms)
+{
+	struct timespec ts;
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000;
+
+	if (nanosleep(&ts, NULL) == -1)
+		fido_log_error(errno, "%s: nanosleep", __func__);
+}
+
+/* connect to the device, and wait for its gatt services to be known */
+static int
+ble_connect(struct ble_linux *ctx)
+{
+	sd_bus_error err = SD_BUS_ERROR_NULL;
+	int r, resolved = 0, ok = -1;
+
+	if ((r = sd_bus_call_method(ctx->bus, BLUEZ, ctx->dev, BLUEZ_DEVICE,
+	    "Connect", &err, NULL, "")) < 0 &&
+	    !sd_bus_error_has_name(&err, "org.bluez.Error.AlreadyConnected")) {
+		fido_log_debug("%s: Connect: %s", __func__,
+		    err.message != NULL ? err.message : strerror(-r));
+		goto fail;
+	}
+
+	for (int ms = 0; ms < RESOLVE_MS; ms += RESOLVE_STEP_MS) {
+		sd_bus_error_free(&err);
+		if ((r = sd_bus_get_property_trivial(ctx->bus, BLUEZ,
+		    ctx->dev, BLUEZ_DEVICE, "ServicesResolved", &err, 'b',
+		    &resolved)) < 0) {
+			fido_log_debug("%s: ServicesResolved: %s", __func__,
+			    err.message != NULL ? err.message : strerror(-r));
+			goto fail;
+		}
+		if (resolved)
+			break;
+		sleep_ms(RESOLVE_STEP_MS);
+	}
+	if (!resolved) {
+		fido_log_debug("%s: services not resolved", __func__);
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+	sd_bus_error_free(&err);
+
+	return ok;
+}
+
+static int
+chrc_read(struct ble_linux *ctx, int chrc, uint8_t *buf, size_t len)
+{
+	sd_bus_error err = SD_BUS_ERROR_NULL;
+	sd_bus_message *m = NULL;
+	const void *ptr;
+	size_t n;
+	int r, ok = -1;
+
+	if ((r = sd_bus_call_method(ctx->bus, BLUEZ, ctx->chrc[chrc],
+	    BLUEZ_CHRC, "ReadValue", &err, &m, "a{sv}", 0)) < 0) {
+		fido_log_debug("%s: ReadValue: %s", __func__,
+		    err.message != NULL ? err.message : strerror(-r));
+		goto fail;
+	}
+	if (sd_bus_message_read_array(m, 'y', &ptr, &n) < 0 || n != len) {
+		fido_log_debug("%s: read_array", __func__);
+		goto fail;
+	}
+	memcpy(buf, ptr, len);
+
+	ok = 0;
+fail:
+	sd_bus_message_unref(m);
+	sd_bus_error_free(&err);
+
+	return ok;
+}
+
+static int
+chrc_write(struct ble_linux *ctx, int chrc, const uint8_t *buf, size_t len)
+{
+	sd_bus_error err = SD_BUS_ERROR_NULL;
+	sd_bus_message *m = NULL;
+	int r, ok = -1;
+
+	if (sd_bus_message_new_method_call(ctx->bus, &m, BLUEZ,
+	    ctx->chrc[chrc], BLUEZ_CHRC, "WriteValue") < 0 ||
+	    sd_bus_message_append_array(m, 'y', buf, len) < 0 ||
+	    sd_bus_message_append(m, "a{sv}", 1, "type", "s", "request") < 0) {
+		fido_log_debug("%s: sd_bus_message", __func__);
+		goto fail;
+	}
+	if ((r = sd_bus_call(ctx->bus, m, 0, &err, NULL)) < 0) {
+		fido_log_debug("%s: WriteValue: %s", __func__,
+		    err.message != NULL ? err.message : strerror(-r));
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+	sd_bus_message_unref(m);
+	sd_bus_error_free(&err);
+
+	return ok;
+}
+
+/* select fido2 if the authenticator speaks both fido2 and u2f */
+static int
+select_revision(struct ble_linux *ctx)
+{
+	uint8_t rev;
+
+	if (chrc_read(ctx, CHRC_REV, &rev, sizeof(rev)) < 0) {
+		fido_log_debug("%s: chrc_read", __func__);
+		return -1;
+	}
+	if (rev & REV_FIDO2)
+		rev = REV_FIDO2;
+	else if (rev & REV_U2F_1_2)
+		rev = REV_U2F_1_2;
+	else
+		return 0; /* u2f 1.1 only; nothing to select */
+
+	return chrc_write(ctx, CHRC_REV, &rev, sizeof(rev));
+}
+
+static int
+acquire_notify(struct ble_linux *ctx)
+{
+	sd_bus_error err = SD_BUS_ERROR_NULL;
+	sd_bus_message *m = NULL;
+	uint16_t mtu;
+	int r, fd, ok = -1;
+
+	if ((r = sd_bus_call_method(ctx->bus, BLUEZ, ctx->chrc[CHRC_STATUS],
+	    BLUEZ_CHRC, "AcquireNotify", &err, &m, "a{sv}", 0)) < 0) {
+		fido_log_debug("%s: AcquireNotify: %s", __func__,
+		    err.message != NULL ? err.message : strerror(-r));
+		goto fail;
+	}
+	if (sd_bus_message_read(m, "hq", &fd, &mtu) < 0) {
+		fido_log_debug("%s: sd_bus_message_read", __func__);
+		goto fail;
+	}
+	/* the descriptor belongs to the message */
+	if ((ctx->fd = fcntl(fd, F_DUPFD_CLOEXEC, 3)) == -1) {
+		fido_log_error(errno, "%s: fcntl", __func__);
+		goto fail;
+	}
+	fido_log_debug("%s: mtu=%u", __func__, (unsigned)mtu);
+
+	ok = 0;
+fail:
+	sd_bus_message_unref(m);
+	sd_bus_error_free(&err);
+
+	return ok;
+}
+
+void *
+fido_ble_open(const char *path)
+{
+	struct ble_linux *ctx = NULL;
+	uint8_t cp_len[2];
+	int r;
+
+	if (strncmp(path, FIDO_BLE_PREFIX, strlen(FIDO_BLE_PREFIX)) != 0) {
+		fido_log_debug("%s: bad prefix", __func__);
+		goto fail;
+	}
+	if ((ctx = fido_calloc(1, sizeof(*ctx))) == NULL ||
+	    (ctx->dev = fido_strdup(path + strlen(FIDO_BLE_PREFIX))) == NULL)
+		goto fail;
+	ctx->fd = -1;
+	if ((r = sd_bus_open_system(&ctx->bus)) < 0) {
+		fido_log_debug("%s: sd_bus_open_system: %s", __func__,
+		    strerror(-r));
+		goto fail;
+	}
+	if (ble_connect(ctx) < 0 ||
+	    ble_walk(ctx->bus, BLUEZ_CHRC, find_chrc, ctx) < 0) {
+		fido_log_debug("%s: %s", __func__, ctx->dev);
+		goto fail;
+	}
+	for (size_t i = 0; i < nitems(ctx->chrc); i++)
+		if (ctx->chrc[i] == NULL) {
+			fido_log_debug("%s: no %s", __func__, chrc_uuid[i]);
+			goto fail;
+		}
+	if (chrc_read(ctx, CHRC_CP_LEN, cp_len, sizeof(cp_len)) < 0 ||
+	    select_revision(ctx) < 0 || acquire_notify(ctx) < 0) {
+		fido_log_debug("%s: gatt", __func__);
+		goto fail;
+	}
+	/* validated by the framing code; see ble.c */
+	ctx->cp_len = (size_t)(cp_len[0] << 8 | cp_len[1]);
+
+	return ctx;
+fail:
+	ble_free(&ctx);
+
+	return NULL;
+}
+
+void
+fido_ble_close(void *handle)
+{
+	struct ble_linux *ctx = handle;
+
+	ble_free(&ctx);
+}
+
+size_t
+fido_ble_cp_len(void *handle)
+{
+	struct ble_linux *ctx = handle;
+
+	return ctx->cp_len;
+}
+
+int
+fido_ble_set_sigmask(void *handle, const fido_sigset_t *sigmask)
+{
+	struct ble_linux *ctx = handle;
+
+	ctx->sigmask = *sigmask;
+	ctx->sigmaskp = &ctx->sigmask;
+
+	return FIDO_OK;
+}
+
+int
+fido_ble_read(void *handle, unsigned char *buf, size_t len, int ms)
+{
+	struct ble_linux *ctx = handle;
+	ssize_t r;
+
+	if (fido_hid_unix_wait(ctx->fd, -1, ms, ctx->sigmaskp) < 0) {
+		fido_log_debug("%s: fido_hid_unix_wait", __func__);
+		return -1;
+	}
+	if ((r = read(ctx->fd, buf, len)) == -1) {
+		fido_log_error(errno, "%s: read", __func__);
+		return -1;
+	}
+	if (r > INT_MAX) {
+		fido_log_debug("%s: %zd", __func__, r);
+		return -1;
+	}
+
+	fido_log_xxd(buf, (size_t)r, "%s", __func__);
+
+	return (int)r;
+}
+
+int
+fido_ble_write(void *handle, const unsigned char *buf, size_t len)
+{
+	struct ble_linux *ctx = handle;
+
+	fido_log_xxd(buf, len, "%s", __func__);
+
+	if (len > INT_MAX) {
+		fido_log_debug("%s: len", __func__);
+		return -1;
+	}
+	if (chrc_write(ctx, CHRC_CP, buf, len) < 0) {
+		fido_log_debug("%s: chrc_write", __func__);
+		return -1;
+	}
+
+	return (int)len;
+}
@@ -7,31 +7,57 @@
 
 #include "fido.h"
 
+#define ARENA_CHUNKLEN	2048
+
+/*
+ * An arena hands out bytes from chunks that are only released, and
+ * wiped, all at once by fido_arena_free(). Blobs set from an arena are
+ * borrowed; resetting them leaves their bytes to the arena.
+ */
+struct fido_arena_chunk {
+	struct fido_arena_chunk	*next; /* previously filled chunk */
+	size_t			 size; /* bytes following the header */
+	size_t			 off;  /* bytes handed out */
+};
+
 fido_blob_t *
 fido_blob_new(void)
 {
-	return calloc(1, sizeof(fido_blob_t));
+	return fido_calloc(1, sizeof(fido_blob_t));
 }
 
 void
 fido_blob_reset(fido_blob_t *b)
 {
-	freezero(b->ptr, b->len);
+	if (b->borrowed == false)
+		fido_freezero(b->ptr, b->len);
 	explicit_bzero(b, sizeof(*b));
 }
 
 int
 fido_blob_set(fido_blob_t *b, const u_char *ptr, size_t len)
 {
-	fido_blob_reset(b);
-
 	if (ptr == NULL || len == 0) {
 		fido_log_debug("%s: ptr=%p, len=%zu", __func__,
 		    (const void *)ptr, len);
+		fido_blob_reset(b);
 		return -1;
 	}
 
-	if ((b->ptr = malloc(len)) == NULL) {
+	/*
+	 * Objects reused for many operations set blobs of the same size
+	 * over and over; a value that fits is written over the old one.
+	 */
+	if (b->ptr != NULL && b->borrowed == false && len <= b->len) {
+		memmove(b->ptr, ptr, len);
+		explicit_bzero(b->ptr + len, b->len - len);
+		b->len = len;
+		return 0;
+	}
+
+	fido_blob_reset(b);
+
+	if ((b->ptr = fido_malloc_as(FIDO_MEM_BLOB, len)) == NULL) {
 		fido_log_debug("%s: malloc", __func__);
 		return -1;
 	}
@@ -42,6 +68,109 @@ fido_blob_set(fido_blob_t *b, const u_char *ptr, size_t len)
 	return 0;
 }
 
+/* as fido_blob_set(), for secrets; see fido_secure_alloc() */
+int
+fido_blob_set_secure(fido_blob_t *b, const u_char *ptr, size_t len)
+{
+	u_char *tmp;
+
+	if (ptr == NULL || len == 0) {
+		fido_log_debug("%s: ptr=%p, len=%zu", __func__,
+		    (const void *)ptr, len);
+		fido_blob_reset(b);
+		return -1;
+	}
+	if ((tmp = fido_secure_alloc(len)) == NULL) {
+		fido_log_debug("%s: fido_secure_alloc", __func__);
+		fido_blob_reset(b);
+		return -1;
+	}
+
+	memcpy(tmp, ptr, len);
+	fido_blob_reset(b);
+	b->ptr = tmp;
+	b->len = len;
+
+	return 0;
+}
+
+/*
+ * Point b at len bytes of the caller's, which must remain valid, and
+ * unchanged, until b is set again or reset.
+ */
+int
+fido_blob_borrow(fido_blob_t *b, const u_char *ptr, size_t len)
+{
+	fido_blob_reset(b);
+
+	if (ptr == NULL || len == 0) {
+		fido_log_debug("%s: ptr=%p, len=%zu", __func__,
+		    (const void *)ptr, len);
+		return -1;
+	}
+
+	b->ptr = (u_char *)(uintptr_t)ptr;
+	b->len = len;
+	b->borrowed = true;
+
+	return 0;
+}
+
+/*
+ * Adopt len bytes at ptr, obtained from the allocator in effect, which
+ * b releases with fido_free(). On failure, ptr remains the caller's.
+ */
+int
+fido_blob_take(fido_blob_t *b, u_char *ptr, size_t len)
+{
+	if (ptr == NULL || len == 0) {
+		fido_log_debug("%s: ptr=%p, len=%zu", __func__,
+		    (const void *)ptr, len);
+		fido_blob_reset(b);
+		return -1;
+	}
+	if ((ptr = fido_mem_adopt(FIDO_MEM_BLOB, ptr, len)) == NULL) {
+		fido_log_debug("%s: fido_mem_adopt", __func__);
+		return -1;
+	}
+
+	fido_blob_reset(b);
+	b->ptr = ptr;
+	b->len = len;
+
+	return 0;
+}
+
+/*
+ * Set b to a copy of len bytes at ptr kept in arena a, which must
+ * outlive b.
+ */
+int
+fido_blob_set_arena(fido_blob_t *b, fido_arena_t *a, const u_char *ptr,
+    size_t len)
+{
+	u_char *tmp;
+
+	fido_blob_reset(b);
+
+	if (ptr == NULL || len == 0) {
+		fido_log_debug("%s: ptr=%p, len=%zu", __func__,
+		    (const void *)ptr, len);
+		return -1;
+	}
+	if ((tmp = fido_arena_alloc(a, len)) == NULL) {
+		fido_log_debug("%s: fido_arena_alloc", __func__);
+		return -1;
+	}
+
+	memcpy(tmp, ptr, len);
+	b->ptr = tmp;
+	b->len = len;
+	b->borrowed = true;
+
+	return 0;
+}
+
 int
 fido_blob_append(fido_blob_t *b, const u_char *ptr, size_t len)
 {
@@ -56,7 +185,17 @@ fido_blob_append(fido_blob_t *b, const u_char *ptr, size_t len)
 		fido_log_debug("%s: overflow", __func__);
 		return -1;
 	}
-	if ((tmp = realloc(b->ptr, b->len + len)) == NULL) {
+	if (b->borrowed) {
+		if ((tmp = fido_malloc_as(FIDO_MEM_BLOB, b->len + len)) == NULL) {
+			fido_log_debug("%s: malloc", __func__);
+			return -1;
+		}
+		memcpy(tmp, b->ptr, b->len);
+		b->ptr = tmp;
+		b->borrowed = false;
+	}
+	if ((tmp = fido_realloc_as(FIDO_MEM_BLOB, b->ptr,
+	    b->len + len)) == NULL) {
 		fido_log_debug("%s: realloc", __func__);
 		return -1;
 	}
@@ -76,7 +215,7 @@ fido_blob_free(fido_blob_t **bp)
 		return;
 
 	fido_blob_reset(b);
-	free(b);
+	fido_free(b);
 	*bp = NULL;
 }
 
@@ -88,15 +227,104 @@ fido_free_blob_array(fido_blob_array_t *array)
 
 	for (size_t i = 0; i < array->len; i++) {
 		fido_blob_t *b = &array->ptr[i];
-		freezero(b->ptr, b->len);
+		fido_freezero(b->ptr, b->len);
 		b->ptr = NULL;
 	}
 
-	free(array->ptr);
+	fido_free(array->ptr);
 	array->ptr = NULL;
 	array->len = 0;
 }
 
+#define BLOB_BUILDER_MINLEN	64
+
+/*
+ * A blob assembled from many pieces, such as the chunks of a large-blob
+ * array. Its buffer grows geometrically and is trimmed once, by
+ * fido_blob_builder_finish(), instead of being reallocated per piece.
+ */
+int
+fido_blob_builder_reserve(fido_blob_builder_t *bb, size_t n)
+{
+	unsigned char	*ptr;
+	size_t		 cap;
+
+	if (n <= bb->cap - bb->len)
+		return 0;
+	if (n > SIZE_MAX / 2 - bb->len) {
+		fido_log_debug("%s: len=%zu, n=%zu", __func__, bb->len, n);
+		return -1;
+	}
+
+	for (cap = bb->cap ? bb->cap : BLOB_BUILDER_MINLEN; cap - bb->len < n;)
+		cap *= 2;
+
+	/* fido_recallocarray() zeroes the old buffer, which may hold secrets */
+	if ((ptr = fido_recallocarray_as(FIDO_MEM_BLOB, bb->ptr, bb->cap,
+	    cap, 1)) == NULL) {
+		fido_log_debug("%s: recallocarray", __func__);
+		return -1;
+	}
+	bb->ptr = ptr;
+	bb->cap = cap;
+
+	return 0;
+}
+
+int
+fido_blob_builder_append(fido_blob_builder_t *bb, const u_char *ptr,
+    size_t len)
+{
+	if (ptr == NULL || len == 0) {
+		fido_log_debug("%s: ptr=%p, len=%zu", __func__,
+		    (const void *)ptr, len);
+		return -1;
+	}
+	if (fido_blob_builder_reserve(bb, len) < 0)
+		return -1;
+
+	memcpy(bb->ptr + bb->len, ptr, len);
+	bb->len += len;
+
+	return 0;
+}
+
+/* hand the assembled bytes over to b, trimmed to size */
+int
+fido_blob_builder_finish(fido_blob_builder_t *bb, fido_blob_t *b)
+{
+	unsigned char *ptr;
+
+	if (bb->len == 0) {
+		fido_log_debug("%s: empty", __func__);
+		fido_blob_builder_reset(bb);
+		return -1;
+	}
+	if (bb->cap > bb->len) {
+		if ((ptr = fido_recallocarray_as(FIDO_MEM_BLOB, bb->ptr,
+		    bb->cap, bb->len, 1)) == NULL) {
+			fido_log_debug("%s: recallocarray", __func__);
+			fido_blob_builder_reset(bb);
+			return -1;
+		}
+		bb->ptr = ptr;
+	}
+
+	fido_blob_reset(b);
+	b->ptr = bb->ptr;
+	b->len = bb->len;
+	memset(bb, 0, sizeof(*bb));
+
+	return 0;
+}
+
+void
+fido_blob_builder_reset(fido_blob_builder_t *bb)
+{
+	fido_freezero(bb->ptr, bb->cap);
+	memset(bb, 0, sizeof(*bb));
+}
+
 cbor_item_t *
 fido_blob_encode(const fido_blob_t *b)
 {
@@ -112,6 +340,27 @@ fido_blob_decode(const cbor_item_t *item, fido_blob_t *b)
 	return cbor_bytestring_copy(item, &b->ptr, &b->len);
 }
 
+/* as fido_blob_decode(), into arena a */
+int
+fido_blob_decode_arena(const cbor_item_t *item, fido_blob_t *b,
+    fido_arena_t *a)
+{
+	if (b->ptr != NULL || b->len != 0) {
+		fido_log_debug("%s: dup", __func__);
+		return -1;
+	}
+	if (cbor_isa_bytestring(item) == false ||
+	    cbor_bytestring_is_definite(item) == false) {
+		fido_log_debug("%s: cbor type", __func__);
+		return -1;
+	}
+	if (cbor_bytestring_length(item) == 0)
+		return 0;
+
+	return fido_blob_set_arena(b, a, cbor_bytestring_handle(item),
+	    cbor_bytestring_length(item));
+}
+
 int
 fido_blob_is_empty(const fido_blob_t *b)
 {
@@ -132,3 +381,43 @@ fido_blob_serialise(fido_blob_t *b, const cbor_item_t *item)
 
 	return 0;
 }
+
+void *
+fido_arena_alloc(fido_arena_t *a, size_t len)
+{
+	struct fido_arena_chunk	*c = a->head;
+	size_t			 size;
+	u_char			*p;
+
+	if (len == 0)
+		return NULL;
+
+	/* the rest of a chunk too short for len is left unused */
+	if (c == NULL || c->size - c->off < len) {
+		size = len > ARENA_CHUNKLEN ? len : ARENA_CHUNKLEN;
+		if (size > SIZE_MAX - sizeof(*c) || (c =
+		    fido_malloc_as(FIDO_MEM_BLOB, sizeof(*c) + size)) == NULL)
+			return NULL;
+		c->next = a->head;
+		c->size = size;
+		c->off = 0;
+		a->head = c;
+	}
+
+	p = (u_char *)(c + 1) + c->off;
+	c->off += len;
+
+	return p;
+}
+
+void
+fido_arena_free(fido_arena_t *a)
+{
+	struct fido_arena_chunk *c, *next;
+
+	for (c = a->head; c != NULL; c = next) {
+		next = c->next;
+		fido_freezero(c, sizeof(*c) + c->size);
+	}
+	a->head = NULL;
+}
@@ -9,6 +9,7 @@
 #define _BLOB_H
 
 #include <cbor.h>
+#include <stdbool.h>
 #include <stdlib.h>
 
 #ifdef __cplusplus
@@ -18,6 +19,7 @@ extern "C" {
 typedef struct fido_blob {
 	unsigned char	*ptr;
 	size_t		 len;
+	bool		 borrowed; /* ptr is not the blob's to free */
 } fido_blob_t;
 
 typedef struct fido_blob_array {
@@ -25,16 +27,51 @@ typedef struct fido_blob_array {
 	size_t		 len;
 } fido_blob_array_t;
 
+typedef struct fido_blob_builder {
+	unsigned char	*ptr; /* output buffer */
+	size_t		 len; /* bytes appended to ptr */
+	size_t		 cap; /* allocated length of ptr */
+} fido_blob_builder_t;
+
+typedef struct fido_arena {
+	struct fido_arena_chunk *head; /* chunk being filled */
+} fido_arena_t;
+
+typedef struct cbor_writer {
+	unsigned char	*ptr; /* output buffer */
+	size_t		 len; /* allocated length of ptr */
+	size_t		 off; /* bytes written to ptr */
+	int		 err; /* set if a write failed */
+} cbor_writer_t;
+
+typedef struct cbor_key_decoder {
+	uint8_t	  key; /* one-byte unsigned map key */
+	int	(*decode)(const cbor_item_t *, void *); /* NULL to skip */
+} cbor_key_decoder_t;
+
 cbor_item_t *fido_blob_encode(const fido_blob_t *);
 fido_blob_t *fido_blob_new(void);
 int fido_blob_decode(const cbor_item_t *, fido_blob_t *);
+int fido_blob_decode_arena(const cbor_item_t *, fido_blob_t *, fido_arena_t *);
 int fido_blob_is_empty(const fido_blob_t *);
 int fido_blob_set(fido_blob_t *, const u_char *, size_t);
+int fido_blob_set_secure(fido_blob_t *, const u_char *, size_t);
+int fido_blob_borrow(fido_blob_t *, const u_char *, size_t);
+int fido_blob_take(fido_blob_t *, u_char *, size_t);
+int fido_blob_set_arena(fido_blob_t *, fido_arena_t *, const u_char *, size_t);
 int fido_blob_append(fido_blob_t *, const u_char *, size_t);
 void fido_blob_free(fido_blob_t **);
 void fido_blob_reset(fido_blob_t *);
 void fido_free_blob_array(fido_blob_array_t *);
 
+int fido_blob_builder_reserve(fido_blob_builder_t *, size_t);
+int fido_blob_builder_append(fido_blob_builder_t *, const u_char *, size_t);
+int fido_blob_builder_finish(fido_blob_builder_t *, fido_blob_t *);
+void fido_blob_builder_reset(fido_blob_builder_t *);
+
+void *fido_arena_alloc(fido_arena_t *, size_t);
+void fido_arena_free(fido_arena_t *);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif /* __cplusplus */
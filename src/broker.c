@@ -0,0 +1,540 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include "fido.h"
+
+#ifdef USE_BROKER
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+
+#define BROKER_MAXCLIENTS	32	/* connections served at a time */
+#define BROKER_MAXCIDS		64	/* channels handed out at a time */
+#define BROKER_MAXFRAMES	(0x80 + 1) /* frames in a ctaphid message */
+#define FRAME_LEN		CTAP_MAX_REPORT_LEN
+
+/*
+ * A broker owns a hid device and relays CTAPHID frames between it and
+ * processes connected to a SOCK_SEQPACKET unix socket. A client sends
+ * every frame of a message in one datagram, and receives one frame per
+ * datagram; report ids are not sent. Clients obtain channels of their
+ * own through CTAPHID_INIT on the broadcast channel, whose reply is
+ * routed by nonce; every other frame is routed by channel id.
+ */
+struct broker_client {
+	int		fd;
+	bool		init;	/* CTAPHID_INIT pending on the broadcast cid */
+	unsigned char	nonce[8];
+};
+
+struct broker_cid {
+	uint32_t	cid;
+	size_t		client;	/* index in broker.client[] */
+};
+
+struct broker {
+	fido_dev_t		*dev;
+	struct broker_client	 client[BROKER_MAXCLIENTS];
+	size_t			 nclient;
+	struct broker_cid	 cid[BROKER_MAXCIDS];
+	size_t			 ncid;
+	unsigned char		 msg[BROKER_MAXFRAMES * FRAME_LEN + 1];
+	unsigned char		 report[BROKER_MAXFRAMES * (FRAME_LEN + 1)];
+};
+
+/* a client's end of the socket */
+struct broker_conn {
+	int		 fd;
+	sigset_t	 sigmask;
+	const sigset_t	*sigmaskp;
+};
+
+static uint32_t
+frame_cid(const unsigned char *frame)
+{
+	uint32_t cid;
+
+	memcpy(&cid, frame, sizeof(cid));
+
+	return (cid);
+}
+
+/* frame is FRAME_LEN bytes: cid, cmd, bcnt, nonce[, cid] */
+static bool
+frame_is_init(const unsigned char *frame)
+{
+	return (frame[4] == (CTAP_FRAME_INIT | CTAP_CMD_INIT));
+}
+
+static int
+set_nonblock(int fd)
+{
+	int flags;
+
+	if ((flags = fcntl(fd, F_GETFL)) == -1 ||
+	    fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		fido_log_error(errno, "%s: fcntl", __func__);
+		return (-1);
+	}
+
+	return (0);
+}
+
+static int
+broker_write(struct broker *b, const unsigned char *msg, size_t n)
+{
+	fido_dev_t	*dev = b->dev;
+	unsigned char	*p = b->report;
+	const size_t	 len = FRAME_LEN + 1;
+
+	for (size_t i = 0; i < n; i++) {
+		p[i * len] = 0; /* report id */
+		memcpy(&p[i * len + 1], &msg[i * FRAME_LEN], FRAME_LEN);
+	}
+
+	if (dev->io.write == fido_hid_write) {
+		if (fido_hid_writev(dev->io_handle, p, len, n) != (int)(n * len))
+			return (-1);
+		return (0);
+	}
+
+	for (size_t i = 0; i < n; i++)
+		if (dev->io.write(dev->io_handle, &p[i * len], len) != (int)len)
+			return (-1);
+
+	return (0);
+}
+
+static int
+broker_owner(const struct broker *b, uint32_t cid, size_t *i)
+{
+	for (size_t k = 0; k < b->ncid; k++)
+		if (b->cid[k].cid == cid) {
+			*i = b->cid[k].client;
+			return (0);
+		}
+
+	return (-1);
+}
+
+static void
+broker_claim(struct broker *b, uint32_t cid, size_t i)
+{
+	for (size_t k = 0; k < b->ncid; k++)
+		if (b->cid[k].cid == cid) {
+			b->cid[k].client = i;
+			return;
+		}
+
+	if (b->ncid == nitems(b->cid)) {
+		/* the cid's frames will be dropped */
+		fido_log_debug("%s: cid=0x%x", __func__, cid);
+		return;
+	}
+
+	b->cid[b->ncid].cid = cid;
+	b->cid[b->ncid].client = i;
+	b->ncid++;
+}
+
+static void
+broker_drop(struct broker *b, size_t i)
+{
+	unsigned char	frame[FRAME_LEN];
+	size_t		k = 0;
+
+	fido_log_debug("%s: fd=%d", __func__, b->client[i].fd);
+
+	if (close(b->client[i].fd) == -1)
+		fido_log_error(errno, "%s: close", __func__);
+
+	/* cancel what its channels left behind, and forget them */
+	while (k < b->ncid) {
+		if (b->cid[k].client != i) {
+			if (b->cid[k].client == b->nclient - 1)
+				b->cid[k].client = i;
+			k++;
+			continue;
+		}
+		memset(frame, 0, sizeof(frame));
+		memcpy(frame, &b->cid[k].cid, sizeof(b->cid[k].cid));
+		frame[4] = CTAP_FRAME_INIT | CTAP_CMD_CANCEL;
+		if (broker_write(b, frame, 1) < 0)
+			fido_log_debug("%s: broker_write", __func__);
+		b->cid[k] = b->cid[--b->ncid];
+	}
+
+	b->client[i] = b->client[--b->nclient];
+	memset(&b->client[b->nclient], 0, sizeof(b->client[b->nclient]));
+}
+
+static void
+broker_send(struct broker *b, size_t i, const unsigned char *frame)
+{
+	/* a client that is not reading loses the frame */
+	if (send(b->client[i].fd, frame, FRAME_LEN, MSG_NOSIGNAL) != FRAME_LEN)
+		fido_log_error(errno, "%s: send", __func__);
+}
+
+/* route a frame read from the device */
+static void
+broker_rx(struct broker *b, const unsigned char *frame)
+{
+	uint32_t	cid = frame_cid(frame);
+	size_t		i;
+
+	if (cid != CTAP_CID_BROADCAST) {
+		if (broker_owner(b, cid, &i) < 0)
+			fido_log_debug("%s: cid=0x%x", __func__, cid);
+		else
+			broker_send(b, i, frame);
+		return;
+	}
+
+	for (i = 0; i < b->nclient; i++) {
+		if (b->client[i].init == false)
+			continue;
+		if (frame_is_init(frame) == false) {
+			/* an error; every pending client gets it */
+			broker_send(b, i, frame);
+			continue;
+		}
+		if (memcmp(&frame[7], b->client[i].nonce,
+		    sizeof(b->client[i].nonce)) == 0) {
+			b->client[i].init = false;
+			broker_claim(b, frame_cid(&frame[15]), i);
+			broker_send(b, i, frame);
+			return;
+		}
+	}
+}
+
+/* relay a message from client i; -1 if the client misbehaved */
+static int
+broker_tx(struct broker *b, size_t i, size_t len, int *r)
+{
+	struct broker_client	*c = &b->client[i];
+	uint32_t		 cid;
+	size_t			 n, owner;
+
+	if (len == 0 || len % FRAME_LEN != 0 ||
+	    (n = len / FRAME_LEN) > BROKER_MAXFRAMES) {
+		fido_log_debug("%s: len=%zu", __func__, len);
+		return (-1);
+	}
+
+	cid = frame_cid(b->msg);
+	for (size_t k = 1; k < n; k++)
+		if (frame_cid(&b->msg[k * FRAME_LEN]) != cid) {
+			fido_log_debug("%s: cid", __func__);
+			return (-1);
+		}
+
+	if (cid == CTAP_CID_BROADCAST) {
+		/* only to obtain a channel */
+		if (n != 1 || frame_is_init(b->msg) == false) {
+			fido_log_debug("%s: broadcast", __func__);
+			return (-1);
+		}
+		c->init = true;
+		memcpy(c->nonce, &b->msg[7], sizeof(c->nonce));
+	} else if (broker_owner(b, cid, &owner) < 0 || owner != i) {
+		fido_log_debug("%s: cid=0x%x not owned", __func__, cid);
+		return (-1);
+	}
+
+	if (broker_write(b, b->msg, n) < 0) {
+		fido_log_debug("%s: broker_write", __func__);
+		*r = FIDO_ERR_TX;
+	}
+
+	return (0);
+}
+
+static void
+broker_accept(struct broker *b, int sock)
+{
+	int fd;
+
+	if ((fd = accept(sock, NULL, NULL)) == -1) {
+		if (errno != EAGAIN && errno != EINTR)
+			fido_log_error(errno, "%s: accept", __func__);
+		return;
+	}
+
+	if (b->nclient == nitems(b->client) || set_nonblock(fd) < 0) {
+		fido_log_debug("%s: refusing fd=%d", __func__, fd);
+		if (close(fd) == -1)
+			fido_log_error(errno, "%s: close", __func__);
+		return;
+	}
+
+	memset(&b->client[b->nclient], 0, sizeof(b->client[b->nclient]));
+	b->client[b->nclient++].fd = fd;
+}
+
+int
+fido_dev_broker(fido_dev_t *dev, int sock, int ms)
+{
+	struct broker	*b = NULL;
+	struct pollfd	 pfd[2 + BROKER_MAXCLIENTS];
+	struct timespec	 ts;
+	unsigned char	 frame[FRAME_LEN];
+	ssize_t		 n;
+	size_t		 i;
+	int		 fd, r = FIDO_ERR_INTERNAL;
+
+	if (sock < 0 || dev->io_handle == NULL || dev->mux != NULL ||
+	    dev->rx_len != FRAME_LEN || dev->tx_len != FRAME_LEN ||
+	    (fd = fido_dev_poll_fd(dev)) == -1) {
+		fido_log_debug("%s: invalid argument", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	if (set_nonblock(sock) < 0 || (b = fido_calloc(1, sizeof(*b))) == NULL)
+		goto fail;
+
+	b->dev = dev;
+
+	for (;;) {
+		memset(&pfd, 0, sizeof(pfd));
+		pfd[0].fd = fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = sock;
+		pfd[1].events = POLLIN;
+		for (i = 0; i < b->nclient; i++) {
+			pfd[2 + i].fd = b->client[i].fd;
+			pfd[2 + i].events = POLLIN;
+		}
+
+		if (fido_time_now(&ts) != 0)
+			goto fail;
+		if (poll(pfd, (nfds_t)(2 + b->nclient),
+		    fido_dev_rx_pending(dev) ? 0 : ms) == -1 && errno != EINTR) {
+			fido_log_error(errno, "%s: poll", __func__);
+			goto fail;
+		}
+
+		if (pfd[0].revents != 0 || fido_dev_rx_pending(dev)) {
+			if (dev->io.read(dev->io_handle, frame, sizeof(frame),
+			    0) != (int)sizeof(frame)) {
+				fido_log_debug("%s: io.read", __func__);
+				r = FIDO_ERR_RX;
+				goto fail;
+			}
+			broker_rx(b, frame);
+		}
+
+		/* backwards; broker_drop() moves the last client down */
+		for (i = b->nclient; i > 0; i--) {
+			if (pfd[1 + i].revents == 0)
+				continue;
+			if ((n = recv(b->client[i - 1].fd, b->msg,
+			    sizeof(b->msg), 0)) == -1 && (errno == EAGAIN ||
+			    errno == EINTR))
+				continue;
+			if (n <= 0 || broker_tx(b, i - 1, (size_t)n, &r) < 0)
+				broker_drop(b, i - 1);
+			if (r == FIDO_ERR_TX)
+				goto fail;
+		}
+
+		if (pfd[1].revents & POLLIN)
+			broker_accept(b, sock);
+
+		if (fido_time_delta(&ts, &ms) != 0)
+			goto fail;
+		if (ms == 0) {
+			r = FIDO_OK;
+			goto fail;
+		}
+	}
+fail:
+	if (b != NULL) {
+		while (b->nclient > 0)
+			broker_drop(b, b->nclient - 1);
+		fido_freezero(b, sizeof(*b));
+	}
+
+	return (r);
+}
+
+bool
+fido_is_broker(const char *path)
+{
+	return (strncmp(path, FIDO_BROKER_PREFIX,
+	    strlen(FIDO_BROKER_PREFIX)) == 0);
+}
+
+void *
+fido_broker_open(const char *path)
+{
+	struct broker_conn	*conn;
+	struct sockaddr_un	 sun;
+
+	if (fido_is_broker(path) == false) {
+		fido_log_debug("%s: path", __func__);
+		return (NULL);
+	}
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlcpy(sun.sun_path, path + strlen(FIDO_BROKER_PREFIX),
+	    sizeof(sun.sun_path)) >= sizeof(sun.sun_path)) {
+		fido_log_debug("%s: strlcpy", __func__);
+		return (NULL);
+	}
+
+	if ((conn = fido_calloc(1, sizeof(*conn))) == NULL)
+		return (NULL);
+
+	if ((conn->fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) == -1) {
+		fido_log_error(errno, "%s: socket", __func__);
+		fido_free(conn);
+		return (NULL);
+	}
+
+	if (connect(conn->fd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+		fido_log_error(errno, "%s: connect", __func__);
+		fido_broker_close(conn);
+		return (NULL);
+	}
+
+	return (conn);
+}
+
+void
+fido_broker_close(void *handle)
+{
+	struct broker_conn *conn = handle;
+
+	if (close(conn->fd) == -1)
+		fido_log_error(errno, "%s: close", __func__);
+
+	fido_free(conn);
+}
+
+int
+fido_broker_set_sigmask(void *handle, const fido_sigset_t *sigmask)
+{
+	struct broker_conn *conn = handle;
+
+	conn->sigmask = *sigmask;
+	conn->sigmaskp = &conn->sigmask;
+
+	return (FIDO_OK);
+}
+
+int
+fido_broker_get_fd(void *handle)
+{
+	struct broker_conn *conn = handle;
+
+	return (conn->fd);
+}
+
+int
+fido_broker_read(void *handle, unsigned char *buf, size_t len, int ms)
+{
+	struct broker_conn	*conn = handle;
+	ssize_t			 r;
+
+	if (len != FRAME_LEN) {
+		fido_log_debug("%s: len %zu", __func__, len);
+		return (-1);
+	}
+
+	if (fido_hid_unix_wait(conn->fd, -1, ms, conn->sigmaskp) < 0) {
+		fido_log_debug("%s: fd not ready", __func__);
+		return (-1);
+	}
+
+	if ((r = recv(conn->fd, buf, len, 0)) == -1) {
+		fido_log_error(errno, "%s: recv", __func__);
+		return (-1);
+	}
+
+	if ((size_t)r != len) {
+		/* 0 once the broker has gone away */
+		fido_log_debug("%s: %zd != %zu", __func__, r, len);
+		return (-1);
+	}
+
+	return ((int)len);
+}
+
+int
+fido_broker_write(void *handle, const unsigned char *buf, size_t len)
+{
+	return (fido_broker_writev(handle, buf, len, 1));
+}
+
+/* every report of a message in one datagram, without report ids */
+int
+fido_broker_writev(void *handle, const unsigned char *buf, size_t len,
+    size_t n)
+{
+	struct broker_conn	*conn = handle;
+	unsigned char		*msg;
+	ssize_t			 r;
+
+	if (len != FRAME_LEN + 1 || n == 0 || n > BROKER_MAXFRAMES) {
+		fido_log_debug("%s: len=%zu, n=%zu", __func__, len, n);
+		return (-1);
+	}
+
+	if ((msg = fido_calloc(n, FRAME_LEN)) == NULL)
+		return (-1);
+
+	for (size_t i = 0; i < n; i++)
+		memcpy(&msg[i * FRAME_LEN], &buf[i * len + 1], FRAME_LEN);
+
+	if ((r = send(conn->fd, msg, n * FRAME_LEN, MSG_NOSIGNAL)) == -1)
+		fido_log_error(errno, "%s: send", __func__);
+
+	fido_freezero(msg, n * FRAME_LEN);
+
+	if (r < 0 || (size_t)r != n * FRAME_LEN)
+		return (-1);
+
+	return ((int)(n * len));
+}
+
+int
+fido_dev_set_broker(fido_dev_t *dev)
+{
+	if (dev->io_handle != NULL) {
+		fido_log_debug("%s: device open", __func__);
+		return (-1);
+	}
+
+	dev->io_own = true;
+	dev->io = (fido_dev_io_t) {
+		fido_broker_open,
+		fido_broker_close,
+		fido_broker_read,
+		fido_broker_write,
+	};
+
+	return (0);
+}
+#else
+int
+fido_dev_broker(fido_dev_t *dev, int sock, int ms)
+{
+	(void)dev;
+	(void)sock;
+	(void)ms;
+
+	return (FIDO_ERR_UNSUPPORTED_OPTION);
+}
+#endif /* USE_BROKER */
@@ -117,53 +117,415 @@ cbor_array_iter(const cbor_item_t *item, void *arg, int(*f)(const cbor_item_t *,
 	return (0);
 }
 
+/*
+ * Check the status byte of a CTAP reply and load the CBOR map that
+ * follows it, so that the caller may walk the map more than once.
+ */
 int
-cbor_parse_reply(const unsigned char *blob, size_t blob_len, void *arg,
-    int(*parser)(const cbor_item_t *, const cbor_item_t *, void *))
+cbor_load_reply(const unsigned char *blob, size_t blob_len,
+    cbor_item_t **item_p)
 {
 	cbor_item_t		*item = NULL;
 	struct cbor_load_result	 cbor;
-	int			 r;
+
+	*item_p = NULL;
 
 	if (blob_len < 1) {
 		fido_log_debug("%s: blob_len=%zu", __func__, blob_len);
-		r = FIDO_ERR_RX;
-		goto fail;
+		return (FIDO_ERR_RX);
 	}
 
 	if (blob[0] != FIDO_OK) {
 		fido_log_debug("%s: blob[0]=0x%02x", __func__, blob[0]);
-		r = blob[0];
-		goto fail;
+		return (blob[0]);
 	}
 
 	if ((item = cbor_load(blob + 1, blob_len - 1, &cbor)) == NULL) {
 		fido_log_debug("%s: cbor_load", __func__);
-		r = FIDO_ERR_RX_NOT_CBOR;
-		goto fail;
+		return (FIDO_ERR_RX_NOT_CBOR);
 	}
 
 	if (cbor_isa_map(item) == false ||
 	    cbor_map_is_definite(item) == false) {
 		fido_log_debug("%s: cbor type", __func__);
-		r = FIDO_ERR_RX_INVALID_CBOR;
-		goto fail;
+		cbor_decref(&item);
+		return (FIDO_ERR_RX_INVALID_CBOR);
 	}
 
+	*item_p = item;
+
+	return (FIDO_OK);
+}
+
+int
+cbor_parse_reply_item(const cbor_item_t *item, void *arg,
+    int(*parser)(const cbor_item_t *, const cbor_item_t *, void *))
+{
 	if (cbor_map_iter(item, arg, parser) < 0) {
 		fido_log_debug("%s: cbor_map_iter", __func__);
-		r = FIDO_ERR_RX_INVALID_CBOR;
-		goto fail;
+		return (FIDO_ERR_RX_INVALID_CBOR);
+	}
+
+	return (FIDO_OK);
+}
+
+/* read the head of the map that follows the status byte of a reply */
+static int
+cbor_reply_map_head(const unsigned char **buf, size_t *len, uint64_t *n)
+{
+	uint8_t	ib;
+	size_t	w;
+
+	if (*len < 1) {
+		fido_log_debug("%s: len=%zu", __func__, *len);
+		return (FIDO_ERR_RX_NOT_CBOR);
+	}
+
+	ib = **buf;
+	if ((ib >> 5) != CBOR_TYPE_MAP || (ib & 0x1f) == 31) {
+		fido_log_debug("%s: cbor type", __func__);
+		return (FIDO_ERR_RX_INVALID_CBOR);
+	}
+
+	switch (ib & 0x1f) {
+	case 24:
+		w = 1;
+		break;
+	case 25:
+		w = 2;
+		break;
+	case 26:
+		w = 4;
+		break;
+	case 27:
+		w = 8;
+		break;
+	case 28:
+	case 29:
+	case 30:
+		fido_log_debug("%s: ib=0x%02x", __func__, ib);
+		return (FIDO_ERR_RX_NOT_CBOR);
+	default:
+		w = 0;
+		break;
+	}
+
+	if (*len - 1 < w) {
+		fido_log_debug("%s: len=%zu", __func__, *len);
+		return (FIDO_ERR_RX_NOT_CBOR);
+	}
+
+	*n = w ? 0 : (ib & 0x1f);
+	for (size_t i = 1; i <= w; i++)
+		*n = (*n << 8) | (*buf)[i];
+
+	*buf += 1 + w;
+	*len -= 1 + w;
+
+	return (FIDO_OK);
+}
+
+/* check the status byte of a reply, and read the head of its map */
+static int
+cbor_reply_open(const unsigned char *blob, size_t blob_len,
+    const unsigned char **ptr, size_t *len, uint64_t *n)
+{
+	int r;
+
+	if (blob_len < 1) {
+		fido_log_debug("%s: blob_len=%zu", __func__, blob_len);
+		return (FIDO_ERR_RX);
+	}
+
+	if (blob[0] != FIDO_OK) {
+		fido_log_debug("%s: blob[0]=0x%02x", __func__, blob[0]);
+		return (blob[0]);
+	}
+
+	*ptr = blob + 1;
+	*len = blob_len - 1;
+
+	if ((r = cbor_reply_map_head(ptr, len, n)) != FIDO_OK) {
+		fido_log_debug("%s: cbor_reply_map_head", __func__);
+		return (r);
+	}
+
+	return (FIDO_OK);
+}
+
+/*
+ * Decode the CBOR map of a CTAP reply one entry at a time, handing each
+ * key and value to the parser as they are read off the wire. Only the
+ * current entry and the previous key, needed by ctap_check_cbor(), are
+ * held in memory; the map itself is never materialised.
+ */
+int
+cbor_parse_reply(const unsigned char *blob, size_t blob_len, void *arg,
+    int(*parser)(const cbor_item_t *, const cbor_item_t *, void *))
+{
+	cbor_item_t		*prev = NULL;
+	cbor_item_t		*key = NULL;
+	cbor_item_t		*val = NULL;
+	struct cbor_load_result	 cbor;
+	const unsigned char	*ptr;
+	size_t			 len;
+	uint64_t		 n;
+	int			 r;
+
+	if ((r = cbor_reply_open(blob, blob_len, &ptr, &len, &n)) != FIDO_OK)
+		return (r);
+
+	for (uint64_t i = 0; i < n; i++) {
+		if ((key = cbor_load(ptr, len, &cbor)) == NULL ||
+		    cbor.read > len) {
+			fido_log_debug("%s: cbor_load key", __func__);
+			r = FIDO_ERR_RX_NOT_CBOR;
+			goto fail;
+		}
+		ptr += cbor.read;
+		len -= cbor.read;
+		if ((val = cbor_load(ptr, len, &cbor)) == NULL ||
+		    cbor.read > len) {
+			fido_log_debug("%s: cbor_load value", __func__);
+			r = FIDO_ERR_RX_NOT_CBOR;
+			goto fail;
+		}
+		ptr += cbor.read;
+		len -= cbor.read;
+		if (prev != NULL && ctap_check_cbor(prev, key) < 0) {
+			fido_log_debug("%s: ctap_check_cbor", __func__);
+			r = FIDO_ERR_RX_INVALID_CBOR;
+			goto fail;
+		}
+		if (parser(key, val, arg) < 0) {
+			fido_log_debug("%s: parser < 0", __func__);
+			r = FIDO_ERR_RX_INVALID_CBOR;
+			goto fail;
+		}
+		cbor_decref(&val);
+		if (prev != NULL)
+			cbor_decref(&prev);
+		prev = key;
+		key = NULL;
 	}
 
 	r = FIDO_OK;
 fail:
-	if (item != NULL)
-		cbor_decref(&item);
+	if (prev != NULL)
+		cbor_decref(&prev);
+	if (key != NULL)
+		cbor_decref(&key);
+	if (val != NULL)
+		cbor_decref(&val);
+
+	return (r);
+}
+
+/*
+ * Table-driven decoding of CTAP reply maps. Each command lists the
+ * integer keys it knows in ascending order, with a function to decode
+ * the value of each. As canonical CBOR sorts map keys, the table is
+ * walked once alongside the map, and a key's order, width and decoder
+ * are settled in one step. Keys other than one-byte unsigned integers,
+ * which CTAP does not use, are checked for order and otherwise ignored.
+ */
+struct key_walk {
+	const cbor_key_decoder_t	*tbl;
+	size_t				 tbl_len;
+	size_t				 idx;	/* next candidate in tbl */
+	int				 last;	/* last integer key, or -1 */
+	cbor_item_t			*prev;	/* last other key, or NULL */
+};
+
+static void
+key_walk_init(struct key_walk *w, const cbor_key_decoder_t *tbl,
+    size_t tbl_len)
+{
+	memset(w, 0, sizeof(*w));
+	w->tbl = tbl;
+	w->tbl_len = tbl_len;
+	w->last = -1;
+}
+
+static int
+key_walk_int(struct key_walk *w, uint8_t key, const cbor_item_t *val,
+    void *arg)
+{
+	if (w->prev != NULL || key <= w->last) {
+		fido_log_debug("%s: unsorted key 0x%02x", __func__, key);
+		return (-1);
+	}
+	w->last = key;
+
+	while (w->idx < w->tbl_len && w->tbl[w->idx].key < key)
+		w->idx++;
+	if (w->idx == w->tbl_len || w->tbl[w->idx].key != key) {
+		fido_log_debug("%s: ignoring key 0x%02x", __func__, key);
+		return (0);
+	}
+	if (w->tbl[w->idx].decode == NULL)
+		return (0);
+
+	return (w->tbl[w->idx].decode(val, arg));
+}
+
+static int
+key_walk_other(struct key_walk *w, cbor_item_t *key)
+{
+	if (w->prev != NULL) {
+		if (ctap_check_cbor(w->prev, key) < 0) {
+			fido_log_debug("%s: ctap_check_cbor", __func__);
+			return (-1);
+		}
+	} else if (w->last >= 0) {
+		if (check_key_type(key) < 0 || (cbor_isa_uint(key) &&
+		    cbor_get_int(key) <= (uint64_t)w->last)) {
+			fido_log_debug("%s: unsorted key", __func__);
+			return (-1);
+		}
+	}
+	w->prev = key;
+
+	return (0);
+}
+
+/* read a one-byte unsigned integer key off the wire, if that is next */
+static bool
+cbor_reply_int_key(const unsigned char **ptr, size_t *len, uint8_t *key)
+{
+	if (*len >= 1 && **ptr < 24) {
+		*key = **ptr;
+		*ptr += 1;
+		*len -= 1;
+		return (true);
+	}
+	if (*len >= 2 && **ptr == 24) {
+		*key = (*ptr)[1];
+		*ptr += 2;
+		*len -= 2;
+		return (true);
+	}
+
+	return (false);
+}
+
+/*
+ * As cbor_parse_reply(), dispatching on tbl. Integer keys are read
+ * straight off the wire; only values, and other keys, go through
+ * libcbor.
+ */
+int
+cbor_parse_reply_keys(const unsigned char *blob, size_t blob_len, void *arg,
+    const cbor_key_decoder_t *tbl, size_t tbl_len)
+{
+	struct key_walk		 w;
+	cbor_item_t		*key = NULL;
+	cbor_item_t		*val = NULL;
+	cbor_item_t		*prev;
+	struct cbor_load_result	 cbor;
+	const unsigned char	*ptr;
+	size_t			 len;
+	uint64_t		 n;
+	uint8_t			 k;
+	bool			 int_key;
+	int			 r;
+
+	key_walk_init(&w, tbl, tbl_len);
+
+	if ((r = cbor_reply_open(blob, blob_len, &ptr, &len, &n)) != FIDO_OK)
+		return (r);
+
+	for (uint64_t i = 0; i < n; i++) {
+		if ((int_key = cbor_reply_int_key(&ptr, &len, &k)) == false) {
+			if ((key = cbor_load(ptr, len, &cbor)) == NULL ||
+			    cbor.read > len) {
+				fido_log_debug("%s: cbor_load key", __func__);
+				r = FIDO_ERR_RX_NOT_CBOR;
+				goto fail;
+			}
+			ptr += cbor.read;
+			len -= cbor.read;
+		}
+		if ((val = cbor_load(ptr, len, &cbor)) == NULL ||
+		    cbor.read > len) {
+			fido_log_debug("%s: cbor_load value", __func__);
+			r = FIDO_ERR_RX_NOT_CBOR;
+			goto fail;
+		}
+		ptr += cbor.read;
+		len -= cbor.read;
+		if (int_key) {
+			if (key_walk_int(&w, k, val, arg) < 0) {
+				fido_log_debug("%s: key_walk_int", __func__);
+				r = FIDO_ERR_RX_INVALID_CBOR;
+				goto fail;
+			}
+		} else {
+			prev = w.prev;
+			if (key_walk_other(&w, key) < 0) {
+				fido_log_debug("%s: key_walk_other", __func__);
+				r = FIDO_ERR_RX_INVALID_CBOR;
+				goto fail;
+			}
+			if (prev != NULL)
+				cbor_decref(&prev);
+			key = NULL; /* now w.prev */
+		}
+		cbor_decref(&val);
+	}
+
+	r = FIDO_OK;
+fail:
+	if (w.prev != NULL)
+		cbor_decref(&w.prev);
+	if (key != NULL)
+		cbor_decref(&key);
+	if (val != NULL)
+		cbor_decref(&val);
 
 	return (r);
 }
 
+/* as cbor_parse_reply_item(), dispatching on tbl */
+int
+cbor_parse_reply_item_keys(const cbor_item_t *item, void *arg,
+    const cbor_key_decoder_t *tbl, size_t tbl_len)
+{
+	struct key_walk		 w;
+	struct cbor_pair	*v;
+	size_t			 n;
+	int			 r;
+
+	key_walk_init(&w, tbl, tbl_len);
+
+	if ((v = cbor_map_handle(item)) == NULL) {
+		fido_log_debug("%s: cbor_map_handle", __func__);
+		return (FIDO_ERR_RX_INVALID_CBOR);
+	}
+
+	n = cbor_map_size(item);
+
+	for (size_t i = 0; i < n; i++) {
+		if (v[i].key == NULL || v[i].value == NULL) {
+			fido_log_debug("%s: key=%p, value=%p for i=%zu",
+			    __func__, (void *)v[i].key, (void *)v[i].value, i);
+			return (FIDO_ERR_RX_INVALID_CBOR);
+		}
+		if (cbor_isa_uint(v[i].key) &&
+		    cbor_int_get_width(v[i].key) == CBOR_INT_8)
+			r = key_walk_int(&w, cbor_get_uint8(v[i].key),
+			    v[i].value, arg);
+		else
+			r = key_walk_other(&w, v[i].key);
+		if (r < 0) {
+			fido_log_debug("%s: key_walk on i=%zu", __func__, i);
+			return (FIDO_ERR_RX_INVALID_CBOR);
+		}
+	}
+
+	return (FIDO_OK);
+}
+
 void
 cbor_vector_free(cbor_item_t **item, size_t len)
 {
@@ -187,7 +549,7 @@ cbor_bytestring_copy(const cbor_item_t *item, unsigned char **buf, size_t *len)
 	}
 
 	*len = cbor_bytestring_length(item);
-	if ((*buf = malloc(*len)) == NULL) {
+	if ((*buf = fido_malloc(*len)) == NULL) {
 		*len = 0;
 		return (-1);
 	}
@@ -214,7 +576,7 @@ cbor_string_copy(const cbor_item_t *item, char **str)
 	}
 
 	if ((len = cbor_string_length(item)) == SIZE_MAX ||
-	    (*str = malloc(len + 1)) == NULL)
+	    (*str = fido_malloc(len + 1)) == NULL)
 		return (-1);
 
 	memcpy(*str, cbor_string_handle(item), len);
@@ -371,63 +733,413 @@ fail:
 	return (ok);
 }
 
-cbor_item_t *
-cbor_flatten_vector(cbor_item_t *argv[], size_t argc)
+cbor_item_t *
+cbor_flatten_vector(cbor_item_t *argv[], size_t argc)
+{
+	cbor_item_t	*map;
+	uint8_t		 i;
+
+	if (argc > UINT8_MAX - 1)
+		return (NULL);
+
+	if ((map = cbor_new_definite_map(argc)) == NULL)
+		return (NULL);
+
+	for (i = 0; i < argc; i++)
+		if (cbor_add_arg(map, (uint8_t)(i + 1), argv[i]) < 0)
+			break;
+
+	if (i != argc) {
+		cbor_decref(&map);
+		map = NULL;
+	}
+
+	return (map);
+}
+
+#define CBOR_WRITER_MINLEN	256
+#define CBOR_WRITER_MAXLEN	(1 << 20)
+
+/*
+ * A minimal CBOR encoder that writes canonical CTAP2 encodings straight
+ * into a single growing buffer, bypassing libcbor's item trees. Errors are
+ * sticky and reported by cbor_writer_finish().
+ */
+static int
+cbor_writer_grow(cbor_writer_t *w, size_t n)
+{
+	unsigned char	*ptr;
+	size_t		 len;
+
+	if (w->err)
+		return (-1);
+	if (n <= w->len - w->off)
+		return (0);
+	if (n > CBOR_WRITER_MAXLEN - w->off) {
+		fido_log_debug("%s: off=%zu, n=%zu", __func__, w->off, n);
+		goto fail;
+	}
+
+	for (len = w->len ? w->len : CBOR_WRITER_MINLEN; len - w->off < n;)
+		len *= 2;
+	if (len > CBOR_WRITER_MAXLEN)
+		len = CBOR_WRITER_MAXLEN;
+
+	/* fido_recallocarray() zeroes the old buffer, which may hold secrets */
+	if ((ptr = fido_recallocarray(w->ptr, w->len, len, 1)) == NULL)
+		goto fail;
+
+	w->ptr = ptr;
+	w->len = len;
+
+	return (0);
+fail:
+	w->err = 1;
+
+	return (-1);
+}
+
+/* encode a head of type and arg at p, which has room for 9 bytes */
+static size_t
+cbor_head_encode(unsigned char *p, uint8_t type, uint64_t arg)
+{
+	size_t n;
+
+	if (arg < 24)
+		n = 0;
+	else if (arg <= UINT8_MAX)
+		n = 1;
+	else if (arg <= UINT16_MAX)
+		n = 2;
+	else if (arg <= UINT32_MAX)
+		n = 4;
+	else
+		n = 8;
+
+	switch (n) {
+	case 0:
+		*p = (uint8_t)((uint64_t)type << 5 | arg);
+		return (1);
+	case 1:
+		*p++ = (uint8_t)(type << 5 | 24);
+		break;
+	case 2:
+		*p++ = (uint8_t)(type << 5 | 25);
+		break;
+	case 4:
+		*p++ = (uint8_t)(type << 5 | 26);
+		break;
+	default:
+		*p++ = (uint8_t)(type << 5 | 27);
+		break;
+	}
+
+	for (size_t i = n; i > 0; i--)
+		*p++ = (uint8_t)(arg >> (8 * (i - 1)));
+
+	return (n + 1);
+}
+
+static void
+cbor_write_head(cbor_writer_t *w, uint8_t type, uint64_t arg)
+{
+	if (cbor_writer_grow(w, 9) < 0)
+		return;
+
+	w->off += cbor_head_encode(w->ptr + w->off, type, arg);
+}
+
+void
+cbor_writer_init(cbor_writer_t *w, uint8_t cmd)
+{
+	memset(w, 0, sizeof(*w));
+
+	if (cbor_writer_grow(w, 1) == 0)
+		w->ptr[w->off++] = cmd;
+}
+
+void
+cbor_writer_reset(cbor_writer_t *w)
+{
+	fido_freezero(w->ptr, w->len);
+	memset(w, 0, sizeof(*w));
+}
+
+/* make room for n more bytes, so that writing them does not reallocate */
+int
+cbor_writer_reserve(cbor_writer_t *w, size_t n)
+{
+	return (cbor_writer_grow(w, n));
+}
+
+int
+cbor_writer_finish(cbor_writer_t *w, fido_blob_t *f)
+{
+	if (w->err || w->ptr == NULL) {
+		fido_log_debug("%s: err=%d", __func__, w->err);
+		cbor_writer_reset(w);
+		return (-1);
+	}
+
+	/* hand over the buffer; callers fido_free(f->ptr) */
+	f->ptr = w->ptr;
+	f->len = w->off;
+	memset(w, 0, sizeof(*w));
+
+	return (0);
+}
+
+void
+cbor_write_map(cbor_writer_t *w, size_t n)
+{
+	cbor_write_head(w, CBOR_TYPE_MAP, n);
+}
+
+void
+cbor_write_array(cbor_writer_t *w, size_t n)
+{
+	cbor_write_head(w, CBOR_TYPE_ARRAY, n);
+}
+
+void
+cbor_write_uint(cbor_writer_t *w, uint64_t v)
+{
+	cbor_write_head(w, CBOR_TYPE_UINT, v);
+}
+
+void
+cbor_write_int(cbor_writer_t *w, int64_t v)
+{
+	if (v < 0)
+		cbor_write_head(w, CBOR_TYPE_NEGINT, (uint64_t)(-(v + 1)));
+	else
+		cbor_write_head(w, CBOR_TYPE_UINT, (uint64_t)v);
+}
+
+void
+cbor_write_bool(cbor_writer_t *w, bool v)
+{
+	cbor_write_head(w, CBOR_TYPE_FLOAT_CTRL, v ? CBOR_CTRL_TRUE :
+	    CBOR_CTRL_FALSE);
+}
+
+void
+cbor_write_bytes(cbor_writer_t *w, const unsigned char *ptr, size_t len)
+{
+	cbor_write_head(w, CBOR_TYPE_BYTESTRING, len);
+	if (len > 0 && cbor_writer_grow(w, len) == 0) {
+		memcpy(w->ptr + w->off, ptr, len);
+		w->off += len;
+	}
+}
+
+void
+cbor_write_blob(cbor_writer_t *w, const fido_blob_t *b)
+{
+	cbor_write_bytes(w, b->ptr, b->len);
+}
+
+void
+cbor_write_text(cbor_writer_t *w, const char *str)
+{
+	size_t len = strlen(str);
+
+	cbor_write_head(w, CBOR_TYPE_STRING, len);
+	if (len > 0 && cbor_writer_grow(w, len) == 0) {
+		memcpy(w->ptr + w->off, str, len);
+		w->off += len;
+	}
+}
+
+/* append bytes that are already CBOR */
+void
+cbor_write_raw(cbor_writer_t *w, const unsigned char *ptr, size_t len)
+{
+	if (len > 0 && cbor_writer_grow(w, len) == 0) {
+		memcpy(w->ptr + w->off, ptr, len);
+		w->off += len;
+	}
+}
+
+/* serialise a libcbor item in place */
+void
+cbor_write_item(cbor_writer_t *w, const cbor_item_t *item)
+{
+	size_t n;
+
+	if (cbor_writer_grow(w, 1) < 0)
+		return;
+
+	while ((n = cbor_serialize(item, w->ptr + w->off,
+	    w->len - w->off)) == 0) {
+		if (w->len >= CBOR_WRITER_MAXLEN ||
+		    cbor_writer_grow(w, w->len - w->off + 1) < 0) {
+			fido_log_debug("%s: cbor_serialize", __func__);
+			w->err = 1;
+			return;
+		}
+	}
+
+	w->off += n;
+}
+
+/* PublicKeyCredentialDescriptor */
+void
+cbor_write_pubkey(cbor_writer_t *w, const fido_blob_t *id)
+{
+	cbor_write_map(w, 2);
+	cbor_write_text(w, "id");
+	cbor_write_blob(w, id);
+	cbor_write_text(w, "type");
+	cbor_write_text(w, "public-key");
+}
+
+/* array of PublicKeyCredentialDescriptor */
+void
+cbor_write_pubkey_list(cbor_writer_t *w, const fido_blob_array_t *list)
+{
+	cbor_write_array(w, list->len);
+	for (size_t i = 0; i < list->len; i++)
+		cbor_write_pubkey(w, &list->ptr[i]);
+}
+
+/* array of PublicKeyCredentialDescriptor, copied from a fido_cred_list_t */
+void
+cbor_write_cred_list(cbor_writer_t *w, const fido_cred_list_t *l,
+    size_t batch)
+{
+	size_t first, n, i, j, from, to;
+
+	if (fido_cred_list_batch(l, batch, &first, &n) < 0) {
+		w->err = 1;
+		return;
+	}
+
+	cbor_write_array(w, n);
+	/* descriptors that follow each other in l->enc are copied at once */
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n; j++)
+			if (l->sel[first + j] != l->sel[first + j - 1] + 1)
+				break;
+		from = l->sel[first + i] ? l->end[l->sel[first + i] - 1] : 0;
+		to = l->end[l->sel[first + j - 1]];
+		if (cbor_writer_grow(w, to - from) < 0)
+			return;
+		memcpy(w->ptr + w->off, l->enc.ptr + from, to - from);
+		w->off += to - from;
+	}
+}
+
+static void
+cbor_write_opt(cbor_writer_t *w, const char *k1, fido_opt_t v1,
+    const char *k2, fido_opt_t v2)
+{
+	cbor_write_map(w, (size_t)(v1 != FIDO_OPT_OMIT) +
+	    (size_t)(v2 != FIDO_OPT_OMIT));
+	if (v1 != FIDO_OPT_OMIT) {
+		cbor_write_text(w, k1);
+		cbor_write_bool(w, v1 == FIDO_OPT_TRUE);
+	}
+	if (v2 != FIDO_OPT_OMIT) {
+		cbor_write_text(w, k2);
+		cbor_write_bool(w, v2 == FIDO_OPT_TRUE);
+	}
+}
+
+void
+cbor_write_assert_opt(cbor_writer_t *w, fido_opt_t up, fido_opt_t uv)
 {
-	cbor_item_t	*map;
-	uint8_t		 i;
-
-	if (argc > UINT8_MAX - 1)
-		return (NULL);
+	cbor_write_opt(w, "up", up, "uv", uv);
+}
 
-	if ((map = cbor_new_definite_map(argc)) == NULL)
-		return (NULL);
+void
+cbor_write_cred_opt(cbor_writer_t *w, fido_opt_t rk, fido_opt_t uv)
+{
+	cbor_write_opt(w, "rk", rk, "uv", uv);
+}
 
-	for (i = 0; i < argc; i++)
-		if (cbor_add_arg(map, (uint8_t)(i + 1), argv[i]) < 0)
-			break;
+/* as cbor_encode_rp_entity() */
+void
+cbor_write_rp_entity(cbor_writer_t *w, const fido_rp_t *rp)
+{
+	cbor_write_map(w, (size_t)(rp->id != NULL) +
+	    (size_t)(rp->name != NULL));
+	if (rp->id != NULL) {
+		cbor_write_text(w, "id");
+		cbor_write_text(w, rp->id);
+	}
+	if (rp->name != NULL) {
+		cbor_write_text(w, "name");
+		cbor_write_text(w, rp->name);
+	}
+}
 
-	if (i != argc) {
-		cbor_decref(&map);
-		map = NULL;
+/* as cbor_encode_user_entity() */
+void
+cbor_write_user_entity(cbor_writer_t *w, const fido_user_t *user)
+{
+	cbor_write_map(w, (size_t)(user->id.ptr != NULL) +
+	    (size_t)(user->icon != NULL) + (size_t)(user->name != NULL) +
+	    (size_t)(user->display_name != NULL));
+	if (user->id.ptr != NULL) {
+		cbor_write_text(w, "id");
+		cbor_write_blob(w, &user->id);
+	}
+	if (user->icon != NULL) {
+		cbor_write_text(w, "icon");
+		cbor_write_text(w, user->icon);
+	}
+	if (user->name != NULL) {
+		cbor_write_text(w, "name");
+		cbor_write_text(w, user->name);
+	}
+	if (user->display_name != NULL) {
+		cbor_write_text(w, "displayName");
+		cbor_write_text(w, user->display_name);
 	}
+}
 
-	return (map);
+/* as cbor_encode_pubkey_param() */
+void
+cbor_write_pubkey_param(cbor_writer_t *w, int cose_alg)
+{
+	if (cose_alg > -1 || cose_alg < INT16_MIN) {
+		fido_log_debug("%s: cose_alg=%d", __func__, cose_alg);
+		w->err = 1;
+		return;
+	}
+
+	cbor_write_array(w, 1);
+	cbor_write_map(w, 2);
+	cbor_write_text(w, "alg");
+	cbor_write_int(w, cose_alg);
+	cbor_write_text(w, "type");
+	cbor_write_text(w, "public-key");
 }
 
 int
 cbor_build_frame(uint8_t cmd, cbor_item_t *argv[], size_t argc, fido_blob_t *f)
 {
-	cbor_item_t	*flat = NULL;
-	unsigned char	*cbor = NULL;
-	size_t		 cbor_len;
-	size_t		 cbor_alloc_len;
-	int		 ok = -1;
-
-	if ((flat = cbor_flatten_vector(argv, argc)) == NULL)
-		goto fail;
-
-	cbor_len = cbor_serialize_alloc(flat, &cbor, &cbor_alloc_len);
-	if (cbor_len == 0 || cbor_len == SIZE_MAX) {
-		fido_log_debug("%s: cbor_len=%zu", __func__, cbor_len);
-		goto fail;
-	}
-
-	if ((f->ptr = malloc(cbor_len + 1)) == NULL)
-		goto fail;
+	cbor_writer_t	w;
+	size_t		n = 0;
 
-	f->len = cbor_len + 1;
-	f->ptr[0] = cmd;
-	memcpy(f->ptr + 1, cbor, f->len - 1);
+	if (argc > UINT8_MAX - 1)
+		return (-1);
 
-	ok = 0;
-fail:
-	if (flat != NULL)
-		cbor_decref(&flat);
+	for (size_t i = 0; i < argc; i++)
+		if (argv[i] != NULL)
+			n++;
 
-	free(cbor);
+	cbor_writer_init(&w, cmd);
+	cbor_write_map(&w, n);
+	for (size_t i = 0; i < argc; i++) {
+		if (argv[i] == NULL)
+			continue; /* empty argument */
+		cbor_write_uint(&w, i + 1);
+		cbor_write_item(&w, argv[i]);
+	}
 
-	return (ok);
+	return (cbor_writer_finish(&w, f));
 }
 
 cbor_item_t *
@@ -535,32 +1247,6 @@ cbor_encode_pubkey(const fido_blob_t *pubkey)
 	return (cbor_key);
 }
 
-cbor_item_t *
-cbor_encode_pubkey_list(const fido_blob_array_t *list)
-{
-	cbor_item_t	*array = NULL;
-	cbor_item_t	*key = NULL;
-
-	if ((array = cbor_new_definite_array(list->len)) == NULL)
-		goto fail;
-
-	for (size_t i = 0; i < list->len; i++) {
-		if ((key = cbor_encode_pubkey(&list->ptr[i])) == NULL ||
-		    cbor_array_push(array, key) == false)
-			goto fail;
-		cbor_decref(&key);
-	}
-
-	return (array);
-fail:
-	if (key != NULL)
-		cbor_decref(&key);
-	if (array != NULL)
-		cbor_decref(&array);
-
-	return (NULL);
-}
-
 cbor_item_t *
 cbor_encode_str_array(const fido_str_array_t *a)
 {
@@ -654,43 +1340,11 @@ cbor_encode_cred_ext(const fido_cred_ext_t *ext, const fido_blob_t *blob)
 	return (item);
 }
 
+#ifndef FIDO_VERIFY_ONLY
 cbor_item_t *
-cbor_encode_cred_opt(fido_opt_t rk, fido_opt_t uv)
-{
-	cbor_item_t *item = NULL;
-
-	if ((item = cbor_new_definite_map(2)) == NULL)
-		return (NULL);
-	if ((rk != FIDO_OPT_OMIT && cbor_add_bool(item, "rk", rk) < 0) ||
-	    (uv != FIDO_OPT_OMIT && cbor_add_bool(item, "uv", uv) < 0)) {
-		cbor_decref(&item);
-		return (NULL);
-	}
-
-	return (item);
-}
-
-cbor_item_t *
-cbor_encode_assert_opt(fido_opt_t up, fido_opt_t uv)
-{
-	cbor_item_t *item = NULL;
-
-	if ((item = cbor_new_definite_map(2)) == NULL)
-		return (NULL);
-	if ((up != FIDO_OPT_OMIT && cbor_add_bool(item, "up", up) < 0) ||
-	    (uv != FIDO_OPT_OMIT && cbor_add_bool(item, "uv", uv) < 0)) {
-		cbor_decref(&item);
-		return (NULL);
-	}
-
-	return (item);
-}
-
-cbor_item_t *
-cbor_encode_pin_auth(const fido_dev_t *dev, const fido_blob_t *secret,
+cbor_encode_pin_auth(fido_dev_t *dev, const fido_blob_t *secret,
     const fido_blob_t *data)
 {
-	const EVP_MD	*md = NULL;
 	unsigned char	 dgst[SHA256_DIGEST_LENGTH];
 	unsigned int	 dgst_len;
 	size_t		 outlen;
@@ -709,9 +1363,8 @@ cbor_encode_pin_auth(const fido_dev_t *dev, const fido_blob_t *secret,
 	if (prot == CTAP_PIN_PROTOCOL2 && key.len > 32)
 		key.len = 32;
 
-	if ((md = EVP_sha256()) == NULL || HMAC(md, key.ptr,
-	    (int)key.len, data->ptr, data->len, dgst,
-	    &dgst_len) == NULL || dgst_len != SHA256_DIGEST_LENGTH)
+	if (fido_dev_pin_mac(dev, &key, data, dgst, &dgst_len) < 0 ||
+	    dgst_len != SHA256_DIGEST_LENGTH)
 		return (NULL);
 
 	outlen = (prot == CTAP_PIN_PROTOCOL1) ? 16 : dgst_len;
@@ -757,7 +1410,7 @@ cbor_encode_change_pin_auth(const fido_dev_t *dev, const fido_blob_t *secret,
 		key.len = 32;
 
 	if ((ctx = HMAC_CTX_new()) == NULL ||
-	    (md = EVP_sha256())  == NULL ||
+	    (md = fido_evp_sha256())  == NULL ||
 	    HMAC_Init_ex(ctx, key.ptr, (int)key.len, md, NULL) == 0 ||
 	    HMAC_Update(ctx, new_pin_enc->ptr, new_pin_enc->len) == 0 ||
 	    HMAC_Update(ctx, pin_hash_enc->ptr, pin_hash_enc->len) == 0 ||
@@ -781,7 +1434,7 @@ fail:
 }
 
 static int
-cbor_encode_hmac_secret_param(const fido_dev_t *dev, cbor_item_t *item,
+cbor_encode_hmac_secret_param(fido_dev_t *dev, cbor_item_t *item,
     const fido_blob_t *ecdh, const es256_pk_t *pk, const fido_blob_t *salt)
 {
 	cbor_item_t		*param = NULL;
@@ -868,9 +1521,10 @@ fail:
 
 cbor_item_t *
 cbor_encode_assert_ext(fido_dev_t *dev, const fido_assert_ext_t *ext,
-    const fido_blob_t *ecdh, const es256_pk_t *pk)
+    const fido_blob_t *id, const fido_blob_t *ecdh, const es256_pk_t *pk)
 {
 	cbor_item_t *item = NULL;
+	const fido_blob_t *salt = &ext->hmac_salt;
 	size_t size = 0;
 
 	if (ext->mask & FIDO_EXT_CRED_BLOB)
@@ -889,8 +1543,16 @@ cbor_encode_assert_ext(fido_dev_t *dev, const fido_assert_ext_t *ext,
 		}
 	}
 	if (ext->mask & FIDO_EXT_HMAC_SECRET) {
+		/* prf evalByCredential, if the request names one credential */
+		for (size_t i = 0; id != NULL && i < ext->prf_id.len; i++)
+			if (ext->prf_id.ptr[i].len == id->len &&
+			    memcmp(ext->prf_id.ptr[i].ptr, id->ptr,
+			    id->len) == 0) {
+				salt = &ext->prf_salt.ptr[i];
+				break;
+			}
 		if (cbor_encode_hmac_secret_param(dev, item, ecdh, pk,
-		    &ext->hmac_salt) < 0) {
+		    salt) < 0) {
 			cbor_decref(&item);
 			return (NULL);
 		}
@@ -905,6 +1567,8 @@ cbor_encode_assert_ext(fido_dev_t *dev, const fido_assert_ext_t *ext,
 	return (item);
 }
 
+#endif /* !FIDO_VERIFY_ONLY */
+
 int
 cbor_decode_fmt(const cbor_item_t *item, char **fmt)
 {
@@ -918,7 +1582,7 @@ cbor_decode_fmt(const cbor_item_t *item, char **fmt)
 	if (strcmp(type, "packed") && strcmp(type, "fido-u2f") &&
 	    strcmp(type, "none") && strcmp(type, "tpm")) {
 		fido_log_debug("%s: type=%s", __func__, type);
-		free(type);
+		fido_free(type);
 		return (-1);
 	}
 
@@ -1095,7 +1759,7 @@ decode_attcred(const unsigned char **buf, size_t *len, int cose_alg,
 	}
 
 	attcred->id.len = (size_t)be16toh(id_len);
-	if ((attcred->id.ptr = malloc(attcred->id.len)) == NULL)
+	if ((attcred->id.ptr = fido_malloc(attcred->id.len)) == NULL)
 		return (-1);
 
 	fido_log_debug("%s: attcred->id.len=%zu", __func__, attcred->id.len);
@@ -1179,7 +1843,7 @@ decode_cred_extension(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 
 	ok = 0;
 out:
-	free(type);
+	fido_free(type);
 
 	return (ok);
 }
@@ -1249,7 +1913,7 @@ decode_assert_extension(const cbor_item_t *key, const cbor_item_t *val,
 
 	ok = 0;
 out:
-	free(type);
+	fido_free(type);
 
 	return (ok);
 }
@@ -1287,30 +1951,50 @@ fail:
 	return (ok);
 }
 
-int
-cbor_decode_cred_authdata(const cbor_item_t *item, int cose_alg,
-    fido_blob_t *authdata_cbor, fido_authdata_t *authdata,
-    fido_attcred_t *attcred, fido_cred_ext_t *authdata_ext)
+/*
+ * Wrap len bytes at ptr in a byte string, as cbor_serialize_alloc() would;
+ * in arena if not NULL.
+ */
+static int
+authdata_encode(const unsigned char *ptr, size_t len,
+    fido_blob_t *authdata_cbor, fido_arena_t *arena)
 {
-	const unsigned char	*buf = NULL;
-	size_t			 len;
-	size_t			 alloc_len;
+	cbor_writer_t	 w;
+	unsigned char	 head[9];
+	unsigned char	*p;
+	size_t		 n;
 
-	if (cbor_isa_bytestring(item) == false ||
-	    cbor_bytestring_is_definite(item) == false) {
-		fido_log_debug("%s: cbor type", __func__);
+	if (authdata_cbor->ptr != NULL) {
+		fido_log_debug("%s: dup", __func__);
 		return (-1);
 	}
 
-	if (authdata_cbor->ptr != NULL ||
-	    (authdata_cbor->len = cbor_serialize_alloc(item,
-	    &authdata_cbor->ptr, &alloc_len)) == 0) {
-		fido_log_debug("%s: cbor_serialize_alloc", __func__);
-		return (-1);
+	if (arena != NULL) {
+		n = cbor_head_encode(head, CBOR_TYPE_BYTESTRING, len);
+		if (len > SIZE_MAX - n ||
+		    (p = fido_arena_alloc(arena, n + len)) == NULL) {
+			fido_log_debug("%s: fido_arena_alloc", __func__);
+			return (-1);
+		}
+		memcpy(p, head, n);
+		memcpy(p + n, ptr, len);
+		authdata_cbor->ptr = p;
+		authdata_cbor->len = n + len;
+		authdata_cbor->borrowed = true;
+		return (0);
 	}
 
-	buf = cbor_bytestring_handle(item);
-	len = cbor_bytestring_length(item);
+	memset(&w, 0, sizeof(w));
+	cbor_write_bytes(&w, ptr, len);
+
+	return (cbor_writer_finish(&w, authdata_cbor));
+}
+
+static int
+cred_authdata_decode(const unsigned char *buf, size_t len, int cose_alg,
+    fido_authdata_t *authdata, fido_attcred_t *attcred,
+    fido_cred_ext_t *authdata_ext)
+{
 	fido_log_xxd(buf, len, "%s", __func__);
 
 	if (fido_buf_read(&buf, &len, authdata, sizeof(*authdata)) < 0) {
@@ -1338,12 +2022,11 @@ cbor_decode_cred_authdata(const cbor_item_t *item, int cose_alg,
 }
 
 int
-cbor_decode_assert_authdata(const cbor_item_t *item, fido_blob_t *authdata_cbor,
-    fido_authdata_t *authdata, fido_assert_extattr_t *authdata_ext)
+cbor_decode_cred_authdata(const cbor_item_t *item, int cose_alg,
+    fido_blob_t *authdata_cbor, fido_authdata_t *authdata,
+    fido_attcred_t *attcred, fido_cred_ext_t *authdata_ext)
 {
-	const unsigned char	*buf = NULL;
-	size_t			 len;
-	size_t			 alloc_len;
+	size_t alloc_len;
 
 	if (cbor_isa_bytestring(item) == false ||
 	    cbor_bytestring_is_definite(item) == false) {
@@ -1358,9 +2041,28 @@ cbor_decode_assert_authdata(const cbor_item_t *item, fido_blob_t *authdata_cbor,
 		return (-1);
 	}
 
-	buf = cbor_bytestring_handle(item);
-	len = cbor_bytestring_length(item);
+	return (cred_authdata_decode(cbor_bytestring_handle(item),
+	    cbor_bytestring_length(item), cose_alg, authdata, attcred,
+	    authdata_ext));
+}
+
+/* as cbor_decode_cred_authdata(), from the contents of the byte string */
+int
+cbor_decode_cred_authdata_raw(const unsigned char *ptr, size_t len,
+    int cose_alg, fido_blob_t *authdata_cbor, fido_authdata_t *authdata,
+    fido_attcred_t *attcred, fido_cred_ext_t *authdata_ext)
+{
+	if (authdata_encode(ptr, len, authdata_cbor, NULL) < 0)
+		return (-1);
+
+	return (cred_authdata_decode(ptr, len, cose_alg, authdata, attcred,
+	    authdata_ext));
+}
 
+static int
+assert_authdata_decode(const unsigned char *buf, size_t len,
+    fido_authdata_t *authdata, fido_assert_extattr_t *authdata_ext)
+{
 	fido_log_debug("%s: buf=%p, len=%zu", __func__, (const void *)buf, len);
 
 	if (fido_buf_read(&buf, &len, authdata, sizeof(*authdata)) < 0) {
@@ -1383,15 +2085,55 @@ cbor_decode_assert_authdata(const cbor_item_t *item, fido_blob_t *authdata_cbor,
 	return (FIDO_OK);
 }
 
+/* authdata_cbor is kept in arena if not NULL */
+int
+cbor_decode_assert_authdata(const cbor_item_t *item, fido_arena_t *arena,
+    fido_blob_t *authdata_cbor, fido_authdata_t *authdata,
+    fido_assert_extattr_t *authdata_ext)
+{
+	if (cbor_isa_bytestring(item) == false ||
+	    cbor_bytestring_is_definite(item) == false) {
+		fido_log_debug("%s: cbor type", __func__);
+		return (-1);
+	}
+
+	if (authdata_encode(cbor_bytestring_handle(item),
+	    cbor_bytestring_length(item), authdata_cbor, arena) < 0) {
+		fido_log_debug("%s: authdata_encode", __func__);
+		return (-1);
+	}
+
+	return (assert_authdata_decode(cbor_bytestring_handle(item),
+	    cbor_bytestring_length(item), authdata, authdata_ext));
+}
+
+/* as cbor_decode_assert_authdata(), from the contents of the byte string */
+int
+cbor_decode_assert_authdata_raw(const unsigned char *ptr, size_t len,
+    fido_blob_t *authdata_cbor, fido_authdata_t *authdata,
+    fido_assert_extattr_t *authdata_ext)
+{
+	if (authdata_encode(ptr, len, authdata_cbor, NULL) < 0)
+		return (-1);
+
+	return (assert_authdata_decode(ptr, len, authdata, authdata_ext));
+}
+
 static int
 decode_x5c(const cbor_item_t *item, void *arg)
 {
-	fido_blob_t *x5c = arg;
+	fido_attstmt_t	*attstmt = arg;
+	fido_blob_array_t *chain = &attstmt->x5c_chain;
+	fido_blob_t	*ptr;
 
-	if (x5c->len)
-		return (0); /* ignore */
+	if (attstmt->x5c.len == 0)
+		return (fido_blob_decode(item, &attstmt->x5c));
+	if (chain->len == SIZE_MAX || (ptr = fido_recallocarray(chain->ptr,
+	    chain->len, chain->len + 1, sizeof(*ptr))) == NULL)
+		return (-1);
+	chain->ptr = ptr;
 
-	return (fido_blob_decode(item, x5c));
+	return (fido_blob_decode(item, &chain->ptr[chain->len++]));
 }
 
 static int
@@ -1429,7 +2171,7 @@ decode_attstmt_entry(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 	} else if (!strcmp(name, "x5c")) {
 		if (cbor_isa_array(val) == false ||
 		    cbor_array_is_definite(val) == false ||
-		    cbor_array_iter(val, &attstmt->x5c, decode_x5c) < 0) {
+		    cbor_array_iter(val, attstmt, decode_x5c) < 0) {
 			fido_log_debug("%s: x5c", __func__);
 			goto out;
 		}
@@ -1447,7 +2189,7 @@ decode_attstmt_entry(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 
 	ok = 0;
 out:
-	free(name);
+	fido_free(name);
 
 	return (ok);
 }
@@ -1474,6 +2216,63 @@ cbor_decode_attstmt(const cbor_item_t *item, fido_attstmt_t *attstmt)
 	return (0);
 }
 
+static int
+decode_attobj(const cbor_item_t *key, const cbor_item_t *val, void *arg)
+{
+	fido_cred_t *cred = arg;
+	char *name = NULL;
+	int ok = -1;
+
+	if (cbor_string_copy(key, &name) < 0) {
+		fido_log_debug("%s: cbor type", __func__);
+		ok = 0; /* ignore */
+		goto fail;
+	}
+
+	if (!strcmp(name, "fmt")) {
+		if (cbor_decode_fmt(val, &cred->fmt) < 0) {
+			fido_log_debug("%s: cbor_decode_fmt", __func__);
+			goto fail;
+		}
+	} else if (!strcmp(name, "attStmt")) {
+		if (cbor_decode_attstmt(val, &cred->attstmt) < 0) {
+			fido_log_debug("%s: cbor_decode_attstmt", __func__);
+			goto fail;
+		}
+	} else if (!strcmp(name, "authData")) {
+		if (fido_blob_decode(val, &cred->authdata_raw) < 0) {
+			fido_log_debug("%s: fido_blob_decode", __func__);
+			goto fail;
+		}
+		if (cbor_decode_cred_authdata(val, cred->type,
+		    &cred->authdata_cbor, &cred->authdata, &cred->attcred,
+		    &cred->authdata_ext) < 0) {
+			fido_log_debug("%s: cbor_decode_cred_authdata",
+			    __func__);
+			goto fail;
+		}
+	}
+
+	ok = 0;
+fail:
+	fido_free(name);
+
+	return (ok);
+}
+
+int
+cbor_decode_attobj(const cbor_item_t *item, fido_cred_t *cred)
+{
+	if (cbor_isa_map(item) == false ||
+	    cbor_map_is_definite(item) == false ||
+	    cbor_map_iter(item, cred, decode_attobj) < 0) {
+		fido_log_debug("%s: cbor type", __func__);
+		return (-1);
+	}
+
+	return (0);
+}
+
 int
 cbor_decode_uint64(const cbor_item_t *item, uint64_t *n)
 {
@@ -1487,12 +2286,17 @@ cbor_decode_uint64(const cbor_item_t *item, uint64_t *n)
 	return (0);
 }
 
+struct cred_id_dst {
+	fido_blob_t	*id;
+	fido_arena_t	*arena; /* may be NULL */
+};
+
 static int
 decode_cred_id_entry(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 {
-	fido_blob_t	*id = arg;
-	char		*name = NULL;
-	int		 ok = -1;
+	struct cred_id_dst	*dst = arg;
+	char			*name = NULL;
+	int			 ok = -1;
 
 	if (cbor_string_copy(key, &name) < 0) {
 		fido_log_debug("%s: cbor type", __func__);
@@ -1500,25 +2304,35 @@ decode_cred_id_entry(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 		goto out;
 	}
 
-	if (!strcmp(name, "id"))
-		if (fido_blob_decode(val, id) < 0) {
+	if (!strcmp(name, "id")) {
+		if (dst->arena != NULL ?
+		    fido_blob_decode_arena(val, dst->id, dst->arena) < 0 :
+		    fido_blob_decode(val, dst->id) < 0) {
 			fido_log_debug("%s: cbor_bytestring_copy", __func__);
 			goto out;
 		}
+	}
 
 	ok = 0;
 out:
-	free(name);
+	fido_free(name);
 
 	return (ok);
 }
 
+/* id is kept in arena if not NULL */
 int
-cbor_decode_cred_id(const cbor_item_t *item, fido_blob_t *id)
+cbor_decode_cred_id(const cbor_item_t *item, fido_arena_t *arena,
+    fido_blob_t *id)
 {
+	struct cred_id_dst dst;
+
+	dst.id = id;
+	dst.arena = arena;
+
 	if (cbor_isa_map(item) == false ||
 	    cbor_map_is_definite(item) == false ||
-	    cbor_map_iter(item, id, decode_cred_id_entry) < 0) {
+	    cbor_map_iter(item, &dst, decode_cred_id_entry) < 0) {
 		fido_log_debug("%s: cbor type", __func__);
 		return (-1);
 	}
@@ -1563,7 +2377,7 @@ decode_user_entry(const cbor_item_t *key, const cbor_item_t *val, void *arg)
 
 	ok = 0;
 out:
-	free(name);
+	fido_free(name);
 
 	return (ok);
 }
@@ -1581,6 +2395,81 @@ cbor_decode_user(const cbor_item_t *item, fido_user_t *user)
 	return (0);
 }
 
+/* whether key, read as a C string like decode_user_entry() does, is s */
+static bool
+user_key_is(const cbor_item_t *key, const char *s)
+{
+	const unsigned char	*ptr = cbor_string_handle(key);
+	size_t			 len = strlen(s);
+
+	if (cbor_string_length(key) < len || memcmp(ptr, s, len) != 0)
+		return (false);
+
+	return (cbor_string_length(key) == len || ptr[len] == '\0');
+}
+
+static int
+check_user_entry(const cbor_item_t *key, const cbor_item_t *val, void *arg)
+{
+	unsigned int	*seen = arg;
+	unsigned int	 bit;
+
+	if (cbor_isa_string(key) == false ||
+	    cbor_string_is_definite(key) == false)
+		return (0); /* ignore */
+
+	if (user_key_is(key, "id")) {
+		if (cbor_isa_bytestring(val) == false ||
+		    cbor_bytestring_is_definite(val) == false) {
+			fido_log_debug("%s: id", __func__);
+			return (-1);
+		}
+		bit = 0x1;
+	} else {
+		if (user_key_is(key, "icon"))
+			bit = 0x2;
+		else if (user_key_is(key, "name"))
+			bit = 0x4;
+		else if (user_key_is(key, "displayName"))
+			bit = 0x8;
+		else
+			return (0); /* ignore */
+		if (cbor_isa_string(val) == false ||
+		    cbor_string_is_definite(val) == false ||
+		    cbor_string_length(val) == SIZE_MAX) {
+			fido_log_debug("%s: cbor type", __func__);
+			return (-1);
+		}
+	}
+
+	if (*seen & bit) {
+		fido_log_debug("%s: dup", __func__);
+		return (-1);
+	}
+	*seen |= bit;
+
+	return (0);
+}
+
+/*
+ * Whether cbor_decode_user() would accept item, short of running out of
+ * memory; nothing is copied.
+ */
+int
+cbor_check_user(const cbor_item_t *item)
+{
+	unsigned int seen = 0;
+
+	if (cbor_isa_map(item) == false ||
+	    cbor_map_is_definite(item) == false ||
+	    cbor_map_iter(item, &seen, check_user_entry) < 0) {
+		fido_log_debug("%s: cbor type", __func__);
+		return (-1);
+	}
+
+	return (0);
+}
+
 static int
 decode_rp_entity_entry(const cbor_item_t *key, const cbor_item_t *val,
     void *arg)
@@ -1609,7 +2498,7 @@ decode_rp_entity_entry(const cbor_item_t *key, const cbor_item_t *val,
 
 	ok = 0;
 out:
-	free(name);
+	fido_free(name);
 
 	return (ok);
 }
@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "fido.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define MUX_MAXFRAMES	256 /* frames queued for other channels */
+
+struct mux_frame {
+	const fido_dev_t	*dev;  /* channel the frame is queued for */
+	size_t			 len;  /* length of data */
+	unsigned char		 data[CTAP_MAX_REPORT_LEN];
+};
+
+/*
+ * A HID handle shared by several CTAPHID channels. Frames read on behalf
+ * of one channel that belong to another are queued for the latter.
+ */
+struct fido_dev_mux {
+#if defined(HAVE_PTHREAD)
+	pthread_mutex_t		 lock;
+#elif defined(_WIN32)
+	SRWLOCK			 lock;
+#endif
+	fido_dev_t		**member; /* channels sharing the handle */
+	size_t			 nmember; /* members in use */
+	size_t			 size;    /* capacity of member[] */
+	struct mux_frame	*frame;   /* queued frames, oldest first */
+	size_t			 nframe;  /* frames in use */
+};
+
+#if defined(HAVE_PTHREAD)
+#define MUX_LOCK_INIT(m)	pthread_mutex_init(&(m)->lock, NULL)
+#define MUX_LOCK_FREE(m)	pthread_mutex_destroy(&(m)->lock)
+#define MUX_LOCK(m)		pthread_mutex_lock(&(m)->lock)
+#define MUX_UNLOCK(m)		pthread_mutex_unlock(&(m)->lock)
+#elif defined(_WIN32)
+#define MUX_LOCK_INIT(m)	(InitializeSRWLock(&(m)->lock), 0)
+#define MUX_LOCK_FREE(m)	do { } while (0)
+#define MUX_LOCK(m)		AcquireSRWLockExclusive(&(m)->lock)
+#define MUX_UNLOCK(m)		ReleaseSRWLockExclusive(&(m)->lock)
+#else
+#define MUX_LOCK_INIT(m)	0
+#define MUX_LOCK_FREE(m)	do { } while (0)
+#define MUX_LOCK(m)		do { } while (0)
+#define MUX_UNLOCK(m)		do { } while (0)
+#endif
+
+static struct fido_dev_mux *
+mux_new(fido_dev_t *parent)
+{
+	struct fido_dev_mux *mux;
+
+	if ((mux = fido_calloc(1, sizeof(*mux))) == NULL)
+		return (NULL);
+	if ((mux->frame = fido_calloc(MUX_MAXFRAMES,
+	    sizeof(*mux->frame))) == NULL ||
+	    (mux->member = fido_calloc(2, sizeof(*mux->member))) == NULL ||
+	    MUX_LOCK_INIT(mux) != 0) {
+		fido_free(mux->member);
+		fido_free(mux->frame);
+		fido_free(mux);
+		return (NULL);
+	}
+	mux->size = 2;
+	mux->member[mux->nmember++] = parent;
+
+	return (mux);
+}
+
+static void
+mux_free(struct fido_dev_mux *mux)
+{
+	MUX_LOCK_FREE(mux);
+	/* frames past nframe were wiped when popped or purged */
+	explicit_bzero(mux->frame, mux->nframe * sizeof(*mux->frame));
+	fido_free(mux->frame);
+	fido_free(mux->member);
+	fido_free(mux);
+}
+
+/* caller must hold mux->lock */
+static int
+mux_add(struct fido_dev_mux *mux, fido_dev_t *dev)
+{
+	fido_dev_t **member;
+
+	if (mux->nmember == mux->size) {
+		if (mux->size > SIZE_MAX / 2 / sizeof(*member))
+			return (-1);
+		if ((member = fido_recallocarray(mux->member, mux->size,
+		    mux->size * 2, sizeof(*member))) == NULL)
+			return (-1);
+		mux->member = member;
+		mux->size *= 2;
+	}
+	mux->member[mux->nmember++] = dev;
+
+	return (0);
+}
+
+/* caller must hold mux->lock */
+static void
+mux_purge(struct fido_dev_mux *mux, const fido_dev_t *dev)
+{
+	size_t i = 0;
+
+	while (i < mux->nframe) {
+		if (mux->frame[i].dev != dev) {
+			i++;
+			continue;
+		}
+		memmove(&mux->frame[i], &mux->frame[i + 1],
+		    (mux->nframe - i - 1) * sizeof(*mux->frame));
+		explicit_bzero(&mux->frame[--mux->nframe],
+		    sizeof(*mux->frame));
+	}
+}
+
+/* caller must hold mux->lock */
+static void
+mux_push(struct fido_dev_mux *mux, const fido_dev_t *dev,
+    const unsigned char *buf, size_t len)
+{
+	struct mux_frame *f;
+
+	if (mux->nframe == MUX_MAXFRAMES) {
+		/* a channel that is not reading; drop its oldest frame */
+		fido_log_debug("%s: queue full", __func__);
+		memmove(&mux->frame[0], &mux->frame[1],
+		    (mux->nframe - 1) * sizeof(*mux->frame));
+		mux->nframe--;
+	}
+	f = &mux->frame[mux->nframe++];
+	f->dev = dev;
+	f->len = len;
+	memcpy(f->data, buf, len);
+}
+
+/* caller must hold mux->lock */
+static int
+mux_pop(struct fido_dev_mux *mux, const fido_dev_t *dev, unsigned char *buf,
+    size_t len)
+{
+	for (size_t i = 0; i < mux->nframe; i++) {
+		if (mux->frame[i].dev != dev)
+			continue;
+		if (mux->frame[i].len != len) {
+			fido_log_debug("%s: len %zu", __func__, len);
+			return (-1);
+		}
+		memcpy(buf, mux->frame[i].data, len);
+		memmove(&mux->frame[i], &mux->frame[i + 1],
+		    (mux->nframe - i - 1) * sizeof(*mux->frame));
+		explicit_bzero(&mux->frame[--mux->nframe],
+		    sizeof(*mux->frame));
+		return ((int)len);
+	}
+
+	return (0);
+}
+
+/* caller must hold mux->lock */
+static void
+mux_route(struct fido_dev_mux *mux, const fido_dev_t *dev,
+    const unsigned char *buf, size_t len)
+{
+	uint32_t cid;
+
+	if (len < sizeof(cid))
+		return;
+	memcpy(&cid, buf, sizeof(cid));
+
+	/* broadcast frames reach every channel still in CTAPHID_INIT */
+	for (size_t i = 0; i < mux->nmember; i++)
+		if (mux->member[i] != dev && mux->member[i]->cid == cid)
+			mux_push(mux, mux->member[i], buf, len);
+}
+
+int
+fido_mux_join(fido_dev_t *dev, fido_dev_t *parent)
+{
+	struct fido_dev_mux	*mux;
+	bool			 created = false;
+	int			 r;
+
+	if ((mux = parent->mux) == NULL) {
+		if ((mux = mux_new(parent)) == NULL) {
+			fido_log_debug("%s: mux_new", __func__);
+			return (FIDO_ERR_INTERNAL);
+		}
+		parent->mux = mux;
+		created = true;
+	}
+
+	MUX_LOCK(mux);
+	if (mux_add(mux, dev) < 0) {
+		fido_log_debug("%s: mux_add", __func__);
+		r = FIDO_ERR_INTERNAL;
+	} else {
+		dev->mux = mux;
+		dev->io = parent->io;
+		dev->io_handle = parent->io_handle;
+		dev->io_writev = parent->io_writev;
+		dev->io_own = parent->io_own;
+		dev->rx_len = parent->rx_len;
+		dev->tx_len = parent->tx_len;
+		r = FIDO_OK;
+	}
+	MUX_UNLOCK(mux);
+
+	if (r != FIDO_OK && created) {
+		parent->mux = NULL;
+		mux_free(mux);
+	}
+
+	return (r);
+}
+
+/*
+ * Detach dev from its mux and return the number of channels still using
+ * the handle. The mux is freed when the last channel leaves.
+ */
+size_t
+fido_mux_leave(fido_dev_t *dev)
+{
+	struct fido_dev_mux	*mux;
+	size_t			 n;
+
+	if ((mux = dev->mux) == NULL)
+		return (0);
+
+	MUX_LOCK(mux);
+	mux_purge(mux, dev);
+	for (size_t i = 0; i < mux->nmember; i++)
+		if (mux->member[i] == dev) {
+			mux->member[i] = mux->member[--mux->nmember];
+			break;
+		}
+	n = mux->nmember;
+	MUX_UNLOCK(mux);
+
+	dev->mux = NULL;
+	if (n == 0)
+		mux_free(mux);
+
+	return (n);
+}
+
+/*
+ * Read a frame for dev: a queued one if available, otherwise the next
+ * frame on the wire. Frames read that belong to other channels are queued
+ * for them and still returned, so the caller may skip them as usual.
+ */
+int
+fido_mux_read(fido_dev_t *dev, unsigned char *buf, size_t len, int ms)
+{
+	struct fido_dev_mux	*mux = dev->mux;
+	int			 n;
+
+	MUX_LOCK(mux);
+	if ((n = mux_pop(mux, dev, buf, len)) == 0 &&
+	    (n = dev->io.read(dev->io_handle, buf, len, ms)) > 0 &&
+	    (size_t)n == len)
+		mux_route(mux, dev, buf, len);
+	MUX_UNLOCK(mux);
+
+	return (n);
+}
+
+void
+fido_mux_lock(fido_dev_t *dev)
+{
+	if (dev->mux != NULL)
+		MUX_LOCK(dev->mux);
+}
+
+void
+fido_mux_unlock(fido_dev_t *dev)
+{
+	if (dev->mux != NULL)
+		MUX_UNLOCK(dev->mux);
+}
+
+size_t
+fido_mux_pending(const fido_dev_t *dev)
+{
+	struct fido_dev_mux	*mux;
+	size_t			 n = 0;
+
+	if ((mux = dev->mux) == NULL)
+		return (0);
+
+	MUX_LOCK(mux);
+	for (size_t i = 0; i < mux->nframe; i++)
+		if (mux->frame[i].dev == dev)
+			n++;
+	MUX_UNLOCK(mux);
+
+	return (n);
+}
+
+static int
+channel_init(fido_dev_t *dev, const fido_dev_t *parent, int *ms)
+{
+	int reply_len;
+
+	if (fido_tx(dev, CTAP_CMD_INIT, &dev->nonce, sizeof(dev->nonce),
+	    ms) < 0) {
+		fido_log_debug("%s: fido_tx", __func__);
+		return (FIDO_ERR_TX);
+	}
+
+	if ((reply_len = fido_rx(dev, CTAP_CMD_INIT, &dev->attr,
+	    sizeof(dev->attr), ms)) < 0) {
+		fido_log_debug("%s: fido_rx", __func__);
+		return (FIDO_ERR_RX);
+	}
+
+#ifdef FIDO_FUZZ
+	dev->attr.nonce = dev->nonce;
+#endif
+
+	if ((size_t)reply_len != sizeof(dev->attr) ||
+	    dev->attr.nonce != dev->nonce) {
+		fido_log_debug("%s: invalid nonce", __func__);
+		return (FIDO_ERR_RX);
+	}
+
+	if (dev->attr.cid == CTAP_CID_BROADCAST ||
+	    dev->attr.cid == parent->cid) {
+		fido_log_debug("%s: cid=0x%x", __func__, dev->attr.cid);
+		return (FIDO_ERR_RX);
+	}
+
+	dev->cid = dev->attr.cid;
+	dev->flags = parent->flags;
+	dev->maxmsgsize = parent->maxmsgsize;
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_open_channel(fido_dev_t *dev, fido_dev_t *parent)
+{
+	int ms = dev->timeout_ms;
+	int r;
+
+	if (dev == parent || dev->io_handle != NULL ||
+	    dev->cid != CTAP_CID_BROADCAST || parent->io_handle == NULL ||
+	    parent->transport.rx != NULL || parent->transport.tx != NULL ||
+	    (parent->flags & FIDO_DEV_WINHELLO)) {
+		fido_log_debug("%s: invalid argument", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	if (fido_get_random(&dev->nonce, sizeof(dev->nonce)) < 0) {
+		fido_log_debug("%s: fido_get_random", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	if ((r = fido_mux_join(dev, parent)) != FIDO_OK)
+		return (r);
+
+	if ((r = channel_init(dev, parent, &ms)) != FIDO_OK) {
+		fido_mux_leave(dev);
+		dev->io_handle = NULL;
+		dev->cid = CTAP_CID_BROADCAST;
+	}
+
+	return (r);
+}
@@ -9,61 +9,70 @@
 #include "fido.h"
 
 #define BOUND (1024UL * 1024UL)
+#define CHUNK 1024UL /* streaming buffer */
 
-/* zlib inflate (raw + headers) */
+/*
+ * Inflate in into the olen bytes at out using zs, an inflate stream
+ * that is reset to the format given by wbits: zlib's (RFC1950) or raw
+ * (RFC1951). All of out must be filled.
+ */
 static int
-rfc1950_inflate(fido_blob_t *out, const fido_blob_t *in, size_t origsiz)
+inflate_into(z_stream *zs, int wbits, u_char *out, u_int olen,
+    const fido_blob_t *in)
 {
-	u_long ilen, olen;
 	int z;
 
-	memset(out, 0, sizeof(*out));
-
-	if (in->len > ULONG_MAX || (ilen = (u_long)in->len) > BOUND ||
-	    origsiz > ULONG_MAX || (olen = (u_long)origsiz) > BOUND) {
-		fido_log_debug("%s: in->len=%zu, origsiz=%zu", __func__,
-		    in->len, origsiz);
-		return FIDO_ERR_INVALID_ARGUMENT;
+	if ((z = inflateReset2(zs, wbits)) != Z_OK) {
+		fido_log_debug("%s: inflateReset2: %d", __func__, z);
+		return FIDO_ERR_COMPRESS;
 	}
+	zs->next_in = in->ptr;
+	zs->avail_in = (u_int)in->len;
+	zs->next_out = out;
+	zs->avail_out = olen;
 
-	if ((out->ptr = calloc(1, olen)) == NULL)
-		return FIDO_ERR_INTERNAL;
-	out->len = olen;
-
-	if ((z = uncompress(out->ptr, &olen, in->ptr, ilen)) != Z_OK ||
-	    olen > SIZE_MAX || olen != out->len) {
-		fido_log_debug("%s: uncompress: %d, olen=%lu, out->len=%zu",
-		    __func__, z, olen, out->len);
-		fido_blob_reset(out);
+	if ((z = inflate(zs, Z_FINISH)) != Z_STREAM_END) {
+		fido_log_debug("%s: inflate: %d", __func__, z);
+		return FIDO_ERR_COMPRESS;
+	}
+	if (zs->avail_out != 0) {
+		fido_log_debug("%s: %u != 0", __func__, zs->avail_out);
 		return FIDO_ERR_COMPRESS;
 	}
 
 	return FIDO_OK;
 }
 
-/* raw inflate */
+/* raw deflate */
 static int
-rfc1951_inflate(fido_blob_t *out, const fido_blob_t *in, size_t origsiz)
+rfc1951_deflate(fido_blob_t *out, const fido_blob_t *in, int level)
 {
 	z_stream zs;
+	u_long bound;
 	u_int ilen, olen;
 	int r, z;
 
 	memset(&zs, 0, sizeof(zs));
 	memset(out, 0, sizeof(*out));
 
-	if (in->len > UINT_MAX || (ilen = (u_int)in->len) > BOUND ||
-	    origsiz > UINT_MAX || (olen = (u_int)origsiz) > BOUND) {
-		fido_log_debug("%s: in->len=%zu, origsiz=%zu", __func__,
-		    in->len, origsiz);
+	if (in->len > UINT_MAX || (ilen = (u_int)in->len) > BOUND) {
+		fido_log_debug("%s: in->len=%zu", __func__, in->len);
 		return FIDO_ERR_INVALID_ARGUMENT;
 	}
-	if ((z = inflateInit2(&zs, -MAX_WBITS)) != Z_OK) {
-		fido_log_debug("%s: inflateInit2: %d", __func__, z);
+	if ((z = deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8,
+	    Z_DEFAULT_STRATEGY)) != Z_OK) {
+		fido_log_debug("%s: deflateInit2: %d", __func__, z);
 		return FIDO_ERR_COMPRESS;
 	}
 
-	if ((out->ptr = calloc(1, olen)) == NULL) {
+	/* the output cannot exceed deflateBound(), so allocate that much */
+	if ((bound = deflateBound(&zs, ilen)) > BOUND) {
+		fido_log_debug("%s: bound=%lu", __func__, bound);
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto fail;
+	}
+	olen = (u_int)bound;
+	if ((out->ptr = fido_calloc(1, olen)) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
@@ -73,21 +82,23 @@ rfc1951_inflate(fido_blob_t *out, const fido_blob_t *in, size_t origsiz)
 	zs.next_out = out->ptr;
 	zs.avail_out = olen;
 
-	if ((z = inflate(&zs, Z_FINISH)) != Z_STREAM_END) {
+	if ((z = deflate(&zs, Z_FINISH)) != Z_STREAM_END) {
 		fido_log_debug("%s: inflate: %d", __func__, z);
 		r = FIDO_ERR_COMPRESS;
 		goto fail;
 	}
-	if (zs.avail_out != 0) {
-		fido_log_debug("%s: %u != 0", __func__, zs.avail_out);
+	if (zs.avail_out >= out->len) {
+		fido_log_debug("%s: %u > %zu", __func__, zs.avail_out,
+		    out->len);
 		r = FIDO_ERR_COMPRESS;
 		goto fail;
 	}
+	out->len -= zs.avail_out;
 
 	r = FIDO_OK;
 fail:
-	if ((z = inflateEnd(&zs)) != Z_OK) {
-		fido_log_debug("%s: inflateEnd: %d", __func__, z);
+	if ((z = deflateEnd(&zs)) != Z_OK) {
+		fido_log_debug("%s: deflateEnd: %d", __func__, z);
 		r = FIDO_ERR_COMPRESS;
 	}
 	if (r != FIDO_OK)
@@ -96,12 +107,171 @@ fail:
 	return r;
 }
 
-/* raw deflate */
+/*
+ * Inflate in using zs, reset to the format given by wbits, passing the
+ * output to wr in pieces; wr may be NULL.
+ */
+static int
+stream_inflate(z_stream *zs, int wbits, const fido_blob_t *in, size_t origsiz,
+    fido_largeblob_write_t *wr, void *arg)
+{
+	u_char buf[CHUNK];
+	size_t n, used = 0; /* bytes of buf to wipe */
+	int r, z;
+
+	if ((z = inflateReset2(zs, wbits)) != Z_OK) {
+		fido_log_debug("%s: inflateReset2: %d", __func__, z);
+		return FIDO_ERR_COMPRESS;
+	}
+	zs->next_in = in->ptr;
+	zs->avail_in = (u_int)in->len;
+
+	do {
+		zs->next_out = buf;
+		zs->avail_out = sizeof(buf);
+		z = inflate(zs, Z_NO_FLUSH);
+		if ((n = sizeof(buf) - zs->avail_out) > used)
+			used = n;
+		if (z != Z_OK && z != Z_STREAM_END) {
+			fido_log_debug("%s: inflate: %d", __func__, z);
+			r = FIDO_ERR_COMPRESS;
+			goto fail;
+		}
+		if (zs->total_out > origsiz) {
+			fido_log_debug("%s: %lu > %zu", __func__,
+			    zs->total_out, origsiz);
+			r = FIDO_ERR_COMPRESS;
+			goto fail;
+		}
+		if (wr != NULL && n > 0 && wr(arg, buf, n) < 0) {
+			fido_log_debug("%s: wr", __func__);
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+	} while (z != Z_STREAM_END);
+
+	if (zs->total_out != origsiz) {
+		fido_log_debug("%s: %lu != %zu", __func__, zs->total_out,
+		    origsiz);
+		r = FIDO_ERR_COMPRESS;
+		goto fail;
+	}
+
+	r = FIDO_OK;
+fail:
+	explicit_bzero(buf, used);
+
+	return r;
+}
+
+/* raw deflate of the data returned by rd, growing out as needed */
 static int
-rfc1951_deflate(fido_blob_t *out, const fido_blob_t *in)
+stream_deflate(fido_blob_t *out, size_t *origsiz, int level,
+    fido_largeblob_read_t *rd, void *arg)
 {
 	z_stream zs;
-	u_int ilen, olen;
+	u_char buf[CHUNK], *ptr;
+	size_t len, size = 0, used = 0; /* bytes of buf to wipe */
+	int flush = Z_NO_FLUSH, n, r, z;
+
+	memset(&zs, 0, sizeof(zs));
+	memset(out, 0, sizeof(*out));
+	*origsiz = 0;
+
+	if ((z = deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8,
+	    Z_DEFAULT_STRATEGY)) != Z_OK) {
+		fido_log_debug("%s: deflateInit2: %d", __func__, z);
+		return FIDO_ERR_COMPRESS;
+	}
+
+	do {
+		if (zs.avail_in == 0 && flush == Z_NO_FLUSH) {
+			if ((n = rd(arg, buf, sizeof(buf))) < 0 ||
+			    (size_t)n > sizeof(buf)) {
+				fido_log_debug("%s: rd", __func__);
+				used = sizeof(buf); /* unknown */
+				r = FIDO_ERR_INTERNAL;
+				goto fail;
+			}
+			if ((size_t)n > used)
+				used = (size_t)n;
+			if ((size_t)n > BOUND - *origsiz) {
+				fido_log_debug("%s: origsiz=%zu", __func__,
+				    *origsiz);
+				r = FIDO_ERR_INVALID_ARGUMENT;
+				goto fail;
+			}
+			if (n == 0)
+				flush = Z_FINISH;
+			*origsiz += (size_t)n;
+			zs.next_in = buf;
+			zs.avail_in = (u_int)n;
+		}
+		if (zs.avail_out == 0) {
+			if ((len = size == 0 ? CHUNK : 2 * size) > BOUND ||
+			    (ptr = fido_recallocarray(out->ptr, size, len,
+			    1)) == NULL) {
+				fido_log_debug("%s: len=%zu", __func__, len);
+				r = FIDO_ERR_COMPRESS;
+				goto fail;
+			}
+			out->ptr = ptr;
+			zs.next_out = ptr + zs.total_out;
+			zs.avail_out = (u_int)(len - zs.total_out);
+			size = len;
+		}
+		if ((z = deflate(&zs, flush)) != Z_OK && z != Z_BUF_ERROR &&
+		    z != Z_STREAM_END) {
+			fido_log_debug("%s: deflate: %d", __func__, z);
+			r = FIDO_ERR_COMPRESS;
+			goto fail;
+		}
+	} while (z != Z_STREAM_END);
+
+	out->len = zs.total_out;
+
+	r = FIDO_OK;
+fail:
+	if ((z = deflateEnd(&zs)) != Z_OK) {
+		fido_log_debug("%s: deflateEnd: %d", __func__, z);
+		r = FIDO_ERR_COMPRESS;
+	}
+	if (r != FIDO_OK) {
+		fido_freezero(out->ptr, size);
+		memset(out, 0, sizeof(*out));
+	}
+	explicit_bzero(buf, used);
+
+	return r;
+}
+
+int
+fido_compress(fido_blob_t *out, const fido_blob_t *in)
+{
+	return rfc1951_deflate(out, in, Z_DEFAULT_COMPRESSION);
+}
+
+/* level 0 stores, 1 to 9 trade speed for size, -1 is zlib's default */
+int
+fido_compress_level(fido_blob_t *out, const fido_blob_t *in, int level)
+{
+	return rfc1951_deflate(out, in, level);
+}
+
+/*
+ * Raw deflate of in into out, in windows of CHUNK bytes, each encrypted
+ * in place with gcm, a context from aes256_gcm_enc_begin(), as soon as
+ * deflate fills it; the mac tag is appended. The compressed plaintext is
+ * thus never held whole, nor copied.
+ */
+int
+fido_compress_seal(fido_blob_t *out, const fido_blob_t *in, int level,
+    EVP_CIPHER_CTX *gcm)
+{
+	z_stream zs;
+	u_long bound;
+	u_int ilen;
+	size_t off = 0, size = 0;
 	int r, z;
 
 	memset(&zs, 0, sizeof(zs));
@@ -111,35 +281,56 @@ rfc1951_deflate(fido_blob_t *out, const fido_blob_t *in)
 		fido_log_debug("%s: in->len=%zu", __func__, in->len);
 		return FIDO_ERR_INVALID_ARGUMENT;
 	}
-	if ((z = deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
-	    -MAX_WBITS, 8, Z_DEFAULT_STRATEGY)) != Z_OK) {
+	if ((z = deflateInit2(&zs, level, Z_DEFLATED, -MAX_WBITS, 8,
+	    Z_DEFAULT_STRATEGY)) != Z_OK) {
 		fido_log_debug("%s: deflateInit2: %d", __func__, z);
 		return FIDO_ERR_COMPRESS;
 	}
 
-	olen = BOUND;
-	if ((out->ptr = calloc(1, olen)) == NULL) {
+	/* the output cannot exceed deflateBound(), plus room for the tag */
+	if ((bound = deflateBound(&zs, ilen)) > BOUND) {
+		fido_log_debug("%s: bound=%lu", __func__, bound);
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto fail;
+	}
+	size = (size_t)bound + 16;
+	if ((out->ptr = fido_calloc(1, size)) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
-	out->len = olen;
 	zs.next_in = in->ptr;
 	zs.avail_in = ilen;
-	zs.next_out = out->ptr;
-	zs.avail_out = olen;
 
-	if ((z = deflate(&zs, Z_FINISH)) != Z_STREAM_END) {
-		fido_log_debug("%s: inflate: %d", __func__, z);
-		r = FIDO_ERR_COMPRESS;
-		goto fail;
-	}
-	if (zs.avail_out >= out->len) {
-		fido_log_debug("%s: %u > %zu", __func__, zs.avail_out,
-		    out->len);
-		r = FIDO_ERR_COMPRESS;
+	do {
+		if (off == (size_t)bound) {
+			fido_log_debug("%s: bound=%lu", __func__, bound);
+			r = FIDO_ERR_COMPRESS;
+			goto fail;
+		}
+		zs.next_out = out->ptr + off;
+		zs.avail_out = (u_int)((size_t)bound - off < CHUNK ?
+		    (size_t)bound - off : CHUNK);
+		if ((z = deflate(&zs, Z_FINISH)) != Z_OK &&
+		    z != Z_STREAM_END) {
+			fido_log_debug("%s: deflate: %d", __func__, z);
+			r = FIDO_ERR_COMPRESS;
+			goto fail;
+		}
+		if (aes256_gcm_enc_update(gcm, out->ptr + off,
+		    (size_t)zs.total_out - off) < 0) {
+			fido_log_debug("%s: aes256_gcm_enc_update", __func__);
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+		off = (size_t)zs.total_out;
+	} while (z != Z_STREAM_END);
+
+	if (aes256_gcm_enc_end(gcm, out->ptr + off) < 0) {
+		fido_log_debug("%s: aes256_gcm_enc_end", __func__);
+		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
-	out->len -= zs.avail_out;
+	out->len = off + 16;
 
 	r = FIDO_OK;
 fail:
@@ -147,22 +338,112 @@ fail:
 		fido_log_debug("%s: deflateEnd: %d", __func__, z);
 		r = FIDO_ERR_COMPRESS;
 	}
+	if (r != FIDO_OK) {
+		fido_freezero(out->ptr, size);
+		memset(out, 0, sizeof(*out));
+	}
+
+	return r;
+}
+
+/*
+ * Inflate in into the outlen bytes at out, which it must fill exactly.
+ * One inflate stream serves both formats.
+ */
+int
+fido_uncompress_buf(u_char *out, size_t outlen, const fido_blob_t *in)
+{
+	z_stream zs;
+	int r, z;
+
+	memset(&zs, 0, sizeof(zs));
+
+	if (in->len > UINT_MAX || in->len > BOUND || outlen > UINT_MAX ||
+	    outlen > BOUND) {
+		fido_log_debug("%s: in->len=%zu, outlen=%zu", __func__,
+		    in->len, outlen);
+		return FIDO_ERR_INVALID_ARGUMENT;
+	}
+	if ((z = inflateInit2(&zs, MAX_WBITS)) != Z_OK) {
+		fido_log_debug("%s: inflateInit2: %d", __func__, z);
+		return FIDO_ERR_COMPRESS;
+	}
+
+	/* backwards compat with libfido2 < 1.11 */
+	if ((r = inflate_into(&zs, MAX_WBITS, out, (u_int)outlen,
+	    in)) != FIDO_OK)
+		r = inflate_into(&zs, -MAX_WBITS, out, (u_int)outlen, in);
+
+	if ((z = inflateEnd(&zs)) != Z_OK) {
+		fido_log_debug("%s: inflateEnd: %d", __func__, z);
+		r = FIDO_ERR_COMPRESS;
+	}
 	if (r != FIDO_OK)
+		explicit_bzero(out, outlen);
+
+	return r;
+}
+
+int
+fido_uncompress(fido_blob_t *out, const fido_blob_t *in, size_t origsiz)
+{
+	int r;
+
+	memset(out, 0, sizeof(*out));
+
+	if (origsiz > BOUND) {
+		fido_log_debug("%s: origsiz=%zu", __func__, origsiz);
+		return FIDO_ERR_INVALID_ARGUMENT;
+	}
+	if ((out->ptr = fido_calloc(1, origsiz)) == NULL)
+		return FIDO_ERR_INTERNAL;
+	out->len = origsiz;
+	if ((r = fido_uncompress_buf(out->ptr, out->len, in)) != FIDO_OK)
 		fido_blob_reset(out);
 
 	return r;
 }
 
 int
-fido_compress(fido_blob_t *out, const fido_blob_t *in)
+fido_compress_stream(fido_blob_t *out, size_t *origsiz, int level,
+    fido_largeblob_read_t *rd, void *arg)
 {
-	return rfc1951_deflate(out, in);
+	return stream_deflate(out, origsiz, level, rd, arg);
 }
 
+/* a dry run picks the format first, so that wr only sees valid data */
 int
-fido_uncompress(fido_blob_t *out, const fido_blob_t *in, size_t origsiz)
+fido_uncompress_stream(const fido_blob_t *in, size_t origsiz,
+    fido_largeblob_write_t *wr, void *arg)
 {
-	if (rfc1950_inflate(out, in, origsiz) == FIDO_OK)
-		return FIDO_OK; /* backwards compat with libfido2 < 1.11 */
-	return rfc1951_inflate(out, in, origsiz);
+	z_stream zs;
+	int r, z, wbits = MAX_WBITS;
+
+	memset(&zs, 0, sizeof(zs));
+
+	if (in->len > UINT_MAX || in->len > BOUND || origsiz > BOUND) {
+		fido_log_debug("%s: in->len=%zu, origsiz=%zu", __func__,
+		    in->len, origsiz);
+		return FIDO_ERR_INVALID_ARGUMENT;
+	}
+	if ((z = inflateInit2(&zs, wbits)) != Z_OK) {
+		fido_log_debug("%s: inflateInit2: %d", __func__, z);
+		return FIDO_ERR_COMPRESS;
+	}
+
+	/* backwards compat with libfido2 < 1.11 */
+	if ((r = stream_inflate(&zs, wbits, in, origsiz, NULL,
+	    NULL)) != FIDO_OK) {
+		wbits = -MAX_WBITS;
+		r = stream_inflate(&zs, wbits, in, origsiz, NULL, NULL);
+	}
+	if (r == FIDO_OK)
+		r = stream_inflate(&zs, wbits, in, origsiz, wr, arg);
+
+	if ((z = inflateEnd(&zs)) != Z_OK) {
+		fido_log_debug("%s: inflateEnd: %d", __func__, z);
+		r = FIDO_ERR_COMPRESS;
+	}
+
+	return r;
 }
@@ -13,6 +13,21 @@
 #define CMD_TOGGLE_ALWAYS_UV	0x02
 #define CMD_SET_PIN_MINLEN	0x03
 
+/*
+ * Settings to be applied to an authenticator with fido_dev_config_apply(),
+ * and the outcome of each. The minimum pin length, its rpids and the
+ * forced pin change travel in one setMinPINLength command.
+ */
+struct fido_config {
+	fido_opt_t		always_uv;
+	bool			entattest;
+	size_t			pin_minlen;
+	bool			force_pin_change;
+	bool			has_rpid;
+	fido_str_array_t	rpid;
+	int			status[3]; /* indexed by FIDO_CONFIG_* - 1 */
+};
+
 static int
 config_prepare_hmac(uint8_t subcmd, const cbor_item_t *item, fido_blob_t *hmac)
 {
@@ -29,7 +44,7 @@ config_prepare_hmac(uint8_t subcmd, const cbor_item_t *item, fido_blob_t *hmac)
 			return -1;
 		}
 	}
-	if ((hmac->ptr = malloc(cbor_len + sizeof(prefix))) == NULL) {
+	if ((hmac->ptr = fido_malloc(cbor_len + sizeof(prefix))) == NULL) {
 		fido_log_debug("%s: malloc", __func__);
 		return -1;
 	}
@@ -45,8 +60,7 @@ config_tx(fido_dev_t *dev, uint8_t subcmd, cbor_item_t **paramv, size_t paramc,
     const char *pin, int *ms)
 {
 	cbor_item_t *argv[4];
-	es256_pk_t *pk = NULL;
-	fido_blob_t *ecdh = NULL, f, hmac;
+	fido_blob_t f, hmac;
 	const uint8_t cmd = CTAP_CBOR_CONFIG;
 	int r = FIDO_ERR_INTERNAL;
 
@@ -74,11 +88,7 @@ config_tx(fido_dev_t *dev, uint8_t subcmd, cbor_item_t **paramv, size_t paramc,
 			fido_log_debug("%s: config_prepare_hmac", __func__);
 			goto fail;
 		}
-		if ((r = fido_do_ecdh(dev, &pk, &ecdh, ms)) != FIDO_OK) {
-			fido_log_debug("%s: fido_do_ecdh", __func__);
-			goto fail;
-		}
-		if ((r = cbor_add_uv_params(dev, cmd, &hmac, pk, ecdh, pin,
+		if ((r = cbor_add_uv_params(dev, cmd, &hmac, NULL, NULL, pin,
 		    NULL, &argv[3], &argv[2], ms)) != FIDO_OK) {
 			fido_log_debug("%s: cbor_add_uv_params", __func__);
 			goto fail;
@@ -96,10 +106,8 @@ config_tx(fido_dev_t *dev, uint8_t subcmd, cbor_item_t **paramv, size_t paramc,
 	r = FIDO_OK;
 fail:
 	cbor_vector_free(argv, nitems(argv));
-	es256_pk_free(&pk);
-	fido_blob_free(&ecdh);
-	free(f.ptr);
-	free(hmac.ptr);
+	fido_free(f.ptr);
+	fido_free(hmac.ptr);
 
 	return r;
 }
@@ -120,8 +128,13 @@ int
 fido_dev_enable_entattest(fido_dev_t *dev, const char *pin)
 {
 	int ms = dev->timeout_ms;
+	int r;
 
-	return (config_enable_entattest_wait(dev, pin, &ms));
+	do
+		r = config_enable_entattest_wait(dev, pin, &ms);
+	while (fido_dev_uv_token_retry(dev, r));
+
+	return (r);
 }
 
 static int
@@ -140,8 +153,13 @@ int
 fido_dev_toggle_always_uv(fido_dev_t *dev, const char *pin)
 {
 	int ms = dev->timeout_ms;
+	int r;
+
+	do
+		r = config_toggle_always_uv_wait(dev, pin, &ms);
+	while (fido_dev_uv_token_retry(dev, r));
 
-	return config_toggle_always_uv_wait(dev, pin, &ms);
+	return r;
 }
 
 static int
@@ -190,11 +208,13 @@ config_pin_minlen(fido_dev_t *dev, size_t len, bool force,
 {
 	int r;
 
-	if ((r = config_pin_minlen_tx(dev, len, force, rpid, pin,
-	    ms)) != FIDO_OK)
-		return r;
+	do {
+		if ((r = config_pin_minlen_tx(dev, len, force, rpid, pin,
+		    ms)) == FIDO_OK)
+			r = fido_rx_cbor_status(dev, ms);
+	} while (fido_dev_uv_token_retry(dev, r));
 
-	return fido_rx_cbor_status(dev, ms);
+	return r;
 }
 
 int
@@ -233,3 +253,211 @@ fail:
 
 	return r;
 }
+
+/* alwaysUv is toggled; look at its current value first */
+int
+fido_dev_set_always_uv(fido_dev_t *dev, fido_opt_t want, const char *pin)
+{
+	const fido_cbor_info_t	*ci;
+	char			**name;
+	const bool		 *value;
+	bool			  on = false;
+	int			  r;
+
+	if ((r = fido_dev_refresh_cbor_info(dev)) != FIDO_OK) {
+		fido_log_debug("%s: fido_dev_refresh_cbor_info", __func__);
+		return (r);
+	}
+	if ((ci = fido_dev_cbor_info(dev)) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	name = fido_cbor_info_options_name_ptr(ci);
+	value = fido_cbor_info_options_value_ptr(ci);
+	for (size_t i = 0; i < fido_cbor_info_options_len(ci); i++)
+		if (strcmp(name[i], "alwaysUv") == 0)
+			on = value[i];
+	if (on == (want == FIDO_OPT_TRUE))
+		return (FIDO_OK);
+
+	return (fido_dev_toggle_always_uv(dev, pin));
+}
+
+fido_config_t *
+fido_config_new(void)
+{
+	return (fido_calloc(1, sizeof(fido_config_t)));
+}
+
+void
+fido_config_free(fido_config_t **cfg_p)
+{
+	fido_config_t *cfg;
+
+	if (cfg_p == NULL || (cfg = *cfg_p) == NULL)
+		return;
+	fido_str_array_free(&cfg->rpid);
+	fido_free(cfg);
+	*cfg_p = NULL;
+}
+
+int
+fido_config_set_always_uv(fido_config_t *cfg, fido_opt_t always_uv)
+{
+	if (always_uv != FIDO_OPT_OMIT && always_uv != FIDO_OPT_FALSE &&
+	    always_uv != FIDO_OPT_TRUE)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	cfg->always_uv = always_uv;
+
+	return (FIDO_OK);
+}
+
+int
+fido_config_set_entattest(fido_config_t *cfg, bool entattest)
+{
+	cfg->entattest = entattest;
+
+	return (FIDO_OK);
+}
+
+int
+fido_config_set_force_pin_change(fido_config_t *cfg, bool force)
+{
+	cfg->force_pin_change = force;
+
+	return (FIDO_OK);
+}
+
+int
+fido_config_set_pin_minlen(fido_config_t *cfg, size_t len)
+{
+	if (len > UINT8_MAX)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	cfg->pin_minlen = len;
+
+	return (FIDO_OK);
+}
+
+int
+fido_config_set_pin_minlen_rpid(fido_config_t *cfg, const char * const *rpid,
+    size_t n)
+{
+	fido_str_array_t sa;
+
+	memset(&sa, 0, sizeof(sa));
+	if (rpid == NULL && n != 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if (rpid != NULL && fido_str_array_pack(&sa, rpid, n) < 0) {
+		fido_log_debug("%s: fido_str_array_pack", __func__);
+		fido_str_array_free(&sa);
+		return (FIDO_ERR_INTERNAL);
+	}
+	fido_str_array_free(&cfg->rpid);
+	cfg->rpid = sa;
+	cfg->has_rpid = rpid != NULL;
+
+	return (FIDO_OK);
+}
+
+int
+fido_config_status(const fido_config_t *cfg, int item)
+{
+	if (item < FIDO_CONFIG_ENTATTEST || item > FIDO_CONFIG_PIN_MINLEN)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	return (cfg->status[item - 1]);
+}
+
+/* a failure after which no other setting can be applied either */
+static bool
+config_fatal(int r)
+{
+	switch (r) {
+	case FIDO_ERR_TX:
+	case FIDO_ERR_RX:
+	case FIDO_ERR_RX_NOT_CBOR:
+	case FIDO_ERR_RX_INVALID_CBOR:
+	case FIDO_ERR_PIN_INVALID:
+	case FIDO_ERR_PIN_BLOCKED:
+	case FIDO_ERR_PIN_AUTH_BLOCKED:
+	case FIDO_ERR_PIN_NOT_SET:
+	case FIDO_ERR_PIN_REQUIRED:
+	case FIDO_ERR_UV_BLOCKED:
+	case FIDO_ERR_UV_INVALID:
+		return (true);
+	default:
+		return (false);
+	}
+}
+
+static int
+config_apply_item(fido_dev_t *dev, const fido_config_t *cfg, int item,
+    const char *pin, int *ms)
+{
+	switch (item) {
+	case FIDO_CONFIG_ALWAYS_UV:
+		return (fido_dev_set_always_uv(dev, cfg->always_uv, pin));
+	case FIDO_CONFIG_ENTATTEST:
+		return (fido_dev_enable_entattest(dev, pin));
+	case FIDO_CONFIG_PIN_MINLEN:
+		return (config_pin_minlen(dev, cfg->pin_minlen,
+		    cfg->force_pin_change, cfg->has_rpid ? &cfg->rpid : NULL,
+		    pin, ms));
+	default:
+		return (FIDO_ERR_INTERNAL);
+	}
+}
+
+/*
+ * Settings are applied with one pin/uv auth token. setMinPINLength goes
+ * last, since a forced pin change stops the authenticator from issuing
+ * further tokens.
+ */
+int
+fido_dev_config_apply(fido_dev_t *dev, fido_config_t *cfg, const char *pin)
+{
+	const int	 order[] = { FIDO_CONFIG_ALWAYS_UV,
+	    FIDO_CONFIG_ENTATTEST, FIDO_CONFIG_PIN_MINLEN };
+	bool		 want[3];
+	bool		 scoped;
+	int		 ms = dev->timeout_ms;
+	int		 r, ok = FIDO_OK, fatal = FIDO_OK;
+
+	want[FIDO_CONFIG_ENTATTEST - 1] = cfg->entattest;
+	want[FIDO_CONFIG_ALWAYS_UV - 1] = cfg->always_uv != FIDO_OPT_OMIT;
+	want[FIDO_CONFIG_PIN_MINLEN - 1] = cfg->pin_minlen != 0 ||
+	    cfg->force_pin_change || cfg->has_rpid;
+	for (size_t i = 0; i < nitems(cfg->status); i++)
+		cfg->status[i] = FIDO_OK;
+
+	/* obtain one token for all settings, even if caching is off */
+	if ((scoped = dev->uv_cache == NULL) &&
+	    (r = fido_dev_set_uv_token_cache(dev, true)) != FIDO_OK)
+		return (r);
+
+	for (size_t i = 0; i < nitems(order); i++) {
+		if (want[order[i] - 1] == false)
+			continue;
+		if (fatal != FIDO_OK) {
+			/* not attempted; report why */
+			cfg->status[order[i] - 1] = fatal;
+			continue;
+		}
+		r = config_apply_item(dev, cfg, order[i], pin, &ms);
+		if (r != FIDO_OK) {
+			fido_log_debug("%s: item %d: %d", __func__, order[i],
+			    r);
+			if (ok == FIDO_OK)
+				ok = r;
+			if (config_fatal(r))
+				fatal = r;
+		}
+		cfg->status[order[i] - 1] = r;
+		/* each command gets a full timeout */
+		ms = dev->timeout_ms;
+	}
+
+	if (scoped)
+		fido_dev_uv_cache_free(dev);
+
+	return (ok);
+}
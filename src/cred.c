@@ -6,47 +6,63 @@
  */
 
 #include <openssl/sha.h>
-#include <openssl/x509.h>
 
 #include "fido.h"
 #include "fido/es256.h"
+#include "fido/verify.h"
+#include "probe.h"
 
 #ifndef FIDO_MAXMSG_CRED
 #define FIDO_MAXMSG_CRED	4096
 #endif
 
+#ifndef FIDO_VERIFY_ONLY
 static int
-parse_makecred_reply(const cbor_item_t *key, const cbor_item_t *val, void *arg)
+decode_makecred_fmt(const cbor_item_t *val, void *arg)
 {
 	fido_cred_t *cred = arg;
 
-	if (cbor_isa_uint(key) == false ||
-	    cbor_int_get_width(key) != CBOR_INT_8) {
-		fido_log_debug("%s: cbor type", __func__);
-		return (0); /* ignore */
-	}
+	return (cbor_decode_fmt(val, &cred->fmt));
+}
 
-	switch (cbor_get_uint8(key)) {
-	case 1: /* fmt */
-		return (cbor_decode_fmt(val, &cred->fmt));
-	case 2: /* authdata */
-		if (fido_blob_decode(val, &cred->authdata_raw) < 0) {
-			fido_log_debug("%s: fido_blob_decode", __func__);
-			return (-1);
-		}
-		return (cbor_decode_cred_authdata(val, cred->type,
-		    &cred->authdata_cbor, &cred->authdata, &cred->attcred,
-		    &cred->authdata_ext));
-	case 3: /* attestation statement */
-		return (cbor_decode_attstmt(val, &cred->attstmt));
-	case 5: /* large blob key */
-		return (fido_blob_decode(val, &cred->largeblob_key));
-	default: /* ignore */
-		fido_log_debug("%s: cbor type", __func__);
-		return (0);
+static int
+decode_makecred_authdata(const cbor_item_t *val, void *arg)
+{
+	fido_cred_t *cred = arg;
+
+	if (fido_blob_decode(val, &cred->authdata_raw) < 0) {
+		fido_log_debug("%s: fido_blob_decode", __func__);
+		return (-1);
 	}
+
+	return (cbor_decode_cred_authdata(val, cred->type,
+	    &cred->authdata_cbor, &cred->authdata, &cred->attcred,
+	    &cred->authdata_ext));
 }
 
+static int
+decode_makecred_attstmt(const cbor_item_t *val, void *arg)
+{
+	fido_cred_t *cred = arg;
+
+	return (cbor_decode_attstmt(val, &cred->attstmt));
+}
+
+static int
+decode_makecred_largeblob_key(const cbor_item_t *val, void *arg)
+{
+	fido_cred_t *cred = arg;
+
+	return (fido_blob_decode(val, &cred->largeblob_key));
+}
+
+static const cbor_key_decoder_t makecred_reply[] = {
+	{ 1, decode_makecred_fmt },		/* fmt */
+	{ 2, decode_makecred_authdata },	/* authdata */
+	{ 3, decode_makecred_attstmt },		/* attestation statement */
+	{ 5, decode_makecred_largeblob_key },	/* large blob key */
+};
+
 static int
 fido_dev_make_cred_tx(fido_dev_t *dev, fido_cred_t *cred, const char *pin,
     int *ms)
@@ -55,12 +71,15 @@ fido_dev_make_cred_tx(fido_dev_t *dev, fido_cred_t *cred, const char *pin,
 	fido_blob_t	*ecdh = NULL;
 	fido_opt_t	 uv = cred->uv;
 	es256_pk_t	*pk = NULL;
-	cbor_item_t	*argv[9];
+	cbor_item_t	*ext = NULL;
+	cbor_item_t	*auth = NULL;
+	cbor_item_t	*prot = NULL;
+	cbor_writer_t	 w;
 	const uint8_t	 cmd = CTAP_CBOR_MAKECRED;
+	bool		 opt, excl;
 	int		 r;
 
 	memset(&f, 0, sizeof(f));
-	memset(argv, 0, sizeof(argv));
 
 	if (cred->cdh.ptr == NULL || cred->type == 0) {
 		fido_log_debug("%s: cdh=%p, type=%d", __func__,
@@ -68,27 +87,18 @@ fido_dev_make_cred_tx(fido_dev_t *dev, fido_cred_t *cred, const char *pin,
 		r = FIDO_ERR_INVALID_ARGUMENT;
 		goto fail;
 	}
-
-	if ((argv[0] = fido_blob_encode(&cred->cdh)) == NULL ||
-	    (argv[1] = cbor_encode_rp_entity(&cred->rp)) == NULL ||
-	    (argv[2] = cbor_encode_user_entity(&cred->user)) == NULL ||
-	    (argv[3] = cbor_encode_pubkey_param(cred->type)) == NULL) {
-		fido_log_debug("%s: cbor encode", __func__);
-		r = FIDO_ERR_INTERNAL;
+	excl = cred->excl.len != 0 || cred->excl_list != NULL;
+	if (cred->excl_list != NULL && cred->excl_batch >=
+	    fido_cred_list_batch_count(cred->excl_list)) {
+		fido_log_debug("%s: excl_batch=%zu", __func__,
+		    cred->excl_batch);
+		r = FIDO_ERR_INVALID_ARGUMENT;
 		goto fail;
 	}
 
-	/* excluded credentials */
-	if (cred->excl.len)
-		if ((argv[4] = cbor_encode_pubkey_list(&cred->excl)) == NULL) {
-			fido_log_debug("%s: cbor_encode_pubkey_list", __func__);
-			r = FIDO_ERR_INTERNAL;
-			goto fail;
-		}
-
 	/* extensions */
 	if (cred->ext.mask)
-		if ((argv[5] = cbor_encode_cred_ext(&cred->ext,
+		if ((ext = cbor_encode_cred_ext(&cred->ext,
 		    &cred->blob)) == NULL) {
 			fido_log_debug("%s: cbor_encode_cred_ext", __func__);
 			r = FIDO_ERR_INTERNAL;
@@ -103,23 +113,54 @@ fido_dev_make_cred_tx(fido_dev_t *dev, fido_cred_t *cred, const char *pin,
 			goto fail;
 		}
 		if ((r = cbor_add_uv_params(dev, cmd, &cred->cdh, pk, ecdh,
-		    pin, cred->rp.id, &argv[7], &argv[8], ms)) != FIDO_OK) {
+		    pin, cred->rp.id, &auth, &prot, ms)) != FIDO_OK) {
 			fido_log_debug("%s: cbor_add_uv_params", __func__);
 			goto fail;
 		}
 		uv = FIDO_OPT_OMIT;
 	}
 
-	/* options */
-	if (cred->rk != FIDO_OPT_OMIT || uv != FIDO_OPT_OMIT)
-		if ((argv[6] = cbor_encode_cred_opt(cred->rk, uv)) == NULL) {
-			fido_log_debug("%s: cbor_encode_cred_opt", __func__);
-			r = FIDO_ERR_INTERNAL;
-			goto fail;
-		}
+	opt = cred->rk != FIDO_OPT_OMIT || uv != FIDO_OPT_OMIT;
+
+	/* write the request directly; only ext and uv params are items */
+	cbor_writer_init(&w, cmd);
+	cbor_write_map(&w, 4 + (size_t)excl +
+	    (size_t)(ext != NULL) + (size_t)opt + (size_t)(auth != NULL) +
+	    (size_t)(prot != NULL));
+	cbor_write_uint(&w, 1);
+	cbor_write_blob(&w, &cred->cdh);
+	cbor_write_uint(&w, 2);
+	cbor_write_rp_entity(&w, &cred->rp);
+	cbor_write_uint(&w, 3);
+	cbor_write_user_entity(&w, &cred->user);
+	cbor_write_uint(&w, 4);
+	cbor_write_pubkey_param(&w, cred->type);
+	if (cred->excl_list != NULL) {
+		cbor_write_uint(&w, 5);
+		cbor_write_cred_list(&w, cred->excl_list, cred->excl_batch);
+	} else if (excl) {
+		cbor_write_uint(&w, 5);
+		cbor_write_pubkey_list(&w, &cred->excl);
+	}
+	if (ext != NULL) {
+		cbor_write_uint(&w, 6);
+		cbor_write_item(&w, ext);
+	}
+	if (opt) {
+		cbor_write_uint(&w, 7);
+		cbor_write_cred_opt(&w, cred->rk, uv);
+	}
+	if (auth != NULL) {
+		cbor_write_uint(&w, 8);
+		cbor_write_item(&w, auth);
+	}
+	if (prot != NULL) {
+		cbor_write_uint(&w, 9);
+		cbor_write_item(&w, prot);
+	}
 
 	/* framing and transmission */
-	if (cbor_build_frame(cmd, argv, nitems(argv), &f) < 0 ||
+	if (cbor_writer_finish(&w, &f) < 0 ||
 	    fido_tx(dev, CTAP_CMD_CBOR, f.ptr, f.len, ms) < 0) {
 		fido_log_debug("%s: fido_tx", __func__);
 		r = FIDO_ERR_TX;
@@ -130,48 +171,55 @@ fido_dev_make_cred_tx(fido_dev_t *dev, fido_cred_t *cred, const char *pin,
 fail:
 	es256_pk_free(&pk);
 	fido_blob_free(&ecdh);
-	cbor_vector_free(argv, nitems(argv));
-	free(f.ptr);
+	if (ext != NULL)
+		cbor_decref(&ext);
+	if (auth != NULL)
+		cbor_decref(&auth);
+	if (prot != NULL)
+		cbor_decref(&prot);
+	fido_free(f.ptr);
 
 	return (r);
 }
 
 static int
-fido_dev_make_cred_rx(fido_dev_t *dev, fido_cred_t *cred, int *ms)
+parse_makecred(fido_cred_t *cred, const unsigned char *reply, size_t reply_len)
 {
-	unsigned char	*reply;
-	int		 reply_len;
-	int		 r;
+	int r;
 
-	fido_cred_reset_rx(cred);
-
-	if ((reply = malloc(FIDO_MAXMSG_CRED)) == NULL) {
-		r = FIDO_ERR_INTERNAL;
-		goto fail;
+	if ((r = cbor_parse_reply_keys(reply, reply_len, cred,
+	    makecred_reply, nitems(makecred_reply))) != FIDO_OK) {
+		fido_log_debug("%s: cbor_parse_reply_keys", __func__);
+		return (r);
 	}
 
-	if ((reply_len = fido_rx(dev, CTAP_CMD_CBOR, reply, FIDO_MAXMSG_CRED,
-	    ms)) < 0) {
-		fido_log_debug("%s: fido_rx", __func__);
-		r = FIDO_ERR_RX;
-		goto fail;
-	}
+	if (cred->fmt == NULL || fido_blob_is_empty(&cred->authdata_cbor) ||
+	    fido_blob_is_empty(&cred->attcred.id))
+		return (FIDO_ERR_INVALID_CBOR);
 
-	if ((r = cbor_parse_reply(reply, (size_t)reply_len, cred,
-	    parse_makecred_reply)) != FIDO_OK) {
-		fido_log_debug("%s: parse_makecred_reply", __func__);
-		goto fail;
-	}
+	return (FIDO_OK);
+}
 
-	if (cred->fmt == NULL || fido_blob_is_empty(&cred->authdata_cbor) ||
-	    fido_blob_is_empty(&cred->attcred.id)) {
-		r = FIDO_ERR_INVALID_CBOR;
+static int
+fido_dev_make_cred_rx(fido_dev_t *dev, fido_cred_t *cred, int *ms)
+{
+	const unsigned char	*reply;
+	size_t			 replysiz;
+	int			 reply_len;
+	int			 r;
+
+	fido_cred_reset_rx(cred);
+
+	if ((reply_len = fido_rx_msg(dev, CTAP_CMD_CBOR, FIDO_MAXMSG_CRED,
+	    &reply, &replysiz, ms)) < 0) {
+		fido_log_debug("%s: fido_rx_msg", __func__);
+		r = FIDO_ERR_RX;
 		goto fail;
 	}
 
-	r = FIDO_OK;
+	r = parse_makecred(cred, reply, (size_t)reply_len);
 fail:
-	free(reply);
+	fido_rx_msg_put(dev, reply, replysiz);
 
 	if (r != FIDO_OK)
 		fido_cred_reset_rx(cred);
@@ -192,11 +240,34 @@ fido_dev_make_cred_wait(fido_dev_t *dev, fido_cred_t *cred, const char *pin,
 	return (FIDO_OK);
 }
 
-int
-fido_dev_make_cred(fido_dev_t *dev, fido_cred_t *cred, const char *pin)
+/* u2f and windows hello take the exclude list id by id */
+static int
+cred_expand_exclude_list(fido_cred_t *cred)
+{
+	int r;
+
+	if (cred->excl_list == NULL)
+		return (FIDO_OK);
+	if ((r = fido_cred_list_expand(cred->excl_list, cred->excl_batch,
+	    &cred->excl)) != FIDO_OK) {
+		fido_log_debug("%s: fido_cred_list_expand", __func__);
+		return (r);
+	}
+	cred->excl_list = NULL;
+	cred->excl_batch = 0;
+
+	return (FIDO_OK);
+}
+
+static int
+dev_make_cred(fido_dev_t *dev, fido_cred_t *cred, const char *pin)
 {
 	int ms = dev->timeout_ms;
+	int r;
 
+	if ((dev->flags & FIDO_DEV_WINHELLO || fido_dev_is_fido2(dev) ==
+	    false) && (r = cred_expand_exclude_list(cred)) != FIDO_OK)
+		return (r);
 #ifdef USE_WINHELLO
 	if (dev->flags & FIDO_DEV_WINHELLO)
 		return (fido_winhello_make_cred(dev, cred, pin, ms));
@@ -211,6 +282,95 @@ fido_dev_make_cred(fido_dev_t *dev, fido_cred_t *cred, const char *pin)
 	return (fido_dev_make_cred_wait(dev, cred, pin, &ms));
 }
 
+int
+fido_dev_make_cred(fido_dev_t *dev, fido_cred_t *cred, const char *pin)
+{
+	fido_trace_span_t span;
+	int r;
+
+	fido_sched_enter(dev);
+	fido_trace_span_begin(dev, &span, FIDO_SPAN_MAKE_CRED);
+	r = dev_make_cred(dev, cred, pin);
+	fido_trace_span_end(dev, &span, r);
+	fido_sched_leave(dev);
+
+	return (r);
+}
+
+int
+fido_dev_make_cred_begin(fido_dev_t *dev, fido_cred_t *cred, const char *pin)
+{
+	int ms = dev->timeout_ms;
+	int r;
+
+	if ((dev->flags & FIDO_DEV_WINHELLO || fido_dev_is_fido2(dev) ==
+	    false) && (r = cred_expand_exclude_list(cred)) != FIDO_OK)
+		return (r);
+#ifdef USE_WINHELLO
+	if (dev->flags & FIDO_DEV_WINHELLO)
+		return (fido_winhello_make_cred_begin(dev, cred, pin));
+#endif
+	if (fido_dev_is_fido2(dev) == false) {
+		if (pin != NULL || cred->rk == FIDO_OPT_TRUE ||
+		    cred->ext.mask != 0)
+			return (FIDO_ERR_UNSUPPORTED_OPTION);
+		return (u2f_register_begin(dev, cred));
+	}
+
+	if ((r = fido_rx_async_begin(dev, FIDO_DEV_ASYNC_CRED, CTAP_CMD_CBOR,
+	    FIDO_MAXMSG_CRED)) != FIDO_OK) {
+		fido_log_debug("%s: fido_rx_async_begin", __func__);
+		return (r);
+	}
+
+	fido_cred_reset_rx(cred);
+
+	if ((r = fido_dev_make_cred_tx(dev, cred, pin, &ms)) != FIDO_OK) {
+		fido_log_debug("%s: fido_dev_make_cred_tx", __func__);
+		fido_rx_async_end(dev);
+		return (r);
+	}
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_make_cred_step(fido_dev_t *dev, fido_cred_t *cred, int *done, int ms)
+{
+	struct fido_dev_async	*a = dev->async;
+	int			 r;
+
+	*done = 0;
+
+	if (a == NULL || a->op != FIDO_DEV_ASYNC_CRED) {
+		fido_log_debug("%s: no credential pending", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+	if (a->u2f != NULL)
+		return (u2f_register_step(dev, cred, done, ms));
+#ifdef USE_WINHELLO
+	if (a->winhello != NULL)
+		return (fido_winhello_make_cred_step(dev, cred, done, ms));
+#endif
+
+	if ((r = fido_rx_async_step(dev, done, ms)) != FIDO_OK) {
+		fido_log_debug("%s: fido_rx_async_step", __func__);
+		goto fail;
+	}
+	if (*done == 0)
+		return (FIDO_OK); /* keep waiting */
+
+	if ((r = parse_makecred(cred, a->buf, a->len)) != FIDO_OK)
+		fido_cred_reset_rx(cred);
+fail:
+	fido_rx_async_end(dev);
+	*done = r == FIDO_OK;
+
+	return (r);
+}
+
+#endif /* !FIDO_VERIFY_ONLY */
+
 static int
 check_extensions(const fido_cred_ext_t *authdata_ext,
     const fido_cred_ext_t *ext)
@@ -224,19 +384,11 @@ check_extensions(const fido_cred_ext_t *authdata_ext,
 	return (timingsafe_bcmp(authdata_ext, &tmp, sizeof(*authdata_ext)));
 }
 
+/* the expected hash is computed once, when the rp id is set */
 int
-fido_check_rp_id(const char *id, const unsigned char *obtained_hash)
+fido_check_rp_id_hash(const unsigned char *expected_hash,
+    const unsigned char *obtained_hash)
 {
-	unsigned char expected_hash[SHA256_DIGEST_LENGTH];
-
-	explicit_bzero(expected_hash, sizeof(expected_hash));
-
-	if (SHA256((const unsigned char *)id, strlen(id),
-	    expected_hash) != expected_hash) {
-		fido_log_debug("%s: sha256", __func__);
-		return (-1);
-	}
-
 	return (timingsafe_bcmp(expected_hash, obtained_hash,
 	    SHA256_DIGEST_LENGTH));
 }
@@ -246,55 +398,37 @@ get_signed_hash_u2f(fido_blob_t *dgst, const unsigned char *rp_id,
     size_t rp_id_len, const fido_blob_t *clientdata, const fido_blob_t *id,
     const es256_pk_t *pk)
 {
-	const uint8_t	 zero = 0;
-	const uint8_t	 four = 4; /* uncompressed point */
-	const EVP_MD	*md = NULL;
-	EVP_MD_CTX	*ctx = NULL;
-	int		 ok = -1;
+	const uint8_t	zero = 0;
+	const uint8_t	four = 4; /* uncompressed point */
+	SHA256_CTX	ctx;
 
 	if (dgst->len < SHA256_DIGEST_LENGTH ||
-	    (md = EVP_sha256()) == NULL ||
-	    (ctx = EVP_MD_CTX_new()) == NULL ||
-	    EVP_DigestInit_ex(ctx, md, NULL) != 1 ||
-	    EVP_DigestUpdate(ctx, &zero, sizeof(zero)) != 1 ||
-	    EVP_DigestUpdate(ctx, rp_id, rp_id_len) != 1 ||
-	    EVP_DigestUpdate(ctx, clientdata->ptr, clientdata->len) != 1 ||
-	    EVP_DigestUpdate(ctx, id->ptr, id->len) != 1 ||
-	    EVP_DigestUpdate(ctx, &four, sizeof(four)) != 1 ||
-	    EVP_DigestUpdate(ctx, pk->x, sizeof(pk->x)) != 1 ||
-	    EVP_DigestUpdate(ctx, pk->y, sizeof(pk->y)) != 1 ||
-	    EVP_DigestFinal_ex(ctx, dgst->ptr, NULL) != 1) {
+	    SHA256_Init(&ctx) != 1 ||
+	    SHA256_Update(&ctx, &zero, sizeof(zero)) != 1 ||
+	    SHA256_Update(&ctx, rp_id, rp_id_len) != 1 ||
+	    SHA256_Update(&ctx, clientdata->ptr, clientdata->len) != 1 ||
+	    SHA256_Update(&ctx, id->ptr, id->len) != 1 ||
+	    SHA256_Update(&ctx, &four, sizeof(four)) != 1 ||
+	    SHA256_Update(&ctx, pk->x, sizeof(pk->x)) != 1 ||
+	    SHA256_Update(&ctx, pk->y, sizeof(pk->y)) != 1 ||
+	    SHA256_Final(dgst->ptr, &ctx) != 1) {
 		fido_log_debug("%s: sha256", __func__);
-		goto fail;
+		return (-1);
 	}
 	dgst->len = SHA256_DIGEST_LENGTH;
 
-	ok = 0;
-fail:
-	EVP_MD_CTX_free(ctx);
-
-	return (ok);
+	return (0);
 }
 
 static int
 verify_attstmt(const fido_blob_t *dgst, const fido_attstmt_t *attstmt)
 {
-	BIO		*rawcert = NULL;
-	X509		*cert = NULL;
 	EVP_PKEY	*pkey = NULL;
 	int		 ok = -1;
 
-	/* openssl needs ints */
-	if (attstmt->x5c.len > INT_MAX) {
-		fido_log_debug("%s: x5c.len=%zu", __func__, attstmt->x5c.len);
-		return (-1);
-	}
-
+	FIDO_PROBE1(attest__start, attstmt->alg);
 	/* fetch key from x509 */
-	if ((rawcert = BIO_new_mem_buf(attstmt->x5c.ptr,
-	    (int)attstmt->x5c.len)) == NULL ||
-	    (cert = d2i_X509_bio(rawcert, NULL)) == NULL ||
-	    (pkey = X509_get_pubkey(cert)) == NULL) {
+	if ((pkey = fido_x5c_pubkey(&attstmt->x5c)) == NULL) {
 		fido_log_debug("%s: x509 key", __func__);
 		goto fail;
 	}
@@ -322,9 +456,8 @@ verify_attstmt(const fido_blob_t *dgst, const fido_attstmt_t *attstmt)
 	}
 
 fail:
-	BIO_free(rawcert);
-	X509_free(cert);
 	EVP_PKEY_free(pkey);
+	FIDO_PROBE2(attest__done, attstmt->alg, ok);
 
 	return (ok);
 }
@@ -355,8 +488,9 @@ fido_cred_verify(const fido_cred_t *cred)
 		goto out;
 	}
 
-	if (fido_check_rp_id(cred->rp.id, cred->authdata.rp_id_hash) != 0) {
-		fido_log_debug("%s: fido_check_rp_id", __func__);
+	if (fido_check_rp_id_hash(cred->rp_id_hash,
+	    cred->authdata.rp_id_hash) != 0) {
+		fido_log_debug("%s: fido_check_rp_id_hash", __func__);
 		r = FIDO_ERR_INVALID_PARAM;
 		goto out;
 	}
@@ -418,6 +552,65 @@ out:
 	return (r);
 }
 
+int
+fido_cred_verify_trust(const fido_cred_t *cred, fido_trust_store_t *ts)
+{
+	int r;
+
+	if (ts == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if ((r = fido_cred_verify(cred)) != FIDO_OK)
+		return (r);
+	if (fido_trust_store_verify(ts, &cred->attstmt.x5c,
+	    &cred->attstmt.x5c_chain) < 0) {
+		fido_log_debug("%s: fido_trust_store_verify", __func__);
+		return (FIDO_ERR_INVALID_SIG);
+	}
+
+	return (FIDO_OK);
+}
+
+int
+fido_cred_export_record(const fido_cred_t *cred, unsigned char **ptr,
+    size_t *len)
+{
+	fido_cred_record_t	*rec;
+	const unsigned char	*pk;
+	size_t			 pk_len, n;
+
+	*ptr = NULL;
+	*len = 0;
+
+	if ((pk = fido_cred_pubkey_ptr(cred)) == NULL ||
+	    cred->attcred.id.ptr == NULL || cred->attcred.id.len > UINT16_MAX) {
+		fido_log_debug("%s: type=%d, id=%p, id_len=%zu", __func__,
+		    cred->attcred.type, (const void *)cred->attcred.id.ptr,
+		    cred->attcred.id.len);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	pk_len = fido_cred_pubkey_len(cred);
+	n = sizeof(*rec) + pk_len + cred->attcred.id.len;
+	if ((rec = fido_calloc(1, n)) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	memcpy(rec->magic, FIDO_CRED_RECORD_MAGIC, sizeof(rec->magic));
+	rec->version = FIDO_CRED_RECORD_VERSION;
+	rec->flags = cred->authdata.flags;
+	rec->pk_len = htobe16((uint16_t)pk_len);
+	rec->type = htobe32((uint32_t)cred->attcred.type);
+	rec->sigcount = htobe32(cred->authdata.sigcount);
+	memcpy(rec->aaguid, cred->attcred.aaguid, sizeof(rec->aaguid));
+	rec->id_len = htobe16((uint16_t)cred->attcred.id.len);
+	memcpy(rec->body, pk, pk_len);
+	memcpy(rec->body + pk_len, cred->attcred.id.ptr, cred->attcred.id.len);
+
+	*ptr = fido_mem_handover(rec, n);
+	*len = n;
+
+	return (FIDO_OK);
+}
+
 int
 fido_cred_verify_self(const fido_cred_t *cred)
 {
@@ -444,8 +637,9 @@ fido_cred_verify_self(const fido_cred_t *cred)
 		goto out;
 	}
 
-	if (fido_check_rp_id(cred->rp.id, cred->authdata.rp_id_hash) != 0) {
-		fido_log_debug("%s: fido_check_rp_id", __func__);
+	if (fido_check_rp_id_hash(cred->rp_id_hash,
+	    cred->authdata.rp_id_hash) != 0) {
+		fido_log_debug("%s: fido_check_rp_id_hash", __func__);
 		r = FIDO_ERR_INVALID_PARAM;
 		goto out;
 	}
@@ -522,7 +716,7 @@ out:
 fido_cred_t *
 fido_cred_new(void)
 {
-	return (calloc(1, sizeof(fido_cred_t)));
+	return (fido_calloc(1, sizeof(fido_cred_t)));
 }
 
 static void
@@ -544,6 +738,7 @@ fido_cred_clean_attstmt(fido_attstmt_t *attstmt)
 	fido_blob_reset(&attstmt->pubarea);
 	fido_blob_reset(&attstmt->cbor);
 	fido_blob_reset(&attstmt->x5c);
+	fido_free_blob_array(&attstmt->x5c_chain);
 	fido_blob_reset(&attstmt->sig);
 
 	memset(attstmt, 0, sizeof(*attstmt));
@@ -557,17 +752,19 @@ fido_cred_reset_tx(fido_cred_t *cred)
 	fido_blob_reset(&cred->user.id);
 	fido_blob_reset(&cred->blob);
 
-	free(cred->rp.id);
-	free(cred->rp.name);
-	free(cred->user.icon);
-	free(cred->user.name);
-	free(cred->user.display_name);
+	fido_free(cred->rp.id);
+	fido_free(cred->rp.name);
+	fido_free(cred->user.icon);
+	fido_free(cred->user.name);
+	fido_free(cred->user.display_name);
 	fido_free_blob_array(&cred->excl);
 
 	memset(&cred->rp, 0, sizeof(cred->rp));
 	memset(&cred->user, 0, sizeof(cred->user));
 	memset(&cred->excl, 0, sizeof(cred->excl));
 	memset(&cred->ext, 0, sizeof(cred->ext));
+	cred->excl_list = NULL;
+	cred->excl_batch = 0;
 
 	cred->type = 0;
 	cred->rk = FIDO_OPT_OMIT;
@@ -577,7 +774,7 @@ fido_cred_reset_tx(fido_cred_t *cred)
 void
 fido_cred_reset_rx(fido_cred_t *cred)
 {
-	free(cred->fmt);
+	fido_free(cred->fmt);
 	cred->fmt = NULL;
 	fido_cred_clean_authdata(cred);
 	fido_cred_clean_attstmt(&cred->attstmt);
@@ -593,7 +790,7 @@ fido_cred_free(fido_cred_t **cred_p)
 		return;
 	fido_cred_reset_tx(cred);
 	fido_cred_reset_rx(cred);
-	free(cred);
+	fido_free(cred);
 	*cred_p = NULL;
 }
 
@@ -640,8 +837,7 @@ int
 fido_cred_set_authdata_raw(fido_cred_t *cred, const unsigned char *ptr,
     size_t len)
 {
-	cbor_item_t	*item = NULL;
-	int		 r = FIDO_ERR_INVALID_ARGUMENT;
+	int r = FIDO_ERR_INVALID_ARGUMENT;
 
 	fido_cred_clean_authdata(cred);
 
@@ -654,23 +850,16 @@ fido_cred_set_authdata_raw(fido_cred_t *cred, const unsigned char *ptr,
 		goto fail;
 	}
 
-	if ((item = cbor_build_bytestring(ptr, len)) == NULL) {
-		fido_log_debug("%s: cbor_build_bytestring", __func__);
-		r = FIDO_ERR_INTERNAL;
-		goto fail;
-	}
-
-	if (cbor_decode_cred_authdata(item, cred->type, &cred->authdata_cbor,
-	    &cred->authdata, &cred->attcred, &cred->authdata_ext) < 0) {
-		fido_log_debug("%s: cbor_decode_cred_authdata", __func__);
+	/* encode and decode straight from ptr, without a libcbor item */
+	if (cbor_decode_cred_authdata_raw(ptr, len, cred->type,
+	    &cred->authdata_cbor, &cred->authdata, &cred->attcred,
+	    &cred->authdata_ext) < 0) {
+		fido_log_debug("%s: cbor_decode_cred_authdata_raw", __func__);
 		goto fail;
 	}
 
 	r = FIDO_OK;
 fail:
-	if (item != NULL)
-		cbor_decref(&item);
-
 	if (r != FIDO_OK)
 		fido_cred_clean_authdata(cred);
 
@@ -695,6 +884,25 @@ fido_cred_set_x509(fido_cred_t *cred, const unsigned char *ptr, size_t len)
 	return (FIDO_OK);
 }
 
+int
+fido_cred_set_x509_borrow(fido_cred_t *cred, const unsigned char *ptr,
+    size_t len)
+{
+	if (fido_blob_borrow(&cred->attstmt.x5c, ptr, len) < 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	return (FIDO_OK);
+}
+
+int
+fido_cred_set_x509_take(fido_cred_t *cred, unsigned char *ptr, size_t len)
+{
+	if (fido_blob_take(&cred->attstmt.x5c, ptr, len) < 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	return (FIDO_OK);
+}
+
 int
 fido_cred_set_sig(fido_cred_t *cred, const unsigned char *ptr, size_t len)
 {
@@ -704,6 +912,25 @@ fido_cred_set_sig(fido_cred_t *cred, const unsigned char *ptr, size_t len)
 	return (FIDO_OK);
 }
 
+int
+fido_cred_set_sig_borrow(fido_cred_t *cred, const unsigned char *ptr,
+    size_t len)
+{
+	if (fido_blob_borrow(&cred->attstmt.sig, ptr, len) < 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	return (FIDO_OK);
+}
+
+int
+fido_cred_set_sig_take(fido_cred_t *cred, unsigned char *ptr, size_t len)
+{
+	if (fido_blob_take(&cred->attstmt.sig, ptr, len) < 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	return (FIDO_OK);
+}
+
 int
 fido_cred_set_attstmt(fido_cred_t *cred, const unsigned char *ptr, size_t len)
 {
@@ -748,14 +975,14 @@ fido_cred_exclude(fido_cred_t *cred, const unsigned char *id_ptr, size_t id_len)
 	if (fido_blob_set(&id_blob, id_ptr, id_len) < 0)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
-	if (cred->excl.len == SIZE_MAX) {
-		free(id_blob.ptr);
+	if (cred->excl.len == SIZE_MAX || cred->excl_list != NULL) {
+		fido_free(id_blob.ptr);
 		return (FIDO_ERR_INVALID_ARGUMENT);
 	}
 
-	if ((list_ptr = recallocarray(cred->excl.ptr, cred->excl.len,
+	if ((list_ptr = fido_recallocarray(cred->excl.ptr, cred->excl.len,
 	    cred->excl.len + 1, sizeof(fido_blob_t))) == NULL) {
-		free(id_blob.ptr);
+		fido_free(id_blob.ptr);
 		return (FIDO_ERR_INTERNAL);
 	}
 
@@ -765,6 +992,20 @@ fido_cred_exclude(fido_cred_t *cred, const unsigned char *id_ptr, size_t id_len)
 	return (FIDO_OK);
 }
 
+int
+fido_cred_set_exclude_list(fido_cred_t *cred, const fido_cred_list_t *l,
+    size_t batch)
+{
+	if (l != NULL && batch >= fido_cred_list_batch_count(l))
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	fido_free_blob_array(&cred->excl);
+	cred->excl_list = l;
+	cred->excl_batch = l != NULL ? batch : 0;
+
+	return (FIDO_OK);
+}
+
 int
 fido_cred_set_clientdata(fido_cred_t *cred, const unsigned char *data,
     size_t data_len)
@@ -781,6 +1022,39 @@ fido_cred_set_clientdata(fido_cred_t *cred, const unsigned char *data,
 	return (FIDO_OK);
 }
 
+/*
+ * As fido_cred_set_clientdata(), once the client data has been checked
+ * against the expected challenge and origin.
+ */
+int
+fido_cred_set_clientdata_checked(fido_cred_t *cred,
+    const unsigned char *data, size_t data_len, const unsigned char *challenge,
+    size_t challenge_len, const char *origin, int flags)
+{
+	unsigned char	cdh[SHA256_DIGEST_LENGTH];
+	fido_blob_t	chal;
+	int		r;
+
+	if (!fido_blob_is_empty(&cred->cdh) || data == NULL ||
+	    data_len == 0 || challenge == NULL || challenge_len == 0 ||
+	    origin == NULL || (flags & ~FIDO_CLIENTDATA_CROSS_ORIGIN) != 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	chal.ptr = (unsigned char *)(uintptr_t)challenge;
+	chal.len = challenge_len;
+	if ((r = fido_json_clientdata(data, data_len, "webauthn.create", &chal,
+	    origin, flags, cdh)) != FIDO_OK)
+		return (r);
+	if (fido_blob_set(&cred->cd, data, data_len) < 0)
+		return (FIDO_ERR_INTERNAL);
+	if (fido_blob_set(&cred->cdh, cdh, sizeof(cdh)) < 0) {
+		fido_blob_reset(&cred->cd);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	return (FIDO_OK);
+}
+
 int
 fido_cred_set_clientdata_hash(fido_cred_t *cred, const unsigned char *hash,
     size_t hash_len)
@@ -798,23 +1072,27 @@ fido_cred_set_rp(fido_cred_t *cred, const char *id, const char *name)
 	fido_rp_t *rp = &cred->rp;
 
 	if (rp->id != NULL) {
-		free(rp->id);
+		fido_free(rp->id);
 		rp->id = NULL;
 	}
 	if (rp->name != NULL) {
-		free(rp->name);
+		fido_free(rp->name);
 		rp->name = NULL;
 	}
 
-	if (id != NULL && (rp->id = strdup(id)) == NULL)
+	explicit_bzero(cred->rp_id_hash, sizeof(cred->rp_id_hash));
+
+	if (id != NULL && ((rp->id = fido_strdup(id)) == NULL ||
+	    SHA256((const unsigned char *)id, strlen(id),
+	    cred->rp_id_hash) != cred->rp_id_hash))
 		goto fail;
-	if (name != NULL && (rp->name = strdup(name)) == NULL)
+	if (name != NULL && (rp->name = fido_strdup(name)) == NULL)
 		goto fail;
 
 	return (FIDO_OK);
 fail:
-	free(rp->id);
-	free(rp->name);
+	fido_free(rp->id);
+	fido_free(rp->name);
 	rp->id = NULL;
 	rp->name = NULL;
 
@@ -829,39 +1107,39 @@ fido_cred_set_user(fido_cred_t *cred, const unsigned char *user_id,
 	fido_user_t *up = &cred->user;
 
 	if (up->id.ptr != NULL) {
-		free(up->id.ptr);
+		fido_free(up->id.ptr);
 		up->id.ptr = NULL;
 		up->id.len = 0;
 	}
 	if (up->name != NULL) {
-		free(up->name);
+		fido_free(up->name);
 		up->name = NULL;
 	}
 	if (up->display_name != NULL) {
-		free(up->display_name);
+		fido_free(up->display_name);
 		up->display_name = NULL;
 	}
 	if (up->icon != NULL) {
-		free(up->icon);
+		fido_free(up->icon);
 		up->icon = NULL;
 	}
 
 	if (user_id != NULL && fido_blob_set(&up->id, user_id, user_id_len) < 0)
 		goto fail;
-	if (name != NULL && (up->name = strdup(name)) == NULL)
+	if (name != NULL && (up->name = fido_strdup(name)) == NULL)
 		goto fail;
 	if (display_name != NULL &&
-	    (up->display_name = strdup(display_name)) == NULL)
+	    (up->display_name = fido_strdup(display_name)) == NULL)
 		goto fail;
-	if (icon != NULL && (up->icon = strdup(icon)) == NULL)
+	if (icon != NULL && (up->icon = fido_strdup(icon)) == NULL)
 		goto fail;
 
 	return (FIDO_OK);
 fail:
-	free(up->id.ptr);
-	free(up->name);
-	free(up->display_name);
-	free(up->icon);
+	fido_free(up->id.ptr);
+	fido_free(up->name);
+	fido_free(up->display_name);
+	fido_free(up->icon);
 
 	up->id.ptr = NULL;
 	up->id.len = 0;
@@ -959,7 +1237,7 @@ fido_cred_set_blob(fido_cred_t *cred, const unsigned char *ptr, size_t len)
 int
 fido_cred_set_fmt(fido_cred_t *cred, const char *fmt)
 {
-	free(cred->fmt);
+	fido_free(cred->fmt);
 	cred->fmt = NULL;
 
 	if (fmt == NULL)
@@ -969,7 +1247,7 @@ fido_cred_set_fmt(fido_cred_t *cred, const char *fmt)
 	    strcmp(fmt, "none") && strcmp(fmt, "tpm"))
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
-	if ((cred->fmt = strdup(fmt)) == NULL)
+	if ((cred->fmt = fido_strdup(fmt)) == NULL)
 		return (FIDO_ERR_INTERNAL);
 
 	return (FIDO_OK);
@@ -1220,3 +1498,90 @@ fido_cred_largeblob_key_len(const fido_cred_t *cred)
 {
 	return (cred->largeblob_key.len);
 }
+
+/*
+ * Sets a credential's attestation object, and its client data, from a
+ * WebAuthn RegistrationResponseJSON. If the credential's type has not been
+ * set, it is taken from the response's publicKeyAlgorithm.
+ */
+int
+fido_cred_from_webauthn_json(fido_cred_t *cred, const char *json,
+    size_t len)
+{
+	fido_blob_t		 type, cd, attobj;
+	int64_t			 alg = 0;
+	fido_json_field_t	 field[] = {
+		{ NULL, "type", FIDO_JSON_STRING, &type, NULL, NULL, NULL,
+		    false },
+		{ "response", "clientDataJSON", FIDO_JSON_B64URL, &cd, NULL,
+		    NULL, NULL, false },
+		{ "response", "attestationObject", FIDO_JSON_B64URL, &attobj,
+		    NULL, NULL, NULL, false },
+		{ "response", "publicKeyAlgorithm", FIDO_JSON_INT, NULL, &alg,
+		    NULL, NULL, false },
+	};
+	cbor_item_t		*item = NULL;
+	struct cbor_load_result	 cbor;
+	bool			 clean = false;
+	int			 r = FIDO_ERR_INVALID_ARGUMENT;
+
+	memset(&type, 0, sizeof(type));
+	memset(&cd, 0, sizeof(cd));
+	memset(&attobj, 0, sizeof(attobj));
+
+	if (fido_json_decode(json, len, field, nitems(field)) < 0 ||
+	    fido_blob_is_empty(&cd) || fido_blob_is_empty(&attobj) ||
+	    !fido_json_public_key(&type)) {
+		fido_log_debug("%s: fido_json_decode", __func__);
+		goto fail;
+	}
+	if (cred->type == 0 && (!field[3].found || alg < INT_MIN ||
+	    alg > INT_MAX || fido_cred_set_type(cred, (int)alg) != FIDO_OK)) {
+		fido_log_debug("%s: publicKeyAlgorithm", __func__);
+		goto fail;
+	}
+	if ((item = cbor_load(attobj.ptr, attobj.len, &cbor)) == NULL) {
+		fido_log_debug("%s: cbor_load", __func__);
+		goto fail;
+	}
+
+	clean = true;
+	fido_cred_clean_authdata(cred);
+	fido_cred_clean_attstmt(&cred->attstmt);
+	fido_free(cred->fmt);
+	cred->fmt = NULL;
+
+	if (cbor_decode_attobj(item, cred) < 0 || cred->fmt == NULL ||
+	    fido_blob_is_empty(&cred->authdata_cbor)) {
+		fido_log_debug("%s: cbor_decode_attobj", __func__);
+		goto fail;
+	}
+
+	fido_blob_reset(&cred->cdh);
+	if (fido_sha256(&cred->cdh, cd.ptr, cd.len) < 0) {
+		fido_log_debug("%s: fido_sha256", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+	fido_blob_reset(&cred->cd);
+	cred->cd = cd;
+	memset(&cd, 0, sizeof(cd));
+
+	r = FIDO_OK;
+fail:
+	if (item != NULL)
+		cbor_decref(&item);
+
+	if (r != FIDO_OK && clean) {
+		fido_cred_clean_authdata(cred);
+		fido_cred_clean_attstmt(&cred->attstmt);
+		fido_free(cred->fmt);
+		cred->fmt = NULL;
+	}
+
+	fido_blob_reset(&type);
+	fido_blob_reset(&cd);
+	fido_blob_reset(&attobj);
+
+	return (r);
+}
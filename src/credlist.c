@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include "fido.h"
+
+/*
+ * A list of credential ids whose PublicKeyCredentialDescriptors are
+ * encoded once, as they are added, and copied into each request the
+ * list is attached to. The descriptors are split into batches the size
+ * an authenticator accepts; ids longer than the authenticator accepts
+ * are left out of every batch.
+ */
+
+fido_cred_list_t *
+fido_cred_list_new(void)
+{
+	return (fido_calloc(1, sizeof(fido_cred_list_t)));
+}
+
+void
+fido_cred_list_free(fido_cred_list_t **l_p)
+{
+	fido_cred_list_t *l;
+
+	if (l_p == NULL || (l = *l_p) == NULL)
+		return;
+	for (size_t i = 0; i < l->id.len; i++)
+		fido_free(l->own[i]);
+	fido_free(l->own);
+	fido_free(l->id.ptr);
+	cbor_writer_reset(&l->enc);
+	fido_free(l->end);
+	fido_free(l->sel);
+	fido_free(l);
+	*l_p = NULL;
+}
+
+/* make room for n more ids */
+static int
+cred_list_grow(fido_cred_list_t *l, size_t n)
+{
+	fido_blob_t	 *id;
+	unsigned char	**own;
+	size_t		 *end, *sel;
+	size_t		  cap;
+
+	if (n <= l->cap - l->id.len)
+		return (0);
+	if (l->cap > SIZE_MAX / 2 / sizeof(*id) ||
+	    n > SIZE_MAX / sizeof(*id) - l->id.len)
+		return (-1);
+	cap = l->cap ? l->cap * 2 : 8;
+	if (cap - l->id.len < n)
+		cap = l->id.len + n;
+
+	if ((id = fido_recallocarray(l->id.ptr, l->cap, cap,
+	    sizeof(*id))) == NULL)
+		return (-1);
+	l->id.ptr = id;
+	if ((own = fido_recallocarray(l->own, l->cap, cap,
+	    sizeof(*own))) == NULL)
+		return (-1);
+	l->own = own;
+	if ((end = fido_recallocarray(l->end, l->cap, cap,
+	    sizeof(*end))) == NULL)
+		return (-1);
+	l->end = end;
+	if ((sel = fido_recallocarray(l->sel, l->cap, cap,
+	    sizeof(*sel))) == NULL)
+		return (-1);
+	l->sel = sel;
+	l->cap = cap;
+
+	return (0);
+}
+
+/* the length of the descriptor cbor_write_pubkey() encodes for an id */
+static size_t
+pubkey_len(size_t len)
+{
+	size_t head;
+
+	if (len < 24)
+		head = 1;
+	else if (len <= UINT8_MAX)
+		head = 2;
+	else if (len <= UINT16_MAX)
+		head = 3;
+	else if ((uint64_t)len <= UINT32_MAX)
+		head = 5;
+	else
+		head = 9;
+
+	/* map(2), "id", bytes, "type", "public-key" */
+	return (1 + 3 + head + len + 5 + 11);
+}
+
+int
+fido_cred_list_add(fido_cred_list_t *l, const unsigned char *ptr, size_t len)
+{
+	fido_blob_t	id;
+	size_t		off;
+
+	memset(&id, 0, sizeof(id));
+
+	if (ptr == NULL || len == 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if (cred_list_grow(l, 1) < 0 || fido_blob_set(&id, ptr, len) < 0) {
+		fido_log_debug("%s: grow/set", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	off = l->enc.off;
+	cbor_write_pubkey(&l->enc, &id);
+	if (l->enc.err) {
+		fido_log_debug("%s: cbor_write_pubkey", __func__);
+		l->enc.off = off;
+		l->enc.err = 0;
+		fido_blob_reset(&id);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	if (l->maxidlen == 0 || len <= l->maxidlen)
+		l->sel[l->nsel++] = l->id.len;
+	l->end[l->id.len] = l->enc.off;
+	l->own[l->id.len] = id.ptr;
+	l->id.ptr[l->id.len++] = id;
+
+	return (FIDO_OK);
+}
+
+/*
+ * Add n ids at once: the list and its encoding are sized for all of
+ * them up front, and the ids are copied into a single allocation or,
+ * with FIDO_CRED_LIST_BORROW, referenced where they are.
+ */
+int
+fido_cred_list_add_array(fido_cred_list_t *l, const unsigned char * const *ptr,
+    const size_t *len, size_t n, int flags)
+{
+	unsigned char	*buf = NULL;
+	fido_blob_t	 id;
+	size_t		 idlen = 0, enclen = 0, off, pos = 0;
+
+	if ((flags & ~FIDO_CRED_LIST_BORROW) != 0 ||
+	    (n > 0 && (ptr == NULL || len == NULL)))
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	for (size_t i = 0; i < n; i++) {
+		if (ptr[i] == NULL || len[i] == 0)
+			return (FIDO_ERR_INVALID_ARGUMENT);
+		if (len[i] > SIZE_MAX / 2 - idlen ||
+		    pubkey_len(len[i]) > SIZE_MAX - enclen) {
+			fido_log_debug("%s: len", __func__);
+			return (FIDO_ERR_INTERNAL);
+		}
+		idlen += len[i];
+		enclen += pubkey_len(len[i]);
+	}
+	if (n == 0)
+		return (FIDO_OK);
+
+	if (cred_list_grow(l, n) < 0 ||
+	    cbor_writer_reserve(&l->enc, enclen) < 0 ||
+	    ((flags & FIDO_CRED_LIST_BORROW) == 0 &&
+	    (buf = fido_malloc(idlen)) == NULL)) {
+		fido_log_debug("%s: grow/reserve/malloc", __func__);
+		l->enc.err = 0;
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	off = l->enc.off;
+	for (size_t i = 0; i < n; i++) {
+		if (buf != NULL) {
+			memcpy(buf + pos, ptr[i], len[i]);
+			id.ptr = buf + pos;
+			pos += len[i];
+		} else
+			id.ptr = (unsigned char *)(uintptr_t)ptr[i];
+		id.len = len[i];
+		cbor_write_pubkey(&l->enc, &id);
+		l->end[l->id.len + i] = l->enc.off;
+		l->id.ptr[l->id.len + i] = id;
+	}
+	if (l->enc.err) {
+		fido_log_debug("%s: cbor_write_pubkey", __func__);
+		l->enc.off = off;
+		l->enc.err = 0;
+		fido_free(buf);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	l->own[l->id.len] = buf;
+	for (size_t i = 0; i < n; i++, l->id.len++)
+		if (l->maxidlen == 0 || len[i] <= l->maxidlen)
+			l->sel[l->nsel++] = l->id.len;
+
+	return (FIDO_OK);
+}
+
+int
+fido_cred_list_split(fido_cred_list_t *l, uint64_t maxcnt, uint64_t maxidlen)
+{
+	if (maxcnt > SIZE_MAX || maxidlen > SIZE_MAX)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	l->maxcnt = (size_t)maxcnt;
+	l->maxidlen = (size_t)maxidlen;
+	l->nsel = 0;
+	for (size_t i = 0; i < l->id.len; i++)
+		if (l->maxidlen == 0 || l->id.ptr[i].len <= l->maxidlen)
+			l->sel[l->nsel++] = i;
+
+	return (FIDO_OK);
+}
+
+size_t
+fido_cred_list_len(const fido_cred_list_t *l)
+{
+	return (l->id.len);
+}
+
+size_t
+fido_cred_list_batch_count(const fido_cred_list_t *l)
+{
+	if (l->nsel == 0)
+		return (0);
+	if (l->maxcnt == 0)
+		return (1);
+
+	return ((l->nsel - 1) / l->maxcnt + 1);
+}
+
+size_t
+fido_cred_list_batch_len(const fido_cred_list_t *l, size_t batch)
+{
+	size_t first, n;
+
+	if (fido_cred_list_batch(l, batch, &first, &n) < 0)
+		return (0);
+
+	return (n);
+}
+
+/* descriptors sel[first] to sel[first + n - 1] make up the batch */
+int
+fido_cred_list_batch(const fido_cred_list_t *l, size_t batch, size_t *first,
+    size_t *n)
+{
+	if (batch >= fido_cred_list_batch_count(l)) {
+		fido_log_debug("%s: batch=%zu", __func__, batch);
+		return (-1);
+	}
+
+	if (l->maxcnt == 0) {
+		*first = 0;
+		*n = l->nsel;
+	} else {
+		*first = batch * l->maxcnt;
+		*n = l->nsel - *first < l->maxcnt ? l->nsel - *first :
+		    l->maxcnt;
+	}
+
+	return (0);
+}
+
+/* copy the ids of a batch, for transports that take them one by one */
+int
+fido_cred_list_expand(const fido_cred_list_t *l, size_t batch,
+    fido_blob_array_t *array)
+{
+	fido_blob_array_t	a;
+	size_t			first, n;
+
+	memset(&a, 0, sizeof(a));
+
+	if (fido_cred_list_batch(l, batch, &first, &n) < 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if ((a.ptr = fido_calloc(n, sizeof(*a.ptr))) == NULL)
+		return (FIDO_ERR_INTERNAL);
+	for (size_t i = 0; i < n; i++) {
+		if (fido_blob_set(&a.ptr[i], l->id.ptr[l->sel[first + i]].ptr,
+		    l->id.ptr[l->sel[first + i]].len) < 0) {
+			fido_free_blob_array(&a);
+			return (FIDO_ERR_INTERNAL);
+		}
+		a.len++;
+	}
+
+	fido_free_blob_array(array);
+	*array = a;
+
+	return (FIDO_OK);
+}
@@ -42,7 +42,8 @@ credman_grow_array(void **ptr, size_t *n_alloc, const size_t *n_rx, size_t n,
 		return (-1);
 	}
 
-	if ((new_ptr = recallocarray(*ptr, *n_alloc, n, size)) == NULL)
+	if ((new_ptr = fido_recallocarray_as(FIDO_MEM_CREDMAN, *ptr, *n_alloc,
+	    n, size)) == NULL)
 		return (-1);
 
 	*ptr = new_ptr;
@@ -116,9 +117,7 @@ credman_tx(fido_dev_t *dev, uint8_t subcmd, const void *param, const char *pin,
     const char *rp_id, fido_opt_t uv, int *ms)
 {
 	fido_blob_t	 f;
-	fido_blob_t	*ecdh = NULL;
 	fido_blob_t	 hmac;
-	es256_pk_t	*pk = NULL;
 	cbor_item_t	*argv[4];
 	const uint8_t	 cmd = CTAP_CBOR_CRED_MGMT_PRE;
 	int		 r = FIDO_ERR_INTERNAL;
@@ -145,11 +144,7 @@ credman_tx(fido_dev_t *dev, uint8_t subcmd, const void *param, const char *pin,
 			fido_log_debug("%s: credman_prepare_hmac", __func__);
 			goto fail;
 		}
-		if ((r = fido_do_ecdh(dev, &pk, &ecdh, ms)) != FIDO_OK) {
-			fido_log_debug("%s: fido_do_ecdh", __func__);
-			goto fail;
-		}
-		if ((r = cbor_add_uv_params(dev, cmd, &hmac, pk, ecdh, pin,
+		if ((r = cbor_add_uv_params(dev, cmd, &hmac, NULL, NULL, pin,
 		    rp_id, &argv[3], &argv[2], ms)) != FIDO_OK) {
 			fido_log_debug("%s: cbor_add_uv_params", __func__);
 			goto fail;
@@ -166,11 +161,9 @@ credman_tx(fido_dev_t *dev, uint8_t subcmd, const void *param, const char *pin,
 
 	r = FIDO_OK;
 fail:
-	es256_pk_free(&pk);
-	fido_blob_free(&ecdh);
 	cbor_vector_free(argv, nitems(argv));
-	free(f.ptr);
-	free(hmac.ptr);
+	fido_free(f.ptr);
+	fido_free(hmac.ptr);
 
 	return (r);
 }
@@ -202,17 +195,18 @@ static int
 credman_rx_metadata(fido_dev_t *dev, fido_credman_metadata_t *metadata, int *ms)
 {
 	unsigned char	*msg;
+	size_t		 msgsiz;
 	int		 msglen;
 	int		 r;
 
 	memset(metadata, 0, sizeof(*metadata));
 
-	if ((msg = malloc(FIDO_MAXMSG)) == NULL) {
+	if ((msg = fido_rx_buf_get(dev, FIDO_MAXMSG, &msgsiz)) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto out;
 	}
 
-	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, FIDO_MAXMSG, ms)) < 0) {
+	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, msgsiz, ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
 		r = FIDO_ERR_RX;
 		goto out;
@@ -226,7 +220,7 @@ credman_rx_metadata(fido_dev_t *dev, fido_credman_metadata_t *metadata, int *ms)
 
 	r = FIDO_OK;
 out:
-	freezero(msg, FIDO_MAXMSG);
+	fido_rx_buf_put(dev, msg, msgsiz);
 
 	return (r);
 }
@@ -249,47 +243,97 @@ int
 fido_credman_get_dev_metadata(fido_dev_t *dev, fido_credman_metadata_t *metadata,
     const char *pin)
 {
-	int ms = dev->timeout_ms;
+	fido_trace_span_t	span;
+	fido_blob_t		shared;
+	int			ms = dev->timeout_ms;
+	bool			lead;
+	int			r;
+
+	memset(&shared, 0, sizeof(shared));
+
+	/* share the counts with threads asking with the same pin */
+	if (fido_sched_join(dev, FIDO_SCHED_METADATA, pin, &shared, &r,
+	    &lead)) {
+		if (r == FIDO_OK && shared.len != sizeof(*metadata))
+			r = FIDO_ERR_INTERNAL;
+		if (r == FIDO_OK)
+			memcpy(metadata, shared.ptr, sizeof(*metadata));
+		fido_blob_reset(&shared);
+		return (r);
+	}
+
+	fido_sched_enter(dev);
+	fido_trace_span_begin(dev, &span, FIDO_SPAN_CREDMAN);
+	do
+		r = credman_get_metadata_wait(dev, metadata, pin, &ms);
+	while (fido_dev_uv_token_retry(dev, r));
+	if (lead)
+		fido_sched_publish(dev, FIDO_SCHED_METADATA,
+		    (const unsigned char *)metadata, sizeof(*metadata), r);
+	fido_trace_span_end(dev, &span, r);
+	fido_sched_leave(dev);
+
+	return (r);
+}
+
+static int
+credman_decode_rk_user(const cbor_item_t *val, void *arg)
+{
+	fido_cred_t *cred = arg;
 
-	return (credman_get_metadata_wait(dev, metadata, pin, &ms));
+	return (cbor_decode_user(val, &cred->user));
 }
 
 static int
-credman_parse_rk(const cbor_item_t *key, const cbor_item_t *val, void *arg)
+credman_decode_rk_id(const cbor_item_t *val, void *arg)
+{
+	fido_cred_t *cred = arg;
+
+	return (cbor_decode_cred_id(val, NULL, &cred->attcred.id));
+}
+
+static int
+credman_decode_rk_pubkey(const cbor_item_t *val, void *arg)
+{
+	fido_cred_t *cred = arg;
+
+	if (cbor_decode_pubkey(val, &cred->attcred.type,
+	    &cred->attcred.pubkey) < 0)
+		return (-1);
+	cred->type = cred->attcred.type; /* XXX */
+
+	return (0);
+}
+
+static int
+credman_decode_rk_prot(const cbor_item_t *val, void *arg)
 {
 	fido_cred_t	*cred = arg;
 	uint64_t	 prot;
 
-	if (cbor_isa_uint(key) == false ||
-	    cbor_int_get_width(key) != CBOR_INT_8) {
-		fido_log_debug("%s: cbor type", __func__);
-		return (0); /* ignore */
-	}
+	if (cbor_decode_uint64(val, &prot) < 0 || prot > INT_MAX ||
+	    fido_cred_set_prot(cred, (int)prot) != FIDO_OK)
+		return (-1);
 
-	switch (cbor_get_uint8(key)) {
-	case 6:
-		return (cbor_decode_user(val, &cred->user));
-	case 7:
-		return (cbor_decode_cred_id(val, &cred->attcred.id));
-	case 8:
-		if (cbor_decode_pubkey(val, &cred->attcred.type,
-		    &cred->attcred.pubkey) < 0)
-			return (-1);
-		cred->type = cred->attcred.type; /* XXX */
-		return (0);
-	case 10:
-		if (cbor_decode_uint64(val, &prot) < 0 || prot > INT_MAX ||
-		    fido_cred_set_prot(cred, (int)prot) != FIDO_OK)
-			return (-1);
-		return (0);
-	case 11:
-		return (fido_blob_decode(val, &cred->largeblob_key));
-	default:
-		fido_log_debug("%s: cbor type", __func__);
-		return (0); /* ignore */
-	}
+	return (0);
 }
 
+static int
+credman_decode_rk_largeblob_key(const cbor_item_t *val, void *arg)
+{
+	fido_cred_t *cred = arg;
+
+	return (fido_blob_decode(val, &cred->largeblob_key));
+}
+
+static const cbor_key_decoder_t credman_rk_reply[] = {
+	{ 6, credman_decode_rk_user },		/* user */
+	{ 7, credman_decode_rk_id },		/* credentialID */
+	{ 8, credman_decode_rk_pubkey },	/* publicKey */
+	{ 10, credman_decode_rk_prot },		/* credProtect */
+	{ 11, credman_decode_rk_largeblob_key },	/* largeBlobKey */
+};
+
 static void
 credman_reset_rk(fido_credman_rk_t *rk)
 {
@@ -298,26 +342,17 @@ credman_reset_rk(fido_credman_rk_t *rk)
 		fido_cred_reset_rx(&rk->ptr[i]);
 	}
 
-	free(rk->ptr);
-	rk->ptr = NULL;
+	fido_free(rk->ptr);
+	fido_free(rk->rp_idx);
 	memset(rk, 0, sizeof(*rk));
 }
 
 static int
-credman_parse_rk_count(const cbor_item_t *key, const cbor_item_t *val,
-    void *arg)
+credman_parse_rk_count(const cbor_item_t *val, void *arg)
 {
 	fido_credman_rk_t *rk = arg;
 	uint64_t n;
 
-	/* totalCredentials */
-	if (cbor_isa_uint(key) == false ||
-	    cbor_int_get_width(key) != CBOR_INT_8 ||
-	    cbor_get_uint8(key) != 9) {
-		fido_log_debug("%s: cbor_type", __func__);
-		return (0); /* ignore */
-	}
-
 	if (cbor_decode_uint64(val, &n) < 0 || n > SIZE_MAX) {
 		fido_log_debug("%s: cbor_decode_uint64", __func__);
 		return (-1);
@@ -332,29 +367,36 @@ credman_parse_rk_count(const cbor_item_t *key, const cbor_item_t *val,
 	return (0);
 }
 
+static const cbor_key_decoder_t credman_rk_count_reply[] = {
+	{ 9, credman_parse_rk_count },	/* totalCredentials */
+};
+
+/* msg is a buffer of msgsiz bytes owned by the caller */
 static int
-credman_rx_rk(fido_dev_t *dev, fido_credman_rk_t *rk, int *ms)
+credman_rx_rk(fido_dev_t *dev, unsigned char *msg, size_t msgsiz,
+    fido_credman_rk_t *rk, int *ms)
 {
-	unsigned char	*msg;
+	cbor_item_t	*item = NULL;
 	int		 msglen;
 	int		 r;
 
 	credman_reset_rk(rk);
 
-	if ((msg = malloc(FIDO_MAXMSG)) == NULL) {
-		r = FIDO_ERR_INTERNAL;
+	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, msgsiz, ms)) < 0) {
+		fido_log_debug("%s: fido_rx", __func__);
+		r = FIDO_ERR_RX;
 		goto out;
 	}
 
-	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, FIDO_MAXMSG, ms)) < 0) {
-		fido_log_debug("%s: fido_rx", __func__);
-		r = FIDO_ERR_RX;
+	/* decode the reply once; it carries the count and the first rk */
+	if ((r = cbor_load_reply(msg, (size_t)msglen, &item)) != FIDO_OK) {
+		fido_log_debug("%s: cbor_load_reply", __func__);
 		goto out;
 	}
 
 	/* adjust as needed */
-	if ((r = cbor_parse_reply(msg, (size_t)msglen, rk,
-	    credman_parse_rk_count)) != FIDO_OK) {
+	if ((r = cbor_parse_reply_item_keys(item, rk, credman_rk_count_reply,
+	    nitems(credman_rk_count_reply))) != FIDO_OK) {
 		fido_log_debug("%s: credman_parse_rk_count", __func__);
 		goto out;
 	}
@@ -366,55 +408,107 @@ credman_rx_rk(fido_dev_t *dev, fido_credman_rk_t *rk, int *ms)
 	}
 
 	/* parse the first rk */
-	if ((r = cbor_parse_reply(msg, (size_t)msglen, &rk->ptr[0],
-	    credman_parse_rk)) != FIDO_OK) {
-		fido_log_debug("%s: credman_parse_rk", __func__);
+	if ((r = cbor_parse_reply_item_keys(item, &rk->ptr[0],
+	    credman_rk_reply, nitems(credman_rk_reply))) != FIDO_OK) {
+		fido_log_debug("%s: cbor_parse_reply_item_keys", __func__);
 		goto out;
 	}
 	rk->n_rx = 1;
 
 	r = FIDO_OK;
 out:
-	freezero(msg, FIDO_MAXMSG);
+	if (item != NULL)
+		cbor_decref(&item);
 
 	return (r);
 }
 
+/* msg is a buffer of msgsiz bytes owned by the caller */
 static int
-credman_rx_next_rk(fido_dev_t *dev, fido_credman_rk_t *rk, int *ms)
+credman_rx_next_rk(fido_dev_t *dev, unsigned char *msg, size_t msgsiz,
+    fido_credman_rk_t *rk, int *ms)
 {
-	unsigned char	*msg;
-	int		 msglen;
-	int		 r;
-
-	if ((msg = malloc(FIDO_MAXMSG)) == NULL) {
-		r = FIDO_ERR_INTERNAL;
-		goto out;
-	}
+	int msglen;
+	int r;
 
-	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, FIDO_MAXMSG, ms)) < 0) {
+	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, msgsiz, ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		r = FIDO_ERR_RX;
-		goto out;
+		return (FIDO_ERR_RX);
 	}
 
 	/* sanity check */
 	if (rk->n_rx >= rk->n_alloc) {
 		fido_log_debug("%s: n_rx=%zu, n_alloc=%zu", __func__, rk->n_rx,
 		    rk->n_alloc);
-		r = FIDO_ERR_INTERNAL;
-		goto out;
+		return (FIDO_ERR_INTERNAL);
 	}
 
-	if ((r = cbor_parse_reply(msg, (size_t)msglen, &rk->ptr[rk->n_rx],
-	    credman_parse_rk)) != FIDO_OK) {
-		fido_log_debug("%s: credman_parse_rk", __func__);
+	if ((r = cbor_parse_reply_keys(msg, (size_t)msglen,
+	    &rk->ptr[rk->n_rx], credman_rk_reply,
+	    nitems(credman_rk_reply))) != FIDO_OK) {
+		fido_log_debug("%s: cbor_parse_reply_keys", __func__);
+		return (r);
+	}
+
+	return (FIDO_OK);
+}
+
+static bool
+credman_same_cred(const fido_cred_t *a, const fido_cred_t *b)
+{
+	return (a->attcred.id.len != 0 &&
+	    a->attcred.id.len == b->attcred.id.len &&
+	    memcmp(a->attcred.id.ptr, b->attcred.id.ptr, a->attcred.id.len) == 0);
+}
+
+/*
+ * Enumerate the rks of the rp whose id hash is rp_dgst. If old is not NULL
+ * and the authenticator reports as many rks as old holds, starting with
+ * the same credential, the walk stops there and *reused is set; rk then
+ * holds the first rk only, and old is to be used instead.
+ */
+static int
+credman_get_rk_hash(fido_dev_t *dev, fido_blob_t *rp_dgst, const char *rp_id,
+    fido_credman_rk_t *rk, const fido_credman_rk_t *old, bool *reused,
+    const char *pin, int *ms)
+{
+	unsigned char	*msg;
+	size_t		 msgsiz;
+	int		 r;
+
+	if (reused != NULL)
+		*reused = false;
+
+	if ((r = credman_tx(dev, CMD_RK_BEGIN, rp_dgst, pin, rp_id,
+	    FIDO_OPT_TRUE, ms)) != FIDO_OK)
+		return (r);
+
+	/* one receive buffer for the whole enumeration */
+	if ((msg = fido_rx_buf_get(dev, FIDO_MAXMSG, &msgsiz)) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	if ((r = credman_rx_rk(dev, msg, msgsiz, rk, ms)) != FIDO_OK)
 		goto out;
+
+	if (old != NULL && reused != NULL && rk->n_alloc == old->n_rx &&
+	    (rk->n_rx == 0 || credman_same_cred(&rk->ptr[0], &old->ptr[0]))) {
+		*reused = true;
+		r = FIDO_OK;
+		goto out;
+	}
+
+	while (rk->n_rx < rk->n_alloc) {
+		if ((r = credman_tx(dev, CMD_RK_NEXT, NULL, NULL, NULL,
+		    FIDO_OPT_FALSE, ms)) != FIDO_OK ||
+		    (r = credman_rx_next_rk(dev, msg, msgsiz, rk,
+		    ms)) != FIDO_OK)
+			goto out;
+		rk->n_rx++;
 	}
 
 	r = FIDO_OK;
 out:
-	freezero(msg, FIDO_MAXMSG);
+	fido_rx_buf_put(dev, msg, msgsiz);
 
 	return (r);
 }
@@ -423,9 +517,8 @@ static int
 credman_get_rk_wait(fido_dev_t *dev, const char *rp_id, fido_credman_rk_t *rk,
     const char *pin, int *ms)
 {
-	fido_blob_t	rp_dgst;
-	uint8_t		dgst[SHA256_DIGEST_LENGTH];
-	int		r;
+	fido_blob_t	 rp_dgst;
+	uint8_t		 dgst[SHA256_DIGEST_LENGTH];
 
 	if (SHA256((const unsigned char *)rp_id, strlen(rp_id), dgst) != dgst) {
 		fido_log_debug("%s: sha256", __func__);
@@ -435,29 +528,27 @@ credman_get_rk_wait(fido_dev_t *dev, const char *rp_id, fido_credman_rk_t *rk,
 	rp_dgst.ptr = dgst;
 	rp_dgst.len = sizeof(dgst);
 
-	if ((r = credman_tx(dev, CMD_RK_BEGIN, &rp_dgst, pin, rp_id,
-	    FIDO_OPT_TRUE, ms)) != FIDO_OK ||
-	    (r = credman_rx_rk(dev, rk, ms)) != FIDO_OK)
-		return (r);
-
-	while (rk->n_rx < rk->n_alloc) {
-		if ((r = credman_tx(dev, CMD_RK_NEXT, NULL, NULL, NULL,
-		    FIDO_OPT_FALSE, ms)) != FIDO_OK ||
-		    (r = credman_rx_next_rk(dev, rk, ms)) != FIDO_OK)
-			return (r);
-		rk->n_rx++;
-	}
-
-	return (FIDO_OK);
+	return (credman_get_rk_hash(dev, &rp_dgst, rp_id, rk, NULL, NULL, pin,
+	    ms));
 }
 
 int
 fido_credman_get_dev_rk(fido_dev_t *dev, const char *rp_id,
     fido_credman_rk_t *rk, const char *pin)
 {
+	fido_trace_span_t span;
 	int ms = dev->timeout_ms;
+	int r;
 
-	return (credman_get_rk_wait(dev, rp_id, rk, pin, &ms));
+	fido_sched_enter(dev);
+	fido_trace_span_begin(dev, &span, FIDO_SPAN_CREDMAN);
+	do
+		r = credman_get_rk_wait(dev, rp_id, rk, pin, &ms);
+	while (fido_dev_uv_token_retry(dev, r));
+	fido_trace_span_end(dev, &span, r);
+	fido_sched_leave(dev);
+
+	return (r);
 }
 
 static int
@@ -479,7 +570,7 @@ credman_del_rk_wait(fido_dev_t *dev, const unsigned char *cred_id,
 
 	r = FIDO_OK;
 fail:
-	free(cred.ptr);
+	fido_free(cred.ptr);
 
 	return (r);
 }
@@ -488,9 +579,85 @@ int
 fido_credman_del_dev_rk(fido_dev_t *dev, const unsigned char *cred_id,
     size_t cred_id_len, const char *pin)
 {
+	fido_trace_span_t span;
 	int ms = dev->timeout_ms;
+	int r;
+
+	fido_sched_enter(dev);
+	fido_trace_span_begin(dev, &span, FIDO_SPAN_CREDMAN);
+	do
+		r = credman_del_rk_wait(dev, cred_id, cred_id_len, pin, &ms);
+	while (fido_dev_uv_token_retry(dev, r));
+	fido_trace_span_end(dev, &span, r);
+	fido_sched_leave(dev);
+
+	return (r);
+}
+
+/*
+ * Delete n credentials with one pinUvAuthToken. A credential that is not
+ * found does not end the batch; any other error, which may come from the
+ * pin, does, and the remaining credentials are marked with it.
+ */
+static int
+credman_del_rk_batch(fido_dev_t *dev, const unsigned char * const *cred_id,
+    const size_t *cred_id_len, size_t n, int *result, const char *pin,
+    int *ms)
+{
+	int r, first = FIDO_OK;
+
+	for (size_t i = 0; i < n; i++) {
+		do
+			r = credman_del_rk_wait(dev, cred_id[i], cred_id_len[i],
+			    pin, ms);
+		while (fido_dev_uv_token_retry(dev, r));
+		if (r != FIDO_OK) {
+			fido_log_debug("%s: %zu: r=%d", __func__, i, r);
+			if (first == FIDO_OK)
+				first = r;
+		}
+		if (result != NULL)
+			result[i] = r;
+		if (r != FIDO_OK && r != FIDO_ERR_NO_CREDENTIALS) {
+			for (size_t j = i + 1; result != NULL && j < n; j++)
+				result[j] = r;
+			break;
+		}
+	}
+
+	return (first);
+}
+
+int
+fido_credman_del_dev_rk_batch(fido_dev_t *dev,
+    const unsigned char * const *cred_id, const size_t *cred_id_len,
+    size_t n, int *result, const char *pin)
+{
+	fido_trace_span_t	span;
+	int			ms = dev->timeout_ms;
+	bool			scoped;
+	int			r;
+
+	if (n > 0 && (cred_id == NULL || cred_id_len == NULL))
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	fido_sched_enter(dev);
+	fido_trace_span_begin(dev, &span, FIDO_SPAN_CREDMAN);
+	/* obtain one token for the whole batch, even if caching is off */
+	if ((scoped = dev->uv_cache == NULL) &&
+	    (r = fido_dev_set_uv_token_cache(dev, true)) != FIDO_OK)
+		goto out;
 
-	return (credman_del_rk_wait(dev, cred_id, cred_id_len, pin, &ms));
+	r = credman_del_rk_batch(dev, cred_id, cred_id_len, n, result, pin,
+	    &ms);
+
+	if (scoped)
+		fido_dev_uv_cache_free(dev);
+out:
+	fido_trace_span_end(dev, &span, r);
+	fido_sched_leave(dev);
+
+	return (r);
 }
 
 static int
@@ -519,14 +686,14 @@ static void
 credman_reset_rp(fido_credman_rp_t *rp)
 {
 	for (size_t i = 0; i < rp->n_alloc; i++) {
-		free(rp->ptr[i].rp_entity.id);
-		free(rp->ptr[i].rp_entity.name);
+		fido_free(rp->ptr[i].rp_entity.id);
+		fido_free(rp->ptr[i].rp_entity.name);
 		rp->ptr[i].rp_entity.id = NULL;
 		rp->ptr[i].rp_entity.name = NULL;
 		fido_blob_reset(&rp->ptr[i].rp_id_hash);
 	}
 
-	free(rp->ptr);
+	fido_free(rp->ptr);
 	rp->ptr = NULL;
 	memset(rp, 0, sizeof(*rp));
 }
@@ -560,28 +727,31 @@ credman_parse_rp_count(const cbor_item_t *key, const cbor_item_t *val,
 	return (0);
 }
 
+/* msg is a buffer of msgsiz bytes owned by the caller */
 static int
-credman_rx_rp(fido_dev_t *dev, fido_credman_rp_t *rp, int *ms)
+credman_rx_rp(fido_dev_t *dev, unsigned char *msg, size_t msgsiz,
+    fido_credman_rp_t *rp, int *ms)
 {
-	unsigned char	*msg;
+	cbor_item_t	*item = NULL;
 	int		 msglen;
 	int		 r;
 
 	credman_reset_rp(rp);
 
-	if ((msg = malloc(FIDO_MAXMSG)) == NULL) {
-		r = FIDO_ERR_INTERNAL;
+	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, msgsiz, ms)) < 0) {
+		fido_log_debug("%s: fido_rx", __func__);
+		r = FIDO_ERR_RX;
 		goto out;
 	}
 
-	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, FIDO_MAXMSG, ms)) < 0) {
-		fido_log_debug("%s: fido_rx", __func__);
-		r = FIDO_ERR_RX;
+	/* decode the reply once; it carries the count and the first rp */
+	if ((r = cbor_load_reply(msg, (size_t)msglen, &item)) != FIDO_OK) {
+		fido_log_debug("%s: cbor_load_reply", __func__);
 		goto out;
 	}
 
 	/* adjust as needed */
-	if ((r = cbor_parse_reply(msg, (size_t)msglen, rp,
+	if ((r = cbor_parse_reply_item(item, rp,
 	    credman_parse_rp_count)) != FIDO_OK) {
 		fido_log_debug("%s: credman_parse_rp_count", __func__);
 		goto out;
@@ -594,7 +764,7 @@ credman_rx_rp(fido_dev_t *dev, fido_credman_rp_t *rp, int *ms)
 	}
 
 	/* parse the first rp */
-	if ((r = cbor_parse_reply(msg, (size_t)msglen, &rp->ptr[0],
+	if ((r = cbor_parse_reply_item(item, &rp->ptr[0],
 	    credman_parse_rp)) != FIDO_OK) {
 		fido_log_debug("%s: credman_parse_rp", __func__);
 		goto out;
@@ -603,78 +773,221 @@ credman_rx_rp(fido_dev_t *dev, fido_credman_rp_t *rp, int *ms)
 
 	r = FIDO_OK;
 out:
-	freezero(msg, FIDO_MAXMSG);
+	if (item != NULL)
+		cbor_decref(&item);
 
 	return (r);
 }
 
+/* msg is a buffer of msgsiz bytes owned by the caller */
 static int
-credman_rx_next_rp(fido_dev_t *dev, fido_credman_rp_t *rp, int *ms)
+credman_rx_next_rp(fido_dev_t *dev, unsigned char *msg, size_t msgsiz,
+    fido_credman_rp_t *rp, int *ms)
 {
-	unsigned char	*msg;
-	int		 msglen;
-	int		 r;
-
-	if ((msg = malloc(FIDO_MAXMSG)) == NULL) {
-		r = FIDO_ERR_INTERNAL;
-		goto out;
-	}
+	int msglen;
+	int r;
 
-	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, FIDO_MAXMSG, ms)) < 0) {
+	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, msgsiz, ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		r = FIDO_ERR_RX;
-		goto out;
+		return (FIDO_ERR_RX);
 	}
 
 	/* sanity check */
 	if (rp->n_rx >= rp->n_alloc) {
 		fido_log_debug("%s: n_rx=%zu, n_alloc=%zu", __func__, rp->n_rx,
 		    rp->n_alloc);
-		r = FIDO_ERR_INTERNAL;
-		goto out;
+		return (FIDO_ERR_INTERNAL);
 	}
 
 	if ((r = cbor_parse_reply(msg, (size_t)msglen, &rp->ptr[rp->n_rx],
 	    credman_parse_rp)) != FIDO_OK) {
 		fido_log_debug("%s: credman_parse_rp", __func__);
-		goto out;
+		return (r);
 	}
 
-	r = FIDO_OK;
-out:
-	freezero(msg, FIDO_MAXMSG);
-
-	return (r);
+	return (FIDO_OK);
 }
 
 static int
 credman_get_rp_wait(fido_dev_t *dev, fido_credman_rp_t *rp, const char *pin,
     int *ms)
 {
-	int r;
+	unsigned char	*msg;
+	size_t		 msgsiz;
+	int		 r;
 
 	if ((r = credman_tx(dev, CMD_RP_BEGIN, NULL, pin, NULL,
-	    FIDO_OPT_TRUE, ms)) != FIDO_OK ||
-	    (r = credman_rx_rp(dev, rp, ms)) != FIDO_OK)
+	    FIDO_OPT_TRUE, ms)) != FIDO_OK)
 		return (r);
 
+	/* one receive buffer for the whole enumeration */
+	if ((msg = fido_rx_buf_get(dev, FIDO_MAXMSG, &msgsiz)) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	if ((r = credman_rx_rp(dev, msg, msgsiz, rp, ms)) != FIDO_OK)
+		goto out;
+
 	while (rp->n_rx < rp->n_alloc) {
 		if ((r = credman_tx(dev, CMD_RP_NEXT, NULL, NULL, NULL,
 		    FIDO_OPT_FALSE, ms)) != FIDO_OK ||
-		    (r = credman_rx_next_rp(dev, rp, ms)) != FIDO_OK)
-			return (r);
+		    (r = credman_rx_next_rp(dev, msg, msgsiz, rp,
+		    ms)) != FIDO_OK)
+			goto out;
 		rp->n_rx++;
 	}
 
-	return (FIDO_OK);
+	r = FIDO_OK;
+out:
+	fido_rx_buf_put(dev, msg, msgsiz);
+
+	return (r);
 }
 
 int
 fido_credman_get_dev_rp(fido_dev_t *dev, fido_credman_rp_t *rp, const char *pin)
 {
+	fido_trace_span_t span;
 	int ms = dev->timeout_ms;
+	int r;
 
-	return (credman_get_rp_wait(dev, rp, pin, &ms));
+	fido_sched_enter(dev);
+	fido_trace_span_begin(dev, &span, FIDO_SPAN_CREDMAN);
+	do
+		r = credman_get_rp_wait(dev, rp, pin, &ms);
+	while (fido_dev_uv_token_retry(dev, r));
+	fido_trace_span_end(dev, &span, r);
+	fido_sched_leave(dev);
+
+	return (r);
+}
+
+/* make room for at least n rks in all, growing geometrically */
+static int
+credman_reserve_rk(fido_credman_rk_t *all, size_t n)
+{
+	fido_cred_t	*ptr;
+	size_t		*rp_idx;
+	size_t		 cap;
+
+	if (n <= all->n_alloc)
+		return (0);
+
+	for (cap = all->n_alloc < 8 ? 8 : all->n_alloc; cap < n; cap *= 2)
+		if (cap > SIZE_MAX / 2) {
+			cap = n;
+			break;
+		}
+
+	/* rp_idx and ptr always have n_alloc entries */
+	if ((rp_idx = fido_recallocarray_as(FIDO_MEM_CREDMAN, all->rp_idx,
+	    all->n_alloc, cap, sizeof(*rp_idx))) == NULL)
+		return (-1);
+	all->rp_idx = rp_idx;
+	if ((ptr = fido_recallocarray_as(FIDO_MEM_CREDMAN, all->ptr,
+	    all->n_alloc, cap, sizeof(*ptr))) == NULL)
+		return (-1);
+	all->ptr = ptr;
+	all->n_alloc = cap;
+
+	return (0);
+}
+
+/* move the rks of rp idx from rk to the end of all */
+static int
+credman_append_rk(fido_credman_rk_t *all, fido_credman_rk_t *rk, size_t idx)
+{
+	size_t n;
+
+	if (rk->n_rx == 0)
+		return (0);
+	if (SIZE_MAX - all->n_rx < rk->n_rx ||
+	    credman_reserve_rk(all, all->n_rx + rk->n_rx) < 0)
+		return (-1);
+
+	n = all->n_rx + rk->n_rx;
+	memcpy(&all->ptr[all->n_rx], rk->ptr, rk->n_rx * sizeof(*rk->ptr));
+	memset(rk->ptr, 0, rk->n_rx * sizeof(*rk->ptr));
+	for (size_t i = all->n_rx; i < n; i++)
+		all->rp_idx[i] = idx;
+	all->n_rx = n;
+
+	return (0);
+}
+
+static int
+credman_get_all_rk_wait(fido_dev_t *dev, fido_credman_rp_t *rp,
+    fido_credman_rk_t *rk, const char *pin, int *ms)
+{
+	fido_credman_rk_t	one;
+	int			r;
+
+	memset(&one, 0, sizeof(one));
+	credman_reset_rk(rk);
+
+	if ((r = credman_get_rp_wait(dev, rp, pin, ms)) != FIDO_OK) {
+		fido_log_debug("%s: credman_get_rp_wait", __func__);
+		return (r);
+	}
+
+	/* every rp listed has at least one rk */
+	if (credman_reserve_rk(rk, rp->n_rx) < 0) {
+		fido_log_debug("%s: credman_reserve_rk", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	/* no rp_id; the token is not bound to a single rp */
+	for (size_t i = 0; i < rp->n_rx; i++) {
+		/* each rp's walk stands alone */
+		fido_sched_yield(dev);
+		if ((r = credman_get_rk_hash(dev, &rp->ptr[i].rp_id_hash, NULL,
+		    &one, NULL, NULL, pin, ms)) != FIDO_OK) {
+			fido_log_debug("%s: credman_get_rk_hash", __func__);
+			goto fail;
+		}
+		if (credman_append_rk(rk, &one, i) < 0) {
+			fido_log_debug("%s: credman_append_rk", __func__);
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+		credman_reset_rk(&one);
+	}
+
+	r = FIDO_OK;
+fail:
+	credman_reset_rk(&one);
+	if (r != FIDO_OK)
+		credman_reset_rk(rk);
+
+	return (r);
+}
+
+int
+fido_credman_get_dev_all_rk(fido_dev_t *dev, fido_credman_rp_t *rp,
+    fido_credman_rk_t *rk, const char *pin)
+{
+	fido_trace_span_t	span;
+	int			ms = dev->timeout_ms;
+	bool			scoped;
+	int			r;
+
+	fido_sched_enter(dev);
+	fido_trace_span_begin(dev, &span, FIDO_SPAN_CREDMAN);
+	/* obtain one token for the whole walk, even if caching is off */
+	if ((scoped = dev->uv_cache == NULL) &&
+	    (r = fido_dev_set_uv_token_cache(dev, true)) != FIDO_OK)
+		goto out;
+
+	do
+		r = credman_get_all_rk_wait(dev, rp, rk, pin, &ms);
+	while (fido_dev_uv_token_retry(dev, r));
+
+	if (scoped)
+		fido_dev_uv_cache_free(dev);
+out:
+	fido_trace_span_end(dev, &span, r);
+	fido_sched_leave(dev);
+
+	return (r);
 }
 
 static int
@@ -694,15 +1007,90 @@ credman_set_dev_rk_wait(fido_dev_t *dev, fido_cred_t *cred, const char *pin,
 int
 fido_credman_set_dev_rk(fido_dev_t *dev, fido_cred_t *cred, const char *pin)
 {
+	fido_trace_span_t span;
 	int ms = dev->timeout_ms;
+	int r;
 
-	return (credman_set_dev_rk_wait(dev, cred, pin, &ms));
+	fido_sched_enter(dev);
+	fido_trace_span_begin(dev, &span, FIDO_SPAN_CREDMAN);
+	do
+		r = credman_set_dev_rk_wait(dev, cred, pin, &ms);
+	while (fido_dev_uv_token_retry(dev, r));
+	fido_trace_span_end(dev, &span, r);
+	fido_sched_leave(dev);
+
+	return (r);
+}
+
+/*
+ * Update n credentials with one pinUvAuthToken. As when deleting, a
+ * credential that is not found does not end the batch; any other error
+ * does, and the remaining credentials are marked with it.
+ */
+static int
+credman_set_rk_batch(fido_dev_t *dev, fido_cred_t * const *cred, size_t n,
+    int *result, const char *pin, int *ms)
+{
+	int r, first = FIDO_OK;
+
+	for (size_t i = 0; i < n; i++) {
+		do
+			r = credman_set_dev_rk_wait(dev, cred[i], pin, ms);
+		while (fido_dev_uv_token_retry(dev, r));
+		if (r != FIDO_OK) {
+			fido_log_debug("%s: %zu: r=%d", __func__, i, r);
+			if (first == FIDO_OK)
+				first = r;
+		}
+		if (result != NULL)
+			result[i] = r;
+		if (r != FIDO_OK && r != FIDO_ERR_NO_CREDENTIALS) {
+			for (size_t j = i + 1; result != NULL && j < n; j++)
+				result[j] = r;
+			break;
+		}
+	}
+
+	return (first);
+}
+
+int
+fido_credman_set_dev_rk_batch(fido_dev_t *dev, fido_cred_t * const *cred,
+    size_t n, int *result, const char *pin)
+{
+	fido_trace_span_t	span;
+	int			ms = dev->timeout_ms;
+	bool			scoped;
+	int			r;
+
+	if (n > 0 && cred == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	for (size_t i = 0; i < n; i++)
+		if (cred[i] == NULL)
+			return (FIDO_ERR_INVALID_ARGUMENT);
+
+	fido_sched_enter(dev);
+	fido_trace_span_begin(dev, &span, FIDO_SPAN_CREDMAN);
+	/* obtain one token for the whole batch, even if caching is off */
+	if ((scoped = dev->uv_cache == NULL) &&
+	    (r = fido_dev_set_uv_token_cache(dev, true)) != FIDO_OK)
+		goto out;
+
+	r = credman_set_rk_batch(dev, cred, n, result, pin, &ms);
+
+	if (scoped)
+		fido_dev_uv_cache_free(dev);
+out:
+	fido_trace_span_end(dev, &span, r);
+	fido_sched_leave(dev);
+
+	return (r);
 }
 
 fido_credman_rk_t *
 fido_credman_rk_new(void)
 {
-	return (calloc(1, sizeof(fido_credman_rk_t)));
+	return (fido_calloc(1, sizeof(fido_credman_rk_t)));
 }
 
 void
@@ -714,7 +1102,7 @@ fido_credman_rk_free(fido_credman_rk_t **rk_p)
 		return;
 
 	credman_reset_rk(rk);
-	free(rk);
+	fido_free(rk);
 	*rk_p = NULL;
 }
 
@@ -724,10 +1112,19 @@ fido_credman_rk_count(const fido_credman_rk_t *rk)
 	return (rk->n_rx);
 }
 
+size_t
+fido_credman_rk_rp_idx(const fido_credman_rk_t *rk, size_t idx)
+{
+	if (rk->rp_idx == NULL || idx >= rk->n_rx)
+		return (SIZE_MAX);
+
+	return (rk->rp_idx[idx]);
+}
+
 const fido_cred_t *
 fido_credman_rk(const fido_credman_rk_t *rk, size_t idx)
 {
-	if (idx >= rk->n_alloc)
+	if (idx >= rk->n_rx)
 		return (NULL);
 
 	return (&rk->ptr[idx]);
@@ -736,7 +1133,7 @@ fido_credman_rk(const fido_credman_rk_t *rk, size_t idx)
 fido_credman_metadata_t *
 fido_credman_metadata_new(void)
 {
-	return (calloc(1, sizeof(fido_credman_metadata_t)));
+	return (fido_calloc(1, sizeof(fido_credman_metadata_t)));
 }
 
 void
@@ -747,7 +1144,7 @@ fido_credman_metadata_free(fido_credman_metadata_t **metadata_p)
 	if (metadata_p == NULL || (metadata = *metadata_p) == NULL)
 		return;
 
-	free(metadata);
+	fido_free(metadata);
 	*metadata_p = NULL;
 }
 
@@ -766,7 +1163,7 @@ fido_credman_rk_remaining(const fido_credman_metadata_t *metadata)
 fido_credman_rp_t *
 fido_credman_rp_new(void)
 {
-	return (calloc(1, sizeof(fido_credman_rp_t)));
+	return (fido_calloc(1, sizeof(fido_credman_rp_t)));
 }
 
 void
@@ -778,7 +1175,7 @@ fido_credman_rp_free(fido_credman_rp_t **rp_p)
 		return;
 
 	credman_reset_rp(rp);
-	free(rp);
+	fido_free(rp);
 	*rp_p = NULL;
 }
 
@@ -823,3 +1220,198 @@ fido_credman_rp_id_hash_ptr(const fido_credman_rp_t *rp, size_t idx)
 
 	return (rp->ptr[idx].rp_id_hash.ptr);
 }
+
+fido_credman_snapshot_t *
+fido_credman_snapshot_new(void)
+{
+	return (fido_calloc(1, sizeof(fido_credman_snapshot_t)));
+}
+
+static void
+credman_snapshot_reset(fido_credman_snapshot_t *snap)
+{
+	for (size_t i = 0; snap->rk != NULL && i < snap->rp.n_rx; i++)
+		credman_reset_rk(&snap->rk[i]);
+
+	fido_free(snap->rk);
+	credman_reset_rp(&snap->rp);
+	memset(snap, 0, sizeof(*snap));
+}
+
+void
+fido_credman_snapshot_free(fido_credman_snapshot_t **snap_p)
+{
+	fido_credman_snapshot_t *snap;
+
+	if (snap_p == NULL || (snap = *snap_p) == NULL)
+		return;
+
+	credman_snapshot_reset(snap);
+	fido_free(snap);
+	*snap_p = NULL;
+}
+
+void
+fido_credman_snapshot_clear(fido_credman_snapshot_t *snap)
+{
+	credman_snapshot_reset(snap);
+}
+
+/* index of the rp of snap whose id hash is h, or snap->rp.n_rx */
+static size_t
+credman_snapshot_find_rp(const fido_credman_snapshot_t *snap,
+    const fido_blob_t *h)
+{
+	const fido_blob_t *o;
+
+	for (size_t i = 0; i < snap->rp.n_rx; i++) {
+		o = &snap->rp.ptr[i].rp_id_hash;
+		if (o->len == h->len && memcmp(o->ptr, h->ptr, h->len) == 0)
+			return (i);
+	}
+
+	return (snap->rp.n_rx);
+}
+
+/*
+ * The metadata counts are compared first; if they are unchanged, nothing
+ * else is fetched. Otherwise the rps are enumerated again, and the rks of
+ * each rp are walked only if their count or first credential differ from
+ * the snapshot's. On failure, the snapshot is left as it was.
+ */
+static int
+credman_snapshot_wait(fido_dev_t *dev, fido_credman_snapshot_t *snap,
+    const char *pin, int *ms)
+{
+	fido_credman_metadata_t	  metadata;
+	fido_credman_rp_t	  rp;
+	fido_credman_rk_t	 *rk = NULL;
+	size_t			 *from = NULL; /* 1 + index of reused rk */
+	size_t			  j, walked = 0;
+	bool			  reused;
+	int			  r;
+
+	memset(&metadata, 0, sizeof(metadata));
+	memset(&rp, 0, sizeof(rp));
+
+	if ((r = credman_get_metadata_wait(dev, &metadata, pin,
+	    ms)) != FIDO_OK) {
+		fido_log_debug("%s: credman_get_metadata_wait", __func__);
+		return (r);
+	}
+
+	if (snap->valid &&
+	    metadata.rk_existing == snap->metadata.rk_existing &&
+	    metadata.rk_remaining == snap->metadata.rk_remaining) {
+		fido_log_debug("%s: unchanged", __func__);
+		snap->walked = 0;
+		return (FIDO_OK);
+	}
+
+	/* authenticators without rks may refuse to enumerate rps */
+	if (metadata.rk_existing > 0 && (r = credman_get_rp_wait(dev, &rp, pin,
+	    ms)) != FIDO_OK) {
+		fido_log_debug("%s: credman_get_rp_wait", __func__);
+		goto fail;
+	}
+
+	if (rp.n_rx > 0 && ((rk = fido_calloc_as(FIDO_MEM_CREDMAN, rp.n_rx,
+	    sizeof(*rk))) == NULL || (from = fido_calloc_as(FIDO_MEM_CREDMAN,
+	    rp.n_rx, sizeof(*from))) == NULL)) {
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	for (size_t i = 0; i < rp.n_rx; i++) {
+		/* each rp's walk stands alone */
+		fido_sched_yield(dev);
+		j = snap->valid ? credman_snapshot_find_rp(snap,
+		    &rp.ptr[i].rp_id_hash) : snap->rp.n_rx;
+		if ((r = credman_get_rk_hash(dev, &rp.ptr[i].rp_id_hash,
+		    rp.ptr[i].rp_entity.id, &rk[i], j < snap->rp.n_rx ?
+		    &snap->rk[j] : NULL, &reused, pin, ms)) != FIDO_OK) {
+			fido_log_debug("%s: credman_get_rk_hash", __func__);
+			goto fail;
+		}
+		if (reused)
+			from[i] = j + 1;
+		else
+			walked++;
+	}
+
+	/* success; move reused rks over and replace the snapshot */
+	for (size_t i = 0; i < rp.n_rx; i++) {
+		if (from[i] == 0)
+			continue;
+		credman_reset_rk(&rk[i]);
+		rk[i] = snap->rk[from[i] - 1];
+		memset(&snap->rk[from[i] - 1], 0, sizeof(*rk));
+	}
+
+	credman_snapshot_reset(snap);
+	snap->metadata = metadata;
+	snap->rp = rp;
+	snap->rk = rk;
+	snap->walked = walked;
+	snap->valid = true;
+	memset(&rp, 0, sizeof(rp));
+	rk = NULL;
+
+	r = FIDO_OK;
+fail:
+	if (rk != NULL) {
+		for (size_t i = 0; i < rp.n_rx; i++)
+			credman_reset_rk(&rk[i]);
+		fido_free(rk);
+	}
+	credman_reset_rp(&rp);
+	fido_free(from);
+
+	return (r);
+}
+
+int
+fido_credman_snapshot_refresh(fido_dev_t *dev, fido_credman_snapshot_t *snap,
+    const char *pin)
+{
+	fido_trace_span_t span;
+	int ms = dev->timeout_ms;
+	int r;
+
+	fido_sched_enter(dev);
+	fido_trace_span_begin(dev, &span, FIDO_SPAN_CREDMAN);
+	do
+		r = credman_snapshot_wait(dev, snap, pin, &ms);
+	while (fido_dev_uv_token_retry(dev, r));
+	fido_trace_span_end(dev, &span, r);
+	fido_sched_leave(dev);
+
+	return (r);
+}
+
+const fido_credman_metadata_t *
+fido_credman_snapshot_metadata(const fido_credman_snapshot_t *snap)
+{
+	return (&snap->metadata);
+}
+
+const fido_credman_rp_t *
+fido_credman_snapshot_rp(const fido_credman_snapshot_t *snap)
+{
+	return (&snap->rp);
+}
+
+const fido_credman_rk_t *
+fido_credman_snapshot_rk(const fido_credman_snapshot_t *snap, size_t idx)
+{
+	if (idx >= snap->rp.n_rx || snap->rk == NULL)
+		return (NULL);
+
+	return (&snap->rk[idx]);
+}
+
+size_t
+fido_credman_snapshot_walked(const fido_credman_snapshot_t *snap)
+{
+	return (snap->walked);
+}
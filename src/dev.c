@@ -5,12 +5,27 @@
  * SPDX-License-Identifier: BSD-2-Clause
  */
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include "fido.h"
 
 #ifndef TLS
 #define TLS
 #endif
 
+#ifndef MIN
+#define MIN(x, y) ((x) > (y) ? (y) : (x))
+#endif
+
+#ifndef MAX
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+#endif
+
+#define FIDO_RX_ADAPTIVE_MIN_MS	250	/* floor of an adaptive budget */
+#define FIDO_RX_ADAPTIVE_MAX_MS	60000	/* cap of an observed wait */
+
 static TLS bool disable_u2f_fallback;
 
 #ifdef FIDO_FUZZ
@@ -80,14 +95,52 @@ fido_dev_set_protocol_flags(fido_dev_t *dev, const fido_cbor_info_t *info)
 		}
 }
 
+static void
+fido_dev_set_version_flags(fido_dev_t *dev, const fido_cbor_info_t *info)
+{
+	char * const	*ptr = fido_cbor_info_versions_ptr(info);
+	size_t		 len = fido_cbor_info_versions_len(info);
+
+	for (size_t i = 0; i < len; i++)
+		if (strcmp(ptr[i], "FIDO_2_1") == 0)
+			dev->flags |= FIDO_DEV_SELECTION;
+}
+
 static void
 fido_dev_set_flags(fido_dev_t *dev, const fido_cbor_info_t *info)
 {
+	fido_dev_set_version_flags(dev, info);
 	fido_dev_set_extension_flags(dev, info);
 	fido_dev_set_option_flags(dev, info);
 	fido_dev_set_protocol_flags(dev, info);
 }
 
+/* the authenticator's maxMsgSize, within the limit set at build time */
+static uint64_t
+fido_dev_maxmsgsize_info(const fido_cbor_info_t *info)
+{
+	uint64_t maxmsgsize = fido_cbor_info_maxmsgsiz(info);
+
+	return (maxmsgsize > FIDO_MAXMSG_LIMIT ? FIDO_MAXMSG_LIMIT :
+	    maxmsgsize);
+}
+
+/* let fido_dev_cancel() end waits on a hid handle */
+static void
+dev_set_wakeup(fido_dev_t *dev)
+{
+	if (dev->transport.rx != NULL || dev->io.read != fido_hid_read)
+		return;
+	if (dev->wakeup == NULL && (dev->wakeup = fido_wakeup_new()) == NULL) {
+		fido_log_debug("%s: fido_wakeup_new", __func__);
+		return;
+	}
+	fido_wakeup_clear(dev->wakeup);
+	dev->rx_stale = false;
+	if (fido_hid_set_wakeup(dev->io_handle, dev->wakeup) != FIDO_OK)
+		fido_log_debug("%s: fido_hid_set_wakeup", __func__);
+}
+
 static int
 fido_dev_open_tx(fido_dev_t *dev, const char *path, int *ms)
 {
@@ -117,6 +170,7 @@ fido_dev_open_tx(fido_dev_t *dev, const char *path, int *ms)
 		fido_log_debug("%s: dev->io.open", __func__);
 		return (FIDO_ERR_INTERNAL);
 	}
+	dev_set_wakeup(dev);
 
 	if (dev->io_own) {
 		dev->rx_len = CTAP_MAX_REPORT_LEN;
@@ -159,18 +213,75 @@ fail:
 	return (r);
 }
 
+/*
+ * Ask for the device's info, unless the session cache has it; *pending
+ * is set if a reply is to be collected with fido_dev_open_info_rx().
+ */
 static int
-fido_dev_open_rx(fido_dev_t *dev, int *ms)
+fido_dev_open_info_tx(fido_dev_t *dev, const char *path,
+    fido_cbor_info_t *info, bool *pending, int *ms)
 {
-	fido_cbor_info_t	*info = NULL;
-	int			 reply_len;
-	int			 r;
+	int r;
+
+	*pending = false;
+	if (dev->transport.rx == NULL && fido_session_cache_size() > 0 &&
+	    fido_session_lookup(dev, path, info) == 0) {
+		fido_log_debug("%s: %s cached", __func__, path);
+		return (FIDO_OK);
+	}
+	if ((r = fido_dev_get_cbor_info_tx(dev, ms)) != FIDO_OK)
+		return (r);
+	*pending = true;
+
+	return (FIDO_OK);
+}
+
+static int
+fido_dev_open_info_rx(fido_dev_t *dev, const char *path,
+    fido_cbor_info_t *info, int *ms)
+{
+	fido_blob_t	reply;
+	int		r;
+
+	if (dev->transport.rx != NULL || fido_session_cache_size() == 0)
+		return (fido_dev_get_cbor_info_rx(dev, info, NULL, ms));
+
+	memset(&reply, 0, sizeof(reply));
+	if ((r = fido_dev_get_cbor_info_rx(dev, info, &reply,
+	    ms)) == FIDO_OK)
+		fido_session_store(dev, path, &reply);
+	fido_blob_reset(&reply);
+
+	return (r);
+}
+
+static int
+fido_dev_open_info(fido_dev_t *dev, const char *path, fido_cbor_info_t *info,
+    int *ms)
+{
+	bool	pending;
+	int	r;
+
+	if ((r = fido_dev_open_info_tx(dev, path, info, &pending,
+	    ms)) != FIDO_OK || pending == false)
+		return (r);
+
+	return (fido_dev_open_info_rx(dev, path, info, ms));
+}
+
+/*
+ * Collect the reply to CTAPHID_INIT sent by fido_dev_open_tx(). A device
+ * known to fail authenticatorGetInfo is opened as U2F right away.
+ */
+static int
+fido_dev_open_rx_init(fido_dev_t *dev, const char *path, int *ms)
+{
+	int reply_len;
 
 	if ((reply_len = fido_rx(dev, CTAP_CMD_INIT, &dev->attr,
 	    sizeof(dev->attr), ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
-		r = FIDO_ERR_RX;
-		goto fail;
+		return (FIDO_ERR_RX);
 	}
 
 #ifdef FIDO_FUZZ
@@ -180,41 +291,55 @@ fido_dev_open_rx(fido_dev_t *dev, int *ms)
 	if ((size_t)reply_len != sizeof(dev->attr) ||
 	    dev->attr.nonce != dev->nonce) {
 		fido_log_debug("%s: invalid nonce", __func__);
-		r = FIDO_ERR_RX;
-		goto fail;
+		return (FIDO_ERR_RX);
 	}
 
 	dev->flags = 0;
 	dev->cid = dev->attr.cid;
 
-	if (fido_dev_is_fido2(dev)) {
-		if ((info = fido_cbor_info_new()) == NULL) {
-			fido_log_debug("%s: fido_cbor_info_new", __func__);
-			r = FIDO_ERR_INTERNAL;
+	if (fido_dev_is_fido2(dev) && disable_u2f_fallback == false &&
+	    fido_legacy_lookup(dev, path) == 0) {
+		fido_log_debug("%s: %s known u2f-only", __func__, path);
+		fido_dev_force_u2f(dev);
+	}
+
+	return (FIDO_OK);
+}
+
+/*
+ * Conclude an open past CTAPHID_INIT; r is the outcome of fetching the
+ * device's info, if any was fetched into *info, which is consumed. On
+ * failure, the handle is closed.
+ */
+static int
+fido_dev_open_finish(fido_dev_t *dev, const char *path,
+    fido_cbor_info_t **info, int r)
+{
+	if (*info != NULL && r != FIDO_OK) {
+		fido_log_debug("%s: fido_dev_cbor_info_wait: %d", __func__, r);
+		if (disable_u2f_fallback)
 			goto fail;
-		}
-		if ((r = fido_dev_get_cbor_info_wait(dev, info,
-		    ms)) != FIDO_OK) {
-			fido_log_debug("%s: fido_dev_cbor_info_wait: %d",
-			    __func__, r);
-			if (disable_u2f_fallback)
-				goto fail;
-			fido_log_debug("%s: falling back to u2f", __func__);
-			fido_dev_force_u2f(dev);
-		} else {
-			fido_dev_set_flags(dev, info);
-		}
+		fido_log_debug("%s: falling back to u2f", __func__);
+		fido_legacy_store(dev, path);
+		fido_dev_force_u2f(dev);
+		fido_cbor_info_free(info);
+	} else if (*info != NULL) {
+		fido_dev_set_flags(dev, *info);
 	}
 
-	if (fido_dev_is_fido2(dev) && info != NULL) {
-		dev->maxmsgsize = fido_cbor_info_maxmsgsiz(info);
+	if (fido_dev_is_fido2(dev) && *info != NULL) {
+		dev->maxmsgsize = fido_dev_maxmsgsize_info(*info);
 		fido_log_debug("%s: FIDO_MAXMSG=%d, maxmsgsiz=%lu", __func__,
 		    FIDO_MAXMSG, (unsigned long)dev->maxmsgsize);
+		/* retained; see fido_dev_cbor_info() */
+		fido_cbor_info_free(&dev->info);
+		dev->info = *info;
+		*info = NULL;
 	}
 
 	r = FIDO_OK;
 fail:
-	fido_cbor_info_free(&info);
+	fido_cbor_info_free(info);
 
 	if (r != FIDO_OK) {
 		dev->io.close(dev->io_handle);
@@ -224,25 +349,89 @@ fail:
 	return (r);
 }
 
+static int
+fido_dev_open_rx(fido_dev_t *dev, const char *path, int *ms)
+{
+	fido_cbor_info_t	*info = NULL;
+	int			 r;
+
+	if ((r = fido_dev_open_rx_init(dev, path, ms)) != FIDO_OK)
+		goto fail;
+
+	if (fido_dev_is_fido2(dev)) {
+		if ((info = fido_cbor_info_new()) == NULL) {
+			fido_log_debug("%s: fido_cbor_info_new", __func__);
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+		r = fido_dev_open_info(dev, path, info, ms);
+	}
+
+	return (fido_dev_open_finish(dev, path, &info, r));
+fail:
+	dev->io.close(dev->io_handle);
+	dev->io_handle = NULL;
+
+	return (r);
+}
+
+/* state kept across opens; see fido_session_largeblob_get() */
+static void
+fido_dev_open_done(fido_dev_t *dev, const char *path)
+{
+	fido_free(dev->session_path);
+	dev->session_path = NULL;
+	if (dev->transport.rx == NULL && fido_session_cache_size() > 0 &&
+	    (dev->session_path = fido_strdup(path)) == NULL)
+		fido_log_debug("%s: strdup", __func__);
+}
+
 static int
 fido_dev_open_wait(fido_dev_t *dev, const char *path, int *ms)
 {
 	int r;
 
+	dev->trace_transport = fido_trace_transport(dev, path);
 #ifdef USE_WINHELLO
 	if (strcmp(path, FIDO_WINHELLO_PATH) == 0)
 		return (fido_winhello_open(dev));
 #endif
 	if ((r = fido_dev_open_tx(dev, path, ms)) != FIDO_OK ||
-	    (r = fido_dev_open_rx(dev, ms)) != FIDO_OK)
+	    (r = fido_dev_open_rx(dev, path, ms)) != FIDO_OK) {
+		fido_session_drop(path);
 		return (r);
+	}
+	fido_dev_open_done(dev, path);
 
 	return (FIDO_OK);
 }
 
+#define MANIFEST_MAXDEV	64 /* per backend, when streaming */
+
+typedef int manifest_t(fido_dev_info_t *, size_t, size_t *);
+
+static const struct manifest_backend {
+	const char	*type;
+	manifest_t	*manifest;
+} manifest_backend[] = {
+	{ "hid", fido_hid_manifest },
+#ifdef USE_NFC
+	{ "nfc", fido_nfc_manifest },
+#endif
+#ifdef USE_PCSC
+	{ "pcsc", fido_pcsc_manifest },
+#endif
+#ifdef USE_BLE
+	{ "ble", fido_ble_manifest },
+#endif
+#ifdef USE_WINHELLO
+	{ "winhello", fido_winhello_manifest },
+#endif
+};
+
 static void
 run_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen,
-    const char *type, int (*manifest)(fido_dev_info_t *, size_t, size_t *))
+    const char *type, manifest_t *manifest)
 {
 	size_t ndevs = 0;
 	int r;
@@ -263,18 +452,342 @@ fido_dev_info_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
 {
 	*olen = 0;
 
-	run_manifest(devlist, ilen, olen, "hid", fido_hid_manifest);
-#ifdef USE_NFC
-	run_manifest(devlist, ilen, olen, "nfc", fido_nfc_manifest);
-#endif
-#ifdef USE_PCSC
-	run_manifest(devlist, ilen, olen, "pcsc", fido_pcsc_manifest);
-#endif
-#ifdef USE_WINHELLO
-	run_manifest(devlist, ilen, olen, "winhello", fido_winhello_manifest);
+	for (size_t i = 0; i < nitems(manifest_backend); i++)
+		run_manifest(devlist, ilen, olen, manifest_backend[i].type,
+		    manifest_backend[i].manifest);
+
+	/* forget devices that went away, unless the list was truncated */
+	if (*olen < ilen)
+		fido_session_prune(devlist, *olen);
+
+	return (FIDO_OK);
+}
+
+/*
+ * Enumerate devices and compare them with prev. Devices not in prev are
+ * moved to devlist; the indices of entries of prev no longer present are
+ * stored in gone, which must have room for nprev entries.
+ */
+int
+fido_dev_info_manifest_diff(const fido_dev_info_t *prev, size_t nprev,
+    fido_dev_info_t *devlist, size_t ilen, size_t *olen, size_t *gone,
+    size_t *ngone)
+{
+	fido_dev_info_t	*cur = NULL;
+	bool		*prev_gone = NULL;
+	bool		*cur_new = NULL;
+	size_t		 ncur, len;
+	int		 r = FIDO_ERR_INTERNAL;
+
+	*olen = 0;
+	*ngone = 0;
+
+	if ((nprev > 0 && (prev == NULL || gone == NULL)) ||
+	    (ilen > 0 && devlist == NULL) || nprev > SIZE_MAX - ilen - 1)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	/* room for every known device, ilen new ones, and one more */
+	len = nprev + ilen + 1;
+	if ((cur = fido_dev_info_new(len)) == NULL ||
+	    (prev_gone = fido_calloc(nprev + 1, sizeof(*prev_gone))) == NULL ||
+	    (cur_new = fido_calloc(len, sizeof(*cur_new))) == NULL)
+		goto fail;
+
+	fido_dev_info_manifest(cur, len, &ncur);
+	if (fido_dev_info_diff(prev, nprev, cur, ncur, prev_gone,
+	    cur_new) < 0) {
+		fido_log_debug("%s: fido_dev_info_diff", __func__);
+		goto fail;
+	}
+
+	for (size_t i = 0; i < ncur && *olen < ilen; i++)
+		if (cur_new[i]) {
+			devlist[(*olen)++] = cur[i];
+			memset(&cur[i], 0, sizeof(cur[i]));
+		}
+
+	/* a truncated enumeration cannot tell which devices went away */
+	if (ncur < len)
+		for (size_t i = 0; i < nprev; i++)
+			if (prev_gone[i])
+				gone[(*ngone)++] = i;
+
+	r = FIDO_OK;
+fail:
+	fido_dev_info_free(&cur, len);
+	fido_free(prev_gone);
+	fido_free(cur_new);
+
+	return (r);
+}
+
+#ifdef HAVE_PTHREAD
+struct manifest_job {
+	const struct manifest_backend	*backend;
+	fido_dev_info_t			*devlist; /* backend's own list */
+	size_t				 ilen;    /* capacity of devlist */
+	size_t				 olen;    /* entries found */
+	bool				 done;    /* backend returned */
+	bool				 orphan;  /* caller stopped waiting */
+};
+
+static pthread_mutex_t manifest_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t manifest_cond = PTHREAD_COND_INITIALIZER;
+
+static void
+manifest_job_free(struct manifest_job **job_p)
+{
+	struct manifest_job *job;
+
+	if (job_p == NULL || (job = *job_p) == NULL)
+		return;
+	fido_dev_info_free(&job->devlist, job->ilen);
+	fido_free(job);
+	*job_p = NULL;
+}
+
+static void *
+manifest_worker(void *arg)
+{
+	struct manifest_job	*job = arg;
+	size_t			 olen = 0;
+	bool			 orphan;
+
+	run_manifest(job->devlist, job->ilen, &olen, job->backend->type,
+	    job->backend->manifest);
+
+	pthread_mutex_lock(&manifest_lock);
+	job->olen = olen;
+	job->done = true;
+	orphan = job->orphan;
+	pthread_cond_broadcast(&manifest_cond);
+	pthread_mutex_unlock(&manifest_lock);
+
+	/* the caller gave up on us; nobody else references job */
+	if (orphan)
+		manifest_job_free(&job);
+
+	return (NULL);
+}
+
+static struct manifest_job *
+manifest_start(const struct manifest_backend *backend, size_t ilen)
+{
+	struct manifest_job	*job;
+	pthread_t		 thread;
+
+	if ((job = fido_calloc(1, sizeof(*job))) == NULL ||
+	    (job->devlist = fido_dev_info_new(ilen)) == NULL) {
+		fido_free(job);
+		return (NULL);
+	}
+	job->backend = backend;
+	job->ilen = ilen;
+
+	if (pthread_create(&thread, NULL, manifest_worker, job) != 0) {
+		fido_log_debug("%s: pthread_create", __func__);
+		/* enumerate inline instead */
+		run_manifest(job->devlist, job->ilen, &job->olen,
+		    backend->type, backend->manifest);
+		job->done = true;
+	} else
+		pthread_detach(thread);
+
+	return (job);
+}
+
+static int
+manifest_deadline(struct timespec *ts, int ms)
+{
+	long nsec;
+
+	if (clock_gettime(CLOCK_REALTIME, ts) != 0) {
+		fido_log_debug("%s: clock_gettime", __func__);
+		return (-1);
+	}
+
+	nsec = ts->tv_nsec + (long)(ms % 1000) * 1000000L;
+	ts->tv_sec += ms / 1000 + nsec / 1000000000L;
+	ts->tv_nsec = nsec % 1000000000L;
+
+	return (0);
+}
+#endif /* HAVE_PTHREAD */
+
+int
+fido_dev_info_manifest_parallel(fido_dev_info_t *devlist, size_t ilen,
+    size_t *olen, int ms)
+{
+#ifdef HAVE_PTHREAD
+	struct manifest_job	*job[nitems(manifest_backend)];
+	struct timespec		 deadline;
+	bool			 complete = true;
+	size_t			 i, k;
+
+	*olen = 0;
+	memset(job, 0, sizeof(job));
+
+	if (ilen == 0)
+		return (FIDO_OK);
+	if (ms >= 0 && manifest_deadline(&deadline, ms) < 0)
+		return (FIDO_ERR_INTERNAL);
+
+	for (i = 0; i < nitems(job); i++)
+		if ((job[i] = manifest_start(&manifest_backend[i],
+		    ilen)) == NULL) {
+			fido_log_debug("%s: manifest_start %s", __func__,
+			    manifest_backend[i].type);
+			complete = false;
+		}
+
+	pthread_mutex_lock(&manifest_lock);
+	for (i = 0; i < nitems(job); i++) {
+		if (job[i] == NULL)
+			continue;
+		while (job[i]->done == false) {
+			if (ms < 0)
+				pthread_cond_wait(&manifest_cond, &manifest_lock);
+			else if (pthread_cond_timedwait(&manifest_cond,
+			    &manifest_lock, &deadline) != 0)
+				break; /* timed out */
+		}
+		if (job[i]->done == false) {
+			fido_log_debug("%s: %s timed out", __func__,
+			    job[i]->backend->type);
+			job[i]->orphan = true; /* freed by the worker */
+			job[i] = NULL;
+			complete = false;
+		}
+	}
+	pthread_mutex_unlock(&manifest_lock);
+
+	/* merge in backend order, as fido_dev_info_manifest() would */
+	for (i = 0; i < nitems(job); i++) {
+		if (job[i] == NULL)
+			continue;
+		for (k = 0; k < job[i]->olen && *olen < ilen; k++) {
+			devlist[(*olen)++] = job[i]->devlist[k];
+			memset(&job[i]->devlist[k], 0,
+			    sizeof(job[i]->devlist[k]));
+		}
+		if (k < job[i]->olen)
+			complete = false;
+		manifest_job_free(&job[i]);
+	}
+
+	if (complete && *olen < ilen)
+		fido_session_prune(devlist, *olen);
+
+	return (FIDO_OK);
+#else
+	(void)ms;
+
+	return (fido_dev_info_manifest(devlist, ilen, olen));
 #endif
+}
+
+/*
+ * Report the devices found by each backend to cb as soon as the backend
+ * returns, rather than once all of them have; a non-zero return from cb
+ * ends the enumeration.
+ */
+static bool
+manifest_report(const fido_dev_info_t *devlist, size_t n,
+    fido_dev_info_cb_t *cb, void *arg)
+{
+	for (size_t i = 0; i < n; i++)
+		if (cb(&devlist[i], arg) != 0)
+			return (false);
+
+	return (true);
+}
+
+int
+fido_dev_info_manifest_cb(fido_dev_info_cb_t *cb, void *arg, int ms)
+{
+#ifdef HAVE_PTHREAD
+	struct manifest_job	*job[nitems(manifest_backend)];
+	struct manifest_job	*ready;
+	struct timespec		 deadline;
+	bool			 more = true;
+	size_t			 i, left = 0;
+
+	if (cb == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	memset(job, 0, sizeof(job));
+
+	if (ms >= 0 && manifest_deadline(&deadline, ms) < 0)
+		return (FIDO_ERR_INTERNAL);
+
+	for (i = 0; i < nitems(job); i++)
+		if ((job[i] = manifest_start(&manifest_backend[i],
+		    MANIFEST_MAXDEV)) == NULL)
+			fido_log_debug("%s: manifest_start %s", __func__,
+			    manifest_backend[i].type);
+		else
+			left++;
+
+	pthread_mutex_lock(&manifest_lock);
+	while (more && left > 0) {
+		ready = NULL;
+		for (i = 0; i < nitems(job) && ready == NULL; i++)
+			if (job[i] != NULL && job[i]->done) {
+				ready = job[i];
+				job[i] = NULL;
+			}
+		if (ready == NULL) {
+			if (ms < 0)
+				pthread_cond_wait(&manifest_cond, &manifest_lock);
+			else if (pthread_cond_timedwait(&manifest_cond,
+			    &manifest_lock, &deadline) != 0)
+				break; /* timed out */
+			continue;
+		}
+		left--;
+		/* cb may well open a device; do not hold the lock meanwhile */
+		pthread_mutex_unlock(&manifest_lock);
+		more = manifest_report(ready->devlist, ready->olen, cb, arg);
+		manifest_job_free(&ready);
+		pthread_mutex_lock(&manifest_lock);
+	}
+	for (i = 0; i < nitems(job); i++) {
+		if (job[i] == NULL)
+			continue;
+		if (job[i]->done)
+			manifest_job_free(&job[i]);
+		else {
+			fido_log_debug("%s: %s %s", __func__,
+			    job[i]->backend->type, more ? "timed out" :
+			    "abandoned");
+			job[i]->orphan = true; /* freed by the worker */
+		}
+	}
+	pthread_mutex_unlock(&manifest_lock);
 
 	return (FIDO_OK);
+#else
+	fido_dev_info_t	*devlist;
+	size_t		 olen;
+	bool		 more = true;
+
+	(void)ms;
+
+	if (cb == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	for (size_t i = 0; i < nitems(manifest_backend) && more; i++) {
+		if ((devlist = fido_dev_info_new(MANIFEST_MAXDEV)) == NULL)
+			return (FIDO_ERR_INTERNAL);
+		olen = 0;
+		run_manifest(devlist, MANIFEST_MAXDEV, &olen,
+		    manifest_backend[i].type, manifest_backend[i].manifest);
+		more = manifest_report(devlist, olen, cb, arg);
+		fido_dev_info_free(&devlist, MANIFEST_MAXDEV);
+	}
+
+	return (FIDO_OK);
+#endif
 }
 
 int
@@ -288,11 +801,9 @@ fido_dev_open_with_info(fido_dev_t *dev)
 	return (fido_dev_open_wait(dev, dev->path, &ms));
 }
 
-int
-fido_dev_open(fido_dev_t *dev, const char *path)
+static int
+fido_dev_set_path_transport(fido_dev_t *dev, const char *path)
 {
-	int ms = dev->timeout_ms;
-
 #ifdef USE_NFC
 	if (fido_is_nfc(path) && fido_dev_set_nfc(dev) < 0) {
 		fido_log_debug("%s: fido_dev_set_nfc", __func__);
@@ -305,23 +816,150 @@ fido_dev_open(fido_dev_t *dev, const char *path)
 		return FIDO_ERR_INTERNAL;
 	}
 #endif
+#ifdef USE_BLE
+	if (fido_is_ble(path) && fido_dev_set_ble(dev) < 0) {
+		fido_log_debug("%s: fido_dev_set_ble", __func__);
+		return FIDO_ERR_INTERNAL;
+	}
+#endif
+#ifdef USE_BROKER
+	if (fido_is_broker(path) && fido_dev_set_broker(dev) < 0) {
+		fido_log_debug("%s: fido_dev_set_broker", __func__);
+		return FIDO_ERR_INTERNAL;
+	}
+#endif
+	(void)dev;
+	(void)path;
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_open(fido_dev_t *dev, const char *path)
+{
+	int ms = dev->timeout_ms;
+	int r;
+
+	if ((r = fido_dev_set_path_transport(dev, path)) != FIDO_OK)
+		return (r);
 
 	return (fido_dev_open_wait(dev, path, &ms));
 }
 
+/*
+ * Open n devices at once: CTAPHID_INIT goes out to every device before
+ * any reply is read, and so does authenticatorGetInfo, so that devices
+ * answer concurrently. Replies are collected in order; those of later
+ * devices wait in their handles meanwhile. Each device keeps its own
+ * timeout. The outcome of opening dev[i] is stored in result[i].
+ */
+int
+fido_dev_open_many(fido_dev_t *const *dev, const char *const *path, size_t n,
+    int *result)
+{
+	struct open_many {
+		fido_cbor_info_t	*info;
+		int			 ms;
+		bool			 busy;     /* awaiting a reply */
+		bool			 pending;  /* getInfo sent */
+		bool			 winhello;
+	} *s;
+	size_t	i;
+	int	r;
+
+	if (dev == NULL || path == NULL || result == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if (n == 0)
+		return (FIDO_OK);
+	if ((s = fido_calloc(n, sizeof(*s))) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	for (i = 0; i < n; i++) {
+		s[i].ms = dev[i]->timeout_ms;
+#ifdef USE_WINHELLO
+		if (strcmp(path[i], FIDO_WINHELLO_PATH) == 0) {
+			s[i].winhello = true;
+			result[i] = fido_winhello_open(dev[i]);
+			continue;
+		}
+#endif
+		if ((r = fido_dev_set_path_transport(dev[i],
+		    path[i])) == FIDO_OK)
+			r = fido_dev_open_tx(dev[i], path[i], &s[i].ms);
+		s[i].busy = r == FIDO_OK;
+		result[i] = r;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (s[i].busy == false)
+			continue;
+		if ((r = fido_dev_open_rx_init(dev[i], path[i],
+		    &s[i].ms)) == FIDO_OK &&
+		    fido_dev_is_fido2(dev[i]) &&
+		    (s[i].info = fido_cbor_info_new()) == NULL)
+			r = FIDO_ERR_INTERNAL;
+		if (r != FIDO_OK) {
+			dev[i]->io.close(dev[i]->io_handle);
+			dev[i]->io_handle = NULL;
+			s[i].busy = false;
+			result[i] = r;
+			continue;
+		}
+		if (s[i].info != NULL && (r = fido_dev_open_info_tx(dev[i],
+		    path[i], s[i].info, &s[i].pending, &s[i].ms)) != FIDO_OK) {
+			s[i].busy = false;
+			result[i] = fido_dev_open_finish(dev[i], path[i],
+			    &s[i].info, r);
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		if (s[i].busy) {
+			r = FIDO_OK;
+			if (s[i].pending)
+				r = fido_dev_open_info_rx(dev[i], path[i],
+				    s[i].info, &s[i].ms);
+			result[i] = fido_dev_open_finish(dev[i], path[i],
+			    &s[i].info, r);
+		}
+		if (s[i].winhello)
+			continue;
+		if (result[i] == FIDO_OK)
+			fido_dev_open_done(dev[i], path[i]);
+		else
+			fido_session_drop(path[i]);
+	}
+
+	fido_free(s);
+
+	return (FIDO_OK);
+}
+
 int
 fido_dev_close(fido_dev_t *dev)
 {
 #ifdef USE_WINHELLO
-	if (dev->flags & FIDO_DEV_WINHELLO)
+	if (dev->flags & FIDO_DEV_WINHELLO) {
+		fido_rx_async_end(dev);
 		return (fido_winhello_close(dev));
+	}
 #endif
 	if (dev->io_handle == NULL || dev->io.close == NULL)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
-	dev->io.close(dev->io_handle);
+	fido_rx_async_end(dev);
+	if (fido_mux_leave(dev) == 0)
+		dev->io.close(dev->io_handle);
 	dev->io_handle = NULL;
 	dev->cid = CTAP_CID_BROADCAST;
+	fido_cbor_info_free(&dev->info);
+	fido_dev_uv_token_flush(dev);
+	fido_dev_ecdh_flush(dev);
+	fido_dev_largeblob_flush(dev);
+	fido_dev_bio_flush(dev);
+	fido_blob_reset(&dev->touch_req);
+	fido_free(dev->session_path);
+	dev->session_path = NULL;
 
 	return (FIDO_OK);
 }
@@ -335,6 +973,14 @@ fido_dev_set_sigmask(fido_dev_t *dev, const fido_sigset_t *sigmask)
 #ifdef USE_NFC
 	if (dev->transport.rx == fido_nfc_rx && dev->io.read == fido_nfc_read)
 		return (fido_nfc_set_sigmask(dev->io_handle, sigmask));
+#endif
+#ifdef USE_BLE
+	if (dev->transport.rx == fido_ble_rx && dev->io.read == fido_ble_read)
+		return (fido_ble_set_sigmask(dev->io_handle, sigmask));
+#endif
+#ifdef USE_BROKER
+	if (dev->transport.rx == NULL && dev->io.read == fido_broker_read)
+		return (fido_broker_set_sigmask(dev->io_handle, sigmask));
 #endif
 	if (dev->transport.rx == NULL && dev->io.read == fido_hid_read)
 		return (fido_hid_set_sigmask(dev->io_handle, sigmask));
@@ -342,19 +988,216 @@ fido_dev_set_sigmask(fido_dev_t *dev, const fido_sigset_t *sigmask)
 	return (FIDO_ERR_INVALID_ARGUMENT);
 }
 
+int
+fido_dev_poll_fd(const fido_dev_t *dev)
+{
+	if (dev->io_handle == NULL || dev->transport.rx != NULL)
+		return (-1);
+#ifdef USE_BROKER
+	if (dev->io.read == fido_broker_read)
+		return (fido_broker_get_fd(dev->io_handle));
+#endif
+	if (dev->io.read != fido_hid_read)
+		return (-1);
+
+	return (fido_hid_get_fd(dev->io_handle));
+}
+
+/*
+ * a pending operation that is waiting on a timer rather than on the
+ * descriptor, such as a u2f request to be repeated
+ */
+int
+fido_dev_poll_timeout(const fido_dev_t *dev)
+{
+	return (u2f_async_timeout(dev));
+}
+
+/*
+ * an event object that is signalled once the pending operation can be
+ * stepped, for devices without a descriptor, such as windows hello
+ */
+void *
+fido_dev_poll_event(const fido_dev_t *dev)
+{
+#ifdef USE_WINHELLO
+	if (dev->flags & FIDO_DEV_WINHELLO)
+		return (fido_winhello_poll_event(dev));
+#endif
+	(void)dev;
+
+	return (NULL);
+}
+
+/*
+ * reports read ahead by the hid backend or queued by another channel;
+ * poll(2) will not report these
+ */
+bool
+fido_dev_rx_pending(const fido_dev_t *dev)
+{
+	if (fido_dev_poll_fd(dev) == -1)
+		return (false);
+
+	return ((dev->io.read == fido_hid_read &&
+	    fido_hid_pending(dev->io_handle) > 0) ||
+	    fido_mux_pending(dev) > 0);
+}
+
+const fido_cbor_info_t *
+fido_dev_cbor_info(const fido_dev_t *dev)
+{
+	return (dev->info);
+}
+
+int
+fido_dev_refresh_cbor_info(fido_dev_t *dev)
+{
+	fido_cbor_info_t	*info = NULL;
+	int			 ms = dev->timeout_ms;
+	int			 r;
+
+	if ((dev->io_handle == NULL && (dev->flags & FIDO_DEV_WINHELLO) == 0) ||
+	    fido_dev_is_fido2(dev) == false)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if ((info = fido_cbor_info_new()) == NULL)
+		return (FIDO_ERR_INTERNAL);
+	if ((r = fido_dev_get_cbor_info_wait(dev, info, &ms)) != FIDO_OK) {
+		fido_log_debug("%s: fido_dev_get_cbor_info_wait: %d",
+		    __func__, r);
+		fido_cbor_info_free(&info);
+		return (r);
+	}
+
+	if ((dev->flags & FIDO_DEV_WINHELLO) == 0) {
+		dev->flags = 0;
+		fido_dev_set_flags(dev, info);
+		fido_blob_reset(&dev->touch_req);
+		dev->maxmsgsize = fido_dev_maxmsgsize_info(info);
+	}
+	fido_cbor_info_free(&dev->info);
+	dev->info = info;
+
+	return (FIDO_OK);
+}
+
+/*
+ * A thread waiting on a hid device for the reply to the cancelled request
+ * is woken up at once, rather than when the authenticator answers the
+ * cancellation; its request fails.
+ */
 int
 fido_dev_cancel(fido_dev_t *dev)
 {
 	int ms = dev->timeout_ms;
+	int r = FIDO_OK;
 
 #ifdef USE_WINHELLO
 	if (dev->flags & FIDO_DEV_WINHELLO)
 		return (fido_winhello_cancel(dev));
 #endif
 	if (fido_dev_is_fido2(dev) == false)
+		r = u2f_async_cancel(dev);
+	else if (fido_tx(dev, CTAP_CMD_CANCEL, NULL, 0, &ms) < 0)
+		r = FIDO_ERR_TX;
+	if (dev->wakeup != NULL)
+		fido_wakeup_signal(dev->wakeup);
+
+	return (r);
+}
+
+/* ctaphid: an echo of a random nonce */
+static int
+fido_dev_ping_ctaphid(fido_dev_t *dev, int *ms)
+{
+	unsigned char	nonce[8];
+	unsigned char	reply[sizeof(nonce)];
+
+	if (fido_get_random(nonce, sizeof(nonce)) < 0) {
+		fido_log_debug("%s: fido_get_random", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+	if (fido_tx(dev, CTAP_CMD_PING, nonce, sizeof(nonce), ms) < 0) {
+		fido_log_debug("%s: fido_tx", __func__);
+		return (FIDO_ERR_TX);
+	}
+	if (fido_rx(dev, CTAP_CMD_PING, reply, sizeof(reply),
+	    ms) != (int)sizeof(reply) || memcmp(nonce, reply,
+	    sizeof(nonce)) != 0) {
+		fido_log_debug("%s: fido_rx", __func__);
+		return (FIDO_ERR_RX);
+	}
+
+	return (FIDO_OK);
+}
+
+/* apdu transports: any status word to u2f version will do */
+static int
+fido_dev_ping_apdu(fido_dev_t *dev, int *ms)
+{
+	iso7816_apdu_t	*apdu;
+	unsigned char	 reply[32];
+	int		 r = FIDO_ERR_TX;
+
+	if ((apdu = iso7816_new(0, U2F_CMD_VERSION, 0, 0)) == NULL)
+		return (FIDO_ERR_INTERNAL);
+	if (fido_tx(dev, CTAP_CMD_MSG, iso7816_ptr(apdu), iso7816_len(apdu),
+	    ms) < 0) {
+		fido_log_debug("%s: fido_tx", __func__);
+		goto fail;
+	}
+	if (fido_rx(dev, CTAP_CMD_MSG, reply, sizeof(reply), ms) < 2) {
+		fido_log_debug("%s: fido_rx", __func__);
+		r = FIDO_ERR_RX;
+		goto fail;
+	}
+
+	r = FIDO_OK;
+fail:
+	iso7816_free(&apdu);
+
+	return (r);
+}
+
+int
+fido_dev_ping(fido_dev_t *dev, int ms)
+{
+#ifdef USE_WINHELLO
+	if (dev->flags & FIDO_DEV_WINHELLO)
+		return (FIDO_OK);
+#endif
+	if (dev->io_handle == NULL || dev->async != NULL)
 		return (FIDO_ERR_INVALID_ARGUMENT);
-	if (fido_tx(dev, CTAP_CMD_CANCEL, NULL, 0, &ms) < 0)
+#ifdef USE_BLE
+	if (dev->transport.rx == fido_ble_rx)
+		return (fido_dev_ping_ctaphid(dev, &ms));
+#endif
+	if (dev->transport.rx != NULL)
+		return (fido_dev_ping_apdu(dev, &ms));
+
+	return (fido_dev_ping_ctaphid(dev, &ms));
+}
+
+int
+fido_dev_wink(fido_dev_t *dev)
+{
+	unsigned char	reply[8];
+	int		ms = dev->timeout_ms;
+
+	if (dev->io_handle == NULL || dev->async != NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if (dev->transport.rx != NULL || (dev->flags & FIDO_DEV_WINHELLO) ||
+	    (dev->attr.flags & FIDO_CAP_WINK) == 0)
+		return (FIDO_ERR_UNSUPPORTED_OPTION);
+	/* acknowledged at once; the device winks on its own */
+	if (fido_tx(dev, CTAP_CMD_WINK, NULL, 0, &ms) < 0) {
+		fido_log_debug("%s: fido_tx", __func__);
 		return (FIDO_ERR_TX);
+	}
+	if (fido_rx(dev, CTAP_CMD_WINK, reply, sizeof(reply), &ms) < 0) {
+		fido_log_debug("%s: fido_rx", __func__);
+		return (FIDO_ERR_RX);
+	}
 
 	return (FIDO_OK);
 }
@@ -379,6 +1222,19 @@ fido_dev_set_io_functions(fido_dev_t *dev, const fido_dev_io_t *io)
 	return (FIDO_OK);
 }
 
+int
+fido_dev_set_io_writev(fido_dev_t *dev, fido_dev_io_writev_t *writev)
+{
+	if (dev->io_handle != NULL) {
+		fido_log_debug("%s: non-NULL handle", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	dev->io_writev = writev;
+
+	return (FIDO_OK);
+}
+
 int
 fido_dev_set_transport_functions(fido_dev_t *dev, const fido_dev_transport_t *t)
 {
@@ -393,6 +1249,25 @@ fido_dev_set_transport_functions(fido_dev_t *dev, const fido_dev_transport_t *t)
 	return (FIDO_OK);
 }
 
+int
+fido_dev_set_transport_borrow(fido_dev_t *dev, fido_dev_rx_borrow_t *borrow,
+    fido_dev_rx_release_t *release)
+{
+	if (dev->io_handle != NULL) {
+		fido_log_debug("%s: non-NULL handle", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+	if (dev->transport.rx == NULL || (borrow == NULL) != (release == NULL)) {
+		fido_log_debug("%s: invalid argument", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	dev->rx_borrow = borrow;
+	dev->rx_release = release;
+
+	return (FIDO_OK);
+}
+
 void *
 fido_dev_io_handle(const fido_dev_t *dev)
 {
@@ -407,34 +1282,100 @@ fido_init(int flags)
 		fido_log_init();
 
 	disable_u2f_fallback = (flags & FIDO_DISABLE_U2F_FALLBACK);
+	fido_random_set_drbg((flags & FIDO_RANDOM_DRBG) != 0);
+	if (flags & FIDO_PRELOAD_CRYPTO)
+		fido_evp_preload();
 }
 
-fido_dev_t *
-fido_dev_new(void)
+#if !defined(__linux__) || defined(USE_HIDAPI)
+int
+fido_hid_set_keep_awake(bool keep)
 {
-	fido_dev_t *dev;
+	(void)keep;
 
-	if ((dev = calloc(1, sizeof(*dev))) == NULL)
-		return (NULL);
+	return (FIDO_ERR_UNSUPPORTED_OPTION);
+}
+#endif
+
+#ifndef USE_PCSC
+int
+fido_pcsc_set_keep_card(bool keep)
+{
+	(void)keep;
+
+	return (FIDO_ERR_UNSUPPORTED_OPTION);
+}
+#endif
+
+static void
+dev_reset_rx_timeout(fido_dev_t *dev, bool budget)
+{
+	for (size_t i = 0; i < nitems(dev->rx_timeout); i++) {
+		if (budget)
+			dev->rx_timeout[i].ms = -1;
+		dev->rx_timeout[i].srtt = -1;
+		dev->rx_timeout[i].rttvar = 0;
+	}
+}
 
+static void
+dev_init(fido_dev_t *dev)
+{
 	dev->cid = CTAP_CID_BROADCAST;
 	dev->timeout_ms = -1;
+	dev->largeblob_level = -1; /* zlib's default */
+	dev_reset_rx_timeout(dev, true);
 	dev->io = (fido_dev_io_t) {
 		&fido_hid_open,
 		&fido_hid_close,
 		&fido_hid_read,
 		&fido_hid_write,
 	};
+}
+
+fido_dev_t *
+fido_dev_new(void)
+{
+	fido_dev_t *dev;
+
+	if ((dev = fido_calloc(1, sizeof(*dev))) == NULL)
+		return (NULL);
+
+	dev_init(dev);
 
 	return (dev);
 }
 
+/* release what dev holds, bar the structure and its receive buffer */
+static void
+dev_release(fido_dev_t *dev)
+{
+	fido_rx_async_end(dev);
+	fido_mux_leave(dev);
+	fido_cbor_info_free(&dev->info);
+	fido_dev_uv_cache_free(dev);
+	fido_dev_ecdh_cache_free(dev);
+	fido_dev_largeblob_flush(dev);
+	fido_dev_bio_cache_free(dev);
+	fido_blob_reset(&dev->touch_req);
+	fido_free(dev->session_path);
+	fido_free(dev->stats);
+	fido_wakeup_free(&dev->wakeup);
+	fido_dev_sched_free(dev);
+	fido_record_free(dev);
+	iso7816_buf_free(&dev->apdu_buf);
+	/* only the bytes written since the last fido_rx_buf_put() */
+	if (dev->rx_buf != NULL)
+		explicit_bzero(dev->rx_buf, dev->rx_buf_used);
+	fido_free(dev->path);
+}
+
 fido_dev_t *
 fido_dev_new_with_info(const fido_dev_info_t *di)
 {
 	fido_dev_t *dev;
 
-	if ((dev = calloc(1, sizeof(*dev))) == NULL)
+	if ((dev = fido_calloc(1, sizeof(*dev))) == NULL)
 		return (NULL);
 
 #if 0
@@ -451,8 +1392,12 @@ fido_dev_new_with_info(const fido_dev_info_t *di)
 	dev->transport = di->transport;
 	dev->cid = CTAP_CID_BROADCAST;
 	dev->timeout_ms = -1;
+	dev->largeblob_level = -1; /* zlib's default */
+	dev->model = (uint32_t)(uint16_t)di->vendor_id << 16 |
+	    (uint16_t)di->product_id;
+	dev_reset_rx_timeout(dev, true);
 
-	if ((dev->path = strdup(di->path)) == NULL) {
+	if ((dev->path = fido_strdup(di->path)) == NULL) {
 		fido_log_debug("%s: strdup", __func__);
 		fido_dev_free(&dev);
 		return (NULL);
@@ -469,12 +1414,58 @@ fido_dev_free(fido_dev_t **dev_p)
 	if (dev_p == NULL || (dev = *dev_p) == NULL)
 		return;
 
-	free(dev->path);
-	free(dev);
+	dev_release(dev);
+	fido_free(dev->rx_buf);
+	fido_free(dev);
 
 	*dev_p = NULL;
 }
 
+#ifdef FIDO_FUZZ
+/*
+ * Return dev, which may be open, to the state fido_dev_new() and the io
+ * and transport setters left it in, so that a fuzz harness can use one
+ * device for every input. The receive buffer is kept, grown once to its
+ * largest size, so that no input allocates it and each behaves as the
+ * first one did.
+ */
+int
+fido_dev_fuzz_reset(fido_dev_t *dev)
+{
+	fido_dev_io_t		 io;
+	fido_dev_transport_t	 transport;
+	unsigned char		*rx_buf;
+	size_t			 rx_buf_len;
+	bool			 io_own;
+
+	if (dev->io_handle != NULL)
+		fido_dev_close(dev);
+	dev_release(dev);
+
+	io = dev->io;
+	transport = dev->transport;
+	io_own = dev->io_own;
+	rx_buf = dev->rx_buf;
+	rx_buf_len = dev->rx_buf_len;
+	if (rx_buf_len < FIDO_MAXMSG_LIMIT) {
+		fido_free(rx_buf);
+		rx_buf_len = FIDO_MAXMSG_LIMIT;
+		if ((rx_buf = fido_calloc(1, rx_buf_len)) == NULL)
+			rx_buf_len = 0;
+	}
+
+	memset(dev, 0, sizeof(*dev));
+	dev_init(dev);
+	dev->io = io;
+	dev->transport = transport;
+	dev->io_own = io_own;
+	dev->rx_buf = rx_buf;
+	dev->rx_buf_len = rx_buf_len;
+
+	return (rx_buf != NULL ? 0 : -1);
+}
+#endif
+
 uint8_t
 fido_dev_protocol(const fido_dev_t *dev)
 {
@@ -599,3 +1590,93 @@ fido_dev_set_timeout(fido_dev_t *dev, int ms)
 
 	return (FIDO_OK);
 }
+
+int
+fido_dev_set_cmd_timeout(fido_dev_t *dev, int class, int ms)
+{
+	if (class < 0 || class >= FIDO_TIMEOUT_NCLASS || ms < -1)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	dev->rx_timeout[class].ms = ms;
+
+	return (FIDO_OK);
+}
+
+/* enabling resets the observed waits */
+int
+fido_dev_set_adaptive_timeout(fido_dev_t *dev, bool enable)
+{
+	dev_reset_rx_timeout(dev, false);
+	dev->rx_adaptive = enable;
+
+	return (FIDO_OK);
+}
+
+/*
+ * The budget of class: the configured one or, in adaptive mode once a
+ * reply was seen, the smoothed wait plus four deviations (as in TCP's
+ * retransmission timer), whichever is smaller. Waits for user presence
+ * are not predictable and are never tuned.
+ */
+int
+fido_dev_cmd_timeout(const fido_dev_t *dev, int class)
+{
+	const struct fido_rx_timeout	*t;
+	int				 ms;
+
+	if (class < 0 || class >= FIDO_TIMEOUT_NCLASS)
+		return (-1);
+
+	t = &dev->rx_timeout[class];
+	if (dev->rx_adaptive == false || class == FIDO_TIMEOUT_UP ||
+	    t->srtt < 0)
+		return (t->ms);
+
+	ms = MAX(t->srtt + 4 * t->rttvar, FIDO_RX_ADAPTIVE_MIN_MS);
+	if (t->ms >= 0)
+		ms = MIN(ms, t->ms);
+
+	return (ms);
+}
+
+/* fold the longest wait for a report of a command of class into its budget */
+void
+fido_dev_rx_sample(fido_dev_t *dev, int class, int ms)
+{
+	struct fido_rx_timeout *t = &dev->rx_timeout[class];
+
+	if (dev->rx_adaptive == false || class == FIDO_TIMEOUT_UP || ms < 0)
+		return;
+
+	ms = MIN(ms, FIDO_RX_ADAPTIVE_MAX_MS);
+	if (t->srtt < 0) {
+		t->srtt = ms;
+		t->rttvar = ms / 2;
+	} else {
+		t->rttvar = (3 * t->rttvar + abs(t->srtt - ms)) / 4;
+		t->srtt = (7 * t->srtt + ms) / 8;
+	}
+}
+
+/* the budget of class expired; back off */
+void
+fido_dev_rx_expired(fido_dev_t *dev, int class)
+{
+	struct fido_rx_timeout *t = &dev->rx_timeout[class];
+
+	if (dev->rx_adaptive == false || t->srtt < 0)
+		return;
+
+	t->srtt = MIN(MAX(2 * t->srtt, FIDO_RX_ADAPTIVE_MIN_MS),
+	    FIDO_RX_ADAPTIVE_MAX_MS);
+	t->rttvar = MIN(2 * t->rttvar, FIDO_RX_ADAPTIVE_MAX_MS);
+}
+
+int
+fido_dev_set_keepalive_cb(fido_dev_t *dev, fido_keepalive_cb_t *cb, void *arg)
+{
+	dev->keepalive_cb = cb;
+	dev->keepalive_arg = arg;
+
+	return (FIDO_OK);
+}
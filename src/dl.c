@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include <dlfcn.h>
+
+#include "fido.h"
+#include "dl.h"
+
+#ifndef UDEV_SONAME
+#define UDEV_SONAME	"libudev.so.1"
+#endif
+#ifndef PCSC_SONAME
+#define PCSC_SONAME	"libpcsclite.so.1"
+#endif
+
+#ifdef HAVE_PTHREAD
+#define DL_ONCE_INIT		PTHREAD_ONCE_INIT
+#define DL_ONCE(o, f)		pthread_once(o, f)
+typedef pthread_once_t dl_once_t;
+#else
+#define DL_ONCE_INIT		false
+#define DL_ONCE(o, f)		do { if (!*(o)) { *(o) = true; f(); } } while (0)
+typedef bool dl_once_t;
+#endif
+
+struct dl_sym {
+	const char	*name;
+	void		**ptr;
+};
+
+#define DL_DEFINE(s)	__typeof__(s) *fido_dl_##s;
+#define DL_ENTRY(s)	{ #s, (void **)(void *)&fido_dl_##s },
+
+/*
+ * Load soname and resolve syms; on failure, all of syms are left NULL
+ * and the library is not tried again.
+ */
+static bool
+dl_load(const char *soname, const struct dl_sym *sym, size_t n)
+{
+	void *handle;
+
+	if ((handle = dlopen(soname, RTLD_NOW | RTLD_LOCAL)) == NULL) {
+		fido_log_debug("%s: dlopen %s: %s", __func__, soname,
+		    dlerror());
+		return (false);
+	}
+	for (size_t i = 0; i < n; i++)
+		if ((*sym[i].ptr = dlsym(handle, sym[i].name)) == NULL) {
+			fido_log_debug("%s: dlsym %s: %s", __func__,
+			    sym[i].name, dlerror());
+			for (size_t j = 0; j < i; j++)
+				*sym[j].ptr = NULL;
+			dlclose(handle);
+			return (false);
+		}
+	fido_log_debug("%s: %s", __func__, soname);
+
+	return (true);
+}
+
+#ifdef DL_UDEV_SYMS
+DL_UDEV_SYMS(DL_DEFINE)
+static __typeof__(fido_dl_udev_new)	*dl_udev_new;
+static dl_once_t			 dl_udev_once = DL_ONCE_INIT;
+
+static void
+dl_udev_load(void)
+{
+	const struct dl_sym sym[] = {
+		{ "udev_new", (void **)&dl_udev_new },
+		DL_UDEV_SYMS(DL_ENTRY)
+	};
+
+	(void)dl_load(UDEV_SONAME, sym, nitems(sym));
+}
+
+struct udev *
+fido_dl_udev_new(void)
+{
+	DL_ONCE(&dl_udev_once, dl_udev_load);
+	if (dl_udev_new == NULL)
+		return (NULL);
+
+	return (dl_udev_new());
+}
+#endif /* DL_UDEV_SYMS */
+
+#ifdef DL_PCSC_SYMS
+DL_PCSC_SYMS(DL_DEFINE)
+static __typeof__(fido_dl_SCardEstablishContext)	*dl_establish_ctx;
+static dl_once_t					 dl_pcsc_once =
+    DL_ONCE_INIT;
+
+static void
+dl_pcsc_load(void)
+{
+	const struct dl_sym sym[] = {
+		{ "SCardEstablishContext", (void **)&dl_establish_ctx },
+		DL_PCSC_SYMS(DL_ENTRY)
+	};
+
+	(void)dl_load(PCSC_SONAME, sym, nitems(sym));
+}
+
+LONG
+fido_dl_SCardEstablishContext(DWORD scope, LPCVOID r1, LPCVOID r2,
+    LPSCARDCONTEXT ctx)
+{
+	DL_ONCE(&dl_pcsc_once, dl_pcsc_load);
+	if (dl_establish_ctx == NULL)
+		return (SCARD_E_NO_SERVICE);
+
+	return (dl_establish_ctx(scope, r1, r2, ctx));
+}
+#endif /* DL_PCSC_SYMS */
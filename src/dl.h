@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef _DL_H
+#define _DL_H
+
+/*
+ * With USE_DLOPEN, libudev and pcsc-lite are not linked against but
+ * loaded by dl.c the first time a backend needs them. The names below
+ * are redirected to pointers filled in by the loader; udev_new() and
+ * SCardEstablishContext(), which every use of their library starts
+ * with, load it and fail as if no devices were present when it cannot
+ * be loaded. Include this header after the library's own.
+ */
+
+#ifdef USE_DLOPEN
+
+#ifdef __linux__
+#include <libudev.h>
+
+#define DL_UDEV_SYMS(X) \
+	X(udev_device_get_devnode) \
+	X(udev_device_get_devnum) \
+	X(udev_device_get_parent_with_subsystem_devtype) \
+	X(udev_device_get_sysattr_value) \
+	X(udev_device_get_sysnum) \
+	X(udev_device_get_syspath) \
+	X(udev_device_new_from_devnum) \
+	X(udev_device_new_from_syspath) \
+	X(udev_device_set_sysattr_value) \
+	X(udev_device_unref) \
+	X(udev_enumerate_add_match_subsystem) \
+	X(udev_enumerate_get_list_entry) \
+	X(udev_enumerate_new) \
+	X(udev_enumerate_scan_devices) \
+	X(udev_enumerate_unref) \
+	X(udev_list_entry_get_name) \
+	X(udev_list_entry_get_next) \
+	X(udev_monitor_enable_receiving) \
+	X(udev_monitor_filter_add_match_subsystem_devtype) \
+	X(udev_monitor_get_fd) \
+	X(udev_monitor_new_from_netlink) \
+	X(udev_monitor_receive_device) \
+	X(udev_monitor_unref) \
+	X(udev_unref)
+#endif /* __linux__ */
+
+#if defined(USE_PCSC) && !defined(_WIN32) && !defined(__APPLE__)
+#include <winscard.h>
+
+#define DL_PCSC_SYMS(X) \
+	X(SCardCancel) \
+	X(SCardConnect) \
+	X(SCardDisconnect) \
+	X(SCardGetStatusChange) \
+	X(SCardListReaders) \
+	X(SCardReconnect) \
+	X(SCardReleaseContext) \
+	X(SCardStatus) \
+	X(SCardTransmit) \
+	X(g_rgSCardT0Pci) \
+	X(g_rgSCardT1Pci)
+#endif /* USE_PCSC */
+
+#define DL_DECLARE(s)	extern __typeof__(s) *fido_dl_##s;
+
+#ifdef DL_UDEV_SYMS
+DL_UDEV_SYMS(DL_DECLARE)
+__typeof__(udev_new) fido_dl_udev_new;
+
+#define udev_device_get_devnode	(*fido_dl_udev_device_get_devnode)
+#define udev_device_get_devnum	(*fido_dl_udev_device_get_devnum)
+#define udev_device_get_parent_with_subsystem_devtype \
+	(*fido_dl_udev_device_get_parent_with_subsystem_devtype)
+#define udev_device_get_sysattr_value \
+	(*fido_dl_udev_device_get_sysattr_value)
+#define udev_device_get_sysnum	(*fido_dl_udev_device_get_sysnum)
+#define udev_device_get_syspath	(*fido_dl_udev_device_get_syspath)
+#define udev_device_new_from_devnum \
+	(*fido_dl_udev_device_new_from_devnum)
+#define udev_device_new_from_syspath \
+	(*fido_dl_udev_device_new_from_syspath)
+#define udev_device_set_sysattr_value \
+	(*fido_dl_udev_device_set_sysattr_value)
+#define udev_device_unref	(*fido_dl_udev_device_unref)
+#define udev_enumerate_add_match_subsystem \
+	(*fido_dl_udev_enumerate_add_match_subsystem)
+#define udev_enumerate_get_list_entry \
+	(*fido_dl_udev_enumerate_get_list_entry)
+#define udev_enumerate_new	(*fido_dl_udev_enumerate_new)
+#define udev_enumerate_scan_devices \
+	(*fido_dl_udev_enumerate_scan_devices)
+#define udev_enumerate_unref	(*fido_dl_udev_enumerate_unref)
+#define udev_list_entry_get_name (*fido_dl_udev_list_entry_get_name)
+#define udev_list_entry_get_next (*fido_dl_udev_list_entry_get_next)
+#define udev_monitor_enable_receiving \
+	(*fido_dl_udev_monitor_enable_receiving)
+#define udev_monitor_filter_add_match_subsystem_devtype \
+	(*fido_dl_udev_monitor_filter_add_match_subsystem_devtype)
+#define udev_monitor_get_fd	(*fido_dl_udev_monitor_get_fd)
+#define udev_monitor_new_from_netlink \
+	(*fido_dl_udev_monitor_new_from_netlink)
+#define udev_monitor_receive_device \
+	(*fido_dl_udev_monitor_receive_device)
+#define udev_monitor_unref	(*fido_dl_udev_monitor_unref)
+#define udev_new		fido_dl_udev_new
+#define udev_unref		(*fido_dl_udev_unref)
+#endif /* DL_UDEV_SYMS */
+
+#ifdef DL_PCSC_SYMS
+DL_PCSC_SYMS(DL_DECLARE)
+__typeof__(SCardEstablishContext) fido_dl_SCardEstablishContext;
+
+#define SCardCancel		(*fido_dl_SCardCancel)
+#define SCardConnect		(*fido_dl_SCardConnect)
+#define SCardDisconnect		(*fido_dl_SCardDisconnect)
+#define SCardEstablishContext	fido_dl_SCardEstablishContext
+#define SCardGetStatusChange	(*fido_dl_SCardGetStatusChange)
+#define SCardListReaders	(*fido_dl_SCardListReaders)
+#define SCardReconnect		(*fido_dl_SCardReconnect)
+#define SCardReleaseContext	(*fido_dl_SCardReleaseContext)
+#define SCardStatus		(*fido_dl_SCardStatus)
+#define SCardTransmit		(*fido_dl_SCardTransmit)
+#define g_rgSCardT0Pci		(*fido_dl_g_rgSCardT0Pci)
+#define g_rgSCardT1Pci		(*fido_dl_g_rgSCardT1Pci)
+#endif /* DL_PCSC_SYMS */
+
+#endif /* USE_DLOPEN */
+
+#endif /* !_DL_H */
@@ -12,6 +12,9 @@
 #else
 #include <openssl/kdf.h>
 #endif
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+#include <openssl/core_names.h>
+#endif
 
 #include "fido.h"
 #include "fido/es256.h"
@@ -24,13 +27,47 @@ hkdf_sha256(uint8_t *key, const char *info, const fido_blob_t *secret)
 	uint8_t salt[32];
 
 	memset(salt, 0, sizeof(salt));
-	if ((md = EVP_sha256()) == NULL ||
+	if ((md = fido_evp_sha256()) == NULL ||
 	    HKDF(key, SHA256_DIGEST_LENGTH, md, secret->ptr, secret->len, salt,
 	    sizeof(salt), (const uint8_t *)info, strlen(info)) != 1)
 		return -1;
 
 	return 0;
 }
+#elif OPENSSL_VERSION_NUMBER >= 0x30000000
+static int
+hkdf_sha256(uint8_t *key, char *info, fido_blob_t *secret)
+{
+	EVP_KDF_CTX *ctx = NULL;
+	OSSL_PARAM params[4];
+	uint8_t	salt[32];
+	int ok = -1;
+
+	memset(salt, 0, sizeof(salt));
+	params[0] = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_KEY,
+	    secret->ptr, secret->len);
+	params[1] = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_SALT,
+	    salt, sizeof(salt));
+	params[2] = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_INFO,
+	    info, strlen(info));
+	params[3] = OSSL_PARAM_construct_end();
+
+	/* the digest is set up by fido_evp_hkdf_sha256() */
+	if ((ctx = fido_evp_hkdf_sha256()) == NULL) {
+		fido_log_debug("%s: fido_evp_hkdf_sha256", __func__);
+		goto fail;
+	}
+	if (EVP_KDF_derive(ctx, key, SHA256_DIGEST_LENGTH, params) != 1) {
+		fido_log_debug("%s: EVP_KDF_derive", __func__);
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+	EVP_KDF_CTX_free(ctx);
+
+	return ok;
+}
 #else
 static int
 hkdf_sha256(uint8_t *key, char *info, fido_blob_t *secret)
@@ -47,7 +84,7 @@ hkdf_sha256(uint8_t *key, char *info, fido_blob_t *secret)
 		fido_log_debug("%s: invalid param", __func__);
 		goto fail;
 	}
-	if ((const_md = EVP_sha256()) == NULL ||
+	if ((const_md = fido_evp_sha256()) == NULL ||
 	    (md = EVP_MD_meth_dup(const_md)) == NULL ||
 	    (ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL)) == NULL) {
 		fido_log_debug("%s: init", __func__);
@@ -87,7 +124,7 @@ kdf(uint8_t prot, fido_blob_t *key, /* const */ fido_blob_t *secret)
 	case CTAP_PIN_PROTOCOL1:
 		/* use sha256 on the resulting secret */
 		key->len = SHA256_DIGEST_LENGTH;
-		if ((key->ptr = calloc(1, key->len)) == NULL ||
+		if ((key->ptr = fido_secure_alloc(key->len)) == NULL ||
 		    SHA256(secret->ptr, secret->len, key->ptr) != key->ptr) {
 			fido_log_debug("%s: SHA256", __func__);
 			return -1;
@@ -96,7 +133,7 @@ kdf(uint8_t prot, fido_blob_t *key, /* const */ fido_blob_t *secret)
 	case CTAP_PIN_PROTOCOL2:
 		/* use two instances of hkdf-sha256 on the resulting secret */
 		key->len = 2 * SHA256_DIGEST_LENGTH;
-		if ((key->ptr = calloc(1, key->len)) == NULL ||
+		if ((key->ptr = fido_secure_alloc(key->len)) == NULL ||
 		    hkdf_sha256(key->ptr, hmac_info, secret) < 0 ||
 		    hkdf_sha256(key->ptr + SHA256_DIGEST_LENGTH, aes_info,
 		    secret) < 0) {
@@ -131,14 +168,14 @@ do_ecdh(const fido_dev_t *dev, const es256_sk_t *sk, const es256_pk_t *pk,
 		fido_log_debug("%s: es256_to_EVP_PKEY", __func__);
 		goto fail;
 	}
-	if ((ctx = EVP_PKEY_CTX_new(sk_evp, NULL)) == NULL ||
+	if ((ctx = fido_evp_pkey_ctx(sk_evp)) == NULL ||
 	    EVP_PKEY_derive_init(ctx) <= 0 ||
 	    EVP_PKEY_derive_set_peer(ctx, pk_evp) <= 0) {
 		fido_log_debug("%s: EVP_PKEY_derive_init", __func__);
 		goto fail;
 	}
 	if (EVP_PKEY_derive(ctx, NULL, &secret->len) <= 0 ||
-	    (secret->ptr = calloc(1, secret->len)) == NULL ||
+	    (secret->ptr = fido_secure_alloc(secret->len)) == NULL ||
 	    EVP_PKEY_derive(ctx, secret->ptr, &secret->len) <= 0) {
 		fido_log_debug("%s: EVP_PKEY_derive", __func__);
 		goto fail;
@@ -164,20 +201,53 @@ fail:
 	return ok;
 }
 
+struct fido_ecdh_cache {
+	es256_pk_t	*pk;   /* our public key, as sent to the authenticator */
+	fido_blob_t	*ecdh; /* shared secret */
+	bool		 used; /* handed out to the current operation */
+};
+
+static void
+ecdh_cache_reset(struct fido_ecdh_cache *c)
+{
+	es256_pk_free(&c->pk);
+	fido_blob_free(&c->ecdh);
+	c->used = false;
+}
+
+static void
+ecdh_cache_store(struct fido_ecdh_cache *c, const es256_pk_t *pk,
+    const fido_blob_t *ecdh)
+{
+	ecdh_cache_reset(c);
+
+	if ((c->pk = es256_pk_new()) == NULL ||
+	    (c->ecdh = fido_blob_new()) == NULL ||
+	    fido_blob_set_secure(c->ecdh, ecdh->ptr, ecdh->len) < 0) {
+		fido_log_debug("%s: fido_blob_set_secure", __func__);
+		ecdh_cache_reset(c);
+		return;
+	}
+	memcpy(c->pk, pk, sizeof(*c->pk));
+}
+
 int
 fido_do_ecdh(fido_dev_t *dev, es256_pk_t **pk, fido_blob_t **ecdh, int *ms)
 {
 	es256_sk_t *sk = NULL; /* our private key */
 	es256_pk_t *ak = NULL; /* authenticator's public key */
+	fido_trace_span_t span;
 	int r;
 
 	*pk = NULL;
 	*ecdh = NULL;
+	fido_trace_span_begin(dev, &span, FIDO_SPAN_ECDH);
 	if ((sk = es256_sk_new()) == NULL || (*pk = es256_pk_new()) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
-	if (es256_sk_create(sk) < 0 || es256_derive_pk(sk, *pk) < 0) {
+	if (fido_keypool_get(sk, *pk) < 0 &&
+	    (es256_sk_create(sk) < 0 || es256_derive_pk(sk, *pk) < 0)) {
 		fido_log_debug("%s: es256_derive_pk", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
@@ -194,6 +264,9 @@ fido_do_ecdh(fido_dev_t *dev, es256_pk_t **pk, fido_blob_t **ecdh, int *ms)
 		goto fail;
 	}
 
+	if (dev->ecdh_cache != NULL)
+		ecdh_cache_store(dev->ecdh_cache, *pk, *ecdh);
+
 	r = FIDO_OK;
 fail:
 	es256_sk_free(&sk);
@@ -203,6 +276,88 @@ fail:
 		es256_pk_free(pk);
 		fido_blob_free(ecdh);
 	}
+	fido_trace_span_end(dev, &span, r);
 
 	return r;
 }
+
+/*
+ * Return copies of the key and shared secret of the last key agreement
+ * with dev, performing a new one if none is kept. Callers must not send
+ * a PIN under a reused secret: should the authenticator have rotated its
+ * key, the PIN would be rejected and a retry consumed.
+ */
+int
+fido_do_ecdh_cached(fido_dev_t *dev, es256_pk_t **pk, fido_blob_t **ecdh,
+    int *ms)
+{
+	struct fido_ecdh_cache *c = dev->ecdh_cache;
+
+	if (c == NULL || c->pk == NULL || c->ecdh == NULL)
+		return fido_do_ecdh(dev, pk, ecdh, ms);
+
+	*pk = NULL;
+	*ecdh = NULL;
+	if ((*pk = es256_pk_new()) == NULL ||
+	    (*ecdh = fido_blob_new()) == NULL ||
+	    fido_blob_set_secure(*ecdh, c->ecdh->ptr, c->ecdh->len) < 0) {
+		es256_pk_free(pk);
+		fido_blob_free(ecdh);
+		return FIDO_ERR_INTERNAL;
+	}
+	memcpy(*pk, c->pk, sizeof(**pk));
+	c->used = true;
+
+	return FIDO_OK;
+}
+
+/*
+ * Called with the result of an operation. If it failed under a reused
+ * secret, the authenticator may have rotated its key; forget the secret
+ * so that the next operation performs a new key agreement.
+ */
+void
+fido_dev_ecdh_result(fido_dev_t *dev, int r)
+{
+	struct fido_ecdh_cache *c;
+
+	if ((c = dev->ecdh_cache) == NULL)
+		return;
+	if (c->used && r != FIDO_OK) {
+		fido_log_debug("%s: dropping shared secret", __func__);
+		ecdh_cache_reset(c);
+	}
+	c->used = false;
+}
+
+void
+fido_dev_ecdh_flush(fido_dev_t *dev)
+{
+	if (dev->ecdh_cache != NULL)
+		ecdh_cache_reset(dev->ecdh_cache);
+}
+
+void
+fido_dev_ecdh_cache_free(fido_dev_t *dev)
+{
+	if (dev->ecdh_cache == NULL)
+		return;
+	ecdh_cache_reset(dev->ecdh_cache);
+	fido_free(dev->ecdh_cache);
+	dev->ecdh_cache = NULL;
+}
+
+int
+fido_dev_set_ecdh_cache(fido_dev_t *dev, bool enable)
+{
+	if (enable == false) {
+		fido_dev_ecdh_cache_free(dev);
+		return FIDO_OK;
+	}
+	if (dev->ecdh_cache == NULL &&
+	    (dev->ecdh_cache = fido_calloc(1,
+	    sizeof(*dev->ecdh_cache))) == NULL)
+		return FIDO_ERR_INTERNAL;
+
+	return FIDO_OK;
+}
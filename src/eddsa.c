@@ -105,7 +105,7 @@ eddsa_pk_decode(const cbor_item_t *item, eddsa_pk_t *k)
 eddsa_pk_t *
 eddsa_pk_new(void)
 {
-	return (calloc(1, sizeof(eddsa_pk_t)));
+	return (fido_calloc(1, sizeof(eddsa_pk_t)));
 }
 
 void
@@ -116,7 +116,7 @@ eddsa_pk_free(eddsa_pk_t **pkp)
 	if (pkp == NULL || (pk = *pkp) == NULL)
 		return;
 
-	freezero(pk, sizeof(*pk));
+	fido_freezero(pk, sizeof(*pk));
 	*pkp = NULL;
 }
 
@@ -169,12 +169,12 @@ eddsa_pk_from_EVP_PKEY(eddsa_pk_t *pk, const EVP_PKEY *pkey)
 	return (FIDO_OK);
 }
 
+/* verify with a caller's digest context, which is left reset */
 int
-eddsa_verify_sig(const fido_blob_t *dgst, EVP_PKEY *pkey,
-    const fido_blob_t *sig)
+eddsa_verify_sig_ctx(EVP_MD_CTX *mdctx, const fido_blob_t *dgst,
+    EVP_PKEY *pkey, const fido_blob_t *sig)
 {
-	EVP_MD_CTX	*mdctx = NULL;
-	int		 ok = -1;
+	int ok = -1;
 
 	if (EVP_PKEY_base_id(pkey) != EVP_PKEY_ED25519) {
 		fido_log_debug("%s: EVP_PKEY_base_id", __func__);
@@ -185,15 +185,10 @@ eddsa_verify_sig(const fido_blob_t *dgst, EVP_PKEY *pkey,
 	if (dgst->len > INT_MAX || sig->len > INT_MAX) {
 		fido_log_debug("%s: dgst->len=%zu, sig->len=%zu", __func__,
 		    dgst->len, sig->len);
-		return (-1);
-	}
-
-	if ((mdctx = EVP_MD_CTX_new()) == NULL) {
-		fido_log_debug("%s: EVP_MD_CTX_new", __func__);
 		goto fail;
 	}
 
-	if (EVP_DigestVerifyInit(mdctx, NULL, NULL, NULL, pkey) != 1) {
+	if (fido_evp_verify_init(mdctx, NULL, pkey) != 1) {
 		fido_log_debug("%s: EVP_DigestVerifyInit", __func__);
 		goto fail;
 	}
@@ -206,6 +201,24 @@ eddsa_verify_sig(const fido_blob_t *dgst, EVP_PKEY *pkey,
 
 	ok = 0;
 fail:
+	EVP_MD_CTX_reset(mdctx);
+
+	return (ok);
+}
+
+int
+eddsa_verify_sig(const fido_blob_t *dgst, EVP_PKEY *pkey,
+    const fido_blob_t *sig)
+{
+	EVP_MD_CTX	*mdctx;
+	int		 ok;
+
+	if ((mdctx = EVP_MD_CTX_new()) == NULL) {
+		fido_log_debug("%s: EVP_MD_CTX_new", __func__);
+		return (-1);
+	}
+
+	ok = eddsa_verify_sig_ctx(mdctx, dgst, pkey, sig);
 	EVP_MD_CTX_free(mdctx);
 
 	return (ok);
@@ -143,7 +143,7 @@ fail:
 es256_sk_t *
 es256_sk_new(void)
 {
-	return (calloc(1, sizeof(es256_sk_t)));
+	return (fido_calloc(1, sizeof(es256_sk_t)));
 }
 
 void
@@ -154,14 +154,14 @@ es256_sk_free(es256_sk_t **skp)
 	if (skp == NULL || (sk = *skp) == NULL)
 		return;
 
-	freezero(sk, sizeof(*sk));
+	fido_freezero(sk, sizeof(*sk));
 	*skp = NULL;
 }
 
 es256_pk_t *
 es256_pk_new(void)
 {
-	return (calloc(1, sizeof(es256_pk_t)));
+	return (fido_calloc(1, sizeof(es256_pk_t)));
 }
 
 void
@@ -172,16 +172,51 @@ es256_pk_free(es256_pk_t **pkp)
 	if (pkp == NULL || (pk = *pkp) == NULL)
 		return;
 
-	freezero(pk, sizeof(*pk));
+	fido_freezero(pk, sizeof(*pk));
 	*pkp = NULL;
 }
 
+/* decompress a sec1 compressed point */
+static int
+pk_decompress(es256_pk_t *pk, const uint8_t *p, size_t len)
+{
+	EC_KEY		*ec = NULL;
+	EC_POINT	*q = NULL;
+	const EC_GROUP	*g = NULL;
+	int		 ok = FIDO_ERR_INTERNAL;
+
+	if ((ec = EC_KEY_new_by_curve_name(es256_nid)) == NULL ||
+	    (g = EC_KEY_get0_group(ec)) == NULL ||
+	    (q = EC_POINT_new(g)) == NULL) {
+		fido_log_debug("%s: EC_KEY init", __func__);
+		goto fail;
+	}
+
+	if (EC_POINT_oct2point(g, q, p, len, NULL) == 0 ||
+	    EC_KEY_set_public_key(ec, q) == 0) {
+		fido_log_debug("%s: EC_POINT_oct2point", __func__);
+		ok = FIDO_ERR_INVALID_ARGUMENT;
+		goto fail;
+	}
+
+	ok = es256_pk_from_EC_KEY(pk, ec);
+fail:
+	if (ec != NULL)
+		EC_KEY_free(ec);
+	if (q != NULL)
+		EC_POINT_free(q);
+
+	return (ok);
+}
+
 int
 es256_pk_from_ptr(es256_pk_t *pk, const void *ptr, size_t len)
 {
 	const uint8_t	*p = ptr;
 	EVP_PKEY	*pkey;
 
+	if (len == sizeof(pk->x) + 1 && (*p == 0x02 || *p == 0x03))
+		return (pk_decompress(pk, p, len)); /* compressed format */
 	if (len < sizeof(*pk))
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
@@ -201,6 +236,18 @@ es256_pk_from_ptr(es256_pk_t *pk, const void *ptr, size_t len)
 	return (FIDO_OK);
 }
 
+int
+es256_pk_to_compressed(const es256_pk_t *pk, unsigned char *ptr, size_t len)
+{
+	if (len < sizeof(pk->x) + 1)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	ptr[0] = 0x02 | (pk->y[sizeof(pk->y) - 1] & 1);
+	memcpy(ptr + 1, pk->x, sizeof(pk->x));
+
+	return (FIDO_OK);
+}
+
 int
 es256_pk_set_x(es256_pk_t *pk, const unsigned char *x)
 {
@@ -237,7 +284,7 @@ es256_sk_create(es256_sk_t *key)
 		goto fail;
 	}
 
-	if ((kctx = EVP_PKEY_CTX_new(p, NULL)) == NULL ||
+	if ((kctx = fido_evp_pkey_ctx(p)) == NULL ||
 	    EVP_PKEY_keygen_init(kctx) <= 0 || EVP_PKEY_keygen(kctx, &k) <= 0) {
 		fido_log_debug("%s: EVP_PKEY_keygen", __func__);
 		goto fail;
@@ -493,11 +540,21 @@ fail:
 	return (ok);
 }
 
+/*
+ * The EC_KEY held by pkey is used directly: ECDSA_verify() skips the
+ * EVP_PKEY_CTX, and with OpenSSL 3.0 the provider lookup and key export,
+ * which cost more than the verification itself. The point was validated
+ * when pkey was built, and the inputs are public, so there is nothing for
+ * a constant-time path to protect. With a library context set by
+ * fido_set_libctx(), the EVP_PKEY_CTX is used, so that the context's
+ * providers do the work.
+ */
 int
 es256_verify_sig(const fido_blob_t *dgst, EVP_PKEY *pkey,
     const fido_blob_t *sig)
 {
 	EVP_PKEY_CTX	*pctx = NULL;
+	const EC_KEY	*ec;
 	int		 ok = -1;
 
 	if (EVP_PKEY_base_id(pkey) != EVP_PKEY_EC) {
@@ -505,7 +562,18 @@ es256_verify_sig(const fido_blob_t *dgst, EVP_PKEY *pkey,
 		goto fail;
 	}
 
-	if ((pctx = EVP_PKEY_CTX_new(pkey, NULL)) == NULL ||
+	if (fido_evp_default_ctx() && (ec = get0_EC_KEY(pkey)) != NULL) {
+		if (dgst->len > INT_MAX || sig->len > INT_MAX ||
+		    ECDSA_verify(0, dgst->ptr, (int)dgst->len, sig->ptr,
+		    (int)sig->len, (EC_KEY *)(uintptr_t)ec) != 1) {
+			fido_log_debug("%s: ECDSA_verify", __func__);
+			goto fail;
+		}
+		ok = 0;
+		goto fail;
+	}
+
+	if ((pctx = fido_evp_pkey_ctx(pkey)) == NULL ||
 	    EVP_PKEY_verify_init(pctx) != 1 ||
 	    EVP_PKEY_verify(pctx, sig->ptr, sig->len, dgst->ptr,
 	    dgst->len) != 1) {
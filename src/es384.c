@@ -68,7 +68,7 @@ es384_pk_decode(const cbor_item_t *item, es384_pk_t *k)
 es384_pk_t *
 es384_pk_new(void)
 {
-	return (calloc(1, sizeof(es384_pk_t)));
+	return (fido_calloc(1, sizeof(es384_pk_t)));
 }
 
 void
@@ -79,16 +79,51 @@ es384_pk_free(es384_pk_t **pkp)
 	if (pkp == NULL || (pk = *pkp) == NULL)
 		return;
 
-	freezero(pk, sizeof(*pk));
+	fido_freezero(pk, sizeof(*pk));
 	*pkp = NULL;
 }
 
+/* decompress a sec1 compressed point */
+static int
+pk_decompress(es384_pk_t *pk, const uint8_t *p, size_t len)
+{
+	EC_KEY		*ec = NULL;
+	EC_POINT	*q = NULL;
+	const EC_GROUP	*g = NULL;
+	int		 ok = FIDO_ERR_INTERNAL;
+
+	if ((ec = EC_KEY_new_by_curve_name(NID_secp384r1)) == NULL ||
+	    (g = EC_KEY_get0_group(ec)) == NULL ||
+	    (q = EC_POINT_new(g)) == NULL) {
+		fido_log_debug("%s: EC_KEY init", __func__);
+		goto fail;
+	}
+
+	if (EC_POINT_oct2point(g, q, p, len, NULL) == 0 ||
+	    EC_KEY_set_public_key(ec, q) == 0) {
+		fido_log_debug("%s: EC_POINT_oct2point", __func__);
+		ok = FIDO_ERR_INVALID_ARGUMENT;
+		goto fail;
+	}
+
+	ok = es384_pk_from_EC_KEY(pk, ec);
+fail:
+	if (ec != NULL)
+		EC_KEY_free(ec);
+	if (q != NULL)
+		EC_POINT_free(q);
+
+	return (ok);
+}
+
 int
 es384_pk_from_ptr(es384_pk_t *pk, const void *ptr, size_t len)
 {
 	const uint8_t	*p = ptr;
 	EVP_PKEY	*pkey;
 
+	if (len == sizeof(pk->x) + 1 && (*p == 0x02 || *p == 0x03))
+		return (pk_decompress(pk, p, len)); /* compressed format */
 	if (len < sizeof(*pk))
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
@@ -108,6 +143,18 @@ es384_pk_from_ptr(es384_pk_t *pk, const void *ptr, size_t len)
 	return (FIDO_OK);
 }
 
+int
+es384_pk_to_compressed(const es384_pk_t *pk, unsigned char *ptr, size_t len)
+{
+	if (len < sizeof(pk->x) + 1)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	ptr[0] = 0x02 | (pk->y[sizeof(pk->y) - 1] & 1);
+	memcpy(ptr + 1, pk->x, sizeof(pk->x));
+
+	return (FIDO_OK);
+}
+
 EVP_PKEY *
 es384_pk_to_EVP_PKEY(const es384_pk_t *k)
 {
@@ -260,7 +307,7 @@ es384_verify_sig(const fido_blob_t *dgst, EVP_PKEY *pkey,
 		goto fail;
 	}
 
-	if ((pctx = EVP_PKEY_CTX_new(pkey, NULL)) == NULL ||
+	if ((pctx = fido_evp_pkey_ctx(pkey)) == NULL ||
 	    EVP_PKEY_verify_init(pctx) != 1 ||
 	    EVP_PKEY_verify(pctx, sig->ptr, sig->len, dgst->ptr,
 	    dgst->len) != 1) {
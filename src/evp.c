@@ -0,0 +1,366 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include <openssl/evp.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+#include <openssl/core_names.h>
+#include <openssl/kdf.h>
+#endif
+
+#include "fido.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+/*
+ * With OpenSSL 3, EVP_sha256() and friends return objects that are
+ * fetched from the default provider every time they are used. Fetch
+ * them once instead, when first needed, and keep them until the library
+ * context they came from is replaced.
+ */
+static struct evp_cache {
+	EVP_MD		*sha1;
+	EVP_MD		*sha256;
+	EVP_MD		*sha384;
+	EVP_CIPHER	*aes_256_cbc;
+	EVP_CIPHER	*aes_256_gcm;
+	EVP_KDF		*hkdf;
+} evp_cache;
+
+/*
+ * The library context and property query algorithms are fetched with,
+ * and keys are used in; see fido_set_libctx(). NULL stands for the
+ * default context and query.
+ */
+static OSSL_LIB_CTX	*evp_libctx;
+static char		*evp_propq;
+
+#ifndef TLS
+#define TLS
+#endif
+
+/*
+ * Each thread keeps a copy of the pointers it has looked up in
+ * evp_cache, so that only its first lookup of an algorithm takes
+ * evp_lock. The objects belong to evp_cache; a thread's copy is dropped
+ * when its generation no longer matches evp_gen, which
+ * fido_set_libctx() advances.
+ */
+static unsigned int evp_gen;
+static TLS struct evp_tls {
+	unsigned int	 gen;
+	struct evp_cache c;
+} evp_tls;
+
+static struct evp_cache *
+evp_tls_cache(void)
+{
+	if (evp_tls.gen != evp_gen) {
+		memset(&evp_tls.c, 0, sizeof(evp_tls.c));
+		evp_tls.gen = evp_gen;
+	}
+
+	return (&evp_tls.c);
+}
+
+#define EVP_TLS(f)	(&evp_tls_cache()->f)
+
+#if defined(HAVE_PTHREAD)
+static pthread_mutex_t evp_lock = PTHREAD_MUTEX_INITIALIZER;
+#define EVP_LOCK()	pthread_mutex_lock(&evp_lock)
+#define EVP_UNLOCK()	pthread_mutex_unlock(&evp_lock)
+#elif defined(_WIN32)
+static SRWLOCK evp_lock = SRWLOCK_INIT;
+#define EVP_LOCK()	AcquireSRWLockExclusive(&evp_lock)
+#define EVP_UNLOCK()	ReleaseSRWLockExclusive(&evp_lock)
+#else
+#define EVP_LOCK()	do { } while (0)
+#define EVP_UNLOCK()	do { } while (0)
+#endif
+
+/* look up md, through this thread's copy local of the cache */
+static EVP_MD *
+md_get(EVP_MD **local, EVP_MD **md, const char *name)
+{
+	if (*local != NULL)
+		return (*local);
+
+	EVP_LOCK();
+	if (*md == NULL &&
+	    (*md = EVP_MD_fetch(evp_libctx, name, evp_propq)) == NULL)
+		fido_log_debug("%s: EVP_MD_fetch %s", __func__, name);
+	*local = *md;
+	EVP_UNLOCK();
+
+	return (*local);
+}
+
+/* a reference to the cached digest, to be released with EVP_MD_free() */
+static EVP_MD *
+md_ref(EVP_MD **local, EVP_MD **md, const char *name)
+{
+	EVP_MD *r;
+
+	if ((r = md_get(local, md, name)) == NULL || EVP_MD_up_ref(r) != 1)
+		return (NULL);
+
+	return (r);
+}
+
+static const EVP_CIPHER *
+cipher_get(EVP_CIPHER **local, EVP_CIPHER **cipher, const char *name)
+{
+	if (*local != NULL)
+		return (*local);
+
+	EVP_LOCK();
+	if (*cipher == NULL &&
+	    (*cipher = EVP_CIPHER_fetch(evp_libctx, name, evp_propq)) == NULL)
+		fido_log_debug("%s: EVP_CIPHER_fetch %s", __func__, name);
+	*local = *cipher;
+	EVP_UNLOCK();
+
+	return (*local);
+}
+
+const EVP_MD *
+fido_evp_sha1(void)
+{
+	return (md_get(EVP_TLS(sha1), &evp_cache.sha1, "SHA1"));
+}
+
+const EVP_MD *
+fido_evp_sha256(void)
+{
+	return (md_get(EVP_TLS(sha256), &evp_cache.sha256, "SHA2-256"));
+}
+
+const EVP_MD *
+fido_evp_sha384(void)
+{
+	return (md_get(EVP_TLS(sha384), &evp_cache.sha384, "SHA2-384"));
+}
+
+EVP_MD *
+fido_evp_sha1_ref(void)
+{
+	return (md_ref(EVP_TLS(sha1), &evp_cache.sha1, "SHA1"));
+}
+
+EVP_MD *
+fido_evp_sha256_ref(void)
+{
+	return (md_ref(EVP_TLS(sha256), &evp_cache.sha256, "SHA2-256"));
+}
+
+const EVP_CIPHER *
+fido_evp_aes_256_cbc(void)
+{
+	return (cipher_get(EVP_TLS(aes_256_cbc), &evp_cache.aes_256_cbc,
+	    "AES-256-CBC"));
+}
+
+const EVP_CIPHER *
+fido_evp_aes_256_gcm(void)
+{
+	return (cipher_get(EVP_TLS(aes_256_gcm), &evp_cache.aes_256_gcm,
+	    "AES-256-GCM"));
+}
+
+/*
+ * Return a new HKDF context with its digest already set up. The caller
+ * sets the key, salt and info, and frees the context.
+ */
+EVP_KDF_CTX *
+fido_evp_hkdf_sha256(void)
+{
+	EVP_KDF		*kdf;
+	EVP_KDF_CTX	*ctx = NULL;
+	OSSL_PARAM	 params[2];
+	char		 digest[] = "SHA2-256";
+
+	params[0] = OSSL_PARAM_construct_utf8_string(OSSL_KDF_PARAM_DIGEST,
+	    digest, 0);
+	params[1] = OSSL_PARAM_construct_end();
+
+	if ((kdf = *EVP_TLS(hkdf)) == NULL) {
+		EVP_LOCK();
+		if (evp_cache.hkdf == NULL &&
+		    (evp_cache.hkdf = EVP_KDF_fetch(evp_libctx, "HKDF",
+		    evp_propq)) == NULL)
+			fido_log_debug("%s: EVP_KDF_fetch", __func__);
+		kdf = *EVP_TLS(hkdf) = evp_cache.hkdf;
+		EVP_UNLOCK();
+	}
+	if (kdf != NULL)
+		ctx = EVP_KDF_CTX_new(kdf);
+
+	if (ctx != NULL && EVP_KDF_CTX_set_params(ctx, params) != 1) {
+		fido_log_debug("%s: EVP_KDF_CTX_set_params", __func__);
+		EVP_KDF_CTX_free(ctx);
+		ctx = NULL;
+	}
+
+	return (ctx);
+}
+
+/*
+ * Fetch everything libfido2 uses from the default provider, so that the
+ * first operation to use an algorithm does not pay for looking it up.
+ * Key management, signature and key exchange methods are not cached
+ * here, but fetching them once leaves them in libcrypto's method store.
+ */
+void
+fido_evp_preload(void)
+{
+	static const char *keymgmt[] = { "EC", "RSA", "ED25519" };
+	static const char *signature[] = { "ECDSA", "RSA", "ED25519" };
+	EVP_KDF_CTX *kctx;
+
+	(void)fido_evp_sha1();
+	(void)fido_evp_sha256();
+	(void)fido_evp_sha384();
+	(void)fido_evp_aes_256_cbc();
+	(void)fido_evp_aes_256_gcm();
+	if ((kctx = fido_evp_hkdf_sha256()) != NULL)
+		EVP_KDF_CTX_free(kctx);
+
+	for (size_t i = 0; i < nitems(keymgmt); i++)
+		EVP_KEYMGMT_free(EVP_KEYMGMT_fetch(evp_libctx, keymgmt[i],
+		    evp_propq));
+	for (size_t i = 0; i < nitems(signature); i++)
+		EVP_SIGNATURE_free(EVP_SIGNATURE_fetch(evp_libctx,
+		    signature[i], evp_propq));
+	EVP_KEYEXCH_free(EVP_KEYEXCH_fetch(evp_libctx, "ECDH", evp_propq));
+}
+
+static void
+evp_cache_free(struct evp_cache *c)
+{
+	EVP_MD_free(c->sha1);
+	EVP_MD_free(c->sha256);
+	EVP_MD_free(c->sha384);
+	EVP_CIPHER_free(c->aes_256_cbc);
+	EVP_CIPHER_free(c->aes_256_gcm);
+	EVP_KDF_free(c->hkdf);
+	memset(c, 0, sizeof(*c));
+}
+
+int
+fido_set_libctx(struct ossl_lib_ctx_st *libctx, const char *propq)
+{
+	char *p = NULL;
+
+	if (propq != NULL && (p = fido_strdup(propq)) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	EVP_LOCK();
+	evp_cache_free(&evp_cache);
+	fido_free(evp_propq);
+	evp_libctx = libctx;
+	evp_propq = p;
+	evp_gen++;
+	EVP_UNLOCK();
+
+	return (FIDO_OK);
+}
+
+bool
+fido_evp_default_ctx(void)
+{
+	return (evp_libctx == NULL && evp_propq == NULL);
+}
+
+/* a context for an operation with pkey, in the configured library context */
+EVP_PKEY_CTX *
+fido_evp_pkey_ctx(EVP_PKEY *pkey)
+{
+	return (EVP_PKEY_CTX_new_from_pkey(evp_libctx, pkey, evp_propq));
+}
+
+/* as EVP_DigestVerifyInit(), in the configured library context */
+int
+fido_evp_verify_init(EVP_MD_CTX *ctx, const EVP_MD *md, EVP_PKEY *pkey)
+{
+	return (EVP_DigestVerifyInit_ex(ctx, NULL,
+	    md != NULL ? EVP_MD_get0_name(md) : NULL, evp_libctx, evp_propq,
+	    pkey, NULL));
+}
+#else
+const EVP_MD *
+fido_evp_sha1(void)
+{
+	return (EVP_sha1());
+}
+
+const EVP_MD *
+fido_evp_sha256(void)
+{
+	return (EVP_sha256());
+}
+
+const EVP_MD *
+fido_evp_sha384(void)
+{
+	return (EVP_sha384());
+}
+
+const EVP_CIPHER *
+fido_evp_aes_256_cbc(void)
+{
+	return (EVP_aes_256_cbc());
+}
+
+const EVP_CIPHER *
+fido_evp_aes_256_gcm(void)
+{
+	return (EVP_aes_256_gcm());
+}
+
+/* load libcrypto's digest and cipher tables ahead of their first use */
+void
+fido_evp_preload(void)
+{
+	if (OPENSSL_init_crypto(OPENSSL_INIT_ADD_ALL_CIPHERS |
+	    OPENSSL_INIT_ADD_ALL_DIGESTS, NULL) != 1)
+		fido_log_debug("%s: OPENSSL_init_crypto", __func__);
+}
+
+/* library contexts need OpenSSL 3; engines are configured globally */
+int
+fido_set_libctx(struct ossl_lib_ctx_st *libctx, const char *propq)
+{
+	if (libctx != NULL || propq != NULL)
+		return (FIDO_ERR_UNSUPPORTED_OPTION);
+
+	return (FIDO_OK);
+}
+
+bool
+fido_evp_default_ctx(void)
+{
+	return (true);
+}
+
+EVP_PKEY_CTX *
+fido_evp_pkey_ctx(EVP_PKEY *pkey)
+{
+	return (EVP_PKEY_CTX_new(pkey, NULL));
+}
+
+int
+fido_evp_verify_init(EVP_MD_CTX *ctx, const EVP_MD *md, EVP_PKEY *pkey)
+{
+	return (EVP_DigestVerifyInit(ctx, NULL, md, NULL, pkey));
+}
+#endif /* OPENSSL_VERSION_NUMBER >= 0x30000000 */
@@ -11,12 +11,14 @@
 		es256_pk_from_ptr;
 		es256_pk_new;
 		es256_pk_to_EVP_PKEY;
+		es256_pk_to_compressed;
 		es384_pk_free;
 		es384_pk_from_EC_KEY;
 		es384_pk_from_EVP_PKEY;
 		es384_pk_from_ptr;
 		es384_pk_new;
 		es384_pk_to_EVP_PKEY;
+		es384_pk_to_compressed;
 		fido_assert_allow_cred;
 		fido_assert_authdata_len;
 		fido_assert_authdata_ptr;
@@ -27,6 +29,7 @@
 		fido_assert_count;
 		fido_assert_flags;
 		fido_assert_free;
+		fido_assert_from_webauthn_json;
 		fido_assert_hmac_secret_len;
 		fido_assert_hmac_secret_ptr;
 		fido_assert_id_len;
@@ -34,18 +37,27 @@
 		fido_assert_largeblob_key_len;
 		fido_assert_largeblob_key_ptr;
 		fido_assert_new;
+		fido_assert_prepare;
 		fido_assert_rp_id;
+		fido_assert_set_allow_list;
 		fido_assert_set_authdata;
 		fido_assert_set_authdata_raw;
 		fido_assert_set_clientdata;
+		fido_assert_set_clientdata_checked;
 		fido_assert_set_clientdata_hash;
+		fido_assert_set_clientdata_hash_borrow;
+		fido_assert_set_clientdata_hash_take;
 		fido_assert_set_count;
 		fido_assert_set_extensions;
 		fido_assert_set_hmac_salt;
 		fido_assert_set_hmac_secret;
 		fido_assert_set_options;
+		fido_assert_set_prf;
+		fido_assert_set_prf_cred;
 		fido_assert_set_rp;
 		fido_assert_set_sig;
+		fido_assert_set_sig_borrow;
+		fido_assert_set_sig_take;
 		fido_assert_set_up;
 		fido_assert_set_uv;
 		fido_assert_sigcount;
@@ -57,6 +69,12 @@
 		fido_assert_user_id_ptr;
 		fido_assert_user_name;
 		fido_assert_verify;
+		fido_assert_verify_batch;
+		fido_assert_verify_view;
+		fido_assert_verify_with_key;
+		fido_authdata_view_set;
+		fido_authdata_view_set_cbor;
+		fido_bio_dev_enroll;
 		fido_bio_dev_enroll_begin;
 		fido_bio_dev_enroll_cancel;
 		fido_bio_dev_enroll_continue;
@@ -116,6 +134,14 @@
 		fido_cbor_info_uv_modality;
 		fido_cbor_info_versions_len;
 		fido_cbor_info_versions_ptr;
+		fido_config_free;
+		fido_config_new;
+		fido_config_set_always_uv;
+		fido_config_set_entattest;
+		fido_config_set_force_pin_change;
+		fido_config_set_pin_minlen;
+		fido_config_set_pin_minlen_rpid;
+		fido_config_status;
 		fido_cred_attstmt_len;
 		fido_cred_attstmt_ptr;
 		fido_cred_authdata_len;
@@ -126,17 +152,41 @@
 		fido_cred_clientdata_hash_ptr;
 		fido_cred_display_name;
 		fido_cred_exclude;
+		fido_cred_export_record;
 		fido_cred_flags;
 		fido_cred_largeblob_key_len;
 		fido_cred_largeblob_key_ptr;
+		fido_cred_list_add;
+		fido_cred_list_add_array;
+		fido_cred_list_batch_count;
+		fido_cred_list_batch_len;
+		fido_cred_list_free;
+		fido_cred_list_len;
+		fido_cred_list_new;
+		fido_cred_list_split;
+		fido_cred_set_clientdata_checked;
+		fido_cred_set_sig_borrow;
+		fido_cred_set_sig_take;
+		fido_cred_set_x509_borrow;
+		fido_cred_set_x509_take;
 		fido_cred_sigcount;
 		fido_cred_fmt;
 		fido_cred_free;
+		fido_cred_from_webauthn_json;
 		fido_cred_id_len;
 		fido_cred_id_ptr;
 		fido_cred_aaguid_len;
 		fido_cred_aaguid_ptr;
+		fido_cred_store_free;
+		fido_cred_store_get;
+		fido_cred_store_len;
+		fido_cred_store_lookup;
+		fido_cred_store_new;
+		fido_cred_store_open;
+		fido_cred_store_write;
 		fido_credman_del_dev_rk;
+		fido_credman_del_dev_rk_batch;
+		fido_credman_get_dev_all_rk;
 		fido_credman_get_dev_metadata;
 		fido_credman_get_dev_rk;
 		fido_credman_get_dev_rp;
@@ -148,6 +198,7 @@
 		fido_credman_rk_free;
 		fido_credman_rk_new;
 		fido_credman_rk_remaining;
+		fido_credman_rk_rp_idx;
 		fido_credman_rp_count;
 		fido_credman_rp_free;
 		fido_credman_rp_id;
@@ -156,6 +207,15 @@
 		fido_credman_rp_name;
 		fido_credman_rp_new;
 		fido_credman_set_dev_rk;
+		fido_credman_set_dev_rk_batch;
+		fido_credman_snapshot_clear;
+		fido_credman_snapshot_free;
+		fido_credman_snapshot_metadata;
+		fido_credman_snapshot_new;
+		fido_credman_snapshot_refresh;
+		fido_credman_snapshot_rk;
+		fido_credman_snapshot_rp;
+		fido_credman_snapshot_walked;
 		fido_cred_new;
 		fido_cred_pin_minlen;
 		fido_cred_prot;
@@ -169,6 +229,7 @@
 		fido_cred_set_blob;
 		fido_cred_set_clientdata;
 		fido_cred_set_clientdata_hash;
+		fido_cred_set_exclude_list;
 		fido_cred_set_extensions;
 		fido_cred_set_fmt;
 		fido_cred_set_id;
@@ -190,11 +251,16 @@
 		fido_cred_user_name;
 		fido_cred_verify;
 		fido_cred_verify_self;
+		fido_cred_verify_trust;
 		fido_cred_x5c_len;
 		fido_cred_x5c_ptr;
+		fido_dev_broker;
 		fido_dev_build;
 		fido_dev_cancel;
+		fido_dev_cbor_info;
 		fido_dev_close;
+		fido_dev_cmd_timeout;
+		fido_dev_config_apply;
 		fido_dev_enable_entattest;
 		fido_dev_flags;
 		fido_dev_force_fido2;
@@ -202,7 +268,10 @@
 		fido_dev_force_u2f;
 		fido_dev_free;
 		fido_dev_get_assert;
+		fido_dev_get_assert_begin;
+		fido_dev_get_assert_step;
 		fido_dev_get_cbor_info;
+		fido_dev_get_hmac_secrets;
 		fido_dev_get_retry_count;
 		fido_dev_get_uv_retry_count;
 		fido_dev_get_touch_begin;
@@ -211,6 +280,9 @@
 		fido_dev_has_uv;
 		fido_dev_info_free;
 		fido_dev_info_manifest;
+		fido_dev_info_manifest_cb;
+		fido_dev_info_manifest_diff;
+		fido_dev_info_manifest_parallel;
 		fido_dev_info_manufacturer_string;
 		fido_dev_info_new;
 		fido_dev_info_path;
@@ -224,34 +296,192 @@
 		fido_dev_is_winhello;
 		fido_dev_major;
 		fido_dev_make_cred;
+		fido_dev_make_cred_begin;
+		fido_dev_make_cred_step;
 		fido_dev_minor;
+		fido_dev_monitor_free;
+		fido_dev_monitor_get_fd;
+		fido_dev_monitor_get_pcsc_fd;
+		fido_dev_monitor_new;
+		fido_dev_monitor_read;
+		fido_dev_monitor_set_pcsc;
+		fido_dev_monitor_start;
 		fido_dev_new;
 		fido_dev_new_with_info;
 		fido_dev_open;
+		fido_dev_open_channel;
+		fido_dev_open_many;
+		fido_dev_ping;
+		fido_dev_poll_event;
+		fido_dev_poll_fd;
+		fido_dev_poll_timeout;
+		fido_dev_pool_add;
+		fido_dev_pool_check;
+		fido_dev_pool_free;
+		fido_dev_pool_get;
+		fido_dev_pool_idle;
+		fido_dev_pool_len;
+		fido_dev_pool_new;
+		fido_dev_pool_put;
 		fido_dev_open_with_info;
 		fido_dev_protocol;
+		fido_dev_provision;
+		fido_dev_provision_batch;
+		fido_dev_refresh_cbor_info;
 		fido_dev_reset;
+		fido_dev_select;
+		fido_dev_set_adaptive_timeout;
+		fido_dev_set_ble_transport;
+		fido_dev_set_bio_cache;
+		fido_dev_set_cmd_timeout;
+		fido_dev_set_ecdh_cache;
 		fido_dev_set_io_functions;
+		fido_dev_set_io_writev;
+		fido_dev_set_keepalive_cb;
+		fido_dev_set_largeblob_level;
 		fido_dev_set_pin;
 		fido_dev_set_pin_minlen;
 		fido_dev_set_pin_minlen_rpid;
+		fido_dev_set_record;
+		fido_dev_set_replay;
+		fido_dev_set_scheduler;
 		fido_dev_set_sigmask;
+		fido_dev_set_stats;
 		fido_dev_set_timeout;
+		fido_dev_set_transport_borrow;
 		fido_dev_set_transport_functions;
+		fido_dev_set_uv_token_cache;
+		fido_dev_stats;
+		fido_dev_stats_cmd_cbor;
+		fido_dev_stats_cmd_ctaphid;
+		fido_dev_stats_cmd_len;
+		fido_dev_stats_counter;
+		fido_dev_stats_free;
+		fido_dev_stats_new;
+		fido_dev_stats_rtt;
+		fido_dev_stats_up_wait;
 		fido_dev_supports_cred_prot;
 		fido_dev_supports_credman;
 		fido_dev_supports_permissions;
 		fido_dev_supports_pin;
 		fido_dev_supports_uv;
 		fido_dev_toggle_always_uv;
+		fido_dev_wink;
+		fido_dev_largeblob_entry_len;
 		fido_dev_largeblob_get;
 		fido_dev_largeblob_get_array;
+		fido_dev_largeblob_get_batch;
+		fido_dev_largeblob_get_stream;
 		fido_dev_largeblob_remove;
 		fido_dev_largeblob_set;
 		fido_dev_largeblob_set_array;
+		fido_dev_largeblob_set_stream;
+		fido_heap_stats;
+		fido_hid_set_keep_awake;
 		fido_init;
+		fido_keypool_len;
+		fido_keypool_set_size;
+		fido_keypool_size;
+		fido_legacy_cache_clear;
+		fido_legacy_cache_len;
+		fido_legacy_cache_load;
+		fido_legacy_cache_save;
+		fido_legacy_cache_set_size;
+		fido_loop_group_add_assert;
+		fido_loop_group_add_cred;
+		fido_loop_group_free;
+		fido_loop_group_new;
+		fido_loop_group_pending;
+		fido_loop_group_wait;
+		fido_mem_stats;
+		fido_mem_stats_reset;
+		fido_pcsc_set_keep_card;
+		fido_provision_free;
+		fido_provision_new;
+		fido_provision_set_always_uv;
+		fido_provision_set_entattest;
+		fido_provision_set_pin;
+		fido_provision_set_pin_minlen;
+		fido_provision_set_reset;
+		fido_loop_add_assert;
+		fido_loop_add_cred;
+		fido_loop_free;
+		fido_loop_new;
+		fido_loop_pending;
+		fido_loop_run;
+		fido_mds_entry_description;
+		fido_mds_entry_free;
+		fido_mds_entry_key_protection;
+		fido_mds_entry_status;
+		fido_mds_entry_trust_store;
+		fido_mds_free;
+		fido_mds_len;
+		fido_mds_load;
+		fido_mds_lookup;
+		fido_mds_new;
+		fido_mds_no;
+		fido_rp_verifier_allow_type;
+		fido_rp_verifier_free;
+		fido_rp_verifier_new;
+		fido_rp_verifier_precheck;
+		fido_rp_verifier_set_cache;
+		fido_rp_verifier_set_extensions;
+		fido_rp_verifier_set_rp;
+		fido_rp_verifier_set_up;
+		fido_rp_verifier_set_uv;
+		fido_rp_verifier_verify;
+		fido_secure_pool_len;
+		fido_secure_pool_set_size;
+		fido_secure_pool_size;
+		fido_session_cache_clear;
+		fido_session_cache_hits;
+		fido_session_cache_len;
+		fido_session_cache_misses;
+		fido_session_cache_set_size;
+		fido_session_cache_size;
+		fido_set_allocator;
+		fido_set_heap;
+		fido_set_libctx;
 		fido_set_log_handler;
+		fido_set_mem_stats;
+		fido_set_thread_priority;
+		fido_set_trace_handler;
+		fido_sigcount_table_advance;
+		fido_sigcount_table_alloc;
+		fido_sigcount_table_free;
+		fido_sigcount_table_get;
+		fido_sigcount_table_map;
+		fido_sigcount_table_new;
 		fido_strerr;
+		fido_thread_priority;
+		fido_trust_store_add_der;
+		fido_trust_store_add_pem;
+		fido_trust_store_free;
+		fido_trust_store_new;
+		fido_verifier_free;
+		fido_verifier_new;
+		fido_verifier_pending;
+		fido_verifier_poll;
+		fido_verifier_set_callback;
+		fido_verifier_submit_assert;
+		fido_verifier_submit_cred;
+		fido_verify_cache_alloc;
+		fido_verify_cache_free;
+		fido_verify_cache_map;
+		fido_verify_cache_new;
+		fido_verify_cache_stats;
+		fido_verify_key_free;
+		fido_verify_key_from_cose;
+		fido_verify_key_from_pk;
+		fido_verify_key_from_record;
+		fido_verify_key_new;
+		fido_verify_key_type;
+		fido_x5c_cache_clear;
+		fido_x5c_cache_hits;
+		fido_x5c_cache_len;
+		fido_x5c_cache_misses;
+		fido_x5c_cache_set_size;
+		fido_x5c_cache_size;
 		rs256_pk_free;
 		rs256_pk_from_ptr;
 		rs256_pk_from_EVP_PKEY;
@@ -18,6 +18,7 @@
 
 #include <stdint.h>
 
+#include "fido/param.h"
 #include "fido/types.h"
 #include "blob.h"
 
@@ -25,6 +26,34 @@
 extern "C" {
 #endif /* __cplusplus */
 
+/* allocation; see fido_set_allocator() */
+void *fido_malloc(size_t);
+void *fido_calloc(size_t, size_t);
+void *fido_realloc(void *, size_t);
+void *fido_recallocarray(void *, size_t, size_t, size_t);
+void fido_free(void *);
+void fido_freezero(void *, size_t);
+char *fido_strdup(const char *);
+char *fido_strndup(const char *, size_t);
+void *fido_malloc_as(int, size_t);
+void *fido_calloc_as(int, size_t, size_t);
+void *fido_realloc_as(int, void *, size_t);
+void *fido_recallocarray_as(int, void *, size_t, size_t, size_t);
+void *fido_mem_handover(void *, size_t);
+void *fido_mem_adopt(int, void *, size_t);
+#ifdef __GNUC__
+int fido_asprintf(char **, const char *, ...)
+    __attribute__((__format__ (printf, 2, 3)));
+#else
+int fido_asprintf(char **, const char *, ...);
+#endif
+
+/* secure memory pool */
+bool fido_secure_owns(const void *);
+void *fido_secure_alloc(size_t);
+void *fido_secure_realloc(void *, size_t);
+void fido_secure_free(void *);
+
 /* aes256 */
 int aes256_cbc_dec(const fido_dev_t *dev, const fido_blob_t *,
     const fido_blob_t *, fido_blob_t *);
@@ -34,41 +63,73 @@ int aes256_gcm_dec(const fido_blob_t *, const fido_blob_t *,
     const fido_blob_t *, const fido_blob_t *, fido_blob_t *);
 int aes256_gcm_enc(const fido_blob_t *, const fido_blob_t *,
     const fido_blob_t *, const fido_blob_t *, fido_blob_t *);
+EVP_CIPHER_CTX *aes256_gcm_enc_begin(const fido_blob_t *, const fido_blob_t *,
+    const fido_blob_t *);
+int aes256_gcm_enc_update(EVP_CIPHER_CTX *, u_char *, size_t);
+int aes256_gcm_enc_end(EVP_CIPHER_CTX *, u_char *);
 
 /* cbor encoding functions */
 cbor_item_t *cbor_build_uint(const uint64_t);
 cbor_item_t *cbor_flatten_vector(cbor_item_t **, size_t);
-cbor_item_t *cbor_encode_assert_opt(fido_opt_t, fido_opt_t);
 cbor_item_t *cbor_encode_change_pin_auth(const fido_dev_t *,
     const fido_blob_t *, const fido_blob_t *, const fido_blob_t *);
 cbor_item_t *cbor_encode_cred_ext(const fido_cred_ext_t *, const fido_blob_t *);
 cbor_item_t *cbor_encode_assert_ext(fido_dev_t *,
-    const fido_assert_ext_t *, const fido_blob_t *, const es256_pk_t *);
-cbor_item_t *cbor_encode_cred_opt(fido_opt_t, fido_opt_t);
-cbor_item_t *cbor_encode_pin_auth(const fido_dev_t *, const fido_blob_t *,
+    const fido_assert_ext_t *, const fido_blob_t *, const fido_blob_t *,
+    const es256_pk_t *);
+cbor_item_t *cbor_encode_pin_auth(fido_dev_t *, const fido_blob_t *,
     const fido_blob_t *);
 cbor_item_t *cbor_encode_pin_opt(const fido_dev_t *);
 cbor_item_t *cbor_encode_pubkey(const fido_blob_t *);
-cbor_item_t *cbor_encode_pubkey_list(const fido_blob_array_t *);
 cbor_item_t *cbor_encode_pubkey_param(int);
 cbor_item_t *cbor_encode_rp_entity(const fido_rp_t *);
 cbor_item_t *cbor_encode_str_array(const fido_str_array_t *);
 cbor_item_t *cbor_encode_user_entity(const fido_user_t *);
 cbor_item_t *es256_pk_encode(const es256_pk_t *, int);
 
+/* streaming cbor encoder */
+void cbor_writer_init(cbor_writer_t *, uint8_t);
+void cbor_writer_reset(cbor_writer_t *);
+int cbor_writer_finish(cbor_writer_t *, fido_blob_t *);
+int cbor_writer_reserve(cbor_writer_t *, size_t);
+void cbor_write_map(cbor_writer_t *, size_t);
+void cbor_write_array(cbor_writer_t *, size_t);
+void cbor_write_uint(cbor_writer_t *, uint64_t);
+void cbor_write_int(cbor_writer_t *, int64_t);
+void cbor_write_bool(cbor_writer_t *, bool);
+void cbor_write_bytes(cbor_writer_t *, const unsigned char *, size_t);
+void cbor_write_blob(cbor_writer_t *, const fido_blob_t *);
+void cbor_write_text(cbor_writer_t *, const char *);
+void cbor_write_item(cbor_writer_t *, const cbor_item_t *);
+void cbor_write_raw(cbor_writer_t *, const unsigned char *, size_t);
+void cbor_write_assert_opt(cbor_writer_t *, fido_opt_t, fido_opt_t);
+void cbor_write_cred_opt(cbor_writer_t *, fido_opt_t, fido_opt_t);
+void cbor_write_pubkey(cbor_writer_t *, const fido_blob_t *);
+void cbor_write_pubkey_list(cbor_writer_t *, const fido_blob_array_t *);
+void cbor_write_cred_list(cbor_writer_t *, const fido_cred_list_t *, size_t);
+void cbor_write_pubkey_param(cbor_writer_t *, int);
+void cbor_write_rp_entity(cbor_writer_t *, const fido_rp_t *);
+void cbor_write_user_entity(cbor_writer_t *, const fido_user_t *);
+
 /* cbor decoding functions */
+int cbor_decode_attobj(const cbor_item_t *, fido_cred_t *);
 int cbor_decode_attstmt(const cbor_item_t *, fido_attstmt_t *);
 int cbor_decode_bool(const cbor_item_t *, bool *);
 int cbor_decode_cred_authdata(const cbor_item_t *, int, fido_blob_t *,
     fido_authdata_t *, fido_attcred_t *, fido_cred_ext_t *);
-int cbor_decode_assert_authdata(const cbor_item_t *, fido_blob_t *,
-    fido_authdata_t *, fido_assert_extattr_t *);
-int cbor_decode_cred_id(const cbor_item_t *, fido_blob_t *);
+int cbor_decode_cred_authdata_raw(const unsigned char *, size_t, int,
+    fido_blob_t *, fido_authdata_t *, fido_attcred_t *, fido_cred_ext_t *);
+int cbor_decode_assert_authdata(const cbor_item_t *, fido_arena_t *,
+    fido_blob_t *, fido_authdata_t *, fido_assert_extattr_t *);
+int cbor_decode_assert_authdata_raw(const unsigned char *, size_t,
+    fido_blob_t *, fido_authdata_t *, fido_assert_extattr_t *);
+int cbor_decode_cred_id(const cbor_item_t *, fido_arena_t *, fido_blob_t *);
 int cbor_decode_fmt(const cbor_item_t *, char **);
 int cbor_decode_pubkey(const cbor_item_t *, int *, void *);
 int cbor_decode_rp_entity(const cbor_item_t *, fido_rp_t *);
 int cbor_decode_uint64(const cbor_item_t *, uint64_t *);
 int cbor_decode_user(const cbor_item_t *, fido_user_t *);
+int cbor_check_user(const cbor_item_t *);
 int es256_pk_decode(const cbor_item_t *, es256_pk_t *);
 int es384_pk_decode(const cbor_item_t *, es384_pk_t *);
 int rs256_pk_decode(const cbor_item_t *, rs256_pk_t *);
@@ -86,8 +147,15 @@ int cbor_bytestring_copy(const cbor_item_t *, unsigned char **, size_t *);
 int cbor_map_iter(const cbor_item_t *, void *, int(*)(const cbor_item_t *,
     const cbor_item_t *, void *));
 int cbor_string_copy(const cbor_item_t *, char **);
+int cbor_load_reply(const unsigned char *, size_t, cbor_item_t **);
 int cbor_parse_reply(const unsigned char *, size_t, void *,
     int(*)(const cbor_item_t *, const cbor_item_t *, void *));
+int cbor_parse_reply_item(const cbor_item_t *, void *,
+    int(*)(const cbor_item_t *, const cbor_item_t *, void *));
+int cbor_parse_reply_keys(const unsigned char *, size_t, void *,
+    const cbor_key_decoder_t *, size_t);
+int cbor_parse_reply_item_keys(const cbor_item_t *, void *,
+    const cbor_key_decoder_t *, size_t);
 int cbor_add_uv_params(fido_dev_t *, uint8_t, const fido_blob_t *,
     const es256_pk_t *, const fido_blob_t *, const char *, const char *,
     cbor_item_t **, cbor_item_t **, int *);
@@ -98,6 +166,14 @@ int cbor_array_drop(cbor_item_t **, size_t);
 /* deflate */
 int fido_compress(fido_blob_t *, const fido_blob_t *);
 int fido_uncompress(fido_blob_t *, const fido_blob_t *, size_t);
+int fido_uncompress_buf(u_char *, size_t, const fido_blob_t *);
+int fido_compress_level(fido_blob_t *, const fido_blob_t *, int);
+int fido_compress_seal(fido_blob_t *, const fido_blob_t *, int,
+    EVP_CIPHER_CTX *);
+int fido_compress_stream(fido_blob_t *, size_t *, int, fido_largeblob_read_t *,
+    void *);
+int fido_uncompress_stream(const fido_blob_t *, size_t,
+    fido_largeblob_write_t *, void *);
 
 #ifndef nitems
 #define nitems(_a)	(sizeof((_a)) / sizeof((_a)[0]))
@@ -107,18 +183,66 @@ int fido_uncompress(fido_blob_t *, const fido_blob_t *, size_t);
 int fido_buf_read(const unsigned char **, size_t *, void *, size_t);
 int fido_buf_write(unsigned char **, size_t *, const void *, size_t);
 
+/* reports drained from a non-blocking hid descriptor in one wakeup */
+#define FIDO_HID_RBUF_LEN	32
+
+typedef struct fido_hid_rbuf {
+	size_t		len;   /* report length; 0 if reads are not buffered */
+	size_t		head;  /* oldest report */
+	size_t		count; /* reports held */
+	unsigned char	report[FIDO_HID_RBUF_LEN][CTAP_MAX_REPORT_LEN];
+	int		wakeup; /* ends waits when readable, or -1 */
+} fido_hid_rbuf_t;
+
+/* scheduler; requests whose results are shared */
+#define FIDO_SCHED_INFO		0	/* authenticatorGetInfo */
+#define FIDO_SCHED_METADATA	1	/* getCredsMetadata */
+#define FIDO_SCHED_NSHARE	2
+void fido_dev_sched_free(fido_dev_t *);
+void fido_sched_enter(fido_dev_t *);
+void fido_sched_leave(fido_dev_t *);
+void fido_sched_yield(fido_dev_t *);
+bool fido_sched_join(fido_dev_t *, int, const char *, fido_blob_t *, int *,
+    bool *);
+void fido_sched_publish(fido_dev_t *, int, const unsigned char *, size_t,
+    int);
+
+/* wakeup */
+typedef struct fido_wakeup fido_wakeup_t;
+fido_wakeup_t *fido_wakeup_new(void);
+void fido_wakeup_free(fido_wakeup_t **);
+void fido_wakeup_signal(fido_wakeup_t *);
+void fido_wakeup_clear(fido_wakeup_t *);
+bool fido_wakeup_pending(fido_wakeup_t *);
+#ifdef _WIN32
+void *fido_wakeup_event(const fido_wakeup_t *);
+#else
+int fido_wakeup_fd(const fido_wakeup_t *);
+#endif
+
 /* hid i/o */
 void *fido_hid_open(const char *);
 void  fido_hid_close(void *);
 int fido_hid_read(void *, unsigned char *, size_t, int);
 int fido_hid_write(void *, const unsigned char *, size_t);
+int fido_hid_writev(void *, const unsigned char *, size_t, size_t);
 int fido_hid_get_usage(const uint8_t *, size_t, uint32_t *);
 int fido_hid_get_report_len(const uint8_t *, size_t, size_t *, size_t *);
 int fido_hid_unix_open(const char *);
-int fido_hid_unix_wait(int, int, const fido_sigset_t *);
+int fido_hid_unix_wait(int, int, int, const fido_sigset_t *);
+int fido_hid_unix_rbuf_init(int, fido_hid_rbuf_t *, size_t);
+int fido_hid_unix_read(int, fido_hid_rbuf_t *, unsigned char *, size_t, int,
+    const fido_sigset_t *);
 int fido_hid_set_sigmask(void *, const fido_sigset_t *);
+int fido_hid_set_wakeup(void *, const fido_wakeup_t *);
 size_t fido_hid_report_in_len(void *);
 size_t fido_hid_report_out_len(void *);
+int fido_hid_get_fd(void *);
+size_t fido_hid_pending(void *);
+void *fido_hid_monitor_open(void);
+void fido_hid_monitor_close(void *);
+int fido_hid_monitor_get_fd(void *);
+int fido_hid_monitor_drain(void *);
 
 /* nfc i/o */
 bool fido_is_nfc(const char *);
@@ -129,9 +253,33 @@ int fido_nfc_read(void *, unsigned char *, size_t, int);
 int fido_nfc_write(void *, const unsigned char *, size_t);
 int fido_nfc_rx(fido_dev_t *, uint8_t, unsigned char *, size_t, int);
 int fido_nfc_tx(fido_dev_t *, uint8_t, const unsigned char *, size_t);
+int fido_nfc_tx_ext(fido_dev_t *, uint8_t, const unsigned char *, size_t);
 int fido_nfc_set_sigmask(void *, const fido_sigset_t *);
 int fido_dev_set_nfc(fido_dev_t *);
 
+/* ble i/o */
+bool fido_is_ble(const char *);
+void *fido_ble_open(const char *);
+void  fido_ble_close(void *);
+int fido_ble_read(void *, unsigned char *, size_t, int);
+int fido_ble_write(void *, const unsigned char *, size_t);
+int fido_ble_rx(fido_dev_t *, uint8_t, unsigned char *, size_t, int);
+int fido_ble_tx(fido_dev_t *, uint8_t, const unsigned char *, size_t);
+int fido_ble_set_sigmask(void *, const fido_sigset_t *);
+size_t fido_ble_cp_len(void *);
+int fido_dev_set_ble(fido_dev_t *);
+
+/* ctaphid frames relayed by fido_dev_broker() */
+bool fido_is_broker(const char *);
+void *fido_broker_open(const char *);
+void  fido_broker_close(void *);
+int fido_broker_read(void *, unsigned char *, size_t, int);
+int fido_broker_write(void *, const unsigned char *, size_t);
+int fido_broker_writev(void *, const unsigned char *, size_t, size_t);
+int fido_broker_set_sigmask(void *, const fido_sigset_t *);
+int fido_broker_get_fd(void *);
+int fido_dev_set_broker(fido_dev_t *);
+
 /* pcsc i/o */
 bool fido_is_pcsc(const char *);
 void *fido_pcsc_open(const char *);
@@ -141,8 +289,13 @@ int fido_pcsc_write(void *, const unsigned char *, size_t);
 int fido_pcsc_rx(fido_dev_t *, uint8_t, unsigned char *, size_t, int);
 int fido_pcsc_tx(fido_dev_t *, uint8_t, const unsigned char *, size_t);
 int fido_dev_set_pcsc(fido_dev_t *);
+void *fido_pcsc_monitor_open(void);
+void fido_pcsc_monitor_close(void *);
+int fido_pcsc_monitor_get_fd(void *);
+int fido_pcsc_monitor_drain(void *);
 
 /* windows hello */
+struct winhello_async;
 int fido_winhello_manifest(fido_dev_info_t *, size_t, size_t *);
 int fido_winhello_open(fido_dev_t *);
 int fido_winhello_close(fido_dev_t *);
@@ -150,11 +303,54 @@ int fido_winhello_cancel(fido_dev_t *);
 int fido_winhello_get_assert(fido_dev_t *, fido_assert_t *, const char *, int);
 int fido_winhello_get_cbor_info(fido_dev_t *, fido_cbor_info_t *);
 int fido_winhello_make_cred(fido_dev_t *, fido_cred_t *, const char *, int);
+int fido_winhello_get_assert_begin(fido_dev_t *, fido_assert_t *, const char *);
+int fido_winhello_get_assert_step(fido_dev_t *, fido_assert_t *, int *, int);
+int fido_winhello_make_cred_begin(fido_dev_t *, fido_cred_t *, const char *);
+int fido_winhello_make_cred_step(fido_dev_t *, fido_cred_t *, int *, int);
+void *fido_winhello_poll_event(const fido_dev_t *);
+void fido_winhello_async_free(struct winhello_async **);
 
 /* generic i/o */
 int fido_rx_cbor_status(fido_dev_t *, int *);
 int fido_rx(fido_dev_t *, uint8_t, void *, size_t, int *);
 int fido_tx(fido_dev_t *, uint8_t, const void *, size_t, int *);
+bool fido_dev_rx_pending(const fido_dev_t *);
+unsigned char *fido_rx_buf_get(fido_dev_t *, size_t, size_t *);
+void fido_rx_buf_put(fido_dev_t *, unsigned char *, size_t);
+int fido_rx_msg(fido_dev_t *, uint8_t, size_t, const unsigned char **,
+    size_t *, int *);
+void fido_rx_msg_put(fido_dev_t *, const unsigned char *, size_t);
+int fido_rx_async_begin(fido_dev_t *, int, uint8_t, size_t);
+int fido_rx_async_step(fido_dev_t *, int *, int);
+void fido_rx_async_end(fido_dev_t *);
+
+/* ctaphid channels sharing a handle */
+int fido_mux_join(fido_dev_t *, fido_dev_t *);
+int fido_mux_read(fido_dev_t *, unsigned char *, size_t, int);
+size_t fido_mux_leave(fido_dev_t *);
+size_t fido_mux_pending(const fido_dev_t *);
+void fido_mux_lock(fido_dev_t *);
+void fido_mux_unlock(fido_dev_t *);
+
+/* key pool */
+int fido_keypool_get(es256_sk_t *, es256_pk_t *);
+
+/* pre-encoded credential lists */
+int fido_cred_list_batch(const fido_cred_list_t *, size_t, size_t *, size_t *);
+int fido_cred_list_expand(const fido_cred_list_t *, size_t,
+    fido_blob_array_t *);
+
+/* u2f-only devices; see legacy.c */
+int fido_legacy_lookup(const fido_dev_t *, const char *);
+void fido_legacy_store(const fido_dev_t *, const char *);
+
+/* session cache */
+int fido_session_lookup(const fido_dev_t *, const char *, fido_cbor_info_t *);
+void fido_session_store(const fido_dev_t *, const char *, const fido_blob_t *);
+void fido_session_drop(const char *);
+void fido_session_prune(const fido_dev_info_t *, size_t);
+int fido_session_largeblob_get(const fido_dev_t *, fido_blob_t *);
+void fido_session_largeblob_set(const fido_dev_t *, const fido_blob_t *);
 
 /* log */
 #ifdef FIDO_NO_DIAGNOSTIC
@@ -177,23 +373,92 @@ void fido_log_debug(const char *, ...);
 void fido_log_xxd(const void *, size_t, const char *, ...);
 void fido_log_error(int, const char *, ...);
 #endif /* __GNUC__ */
+#ifndef TLS
+#define TLS
+#endif
+extern TLS int fido_logging;
 #endif /* FIDO_NO_DIAGNOSTIC */
 
+/*
+ * Messages logged for every report in io.c; the flag is tested at the
+ * call site so that nothing is formatted or called when logging is
+ * off, and the messages are compiled out with FIDO_NO_IO_LOG.
+ */
+#if defined(FIDO_NO_DIAGNOSTIC) || defined(FIDO_NO_IO_LOG)
+#define fido_log_io_debug(...)	do { /* nothing */ } while (0)
+#define fido_log_io_xxd(...)	do { /* nothing */ } while (0)
+#else
+#define fido_log_io_debug(...)	do {					\
+	if (fido_logging)						\
+		fido_log_debug(__VA_ARGS__);				\
+} while (0)
+#define fido_log_io_xxd(...)	do {					\
+	if (fido_logging)						\
+		fido_log_xxd(__VA_ARGS__);				\
+} while (0)
+#endif
+
+/* trace */
+void fido_trace(const fido_dev_t *, int, uint8_t, size_t, int);
+void fido_trace_span_begin(fido_dev_t *, fido_trace_span_t *, int);
+void fido_trace_span_end(fido_dev_t *, fido_trace_span_t *, int);
+void fido_trace_up_begin(fido_dev_t *);
+void fido_trace_up_end(fido_dev_t *, int);
+const char *fido_trace_transport(const fido_dev_t *, const char *);
+void fido_stats_update(const fido_dev_t *, const fido_trace_event_t *);
+
+/* record */
+void fido_record_tx(fido_dev_t *, uint8_t, const void *, size_t);
+void fido_record_rx(fido_dev_t *, uint8_t, const void *, int);
+void fido_record_free(fido_dev_t *);
+
 /* u2f */
+struct u2f_async;
 int u2f_register(fido_dev_t *, fido_cred_t *, int *);
 int u2f_authenticate(fido_dev_t *, fido_assert_t *, int *);
 int u2f_get_touch_begin(fido_dev_t *, int *);
 int u2f_get_touch_status(fido_dev_t *, int *, int *);
+int u2f_get_touch_pace(const fido_dev_t *);
+int u2f_authenticate_begin(fido_dev_t *, fido_assert_t *);
+int u2f_authenticate_step(fido_dev_t *, fido_assert_t *, int *, int);
+int u2f_register_begin(fido_dev_t *, fido_cred_t *);
+int u2f_register_step(fido_dev_t *, fido_cred_t *, int *, int);
+int u2f_async_timeout(const fido_dev_t *);
+int u2f_async_cancel(fido_dev_t *);
+void u2f_async_free(struct u2f_async **);
 
 /* unexposed fido ops */
 uint8_t fido_dev_get_pin_protocol(const fido_dev_t *);
 int fido_dev_authkey(fido_dev_t *, es256_pk_t *, int *);
 int fido_dev_get_cbor_info_wait(fido_dev_t *, fido_cbor_info_t *, int *);
+int fido_dev_get_cbor_info_reply(fido_dev_t *, fido_cbor_info_t *,
+    fido_blob_t *, int *);
+int fido_dev_get_cbor_info_tx(fido_dev_t *, int *);
+int fido_dev_get_cbor_info_rx(fido_dev_t *, fido_cbor_info_t *,
+    fido_blob_t *, int *);
 int fido_dev_get_uv_token(fido_dev_t *, uint8_t, const char *,
     const fido_blob_t *, const es256_pk_t *, const char *, fido_blob_t *,
     int *);
+int fido_dev_get_uv_token_cached(fido_dev_t *, uint8_t, const char *,
+    const char *, fido_blob_t *, int *);
+bool fido_dev_uv_token_retry(fido_dev_t *, int);
+void fido_dev_uv_token_flush(fido_dev_t *);
+void fido_dev_uv_cache_free(fido_dev_t *);
+int fido_dev_pin_mac(fido_dev_t *, const fido_blob_t *, const fido_blob_t *,
+    unsigned char *, unsigned int *);
+void fido_dev_pin_mac_free(fido_dev_t *);
 uint64_t fido_dev_maxmsgsize(const fido_dev_t *);
 int fido_do_ecdh(fido_dev_t *, es256_pk_t **, fido_blob_t **, int *);
+int fido_do_ecdh_cached(fido_dev_t *, es256_pk_t **, fido_blob_t **, int *);
+void fido_dev_ecdh_result(fido_dev_t *, int);
+void fido_dev_ecdh_flush(fido_dev_t *);
+void fido_dev_ecdh_cache_free(fido_dev_t *);
+void fido_dev_largeblob_flush(fido_dev_t *);
+void fido_dev_bio_flush(fido_dev_t *);
+int fido_dev_set_always_uv(fido_dev_t *, fido_opt_t, const char *);
+void fido_dev_bio_cache_free(fido_dev_t *);
+void fido_dev_rx_sample(fido_dev_t *, int, int);
+void fido_dev_rx_expired(fido_dev_t *, int);
 
 /* types */
 void fido_algo_array_free(fido_algo_array_t *);
@@ -210,13 +475,17 @@ void fido_assert_reset_tx(fido_assert_t *);
 void fido_cred_reset_rx(fido_cred_t *);
 void fido_cred_reset_tx(fido_cred_t *);
 void fido_cbor_info_reset(fido_cbor_info_t *);
+int fido_cbor_info_decode(fido_cbor_info_t *, const fido_blob_t *);
 int fido_blob_serialise(fido_blob_t *, const cbor_item_t *);
 int fido_check_flags(uint8_t, fido_opt_t, fido_opt_t);
-int fido_check_rp_id(const char *, const unsigned char *);
+int fido_check_rp_id_hash(const unsigned char *, const unsigned char *);
 int fido_get_random(void *, size_t);
+void fido_random_set_drbg(bool);
 int fido_sha256(fido_blob_t *, const u_char *, size_t);
 int fido_time_now(struct timespec *);
 int fido_time_delta(const struct timespec *, int *);
+int fido_time_deadline(struct timespec *, int);
+int fido_time_left(const struct timespec *, int *);
 int fido_to_uint64(const char *, int, uint64_t *);
 
 /* crypto */
@@ -224,6 +493,8 @@ int es256_verify_sig(const fido_blob_t *, EVP_PKEY *, const fido_blob_t *);
 int es384_verify_sig(const fido_blob_t *, EVP_PKEY *, const fido_blob_t *);
 int rs256_verify_sig(const fido_blob_t *, EVP_PKEY *, const fido_blob_t *);
 int eddsa_verify_sig(const fido_blob_t *, EVP_PKEY *, const fido_blob_t *);
+int eddsa_verify_sig_ctx(EVP_MD_CTX *, const fido_blob_t *, EVP_PKEY *,
+    const fido_blob_t *);
 int rs1_verify_sig(const fido_blob_t *, EVP_PKEY *, const fido_blob_t *);
 int es256_pk_verify_sig(const fido_blob_t *, const es256_pk_t *,
     const fido_blob_t *);
@@ -238,14 +509,45 @@ int fido_get_signed_hash(int, fido_blob_t *, const fido_blob_t *,
 int fido_get_signed_hash_tpm(fido_blob_t *, const fido_blob_t *,
     const fido_blob_t *, const fido_attstmt_t *, const fido_attcred_t *);
 
+/* algorithm handles */
+const EVP_MD *fido_evp_sha1(void);
+const EVP_MD *fido_evp_sha256(void);
+const EVP_MD *fido_evp_sha384(void);
+const EVP_CIPHER *fido_evp_aes_256_cbc(void);
+const EVP_CIPHER *fido_evp_aes_256_gcm(void);
+void fido_evp_preload(void);
+bool fido_evp_default_ctx(void);
+EVP_PKEY_CTX *fido_evp_pkey_ctx(EVP_PKEY *);
+int fido_evp_verify_init(EVP_MD_CTX *, const EVP_MD *, EVP_PKEY *);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+EVP_MD *fido_evp_sha1_ref(void);
+EVP_MD *fido_evp_sha256_ref(void);
+EVP_KDF_CTX *fido_evp_hkdf_sha256(void);
+#endif
+
+/* credential records */
+int fido_cred_record_parse(const unsigned char *, size_t, int *,
+    const unsigned char **, size_t *);
+
+/* attestation certificate cache, trust stores */
+struct fido_trust_store;
+EVP_PKEY *fido_x5c_pubkey(const fido_blob_t *);
+int fido_trust_store_verify(struct fido_trust_store *, const fido_blob_t *,
+    const fido_blob_array_t *);
+
 /* device manifest functions */
 int fido_hid_manifest(fido_dev_info_t *, size_t, size_t *);
 int fido_nfc_manifest(fido_dev_info_t *, size_t, size_t *);
+int fido_ble_manifest(fido_dev_info_t *, size_t, size_t *);
 int fido_pcsc_manifest(fido_dev_info_t *, size_t, size_t *);
+void fido_dev_info_reset(fido_dev_info_t *);
+int fido_dev_info_diff(const fido_dev_info_t *, size_t,
+    const fido_dev_info_t *, size_t, bool *, bool *);
 
 /* fuzzing instrumentation */
 #ifdef FIDO_FUZZ
 uint32_t uniform_random(uint32_t);
+int fido_dev_fuzz_reset(fido_dev_t *);
 #endif
 
 /* internal device capability flags */
@@ -259,6 +561,52 @@ uint32_t uniform_random(uint32_t);
 #define FIDO_DEV_UV_UNSET	0x080
 #define FIDO_DEV_TOKEN_PERMS	0x100
 #define FIDO_DEV_WINHELLO	0x200
+#define FIDO_DEV_SELECTION	0x400
+
+/* asynchronous operations */
+#define FIDO_DEV_ASYNC_ASSERT	1
+#define FIDO_DEV_ASYNC_CRED	2
+
+struct fido_dev_async {
+	int		 op;    /* FIDO_DEV_ASYNC_* */
+	uint8_t		 cmd;   /* command of the awaited reply */
+	unsigned char	*buf;   /* reassembled reply */
+	size_t		 size;  /* capacity of buf */
+	size_t		 len;   /* length of the reply, once init is set */
+	size_t		 off;   /* bytes of the reply received so far */
+	int		 seq;   /* next continuation sequence number */
+	bool		 init;  /* initialisation frame received */
+	fido_blob_t	*ecdh;  /* shared secret, if any */
+	struct u2f_async *u2f;  /* u2f request state, if any */
+	struct winhello_async *winhello; /* windows hello request, if any */
+};
+
+/* webauthn json */
+#define FIDO_JSON_B64URL	1
+#define FIDO_JSON_STRING	2
+#define FIDO_JSON_INT		3
+#define FIDO_JSON_ARRAY		4
+
+typedef int fido_json_elem_t(const char *, size_t, void *);
+
+typedef struct fido_json_field {
+	const char	 *obj;   /* enclosing member, or NULL at the top level */
+	const char	 *name;  /* member name */
+	int		  type;  /* FIDO_JSON_* */
+	fido_blob_t	 *blob;  /* FIDO_JSON_B64URL, FIDO_JSON_STRING */
+	int64_t		 *num;   /* FIDO_JSON_INT */
+	fido_json_elem_t *elem;  /* FIDO_JSON_ARRAY, called per element */
+	void		 *arg;   /* FIDO_JSON_ARRAY, elem's argument */
+	bool		  found; /* set by fido_json_decode() */
+} fido_json_field_t;
+
+bool fido_json_public_key(const fido_blob_t *);
+int fido_json_decode(const char *, size_t, fido_json_field_t *, size_t);
+int fido_json_string(const char *, size_t, fido_blob_t *);
+int fido_json_b64(const char *, size_t, fido_blob_t *);
+int fido_json_clientdata(const unsigned char *, size_t, const char *,
+    const fido_blob_t *, const char *, int, unsigned char *);
+int fido_b64_decode(const char *, size_t, fido_blob_t *);
 
 /* miscellanea */
 #define FIDO_DUMMY_CLIENTDATA	""
@@ -267,7 +615,9 @@ uint32_t uniform_random(uint32_t);
 #define FIDO_DUMMY_USER_ID	1
 #define FIDO_WINHELLO_PATH	"windows://hello"
 #define FIDO_NFC_PREFIX		"nfc:"
+#define FIDO_BLE_PREFIX		"ble:"
 #define FIDO_PCSC_PREFIX	"pcsc:"
+#define FIDO_BROKER_PREFIX	"broker:"
 
 #ifdef __cplusplus
 } /* extern "C" */
@@ -58,6 +58,7 @@ extern "C" {
 
 fido_assert_t *fido_assert_new(void);
 fido_cred_t *fido_cred_new(void);
+fido_cred_list_t *fido_cred_list_new(void);
 fido_dev_t *fido_dev_new(void);
 fido_dev_t *fido_dev_new_with_info(const fido_dev_info_t *);
 fido_dev_info_t *fido_dev_info_new(size_t);
@@ -67,17 +68,32 @@ void *fido_dev_io_handle(const fido_dev_t *);
 void fido_assert_free(fido_assert_t **);
 void fido_cbor_info_free(fido_cbor_info_t **);
 void fido_cred_free(fido_cred_t **);
+void fido_cred_list_free(fido_cred_list_t **);
 void fido_dev_force_fido2(fido_dev_t *);
 void fido_dev_force_u2f(fido_dev_t *);
 void fido_dev_free(fido_dev_t **);
 void fido_dev_info_free(fido_dev_info_t **, size_t);
+void fido_legacy_cache_clear(void);
+void fido_session_cache_clear(void);
+
+struct ossl_lib_ctx_st; /* OSSL_LIB_CTX, with OpenSSL 3 */
 
 /* fido_init() flags. */
 #define FIDO_DEBUG	0x01
 #define FIDO_DISABLE_U2F_FALLBACK 0x02
+#define FIDO_RANDOM_DRBG	0x04
+#define FIDO_PRELOAD_CRYPTO	0x08
 
 void fido_init(int);
 void fido_set_log_handler(fido_log_handler_t *);
+int fido_set_allocator(fido_malloc_t *, fido_realloc_t *, fido_free_t *);
+int fido_set_heap(void *, size_t);
+void fido_heap_stats(size_t *, size_t *);
+int fido_set_mem_stats(bool);
+int fido_mem_stats(int, uint64_t *, uint64_t *, size_t *, size_t *);
+void fido_mem_stats_reset(void);
+int fido_set_libctx(struct ossl_lib_ctx_st *, const char *);
+void fido_set_trace_handler(fido_trace_handler_t *, void *);
 
 const unsigned char *fido_assert_authdata_ptr(const fido_assert_t *, size_t);
 const unsigned char *fido_assert_clientdata_hash_ptr(const fido_assert_t *);
@@ -107,6 +123,7 @@ const char *fido_cred_user_name(const fido_cred_t *);
 const char *fido_dev_info_manufacturer_string(const fido_dev_info_t *);
 const char *fido_dev_info_path(const fido_dev_info_t *);
 const char *fido_dev_info_product_string(const fido_dev_info_t *);
+const fido_cbor_info_t *fido_dev_cbor_info(const fido_dev_t *);
 const fido_dev_info_t *fido_dev_info_ptr(const fido_dev_info_t *, size_t);
 const uint8_t *fido_cbor_info_protocols_ptr(const fido_cbor_info_t *);
 const uint64_t *fido_cbor_info_certs_value_ptr(const fido_cbor_info_t *);
@@ -124,33 +141,60 @@ const unsigned char *fido_cred_user_id_ptr(const fido_cred_t *);
 const unsigned char *fido_cred_x5c_ptr(const fido_cred_t *);
 
 int fido_assert_allow_cred(fido_assert_t *, const unsigned char *, size_t);
+int fido_assert_prepare(fido_assert_t *);
+int fido_assert_set_allow_list(fido_assert_t *, const fido_cred_list_t *,
+    size_t);
 int fido_assert_set_authdata(fido_assert_t *, size_t, const unsigned char *,
     size_t);
 int fido_assert_set_authdata_raw(fido_assert_t *, size_t, const unsigned char *,
     size_t);
 int fido_assert_set_clientdata(fido_assert_t *, const unsigned char *, size_t);
+int fido_assert_set_clientdata_checked(fido_assert_t *, const unsigned char *,
+    size_t, const unsigned char *, size_t, const char *, int);
 int fido_assert_set_clientdata_hash(fido_assert_t *, const unsigned char *,
     size_t);
+int fido_assert_set_clientdata_hash_borrow(fido_assert_t *,
+    const unsigned char *, size_t);
+int fido_assert_set_clientdata_hash_take(fido_assert_t *, unsigned char *,
+    size_t);
+int fido_assert_from_webauthn_json(fido_assert_t *, const char *, size_t);
 int fido_assert_set_count(fido_assert_t *, size_t);
 int fido_assert_set_extensions(fido_assert_t *, int);
 int fido_assert_set_hmac_salt(fido_assert_t *, const unsigned char *, size_t);
 int fido_assert_set_hmac_secret(fido_assert_t *, size_t, const unsigned char *,
     size_t);
 int fido_assert_set_options(fido_assert_t *, bool, bool);
+int fido_assert_set_prf(fido_assert_t *, const unsigned char *, size_t,
+    const unsigned char *, size_t);
+int fido_assert_set_prf_cred(fido_assert_t *, const unsigned char *, size_t,
+    const unsigned char *, size_t, const unsigned char *, size_t);
 int fido_assert_set_rp(fido_assert_t *, const char *);
 int fido_assert_set_up(fido_assert_t *, fido_opt_t);
 int fido_assert_set_uv(fido_assert_t *, fido_opt_t);
 int fido_assert_set_sig(fido_assert_t *, size_t, const unsigned char *, size_t);
+int fido_assert_set_sig_borrow(fido_assert_t *, size_t, const unsigned char *,
+    size_t);
+int fido_assert_set_sig_take(fido_assert_t *, size_t, unsigned char *, size_t);
 int fido_assert_verify(const fido_assert_t *, size_t, int, const void *);
+int fido_assert_verify_batch(const fido_assert_verify_item_t *, size_t, int *);
 int fido_cbor_info_algorithm_cose(const fido_cbor_info_t *, size_t);
 int fido_cred_exclude(fido_cred_t *, const unsigned char *, size_t);
+int fido_cred_from_webauthn_json(fido_cred_t *, const char *, size_t);
+int fido_cred_list_add(fido_cred_list_t *, const unsigned char *, size_t);
+int fido_cred_list_add_array(fido_cred_list_t *,
+    const unsigned char * const *, const size_t *, size_t, int);
+int fido_cred_list_split(fido_cred_list_t *, uint64_t, uint64_t);
 int fido_cred_prot(const fido_cred_t *);
 int fido_cred_set_attstmt(fido_cred_t *, const unsigned char *, size_t);
 int fido_cred_set_authdata(fido_cred_t *, const unsigned char *, size_t);
 int fido_cred_set_authdata_raw(fido_cred_t *, const unsigned char *, size_t);
 int fido_cred_set_blob(fido_cred_t *, const unsigned char *, size_t);
 int fido_cred_set_clientdata(fido_cred_t *, const unsigned char *, size_t);
+int fido_cred_set_clientdata_checked(fido_cred_t *, const unsigned char *,
+    size_t, const unsigned char *, size_t, const char *, int);
 int fido_cred_set_clientdata_hash(fido_cred_t *, const unsigned char *, size_t);
+int fido_cred_set_exclude_list(fido_cred_t *, const fido_cred_list_t *,
+    size_t);
 int fido_cred_set_extensions(fido_cred_t *, int);
 int fido_cred_set_fmt(fido_cred_t *, const char *);
 int fido_cred_set_id(fido_cred_t *, const unsigned char *, size_t);
@@ -160,36 +204,85 @@ int fido_cred_set_prot(fido_cred_t *, int);
 int fido_cred_set_rk(fido_cred_t *, fido_opt_t);
 int fido_cred_set_rp(fido_cred_t *, const char *, const char *);
 int fido_cred_set_sig(fido_cred_t *, const unsigned char *, size_t);
+int fido_cred_set_sig_borrow(fido_cred_t *, const unsigned char *, size_t);
+int fido_cred_set_sig_take(fido_cred_t *, unsigned char *, size_t);
 int fido_cred_set_type(fido_cred_t *, int);
 int fido_cred_set_uv(fido_cred_t *, fido_opt_t);
 int fido_cred_type(const fido_cred_t *);
 int fido_cred_set_user(fido_cred_t *, const unsigned char *, size_t,
     const char *, const char *, const char *);
 int fido_cred_set_x509(fido_cred_t *, const unsigned char *, size_t);
+int fido_cred_set_x509_borrow(fido_cred_t *, const unsigned char *, size_t);
+int fido_cred_set_x509_take(fido_cred_t *, unsigned char *, size_t);
 int fido_cred_verify(const fido_cred_t *);
 int fido_cred_verify_self(const fido_cred_t *);
 #ifdef _FIDO_SIGSET_DEFINED
 int fido_dev_set_sigmask(fido_dev_t *, const fido_sigset_t *);
 #endif
+int fido_dev_broker(fido_dev_t *, int, int);
 int fido_dev_cancel(fido_dev_t *);
 int fido_dev_close(fido_dev_t *);
+int fido_dev_cmd_timeout(const fido_dev_t *, int);
 int fido_dev_get_assert(fido_dev_t *, fido_assert_t *, const char *);
+int fido_dev_get_assert_begin(fido_dev_t *, fido_assert_t *, const char *);
+int fido_dev_get_assert_step(fido_dev_t *, fido_assert_t *, int *, int);
 int fido_dev_get_cbor_info(fido_dev_t *, fido_cbor_info_t *);
+int fido_dev_get_hmac_secrets(fido_dev_t *, fido_assert_t *,
+    const unsigned char *, size_t, unsigned char *, size_t, const char *);
 int fido_dev_get_retry_count(fido_dev_t *, int *);
 int fido_dev_get_uv_retry_count(fido_dev_t *, int *);
 int fido_dev_get_touch_begin(fido_dev_t *);
 int fido_dev_get_touch_status(fido_dev_t *, int *, int);
+int fido_dev_select(fido_dev_t *const *, size_t, int, size_t *);
 int fido_dev_info_manifest(fido_dev_info_t *, size_t, size_t *);
+int fido_dev_info_manifest_cb(fido_dev_info_cb_t *, void *, int);
+int fido_dev_info_manifest_diff(const fido_dev_info_t *, size_t,
+    fido_dev_info_t *, size_t, size_t *, size_t *, size_t *);
+int fido_dev_info_manifest_parallel(fido_dev_info_t *, size_t, size_t *,
+    int);
 int fido_dev_info_set(fido_dev_info_t *, size_t, const char *, const char *,
     const char *, const fido_dev_io_t *, const fido_dev_transport_t *);
 int fido_dev_make_cred(fido_dev_t *, fido_cred_t *, const char *);
+int fido_dev_make_cred_begin(fido_dev_t *, fido_cred_t *, const char *);
+int fido_dev_make_cred_step(fido_dev_t *, fido_cred_t *, int *, int);
 int fido_dev_open_with_info(fido_dev_t *);
 int fido_dev_open(fido_dev_t *, const char *);
+int fido_dev_open_channel(fido_dev_t *, fido_dev_t *);
+int fido_dev_open_many(fido_dev_t *const *, const char *const *, size_t,
+    int *);
+int fido_dev_ping(fido_dev_t *, int);
+void *fido_dev_poll_event(const fido_dev_t *);
+int fido_dev_poll_fd(const fido_dev_t *);
+int fido_dev_poll_timeout(const fido_dev_t *);
+int fido_dev_refresh_cbor_info(fido_dev_t *);
 int fido_dev_reset(fido_dev_t *);
+int fido_dev_wink(fido_dev_t *);
+int fido_dev_set_adaptive_timeout(fido_dev_t *, bool);
+int fido_dev_set_ble_transport(fido_dev_t *, size_t);
+int fido_dev_set_cmd_timeout(fido_dev_t *, int, int);
+int fido_dev_set_ecdh_cache(fido_dev_t *, bool);
 int fido_dev_set_io_functions(fido_dev_t *, const fido_dev_io_t *);
+int fido_dev_set_io_writev(fido_dev_t *, fido_dev_io_writev_t *);
+int fido_dev_set_keepalive_cb(fido_dev_t *, fido_keepalive_cb_t *, void *);
 int fido_dev_set_pin(fido_dev_t *, const char *, const char *);
+int fido_dev_set_record(fido_dev_t *, const char *);
+int fido_dev_set_replay(fido_dev_t *, unsigned int);
+int fido_dev_set_scheduler(fido_dev_t *, bool);
+int fido_dev_set_transport_borrow(fido_dev_t *, fido_dev_rx_borrow_t *,
+    fido_dev_rx_release_t *);
 int fido_dev_set_transport_functions(fido_dev_t *, const fido_dev_transport_t *);
 int fido_dev_set_timeout(fido_dev_t *, int);
+int fido_dev_set_uv_token_cache(fido_dev_t *, bool);
+int fido_hid_set_keep_awake(bool);
+int fido_keypool_set_size(size_t);
+int fido_legacy_cache_load(const char *);
+int fido_legacy_cache_save(const char *);
+int fido_legacy_cache_set_size(size_t);
+int fido_pcsc_set_keep_card(bool);
+int fido_secure_pool_set_size(size_t);
+int fido_session_cache_set_size(size_t);
+int fido_set_thread_priority(int);
+int fido_thread_priority(void);
 
 size_t fido_assert_authdata_len(const fido_assert_t *, size_t);
 size_t fido_assert_clientdata_hash_len(const fido_assert_t *);
@@ -215,11 +308,21 @@ size_t fido_cred_authdata_raw_len(const fido_cred_t *);
 size_t fido_cred_clientdata_hash_len(const fido_cred_t *);
 size_t fido_cred_id_len(const fido_cred_t *);
 size_t fido_cred_largeblob_key_len(const fido_cred_t *);
+size_t fido_cred_list_batch_count(const fido_cred_list_t *);
+size_t fido_cred_list_batch_len(const fido_cred_list_t *, size_t);
+size_t fido_cred_list_len(const fido_cred_list_t *);
 size_t fido_cred_pin_minlen(const fido_cred_t *);
 size_t fido_cred_pubkey_len(const fido_cred_t *);
 size_t fido_cred_sig_len(const fido_cred_t *);
 size_t fido_cred_user_id_len(const fido_cred_t *);
 size_t fido_cred_x5c_len(const fido_cred_t *);
+size_t fido_keypool_len(void);
+size_t fido_keypool_size(void);
+size_t fido_legacy_cache_len(void);
+size_t fido_secure_pool_len(void);
+size_t fido_secure_pool_size(void);
+size_t fido_session_cache_len(void);
+size_t fido_session_cache_size(void);
 
 uint8_t  fido_assert_flags(const fido_assert_t *, size_t);
 uint32_t fido_assert_sigcount(const fido_assert_t *, size_t);
@@ -242,6 +345,8 @@ uint64_t fido_cbor_info_maxrpid_minpinlen(const fido_cbor_info_t *);
 uint64_t fido_cbor_info_minpinlen(const fido_cbor_info_t *);
 uint64_t fido_cbor_info_uv_attempts(const fido_cbor_info_t *);
 uint64_t fido_cbor_info_uv_modality(const fido_cbor_info_t *);
+uint64_t fido_session_cache_hits(void);
+uint64_t fido_session_cache_misses(void);
 int64_t  fido_cbor_info_rk_remaining(const fido_cbor_info_t *);
 
 bool fido_dev_has_pin(const fido_dev_t *);
@@ -257,6 +362,8 @@ bool fido_cbor_info_new_pin_required(const fido_cbor_info_t *);
 
 int fido_dev_largeblob_get(fido_dev_t *, const unsigned char *, size_t,
     unsigned char **, size_t *);
+int fido_dev_largeblob_get_batch(fido_dev_t *, const unsigned char *const *,
+    const size_t *, size_t, unsigned char **, size_t *, int *);
 int fido_dev_largeblob_set(fido_dev_t *, const unsigned char *, size_t,
     const unsigned char *, size_t, const char *);
 int fido_dev_largeblob_remove(fido_dev_t *, const unsigned char *, size_t,
@@ -264,6 +371,13 @@ int fido_dev_largeblob_remove(fido_dev_t *, const unsigned char *, size_t,
 int fido_dev_largeblob_get_array(fido_dev_t *, unsigned char **, size_t *);
 int fido_dev_largeblob_set_array(fido_dev_t *, const unsigned char *, size_t,
     const char *);
+int fido_dev_largeblob_get_stream(fido_dev_t *, const unsigned char *, size_t,
+    fido_largeblob_write_t *, void *);
+int fido_dev_largeblob_set_stream(fido_dev_t *, const unsigned char *, size_t,
+    fido_largeblob_read_t *, void *, const char *);
+int fido_dev_largeblob_entry_len(const fido_dev_t *, const unsigned char *,
+    size_t, size_t *);
+int fido_dev_set_largeblob_level(fido_dev_t *, int);
 
 #ifdef __cplusplus
 } /* extern "C" */
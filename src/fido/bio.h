@@ -75,6 +75,7 @@ typedef struct fido_bio_template fido_bio_template_t;
 typedef struct fido_bio_template_array fido_bio_template_array_t;
 typedef struct fido_bio_enroll fido_bio_enroll_t;
 typedef struct fido_bio_info fido_bio_info_t;
+typedef int fido_bio_enroll_cb_t(uint8_t, uint8_t, void *);
 
 #define FIDO_BIO_ENROLL_FP_GOOD				0x00
 #define FIDO_BIO_ENROLL_FP_TOO_HIGH			0x01
@@ -100,6 +101,9 @@ fido_bio_enroll_t *fido_bio_enroll_new(void);
 fido_bio_info_t *fido_bio_info_new(void);
 fido_bio_template_array_t *fido_bio_template_array_new(void);
 fido_bio_template_t *fido_bio_template_new(void);
+int fido_bio_dev_enroll(fido_dev_t *, fido_bio_template_t *,
+    fido_bio_enroll_t *, uint32_t, const char *, fido_bio_enroll_cb_t *,
+    void *);
 int fido_bio_dev_enroll_begin(fido_dev_t *, fido_bio_template_t *,
     fido_bio_enroll_t *, uint32_t, const char *);
 int fido_bio_dev_enroll_cancel(fido_dev_t *);
@@ -115,6 +119,7 @@ int fido_bio_dev_set_template_name(fido_dev_t *, const fido_bio_template_t *,
 int fido_bio_template_set_id(fido_bio_template_t *, const unsigned char *,
     size_t);
 int fido_bio_template_set_name(fido_bio_template_t *, const char *);
+int fido_dev_set_bio_cache(fido_dev_t *, bool);
 size_t fido_bio_template_array_count(const fido_bio_template_array_t *);
 size_t fido_bio_template_id_len(const fido_bio_template_t *);
 uint8_t fido_bio_enroll_last_status(const fido_bio_enroll_t *);
@@ -51,6 +51,40 @@ int fido_dev_set_pin_minlen(fido_dev_t *, size_t, const char *);
 int fido_dev_set_pin_minlen_rpid(fido_dev_t *, const char * const *, size_t,
     const char *);
 
+#define FIDO_CONFIG_ENTATTEST	0x01
+#define FIDO_CONFIG_ALWAYS_UV	0x02
+#define FIDO_CONFIG_PIN_MINLEN	0x03
+
+typedef struct fido_config fido_config_t;
+
+fido_config_t *fido_config_new(void);
+void fido_config_free(fido_config_t **);
+
+int fido_config_set_always_uv(fido_config_t *, fido_opt_t);
+int fido_config_set_entattest(fido_config_t *, bool);
+int fido_config_set_force_pin_change(fido_config_t *, bool);
+int fido_config_set_pin_minlen(fido_config_t *, size_t);
+int fido_config_set_pin_minlen_rpid(fido_config_t *, const char * const *,
+    size_t);
+int fido_config_status(const fido_config_t *, int);
+
+int fido_dev_config_apply(fido_dev_t *, fido_config_t *, const char *);
+
+typedef struct fido_provision fido_provision_t;
+
+fido_provision_t *fido_provision_new(void);
+void fido_provision_free(fido_provision_t **);
+
+int fido_provision_set_always_uv(fido_provision_t *, fido_opt_t);
+int fido_provision_set_entattest(fido_provision_t *, bool);
+int fido_provision_set_pin(fido_provision_t *, const char *);
+int fido_provision_set_pin_minlen(fido_provision_t *, size_t);
+int fido_provision_set_reset(fido_provision_t *, bool);
+
+int fido_dev_provision(fido_dev_t *, const fido_provision_t *, fido_cred_t *);
+int fido_dev_provision_batch(fido_dev_t *const *, size_t,
+    const fido_provision_t *, fido_cred_t *const *, int *);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif /* __cplusplus */
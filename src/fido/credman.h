@@ -68,36 +68,63 @@ struct fido_credman_rk {
 	fido_cred_t *ptr;
 	size_t n_alloc; /* number of allocated entries */
 	size_t n_rx;    /* number of populated entries */
+	size_t *rp_idx; /* rp of each entry, if from fido_credman_get_dev_all_rk */
+};
+
+struct fido_credman_snapshot {
+	struct fido_credman_metadata metadata; /* counts at the last walk */
+	struct fido_credman_rp rp;             /* rps at the last walk */
+	struct fido_credman_rk *rk;            /* rks of each rp */
+	size_t walked;                         /* rps walked by the last refresh */
+	bool valid;                            /* rp and rk are populated */
 };
 #endif
 
 typedef struct fido_credman_metadata fido_credman_metadata_t;
 typedef struct fido_credman_rk fido_credman_rk_t;
 typedef struct fido_credman_rp fido_credman_rp_t;
+typedef struct fido_credman_snapshot fido_credman_snapshot_t;
 
 const char *fido_credman_rp_id(const fido_credman_rp_t *, size_t);
 const char *fido_credman_rp_name(const fido_credman_rp_t *, size_t);
 
 const fido_cred_t *fido_credman_rk(const fido_credman_rk_t *, size_t);
+const fido_credman_metadata_t *fido_credman_snapshot_metadata(const
+    fido_credman_snapshot_t *);
+const fido_credman_rk_t *fido_credman_snapshot_rk(const
+    fido_credman_snapshot_t *, size_t);
+const fido_credman_rp_t *fido_credman_snapshot_rp(const
+    fido_credman_snapshot_t *);
 const unsigned char *fido_credman_rp_id_hash_ptr(const fido_credman_rp_t *,
     size_t);
 
 fido_credman_metadata_t *fido_credman_metadata_new(void);
 fido_credman_rk_t *fido_credman_rk_new(void);
 fido_credman_rp_t *fido_credman_rp_new(void);
+fido_credman_snapshot_t *fido_credman_snapshot_new(void);
 
 int fido_credman_del_dev_rk(fido_dev_t *, const unsigned char *, size_t,
     const char *);
+int fido_credman_del_dev_rk_batch(fido_dev_t *, const unsigned char *const *,
+    const size_t *, size_t, int *, const char *);
+int fido_credman_get_dev_all_rk(fido_dev_t *, fido_credman_rp_t *,
+    fido_credman_rk_t *, const char *);
 int fido_credman_get_dev_metadata(fido_dev_t *, fido_credman_metadata_t *,
     const char *);
 int fido_credman_get_dev_rk(fido_dev_t *, const char *, fido_credman_rk_t *,
     const char *);
 int fido_credman_get_dev_rp(fido_dev_t *, fido_credman_rp_t *, const char *);
 int fido_credman_set_dev_rk(fido_dev_t *, fido_cred_t *, const char *);
+int fido_credman_set_dev_rk_batch(fido_dev_t *, fido_cred_t *const *, size_t,
+    int *, const char *);
+int fido_credman_snapshot_refresh(fido_dev_t *, fido_credman_snapshot_t *,
+    const char *);
 
 size_t fido_credman_rk_count(const fido_credman_rk_t *);
+size_t fido_credman_rk_rp_idx(const fido_credman_rk_t *, size_t);
 size_t fido_credman_rp_count(const fido_credman_rp_t *);
 size_t fido_credman_rp_id_hash_len(const fido_credman_rp_t *, size_t);
+size_t fido_credman_snapshot_walked(const fido_credman_snapshot_t *);
 
 uint64_t fido_credman_rk_existing(const fido_credman_metadata_t *);
 uint64_t fido_credman_rk_remaining(const fido_credman_metadata_t *);
@@ -105,6 +132,8 @@ uint64_t fido_credman_rk_remaining(const fido_credman_metadata_t *);
 void fido_credman_metadata_free(fido_credman_metadata_t **);
 void fido_credman_rk_free(fido_credman_rk_t **);
 void fido_credman_rp_free(fido_credman_rp_t **);
+void fido_credman_snapshot_clear(fido_credman_snapshot_t *);
+void fido_credman_snapshot_free(fido_credman_snapshot_t **);
 
 #ifdef __cplusplus
 } /* extern "C" */
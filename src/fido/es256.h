@@ -51,6 +51,7 @@ EVP_PKEY *es256_pk_to_EVP_PKEY(const es256_pk_t *);
 int es256_pk_from_EC_KEY(es256_pk_t *, const EC_KEY *);
 int es256_pk_from_EVP_PKEY(es256_pk_t *, const EVP_PKEY *);
 int es256_pk_from_ptr(es256_pk_t *, const void *, size_t);
+int es256_pk_to_compressed(const es256_pk_t *, unsigned char *, size_t);
 
 #ifdef _FIDO_INTERNAL
 es256_sk_t *es256_sk_new(void);
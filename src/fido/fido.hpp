@@ -0,0 +1,448 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * SPDX-License-Identifier: BSD-2-Clause
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _FIDO_FIDO_HPP
+#define _FIDO_FIDO_HPP
+
+/*
+ * A header-only C++20 layer over the C API. Handles are move-only and
+ * free their object on destruction; accessors return std::span and
+ * std::string_view over the object's own buffers, valid until the
+ * object is modified or destroyed. Errors are the FIDO_ERR_* codes of
+ * the C API; only allocation failure throws (std::bad_alloc). The C
+ * object behind a handle is available through get(), so that any C
+ * function not wrapped here may be used with it.
+ *
+ * dev::get_assert() and dev::make_cred() return awaitables built on
+ * fido_dev_get_assert_begin(3) and friends. The application supplies
+ * a waiter: a callable invoked as w(fd, ms, wake) that must arrange
+ * for wake() to be called, once, when descriptor fd becomes readable
+ * or ms milliseconds have elapsed (ms is -1 for no limit). The
+ * awaiting coroutine is resumed from within wake(). On transports
+ * without a pollable descriptor, the operation completes without
+ * suspending.
+ */
+
+#if !defined(__cplusplus) || __cplusplus < 202002L
+#error "fido/fido.hpp requires C++20"
+#endif
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <span>
+#include <string_view>
+#include <utility>
+
+#include <fido.h>
+#include <fido/credman.h>
+
+namespace fido {
+
+using bytes = std::span<const unsigned char>;
+
+namespace detail {
+
+inline bytes
+make_bytes(const unsigned char *ptr, size_t len) noexcept
+{
+	if (ptr == nullptr)
+		return {};
+
+	return { ptr, len };
+}
+
+inline std::string_view
+make_string(const char *s) noexcept
+{
+	if (s == nullptr)
+		return {};
+
+	return s;
+}
+
+/* a move-only owner of a T, released with Free(&p) */
+template <typename T, T *(*New)(void), void (*Free)(T **)>
+class handle {
+public:
+	handle() : p_(New())
+	{
+		if (p_ == nullptr)
+			throw std::bad_alloc();
+	}
+	handle(handle &&o) noexcept : p_(std::exchange(o.p_, nullptr)) {}
+	handle &operator=(handle &&o) noexcept
+	{
+		if (this != &o) {
+			Free(&p_);
+			p_ = std::exchange(o.p_, nullptr);
+		}
+		return *this;
+	}
+	handle(const handle &) = delete;
+	handle &operator=(const handle &) = delete;
+	~handle() { Free(&p_); }
+
+	T *get() noexcept { return p_; }
+	const T *get() const noexcept { return p_; }
+	explicit operator bool() const noexcept { return p_ != nullptr; }
+
+protected:
+	T *p_;
+};
+
+} /* namespace detail */
+
+/* a non-owning view of a credential, as listed by fido_credman_rk */
+class cred_view {
+public:
+	explicit cred_view(const fido_cred_t *c) noexcept : c_(c) {}
+
+	const fido_cred_t *get() const noexcept { return c_; }
+
+	bytes authdata() const noexcept {
+		return detail::make_bytes(fido_cred_authdata_ptr(c_),
+		    fido_cred_authdata_len(c_));
+	}
+	bytes authdata_raw() const noexcept {
+		return detail::make_bytes(fido_cred_authdata_raw_ptr(c_),
+		    fido_cred_authdata_raw_len(c_));
+	}
+	bytes attstmt() const noexcept {
+		return detail::make_bytes(fido_cred_attstmt_ptr(c_),
+		    fido_cred_attstmt_len(c_));
+	}
+	bytes aaguid() const noexcept {
+		return detail::make_bytes(fido_cred_aaguid_ptr(c_),
+		    fido_cred_aaguid_len(c_));
+	}
+	bytes clientdata_hash() const noexcept {
+		return detail::make_bytes(fido_cred_clientdata_hash_ptr(c_),
+		    fido_cred_clientdata_hash_len(c_));
+	}
+	bytes id() const noexcept {
+		return detail::make_bytes(fido_cred_id_ptr(c_),
+		    fido_cred_id_len(c_));
+	}
+	bytes largeblob_key() const noexcept {
+		return detail::make_bytes(fido_cred_largeblob_key_ptr(c_),
+		    fido_cred_largeblob_key_len(c_));
+	}
+	bytes pubkey() const noexcept {
+		return detail::make_bytes(fido_cred_pubkey_ptr(c_),
+		    fido_cred_pubkey_len(c_));
+	}
+	bytes sig() const noexcept {
+		return detail::make_bytes(fido_cred_sig_ptr(c_),
+		    fido_cred_sig_len(c_));
+	}
+	bytes user_id() const noexcept {
+		return detail::make_bytes(fido_cred_user_id_ptr(c_),
+		    fido_cred_user_id_len(c_));
+	}
+	bytes x5c() const noexcept {
+		return detail::make_bytes(fido_cred_x5c_ptr(c_),
+		    fido_cred_x5c_len(c_));
+	}
+	std::string_view display_name() const noexcept {
+		return detail::make_string(fido_cred_display_name(c_));
+	}
+	std::string_view fmt() const noexcept {
+		return detail::make_string(fido_cred_fmt(c_));
+	}
+	std::string_view rp_id() const noexcept {
+		return detail::make_string(fido_cred_rp_id(c_));
+	}
+	std::string_view rp_name() const noexcept {
+		return detail::make_string(fido_cred_rp_name(c_));
+	}
+	std::string_view user_name() const noexcept {
+		return detail::make_string(fido_cred_user_name(c_));
+	}
+	int type() const noexcept { return fido_cred_type(c_); }
+	uint8_t flags() const noexcept { return fido_cred_flags(c_); }
+	uint32_t sigcount() const noexcept { return fido_cred_sigcount(c_); }
+
+private:
+	const fido_cred_t *c_;
+};
+
+class cred : public detail::handle<fido_cred_t, fido_cred_new,
+    fido_cred_free> {
+public:
+	cred_view view() const noexcept { return cred_view(p_); }
+
+	int set_type(int cose_alg) noexcept {
+		return fido_cred_set_type(p_, cose_alg);
+	}
+	int set_clientdata_hash(bytes b) noexcept {
+		return fido_cred_set_clientdata_hash(p_, b.data(), b.size());
+	}
+	int set_rp(const char *id, const char *name) noexcept {
+		return fido_cred_set_rp(p_, id, name);
+	}
+	int set_user(bytes id, const char *name, const char *display_name,
+	    const char *icon) noexcept {
+		return fido_cred_set_user(p_, id.data(), id.size(), name,
+		    display_name, icon);
+	}
+	int set_rk(fido_opt_t rk) noexcept {
+		return fido_cred_set_rk(p_, rk);
+	}
+	int set_uv(fido_opt_t uv) noexcept {
+		return fido_cred_set_uv(p_, uv);
+	}
+	int verify() const noexcept { return fido_cred_verify(p_); }
+};
+
+/* named so as not to collide with the assert() macro */
+class assertion : public detail::handle<fido_assert_t, fido_assert_new,
+    fido_assert_free> {
+public:
+	size_t count() const noexcept { return fido_assert_count(p_); }
+
+	bytes authdata(size_t i) const noexcept {
+		return detail::make_bytes(fido_assert_authdata_ptr(p_, i),
+		    fido_assert_authdata_len(p_, i));
+	}
+	bytes blob(size_t i) const noexcept {
+		return detail::make_bytes(fido_assert_blob_ptr(p_, i),
+		    fido_assert_blob_len(p_, i));
+	}
+	bytes clientdata_hash() const noexcept {
+		return detail::make_bytes(fido_assert_clientdata_hash_ptr(p_),
+		    fido_assert_clientdata_hash_len(p_));
+	}
+	bytes hmac_secret(size_t i) const noexcept {
+		return detail::make_bytes(fido_assert_hmac_secret_ptr(p_, i),
+		    fido_assert_hmac_secret_len(p_, i));
+	}
+	bytes id(size_t i) const noexcept {
+		return detail::make_bytes(fido_assert_id_ptr(p_, i),
+		    fido_assert_id_len(p_, i));
+	}
+	bytes largeblob_key(size_t i) const noexcept {
+		return detail::make_bytes(fido_assert_largeblob_key_ptr(p_, i),
+		    fido_assert_largeblob_key_len(p_, i));
+	}
+	bytes sig(size_t i) const noexcept {
+		return detail::make_bytes(fido_assert_sig_ptr(p_, i),
+		    fido_assert_sig_len(p_, i));
+	}
+	bytes user_id(size_t i) const noexcept {
+		return detail::make_bytes(fido_assert_user_id_ptr(p_, i),
+		    fido_assert_user_id_len(p_, i));
+	}
+	std::string_view rp_id() const noexcept {
+		return detail::make_string(fido_assert_rp_id(p_));
+	}
+	std::string_view user_display_name(size_t i) const noexcept {
+		return detail::make_string(fido_assert_user_display_name(p_,
+		    i));
+	}
+	std::string_view user_name(size_t i) const noexcept {
+		return detail::make_string(fido_assert_user_name(p_, i));
+	}
+	uint8_t flags(size_t i) const noexcept {
+		return fido_assert_flags(p_, i);
+	}
+	uint32_t sigcount(size_t i) const noexcept {
+		return fido_assert_sigcount(p_, i);
+	}
+
+	int set_clientdata_hash(bytes b) noexcept {
+		return fido_assert_set_clientdata_hash(p_, b.data(), b.size());
+	}
+	int set_rp(const char *id) noexcept {
+		return fido_assert_set_rp(p_, id);
+	}
+	int allow_cred(bytes id) noexcept {
+		return fido_assert_allow_cred(p_, id.data(), id.size());
+	}
+	int set_up(fido_opt_t up) noexcept {
+		return fido_assert_set_up(p_, up);
+	}
+	int set_uv(fido_opt_t uv) noexcept {
+		return fido_assert_set_uv(p_, uv);
+	}
+	int verify(size_t i, int cose_alg, const void *pk) const noexcept {
+		return fido_assert_verify(p_, i, cose_alg, pk);
+	}
+};
+
+class credman_rk : public detail::handle<fido_credman_rk_t,
+    fido_credman_rk_new, fido_credman_rk_free> {
+public:
+	size_t size() const noexcept { return fido_credman_rk_count(p_); }
+	cred_view operator[](size_t i) const noexcept {
+		return cred_view(fido_credman_rk(p_, i));
+	}
+};
+
+namespace detail {
+
+/*
+ * The state of an operation started by dev::get_assert() or
+ * dev::make_cred(). Begin transmits the request; Step is called with a
+ * zero timeout each time the waiter wakes it, until the reply is in.
+ */
+template <typename T, typename Waiter,
+    int (*Begin)(fido_dev_t *, T *, const char *),
+    int (*Step)(fido_dev_t *, T *, int *, int)>
+class operation {
+public:
+	operation(fido_dev_t *dev, T *obj, const char *pin, Waiter w)
+	    : dev_(dev), obj_(obj), pin_(pin), waiter_(std::move(w)) {}
+	operation(const operation &) = delete;
+	operation &operator=(const operation &) = delete;
+
+	bool await_ready() const noexcept { return false; }
+
+	bool await_suspend(std::coroutine_handle<> h)
+	{
+		int fd;
+
+		h_ = h;
+		if ((r_ = Begin(dev_, obj_, pin_)) != FIDO_OK)
+			return false;
+		if ((fd = fido_dev_poll_fd(dev_)) < 0) {
+			/* no descriptor to wait on; block in the library */
+			r_ = finish(-1);
+			return false;
+		}
+		wait(fd);
+
+		return true;
+	}
+
+	int await_resume() const noexcept { return r_; }
+
+private:
+	int finish(int ms) noexcept
+	{
+		int done = 0;
+		int r;
+
+		while ((r = Step(dev_, obj_, &done, ms)) == FIDO_OK && !done)
+			continue;
+
+		return r;
+	}
+
+	void wait(int fd)
+	{
+		waiter_(fd, fido_dev_poll_timeout(dev_),
+		    std::function<void()>([this] { wake(); }));
+	}
+
+	void wake()
+	{
+		int done = 0;
+		int fd;
+
+		if ((r_ = Step(dev_, obj_, &done, 0)) == FIDO_OK && !done &&
+		    (fd = fido_dev_poll_fd(dev_)) >= 0) {
+			wait(fd);
+			return;
+		}
+		if (r_ == FIDO_OK && !done)
+			r_ = finish(-1);
+		h_.resume();
+	}
+
+	fido_dev_t		*dev_;
+	T			*obj_;
+	const char		*pin_;
+	Waiter			 waiter_;
+	std::coroutine_handle<>	 h_;
+	int			 r_ = FIDO_ERR_INTERNAL;
+};
+
+} /* namespace detail */
+
+template <typename W>
+concept waiter = requires(W &w, int fd, int ms, std::function<void()> f) {
+	w(fd, ms, std::move(f));
+};
+
+class dev : public detail::handle<fido_dev_t, fido_dev_new, fido_dev_free> {
+public:
+	dev() = default;
+	dev(dev &&) noexcept = default;
+	dev &operator=(dev &&o) noexcept
+	{
+		if (this != &o && p_ != nullptr)
+			(void)fido_dev_close(p_);
+		detail::handle<fido_dev_t, fido_dev_new,
+		    fido_dev_free>::operator=(std::move(o));
+		return *this;
+	}
+	~dev()
+	{
+		if (p_ != nullptr)
+			(void)fido_dev_close(p_);
+	}
+
+	int open(const char *path) noexcept {
+		return fido_dev_open(p_, path);
+	}
+	int close() noexcept { return fido_dev_close(p_); }
+	int cancel() noexcept { return fido_dev_cancel(p_); }
+	bool is_fido2() const noexcept { return fido_dev_is_fido2(p_); }
+
+	int get_credman_rk(const char *rp_id, credman_rk &rk,
+	    const char *pin) noexcept {
+		return fido_credman_get_dev_rk(p_, rp_id, rk.get(), pin);
+	}
+
+	/*
+	 * Awaitables yielding the operation's FIDO_* result. The device,
+	 * the object, pin and the awaitable itself must outlive the
+	 * co_await.
+	 */
+	template <waiter W>
+	[[nodiscard]] auto get_assert(assertion &a, const char *pin, W w)
+	{
+		return detail::operation<fido_assert_t, W,
+		    fido_dev_get_assert_begin, fido_dev_get_assert_step>(p_,
+		    a.get(), pin, std::move(w));
+	}
+	template <waiter W>
+	[[nodiscard]] auto make_cred(cred &c, const char *pin, W w)
+	{
+		return detail::operation<fido_cred_t, W,
+		    fido_dev_make_cred_begin, fido_dev_make_cred_step>(p_,
+		    c.get(), pin, std::move(w));
+	}
+};
+
+} /* namespace fido */
+
+#endif /* !_FIDO_FIDO_HPP */
@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * SPDX-License-Identifier: BSD-2-Clause
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _FIDO_LOOP_H
+#define _FIDO_LOOP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef _FIDO_INTERNAL
+#include "fido/types.h"
+#else
+#include <fido.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+typedef struct fido_loop fido_loop_t;
+typedef struct fido_loop_group fido_loop_group_t;
+typedef void fido_loop_cb_t(fido_dev_t *, void *, int);
+
+fido_loop_t *fido_loop_new(void);
+void fido_loop_free(fido_loop_t **);
+
+int fido_loop_add_assert(fido_loop_t *, fido_dev_t *, fido_assert_t *,
+    const char *, fido_loop_cb_t *, void *);
+int fido_loop_add_cred(fido_loop_t *, fido_dev_t *, fido_cred_t *,
+    const char *, fido_loop_cb_t *, void *);
+int fido_loop_run(fido_loop_t *, int);
+size_t fido_loop_pending(const fido_loop_t *);
+
+fido_loop_group_t *fido_loop_group_new(size_t);
+void fido_loop_group_free(fido_loop_group_t **);
+
+int fido_loop_group_add_assert(fido_loop_group_t *, fido_dev_t *,
+    fido_assert_t *, const char *, fido_loop_cb_t *, void *);
+int fido_loop_group_add_cred(fido_loop_group_t *, fido_dev_t *,
+    fido_cred_t *, const char *, fido_loop_cb_t *, void *);
+int fido_loop_group_wait(fido_loop_group_t *, int);
+size_t fido_loop_group_pending(fido_loop_group_t *);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif /* __cplusplus */
+
+#endif /* !_FIDO_LOOP_H */
@@ -53,6 +53,7 @@
 #define CTAP_CBOR_CLIENT_PIN		0x06
 #define CTAP_CBOR_RESET			0x07
 #define CTAP_CBOR_NEXT_ASSERT		0x08
+#define CTAP_CBOR_SELECTION		0x0b
 #define CTAP_CBOR_LARGEBLOB		0x0c
 #define CTAP_CBOR_CONFIG		0x0d
 #define CTAP_CBOR_BIO_ENROLL_PRE	0x40
@@ -65,6 +66,7 @@
 /* U2F command opcodes. */
 #define U2F_CMD_REGISTER		0x01
 #define U2F_CMD_AUTH			0x02
+#define U2F_CMD_VERSION			0x03
 
 /* U2F command flags. */
 #define U2F_AUTH_SIGN			0x03
@@ -72,8 +74,11 @@
 
 /* ISO7816-4 status words. */
 #define SW1_MORE_DATA			0x61
+#define SW_WRONG_LENGTH			0x6700
 #define SW_CONDITIONS_NOT_SATISFIED	0x6985
 #define SW_WRONG_DATA			0x6a80
+#define SW_INS_NOT_SUPPORTED		0x6d00
+#define SW_CLA_NOT_SUPPORTED		0x6e00
 #define SW_NO_ERROR			0x9000
 
 /* HID Broadcast channel ID. */
@@ -98,6 +103,21 @@
 #define FIDO_MAXMSG	2048
 #endif
 
+/* Largest maxMsgSize honoured, and so largest receive buffer. */
+#ifndef FIDO_MAXMSG_LIMIT
+#define FIDO_MAXMSG_LIMIT	UINT16_MAX
+#endif
+
+/* Maximum number of statements in an assertion. */
+#ifndef FIDO_MAXSTMT
+#define FIDO_MAXSTMT	SIZE_MAX
+#endif
+
+/* Maximum number of entries in an assertion's allow list. */
+#ifndef FIDO_MAXALLOW
+#define FIDO_MAXALLOW	SIZE_MAX
+#endif
+
 /* CTAP capability bits. */
 #define FIDO_CAP_WINK	0x01 /* if set, device supports CTAP_CMD_WINK */
 #define FIDO_CAP_CBOR	0x04 /* if set, device supports CTAP_CMD_CBOR */
@@ -134,6 +154,12 @@
 #define FIDO_CRED_PROT_UV_OPTIONAL_WITH_ID	0x02
 #define FIDO_CRED_PROT_UV_REQUIRED		0x03
 
+/* Flags for fido_cred_list_add_array(). */
+#define FIDO_CRED_LIST_BORROW	0x01	/* reference the ids, do not copy */
+
+/* Flags for fido_assert_set_clientdata_checked(). */
+#define FIDO_CLIENTDATA_CROSS_ORIGIN	0x01	/* allow crossOrigin true */
+
 #ifdef _FIDO_INTERNAL
 #define FIDO_EXT_ASSERT_MASK	(FIDO_EXT_HMAC_SECRET|FIDO_EXT_LARGEBLOB_KEY| \
 				 FIDO_EXT_CRED_BLOB)
@@ -157,4 +183,49 @@
 #define FIDO_UV_MODE_EXT_PIN	0x0800	/* external pin verification */
 #define FIDO_UV_MODE_EXT_DRAWN	0x1000	/* external drawn pattern check */
 
+/* Trace events; see fido_set_trace_handler(3). */
+#define FIDO_TRACE_CMD_START	1	/* message about to be sent */
+#define FIDO_TRACE_CMD_END	2	/* reply received, or not */
+#define FIDO_TRACE_TX		3	/* report written */
+#define FIDO_TRACE_RX		4	/* report read */
+#define FIDO_TRACE_KEEPALIVE	5	/* keepalive report read */
+#define FIDO_TRACE_TIMEOUT	6	/* timeout expired */
+#define FIDO_TRACE_SPAN_BEGIN	7	/* span opened */
+#define FIDO_TRACE_SPAN_END	8	/* span closed */
+
+/* Spans; see fido_set_trace_handler(3). */
+#define FIDO_SPAN_GET_ASSERT	1	/* fido_dev_get_assert() */
+#define FIDO_SPAN_MAKE_CRED	2	/* fido_dev_make_cred() */
+#define FIDO_SPAN_CREDMAN	3	/* fido_credman_*() */
+#define FIDO_SPAN_LARGEBLOB	4	/* fido_dev_largeblob_*() */
+#define FIDO_SPAN_ECDH		5	/* key agreement */
+#define FIDO_SPAN_UV_TOKEN	6	/* pin/uv token acquisition */
+#define FIDO_SPAN_UP		7	/* wait for user presence */
+
+/* CTAPHID_KEEPALIVE status codes. */
+#define FIDO_KEEPALIVE_PROCESSING	1	/* processing the request */
+#define FIDO_KEEPALIVE_UPNEEDED		2	/* waiting for user presence */
+
+/* Command classes; see fido_dev_set_cmd_timeout(3). */
+#define FIDO_TIMEOUT_INIT	0	/* CTAPHID_INIT */
+#define FIDO_TIMEOUT_INFO	1	/* authenticatorGetInfo */
+#define FIDO_TIMEOUT_CBOR	2	/* other commands */
+#define FIDO_TIMEOUT_UP		3	/* after user presence was requested */
+#define FIDO_TIMEOUT_NCLASS	4
+
+/* Memory classes; see fido_mem_stats(3). */
+#define FIDO_MEM_ALL		(-1)	/* all classes together */
+#define FIDO_MEM_OTHER		0	/* not in a class below */
+#define FIDO_MEM_CBOR		1	/* made by libcbor */
+#define FIDO_MEM_BLOB		2	/* contents of byte strings */
+#define FIDO_MEM_IO		3	/* report and message buffers */
+#define FIDO_MEM_CREDMAN	4	/* credential management arrays */
+#define FIDO_MEM_LARGEBLOB	5	/* large-blob arrays and entries */
+#define FIDO_MEM_NCLASSES	6
+
+/* Thread priorities; see fido_dev_set_scheduler(3). */
+#define FIDO_PRIO_BACKGROUND	0
+#define FIDO_PRIO_NORMAL	1
+#define FIDO_PRIO_INTERACTIVE	2
+
 #endif /* !_FIDO_PARAM_H */
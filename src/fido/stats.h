@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * SPDX-License-Identifier: BSD-2-Clause
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _FIDO_STATS_H
+#define _FIDO_STATS_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef _FIDO_INTERNAL
+#include "fido/types.h"
+#else
+#include <fido.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#define FIDO_STATS_TX_BYTES	0 /* bytes written */
+#define FIDO_STATS_RX_BYTES	1 /* bytes read */
+#define FIDO_STATS_TX_REPORTS	2 /* reports written */
+#define FIDO_STATS_RX_REPORTS	3 /* reports read */
+#define FIDO_STATS_KEEPALIVES	4 /* keepalive reports read */
+#define FIDO_STATS_COMMANDS	5 /* messages sent */
+#define FIDO_STATS_REPLIES	6 /* replies received */
+#define FIDO_STATS_RX_ERRORS	7 /* replies not received */
+#define FIDO_STATS_NCOUNTERS	8
+
+#define FIDO_STATS_NBUCKETS	32 /* bucket i: [2^i, 2^(i+1)) microseconds */
+
+typedef struct fido_dev_stats fido_dev_stats_t;
+
+fido_dev_stats_t *fido_dev_stats_new(void);
+void fido_dev_stats_free(fido_dev_stats_t **);
+
+int fido_dev_set_stats(fido_dev_t *, bool);
+int fido_dev_stats(const fido_dev_t *, fido_dev_stats_t *);
+
+size_t fido_dev_stats_cmd_len(const fido_dev_stats_t *);
+uint8_t fido_dev_stats_cmd_ctaphid(const fido_dev_stats_t *, size_t);
+uint8_t fido_dev_stats_cmd_cbor(const fido_dev_stats_t *, size_t);
+uint64_t fido_dev_stats_counter(const fido_dev_stats_t *, int);
+uint64_t fido_dev_stats_rtt(const fido_dev_stats_t *, size_t, size_t);
+uint64_t fido_dev_stats_up_wait(const fido_dev_stats_t *, size_t);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif /* __cplusplus */
+
+#endif /* !_FIDO_STATS_H */
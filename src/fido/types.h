@@ -41,14 +41,19 @@
 extern "C" {
 #endif /* __cplusplus */
 
+struct fido_assert;
 struct fido_dev;
+struct fido_dev_info;
 
 typedef void *fido_dev_io_open_t(const char *);
 typedef void  fido_dev_io_close_t(void *);
 typedef int   fido_dev_io_read_t(void *, unsigned char *, size_t, int);
 typedef int   fido_dev_io_write_t(void *, const unsigned char *, size_t);
+typedef int   fido_dev_io_writev_t(void *, const unsigned char *, size_t, size_t);
 typedef int   fido_dev_rx_t(struct fido_dev *, uint8_t, unsigned char *, size_t, int);
 typedef int   fido_dev_tx_t(struct fido_dev *, uint8_t, const unsigned char *, size_t);
+typedef int   fido_dev_rx_borrow_t(struct fido_dev *, uint8_t, const unsigned char **, size_t *, int);
+typedef void  fido_dev_rx_release_t(struct fido_dev *, const unsigned char *, size_t);
 
 typedef struct fido_dev_io {
 	fido_dev_io_open_t  *open;
@@ -62,6 +67,13 @@ typedef struct fido_dev_transport {
 	fido_dev_tx_t *tx;
 } fido_dev_transport_t;
 
+typedef struct fido_assert_verify_item {
+	const struct fido_assert *assert;   /* assertion */
+	size_t                    idx;      /* statement index */
+	int                       cose_alg; /* cose algorithm of pk */
+	const void               *pk;       /* public key of type cose_alg */
+} fido_assert_verify_item_t;
+
 typedef enum {
 	FIDO_OPT_OMIT = 0, /* use authenticator's default */
 	FIDO_OPT_FALSE,    /* explicitly set option to false */
@@ -69,6 +81,33 @@ typedef enum {
 } fido_opt_t;
 
 typedef void fido_log_handler_t(const char *);
+typedef void *fido_malloc_t(size_t);
+typedef void *fido_realloc_t(void *, size_t);
+typedef void fido_free_t(void *);
+
+typedef struct fido_trace_event {
+	int                     type;   /* FIDO_TRACE_* */
+	const struct fido_dev  *dev;    /* device, or NULL */
+	uint8_t                 cmd;    /* ctaphid command, or 0 */
+	uint8_t                 cbor;   /* ctap2 command, or 0 */
+	size_t                  len;    /* payload or report length */
+	int                     result; /* depends on type */
+	uint64_t                ns;     /* monotonic time, in nanoseconds */
+	int                     span;   /* FIDO_SPAN_*, or 0 */
+	uint64_t                span_id;   /* span, or span in progress */
+	uint64_t                parent_id; /* enclosing span, or 0 */
+	const char             *transport; /* span events: "usb", "nfc"... */
+	const unsigned char    *aaguid;    /* span events: 16 bytes, or NULL */
+} fido_trace_event_t;
+
+typedef void fido_trace_handler_t(void *, const fido_trace_event_t *);
+
+typedef int fido_keepalive_cb_t(void *, int, int);
+
+typedef int fido_dev_info_cb_t(const struct fido_dev_info *, void *);
+
+typedef int fido_largeblob_read_t(void *, unsigned char *, size_t);
+typedef int fido_largeblob_write_t(void *, const unsigned char *, size_t);
 
 #undef  _FIDO_SIGSET_DEFINED
 #define _FIDO_SIGSET_DEFINED
@@ -83,6 +122,7 @@ typedef sigset_t fido_sigset_t;
 #ifdef _FIDO_INTERNAL
 #include "packed.h"
 #include "blob.h"
+#include "iso7816.h"
 
 /* COSE ES256 (ECDSA over P-256 with SHA-256) public key */
 typedef struct es256_pk {
@@ -127,6 +167,20 @@ struct fido_attcred_raw {
 	uint8_t       body[];     /* credential id + pubkey */
 })
 
+PACKED_TYPE(fido_cred_record_t,
+struct fido_cred_record {
+	unsigned char magic[4];   /* FIDO_CRED_RECORD_MAGIC */
+	uint8_t       version;    /* FIDO_CRED_RECORD_VERSION */
+	uint8_t       flags;      /* authdata flags at registration */
+	uint16_t      pk_len;     /* length of the public key */
+	uint32_t      type;       /* credential's cose algorithm */
+	uint32_t      sigcount;   /* signature counter at registration */
+	unsigned char aaguid[16]; /* authenticator's aaguid */
+	uint16_t      id_len;     /* credential id length */
+	uint16_t      reserved;   /* zero */
+	uint8_t       body[];     /* pubkey + credential id */
+})
+
 typedef struct fido_attcred {
 	unsigned char aaguid[16]; /* credential's aaguid */
 	fido_blob_t   id;         /* credential id */
@@ -140,12 +194,13 @@ typedef struct fido_attcred {
 } fido_attcred_t;
 
 typedef struct fido_attstmt {
-	fido_blob_t certinfo; /* tpm attestation TPMS_ATTEST structure */
-	fido_blob_t pubarea;  /* tpm attestation TPMT_PUBLIC structure */
-	fido_blob_t cbor;     /* cbor-encoded attestation statement */
-	fido_blob_t x5c;      /* attestation certificate */
-	fido_blob_t sig;      /* attestation signature */
-	int         alg;      /* attestation algorithm (cose) */
+	fido_blob_t       certinfo;  /* tpm attestation TPMS_ATTEST structure */
+	fido_blob_t       pubarea;   /* tpm attestation TPMT_PUBLIC structure */
+	fido_blob_t       cbor;      /* cbor-encoded attestation statement */
+	fido_blob_t       x5c;       /* attestation certificate */
+	fido_blob_array_t x5c_chain; /* certificates following x5c */
+	fido_blob_t       sig;       /* attestation signature */
+	int               alg;       /* attestation algorithm (cose) */
 } fido_attstmt_t;
 
 typedef struct fido_rp {
@@ -166,12 +221,27 @@ typedef struct fido_cred_ext {
 	size_t minpinlen; /* minimum pin length */
 } fido_cred_ext_t;
 
+typedef struct fido_cred_list {
+	fido_blob_array_t id;      /* credential ids, as added */
+	unsigned char   **own;     /* allocation freed with each id, if any */
+	cbor_writer_t     enc;     /* their descriptors, back to back */
+	size_t           *end;     /* end of each descriptor in enc */
+	size_t           *sel;     /* descriptors within maxidlen */
+	size_t            nsel;    /* entries in sel */
+	size_t            cap;     /* allocated entries in id, own, end, sel */
+	size_t            maxcnt;  /* descriptors per batch; 0 for all */
+	size_t            maxidlen; /* longest id sent; 0 for any */
+} fido_cred_list_t;
+
 typedef struct fido_cred {
 	fido_blob_t       cd;            /* client data */
 	fido_blob_t       cdh;           /* client data hash */
 	fido_rp_t         rp;            /* relying party */
+	unsigned char     rp_id_hash[32]; /* sha256 of rp.id */
 	fido_user_t       user;          /* user entity */
 	fido_blob_array_t excl;          /* list of credential ids to exclude */
+	const fido_cred_list_t *excl_list; /* pre-encoded exclude list */
+	size_t            excl_batch;    /* batch of excl_list sent */
 	fido_opt_t        rk;            /* resident key */
 	fido_opt_t        uv;            /* user verification */
 	fido_cred_ext_t   ext;           /* extensions */
@@ -202,24 +272,34 @@ typedef struct _fido_assert_stmt {
 	fido_authdata_t       authdata;      /* decoded authdata payload */
 	fido_blob_t           sig;           /* signature of cdh + authdata */
 	fido_blob_t           largeblob_key; /* decoded large blob key */
+	fido_blob_t           raw;           /* reply, while deferred */
+	bool                  deferred;      /* user, largeblob_key undecoded */
 } fido_assert_stmt;
 
 typedef struct fido_assert_ext {
-	int         mask;                /* enabled extensions */
-	fido_blob_t hmac_salt;           /* optional hmac-secret salt */
+	int               mask;          /* enabled extensions */
+	fido_blob_t       hmac_salt;     /* optional hmac-secret salt */
+	fido_blob_array_t prf_id;        /* prf evalByCredential ids */
+	fido_blob_array_t prf_salt;      /* and their hmac-secret salts */
 } fido_assert_ext_t;
 
 typedef struct fido_assert {
 	char              *rp_id;        /* relying party id */
+	unsigned char      rp_id_hash[32]; /* sha256 of rp_id */
 	fido_blob_t        cd;           /* client data */
 	fido_blob_t        cdh;          /* client data hash */
 	fido_blob_array_t  allow_list;   /* list of allowed credentials */
+	const fido_cred_list_t *allow_cred_list; /* pre-encoded allow list */
+	size_t             allow_batch;  /* batch of allow_cred_list sent */
 	fido_opt_t         up;           /* user presence */
 	fido_opt_t         uv;           /* user verification */
 	fido_assert_ext_t  ext;          /* enabled extensions */
+	fido_blob_t        req;          /* prepared request; see fido_assert_prepare() */
+	size_t             req_cdh;      /* where the client data hash goes in req */
 	fido_assert_stmt  *stmt;         /* array of expected assertions */
 	size_t             stmt_cnt;     /* number of allocated assertions */
 	size_t             stmt_len;     /* number of received assertions */
+	fido_arena_t       arena;        /* reply fields of stmt[] */
 } fido_assert_t;
 
 typedef struct fido_opt_array {
@@ -275,6 +355,8 @@ typedef struct fido_cbor_info {
 	int64_t           rk_remaining;   /* remaining resident credentials */
 	bool              new_pin_reqd;   /* new pin required */
 	fido_cert_array_t certs;          /* associated certifications */
+	fido_blob_t       raw;            /* reply, while fields are deferred */
+	bool              deferred;       /* transports, algorithms, certs */
 } fido_cbor_info_t;
 
 typedef struct fido_dev_info {
@@ -299,6 +381,21 @@ struct fido_ctap_info {
 	uint8_t  flags;    /* capabilities flags; see FIDO_CAP_* */
 })
 
+/* per-report reply budget of a command class */
+struct fido_rx_timeout {
+	int	ms;     /* budget, or -1 */
+	int	srtt;   /* smoothed wait in ms if adaptive, or -1 */
+	int	rttvar; /* its mean deviation */
+};
+
+/* a span of the trace; see fido_trace_span_begin() */
+typedef struct fido_trace_span {
+	int		type;   /* FIDO_SPAN_*, or 0 if not open */
+	uint64_t	id;     /* span id, unique to the device */
+	uint64_t	parent; /* enclosing span, or 0 */
+	uint64_t	bytes;  /* trace_bytes when opened */
+} fido_trace_span_t;
+
 typedef struct fido_dev {
 	uint64_t              nonce;      /* issued nonce */
 	fido_ctap_info_t      attr;       /* device attributes */
@@ -306,19 +403,62 @@ typedef struct fido_dev {
 	char                 *path;       /* device path */
 	void                 *io_handle;  /* abstract i/o handle */
 	fido_dev_io_t         io;         /* i/o functions */
+	fido_dev_io_writev_t *io_writev;  /* optional batched write */
 	bool                  io_own;     /* device has own io/transport */
 	size_t                rx_len;     /* length of HID input reports */
 	size_t                tx_len;     /* length of HID output reports */
+	size_t                ble_len;    /* length of BLE fragments */
 	int                   flags;      /* internal flags; see FIDO_DEV_* */
 	fido_dev_transport_t  transport;  /* transport functions */
+	fido_dev_rx_borrow_t *rx_borrow;  /* optional in-place receive */
+	fido_dev_rx_release_t *rx_release; /* returns a borrowed reply */
 	uint64_t	      maxmsgsize; /* max message size */
 	int		      timeout_ms; /* read timeout in ms */
+	struct fido_dev_async *async;     /* pending async operation */
+	iso7816_buf_t         apdu_buf;   /* reusable nfc/pcsc apdu */
+	unsigned char        *rx_buf;     /* reusable receive buffer */
+	size_t                rx_buf_len; /* size of rx_buf */
+	size_t                rx_buf_used; /* bytes of rx_buf to wipe */
+	bool                  rx_buf_busy; /* rx_buf lent out */
+	struct fido_dev_mux  *mux;        /* shared handle, if any */
+	fido_cbor_info_t     *info;       /* getinfo reply, if any */
+	struct fido_uv_cache *uv_cache;   /* cached uv token, if enabled */
+	struct fido_pin_mac  *pin_mac;    /* hmac key schedule of last token */
+	struct fido_ecdh_cache *ecdh_cache; /* shared secret, if enabled */
+	struct fido_bio_cache *bio_cache; /* bio info, templates, if enabled */
+	fido_blob_t          *largeblob;  /* large-blob array last seen */
+	struct fido_largeblob_index *largeblob_index; /* its entries by key */
+	int                   largeblob_level; /* deflate level of new blobs */
+	char                 *session_path; /* session cache key, if any */
+	uint8_t               trace_cmd;  /* ctaphid command in flight */
+	uint8_t               trace_cbor; /* ctap2 command in flight */
+	uint64_t              trace_span; /* span in progress, or 0 */
+	uint64_t              trace_seq;  /* last span id issued */
+	uint64_t              trace_bytes; /* message bytes sent and received */
+	fido_trace_span_t     trace_up;   /* user presence span, if open */
+	const char           *trace_transport; /* span transport, from the open */
+	struct fido_dev_stats *stats;     /* counters, if enabled */
+	fido_keepalive_cb_t  *keepalive_cb; /* keepalive callback, if any */
+	void                 *keepalive_arg; /* its argument */
+	struct timespec       keepalive_ts; /* start of the message in flight */
+	bool                  keepalive_cancel; /* cancel sent for it */
+	struct fido_wakeup   *wakeup;     /* interrupts waits; see fido_dev_cancel() */
+	bool                  rx_stale;   /* a reply may be left over from a wait cut short */
+	struct timespec       u2f_touch_ts; /* u2f touch request first sent */
+	fido_blob_t           touch_req;  /* cached touch request frame */
+	struct fido_rx_timeout rx_timeout[4]; /* by FIDO_TIMEOUT_* class */
+	bool                  rx_adaptive; /* tune rx_timeout from replies */
+	struct fido_sched    *sched;      /* orders threads sharing dev, if enabled */
+	struct fido_record   *record;     /* message recording, if any */
+	unsigned int          replay_speed; /* of a replayed recording; 0 is no delay */
+	uint32_t              model;      /* usb vendor << 16 | product, or 0 */
 } fido_dev_t;
 
 #else
 typedef struct fido_assert fido_assert_t;
 typedef struct fido_cbor_info fido_cbor_info_t;
 typedef struct fido_cred fido_cred_t;
+typedef struct fido_cred_list fido_cred_list_t;
 typedef struct fido_dev fido_dev_t;
 typedef struct fido_dev_info fido_dev_info_t;
 typedef struct es256_pk es256_pk_t;
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * SPDX-License-Identifier: BSD-2-Clause
+ * 
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ * 
+ *    1. Redistributions of source code must retain the above copyright
+ *       notice, this list of conditions and the following disclaimer.
+ *    2. Redistributions in binary form must reproduce the above copyright
+ *       notice, this list of conditions and the following disclaimer in
+ *       the documentation and/or other materials provided with the
+ *       distribution.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _FIDO_VERIFY_H
+#define _FIDO_VERIFY_H
+
+#include <openssl/evp.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef _FIDO_INTERNAL
+#include "fido/types.h"
+#else
+#include <fido.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+#ifdef _FIDO_INTERNAL
+struct fido_verify_key {
+	int           type;   /* cose algorithm */
+	EVP_PKEY     *pkey;   /* decoded public key */
+	unsigned char id[32]; /* sha256 of its SubjectPublicKeyInfo */
+};
+
+#define FIDO_RP_VERIFIER_MAXTYPE	8
+
+struct fido_rp_verifier {
+	unsigned char rp_id_hash[32]; /* sha256 of the rp id */
+	bool          rp_id_set;      /* rp_id_hash holds a hash */
+	fido_opt_t    up;             /* user presence */
+	fido_opt_t    uv;             /* user verification */
+	int           ext;            /* FIDO_EXT_* expected in authdata */
+	int           type[FIDO_RP_VERIFIER_MAXTYPE]; /* cose algorithms */
+	size_t        ntype;          /* entries in type; 0 allows any */
+	struct fido_verify_cache *cache; /* verification results, if any */
+};
+
+int fido_verify_cache_digest(const struct fido_verify_key *,
+    const fido_blob_t *, const fido_blob_t *, const fido_blob_t *,
+    unsigned char *);
+int fido_verify_cache_get(struct fido_verify_cache *, const unsigned char *,
+    int *);
+void fido_verify_cache_put(struct fido_verify_cache *, const unsigned char *,
+    int);
+#endif
+
+typedef struct fido_verify_key fido_verify_key_t;
+typedef struct fido_rp_verifier fido_rp_verifier_t;
+typedef struct fido_verify_cache fido_verify_cache_t;
+
+typedef struct fido_authdata_view {
+	const unsigned char *ptr;        /* authenticator data */
+	size_t               len;        /* length of ptr */
+	const unsigned char *rp_id_hash; /* 32-byte rp id hash */
+	uint8_t              flags;      /* user present/verified */
+	uint32_t             sigcount;   /* signature counter */
+	const unsigned char *ext_ptr;    /* cbor-encoded extensions */
+	size_t               ext_len;    /* length of ext_ptr */
+	int                  ext;        /* FIDO_EXT_* present in ext_ptr */
+} fido_authdata_view_t;
+
+fido_verify_key_t *fido_verify_key_new(void);
+void fido_verify_key_free(fido_verify_key_t **);
+
+int fido_verify_key_from_cose(fido_verify_key_t *, const unsigned char *,
+    size_t);
+int fido_verify_key_from_pk(fido_verify_key_t *, int, const void *);
+int fido_verify_key_from_record(fido_verify_key_t *, const unsigned char *,
+    size_t);
+int fido_verify_key_type(const fido_verify_key_t *);
+
+#define FIDO_CRED_RECORD_MAGIC		"F2CR"
+#define FIDO_CRED_RECORD_VERSION	1
+#define FIDO_CRED_RECORD_HDRLEN		36
+
+int fido_cred_export_record(const fido_cred_t *, unsigned char **, size_t *);
+
+typedef struct fido_cred_store fido_cred_store_t;
+
+fido_cred_store_t *fido_cred_store_new(void);
+void fido_cred_store_free(fido_cred_store_t **);
+
+int fido_cred_store_open(fido_cred_store_t *, const char *);
+int fido_cred_store_lookup(const fido_cred_store_t *, const unsigned char *,
+    size_t, const unsigned char **, size_t *);
+int fido_cred_store_get(const fido_cred_store_t *, size_t,
+    const unsigned char **, size_t *);
+size_t fido_cred_store_len(const fido_cred_store_t *);
+int fido_cred_store_write(const char *, const fido_cred_store_t *,
+    const unsigned char *const *, const size_t *, size_t);
+
+typedef struct fido_sigcount_table fido_sigcount_table_t;
+
+fido_sigcount_table_t *fido_sigcount_table_new(void);
+void fido_sigcount_table_free(fido_sigcount_table_t **);
+
+int fido_sigcount_table_alloc(fido_sigcount_table_t *, size_t);
+int fido_sigcount_table_map(fido_sigcount_table_t *, const char *, size_t);
+int fido_sigcount_table_advance(fido_sigcount_table_t *,
+    const unsigned char *, size_t, uint32_t);
+int fido_sigcount_table_get(fido_sigcount_table_t *, const unsigned char *,
+    size_t, uint32_t *);
+
+int fido_authdata_view_set(fido_authdata_view_t *, const unsigned char *,
+    size_t);
+int fido_authdata_view_set_cbor(fido_authdata_view_t *,
+    const unsigned char *, size_t);
+
+int fido_assert_verify_with_key(const fido_assert_t *, size_t,
+    const fido_verify_key_t *);
+int fido_assert_verify_view(const fido_assert_t *,
+    const fido_authdata_view_t *, const unsigned char *, size_t,
+    const fido_verify_key_t *);
+
+fido_rp_verifier_t *fido_rp_verifier_new(void);
+void fido_rp_verifier_free(fido_rp_verifier_t **);
+
+int fido_rp_verifier_set_rp(fido_rp_verifier_t *, const char *);
+int fido_rp_verifier_set_up(fido_rp_verifier_t *, fido_opt_t);
+int fido_rp_verifier_set_uv(fido_rp_verifier_t *, fido_opt_t);
+int fido_rp_verifier_set_extensions(fido_rp_verifier_t *, int);
+int fido_rp_verifier_allow_type(fido_rp_verifier_t *, int);
+int fido_rp_verifier_precheck(const fido_rp_verifier_t *,
+    const unsigned char *, size_t, const unsigned char *, size_t, int);
+int fido_rp_verifier_verify(const fido_rp_verifier_t *,
+    const unsigned char *, size_t, const unsigned char *, size_t,
+    const unsigned char *, size_t, const fido_verify_key_t *);
+int fido_rp_verifier_set_cache(fido_rp_verifier_t *, fido_verify_cache_t *);
+
+fido_verify_cache_t *fido_verify_cache_new(void);
+void fido_verify_cache_free(fido_verify_cache_t **);
+
+int fido_verify_cache_alloc(fido_verify_cache_t *, size_t, int);
+int fido_verify_cache_map(fido_verify_cache_t *, const char *, size_t, int);
+void fido_verify_cache_stats(fido_verify_cache_t *, uint64_t *, uint64_t *);
+
+typedef struct fido_verifier fido_verifier_t;
+typedef void fido_verifier_cb_t(void *, size_t, int);
+
+fido_verifier_t *fido_verifier_new(size_t);
+void fido_verifier_free(fido_verifier_t **);
+
+int fido_verifier_set_callback(fido_verifier_t *, fido_verifier_cb_t *);
+int fido_verifier_submit_assert(fido_verifier_t *,
+    const fido_assert_verify_item_t *, size_t, void *);
+int fido_verifier_submit_cred(fido_verifier_t *, const fido_cred_t *const *,
+    size_t, void *);
+int fido_verifier_poll(fido_verifier_t *, void **, size_t *, int *, int);
+size_t fido_verifier_pending(fido_verifier_t *);
+
+typedef struct fido_trust_store fido_trust_store_t;
+
+fido_trust_store_t *fido_trust_store_new(void);
+void fido_trust_store_free(fido_trust_store_t **);
+
+int fido_trust_store_add_der(fido_trust_store_t *, const unsigned char *,
+    size_t);
+int fido_trust_store_add_pem(fido_trust_store_t *, const char *, size_t);
+int fido_cred_verify_trust(const fido_cred_t *, fido_trust_store_t *);
+
+#define FIDO_MDS_KEY_SOFTWARE		0x01
+#define FIDO_MDS_KEY_HARDWARE		0x02
+#define FIDO_MDS_KEY_TEE		0x04
+#define FIDO_MDS_KEY_SECURE_ELEMENT	0x08
+#define FIDO_MDS_KEY_REMOTE_HANDLE	0x10
+
+typedef struct fido_mds fido_mds_t;
+typedef struct fido_mds_entry fido_mds_entry_t;
+
+fido_mds_t *fido_mds_new(void);
+void fido_mds_free(fido_mds_t **);
+
+int fido_mds_load(fido_mds_t *, const char *, size_t, fido_trust_store_t *);
+int64_t fido_mds_no(fido_mds_t *);
+size_t fido_mds_len(fido_mds_t *);
+
+fido_mds_entry_t *fido_mds_lookup(fido_mds_t *, const unsigned char *,
+    size_t);
+void fido_mds_entry_free(fido_mds_entry_t **);
+
+const char *fido_mds_entry_status(const fido_mds_entry_t *);
+const char *fido_mds_entry_description(const fido_mds_entry_t *);
+int fido_mds_entry_key_protection(const fido_mds_entry_t *);
+fido_trust_store_t *fido_mds_entry_trust_store(const fido_mds_entry_t *);
+
+int fido_x5c_cache_set_size(size_t);
+void fido_x5c_cache_clear(void);
+size_t fido_x5c_cache_size(void);
+size_t fido_x5c_cache_len(void);
+uint64_t fido_x5c_cache_hits(void);
+uint64_t fido_x5c_cache_misses(void);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif /* __cplusplus */
+
+#endif /* !_FIDO_VERIFY_H */
@@ -119,15 +119,15 @@ fido_hid_get_report_len(const uint8_t *report_ptr, size_t report_len,
 fido_dev_info_t *
 fido_dev_info_new(size_t n)
 {
-	return (calloc(n, sizeof(fido_dev_info_t)));
+	return (fido_calloc(n, sizeof(fido_dev_info_t)));
 }
 
-static void
+void
 fido_dev_info_reset(fido_dev_info_t *di)
 {
-	free(di->path);
-	free(di->manufacturer);
-	free(di->product);
+	fido_free(di->path);
+	fido_free(di->manufacturer);
+	fido_free(di->product);
 	memset(di, 0, sizeof(*di));
 }
 
@@ -142,7 +142,7 @@ fido_dev_info_free(fido_dev_info_t **devlist_p, size_t n)
 	for (size_t i = 0; i < n; i++)
 		fido_dev_info_reset(&devlist[i]);
 
-	free(devlist);
+	fido_free(devlist);
 
 	*devlist_p = NULL;
 }
@@ -153,6 +153,89 @@ fido_dev_info_ptr(const fido_dev_info_t *devlist, size_t i)
 	return (&devlist[i]);
 }
 
+static const char *
+dev_info_path(const fido_dev_info_t *di)
+{
+	return (di->path != NULL ? di->path : "");
+}
+
+static int
+dev_info_cmp(const void *pa, const void *pb)
+{
+	const fido_dev_info_t *a = *(const fido_dev_info_t * const *)pa;
+	const fido_dev_info_t *b = *(const fido_dev_info_t * const *)pb;
+
+	return (strcmp(dev_info_path(a), dev_info_path(b)));
+}
+
+static bool
+dev_info_same(const fido_dev_info_t *a, const fido_dev_info_t *b)
+{
+	if (a->path == NULL || b->path == NULL ||
+	    a->manufacturer == NULL || b->manufacturer == NULL ||
+	    a->product == NULL || b->product == NULL)
+		return (false);
+
+	return (a->vendor_id == b->vendor_id &&
+	    a->product_id == b->product_id &&
+	    strcmp(a->manufacturer, b->manufacturer) == 0 &&
+	    strcmp(a->product, b->product) == 0);
+}
+
+/*
+ * Compare two device lists. On return, a_gone[i] is true if a[i] has no
+ * counterpart in b, and b_new[j] is true if b[j] has none in a. Entries
+ * match if they share a path and describe the same device; a different
+ * device behind a reused path is reported as removed and added.
+ */
+int
+fido_dev_info_diff(const fido_dev_info_t *a, size_t na,
+    const fido_dev_info_t *b, size_t nb, bool *a_gone, bool *b_new)
+{
+	const fido_dev_info_t	**sa = NULL;
+	const fido_dev_info_t	**sb = NULL;
+	size_t			  i = 0, j = 0;
+	int			  c, ok = -1;
+
+	if (na == SIZE_MAX || nb == SIZE_MAX ||
+	    (sa = fido_calloc(na + 1, sizeof(*sa))) == NULL ||
+	    (sb = fido_calloc(nb + 1, sizeof(*sb))) == NULL)
+		goto fail;
+
+	for (size_t k = 0; k < na; k++) {
+		sa[k] = &a[k];
+		a_gone[k] = true;
+	}
+	for (size_t k = 0; k < nb; k++) {
+		sb[k] = &b[k];
+		b_new[k] = true;
+	}
+	qsort(sa, na, sizeof(*sa), dev_info_cmp);
+	qsort(sb, nb, sizeof(*sb), dev_info_cmp);
+
+	while (i < na && j < nb) {
+		if ((c = dev_info_cmp(&sa[i], &sb[j])) < 0)
+			i++;
+		else if (c > 0)
+			j++;
+		else {
+			if (dev_info_same(sa[i], sb[j])) {
+				a_gone[sa[i] - a] = false;
+				b_new[sb[j] - b] = false;
+			}
+			i++;
+			j++;
+		}
+	}
+
+	ok = 0;
+fail:
+	fido_free(sa);
+	fido_free(sb);
+
+	return (ok);
+}
+
 int
 fido_dev_info_set(fido_dev_info_t *devlist, size_t i,
     const char *path, const char *manufacturer, const char *product,
@@ -167,9 +250,9 @@ fido_dev_info_set(fido_dev_info_t *devlist, size_t i,
 		goto out;
 	}
 
-	if ((path_copy = strdup(path)) == NULL ||
-	    (manu_copy = strdup(manufacturer)) == NULL ||
-	    (prod_copy = strdup(product)) == NULL) {
+	if ((path_copy = fido_strdup(path)) == NULL ||
+	    (manu_copy = fido_strdup(manufacturer)) == NULL ||
+	    (prod_copy = fido_strdup(product)) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto out;
 	}
@@ -184,9 +267,9 @@ fido_dev_info_set(fido_dev_info_t *devlist, size_t i,
 	r = FIDO_OK;
 out:
 	if (r != FIDO_OK) {
-		free(prod_copy);
-		free(manu_copy);
-		free(path_copy);
+		fido_free(prod_copy);
+		fido_free(manu_copy);
+		fido_free(path_copy);
 	}
 	return (r);
 }
@@ -6,6 +6,8 @@
  */
 
 #include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include <dev/usb/usb_ioctl.h>
 #include <dev/usb/usbhid.h>
@@ -26,6 +28,7 @@
 #endif
 
 #define MAX_UHID	64
+#define DEVD_SOCKET	"/var/run/devd.seqpacket.pipe"
 
 struct hid_freebsd {
 	int             fd;
@@ -33,6 +36,7 @@ struct hid_freebsd {
 	size_t          report_out_len;
 	sigset_t        sigmask;
 	const sigset_t *sigmaskp;
+	fido_hid_rbuf_t rbuf;
 };
 
 static bool
@@ -83,16 +87,16 @@ copy_info_hidraw(fido_dev_info_t *di, const char *path)
 	if (ioctl(fd, IOCTL_REQ(USB_GET_DEVICEINFO), &udi) == -1) {
 		if (ioctl(fd, IOCTL_REQ(HIDIOCGRAWINFO), &devinfo) == -1 ||
 		    ioctl(fd, IOCTL_REQ(HIDIOCGRAWNAME(128)), rawname) == -1 ||
-		    (di->path = strdup(path)) == NULL ||
-		    (di->manufacturer = strdup(UHID_VENDOR)) == NULL ||
-		    (di->product = strdup(rawname)) == NULL)
+		    (di->path = fido_strdup(path)) == NULL ||
+		    (di->manufacturer = fido_strdup(UHID_VENDOR)) == NULL ||
+		    (di->product = fido_strdup(rawname)) == NULL)
 			goto fail;
 		di->vendor_id = devinfo.vendor;
 		di->product_id = devinfo.product;
 	} else {
-		if ((di->path = strdup(path)) == NULL ||
-		    (di->manufacturer = strdup(udi.udi_vendor)) == NULL ||
-		    (di->product = strdup(udi.udi_product)) == NULL)
+		if ((di->path = fido_strdup(path)) == NULL ||
+		    (di->manufacturer = fido_strdup(udi.udi_vendor)) == NULL ||
+		    (di->product = fido_strdup(udi.udi_product)) == NULL)
 			goto fail;
 		di->vendor_id = (int16_t)udi.udi_vendorNo;
 		di->product_id = (int16_t)udi.udi_productNo;
@@ -104,9 +108,9 @@ fail:
 		fido_log_error(errno, "%s: close %s", __func__, path);
 
 	if (ok < 0) {
-		free(di->path);
-		free(di->manufacturer);
-		free(di->product);
+		fido_free(di->path);
+		fido_free(di->manufacturer);
+		fido_free(di->product);
 		explicit_bzero(di, sizeof(*di));
 	}
 
@@ -134,9 +138,9 @@ copy_info_uhid(fido_dev_info_t *di, const char *path)
 		udi.udi_vendorNo = 0x0b5d; /* stolen from PCI_VENDOR_OPENBSD */
 	}
 
-	if ((di->path = strdup(path)) == NULL ||
-	    (di->manufacturer = strdup(udi.udi_vendor)) == NULL ||
-	    (di->product = strdup(udi.udi_product)) == NULL)
+	if ((di->path = fido_strdup(path)) == NULL ||
+	    (di->manufacturer = fido_strdup(udi.udi_vendor)) == NULL ||
+	    (di->product = fido_strdup(udi.udi_product)) == NULL)
 		goto fail;
 	di->vendor_id = (int16_t)udi.udi_vendorNo;
 	di->product_id = (int16_t)udi.udi_productNo;
@@ -147,9 +151,9 @@ fail:
 		fido_log_error(errno, "%s: close %s", __func__, path);
 
 	if (ok < 0) {
-		free(di->path);
-		free(di->manufacturer);
-		free(di->product);
+		fido_free(di->path);
+		fido_free(di->manufacturer);
+		fido_free(di->product);
 		explicit_bzero(di, sizeof(*di));
 	}
 
@@ -215,11 +219,11 @@ fido_hid_open(const char *path)
 	memset(&buf, 0, sizeof(buf));
 	memset(&ugd, 0, sizeof(ugd));
 
-	if ((ctx = calloc(1, sizeof(*ctx))) == NULL)
+	if ((ctx = fido_calloc(1, sizeof(*ctx))) == NULL)
 		return (NULL);
 
 	if ((ctx->fd = fido_hid_unix_open(path)) == -1) {
-		free(ctx);
+		fido_free(ctx);
 		return (NULL);
 	}
 
@@ -242,6 +246,10 @@ fido_hid_open(const char *path)
 		ctx->report_out_len = CTAP_MAX_REPORT_LEN;
 	}
 
+	if (fido_hid_unix_rbuf_init(ctx->fd, &ctx->rbuf,
+	    ctx->report_in_len) < 0)
+		fido_log_debug("%s: reads not buffered", __func__);
+
 	return (ctx);
 }
 
@@ -253,7 +261,7 @@ fido_hid_close(void *handle)
 	if (close(ctx->fd) == -1)
 		fido_log_error(errno, "%s: close", __func__);
 
-	free(ctx);
+	fido_free(ctx);
 }
 
 int
@@ -268,32 +276,27 @@ fido_hid_set_sigmask(void *handle, const fido_sigset_t *sigmask)
 }
 
 int
-fido_hid_read(void *handle, unsigned char *buf, size_t len, int ms)
+fido_hid_set_wakeup(void *handle, const fido_wakeup_t *wakeup)
 {
-	struct hid_freebsd	*ctx = handle;
-	ssize_t			 r;
+	struct hid_freebsd *ctx = handle;
 
-	if (len != ctx->report_in_len) {
-		fido_log_debug("%s: len %zu", __func__, len);
-		return (-1);
-	}
+	ctx->rbuf.wakeup = fido_wakeup_fd(wakeup);
 
-	if (fido_hid_unix_wait(ctx->fd, ms, ctx->sigmaskp) < 0) {
-		fido_log_debug("%s: fd not ready", __func__);
-		return (-1);
-	}
+	return (FIDO_OK);
+}
 
-	if ((r = read(ctx->fd, buf, len)) == -1) {
-		fido_log_error(errno, "%s: read", __func__);
-		return (-1);
-	}
+int
+fido_hid_read(void *handle, unsigned char *buf, size_t len, int ms)
+{
+	struct hid_freebsd *ctx = handle;
 
-	if (r < 0 || (size_t)r != len) {
-		fido_log_debug("%s: %zd != %zu", __func__, r, len);
+	if (len != ctx->report_in_len) {
+		fido_log_debug("%s: len %zu", __func__, len);
 		return (-1);
 	}
 
-	return ((int)r);
+	return (fido_hid_unix_read(ctx->fd, &ctx->rbuf, buf, len, ms,
+	    ctx->sigmaskp));
 }
 
 int
@@ -320,6 +323,22 @@ fido_hid_write(void *handle, const unsigned char *buf, size_t len)
 	return ((int)len);
 }
 
+/* uhid(4) takes one report per write(2) */
+int
+fido_hid_writev(void *handle, const unsigned char *buf, size_t len, size_t n)
+{
+	if (len == 0 || n > INT_MAX / len) {
+		fido_log_debug("%s: len=%zu, n=%zu", __func__, len, n);
+		return (-1);
+	}
+
+	for (size_t i = 0; i < n; i++)
+		if (fido_hid_write(handle, buf + i * len, len) != (int)len)
+			return (-1);
+
+	return ((int)(len * n));
+}
+
 size_t
 fido_hid_report_in_len(void *handle)
 {
@@ -335,3 +354,92 @@ fido_hid_report_out_len(void *handle)
 
 	return (ctx->report_out_len);
 }
+
+int
+fido_hid_get_fd(void *handle)
+{
+	struct hid_freebsd *ctx = handle;
+
+	return (ctx->fd);
+}
+
+size_t
+fido_hid_pending(void *handle)
+{
+	struct hid_freebsd *ctx = handle;
+
+	return (ctx->rbuf.count);
+}
+
+struct hid_freebsd_monitor {
+	int fd; /* devd(8) event socket */
+};
+
+void *
+fido_hid_monitor_open(void)
+{
+	struct hid_freebsd_monitor	*ctx;
+	struct sockaddr_un		 sun;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	strlcpy(sun.sun_path, DEVD_SOCKET, sizeof(sun.sun_path));
+
+	if ((ctx = fido_calloc(1, sizeof(*ctx))) == NULL)
+		return (NULL);
+	if ((ctx->fd = socket(PF_LOCAL, SOCK_SEQPACKET | SOCK_CLOEXEC |
+	    SOCK_NONBLOCK, 0)) == -1) {
+		fido_log_error(errno, "%s: socket", __func__);
+		fido_free(ctx);
+		return (NULL);
+	}
+	if (connect(ctx->fd, (struct sockaddr *)&sun, sizeof(sun)) == -1) {
+		fido_log_error(errno, "%s: connect", __func__);
+		close(ctx->fd);
+		fido_free(ctx);
+		return (NULL);
+	}
+
+	return (ctx);
+}
+
+void
+fido_hid_monitor_close(void *handle)
+{
+	struct hid_freebsd_monitor *ctx = handle;
+
+	if (close(ctx->fd) == -1)
+		fido_log_error(errno, "%s: close", __func__);
+	fido_free(ctx);
+}
+
+int
+fido_hid_monitor_get_fd(void *handle)
+{
+	struct hid_freebsd_monitor *ctx = handle;
+
+	return (ctx->fd);
+}
+
+int
+fido_hid_monitor_drain(void *handle)
+{
+	struct hid_freebsd_monitor	*ctx = handle;
+	char				 buf[1024];
+	ssize_t				 n;
+	int				 changed = 0;
+
+	/* one devd(8) event per packet; see DEVFS in devd.conf(5) */
+	while ((n = recv(ctx->fd, buf, sizeof(buf) - 1, 0)) > 0) {
+		buf[n] = '\0';
+		if (strstr(buf, "cdev=uhid") != NULL ||
+		    strstr(buf, "cdev=hidraw") != NULL)
+			changed = 1;
+	}
+	if (n == 0 || (n == -1 && errno != EAGAIN && errno != EINTR)) {
+		fido_log_error(errno, "%s: recv", __func__);
+		return (-1);
+	}
+
+	return (changed);
+}
@@ -18,12 +18,35 @@
 
 #include "fido.h"
 
+#if defined(HAVE_HID_HOTPLUG) && defined(HAVE_PTHREAD)
+#include <pthread.h>
+#define MANIFEST_CACHE
+#define MANIFEST_CACHE_LEN	64	/* fido devices remembered */
+#endif
+
 struct hid_hidapi {
 	void *handle;
 	size_t report_in_len;
 	size_t report_out_len;
 };
 
+#ifdef MANIFEST_CACHE
+/*
+ * The fido devices found by the last enumeration are handed out again
+ * until hidapi reports a device arriving or leaving. hotplug_lock only
+ * guards hotplug_gen, and is never held across a call into hidapi.
+ */
+static pthread_once_t	 hotplug_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t	 hotplug_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool		 hotplug_ok;
+static uint64_t		 hotplug_gen;
+static pthread_mutex_t	 manifest_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool		 manifest_valid;
+static uint64_t		 manifest_gen;
+static size_t		 manifest_len;
+static fido_dev_info_t	 manifest_cache[MANIFEST_CACHE_LEN];
+#endif
+
 static size_t
 fido_wcslen(const wchar_t *wcs)
 {
@@ -39,14 +62,14 @@ wcs_to_cs(const wchar_t *wcs)
 	char *cs;
 	size_t i;
 
-	if (wcs == NULL || (cs = calloc(fido_wcslen(wcs) + 1, 1)) == NULL)
+	if (wcs == NULL || (cs = fido_calloc(fido_wcslen(wcs) + 1, 1)) == NULL)
 		return NULL;
 
 	for (i = 0; i < fido_wcslen(wcs); i++) {
 		if (wcs[i] >= 128) {
 			/* give up on parsing non-ASCII text */
-			free(cs);
-			return strdup("hidapi device");
+			fido_free(cs);
+			return fido_strdup("hidapi device");
 		}
 		cs[i] = (char)wcs[i];
 	}
@@ -60,26 +83,26 @@ copy_info(fido_dev_info_t *di, const struct hid_device_info *d)
 	memset(di, 0, sizeof(*di));
 
 	if (d->path != NULL)
-		di->path = strdup(d->path);
+		di->path = fido_strdup(d->path);
 	else
-		di->path = strdup("");
+		di->path = fido_strdup("");
 
 	if (d->manufacturer_string != NULL)
 		di->manufacturer = wcs_to_cs(d->manufacturer_string);
 	else
-		di->manufacturer = strdup("");
+		di->manufacturer = fido_strdup("");
 
 	if (d->product_string != NULL)
 		di->product = wcs_to_cs(d->product_string);
 	else
-		di->product = strdup("");
+		di->product = fido_strdup("");
 
 	if (di->path == NULL ||
 	    di->manufacturer == NULL ||
 	    di->product == NULL) {
-		free(di->path);
-		free(di->manufacturer);
-		free(di->product);
+		fido_free(di->path);
+		fido_free(di->manufacturer);
+		fido_free(di->product);
 		explicit_bzero(di, sizeof(*di));
 		return -1;
 	}
@@ -136,12 +159,12 @@ is_fido(const struct hid_device_info *hdi)
 	uint32_t usage_page = 0;
 	struct hidraw_report_descriptor *hrd;
 
-	if ((hrd = calloc(1, sizeof(*hrd))) == NULL ||
+	if ((hrd = fido_calloc(1, sizeof(*hrd))) == NULL ||
 	    get_report_descriptor(hdi->path, hrd) < 0 ||
 	    fido_hid_get_usage(hrd->value, hrd->size, &usage_page) < 0)
 		usage_page = 0;
 
-	free(hrd);
+	fido_free(hrd);
 
 	return usage_page == 0xf1d0;
 }
@@ -166,15 +189,19 @@ fido_hid_open(const char *path)
 {
 	struct hid_hidapi *ctx;
 
-	if ((ctx = calloc(1, sizeof(*ctx))) == NULL) {
+	if ((ctx = fido_calloc(1, sizeof(*ctx))) == NULL) {
 		return (NULL);
 	}
 
 	if ((ctx->handle = hid_open_path(path)) == NULL) {
-		free(ctx);
+		fido_free(ctx);
 		return (NULL);
 	}
 
+	/* fido_hid_read() waits only when nothing is queued */
+	if (hid_set_nonblocking(ctx->handle, 1) != 0)
+		fido_log_debug("%s: hid_set_nonblocking", __func__);
+
 	ctx->report_in_len = ctx->report_out_len = CTAP_MAX_REPORT_LEN;
 
 	return ctx;
@@ -186,7 +213,7 @@ fido_hid_close(void *handle)
 	struct hid_hidapi *ctx = handle;
 
 	hid_close(ctx->handle);
-	free(ctx);
+	fido_free(ctx);
 }
 
 int
@@ -198,16 +225,30 @@ fido_hid_set_sigmask(void *handle, const fido_sigset_t *sigmask)
 	return (FIDO_ERR_INTERNAL);
 }
 
+int
+fido_hid_set_wakeup(void *handle, const fido_wakeup_t *wakeup)
+{
+	(void)handle;
+	(void)wakeup;
+
+	return (FIDO_ERR_INTERNAL);
+}
+
 int
 fido_hid_read(void *handle, unsigned char *buf, size_t len, int ms)
 {
 	struct hid_hidapi *ctx = handle;
+	int r;
 
 	if (len != ctx->report_in_len) {
 		fido_log_debug("%s: len %zu", __func__, len);
 		return -1;
 	}
 
+	/* a report already queued is returned without a timed wait */
+	if ((r = hid_read(ctx->handle, buf, len)) != 0 || ms == 0)
+		return r;
+
 	return hid_read_timeout(ctx->handle, buf, len, ms);
 }
 
@@ -224,17 +265,29 @@ fido_hid_write(void *handle, const unsigned char *buf, size_t len)
 	return hid_write(ctx->handle, buf, len);
 }
 
+/* hid_write() takes one report at a time */
 int
-fido_hid_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
+fido_hid_writev(void *handle, const unsigned char *buf, size_t len, size_t n)
+{
+	if (len == 0 || n > INT_MAX / len) {
+		fido_log_debug("%s: len=%zu, n=%zu", __func__, len, n);
+		return (-1);
+	}
+
+	for (size_t i = 0; i < n; i++)
+		if (fido_hid_write(handle, buf + i * len, len) != (int)len)
+			return (-1);
+
+	return ((int)(len * n));
+}
+
+static int
+manifest_enum(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
 {
 	struct hid_device_info *hdi;
 
 	*olen = 0;
 
-	if (ilen == 0)
-		return FIDO_OK; /* nothing to do */
-	if (devlist == NULL)
-		return FIDO_ERR_INVALID_ARGUMENT;
 	if ((hdi = hid_enumerate(0, 0)) == NULL)
 		return FIDO_OK; /* nothing to do */
 
@@ -252,6 +305,131 @@ fido_hid_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
 	return FIDO_OK;
 }
 
+#ifdef MANIFEST_CACHE
+static int HID_API_CALL
+hotplug_cb(hid_hotplug_callback_handle cb, struct hid_device_info *d,
+    hid_hotplug_event event, void *arg)
+{
+	(void)cb;
+	(void)d;
+	(void)event;
+	(void)arg;
+
+	pthread_mutex_lock(&hotplug_lock);
+	hotplug_gen++;
+	pthread_mutex_unlock(&hotplug_lock);
+
+	return (0); /* stay registered */
+}
+
+static void
+hotplug_init(void)
+{
+	hid_hotplug_callback_handle cb;
+
+	if (hid_hotplug_register_callback(0, 0,
+	    HID_API_HOTPLUG_EVENT_DEVICE_ARRIVED |
+	    HID_API_HOTPLUG_EVENT_DEVICE_LEFT, 0, hotplug_cb, NULL,
+	    &cb) != 0) {
+		fido_log_debug("%s: hid_hotplug_register_callback", __func__);
+		return;
+	}
+
+	hotplug_ok = true; /* kept for the life of the process */
+}
+
+static uint64_t
+hotplug_get_gen(void)
+{
+	uint64_t gen;
+
+	pthread_mutex_lock(&hotplug_lock);
+	gen = hotplug_gen;
+	pthread_mutex_unlock(&hotplug_lock);
+
+	return (gen);
+}
+
+static void
+manifest_reset(void)
+{
+	for (size_t i = 0; i < manifest_len; i++)
+		fido_dev_info_reset(&manifest_cache[i]);
+
+	manifest_len = 0;
+	manifest_valid = false;
+}
+
+int
+fido_hid_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
+{
+	fido_dev_info_t *di;
+	int r = FIDO_ERR_INTERNAL;
+
+	*olen = 0;
+
+	if (ilen == 0)
+		return (FIDO_OK); /* nothing to do */
+	if (devlist == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	if (pthread_once(&hotplug_once, hotplug_init) != 0 || !hotplug_ok)
+		return (manifest_enum(devlist, ilen, olen));
+
+	pthread_mutex_lock(&manifest_lock);
+
+	if (manifest_valid == false || hotplug_get_gen() != manifest_gen) {
+		manifest_reset();
+		/* read before enumerating; a later event invalidates */
+		manifest_gen = hotplug_get_gen();
+		if ((r = manifest_enum(manifest_cache, nitems(manifest_cache),
+		    &manifest_len)) != FIDO_OK) {
+			fido_log_debug("%s: manifest_enum", __func__);
+			manifest_reset();
+			goto fail;
+		}
+		if (manifest_len == nitems(manifest_cache)) {
+			/* possibly truncated */
+			manifest_reset();
+			pthread_mutex_unlock(&manifest_lock);
+			return (manifest_enum(devlist, ilen, olen));
+		}
+		manifest_valid = true;
+	}
+
+	for (size_t i = 0; i < manifest_len && *olen < ilen; i++) {
+		di = &manifest_cache[i];
+		if ((r = fido_dev_info_set(devlist, *olen, di->path,
+		    di->manufacturer, di->product, &di->io, NULL)) != FIDO_OK) {
+			fido_log_debug("%s: fido_dev_info_set", __func__);
+			goto fail;
+		}
+		devlist[*olen].vendor_id = di->vendor_id;
+		devlist[*olen].product_id = di->product_id;
+		(*olen)++;
+	}
+
+	r = FIDO_OK;
+fail:
+	pthread_mutex_unlock(&manifest_lock);
+
+	return (r);
+}
+#else
+int
+fido_hid_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
+{
+	*olen = 0;
+
+	if (ilen == 0)
+		return FIDO_OK; /* nothing to do */
+	if (devlist == NULL)
+		return FIDO_ERR_INVALID_ARGUMENT;
+
+	return manifest_enum(devlist, ilen, olen);
+}
+#endif
+
 size_t
 fido_hid_report_in_len(void *handle)
 {
@@ -267,3 +445,48 @@ fido_hid_report_out_len(void *handle)
 
 	return (ctx->report_out_len);
 }
+
+int
+fido_hid_get_fd(void *handle)
+{
+	(void)handle;
+
+	return (-1); /* hidapi does not expose its descriptor */
+}
+
+size_t
+fido_hid_pending(void *handle)
+{
+	(void)handle;
+
+	return (0);
+}
+
+/* no descriptor to poll for hotplug events; fido_dev_monitor_read() rescans */
+void *
+fido_hid_monitor_open(void)
+{
+	return (NULL);
+}
+
+void
+fido_hid_monitor_close(void *handle)
+{
+	(void)handle;
+}
+
+int
+fido_hid_monitor_get_fd(void *handle)
+{
+	(void)handle;
+
+	return (-1);
+}
+
+int
+fido_hid_monitor_drain(void *handle)
+{
+	(void)handle;
+
+	return (1);
+}
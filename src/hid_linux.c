@@ -8,16 +8,27 @@
 #include <sys/types.h>
 #include <sys/file.h>
 #include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 
 #include <linux/hidraw.h>
 #include <linux/input.h>
 
 #include <errno.h>
+#include <fcntl.h>
 #include <libudev.h>
+#include <poll.h>
 #include <time.h>
 #include <unistd.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include "fido.h"
+#include "dl.h"
+
+#define RDESC_CACHE_LEN	256 /* hidraw nodes whose type is remembered */
 
 struct hid_linux {
 	int             fd;
@@ -25,6 +36,8 @@ struct hid_linux {
 	size_t          report_out_len;
 	sigset_t        sigmask;
 	const sigset_t *sigmaskp;
+	fido_hid_rbuf_t rbuf;
+	char           *awake; /* usb device held out of autosuspend, if any */
 };
 
 static int
@@ -52,27 +65,246 @@ get_report_descriptor(int fd, struct hidraw_report_descriptor *hrd)
 	return (0);
 }
 
-static bool
+/* 1 if the node at path is a fido device, 0 if not, -1 if unknown */
+static int
 is_fido(const char *path)
 {
 	int				 fd = -1;
+	int				 ok = -1;
 	uint32_t			 usage_page = 0;
 	struct hidraw_report_descriptor	*hrd = NULL;
 
-	if ((hrd = calloc(1, sizeof(*hrd))) == NULL ||
+	if ((hrd = fido_calloc(1, sizeof(*hrd))) == NULL ||
 	    (fd = fido_hid_unix_open(path)) == -1)
 		goto out;
 	if (get_report_descriptor(fd, hrd) < 0 ||
 	    fido_hid_get_usage(hrd->value, hrd->size, &usage_page) < 0)
 		usage_page = 0;
 
+	ok = usage_page == 0xf1d0;
 out:
-	free(hrd);
+	fido_free(hrd);
 
 	if (fd != -1 && close(fd) == -1)
 		fido_log_error(errno, "%s: close", __func__);
 
-	return (usage_page == 0xf1d0);
+	return (ok);
+}
+
+/*
+ * Remember whether a hidraw node is a fido device, so that enumeration
+ * need not open every hid device on every call. Entries are keyed by
+ * syspath and device number, and are dropped when udev reports an event
+ * for the node or when the node is no longer enumerated. Without a udev
+ * monitor, nothing is cached.
+ */
+struct rdesc_entry {
+	char		*syspath; /* udev syspath of the hidraw node */
+	dev_t		 devnum;  /* device number of the node */
+	bool		 fido;    /* fido usage page */
+	uint64_t	 gen;     /* last enumeration the node was seen in */
+};
+
+static struct rdesc_cache {
+	struct udev		*udev;
+	struct udev_monitor	*mon;    /* hidraw events */
+	bool			 broken; /* no monitor; caching disabled */
+	uint64_t		 gen;    /* enumeration counter */
+	size_t			 len;    /* entries in use */
+	struct rdesc_entry	 entry[RDESC_CACHE_LEN];
+} rdesc_cache;
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t rdesc_lock = PTHREAD_MUTEX_INITIALIZER;
+#define RDESC_LOCK()	pthread_mutex_lock(&rdesc_lock)
+#define RDESC_UNLOCK()	pthread_mutex_unlock(&rdesc_lock)
+#else
+#define RDESC_LOCK()	do { } while (0)
+#define RDESC_UNLOCK()	do { } while (0)
+#endif
+
+static bool keep_awake; /* see fido_hid_set_keep_awake(); under rdesc_lock */
+
+/* caller must hold rdesc_lock */
+static void
+rdesc_cache_remove(size_t i)
+{
+	fido_free(rdesc_cache.entry[i].syspath);
+	rdesc_cache.entry[i] = rdesc_cache.entry[--rdesc_cache.len];
+	memset(&rdesc_cache.entry[rdesc_cache.len], 0,
+	    sizeof(rdesc_cache.entry[rdesc_cache.len]));
+}
+
+/* caller must hold rdesc_lock */
+static void
+rdesc_cache_drop(const char *syspath)
+{
+	for (size_t i = 0; i < rdesc_cache.len; i++)
+		if (strcmp(rdesc_cache.entry[i].syspath, syspath) == 0) {
+			rdesc_cache_remove(i);
+			return;
+		}
+}
+
+static int
+hidraw_monitor_new(struct udev **udev_p, struct udev_monitor **mon_p)
+{
+	struct udev_monitor	*mon = NULL;
+	struct udev		*udev = NULL;
+
+	if ((udev = udev_new()) == NULL ||
+	    (mon = udev_monitor_new_from_netlink(udev, "udev")) == NULL ||
+	    udev_monitor_filter_add_match_subsystem_devtype(mon, "hidraw",
+	    NULL) < 0 || udev_monitor_enable_receiving(mon) < 0) {
+		fido_log_debug("%s: udev monitor", __func__);
+		if (mon != NULL)
+			udev_monitor_unref(mon);
+		if (udev != NULL)
+			udev_unref(udev);
+		return (-1);
+	}
+
+	*udev_p = udev;
+	*mon_p = mon;
+
+	return (0);
+}
+
+/*
+ * Consume the events queued on mon without blocking, passing the syspath
+ * of each to cb (if not NULL). Returns the number of events consumed.
+ */
+static size_t
+hidraw_monitor_drain(struct udev_monitor *mon, void (*cb)(const char *))
+{
+	struct udev_device	*dev;
+	struct pollfd		 pfd;
+	const char		*syspath;
+	size_t			 n = 0;
+
+	memset(&pfd, 0, sizeof(pfd));
+	pfd.fd = udev_monitor_get_fd(mon);
+	pfd.events = POLLIN;
+
+	while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN) &&
+	    (dev = udev_monitor_receive_device(mon)) != NULL) {
+		if ((syspath = udev_device_get_syspath(dev)) != NULL) {
+			fido_log_debug("%s: event %s", __func__, syspath);
+			if (cb != NULL)
+				cb(syspath);
+		}
+		udev_device_unref(dev);
+		n++;
+	}
+
+	return (n);
+}
+
+/*
+ * Start an enumeration: apply pending udev events and bump the
+ * generation. Returns false if caching is unavailable.
+ */
+static bool
+rdesc_cache_begin(void)
+{
+	bool ok = false;
+
+	RDESC_LOCK();
+	if (rdesc_cache.broken)
+		goto out;
+	if (rdesc_cache.mon == NULL && hidraw_monitor_new(&rdesc_cache.udev,
+	    &rdesc_cache.mon) < 0) {
+		rdesc_cache.broken = true;
+		goto out;
+	}
+
+	hidraw_monitor_drain(rdesc_cache.mon, rdesc_cache_drop);
+	rdesc_cache.gen++;
+	ok = true;
+out:
+	RDESC_UNLOCK();
+
+	return (ok);
+}
+
+/* forget nodes that were not seen by a complete enumeration */
+static void
+rdesc_cache_end(void)
+{
+	size_t i = 0;
+
+	RDESC_LOCK();
+	while (i < rdesc_cache.len) {
+		if (rdesc_cache.entry[i].gen != rdesc_cache.gen)
+			rdesc_cache_remove(i);
+		else
+			i++;
+	}
+	RDESC_UNLOCK();
+}
+
+static int
+rdesc_cache_lookup(const char *syspath, dev_t devnum)
+{
+	struct rdesc_entry	*e;
+	int			 fido = -1;
+
+	RDESC_LOCK();
+	for (size_t i = 0; i < rdesc_cache.len; i++) {
+		e = &rdesc_cache.entry[i];
+		if (e->devnum == devnum && strcmp(e->syspath, syspath) == 0) {
+			e->gen = rdesc_cache.gen;
+			fido = e->fido;
+			break;
+		}
+	}
+	RDESC_UNLOCK();
+
+	return (fido);
+}
+
+static void
+rdesc_cache_insert(const char *syspath, dev_t devnum, bool fido)
+{
+	struct rdesc_entry	*e;
+	char			*s;
+
+	if ((s = fido_strdup(syspath)) == NULL)
+		return;
+
+	RDESC_LOCK();
+	rdesc_cache_drop(syspath);
+	if (rdesc_cache.len == nitems(rdesc_cache.entry)) {
+		RDESC_UNLOCK();
+		fido_free(s);
+		return;
+	}
+	e = &rdesc_cache.entry[rdesc_cache.len++];
+	e->syspath = s;
+	e->devnum = devnum;
+	e->fido = fido;
+	e->gen = rdesc_cache.gen;
+	RDESC_UNLOCK();
+}
+
+static bool
+is_fido_cached(struct udev_device *dev, const char *path, bool cache)
+{
+	const char	*syspath = NULL;
+	dev_t		 devnum = 0;
+	int		 fido;
+
+	if (cache && (syspath = udev_device_get_syspath(dev)) != NULL &&
+	    (devnum = udev_device_get_devnum(dev)) != 0 &&
+	    (fido = rdesc_cache_lookup(syspath, devnum)) != -1)
+		return (fido);
+
+	if ((fido = is_fido(path)) == -1)
+		return (false); /* could not tell; try again next time */
+	if (cache && syspath != NULL && devnum != 0)
+		rdesc_cache_insert(syspath, devnum, fido);
+
+	return (fido);
 }
 
 static int
@@ -87,7 +319,7 @@ parse_uevent(const char *uevent, int *bus, int16_t *vendor_id,
 	short unsigned int	 y;
 	short unsigned int	 z;
 
-	if ((s = cp = strdup(uevent)) == NULL)
+	if ((s = cp = fido_strdup(uevent)) == NULL)
 		return (-1);
 
 	while ((p = strsep(&cp, "\n")) != NULL && *p != '\0') {
@@ -102,7 +334,7 @@ parse_uevent(const char *uevent, int *bus, int16_t *vendor_id,
 		}
 	}
 
-	free(s);
+	fido_free(s);
 
 	return (ok);
 }
@@ -119,7 +351,7 @@ get_parent_attr(struct udev_device *dev, const char *subsystem,
 	    udev_device_get_sysattr_value(parent, attr)) == NULL)
 		return (NULL);
 
-	return (strdup(value));
+	return (fido_strdup(value));
 }
 
 static char *
@@ -130,7 +362,7 @@ get_usb_attr(struct udev_device *dev, const char *attr)
 
 static int
 copy_info(fido_dev_info_t *di, struct udev *udev,
-    struct udev_list_entry *udev_entry)
+    struct udev_list_entry *udev_entry, bool cache)
 {
 	const char		*name;
 	const char		*path;
@@ -144,7 +376,7 @@ copy_info(fido_dev_info_t *di, struct udev *udev,
 	if ((name = udev_list_entry_get_name(udev_entry)) == NULL ||
 	    (dev = udev_device_new_from_syspath(udev, name)) == NULL ||
 	    (path = udev_device_get_devnode(dev)) == NULL ||
-	    is_fido(path) == 0)
+	    is_fido_cached(dev, path, cache) == false)
 		goto fail;
 
 	if ((uevent = get_parent_attr(dev, "hid", NULL, "uevent")) == NULL ||
@@ -160,11 +392,11 @@ copy_info(fido_dev_info_t *di, struct udev *udev,
 	}
 #endif
 
-	di->path = strdup(path);
+	di->path = fido_strdup(path);
 	if ((di->manufacturer = get_usb_attr(dev, "manufacturer")) == NULL)
-		di->manufacturer = strdup("");
+		di->manufacturer = fido_strdup("");
 	if ((di->product = get_usb_attr(dev, "product")) == NULL)
-		di->product = strdup("");
+		di->product = fido_strdup("");
 	if (di->path == NULL || di->manufacturer == NULL || di->product == NULL)
 		goto fail;
 
@@ -173,12 +405,12 @@ fail:
 	if (dev != NULL)
 		udev_device_unref(dev);
 
-	free(uevent);
+	fido_free(uevent);
 
 	if (ok < 0) {
-		free(di->path);
-		free(di->manufacturer);
-		free(di->product);
+		fido_free(di->path);
+		fido_free(di->manufacturer);
+		fido_free(di->product);
 		explicit_bzero(di, sizeof(*di));
 	}
 
@@ -192,6 +424,8 @@ fido_hid_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
 	struct udev_enumerate	*udev_enum = NULL;
 	struct udev_list_entry	*udev_list;
 	struct udev_list_entry	*udev_entry;
+	bool			 cache = false;
+	bool			 complete = true;
 	int			 r = FIDO_ERR_INTERNAL;
 
 	*olen = 0;
@@ -210,26 +444,34 @@ fido_hid_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
 	    udev_enumerate_scan_devices(udev_enum) < 0)
 		goto fail;
 
+#ifndef FIDO_FUZZ
+	cache = rdesc_cache_begin();
+#endif
+
 	if ((udev_list = udev_enumerate_get_list_entry(udev_enum)) == NULL) {
 		r = FIDO_OK; /* zero hidraw devices */
 		goto fail;
 	}
 
 	udev_list_entry_foreach(udev_entry, udev_list) {
-		if (copy_info(&devlist[*olen], udev, udev_entry) == 0) {
+		if (copy_info(&devlist[*olen], udev, udev_entry, cache) == 0) {
 			devlist[*olen].io = (fido_dev_io_t) {
 				fido_hid_open,
 				fido_hid_close,
 				fido_hid_read,
 				fido_hid_write,
 			};
-			if (++(*olen) == ilen)
+			if (++(*olen) == ilen) {
+				complete = false;
 				break;
+			}
 		}
 	}
 
 	r = FIDO_OK;
 fail:
+	if (cache && complete)
+		rdesc_cache_end();
 	if (udev_enum != NULL)
 		udev_enumerate_unref(udev_enum);
 	if (udev != NULL)
@@ -238,6 +480,144 @@ fail:
 	return (r);
 }
 
+struct hid_linux_monitor {
+	struct udev		*udev;
+	struct udev_monitor	*mon;
+};
+
+void *
+fido_hid_monitor_open(void)
+{
+	struct hid_linux_monitor *ctx;
+
+	if ((ctx = fido_calloc(1, sizeof(*ctx))) == NULL)
+		return (NULL);
+	if (hidraw_monitor_new(&ctx->udev, &ctx->mon) < 0) {
+		fido_free(ctx);
+		return (NULL);
+	}
+
+	return (ctx);
+}
+
+void
+fido_hid_monitor_close(void *handle)
+{
+	struct hid_linux_monitor *ctx = handle;
+
+	udev_monitor_unref(ctx->mon);
+	udev_unref(ctx->udev);
+	fido_free(ctx);
+}
+
+int
+fido_hid_monitor_get_fd(void *handle)
+{
+	struct hid_linux_monitor *ctx = handle;
+
+	return (udev_monitor_get_fd(ctx->mon));
+}
+
+int
+fido_hid_monitor_drain(void *handle)
+{
+	struct hid_linux_monitor *ctx = handle;
+
+	return (hidraw_monitor_drain(ctx->mon, NULL) > 0);
+}
+
+int
+fido_hid_set_keep_awake(bool keep)
+{
+	RDESC_LOCK();
+	keep_awake = keep;
+	RDESC_UNLOCK();
+
+	return (FIDO_OK);
+}
+
+/* set a usb device's power/control attribute */
+static int
+usb_set_power_control(struct udev_device *usb, const char *value)
+{
+	char	buf[8];
+	size_t	len;
+	int	r;
+
+	/* older libudev takes a non-const value */
+	if ((len = strlen(value)) >= sizeof(buf))
+		return (-1);
+	memcpy(buf, value, len + 1);
+	if ((r = udev_device_set_sysattr_value(usb, "power/control",
+	    buf)) < 0) {
+		fido_log_error(-r, "%s: %s", __func__, value);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Keep the usb device behind the hidraw node fd from being runtime
+ * suspended, so that the first report after an idle period does not
+ * wait for it to resume. Returns the syspath of the device if its
+ * power/control attribute was changed, to be restored on close. Writing
+ * the attribute usually takes privileges; failure is not fatal.
+ */
+static char *
+usb_hold_awake(int fd)
+{
+	struct udev		*udev = NULL;
+	struct udev_device	*dev = NULL;
+	struct udev_device	*usb;
+	struct stat		 st;
+	const char		*control;
+	char			*syspath = NULL;
+
+	if (fstat(fd, &st) == -1) {
+		fido_log_error(errno, "%s: fstat", __func__);
+		goto out;
+	}
+	if ((udev = udev_new()) == NULL ||
+	    (dev = udev_device_new_from_devnum(udev, 'c', st.st_rdev)) == NULL ||
+	    (usb = udev_device_get_parent_with_subsystem_devtype(dev, "usb",
+	    "usb_device")) == NULL ||
+	    (control = udev_device_get_sysattr_value(usb,
+	    "power/control")) == NULL) {
+		fido_log_debug("%s: no usb power control", __func__);
+		goto out;
+	}
+	if (strcmp(control, "auto") != 0) {
+		fido_log_debug("%s: power/control=%s", __func__, control);
+		goto out;
+	}
+	if (usb_set_power_control(usb, "on") == 0 &&
+	    (syspath = fido_strdup(udev_device_get_syspath(usb))) == NULL)
+		usb_set_power_control(usb, "auto");
+out:
+	if (dev != NULL)
+		udev_device_unref(dev);
+	if (udev != NULL)
+		udev_unref(udev);
+
+	return (syspath);
+}
+
+static void
+usb_release_awake(const char *syspath)
+{
+	struct udev		*udev;
+	struct udev_device	*usb;
+
+	if ((udev = udev_new()) == NULL)
+		return;
+	if ((usb = udev_device_new_from_syspath(udev, syspath)) != NULL) {
+		usb_set_power_control(usb, "auto");
+		udev_device_unref(usb);
+	}
+	udev_unref(udev);
+}
+
 void *
 fido_hid_open(const char *path)
 {
@@ -245,14 +625,14 @@ fido_hid_open(const char *path)
 	struct hidraw_report_descriptor *hrd;
 	struct timespec tv_pause;
 	long interval_ms, retries = 0;
-	bool looped;
+	bool looped, awake;
 
 retry:
 	looped = false;
 
-	if ((ctx = calloc(1, sizeof(*ctx))) == NULL ||
+	if ((ctx = fido_calloc(1, sizeof(*ctx))) == NULL ||
 	    (ctx->fd = fido_hid_unix_open(path)) == -1) {
-		free(ctx);
+		fido_free(ctx);
 		return (NULL);
 	}
 
@@ -284,7 +664,7 @@ retry:
 		goto retry;
 	}
 
-	if ((hrd = calloc(1, sizeof(*hrd))) == NULL ||
+	if ((hrd = fido_calloc(1, sizeof(*hrd))) == NULL ||
 	    get_report_descriptor(ctx->fd, hrd) < 0 ||
 	    fido_hid_get_report_len(hrd->value, hrd->size, &ctx->report_in_len,
 	    &ctx->report_out_len) < 0 || ctx->report_in_len == 0 ||
@@ -294,7 +674,17 @@ retry:
 		ctx->report_out_len = CTAP_MAX_REPORT_LEN;
 	}
 
-	free(hrd);
+	fido_free(hrd);
+
+	if (fido_hid_unix_rbuf_init(ctx->fd, &ctx->rbuf,
+	    ctx->report_in_len) < 0)
+		fido_log_debug("%s: reads not buffered", __func__);
+
+	RDESC_LOCK();
+	awake = keep_awake;
+	RDESC_UNLOCK();
+	if (awake)
+		ctx->awake = usb_hold_awake(ctx->fd);
 
 	return (ctx);
 }
@@ -306,8 +696,12 @@ fido_hid_close(void *handle)
 
 	if (close(ctx->fd) == -1)
 		fido_log_error(errno, "%s: close", __func__);
+	if (ctx->awake != NULL) {
+		usb_release_awake(ctx->awake);
+		fido_free(ctx->awake);
+	}
 
-	free(ctx);
+	fido_freezero(ctx, sizeof(*ctx));
 }
 
 int
@@ -322,32 +716,27 @@ fido_hid_set_sigmask(void *handle, const fido_sigset_t *sigmask)
 }
 
 int
-fido_hid_read(void *handle, unsigned char *buf, size_t len, int ms)
+fido_hid_set_wakeup(void *handle, const fido_wakeup_t *wakeup)
 {
-	struct hid_linux	*ctx = handle;
-	ssize_t			 r;
+	struct hid_linux *ctx = handle;
 
-	if (len != ctx->report_in_len) {
-		fido_log_debug("%s: len %zu", __func__, len);
-		return (-1);
-	}
+	ctx->rbuf.wakeup = fido_wakeup_fd(wakeup);
 
-	if (fido_hid_unix_wait(ctx->fd, ms, ctx->sigmaskp) < 0) {
-		fido_log_debug("%s: fd not ready", __func__);
-		return (-1);
-	}
+	return (FIDO_OK);
+}
 
-	if ((r = read(ctx->fd, buf, len)) == -1) {
-		fido_log_error(errno, "%s: read", __func__);
-		return (-1);
-	}
+int
+fido_hid_read(void *handle, unsigned char *buf, size_t len, int ms)
+{
+	struct hid_linux *ctx = handle;
 
-	if (r < 0 || (size_t)r != len) {
-		fido_log_debug("%s: %zd != %zu", __func__, r, len);
+	if (len != ctx->report_in_len) {
+		fido_log_debug("%s: len %zu", __func__, len);
 		return (-1);
 	}
 
-	return ((int)r);
+	return (fido_hid_unix_read(ctx->fd, &ctx->rbuf, buf, len, ms,
+	    ctx->sigmaskp));
 }
 
 int
@@ -374,6 +763,40 @@ fido_hid_write(void *handle, const unsigned char *buf, size_t len)
 	return ((int)r);
 }
 
+/* hidraw(4) treats each iovec as a separate output report */
+int
+fido_hid_writev(void *handle, const unsigned char *buf, size_t len, size_t n)
+{
+	struct hid_linux	*ctx = handle;
+	struct iovec		 iov[32];
+	size_t			 i, k, total = 0;
+	ssize_t			 r;
+
+	if (len != ctx->report_out_len + 1 || n > INT_MAX / len) {
+		fido_log_debug("%s: len=%zu, n=%zu", __func__, len, n);
+		return (-1);
+	}
+
+	for (i = 0; i < n; i += k) {
+		for (k = 0; k < nitems(iov) && i + k < n; k++) {
+			iov[k].iov_base = (void *)(uintptr_t)(buf + total +
+			    k * len);
+			iov[k].iov_len = len;
+		}
+		if ((r = writev(ctx->fd, iov, (int)k)) == -1) {
+			fido_log_error(errno, "%s: writev", __func__);
+			return (-1);
+		}
+		if (r < 0 || (size_t)r != k * len) {
+			fido_log_debug("%s: %zd != %zu", __func__, r, k * len);
+			return (-1);
+		}
+		total += (size_t)r;
+	}
+
+	return ((int)total);
+}
+
 size_t
 fido_hid_report_in_len(void *handle)
 {
@@ -389,3 +812,19 @@ fido_hid_report_out_len(void *handle)
 
 	return (ctx->report_out_len);
 }
+
+int
+fido_hid_get_fd(void *handle)
+{
+	struct hid_linux *ctx = handle;
+
+	return (ctx->fd);
+}
+
+size_t
+fido_hid_pending(void *handle)
+{
+	struct hid_linux *ctx = handle;
+
+	return (ctx->rbuf.count);
+}
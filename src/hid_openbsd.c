@@ -26,6 +26,7 @@ struct hid_openbsd {
 	size_t report_out_len;
 	sigset_t sigmask;
 	const sigset_t *sigmaskp;
+	fido_hid_rbuf_t rbuf;
 };
 
 static int
@@ -52,9 +53,9 @@ copy_info(fido_dev_info_t *di, const char *path)
 	    "releaseNo = 0x%04x", __func__, path, udi.udi_productNo,
 	    udi.udi_vendorNo, udi.udi_releaseNo);
 
-	if ((di->path = strdup(path)) == NULL ||
-	    (di->manufacturer = strdup(udi.udi_vendor)) == NULL ||
-	    (di->product = strdup(udi.udi_product)) == NULL)
+	if ((di->path = fido_strdup(path)) == NULL ||
+	    (di->manufacturer = fido_strdup(udi.udi_vendor)) == NULL ||
+	    (di->product = fido_strdup(udi.udi_product)) == NULL)
 		goto fail;
 
 	di->vendor_id = (int16_t)udi.udi_vendorNo;
@@ -66,9 +67,9 @@ fail:
 		fido_log_error(errno, "%s: close %s", __func__, path);
 
 	if (ok < 0) {
-		free(di->path);
-		free(di->manufacturer);
-		free(di->product);
+		fido_free(di->path);
+		fido_free(di->manufacturer);
+		fido_free(di->product);
 		explicit_bzero(di, sizeof(*di));
 	}
 
@@ -164,9 +165,9 @@ fido_hid_open(const char *path)
 {
 	struct hid_openbsd *ret = NULL;
 
-	if ((ret = calloc(1, sizeof(*ret))) == NULL ||
+	if ((ret = fido_calloc(1, sizeof(*ret))) == NULL ||
 	    (ret->fd = fido_hid_unix_open(path)) == -1) {
-		free(ret);
+		fido_free(ret);
 		return (NULL);
 	}
 	ret->report_in_len = ret->report_out_len = CTAP_MAX_REPORT_LEN;
@@ -183,6 +184,11 @@ fido_hid_open(const char *path)
 		return NULL;
 	}
 
+	/* after the kludge, whose replies are not to be kept */
+	if (fido_hid_unix_rbuf_init(ret->fd, &ret->rbuf,
+	    ret->report_in_len) < 0)
+		fido_log_debug("%s: reads not buffered", __func__);
+
 	return (ret);
 }
 
@@ -194,7 +200,7 @@ fido_hid_close(void *handle)
 	if (close(ctx->fd) == -1)
 		fido_log_error(errno, "%s: close", __func__);
 
-	free(ctx);
+	fido_free(ctx);
 }
 
 int
@@ -208,11 +214,20 @@ fido_hid_set_sigmask(void *handle, const fido_sigset_t *sigmask)
 	return (FIDO_OK);
 }
 
+int
+fido_hid_set_wakeup(void *handle, const fido_wakeup_t *wakeup)
+{
+	struct hid_openbsd *ctx = handle;
+
+	ctx->rbuf.wakeup = fido_wakeup_fd(wakeup);
+
+	return (FIDO_OK);
+}
+
 int
 fido_hid_read(void *handle, unsigned char *buf, size_t len, int ms)
 {
 	struct hid_openbsd *ctx = (struct hid_openbsd *)handle;
-	ssize_t r;
 
 	if (len != ctx->report_in_len) {
 		fido_log_debug("%s: invalid len: got %zu, want %zu", __func__,
@@ -220,22 +235,8 @@ fido_hid_read(void *handle, unsigned char *buf, size_t len, int ms)
 		return (-1);
 	}
 
-	if (fido_hid_unix_wait(ctx->fd, ms, ctx->sigmaskp) < 0) {
-		fido_log_debug("%s: fd not ready", __func__);
-		return (-1);
-	}
-
-	if ((r = read(ctx->fd, buf, len)) == -1) {
-		fido_log_error(errno, "%s: read", __func__);
-		return (-1);
-	}
-
-	if (r < 0 || (size_t)r != len) {
-		fido_log_debug("%s: %zd != %zu", __func__, r, len);
-		return (-1);
-	}
-
-	return ((int)len);
+	return (fido_hid_unix_read(ctx->fd, &ctx->rbuf, buf, len, ms,
+	    ctx->sigmaskp));
 }
 
 int
@@ -263,6 +264,22 @@ fido_hid_write(void *handle, const unsigned char *buf, size_t len)
 	return ((int)len);
 }
 
+/* uhid(4) takes one report per write(2) */
+int
+fido_hid_writev(void *handle, const unsigned char *buf, size_t len, size_t n)
+{
+	if (len == 0 || n > INT_MAX / len) {
+		fido_log_debug("%s: len=%zu, n=%zu", __func__, len, n);
+		return (-1);
+	}
+
+	for (size_t i = 0; i < n; i++)
+		if (fido_hid_write(handle, buf + i * len, len) != (int)len)
+			return (-1);
+
+	return ((int)(len * n));
+}
+
 size_t
 fido_hid_report_in_len(void *handle)
 {
@@ -278,3 +295,48 @@ fido_hid_report_out_len(void *handle)
 
 	return (ctx->report_out_len);
 }
+
+int
+fido_hid_get_fd(void *handle)
+{
+	struct hid_openbsd *ctx = handle;
+
+	return (ctx->fd);
+}
+
+size_t
+fido_hid_pending(void *handle)
+{
+	struct hid_openbsd *ctx = handle;
+
+	return (ctx->rbuf.count);
+}
+
+/* no hotplug notifications; fido_dev_monitor_read() rescans */
+void *
+fido_hid_monitor_open(void)
+{
+	return (NULL);
+}
+
+void
+fido_hid_monitor_close(void *handle)
+{
+	(void)handle;
+}
+
+int
+fido_hid_monitor_get_fd(void *handle)
+{
+	(void)handle;
+
+	return (-1);
+}
+
+int
+fido_hid_monitor_drain(void *handle)
+{
+	(void)handle;
+
+	return (1);
+}
@@ -9,6 +9,8 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <signal.h>
 #include <unistd.h>
 
@@ -26,15 +28,40 @@
 
 #define IOREG "ioreg://"
 
+/*
+ * Devices are scheduled on a single run loop, run for the life of the
+ * process by a thread of its own. report_callback() queues each input
+ * report on the device's pipe, which fido_hid_read() polls and
+ * fido_hid_get_fd() hands out; a removed device's pipe reads as EOF.
+ * Devices are scheduled and unscheduled on the loop's thread, through
+ * hid_loop_call(), so that no callback runs on a closing device.
+ */
 struct hid_osx {
 	IOHIDDeviceRef	ref;
-	CFStringRef	loop_id;
 	int		report_pipe[2];
 	size_t		report_in_len;
 	size_t		report_out_len;
-	unsigned char	report[CTAP_MAX_REPORT_LEN];
+	unsigned char	report[CTAP_MAX_REPORT_LEN]; /* owned by the loop */
 };
 
+struct hid_loop_call {
+	void	(*fn)(struct hid_osx *);
+	struct hid_osx *ctx;
+	bool	  done;
+};
+
+static pthread_once_t		 hid_loop_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t		 hid_loop_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t		 hid_loop_cond = PTHREAD_COND_INITIALIZER;
+static CFRunLoopRef		 hid_loop;      /* NULL if not started */
+static CFRunLoopSourceRef	 hid_loop_src;  /* runs hid_loop_pending */
+static struct hid_loop_call	*hid_loop_pending;
+static bool			 hid_loop_ready;
+
+/* enumeration reuses one manager, under manager_lock */
+static pthread_mutex_t		 manager_lock = PTHREAD_MUTEX_INITIALIZER;
+static IOHIDManagerRef		 manager;
+
 static int
 get_int32(IOHIDDeviceRef dev, CFStringRef key, int32_t *v)
 {
@@ -140,14 +167,14 @@ get_str(IOHIDDeviceRef dev, char **manufacturer, char **product)
 	*product = NULL;
 
 	if (get_utf8(dev, CFSTR(kIOHIDManufacturerKey), buf, sizeof(buf)) < 0)
-		*manufacturer = strdup("");
+		*manufacturer = fido_strdup("");
 	else
-		*manufacturer = strdup(buf);
+		*manufacturer = fido_strdup(buf);
 
 	if (get_utf8(dev, CFSTR(kIOHIDProductKey), buf, sizeof(buf)) < 0)
-		*product = strdup("");
+		*product = fido_strdup("");
 	else
-		*product = strdup(buf);
+		*product = fido_strdup(buf);
 
 	if (*manufacturer == NULL || *product == NULL) {
 		fido_log_debug("%s: strdup", __func__);
@@ -157,8 +184,8 @@ get_str(IOHIDDeviceRef dev, char **manufacturer, char **product)
 	ok = 0;
 fail:
 	if (ok < 0) {
-		free(*manufacturer);
-		free(*product);
+		fido_free(*manufacturer);
+		fido_free(*product);
 		*manufacturer = NULL;
 		*product = NULL;
 	}
@@ -184,7 +211,8 @@ get_path(IOHIDDeviceRef dev)
 		return (NULL);
 	}
 
-	if (asprintf(&path, "%s%llu", IOREG, (unsigned long long)id) == -1) {
+	if (fido_asprintf(&path, "%s%llu", IOREG,
+	    (unsigned long long)id) == -1) {
 		fido_log_error(errno, "%s: asprintf", __func__);
 		return (NULL);
 	}
@@ -228,9 +256,9 @@ copy_info(fido_dev_info_t *di, IOHIDDeviceRef dev)
 	if (get_id(dev, &di->vendor_id, &di->product_id) < 0 ||
 	    get_str(dev, &di->manufacturer, &di->product) < 0 ||
 	    (di->path = get_path(dev)) == NULL) {
-		free(di->path);
-		free(di->manufacturer);
-		free(di->product);
+		fido_free(di->path);
+		fido_free(di->manufacturer);
+		fido_free(di->product);
 		explicit_bzero(di, sizeof(*di));
 		return (-1);
 	}
@@ -241,7 +269,6 @@ copy_info(fido_dev_info_t *di, IOHIDDeviceRef dev)
 int
 fido_hid_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
 {
-	IOHIDManagerRef	 manager = NULL;
 	CFSetRef	 devset = NULL;
 	size_t		 devcnt;
 	CFIndex		 n;
@@ -256,15 +283,19 @@ fido_hid_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
 	if (devlist == NULL)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 
-	if ((manager = IOHIDManagerCreate(kCFAllocatorDefault,
-	    kIOHIDManagerOptionNone)) == NULL) {
+	pthread_mutex_lock(&manager_lock);
+	if (manager == NULL && (manager = IOHIDManagerCreate(
+	    kCFAllocatorDefault, kIOHIDManagerOptionNone)) == NULL) {
 		fido_log_debug("%s: IOHIDManagerCreate", __func__);
+		pthread_mutex_unlock(&manager_lock);
 		goto fail;
 	}
-
+	/* (re)enumerates; the set copied holds on to its devices */
 	IOHIDManagerSetDeviceMatching(manager, NULL);
+	devset = IOHIDManagerCopyDevices(manager);
+	pthread_mutex_unlock(&manager_lock);
 
-	if ((devset = IOHIDManagerCopyDevices(manager)) == NULL) {
+	if (devset == NULL) {
 		fido_log_debug("%s: IOHIDManagerCopyDevices", __func__);
 		goto fail;
 	}
@@ -276,7 +307,7 @@ fido_hid_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
 
 	devcnt = (size_t)n;
 
-	if ((devs = calloc(devcnt, sizeof(*devs))) == NULL) {
+	if ((devs = fido_calloc(devcnt, sizeof(*devs))) == NULL) {
 		fido_log_debug("%s: calloc", __func__);
 		goto fail;
 	}
@@ -298,12 +329,10 @@ fido_hid_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
 
 	r = FIDO_OK;
 fail:
-	if (manager != NULL)
-		CFRelease(manager);
 	if (devset != NULL)
 		CFRelease(devset);
 
-	free(devs);
+	fido_free(devs);
 
 	return (r);
 }
@@ -337,11 +366,145 @@ report_callback(void *context, IOReturn result, void *dev, IOHIDReportType type,
 static void
 removal_callback(void *context, IOReturn result, void *sender)
 {
-	(void)context;
+	struct hid_osx *ctx = context;
+
 	(void)result;
 	(void)sender;
 
-	CFRunLoopStop(CFRunLoopGetCurrent());
+	/* wake up readers */
+	if (ctx->report_pipe[1] != -1) {
+		close(ctx->report_pipe[1]);
+		ctx->report_pipe[1] = -1;
+	}
+}
+
+static void
+hid_loop_perform(void *info)
+{
+	struct hid_loop_call *c;
+
+	(void)info;
+
+	pthread_mutex_lock(&hid_loop_lock);
+	c = hid_loop_pending;
+	pthread_mutex_unlock(&hid_loop_lock);
+
+	if (c == NULL)
+		return;
+
+	c->fn(c->ctx);
+
+	pthread_mutex_lock(&hid_loop_lock);
+	c->done = true;
+	hid_loop_pending = NULL;
+	pthread_cond_broadcast(&hid_loop_cond);
+	pthread_mutex_unlock(&hid_loop_lock);
+}
+
+static void *
+hid_loop_main(void *arg)
+{
+	CFRunLoopSourceContext	src;
+	CFRunLoopRef		loop = NULL;
+
+	(void)arg;
+
+	memset(&src, 0, sizeof(src));
+	src.perform = hid_loop_perform;
+
+	pthread_mutex_lock(&hid_loop_lock);
+	if ((hid_loop_src = CFRunLoopSourceCreate(kCFAllocatorDefault, 0,
+	    &src)) == NULL)
+		fido_log_debug("%s: CFRunLoopSourceCreate", __func__);
+	else {
+		loop = CFRunLoopGetCurrent();
+		CFRunLoopAddSource(loop, hid_loop_src, kCFRunLoopDefaultMode);
+		hid_loop = loop;
+	}
+	hid_loop_ready = true;
+	pthread_cond_broadcast(&hid_loop_cond);
+	pthread_mutex_unlock(&hid_loop_lock);
+
+	/* hid_loop_src keeps the loop from running out of sources */
+	if (loop != NULL)
+		CFRunLoopRun();
+
+	return (NULL);
+}
+
+static void
+hid_loop_start(void)
+{
+	pthread_attr_t	attr;
+	pthread_t	thread;
+	bool		ok = false;
+
+	if (pthread_attr_init(&attr) != 0) {
+		fido_log_debug("%s: pthread_attr_init", __func__);
+		return;
+	}
+	if (pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED) != 0 ||
+	    pthread_create(&thread, &attr, hid_loop_main, NULL) != 0)
+		fido_log_debug("%s: pthread_create", __func__);
+	else
+		ok = true;
+	pthread_attr_destroy(&attr);
+
+	if (ok) {
+		pthread_mutex_lock(&hid_loop_lock);
+		while (!hid_loop_ready)
+			pthread_cond_wait(&hid_loop_cond, &hid_loop_lock);
+		pthread_mutex_unlock(&hid_loop_lock);
+	}
+}
+
+/* run fn(ctx) on the loop's thread, and wait for it to return */
+static int
+hid_loop_call(void (*fn)(struct hid_osx *), struct hid_osx *ctx)
+{
+	struct hid_loop_call c;
+
+	if (pthread_once(&hid_loop_once, hid_loop_start) != 0 ||
+	    hid_loop == NULL) {
+		fido_log_debug("%s: no run loop", __func__);
+		return (-1);
+	}
+
+	c.fn = fn;
+	c.ctx = ctx;
+	c.done = false;
+
+	pthread_mutex_lock(&hid_loop_lock);
+	while (hid_loop_pending != NULL)
+		pthread_cond_wait(&hid_loop_cond, &hid_loop_lock);
+	hid_loop_pending = &c;
+	CFRunLoopSourceSignal(hid_loop_src);
+	CFRunLoopWakeUp(hid_loop);
+	while (!c.done)
+		pthread_cond_wait(&hid_loop_cond, &hid_loop_lock);
+	pthread_mutex_unlock(&hid_loop_lock);
+
+	return (0);
+}
+
+static void
+schedule(struct hid_osx *ctx)
+{
+	IOHIDDeviceRegisterInputReportCallback(ctx->ref, ctx->report,
+	    (long)ctx->report_in_len, &report_callback, ctx);
+	IOHIDDeviceRegisterRemovalCallback(ctx->ref, &removal_callback, ctx);
+	IOHIDDeviceScheduleWithRunLoop(ctx->ref, hid_loop,
+	    kCFRunLoopDefaultMode);
+}
+
+static void
+unschedule(struct hid_osx *ctx)
+{
+	IOHIDDeviceUnscheduleFromRunLoop(ctx->ref, hid_loop,
+	    kCFRunLoopDefaultMode);
+	IOHIDDeviceRegisterInputReportCallback(ctx->ref, ctx->report,
+	    (long)ctx->report_in_len, NULL, ctx);
+	IOHIDDeviceRegisterRemovalCallback(ctx->ref, NULL, ctx);
 }
 
 static int
@@ -397,11 +560,10 @@ fido_hid_open(const char *path)
 {
 	struct hid_osx		*ctx;
 	io_registry_entry_t	 entry = MACH_PORT_NULL;
-	char			 loop_id[32];
+	bool			 opened = false;
 	int			 ok = -1;
-	int			 r;
 
-	if ((ctx = calloc(1, sizeof(*ctx))) == NULL) {
+	if ((ctx = fido_calloc(1, sizeof(*ctx))) == NULL) {
 		fido_log_debug("%s: calloc", __func__);
 		goto fail;
 	}
@@ -453,38 +615,29 @@ fido_hid_open(const char *path)
 		fido_log_debug("%s: IOHIDDeviceOpen", __func__);
 		goto fail;
 	}
+	opened = true;
 
-	if ((r = snprintf(loop_id, sizeof(loop_id), "fido2-%p",
-	    (void *)ctx->ref)) < 0 || (size_t)r >= sizeof(loop_id)) {
-		fido_log_debug("%s: snprintf", __func__);
-		goto fail;
-	}
-
-	if ((ctx->loop_id = CFStringCreateWithCString(NULL, loop_id,
-	    kCFStringEncodingASCII)) == NULL) {
-		fido_log_debug("%s: CFStringCreateWithCString", __func__);
+	if (hid_loop_call(schedule, ctx) < 0) {
+		fido_log_debug("%s: hid_loop_call", __func__);
 		goto fail;
 	}
 
-	IOHIDDeviceRegisterInputReportCallback(ctx->ref, ctx->report,
-	    (long)ctx->report_in_len, &report_callback, ctx);
-	IOHIDDeviceRegisterRemovalCallback(ctx->ref, &removal_callback, ctx);
-
 	ok = 0;
 fail:
 	if (entry != MACH_PORT_NULL)
 		IOObjectRelease(entry);
 
 	if (ok < 0 && ctx != NULL) {
+		if (opened && IOHIDDeviceClose(ctx->ref,
+		    kIOHIDOptionsTypeSeizeDevice) != kIOReturnSuccess)
+			fido_log_debug("%s: IOHIDDeviceClose", __func__);
 		if (ctx->ref != NULL)
 			CFRelease(ctx->ref);
-		if (ctx->loop_id != NULL)
-			CFRelease(ctx->loop_id);
 		if (ctx->report_pipe[0] != -1)
 			close(ctx->report_pipe[0]);
 		if (ctx->report_pipe[1] != -1)
 			close(ctx->report_pipe[1]);
-		free(ctx);
+		fido_free(ctx);
 		ctx = NULL;
 	}
 
@@ -496,22 +649,22 @@ fido_hid_close(void *handle)
 {
 	struct hid_osx *ctx = handle;
 
-	IOHIDDeviceRegisterInputReportCallback(ctx->ref, ctx->report,
-	    (long)ctx->report_in_len, NULL, ctx);
-	IOHIDDeviceRegisterRemovalCallback(ctx->ref, NULL, ctx);
+	/* the loop was running when ctx was opened */
+	if (hid_loop_call(unschedule, ctx) < 0)
+		fido_log_debug("%s: hid_loop_call", __func__);
 
 	if (IOHIDDeviceClose(ctx->ref,
 	    kIOHIDOptionsTypeSeizeDevice) != kIOReturnSuccess)
 		fido_log_debug("%s: IOHIDDeviceClose", __func__);
 
 	CFRelease(ctx->ref);
-	CFRelease(ctx->loop_id);
 
 	explicit_bzero(ctx->report, sizeof(ctx->report));
 	close(ctx->report_pipe[0]);
-	close(ctx->report_pipe[1]);
+	if (ctx->report_pipe[1] != -1)
+		close(ctx->report_pipe[1]);
 
-	free(ctx);
+	fido_free(ctx);
 }
 
 int
@@ -523,36 +676,49 @@ fido_hid_set_sigmask(void *handle, const fido_sigset_t *sigmask)
 	return (FIDO_ERR_INTERNAL);
 }
 
+int
+fido_hid_set_wakeup(void *handle, const fido_wakeup_t *wakeup)
+{
+	(void)handle;
+	(void)wakeup;
+
+	return (FIDO_ERR_INTERNAL);
+}
+
 int
 fido_hid_read(void *handle, unsigned char *buf, size_t len, int ms)
 {
 	struct hid_osx		*ctx = handle;
+	struct pollfd		 pfd;
 	ssize_t			 r;
 
 	explicit_bzero(buf, len);
-	explicit_bzero(ctx->report, sizeof(ctx->report));
 
 	if (len != ctx->report_in_len || len > sizeof(ctx->report)) {
 		fido_log_debug("%s: len %zu", __func__, len);
 		return (-1);
 	}
 
-	IOHIDDeviceScheduleWithRunLoop(ctx->ref, CFRunLoopGetCurrent(),
-	    ctx->loop_id);
-
-	if (ms == -1)
-		ms = 5000; /* wait 5 seconds by default */
+	memset(&pfd, 0, sizeof(pfd));
+	pfd.fd = ctx->report_pipe[0];
+	pfd.events = POLLIN;
 
-	CFRunLoopRunInMode(ctx->loop_id, (double)ms/1000.0, true);
-
-	IOHIDDeviceUnscheduleFromRunLoop(ctx->ref, CFRunLoopGetCurrent(),
-	    ctx->loop_id);
+	if ((r = poll(&pfd, 1, ms)) < 1) {
+		if (r == -1)
+			fido_log_error(errno, "%s: poll", __func__);
+		return (-1);
+	}
 
 	if ((r = read(ctx->report_pipe[0], buf, len)) == -1) {
 		fido_log_error(errno, "%s: read", __func__);
 		return (-1);
 	}
 
+	if (r == 0) {
+		fido_log_debug("%s: device removed", __func__);
+		return (-1);
+	}
+
 	if (r < 0 || (size_t)r != len) {
 		fido_log_debug("%s: %zd != %zu", __func__, r, len);
 		return (-1);
@@ -580,6 +746,22 @@ fido_hid_write(void *handle, const unsigned char *buf, size_t len)
 	return ((int)len);
 }
 
+/* IOHIDDeviceSetReport() takes one report at a time */
+int
+fido_hid_writev(void *handle, const unsigned char *buf, size_t len, size_t n)
+{
+	if (len == 0 || n > INT_MAX / len) {
+		fido_log_debug("%s: len=%zu, n=%zu", __func__, len, n);
+		return (-1);
+	}
+
+	for (size_t i = 0; i < n; i++)
+		if (fido_hid_write(handle, buf + i * len, len) != (int)len)
+			return (-1);
+
+	return ((int)(len * n));
+}
+
 size_t
 fido_hid_report_in_len(void *handle)
 {
@@ -595,3 +777,48 @@ fido_hid_report_out_len(void *handle)
 
 	return (ctx->report_out_len);
 }
+
+int
+fido_hid_get_fd(void *handle)
+{
+	struct hid_osx *ctx = handle;
+
+	return (ctx->report_pipe[0]);
+}
+
+size_t
+fido_hid_pending(void *handle)
+{
+	(void)handle;
+
+	return (0);
+}
+
+/* IOHIDManager delivers hotplug callbacks on a CFRunLoop; no descriptor */
+void *
+fido_hid_monitor_open(void)
+{
+	return (NULL);
+}
+
+void
+fido_hid_monitor_close(void *handle)
+{
+	(void)handle;
+}
+
+int
+fido_hid_monitor_get_fd(void *handle)
+{
+	(void)handle;
+
+	return (-1);
+}
+
+int
+fido_hid_monitor_drain(void *handle)
+{
+	(void)handle;
+
+	return (1);
+}
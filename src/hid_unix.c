@@ -47,16 +47,23 @@ fido_hid_unix_open(const char *path)
 	return (fd);
 }
 
+/* wait up to ms for fd to become readable, unless wakeup is or becomes so */
 int
-fido_hid_unix_wait(int fd, int ms, const fido_sigset_t *sigmask)
+fido_hid_unix_wait(int fd, int wakeup, int ms, const fido_sigset_t *sigmask)
 {
 	struct timespec ts;
-	struct pollfd pfd;
+	struct pollfd pfd[2];
+	nfds_t n = 1;
 	int r;
 
 	memset(&pfd, 0, sizeof(pfd));
-	pfd.events = POLLIN;
-	pfd.fd = fd;
+	pfd[0].events = POLLIN;
+	pfd[0].fd = fd;
+	if (wakeup != -1) {
+		pfd[1].events = POLLIN;
+		pfd[1].fd = wakeup;
+		n++;
+	}
 
 #ifdef FIDO_FUZZ
 	return (0);
@@ -66,11 +73,114 @@ fido_hid_unix_wait(int fd, int ms, const fido_sigset_t *sigmask)
 		ts.tv_nsec = (ms % 1000) * 1000000;
 	}
 
-	if ((r = ppoll(&pfd, 1, ms > -1 ? &ts : NULL, sigmask)) < 1) {
+	if ((r = ppoll(pfd, n, ms > -1 ? &ts : NULL, sigmask)) < 1) {
 		if (r == -1)
 			fido_log_error(errno, "%s: ppoll", __func__);
 		return (-1);
 	}
+	if (n == 2 && pfd[1].revents != 0) {
+		fido_log_debug("%s: woken up", __func__);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* make fd non-blocking, and buffer the reports of len bytes read from it */
+int
+fido_hid_unix_rbuf_init(int fd, fido_hid_rbuf_t *rbuf, size_t len)
+{
+	int flags;
+
+	memset(rbuf, 0, sizeof(*rbuf));
+	rbuf->wakeup = -1;
+
+	if (len == 0 || len > sizeof(rbuf->report[0]))
+		return (-1);
+
+	if ((flags = fcntl(fd, F_GETFL)) == -1) {
+		fido_log_error(errno, "%s: fcntl F_GETFL", __func__);
+		return (-1);
+	}
+
+	if (fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+		fido_log_error(errno, "%s: fcntl F_SETFL", __func__);
+		return (-1);
+	}
+
+	rbuf->len = len;
 
 	return (0);
 }
+
+/* drain reports already queued by the kernel without waiting */
+static void
+rbuf_fill(int fd, fido_hid_rbuf_t *rbuf)
+{
+	unsigned char	*p;
+	ssize_t		 r;
+
+	while (rbuf->count < nitems(rbuf->report)) {
+		p = rbuf->report[(rbuf->head + rbuf->count) %
+		    nitems(rbuf->report)];
+		if ((r = read(fd, p, rbuf->len)) == -1) {
+			if (errno != EAGAIN)
+				fido_log_error(errno, "%s: read", __func__);
+			return;
+		}
+		if ((size_t)r != rbuf->len) {
+			fido_log_debug("%s: %zd != %zu", __func__, r,
+			    rbuf->len);
+			return;
+		}
+		rbuf->count++;
+	}
+}
+
+/* read a report of len bytes, waiting up to ms only if none is queued */
+int
+fido_hid_unix_read(int fd, fido_hid_rbuf_t *rbuf, unsigned char *buf,
+    size_t len, int ms, const fido_sigset_t *sigmask)
+{
+	ssize_t r = -1;
+
+	if (rbuf->count > 0) {
+		if (len != rbuf->len) {
+			fido_log_debug("%s: len %zu", __func__, len);
+			return (-1);
+		}
+		memcpy(buf, rbuf->report[rbuf->head], len);
+		explicit_bzero(rbuf->report[rbuf->head], len);
+		rbuf->head = (rbuf->head + 1) % nitems(rbuf->report);
+		rbuf->count--;
+		return ((int)len);
+	}
+
+	/* fd is non-blocking; try it before paying for a ppoll() */
+	if (rbuf->len == len && (r = read(fd, buf, len)) == -1 &&
+	    errno != EAGAIN) {
+		fido_log_error(errno, "%s: read", __func__);
+		return (-1);
+	}
+
+	if (r == -1) {
+		if (fido_hid_unix_wait(fd, rbuf->wakeup, ms, sigmask) < 0) {
+			fido_log_debug("%s: fd not ready", __func__);
+			return (-1);
+		}
+		if ((r = read(fd, buf, len)) == -1) {
+			fido_log_error(errno, "%s: read", __func__);
+			return (-1);
+		}
+	}
+
+	if (r < 0 || (size_t)r != len) {
+		fido_log_debug("%s: %zd != %zu", __func__, r, len);
+		return (-1);
+	}
+
+	if (rbuf->len == len)
+		rbuf_fill(fd, rbuf);
+
+	return ((int)r);
+}
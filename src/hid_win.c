@@ -33,15 +33,67 @@ DEFINE_DEVPROPKEY(DEVPKEY_Device_Parent, 0x4340a6c5, 0x93fa, 0x4706, 0x97,
     0x2c, 0x7b, 0x64, 0x80, 0x08, 0xa5, 0xa7, 8);
 #endif
 
+#define READ_QUEUE_LEN		4	/* overlapped reads kept in flight */
+#define MANIFEST_CACHE_LEN	64	/* fido devices remembered */
+
+/*
+ * Each device keeps READ_QUEUE_LEN reads queued, so that a report is
+ * already being received when fido_hid_read() asks for it. The reads
+ * complete in the order they were issued; rq_head is the oldest, and a
+ * read is reissued as soon as its report has been collected.
+ */
+struct hid_read {
+	OVERLAPPED	overlap;  /* hEvent lives as long as the device */
+	int		pending;  /* issued and not yet collected */
+	unsigned char	report[1 + CTAP_MAX_REPORT_LEN];
+};
+
 struct hid_win {
 	HANDLE		dev;
-	OVERLAPPED	overlap;
-	int		report_pending;
+	HANDLE		write_event;
+	HANDLE		wakeup; /* ends waits when signalled, or NULL */
+	struct hid_read	rq[READ_QUEUE_LEN];
+	size_t		rq_head;
 	size_t		report_in_len;
 	size_t		report_out_len;
-	unsigned char	report[1 + CTAP_MAX_REPORT_LEN];
 };
 
+/*
+ * CM_Register_Notification() first shipped with Windows 8; it is looked
+ * up at run time, and declared here to the extent it is used.
+ */
+struct cm_notify_filter {
+	DWORD	cbSize;
+	DWORD	Flags;
+	int	FilterType;
+	DWORD	Reserved;
+	union {
+		GUID	ClassGuid;
+		HANDLE	hTarget;
+		WCHAR	InstanceId[200];
+	} u;
+};
+
+#define CM_FILTER_DEVICEINTERFACE	0
+
+typedef DWORD CALLBACK cm_notify_cb_t(HANDLE, PVOID, int, PVOID, DWORD);
+typedef DWORD WINAPI cm_register_t(struct cm_notify_filter *, PVOID,
+    cm_notify_cb_t *, HANDLE *);
+
+/*
+ * The fido devices found by the last enumeration are handed out again
+ * until a hid interface arrives or leaves. Without notifications, or
+ * with more than MANIFEST_CACHE_LEN devices, nothing is cached.
+ */
+static INIT_ONCE	 hid_watch_once = INIT_ONCE_STATIC_INIT;
+static BOOL		 hid_watched;
+static LONG volatile	 hid_gen;	/* bumped on every notification */
+static SRWLOCK		 manifest_lock = SRWLOCK_INIT;
+static bool		 manifest_valid;
+static LONG		 manifest_gen;
+static size_t		 manifest_len;
+static fido_dev_info_t	 manifest_cache[MANIFEST_CACHE_LEN];
+
 static bool
 is_fido(HANDLE dev)
 {
@@ -141,7 +193,7 @@ get_manufacturer(HANDLE dev, char **manufacturer)
 		goto fail;
 	}
 
-	if ((*manufacturer = malloc((size_t)utf8_len)) == NULL) {
+	if ((*manufacturer = fido_malloc((size_t)utf8_len)) == NULL) {
 		fido_log_debug("%s: malloc", __func__);
 		goto fail;
 	}
@@ -155,7 +207,7 @@ get_manufacturer(HANDLE dev, char **manufacturer)
 	ok = 0;
 fail:
 	if (ok < 0) {
-		free(*manufacturer);
+		fido_free(*manufacturer);
 		*manufacturer = NULL;
 	}
 
@@ -182,7 +234,7 @@ get_product(HANDLE dev, char **product)
 		goto fail;
 	}
 
-	if ((*product = malloc((size_t)utf8_len)) == NULL) {
+	if ((*product = fido_malloc((size_t)utf8_len)) == NULL) {
 		fido_log_debug("%s: malloc", __func__);
 		goto fail;
 	}
@@ -196,7 +248,7 @@ get_product(HANDLE dev, char **product)
 	ok = 0;
 fail:
 	if (ok < 0) {
-		free(*product);
+		fido_free(*product);
 		*product = NULL;
 	}
 
@@ -225,7 +277,7 @@ get_path(HDEVINFO devinfo, SP_DEVICE_INTERFACE_DATA *ifdata)
 		goto fail;
 	}
 
-	if ((ifdetail = malloc(len)) == NULL) {
+	if ((ifdetail = fido_malloc(len)) == NULL) {
 		fido_log_debug("%s: malloc", __func__);
 		goto fail;
 	}
@@ -239,13 +291,13 @@ get_path(HDEVINFO devinfo, SP_DEVICE_INTERFACE_DATA *ifdata)
 		goto fail;
 	}
 
-	if ((path = strdup(ifdetail->DevicePath)) == NULL) {
+	if ((path = fido_strdup(ifdetail->DevicePath)) == NULL) {
 		fido_log_debug("%s: strdup", __func__);
 		goto fail;
 	}
 
 fail:
-	free(ifdetail);
+	fido_free(ifdetail);
 
 	return (path);
 }
@@ -275,7 +327,7 @@ hid_ok(HDEVINFO devinfo, DWORD idx)
 		goto fail;
 	}
 
-	if ((parent = malloc(len)) == NULL) {
+	if ((parent = fido_malloc(len)) == NULL) {
 		fido_log_debug("%s: malloc", __func__);
 		goto fail;
 	}
@@ -289,7 +341,7 @@ hid_ok(HDEVINFO devinfo, DWORD idx)
 
 	ok = wcsncmp(parent, L"USB\\", 4) == 0;
 fail:
-	free(parent);
+	fido_free(parent);
 
 	return (ok);
 }
@@ -337,12 +389,12 @@ copy_info(fido_dev_info_t *di, HDEVINFO devinfo, DWORD idx,
 
 	if (get_manufacturer(dev, &di->manufacturer) < 0) {
 		fido_log_debug("%s: get_manufacturer", __func__);
-		di->manufacturer = strdup("");
+		di->manufacturer = fido_strdup("");
 	}
 
 	if (get_product(dev, &di->product) < 0) {
 		fido_log_debug("%s: get_product", __func__);
-		di->product = strdup("");
+		di->product = fido_strdup("");
 	}
 
 	if (di->manufacturer == NULL || di->product == NULL) {
@@ -356,17 +408,82 @@ fail:
 		CloseHandle(dev);
 
 	if (ok < 0) {
-		free(di->path);
-		free(di->manufacturer);
-		free(di->product);
+		fido_free(di->path);
+		fido_free(di->manufacturer);
+		fido_free(di->product);
 		explicit_bzero(di, sizeof(*di));
 	}
 
 	return (ok);
 }
 
-int
-fido_hid_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
+static DWORD CALLBACK
+hid_notify(HANDLE notify, PVOID ctx, int action, PVOID data, DWORD len)
+{
+	(void)notify;
+	(void)ctx;
+	(void)action;
+	(void)data;
+	(void)len;
+
+	InterlockedIncrement(&hid_gen);
+
+	return (ERROR_SUCCESS);
+}
+
+static BOOL CALLBACK
+hid_watch(PINIT_ONCE once, PVOID arg, PVOID *ctx)
+{
+	struct cm_notify_filter	 filter;
+	cm_register_t		*cm_register;
+	HMODULE			 cfgmgr;
+	HANDLE			 notify;
+
+	(void)once;
+	(void)arg;
+	(void)ctx;
+
+	if ((cfgmgr = LoadLibrary("cfgmgr32.dll")) == NULL) {
+		fido_log_debug("%s: LoadLibrary", __func__);
+		return (TRUE); /* not retried */
+	}
+
+	if ((cm_register = (cm_register_t *)GetProcAddress(cfgmgr,
+	    "CM_Register_Notification")) == NULL) {
+		fido_log_debug("%s: CM_Register_Notification", __func__);
+		FreeLibrary(cfgmgr);
+		return (TRUE);
+	}
+
+	memset(&filter, 0, sizeof(filter));
+	filter.cbSize = sizeof(filter);
+	filter.FilterType = CM_FILTER_DEVICEINTERFACE;
+	filter.u.ClassGuid = GUID_DEVINTERFACE_HID;
+
+	if (cm_register(&filter, NULL, hid_notify, &notify) != 0) {
+		fido_log_debug("%s: cm_register", __func__);
+		FreeLibrary(cfgmgr);
+		return (TRUE);
+	}
+
+	/* cfgmgr and notify are kept for the life of the process */
+	hid_watched = TRUE;
+
+	return (TRUE);
+}
+
+static void
+manifest_reset(void)
+{
+	for (size_t i = 0; i < manifest_len; i++)
+		fido_dev_info_reset(&manifest_cache[i]);
+
+	manifest_len = 0;
+	manifest_valid = false;
+}
+
+static int
+manifest_enum(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
 {
 	GUID				hid_guid = GUID_DEVINTERFACE_HID;
 	HDEVINFO			devinfo = INVALID_HANDLE_VALUE;
@@ -376,11 +493,6 @@ fido_hid_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
 
 	*olen = 0;
 
-	if (ilen == 0)
-		return (FIDO_OK); /* nothing to do */
-	if (devlist == NULL)
-		return (FIDO_ERR_INVALID_ARGUMENT);
-
 	if ((devinfo = SetupDiGetClassDevsA(&hid_guid, NULL, NULL,
 	    DIGCF_DEVICEINTERFACE | DIGCF_PRESENT)) == INVALID_HANDLE_VALUE) {
 		fido_log_debug("%s: SetupDiGetClassDevsA", __func__);
@@ -411,12 +523,89 @@ fail:
 	return (r);
 }
 
+int
+fido_hid_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
+{
+	fido_dev_info_t	*di;
+	int		 r = FIDO_ERR_INTERNAL;
+
+	*olen = 0;
+
+	if (ilen == 0)
+		return (FIDO_OK); /* nothing to do */
+	if (devlist == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	if (InitOnceExecuteOnce(&hid_watch_once, hid_watch, NULL,
+	    NULL) == false || hid_watched == false)
+		return (manifest_enum(devlist, ilen, olen));
+
+	AcquireSRWLockExclusive(&manifest_lock);
+
+	if (manifest_valid == false ||
+	    InterlockedCompareExchange(&hid_gen, 0, 0) != manifest_gen) {
+		manifest_reset();
+		/* read before enumerating; a later event invalidates */
+		manifest_gen = InterlockedCompareExchange(&hid_gen, 0, 0);
+		if ((r = manifest_enum(manifest_cache, nitems(manifest_cache),
+		    &manifest_len)) != FIDO_OK) {
+			fido_log_debug("%s: manifest_enum", __func__);
+			manifest_reset();
+			goto fail;
+		}
+		if (manifest_len == nitems(manifest_cache)) {
+			/* possibly truncated */
+			manifest_reset();
+			ReleaseSRWLockExclusive(&manifest_lock);
+			return (manifest_enum(devlist, ilen, olen));
+		}
+		manifest_valid = true;
+	}
+
+	for (size_t i = 0; i < manifest_len && *olen < ilen; i++) {
+		di = &manifest_cache[i];
+		if ((r = fido_dev_info_set(devlist, *olen, di->path,
+		    di->manufacturer, di->product, &di->io, NULL)) != FIDO_OK) {
+			fido_log_debug("%s: fido_dev_info_set", __func__);
+			goto fail;
+		}
+		devlist[*olen].vendor_id = di->vendor_id;
+		devlist[*olen].product_id = di->product_id;
+		(*olen)++;
+	}
+
+	r = FIDO_OK;
+fail:
+	ReleaseSRWLockExclusive(&manifest_lock);
+
+	return (r);
+}
+
+static int
+read_submit(struct hid_win *ctx, struct hid_read *rd)
+{
+	HANDLE ev = rd->overlap.hEvent;
+
+	memset(&rd->overlap, 0, sizeof(rd->overlap));
+	rd->overlap.hEvent = ev;
+
+	if (ReadFile(ctx->dev, rd->report, (DWORD)ctx->report_in_len, NULL,
+	    &rd->overlap) == 0 && GetLastError() != ERROR_IO_PENDING) {
+		fido_log_debug("%s: ReadFile", __func__);
+		return (-1);
+	}
+
+	rd->pending = 1;
+
+	return (0);
+}
+
 void *
 fido_hid_open(const char *path)
 {
 	struct hid_win *ctx;
 
-	if ((ctx = calloc(1, sizeof(*ctx))) == NULL)
+	if ((ctx = fido_calloc(1, sizeof(*ctx))) == NULL)
 		return (NULL);
 
 	ctx->dev = CreateFileA(path, GENERIC_READ | GENERIC_WRITE,
@@ -424,17 +613,25 @@ fido_hid_open(const char *path)
 	    FILE_FLAG_OVERLAPPED, NULL);
 
 	if (ctx->dev == INVALID_HANDLE_VALUE) {
-		free(ctx);
+		fido_free(ctx);
 		return (NULL);
 	}
 
-	if ((ctx->overlap.hEvent = CreateEventA(NULL, FALSE, FALSE,
+	if ((ctx->write_event = CreateEventA(NULL, TRUE, FALSE,
 	    NULL)) == NULL) {
 		fido_log_debug("%s: CreateEventA", __func__);
 		fido_hid_close(ctx);
 		return (NULL);
 	}
 
+	for (size_t i = 0; i < nitems(ctx->rq); i++)
+		if ((ctx->rq[i].overlap.hEvent = CreateEventA(NULL, TRUE,
+		    FALSE, NULL)) == NULL) {
+			fido_log_debug("%s: CreateEventA", __func__);
+			fido_hid_close(ctx);
+			return (NULL);
+		}
+
 	if (get_report_len(ctx->dev, 0, &ctx->report_in_len) < 0 ||
 	    get_report_len(ctx->dev, 1, &ctx->report_out_len) < 0) {
 		fido_log_debug("%s: get_report_len", __func__);
@@ -442,27 +639,50 @@ fido_hid_open(const char *path)
 		return (NULL);
 	}
 
+	if (ctx->report_in_len > sizeof(ctx->rq[0].report)) {
+		fido_log_debug("%s: report_in_len %zu", __func__,
+		    ctx->report_in_len);
+		fido_hid_close(ctx);
+		return (NULL);
+	}
+
+	for (size_t i = 0; i < nitems(ctx->rq); i++)
+		if (read_submit(ctx, &ctx->rq[i]) < 0) {
+			fido_log_debug("%s: read_submit", __func__);
+			fido_hid_close(ctx);
+			return (NULL);
+		}
+
 	return (ctx);
 }
 
 void
 fido_hid_close(void *handle)
 {
-	struct hid_win *ctx = handle;
+	struct hid_win	*ctx = handle;
+	struct hid_read	*rd;
+	DWORD		 n;
 
-	if (ctx->overlap.hEvent != NULL) {
-		if (ctx->report_pending) {
-			fido_log_debug("%s: report_pending", __func__);
-			if (CancelIoEx(ctx->dev, &ctx->overlap) == 0)
-				fido_log_debug("%s CancelIoEx: 0x%lx",
-				    __func__, (u_long)GetLastError());
-		}
-		CloseHandle(ctx->overlap.hEvent);
+	if (CancelIoEx(ctx->dev, NULL) == 0 &&
+	    GetLastError() != ERROR_NOT_FOUND)
+		fido_log_debug("%s: CancelIoEx: 0x%lx", __func__,
+		    (u_long)GetLastError());
+
+	for (size_t i = 0; i < nitems(ctx->rq); i++) {
+		rd = &ctx->rq[i];
+		/* the buffer is ours again once the read has completed */
+		if (rd->pending)
+			GetOverlappedResult(ctx->dev, &rd->overlap, &n, TRUE);
+		if (rd->overlap.hEvent != NULL)
+			CloseHandle(rd->overlap.hEvent);
+		explicit_bzero(rd->report, sizeof(rd->report));
 	}
 
-	explicit_bzero(ctx->report, sizeof(ctx->report));
+	if (ctx->write_event != NULL)
+		CloseHandle(ctx->write_event);
+
 	CloseHandle(ctx->dev);
-	free(ctx);
+	fido_free(ctx);
 }
 
 int
@@ -474,50 +694,68 @@ fido_hid_set_sigmask(void *handle, const fido_sigset_t *sigmask)
 	return (FIDO_ERR_INTERNAL);
 }
 
+int
+fido_hid_set_wakeup(void *handle, const fido_wakeup_t *wakeup)
+{
+	struct hid_win *ctx = handle;
+
+	ctx->wakeup = fido_wakeup_event(wakeup);
+
+	return (FIDO_OK);
+}
+
 int
 fido_hid_read(void *handle, unsigned char *buf, size_t len, int ms)
 {
 	struct hid_win	*ctx = handle;
-	DWORD		 n;
+	struct hid_read	*rd;
+	HANDLE		 ev[2];
+	DWORD		 n, nev = 0;
+	int		 r = -1;
 
-	if (len != ctx->report_in_len - 1 || len > sizeof(ctx->report) - 1) {
+	if (len != ctx->report_in_len - 1) {
 		fido_log_debug("%s: len %zu", __func__, len);
 		return (-1);
 	}
 
-	if (ctx->report_pending == 0) {
-		memset(&ctx->report, 0, sizeof(ctx->report));
-		ResetEvent(ctx->overlap.hEvent);
-		if (ReadFile(ctx->dev, ctx->report, (DWORD)(len + 1), &n,
-		    &ctx->overlap) == 0 && GetLastError() != ERROR_IO_PENDING) {
-			CancelIo(ctx->dev);
-			fido_log_debug("%s: ReadFile", __func__);
-			return (-1);
-		}
-		ctx->report_pending = 1;
+	rd = &ctx->rq[ctx->rq_head];
+
+	/* reissue a read that could not be queued earlier */
+	if (rd->pending == 0 && read_submit(ctx, rd) < 0) {
+		fido_log_debug("%s: read_submit", __func__);
+		return (-1);
 	}
 
-	if (ms > -1 && WaitForSingleObject(ctx->overlap.hEvent,
-	    (DWORD)ms) != WAIT_OBJECT_0)
+	ev[nev++] = rd->overlap.hEvent;
+	if (ctx->wakeup != NULL)
+		ev[nev++] = ctx->wakeup;
+	if ((ms > -1 || nev > 1) && (n = WaitForMultipleObjects(nev, ev, FALSE,
+	    ms > -1 ? (DWORD)ms : INFINITE)) != WAIT_OBJECT_0) {
+		if (n == WAIT_OBJECT_0 + 1)
+			fido_log_debug("%s: woken up", __func__);
 		return (0);
+	}
 
-	ctx->report_pending = 0;
+	rd->pending = 0;
+	ctx->rq_head = (ctx->rq_head + 1) % nitems(ctx->rq);
 
-	if (GetOverlappedResult(ctx->dev, &ctx->overlap, &n, TRUE) == 0) {
+	if (GetOverlappedResult(ctx->dev, &rd->overlap, &n, TRUE) == 0)
 		fido_log_debug("%s: GetOverlappedResult", __func__);
-		return (-1);
-	}
-
-	if (n != len + 1) {
+	else if (n != len + 1)
 		fido_log_debug("%s: expected %zu, got %zu", __func__,
 		    len + 1, (size_t)n);
-		return (-1);
+	else {
+		memcpy(buf, rd->report + 1, len);
+		r = (int)len;
 	}
 
-	memcpy(buf, ctx->report + 1, len);
-	explicit_bzero(ctx->report, sizeof(ctx->report));
+	explicit_bzero(rd->report, sizeof(rd->report));
 
-	return ((int)len);
+	/* rd is now at the tail of the queue */
+	if (read_submit(ctx, rd) < 0)
+		fido_log_debug("%s: read_submit", __func__);
+
+	return (r);
 }
 
 int
@@ -528,6 +766,7 @@ fido_hid_write(void *handle, const unsigned char *buf, size_t len)
 	DWORD		 n;
 
 	memset(&overlap, 0, sizeof(overlap));
+	overlap.hEvent = ctx->write_event; /* not the handle; reads are queued */
 
 	if (len != ctx->report_out_len) {
 		fido_log_debug("%s: len %zu", __func__, len);
@@ -554,6 +793,22 @@ fido_hid_write(void *handle, const unsigned char *buf, size_t len)
 	return ((int)len);
 }
 
+/* WriteFile() takes one report at a time */
+int
+fido_hid_writev(void *handle, const unsigned char *buf, size_t len, size_t n)
+{
+	if (len == 0 || n > INT_MAX / len) {
+		fido_log_debug("%s: len=%zu, n=%zu", __func__, len, n);
+		return (-1);
+	}
+
+	for (size_t i = 0; i < n; i++)
+		if (fido_hid_write(handle, buf + i * len, len) != (int)len)
+			return (-1);
+
+	return ((int)(len * n));
+}
+
 size_t
 fido_hid_report_in_len(void *handle)
 {
@@ -569,3 +824,58 @@ fido_hid_report_out_len(void *handle)
 
 	return (ctx->report_out_len - 1);
 }
+
+int
+fido_hid_get_fd(void *handle)
+{
+	(void)handle;
+
+	return (-1); /* no pollable descriptor */
+}
+
+size_t
+fido_hid_pending(void *handle)
+{
+	struct hid_win	*ctx = handle;
+	struct hid_read	*rd;
+	size_t		 n = 0;
+
+	/* reads complete in order; count those done from the head */
+	for (size_t i = 0; i < nitems(ctx->rq); i++) {
+		rd = &ctx->rq[(ctx->rq_head + i) % nitems(ctx->rq)];
+		if (rd->pending == 0 || !HasOverlappedIoCompleted(&rd->overlap))
+			break;
+		n++;
+	}
+
+	return (n);
+}
+
+/* CM_Register_Notification() delivers callbacks on a thread; no descriptor */
+void *
+fido_hid_monitor_open(void)
+{
+	return (NULL);
+}
+
+void
+fido_hid_monitor_close(void *handle)
+{
+	(void)handle;
+}
+
+int
+fido_hid_monitor_get_fd(void *handle)
+{
+	(void)handle;
+
+	return (-1);
+}
+
+int
+fido_hid_monitor_drain(void *handle)
+{
+	(void)handle;
+
+	return (1);
+}
@@ -5,8 +5,30 @@
  * SPDX-License-Identifier: BSD-2-Clause
  */
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include "fido.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/* serialises the deferred decoding of fido_cbor_info_t objects */
+#if defined(HAVE_PTHREAD)
+static pthread_mutex_t info_lock = PTHREAD_MUTEX_INITIALIZER;
+#define INFO_LOCK()		pthread_mutex_lock(&info_lock)
+#define INFO_UNLOCK()		pthread_mutex_unlock(&info_lock)
+#elif defined(_WIN32)
+static SRWLOCK info_lock = SRWLOCK_INIT;
+#define INFO_LOCK()		AcquireSRWLockExclusive(&info_lock)
+#define INFO_UNLOCK()		ReleaseSRWLockExclusive(&info_lock)
+#else
+#define INFO_LOCK()		do { } while (0)
+#define INFO_UNLOCK()		do { } while (0)
+#endif
+
 static int
 decode_string(const cbor_item_t *item, void *arg)
 {
@@ -36,7 +58,7 @@ decode_string_array(const cbor_item_t *item, fido_str_array_t *v)
 		return (-1);
 	}
 
-	v->ptr = calloc(cbor_array_size(item), sizeof(char *));
+	v->ptr = fido_calloc(cbor_array_size(item), sizeof(char *));
 	if (v->ptr == NULL)
 		return (-1);
 
@@ -99,8 +121,8 @@ decode_options(const cbor_item_t *item, fido_opt_array_t *o)
 		return (-1);
 	}
 
-	o->name = calloc(cbor_map_size(item), sizeof(char *));
-	o->value = calloc(cbor_map_size(item), sizeof(bool));
+	o->name = fido_calloc(cbor_map_size(item), sizeof(char *));
+	o->value = fido_calloc(cbor_map_size(item), sizeof(bool));
 	if (o->name == NULL || o->value == NULL)
 		return (-1);
 
@@ -138,7 +160,7 @@ decode_protocols(const cbor_item_t *item, fido_byte_array_t *p)
 		return (-1);
 	}
 
-	p->ptr = calloc(cbor_array_size(item), sizeof(uint8_t));
+	p->ptr = fido_calloc(cbor_array_size(item), sizeof(uint8_t));
 	if (p->ptr == NULL)
 		return (-1);
 
@@ -180,7 +202,7 @@ decode_algorithm_entry(const cbor_item_t *key, const cbor_item_t *val,
 
 	ok = 0;
 out:
-	free(name);
+	fido_free(name);
 
 	return (ok);
 }
@@ -223,7 +245,7 @@ decode_algorithms(const cbor_item_t *item, fido_algo_array_t *aa)
 		return (-1);
 	}
 
-	aa->ptr = calloc(cbor_array_size(item), sizeof(fido_algo_t));
+	aa->ptr = fido_calloc(cbor_array_size(item), sizeof(fido_algo_t));
 	if (aa->ptr == NULL)
 		return (-1);
 
@@ -271,79 +293,194 @@ decode_certs(const cbor_item_t *item, fido_cert_array_t *c)
 		return (-1);
 	}
 
-	c->name = calloc(cbor_map_size(item), sizeof(char *));
-	c->value = calloc(cbor_map_size(item), sizeof(uint64_t));
+	c->name = fido_calloc(cbor_map_size(item), sizeof(char *));
+	c->value = fido_calloc(cbor_map_size(item), sizeof(uint64_t));
 	if (c->name == NULL || c->value == NULL)
 		return (-1);
 
 	return (cbor_map_iter(item, c, decode_cert));
 }
 
+/*
+ * Transports, algorithms and certifications are not needed to open a
+ * device, and take the most allocations to decode; they are decoded
+ * from the retained reply when first asked for, under a lock, so that
+ * a const fido_cbor_info_t may be read by several threads at once.
+ */
 static int
-parse_reply_element(const cbor_item_t *key, const cbor_item_t *val, void *arg)
+decode_info_transports(const cbor_item_t *val, void *arg)
 {
 	fido_cbor_info_t *ci = arg;
-	uint64_t x;
 
-	if (cbor_isa_uint(key) == false ||
-	    cbor_int_get_width(key) != CBOR_INT_8) {
-		fido_log_debug("%s: cbor type", __func__);
-		return (0); /* ignore */
+	return (decode_string_array(val, &ci->transports));
+}
+
+static int
+decode_info_algorithms(const cbor_item_t *val, void *arg)
+{
+	fido_cbor_info_t *ci = arg;
+
+	return (decode_algorithms(val, &ci->algorithms));
+}
+
+static int
+decode_info_certs(const cbor_item_t *val, void *arg)
+{
+	fido_cbor_info_t *ci = arg;
+
+	return (decode_certs(val, &ci->certs));
+}
+
+/* the remaining keys were decoded already */
+static const cbor_key_decoder_t info_deferred_reply[] = {
+	{ 9, decode_info_transports },		/* transports */
+	{ 10, decode_info_algorithms },		/* algorithms */
+	{ 19, decode_info_certs },		/* certifications */
+};
+
+static void
+info_decode_deferred(const fido_cbor_info_t *cci)
+{
+	/* every fido_cbor_info_t is allocated by fido_cbor_info_new() */
+	fido_cbor_info_t *ci = (fido_cbor_info_t *)(uintptr_t)cci;
+
+	INFO_LOCK();
+	if (ci->deferred == false)
+		goto out;
+	ci->deferred = false;
+	if (cbor_parse_reply_keys(ci->raw.ptr, ci->raw.len, ci,
+	    info_deferred_reply, nitems(info_deferred_reply)) != FIDO_OK) {
+		fido_log_debug("%s: cbor_parse_reply_keys", __func__);
+		fido_str_array_free(&ci->transports);
+		fido_algo_array_free(&ci->algorithms);
+		fido_cert_array_free(&ci->certs);
 	}
+	fido_blob_reset(&ci->raw);
+out:
+	INFO_UNLOCK();
+}
 
-	switch (cbor_get_uint8(key)) {
-	case 1: /* versions */
-		return (decode_string_array(val, &ci->versions));
-	case 2: /* extensions */
-		return (decode_string_array(val, &ci->extensions));
-	case 3: /* aaguid */
-		return (decode_aaguid(val, ci->aaguid, sizeof(ci->aaguid)));
-	case 4: /* options */
-		return (decode_options(val, &ci->options));
-	case 5: /* maxMsgSize */
-		return (cbor_decode_uint64(val, &ci->maxmsgsiz));
-	case 6: /* pinProtocols */
-		return (decode_protocols(val, &ci->protocols));
-	case 7: /* maxCredentialCountInList */
-		return (cbor_decode_uint64(val, &ci->maxcredcntlst));
-	case 8: /* maxCredentialIdLength */
-		return (cbor_decode_uint64(val, &ci->maxcredidlen));
-	case 9: /* transports */
-		return (decode_string_array(val, &ci->transports));
-	case 10: /* algorithms */
-		return (decode_algorithms(val, &ci->algorithms));
-	case 11: /* maxSerializedLargeBlobArray */
-		return (cbor_decode_uint64(val, &ci->maxlargeblob));
-	case 12: /* forcePINChange */
-		return (cbor_decode_bool(val, &ci->new_pin_reqd));
-	case 13: /* minPINLength */
-		return (cbor_decode_uint64(val, &ci->minpinlen));
-	case 14: /* fwVersion */
-		return (cbor_decode_uint64(val, &ci->fwversion));
-	case 15: /* maxCredBlobLen */
-		return (cbor_decode_uint64(val, &ci->maxcredbloblen));
-	case 16: /* maxRPIDsForSetMinPINLength */
-		return (cbor_decode_uint64(val, &ci->maxrpid_minlen));
-	case 17: /* preferredPlatformUvAttempts */
-		return (cbor_decode_uint64(val, &ci->uv_attempts));
-	case 18: /* uvModality */
-		return (cbor_decode_uint64(val, &ci->uv_modality));
-	case 19: /* certifications */
-		return (decode_certs(val, &ci->certs));
-	case 20: /* remainingDiscoverableCredentials */
-		if (cbor_decode_uint64(val, &x) < 0 || x > INT64_MAX) {
-			fido_log_debug("%s: cbor_decode_uint64", __func__);
-			return (-1);
-		}
-		ci->rk_remaining = (int64_t)x;
-		return (0);
-	default: /* ignore */
-		fido_log_debug("%s: cbor type: 0x%02x", __func__, cbor_get_uint8(key));
-		return (0);
+static int
+decode_info_versions(const cbor_item_t *val, void *arg)
+{
+	fido_cbor_info_t *ci = arg;
+
+	return (decode_string_array(val, &ci->versions));
+}
+
+static int
+decode_info_extensions(const cbor_item_t *val, void *arg)
+{
+	fido_cbor_info_t *ci = arg;
+
+	return (decode_string_array(val, &ci->extensions));
+}
+
+static int
+decode_info_aaguid(const cbor_item_t *val, void *arg)
+{
+	fido_cbor_info_t *ci = arg;
+
+	return (decode_aaguid(val, ci->aaguid, sizeof(ci->aaguid)));
+}
+
+static int
+decode_info_options(const cbor_item_t *val, void *arg)
+{
+	fido_cbor_info_t *ci = arg;
+
+	return (decode_options(val, &ci->options));
+}
+
+static int
+decode_info_protocols(const cbor_item_t *val, void *arg)
+{
+	fido_cbor_info_t *ci = arg;
+
+	return (decode_protocols(val, &ci->protocols));
+}
+
+static int
+decode_info_new_pin_reqd(const cbor_item_t *val, void *arg)
+{
+	fido_cbor_info_t *ci = arg;
+
+	return (cbor_decode_bool(val, &ci->new_pin_reqd));
+}
+
+static int
+decode_info_rk_remaining(const cbor_item_t *val, void *arg)
+{
+	fido_cbor_info_t	*ci = arg;
+	uint64_t		 x;
+
+	if (cbor_decode_uint64(val, &x) < 0 || x > INT64_MAX) {
+		fido_log_debug("%s: cbor_decode_uint64", __func__);
+		return (-1);
 	}
+	ci->rk_remaining = (int64_t)x;
+
+	return (0);
 }
 
+#define INFO_UINT64(f) \
+static int \
+decode_info_##f(const cbor_item_t *val, void *arg) \
+{ \
+	fido_cbor_info_t *ci = arg; \
+\
+	return (cbor_decode_uint64(val, &ci->f)); \
+}
+
+INFO_UINT64(maxmsgsiz)
+INFO_UINT64(maxcredcntlst)
+INFO_UINT64(maxcredidlen)
+INFO_UINT64(maxlargeblob)
+INFO_UINT64(minpinlen)
+INFO_UINT64(fwversion)
+INFO_UINT64(maxcredbloblen)
+INFO_UINT64(maxrpid_minlen)
+INFO_UINT64(uv_attempts)
+INFO_UINT64(uv_modality)
+
+/* entries with no decoder are decoded when first asked for */
+static const cbor_key_decoder_t info_reply[] = {
+	{ 1, decode_info_versions },		/* versions */
+	{ 2, decode_info_extensions },		/* extensions */
+	{ 3, decode_info_aaguid },		/* aaguid */
+	{ 4, decode_info_options },		/* options */
+	{ 5, decode_info_maxmsgsiz },		/* maxMsgSize */
+	{ 6, decode_info_protocols },		/* pinProtocols */
+	{ 7, decode_info_maxcredcntlst },	/* maxCredentialCountInList */
+	{ 8, decode_info_maxcredidlen },	/* maxCredentialIdLength */
+	{ 9, NULL },				/* transports */
+	{ 10, NULL },				/* algorithms */
+	{ 11, decode_info_maxlargeblob }, /* maxSerializedLargeBlobArray */
+	{ 12, decode_info_new_pin_reqd },	/* forcePINChange */
+	{ 13, decode_info_minpinlen },		/* minPINLength */
+	{ 14, decode_info_fwversion },		/* fwVersion */
+	{ 15, decode_info_maxcredbloblen },	/* maxCredBlobLen */
+	{ 16, decode_info_maxrpid_minlen },	/* maxRPIDsForSetMinPINLength */
+	{ 17, decode_info_uv_attempts }, /* preferredPlatformUvAttempts */
+	{ 18, decode_info_uv_modality },	/* uvModality */
+	{ 19, NULL },				/* certifications */
+	{ 20, decode_info_rk_remaining }, /* remainingDiscoverableCredentials */
+};
+
 static int
+info_parse(fido_cbor_info_t *ci, const unsigned char *msg, size_t msglen)
+{
+	if (fido_blob_set(&ci->raw, msg, msglen) < 0) {
+		fido_log_debug("%s: fido_blob_set", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+	ci->deferred = true;
+
+	return (cbor_parse_reply_keys(msg, msglen, ci, info_reply,
+	    nitems(info_reply)));
+}
+
+int
 fido_dev_get_cbor_info_tx(fido_dev_t *dev, int *ms)
 {
 	const unsigned char cbor[] = { CTAP_CBOR_GETINFO };
@@ -358,36 +495,62 @@ fido_dev_get_cbor_info_tx(fido_dev_t *dev, int *ms)
 	return (FIDO_OK);
 }
 
-static int
-fido_dev_get_cbor_info_rx(fido_dev_t *dev, fido_cbor_info_t *ci, int *ms)
+int
+fido_dev_get_cbor_info_rx(fido_dev_t *dev, fido_cbor_info_t *ci,
+    fido_blob_t *reply, int *ms)
 {
-	unsigned char	*msg;
-	int		 msglen;
-	int		 r;
+	const unsigned char	*msg;
+	size_t			 msgsiz;
+	int			 msglen;
+	int			 r;
 
 	fido_log_debug("%s: dev=%p, ci=%p, ms=%d", __func__, (void *)dev,
 	    (void *)ci, *ms);
 
 	fido_cbor_info_reset(ci);
 
-	if ((msg = malloc(FIDO_MAXMSG)) == NULL) {
-		r = FIDO_ERR_INTERNAL;
+	if ((msglen = fido_rx_msg(dev, CTAP_CMD_CBOR, FIDO_MAXMSG, &msg,
+	    &msgsiz, ms)) < 0) {
+		fido_log_debug("%s: fido_rx_msg", __func__);
+		r = FIDO_ERR_RX;
 		goto out;
 	}
 
-	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, FIDO_MAXMSG, ms)) < 0) {
-		fido_log_debug("%s: fido_rx", __func__);
-		r = FIDO_ERR_RX;
+	if (reply != NULL && fido_blob_set(reply, msg, (size_t)msglen) < 0) {
+		fido_log_debug("%s: fido_blob_set", __func__);
+		r = FIDO_ERR_INTERNAL;
 		goto out;
 	}
 
-	r = cbor_parse_reply(msg, (size_t)msglen, ci, parse_reply_element);
+	r = info_parse(ci, msg, (size_t)msglen);
 out:
-	freezero(msg, FIDO_MAXMSG);
+	fido_rx_msg_put(dev, msg, msgsiz);
 
 	return (r);
 }
 
+/* same as fido_dev_get_cbor_info_wait(), also returning the raw reply */
+int
+fido_dev_get_cbor_info_reply(fido_dev_t *dev, fido_cbor_info_t *ci,
+    fido_blob_t *reply, int *ms)
+{
+	int r;
+
+	if ((r = fido_dev_get_cbor_info_tx(dev, ms)) != FIDO_OK ||
+	    (r = fido_dev_get_cbor_info_rx(dev, ci, reply, ms)) != FIDO_OK)
+		return (r);
+
+	return (FIDO_OK);
+}
+
+int
+fido_cbor_info_decode(fido_cbor_info_t *ci, const fido_blob_t *reply)
+{
+	fido_cbor_info_reset(ci);
+
+	return (info_parse(ci, reply->ptr, reply->len));
+}
+
 int
 fido_dev_get_cbor_info_wait(fido_dev_t *dev, fido_cbor_info_t *ci, int *ms)
 {
@@ -398,7 +561,7 @@ fido_dev_get_cbor_info_wait(fido_dev_t *dev, fido_cbor_info_t *ci, int *ms)
 		return (fido_winhello_get_cbor_info(dev, ci));
 #endif
 	if ((r = fido_dev_get_cbor_info_tx(dev, ms)) != FIDO_OK ||
-	    (r = fido_dev_get_cbor_info_rx(dev, ci, ms)) != FIDO_OK)
+	    (r = fido_dev_get_cbor_info_rx(dev, ci, NULL, ms)) != FIDO_OK)
 		return (r);
 
 	return (FIDO_OK);
@@ -407,9 +570,33 @@ fido_dev_get_cbor_info_wait(fido_dev_t *dev, fido_cbor_info_t *ci, int *ms)
 int
 fido_dev_get_cbor_info(fido_dev_t *dev, fido_cbor_info_t *ci)
 {
-	int ms = dev->timeout_ms;
+	fido_blob_t	reply;
+	int		ms = dev->timeout_ms;
+	bool		lead = false;
+	int		r;
 
-	return (fido_dev_get_cbor_info_wait(dev, ci, &ms));
+	memset(&reply, 0, sizeof(reply));
+
+	/* share the reply with threads asking at the same time */
+	if ((dev->flags & FIDO_DEV_WINHELLO) == 0 &&
+	    fido_sched_join(dev, FIDO_SCHED_INFO, NULL, &reply, &r, &lead)) {
+		if (r == FIDO_OK)
+			r = fido_cbor_info_decode(ci, &reply);
+		fido_blob_reset(&reply);
+		return (r);
+	}
+
+	fido_sched_enter(dev);
+	if (lead) {
+		r = fido_dev_get_cbor_info_reply(dev, ci, &reply, &ms);
+		fido_sched_publish(dev, FIDO_SCHED_INFO, reply.ptr, reply.len,
+		    r);
+	} else
+		r = fido_dev_get_cbor_info_wait(dev, ci, &ms);
+	fido_sched_leave(dev);
+	fido_blob_reset(&reply);
+
+	return (r);
 }
 
 /*
@@ -421,7 +608,7 @@ fido_cbor_info_new(void)
 {
 	fido_cbor_info_t *ci;
 
-	if ((ci = calloc(1, sizeof(fido_cbor_info_t))) == NULL)
+	if ((ci = fido_calloc(1, sizeof(fido_cbor_info_t))) == NULL)
 		return (NULL);
 
 	fido_cbor_info_reset(ci);
@@ -439,6 +626,8 @@ fido_cbor_info_reset(fido_cbor_info_t *ci)
 	fido_byte_array_free(&ci->protocols);
 	fido_algo_array_free(&ci->algorithms);
 	fido_cert_array_free(&ci->certs);
+	fido_blob_reset(&ci->raw);
+	ci->deferred = false;
 	ci->rk_remaining = -1;
 }
 
@@ -450,7 +639,7 @@ fido_cbor_info_free(fido_cbor_info_t **ci_p)
 	if (ci_p == NULL || (ci = *ci_p) ==  NULL)
 		return;
 	fido_cbor_info_reset(ci);
-	free(ci);
+	fido_free(ci);
 	*ci_p = NULL;
 }
 
@@ -481,12 +670,16 @@ fido_cbor_info_extensions_len(const fido_cbor_info_t *ci)
 char **
 fido_cbor_info_transports_ptr(const fido_cbor_info_t *ci)
 {
+	info_decode_deferred(ci);
+
 	return (ci->transports.ptr);
 }
 
 size_t
 fido_cbor_info_transports_len(const fido_cbor_info_t *ci)
 {
+	info_decode_deferred(ci);
+
 	return (ci->transports.len);
 }
 
@@ -601,12 +794,16 @@ fido_cbor_info_protocols_len(const fido_cbor_info_t *ci)
 size_t
 fido_cbor_info_algorithm_count(const fido_cbor_info_t *ci)
 {
+	info_decode_deferred(ci);
+
 	return (ci->algorithms.len);
 }
 
 const char *
 fido_cbor_info_algorithm_type(const fido_cbor_info_t *ci, size_t idx)
 {
+	info_decode_deferred(ci);
+
 	if (idx >= ci->algorithms.len)
 		return (NULL);
 
@@ -616,6 +813,8 @@ fido_cbor_info_algorithm_type(const fido_cbor_info_t *ci, size_t idx)
 int
 fido_cbor_info_algorithm_cose(const fido_cbor_info_t *ci, size_t idx)
 {
+	info_decode_deferred(ci);
+
 	if (idx >= ci->algorithms.len)
 		return (0);
 
@@ -631,17 +830,23 @@ fido_cbor_info_new_pin_required(const fido_cbor_info_t *ci)
 char **
 fido_cbor_info_certs_name_ptr(const fido_cbor_info_t *ci)
 {
+	info_decode_deferred(ci);
+
 	return (ci->certs.name);
 }
 
 const uint64_t *
 fido_cbor_info_certs_value_ptr(const fido_cbor_info_t *ci)
 {
+	info_decode_deferred(ci);
+
 	return (ci->certs.value);
 }
 
 size_t
 fido_cbor_info_certs_len(const fido_cbor_info_t *ci)
 {
+	info_decode_deferred(ci);
+
 	return (ci->certs.len);
 }
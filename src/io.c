@@ -5,8 +5,14 @@
  * SPDX-License-Identifier: BSD-2-Clause
  */
 
+#ifndef _WIN32
+#include <errno.h>
+#include <poll.h>
+#endif
+
 #include "fido.h"
 #include "packed.h"
+#include "probe.h"
 
 PACKED_TYPE(frame_t,
 struct frame {
@@ -30,25 +36,43 @@ struct frame {
 #define MIN(x, y) ((x) > (y) ? (y) : (x))
 #endif
 
+#ifndef MAX
+#define MAX(x, y) ((x) > (y) ? (x) : (y))
+#endif
+
+/*
+ * Copy n bytes of a frame's payload, where full is the payload of a
+ * frame of CTAP_MAX_REPORT_LEN bytes. Nearly every device uses reports
+ * of that size, and every frame but the last of a message is full, so
+ * most copies take the constant-size branch, which the compiler unrolls.
+ */
+#define FRAME_COPY(dst, src, n, full)				\
+	((n) == (full) ? memcpy((dst), (src), (full)) :		\
+	    memcpy((dst), (src), (n)))
+
+struct rx_wait {
+	int	class;  /* FIDO_TIMEOUT_* of the report awaited */
+	int	max_ms; /* longest wait before user presence, if adaptive */
+};
+
+/*
+ * Writes are not bounded by a timeout; the time they take is accounted
+ * for by the deadline of the exchange, in fido_tx().
+ */
 static int
-tx_pkt(fido_dev_t *d, const void *pkt, size_t len, int *ms)
+tx_pkt(fido_dev_t *d, const void *pkt, size_t len)
 {
-	struct timespec ts;
 	int n;
 
-	if (fido_time_now(&ts) != 0)
-		return (-1);
-
 	n = d->io.write(d->io_handle, pkt, len);
-
-	if (fido_time_delta(&ts, ms) != 0)
-		return (-1);
+	FIDO_PROBE3(hid__write, (void *)d, len, n);
+	fido_trace(d, FIDO_TRACE_TX, d->trace_cmd, len, n);
 
 	return (n);
 }
 
 static int
-tx_empty(fido_dev_t *d, uint8_t cmd, int *ms)
+tx_empty(fido_dev_t *d, uint8_t cmd)
 {
 	struct frame	*fp;
 	unsigned char	 pkt[sizeof(*fp) + 1];
@@ -60,7 +84,7 @@ tx_empty(fido_dev_t *d, uint8_t cmd, int *ms)
 	fp->cid = d->cid;
 	fp->body.init.cmd = CTAP_FRAME_INIT | cmd;
 
-	if (len > sizeof(pkt) || (n = tx_pkt(d, pkt, len, ms)) < 0 ||
+	if (len > sizeof(pkt) || (n = tx_pkt(d, pkt, len)) < 0 ||
 	    (size_t)n != len)
 		return (-1);
 
@@ -68,26 +92,31 @@ tx_empty(fido_dev_t *d, uint8_t cmd, int *ms)
 }
 
 static size_t
-tx_preamble(fido_dev_t *d, uint8_t cmd, const void *buf, size_t count, int *ms)
+tx_preamble(fido_dev_t *d, uint8_t cmd, const void *buf, size_t count)
 {
 	struct frame	*fp;
 	unsigned char	 pkt[sizeof(*fp) + 1];
 	const size_t	 len = d->tx_len + 1;
+	size_t		 room;
 	int		 n;
 
-	if (d->tx_len - CTAP_INIT_HEADER_LEN > sizeof(fp->body.init.data))
+	if ((room = d->tx_len - CTAP_INIT_HEADER_LEN) >
+	    sizeof(fp->body.init.data))
 		return (0);
 
-	memset(&pkt, 0, sizeof(pkt));
+	pkt[0] = 0; /* report id */
 	fp = (struct frame *)(pkt + 1);
 	fp->cid = d->cid;
 	fp->body.init.cmd = CTAP_FRAME_INIT | cmd;
 	fp->body.init.bcnth = (count >> 8) & 0xff;
 	fp->body.init.bcntl = count & 0xff;
-	count = MIN(count, d->tx_len - CTAP_INIT_HEADER_LEN);
-	memcpy(&fp->body.init.data, buf, count);
+	count = MIN(count, room);
+	FRAME_COPY(fp->body.init.data, buf, count,
+	    sizeof(fp->body.init.data));
+	/* only the padding of a short frame is zeroed */
+	memset(fp->body.init.data + count, 0, room - count);
 
-	if (len > sizeof(pkt) || (n = tx_pkt(d, pkt, len, ms)) < 0 ||
+	if (len > sizeof(pkt) || (n = tx_pkt(d, pkt, len)) < 0 ||
 	    (size_t)n != len)
 		return (0);
 
@@ -95,24 +124,28 @@ tx_preamble(fido_dev_t *d, uint8_t cmd, const void *buf, size_t count, int *ms)
 }
 
 static size_t
-tx_frame(fido_dev_t *d, uint8_t seq, const void *buf, size_t count, int *ms)
+tx_frame(fido_dev_t *d, uint8_t seq, const void *buf, size_t count)
 {
 	struct frame	*fp;
 	unsigned char	 pkt[sizeof(*fp) + 1];
 	const size_t	 len = d->tx_len + 1;
+	size_t		 room;
 	int		 n;
 
-	if (d->tx_len - CTAP_CONT_HEADER_LEN > sizeof(fp->body.cont.data))
+	if ((room = d->tx_len - CTAP_CONT_HEADER_LEN) >
+	    sizeof(fp->body.cont.data))
 		return (0);
 
-	memset(&pkt, 0, sizeof(pkt));
+	pkt[0] = 0; /* report id */
 	fp = (struct frame *)(pkt + 1);
 	fp->cid = d->cid;
 	fp->body.cont.seq = seq;
-	count = MIN(count, d->tx_len - CTAP_CONT_HEADER_LEN);
-	memcpy(&fp->body.cont.data, buf, count);
+	count = MIN(count, room);
+	FRAME_COPY(fp->body.cont.data, buf, count,
+	    sizeof(fp->body.cont.data));
+	memset(fp->body.cont.data + count, 0, room - count);
 
-	if (len > sizeof(pkt) || (n = tx_pkt(d, pkt, len, ms)) < 0 ||
+	if (len > sizeof(pkt) || (n = tx_pkt(d, pkt, len)) < 0 ||
 	    (size_t)n != len)
 		return (0);
 
@@ -120,11 +153,11 @@ tx_frame(fido_dev_t *d, uint8_t seq, const void *buf, size_t count, int *ms)
 }
 
 static int
-tx(fido_dev_t *d, uint8_t cmd, const unsigned char *buf, size_t count, int *ms)
+tx(fido_dev_t *d, uint8_t cmd, const unsigned char *buf, size_t count)
 {
 	size_t n, sent;
 
-	if ((sent = tx_preamble(d, cmd, buf, count, ms)) == 0) {
+	if ((sent = tx_preamble(d, cmd, buf, count)) == 0) {
 		fido_log_debug("%s: tx_preamble", __func__);
 		return (-1);
 	}
@@ -134,8 +167,8 @@ tx(fido_dev_t *d, uint8_t cmd, const unsigned char *buf, size_t count, int *ms)
 			fido_log_debug("%s: seq & 0x80", __func__);
 			return (-1);
 		}
-		if ((n = tx_frame(d, seq++, buf + sent, count - sent,
-		    ms)) == 0) {
+		if ((n = tx_frame(d, seq++, buf + sent,
+		    count - sent)) == 0) {
 			fido_log_debug("%s: tx_frame", __func__);
 			return (-1);
 		}
@@ -144,73 +177,348 @@ tx(fido_dev_t *d, uint8_t cmd, const unsigned char *buf, size_t count, int *ms)
 	return (0);
 }
 
+/*
+ * Assemble every report of a message into one buffer and hand it to
+ * writev in a single call.
+ */
 static int
-transport_tx(fido_dev_t *d, uint8_t cmd, const void *buf, size_t count, int *ms)
+tx_reports(fido_dev_t *d, fido_dev_io_writev_t *io_writev, uint8_t cmd,
+    const unsigned char *buf, size_t count)
 {
-	struct timespec ts;
-	int n;
+	struct frame	*fp;
+	unsigned char	*pkt = NULL;
+	const size_t	 len = d->tx_len + 1;
+	size_t		 init, cont, npkt, n, sent;
+	int		 w, r = -1;
 
-	if (fido_time_now(&ts) != 0)
+	if (d->tx_len <= CTAP_INIT_HEADER_LEN ||
+	    d->tx_len > CTAP_MAX_REPORT_LEN) {
+		fido_log_debug("%s: tx_len=%zu", __func__, d->tx_len);
+		return (-1);
+	}
+
+	init = d->tx_len - CTAP_INIT_HEADER_LEN;
+	cont = d->tx_len - CTAP_CONT_HEADER_LEN;
+	npkt = 1;
+	if (count > init)
+		npkt += (count - init + cont - 1) / cont;
+	if (npkt > 0x80 + 1) {
+		fido_log_debug("%s: count=%zu", __func__, count);
+		return (-1);
+	}
+	if ((pkt = fido_calloc_as(FIDO_MEM_IO, npkt, len)) == NULL)
 		return (-1);
 
+	fp = (struct frame *)(pkt + 1);
+	fp->cid = d->cid;
+	fp->body.init.cmd = CTAP_FRAME_INIT | cmd;
+	fp->body.init.bcnth = (count >> 8) & 0xff;
+	fp->body.init.bcntl = count & 0xff;
+	sent = MIN(count, init);
+	FRAME_COPY(fp->body.init.data, buf, sent, sizeof(fp->body.init.data));
+
+	for (uint8_t seq = 0; sent < count; sent += n) {
+		fp = (struct frame *)(pkt + (seq + 1) * len + 1);
+		fp->cid = d->cid;
+		fp->body.cont.seq = seq++;
+		n = MIN(count - sent, cont);
+		FRAME_COPY(fp->body.cont.data, buf + sent, n,
+		    sizeof(fp->body.cont.data));
+	}
+
+	w = io_writev(d->io_handle, pkt, len, npkt);
+	FIDO_PROBE3(hid__write, (void *)d, npkt * len, w);
+	fido_trace(d, FIDO_TRACE_TX, cmd, npkt * len, w);
+	if (w < 0 || (size_t)w != npkt * len) {
+		fido_log_debug("%s: writev npkt=%zu", __func__, npkt);
+		goto fail;
+	}
+
+	r = 0;
+fail:
+	fido_freezero(pkt, npkt * len);
+
+	return (r);
+}
+
+static fido_dev_io_writev_t *
+tx_writev(const fido_dev_t *d)
+{
+	if (d->io_writev != NULL)
+		return (d->io_writev);
+	if (d->io.write == fido_hid_write)
+		return (fido_hid_writev);
+#ifdef USE_BROKER
+	if (d->io.write == fido_broker_write)
+		return (fido_broker_writev);
+#endif
+
+	return (NULL);
+}
+
+static int
+transport_tx(fido_dev_t *d, uint8_t cmd, const void *buf, size_t count)
+{
+	int n;
+
 	n = d->transport.tx(d, cmd, buf, count);
+	fido_trace(d, FIDO_TRACE_TX, cmd, count, n);
+
+	return (n);
+}
+
+/*
+ * Charge the time spent since the exchange began, which ends at dl, to
+ * the caller's budget.
+ */
+static int
+io_time_left(const struct timespec *dl, int *ms)
+{
+	int left;
 
-	if (fido_time_delta(&ts, ms) != 0)
+	if (*ms < 0)
+		return (0);
+	if (fido_time_left(dl, &left) != 0)
 		return (-1);
+	if (left == 0 && *ms > 0)
+		fido_trace(NULL, FIDO_TRACE_TIMEOUT, 0, 0, *ms);
+	*ms = left;
 
-	return (n);
+	return (0);
+}
+
+static int rx_frame(fido_dev_t *, struct frame *, int);
+
+/*
+ * A wait cut short by fido_dev_cancel() may leave the authenticator's
+ * reply to the cancelled message to arrive later. Before the next
+ * message, the channel is synchronised with CTAPHID_INIT, and frames are
+ * discarded until its reply.
+ */
+static int
+tx_resync(fido_dev_t *d, const struct timespec *dl)
+{
+	struct frame	f;
+	uint64_t	nonce;
+	int		ms, r;
+
+	d->rx_stale = false;
+	if (fido_get_random(&nonce, sizeof(nonce)) < 0) {
+		fido_log_debug("%s: fido_get_random", __func__);
+		return (-1);
+	}
+	fido_mux_lock(d);
+	r = tx(d, CTAP_CMD_INIT, (const unsigned char *)&nonce, sizeof(nonce));
+	fido_mux_unlock(d);
+	if (r < 0) {
+		fido_log_debug("%s: tx", __func__);
+		return (-1);
+	}
+	for (;;) {
+		if (fido_time_left(dl, &ms) != 0 || rx_frame(d, &f, ms) < 0) {
+			fido_log_debug("%s: rx_frame", __func__);
+			return (-1);
+		}
+		if (f.cid == d->cid &&
+		    f.body.init.cmd == (CTAP_FRAME_INIT | CTAP_CMD_INIT) &&
+		    memcmp(f.body.init.data, &nonce, sizeof(nonce)) == 0)
+			return (0);
+		fido_log_debug("%s: discarding frame", __func__);
+	}
 }
 
 int
 fido_tx(fido_dev_t *d, uint8_t cmd, const void *buf, size_t count, int *ms)
 {
-	fido_log_debug("%s: dev=%p, cmd=0x%02x", __func__, (void *)d, cmd);
-	fido_log_xxd(buf, count, "%s", __func__);
+	fido_dev_io_writev_t	*io_writev;
+	struct timespec		 dl;
+	int			 r;
+
+	fido_log_io_debug("%s: dev=%p, cmd=0x%02x", __func__, (void *)d, cmd);
+	fido_log_io_xxd(buf, count, "%s", __func__);
+
+	d->trace_cmd = cmd;
+	d->trace_cbor = cmd == CTAP_CMD_CBOR && count > 0 ?
+	    ((const uint8_t *)buf)[0] : 0;
+	d->trace_bytes += count;
+	FIDO_PROBE3(tx__start, (void *)d, cmd, count);
+	fido_trace(d, FIDO_TRACE_CMD_START, cmd, count, FIDO_OK);
+	if (d->keepalive_cb != NULL && cmd != CTAP_CMD_CANCEL) {
+		if (fido_time_now(&d->keepalive_ts) != 0)
+			return (-1);
+		d->keepalive_cancel = false;
+	}
 
-	if (d->transport.tx != NULL)
-		return (transport_tx(d, cmd, buf, count, ms));
-	if (d->io_handle == NULL || d->io.write == NULL || count > UINT16_MAX) {
+	if (d->transport.tx == NULL && (d->io_handle == NULL ||
+	    d->io.write == NULL || count > UINT16_MAX)) {
 		fido_log_debug("%s: invalid argument", __func__);
 		return (-1);
 	}
+	if (fido_time_deadline(&dl, *ms) != 0)
+		return (-1);
 
-	return (count == 0 ? tx_empty(d, cmd, ms) : tx(d, cmd, buf, count, ms));
+	/* a cancellation ends with the message it was sent for */
+	if (d->wakeup != NULL && cmd != CTAP_CMD_CANCEL) {
+		fido_wakeup_clear(d->wakeup);
+		if (d->rx_stale && tx_resync(d, &dl) < 0)
+			return (-1);
+	}
+
+	if (d->transport.tx != NULL)
+		r = transport_tx(d, cmd, buf, count);
+	else {
+		fido_mux_lock(d);
+		if (count == 0)
+			r = tx_empty(d, cmd);
+		else if ((io_writev = tx_writev(d)) != NULL)
+			r = tx_reports(d, io_writev, cmd, buf, count);
+		else
+			r = tx(d, cmd, buf, count);
+		fido_mux_unlock(d);
+	}
+	if (r >= 0)
+		fido_record_tx(d, cmd, buf, count);
+
+	if (r >= 0 && io_time_left(&dl, ms) != 0)
+		return (-1);
+
+	return (r);
 }
 
+/* read a frame, waiting at most ms, or forever if ms is -1 */
 static int
-rx_frame(fido_dev_t *d, struct frame *fp, int *ms)
+rx_frame(fido_dev_t *d, struct frame *fp, int ms)
 {
-	struct timespec ts;
 	int n;
 
-	memset(fp, 0, sizeof(*fp));
+	if (d->rx_len > sizeof(*fp))
+		return (-1);
+	/* a report of CTAP_MAX_REPORT_LEN bytes fills the frame */
+	memset((unsigned char *)fp + d->rx_len, 0, sizeof(*fp) - d->rx_len);
+	if (d->mux != NULL)
+		n = fido_mux_read(d, (unsigned char *)fp, d->rx_len, ms);
+	else
+		n = d->io.read(d->io_handle, (unsigned char *)fp, d->rx_len,
+		    ms);
+	FIDO_PROBE3(hid__read, (void *)d, d->rx_len, n);
+	fido_trace(d, FIDO_TRACE_RX, d->trace_cmd, d->rx_len, n);
+	if (n < 0 || (size_t)n != d->rx_len) {
+		if (d->wakeup != NULL && fido_wakeup_pending(d->wakeup))
+			d->rx_stale = true;
+		return (-1);
+	}
+
+	return (0);
+}
 
-	if (fido_time_now(&ts) != 0)
+/*
+ * Report a keepalive to the device's callback. If the callback asks for
+ * the message in flight to be cancelled, CTAPHID_CANCEL is sent once; the
+ * authenticator then replies with CTAP2_ERR_KEEPALIVE_CANCEL.
+ */
+static void
+rx_keepalive(fido_dev_t *d, uint8_t cmd, uint8_t status)
+{
+	struct timespec	now, delta;
+	int		elapsed = -1;
+
+	FIDO_PROBE3(keepalive, (void *)d, cmd, status);
+	fido_trace(d, FIDO_TRACE_KEEPALIVE, cmd, 0, status);
+	if (status == FIDO_KEEPALIVE_UPNEEDED)
+		fido_trace_up_begin(d);
+
+	if (d->keepalive_cb == NULL)
+		return;
+	if (fido_time_now(&now) == 0 &&
+	    timespeccmp(&now, &d->keepalive_ts, >=)) {
+		timespecsub(&now, &d->keepalive_ts, &delta);
+		if (delta.tv_sec < INT_MAX / 1000)
+			elapsed = (int)(delta.tv_sec * 1000 +
+			    delta.tv_nsec / 1000000);
+		else
+			elapsed = INT_MAX;
+	}
+	if (d->keepalive_cb(d->keepalive_arg, status, elapsed) == 0 ||
+	    d->keepalive_cancel)
+		return;
+
+	d->keepalive_cancel = true;
+	fido_mux_lock(d);
+	if (tx_empty(d, CTAP_CMD_CANCEL) < 0)
+		fido_log_debug("%s: tx_empty", __func__);
+	fido_mux_unlock(d);
+}
+
+static int
+rx_class(const fido_dev_t *d, uint8_t cmd)
+{
+	if (cmd == CTAP_CMD_INIT)
+		return (FIDO_TIMEOUT_INIT);
+	if (cmd == CTAP_CMD_CBOR && d->trace_cbor == CTAP_CBOR_GETINFO)
+		return (FIDO_TIMEOUT_INFO);
+
+	return (FIDO_TIMEOUT_CBOR);
+}
+
+/*
+ * Read a frame, waiting no longer than the budget of w->class or until
+ * dl, whichever comes first.
+ */
+static int
+rx_frame_wait(fido_dev_t *d, struct frame *fp, const struct timespec *dl,
+    struct rx_wait *w)
+{
+	struct timespec	ts;
+	int		budget, ms, left = INT_MAX;
+	bool		limited, sample;
+
+	if (fido_time_left(dl, &ms) != 0)
+		return (-1);
+	budget = fido_dev_cmd_timeout(d, w->class);
+	if ((limited = budget >= 0 && (ms < 0 || budget < ms)))
+		ms = budget;
+	sample = d->rx_adaptive && w->class != FIDO_TIMEOUT_UP;
+	if (sample && fido_time_now(&ts) != 0)
 		return (-1);
 
-	if (d->rx_len > sizeof(*fp) || (n = d->io.read(d->io_handle,
-	    (unsigned char *)fp, d->rx_len, *ms)) < 0 || (size_t)n != d->rx_len)
+	if (rx_frame(d, fp, ms) < 0) {
+		if (limited) {
+			fido_log_debug("%s: class %d, budget %d ms expired",
+			    __func__, w->class, budget);
+			fido_dev_rx_expired(d, w->class);
+		}
 		return (-1);
+	}
+
+	if (sample && fido_time_delta(&ts, &left) == 0)
+		w->max_ms = MAX(w->max_ms, INT_MAX - left);
 
-	return (fido_time_delta(&ts, ms));
+	return (0);
 }
 
 static int
-rx_preamble(fido_dev_t *d, uint8_t cmd, struct frame *fp, int *ms)
+rx_preamble(fido_dev_t *d, uint8_t cmd, struct frame *fp,
+    const struct timespec *dl, struct rx_wait *w)
 {
 	do {
-		if (rx_frame(d, fp, ms) < 0)
+		if (rx_frame_wait(d, fp, dl, w) < 0)
 			return (-1);
 #ifdef FIDO_FUZZ
 		fp->cid = d->cid;
 #endif
+		if (fp->cid == d->cid &&
+		    fp->body.init.cmd == (CTAP_FRAME_INIT | CTAP_KEEPALIVE)) {
+			rx_keepalive(d, d->trace_cmd, fp->body.init.data[0]);
+			if (fp->body.init.data[0] == FIDO_KEEPALIVE_UPNEEDED)
+				w->class = FIDO_TIMEOUT_UP;
+		}
 	} while (fp->cid != d->cid || (fp->cid == d->cid &&
 	    fp->body.init.cmd == (CTAP_FRAME_INIT | CTAP_KEEPALIVE)));
 
 	if (d->rx_len > sizeof(*fp))
 		return (-1);
 
-	fido_log_xxd(fp, d->rx_len, "%s", __func__);
+	fido_log_io_xxd(fp, d->rx_len, "%s", __func__);
 #ifdef FIDO_FUZZ
 	fp->body.init.cmd = (CTAP_FRAME_INIT | cmd);
 #endif
@@ -225,10 +533,12 @@ rx_preamble(fido_dev_t *d, uint8_t cmd, struct frame *fp, int *ms)
 }
 
 static int
-rx(fido_dev_t *d, uint8_t cmd, unsigned char *buf, size_t count, int *ms)
+rx(fido_dev_t *d, uint8_t cmd, unsigned char *buf, size_t count,
+    const struct timespec *dl)
 {
 	struct frame f;
-	size_t r, payload_len, init_data_len, cont_data_len;
+	struct rx_wait w;
+	size_t n, r, payload_len, init_data_len, cont_data_len;
 
 	if (d->rx_len <= CTAP_INIT_HEADER_LEN ||
 	    d->rx_len <= CTAP_CONT_HEADER_LEN)
@@ -241,13 +551,16 @@ rx(fido_dev_t *d, uint8_t cmd, unsigned char *buf, size_t count, int *ms)
 	    cont_data_len > sizeof(f.body.cont.data))
 		return (-1);
 
-	if (rx_preamble(d, cmd, &f, ms) < 0) {
+	w.class = rx_class(d, cmd);
+	w.max_ms = 0;
+
+	if (rx_preamble(d, cmd, &f, dl, &w) < 0) {
 		fido_log_debug("%s: rx_preamble", __func__);
 		return (-1);
 	}
 
 	payload_len = (size_t)((f.body.init.bcnth << 8) | f.body.init.bcntl);
-	fido_log_debug("%s: payload_len=%zu", __func__, payload_len);
+	fido_log_io_debug("%s: payload_len=%zu", __func__, payload_len);
 
 	if (count < payload_len) {
 		fido_log_debug("%s: count < payload_len", __func__);
@@ -256,19 +569,25 @@ rx(fido_dev_t *d, uint8_t cmd, unsigned char *buf, size_t count, int *ms)
 
 	if (payload_len < init_data_len) {
 		memcpy(buf, f.body.init.data, payload_len);
+		fido_dev_rx_sample(d, rx_class(d, cmd), w.max_ms);
 		return ((int)payload_len);
 	}
 
-	memcpy(buf, f.body.init.data, init_data_len);
+	FRAME_COPY(buf, f.body.init.data, init_data_len,
+	    sizeof(f.body.init.data));
 	r = init_data_len;
 
 	for (int seq = 0; r < payload_len; seq++) {
-		if (rx_frame(d, &f, ms) < 0) {
+		if (rx_frame_wait(d, &f, dl, &w) < 0) {
 			fido_log_debug("%s: rx_frame", __func__);
 			return (-1);
 		}
 
-		fido_log_xxd(&f, d->rx_len, "%s", __func__);
+		if (d->mux != NULL && f.cid != d->cid) {
+			seq--; /* another channel's; queued for it */
+			continue;
+		}
+		fido_log_io_xxd(&f, d->rx_len, "%s", __func__);
 #ifdef FIDO_FUZZ
 		f.cid = d->cid;
 		f.body.cont.seq = (uint8_t)seq;
@@ -280,77 +599,472 @@ rx(fido_dev_t *d, uint8_t cmd, unsigned char *buf, size_t count, int *ms)
 			return (-1);
 		}
 
-		if (payload_len - r > cont_data_len) {
-			memcpy(buf + r, f.body.cont.data, cont_data_len);
-			r += cont_data_len;
-		} else {
-			memcpy(buf + r, f.body.cont.data, payload_len - r);
-			r += payload_len - r; /* break */
-		}
+		n = MIN(payload_len - r, cont_data_len);
+		FRAME_COPY(buf + r, f.body.cont.data, n,
+		    sizeof(f.body.cont.data));
+		r += n; /* breaks on the last frame */
 	}
 
+	fido_dev_rx_sample(d, rx_class(d, cmd), w.max_ms);
+
 	return ((int)r);
 }
 
 static int
-transport_rx(fido_dev_t *d, uint8_t cmd, void *buf, size_t count, int *ms)
+transport_rx(fido_dev_t *d, uint8_t cmd, void *buf, size_t count,
+    const struct timespec *dl)
 {
-	struct timespec ts;
-	int n;
+	int n, ms;
 
-	if (fido_time_now(&ts) != 0)
+	if (fido_time_left(dl, &ms) != 0)
 		return (-1);
 
-	n = d->transport.rx(d, cmd, buf, count, *ms);
-
-	if (fido_time_delta(&ts, ms) != 0)
-		return (-1);
+	n = d->transport.rx(d, cmd, buf, count, ms);
+	fido_trace(d, FIDO_TRACE_RX, cmd, count, n);
 
 	return (n);
 }
 
+static void
+trace_end(fido_dev_t *d, uint8_t cmd, const unsigned char *buf, int n)
+{
+	int r = FIDO_OK;
+
+	if (n < 0)
+		r = FIDO_ERR_RX;
+	else if (cmd == CTAP_CMD_CBOR && n > 0)
+		r = buf[0]; /* ctap2 status */
+
+	FIDO_PROBE3(rx__done, (void *)d, cmd, n);
+	if (n > 0)
+		d->trace_bytes += (size_t)n;
+	fido_trace(d, FIDO_TRACE_CMD_END, cmd, n < 0 ? 0 : (size_t)n, r);
+	fido_record_rx(d, cmd, buf, n);
+	if (cmd == CTAP_CMD_CBOR)
+		fido_trace_up_end(d, r);
+}
+
 int
 fido_rx(fido_dev_t *d, uint8_t cmd, void *buf, size_t count, int *ms)
 {
-	int n;
+	struct timespec	dl;
+	int		n;
 
-	fido_log_debug("%s: dev=%p, cmd=0x%02x, ms=%d", __func__, (void *)d,
+	fido_log_io_debug("%s: dev=%p, cmd=0x%02x, ms=%d", __func__, (void *)d,
 	    cmd, *ms);
 
-	if (d->transport.rx != NULL)
-		return (transport_rx(d, cmd, buf, count, ms));
-	if (d->io_handle == NULL || d->io.read == NULL || count > UINT16_MAX) {
+	if (d->transport.rx == NULL && (d->io_handle == NULL ||
+	    d->io.read == NULL || count > UINT16_MAX)) {
 		fido_log_debug("%s: invalid argument", __func__);
 		return (-1);
 	}
-	if ((n = rx(d, cmd, buf, count, ms)) >= 0)
-		fido_log_xxd(buf, (size_t)n, "%s", __func__);
+
+	if (fido_time_deadline(&dl, *ms) != 0)
+		n = -1;
+	else if (d->transport.rx != NULL)
+		n = transport_rx(d, cmd, buf, count, &dl);
+	else if ((n = rx(d, cmd, buf, count, &dl)) >= 0)
+		fido_log_io_xxd(buf, (size_t)n, "%s", __func__);
+	if (n >= 0 && io_time_left(&dl, ms) != 0)
+		n = -1;
+
+	trace_end(d, cmd, buf, n);
+
+	/* remember how much of rx_buf fido_rx_buf_put() has to wipe */
+	if (buf == d->rx_buf) {
+		if (n < 0)
+			d->rx_buf_used = MAX(d->rx_buf_used, count);
+		else
+			d->rx_buf_used = MAX(d->rx_buf_used, (size_t)n);
+	}
 
 	return (n);
 }
 
+/*
+ * Lend out dev's receive buffer, sized from the authenticator's
+ * maxMsgSize and holding at least min bytes. If the buffer is already
+ * lent out, a new one is allocated. Return it with fido_rx_buf_put().
+ */
+unsigned char *
+fido_rx_buf_get(fido_dev_t *d, size_t min, size_t *len)
+{
+	unsigned char	*buf;
+	size_t		 want = FIDO_MAXMSG;
+
+	/* the CTAPHID and ISO 7816 length fields are 16 bits wide */
+	if (d->maxmsgsize > want)
+		want = d->maxmsgsize > UINT16_MAX ? UINT16_MAX :
+		    (size_t)d->maxmsgsize;
+	if (min > want)
+		want = min;
+
+	if (d->rx_buf_busy) {
+		*len = want;
+		return (fido_malloc_as(FIDO_MEM_IO, want));
+	}
+	if (d->rx_buf_len < want) {
+		if ((buf = fido_calloc_as(FIDO_MEM_IO, 1, want)) == NULL)
+			return (NULL);
+		fido_free(d->rx_buf); /* wiped by fido_rx_buf_put() */
+		d->rx_buf = buf;
+		d->rx_buf_len = want;
+	}
+
+	*len = d->rx_buf_len;
+	d->rx_buf_used = 0;
+	d->rx_buf_busy = true;
+
+	return (d->rx_buf);
+}
+
+/* wipe and hand back a buffer obtained with fido_rx_buf_get() */
+void
+fido_rx_buf_put(fido_dev_t *d, unsigned char *buf, size_t len)
+{
+	if (buf == NULL)
+		return;
+	if (buf != d->rx_buf) {
+		fido_freezero(buf, len);
+		return;
+	}
+
+	explicit_bzero(buf, d->rx_buf_used);
+	d->rx_buf_used = 0;
+	d->rx_buf_busy = false;
+}
+
+static int
+transport_borrow(fido_dev_t *d, uint8_t cmd, const unsigned char **ptr,
+    size_t *len, const struct timespec *dl)
+{
+	int n, ms;
+
+	if (fido_time_left(dl, &ms) != 0)
+		return (-1);
+
+	*ptr = NULL;
+	*len = 0;
+	if (d->rx_borrow(d, cmd, ptr, len, ms) < 0 || *ptr == NULL)
+		n = -1;
+	else if (*len > INT_MAX) {
+		d->rx_release(d, *ptr, *len);
+		n = -1;
+	} else
+		n = (int)*len;
+	fido_trace(d, FIDO_TRACE_RX, cmd, n < 0 ? 0 : *len, n);
+
+	return (n);
+}
+
+/*
+ * Receive a reply of at most min bytes, or of dev's maxMsgSize if
+ * larger, and point *msg at it. If the transport lends out its own
+ * buffer, the reply is parsed where it lies; otherwise, it is read into a
+ * buffer from fido_rx_buf_get(). Either way, hand it back with
+ * fido_rx_msg_put(). Returns the length of the reply, or -1.
+ */
 int
-fido_rx_cbor_status(fido_dev_t *d, int *ms)
+fido_rx_msg(fido_dev_t *d, uint8_t cmd, size_t min, const unsigned char **msg,
+    size_t *msgsiz, int *ms)
 {
-	unsigned char	*msg;
-	int		 msglen;
-	int		 r;
+	unsigned char	*buf;
+	struct timespec	 dl;
+	int		 n;
 
-	if ((msg = malloc(FIDO_MAXMSG)) == NULL) {
-		r = FIDO_ERR_INTERNAL;
-		goto out;
+	*msg = NULL;
+	*msgsiz = 0;
+
+	if (d->rx_borrow == NULL) {
+		if ((buf = fido_rx_buf_get(d, min, msgsiz)) == NULL)
+			return (-1);
+		if ((n = fido_rx(d, cmd, buf, *msgsiz, ms)) < 0) {
+			fido_rx_buf_put(d, buf, *msgsiz);
+			*msgsiz = 0;
+			return (-1);
+		}
+		*msg = buf;
+		return (n);
+	}
+
+	fido_log_io_debug("%s: dev=%p, cmd=0x%02x, ms=%d", __func__, (void *)d,
+	    cmd, *ms);
+
+	if (fido_time_deadline(&dl, *ms) != 0)
+		n = -1;
+	else if ((n = transport_borrow(d, cmd, msg, msgsiz, &dl)) >= 0 &&
+	    io_time_left(&dl, ms) != 0) {
+		d->rx_release(d, *msg, *msgsiz);
+		n = -1;
+	}
+
+	trace_end(d, cmd, *msg, n);
+
+	if (n < 0) {
+		*msg = NULL;
+		*msgsiz = 0;
+	}
+
+	return (n);
+}
+
+/* hand back a reply obtained with fido_rx_msg() */
+void
+fido_rx_msg_put(fido_dev_t *d, const unsigned char *msg, size_t msgsiz)
+{
+	if (msg == NULL)
+		return;
+	if (d->rx_borrow != NULL)
+		d->rx_release(d, msg, msgsiz);
+	else
+		fido_rx_buf_put(d, (unsigned char *)(uintptr_t)msg, msgsiz);
+}
+
+/*
+ * Asynchronous reception: a reply is reassembled one report at a time,
+ * as reports become available on the descriptor returned by
+ * fido_dev_poll_fd(). On devices without a pollable descriptor, each
+ * step falls back to a read bounded by the caller's timeout; devices
+ * with transport functions are handed whole replies the same way.
+ */
+int
+fido_rx_async_begin(fido_dev_t *d, int op, uint8_t cmd, size_t size)
+{
+	struct fido_dev_async *a;
+
+	if (d->async != NULL) {
+		fido_log_debug("%s: op=%d pending", __func__, d->async->op);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+	if (size > UINT16_MAX || (d->transport.rx == NULL &&
+	    (d->io_handle == NULL || d->io.read == NULL))) {
+		fido_log_debug("%s: unsupported transport", __func__);
+		return (FIDO_ERR_UNSUPPORTED_OPTION);
+	}
+	if (d->transport.rx == NULL && (d->rx_len <= CTAP_INIT_HEADER_LEN ||
+	    d->rx_len <= CTAP_CONT_HEADER_LEN ||
+	    d->rx_len > sizeof(struct frame))) {
+		fido_log_debug("%s: rx_len=%zu", __func__, d->rx_len);
+		return (FIDO_ERR_INTERNAL);
 	}
+	if ((a = fido_calloc(1, sizeof(*a))) == NULL ||
+	    (a->buf = fido_rx_buf_get(d, size, &a->size)) == NULL) {
+		fido_free(a);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	a->op = op;
+	a->cmd = cmd;
+	d->async = a;
+
+	return (FIDO_OK);
+}
 
-	if ((msglen = fido_rx(d, CTAP_CMD_CBOR, msg, FIDO_MAXMSG, ms)) < 0 ||
-	    (size_t)msglen < 1) {
-		fido_log_debug("%s: fido_rx", __func__);
+void
+fido_rx_async_end(fido_dev_t *d)
+{
+	struct fido_dev_async *a;
+
+	if ((a = d->async) == NULL)
+		return;
+
+	/* reassembled by rx_async_frame(), not fido_rx() */
+	if (a->buf == d->rx_buf && d->rx_buf_used < a->off)
+		d->rx_buf_used = a->off;
+	fido_rx_buf_put(d, a->buf, a->size);
+	fido_blob_free(&a->ecdh);
+	u2f_async_free(&a->u2f);
+#ifdef USE_WINHELLO
+	fido_winhello_async_free(&a->winhello);
+#endif
+	fido_free(a);
+	d->async = NULL;
+}
+
+/* 1 if a report is available within ms, 0 if not, -1 on error */
+static int
+rx_async_wait(int fd, int ms)
+{
+#ifndef _WIN32
+	struct pollfd	pfd;
+	int		r;
+
+	memset(&pfd, 0, sizeof(pfd));
+	pfd.events = POLLIN;
+	pfd.fd = fd;
+
+#ifdef FIDO_FUZZ
+	return (1);
+#endif
+	if ((r = poll(&pfd, 1, ms)) == -1) {
+		fido_log_error(errno, "%s: poll", __func__);
+		return (-1);
+	}
+
+	return (r > 0);
+#else
+	(void)fd;
+	(void)ms;
+
+	return (-1);
+#endif
+}
+
+static int
+rx_async_frame(fido_dev_t *d, const struct frame *fp)
+{
+	struct fido_dev_async	*a = d->async;
+	size_t			 init_data_len, cont_data_len, n;
+
+	init_data_len = d->rx_len - CTAP_INIT_HEADER_LEN;
+	cont_data_len = d->rx_len - CTAP_CONT_HEADER_LEN;
+
+	if (a->init == false) {
+		if (fp->cid == d->cid && fp->body.init.cmd ==
+		    (CTAP_FRAME_INIT | CTAP_KEEPALIVE))
+			rx_keepalive(d, a->cmd, fp->body.init.data[0]);
+		if (fp->cid != d->cid || fp->body.init.cmd ==
+		    (CTAP_FRAME_INIT | CTAP_KEEPALIVE))
+			return (0); /* ignore */
+		fido_log_io_xxd(fp, d->rx_len, "%s", __func__);
+		if (fp->body.init.cmd != (CTAP_FRAME_INIT | a->cmd)) {
+			fido_log_debug("%s: cmd (0x%02x, 0x%02x)", __func__,
+			    fp->body.init.cmd, a->cmd);
+			return (-1);
+		}
+		a->len = (size_t)((fp->body.init.bcnth << 8) |
+		    fp->body.init.bcntl);
+		if (a->len > a->size) {
+			fido_log_debug("%s: len=%zu, size=%zu", __func__,
+			    a->len, a->size);
+			return (-1);
+		}
+		n = MIN(a->len, init_data_len);
+		memcpy(a->buf, fp->body.init.data, n);
+		a->off = n;
+		a->init = true;
+		return (0);
+	}
+
+	if (d->mux != NULL && fp->cid != d->cid)
+		return (0); /* another channel's; queued for it */
+	fido_log_io_xxd(fp, d->rx_len, "%s", __func__);
+	if (fp->cid != d->cid || fp->body.cont.seq != a->seq) {
+		fido_log_debug("%s: cid (0x%x, 0x%x), seq (%d, %d)", __func__,
+		    fp->cid, d->cid, fp->body.cont.seq, a->seq);
+		return (-1);
+	}
+	n = MIN(a->len - a->off, cont_data_len);
+	memcpy(a->buf + a->off, fp->body.cont.data, n);
+	a->off += n;
+	a->seq++;
+
+	return (0);
+}
+
+/* a reply that fails to arrive by the deadline is not yet due */
+static int
+rx_async_transport(fido_dev_t *d, int *done, int ms)
+{
+	struct fido_dev_async	*a = d->async;
+	struct timespec		 dl;
+	int			 n;
+
+	if (fido_time_deadline(&dl, ms) != 0)
+		return (FIDO_ERR_RX);
+	if ((n = transport_rx(d, a->cmd, a->buf, a->size, &dl)) < 0) {
+		if (ms >= 0 && fido_time_left(&dl, &ms) == 0 && ms == 0)
+			return (FIDO_OK); /* timed out; not yet */
+		fido_log_debug("%s: transport_rx", __func__);
+		trace_end(d, a->cmd, a->buf, -1);
+		return (FIDO_ERR_RX);
+	}
+
+	a->len = a->off = (size_t)n;
+	a->init = true;
+	fido_log_io_xxd(a->buf, a->len, "%s", __func__);
+	trace_end(d, a->cmd, a->buf, n);
+	*done = 1;
+
+	return (FIDO_OK);
+}
+
+int
+fido_rx_async_step(fido_dev_t *d, int *done, int ms)
+{
+	struct fido_dev_async	*a = d->async;
+	struct frame		 f;
+	struct timespec		 dl;
+	int			 fd;
+	int			 r;
+
+	*done = 0;
+
+	if (a == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if (d->transport.rx != NULL)
+		return (rx_async_transport(d, done, ms));
+
+	fd = fido_dev_poll_fd(d);
+	if (fd == -1 && fido_time_deadline(&dl, ms) != 0)
+		return (FIDO_ERR_RX);
+
+	while (a->init == false || a->off < a->len) {
+		if (fd == -1) {
+			if (fido_time_left(&dl, &ms) != 0)
+				return (FIDO_ERR_RX);
+		} else if (fido_dev_rx_pending(d) == false) {
+			if ((r = rx_async_wait(fd, ms)) < 0)
+				return (FIDO_ERR_RX);
+			if (r == 0)
+				return (FIDO_OK); /* not yet */
+			ms = 0;
+		}
+		if (rx_frame(d, &f, ms) < 0) {
+			if (fd == -1 && a->init == false)
+				return (FIDO_OK); /* timed out; not yet */
+			fido_log_debug("%s: rx_frame", __func__);
+			trace_end(d, a->cmd, a->buf, -1);
+			return (FIDO_ERR_RX);
+		}
+#ifdef FIDO_FUZZ
+		f.cid = d->cid;
+		if (a->init == false)
+			f.body.init.cmd = (CTAP_FRAME_INIT | a->cmd);
+		else
+			f.body.cont.seq = (uint8_t)a->seq;
+#endif
+		if (rx_async_frame(d, &f) < 0) {
+			trace_end(d, a->cmd, a->buf, -1);
+			return (FIDO_ERR_RX);
+		}
+	}
+
+	fido_log_io_xxd(a->buf, a->len, "%s", __func__);
+	trace_end(d, a->cmd, a->buf, (int)a->len);
+	*done = 1;
+
+	return (FIDO_OK);
+}
+
+int
+fido_rx_cbor_status(fido_dev_t *d, int *ms)
+{
+	const unsigned char	*msg;
+	size_t			 msgsiz;
+	int			 msglen;
+	int			 r;
+
+	if ((msglen = fido_rx_msg(d, CTAP_CMD_CBOR, FIDO_MAXMSG, &msg,
+	    &msgsiz, ms)) < 1) {
+		fido_log_debug("%s: fido_rx_msg", __func__);
 		r = FIDO_ERR_RX;
 		goto out;
 	}
 
 	r = msg[0];
 out:
-	freezero(msg, FIDO_MAXMSG);
+	fido_rx_msg_put(d, msg, msgsiz);
 
 	return (r);
 }
@@ -14,7 +14,7 @@ iso7816_new(uint8_t cla, uint8_t ins, uint8_t p1, uint16_t payload_len)
 	size_t alloc_len;
 
 	alloc_len = sizeof(iso7816_apdu_t) + payload_len + 2; /* le1 le2 */
-	if ((apdu = calloc(1, alloc_len)) == NULL)
+	if ((apdu = fido_calloc(1, alloc_len)) == NULL)
 		return NULL;
 	apdu->alloc_len = alloc_len;
 	apdu->payload_len = payload_len;
@@ -35,7 +35,7 @@ iso7816_free(iso7816_apdu_t **apdu_p)
 
 	if (apdu_p == NULL || (apdu = *apdu_p) == NULL)
 		return;
-	freezero(apdu, apdu->alloc_len);
+	fido_freezero(apdu, apdu->alloc_len);
 	*apdu_p = NULL;
 }
 
@@ -63,3 +63,92 @@ iso7816_len(const iso7816_apdu_t *apdu)
 	return apdu->alloc_len - offsetof(iso7816_apdu_t, header) -
 	    (sizeof(iso7816_apdu_t) - offsetof(iso7816_apdu_t, payload));
 }
+
+#define ISO7816_SHORT_MAXLEN	(5 + UINT8_MAX + 1)
+
+/*
+ * Apdus sent over NFC and PC/SC are assembled in a buffer that belongs to
+ * the device: header, one segment of payload, and le. It is sized for the
+ * longest short apdu on first use, grown for extended ones, and wiped
+ * after each apdu, so that chained segments and GET RESPONSE rounds do
+ * not allocate.
+ */
+static int
+iso7816_buf_reserve(iso7816_buf_t *b, size_t len)
+{
+	uint8_t *ptr;
+
+	if (len < ISO7816_SHORT_MAXLEN)
+		len = ISO7816_SHORT_MAXLEN;
+	if (b->len >= len)
+		return 0;
+	if ((ptr = fido_calloc(1, len)) == NULL)
+		return -1;
+	iso7816_buf_free(b);
+	b->ptr = ptr;
+	b->len = len;
+
+	return 0;
+}
+
+/* header, with cla_flags or'd into cla, payload, and a zero le */
+int
+iso7816_build_short(iso7816_buf_t *b, const iso7816_header_t *h,
+    uint8_t cla_flags, const uint8_t *payload, uint8_t payload_len)
+{
+	if (iso7816_buf_reserve(b, ISO7816_SHORT_MAXLEN) < 0)
+		return -1;
+
+	b->ptr[0] = h->cla | cla_flags;
+	b->ptr[1] = h->ins;
+	b->ptr[2] = h->p1;
+	b->ptr[3] = h->p2;
+	b->ptr[4] = payload_len;
+	if (payload_len > 0)
+		memcpy(&b->ptr[5], payload, payload_len);
+	b->used = (size_t)(5 + payload_len + 1);
+	b->ptr[b->used - 1] = 0; /* le */
+
+	return 0;
+}
+
+int
+iso7816_build_ext(iso7816_buf_t *b, const iso7816_header_t *h,
+    const uint8_t *payload, size_t payload_len, uint16_t le)
+{
+	if (payload_len == 0 || payload_len > UINT16_MAX ||
+	    iso7816_buf_reserve(b, 7 + payload_len + 2) < 0)
+		return -1;
+
+	b->ptr[0] = h->cla;
+	b->ptr[1] = h->ins;
+	b->ptr[2] = h->p1;
+	b->ptr[3] = h->p2;
+	b->ptr[4] = 0;
+	b->ptr[5] = (uint8_t)((payload_len >> 8) & 0xff);
+	b->ptr[6] = (uint8_t)(payload_len & 0xff);
+	memcpy(&b->ptr[7], payload, payload_len);
+	b->used = 7 + payload_len + 2;
+	b->ptr[b->used - 2] = (uint8_t)((le >> 8) & 0xff);
+	b->ptr[b->used - 1] = (uint8_t)(le & 0xff);
+
+	return 0;
+}
+
+/* only the bytes of the last apdu */
+void
+iso7816_buf_wipe(iso7816_buf_t *b)
+{
+	if (b->ptr != NULL)
+		explicit_bzero(b->ptr, b->used);
+	b->used = 0;
+}
+
+void
+iso7816_buf_free(iso7816_buf_t *b)
+{
+	iso7816_buf_wipe(b);
+	fido_free(b->ptr);
+	b->ptr = NULL;
+	b->len = 0;
+}
@@ -36,12 +36,26 @@ typedef struct iso7816_apdu {
 	uint8_t           payload[];
 } iso7816_apdu_t;
 
+/* a buffer in which apdus are assembled, kept between apdus */
+typedef struct iso7816_buf {
+	uint8_t	*ptr;
+	size_t	 len;  /* allocated length of ptr */
+	size_t	 used; /* length of the apdu in ptr */
+} iso7816_buf_t;
+
 const unsigned char *iso7816_ptr(const iso7816_apdu_t *);
 int iso7816_add(iso7816_apdu_t *, const void *, size_t);
 iso7816_apdu_t *iso7816_new(uint8_t, uint8_t, uint8_t, uint16_t);
 size_t iso7816_len(const iso7816_apdu_t *);
 void iso7816_free(iso7816_apdu_t **);
 
+int iso7816_build_short(iso7816_buf_t *, const iso7816_header_t *, uint8_t,
+    const uint8_t *, uint8_t);
+int iso7816_build_ext(iso7816_buf_t *, const iso7816_header_t *,
+    const uint8_t *, size_t, uint16_t);
+void iso7816_buf_wipe(iso7816_buf_t *);
+void iso7816_buf_free(iso7816_buf_t *);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif /* __cplusplus */
@@ -0,0 +1,796 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Just enough JSON to read the members of a WebAuthn PublicKeyCredential
+ * serialisation (WebAuthn Level 3, toJSON()). Members of the top level
+ * object, and of the objects it holds, are matched against a table of
+ * fields; base64url members are decoded straight into the field's blob,
+ * arrays are handed to the field's callback one element at a time, and
+ * everything else is validated and skipped.
+ */
+
+#include <openssl/sha.h>
+
+#include "fido.h"
+
+#define JSON_MAXDEPTH	16
+
+#define JSON_ONES	0x0101010101010101ULL
+#define JSON_HIGHS	0x8080808080808080ULL
+#define JSON_HASZERO(v)	(((v) - JSON_ONES) & ~(v) & JSON_HIGHS)
+
+struct json {
+	const char	*p;
+	const char	*end;
+	int		 depth;
+};
+
+/* base64url, and the standard alphabet, a browser might also use */
+static int
+b64_value(unsigned char c)
+{
+	if (c >= 'A' && c <= 'Z')
+		return (c - 'A');
+	if (c >= 'a' && c <= 'z')
+		return (c - 'a' + 26);
+	if (c >= '0' && c <= '9')
+		return (c - '0' + 52);
+	if (c == '-' || c == '+')
+		return (62);
+	if (c == '_' || c == '/')
+		return (63);
+
+	return (-1);
+}
+
+int
+fido_b64_decode(const char *in, size_t len, fido_blob_t *out)
+{
+	uint32_t v = 0;
+	size_t n = 0;
+	int c;
+
+	fido_blob_reset(out);
+
+	while (len > 0 && in[len - 1] == '=')
+		len--;
+	if (len == 0 || len % 4 == 1 || len > SIZE_MAX / 3) {
+		fido_log_debug("%s: len=%zu", __func__, len);
+		return (-1);
+	}
+	if ((out->ptr = fido_malloc(len / 4 * 3 + 2)) == NULL) {
+		fido_log_debug("%s: malloc", __func__);
+		return (-1);
+	}
+
+	for (size_t i = 0; i < len; i++) {
+		if ((c = b64_value((unsigned char)in[i])) < 0) {
+			fido_log_debug("%s: invalid character", __func__);
+			fido_blob_reset(out);
+			return (-1);
+		}
+		v = v << 6 | (uint32_t)c;
+		if (++n == 4) {
+			out->ptr[out->len++] = (u_char)(v >> 16);
+			out->ptr[out->len++] = (u_char)(v >> 8);
+			out->ptr[out->len++] = (u_char)v;
+			v = 0;
+			n = 0;
+		}
+	}
+	if (n == 3) {
+		out->ptr[out->len++] = (u_char)(v >> 10);
+		out->ptr[out->len++] = (u_char)(v >> 2);
+	} else if (n == 2)
+		out->ptr[out->len++] = (u_char)(v >> 4);
+
+	return (0);
+}
+
+static void
+json_ws(struct json *j)
+{
+	while (j->p < j->end && (*j->p == ' ' || *j->p == '\t' ||
+	    *j->p == '\n' || *j->p == '\r'))
+		j->p++;
+}
+
+static int
+json_expect(struct json *j, char c)
+{
+	json_ws(j);
+	if (j->p == j->end || *j->p != c)
+		return (-1);
+	j->p++;
+
+	return (0);
+}
+
+/*
+ * Skip the characters of a string that need no attention, eight at a
+ * time: stop at the first quote, backslash or control character.
+ */
+static const char *
+json_plain(const char *p, const char *end)
+{
+	uint64_t v, q, b;
+
+	while (end - p >= 8) {
+		memcpy(&v, p, sizeof(v));
+		q = v ^ (JSON_ONES * '"');
+		b = v ^ (JSON_ONES * '\\');
+		if ((JSON_HASZERO(q) | JSON_HASZERO(b) |
+		    ((v - JSON_ONES * 0x20) & ~v & JSON_HIGHS)) != 0)
+			break;
+		p += 8;
+	}
+	while (p < end && *p != '"' && *p != '\\' &&
+	    (unsigned char)*p >= 0x20)
+		p++;
+
+	return (p);
+}
+
+/* the raw contents of a string; *esc is set if it holds escapes */
+static int
+json_string(struct json *j, const char **ptr, size_t *len, bool *esc)
+{
+	const char *s;
+
+	if (json_expect(j, '"') < 0)
+		return (-1);
+
+	*esc = false;
+	s = j->p;
+
+	while ((j->p = json_plain(j->p, j->end)) < j->end && *j->p != '"') {
+		if ((unsigned char)*j->p < 0x20)
+			return (-1);
+		if (*j->p == '\\') {
+			*esc = true;
+			if (++j->p == j->end)
+				return (-1);
+		}
+		j->p++;
+	}
+	if (j->p == j->end)
+		return (-1);
+
+	*ptr = s;
+	*len = (size_t)(j->p++ - s);
+
+	return (0);
+}
+
+static int
+hex4(const char *s, uint32_t *v)
+{
+	*v = 0;
+	for (size_t i = 0; i < 4; i++) {
+		if (s[i] >= '0' && s[i] <= '9')
+			*v = *v << 4 | (uint32_t)(s[i] - '0');
+		else if (s[i] >= 'a' && s[i] <= 'f')
+			*v = *v << 4 | (uint32_t)(s[i] - 'a' + 10);
+		else if (s[i] >= 'A' && s[i] <= 'F')
+			*v = *v << 4 | (uint32_t)(s[i] - 'A' + 10);
+		else
+			return (-1);
+	}
+
+	return (0);
+}
+
+/* the contents of a string, as utf-8; escapes never grow when decoded */
+static int
+json_unescape(const char *s, size_t len, fido_blob_t *out)
+{
+	static const char esc[] = "\"\\/bfnrt", val[] = "\"\\/\b\f\n\r\t";
+	const char *e;
+	uint32_t cp, lo;
+	size_t i, n = 0;
+
+	fido_blob_reset(out);
+	if (len == 0 || (out->ptr = fido_malloc(len)) == NULL)
+		return (-1);
+
+	for (i = 0; i < len; i++) {
+		if (s[i] != '\\') {
+			out->ptr[n++] = (u_char)s[i];
+			continue;
+		}
+		if (++i == len)
+			goto fail;
+		if (s[i] != 'u') {
+			if ((e = strchr(esc, s[i])) == NULL || *e == '\0')
+				goto fail;
+			out->ptr[n++] = (u_char)val[e - esc];
+			continue;
+		}
+		if (len - i < 5 || hex4(&s[i + 1], &cp) < 0 || cp == 0)
+			goto fail;
+		i += 4;
+		if (cp >= 0xdc00 && cp <= 0xdfff)
+			goto fail;
+		if (cp >= 0xd800 && cp <= 0xdbff) {
+			if (len - i < 7 || s[i + 1] != '\\' || s[i + 2] != 'u' ||
+			    hex4(&s[i + 3], &lo) < 0 || lo < 0xdc00 || lo > 0xdfff)
+				goto fail;
+			cp = 0x10000 + ((cp - 0xd800) << 10) + (lo - 0xdc00);
+			i += 6;
+		}
+		if (cp < 0x80)
+			out->ptr[n++] = (u_char)cp;
+		else if (cp < 0x800) {
+			out->ptr[n++] = (u_char)(0xc0 | cp >> 6);
+			out->ptr[n++] = (u_char)(0x80 | (cp & 0x3f));
+		} else if (cp < 0x10000) {
+			out->ptr[n++] = (u_char)(0xe0 | cp >> 12);
+			out->ptr[n++] = (u_char)(0x80 | (cp >> 6 & 0x3f));
+			out->ptr[n++] = (u_char)(0x80 | (cp & 0x3f));
+		} else {
+			out->ptr[n++] = (u_char)(0xf0 | cp >> 18);
+			out->ptr[n++] = (u_char)(0x80 | (cp >> 12 & 0x3f));
+			out->ptr[n++] = (u_char)(0x80 | (cp >> 6 & 0x3f));
+			out->ptr[n++] = (u_char)(0x80 | (cp & 0x3f));
+		}
+	}
+	out->len = n;
+
+	return (0);
+fail:
+	fido_log_debug("%s: invalid escape", __func__);
+	fido_blob_reset(out);
+
+	return (-1);
+}
+
+static int
+json_int(struct json *j, int64_t *v)
+{
+	bool neg = false;
+	int64_t n = 0;
+	size_t digits = 0;
+
+	json_ws(j);
+	if (j->p < j->end && *j->p == '-') {
+		neg = true;
+		j->p++;
+	}
+	while (j->p < j->end && *j->p >= '0' && *j->p <= '9') {
+		if (++digits > 18)
+			return (-1);
+		n = n * 10 + (*j->p++ - '0');
+	}
+	if (digits == 0 || (j->p < j->end && (*j->p == '.' ||
+	    *j->p == 'e' || *j->p == 'E')))
+		return (-1);
+
+	*v = neg ? -n : n;
+
+	return (0);
+}
+
+static int
+json_literal(struct json *j, const char *lit)
+{
+	size_t len = strlen(lit);
+
+	if ((size_t)(j->end - j->p) < len || memcmp(j->p, lit, len) != 0)
+		return (-1);
+	j->p += len;
+
+	return (0);
+}
+
+static bool
+json_is_null(struct json *j)
+{
+	json_ws(j);
+	if (json_literal(j, "null") < 0)
+		return (false);
+
+	return (true);
+}
+
+static int json_value(struct json *, const char *, fido_json_field_t *,
+    size_t);
+
+static int
+json_number(struct json *j)
+{
+	const char *s = j->p;
+
+	if (j->p < j->end && *j->p == '-')
+		j->p++;
+	while (j->p < j->end && ((*j->p >= '0' && *j->p <= '9') ||
+	    *j->p == '.' || *j->p == 'e' || *j->p == 'E' || *j->p == '+' ||
+	    *j->p == '-'))
+		j->p++;
+
+	return (j->p == s ? -1 : 0);
+}
+
+/* an array; if elem is set, it is called with each element's text */
+static int
+json_array(struct json *j, fido_json_elem_t *elem, void *arg)
+{
+	const char *s;
+
+	if (json_expect(j, '[') < 0)
+		return (-1);
+	json_ws(j);
+	if (j->p < j->end && *j->p == ']') {
+		j->p++;
+		return (0);
+	}
+	for (;;) {
+		json_ws(j);
+		s = j->p;
+		if (json_value(j, NULL, NULL, 0) < 0)
+			return (-1);
+		if (elem != NULL && elem(s, (size_t)(j->p - s), arg) < 0) {
+			fido_log_debug("%s: elem", __func__);
+			return (-1);
+		}
+		json_ws(j);
+		if (j->p < j->end && *j->p == ',') {
+			j->p++;
+			continue;
+		}
+		return (json_expect(j, ']'));
+	}
+}
+
+static fido_json_field_t *
+json_field(const char *obj, const char *key, size_t len,
+    fido_json_field_t *field, size_t nfields)
+{
+	for (size_t i = 0; i < nfields; i++) {
+		if ((obj == NULL) != (field[i].obj == NULL) ||
+		    (obj != NULL && strcmp(obj, field[i].obj) != 0))
+			continue;
+		if (strlen(field[i].name) == len &&
+		    memcmp(field[i].name, key, len) == 0)
+			return (&field[i]);
+	}
+
+	return (NULL);
+}
+
+static bool
+json_is_obj(const char *key, size_t len, const fido_json_field_t *field,
+    size_t nfields)
+{
+	for (size_t i = 0; i < nfields; i++)
+		if (field[i].obj != NULL && strlen(field[i].obj) == len &&
+		    memcmp(field[i].obj, key, len) == 0)
+			return (true);
+
+	return (false);
+}
+
+static int
+json_member(struct json *j, fido_json_field_t *f)
+{
+	const char *s;
+	size_t len;
+	bool esc;
+
+	if (f->found) {
+		fido_log_debug("%s: duplicate %s", __func__, f->name);
+		return (-1);
+	}
+	if (json_is_null(j))
+		return (0);
+
+	switch (f->type) {
+	case FIDO_JSON_B64URL:
+		if (json_string(j, &s, &len, &esc) < 0 || esc ||
+		    fido_b64_decode(s, len, f->blob) < 0)
+			return (-1);
+		break;
+	case FIDO_JSON_STRING:
+		if (json_string(j, &s, &len, &esc) < 0 || len == 0)
+			return (-1);
+		if (esc ? json_unescape(s, len, f->blob) < 0 :
+		    fido_blob_set(f->blob, (const u_char *)s, len) < 0)
+			return (-1);
+		break;
+	case FIDO_JSON_INT:
+		if (json_int(j, f->num) < 0)
+			return (-1);
+		break;
+	case FIDO_JSON_ARRAY:
+		json_ws(j);
+		if (j->p == j->end || *j->p != '[' ||
+		    ++j->depth > JSON_MAXDEPTH ||
+		    json_array(j, f->elem, f->arg) < 0)
+			return (-1);
+		j->depth--;
+		break;
+	default:
+		return (-1);
+	}
+
+	f->found = true;
+
+	return (0);
+}
+
+/*
+ * An object. At the top level (obj is NULL), and in the objects named by
+ * the fields' obj, members are looked up in field; elsewhere, field is
+ * NULL and the object is only validated.
+ */
+static int
+json_object(struct json *j, const char *obj, fido_json_field_t *field,
+    size_t nfields)
+{
+	fido_json_field_t *f;
+	const char *key;
+	char name[64];
+	size_t len;
+	bool esc;
+
+	if (json_expect(j, '{') < 0)
+		return (-1);
+	json_ws(j);
+	if (j->p < j->end && *j->p == '}') {
+		j->p++;
+		return (0);
+	}
+	for (;;) {
+		if (json_string(j, &key, &len, &esc) < 0 ||
+		    json_expect(j, ':') < 0)
+			return (-1);
+		f = NULL;
+		if (field != NULL && !esc)
+			f = json_field(obj, key, len, field, nfields);
+		if (f != NULL) {
+			if (json_member(j, f) < 0)
+				return (-1);
+		} else if (field != NULL && obj == NULL && !esc &&
+		    len < sizeof(name) && json_is_obj(key, len, field,
+		    nfields)) {
+			memcpy(name, key, len);
+			name[len] = '\0';
+			if (json_value(j, name, field, nfields) < 0)
+				return (-1);
+		} else if (json_value(j, NULL, NULL, 0) < 0)
+			return (-1);
+		json_ws(j);
+		if (j->p < j->end && *j->p == ',') {
+			j->p++;
+			continue;
+		}
+		return (json_expect(j, '}'));
+	}
+}
+
+static int
+json_value(struct json *j, const char *obj, fido_json_field_t *field,
+    size_t nfields)
+{
+	const char *s;
+	size_t len;
+	bool esc;
+	int r;
+
+	json_ws(j);
+	if (j->p == j->end)
+		return (-1);
+	if (++j->depth > JSON_MAXDEPTH) {
+		fido_log_debug("%s: depth", __func__);
+		return (-1);
+	}
+
+	switch (*j->p) {
+	case '{':
+		r = json_object(j, obj, field, nfields);
+		break;
+	case '[':
+		r = json_array(j, NULL, NULL);
+		break;
+	case '"':
+		r = json_string(j, &s, &len, &esc);
+		break;
+	case 't':
+		r = json_literal(j, "true");
+		break;
+	case 'f':
+		r = json_literal(j, "false");
+		break;
+	case 'n':
+		r = json_literal(j, "null");
+		break;
+	default:
+		r = json_number(j);
+		break;
+	}
+
+	j->depth--;
+
+	return (r);
+}
+
+int
+fido_json_decode(const char *ptr, size_t len, fido_json_field_t *field,
+    size_t nfields)
+{
+	struct json j;
+
+	for (size_t i = 0; i < nfields; i++)
+		field[i].found = false;
+
+	if (ptr == NULL || len == 0) {
+		fido_log_debug("%s: ptr=%p, len=%zu", __func__,
+		    (const void *)ptr, len);
+		return (-1);
+	}
+
+	j.p = ptr;
+	j.end = ptr + len;
+	j.depth = 0;
+
+	json_ws(&j);
+	if (j.p == j.end || *j.p != '{' ||
+	    json_value(&j, NULL, field, nfields) < 0) {
+		fido_log_debug("%s: invalid json at %zu", __func__,
+		    (size_t)(j.p - ptr));
+		return (-1);
+	}
+	json_ws(&j);
+	if (j.p != j.end) {
+		fido_log_debug("%s: trailing data", __func__);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* a string, on its own, as handed to an array's elem callback */
+static int
+json_elem_string(const char *ptr, size_t len, const char **s, size_t *n,
+    bool *esc)
+{
+	struct json j;
+
+	j.p = ptr;
+	j.end = ptr + len;
+	j.depth = 0;
+
+	if (json_string(&j, s, n, esc) < 0) {
+		fido_log_debug("%s: string", __func__);
+		return (-1);
+	}
+	json_ws(&j);
+	if (j.p != j.end) {
+		fido_log_debug("%s: trailing data", __func__);
+		return (-1);
+	}
+
+	return (0);
+}
+
+int
+fido_json_string(const char *ptr, size_t len, fido_blob_t *out)
+{
+	const char *s;
+	size_t n;
+	bool esc;
+
+	if (json_elem_string(ptr, len, &s, &n, &esc) < 0 || n == 0)
+		return (-1);
+	if (esc)
+		return (json_unescape(s, n, out));
+
+	return (fido_blob_set(out, (const u_char *)s, n));
+}
+
+/* base64, in either alphabet */
+int
+fido_json_b64(const char *ptr, size_t len, fido_blob_t *out)
+{
+	const char *s;
+	size_t n;
+	bool esc;
+
+	if (json_elem_string(ptr, len, &s, &n, &esc) < 0 || esc)
+		return (-1);
+
+	return (fido_b64_decode(s, n, out));
+}
+
+/* a credential's type member, if present, must be "public-key" */
+bool
+fido_json_public_key(const fido_blob_t *type)
+{
+	static const char public_key[] = "public-key";
+
+	if (fido_blob_is_empty(type))
+		return (true);
+	if (type->len != sizeof(public_key) - 1 ||
+	    memcmp(type->ptr, public_key, type->len) != 0) {
+		fido_log_debug("%s: type", __func__);
+		return (false);
+	}
+
+	return (true);
+}
+
+/* whether base64url s decodes to ptr, without decoding it anywhere */
+static bool
+json_b64_equal(const char *s, size_t n, const unsigned char *ptr, size_t len)
+{
+	uint32_t v = 0;
+	size_t k = 0, off = 0;
+	int c;
+
+	while (n > 0 && s[n - 1] == '=')
+		n--;
+	if (n == 0 || n % 4 == 1 ||
+	    n / 4 * 3 + (n % 4 ? n % 4 - 1 : 0) != len)
+		return (false);
+
+	for (size_t i = 0; i < n; i++) {
+		if ((c = b64_value((unsigned char)s[i])) < 0)
+			return (false);
+		v = v << 6 | (uint32_t)c;
+		if (++k == 4) {
+			if (ptr[off++] != (u_char)(v >> 16) ||
+			    ptr[off++] != (u_char)(v >> 8) ||
+			    ptr[off++] != (u_char)v)
+				return (false);
+			v = 0;
+			k = 0;
+		}
+	}
+	if (k == 3)
+		return (ptr[off] == (u_char)(v >> 10) &&
+		    ptr[off + 1] == (u_char)(v >> 2));
+	if (k == 2)
+		return (ptr[off] == (u_char)(v >> 4));
+
+	return (true);
+}
+
+#define CD_TYPE		0x01
+#define CD_CHALLENGE	0x02
+#define CD_ORIGIN	0x04
+#define CD_CROSSORIGIN	0x08
+
+static int
+clientdata_key(const char *key, size_t len)
+{
+	static const struct {
+		const char	*name;
+		int		 bit;
+	} keys[] = {
+		{ "type",		CD_TYPE },
+		{ "challenge",		CD_CHALLENGE },
+		{ "origin",		CD_ORIGIN },
+		{ "crossOrigin",	CD_CROSSORIGIN },
+	};
+
+	for (size_t i = 0; i < nitems(keys); i++)
+		if (strlen(keys[i].name) == len &&
+		    memcmp(keys[i].name, key, len) == 0)
+			return (keys[i].bit);
+
+	return (0);
+}
+
+static int
+clientdata_member(struct json *j, int bit, const char *type,
+    const fido_blob_t *chal, const char *origin, int flags)
+{
+	const char *s;
+	size_t n;
+	bool esc;
+
+	switch (bit) {
+	case CD_TYPE:
+		return (json_string(j, &s, &n, &esc) < 0 || esc ||
+		    strlen(type) != n || memcmp(type, s, n) != 0 ? -1 : 0);
+	case CD_CHALLENGE:
+		return (json_string(j, &s, &n, &esc) < 0 || esc ||
+		    !json_b64_equal(s, n, chal->ptr, chal->len) ? -1 : 0);
+	case CD_ORIGIN:
+		return (json_string(j, &s, &n, &esc) < 0 || esc ||
+		    strlen(origin) != n || memcmp(origin, s, n) != 0 ? -1 : 0);
+	case CD_CROSSORIGIN:
+		json_ws(j);
+		if (json_literal(j, "false") == 0 ||
+		    ((flags & FIDO_CLIENTDATA_CROSS_ORIGIN) != 0 &&
+		    json_literal(j, "true") == 0))
+			return (0);
+		return (-1);
+	default:
+		return (json_value(j, NULL, NULL, 0));
+	}
+}
+
+/*
+ * Check a clientDataJSON in place, without allocating: type, challenge
+ * and origin must be present and match, crossOrigin may only be true if
+ * flags allow it, and other members are validated and skipped. Keys and
+ * values are compared as serialised: a browser escapes neither, and one
+ * holding escapes does not match.
+ * The SHA-256 of the buffer is taken member by member as it is scanned.
+ */
+int
+fido_json_clientdata(const unsigned char *ptr, size_t len, const char *type,
+    const fido_blob_t *chal, const char *origin, int flags,
+    unsigned char *cdh)
+{
+	SHA256_CTX ctx;
+	struct json j;
+	const char *key, *mark;
+	size_t klen;
+	bool esc;
+	int bit, seen = 0;
+
+	if (ptr == NULL || len == 0 || SHA256_Init(&ctx) != 1)
+		return (FIDO_ERR_INTERNAL);
+
+	j.p = mark = (const char *)ptr;
+	j.end = j.p + len;
+	j.depth = 1;
+
+	if (json_expect(&j, '{') < 0)
+		goto fail;
+	json_ws(&j);
+	if (j.p < j.end && *j.p == '}')
+		j.p++;
+	else
+		for (;;) {
+			if (json_string(&j, &key, &klen, &esc) < 0 || esc ||
+			    json_expect(&j, ':') < 0)
+				goto fail;
+			bit = clientdata_key(key, klen);
+			if ((seen & bit) != 0 || clientdata_member(&j, bit,
+			    type, chal, origin, flags) < 0) {
+				fido_log_debug("%s: member 0x%x", __func__,
+				    bit);
+				goto fail;
+			}
+			seen |= bit;
+			if (SHA256_Update(&ctx, mark,
+			    (size_t)(j.p - mark)) != 1)
+				return (FIDO_ERR_INTERNAL);
+			mark = j.p;
+			json_ws(&j);
+			if (j.p < j.end && *j.p == ',') {
+				j.p++;
+				continue;
+			}
+			if (json_expect(&j, '}') < 0)
+				goto fail;
+			break;
+		}
+	json_ws(&j);
+	if (j.p != j.end) {
+		fido_log_debug("%s: trailing data", __func__);
+		goto fail;
+	}
+	if ((seen & (CD_TYPE|CD_CHALLENGE|CD_ORIGIN)) !=
+	    (CD_TYPE|CD_CHALLENGE|CD_ORIGIN)) {
+		fido_log_debug("%s: seen=0x%x", __func__, seen);
+		goto fail;
+	}
+	if (SHA256_Update(&ctx, mark, (size_t)(j.end - mark)) != 1 ||
+	    SHA256_Final(cdh, &ctx) != 1)
+		return (FIDO_ERR_INTERNAL);
+
+	return (FIDO_OK);
+fail:
+	fido_log_debug("%s: invalid client data at %zu", __func__,
+	    (size_t)(j.p - (const char *)ptr));
+
+	return (FIDO_ERR_CLIENTDATA);
+}
@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "fido.h"
+#include "fido/es256.h"
+
+#define KEYPOOL_MAXLEN	64
+
+struct keypool_entry {
+	es256_sk_t	sk; /* platform ephemeral key */
+	es256_pk_t	pk; /* its public part */
+};
+
+/*
+ * Key pairs generated ahead of time for fido_do_ecdh(). Each pair is
+ * handed out once and wiped. Under HAVE_PTHREAD the pool is refilled by
+ * a worker thread; otherwise it is filled by fido_keypool_set_size().
+ */
+static struct keypool {
+	struct keypool_entry	*entry;  /* generated pairs */
+	size_t			 size;   /* capacity of entry[] */
+	size_t			 len;    /* entries in use */
+#ifdef HAVE_UNISTD_H
+	pid_t			 pid;    /* process the pairs belong to */
+#endif
+#ifdef HAVE_PTHREAD
+	pthread_t		 thread; /* refill worker */
+	bool			 running;
+	bool			 stop;   /* worker should exit */
+#endif
+} keypool;
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t keypool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t keypool_ctl = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t keypool_work = PTHREAD_COND_INITIALIZER;
+#define KEYPOOL_LOCK()		pthread_mutex_lock(&keypool_lock)
+#define KEYPOOL_UNLOCK()	pthread_mutex_unlock(&keypool_lock)
+#define KEYPOOL_SIGNAL()	pthread_cond_signal(&keypool_work)
+#define KEYPOOL_CTL_LOCK()	pthread_mutex_lock(&keypool_ctl)
+#define KEYPOOL_CTL_UNLOCK()	pthread_mutex_unlock(&keypool_ctl)
+#else
+#define KEYPOOL_LOCK()		do { } while (0)
+#define KEYPOOL_UNLOCK()	do { } while (0)
+#define KEYPOOL_SIGNAL()	do { } while (0)
+#define KEYPOOL_CTL_LOCK()	do { } while (0)
+#define KEYPOOL_CTL_UNLOCK()	do { } while (0)
+#endif
+
+static int
+keypool_generate(struct keypool_entry *e)
+{
+	if (es256_sk_create(&e->sk) < 0 || es256_derive_pk(&e->sk,
+	    &e->pk) < 0) {
+		fido_log_debug("%s: es256_sk_create", __func__);
+		explicit_bzero(e, sizeof(*e));
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* caller must hold keypool_lock */
+static void
+keypool_trim(size_t len)
+{
+	while (keypool.len > len)
+		explicit_bzero(&keypool.entry[--keypool.len],
+		    sizeof(*keypool.entry));
+}
+
+/*
+ * Pairs inherited through fork() are also held by the parent, and the
+ * worker is not; caller must hold keypool_lock.
+ */
+static void
+keypool_check_pid(void)
+{
+#ifdef HAVE_UNISTD_H
+	if (keypool.pid != getpid()) {
+		keypool_trim(0);
+		keypool.pid = getpid();
+#ifdef HAVE_PTHREAD
+		keypool.running = false;
+#endif
+	}
+#endif
+}
+
+#ifdef HAVE_PTHREAD
+static void *
+keypool_worker(void *arg)
+{
+	struct keypool_entry	e;
+	bool			failed = false;
+
+	(void)arg;
+
+	KEYPOOL_LOCK();
+	for (;;) {
+		while (keypool.stop == false &&
+		    (failed || keypool.len >= keypool.size)) {
+			pthread_cond_wait(&keypool_work, &keypool_lock);
+			failed = false;
+		}
+		if (keypool.stop)
+			break;
+		KEYPOOL_UNLOCK();
+		/* wait for the next request before retrying a failure */
+		failed = keypool_generate(&e) < 0;
+		KEYPOOL_LOCK();
+		keypool_check_pid();
+		if (failed == false && keypool.len < keypool.size)
+			keypool.entry[keypool.len++] = e;
+		explicit_bzero(&e, sizeof(e));
+	}
+	KEYPOOL_UNLOCK();
+
+	return (NULL);
+}
+
+/* caller must hold keypool_lock */
+static int
+keypool_start(void)
+{
+	if (keypool.running)
+		return (0);
+	keypool.stop = false;
+	if (pthread_create(&keypool.thread, NULL, keypool_worker, NULL) != 0) {
+		fido_log_debug("%s: pthread_create", __func__);
+		return (-1);
+	}
+	keypool.running = true;
+
+	return (0);
+}
+
+static void
+keypool_stop(void)
+{
+	pthread_t	thread;
+	bool		running;
+
+	KEYPOOL_LOCK();
+	thread = keypool.thread;
+	running = keypool.running;
+	keypool.running = false;
+	keypool.stop = true;
+	pthread_cond_broadcast(&keypool_work);
+	KEYPOOL_UNLOCK();
+
+	if (running)
+		pthread_join(thread, NULL);
+}
+#else
+/* no worker thread; fill the pool now */
+static void
+keypool_fill(void)
+{
+	while (keypool.len < keypool.size &&
+	    keypool_generate(&keypool.entry[keypool.len]) == 0)
+		keypool.len++;
+}
+#endif /* HAVE_PTHREAD */
+
+/*
+ * Take a pregenerated key pair. Returns 0 on success, -1 if the pool is
+ * disabled or empty.
+ */
+int
+fido_keypool_get(es256_sk_t *sk, es256_pk_t *pk)
+{
+	struct keypool_entry	*e;
+	int			 ok = -1;
+
+	KEYPOOL_LOCK();
+	keypool_check_pid();
+	if (keypool.len > 0) {
+		e = &keypool.entry[--keypool.len];
+		memcpy(sk, &e->sk, sizeof(*sk));
+		memcpy(pk, &e->pk, sizeof(*pk));
+		explicit_bzero(e, sizeof(*e));
+		ok = 0;
+	}
+	if (keypool.size > 0)
+		KEYPOOL_SIGNAL();
+	KEYPOOL_UNLOCK();
+
+	return (ok);
+}
+
+/* caller must hold keypool_ctl */
+static int
+keypool_resize(size_t size)
+{
+	struct keypool_entry	*entry;
+	int			 r = FIDO_ERR_INTERNAL;
+
+#ifdef HAVE_PTHREAD
+	if (size == 0)
+		keypool_stop();
+#endif
+
+	KEYPOOL_LOCK();
+	keypool_check_pid();
+	keypool_trim(size);
+	if (size == 0) {
+		fido_freezero(keypool.entry,
+		    keypool.size * sizeof(*keypool.entry));
+		keypool.entry = NULL;
+	} else if ((entry = fido_recallocarray(keypool.entry, keypool.size,
+	    size, sizeof(*entry))) == NULL)
+		goto fail;
+	else
+		keypool.entry = entry;
+	keypool.size = size;
+#ifdef HAVE_PTHREAD
+	if (size > 0 && keypool_start() < 0)
+		goto fail;
+	pthread_cond_broadcast(&keypool_work);
+#else
+	keypool_fill();
+#endif
+
+	r = FIDO_OK;
+fail:
+	KEYPOOL_UNLOCK();
+
+	return (r);
+}
+
+int
+fido_keypool_set_size(size_t size)
+{
+	int r;
+
+	if (size > KEYPOOL_MAXLEN) {
+		fido_log_debug("%s: size=%zu", __func__, size);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	/* one resize at a time, so that workers are started and joined once */
+	KEYPOOL_CTL_LOCK();
+	r = keypool_resize(size);
+	KEYPOOL_CTL_UNLOCK();
+
+	return (r);
+}
+
+size_t
+fido_keypool_size(void)
+{
+	size_t size;
+
+	KEYPOOL_LOCK();
+	size = keypool.size;
+	KEYPOOL_UNLOCK();
+
+	return (size);
+}
+
+size_t
+fido_keypool_len(void)
+{
+	size_t len;
+
+	KEYPOOL_LOCK();
+	keypool_check_pid();
+	len = keypool.len;
+	KEYPOOL_UNLOCK();
+
+	return (len);
+}
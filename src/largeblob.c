@@ -13,6 +13,7 @@
 #define LARGEBLOB_DIGEST_LENGTH	16
 #define LARGEBLOB_NONCE_LENGTH	12
 #define LARGEBLOB_TAG_LENGTH	16
+#define LARGEBLOB_INDEX_LEN	32	/* keys remembered per array */
 
 typedef struct largeblob {
 	size_t origsiz;
@@ -20,10 +21,25 @@ typedef struct largeblob {
 	fido_blob_t nonce;
 } largeblob_t;
 
+/*
+ * The entry of the cached array that each recently used key opened,
+ * so that reads need not try every entry. Keys are kept as their
+ * SHA-256; the index goes with the array, and a stale hint only costs
+ * a failed decryption.
+ */
+struct fido_largeblob_index {
+	struct {
+		u_char	key_hash[SHA256_DIGEST_LENGTH];
+		size_t	idx;
+	}	ent[LARGEBLOB_INDEX_LEN];
+	size_t	len;  /* entries in use */
+	size_t	next; /* entry replaced next, once full */
+};
+
 static largeblob_t *
 largeblob_new(void)
 {
-	return calloc(1, sizeof(largeblob_t));
+	return fido_calloc_as(FIDO_MEM_LARGEBLOB, 1, sizeof(largeblob_t));
 }
 
 static void
@@ -42,7 +58,7 @@ largeblob_free(largeblob_t **blob_ptr)
 	if (blob_ptr == NULL || (blob = *blob_ptr) == NULL)
 		return;
 	largeblob_reset(blob);
-	free(blob);
+	fido_free(blob);
 	*blob_ptr = NULL;
 }
 
@@ -114,20 +130,75 @@ fail:
 	return ok;
 }
 
+/*
+ * Seal plaintext, the compressed form of origsiz bytes, into blob. The
+ * plaintext is encrypted in place and its buffer, grown by the mac tag,
+ * becomes the ciphertext; plaintext is left empty.
+ */
 static int
-largeblob_seal(largeblob_t *blob, const fido_blob_t *body,
+largeblob_seal(largeblob_t *blob, fido_blob_t *plaintext, size_t origsiz,
     const fido_blob_t *key)
 {
-	fido_blob_t *plaintext = NULL, *aad = NULL;
+	fido_blob_t *aad = NULL;
+	EVP_CIPHER_CTX *ctx = NULL;
+	u_char *ptr;
 	int ok = -1;
 
-	if ((plaintext = fido_blob_new()) == NULL ||
-	    (aad = fido_blob_new()) == NULL) {
+	if (plaintext->len > SIZE_MAX - 16) {
+		fido_log_debug("%s: len=%zu", __func__, plaintext->len);
+		goto fail;
+	}
+	if ((aad = fido_blob_new()) == NULL) {
 		fido_log_debug("%s: fido_blob_new", __func__);
 		goto fail;
 	}
-	if (fido_compress(plaintext, body) != FIDO_OK) {
-		fido_log_debug("%s: fido_compress", __func__);
+	if (largeblob_aad(aad, origsiz) < 0) {
+		fido_log_debug("%s: largeblob_aad", __func__);
+		goto fail;
+	}
+	if (largeblob_get_nonce(blob) < 0) {
+		fido_log_debug("%s: largeblob_get_nonce", __func__);
+		goto fail;
+	}
+	if ((ptr = fido_recallocarray_as(FIDO_MEM_LARGEBLOB, plaintext->ptr,
+	    plaintext->len, plaintext->len + 16, 1)) == NULL) {
+		fido_log_debug("%s: fido_recallocarray", __func__);
+		goto fail;
+	}
+	plaintext->ptr = ptr;
+	if ((ctx = aes256_gcm_enc_begin(key, &blob->nonce, aad)) == NULL ||
+	    aes256_gcm_enc_update(ctx, ptr, plaintext->len) < 0 ||
+	    aes256_gcm_enc_end(ctx, ptr + plaintext->len) < 0) {
+		fido_log_debug("%s: aes256_gcm_enc", __func__);
+		plaintext->len += 16; /* wiped as a whole */
+		goto fail;
+	}
+	fido_blob_reset(&blob->ciphertext);
+	blob->ciphertext.ptr = ptr;
+	blob->ciphertext.len = plaintext->len + 16;
+	memset(plaintext, 0, sizeof(*plaintext));
+	blob->origsiz = origsiz;
+
+	ok = 0;
+fail:
+	if (ctx != NULL)
+		EVP_CIPHER_CTX_free(ctx);
+	fido_blob_free(&aad);
+
+	return ok;
+}
+
+/* compress and seal body into blob in one pass */
+static int
+largeblob_seal_body(largeblob_t *blob, const fido_blob_t *body, int level,
+    const fido_blob_t *key)
+{
+	fido_blob_t *aad = NULL;
+	EVP_CIPHER_CTX *ctx = NULL;
+	int ok = -1;
+
+	if ((aad = fido_blob_new()) == NULL) {
+		fido_log_debug("%s: fido_blob_new", __func__);
 		goto fail;
 	}
 	if (largeblob_aad(aad, body->len) < 0) {
@@ -138,48 +209,69 @@ largeblob_seal(largeblob_t *blob, const fido_blob_t *body,
 		fido_log_debug("%s: largeblob_get_nonce", __func__);
 		goto fail;
 	}
-	if (aes256_gcm_enc(key, &blob->nonce, aad, plaintext,
-	    &blob->ciphertext) < 0) {
-		fido_log_debug("%s: aes256_gcm_enc", __func__);
+	fido_blob_reset(&blob->ciphertext);
+	if ((ctx = aes256_gcm_enc_begin(key, &blob->nonce, aad)) == NULL ||
+	    fido_compress_seal(&blob->ciphertext, body, level,
+	    ctx) != FIDO_OK) {
+		fido_log_debug("%s: fido_compress_seal", __func__);
 		goto fail;
 	}
 	blob->origsiz = body->len;
 
 	ok = 0;
 fail:
-	fido_blob_free(&plaintext);
+	if (ctx != NULL)
+		EVP_CIPHER_CTX_free(ctx);
 	fido_blob_free(&aad);
 
 	return ok;
 }
 
 static int
-largeblob_get_tx(fido_dev_t *dev, size_t offset, size_t count, int *ms)
+largeblob_get_frame(size_t offset, size_t count, fido_blob_t *f)
 {
-	fido_blob_t f;
 	cbor_item_t *argv[3];
 	int r;
 
 	memset(argv, 0, sizeof(argv));
-	memset(&f, 0, sizeof(f));
 
 	if ((argv[0] = cbor_build_uint(count)) == NULL ||
-	    (argv[2] = cbor_build_uint(offset)) == NULL) {
+	    (argv[2] = cbor_build_uint(offset)) == NULL ||
+	    cbor_build_frame(CTAP_CBOR_LARGEBLOB, argv, nitems(argv), f) < 0) {
 		fido_log_debug("%s: cbor encode", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
-	if (cbor_build_frame(CTAP_CBOR_LARGEBLOB, argv, nitems(argv), &f) < 0 ||
-	    fido_tx(dev, CTAP_CMD_CBOR, f.ptr, f.len, ms) < 0) {
-		fido_log_debug("%s: fido_tx", __func__);
-		r = FIDO_ERR_TX;
-		goto fail;
-	}
 
 	r = FIDO_OK;
 fail:
 	cbor_vector_free(argv, nitems(argv));
-	free(f.ptr);
+
+	return r;
+}
+
+static int
+largeblob_frame_tx(fido_dev_t *dev, const fido_blob_t *f, int *ms)
+{
+	if (fido_tx(dev, CTAP_CMD_CBOR, f->ptr, f->len, ms) < 0) {
+		fido_log_debug("%s: fido_tx", __func__);
+		return FIDO_ERR_TX;
+	}
+
+	return FIDO_OK;
+}
+
+static int
+largeblob_get_tx(fido_dev_t *dev, size_t offset, size_t count, int *ms)
+{
+	fido_blob_t f;
+	int r;
+
+	memset(&f, 0, sizeof(f));
+
+	if ((r = largeblob_get_frame(offset, count, &f)) == FIDO_OK)
+		r = largeblob_frame_tx(dev, &f, ms);
+	fido_free(f.ptr);
 
 	return r;
 }
@@ -202,14 +294,15 @@ static int
 largeblob_get_rx(fido_dev_t *dev, fido_blob_t **chunk, int *ms)
 {
 	unsigned char *msg;
+	size_t msgsiz;
 	int msglen, r;
 
 	*chunk = NULL;
-	if ((msg = malloc(FIDO_MAXMSG)) == NULL) {
+	if ((msg = fido_rx_buf_get(dev, FIDO_MAXMSG, &msgsiz)) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto out;
 	}
-	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, FIDO_MAXMSG, ms)) < 0) {
+	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, msgsiz, ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
 		r = FIDO_ERR_RX;
 		goto out;
@@ -230,7 +323,7 @@ out:
 	if (r != FIDO_OK)
 		fido_blob_free(chunk);
 
-	freezero(msg, FIDO_MAXMSG);
+	fido_rx_buf_put(dev, msg, msgsiz);
 
 	return r;
 }
@@ -264,10 +357,9 @@ get_chunklen(fido_dev_t *dev)
 {
 	uint64_t maxchunklen;
 
-	if ((maxchunklen = fido_dev_maxmsgsize(dev)) > SIZE_MAX)
-		maxchunklen = SIZE_MAX;
-	if (maxchunklen > FIDO_MAXMSG)
-		maxchunklen = FIDO_MAXMSG;
+	/* replies land in the device's rx buffer; see fido_rx_buf_get() */
+	if ((maxchunklen = fido_dev_maxmsgsize(dev)) > UINT16_MAX)
+		maxchunklen = UINT16_MAX;
 	maxchunklen = maxchunklen > 64 ? maxchunklen - 64 : 0;
 
 	return (size_t)maxchunklen;
@@ -328,146 +420,401 @@ largeblob_decode(largeblob_t *blob, const cbor_item_t *item)
 	return 0;
 }
 
+/*
+ * Encode a sealed blob as a largeBlobMap. The ciphertext buffer is handed
+ * to libcbor, which frees it with the item, rather than copied.
+ */
 static cbor_item_t *
-largeblob_encode(const fido_blob_t *body, const fido_blob_t *key)
+largeblob_pack(largeblob_t *blob)
 {
-	largeblob_t *blob;
 	cbor_item_t *argv[3], *item = NULL;
+	u_char *ptr;
 
 	memset(argv, 0, sizeof(argv));
-	if ((blob = largeblob_new()) == NULL ||
-	    largeblob_seal(blob, body, key) < 0) {
-		fido_log_debug("%s: largeblob_seal", __func__);
-		goto fail;
-	}
-	if ((argv[0] = fido_blob_encode(&blob->ciphertext)) == NULL ||
+	/* fido_compress_seal() allocates for the worst case */
+	if ((ptr = fido_realloc_as(FIDO_MEM_LARGEBLOB, blob->ciphertext.ptr,
+	    blob->ciphertext.len)) != NULL)
+		blob->ciphertext.ptr = ptr;
+	if ((argv[0] = cbor_new_definite_bytestring()) == NULL ||
 	    (argv[1] = fido_blob_encode(&blob->nonce)) == NULL ||
 	    (argv[2] = cbor_build_uint(blob->origsiz)) == NULL) {
 		fido_log_debug("%s: cbor encode", __func__);
 		goto fail;
 	}
+	cbor_bytestring_set_handle(argv[0], blob->ciphertext.ptr,
+	    blob->ciphertext.len);
+	memset(&blob->ciphertext, 0, sizeof(blob->ciphertext));
 	item = cbor_flatten_vector(argv, nitems(argv));
 fail:
 	cbor_vector_free(argv, nitems(argv));
+
+	return item;
+}
+
+/* compress, seal and encode body, holding about one copy of it */
+static cbor_item_t *
+largeblob_encode(const fido_dev_t *dev, const fido_blob_t *body,
+    const fido_blob_t *key)
+{
+	largeblob_t *blob;
+	cbor_item_t *item = NULL;
+
+	if ((blob = largeblob_new()) == NULL ||
+	    largeblob_seal_body(blob, body, dev->largeblob_level, key) < 0) {
+		fido_log_debug("%s: largeblob_seal_body", __func__);
+		goto fail;
+	}
+	item = largeblob_pack(blob);
+fail:
 	largeblob_free(&blob);
 
 	return item;
 }
 
 static int
-largeblob_array_lookup(fido_blob_t *out, size_t *idx, const cbor_item_t *item,
+largeblob_key_hash(u_char out[SHA256_DIGEST_LENGTH], const fido_blob_t *key)
+{
+	if (SHA256(key->ptr, key->len, out) != out)
+		return -1;
+
+	return 0;
+}
+
+static int
+largeblob_index_get(const fido_dev_t *dev, const fido_blob_t *key,
+    size_t *idx)
+{
+	const struct fido_largeblob_index *x = dev->largeblob_index;
+	u_char h[SHA256_DIGEST_LENGTH];
+
+	if (x == NULL || largeblob_key_hash(h, key) < 0)
+		return -1;
+	for (size_t i = 0; i < x->len; i++)
+		if (timingsafe_bcmp(x->ent[i].key_hash, h, sizeof(h)) == 0) {
+			*idx = x->ent[i].idx;
+			return 0;
+		}
+
+	return -1;
+}
+
+static void
+largeblob_index_put(fido_dev_t *dev, const fido_blob_t *key, size_t idx)
+{
+	struct fido_largeblob_index *x;
+	u_char h[SHA256_DIGEST_LENGTH];
+	size_t i;
+
+	if (largeblob_key_hash(h, key) < 0)
+		return;
+	if ((x = dev->largeblob_index) == NULL &&
+	    (x = dev->largeblob_index = fido_calloc_as(FIDO_MEM_LARGEBLOB, 1,
+	    sizeof(*x))) == NULL)
+		return;
+	for (i = 0; i < x->len; i++)
+		if (timingsafe_bcmp(x->ent[i].key_hash, h, sizeof(h)) == 0)
+			break;
+	if (i == x->len) {
+		if (x->len < nitems(x->ent))
+			i = x->len++;
+		else {
+			i = x->next;
+			x->next = (x->next + 1) % nitems(x->ent);
+		}
+	}
+	memcpy(x->ent[i].key_hash, h, sizeof(h));
+	x->ent[i].idx = idx;
+}
+
+static void
+largeblob_index_drop(fido_dev_t *dev)
+{
+	fido_freezero(dev->largeblob_index, sizeof(*dev->largeblob_index));
+	dev->largeblob_index = NULL;
+}
+
+/* decrypt entry i of the array v with key; the entry is left decoded */
+static fido_blob_t *
+largeblob_array_open(largeblob_t *blob, cbor_item_t **v, size_t i,
+    const fido_blob_t *key)
+{
+	largeblob_reset(blob);
+	if (largeblob_decode(blob, v[i]) < 0) {
+		fido_log_debug("%s: largeblob_decode", __func__);
+		return NULL;
+	}
+
+	return largeblob_decrypt(blob, key);
+}
+
+/*
+ * Find the entry of the array in item that decrypts with key, and return
+ * its compressed plaintext. The entry remembered for key, if any, is
+ * tried first.
+ */
+static int
+largeblob_array_find(fido_dev_t *dev, fido_blob_t **plaintext,
+    size_t *origsiz, size_t *idx, const cbor_item_t *item,
     const fido_blob_t *key)
 {
 	cbor_item_t **v;
-	fido_blob_t *plaintext = NULL;
 	largeblob_t blob;
-	int r;
+	size_t hint, i, n;
 
 	memset(&blob, 0, sizeof(blob));
+	*plaintext = NULL;
+	*origsiz = 0;
 	if (idx != NULL)
 		*idx = 0;
 	if ((v = cbor_array_handle(item)) == NULL)
 		return FIDO_ERR_INVALID_ARGUMENT;
-	for (size_t i = 0; i < cbor_array_size(item); i++) {
-		if (largeblob_decode(&blob, v[i]) < 0 ||
-		    (plaintext = largeblob_decrypt(&blob, key)) == NULL) {
-			fido_log_debug("%s: largeblob_decode", __func__);
-			largeblob_reset(&blob);
-			continue;
-		}
-		if (idx != NULL)
-			*idx = i;
-		break;
-	}
-	if (plaintext == NULL) {
+	n = cbor_array_size(item);
+	if (largeblob_index_get(dev, key, &hint) == 0 && hint < n &&
+	    (*plaintext = largeblob_array_open(&blob, v, hint, key)) != NULL)
+		i = hint;
+	else
+		for (i = 0; i < n; i++)
+			if ((*plaintext = largeblob_array_open(&blob, v, i,
+			    key)) != NULL)
+				break;
+	*origsiz = blob.origsiz;
+	largeblob_reset(&blob);
+	if (*plaintext == NULL) {
 		fido_log_debug("%s: not found", __func__);
 		return FIDO_ERR_NOTFOUND;
 	}
+	largeblob_index_put(dev, key, i);
+	if (idx != NULL)
+		*idx = i;
+
+	return FIDO_OK;
+}
+
+static int
+largeblob_array_lookup(fido_dev_t *dev, fido_blob_t *out, size_t *idx,
+    const cbor_item_t *item, const fido_blob_t *key)
+{
+	fido_blob_t *plaintext = NULL;
+	size_t origsiz;
+	int r;
+
+	if ((r = largeblob_array_find(dev, &plaintext, &origsiz, idx, item,
+	    key)) != FIDO_OK)
+		return r;
 	if (out != NULL)
-		r = fido_uncompress(out, plaintext, blob.origsiz);
-	else
-		r = FIDO_OK;
+		r = fido_uncompress(out, plaintext, origsiz);
 
 	fido_blob_free(&plaintext);
-	largeblob_reset(&blob);
 
 	return r;
 }
 
+/*
+ * Feed the bytes of bb that can no longer belong to the trailing digest
+ * to ctx; *hashed counts the bytes fed so far.
+ */
 static int
-largeblob_array_digest(u_char out[LARGEBLOB_DIGEST_LENGTH], const u_char *data,
-    size_t len)
+largeblob_array_hash(SHA256_CTX *ctx, const fido_blob_builder_t *bb,
+    size_t *hashed)
 {
-	u_char dgst[SHA256_DIGEST_LENGTH];
+	size_t end;
 
-	if (data == NULL || len == 0)
-		return -1;
-	if (SHA256(data, len, dgst) != dgst)
+	if (bb->len <= LARGEBLOB_DIGEST_LENGTH ||
+	    (end = bb->len - LARGEBLOB_DIGEST_LENGTH) <= *hashed)
+		return 0;
+	if (SHA256_Update(ctx, bb->ptr + *hashed, end - *hashed) != 1)
 		return -1;
-	memcpy(out, dgst, LARGEBLOB_DIGEST_LENGTH);
+	*hashed = end;
 
 	return 0;
 }
 
+/* compare the digest of the hashed body against the array's own */
 static int
-largeblob_array_check(const fido_blob_t *array)
+largeblob_array_check(SHA256_CTX *ctx, const fido_blob_t *array,
+    size_t hashed)
 {
-	u_char expected_hash[LARGEBLOB_DIGEST_LENGTH];
+	u_char dgst[SHA256_DIGEST_LENGTH];
 	size_t body_len;
+	int r;
 
 	fido_log_xxd(array->ptr, array->len, __func__);
-	if (array->len < sizeof(expected_hash)) {
+	if (array->len <= LARGEBLOB_DIGEST_LENGTH) {
 		fido_log_debug("%s: len %zu", __func__, array->len);
 		return -1;
 	}
-	body_len = array->len - sizeof(expected_hash);
-	if (largeblob_array_digest(expected_hash, array->ptr, body_len) < 0) {
-		fido_log_debug("%s: largeblob_array_digest", __func__);
+	body_len = array->len - LARGEBLOB_DIGEST_LENGTH;
+	if (hashed != body_len || SHA256_Final(dgst, ctx) != 1) {
+		fido_log_debug("%s: hashed=%zu, body_len=%zu", __func__,
+		    hashed, body_len);
 		return -1;
 	}
+	r = timingsafe_bcmp(dgst, array->ptr + body_len,
+	    LARGEBLOB_DIGEST_LENGTH);
+	explicit_bzero(dgst, sizeof(dgst));
 
-	return timingsafe_bcmp(expected_hash, array->ptr + body_len,
-	    sizeof(expected_hash));
+	return r;
 }
 
+static void
+largeblob_cache_store(fido_dev_t *dev, const u_char *ptr, size_t len)
+{
+	fido_dev_largeblob_flush(dev);
+
+	if ((dev->largeblob = fido_blob_new()) == NULL ||
+	    fido_blob_set(dev->largeblob, ptr, len) < 0) {
+		fido_log_debug("%s: fido_blob_set", __func__);
+		fido_blob_free(&dev->largeblob);
+	}
+	fido_session_largeblob_set(dev, dev->largeblob);
+}
+
+static void
+largeblob_cache_drop(fido_dev_t *dev)
+{
+	fido_dev_largeblob_flush(dev);
+	fido_session_largeblob_set(dev, NULL);
+}
+
+/* an array kept by the session cache from an earlier open of dev */
+static void
+largeblob_cache_load(fido_dev_t *dev)
+{
+	fido_blob_t *array;
+
+	if ((array = fido_blob_new()) == NULL)
+		return;
+	if (fido_session_largeblob_get(dev, array) < 0) {
+		fido_blob_free(&array);
+		return;
+	}
+	dev->largeblob = array;
+}
+
+/*
+ * Check whether the array last read from or written to dev is still the
+ * one on the device by fetching its trailing digest, asking for one byte
+ * more so that a longer array is noticed. Returns 0 if so; otherwise, the
+ * array is forgotten and -1 is returned.
+ */
+static int
+largeblob_cache_check(fido_dev_t *dev, size_t n, int *ms)
+{
+	const fido_blob_t *array;
+	fido_blob_t *chunk = NULL;
+	size_t off;
+	int ok = -1;
+
+	if (dev->largeblob == NULL)
+		largeblob_cache_load(dev);
+	if ((array = dev->largeblob) == NULL)
+		return -1;
+	if (n <= LARGEBLOB_DIGEST_LENGTH ||
+	    array->len < LARGEBLOB_DIGEST_LENGTH)
+		goto fail;
+	off = array->len - LARGEBLOB_DIGEST_LENGTH;
+	if (largeblob_get_tx(dev, off, LARGEBLOB_DIGEST_LENGTH + 1,
+	    ms) != FIDO_OK || largeblob_get_rx(dev, &chunk, ms) != FIDO_OK) {
+		fido_log_debug("%s: largeblob_get_wait", __func__);
+		goto fail;
+	}
+	if (chunk->len != LARGEBLOB_DIGEST_LENGTH ||
+	    timingsafe_bcmp(chunk->ptr, array->ptr + off,
+	    LARGEBLOB_DIGEST_LENGTH) != 0) {
+		fido_log_debug("%s: array changed", __func__);
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+	if (ok < 0)
+		largeblob_cache_drop(dev);
+	fido_blob_free(&chunk);
+
+	return ok;
+}
+
+/*
+ * Chunks are requested one at a time. The request for the next chunk is
+ * encoded, and the chunks received so far hashed, while the device
+ * handles the current one; the request is sent if the current chunk
+ * turns out to be full.
+ */
 static int
 largeblob_get_array(fido_dev_t *dev, cbor_item_t **item, int *ms)
 {
-	fido_blob_t *array, *chunk = NULL;
-	size_t n;
+	fido_blob_builder_t bb;
+	fido_blob_t array, *chunk = NULL, frame[2];
+	SHA256_CTX sha;
+	size_t n, hashed = 0, cur = 0;
 	int r;
 
 	*item = NULL;
+	memset(&bb, 0, sizeof(bb));
+	memset(&array, 0, sizeof(array));
+	memset(frame, 0, sizeof(frame));
 	if ((n = get_chunklen(dev)) == 0)
 		return FIDO_ERR_INVALID_ARGUMENT;
-	if ((array = fido_blob_new()) == NULL)
+	if (largeblob_cache_check(dev, n, ms) == 0) {
+		if ((*item = largeblob_array_load(dev->largeblob->ptr,
+		    dev->largeblob->len)) == NULL)
+			return FIDO_ERR_INTERNAL;
+		return FIDO_OK;
+	}
+	if (fido_blob_builder_reserve(&bb, n) < 0 || SHA256_Init(&sha) != 1)
 		return FIDO_ERR_INTERNAL;
+	if ((r = largeblob_get_frame(0, n, &frame[cur])) != FIDO_OK)
+		goto fail;
 	do {
 		fido_blob_free(&chunk);
-		if ((r = largeblob_get_tx(dev, array->len, n, ms)) != FIDO_OK ||
-		    (r = largeblob_get_rx(dev, &chunk, ms)) != FIDO_OK) {
+		if ((r = largeblob_frame_tx(dev, &frame[cur], ms)) != FIDO_OK)
+			goto fail;
+		/* only needed if this chunk is full; checked below */
+		fido_blob_reset(&frame[cur ^ 1]);
+		if (bb.len <= SIZE_MAX - 2 * n)
+			(void)largeblob_get_frame(bb.len + n, n,
+			    &frame[cur ^ 1]);
+		if (largeblob_array_hash(&sha, &bb, &hashed) < 0) {
+			fido_log_debug("%s: largeblob_array_hash", __func__);
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+		if ((r = largeblob_get_rx(dev, &chunk, ms)) != FIDO_OK) {
 			fido_log_debug("%s: largeblob_get_wait %zu/%zu",
-			    __func__, array->len, n);
+			    __func__, bb.len, n);
 			goto fail;
 		}
-		if (fido_blob_append(array, chunk->ptr, chunk->len) < 0) {
-			fido_log_debug("%s: fido_blob_append", __func__);
+		if (fido_blob_builder_append(&bb, chunk->ptr, chunk->len) < 0 ||
+		    (chunk->len == n && frame[cur ^ 1].ptr == NULL)) {
+			fido_log_debug("%s: fido_blob_builder_append",
+			    __func__);
 			r = FIDO_ERR_INTERNAL;
 			goto fail;
 		}
+		cur ^= 1;
 	} while (chunk->len == n);
 
-	if (largeblob_array_check(array) != 0)
+	if (largeblob_array_hash(&sha, &bb, &hashed) < 0 ||
+	    fido_blob_builder_finish(&bb, &array) < 0) {
+		fido_log_debug("%s: fido_blob_builder_finish", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+	if (largeblob_array_check(&sha, &array, hashed) != 0)
 		*item = cbor_new_definite_array(0); /* per spec */
-	else
-		*item = largeblob_array_load(array->ptr, array->len);
+	else if ((*item = largeblob_array_load(array.ptr,
+	    array.len)) != NULL)
+		largeblob_cache_store(dev, array.ptr, array.len);
 	if (*item == NULL)
 		r = FIDO_ERR_INTERNAL;
 	else
 		r = FIDO_OK;
 fail:
-	fido_blob_free(&array);
+	fido_blob_builder_reset(&bb);
+	fido_blob_reset(&array);
 	fido_blob_free(&chunk);
+	fido_blob_reset(&frame[0]);
+	fido_blob_reset(&frame[1]);
 
 	return r;
 }
@@ -502,15 +849,15 @@ prepare_hmac(size_t offset, const u_char *data, size_t len, fido_blob_t *hmac)
 }
 
 static int
-largeblob_set_tx(fido_dev_t *dev, const fido_blob_t *token, const u_char *chunk,
-    size_t chunk_len, size_t offset, size_t totalsiz, int *ms)
+largeblob_set_frame(fido_dev_t *dev, const fido_blob_t *token,
+    const u_char *chunk, size_t chunk_len, size_t offset, size_t totalsiz,
+    fido_blob_t *f)
 {
-	fido_blob_t *hmac = NULL, f;
+	fido_blob_t *hmac = NULL;
 	cbor_item_t *argv[6];
 	int r;
 
 	memset(argv, 0, sizeof(argv));
-	memset(&f, 0, sizeof(f));
 
 	if ((argv[1] = cbor_build_bytestring(chunk, chunk_len)) == NULL ||
 	    (argv[2] = cbor_build_uint(offset)) == NULL ||
@@ -529,10 +876,9 @@ largeblob_set_tx(fido_dev_t *dev, const fido_blob_t *token, const u_char *chunk,
 			goto fail;
 		}
 	}
-	if (cbor_build_frame(CTAP_CBOR_LARGEBLOB, argv, nitems(argv), &f) < 0 ||
-	    fido_tx(dev, CTAP_CMD_CBOR, f.ptr, f.len, ms) < 0) {
-		fido_log_debug("%s: fido_tx", __func__);
-		r = FIDO_ERR_TX;
+	if (cbor_build_frame(CTAP_CBOR_LARGEBLOB, argv, nitems(argv), f) < 0) {
+		fido_log_debug("%s: cbor_build_frame", __func__);
+		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
@@ -540,52 +886,84 @@ largeblob_set_tx(fido_dev_t *dev, const fido_blob_t *token, const u_char *chunk,
 fail:
 	cbor_vector_free(argv, nitems(argv));
 	fido_blob_free(&hmac);
-	free(f.ptr);
 
 	return r;
 }
 
+/*
+ * The serialised array is written in chunks of at most maxchunklen bytes,
+ * followed by its truncated digest in a chunk of its own. The digest is
+ * computed as the chunks are encoded, so that the array is not hashed in
+ * a pass of its own.
+ */
+static size_t
+largeblob_chunk_end(size_t offset, size_t body_len, size_t total_len,
+    size_t maxchunklen)
+{
+	if (offset >= body_len)
+		return total_len;
+	if (body_len - offset > maxchunklen)
+		return offset + maxchunklen;
+
+	return body_len;
+}
+
+/* encode the chunk of array from offset to end, hashing it on the way */
+static int
+largeblob_write_frame(fido_dev_t *dev, const fido_blob_t *token,
+    fido_blob_t *array, size_t body_len, size_t offset, size_t end,
+    SHA256_CTX *sha, fido_blob_t *f)
+{
+	unsigned char dgst[SHA256_DIGEST_LENGTH];
+
+	if (offset < body_len) {
+		if (SHA256_Update(sha, array->ptr + offset,
+		    end - offset) != 1) {
+			fido_log_debug("%s: SHA256_Update", __func__);
+			return FIDO_ERR_INTERNAL;
+		}
+	} else {
+		if (SHA256_Final(dgst, sha) != 1) {
+			fido_log_debug("%s: SHA256_Final", __func__);
+			return FIDO_ERR_INTERNAL;
+		}
+		/* the first 16 bytes of the digest only */
+		memcpy(array->ptr + body_len, dgst, LARGEBLOB_DIGEST_LENGTH);
+	}
+
+	return largeblob_set_frame(dev, token, array->ptr + offset,
+	    end - offset, offset, array->len, f);
+}
+
 static int
 largeblob_get_uv_token(fido_dev_t *dev, const char *pin, fido_blob_t **token,
     int *ms)
 {
-	es256_pk_t *pk = NULL;
-	fido_blob_t *ecdh = NULL;
 	int r;
 
 	if ((*token = fido_blob_new()) == NULL)
 		return FIDO_ERR_INTERNAL;
-	if ((r = fido_do_ecdh(dev, &pk, &ecdh, ms)) != FIDO_OK) {
-		fido_log_debug("%s: fido_do_ecdh", __func__);
-		goto fail;
-	}
-	if ((r = fido_dev_get_uv_token(dev, CTAP_CBOR_LARGEBLOB, pin, ecdh, pk,
+	if ((r = fido_dev_get_uv_token_cached(dev, CTAP_CBOR_LARGEBLOB, pin,
 	    NULL, *token, ms)) != FIDO_OK) {
-		fido_log_debug("%s: fido_dev_get_uv_token", __func__);
-		goto fail;
-	}
-
-	r = FIDO_OK;
-fail:
-	if (r != FIDO_OK)
+		fido_log_debug("%s: fido_dev_get_uv_token_cached", __func__);
 		fido_blob_free(token);
-
-	fido_blob_free(&ecdh);
-	es256_pk_free(&pk);
+	}
 
 	return r;
 }
 
 static int
-largeblob_set_array(fido_dev_t *dev, const cbor_item_t *item, const char *pin,
-    int *ms)
+largeblob_write_array(fido_dev_t *dev, const cbor_item_t *item,
+    const char *pin, int *ms)
 {
-	unsigned char dgst[SHA256_DIGEST_LENGTH];
-	fido_blob_t cbor, *token = NULL;
-	size_t chunklen, maxchunklen, totalsize;
+	const unsigned char zero[LARGEBLOB_DIGEST_LENGTH] = { 0 };
+	fido_blob_t cbor, *token = NULL, frame[2];
+	SHA256_CTX sha;
+	size_t body_len, end, maxchunklen, cur = 0;
 	int r;
 
 	memset(&cbor, 0, sizeof(cbor));
+	memset(frame, 0, sizeof(frame));
 
 	if ((maxchunklen = get_chunklen(dev)) == 0) {
 		fido_log_debug("%s: maxchunklen=%zu", __func__, maxchunklen);
@@ -602,17 +980,19 @@ largeblob_set_array(fido_dev_t *dev, const cbor_item_t *item, const char *pin,
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
-	if (cbor.len > SIZE_MAX - sizeof(dgst)) {
+	if (cbor.len > SIZE_MAX - sizeof(zero)) {
 		fido_log_debug("%s: cbor.len=%zu", __func__, cbor.len);
 		r = FIDO_ERR_INVALID_ARGUMENT;
 		goto fail;
 	}
-	if (SHA256(cbor.ptr, cbor.len, dgst) != dgst) {
-		fido_log_debug("%s: SHA256", __func__);
+	body_len = cbor.len;
+	/* room for the digest, filled in once the body has been hashed */
+	if (fido_blob_append(&cbor, zero, sizeof(zero)) < 0 ||
+	    SHA256_Init(&sha) != 1) {
+		fido_log_debug("%s: fido_blob_append", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
-	totalsize = cbor.len + sizeof(dgst) - 16; /* the first 16 bytes only */
 	if (pin != NULL || fido_dev_supports_permissions(dev)) {
 		if ((r = largeblob_get_uv_token(dev, pin, &token,
 		    ms)) != FIDO_OK) {
@@ -620,27 +1000,56 @@ largeblob_set_array(fido_dev_t *dev, const cbor_item_t *item, const char *pin,
 			goto fail;
 		}
 	}
-	for (size_t offset = 0; offset < cbor.len; offset += chunklen) {
-		if ((chunklen = cbor.len - offset) > maxchunklen)
-			chunklen = maxchunklen;
-		if ((r = largeblob_set_tx(dev, token, cbor.ptr + offset,
-		    chunklen, offset, totalsize, ms)) != FIDO_OK ||
-		    (r = fido_rx_cbor_status(dev, ms)) != FIDO_OK) {
-			fido_log_debug("%s: body", __func__);
+	/* the array on the device is unknown until the last chunk is acked */
+	largeblob_cache_drop(dev);
+	end = largeblob_chunk_end(0, body_len, cbor.len, maxchunklen);
+	if ((r = largeblob_write_frame(dev, token, &cbor, body_len, 0, end,
+	    &sha, &frame[cur])) != FIDO_OK) {
+		fido_log_debug("%s: largeblob_write_frame", __func__);
+		goto fail;
+	}
+	for (size_t offset = 0; offset < cbor.len; offset = end, cur ^= 1) {
+		end = largeblob_chunk_end(offset, body_len, cbor.len,
+		    maxchunklen);
+		if ((r = largeblob_frame_tx(dev, &frame[cur], ms)) != FIDO_OK)
+			goto fail;
+		/* encode the next chunk while the device handles this one */
+		fido_blob_reset(&frame[cur ^ 1]);
+		if (end < cbor.len && largeblob_write_frame(dev, token, &cbor,
+		    body_len, end, largeblob_chunk_end(end, body_len, cbor.len,
+		    maxchunklen), &sha, &frame[cur ^ 1]) != FIDO_OK)
+			fido_log_debug("%s: largeblob_write_frame", __func__);
+		if ((r = fido_rx_cbor_status(dev, ms)) != FIDO_OK) {
+			fido_log_debug("%s: fido_rx_cbor_status %zu/%zu",
+			    __func__, offset, cbor.len);
+			goto fail;
+		}
+		if (end < cbor.len && frame[cur ^ 1].ptr == NULL) {
+			r = FIDO_ERR_INTERNAL;
 			goto fail;
 		}
 	}
-	if ((r = largeblob_set_tx(dev, token, dgst, sizeof(dgst) - 16, cbor.len,
-	    totalsize, ms)) != FIDO_OK ||
-	    (r = fido_rx_cbor_status(dev, ms)) != FIDO_OK) {
-		fido_log_debug("%s: dgst", __func__);
-		goto fail;
-	}
+	largeblob_cache_store(dev, cbor.ptr, cbor.len);
 
 	r = FIDO_OK;
 fail:
 	fido_blob_free(&token);
 	fido_blob_reset(&cbor);
+	fido_blob_reset(&frame[0]);
+	fido_blob_reset(&frame[1]);
+
+	return r;
+}
+
+static int
+largeblob_set_array(fido_dev_t *dev, const cbor_item_t *item, const char *pin,
+    int *ms)
+{
+	int r;
+
+	do
+		r = largeblob_write_array(dev, item, pin, ms);
+	while (fido_dev_uv_token_retry(dev, r));
 
 	return r;
 }
@@ -658,7 +1067,7 @@ largeblob_add(fido_dev_t *dev, const fido_blob_t *key, cbor_item_t *item,
 		goto fail;
 	}
 
-	switch (r = largeblob_array_lookup(NULL, &idx, array, key)) {
+	switch (r = largeblob_array_lookup(dev, NULL, &idx, array, key)) {
 	case FIDO_OK:
 		if (!cbor_array_replace(array, idx, item)) {
 			r = FIDO_ERR_INTERNAL;
@@ -701,7 +1110,8 @@ largeblob_drop(fido_dev_t *dev, const fido_blob_t *key, const char *pin,
 		fido_log_debug("%s: largeblob_get_array", __func__);
 		goto fail;
 	}
-	if ((r = largeblob_array_lookup(NULL, &idx, array, key)) != FIDO_OK) {
+	if ((r = largeblob_array_lookup(dev, NULL, &idx, array,
+	    key)) != FIDO_OK) {
 		fido_log_debug("%s: largeblob_array_lookup", __func__);
 		goto fail;
 	}
@@ -727,6 +1137,7 @@ int
 fido_dev_largeblob_get(fido_dev_t *dev, const unsigned char *key_ptr,
     size_t key_len, unsigned char **blob_ptr, size_t *blob_len)
 {
+	fido_trace_span_t span;
 	cbor_item_t *item = NULL;
 	fido_blob_t key, body;
 	int ms = dev->timeout_ms;
@@ -750,17 +1161,22 @@ fido_dev_largeblob_get(fido_dev_t *dev, const unsigned char *key_ptr,
 		fido_log_debug("%s: fido_blob_set", __func__);
 		return FIDO_ERR_INTERNAL;
 	}
+	fido_sched_enter(dev);
+	fido_trace_span_begin(dev, &span, FIDO_SPAN_LARGEBLOB);
 	if ((r = largeblob_get_array(dev, &item, &ms)) != FIDO_OK) {
 		fido_log_debug("%s: largeblob_get_array", __func__);
 		goto fail;
 	}
-	if ((r = largeblob_array_lookup(&body, NULL, item, &key)) != FIDO_OK)
+	if ((r = largeblob_array_lookup(dev, &body, NULL, item,
+	    &key)) != FIDO_OK)
 		fido_log_debug("%s: largeblob_array_lookup", __func__);
 	else {
-		*blob_ptr = body.ptr;
+		*blob_ptr = fido_mem_handover(body.ptr, body.len);
 		*blob_len = body.len;
 	}
 fail:
+	fido_trace_span_end(dev, &span, r);
+	fido_sched_leave(dev);
 	if (item != NULL)
 		cbor_decref(&item);
 
@@ -769,11 +1185,116 @@ fail:
 	return r;
 }
 
+/*
+ * Read the blobs of n keys with one fetch of the array. Keys with an
+ * entry in the index are tried against it; the others share a single
+ * pass over the array, in which each entry is decoded once.
+ */
+int
+fido_dev_largeblob_get_batch(fido_dev_t *dev,
+    const unsigned char *const *key_ptr, const size_t *key_len, size_t n,
+    unsigned char **blob_ptr, size_t *blob_len, int *result)
+{
+	fido_trace_span_t span;
+	cbor_item_t *item = NULL, **v;
+	fido_blob_t key, body, *plaintext;
+	largeblob_t blob;
+	size_t hint, left = 0;
+	int ms = dev->timeout_ms;
+	int r;
+
+	memset(&blob, 0, sizeof(blob));
+
+	if (key_ptr == NULL || key_len == NULL || blob_ptr == NULL ||
+	    blob_len == NULL || result == NULL || n == 0) {
+		fido_log_debug("%s: invalid argument", __func__);
+		return FIDO_ERR_INVALID_ARGUMENT;
+	}
+	for (size_t i = 0; i < n; i++) {
+		blob_ptr[i] = NULL;
+		blob_len[i] = 0;
+		if (key_ptr[i] == NULL || key_len[i] != 32) {
+			fido_log_debug("%s: invalid key %zu", __func__, i);
+			result[i] = FIDO_ERR_INVALID_ARGUMENT;
+		} else {
+			result[i] = FIDO_ERR_NOTFOUND;
+			left++;
+		}
+	}
+	fido_sched_enter(dev);
+	fido_trace_span_begin(dev, &span, FIDO_SPAN_LARGEBLOB);
+	if ((r = largeblob_get_array(dev, &item, &ms)) != FIDO_OK) {
+		fido_log_debug("%s: largeblob_get_array", __func__);
+		goto fail;
+	}
+	if ((v = cbor_array_handle(item)) == NULL && cbor_array_size(item)) {
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto fail;
+	}
+
+	/* keys the index knows */
+	for (size_t i = 0; i < n && left > 0; i++) {
+		if (result[i] != FIDO_ERR_NOTFOUND)
+			continue;
+		key.ptr = (u_char *)(uintptr_t)key_ptr[i];
+		key.len = key_len[i];
+		if (largeblob_index_get(dev, &key, &hint) < 0 ||
+		    hint >= cbor_array_size(item) || (plaintext =
+		    largeblob_array_open(&blob, v, hint, &key)) == NULL)
+			continue;
+		memset(&body, 0, sizeof(body));
+		result[i] = fido_uncompress(&body, plaintext, blob.origsiz);
+		blob_ptr[i] = fido_mem_handover(body.ptr, body.len);
+		blob_len[i] = body.len;
+		fido_blob_free(&plaintext);
+		left--;
+	}
+
+	/* one pass over the array for the rest */
+	for (size_t j = 0; j < cbor_array_size(item) && left > 0; j++) {
+		largeblob_reset(&blob);
+		if (largeblob_decode(&blob, v[j]) < 0) {
+			fido_log_debug("%s: largeblob_decode", __func__);
+			continue;
+		}
+		for (size_t i = 0; i < n && left > 0; i++) {
+			if (result[i] != FIDO_ERR_NOTFOUND)
+				continue;
+			key.ptr = (u_char *)(uintptr_t)key_ptr[i];
+			key.len = key_len[i];
+			if ((plaintext = largeblob_decrypt(&blob,
+			    &key)) == NULL)
+				continue;
+			memset(&body, 0, sizeof(body));
+			result[i] = fido_uncompress(&body, plaintext,
+			    blob.origsiz);
+			blob_ptr[i] = fido_mem_handover(body.ptr, body.len);
+			blob_len[i] = body.len;
+			fido_blob_free(&plaintext);
+			largeblob_index_put(dev, &key, j);
+			left--;
+			break; /* an entry opens with one key only */
+		}
+	}
+
+	r = FIDO_OK;
+fail:
+	fido_trace_span_end(dev, &span, r);
+	fido_sched_leave(dev);
+	if (item != NULL)
+		cbor_decref(&item);
+
+	largeblob_reset(&blob);
+
+	return r;
+}
+
 int
 fido_dev_largeblob_set(fido_dev_t *dev, const unsigned char *key_ptr,
     size_t key_len, const unsigned char *blob_ptr, size_t blob_len,
     const char *pin)
 {
+	fido_trace_span_t span;
 	cbor_item_t *item = NULL;
 	fido_blob_t key, body;
 	int ms = dev->timeout_ms;
@@ -797,13 +1318,17 @@ fido_dev_largeblob_set(fido_dev_t *dev, const unsigned char *key_ptr,
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
-	if ((item = largeblob_encode(&body, &key)) == NULL) {
+	if ((item = largeblob_encode(dev, &body, &key)) == NULL) {
 		fido_log_debug("%s: largeblob_encode", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
+	fido_sched_enter(dev);
+	fido_trace_span_begin(dev, &span, FIDO_SPAN_LARGEBLOB);
 	if ((r = largeblob_add(dev, &key, item, pin, &ms)) != FIDO_OK)
 		fido_log_debug("%s: largeblob_add", __func__);
+	fido_trace_span_end(dev, &span, r);
+	fido_sched_leave(dev);
 fail:
 	if (item != NULL)
 		cbor_decref(&item);
@@ -818,6 +1343,7 @@ int
 fido_dev_largeblob_remove(fido_dev_t *dev, const unsigned char *key_ptr,
     size_t key_len, const char *pin)
 {
+	fido_trace_span_t span;
 	fido_blob_t key;
 	int ms = dev->timeout_ms;
 	int r;
@@ -832,8 +1358,12 @@ fido_dev_largeblob_remove(fido_dev_t *dev, const unsigned char *key_ptr,
 		fido_log_debug("%s: fido_blob_set", __func__);
 		return FIDO_ERR_INTERNAL;
 	}
+	fido_sched_enter(dev);
+	fido_trace_span_begin(dev, &span, FIDO_SPAN_LARGEBLOB);
 	if ((r = largeblob_drop(dev, &key, pin, &ms)) != FIDO_OK)
 		fido_log_debug("%s: largeblob_drop", __func__);
+	fido_trace_span_end(dev, &span, r);
+	fido_sched_leave(dev);
 
 	fido_blob_reset(&key);
 
@@ -844,6 +1374,7 @@ int
 fido_dev_largeblob_get_array(fido_dev_t *dev, unsigned char **cbor_ptr,
     size_t *cbor_len)
 {
+	fido_trace_span_t span;
 	cbor_item_t *item = NULL;
 	fido_blob_t cbor;
 	int ms = dev->timeout_ms;
@@ -858,7 +1389,12 @@ fido_dev_largeblob_get_array(fido_dev_t *dev, unsigned char **cbor_ptr,
 	}
 	*cbor_ptr = NULL;
 	*cbor_len = 0;
-	if ((r = largeblob_get_array(dev, &item, &ms)) != FIDO_OK) {
+	fido_sched_enter(dev);
+	fido_trace_span_begin(dev, &span, FIDO_SPAN_LARGEBLOB);
+	r = largeblob_get_array(dev, &item, &ms);
+	fido_trace_span_end(dev, &span, r);
+	fido_sched_leave(dev);
+	if (r != FIDO_OK) {
 		fido_log_debug("%s: largeblob_get_array", __func__);
 		return r;
 	}
@@ -866,7 +1402,7 @@ fido_dev_largeblob_get_array(fido_dev_t *dev, unsigned char **cbor_ptr,
 		fido_log_debug("%s: fido_blob_serialise", __func__);
 		r = FIDO_ERR_INTERNAL;
 	} else {
-		*cbor_ptr = cbor.ptr;
+		*cbor_ptr = fido_mem_handover(cbor.ptr, cbor.len);
 		*cbor_len = cbor.len;
 	}
 
@@ -879,6 +1415,7 @@ int
 fido_dev_largeblob_set_array(fido_dev_t *dev, const unsigned char *cbor_ptr,
     size_t cbor_len, const char *pin)
 {
+	fido_trace_span_t span;
 	cbor_item_t *item = NULL;
 	struct cbor_load_result cbor_result;
 	int ms = dev->timeout_ms;
@@ -893,10 +1430,196 @@ fido_dev_largeblob_set_array(fido_dev_t *dev, const unsigned char *cbor_ptr,
 		fido_log_debug("%s: cbor_load", __func__);
 		return FIDO_ERR_INVALID_ARGUMENT;
 	}
+	fido_sched_enter(dev);
+	fido_trace_span_begin(dev, &span, FIDO_SPAN_LARGEBLOB);
 	if ((r = largeblob_set_array(dev, item, pin, &ms)) != FIDO_OK)
 		fido_log_debug("%s: largeblob_set_array", __func__);
+	fido_trace_span_end(dev, &span, r);
+	fido_sched_leave(dev);
 
 	cbor_decref(&item);
 
 	return r;
 }
+
+int
+fido_dev_largeblob_get_stream(fido_dev_t *dev, const unsigned char *key_ptr,
+    size_t key_len, fido_largeblob_write_t *wr, void *arg)
+{
+	fido_trace_span_t span;
+	cbor_item_t *item = NULL;
+	fido_blob_t key, *plaintext = NULL;
+	size_t origsiz;
+	int ms = dev->timeout_ms;
+	int r;
+
+	memset(&key, 0, sizeof(key));
+
+	if (key_len != 32) {
+		fido_log_debug("%s: invalid key len %zu", __func__, key_len);
+		return FIDO_ERR_INVALID_ARGUMENT;
+	}
+	if (wr == NULL) {
+		fido_log_debug("%s: wr=NULL", __func__);
+		return FIDO_ERR_INVALID_ARGUMENT;
+	}
+	if (fido_blob_set(&key, key_ptr, key_len) < 0) {
+		fido_log_debug("%s: fido_blob_set", __func__);
+		return FIDO_ERR_INTERNAL;
+	}
+	fido_sched_enter(dev);
+	fido_trace_span_begin(dev, &span, FIDO_SPAN_LARGEBLOB);
+	if ((r = largeblob_get_array(dev, &item, &ms)) != FIDO_OK)
+		fido_log_debug("%s: largeblob_get_array", __func__);
+	else if ((r = largeblob_array_find(dev, &plaintext, &origsiz, NULL,
+	    item, &key)) != FIDO_OK)
+		fido_log_debug("%s: largeblob_array_find", __func__);
+	fido_trace_span_end(dev, &span, r);
+	fido_sched_leave(dev);
+	if (r != FIDO_OK)
+		goto fail;
+	/* the blob is inflated into wr without being held whole */
+	if ((r = fido_uncompress_stream(plaintext, origsiz, wr,
+	    arg)) != FIDO_OK)
+		fido_log_debug("%s: fido_uncompress_stream", __func__);
+fail:
+	if (item != NULL)
+		cbor_decref(&item);
+
+	fido_blob_free(&plaintext);
+	fido_blob_reset(&key);
+
+	return r;
+}
+
+int
+fido_dev_largeblob_set_stream(fido_dev_t *dev, const unsigned char *key_ptr,
+    size_t key_len, fido_largeblob_read_t *rd, void *arg, const char *pin)
+{
+	fido_trace_span_t span;
+	largeblob_t *blob = NULL;
+	cbor_item_t *item = NULL;
+	fido_blob_t key, plaintext;
+	size_t origsiz;
+	int ms = dev->timeout_ms;
+	int r;
+
+	memset(&key, 0, sizeof(key));
+	memset(&plaintext, 0, sizeof(plaintext));
+
+	if (key_len != 32) {
+		fido_log_debug("%s: invalid key len %zu", __func__, key_len);
+		return FIDO_ERR_INVALID_ARGUMENT;
+	}
+	if (rd == NULL) {
+		fido_log_debug("%s: rd=NULL", __func__);
+		return FIDO_ERR_INVALID_ARGUMENT;
+	}
+	if (fido_blob_set(&key, key_ptr, key_len) < 0) {
+		fido_log_debug("%s: fido_blob_set", __func__);
+		return FIDO_ERR_INTERNAL;
+	}
+	/* the blob is deflated as it is read, without being held whole */
+	if ((r = fido_compress_stream(&plaintext, &origsiz,
+	    dev->largeblob_level, rd, arg)) != FIDO_OK) {
+		fido_log_debug("%s: fido_compress_stream", __func__);
+		goto fail;
+	}
+	if (origsiz == 0) {
+		fido_log_debug("%s: empty blob", __func__);
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto fail;
+	}
+	if ((blob = largeblob_new()) == NULL ||
+	    largeblob_seal(blob, &plaintext, origsiz, &key) < 0 ||
+	    (item = largeblob_pack(blob)) == NULL) {
+		fido_log_debug("%s: largeblob_pack", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+	fido_sched_enter(dev);
+	fido_trace_span_begin(dev, &span, FIDO_SPAN_LARGEBLOB);
+	if ((r = largeblob_add(dev, &key, item, pin, &ms)) != FIDO_OK)
+		fido_log_debug("%s: largeblob_add", __func__);
+	fido_trace_span_end(dev, &span, r);
+	fido_sched_leave(dev);
+fail:
+	if (item != NULL)
+		cbor_decref(&item);
+
+	largeblob_free(&blob);
+	fido_blob_reset(&key);
+	fido_blob_reset(&plaintext);
+
+	return r;
+}
+
+int
+fido_dev_set_largeblob_level(fido_dev_t *dev, int level)
+{
+	if (level < -1 || level > 9) {
+		fido_log_debug("%s: level=%d", __func__, level);
+		return FIDO_ERR_INVALID_ARGUMENT;
+	}
+	dev->largeblob_level = level;
+
+	return FIDO_OK;
+}
+
+/*
+ * The entry of a blob is made of its compressed and encrypted body, its
+ * nonce and its original size. Only the length of the body depends on
+ * its contents, so a throwaway key serves to measure it.
+ */
+int
+fido_dev_largeblob_entry_len(const fido_dev_t *dev,
+    const unsigned char *blob_ptr, size_t blob_len, size_t *entry_len)
+{
+	cbor_item_t *item = NULL;
+	fido_blob_t key, body, cbor;
+	u_char zero[32];
+	int r;
+
+	memset(&body, 0, sizeof(body));
+	memset(&cbor, 0, sizeof(cbor));
+	memset(zero, 0, sizeof(zero));
+	key.ptr = zero;
+	key.len = sizeof(zero);
+
+	if (blob_ptr == NULL || blob_len == 0 || entry_len == NULL) {
+		fido_log_debug("%s: invalid blob_ptr=%p, blob_len=%zu, "
+		    "entry_len=%p", __func__, (const void *)blob_ptr, blob_len,
+		    (void *)entry_len);
+		return FIDO_ERR_INVALID_ARGUMENT;
+	}
+	*entry_len = 0;
+	if (fido_blob_set(&body, blob_ptr, blob_len) < 0) {
+		fido_log_debug("%s: fido_blob_set", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+	if ((item = largeblob_encode(dev, &body, &key)) == NULL ||
+	    fido_blob_serialise(&cbor, item) < 0) {
+		fido_log_debug("%s: largeblob_encode", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+	*entry_len = cbor.len;
+
+	r = FIDO_OK;
+fail:
+	if (item != NULL)
+		cbor_decref(&item);
+
+	fido_blob_reset(&body);
+	fido_blob_reset(&cbor);
+
+	return r;
+}
+
+void
+fido_dev_largeblob_flush(fido_dev_t *dev)
+{
+	fido_blob_free(&dev->largeblob);
+	largeblob_index_drop(dev);
+}
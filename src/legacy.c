@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+
+#include "fido.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/*
+ * Devices that claim CTAP2 in their CTAPHID_INIT reply but fail
+ * authenticatorGetInfo, and are therefore opened as U2F. Remembering
+ * them spares later opens the failed probe, and its timeout.
+ *
+ * A device is identified by the fixed part of its CTAPHID_INIT reply,
+ * which includes its firmware version, and by its USB vendor and product
+ * ids if known, or its path otherwise. Only entries with ids are saved
+ * by fido_legacy_cache_save(), one per line:
+ *
+ *   vvvv:pppp iiiiiiiiii
+ *
+ * where vvvv and pppp are the ids and iiiiiiiiii the five bytes of the
+ * CTAPHID_INIT reply, in hex.
+ */
+
+#define LEGACY_CACHE_MAXLEN	256
+#define LEGACY_LINELEN		21 /* including newline */
+
+struct legacy_entry {
+	char		*path;     /* device path; NULL if model is set */
+	uint32_t	 model;    /* vendor << 16 | product, or 0 */
+	uint8_t		 ident[5]; /* ctaphid protocol, version and flags */
+	uint64_t	 used;     /* tick of last lookup */
+};
+
+static struct legacy_cache {
+	struct legacy_entry	*entry; /* known u2f-only devices */
+	size_t			 size;  /* capacity of entry[] */
+	size_t			 len;   /* entries in use */
+	uint64_t		 tick;  /* lookup counter */
+} legacy_cache;
+
+#if defined(HAVE_PTHREAD)
+static pthread_mutex_t legacy_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LEGACY_LOCK()		pthread_mutex_lock(&legacy_lock)
+#define LEGACY_UNLOCK()		pthread_mutex_unlock(&legacy_lock)
+#elif defined(_WIN32)
+static SRWLOCK legacy_lock = SRWLOCK_INIT;
+#define LEGACY_LOCK()		AcquireSRWLockExclusive(&legacy_lock)
+#define LEGACY_UNLOCK()		ReleaseSRWLockExclusive(&legacy_lock)
+#else
+#define LEGACY_LOCK()		do { } while (0)
+#define LEGACY_UNLOCK()		do { } while (0)
+#endif
+
+/* called before fido_dev_force_u2f(), which clears FIDO_CAP_CBOR */
+static void
+legacy_ident(const fido_dev_t *dev, uint8_t ident[5])
+{
+	ident[0] = dev->attr.protocol;
+	ident[1] = dev->attr.major;
+	ident[2] = dev->attr.minor;
+	ident[3] = dev->attr.build;
+	ident[4] = dev->attr.flags;
+}
+
+static void
+legacy_entry_reset(struct legacy_entry *e)
+{
+	fido_free(e->path);
+	memset(e, 0, sizeof(*e));
+}
+
+/* caller must hold legacy_lock */
+static void
+legacy_cache_trim(size_t len)
+{
+	while (legacy_cache.len > len)
+		legacy_entry_reset(&legacy_cache.entry[--legacy_cache.len]);
+}
+
+/* caller must hold legacy_lock */
+static struct legacy_entry *
+legacy_cache_find(uint32_t model, const char *path, const uint8_t ident[5])
+{
+	struct legacy_entry *e;
+
+	for (size_t i = 0; i < legacy_cache.len; i++) {
+		e = &legacy_cache.entry[i];
+		if (memcmp(e->ident, ident, sizeof(e->ident)) != 0)
+			continue;
+		if (model != 0 ? e->model == model :
+		    e->path != NULL && strcmp(e->path, path) == 0)
+			return (e);
+	}
+
+	return (NULL);
+}
+
+/* caller must hold legacy_lock */
+static struct legacy_entry *
+legacy_cache_slot(void)
+{
+	struct legacy_entry *e;
+
+	if (legacy_cache.len < legacy_cache.size)
+		return (&legacy_cache.entry[legacy_cache.len++]);
+
+	/* evict the least recently used entry */
+	e = &legacy_cache.entry[0];
+	for (size_t i = 1; i < legacy_cache.len; i++)
+		if (legacy_cache.entry[i].used < e->used)
+			e = &legacy_cache.entry[i];
+	legacy_entry_reset(e);
+
+	return (e);
+}
+
+/* caller must hold legacy_lock; n is consumed */
+static void
+legacy_cache_put(struct legacy_entry *n)
+{
+	struct legacy_entry *e;
+
+	if ((e = legacy_cache_find(n->model, n->path, n->ident)) != NULL)
+		legacy_entry_reset(e);
+	else
+		e = legacy_cache_slot();
+	*e = *n;
+	e->used = ++legacy_cache.tick;
+	memset(n, 0, sizeof(*n));
+}
+
+/* returns 0 if dev, at path, is known to fail authenticatorGetInfo */
+int
+fido_legacy_lookup(const fido_dev_t *dev, const char *path)
+{
+	struct legacy_entry	*e;
+	uint8_t			 ident[5];
+	int			 ok = -1;
+
+	legacy_ident(dev, ident);
+
+	LEGACY_LOCK();
+	if ((e = legacy_cache_find(dev->model, path, ident)) != NULL) {
+		e->used = ++legacy_cache.tick;
+		ok = 0;
+	}
+	LEGACY_UNLOCK();
+
+	return (ok);
+}
+
+void
+fido_legacy_store(const fido_dev_t *dev, const char *path)
+{
+	struct legacy_entry n;
+
+	memset(&n, 0, sizeof(n));
+	n.model = dev->model;
+	legacy_ident(dev, n.ident);
+
+	if (n.model == 0 && (n.path = fido_strdup(path)) == NULL) {
+		fido_log_debug("%s: strdup", __func__);
+		return;
+	}
+
+	LEGACY_LOCK();
+	if (legacy_cache.size > 0)
+		legacy_cache_put(&n);
+	LEGACY_UNLOCK();
+
+	legacy_entry_reset(&n);
+}
+
+int
+fido_legacy_cache_set_size(size_t size)
+{
+	struct legacy_entry *entry;
+
+	if (size > LEGACY_CACHE_MAXLEN) {
+		fido_log_debug("%s: size=%zu", __func__, size);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	LEGACY_LOCK();
+	legacy_cache_trim(size);
+	if (size == 0) {
+		fido_free(legacy_cache.entry);
+		legacy_cache.entry = NULL;
+	} else if ((entry = fido_recallocarray(legacy_cache.entry,
+	    legacy_cache.size, size, sizeof(*entry))) == NULL) {
+		LEGACY_UNLOCK();
+		return (FIDO_ERR_INTERNAL);
+	} else
+		legacy_cache.entry = entry;
+	legacy_cache.size = size;
+	LEGACY_UNLOCK();
+
+	return (FIDO_OK);
+}
+
+void
+fido_legacy_cache_clear(void)
+{
+	LEGACY_LOCK();
+	legacy_cache_trim(0);
+	LEGACY_UNLOCK();
+}
+
+size_t
+fido_legacy_cache_len(void)
+{
+	size_t len;
+
+	LEGACY_LOCK();
+	len = legacy_cache.len;
+	LEGACY_UNLOCK();
+
+	return (len);
+}
+
+static int
+legacy_parse(const char *line, struct legacy_entry *n)
+{
+	unsigned int	v, p, x[5];
+	char		end;
+
+	if (sscanf(line, "%4x:%4x %2x%2x%2x%2x%2x%c", &v, &p, &x[0], &x[1],
+	    &x[2], &x[3], &x[4], &end) != 8 || end != '\n' ||
+	    (v == 0 && p == 0))
+		return (-1);
+
+	memset(n, 0, sizeof(*n));
+	n->model = (uint32_t)v << 16 | (uint32_t)p;
+	for (size_t i = 0; i < nitems(x); i++)
+		n->ident[i] = (uint8_t)x[i];
+
+	return (0);
+}
+
+int
+fido_legacy_cache_load(const char *path)
+{
+	struct legacy_entry	 n;
+	FILE			*fp;
+	char			 line[LEGACY_LINELEN + 2];
+	int			 r = FIDO_OK;
+
+	if (path == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if ((fp = fopen(path, "r")) == NULL) {
+		fido_log_error(errno, "%s: fopen %s", __func__, path);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	LEGACY_LOCK();
+	while (fgets(line, (int)sizeof(line), fp) != NULL) {
+		if (legacy_parse(line, &n) < 0) {
+			fido_log_debug("%s: invalid line", __func__);
+			r = FIDO_ERR_INVALID_ARGUMENT;
+			break;
+		}
+		if (legacy_cache.size > 0)
+			legacy_cache_put(&n);
+	}
+	if (r == FIDO_OK && ferror(fp)) {
+		fido_log_error(errno, "%s: fgets %s", __func__, path);
+		r = FIDO_ERR_INTERNAL;
+	}
+	LEGACY_UNLOCK();
+
+	fclose(fp);
+
+	return (r);
+}
+
+int
+fido_legacy_cache_save(const char *path)
+{
+	const struct legacy_entry	*e;
+	FILE				*fp;
+	int				 r = FIDO_OK;
+
+	if (path == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if ((fp = fopen(path, "w")) == NULL) {
+		fido_log_error(errno, "%s: fopen %s", __func__, path);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	LEGACY_LOCK();
+	for (size_t i = 0; i < legacy_cache.len; i++) {
+		e = &legacy_cache.entry[i];
+		if (e->model == 0)
+			continue;
+		if (fprintf(fp, "%04x:%04x %02x%02x%02x%02x%02x\n",
+		    e->model >> 16, e->model & 0xffff, e->ident[0],
+		    e->ident[1], e->ident[2], e->ident[3],
+		    e->ident[4]) != LEGACY_LINELEN) {
+			fido_log_error(errno, "%s: fprintf %s", __func__, path);
+			r = FIDO_ERR_INTERNAL;
+			break;
+		}
+	}
+	LEGACY_UNLOCK();
+
+	if (fclose(fp) != 0) {
+		fido_log_error(errno, "%s: fclose %s", __func__, path);
+		r = FIDO_ERR_INTERNAL;
+	}
+
+	return (r);
+}
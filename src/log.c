@@ -22,7 +22,7 @@
 #define TLS
 #endif
 
-static TLS int logging;
+TLS int fido_logging;
 static TLS fido_log_handler_t *log_handler;
 
 static void
@@ -49,7 +49,7 @@ do_log(const char *suffix, const char *fmt, va_list args)
 void
 fido_log_init(void)
 {
-	logging = 1;
+	fido_logging = 1;
 	log_handler = log_on_stderr;
 }
 
@@ -58,7 +58,7 @@ fido_log_debug(const char *fmt, ...)
 {
 	va_list args;
 
-	if (!logging || log_handler == NULL)
+	if (!fido_logging || log_handler == NULL)
 		return;
 
 	va_start(args, fmt);
@@ -73,7 +73,7 @@ fido_log_xxd(const void *buf, size_t count, const char *fmt, ...)
 	char row[XXDROW], xxd[XXDLEN];
 	va_list args;
 
-	if (!logging || log_handler == NULL)
+	if (!fido_logging || log_handler == NULL)
 		return;
 
 	snprintf(row, sizeof(row), "buf=%p, len=%zu", buf, count);
@@ -102,7 +102,7 @@ fido_log_error(int errnum, const char *fmt, ...)
 	char errstr[LINELEN];
 	va_list args;
 
-	if (!logging || log_handler == NULL)
+	if (!fido_logging || log_handler == NULL)
 		return;
 	if (strerror_r(errnum, errstr, sizeof(errstr)) != 0)
 		snprintf(errstr, sizeof(errstr), "error %d", errnum);
@@ -0,0 +1,819 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <poll.h>
+#endif
+
+#include "fido.h"
+#include "fido/loop.h"
+
+#define LOOP_TICK_MS		20 /* how often to step devices without an fd */
+#define LOOP_GROUP_MAXTHREADS	256
+
+struct loop_entry {
+	fido_dev_t	*dev;    /* device with a pending operation */
+	int		 op;     /* FIDO_DEV_ASYNC_* */
+	void		*obj;    /* fido_assert_t or fido_cred_t */
+	fido_loop_cb_t	*cb;     /* completion callback */
+	void		*cookie; /* caller's cookie */
+};
+
+#ifdef _WIN32
+typedef struct loop_pollfd {
+	int   fd;
+	short events;
+	short revents;
+	void *event; /* fido_dev_poll_event(), if fd is -1 */
+} loop_pollfd_t;
+#ifndef POLLIN
+#define POLLIN	0x0100
+#endif
+#else
+typedef struct pollfd loop_pollfd_t;
+#endif
+
+struct fido_loop {
+	struct loop_entry	*entry; /* pending operations */
+	loop_pollfd_t		*pfd;   /* entry[i] is polled through pfd[i] */
+	size_t			 len;   /* entries in use */
+	size_t			 size;  /* capacity of entry[] and pfd[] */
+};
+
+fido_loop_t *
+fido_loop_new(void)
+{
+	return (fido_calloc(1, sizeof(fido_loop_t)));
+}
+
+void
+fido_loop_free(fido_loop_t **loop_p)
+{
+	fido_loop_t *loop;
+
+	if (loop_p == NULL || (loop = *loop_p) == NULL)
+		return;
+	fido_free(loop->entry);
+	fido_free(loop->pfd);
+	fido_free(loop);
+	*loop_p = NULL;
+}
+
+size_t
+fido_loop_pending(const fido_loop_t *loop)
+{
+	return (loop->len);
+}
+
+static int
+loop_grow(fido_loop_t *loop)
+{
+	struct loop_entry	*entry;
+	loop_pollfd_t		*pfd;
+	size_t			 size;
+
+	if (loop->len < loop->size)
+		return (0);
+	if (loop->size > SIZE_MAX / 2 - 1)
+		return (-1);
+
+	size = loop->size ? loop->size * 2 : 8;
+	if ((entry = fido_recallocarray(loop->entry, loop->size, size,
+	    sizeof(*entry))) == NULL)
+		return (-1);
+	loop->entry = entry;
+	if ((pfd = fido_recallocarray(loop->pfd, loop->size, size,
+	    sizeof(*pfd))) == NULL)
+		return (-1);
+	loop->pfd = pfd;
+	loop->size = size;
+
+	return (0);
+}
+
+static int
+loop_add(fido_loop_t *loop, fido_dev_t *dev, int op, void *obj,
+    const char *pin, fido_loop_cb_t *cb, void *cookie)
+{
+	struct loop_entry	*e;
+	int			 r;
+
+	if (dev == NULL || obj == NULL || cb == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if (loop_grow(loop) < 0) {
+		fido_log_debug("%s: loop_grow", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	if (op == FIDO_DEV_ASYNC_ASSERT)
+		r = fido_dev_get_assert_begin(dev, obj, pin);
+	else
+		r = fido_dev_make_cred_begin(dev, obj, pin);
+	if (r != FIDO_OK) {
+		fido_log_debug("%s: begin op=%d", __func__, op);
+		return (r);
+	}
+
+	e = &loop->entry[loop->len++];
+	e->dev = dev;
+	e->op = op;
+	e->obj = obj;
+	e->cb = cb;
+	e->cookie = cookie;
+
+	return (FIDO_OK);
+}
+
+int
+fido_loop_add_assert(fido_loop_t *loop, fido_dev_t *dev,
+    fido_assert_t *assert, const char *pin, fido_loop_cb_t *cb, void *cookie)
+{
+	return (loop_add(loop, dev, FIDO_DEV_ASYNC_ASSERT, assert, pin, cb,
+	    cookie));
+}
+
+int
+fido_loop_add_cred(fido_loop_t *loop, fido_dev_t *dev, fido_cred_t *cred,
+    const char *pin, fido_loop_cb_t *cb, void *cookie)
+{
+	return (loop_add(loop, dev, FIDO_DEV_ASYNC_CRED, cred, pin, cb,
+	    cookie));
+}
+
+/* the event object to wait on for dev, if it has no descriptor */
+static void *
+loop_event(loop_pollfd_t *pfd, const fido_dev_t *dev)
+{
+#ifdef _WIN32
+	return (pfd->event = fido_dev_poll_event(dev));
+#else
+	(void)pfd;
+	(void)dev;
+
+	return (NULL);
+#endif
+}
+
+/* wait up to ms for any of the first n descriptors; -1 on error */
+static int
+loop_wait(loop_pollfd_t *pfd, size_t n, int ms)
+{
+#ifdef _WIN32
+	HANDLE	h[MAXIMUM_WAIT_OBJECTS];
+	DWORD	nh = 0;
+#endif
+
+	for (size_t i = 0; i < n; i++)
+		pfd[i].revents = 0;
+#ifdef _WIN32
+	/* no pollable descriptors; only event objects are waited on */
+	for (size_t i = 0; i < n; i++) {
+		if (pfd[i].event == NULL)
+			continue;
+		if (nh == MAXIMUM_WAIT_OBJECTS) {
+			/* the rest are stepped every tick */
+			if (ms < 0 || ms > LOOP_TICK_MS)
+				ms = LOOP_TICK_MS;
+			break;
+		}
+		h[nh++] = pfd[i].event;
+	}
+	if (nh == 0) {
+		if (ms > 0)
+			Sleep((DWORD)ms);
+		return (0);
+	}
+	if (WaitForMultipleObjects(nh, h, FALSE, ms < 0 ? INFINITE :
+	    (DWORD)ms) == WAIT_FAILED) {
+		fido_log_debug("%s: WaitForMultipleObjects", __func__);
+		return (-1);
+	}
+
+	return (0);
+#else
+	if (n > UINT_MAX) {
+		fido_log_debug("%s: n=%zu", __func__, n);
+		return (-1);
+	}
+	if (poll(pfd, (nfds_t)n, ms) == -1 && errno != EINTR) {
+		fido_log_error(errno, "%s: poll", __func__);
+		return (-1);
+	}
+
+	return (0);
+#endif
+}
+
+static int
+loop_step(struct loop_entry *e, int *done)
+{
+	if (e->op == FIDO_DEV_ASYNC_ASSERT)
+		return (fido_dev_get_assert_step(e->dev, e->obj, done, 0));
+
+	return (fido_dev_make_cred_step(e->dev, e->obj, done, 0));
+}
+
+/*
+ * Step every device that is ready, invoking the callbacks of those
+ * operations that completed. Entries appended by a callback are left
+ * for the next pass.
+ */
+static void
+loop_dispatch(fido_loop_t *loop)
+{
+	struct loop_entry	e;
+	size_t			n = loop->len;
+	size_t			i = 0;
+	int			done;
+	int			r;
+
+	while (i < n) {
+		if (loop->pfd[i].fd != -1 && loop->pfd[i].revents == 0) {
+			i++;
+			continue;
+		}
+		if ((r = loop_step(&loop->entry[i], &done)) == FIDO_OK &&
+		    done == 0) {
+			i++;
+			continue;
+		}
+		e = loop->entry[i];
+		memmove(&loop->entry[i], &loop->entry[i + 1],
+		    (loop->len - i - 1) * sizeof(*loop->entry));
+		memmove(&loop->pfd[i], &loop->pfd[i + 1],
+		    (loop->len - i - 1) * sizeof(*loop->pfd));
+		loop->len--;
+		n--;
+		e.cb(e.dev, e.cookie, r);
+	}
+}
+
+int
+fido_loop_run(fido_loop_t *loop, int ms)
+{
+	struct timespec	 ts;
+	fido_dev_t	*dev;
+	bool		 tick, ready;
+	int		 wait_ms, next_ms, t;
+
+	while (loop->len > 0) {
+		tick = false;
+		ready = false;
+		next_ms = -1;
+		for (size_t i = 0; i < loop->len; i++) {
+			dev = loop->entry[i].dev;
+			memset(&loop->pfd[i], 0, sizeof(loop->pfd[i]));
+			loop->pfd[i].events = POLLIN;
+			if ((t = fido_dev_poll_timeout(dev)) != -1) {
+				/* waiting on a timer; stepped every pass */
+				loop->pfd[i].fd = -1;
+				if (next_ms == -1 || t < next_ms)
+					next_ms = t;
+			} else if ((loop->pfd[i].fd =
+			    fido_dev_poll_fd(dev)) == -1) {
+				if (loop_event(&loop->pfd[i], dev) == NULL)
+					tick = true;
+			} else if (fido_dev_rx_pending(dev)) {
+				/* already read ahead; step without polling */
+				loop->pfd[i].fd = -1;
+				ready = true;
+			}
+		}
+
+		wait_ms = ms;
+		if (ready)
+			wait_ms = 0;
+		else if (tick && (wait_ms < 0 || wait_ms > LOOP_TICK_MS))
+			wait_ms = LOOP_TICK_MS;
+		if (next_ms != -1 && (wait_ms < 0 || wait_ms > next_ms))
+			wait_ms = next_ms;
+
+		if (fido_time_now(&ts) != 0 ||
+		    loop_wait(loop->pfd, loop->len, wait_ms) < 0)
+			return (FIDO_ERR_INTERNAL);
+
+		loop_dispatch(loop);
+
+		if (fido_time_delta(&ts, &ms) != 0)
+			return (FIDO_ERR_INTERNAL);
+		if (ms == 0 && loop->len > 0)
+			return (FIDO_ERR_TIMEOUT);
+	}
+
+	return (FIDO_OK);
+}
+
+/*
+ * A fido_loop_group_t shards operations over threads, each stepping its
+ * own fido_loop_t. An operation is placed on the least loaded shard, and
+ * begun, stepped and completed by that shard's thread only. Its callback
+ * is then queued on the shard, which runs its queue after each pass over
+ * its devices; a shard with no devices to step steals callbacks from the
+ * others meanwhile. A busy shard's pass lasts up to LOOP_TICK_MS, which
+ * also bounds how long an operation added to it waits to be begun.
+ *
+ * Without threads, a group has a single shard, run by
+ * fido_loop_group_wait() on the calling thread.
+ */
+
+struct group_op {
+	struct group_op		*next;
+	struct group_shard	*shard;  /* owner */
+	fido_dev_t		*dev;
+	int			 op;     /* FIDO_DEV_ASYNC_* */
+	void			*obj;    /* fido_assert_t or fido_cred_t */
+	char			*pin;    /* copy of the caller's, or NULL */
+	fido_loop_cb_t		*cb;     /* completion callback */
+	void			*cookie; /* caller's cookie */
+	int			 result; /* outcome of the operation */
+};
+
+struct group_queue {
+	struct group_op	*head;
+	struct group_op	*tail;
+	size_t		 len;
+};
+
+struct group_shard {
+	fido_loop_group_t	*group;
+	fido_loop_t		*loop;  /* stepped by the shard's thread only */
+#ifdef HAVE_PTHREAD
+	pthread_t		 thread;
+#endif
+	struct group_queue	 inbox; /* operations to begin */
+	struct group_queue	 done;  /* callbacks to run */
+	size_t			 load;  /* operations placed, not yet complete */
+};
+
+struct fido_loop_group {
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t		 lock;
+	pthread_cond_t		 work;    /* operations or callbacks queued */
+	pthread_cond_t		 idle;    /* nothing left pending */
+	bool			 stop;    /* threads should exit */
+#endif
+	struct group_shard	*shard;
+	size_t			 nshards;
+	size_t			 pending; /* callbacks not yet returned */
+};
+
+#ifdef HAVE_PTHREAD
+#define GROUP_LOCK(g)		pthread_mutex_lock(&(g)->lock)
+#define GROUP_UNLOCK(g)		pthread_mutex_unlock(&(g)->lock)
+#define GROUP_SIGNAL(g, c)	pthread_cond_broadcast(&(g)->c)
+#else
+#define GROUP_LOCK(g)		(void)(g)
+#define GROUP_UNLOCK(g)		(void)(g)
+#define GROUP_SIGNAL(g, c)	(void)(g)
+#endif
+
+static void
+group_push(struct group_queue *q, struct group_op *op)
+{
+	op->next = NULL;
+	if (q->tail != NULL)
+		q->tail->next = op;
+	else
+		q->head = op;
+	q->tail = op;
+	q->len++;
+}
+
+static struct group_op *
+group_pop(struct group_queue *q)
+{
+	struct group_op *op;
+
+	if ((op = q->head) != NULL) {
+		if ((q->head = op->next) == NULL)
+			q->tail = NULL;
+		op->next = NULL;
+		q->len--;
+	}
+
+	return (op);
+}
+
+static void
+group_op_free(struct group_op *op)
+{
+	if (op->pin != NULL)
+		fido_freezero(op->pin, strlen(op->pin));
+	fido_free(op);
+}
+
+static void
+group_queue_free(struct group_queue *q)
+{
+	struct group_op *op;
+
+	while ((op = group_pop(q)) != NULL)
+		group_op_free(op);
+}
+
+/* the fido_loop_cb_t of a shard's loop; cookie is the group_op */
+static void
+shard_complete(fido_dev_t *dev, void *cookie, int r)
+{
+	struct group_op		*op = cookie;
+	struct group_shard	*s = op->shard;
+	fido_loop_group_t	*g = s->group;
+
+	(void)dev;
+
+	op->result = r;
+
+	GROUP_LOCK(g);
+	group_push(&s->done, op);
+	s->load--;
+	GROUP_SIGNAL(g, work);
+	GROUP_UNLOCK(g);
+}
+
+static void
+shard_begin(struct group_shard *s, struct group_op *op)
+{
+	int r;
+
+	r = loop_add(s->loop, op->dev, op->op, op->obj, op->pin,
+	    shard_complete, op);
+
+	/* the pin is only used by fido_dev_*_begin() */
+	if (op->pin != NULL) {
+		fido_freezero(op->pin, strlen(op->pin));
+		op->pin = NULL;
+	}
+	if (r != FIDO_OK)
+		shard_complete(op->dev, op, r);
+}
+
+static void
+group_finish(fido_loop_group_t *g, struct group_op *op)
+{
+	op->cb(op->dev, op->cookie, op->result);
+	group_op_free(op);
+
+	GROUP_LOCK(g);
+	if (--g->pending == 0)
+		GROUP_SIGNAL(g, idle);
+	GROUP_UNLOCK(g);
+}
+
+/* run the callbacks queued on s, which others may be stealing */
+static void
+shard_drain(struct group_shard *s)
+{
+	fido_loop_group_t	*g = s->group;
+	struct group_op		*op;
+
+	for (;;) {
+		GROUP_LOCK(g);
+		op = group_pop(&s->done);
+		GROUP_UNLOCK(g);
+		if (op == NULL)
+			break;
+		group_finish(g, op);
+	}
+}
+
+/* fail the operations in s's loop, which can no longer be waited on */
+static void
+shard_fail(struct group_shard *s)
+{
+	struct loop_entry e;
+
+	while (s->loop->len > 0) {
+		e = s->loop->entry[--s->loop->len];
+		e.cb(e.dev, e.cookie, FIDO_ERR_INTERNAL);
+	}
+}
+
+/* abandon s's operations; their callbacks are not invoked */
+static void
+shard_reset(struct group_shard *s)
+{
+	fido_loop_t *loop;
+
+	if ((loop = s->loop) != NULL)
+		for (size_t i = 0; i < loop->len; i++)
+			group_op_free(loop->entry[i].cookie);
+	fido_loop_free(&s->loop);
+	group_queue_free(&s->inbox);
+	group_queue_free(&s->done);
+}
+
+#ifdef HAVE_PTHREAD
+/* caller must hold g->lock; the oldest callback of the longest queue */
+static struct group_op *
+group_steal(fido_loop_group_t *g, const struct group_shard *self)
+{
+	struct group_shard *victim = NULL;
+
+	for (size_t i = 0; i < g->nshards; i++) {
+		if (&g->shard[i] == self || g->shard[i].done.len == 0)
+			continue;
+		if (victim == NULL || g->shard[i].done.len > victim->done.len)
+			victim = &g->shard[i];
+	}
+
+	return (victim != NULL ? group_pop(&victim->done) : NULL);
+}
+
+static void *
+shard_main(void *arg)
+{
+	struct group_shard	*s = arg;
+	fido_loop_group_t	*g = s->group;
+	struct group_queue	 in;
+	struct group_op		*op;
+
+	GROUP_LOCK(g);
+	while (g->stop == false) {
+		in = s->inbox;
+		memset(&s->inbox, 0, sizeof(s->inbox));
+		op = NULL;
+		if (in.head == NULL && s->done.head == NULL &&
+		    fido_loop_pending(s->loop) == 0 &&
+		    (op = group_steal(g, s)) == NULL) {
+			pthread_cond_wait(&g->work, &g->lock);
+			continue;
+		}
+		GROUP_UNLOCK(g);
+		if (op != NULL)
+			group_finish(g, op);
+		while ((op = group_pop(&in)) != NULL)
+			shard_begin(s, op);
+		if (fido_loop_pending(s->loop) > 0 &&
+		    fido_loop_run(s->loop, LOOP_TICK_MS) == FIDO_ERR_INTERNAL)
+			shard_fail(s);
+		shard_drain(s);
+		GROUP_LOCK(g);
+	}
+	GROUP_UNLOCK(g);
+
+	return (NULL);
+}
+
+static void
+group_stop(fido_loop_group_t *g, size_t nthreads)
+{
+	GROUP_LOCK(g);
+	g->stop = true;
+	GROUP_SIGNAL(g, work);
+	GROUP_UNLOCK(g);
+
+	for (size_t i = 0; i < nthreads; i++)
+		pthread_join(g->shard[i].thread, NULL);
+}
+
+static int
+group_start(fido_loop_group_t *g)
+{
+	if (pthread_mutex_init(&g->lock, NULL) != 0)
+		return (-1);
+	if (pthread_cond_init(&g->work, NULL) != 0) {
+		pthread_mutex_destroy(&g->lock);
+		return (-1);
+	}
+	if (pthread_cond_init(&g->idle, NULL) != 0) {
+		pthread_cond_destroy(&g->work);
+		pthread_mutex_destroy(&g->lock);
+		return (-1);
+	}
+
+	for (size_t i = 0; i < g->nshards; i++) {
+		if (pthread_create(&g->shard[i].thread, NULL, shard_main,
+		    &g->shard[i]) != 0) {
+			fido_log_debug("%s: pthread_create", __func__);
+			group_stop(g, i);
+			pthread_cond_destroy(&g->idle);
+			pthread_cond_destroy(&g->work);
+			pthread_mutex_destroy(&g->lock);
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+static int
+group_deadline(struct timespec *ts, int ms)
+{
+	long nsec;
+
+	if (clock_gettime(CLOCK_REALTIME, ts) != 0) {
+		fido_log_debug("%s: clock_gettime", __func__);
+		return (-1);
+	}
+
+	nsec = ts->tv_nsec + (long)(ms % 1000) * 1000000L;
+	ts->tv_sec += ms / 1000 + nsec / 1000000000L;
+	ts->tv_nsec = nsec % 1000000000L;
+
+	return (0);
+}
+#else
+/* the shard's pass, on the calling thread */
+static int
+group_run(fido_loop_group_t *g, int ms)
+{
+	struct group_shard	*s = &g->shard[0];
+	struct group_op		*op;
+	struct timespec		 ts;
+
+	while (g->pending > 0) {
+		if (fido_time_now(&ts) != 0)
+			return (FIDO_ERR_INTERNAL);
+		while ((op = group_pop(&s->inbox)) != NULL)
+			shard_begin(s, op);
+		if (fido_loop_pending(s->loop) > 0 &&
+		    fido_loop_run(s->loop, ms) == FIDO_ERR_INTERNAL)
+			shard_fail(s);
+		shard_drain(s);
+		if (fido_time_delta(&ts, &ms) != 0)
+			return (FIDO_ERR_INTERNAL);
+		if (ms == 0 && g->pending > 0)
+			return (FIDO_ERR_TIMEOUT);
+	}
+
+	return (FIDO_OK);
+}
+#endif /* HAVE_PTHREAD */
+
+static size_t
+online_cpus(void)
+{
+#if defined(HAVE_SYSCONF) && defined(_SC_NPROCESSORS_ONLN)
+	long n;
+
+	if ((n = sysconf(_SC_NPROCESSORS_ONLN)) > 0)
+		return (n > LOOP_GROUP_MAXTHREADS ? LOOP_GROUP_MAXTHREADS :
+		    (size_t)n);
+#endif
+	return (1);
+}
+
+fido_loop_group_t *
+fido_loop_group_new(size_t nthreads)
+{
+	fido_loop_group_t *g;
+
+	if (nthreads > LOOP_GROUP_MAXTHREADS) {
+		fido_log_debug("%s: nthreads=%zu", __func__, nthreads);
+		return (NULL);
+	}
+	if ((g = fido_calloc(1, sizeof(*g))) == NULL)
+		return (NULL);
+#ifdef HAVE_PTHREAD
+	g->nshards = nthreads ? nthreads : online_cpus();
+#else
+	g->nshards = 1;
+#endif
+	if ((g->shard = fido_calloc(g->nshards, sizeof(*g->shard))) == NULL)
+		goto fail;
+	for (size_t i = 0; i < g->nshards; i++) {
+		g->shard[i].group = g;
+		if ((g->shard[i].loop = fido_loop_new()) == NULL)
+			goto fail;
+	}
+#ifdef HAVE_PTHREAD
+	if (group_start(g) < 0) {
+		fido_log_debug("%s: group_start", __func__);
+		goto fail;
+	}
+#endif
+
+	return (g);
+fail:
+	if (g->shard != NULL)
+		for (size_t i = 0; i < g->nshards; i++)
+			fido_loop_free(&g->shard[i].loop);
+	fido_free(g->shard);
+	fido_free(g);
+
+	return (NULL);
+}
+
+void
+fido_loop_group_free(fido_loop_group_t **g_p)
+{
+	fido_loop_group_t *g;
+
+	if (g_p == NULL || (g = *g_p) == NULL)
+		return;
+#ifdef HAVE_PTHREAD
+	group_stop(g, g->nshards);
+	pthread_cond_destroy(&g->idle);
+	pthread_cond_destroy(&g->work);
+	pthread_mutex_destroy(&g->lock);
+#endif
+	for (size_t i = 0; i < g->nshards; i++)
+		shard_reset(&g->shard[i]);
+	fido_free(g->shard);
+	fido_free(g);
+	*g_p = NULL;
+}
+
+static int
+group_add(fido_loop_group_t *g, fido_dev_t *dev, int op, void *obj,
+    const char *pin, fido_loop_cb_t *cb, void *cookie)
+{
+	struct group_shard	*s;
+	struct group_op		*o;
+
+	if (dev == NULL || obj == NULL || cb == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if ((o = fido_calloc(1, sizeof(*o))) == NULL)
+		return (FIDO_ERR_INTERNAL);
+	if (pin != NULL && (o->pin = fido_strdup(pin)) == NULL) {
+		fido_free(o);
+		return (FIDO_ERR_INTERNAL);
+	}
+	o->dev = dev;
+	o->op = op;
+	o->obj = obj;
+	o->cb = cb;
+	o->cookie = cookie;
+
+	GROUP_LOCK(g);
+	s = &g->shard[0];
+	for (size_t i = 1; i < g->nshards; i++)
+		if (g->shard[i].load < s->load)
+			s = &g->shard[i];
+	o->shard = s;
+	group_push(&s->inbox, o);
+	s->load++;
+	g->pending++;
+	GROUP_SIGNAL(g, work);
+	GROUP_UNLOCK(g);
+
+	return (FIDO_OK);
+}
+
+int
+fido_loop_group_add_assert(fido_loop_group_t *g, fido_dev_t *dev,
+    fido_assert_t *assert, const char *pin, fido_loop_cb_t *cb, void *cookie)
+{
+	return (group_add(g, dev, FIDO_DEV_ASYNC_ASSERT, assert, pin, cb,
+	    cookie));
+}
+
+int
+fido_loop_group_add_cred(fido_loop_group_t *g, fido_dev_t *dev,
+    fido_cred_t *cred, const char *pin, fido_loop_cb_t *cb, void *cookie)
+{
+	return (group_add(g, dev, FIDO_DEV_ASYNC_CRED, cred, pin, cb,
+	    cookie));
+}
+
+int
+fido_loop_group_wait(fido_loop_group_t *g, int ms)
+{
+#ifdef HAVE_PTHREAD
+	struct timespec	ts;
+	int		r = FIDO_OK;
+
+	if (ms > 0 && group_deadline(&ts, ms) < 0)
+		return (FIDO_ERR_INTERNAL);
+
+	GROUP_LOCK(g);
+	while (g->pending > 0 && r == FIDO_OK) {
+		if (ms < 0)
+			pthread_cond_wait(&g->idle, &g->lock);
+		else if (ms == 0 ||
+		    pthread_cond_timedwait(&g->idle, &g->lock, &ts) != 0)
+			r = g->pending > 0 ? FIDO_ERR_TIMEOUT : FIDO_OK;
+	}
+	GROUP_UNLOCK(g);
+
+	return (r);
+#else
+	return (group_run(g, ms));
+#endif
+}
+
+size_t
+fido_loop_group_pending(fido_loop_group_t *g)
+{
+	size_t n;
+
+	GROUP_LOCK(g);
+	n = g->pending;
+	GROUP_UNLOCK(g);
+
+	return (n);
+}
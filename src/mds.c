@@ -0,0 +1,659 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * FIDO Metadata Service (MDS3) BLOBs. A BLOB is a JWT whose payload lists
+ * the metadata of authenticators; fido_mds_load() verifies its signature
+ * against a trust store, and indexes the entries naming an AAGUID in a
+ * table sorted by it. A table is not modified once built: a load builds
+ * a new one and swaps it in, and entries looked up hold a reference to
+ * the table they came from.
+ */
+
+#include <openssl/ecdsa.h>
+#include <openssl/sha.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "fido.h"
+#include "fido/verify.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#if defined(HAVE_PTHREAD)
+#define MDS_LOCK_T		pthread_mutex_t
+#define MDS_LOCK_INIT(l)	(pthread_mutex_init((l), NULL) == 0)
+#define MDS_LOCK_FREE(l)	pthread_mutex_destroy(l)
+#define MDS_LOCK(l)		pthread_mutex_lock(l)
+#define MDS_UNLOCK(l)		pthread_mutex_unlock(l)
+#elif defined(_WIN32)
+#define MDS_LOCK_T		SRWLOCK
+#define MDS_LOCK_INIT(l)	(InitializeSRWLock(l), 1)
+#define MDS_LOCK_FREE(l)	do { } while (0)
+#define MDS_LOCK(l)		AcquireSRWLockExclusive(l)
+#define MDS_UNLOCK(l)		ReleaseSRWLockExclusive(l)
+#else
+#define MDS_LOCK_T		int
+#define MDS_LOCK_INIT(l)	1
+#define MDS_LOCK_FREE(l)	do { } while (0)
+#define MDS_LOCK(l)		do { } while (0)
+#define MDS_UNLOCK(l)		do { } while (0)
+#endif
+
+struct mds_entry {
+	unsigned char		 aaguid[16];
+	char			*status;         /* latest status report */
+	char			*status_date;    /* its effectiveDate */
+	char			*description;
+	int			 key_protection; /* FIDO_MDS_KEY_* */
+	fido_trust_store_t	*ts;             /* attestation roots */
+};
+
+struct mds_table {
+	MDS_LOCK_T		 lock;
+	unsigned int		 refs;  /* fido_mds_t, entries handed out */
+	int64_t			 no;    /* serial number of the BLOB */
+	struct mds_entry	*entry; /* sorted by aaguid */
+	size_t			 len;
+};
+
+struct fido_mds {
+	MDS_LOCK_T		 lock;
+	struct mds_table	*table; /* NULL until loaded */
+};
+
+struct fido_mds_entry {
+	struct mds_table	*table;
+	const struct mds_entry	*e;
+};
+
+static char *
+blob_str(const fido_blob_t *b)
+{
+	char *s;
+
+	if (fido_blob_is_empty(b) || memchr(b->ptr, '\0', b->len) != NULL ||
+	    (s = fido_malloc(b->len + 1)) == NULL)
+		return (NULL);
+	memcpy(s, b->ptr, b->len);
+	s[b->len] = '\0';
+
+	return (s);
+}
+
+static void
+table_free(struct mds_table *t)
+{
+	struct mds_entry *e;
+
+	for (size_t i = 0; i < t->len; i++) {
+		e = &t->entry[i];
+		fido_free(e->status);
+		fido_free(e->status_date);
+		fido_free(e->description);
+		fido_trust_store_free(&e->ts);
+	}
+	fido_free(t->entry);
+	MDS_LOCK_FREE(&t->lock);
+	fido_free(t);
+}
+
+static void
+table_ref(struct mds_table *t)
+{
+	MDS_LOCK(&t->lock);
+	t->refs++;
+	MDS_UNLOCK(&t->lock);
+}
+
+static void
+table_unref(struct mds_table *t)
+{
+	unsigned int refs;
+
+	if (t == NULL)
+		return;
+	MDS_LOCK(&t->lock);
+	refs = --t->refs;
+	MDS_UNLOCK(&t->lock);
+	if (refs == 0)
+		table_free(t);
+}
+
+static int
+parse_aaguid(const fido_blob_t *b, unsigned char *aaguid)
+{
+	size_t n = 0;
+	int hi = -1, v;
+
+	/* xxxxxxxx-xxxx-xxxx-xxxx-xxxxxxxxxxxx */
+	if (b->len != 36)
+		return (-1);
+	for (size_t i = 0; i < b->len; i++) {
+		if (i == 8 || i == 13 || i == 18 || i == 23) {
+			if (b->ptr[i] != '-')
+				return (-1);
+			continue;
+		}
+		if (b->ptr[i] >= '0' && b->ptr[i] <= '9')
+			v = b->ptr[i] - '0';
+		else if (b->ptr[i] >= 'a' && b->ptr[i] <= 'f')
+			v = b->ptr[i] - 'a' + 10;
+		else if (b->ptr[i] >= 'A' && b->ptr[i] <= 'F')
+			v = b->ptr[i] - 'A' + 10;
+		else
+			return (-1);
+		if (hi < 0)
+			hi = v;
+		else {
+			aaguid[n++] = (unsigned char)(hi << 4 | v);
+			hi = -1;
+		}
+	}
+
+	return (0);
+}
+
+static int
+parse_status(const char *ptr, size_t len, void *arg)
+{
+	struct mds_entry	*e = arg;
+	fido_blob_t		 status, date;
+	fido_json_field_t	 field[] = {
+		{ NULL, "status", FIDO_JSON_STRING, &status, NULL, NULL, NULL,
+		    false },
+		{ NULL, "effectiveDate", FIDO_JSON_STRING, &date, NULL, NULL,
+		    NULL, false },
+	};
+	char			*s = NULL, *d = NULL;
+	int			 ok = -1;
+
+	memset(&status, 0, sizeof(status));
+	memset(&date, 0, sizeof(date));
+
+	if (fido_json_decode(ptr, len, field, nitems(field)) < 0 ||
+	    (s = blob_str(&status)) == NULL) {
+		fido_log_debug("%s: status report", __func__);
+		goto fail;
+	}
+	if ((d = blob_str(&date)) == NULL && (d = fido_strdup("")) == NULL)
+		goto fail;
+
+	/* ISO 8601 dates compare as strings; later reports win ties */
+	if (e->status_date == NULL || strcmp(d, e->status_date) >= 0) {
+		fido_free(e->status);
+		fido_free(e->status_date);
+		e->status = s;
+		e->status_date = d;
+		s = d = NULL;
+	}
+
+	ok = 0;
+fail:
+	fido_free(s);
+	fido_free(d);
+	fido_blob_reset(&status);
+	fido_blob_reset(&date);
+
+	return (ok);
+}
+
+static int
+parse_root(const char *ptr, size_t len, void *arg)
+{
+	struct mds_entry	*e = arg;
+	fido_blob_t		 der;
+	int			 ok = -1;
+
+	memset(&der, 0, sizeof(der));
+
+	if (fido_json_b64(ptr, len, &der) < 0 ||
+	    fido_trust_store_add_der(e->ts, der.ptr, der.len) != FIDO_OK) {
+		fido_log_debug("%s: attestation root", __func__);
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+	fido_blob_reset(&der);
+
+	return (ok);
+}
+
+static int
+parse_key_protection(const char *ptr, size_t len, void *arg)
+{
+	static const struct {
+		const char	*name;
+		int		 flag;
+	} key[] = {
+		{ "software",		FIDO_MDS_KEY_SOFTWARE },
+		{ "hardware",		FIDO_MDS_KEY_HARDWARE },
+		{ "tee",		FIDO_MDS_KEY_TEE },
+		{ "secure_element",	FIDO_MDS_KEY_SECURE_ELEMENT },
+		{ "remote_handle",	FIDO_MDS_KEY_REMOTE_HANDLE },
+	};
+	struct mds_entry	*e = arg;
+	fido_blob_t		 name;
+
+	memset(&name, 0, sizeof(name));
+
+	if (fido_json_string(ptr, len, &name) < 0) {
+		fido_log_debug("%s: key protection", __func__);
+		return (-1);
+	}
+	for (size_t i = 0; i < nitems(key); i++)
+		if (strlen(key[i].name) == name.len &&
+		    memcmp(key[i].name, name.ptr, name.len) == 0)
+			e->key_protection |= key[i].flag;
+	fido_blob_reset(&name);
+
+	return (0); /* unknown values are ignored */
+}
+
+static int
+parse_entry(const char *ptr, size_t len, void *arg)
+{
+	struct mds_table	*t = arg;
+	struct mds_entry	 e, *p;
+	fido_blob_t		 aaguid, description;
+	fido_json_field_t	 field[] = {
+		{ NULL, "aaguid", FIDO_JSON_STRING, &aaguid, NULL, NULL, NULL,
+		    false },
+		{ NULL, "statusReports", FIDO_JSON_ARRAY, NULL, NULL,
+		    parse_status, &e, false },
+		{ "metadataStatement", "description", FIDO_JSON_STRING,
+		    &description, NULL, NULL, NULL, false },
+		{ "metadataStatement", "attestationRootCertificates",
+		    FIDO_JSON_ARRAY, NULL, NULL, parse_root, &e, false },
+		{ "metadataStatement", "keyProtection", FIDO_JSON_ARRAY, NULL,
+		    NULL, parse_key_protection, &e, false },
+	};
+	int			 ok = -1;
+
+	memset(&e, 0, sizeof(e));
+	memset(&aaguid, 0, sizeof(aaguid));
+	memset(&description, 0, sizeof(description));
+
+	if ((e.ts = fido_trust_store_new()) == NULL)
+		goto fail;
+	if (fido_json_decode(ptr, len, field, nitems(field)) < 0) {
+		fido_log_debug("%s: fido_json_decode", __func__);
+		goto fail;
+	}
+	if (!field[0].found) {
+		ok = 0; /* u2f and uaf authenticators have no aaguid */
+		goto fail;
+	}
+	if (parse_aaguid(&aaguid, e.aaguid) < 0) {
+		fido_log_debug("%s: aaguid", __func__);
+		goto fail;
+	}
+	if (fido_blob_is_empty(&description) == 0 &&
+	    (e.description = blob_str(&description)) == NULL)
+		goto fail;
+	if (t->len == SIZE_MAX || (p = fido_recallocarray(t->entry, t->len,
+	    t->len + 1, sizeof(*p))) == NULL)
+		goto fail;
+	t->entry = p;
+	t->entry[t->len++] = e;
+	memset(&e, 0, sizeof(e));
+
+	ok = 0;
+fail:
+	fido_free(e.status);
+	fido_free(e.status_date);
+	fido_free(e.description);
+	fido_trust_store_free(&e.ts);
+	fido_blob_reset(&aaguid);
+	fido_blob_reset(&description);
+
+	return (ok);
+}
+
+static int
+cmp_entry(const void *a, const void *b)
+{
+	const struct mds_entry *x = a, *y = b;
+
+	return (memcmp(x->aaguid, y->aaguid, sizeof(x->aaguid)));
+}
+
+static int
+collect_x5c(const char *ptr, size_t len, void *arg)
+{
+	fido_blob_array_t	*x5c = arg;
+	fido_blob_t		*p;
+
+	if (x5c->len == SIZE_MAX || (p = fido_recallocarray(x5c->ptr, x5c->len,
+	    x5c->len + 1, sizeof(*p))) == NULL)
+		return (-1);
+	x5c->ptr = p;
+
+	return (fido_json_b64(ptr, len, &x5c->ptr[x5c->len++]));
+}
+
+/* a JWS ES256 signature is r and s, of 32 bytes each; openssl wants DER */
+static int
+es256_sig_der(const fido_blob_t *raw, fido_blob_t *der)
+{
+	ECDSA_SIG	*sig = NULL;
+	BIGNUM		*r = NULL, *s = NULL;
+	unsigned char	*p;
+	int		 len, ok = -1;
+
+	if (raw->len != 64 ||
+	    (sig = ECDSA_SIG_new()) == NULL ||
+	    (r = BN_bin2bn(raw->ptr, 32, NULL)) == NULL ||
+	    (s = BN_bin2bn(raw->ptr + 32, 32, NULL)) == NULL ||
+	    ECDSA_SIG_set0(sig, r, s) != 1) {
+		fido_log_debug("%s: ECDSA_SIG", __func__);
+		BN_free(r);
+		BN_free(s);
+		goto fail;
+	}
+	if ((len = i2d_ECDSA_SIG(sig, NULL)) <= 0 ||
+	    (der->ptr = fido_calloc(1, (size_t)len)) == NULL)
+		goto fail;
+	p = der->ptr;
+	if (i2d_ECDSA_SIG(sig, &p) != len) {
+		fido_blob_reset(der);
+		goto fail;
+	}
+	der->len = (size_t)len;
+
+	ok = 0;
+fail:
+	ECDSA_SIG_free(sig);
+
+	return (ok);
+}
+
+/*
+ * Verify the signature of a compact JWS against ts, and decode its
+ * payload into out.
+ */
+static int
+jws_verify(const char *ptr, size_t len, fido_trust_store_t *ts,
+    fido_blob_t *out)
+{
+	unsigned char		 digest[SHA256_DIGEST_LENGTH];
+	const char		*dot1, *dot2;
+	fido_blob_t		 hdr, alg, sig, der, dgst;
+	fido_blob_array_t	 x5c, chain;
+	fido_json_field_t	 field[] = {
+		{ NULL, "alg", FIDO_JSON_STRING, &alg, NULL, NULL, NULL,
+		    false },
+		{ NULL, "x5c", FIDO_JSON_ARRAY, NULL, NULL, collect_x5c, &x5c,
+		    false },
+	};
+	EVP_PKEY		*pkey = NULL;
+	int			 r = FIDO_ERR_INVALID_ARGUMENT;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memset(&sig, 0, sizeof(sig));
+	memset(&der, 0, sizeof(der));
+	memset(&x5c, 0, sizeof(x5c));
+	memset(&alg, 0, sizeof(alg));
+
+	if ((dot1 = memchr(ptr, '.', len)) == NULL ||
+	    (dot2 = memchr(dot1 + 1, '.', len - (size_t)(dot1 + 1 - ptr))) ==
+	    NULL) {
+		fido_log_debug("%s: not a jws", __func__);
+		goto fail;
+	}
+	if (fido_b64_decode(ptr, (size_t)(dot1 - ptr), &hdr) < 0 ||
+	    fido_b64_decode(dot1 + 1, (size_t)(dot2 - dot1 - 1), out) < 0 ||
+	    fido_b64_decode(dot2 + 1, len - (size_t)(dot2 + 1 - ptr),
+	    &sig) < 0) {
+		fido_log_debug("%s: base64", __func__);
+		goto fail;
+	}
+	if (fido_json_decode((const char *)hdr.ptr, hdr.len, field,
+	    nitems(field)) < 0 || x5c.len == 0) {
+		fido_log_debug("%s: header", __func__);
+		goto fail;
+	}
+
+	chain.ptr = x5c.ptr + 1;
+	chain.len = x5c.len - 1;
+	r = FIDO_ERR_INVALID_SIG;
+	if (fido_trust_store_verify(ts, &x5c.ptr[0], &chain) < 0) {
+		fido_log_debug("%s: fido_trust_store_verify", __func__);
+		goto fail;
+	}
+	if ((pkey = fido_x5c_pubkey(&x5c.ptr[0])) == NULL ||
+	    SHA256((const unsigned char *)ptr, (size_t)(dot2 - ptr),
+	    digest) != digest) {
+		fido_log_debug("%s: x509 key", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+	dgst.ptr = digest;
+	dgst.len = sizeof(digest);
+
+	if (alg.len == 5 && memcmp(alg.ptr, "RS256", 5) == 0) {
+		if (rs256_verify_sig(&dgst, pkey, &sig) < 0)
+			goto fail;
+	} else if (alg.len == 5 && memcmp(alg.ptr, "ES256", 5) == 0) {
+		if (es256_sig_der(&sig, &der) < 0 ||
+		    es256_verify_sig(&dgst, pkey, &der) < 0)
+			goto fail;
+	} else {
+		fido_log_debug("%s: unsupported alg", __func__);
+		r = FIDO_ERR_UNSUPPORTED_ALGORITHM;
+		goto fail;
+	}
+
+	r = FIDO_OK;
+fail:
+	if (r != FIDO_OK)
+		fido_blob_reset(out);
+	EVP_PKEY_free(pkey);
+	fido_free_blob_array(&x5c);
+	fido_blob_reset(&hdr);
+	fido_blob_reset(&sig);
+	fido_blob_reset(&der);
+	fido_blob_reset(&alg);
+
+	return (r);
+}
+
+fido_mds_t *
+fido_mds_new(void)
+{
+	fido_mds_t *mds;
+
+	if ((mds = fido_calloc(1, sizeof(*mds))) == NULL)
+		return (NULL);
+	if (!MDS_LOCK_INIT(&mds->lock)) {
+		fido_log_debug("%s: lock", __func__);
+		fido_free(mds);
+		return (NULL);
+	}
+
+	return (mds);
+}
+
+void
+fido_mds_free(fido_mds_t **mds_p)
+{
+	fido_mds_t *mds;
+
+	if (mds_p == NULL || (mds = *mds_p) == NULL)
+		return;
+	table_unref(mds->table);
+	MDS_LOCK_FREE(&mds->lock);
+	fido_free(mds);
+
+	*mds_p = NULL;
+}
+
+int
+fido_mds_load(fido_mds_t *mds, const char *ptr, size_t len,
+    fido_trust_store_t *ts)
+{
+	struct mds_table	*t = NULL, *old;
+	fido_blob_t		 payload;
+	int64_t			 no = -1;
+	fido_json_field_t	 field[] = {
+		{ NULL, "no", FIDO_JSON_INT, NULL, &no, NULL, NULL, false },
+		{ NULL, "entries", FIDO_JSON_ARRAY, NULL, NULL, parse_entry,
+		    NULL, false },
+	};
+	int			 r;
+
+	memset(&payload, 0, sizeof(payload));
+
+	if (mds == NULL || ptr == NULL || len == 0 || ts == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if ((r = jws_verify(ptr, len, ts, &payload)) != FIDO_OK) {
+		fido_log_debug("%s: jws_verify", __func__);
+		goto fail;
+	}
+
+	if ((t = fido_calloc(1, sizeof(*t))) == NULL ||
+	    !MDS_LOCK_INIT(&t->lock)) {
+		fido_free(t);
+		t = NULL;
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+	t->refs = 1;
+	field[1].arg = t;
+	if (fido_json_decode((const char *)payload.ptr, payload.len, field,
+	    nitems(field)) < 0 || !field[0].found || no < 0) {
+		fido_log_debug("%s: payload", __func__);
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto fail;
+	}
+	t->no = no;
+	if (t->len > 1)
+		qsort(t->entry, t->len, sizeof(*t->entry), cmp_entry);
+	for (size_t i = 1; i < t->len; i++)
+		if (cmp_entry(&t->entry[i - 1], &t->entry[i]) == 0) {
+			fido_log_debug("%s: duplicate aaguid", __func__);
+			r = FIDO_ERR_INVALID_ARGUMENT;
+			goto fail;
+		}
+
+	MDS_LOCK(&mds->lock);
+	if ((old = mds->table) != NULL && old->no > t->no) {
+		MDS_UNLOCK(&mds->lock);
+		fido_log_debug("%s: no=%lld, loaded %lld", __func__,
+		    (long long)t->no, (long long)old->no);
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto fail;
+	}
+	mds->table = t;
+	MDS_UNLOCK(&mds->lock);
+
+	t = old; /* dropped below */
+	r = FIDO_OK;
+fail:
+	table_unref(t);
+	fido_blob_reset(&payload);
+
+	return (r);
+}
+
+int64_t
+fido_mds_no(fido_mds_t *mds)
+{
+	int64_t no = -1;
+
+	MDS_LOCK(&mds->lock);
+	if (mds->table != NULL)
+		no = mds->table->no;
+	MDS_UNLOCK(&mds->lock);
+
+	return (no);
+}
+
+size_t
+fido_mds_len(fido_mds_t *mds)
+{
+	size_t len = 0;
+
+	MDS_LOCK(&mds->lock);
+	if (mds->table != NULL)
+		len = mds->table->len;
+	MDS_UNLOCK(&mds->lock);
+
+	return (len);
+}
+
+fido_mds_entry_t *
+fido_mds_lookup(fido_mds_t *mds, const unsigned char *aaguid, size_t len)
+{
+	struct mds_table	*t;
+	struct mds_entry	 key;
+	const struct mds_entry	*e = NULL;
+	fido_mds_entry_t	*entry;
+
+	if (aaguid == NULL || len != sizeof(key.aaguid))
+		return (NULL);
+	memcpy(key.aaguid, aaguid, sizeof(key.aaguid));
+
+	MDS_LOCK(&mds->lock);
+	if ((t = mds->table) != NULL)
+		table_ref(t);
+	MDS_UNLOCK(&mds->lock);
+
+	if (t != NULL && t->len > 0)
+		e = bsearch(&key, t->entry, t->len, sizeof(*t->entry),
+		    cmp_entry);
+	if (e == NULL || (entry = fido_calloc(1, sizeof(*entry))) == NULL) {
+		table_unref(t);
+		return (NULL);
+	}
+	entry->table = t;
+	entry->e = e;
+
+	return (entry);
+}
+
+void
+fido_mds_entry_free(fido_mds_entry_t **entry_p)
+{
+	fido_mds_entry_t *entry;
+
+	if (entry_p == NULL || (entry = *entry_p) == NULL)
+		return;
+	table_unref(entry->table);
+	fido_free(entry);
+
+	*entry_p = NULL;
+}
+
+const char *
+fido_mds_entry_status(const fido_mds_entry_t *entry)
+{
+	return (entry->e->status);
+}
+
+const char *
+fido_mds_entry_description(const fido_mds_entry_t *entry)
+{
+	return (entry->e->description);
+}
+
+int
+fido_mds_entry_key_protection(const fido_mds_entry_t *entry)
+{
+	return (entry->e->key_protection);
+}
+
+fido_trust_store_t *
+fido_mds_entry_trust_store(const fido_mds_entry_t *entry)
+{
+	return (entry->e->ts);
+}
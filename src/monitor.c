@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include "fido.h"
+#include "fido/monitor.h"
+
+#define MONITOR_MAXDEV	64 /* hid devices tracked by a monitor */
+
+struct monitor_event {
+	int		type; /* FIDO_DEV_MONITOR_* */
+	fido_dev_info_t	di;   /* device the event refers to */
+};
+
+/*
+ * The platform's hotplug notifications only tell us that something
+ * changed; the list of hid devices is then rescanned with the backend's
+ * manifest function and compared with the previous one. Without
+ * notifications, every read rescans. PC/SC readers, if requested, are
+ * watched and rescanned the same way.
+ */
+struct fido_dev_monitor {
+	void			*hid;    /* platform notifications, or NULL */
+	void			*pcsc;   /* reader notifications, or NULL */
+	bool			 use_pcsc;
+	bool			 started;
+	bool			 stale;  /* a rescan is due */
+	fido_dev_info_t		*known;  /* devices seen by the last rescan */
+	size_t			 nknown; /* entries in known[] */
+	struct monitor_event	*event;  /* events not yet read */
+	size_t			 head;   /* next event to read */
+	size_t			 nevent; /* entries in event[] */
+};
+
+fido_dev_monitor_t *
+fido_dev_monitor_new(void)
+{
+	fido_dev_monitor_t *mon;
+
+	if ((mon = fido_calloc(1, sizeof(*mon))) == NULL)
+		return (NULL);
+	/* a rescan yields at most one event per known and present device */
+	if ((mon->event = fido_calloc(2 * MONITOR_MAXDEV,
+	    sizeof(*mon->event))) == NULL) {
+		fido_free(mon);
+		return (NULL);
+	}
+
+	return (mon);
+}
+
+void
+fido_dev_monitor_free(fido_dev_monitor_t **mon_p)
+{
+	fido_dev_monitor_t *mon;
+
+	if (mon_p == NULL || (mon = *mon_p) == NULL)
+		return;
+	if (mon->hid != NULL)
+		fido_hid_monitor_close(mon->hid);
+#ifdef USE_PCSC
+	if (mon->pcsc != NULL)
+		fido_pcsc_monitor_close(mon->pcsc);
+#endif
+	fido_dev_info_free(&mon->known, mon->nknown);
+	for (size_t i = mon->head; i < mon->nevent; i++)
+		fido_dev_info_reset(&mon->event[i].di);
+	fido_free(mon->event);
+	fido_free(mon);
+	*mon_p = NULL;
+}
+
+static int
+monitor_info_copy(fido_dev_info_t *dst, const fido_dev_info_t *src)
+{
+	memset(dst, 0, sizeof(*dst));
+
+	if ((dst->path = fido_strdup(src->path)) == NULL ||
+	    (dst->manufacturer = fido_strdup(src->manufacturer)) == NULL ||
+	    (dst->product = fido_strdup(src->product)) == NULL) {
+		fido_dev_info_reset(dst);
+		return (-1);
+	}
+	dst->vendor_id = src->vendor_id;
+	dst->product_id = src->product_id;
+	dst->io = src->io;
+	dst->transport = src->transport;
+
+	return (0);
+}
+
+/* caller must have read all queued events */
+static int
+monitor_rescan(fido_dev_monitor_t *mon)
+{
+	fido_dev_info_t		*devlist = NULL;
+	struct monitor_event	*e;
+	bool			*known_gone = NULL;
+	bool			*devlist_new = NULL;
+	size_t			 n;
+	int			 r = FIDO_ERR_INTERNAL;
+
+	mon->head = mon->nevent = 0;
+
+	if ((devlist = fido_dev_info_new(MONITOR_MAXDEV)) == NULL ||
+	    (known_gone = fido_calloc(MONITOR_MAXDEV, sizeof(bool))) == NULL ||
+	    (devlist_new = fido_calloc(MONITOR_MAXDEV, sizeof(bool))) == NULL)
+		goto fail;
+	if ((r = fido_hid_manifest(devlist, MONITOR_MAXDEV, &n)) != FIDO_OK) {
+		fido_log_debug("%s: fido_hid_manifest", __func__);
+		goto fail;
+	}
+#ifdef USE_PCSC
+	if (mon->use_pcsc) {
+		size_t m;
+
+		if ((r = fido_pcsc_manifest(devlist + n, MONITOR_MAXDEV - n,
+		    &m)) != FIDO_OK) {
+			fido_log_debug("%s: fido_pcsc_manifest", __func__);
+			goto fail;
+		}
+		n += m;
+	}
+#endif
+	if (fido_dev_info_diff(mon->known, mon->nknown, devlist, n,
+	    known_gone, devlist_new) < 0) {
+		fido_log_debug("%s: fido_dev_info_diff", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	/*
+	 * Removed devices are reported with the information last seen, and
+	 * before any device that took their path.
+	 */
+	for (size_t i = 0; i < mon->nknown; i++) {
+		if (known_gone[i] == false)
+			continue;
+		e = &mon->event[mon->nevent++];
+		e->type = FIDO_DEV_MONITOR_REMOVE;
+		e->di = mon->known[i];
+		memset(&mon->known[i], 0, sizeof(mon->known[i]));
+	}
+
+	for (size_t i = 0; i < n; i++) {
+		if (devlist_new[i] == false)
+			continue;
+		e = &mon->event[mon->nevent];
+		if (monitor_info_copy(&e->di, &devlist[i]) < 0) {
+			fido_log_debug("%s: monitor_info_copy", __func__);
+			continue;
+		}
+		e->type = FIDO_DEV_MONITOR_ADD;
+		mon->nevent++;
+	}
+
+	fido_dev_info_free(&mon->known, mon->nknown);
+	mon->known = devlist;
+	mon->nknown = n;
+	mon->stale = false;
+	devlist = NULL;
+	r = FIDO_OK;
+fail:
+	fido_dev_info_free(&devlist, MONITOR_MAXDEV);
+	fido_free(known_gone);
+	fido_free(devlist_new);
+
+	return (r);
+}
+
+int
+fido_dev_monitor_start(fido_dev_monitor_t *mon)
+{
+	if (mon->started)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	if ((mon->hid = fido_hid_monitor_open()) == NULL)
+		fido_log_debug("%s: no hotplug notifications", __func__);
+#ifdef USE_PCSC
+	if (mon->use_pcsc && (mon->pcsc = fido_pcsc_monitor_open()) == NULL)
+		fido_log_debug("%s: no reader notifications", __func__);
+#endif
+	mon->started = true;
+	mon->stale = true;
+
+	/* devices already present are reported as added */
+	return (monitor_rescan(mon));
+}
+
+int
+fido_dev_monitor_set_pcsc(fido_dev_monitor_t *mon, bool use_pcsc)
+{
+	if (mon->started)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+#ifndef USE_PCSC
+	if (use_pcsc)
+		return (FIDO_ERR_UNSUPPORTED_OPTION);
+#endif
+	mon->use_pcsc = use_pcsc;
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_monitor_get_fd(const fido_dev_monitor_t *mon)
+{
+	if (mon->hid == NULL)
+		return (-1);
+
+	return (fido_hid_monitor_get_fd(mon->hid));
+}
+
+int
+fido_dev_monitor_get_pcsc_fd(const fido_dev_monitor_t *mon)
+{
+#ifdef USE_PCSC
+	if (mon->pcsc != NULL)
+		return (fido_pcsc_monitor_get_fd(mon->pcsc));
+#else
+	(void)mon;
+#endif
+	return (-1);
+}
+
+/* returns 1 if a source asks for a rescan, 0 if not, -1 on error */
+static int
+monitor_drain(fido_dev_monitor_t *mon)
+{
+	int r, changed = 0;
+
+	if (mon->hid == NULL)
+		changed = 1;
+	else if ((r = fido_hid_monitor_drain(mon->hid)) < 0) {
+		fido_log_debug("%s: fido_hid_monitor_drain", __func__);
+		return (-1);
+	} else if (r > 0)
+		changed = 1;
+#ifdef USE_PCSC
+	if (mon->use_pcsc && mon->pcsc == NULL)
+		changed = 1;
+	else if (mon->pcsc != NULL) {
+		if ((r = fido_pcsc_monitor_drain(mon->pcsc)) < 0) {
+			fido_log_debug("%s: fido_pcsc_monitor_drain",
+			    __func__);
+			return (-1);
+		}
+		if (r > 0)
+			changed = 1;
+	}
+#endif
+
+	return (changed);
+}
+
+int
+fido_dev_monitor_read(fido_dev_monitor_t *mon, fido_dev_info_t *di,
+    int *event)
+{
+	struct monitor_event	*e;
+	int			 r;
+
+	if (di == NULL || event == NULL || mon->started == false)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	*event = 0;
+
+	if (mon->head == mon->nevent) {
+		if ((r = monitor_drain(mon)) < 0)
+			return (FIDO_ERR_INTERNAL);
+		else if (r > 0)
+			mon->stale = true;
+		if (mon->stale && (r = monitor_rescan(mon)) != FIDO_OK)
+			return (r);
+	}
+
+	if (mon->head < mon->nevent) {
+		e = &mon->event[mon->head++];
+		fido_dev_info_reset(di);
+		*di = e->di;
+		*event = e->type;
+		memset(&e->di, 0, sizeof(e->di));
+	}
+
+	return (FIDO_OK);
+}
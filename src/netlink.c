@@ -11,8 +11,13 @@
 #include <linux/netlink.h>
 #include <linux/nfc.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include <errno.h>
 #include <limits.h>
+#include <unistd.h>
 
 #include "fido.h"
 #include "netlink.h"
@@ -32,6 +37,42 @@ static ssize_t (*fuzz_write)(int, const void *, size_t);
 #endif
 
 #define NETLINK_POLL_MS	100
+#define NETLINK_TXLEN	64	/* payload of a request */
+
+/*
+ * The id and multicast group of the nfc family are resolved once per
+ * process, and again if the family goes away (e.g. the nfc module is
+ * reloaded). Fuzzing runs resolve them every time.
+ */
+static struct nl_family_cache {
+	uint16_t	type;     /* family id, or 0 */
+	uint32_t	mcastgrp; /* event group */
+} nl_family_cache;
+
+/*
+ * A single context, with its socket and message buffers, is shared by
+ * all nfc handles and kept when unused. Requests on it are made one at a
+ * time. A context inherited through fork() is forgotten, as its socket
+ * is also the parent's. Fuzzing runs use a context of their own.
+ */
+static struct nl_shared {
+	fido_nl_t	*nl;  /* shared context, or NULL */
+	pid_t		 pid; /* process nl belongs to */
+} nl_shared;
+
+#if defined(HAVE_PTHREAD)
+static pthread_mutex_t nl_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t nl_io_lock = PTHREAD_MUTEX_INITIALIZER;
+#define NL_LOCK()	pthread_mutex_lock(&nl_lock)
+#define NL_UNLOCK()	pthread_mutex_unlock(&nl_lock)
+#define NL_IO_LOCK()	pthread_mutex_lock(&nl_io_lock)
+#define NL_IO_UNLOCK()	pthread_mutex_unlock(&nl_io_lock)
+#else
+#define NL_LOCK()	do { } while (0)
+#define NL_UNLOCK()	do { } while (0)
+#define NL_IO_LOCK()	do { } while (0)
+#define NL_IO_UNLOCK()	do { } while (0)
+#endif
 
 /* XXX avoid signed NLA_ALIGNTO */
 #undef NLA_HDRLEN
@@ -107,7 +148,7 @@ nlmsg_new(uint16_t type, uint16_t flags, size_t len)
 
 	if (len > SIZE_MAX - sizeof(*m) ||
 	    (siz = sizeof(*m) + len) > UINT16_MAX ||
-	    (m = calloc(1, siz)) == NULL)
+	    (m = fido_calloc(1, siz)) == NULL)
 		return (NULL);
 
 	m->siz = siz;
@@ -120,6 +161,23 @@ nlmsg_new(uint16_t type, uint16_t flags, size_t len)
 	return (m);
 }
 
+/* start a new request in the message buffer of nl */
+static nlmsgbuf_t *
+nlmsg_reset(fido_nl_t *nl, uint16_t type, uint16_t flags)
+{
+	nlmsgbuf_t *m = nl->tx;
+
+	memset(m, 0, m->siz);
+	m->siz = sizeof(*m) + NETLINK_TXLEN;
+	m->len = NETLINK_TXLEN;
+	m->ptr = m->payload;
+	m->u.nlmsg.nlmsg_type = type;
+	m->u.nlmsg.nlmsg_flags = NLM_F_REQUEST | flags;
+	m->u.nlmsg.nlmsg_len = NLMSG_HDRLEN;
+
+	return (m);
+}
+
 static nlamsgbuf_t *
 nla_from_buf(const unsigned char **ptr, size_t *len)
 {
@@ -136,7 +194,7 @@ nla_from_buf(const unsigned char **ptr, size_t *len)
 	    nlalen - sizeof(h.u) > UINT16_MAX ||
 	    nlalen > SIZE_MAX - sizeof(*a) ||
 	    (skip = NLMSG_ALIGN(nlalen)) > *len ||
-	    (a = calloc(1, sizeof(*a) + nlalen - sizeof(h.u))) == NULL)
+	    (a = fido_calloc(1, sizeof(*a) + nlalen - sizeof(h.u))) == NULL)
 		return (NULL);
 
 	memcpy(&a->u, *ptr, nlalen);
@@ -269,25 +327,21 @@ nlmsg_get_status(nlmsgbuf_t *m)
 static int
 nlmsg_setattr(nlmsgbuf_t *m, uint16_t type, const void *ptr, size_t len)
 {
-	int r;
-	char *padding;
+	static const char padding[NLMSG_ALIGNTO];
 	size_t skip;
 	nlamsgbuf_t a;
 
 	if ((skip = NLMSG_ALIGN(len)) > UINT16_MAX - sizeof(a.u) ||
-	    skip < len || (padding = calloc(1, skip - len)) == NULL)
+	    skip < len || skip - len > sizeof(padding))
 		return (-1);
 
 	memset(&a, 0, sizeof(a));
 	a.u.nla.nla_type = type;
 	a.u.nla.nla_len = (uint16_t)(len + sizeof(a.u));
-	r = nlmsg_write(m, &a.u, sizeof(a.u)) < 0 ||
-	    nlmsg_write(m, ptr, len) < 0 ||
-	    nlmsg_write(m, padding, skip - len) < 0 ? -1 : 0;
-
-	free(padding);
 
-	return (r);
+	return (nlmsg_write(m, &a.u, sizeof(a.u)) < 0 ||
+	    nlmsg_write(m, ptr, len) < 0 ||
+	    nlmsg_write(m, padding, skip - len) < 0 ? -1 : 0);
 }
 
 static int
@@ -327,8 +381,8 @@ nla_get_str(nlamsgbuf_t *a)
 	char *s = NULL;
 
 	if ((n = a->len) < 1 || a->ptr[n - 1] != '\0' ||
-	    (s = calloc(1, n)) == NULL || nla_read(a, s, n) < 0) {
-		free(s);
+	    (s = fido_calloc(1, n)) == NULL || nla_read(a, s, n) < 0) {
+		fido_free(s);
 		return (NULL);
 	}
 	s[n - 1] = '\0';
@@ -336,12 +390,33 @@ nla_get_str(nlamsgbuf_t *a)
 	return (s);
 }
 
+/*
+ * Discard what is left on the socket of nl by an earlier request, such as
+ * the end of a dump or a reply that came too late.
+ */
+static void
+nl_drain(fido_nl_t *nl)
+{
+#ifndef FIDO_FUZZ
+	ssize_t r;
+
+	while (fido_hid_unix_wait(nl->fd, -1, 0, NULL) == 0 &&
+	    (r = READ(nl->fd, nl->rx, sizeof(nl->rx))) > 0)
+		fido_log_debug("%s: discarding %zd bytes", __func__, r);
+#else
+	(void)nl;
+#endif
+}
+
+/* send the request in the message buffer of nl */
 static int
-nlmsg_tx(int fd, const nlmsgbuf_t *m)
+nlmsg_tx(fido_nl_t *nl)
 {
+	const nlmsgbuf_t *m = nl->tx;
 	ssize_t r;
 
-	if ((r = WRITE(fd, nlmsg_ptr(m), nlmsg_len(m))) == -1) {
+	nl_drain(nl);
+	if ((r = WRITE(nl->fd, nlmsg_ptr(m), nlmsg_len(m))) == -1) {
 		fido_log_error(errno, "%s: write", __func__);
 		return (-1);
 	}
@@ -354,24 +429,21 @@ nlmsg_tx(int fd, const nlmsgbuf_t *m)
 	return (0);
 }
 
+/* read a reply into the receive buffer of nl */
 static ssize_t
-nlmsg_rx(int fd, unsigned char *ptr, size_t len, int ms)
+nlmsg_rx(fido_nl_t *nl, int ms)
 {
 	ssize_t r;
 
-	if (len > SSIZE_MAX) {
-		fido_log_debug("%s: len", __func__);
-		return (-1);
-	}
-	if (fido_hid_unix_wait(fd, ms, NULL) < 0) {
+	if (fido_hid_unix_wait(nl->fd, -1, ms, NULL) < 0) {
 		fido_log_debug("%s: fido_hid_unix_wait", __func__);
 		return (-1);
 	}
-	if ((r = READ(fd, ptr, len)) == -1) {
+	if ((r = READ(nl->fd, nl->rx, sizeof(nl->rx))) == -1) {
 		fido_log_error(errno, "%s: read %zd", __func__, r);
 		return (-1);
 	}
-	fido_log_xxd(ptr, (size_t)r, "%s", __func__);
+	fido_log_xxd(nl->rx, (size_t)r, "%s", __func__);
 
 	return (r);
 }
@@ -384,7 +456,7 @@ nlmsg_iter(nlmsgbuf_t *m, void *arg, int (*parser)(nlamsgbuf_t *, void *))
 
 	while ((a = nlmsg_getattr(m)) != NULL) {
 		r = parser(a, arg);
-		free(a);
+		fido_free(a);
 		if (r < 0) {
 			fido_log_debug("%s: parser", __func__);
 			return (-1);
@@ -402,7 +474,7 @@ nla_iter(nlamsgbuf_t *g, void *arg, int (*parser)(nlamsgbuf_t *, void *))
 
 	while ((a = nla_getattr(g)) != NULL) {
 		r = parser(a, arg);
-		free(a);
+		fido_free(a);
 		if (r < 0) {
 			fido_log_debug("%s: parser", __func__);
 			return (-1);
@@ -426,21 +498,21 @@ nl_parse_reply(const uint8_t *blob, size_t blob_len, uint16_t msg_type,
 		}
 		if (nlmsg_type(m) == NLMSG_ERROR) {
 			r = nlmsg_get_status(m);
-			free(m);
+			fido_free(m);
 			return (r);
 		}
 		if (nlmsg_type(m) != msg_type ||
 		    nlmsg_get_genl(m, genl_cmd) < 0) {
 			fido_log_debug("%s: skipping", __func__);
-			free(m);
+			fido_free(m);
 			continue;
 		}
 		if (parser != NULL && nlmsg_iter(m, arg, parser) < 0) {
 			fido_log_debug("%s: nlmsg_iter", __func__);
-			free(m);
+			fido_free(m);
 			return (-1);
 		}
-		free(m);
+		fido_free(m);
 	}
 
 	return (0);
@@ -456,10 +528,10 @@ parse_mcastgrp(nlamsgbuf_t *a, void *arg)
 	case CTRL_ATTR_MCAST_GRP_NAME:
 		if ((name = nla_get_str(a)) == NULL ||
 		    strcmp(name, NFC_GENL_MCAST_EVENT_NAME) != 0) {
-			free(name);
+			fido_free(name);
 			return (-1); /* XXX skip? */
 		}
-		free(name);
+		fido_free(name);
 		return (0);
 	case CTRL_ATTR_MCAST_GRP_ID:
 		if (family->mcastgrp)
@@ -506,29 +578,25 @@ parse_family(nlamsgbuf_t *a, void *arg)
 }
 
 static int
-nl_get_nfc_family(int fd, uint16_t *type, uint32_t *mcastgrp)
+nl_get_nfc_family(fido_nl_t *nl, uint16_t *type, uint32_t *mcastgrp)
 {
 	nlmsgbuf_t *m;
-	uint8_t reply[512];
 	nl_family_t family;
 	ssize_t r;
 	int ok;
 
-	if ((m = nlmsg_new(GENL_ID_CTRL, 0, 64)) == NULL ||
-	    nlmsg_set_genl(m, CTRL_CMD_GETFAMILY) < 0 ||
+	m = nlmsg_reset(nl, GENL_ID_CTRL, 0);
+	if (nlmsg_set_genl(m, CTRL_CMD_GETFAMILY) < 0 ||
 	    nlmsg_set_u16(m, CTRL_ATTR_FAMILY_ID, GENL_ID_CTRL) < 0 ||
 	    nlmsg_set_str(m, CTRL_ATTR_FAMILY_NAME, NFC_GENL_NAME) < 0 ||
-	    nlmsg_tx(fd, m) < 0) {
-		free(m);
+	    nlmsg_tx(nl) < 0)
 		return (-1);
-	}
-	free(m);
 	memset(&family, 0, sizeof(family));
-	if ((r = nlmsg_rx(fd, reply, sizeof(reply), -1)) < 0) {
+	if ((r = nlmsg_rx(nl, -1)) < 0) {
 		fido_log_debug("%s: nlmsg_rx", __func__);
 		return (-1);
 	}
-	if ((ok = nl_parse_reply(reply, (size_t)r, GENL_ID_CTRL,
+	if ((ok = nl_parse_reply(nl->rx, (size_t)r, GENL_ID_CTRL,
 	    CTRL_CMD_NEWFAMILY, &family, parse_family)) != 0) {
 		fido_log_debug("%s: nl_parse_reply: %d", __func__, ok);
 		return (-1);
@@ -543,6 +611,33 @@ nl_get_nfc_family(int fd, uint16_t *type, uint32_t *mcastgrp)
 	return (0);
 }
 
+/* fill in the nfc family of nl, resolving it unless cached */
+static int
+nl_set_nfc_family(fido_nl_t *nl, bool cached)
+{
+	NL_LOCK();
+	if (cached && nl_family_cache.type != 0) {
+		nl->nfc_type = nl_family_cache.type;
+		nl->nfc_mcastgrp = nl_family_cache.mcastgrp;
+		NL_UNLOCK();
+		return (0);
+	}
+	NL_UNLOCK();
+
+	if (nl_get_nfc_family(nl, &nl->nfc_type, &nl->nfc_mcastgrp) < 0) {
+		fido_log_debug("%s: nl_get_nfc_family", __func__);
+		return (-1);
+	}
+#ifndef FIDO_FUZZ
+	NL_LOCK();
+	nl_family_cache.type = nl->nfc_type;
+	nl_family_cache.mcastgrp = nl->nfc_mcastgrp;
+	NL_UNLOCK();
+#endif
+
+	return (0);
+}
+
 static int
 parse_target(nlamsgbuf_t *a, void *arg)
 {
@@ -561,57 +656,69 @@ parse_target(nlamsgbuf_t *a, void *arg)
 	return (0);
 }
 
-int
-fido_nl_power_nfc(fido_nl_t *nl, uint32_t dev)
+static int
+nl_power_nfc(fido_nl_t *nl, uint32_t dev)
 {
 	nlmsgbuf_t *m;
-	uint8_t reply[512];
 	ssize_t r;
 	int ok;
 
-	if ((m = nlmsg_new(nl->nfc_type, NLM_F_ACK, 64)) == NULL ||
-	    nlmsg_set_genl(m, NFC_CMD_DEV_UP) < 0 ||
+	m = nlmsg_reset(nl, nl->nfc_type, NLM_F_ACK);
+	if (nlmsg_set_genl(m, NFC_CMD_DEV_UP) < 0 ||
 	    nlmsg_set_u32(m, NFC_ATTR_DEVICE_INDEX, dev) < 0 ||
-	    nlmsg_tx(nl->fd, m) < 0) {
-		free(m);
+	    nlmsg_tx(nl) < 0)
 		return (-1);
-	}
-	free(m);
-	if ((r = nlmsg_rx(nl->fd, reply, sizeof(reply), -1)) < 0) {
+	if ((r = nlmsg_rx(nl, -1)) < 0) {
 		fido_log_debug("%s: nlmsg_rx", __func__);
 		return (-1);
 	}
-	if ((ok = nl_parse_reply(reply, (size_t)r, nl->nfc_type,
+	if ((ok = nl_parse_reply(nl->rx, (size_t)r, nl->nfc_type,
 	    NFC_CMD_DEV_UP, NULL, NULL)) != 0 && ok != EALREADY) {
 		fido_log_debug("%s: nl_parse_reply: %d", __func__, ok);
-		return (-1);
+		return (ok == ENOENT ? ENOENT : -1);
 	}
 
 	return (0);
 }
 
+int
+fido_nl_power_nfc(fido_nl_t *nl, uint32_t dev)
+{
+	int r;
+
+	NL_IO_LOCK();
+	/* the first request of an open; an unknown family means a stale id */
+	if ((r = nl_power_nfc(nl, dev)) != ENOENT)
+		goto out;
+	fido_log_debug("%s: resolving nfc family", __func__);
+	if (nl_set_nfc_family(nl, false) < 0)
+		r = -1;
+	else
+		r = nl_power_nfc(nl, dev) == 0 ? 0 : -1;
+out:
+	NL_IO_UNLOCK();
+
+	return (r);
+}
+
 static int
 nl_nfc_poll(fido_nl_t *nl, uint32_t dev)
 {
 	nlmsgbuf_t *m;
-	uint8_t reply[512];
 	ssize_t r;
 	int ok;
 
-	if ((m = nlmsg_new(nl->nfc_type, NLM_F_ACK, 64)) == NULL ||
-	    nlmsg_set_genl(m, NFC_CMD_START_POLL) < 0 ||
+	m = nlmsg_reset(nl, nl->nfc_type, NLM_F_ACK);
+	if (nlmsg_set_genl(m, NFC_CMD_START_POLL) < 0 ||
 	    nlmsg_set_u32(m, NFC_ATTR_DEVICE_INDEX, dev) < 0 ||
 	    nlmsg_set_u32(m, NFC_ATTR_PROTOCOLS, NFC_PROTO_ISO14443_MASK) < 0 ||
-	    nlmsg_tx(nl->fd, m) < 0) {
-		free(m);
+	    nlmsg_tx(nl) < 0)
 		return (-1);
-	}
-	free(m);
-	if ((r = nlmsg_rx(nl->fd, reply, sizeof(reply), -1)) < 0) {
+	if ((r = nlmsg_rx(nl, -1)) < 0) {
 		fido_log_debug("%s: nlmsg_rx", __func__);
 		return (-1);
 	}
-	if ((ok = nl_parse_reply(reply, (size_t)r, nl->nfc_type,
+	if ((ok = nl_parse_reply(nl->rx, (size_t)r, nl->nfc_type,
 	    NFC_CMD_START_POLL, NULL, NULL)) != 0) {
 		fido_log_debug("%s: nl_parse_reply: %d", __func__, ok);
 		return (-1);
@@ -625,25 +732,21 @@ nl_dump_nfc_target(fido_nl_t *nl, uint32_t dev, uint32_t *target, int ms)
 {
 	nlmsgbuf_t *m;
 	nl_target_t t;
-	uint8_t reply[512];
 	ssize_t r;
 	int ok;
 
-	if ((m = nlmsg_new(nl->nfc_type, NLM_F_DUMP, 64)) == NULL ||
-	    nlmsg_set_genl(m, NFC_CMD_GET_TARGET) < 0 ||
+	m = nlmsg_reset(nl, nl->nfc_type, NLM_F_DUMP);
+	if (nlmsg_set_genl(m, NFC_CMD_GET_TARGET) < 0 ||
 	    nlmsg_set_u32(m, NFC_ATTR_DEVICE_INDEX, dev) < 0 ||
-	    nlmsg_tx(nl->fd, m) < 0) {
-		free(m);
+	    nlmsg_tx(nl) < 0)
 		return (-1);
-	}
-	free(m);
-	if ((r = nlmsg_rx(nl->fd, reply, sizeof(reply), ms)) < 0) {
+	if ((r = nlmsg_rx(nl, ms)) < 0) {
 		fido_log_debug("%s: nlmsg_rx", __func__);
 		return (-1);
 	}
 	memset(&t, 0, sizeof(t));
 	t.value = target;
-	if ((ok = nl_parse_reply(reply, (size_t)r, nl->nfc_type,
+	if ((ok = nl_parse_reply(nl->rx, (size_t)r, nl->nfc_type,
 	    NFC_CMD_GET_TARGET, &t, parse_target)) != 0) {
 		fido_log_debug("%s: nl_parse_reply: %d", __func__, ok);
 		return (-1);
@@ -656,6 +759,19 @@ nl_dump_nfc_target(fido_nl_t *nl, uint32_t dev, uint32_t *target, int ms)
 	return (0);
 }
 
+/* look up a target already known to the kernel, without polling */
+int
+fido_nl_find_nfc_target(fido_nl_t *nl, uint32_t dev, uint32_t *target)
+{
+	int r;
+
+	NL_IO_LOCK();
+	r = nl_dump_nfc_target(nl, dev, target, NETLINK_POLL_MS);
+	NL_IO_UNLOCK();
+
+	return (r);
+}
+
 static int
 parse_nfc_event(nlamsgbuf_t *a, void *arg)
 {
@@ -678,10 +794,9 @@ parse_nfc_event(nlamsgbuf_t *a, void *arg)
 	return (0);
 }
 
-int
-fido_nl_get_nfc_target(fido_nl_t *nl, uint32_t dev, uint32_t *target)
+static int
+nl_get_nfc_target(fido_nl_t *nl, uint32_t dev, uint32_t *target)
 {
-	uint8_t reply[512];
 	nl_poll_t ctx;
 	ssize_t r;
 	int ok;
@@ -697,7 +812,7 @@ fido_nl_get_nfc_target(fido_nl_t *nl, uint32_t dev, uint32_t *target)
 		return (-1);
 	}
 #endif
-	r = nlmsg_rx(nl->fd, reply, sizeof(reply), NETLINK_POLL_MS);
+	r = nlmsg_rx(nl, NETLINK_POLL_MS);
 #ifndef FIDO_FUZZ
 	if (setsockopt(nl->fd, SOL_NETLINK, NETLINK_DROP_MEMBERSHIP,
 	    &nl->nfc_mcastgrp, sizeof(nl->nfc_mcastgrp)) == -1) {
@@ -711,7 +826,7 @@ fido_nl_get_nfc_target(fido_nl_t *nl, uint32_t dev, uint32_t *target)
 	}
 	memset(&ctx, 0, sizeof(ctx));
 	ctx.dev = dev;
-	if ((ok = nl_parse_reply(reply, (size_t)r, nl->nfc_type,
+	if ((ok = nl_parse_reply(nl->rx, (size_t)r, nl->nfc_type,
 	    NFC_EVENT_TARGETS_FOUND, &ctx, parse_nfc_event)) != 0) {
 		fido_log_debug("%s: nl_parse_reply: %d", __func__, ok);
 		return (-1);
@@ -728,28 +843,40 @@ fido_nl_get_nfc_target(fido_nl_t *nl, uint32_t dev, uint32_t *target)
 	return (0);
 }
 
-void
-fido_nl_free(fido_nl_t **nlp)
+int
+fido_nl_get_nfc_target(fido_nl_t *nl, uint32_t dev, uint32_t *target)
 {
-	fido_nl_t *nl;
+	int r;
 
-	if (nlp == NULL || (nl = *nlp) == NULL)
-		return;
+	NL_IO_LOCK();
+	r = nl_get_nfc_target(nl, dev, target);
+	NL_IO_UNLOCK();
+
+	return (r);
+}
+
+static void
+nl_free(fido_nl_t *nl)
+{
 	if (nl->fd != -1 && close(nl->fd) == -1)
 		fido_log_error(errno, "%s: close", __func__);
 
-	free(nl);
-	*nlp = NULL;
+	fido_free(nl->tx);
+	fido_free(nl);
 }
 
-fido_nl_t *
-fido_nl_new(void)
+static fido_nl_t *
+nl_new(void)
 {
 	fido_nl_t *nl;
 	int ok = -1;
 
-	if ((nl = calloc(1, sizeof(*nl))) == NULL)
+	if ((nl = fido_calloc(1, sizeof(*nl))) == NULL)
 		return (NULL);
+	nl->fd = -1;
+	nl->refs = 1;
+	if ((nl->tx = nlmsg_new(0, 0, NETLINK_TXLEN)) == NULL)
+		goto fail;
 	if ((nl->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC,
 	    NETLINK_GENERIC)) == -1) {
 		fido_log_error(errno, "%s: socket", __func__);
@@ -761,15 +888,65 @@ fido_nl_new(void)
 		fido_log_error(errno, "%s: bind", __func__);
 		goto fail;
 	}
-	if (nl_get_nfc_family(nl->fd, &nl->nfc_type, &nl->nfc_mcastgrp) < 0) {
-		fido_log_debug("%s: nl_get_nfc_family", __func__);
+	if (nl_set_nfc_family(nl, true) < 0) {
+		fido_log_debug("%s: nl_set_nfc_family", __func__);
 		goto fail;
 	}
 
 	ok = 0;
 fail:
-	if (ok < 0)
-		fido_nl_free(&nl);
+	if (ok < 0) {
+		nl_free(nl);
+		nl = NULL;
+	}
+
+	return (nl);
+}
+
+void
+fido_nl_free(fido_nl_t **nlp)
+{
+	fido_nl_t *nl;
+	bool keep;
+
+	if (nlp == NULL || (nl = *nlp) == NULL)
+		return;
+
+	NL_LOCK();
+	keep = --nl->refs > 0 || nl == nl_shared.nl;
+	NL_UNLOCK();
+	if (keep == false)
+		nl_free(nl);
+
+	*nlp = NULL;
+}
+
+fido_nl_t *
+fido_nl_new(void)
+{
+	fido_nl_t *nl;
+
+#ifndef FIDO_FUZZ
+	NL_LOCK();
+	if (nl_shared.pid != getpid()) {
+		nl_shared.nl = NULL; /* the parent's; see above */
+		nl_shared.pid = getpid();
+	}
+	if ((nl = nl_shared.nl) != NULL)
+		nl->refs++;
+	NL_UNLOCK();
+	if (nl != NULL)
+		return (nl);
+#endif
+	if ((nl = nl_new()) == NULL)
+		return (NULL);
+#ifndef FIDO_FUZZ
+	/* of two contexts created at the same time, one is not shared */
+	NL_LOCK();
+	if (nl_shared.nl == NULL && nl_shared.pid == getpid())
+		nl_shared.nl = nl;
+	NL_UNLOCK();
+#endif
 
 	return (nl);
 }
@@ -26,12 +26,16 @@ typedef struct fido_nl {
 	uint16_t           nfc_type;
 	uint32_t           nfc_mcastgrp;
 	struct sockaddr_nl saddr;
+	size_t             refs;    /* handles using the context */
+	struct nlmsgbuf   *tx;      /* request being built */
+	unsigned char      rx[512]; /* last reply read */
 } fido_nl_t;
 
 fido_nl_t *fido_nl_new(void);
 void fido_nl_free(struct fido_nl **);
 int fido_nl_power_nfc(struct fido_nl *, uint32_t);
 int fido_nl_get_nfc_target(struct fido_nl *, uint32_t , uint32_t *);
+int fido_nl_find_nfc_target(struct fido_nl *, uint32_t , uint32_t *);
 
 #ifdef FIDO_FUZZ
 void set_netlink_io_functions(ssize_t (*)(int, void *, size_t),
@@ -13,6 +13,7 @@
 #include "iso7816.h"
 
 #define TX_CHUNK_SIZE	240
+#define RX_EXT_LE	256 /* bytes per reply to an extended-length apdu */
 
 static const uint8_t aid[] = { 0xa0, 0x00, 0x00, 0x06, 0x47, 0x2f, 0x00, 0x01 };
 static const uint8_t v_u2f[] = { 'U', '2', 'F', '_', 'V', '2' };
@@ -22,21 +23,16 @@ static int
 tx_short_apdu(fido_dev_t *d, const iso7816_header_t *h, const uint8_t *payload,
     uint8_t payload_len, uint8_t cla_flags)
 {
-	uint8_t apdu[5 + UINT8_MAX + 1];
 	uint8_t sw[2];
-	size_t apdu_len;
 	int ok = -1;
 
-	memset(&apdu, 0, sizeof(apdu));
-	apdu[0] = h->cla | cla_flags;
-	apdu[1] = h->ins;
-	apdu[2] = h->p1;
-	apdu[3] = h->p2;
-	apdu[4] = payload_len;
-	memcpy(&apdu[5], payload, payload_len);
-	apdu_len = (size_t)(5 + payload_len + 1);
-
-	if (d->io.write(d->io_handle, apdu, apdu_len) < 0) {
+	if (iso7816_build_short(&d->apdu_buf, h, cla_flags, payload,
+	    payload_len) < 0) {
+		fido_log_debug("%s: iso7816_build_short", __func__);
+		return -1;
+	}
+	if (d->io.write(d->io_handle, d->apdu_buf.ptr,
+	    d->apdu_buf.used) < 0) {
 		fido_log_debug("%s: write", __func__);
 		goto fail;
 	}
@@ -54,37 +50,64 @@ tx_short_apdu(fido_dev_t *d, const iso7816_header_t *h, const uint8_t *payload,
 
 	ok = 0;
 fail:
-	explicit_bzero(apdu, sizeof(apdu));
+	iso7816_buf_wipe(&d->apdu_buf);
 
 	return ok;
 }
 
+/*
+ * Send the whole payload in one extended-length apdu. The expected reply
+ * length is capped so that replies still fit our receive buffers; longer
+ * ones are fetched with GET RESPONSE, as with short apdus.
+ */
 static int
-nfc_do_tx(fido_dev_t *d, const uint8_t *apdu_ptr, size_t apdu_len)
+tx_ext_apdu(fido_dev_t *d, const iso7816_header_t *h, const uint8_t *payload,
+    size_t payload_len)
 {
-	iso7816_header_t h;
+	int ok = -1;
 
-	if (fido_buf_read(&apdu_ptr, &apdu_len, &h, sizeof(h)) < 0) {
-		fido_log_debug("%s: header", __func__);
+	if (iso7816_build_ext(&d->apdu_buf, h, payload, payload_len,
+	    RX_EXT_LE) < 0) {
+		fido_log_debug("%s: payload_len %zu", __func__, payload_len);
 		return -1;
 	}
-	if (apdu_len < 2) {
-		fido_log_debug("%s: apdu_len %zu", __func__, apdu_len);
-		return -1;
+	if (d->io.write(d->io_handle, d->apdu_buf.ptr,
+	    d->apdu_buf.used) < 0) {
+		fido_log_debug("%s: write", __func__);
+		goto fail;
 	}
 
-	apdu_len -= 2; /* trim le1 le2 */
+	ok = 0;
+fail:
+	iso7816_buf_wipe(&d->apdu_buf);
+
+	return ok;
+}
+
+/* send payload under h, chained over short apdus if needed */
+static int
+tx_apdu(fido_dev_t *d, const iso7816_header_t *h, const uint8_t *payload,
+    size_t payload_len, bool ext)
+{
+	/* chaining is only needed when the payload doesn't fit */
+	if (ext && payload_len > TX_CHUNK_SIZE) {
+		if (tx_ext_apdu(d, h, payload, payload_len) < 0) {
+			fido_log_debug("%s: tx_ext_apdu", __func__);
+			return -1;
+		}
+		return 0;
+	}
 
-	while (apdu_len > TX_CHUNK_SIZE) {
-		if (tx_short_apdu(d, &h, apdu_ptr, TX_CHUNK_SIZE, 0x10) < 0) {
+	while (payload_len > TX_CHUNK_SIZE) {
+		if (tx_short_apdu(d, h, payload, TX_CHUNK_SIZE, 0x10) < 0) {
 			fido_log_debug("%s: chain", __func__);
 			return -1;
 		}
-		apdu_ptr += TX_CHUNK_SIZE;
-		apdu_len -= TX_CHUNK_SIZE;
+		payload += TX_CHUNK_SIZE;
+		payload_len -= TX_CHUNK_SIZE;
 	}
 
-	if (tx_short_apdu(d, &h, apdu_ptr, (uint8_t)apdu_len, 0) < 0) {
+	if (tx_short_apdu(d, h, payload, (uint8_t)payload_len, 0) < 0) {
 		fido_log_debug("%s: tx_short_apdu", __func__);
 		return -1;
 	}
@@ -92,55 +115,70 @@ nfc_do_tx(fido_dev_t *d, const uint8_t *apdu_ptr, size_t apdu_len)
 	return 0;
 }
 
-int
-fido_nfc_tx(fido_dev_t *d, uint8_t cmd, const unsigned char *buf, size_t count)
+/*
+ * The select and cbor commands are sent as a header and the caller's
+ * buffer; an apdu from the caller is taken apart into the same. Either
+ * way, the payload is copied once, into d->apdu_buf.
+ */
+static int
+nfc_tx(fido_dev_t *d, uint8_t cmd, const unsigned char *buf, size_t count,
+    bool ext)
 {
-	iso7816_apdu_t *apdu = NULL;
-	const uint8_t *ptr;
-	size_t len;
-	int ok = -1;
+	iso7816_header_t h;
+
+	memset(&h, 0, sizeof(h));
 
 	switch (cmd) {
 	case CTAP_CMD_INIT: /* select */
-		if ((apdu = iso7816_new(0, 0xa4, 0x04, sizeof(aid))) == NULL ||
-		    iso7816_add(apdu, aid, sizeof(aid)) < 0) {
-			fido_log_debug("%s: iso7816", __func__);
-			goto fail;
-		}
+		h.ins = 0xa4;
+		h.p1 = 0x04;
+		buf = aid;
+		count = sizeof(aid);
 		break;
 	case CTAP_CMD_CBOR: /* wrap cbor */
-		if (count > UINT16_MAX || (apdu = iso7816_new(0x80, 0x10, 0x00,
-		    (uint16_t)count)) == NULL ||
-		    iso7816_add(apdu, buf, count) < 0) {
-			fido_log_debug("%s: iso7816", __func__);
-			goto fail;
+		if (count > UINT16_MAX) {
+			fido_log_debug("%s: count=%zu", __func__, count);
+			return -1;
 		}
+		h.cla = 0x80;
+		h.ins = 0x10;
 		break;
 	case CTAP_CMD_MSG: /* already an apdu */
+		if (fido_buf_read(&buf, &count, &h, sizeof(h)) < 0) {
+			fido_log_debug("%s: header", __func__);
+			return -1;
+		}
+		if (count < 2) {
+			fido_log_debug("%s: count %zu", __func__, count);
+			return -1;
+		}
+		count -= 2; /* trim le1 le2 */
 		break;
 	default:
 		fido_log_debug("%s: cmd=%02x", __func__, cmd);
-		goto fail;
+		return -1;
 	}
 
-	if (apdu != NULL) {
-		ptr = iso7816_ptr(apdu);
-		len = iso7816_len(apdu);
-	} else {
-		ptr = buf;
-		len = count;
+	if (tx_apdu(d, &h, buf, count, ext) < 0) {
+		fido_log_debug("%s: tx_apdu", __func__);
+		return -1;
 	}
 
-	if (nfc_do_tx(d, ptr, len) < 0) {
-		fido_log_debug("%s: nfc_do_tx", __func__);
-		goto fail;
-	}
+	return 0;
+}
 
-	ok = 0;
-fail:
-	iso7816_free(&apdu);
+int
+fido_nfc_tx(fido_dev_t *d, uint8_t cmd, const unsigned char *buf, size_t count)
+{
+	return nfc_tx(d, cmd, buf, count, false);
+}
 
-	return ok;
+/* as fido_nfc_tx(), for cards that take extended-length apdus */
+int
+fido_nfc_tx_ext(fido_dev_t *d, uint8_t cmd, const unsigned char *buf,
+    size_t count)
+{
+	return nfc_tx(d, cmd, buf, count, true);
 }
 
 static int
@@ -204,13 +242,24 @@ static int
 rx_apdu(fido_dev_t *d, uint8_t sw[2], unsigned char **buf, size_t *count, int *ms)
 {
 	uint8_t f[256 + 2];
+	unsigned char *ptr;
 	struct timespec ts;
+	size_t len;
 	int n, ok = -1;
 
+	/* read in place if any reply fits; the status word is moved out */
+	if (*count >= sizeof(f)) {
+		ptr = *buf;
+		len = *count;
+	} else {
+		ptr = f;
+		len = sizeof(f);
+	}
+
 	if (fido_time_now(&ts) != 0)
-		goto fail;
+		return -1;
 
-	if ((n = d->io.read(d->io_handle, f, sizeof(f), *ms)) < 2) {
+	if ((n = d->io.read(d->io_handle, ptr, len, *ms)) < 2) {
 		fido_log_debug("%s: read", __func__);
 		goto fail;
 	}
@@ -218,16 +267,24 @@ rx_apdu(fido_dev_t *d, uint8_t sw[2], unsigned char **buf, size_t *count, int *m
 	if (fido_time_delta(&ts, ms) != 0)
 		goto fail;
 
-	if (fido_buf_write(buf, count, f, (size_t)(n - 2)) < 0) {
+	memcpy(sw, ptr + n - 2, 2);
+
+	if (ptr == *buf) {
+		*buf += n - 2;
+		*count -= (size_t)(n - 2);
+	} else if (fido_buf_write(buf, count, f, (size_t)(n - 2)) < 0) {
 		fido_log_debug("%s: fido_buf_write", __func__);
 		goto fail;
 	}
 
-	memcpy(sw, f + n - 2, 2);
-
 	ok = 0;
 fail:
-	explicit_bzero(f, sizeof(f));
+	/* a failed read may have written anywhere in f */
+	if (ptr == f) {
+		if (n < 0 || (size_t)n > sizeof(f))
+			n = (int)sizeof(f);
+		explicit_bzero(f, (size_t)n);
+	}
 
 	return ok;
 }
@@ -19,6 +19,7 @@
 #include <unistd.h>
 
 #include "fido.h"
+#include "dl.h"
 #include "fido/param.h"
 #include "netlink.h"
 #include "iso7816.h"
@@ -44,7 +45,7 @@ get_parent_attr(struct udev_device *dev, const char *subsystem,
 	    udev_device_get_sysattr_value(parent, attr)) == NULL)
 		return NULL;
 
-	return strdup(value);
+	return fido_strdup(value);
 }
 
 static char *
@@ -68,7 +69,7 @@ copy_info(fido_dev_info_t *di, struct udev *udev,
 	if ((name = udev_list_entry_get_name(udev_entry)) == NULL ||
 	    (dev = udev_device_new_from_syspath(udev, name)) == NULL)
 		goto fail;
-	if (asprintf(&di->path, "%s/%s", FIDO_NFC_PREFIX, name) == -1) {
+	if (fido_asprintf(&di->path, "%s/%s", FIDO_NFC_PREFIX, name) == -1) {
 		di->path = NULL;
 		goto fail;
 	}
@@ -77,20 +78,20 @@ copy_info(fido_dev_info_t *di, struct udev *udev,
 		goto fail;
 	}
 	if ((di->manufacturer = get_usb_attr(dev, "manufacturer")) == NULL)
-		di->manufacturer = strdup("");
+		di->manufacturer = fido_strdup("");
 	if ((di->product = get_usb_attr(dev, "product")) == NULL)
-		di->product = strdup("");
+		di->product = fido_strdup("");
 	if (di->manufacturer == NULL || di->product == NULL)
 		goto fail;
 	/* XXX assumes USB for vendor/product info */
 	if ((str = get_usb_attr(dev, "idVendor")) != NULL &&
 	    fido_to_uint64(str, 16, &id) == 0 && id <= UINT16_MAX)
 		di->vendor_id = (int16_t)id;
-	free(str);
+	fido_free(str);
 	if ((str = get_usb_attr(dev, "idProduct")) != NULL &&
 	    fido_to_uint64(str, 16, &id) == 0 && id <= UINT16_MAX)
 		di->product_id = (int16_t)id;
-	free(str);
+	fido_free(str);
 
 	ok = 0;
 fail:
@@ -98,9 +99,9 @@ fail:
 		udev_device_unref(dev);
 
 	if (ok < 0) {
-		free(di->path);
-		free(di->manufacturer);
-		free(di->product);
+		fido_free(di->path);
+		fido_free(di->manufacturer);
+		fido_free(di->product);
 		explicit_bzero(di, sizeof(*di));
 	}
 
@@ -226,7 +227,7 @@ nfc_free(struct nfc_linux **ctx_p)
 	if (ctx->nl != NULL)
 		fido_nl_free(&ctx->nl);
 
-	free(ctx);
+	fido_free(ctx);
 	*ctx_p = NULL;
 }
 
@@ -235,7 +236,7 @@ nfc_new(uint32_t dev)
 {
 	struct nfc_linux *ctx;
 
-	if ((ctx = calloc(1, sizeof(*ctx))) == NULL ||
+	if ((ctx = fido_calloc(1, sizeof(*ctx))) == NULL ||
 	    (ctx->nl = fido_nl_new()) == NULL) {
 		nfc_free(&ctx);
 		return NULL;
@@ -262,8 +263,15 @@ fido_nfc_open(const char *path)
 		fido_log_debug("%s: nfc_new", __func__);
 		goto fail;
 	}
-	if (fido_nl_power_nfc(ctx->nl, ctx->dev) < 0 ||
-	    fido_nl_get_nfc_target(ctx->nl, ctx->dev, &ctx->target) < 0 ||
+	if (fido_nl_power_nfc(ctx->nl, ctx->dev) < 0) {
+		fido_log_debug("%s: netlink", __func__);
+		goto fail;
+	}
+	/* a card that is still in the field need not be polled for */
+	if (fido_nl_find_nfc_target(ctx->nl, ctx->dev, &ctx->target) == 0 &&
+	    nfc_target_connect(ctx) == 0)
+		return ctx;
+	if (fido_nl_get_nfc_target(ctx->nl, ctx->dev, &ctx->target) < 0 ||
 	    nfc_target_connect(ctx) < 0) {
 		fido_log_debug("%s: netlink", __func__);
 		goto fail;
@@ -308,7 +316,7 @@ fido_nfc_read(void *handle, unsigned char *buf, size_t len, int ms)
 	iov[1].iov_base = buf;
 	iov[1].iov_len = len;
 
-	if (fido_hid_unix_wait(ctx->fd, ms, ctx->sigmaskp) < 0) {
+	if (fido_hid_unix_wait(ctx->fd, -1, ms, ctx->sigmaskp) < 0) {
 		fido_log_debug("%s: fido_hid_unix_wait", __func__);
 		return -1;
 	}
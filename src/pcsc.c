@@ -13,15 +13,32 @@
 #include <winscard.h>
 #endif /* __APPLE__ */
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
 #include <errno.h>
+#include <fcntl.h>
+#include <time.h>
 
 #include "fido.h"
+#include "dl.h"
 #include "fido/param.h"
 #include "iso7816.h"
 
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
 #if defined(_WIN32) && !defined(__MINGW32__)
 #define SCardConnect SCardConnectA
 #define SCardListReaders SCardListReadersA
+#define SCardStatus SCardStatusA
+#define SCardGetStatusChange SCardGetStatusChangeA
+#define SCARD_READERSTATE SCARD_READERSTATEA
 #endif
 
 #ifndef SCARD_PROTOCOL_Tx
@@ -31,26 +48,250 @@
 #define BUFSIZE 1024	/* in bytes; passed to SCardListReaders() */
 #define APDULEN 264	/* 261 rounded up to the nearest multiple of 8 */
 #define READERS 8	/* maximum number of readers */
+#define ATRLEN  33	/* maximum length of an atr */
+#define PNP_READER "\\\\?PnP?\\Notification" /* reader changes */
+#define MONITOR_MS 1000	/* longest wait of the monitor worker */
+
+#if defined(HAVE_PTHREAD) && !defined(_WIN32)
+#define PCSC_MONITOR_THREAD
+#endif
+
+#ifdef FIDO_FUZZ
+#define PCSC_KEEP_CTX	false	/* keep fuzzing runs independent */
+#else
+#define PCSC_KEEP_CTX	true
+#endif
+
+struct pcsc_ctx {
+	SCARDCONTEXT	ctx;
+	size_t		refs; /* handles, idle cards and manifests using ctx */
+};
 
 struct pcsc {
-	SCARDCONTEXT     ctx;
+	struct pcsc_ctx *ctx;
+	char            *reader;
 	SCARDHANDLE      h;
 	SCARD_IO_REQUEST req;
 	uint8_t          rx_buf[APDULEN];
 	size_t           rx_len;
+	bool             ext_apdu; /* card takes extended-length apdus */
+	uint8_t          applet;   /* flags of the selected fido applet, or 0 */
+	bool             skipped;  /* select not sent; see fido_pcsc_tx() */
 };
 
+/* a card left connected by a closed handle */
+struct pcsc_idle {
+	struct pcsc_ctx	*ctx;
+	char		*reader;
+	SCARDHANDLE	 h;
+	uint8_t		 applet; /* as in struct pcsc */
+};
+
+/*
+ * Establishing a context with pcscd is slow, so one is shared by all
+ * handles and manifests, and kept when unused. It is replaced when pcscd
+ * goes away and after fork(). With fido_pcsc_set_keep_card(), closed
+ * handles also leave their card connected, so that the next open of the
+ * reader only has to reconnect to it. The fido applet stays selected on
+ * such a card, and is not selected again unless the card was reset or
+ * replaced in the meantime.
+ */
+static struct pcsc_shared {
+	struct pcsc_ctx		*ctx;  /* current context, or NULL */
+	struct pcsc_idle	 idle[READERS];
+	bool			 keep; /* keep cards of closed handles */
+#ifdef HAVE_UNISTD_H
+	pid_t			 pid;  /* process ctx belongs to */
+#endif
+} pcsc_shared;
+
+#if defined(HAVE_PTHREAD)
+static pthread_mutex_t pcsc_lock = PTHREAD_MUTEX_INITIALIZER;
+#define PCSC_LOCK()	pthread_mutex_lock(&pcsc_lock)
+#define PCSC_UNLOCK()	pthread_mutex_unlock(&pcsc_lock)
+#elif defined(_WIN32)
+static SRWLOCK pcsc_lock = SRWLOCK_INIT;
+#define PCSC_LOCK()	AcquireSRWLockExclusive(&pcsc_lock)
+#define PCSC_UNLOCK()	ReleaseSRWLockExclusive(&pcsc_lock)
+#else
+#define PCSC_LOCK()	do { } while (0)
+#define PCSC_UNLOCK()	do { } while (0)
+#endif
+
+static bool
+pcsc_lost(LONG s)
+{
+	return s == (LONG)SCARD_E_SERVICE_STOPPED ||
+	    s == (LONG)SCARD_E_NO_SERVICE || s == (LONG)SCARD_E_INVALID_HANDLE;
+}
+
+/* caller must hold pcsc_lock */
+static void
+ctx_unref(struct pcsc_ctx *c)
+{
+	if (--c->refs > 0 || (c == pcsc_shared.ctx && PCSC_KEEP_CTX))
+		return;
+	if (c == pcsc_shared.ctx)
+		pcsc_shared.ctx = NULL;
+	SCardReleaseContext(c->ctx);
+	fido_free(c);
+}
+
+/* caller must hold pcsc_lock */
+static void
+idle_drop(struct pcsc_idle *e, bool disconnect)
+{
+	if (disconnect)
+		SCardDisconnect(e->h, SCARD_LEAVE_CARD);
+	ctx_unref(e->ctx);
+	fido_free(e->reader);
+	memset(e, 0, sizeof(*e));
+}
+
+/*
+ * A context and cards inherited through fork() belong to the parent, and
+ * are forgotten without being released; caller must hold pcsc_lock.
+ */
+static void
+pcsc_check_pid(void)
+{
+#ifdef HAVE_UNISTD_H
+	if (pcsc_shared.pid == getpid())
+		return;
+	pcsc_shared.pid = getpid();
+	pcsc_shared.ctx = NULL;
+	for (size_t i = 0; i < nitems(pcsc_shared.idle); i++) {
+		fido_free(pcsc_shared.idle[i].reader);
+		memset(&pcsc_shared.idle[i], 0, sizeof(pcsc_shared.idle[i]));
+	}
+#endif
+}
+
+static struct pcsc_ctx *
+ctx_get(LONG *s)
+{
+	struct pcsc_ctx	*c;
+	SCARDCONTEXT	 ctx = 0;
+
+	*s = SCARD_S_SUCCESS;
+
+	PCSC_LOCK();
+	pcsc_check_pid();
+	if ((c = pcsc_shared.ctx) != NULL) {
+		c->refs++;
+		goto out;
+	}
+	if ((*s = SCardEstablishContext(SCARD_SCOPE_SYSTEM, NULL, NULL,
+	    &ctx)) != SCARD_S_SUCCESS || ctx == 0) {
+		fido_log_debug("%s: SCardEstablishContext 0x%lx", __func__,
+		    (long)*s);
+		goto out;
+	}
+	if ((c = fido_calloc(1, sizeof(*c))) == NULL) {
+		SCardReleaseContext(ctx);
+		*s = (LONG)SCARD_E_NO_MEMORY;
+		goto out;
+	}
+	c->ctx = ctx;
+	c->refs = 1;
+	pcsc_shared.ctx = c;
+out:
+	PCSC_UNLOCK();
+
+	return c;
+}
+
+static void
+ctx_put(struct pcsc_ctx *c)
+{
+	PCSC_LOCK();
+	ctx_unref(c);
+	PCSC_UNLOCK();
+}
+
+/* stop sharing c if s says that pcscd went away */
+static void
+ctx_check(struct pcsc_ctx *c, LONG s)
+{
+	if (pcsc_lost(s) == false)
+		return;
+
+	PCSC_LOCK();
+	if (c == pcsc_shared.ctx) {
+		fido_log_debug("%s: context lost 0x%lx", __func__, (long)s);
+		pcsc_shared.ctx = NULL;
+		for (size_t i = 0; i < nitems(pcsc_shared.idle); i++)
+			if (pcsc_shared.idle[i].ctx == c)
+				idle_drop(&pcsc_shared.idle[i], false);
+	}
+	PCSC_UNLOCK();
+}
+
+/* take a card of reader left connected by a closed handle, or 0 */
+static SCARDHANDLE
+idle_take(struct pcsc_ctx *c, const char *reader, uint8_t *applet)
+{
+	struct pcsc_idle	*e;
+	SCARDHANDLE		 h = 0;
+
+	PCSC_LOCK();
+	for (size_t i = 0; i < nitems(pcsc_shared.idle); i++) {
+		e = &pcsc_shared.idle[i];
+		if (e->ctx == c && strcmp(e->reader, reader) == 0) {
+			h = e->h;
+			*applet = e->applet;
+			idle_drop(e, false); /* caller holds a reference */
+			break;
+		}
+	}
+	PCSC_UNLOCK();
+
+	return h;
+}
+
+/* leave the card of dev connected; returns true if dev->h was taken */
+static bool
+idle_put(struct pcsc *dev)
+{
+	struct pcsc_idle	*e;
+	bool			 ok = false;
+
+	PCSC_LOCK();
+	if (pcsc_shared.keep == false || dev->ctx != pcsc_shared.ctx)
+		goto out;
+	for (size_t i = 0; i < nitems(pcsc_shared.idle); i++) {
+		e = &pcsc_shared.idle[i];
+		if (e->ctx != NULL)
+			continue;
+		e->ctx = dev->ctx;
+		e->reader = dev->reader;
+		e->h = dev->h;
+		e->applet = dev->applet;
+		dev->ctx = NULL;
+		dev->reader = NULL;
+		dev->h = 0;
+		ok = true;
+		break;
+	}
+out:
+	PCSC_UNLOCK();
+
+	return ok;
+}
+
 static LONG
 list_readers(SCARDCONTEXT ctx, char **buf)
 {
-	LONG s;
+	LONG s, r = (LONG)SCARD_E_NO_READERS_AVAILABLE;
 	DWORD len;
 
 	len = BUFSIZE;
-	if ((*buf = calloc(1, len)) == NULL)
+	if ((*buf = fido_calloc(1, len)) == NULL)
 		goto fail;
 	if ((s = SCardListReaders(ctx, NULL, *buf, &len)) != SCARD_S_SUCCESS) {
 		fido_log_debug("%s: SCardListReaders 0x%lx", __func__, (long)s);
+		if (pcsc_lost(s))
+			r = s; /* let the caller retry */
 		goto fail;
 	}
 	/* sanity check "multi-string" */
@@ -64,19 +305,21 @@ list_readers(SCARDCONTEXT ctx, char **buf)
 	}
 	return (LONG)SCARD_S_SUCCESS;
 fail:
-	free(*buf);
+	fido_free(*buf);
 	*buf = NULL;
 
-	return (LONG)SCARD_E_NO_READERS_AVAILABLE;
+	return r;
 }
 
 static char *
-get_reader(SCARDCONTEXT ctx, const char *path)
+get_reader(SCARDCONTEXT ctx, const char *path, LONG *s)
 {
 	char *reader = NULL, *buf = NULL;
 	const char prefix[] = FIDO_PCSC_PREFIX "//slot";
 	uint64_t n;
 
+	*s = SCARD_S_SUCCESS;
+
 	if (path == NULL)
 		goto out;
 	if (strncmp(path, prefix, strlen(prefix)) != 0 ||
@@ -85,20 +328,20 @@ get_reader(SCARDCONTEXT ctx, const char *path)
 		fido_log_debug("%s: invalid path %s", __func__, path);
 		goto out;
 	}
-	if (list_readers(ctx, &buf) != SCARD_S_SUCCESS) {
+	if ((*s = list_readers(ctx, &buf)) != SCARD_S_SUCCESS) {
 		fido_log_debug("%s: list_readers", __func__);
 		goto out;
 	}
 	for (const char *name = buf; *name != 0; name += strlen(name) + 1) {
 		if (n == 0) {
-			reader = strdup(name);
+			reader = fido_strdup(name);
 			goto out;
 		}
 		n--;
 	}
 	fido_log_debug("%s: failed to find reader %s", __func__, path);
 out:
-	free(buf);
+	fido_free(buf);
 
 	return reader;
 }
@@ -124,6 +367,96 @@ prepare_io_request(DWORD prot, SCARD_IO_REQUEST *req)
 	return 0;
 }
 
+/*
+ * Look for the "extended Lc and Le fields" bit of the card capabilities
+ * (ISO 7816-4, 8.1.1.2.7) in the historical bytes of an atr. Readers
+ * build the atr of a contactless card from its ats, and only advertise
+ * the capability if they can pass such apdus on.
+ */
+static bool
+atr_ext_apdu(const uint8_t *atr, size_t len)
+{
+	size_t i = 1, k, end;
+	uint8_t y, tag, n;
+
+	if (len < 2)
+		return false;
+	y = atr[i] & 0xf0;
+	k = atr[i++] & 0x0f;
+	/* skip interface bytes */
+	while (y != 0) {
+		i += (size_t)(((y & 0x10) != 0) + ((y & 0x20) != 0) +
+		    ((y & 0x40) != 0));
+		if ((y & 0x80) == 0)
+			break;
+		if (i >= len)
+			return false;
+		y = atr[i++] & 0xf0;
+	}
+	if (k == 0 || i + k > len || atr[i] != 0x80)
+		return false;
+	/* compact-tlv objects */
+	for (end = i + k, i++; i < end; i += n) {
+		tag = atr[i] >> 4;
+		n = atr[i++] & 0x0f;
+		if (i + n > end)
+			return false;
+		if (tag == 0x7 && n >= 3)
+			return (atr[i + 2] & 0x40) != 0;
+	}
+
+	return false;
+}
+
+static bool
+card_ext_apdu(SCARDHANDLE h)
+{
+	uint8_t atr[ATRLEN];
+	DWORD atr_len, reader_len, state, prot;
+	LONG s;
+
+	atr_len = (DWORD)sizeof(atr);
+	reader_len = 0;
+	if ((s = SCardStatus(h, NULL, &reader_len, &state, &prot, atr,
+	    &atr_len)) != SCARD_S_SUCCESS) {
+		fido_log_debug("%s: SCardStatus 0x%lx", __func__, (long)s);
+		return false;
+	}
+	if (atr_len > sizeof(atr)) {
+		fido_log_debug("%s: bogus atr_len=%u", __func__,
+		    (unsigned)atr_len);
+		return false;
+	}
+	fido_log_xxd(atr, atr_len, "%s: atr", __func__);
+	if (atr_ext_apdu(atr, atr_len) == false)
+		return false;
+	fido_log_debug("%s: extended-length apdus", __func__);
+
+	return true;
+}
+
+/*
+ * Whether the card behind h is the one it was connected to, and has not
+ * been reset since; SCardStatus() only answers from pcscd's state.
+ */
+static bool
+card_unchanged(SCARDHANDLE h)
+{
+	uint8_t atr[ATRLEN];
+	DWORD atr_len, reader_len, state, prot;
+	LONG s;
+
+	atr_len = (DWORD)sizeof(atr);
+	reader_len = 0;
+	if ((s = SCardStatus(h, NULL, &reader_len, &state, &prot, atr,
+	    &atr_len)) != SCARD_S_SUCCESS) {
+		fido_log_debug("%s: SCardStatus 0x%lx", __func__, (long)s);
+		return false;
+	}
+
+	return true;
+}
+
 static int
 copy_info(fido_dev_info_t *di, SCARDCONTEXT ctx, const char *reader, size_t idx)
 {
@@ -145,7 +478,8 @@ copy_info(fido_dev_info_t *di, SCARDCONTEXT ctx, const char *reader, size_t idx)
 		fido_log_debug("%s: prepare_io_request", __func__);
 		goto fail;
 	}
-	if (asprintf(&di->path, "%s//slot%zu", FIDO_PCSC_PREFIX, idx) == -1) {
+	if (fido_asprintf(&di->path, "%s//slot%zu", FIDO_PCSC_PREFIX,
+	    idx) == -1) {
 		di->path = NULL;
 		fido_log_debug("%s: asprintf", __func__);
 		goto fail;
@@ -154,8 +488,8 @@ copy_info(fido_dev_info_t *di, SCARDCONTEXT ctx, const char *reader, size_t idx)
 		fido_log_debug("%s: nfc_is_fido: %s", __func__, di->path);
 		goto fail;
 	}
-	if ((di->manufacturer = strdup("PC/SC")) == NULL ||
-	    (di->product = strdup(reader)) == NULL)
+	if ((di->manufacturer = fido_strdup("PC/SC")) == NULL ||
+	    (di->product = fido_strdup(reader)) == NULL)
 		goto fail;
 
 	ok = 0;
@@ -163,43 +497,33 @@ fail:
 	if (h != 0)
 		SCardDisconnect(h, SCARD_LEAVE_CARD);
 	if (ok < 0) {
-		free(di->path);
-		free(di->manufacturer);
-		free(di->product);
+		fido_free(di->path);
+		fido_free(di->manufacturer);
+		fido_free(di->product);
 		explicit_bzero(di, sizeof(*di));
 	}
 
 	return ok;
 }
 
-int
-fido_pcsc_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
+static int
+pcsc_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen, LONG *s)
 {
-	SCARDCONTEXT ctx = 0;
+	struct pcsc_ctx *c;
 	char *buf = NULL;
-	LONG s;
 	size_t idx = 0;
 	int r = FIDO_ERR_INTERNAL;
 
-	*olen = 0;
-
-	if (ilen == 0)
-		return FIDO_OK;
-	if (devlist == NULL)
-		return FIDO_ERR_INVALID_ARGUMENT;
-
-	if ((s = SCardEstablishContext(SCARD_SCOPE_SYSTEM, NULL, NULL,
-	    &ctx)) != SCARD_S_SUCCESS || ctx == 0) {
-		fido_log_debug("%s: SCardEstablishContext 0x%lx", __func__,
-		    (long)s);
-		if (s == (LONG)SCARD_E_NO_SERVICE ||
-		    s == (LONG)SCARD_E_NO_SMARTCARD)
+	if ((c = ctx_get(s)) == NULL) {
+		fido_log_debug("%s: ctx_get 0x%lx", __func__, (long)*s);
+		if (*s == (LONG)SCARD_E_NO_SERVICE ||
+		    *s == (LONG)SCARD_E_NO_SMARTCARD)
 			r = FIDO_OK; /* suppress error */
 		goto out;
 	}
-	if ((s = list_readers(ctx, &buf)) != SCARD_S_SUCCESS) {
-		fido_log_debug("%s: list_readers 0x%lx", __func__, (long)s);
-		if (s == (LONG)SCARD_E_NO_READERS_AVAILABLE)
+	if ((*s = list_readers(c->ctx, &buf)) != SCARD_S_SUCCESS) {
+		fido_log_debug("%s: list_readers 0x%lx", __func__, (long)*s);
+		if (*s == (LONG)SCARD_E_NO_READERS_AVAILABLE)
 			r = FIDO_OK; /* suppress error */
 		goto out;
 	}
@@ -211,7 +535,7 @@ fido_pcsc_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
 			r = FIDO_OK;
 			goto out;
 		}
-		if (copy_info(&devlist[*olen], ctx, name, idx++) == 0) {
+		if (copy_info(&devlist[*olen], c->ctx, name, idx++) == 0) {
 			devlist[*olen].io = (fido_dev_io_t) {
 				fido_pcsc_open,
 				fido_pcsc_close,
@@ -229,60 +553,115 @@ fido_pcsc_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
 
 	r = FIDO_OK;
 out:
-	free(buf);
-	if (ctx != 0)
-		SCardReleaseContext(ctx);
+	fido_free(buf);
+	if (c != NULL) {
+		ctx_check(c, *s);
+		ctx_put(c);
+	}
 
 	return r;
 }
 
-void *
-fido_pcsc_open(const char *path)
+int
+fido_pcsc_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
+{
+	LONG s;
+	int r;
+
+	*olen = 0;
+
+	if (ilen == 0)
+		return FIDO_OK;
+	if (devlist == NULL)
+		return FIDO_ERR_INVALID_ARGUMENT;
+
+	/* pcscd may have been restarted since the context was established */
+	if ((r = pcsc_manifest(devlist, ilen, olen, &s)) != FIDO_OK &&
+	    pcsc_lost(s)) {
+		fido_log_debug("%s: retrying", __func__);
+		r = pcsc_manifest(devlist, ilen, olen, &s);
+	}
+
+	return r;
+}
+
+static struct pcsc *
+pcsc_open(const char *path, LONG *s)
 {
+	struct pcsc_ctx *c;
 	char *reader = NULL;
 	struct pcsc *dev = NULL;
-	SCARDCONTEXT ctx = 0;
 	SCARDHANDLE h = 0;
 	SCARD_IO_REQUEST req;
 	DWORD prot = 0;
-	LONG s;
+	uint8_t applet = 0;
 
 	memset(&req, 0, sizeof(req));
 
-	if ((s = SCardEstablishContext(SCARD_SCOPE_SYSTEM, NULL, NULL,
-	    &ctx)) != SCARD_S_SUCCESS || ctx == 0) {
-		fido_log_debug("%s: SCardEstablishContext 0x%lx", __func__,
-		    (long)s);
-		goto fail;
-
+	if ((c = ctx_get(s)) == NULL) {
+		fido_log_debug("%s: ctx_get 0x%lx", __func__, (long)*s);
+		return NULL;
 	}
-	if ((reader = get_reader(ctx, path)) == NULL) {
+	if ((reader = get_reader(c->ctx, path, s)) == NULL) {
 		fido_log_debug("%s: get_reader(%s)", __func__, path);
 		goto fail;
 	}
-	if ((s = SCardConnect(ctx, reader, SCARD_SHARE_SHARED,
+	/* a reset or replaced card has to have its applet selected again */
+	if ((h = idle_take(c, reader, &applet)) != 0 && applet != 0 &&
+	    card_unchanged(h) == false)
+		applet = 0;
+	if (h != 0 && (*s = SCardReconnect(h, SCARD_SHARE_SHARED,
+	    SCARD_PROTOCOL_Tx, SCARD_LEAVE_CARD, &prot)) != SCARD_S_SUCCESS) {
+		fido_log_debug("%s: SCardReconnect 0x%lx", __func__, (long)*s);
+		SCardDisconnect(h, SCARD_LEAVE_CARD);
+		h = 0;
+		applet = 0;
+	}
+	if (h == 0 && (*s = SCardConnect(c->ctx, reader, SCARD_SHARE_SHARED,
 	    SCARD_PROTOCOL_Tx, &h, &prot)) != SCARD_S_SUCCESS) {
-		fido_log_debug("%s: SCardConnect 0x%lx", __func__, (long)s);
+		fido_log_debug("%s: SCardConnect 0x%lx", __func__, (long)*s);
+		h = 0;
 		goto fail;
 	}
 	if (prepare_io_request(prot, &req) < 0) {
 		fido_log_debug("%s: prepare_io_request", __func__);
 		goto fail;
 	}
-	if ((dev = calloc(1, sizeof(*dev))) == NULL)
+	if ((dev = fido_calloc(1, sizeof(*dev))) == NULL)
 		goto fail;
 
-	dev->ctx = ctx;
+	dev->ctx = c;
+	dev->reader = reader;
 	dev->h = h;
 	dev->req = req;
-	ctx = 0;
+	dev->ext_apdu = card_ext_apdu(h);
+	dev->applet = applet;
+	c = NULL;
+	reader = NULL;
 	h = 0;
 fail:
 	if (h != 0)
 		SCardDisconnect(h, SCARD_LEAVE_CARD);
-	if (ctx != 0)
-		SCardReleaseContext(ctx);
-	free(reader);
+	if (c != NULL) {
+		ctx_check(c, *s);
+		ctx_put(c);
+	}
+	fido_free(reader);
+
+	return dev;
+}
+
+void *
+fido_pcsc_open(const char *path)
+{
+	struct pcsc *dev;
+	LONG s;
+
+	/* pcscd may have been restarted since the context was established */
+	if ((dev = pcsc_open(path, &s)) == NULL && pcsc_lost(s)) {
+		fido_log_debug("%s: retrying", __func__);
+		dev = pcsc_open(path, &s);
+	}
 
 	return dev;
 }
@@ -292,13 +671,15 @@ fido_pcsc_close(void *handle)
 {
 	struct pcsc *dev = handle;
 
-	if (dev->h != 0)
+	if (dev->h != 0 && idle_put(dev) == false)
 		SCardDisconnect(dev->h, SCARD_LEAVE_CARD);
-	if (dev->ctx != 0)
-		SCardReleaseContext(dev->ctx);
+	if (dev->ctx != NULL)
+		ctx_put(dev->ctx);
 
-	explicit_bzero(dev->rx_buf, sizeof(dev->rx_buf));
-	free(dev);
+	fido_free(dev->reader);
+	/* the rest of rx_buf is wiped by fido_pcsc_read() and _write() */
+	explicit_bzero(dev->rx_buf, dev->rx_len);
+	fido_free(dev);
 }
 
 int
@@ -315,7 +696,7 @@ fido_pcsc_read(void *handle, unsigned char *buf, size_t len, int ms)
 	}
 	fido_log_xxd(dev->rx_buf, dev->rx_len, "%s: reading", __func__);
 	memcpy(buf, dev->rx_buf, dev->rx_len);
-	explicit_bzero(dev->rx_buf, sizeof(dev->rx_buf));
+	explicit_bzero(dev->rx_buf, dev->rx_len);
 	r = (int)dev->rx_len;
 	dev->rx_len = 0;
 
@@ -334,8 +715,11 @@ fido_pcsc_write(void *handle, const unsigned char *buf, size_t len)
 		return -1;
 	}
 
-	explicit_bzero(dev->rx_buf, sizeof(dev->rx_buf));
-	dev->rx_len = 0;
+	/* a reply that was read has been wiped already */
+	if (dev->rx_len != 0) {
+		explicit_bzero(dev->rx_buf, dev->rx_len);
+		dev->rx_len = 0;
+	}
 	n = (DWORD)sizeof(dev->rx_buf);
 
 	fido_log_xxd(buf, len, "%s: writing", __func__);
@@ -344,25 +728,85 @@ fido_pcsc_write(void *handle, const unsigned char *buf, size_t len)
 	    dev->rx_buf, &n)) != SCARD_S_SUCCESS) {
 		fido_log_debug("%s: SCardTransmit 0x%lx", __func__, (long)s);
 		explicit_bzero(dev->rx_buf, sizeof(dev->rx_buf));
+		dev->applet = 0;
 		return -1;
 	}
 	dev->rx_len = (size_t)n;
 
 	fido_log_xxd(dev->rx_buf, dev->rx_len, "%s: read", __func__);
 
+	/* the card or reader didn't take an extended-length apdu after all */
+	if (dev->ext_apdu && len > 7 && buf[4] == 0 && n == 2 &&
+	    (dev->rx_buf[0] << 8 | dev->rx_buf[1]) == SW_WRONG_LENGTH) {
+		fido_log_debug("%s: falling back to chaining", __func__);
+		dev->ext_apdu = false;
+	}
+
+	/* someone else selected another applet while the card was kept */
+	if (dev->applet != 0 && n == 2 &&
+	    ((dev->rx_buf[0] << 8 | dev->rx_buf[1]) == SW_INS_NOT_SUPPORTED ||
+	    (dev->rx_buf[0] << 8 | dev->rx_buf[1]) == SW_CLA_NOT_SUPPORTED)) {
+		fido_log_debug("%s: applet no longer selected", __func__);
+		dev->applet = 0;
+	}
+
 	return (int)len;
 }
 
+/*
+ * The select sent by fido_dev_open() is skipped on a kept card whose fido
+ * applet is still selected; fido_pcsc_rx() then answers it from the
+ * flags of the earlier reply.
+ */
 int
 fido_pcsc_tx(fido_dev_t *d, uint8_t cmd, const u_char *buf, size_t count)
 {
+	struct pcsc *dev = d->io_handle;
+
+	if (d->io.write != fido_pcsc_write || dev == NULL)
+		return fido_nfc_tx(d, cmd, buf, count);
+
+	dev->skipped = false;
+	if (cmd == CTAP_CMD_INIT && dev->applet != 0) {
+		fido_log_debug("%s: applet selected", __func__);
+		dev->skipped = true;
+		return 0;
+	}
+	if (dev->ext_apdu)
+		return fido_nfc_tx_ext(d, cmd, buf, count);
+
 	return fido_nfc_tx(d, cmd, buf, count);
 }
 
 int
 fido_pcsc_rx(fido_dev_t *d, uint8_t cmd, u_char *buf, size_t count, int ms)
 {
-	return fido_nfc_rx(d, cmd, buf, count, ms);
+	struct pcsc *dev = d->io_handle;
+	fido_ctap_info_t attr;
+	int n;
+
+	if (cmd != CTAP_CMD_INIT || d->io.read != fido_pcsc_read ||
+	    dev == NULL)
+		return fido_nfc_rx(d, cmd, buf, count, ms);
+	if (count != sizeof(attr)) {
+		fido_log_debug("%s: count=%zu", __func__, count);
+		return -1;
+	}
+
+	if (dev->skipped) {
+		dev->skipped = false;
+		memset(&attr, 0, sizeof(attr));
+		attr.flags = dev->applet;
+		attr.nonce = d->nonce;
+		memcpy(buf, &attr, sizeof(attr));
+		return (int)count;
+	}
+	if ((n = fido_nfc_rx(d, cmd, buf, count, ms)) == (int)count) {
+		memcpy(&attr, buf, sizeof(attr));
+		dev->applet = attr.flags;
+	}
+
+	return n;
 }
 
 bool
@@ -392,3 +836,297 @@ fido_dev_set_pcsc(fido_dev_t *d)
 
 	return 0;
 }
+
+int
+fido_pcsc_set_keep_card(bool keep)
+{
+	PCSC_LOCK();
+	pcsc_check_pid();
+	pcsc_shared.keep = keep;
+	if (keep == false)
+		for (size_t i = 0; i < nitems(pcsc_shared.idle); i++)
+			if (pcsc_shared.idle[i].ctx != NULL)
+				idle_drop(&pcsc_shared.idle[i], true);
+	PCSC_UNLOCK();
+
+	return FIDO_OK;
+}
+
+/*
+ * Reader and card changes are waited for with SCardGetStatusChange(),
+ * which blocks. Where possible, a worker thread waits with a context of
+ * its own and signals changes through a pipe; otherwise, each drain
+ * polls.
+ */
+struct pcsc_monitor {
+	SCARDCONTEXT		 ctx;    /* protected by pcsc_lock */
+	char			*buf;    /* reader names */
+	SCARD_READERSTATE	 state[READERS + 1]; /* [0] is PNP_READER */
+	DWORD			 nstate; /* entries in state[] */
+#ifdef PCSC_MONITOR_THREAD
+	pthread_t		 thread;
+	int			 fd[2];  /* worker to monitor */
+	bool			 stop;   /* protected by pcsc_lock */
+#endif
+};
+
+/* forget the current state of the readers of mon, and learn the new one */
+static int
+monitor_readers(struct pcsc_monitor *mon)
+{
+	SCARD_READERSTATE	*st;
+	LONG			 s;
+
+	fido_free(mon->buf);
+	mon->buf = NULL;
+	mon->nstate = 1;
+
+	if ((s = list_readers(mon->ctx, &mon->buf)) != SCARD_S_SUCCESS)
+		return s == (LONG)SCARD_E_NO_READERS_AVAILABLE ? 0 : -1;
+	for (const char *name = mon->buf; *name != 0 &&
+	    mon->nstate < nitems(mon->state); name += strlen(name) + 1) {
+		st = &mon->state[mon->nstate++];
+		memset(st, 0, sizeof(*st));
+		st->szReader = name;
+		st->dwCurrentState = SCARD_STATE_UNAWARE;
+	}
+	/* pcsc-lite keeps the number of readers in the high word */
+	mon->state[0].dwCurrentState = (mon->nstate - 1) << 16;
+	if (mon->nstate == 1)
+		return 0;
+
+	/* returns immediately, since all readers are new */
+	if ((s = SCardGetStatusChange(mon->ctx, 0, &mon->state[1],
+	    mon->nstate - 1)) != SCARD_S_SUCCESS) {
+		fido_log_debug("%s: SCardGetStatusChange 0x%lx", __func__,
+		    (long)s);
+		return -1;
+	}
+	for (DWORD i = 1; i < mon->nstate; i++)
+		mon->state[i].dwCurrentState = mon->state[i].dwEventState &
+		    ~(DWORD)SCARD_STATE_CHANGED;
+
+	return 0;
+}
+
+/* caller must not be waiting on mon->ctx */
+static int
+monitor_reset(struct pcsc_monitor *mon)
+{
+	SCARDCONTEXT	ctx = 0, old;
+	LONG		s;
+
+	if ((s = SCardEstablishContext(SCARD_SCOPE_SYSTEM, NULL, NULL,
+	    &ctx)) != SCARD_S_SUCCESS || ctx == 0) {
+		fido_log_debug("%s: SCardEstablishContext 0x%lx", __func__,
+		    (long)s);
+		return -1;
+	}
+	PCSC_LOCK();
+	old = mon->ctx;
+	mon->ctx = ctx;
+	PCSC_UNLOCK();
+	if (old != 0)
+		SCardReleaseContext(old);
+
+	return monitor_readers(mon);
+}
+
+/* returns 1 if a reader or card changed, 0 if not, -1 on error */
+static int
+monitor_wait(struct pcsc_monitor *mon, DWORD ms)
+{
+	SCARD_READERSTATE	*st;
+	bool			 readers = false;
+	int			 changed = 0;
+	LONG			 s;
+
+	if ((s = SCardGetStatusChange(mon->ctx, ms, mon->state,
+	    mon->nstate)) == (LONG)SCARD_E_TIMEOUT)
+		return 0;
+	if (s != SCARD_S_SUCCESS) {
+		fido_log_debug("%s: SCardGetStatusChange 0x%lx", __func__,
+		    (long)s);
+		return -1;
+	}
+	for (DWORD i = 0; i < mon->nstate; i++) {
+		st = &mon->state[i];
+		if ((st->dwEventState & SCARD_STATE_CHANGED) == 0)
+			continue;
+		st->dwCurrentState = st->dwEventState &
+		    ~(DWORD)SCARD_STATE_CHANGED;
+		readers |= i == 0;
+		changed = 1;
+	}
+	if (readers && monitor_readers(mon) < 0)
+		return -1;
+
+	return changed;
+}
+
+#ifdef PCSC_MONITOR_THREAD
+static bool
+monitor_stopped(struct pcsc_monitor *mon)
+{
+	bool stop;
+
+	PCSC_LOCK();
+	stop = mon->stop;
+	PCSC_UNLOCK();
+
+	return stop;
+}
+
+static void *
+monitor_worker(void *arg)
+{
+	struct pcsc_monitor	*mon = arg;
+	struct timespec		 ts;
+	int			 r;
+
+	ts.tv_sec = MONITOR_MS / 1000;
+	ts.tv_nsec = (MONITOR_MS % 1000) * 1000000L;
+
+	while (monitor_stopped(mon) == false) {
+		if ((r = monitor_wait(mon, MONITOR_MS)) < 0) {
+			/* pcscd went away; let readers be enumerated again */
+			if (monitor_stopped(mon))
+				break;
+			nanosleep(&ts, NULL);
+			(void)monitor_reset(mon);
+		}
+		/* the pipe may be full, in which case a change is pending */
+		if (r != 0 && write(mon->fd[1], "", 1) == -1 &&
+		    errno != EAGAIN)
+			fido_log_error(errno, "%s: write", __func__);
+	}
+
+	return NULL;
+}
+
+static int
+set_nonblock_cloexec(int fd)
+{
+	int flags;
+
+	if ((flags = fcntl(fd, F_GETFL)) == -1 ||
+	    fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1 ||
+	    (flags = fcntl(fd, F_GETFD)) == -1 ||
+	    fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == -1) {
+		fido_log_error(errno, "%s: fcntl", __func__);
+		return -1;
+	}
+
+	return 0;
+}
+#endif /* PCSC_MONITOR_THREAD */
+
+static void
+monitor_free(struct pcsc_monitor *mon)
+{
+#ifdef PCSC_MONITOR_THREAD
+	if (mon->fd[0] != -1)
+		close(mon->fd[0]);
+	if (mon->fd[1] != -1)
+		close(mon->fd[1]);
+#endif
+	if (mon->ctx != 0)
+		SCardReleaseContext(mon->ctx);
+	fido_free(mon->buf);
+	fido_free(mon);
+}
+
+void *
+fido_pcsc_monitor_open(void)
+{
+	struct pcsc_monitor *mon;
+
+	if ((mon = fido_calloc(1, sizeof(*mon))) == NULL)
+		return NULL;
+	mon->state[0].szReader = PNP_READER;
+#ifdef PCSC_MONITOR_THREAD
+	mon->fd[0] = mon->fd[1] = -1;
+#endif
+	if (monitor_reset(mon) < 0) {
+		fido_log_debug("%s: monitor_reset", __func__);
+		goto fail;
+	}
+#ifdef PCSC_MONITOR_THREAD
+	if (pipe(mon->fd) == -1) {
+		fido_log_error(errno, "%s: pipe", __func__);
+		mon->fd[0] = mon->fd[1] = -1;
+		goto fail;
+	}
+	if (set_nonblock_cloexec(mon->fd[0]) < 0 ||
+	    set_nonblock_cloexec(mon->fd[1]) < 0)
+		goto fail;
+	if (pthread_create(&mon->thread, NULL, monitor_worker, mon) != 0) {
+		fido_log_debug("%s: pthread_create", __func__);
+		goto fail;
+	}
+#endif
+
+	return mon;
+fail:
+	monitor_free(mon);
+
+	return NULL;
+}
+
+void
+fido_pcsc_monitor_close(void *handle)
+{
+	struct pcsc_monitor *mon = handle;
+
+#ifdef PCSC_MONITOR_THREAD
+	PCSC_LOCK();
+	mon->stop = true;
+	SCardCancel(mon->ctx);
+	PCSC_UNLOCK();
+	/* a wait that began after the cancel ends within MONITOR_MS */
+	pthread_join(mon->thread, NULL);
+#endif
+	monitor_free(mon);
+}
+
+int
+fido_pcsc_monitor_get_fd(void *handle)
+{
+#ifdef PCSC_MONITOR_THREAD
+	struct pcsc_monitor *mon = handle;
+
+	return mon->fd[0];
+#else
+	(void)handle;
+
+	return -1;
+#endif
+}
+
+/* returns 1 if readers should be enumerated again, 0 if not */
+int
+fido_pcsc_monitor_drain(void *handle)
+{
+	struct pcsc_monitor *mon = handle;
+#ifdef PCSC_MONITOR_THREAD
+	char buf[64];
+	ssize_t n;
+	int changed = 0;
+
+	while ((n = read(mon->fd[0], buf, sizeof(buf))) > 0)
+		changed = 1;
+	if (n == -1 && errno != EAGAIN && errno != EINTR) {
+		fido_log_error(errno, "%s: read", __func__);
+		return -1;
+	}
+
+	return changed;
+#else
+	int r;
+
+	if ((r = monitor_wait(mon, 0)) < 0 && monitor_reset(mon) < 0)
+		fido_log_debug("%s: monitor_reset", __func__);
+
+	return r != 0;
+#endif
+}
@@ -5,6 +5,7 @@
  * SPDX-License-Identifier: BSD-2-Clause
  */
 
+#include <openssl/hmac.h>
 #include <openssl/sha.h>
 #include "fido.h"
 #include "fido/es256.h"
@@ -16,22 +17,6 @@
 #define CTAP21_UV_TOKEN_PERM_LARGEBLOB	0x10
 #define CTAP21_UV_TOKEN_PERM_CONFIG	0x20
 
-int
-fido_sha256(fido_blob_t *digest, const u_char *data, size_t data_len)
-{
-	if ((digest->ptr = calloc(1, SHA256_DIGEST_LENGTH)) == NULL)
-		return (-1);
-
-	digest->len = SHA256_DIGEST_LENGTH;
-
-	if (SHA256(data, data_len, digest->ptr) != digest->ptr) {
-		fido_blob_reset(digest);
-		return (-1);
-	}
-
-	return (0);
-}
-
 static int
 pin_sha256_enc(const fido_dev_t *dev, const fido_blob_t *shared,
     const fido_blob_t *pin, fido_blob_t **out)
@@ -45,7 +30,9 @@ pin_sha256_enc(const fido_dev_t *dev, const fido_blob_t *shared,
 		goto fail;
 	}
 
-	if (fido_sha256(ph, pin->ptr, pin->len) < 0 || ph->len < 16) {
+	ph->len = SHA256_DIGEST_LENGTH;
+	if ((ph->ptr = fido_secure_alloc(ph->len)) == NULL ||
+	    SHA256(pin->ptr, pin->len, ph->ptr) != ph->ptr) {
 		fido_log_debug("%s: SHA256", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
@@ -83,7 +70,7 @@ pad64(const char *pin, fido_blob_t **ppin)
 
 	ppin_len = (pin_len + 63U) & ~63U;
 	if (ppin_len < pin_len ||
-	    ((*ppin)->ptr = calloc(1, ppin_len)) == NULL) {
+	    ((*ppin)->ptr = fido_secure_alloc(ppin_len)) == NULL) {
 		fido_blob_free(ppin);
 		return (FIDO_ERR_INTERNAL);
 	}
@@ -124,28 +111,39 @@ fail:
 	return (r);
 }
 
-static cbor_item_t *
-encode_uv_permission(uint8_t cmd)
+static uint8_t
+uv_permission(uint8_t cmd)
 {
 	switch (cmd) {
 	case CTAP_CBOR_ASSERT:
-		return (cbor_build_uint8(CTAP21_UV_TOKEN_PERM_ASSERT));
+		return (CTAP21_UV_TOKEN_PERM_ASSERT);
 	case CTAP_CBOR_BIO_ENROLL_PRE:
-		return (cbor_build_uint8(CTAP21_UV_TOKEN_PERM_BIO));
+		return (CTAP21_UV_TOKEN_PERM_BIO);
 	case CTAP_CBOR_CONFIG:
-		return (cbor_build_uint8(CTAP21_UV_TOKEN_PERM_CONFIG));
+		return (CTAP21_UV_TOKEN_PERM_CONFIG);
 	case CTAP_CBOR_MAKECRED:
-		return (cbor_build_uint8(CTAP21_UV_TOKEN_PERM_MAKECRED));
+		return (CTAP21_UV_TOKEN_PERM_MAKECRED);
 	case CTAP_CBOR_CRED_MGMT_PRE:
-		return (cbor_build_uint8(CTAP21_UV_TOKEN_PERM_CRED_MGMT));
+		return (CTAP21_UV_TOKEN_PERM_CRED_MGMT);
 	case CTAP_CBOR_LARGEBLOB:
-		return (cbor_build_uint8(CTAP21_UV_TOKEN_PERM_LARGEBLOB));
+		return (CTAP21_UV_TOKEN_PERM_LARGEBLOB);
 	default:
 		fido_log_debug("%s: cmd 0x%02x", __func__, cmd);
-		return (NULL);
+		return (0);
 	}
 }
 
+static cbor_item_t *
+encode_uv_permission(uint8_t cmd)
+{
+	uint8_t perm;
+
+	if ((perm = uv_permission(cmd)) == 0)
+		return (NULL);
+
+	return (cbor_build_uint8(perm));
+}
+
 static int
 ctap20_uv_token_tx(fido_dev_t *dev, const char *pin, const fido_blob_t *ecdh,
     const es256_pk_t *pk, int *ms)
@@ -165,9 +163,9 @@ ctap20_uv_token_tx(fido_dev_t *dev, const char *pin, const fido_blob_t *ecdh,
 		goto fail;
 	}
 
-	if ((p = fido_blob_new()) == NULL || fido_blob_set(p,
+	if ((p = fido_blob_new()) == NULL || fido_blob_set_secure(p,
 	    (const unsigned char *)pin, strlen(pin)) < 0) {
-		fido_log_debug("%s: fido_blob_set", __func__);
+		fido_log_debug("%s: fido_blob_set_secure", __func__);
 		r = FIDO_ERR_INVALID_ARGUMENT;
 		goto fail;
 	}
@@ -198,7 +196,7 @@ fail:
 	cbor_vector_free(argv, nitems(argv));
 	fido_blob_free(&p);
 	fido_blob_free(&phe);
-	free(f.ptr);
+	fido_free(f.ptr);
 
 	return (r);
 }
@@ -218,9 +216,9 @@ ctap21_uv_token_tx(fido_dev_t *dev, const char *pin, const fido_blob_t *ecdh,
 	memset(argv, 0, sizeof(argv));
 
 	if (pin != NULL) {
-		if ((p = fido_blob_new()) == NULL || fido_blob_set(p,
+		if ((p = fido_blob_new()) == NULL || fido_blob_set_secure(p,
 		    (const unsigned char *)pin, strlen(pin)) < 0) {
-			fido_log_debug("%s: fido_blob_set", __func__);
+			fido_log_debug("%s: fido_blob_set_secure", __func__);
 			r = FIDO_ERR_INVALID_ARGUMENT;
 			goto fail;
 		}
@@ -261,7 +259,7 @@ fail:
 	cbor_vector_free(argv, nitems(argv));
 	fido_blob_free(&p);
 	fido_blob_free(&phe);
-	free(f.ptr);
+	fido_free(f.ptr);
 
 	return (r);
 }
@@ -287,6 +285,7 @@ uv_token_rx(fido_dev_t *dev, const fido_blob_t *ecdh, fido_blob_t *token,
 {
 	fido_blob_t	*aes_token = NULL;
 	unsigned char	*msg = NULL;
+	size_t		 msgsiz = 0;
 	int		 msglen;
 	int		 r;
 
@@ -295,12 +294,12 @@ uv_token_rx(fido_dev_t *dev, const fido_blob_t *ecdh, fido_blob_t *token,
 		goto fail;
 	}
 
-	if ((msg = malloc(FIDO_MAXMSG)) == NULL) {
+	if ((msg = fido_rx_buf_get(dev, FIDO_MAXMSG, &msgsiz)) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
-	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, FIDO_MAXMSG, ms)) < 0) {
+	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, msgsiz, ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
 		r = FIDO_ERR_RX;
 		goto fail;
@@ -321,7 +320,7 @@ uv_token_rx(fido_dev_t *dev, const fido_blob_t *ecdh, fido_blob_t *token,
 	r = FIDO_OK;
 fail:
 	fido_blob_free(&aes_token);
-	freezero(msg, FIDO_MAXMSG);
+	fido_rx_buf_put(dev, msg, msgsiz);
 
 	return (r);
 }
@@ -345,12 +344,316 @@ uv_token_wait(fido_dev_t *dev, uint8_t cmd, const char *pin,
 	return (uv_token_rx(dev, ecdh, token, ms));
 }
 
+/*
+ * A pinUvAuthToken kept for reuse, with what it was obtained for. The
+ * authenticator invalidates a token whenever another is issued, so at
+ * most one is cached per device. The pin is only kept as an HMAC under
+ * a random key of the cache's own, so that it cannot be recovered by
+ * hashing candidate pins; key and MAC are in secure memory.
+ */
+#define UV_CACHE_MACLEN	SHA256_DIGEST_LENGTH
+
+struct fido_uv_cache {
+	bool		valid;    /* token may be reused */
+	bool		used;     /* last token handed out came from cache */
+	fido_blob_t	token;    /* decrypted pinUvAuthToken */
+	uint8_t		perm;     /* CTAP21_UV_TOKEN_PERM_* granted */
+	char		*rpid;    /* rpid the token is bound to, if any */
+	bool		has_pin;  /* obtained with a pin rather than uv */
+	unsigned char	*pin_key; /* UV_CACHE_MACLEN bytes, random */
+	unsigned char	*pin_mac; /* HMAC-SHA256(pin_key, pin) */
+};
+
+static void
+uv_cache_reset(struct fido_uv_cache *c)
+{
+	fido_blob_reset(&c->token);
+	fido_free(c->rpid);
+	c->rpid = NULL;
+	c->valid = false;
+	c->used = false;
+	c->perm = 0;
+	c->has_pin = false;
+	explicit_bzero(c->pin_mac, UV_CACHE_MACLEN);
+}
+
+static struct fido_uv_cache *
+uv_cache_new(void)
+{
+	struct fido_uv_cache *c;
+
+	if ((c = fido_calloc(1, sizeof(*c))) == NULL)
+		return (NULL);
+	if ((c->pin_key = fido_secure_alloc(UV_CACHE_MACLEN)) == NULL ||
+	    (c->pin_mac = fido_secure_alloc(UV_CACHE_MACLEN)) == NULL ||
+	    fido_get_random(c->pin_key, UV_CACHE_MACLEN) < 0) {
+		fido_log_debug("%s: pin key", __func__);
+		fido_freezero(c->pin_key, UV_CACHE_MACLEN);
+		fido_freezero(c->pin_mac, UV_CACHE_MACLEN);
+		fido_free(c);
+		return (NULL);
+	}
+
+	return (c);
+}
+
+/* the mac of no pin is all zeroes */
+static int
+uv_cache_pin_mac(const struct fido_uv_cache *c, const char *pin,
+    unsigned char *mac)
+{
+	unsigned int len = UV_CACHE_MACLEN;
+
+	if (pin == NULL)
+		return (0);
+	if (HMAC(EVP_sha256(), c->pin_key, UV_CACHE_MACLEN,
+	    (const unsigned char *)pin, strlen(pin), mac, &len) == NULL ||
+	    len != UV_CACHE_MACLEN)
+		return (-1);
+
+	return (0);
+}
+
+static bool
+uv_cache_match(const struct fido_uv_cache *c, uint8_t perm, const char *pin,
+    const char *rpid)
+{
+	unsigned char	mac[UV_CACHE_MACLEN];
+	bool		ok;
+
+	if (c->valid == false || (c->perm & perm) != perm ||
+	    (pin != NULL) != c->has_pin ||
+	    (rpid != NULL) != (c->rpid != NULL) ||
+	    (rpid != NULL && strcmp(rpid, c->rpid) != 0))
+		return (false);
+
+	memset(mac, 0, sizeof(mac));
+	ok = uv_cache_pin_mac(c, pin, mac) == 0 &&
+	    timingsafe_bcmp(mac, c->pin_mac, sizeof(mac)) == 0;
+	explicit_bzero(mac, sizeof(mac));
+
+	return (ok);
+}
+
+static void
+uv_cache_store(struct fido_uv_cache *c, const fido_dev_t *dev, uint8_t perm,
+    const char *pin, const char *rpid, const fido_blob_t *token)
+{
+	uv_cache_reset(c);
+
+	if (fido_blob_set_secure(&c->token, token->ptr, token->len) < 0 ||
+	    (rpid != NULL && (c->rpid = fido_strdup(rpid)) == NULL) ||
+	    uv_cache_pin_mac(c, pin, c->pin_mac) < 0) {
+		fido_log_debug("%s: could not cache token", __func__);
+		uv_cache_reset(c);
+		return;
+	}
+
+	/* ctap 2.0 tokens carry no permissions */
+	c->perm = fido_dev_supports_permissions(dev) ? perm : 0xff;
+	c->has_pin = pin != NULL;
+	c->valid = true;
+}
+
 int
 fido_dev_get_uv_token(fido_dev_t *dev, uint8_t cmd, const char *pin,
     const fido_blob_t *ecdh, const es256_pk_t *pk, const char *rpid,
     fido_blob_t *token, int *ms)
 {
-	return (uv_token_wait(dev, cmd, pin, ecdh, pk, rpid, token, ms));
+	fido_trace_span_t	span;
+	int			r;
+
+	/* issuing a token invalidates the one we may have cached */
+	if (dev->uv_cache != NULL)
+		uv_cache_reset(dev->uv_cache);
+
+	fido_trace_span_begin(dev, &span, FIDO_SPAN_UV_TOKEN);
+	/* the authenticator may rotate its key after a failed attempt */
+	if ((r = uv_token_wait(dev, cmd, pin, ecdh, pk, rpid, token,
+	    ms)) != FIDO_OK)
+		fido_dev_ecdh_flush(dev);
+	fido_trace_span_end(dev, &span, r);
+
+	return (r);
+}
+
+/*
+ * Obtain a token for cmd, reusing the cached one if caching is enabled
+ * and the token was obtained with the same pin for the same purpose.
+ */
+int
+fido_dev_get_uv_token_cached(fido_dev_t *dev, uint8_t cmd, const char *pin,
+    const char *rpid, fido_blob_t *token, int *ms)
+{
+	struct fido_uv_cache	*c = dev->uv_cache;
+	es256_pk_t		*pk = NULL;
+	fido_blob_t		*ecdh = NULL;
+	uint8_t			 perm;
+	int			 r;
+
+	perm = uv_permission(cmd);
+
+	if (c != NULL && perm != 0 && uv_cache_match(c, perm, pin, rpid)) {
+		if (fido_blob_set_secure(token, c->token.ptr,
+		    c->token.len) < 0)
+			return (FIDO_ERR_INTERNAL);
+		fido_log_debug("%s: reusing token", __func__);
+		c->used = true;
+		return (FIDO_OK);
+	}
+
+	if ((r = fido_do_ecdh(dev, &pk, &ecdh, ms)) != FIDO_OK) {
+		fido_log_debug("%s: fido_do_ecdh", __func__);
+		goto fail;
+	}
+	if ((r = fido_dev_get_uv_token(dev, cmd, pin, ecdh, pk, rpid, token,
+	    ms)) != FIDO_OK) {
+		fido_log_debug("%s: fido_dev_get_uv_token", __func__);
+		goto fail;
+	}
+	if (c != NULL && perm != 0)
+		uv_cache_store(c, dev, perm, pin, rpid, token);
+fail:
+	es256_pk_free(&pk);
+	fido_blob_free(&ecdh);
+
+	return (r);
+}
+
+/*
+ * Called with the result of an operation. If the authenticator rejected
+ * a cached token, forget it and return true so that the caller retries
+ * with a fresh one.
+ */
+bool
+fido_dev_uv_token_retry(fido_dev_t *dev, int r)
+{
+	struct fido_uv_cache	*c;
+	bool			 used;
+
+	if ((c = dev->uv_cache) == NULL)
+		return (false);
+
+	used = c->used;
+	c->used = false;
+	if (r != FIDO_ERR_PIN_AUTH_INVALID)
+		return (false);
+
+	fido_log_debug("%s: token rejected", __func__);
+	uv_cache_reset(c);
+
+	return (used);
+}
+
+void
+fido_dev_uv_token_flush(fido_dev_t *dev)
+{
+	if (dev->uv_cache != NULL)
+		uv_cache_reset(dev->uv_cache);
+	fido_dev_pin_mac_free(dev);
+}
+
+void
+fido_dev_uv_cache_free(fido_dev_t *dev)
+{
+	fido_dev_pin_mac_free(dev);
+	if (dev->uv_cache == NULL)
+		return;
+	uv_cache_reset(dev->uv_cache);
+	fido_freezero(dev->uv_cache->pin_key, UV_CACHE_MACLEN);
+	fido_freezero(dev->uv_cache->pin_mac, UV_CACHE_MACLEN);
+	fido_free(dev->uv_cache);
+	dev->uv_cache = NULL;
+}
+
+/*
+ * The HMAC-SHA-256 key schedule of the key a pinUvAuthParam was last
+ * computed under, usually the device's pinUvAuthToken. A run of
+ * commands under one token, such as the chunks of a large-blob write
+ * or the steps of a credential enumeration, expands the key once; each
+ * message restarts from the saved inner and outer states.
+ */
+struct fido_pin_mac {
+	HMAC_CTX	*ctx;
+	fido_blob_t	 key;	/* in secure memory */
+};
+
+static void
+pin_mac_reset(struct fido_pin_mac *m)
+{
+	HMAC_CTX_free(m->ctx);
+	m->ctx = NULL;
+	fido_blob_reset(&m->key);
+}
+
+void
+fido_dev_pin_mac_free(fido_dev_t *dev)
+{
+	if (dev->pin_mac == NULL)
+		return;
+	pin_mac_reset(dev->pin_mac);
+	fido_free(dev->pin_mac);
+	dev->pin_mac = NULL;
+}
+
+/* HMAC-SHA-256 of data under key, reusing the key schedule of dev */
+int
+fido_dev_pin_mac(fido_dev_t *dev, const fido_blob_t *key,
+    const fido_blob_t *data, unsigned char *dgst, unsigned int *dgst_len)
+{
+	struct fido_pin_mac	*m;
+	const EVP_MD		*md;
+
+	if (key->ptr == NULL || key->len == 0 || key->len > INT_MAX) {
+		fido_log_debug("%s: key->len=%zu", __func__, key->len);
+		return (-1);
+	}
+	if ((m = dev->pin_mac) == NULL &&
+	    (m = dev->pin_mac = fido_calloc(1, sizeof(*m))) == NULL)
+		return (-1);
+
+	if (m->ctx != NULL && m->key.len == key->len &&
+	    timingsafe_bcmp(m->key.ptr, key->ptr, key->len) == 0) {
+		if (HMAC_Init_ex(m->ctx, NULL, 0, NULL, NULL) == 0) {
+			fido_log_debug("%s: HMAC_Init_ex", __func__);
+			goto fail;
+		}
+	} else {
+		pin_mac_reset(m);
+		if ((m->ctx = HMAC_CTX_new()) == NULL ||
+		    (md = fido_evp_sha256()) == NULL ||
+		    HMAC_Init_ex(m->ctx, key->ptr, (int)key->len, md,
+		    NULL) == 0 ||
+		    fido_blob_set_secure(&m->key, key->ptr, key->len) < 0) {
+			fido_log_debug("%s: HMAC_Init_ex", __func__);
+			goto fail;
+		}
+	}
+
+	if (HMAC_Update(m->ctx, data->ptr, data->len) == 0 ||
+	    HMAC_Final(m->ctx, dgst, dgst_len) == 0) {
+		fido_log_debug("%s: HMAC", __func__);
+		goto fail;
+	}
+
+	return (0);
+fail:
+	pin_mac_reset(m);
+
+	return (-1);
+}
+
+int
+fido_dev_set_uv_token_cache(fido_dev_t *dev, bool enable)
+{
+	if (enable == false) {
+		fido_dev_uv_cache_free(dev);
+		return (FIDO_OK);
+	}
+	if (dev->uv_cache == NULL && (dev->uv_cache = uv_cache_new()) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	return (FIDO_OK);
 }
 
 static int
@@ -369,9 +672,9 @@ fido_dev_change_pin_tx(fido_dev_t *dev, const char *pin, const char *oldpin,
 	memset(&f, 0, sizeof(f));
 	memset(argv, 0, sizeof(argv));
 
-	if ((opin = fido_blob_new()) == NULL || fido_blob_set(opin,
+	if ((opin = fido_blob_new()) == NULL || fido_blob_set_secure(opin,
 	    (const unsigned char *)oldpin, strlen(oldpin)) < 0) {
-		fido_log_debug("%s: fido_blob_set", __func__);
+		fido_log_debug("%s: fido_blob_set_secure", __func__);
 		r = FIDO_ERR_INVALID_ARGUMENT;
 		goto fail;
 	}
@@ -419,7 +722,7 @@ fail:
 	fido_blob_free(&ecdh);
 	fido_blob_free(&opin);
 	fido_blob_free(&opinhe);
-	free(f.ptr);
+	fido_free(f.ptr);
 
 	return (r);
 
@@ -471,7 +774,7 @@ fail:
 	es256_pk_free(&pk);
 	fido_blob_free(&ppine);
 	fido_blob_free(&ecdh);
-	free(f.ptr);
+	fido_free(f.ptr);
 
 	return (r);
 }
@@ -512,8 +815,15 @@ int
 fido_dev_set_pin(fido_dev_t *dev, const char *pin, const char *oldpin)
 {
 	int ms = dev->timeout_ms;
+	int r;
+
+	fido_sched_enter(dev);
+	fido_dev_uv_token_flush(dev);
+	fido_dev_ecdh_flush(dev);
+	r = fido_dev_set_pin_wait(dev, pin, oldpin, &ms);
+	fido_sched_leave(dev);
 
-	return (fido_dev_set_pin_wait(dev, pin, oldpin, &ms));
+	return (r);
 }
 
 static int
@@ -578,7 +888,7 @@ fido_dev_get_retry_count_tx(fido_dev_t *dev, uint8_t subcmd, int *ms)
 	r = FIDO_OK;
 fail:
 	cbor_vector_free(argv, nitems(argv));
-	free(f.ptr);
+	fido_free(f.ptr);
 
 	return (r);
 }
@@ -587,17 +897,18 @@ static int
 fido_dev_get_pin_retry_count_rx(fido_dev_t *dev, int *retries, int *ms)
 {
 	unsigned char	*msg;
+	size_t		 msgsiz;
 	int		 msglen;
 	int		 r;
 
 	*retries = 0;
 
-	if ((msg = malloc(FIDO_MAXMSG)) == NULL) {
+	if ((msg = fido_rx_buf_get(dev, FIDO_MAXMSG, &msgsiz)) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
-	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, FIDO_MAXMSG, ms)) < 0) {
+	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, msgsiz, ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
 		r = FIDO_ERR_RX;
 		goto fail;
@@ -611,7 +922,7 @@ fido_dev_get_pin_retry_count_rx(fido_dev_t *dev, int *retries, int *ms)
 
 	r = FIDO_OK;
 fail:
-	freezero(msg, FIDO_MAXMSG);
+	fido_rx_buf_put(dev, msg, msgsiz);
 
 	return (r);
 }
@@ -632,25 +943,31 @@ int
 fido_dev_get_retry_count(fido_dev_t *dev, int *retries)
 {
 	int ms = dev->timeout_ms;
+	int r;
 
-	return (fido_dev_get_pin_retry_count_wait(dev, retries, &ms));
+	fido_sched_enter(dev);
+	r = fido_dev_get_pin_retry_count_wait(dev, retries, &ms);
+	fido_sched_leave(dev);
+
+	return (r);
 }
 
 static int
 fido_dev_get_uv_retry_count_rx(fido_dev_t *dev, int *retries, int *ms)
 {
 	unsigned char	*msg;
+	size_t		 msgsiz;
 	int		 msglen;
 	int		 r;
 
 	*retries = 0;
 
-	if ((msg = malloc(FIDO_MAXMSG)) == NULL) {
+	if ((msg = fido_rx_buf_get(dev, FIDO_MAXMSG, &msgsiz)) == NULL) {
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
-	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, FIDO_MAXMSG, ms)) < 0) {
+	if ((msglen = fido_rx(dev, CTAP_CMD_CBOR, msg, msgsiz, ms)) < 0) {
 		fido_log_debug("%s: fido_rx", __func__);
 		r = FIDO_ERR_RX;
 		goto fail;
@@ -664,7 +981,7 @@ fido_dev_get_uv_retry_count_rx(fido_dev_t *dev, int *retries, int *ms)
 
 	r = FIDO_OK;
 fail:
-	freezero(msg, FIDO_MAXMSG);
+	fido_rx_buf_put(dev, msg, msgsiz);
 
 	return (r);
 }
@@ -685,8 +1002,13 @@ int
 fido_dev_get_uv_retry_count(fido_dev_t *dev, int *retries)
 {
 	int ms = dev->timeout_ms;
+	int r;
+
+	fido_sched_enter(dev);
+	r = fido_dev_get_uv_retry_count_wait(dev, retries, &ms);
+	fido_sched_leave(dev);
 
-	return (fido_dev_get_uv_retry_count_wait(dev, retries, &ms));
+	return (r);
 }
 
 int
@@ -702,8 +1024,14 @@ cbor_add_uv_params(fido_dev_t *dev, uint8_t cmd, const fido_blob_t *hmac_data,
 		goto fail;
 	}
 
-	if ((r = fido_dev_get_uv_token(dev, cmd, pin, ecdh, pk, rpid,
-	    token, ms)) != FIDO_OK) {
+	/* without a shared secret of the caller's, a cached token will do */
+	if (ecdh == NULL && pk == NULL)
+		r = fido_dev_get_uv_token_cached(dev, cmd, pin, rpid, token,
+		    ms);
+	else
+		r = fido_dev_get_uv_token(dev, cmd, pin, ecdh, pk, rpid,
+		    token, ms);
+	if (r != FIDO_OK) {
 		fido_log_debug("%s: fido_dev_get_uv_token", __func__);
 		goto fail;
 	}
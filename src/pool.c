@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "fido.h"
+#include "fido/pool.h"
+
+#define POOL_MAXDEV	64	/* devices in a pool */
+#define POOL_IDLE_MS	1000	/* idle time after which a device is pinged */
+#define POOL_PING_MS	500	/* how long to wait for a ping reply */
+
+struct pool_entry {
+	fido_dev_t	*dev;    /* open device, owned by the pool */
+	char		*path;   /* where to reopen it */
+	bool		 busy;   /* lent out, or being checked */
+	bool		 broken; /* to be reopened before use */
+	struct timespec	 used;   /* when it was last given back */
+};
+
+/*
+ * Open devices waiting to be lent out are kept in a ring, so that each
+ * gets its turn. A device is pinged before being lent out if it has
+ * been idle for a while, and reopened if the ping or the caller's last
+ * request failed at the transport level. Pings and reopens happen with
+ * the lock released.
+ */
+struct fido_dev_pool {
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t		 lock;
+	pthread_cond_t		 idle_cond; /* a device was given back */
+#endif
+	struct pool_entry	 entry[POOL_MAXDEV];
+	size_t			 len;   /* entries in use */
+	size_t			 idle[POOL_MAXDEV]; /* ring of idle entries */
+	size_t			 head;  /* first idle entry */
+	size_t			 nidle; /* idle entries */
+};
+
+#ifdef HAVE_PTHREAD
+#define POOL_LOCK(p)		pthread_mutex_lock(&(p)->lock)
+#define POOL_UNLOCK(p)		pthread_mutex_unlock(&(p)->lock)
+#define POOL_SIGNAL(p)		pthread_cond_signal(&(p)->idle_cond)
+#else
+#define POOL_LOCK(p)		do { } while (0)
+#define POOL_UNLOCK(p)		do { } while (0)
+#define POOL_SIGNAL(p)		do { } while (0)
+#endif
+
+/* caller must hold the lock */
+static size_t
+pool_pop(fido_dev_pool_t *p)
+{
+	size_t i;
+
+	i = p->idle[p->head];
+	p->head = (p->head + 1) % POOL_MAXDEV;
+	p->nidle--;
+	p->entry[i].busy = true;
+
+	return (i);
+}
+
+/* caller must hold the lock */
+static void
+pool_push(fido_dev_pool_t *p, size_t i)
+{
+	p->entry[i].busy = false;
+	p->idle[(p->head + p->nidle) % POOL_MAXDEV] = i;
+	p->nidle++;
+	POOL_SIGNAL(p);
+}
+
+/* a status after which the device's channel can no longer be trusted */
+static bool
+pool_failed(int status)
+{
+	switch (status) {
+	case FIDO_ERR_TX:
+	case FIDO_ERR_RX:
+	case FIDO_ERR_RX_NOT_CBOR:
+	case FIDO_ERR_RX_INVALID_CBOR:
+		return (true);
+	default:
+		return (false);
+	}
+}
+
+static bool
+pool_stale(const struct pool_entry *e)
+{
+	int ms = POOL_IDLE_MS;
+
+	return (fido_time_delta(&e->used, &ms) != 0 || ms == 0);
+}
+
+/* make a busy entry ready for use; called without the lock */
+static int
+pool_ready(struct pool_entry *e, bool force)
+{
+	int r;
+
+	if (e->broken == false) {
+		if (force == false && pool_stale(e) == false)
+			return (FIDO_OK);
+		if ((r = fido_dev_ping(e->dev, POOL_PING_MS)) == FIDO_OK)
+			goto out;
+		fido_log_debug("%s: fido_dev_ping %s", __func__, e->path);
+	}
+
+	fido_dev_close(e->dev);
+	if ((r = fido_dev_open(e->dev, e->path)) != FIDO_OK) {
+		fido_log_debug("%s: fido_dev_open %s", __func__, e->path);
+		e->broken = true;
+		return (r);
+	}
+	e->broken = false;
+out:
+	if (fido_time_now(&e->used) != 0)
+		memset(&e->used, 0, sizeof(e->used));
+
+	return (FIDO_OK);
+}
+
+#ifdef HAVE_PTHREAD
+static int
+pool_deadline(struct timespec *ts, int ms)
+{
+	long nsec;
+
+	if (clock_gettime(CLOCK_REALTIME, ts) != 0) {
+		fido_log_debug("%s: clock_gettime", __func__);
+		return (-1);
+	}
+
+	nsec = ts->tv_nsec + (long)(ms % 1000) * 1000000L;
+	ts->tv_sec += ms / 1000 + nsec / 1000000000L;
+	ts->tv_nsec = nsec % 1000000000L;
+
+	return (0);
+}
+#endif
+
+fido_dev_pool_t *
+fido_dev_pool_new(void)
+{
+	fido_dev_pool_t *p;
+
+	if ((p = fido_calloc(1, sizeof(*p))) == NULL)
+		return (NULL);
+#ifdef HAVE_PTHREAD
+	if (pthread_mutex_init(&p->lock, NULL) != 0) {
+		fido_free(p);
+		return (NULL);
+	}
+	if (pthread_cond_init(&p->idle_cond, NULL) != 0) {
+		pthread_mutex_destroy(&p->lock);
+		fido_free(p);
+		return (NULL);
+	}
+#endif
+
+	return (p);
+}
+
+void
+fido_dev_pool_free(fido_dev_pool_t **p_p)
+{
+	fido_dev_pool_t *p;
+
+	if (p_p == NULL || (p = *p_p) == NULL)
+		return;
+	for (size_t i = 0; i < p->len; i++) {
+		fido_dev_close(p->entry[i].dev);
+		fido_dev_free(&p->entry[i].dev);
+		fido_free(p->entry[i].path);
+	}
+#ifdef HAVE_PTHREAD
+	pthread_cond_destroy(&p->idle_cond);
+	pthread_mutex_destroy(&p->lock);
+#endif
+	fido_free(p);
+	*p_p = NULL;
+}
+
+int
+fido_dev_pool_add(fido_dev_pool_t *p, fido_dev_t *dev, const char *path)
+{
+	struct pool_entry	*e;
+	char			*s;
+	int			 r = FIDO_ERR_INVALID_ARGUMENT;
+
+	if (dev == NULL || path == NULL || dev->io_handle == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if ((s = fido_strdup(path)) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	POOL_LOCK(p);
+	if (p->len == POOL_MAXDEV) {
+		fido_log_debug("%s: len=%zu", __func__, p->len);
+		goto fail;
+	}
+	for (size_t i = 0; i < p->len; i++)
+		if (p->entry[i].dev == dev) {
+			fido_log_debug("%s: dev", __func__);
+			goto fail;
+		}
+	e = &p->entry[p->len];
+	memset(e, 0, sizeof(*e));
+	e->dev = dev;
+	e->path = s;
+	s = NULL;
+	if (fido_time_now(&e->used) != 0)
+		memset(&e->used, 0, sizeof(e->used));
+	pool_push(p, p->len++);
+
+	r = FIDO_OK;
+fail:
+	POOL_UNLOCK(p);
+	fido_free(s);
+
+	return (r);
+}
+
+int
+fido_dev_pool_get(fido_dev_pool_t *p, fido_dev_t **dev_p, int ms)
+{
+	struct pool_entry	*e;
+	size_t			 i, tries = 0;
+	int			 r = FIDO_ERR_NOTFOUND;
+#ifdef HAVE_PTHREAD
+	struct timespec		 ts;
+#endif
+
+	if (dev_p == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	*dev_p = NULL;
+#ifdef HAVE_PTHREAD
+	if (ms > 0 && pool_deadline(&ts, ms) < 0)
+		return (FIDO_ERR_INTERNAL);
+#endif
+
+	POOL_LOCK(p);
+	/* give up once every device has failed to become ready */
+	while (tries < p->len) {
+#ifdef HAVE_PTHREAD
+		while (p->nidle == 0 && ms != 0) {
+			if (ms < 0)
+				pthread_cond_wait(&p->idle_cond, &p->lock);
+			else if (pthread_cond_timedwait(&p->idle_cond,
+			    &p->lock, &ts) != 0)
+				break;
+		}
+#endif
+		if (p->nidle == 0) {
+			r = FIDO_ERR_TIMEOUT;
+			break;
+		}
+		i = pool_pop(p);
+		e = &p->entry[i];
+		POOL_UNLOCK(p);
+		r = pool_ready(e, false);
+		POOL_LOCK(p);
+		if (r == FIDO_OK) {
+			*dev_p = e->dev;
+			break;
+		}
+		pool_push(p, i);
+		tries++;
+	}
+	POOL_UNLOCK(p);
+
+	return (r);
+}
+
+int
+fido_dev_pool_put(fido_dev_pool_t *p, fido_dev_t *dev, int status)
+{
+	struct pool_entry *e;
+
+	POOL_LOCK(p);
+	for (size_t i = 0; i < p->len; i++) {
+		e = &p->entry[i];
+		if (e->dev != dev || e->busy == false)
+			continue;
+		if (pool_failed(status))
+			e->broken = true;
+		if (fido_time_now(&e->used) != 0)
+			memset(&e->used, 0, sizeof(e->used));
+		pool_push(p, i);
+		POOL_UNLOCK(p);
+		return (FIDO_OK);
+	}
+	POOL_UNLOCK(p);
+
+	fido_log_debug("%s: dev", __func__);
+
+	return (FIDO_ERR_INVALID_ARGUMENT);
+}
+
+int
+fido_dev_pool_check(fido_dev_pool_t *p)
+{
+	struct pool_entry	*e;
+	size_t			 i, n;
+	int			 r, ok = FIDO_OK;
+
+	POOL_LOCK(p);
+	/* one at a time, so that the others stay available */
+	for (n = p->nidle; n > 0 && p->nidle > 0; n--) {
+		i = pool_pop(p);
+		e = &p->entry[i];
+		POOL_UNLOCK(p);
+		if ((r = pool_ready(e, true)) != FIDO_OK)
+			ok = r;
+		POOL_LOCK(p);
+		pool_push(p, i);
+	}
+	POOL_UNLOCK(p);
+
+	return (ok);
+}
+
+size_t
+fido_dev_pool_len(fido_dev_pool_t *p)
+{
+	size_t n;
+
+	POOL_LOCK(p);
+	n = p->len;
+	POOL_UNLOCK(p);
+
+	return (n);
+}
+
+size_t
+fido_dev_pool_idle(fido_dev_pool_t *p)
+{
+	size_t n;
+
+	POOL_LOCK(p);
+	n = p->nidle;
+	POOL_UNLOCK(p);
+
+	return (n);
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef _PROBE_H
+#define _PROBE_H
+
+/*
+ * Static probes of provider "libfido2", for bpftrace, SystemTap and
+ * DTrace. With USE_USDT, each probe is a nop and a note describing its
+ * arguments, which a tracer attaching to it turns into a breakpoint;
+ * without, they compile to nothing. Arguments are integers or pointers,
+ * and must be cheap to evaluate: they are, whether or not a tracer is
+ * attached.
+ *
+ *   tx__start(dev, cmd, len)	message about to be sent
+ *   hid__write(dev, len, n)	report(s) written; n as returned
+ *   hid__read(dev, len, n)	report read; n as returned
+ *   keepalive(dev, cmd, status)	keepalive report read
+ *   rx__done(dev, cmd, n)	reply of n bytes received, or -1
+ *   verify__start(alg, len)	assertion signature over len bytes
+ *   verify__done(alg, r)	its result, a FIDO_ERR_* code
+ *   attest__start(alg)		attestation signature
+ *   attest__done(alg, ok)	its result; 0 if valid
+ */
+
+#ifdef USE_USDT
+#include <sys/sdt.h>
+
+#define FIDO_PROBE1(n, a)		DTRACE_PROBE1(libfido2, n, a)
+#define FIDO_PROBE2(n, a, b)		DTRACE_PROBE2(libfido2, n, a, b)
+#define FIDO_PROBE3(n, a, b, c)		DTRACE_PROBE3(libfido2, n, a, b, c)
+#else
+#define FIDO_PROBE1(n, a)		do { } while (0)
+#define FIDO_PROBE2(n, a, b)		do { } while (0)
+#define FIDO_PROBE3(n, a, b, c)		do { } while (0)
+#endif /* USE_USDT */
+
+#endif /* !_PROBE_H */
@@ -0,0 +1,243 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "fido.h"
+#include "fido/config.h"
+
+#define PROVISION_MAXTHREADS	64	/* devices provisioned at a time */
+
+/*
+ * The steps a device goes through, in order: reset, pin, minimum pin
+ * length, alwaysUv, enterprise attestation, and credential. The steps
+ * after the pin share one key agreement and, where their permissions
+ * allow, one pin/uv auth token.
+ */
+struct fido_provision {
+	bool		 reset;
+	char		*pin;        /* pin the device ends up with */
+	size_t		 pin_minlen; /* 0 to leave alone */
+	fido_opt_t	 always_uv;
+	bool		 entattest;
+};
+
+struct provision_batch {
+	fido_dev_t *const	*dev;
+	fido_cred_t *const	*cred;
+	const fido_provision_t	*p;
+	int			*result;
+	size_t			 n;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t		 lock;
+#endif
+	size_t			 next; /* next device to provision */
+};
+
+fido_provision_t *
+fido_provision_new(void)
+{
+	return (fido_calloc(1, sizeof(fido_provision_t)));
+}
+
+void
+fido_provision_free(fido_provision_t **p_p)
+{
+	fido_provision_t *p;
+
+	if (p_p == NULL || (p = *p_p) == NULL)
+		return;
+	if (p->pin != NULL)
+		fido_freezero(p->pin, strlen(p->pin));
+	fido_free(p);
+	*p_p = NULL;
+}
+
+int
+fido_provision_set_reset(fido_provision_t *p, bool reset)
+{
+	p->reset = reset;
+
+	return (FIDO_OK);
+}
+
+int
+fido_provision_set_pin(fido_provision_t *p, const char *pin)
+{
+	char *s = NULL;
+
+	if (pin != NULL && (s = fido_strdup(pin)) == NULL)
+		return (FIDO_ERR_INTERNAL);
+	if (p->pin != NULL)
+		fido_freezero(p->pin, strlen(p->pin));
+	p->pin = s;
+
+	return (FIDO_OK);
+}
+
+int
+fido_provision_set_pin_minlen(fido_provision_t *p, size_t len)
+{
+	if (len > UINT8_MAX)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	p->pin_minlen = len;
+
+	return (FIDO_OK);
+}
+
+int
+fido_provision_set_always_uv(fido_provision_t *p, fido_opt_t always_uv)
+{
+	if (always_uv != FIDO_OPT_OMIT && always_uv != FIDO_OPT_FALSE &&
+	    always_uv != FIDO_OPT_TRUE)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	p->always_uv = always_uv;
+
+	return (FIDO_OK);
+}
+
+int
+fido_provision_set_entattest(fido_provision_t *p, bool entattest)
+{
+	p->entattest = entattest;
+
+	return (FIDO_OK);
+}
+
+static int
+provision_steps(fido_dev_t *dev, const fido_provision_t *p,
+    fido_cred_t *cred)
+{
+	int r;
+
+	if (p->reset && (r = fido_dev_reset(dev)) != FIDO_OK) {
+		fido_log_debug("%s: fido_dev_reset", __func__);
+		return (r);
+	}
+	if (p->pin != NULL && fido_dev_has_pin(dev) == false &&
+	    (r = fido_dev_set_pin(dev, p->pin, NULL)) != FIDO_OK) {
+		fido_log_debug("%s: fido_dev_set_pin", __func__);
+		return (r);
+	}
+	if (p->pin_minlen != 0 && (r = fido_dev_set_pin_minlen(dev,
+	    p->pin_minlen, p->pin)) != FIDO_OK) {
+		fido_log_debug("%s: fido_dev_set_pin_minlen", __func__);
+		return (r);
+	}
+	if (p->always_uv != FIDO_OPT_OMIT && (r = fido_dev_set_always_uv(dev,
+	    p->always_uv, p->pin)) != FIDO_OK) {
+		fido_log_debug("%s: fido_dev_set_always_uv", __func__);
+		return (r);
+	}
+	if (p->entattest && (r = fido_dev_enable_entattest(dev,
+	    p->pin)) != FIDO_OK) {
+		fido_log_debug("%s: fido_dev_enable_entattest", __func__);
+		return (r);
+	}
+	if (cred != NULL && (r = fido_dev_make_cred(dev, cred,
+	    p->pin)) != FIDO_OK) {
+		fido_log_debug("%s: fido_dev_make_cred", __func__);
+		return (r);
+	}
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_provision(fido_dev_t *dev, const fido_provision_t *p,
+    fido_cred_t *cred)
+{
+	bool	uv_cache, ecdh_cache;
+	int	r;
+
+	if (dev == NULL || p == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	/* share key agreement and tokens between steps */
+	uv_cache = dev->uv_cache != NULL;
+	ecdh_cache = dev->ecdh_cache != NULL;
+	if ((r = fido_dev_set_uv_token_cache(dev, true)) != FIDO_OK ||
+	    (r = fido_dev_set_ecdh_cache(dev, true)) != FIDO_OK)
+		goto out;
+
+	r = provision_steps(dev, p, cred);
+out:
+	if (uv_cache == false)
+		fido_dev_set_uv_token_cache(dev, false);
+	if (ecdh_cache == false)
+		fido_dev_set_ecdh_cache(dev, false);
+
+	return (r);
+}
+
+static void *
+provision_worker(void *arg)
+{
+	struct provision_batch	*b = arg;
+	size_t			 i;
+
+	for (;;) {
+#ifdef HAVE_PTHREAD
+		pthread_mutex_lock(&b->lock);
+#endif
+		i = b->next < b->n ? b->next++ : b->n;
+#ifdef HAVE_PTHREAD
+		pthread_mutex_unlock(&b->lock);
+#endif
+		if (i == b->n)
+			break;
+		b->result[i] = fido_dev_provision(b->dev[i], b->p,
+		    b->cred != NULL ? b->cred[i] : NULL);
+	}
+
+	return (NULL);
+}
+
+int
+fido_dev_provision_batch(fido_dev_t *const *dev, size_t n,
+    const fido_provision_t *p, fido_cred_t *const *cred, int *result)
+{
+	struct provision_batch	 b;
+#ifdef HAVE_PTHREAD
+	pthread_t		 thread[PROVISION_MAXTHREADS];
+	size_t			 i, nthreads = 0;
+#endif
+
+	if (dev == NULL || p == NULL || result == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	memset(&b, 0, sizeof(b));
+	b.dev = dev;
+	b.cred = cred;
+	b.p = p;
+	b.result = result;
+	b.n = n;
+
+#ifdef HAVE_PTHREAD
+	if (pthread_mutex_init(&b.lock, NULL) != 0)
+		return (FIDO_ERR_INTERNAL);
+	/* the calling thread takes a share of the devices too */
+	for (i = 1; i < n && i < PROVISION_MAXTHREADS; i++) {
+		if (pthread_create(&thread[nthreads], NULL, provision_worker,
+		    &b) != 0) {
+			fido_log_debug("%s: pthread_create", __func__);
+			break;
+		}
+		nthreads++;
+	}
+	provision_worker(&b);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(thread[i], NULL);
+	pthread_mutex_destroy(&b.lock);
+#else
+	provision_worker(&b);
+#endif
+
+	return (FIDO_OK);
+}
@@ -12,12 +12,33 @@
 #endif
 
 #include <fcntl.h>
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
 
+#include <openssl/rand.h>
+
 #include "fido.h"
 
+#define RANDOM_DRBG_MAXLEN	64	/* bytes taken from the drbg at once */
+
+/*
+ * With FIDO_RANDOM_DRBG, nonces, ivs and other short random strings come
+ * from libcrypto's drbg, which keeps a generator per thread, seeded from
+ * the operating system and reseeded after fork(). Otherwise, and for
+ * anything longer, the operating system is asked every time.
+ */
+static bool random_drbg;
+
+void
+fido_random_set_drbg(bool drbg)
+{
+	random_drbg = drbg;
+}
+
 #if defined(_WIN32)
 #include <windows.h>
 
@@ -27,8 +48,8 @@
 #include <bcrypt.h>
 #include <sal.h>
 
-int
-fido_get_random(void *buf, size_t len)
+static int
+os_random(void *buf, size_t len)
 {
 	NTSTATUS status;
 
@@ -41,15 +62,15 @@ fido_get_random(void *buf, size_t len)
 	return (0);
 }
 #elif defined(HAVE_ARC4RANDOM_BUF)
-int
-fido_get_random(void *buf, size_t len)
+static int
+os_random(void *buf, size_t len)
 {
 	arc4random_buf(buf, len);
 	return (0);
 }
 #elif defined(HAVE_GETRANDOM)
-int
-fido_get_random(void *buf, size_t len)
+static int
+os_random(void *buf, size_t len)
 {
 	ssize_t	r;
 
@@ -59,25 +80,52 @@ fido_get_random(void *buf, size_t len)
 	return (0);
 }
 #elif defined(HAVE_DEV_URANDOM)
-int
-fido_get_random(void *buf, size_t len)
+#ifndef O_CLOEXEC
+#define O_CLOEXEC	0
+#endif
+
+#ifdef HAVE_PTHREAD
+static pthread_mutex_t random_lock = PTHREAD_MUTEX_INITIALIZER;
+#define RANDOM_LOCK()	pthread_mutex_lock(&random_lock)
+#define RANDOM_UNLOCK()	pthread_mutex_unlock(&random_lock)
+#else
+#define RANDOM_LOCK()	do { } while (0)
+#define RANDOM_UNLOCK()	do { } while (0)
+#endif
+
+/* FIDO_RANDOM_DEV is opened once, and kept open */
+static int
+os_random(void *buf, size_t len)
 {
-	int	fd = -1;
-	int	ok = -1;
-	ssize_t	r;
+	static int	random_fd = -1;
+	int		fd;
+	ssize_t		r;
 
-	if ((fd = open(FIDO_RANDOM_DEV, O_RDONLY)) < 0)
-		goto fail;
-	if ((r = read(fd, buf, len)) < 0 || (size_t)r != len)
-		goto fail;
+	RANDOM_LOCK();
+	if (random_fd == -1)
+		random_fd = open(FIDO_RANDOM_DEV, O_RDONLY | O_CLOEXEC);
+	fd = random_fd;
+	RANDOM_UNLOCK();
 
-	ok = 0;
-fail:
-	if (fd != -1)
-		close(fd);
+	if (fd == -1)
+		return (-1);
+	if ((r = read(fd, buf, len)) < 0 || (size_t)r != len)
+		return (-1);
 
-	return (ok);
+	return (0);
 }
 #else
 #error "please provide an implementation of fido_get_random() for your platform"
 #endif /* _WIN32 */
+
+int
+fido_get_random(void *buf, size_t len)
+{
+	if (random_drbg && len <= RANDOM_DRBG_MAXLEN) {
+		if (RAND_bytes(buf, (int)len) == 1)
+			return (0);
+		fido_log_debug("%s: RAND_bytes", __func__);
+	}
+
+	return (os_random(buf, len));
+}
@@ -0,0 +1,408 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <errno.h>
+#include <stdio.h>
+
+#include "fido.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/*
+ * Recordings of the messages exchanged with a device, and their replay.
+ * A recording is REC_MAGIC followed by records of REC_HDRLEN bytes and
+ * a payload:
+ *
+ *   type (1)	REC_TX or REC_RX
+ *   cmd (1)	ctaphid command
+ *   len (4)	payload length; REC_FAIL if the receive failed
+ *   delta (4)	microseconds since the previous record
+ *
+ * Integers are big-endian. Messages are recorded as passed to and from
+ * the transport, after framing has been undone, so that a recording
+ * made over any transport replays the same way.
+ */
+
+#define REC_MAGIC	"FIDOREC\x01"
+#define REC_MAGICLEN	(sizeof(REC_MAGIC) - 1)
+#define REC_HDRLEN	10
+#define REC_TX		1
+#define REC_RX		2
+#define REC_FAIL	UINT32_MAX
+
+struct fido_record {
+	FILE		*fp;
+	struct timespec	 last; /* previous record */
+};
+
+struct rec_entry {
+	uint8_t			 type;
+	uint8_t			 cmd;
+	uint32_t		 len;
+	uint32_t		 delta;
+	const unsigned char	*ptr;
+	size_t			 next; /* offset of the next record */
+};
+
+struct replay {
+	unsigned char	*buf;
+	size_t		 len;
+	size_t		 off;     /* next record */
+	uint64_t	 slept;   /* us waited for the next reply so far */
+	unsigned char	 nonce[8]; /* of the last CTAPHID_INIT */
+	fido_blob_t	 ping;    /* payload of the last CTAPHID_PING */
+};
+
+static void
+put_be32(unsigned char *p, uint32_t v)
+{
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+
+static uint32_t
+get_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	    (uint32_t)p[2] << 8 | (uint32_t)p[3]);
+}
+
+static int
+record_close(fido_dev_t *dev)
+{
+	struct fido_record	*rec;
+	int			 ok = 0;
+
+	if ((rec = dev->record) == NULL)
+		return (0);
+	if (fclose(rec->fp) != 0) {
+		fido_log_error(errno, "%s: fclose", __func__);
+		ok = -1;
+	}
+	fido_free(rec);
+	dev->record = NULL;
+
+	return (ok);
+}
+
+static void
+record_put(fido_dev_t *dev, uint8_t type, uint8_t cmd, const void *buf,
+    uint32_t len)
+{
+	struct fido_record	*rec = dev->record;
+	struct timespec		 now, delta;
+	unsigned char		 hdr[REC_HDRLEN];
+	uint64_t		 us = 0;
+
+	if (fido_time_now(&now) != 0)
+		goto fail;
+	if (timespeccmp(&now, &rec->last, >)) {
+		timespecsub(&now, &rec->last, &delta);
+		us = (uint64_t)delta.tv_sec * 1000000 +
+		    (uint64_t)delta.tv_nsec / 1000;
+	}
+	rec->last = now;
+
+	hdr[0] = type;
+	hdr[1] = cmd;
+	put_be32(&hdr[2], len);
+	put_be32(&hdr[6], us > UINT32_MAX ? UINT32_MAX : (uint32_t)us);
+	if (fwrite(hdr, 1, sizeof(hdr), rec->fp) != sizeof(hdr) ||
+	    (len != REC_FAIL && len > 0 &&
+	    fwrite(buf, 1, len, rec->fp) != len)) {
+		fido_log_error(errno, "%s: fwrite", __func__);
+		goto fail;
+	}
+
+	return;
+fail:
+	fido_log_debug("%s: recording stopped", __func__);
+	record_close(dev);
+}
+
+void
+fido_record_tx(fido_dev_t *dev, uint8_t cmd, const void *buf, size_t count)
+{
+	if (dev->record == NULL)
+		return;
+	if (count >= REC_FAIL) {
+		fido_log_debug("%s: count=%zu", __func__, count);
+		record_close(dev);
+		return;
+	}
+
+	record_put(dev, REC_TX, cmd, buf, (uint32_t)count);
+}
+
+void
+fido_record_rx(fido_dev_t *dev, uint8_t cmd, const void *buf, int n)
+{
+	if (dev->record == NULL)
+		return;
+
+	record_put(dev, REC_RX, cmd, buf, n < 0 ? REC_FAIL : (uint32_t)n);
+}
+
+void
+fido_record_free(fido_dev_t *dev)
+{
+	record_close(dev);
+}
+
+int
+fido_dev_set_record(fido_dev_t *dev, const char *path)
+{
+	struct fido_record	*rec;
+
+	if (record_close(dev) < 0 && path == NULL)
+		return (FIDO_ERR_INTERNAL);
+	if (path == NULL)
+		return (FIDO_OK);
+
+	if ((rec = fido_calloc(1, sizeof(*rec))) == NULL)
+		return (FIDO_ERR_INTERNAL);
+	if ((rec->fp = fopen(path, "wb")) == NULL) {
+		fido_log_error(errno, "%s: fopen %s", __func__, path);
+		fido_free(rec);
+		return (FIDO_ERR_INTERNAL);
+	}
+	if (fwrite(REC_MAGIC, 1, REC_MAGICLEN, rec->fp) != REC_MAGICLEN ||
+	    fido_time_now(&rec->last) != 0) {
+		fido_log_error(errno, "%s: fwrite %s", __func__, path);
+		fclose(rec->fp);
+		fido_free(rec);
+		return (FIDO_ERR_INTERNAL);
+	}
+	dev->record = rec;
+
+	return (FIDO_OK);
+}
+
+static void *
+replay_open(const char *path)
+{
+	struct replay	*r;
+	FILE		*fp;
+	long		 len;
+
+	if ((r = fido_calloc(1, sizeof(*r))) == NULL)
+		return (NULL);
+	if ((fp = fopen(path, "rb")) == NULL) {
+		fido_log_error(errno, "%s: fopen %s", __func__, path);
+		fido_free(r);
+		return (NULL);
+	}
+	if (fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) <
+	    (long)REC_MAGICLEN || (unsigned long)len > SIZE_MAX ||
+	    fseek(fp, 0, SEEK_SET) != 0) {
+		fido_log_debug("%s: size", __func__);
+		goto fail;
+	}
+	if ((r->buf = fido_malloc((size_t)len)) == NULL ||
+	    fread(r->buf, 1, (size_t)len, fp) != (size_t)len) {
+		fido_log_debug("%s: fread", __func__);
+		goto fail;
+	}
+	if (memcmp(r->buf, REC_MAGIC, REC_MAGICLEN) != 0) {
+		fido_log_debug("%s: magic", __func__);
+		goto fail;
+	}
+	r->len = (size_t)len;
+	r->off = REC_MAGICLEN;
+	fclose(fp);
+
+	return (r);
+fail:
+	fclose(fp);
+	fido_free(r->buf);
+	fido_free(r);
+
+	return (NULL);
+}
+
+static void
+replay_close(void *handle)
+{
+	struct replay *r = handle;
+
+	fido_blob_reset(&r->ping);
+	fido_free(r->buf);
+	fido_free(r);
+}
+
+static int
+replay_read(void *handle, unsigned char *buf, size_t len, int ms)
+{
+	(void)handle;
+	(void)buf;
+	(void)len;
+	(void)ms;
+
+	return (-1);
+}
+
+static int
+replay_write(void *handle, const unsigned char *buf, size_t len)
+{
+	(void)handle;
+	(void)buf;
+	(void)len;
+
+	return (-1);
+}
+
+static int
+replay_peek(const struct replay *r, uint8_t type, uint8_t cmd,
+    struct rec_entry *e)
+{
+	const unsigned char *p = r->buf + r->off;
+
+	if (r->len - r->off < REC_HDRLEN) {
+		fido_log_debug("%s: end of recording", __func__);
+		return (-1);
+	}
+	e->type = p[0];
+	e->cmd = p[1];
+	e->len = get_be32(&p[2]);
+	e->delta = get_be32(&p[6]);
+	e->ptr = p + REC_HDRLEN;
+	e->next = r->off + REC_HDRLEN;
+	if (e->len != REC_FAIL) {
+		if (r->len - e->next < e->len) {
+			fido_log_debug("%s: truncated", __func__);
+			return (-1);
+		}
+		e->next += e->len;
+	}
+	if (e->type != type || e->cmd != cmd) {
+		fido_log_debug("%s: recorded type=%u, cmd=0x%02x; got "
+		    "type=%u, cmd=0x%02x", __func__, e->type, e->cmd, type,
+		    cmd);
+		return (-1);
+	}
+
+	return (0);
+}
+
+static int
+replay_sleep(uint64_t us)
+{
+#ifdef _WIN32
+	Sleep((DWORD)(us / 1000));
+#else
+	struct timespec ts;
+
+	ts.tv_sec = (time_t)(us / 1000000);
+	ts.tv_nsec = (long)(us % 1000000) * 1000;
+	if (nanosleep(&ts, NULL) == -1 && errno != EINTR) {
+		fido_log_error(errno, "%s: nanosleep", __func__);
+		return (-1);
+	}
+#endif
+
+	return (0);
+}
+
+static int
+replay_tx(fido_dev_t *dev, uint8_t cmd, const unsigned char *buf,
+    size_t count)
+{
+	struct replay		*r = dev->io_handle;
+	struct rec_entry	 e;
+
+	if (replay_peek(r, REC_TX, cmd, &e) < 0)
+		return (-1);
+	/* the ctap2 command, which is not the rest of the message, must match */
+	if (cmd == CTAP_CMD_CBOR && (count == 0 || e.len == 0 ||
+	    e.len == REC_FAIL || buf[0] != e.ptr[0])) {
+		fido_log_debug("%s: ctap2 command mismatch", __func__);
+		return (-1);
+	}
+	if (cmd == CTAP_CMD_INIT && count == sizeof(r->nonce))
+		memcpy(r->nonce, buf, sizeof(r->nonce));
+	if (cmd == CTAP_CMD_PING && fido_blob_set(&r->ping, buf, count) < 0)
+		return (-1);
+	r->off = e.next;
+	r->slept = 0;
+
+	return (0);
+}
+
+static int
+replay_rx(fido_dev_t *dev, uint8_t cmd, unsigned char *buf, size_t count,
+    int ms)
+{
+	struct replay		*r = dev->io_handle;
+	struct rec_entry	 e;
+	uint64_t		 us = 0;
+
+	if (replay_peek(r, REC_RX, cmd, &e) < 0)
+		return (-1);
+
+	/* a wait cut short by ms resumes where it stopped */
+	if (dev->replay_speed > 0)
+		us = e.delta / dev->replay_speed;
+	if (us > r->slept) {
+		us -= r->slept;
+		if (ms >= 0 && us > (uint64_t)ms * 1000) {
+			if (replay_sleep((uint64_t)ms * 1000) < 0)
+				return (-1);
+			r->slept += (uint64_t)ms * 1000;
+			fido_log_debug("%s: timeout", __func__);
+			return (-1);
+		}
+		if (replay_sleep(us) < 0)
+			return (-1);
+	}
+	r->off = e.next;
+	r->slept = 0;
+
+	if (e.len == REC_FAIL)
+		return (-1);
+	if (e.len > count || e.len > INT_MAX) {
+		fido_log_debug("%s: len=%u, count=%zu", __func__, e.len,
+		    count);
+		return (-1);
+	}
+	/* the device echoed what it was sent; so does the replay */
+	if (cmd == CTAP_CMD_PING && r->ping.len == e.len) {
+		memcpy(buf, r->ping.ptr, r->ping.len);
+		return ((int)e.len);
+	}
+	memcpy(buf, e.ptr, e.len);
+	if (cmd == CTAP_CMD_INIT && e.len >= sizeof(r->nonce))
+		memcpy(buf, r->nonce, sizeof(r->nonce));
+
+	return ((int)e.len);
+}
+
+int
+fido_dev_set_replay(fido_dev_t *dev, unsigned int speed)
+{
+	const fido_dev_io_t io = {
+		replay_open,
+		replay_close,
+		replay_read,
+		replay_write,
+	};
+	const fido_dev_transport_t t = {
+		replay_rx,
+		replay_tx,
+	};
+	int r;
+
+	if ((r = fido_dev_set_io_functions(dev, &io)) != FIDO_OK ||
+	    (r = fido_dev_set_transport_functions(dev, &t)) != FIDO_OK)
+		return (r);
+	dev->replay_speed = speed;
+
+	return (FIDO_OK);
+}
@@ -41,6 +41,16 @@ int
 fido_dev_reset(fido_dev_t *dev)
 {
 	int ms = dev->timeout_ms;
+	int r;
+
+	fido_sched_enter(dev);
+	fido_dev_uv_token_flush(dev);
+	fido_dev_ecdh_flush(dev);
+	fido_dev_largeblob_flush(dev);
+	fido_session_largeblob_set(dev, NULL);
+	fido_dev_bio_flush(dev);
+	r = fido_dev_reset_wait(dev, &ms);
+	fido_sched_leave(dev);
 
-	return (fido_dev_reset_wait(dev, &ms));
+	return (r);
 }
@@ -10,6 +10,12 @@
 
 #include "fido.h"
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000
+#define get0_RSA(x)	EVP_PKEY_get0_RSA((x))
+#else
+#define get0_RSA(x)	EVP_PKEY_get0((x))
+#endif
+
 #if defined(LIBRESSL_VERSION_NUMBER) && LIBRESSL_VERSION_NUMBER < 0x3050200fL
 static EVP_MD *
 rs1_get_EVP_MD(void)
@@ -17,7 +23,8 @@ rs1_get_EVP_MD(void)
 	const EVP_MD *from;
 	EVP_MD *to = NULL;
 
-	if ((from = EVP_sha1()) != NULL && (to = malloc(sizeof(*to))) != NULL)
+	if ((from = EVP_sha1()) != NULL &&
+	    (to = fido_malloc(sizeof(*to))) != NULL)
 		memcpy(to, from, sizeof(*to));
 
 	return (to);
@@ -26,13 +33,13 @@ rs1_get_EVP_MD(void)
 static void
 rs1_free_EVP_MD(EVP_MD *md)
 {
-	freezero(md, sizeof(*md));
+	fido_freezero(md, sizeof(*md));
 }
 #elif OPENSSL_VERSION_NUMBER >= 0x30000000
 static EVP_MD *
 rs1_get_EVP_MD(void)
 {
-	return (EVP_MD_fetch(NULL, "SHA-1", NULL));
+	return (fido_evp_sha1_ref());
 }
 
 static void
@@ -59,12 +66,17 @@ rs1_free_EVP_MD(EVP_MD *md)
 }
 #endif /* LIBRESSL_VERSION_NUMBER */
 
+/*
+ * The RSA key held by pkey is used directly, so that RSA_verify() keeps
+ * its Montgomery context across calls, and no EVP_PKEY_CTX is set up.
+ */
 int
 rs1_verify_sig(const fido_blob_t *dgst, EVP_PKEY *pkey,
     const fido_blob_t *sig)
 {
 	EVP_PKEY_CTX	*pctx = NULL;
 	EVP_MD		*md = NULL;
+	const RSA	*rsa;
 	int		 ok = -1;
 
 	if (EVP_PKEY_base_id(pkey) != EVP_PKEY_RSA) {
@@ -72,12 +84,24 @@ rs1_verify_sig(const fido_blob_t *dgst, EVP_PKEY *pkey,
 		goto fail;
 	}
 
+	if (fido_evp_default_ctx() && (rsa = get0_RSA(pkey)) != NULL) {
+		if (dgst->len > UINT_MAX || sig->len > UINT_MAX ||
+		    RSA_verify(NID_sha1, dgst->ptr, (unsigned int)dgst->len,
+		    sig->ptr, (unsigned int)sig->len,
+		    (RSA *)(uintptr_t)rsa) != 1) {
+			fido_log_debug("%s: RSA_verify", __func__);
+			goto fail;
+		}
+		ok = 0;
+		goto fail;
+	}
+
 	if ((md = rs1_get_EVP_MD()) == NULL) {
 		fido_log_debug("%s: rs1_get_EVP_MD", __func__);
 		goto fail;
 	}
 
-	if ((pctx = EVP_PKEY_CTX_new(pkey, NULL)) == NULL ||
+	if ((pctx = fido_evp_pkey_ctx(pkey)) == NULL ||
 	    EVP_PKEY_verify_init(pctx) != 1 ||
 	    EVP_PKEY_CTX_set_rsa_padding(pctx, RSA_PKCS1_PADDING) != 1 ||
 	    EVP_PKEY_CTX_set_signature_md(pctx, md) != 1) {
@@ -25,7 +25,8 @@ rs256_get_EVP_MD(void)
 	const EVP_MD *from;
 	EVP_MD *to = NULL;
 
-	if ((from = EVP_sha256()) != NULL && (to = malloc(sizeof(*to))) != NULL)
+	if ((from = EVP_sha256()) != NULL &&
+	    (to = fido_malloc(sizeof(*to))) != NULL)
 		memcpy(to, from, sizeof(*to));
 
 	return (to);
@@ -34,13 +35,13 @@ rs256_get_EVP_MD(void)
 static void
 rs256_free_EVP_MD(EVP_MD *md)
 {
-	freezero(md, sizeof(*md));
+	fido_freezero(md, sizeof(*md));
 }
 #elif OPENSSL_VERSION_NUMBER >= 0x30000000
 static EVP_MD *
 rs256_get_EVP_MD(void)
 {
-	return (EVP_MD_fetch(NULL, "SHA2-256", NULL));
+	return (fido_evp_sha256_ref());
 }
 
 static void
@@ -117,7 +118,7 @@ rs256_pk_decode(const cbor_item_t *item, rs256_pk_t *k)
 rs256_pk_t *
 rs256_pk_new(void)
 {
-	return (calloc(1, sizeof(rs256_pk_t)));
+	return (fido_calloc(1, sizeof(rs256_pk_t)));
 }
 
 void
@@ -128,7 +129,7 @@ rs256_pk_free(rs256_pk_t **pkp)
 	if (pkp == NULL || (pk = *pkp) == NULL)
 		return;
 
-	freezero(pk, sizeof(*pk));
+	fido_freezero(pk, sizeof(*pk));
 	*pkp = NULL;
 }
 
@@ -255,12 +256,17 @@ rs256_pk_from_EVP_PKEY(rs256_pk_t *pk, const EVP_PKEY *pkey)
 	return (rs256_pk_from_RSA(pk, rsa));
 }
 
+/*
+ * The RSA key held by pkey is used directly, so that RSA_verify() keeps
+ * its Montgomery context across calls, and no EVP_PKEY_CTX is set up.
+ */
 int
 rs256_verify_sig(const fido_blob_t *dgst, EVP_PKEY *pkey,
     const fido_blob_t *sig)
 {
 	EVP_PKEY_CTX	*pctx = NULL;
 	EVP_MD		*md = NULL;
+	const RSA	*rsa;
 	int		 ok = -1;
 
 	if (EVP_PKEY_base_id(pkey) != EVP_PKEY_RSA) {
@@ -268,12 +274,24 @@ rs256_verify_sig(const fido_blob_t *dgst, EVP_PKEY *pkey,
 		goto fail;
 	}
 
+	if (fido_evp_default_ctx() && (rsa = get0_RSA(pkey)) != NULL) {
+		if (dgst->len > UINT_MAX || sig->len > UINT_MAX ||
+		    RSA_verify(NID_sha256, dgst->ptr, (unsigned int)dgst->len,
+		    sig->ptr, (unsigned int)sig->len,
+		    (RSA *)(uintptr_t)rsa) != 1) {
+			fido_log_debug("%s: RSA_verify", __func__);
+			goto fail;
+		}
+		ok = 0;
+		goto fail;
+	}
+
 	if ((md = rs256_get_EVP_MD()) == NULL) {
 		fido_log_debug("%s: rs256_get_EVP_MD", __func__);
 		goto fail;
 	}
 
-	if ((pctx = EVP_PKEY_CTX_new(pkey, NULL)) == NULL ||
+	if ((pctx = fido_evp_pkey_ctx(pkey)) == NULL ||
 	    EVP_PKEY_verify_init(pctx) != 1 ||
 	    EVP_PKEY_CTX_set_rsa_padding(pctx, RSA_PKCS1_PADDING) != 1 ||
 	    EVP_PKEY_CTX_set_signature_md(pctx, md) != 1) {
@@ -0,0 +1,474 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "fido.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define SCHED_NPRIO	(FIDO_PRIO_INTERACTIVE + 1)
+
+/*
+ * Turns on a device shared by several threads. A thread holds the device
+ * for the length of an operation; threads waiting for it are served by
+ * priority, and in the order they arrived within a priority. Long walks
+ * give the device up between the steps the protocol allows to be
+ * interleaved when a thread of higher priority is waiting. Operations
+ * nested in an operation of the same thread do not wait.
+ *
+ * Read-only requests whose replies do not depend on who asks are shared:
+ * a thread making one while the same request is in flight for another
+ * thread waits for that request's result instead of queueing its own.
+ */
+struct sched_share {
+	bool		 busy;   /* a request in flight */
+	const char	*pin;    /* its pin, if any */
+	size_t		 nwait;  /* threads waiting for its result */
+	uint64_t	 gen;    /* results published */
+	fido_blob_t	 result; /* the last one, if anyone waited */
+	int		 r;      /* its outcome */
+};
+
+struct fido_sched {
+#if defined(HAVE_PTHREAD)
+	pthread_mutex_t		 lock;
+	pthread_cond_t		 cond;
+	pthread_t		 owner;
+#elif defined(_WIN32)
+	SRWLOCK			 lock;
+	CONDITION_VARIABLE	 cond;
+	DWORD			 owner;
+#endif
+	bool			 busy;  /* held by owner */
+	unsigned int		 depth; /* nested operations of owner */
+	uint64_t		 head[SCHED_NPRIO]; /* next ticket served */
+	uint64_t		 tail[SCHED_NPRIO]; /* next ticket issued */
+	struct sched_share	 share[FIDO_SCHED_NSHARE];
+};
+
+#if defined(HAVE_PTHREAD)
+#define SCHED_LOCK(s)		pthread_mutex_lock(&(s)->lock)
+#define SCHED_UNLOCK(s)		pthread_mutex_unlock(&(s)->lock)
+#define SCHED_WAIT(s)		pthread_cond_wait(&(s)->cond, &(s)->lock)
+#define SCHED_WAKE(s)		pthread_cond_broadcast(&(s)->cond)
+#define SCHED_SELF()		pthread_self()
+#define SCHED_IS_SELF(t)	pthread_equal((t), pthread_self())
+#elif defined(_WIN32)
+#define SCHED_LOCK(s)		AcquireSRWLockExclusive(&(s)->lock)
+#define SCHED_UNLOCK(s)		ReleaseSRWLockExclusive(&(s)->lock)
+#define SCHED_WAIT(s)		SleepConditionVariableSRW(&(s)->cond, \
+				    &(s)->lock, INFINITE, 0)
+#define SCHED_WAKE(s)		WakeAllConditionVariable(&(s)->cond)
+#define SCHED_SELF()		GetCurrentThreadId()
+#define SCHED_IS_SELF(t)	((t) == GetCurrentThreadId())
+#endif
+
+/* the calling thread's priority, FIDO_PRIO_NORMAL unless set */
+#if defined(HAVE_PTHREAD)
+static pthread_once_t	prio_once = PTHREAD_ONCE_INIT;
+static pthread_key_t	prio_key;
+static bool		prio_key_ok;
+
+static void
+prio_init(void)
+{
+	prio_key_ok = pthread_key_create(&prio_key, NULL) == 0;
+}
+
+static int
+prio_set(int prio)
+{
+	if (pthread_once(&prio_once, prio_init) != 0 || !prio_key_ok ||
+	    pthread_setspecific(prio_key, (void *)(uintptr_t)(prio + 1)) != 0)
+		return (-1);
+
+	return (0);
+}
+
+static int
+prio_get(void)
+{
+	void *v;
+
+	if (pthread_once(&prio_once, prio_init) != 0 || !prio_key_ok ||
+	    (v = pthread_getspecific(prio_key)) == NULL)
+		return (FIDO_PRIO_NORMAL);
+
+	return ((int)((uintptr_t)v - 1));
+}
+#elif defined(_WIN32)
+static INIT_ONCE	prio_once = INIT_ONCE_STATIC_INIT;
+static DWORD		prio_tls = TLS_OUT_OF_INDEXES;
+
+static BOOL CALLBACK
+prio_init(PINIT_ONCE once, PVOID param, PVOID *ctx)
+{
+	(void)once;
+	(void)param;
+	(void)ctx;
+	prio_tls = TlsAlloc();
+
+	return (TRUE);
+}
+
+static int
+prio_set(int prio)
+{
+	if (InitOnceExecuteOnce(&prio_once, prio_init, NULL, NULL) == 0 ||
+	    prio_tls == TLS_OUT_OF_INDEXES ||
+	    TlsSetValue(prio_tls, (LPVOID)(uintptr_t)(prio + 1)) == 0)
+		return (-1);
+
+	return (0);
+}
+
+static int
+prio_get(void)
+{
+	LPVOID v;
+
+	if (InitOnceExecuteOnce(&prio_once, prio_init, NULL, NULL) == 0 ||
+	    prio_tls == TLS_OUT_OF_INDEXES ||
+	    (v = TlsGetValue(prio_tls)) == NULL)
+		return (FIDO_PRIO_NORMAL);
+
+	return ((int)((uintptr_t)v - 1));
+}
+#else
+static int prio_cur = FIDO_PRIO_NORMAL;
+
+static int
+prio_set(int prio)
+{
+	prio_cur = prio;
+
+	return (0);
+}
+
+static int
+prio_get(void)
+{
+	return (prio_cur);
+}
+#endif
+
+int
+fido_set_thread_priority(int prio)
+{
+	if (prio < FIDO_PRIO_BACKGROUND || prio > FIDO_PRIO_INTERACTIVE)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if (prio_set(prio) < 0) {
+		fido_log_debug("%s: prio_set", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	return (FIDO_OK);
+}
+
+int
+fido_thread_priority(void)
+{
+	return (prio_get());
+}
+
+#if defined(HAVE_PTHREAD) || defined(_WIN32)
+/* whether a thread of priority higher than prio is waiting */
+static bool
+sched_outranked(const struct fido_sched *s, int prio)
+{
+	for (int p = prio + 1; p < SCHED_NPRIO; p++)
+		if (s->head[p] != s->tail[p])
+			return (true);
+
+	return (false);
+}
+
+/* called with s->lock held */
+static void
+sched_acquire(struct fido_sched *s, int prio)
+{
+	uint64_t ticket = s->tail[prio]++;
+
+	while (s->busy || s->head[prio] != ticket ||
+	    sched_outranked(s, prio))
+		SCHED_WAIT(s);
+
+	s->head[prio]++;
+	s->busy = true;
+	s->owner = SCHED_SELF();
+	s->depth = 1;
+}
+
+/* called with s->lock held */
+static void
+sched_release(struct fido_sched *s)
+{
+	s->busy = false;
+	s->depth = 0;
+	SCHED_WAKE(s);
+}
+
+static struct fido_sched *
+sched_new(void)
+{
+	struct fido_sched *s;
+
+	if ((s = fido_calloc(1, sizeof(*s))) == NULL)
+		return (NULL);
+#if defined(HAVE_PTHREAD)
+	if (pthread_mutex_init(&s->lock, NULL) != 0) {
+		fido_free(s);
+		return (NULL);
+	}
+	if (pthread_cond_init(&s->cond, NULL) != 0) {
+		pthread_mutex_destroy(&s->lock);
+		fido_free(s);
+		return (NULL);
+	}
+#else
+	InitializeSRWLock(&s->lock);
+	InitializeConditionVariable(&s->cond);
+#endif
+
+	return (s);
+}
+
+void
+fido_dev_sched_free(fido_dev_t *dev)
+{
+	struct fido_sched *s;
+
+	if ((s = dev->sched) == NULL)
+		return;
+	for (size_t i = 0; i < FIDO_SCHED_NSHARE; i++)
+		fido_blob_reset(&s->share[i].result);
+#if defined(HAVE_PTHREAD)
+	pthread_cond_destroy(&s->cond);
+	pthread_mutex_destroy(&s->lock);
+#endif
+	fido_free(s);
+	dev->sched = NULL;
+}
+
+int
+fido_dev_set_scheduler(fido_dev_t *dev, bool enable)
+{
+	if (enable == false) {
+		fido_dev_sched_free(dev);
+		return (FIDO_OK);
+	}
+	if (dev->sched == NULL && (dev->sched = sched_new()) == NULL) {
+		fido_log_debug("%s: sched_new", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	return (FIDO_OK);
+}
+
+void
+fido_sched_enter(fido_dev_t *dev)
+{
+	struct fido_sched *s;
+
+	if ((s = dev->sched) == NULL)
+		return;
+
+	SCHED_LOCK(s);
+	if (s->busy && SCHED_IS_SELF(s->owner))
+		s->depth++;
+	else
+		sched_acquire(s, prio_get());
+	SCHED_UNLOCK(s);
+}
+
+void
+fido_sched_leave(fido_dev_t *dev)
+{
+	struct fido_sched *s;
+
+	if ((s = dev->sched) == NULL)
+		return;
+
+	SCHED_LOCK(s);
+	if (--s->depth == 0)
+		sched_release(s);
+	SCHED_UNLOCK(s);
+}
+
+/*
+ * A point between two steps of an operation where the device may be
+ * handed to a waiting thread of higher priority; the caller may not
+ * rely on authenticator state across it.
+ */
+void
+fido_sched_yield(fido_dev_t *dev)
+{
+	struct fido_sched	*s;
+	int			 prio;
+
+	if ((s = dev->sched) == NULL)
+		return;
+
+	prio = prio_get();
+	SCHED_LOCK(s);
+	if (s->depth == 1 && sched_outranked(s, prio)) {
+		fido_log_debug("%s: yielding", __func__);
+		sched_release(s);
+		sched_acquire(s, prio);
+	}
+	SCHED_UNLOCK(s);
+}
+
+static bool
+sched_same_pin(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL)
+		return (a == b);
+
+	return (strcmp(a, b) == 0);
+}
+
+/*
+ * Wait for the result of a request of the given kind in flight for
+ * another thread with the same pin, if any. Returns true if *result and
+ * *r were set so. Otherwise, the caller makes the request itself, and
+ * if *lead is set, publishes its result with fido_sched_publish().
+ */
+bool
+fido_sched_join(fido_dev_t *dev, int kind, const char *pin,
+    fido_blob_t *result, int *r, bool *lead)
+{
+	struct fido_sched	*s;
+	struct sched_share	*sh;
+	uint64_t		 gen;
+
+	*lead = false;
+	if ((s = dev->sched) == NULL)
+		return (false);
+
+	sh = &s->share[kind];
+	SCHED_LOCK(s);
+	/* a holder of the device would wait on itself */
+	if (s->busy && SCHED_IS_SELF(s->owner)) {
+		SCHED_UNLOCK(s);
+		return (false);
+	}
+	if (sh->busy == false) {
+		sh->busy = true;
+		sh->pin = pin;
+		*lead = true;
+		SCHED_UNLOCK(s);
+		return (false);
+	}
+	if (sched_same_pin(sh->pin, pin) == false) {
+		SCHED_UNLOCK(s);
+		return (false);
+	}
+	sh->nwait++;
+	for (gen = sh->gen; sh->gen == gen;)
+		SCHED_WAIT(s);
+	sh->nwait--;
+	if ((*r = sh->r) == FIDO_OK && fido_blob_set(result, sh->result.ptr,
+	    sh->result.len) < 0)
+		*r = FIDO_ERR_INTERNAL;
+	SCHED_UNLOCK(s);
+	fido_log_debug("%s: shared %d", __func__, kind);
+
+	return (true);
+}
+
+void
+fido_sched_publish(fido_dev_t *dev, int kind, const unsigned char *ptr,
+    size_t len, int r)
+{
+	struct fido_sched	*s;
+	struct sched_share	*sh;
+
+	if ((s = dev->sched) == NULL)
+		return;
+
+	sh = &s->share[kind];
+	SCHED_LOCK(s);
+	fido_blob_reset(&sh->result);
+	if (sh->nwait > 0 && r == FIDO_OK &&
+	    fido_blob_set(&sh->result, ptr, len) < 0)
+		r = FIDO_ERR_INTERNAL;
+	sh->r = r;
+	sh->gen++;
+	sh->busy = false;
+	sh->pin = NULL;
+	SCHED_WAKE(s);
+	SCHED_UNLOCK(s);
+}
+#else
+void
+fido_dev_sched_free(fido_dev_t *dev)
+{
+	(void)dev;
+}
+
+int
+fido_dev_set_scheduler(fido_dev_t *dev, bool enable)
+{
+	(void)dev;
+
+	if (enable) {
+		fido_log_debug("%s: no thread support", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	return (FIDO_OK);
+}
+
+void
+fido_sched_enter(fido_dev_t *dev)
+{
+	(void)dev;
+}
+
+void
+fido_sched_leave(fido_dev_t *dev)
+{
+	(void)dev;
+}
+
+void
+fido_sched_yield(fido_dev_t *dev)
+{
+	(void)dev;
+}
+
+bool
+fido_sched_join(fido_dev_t *dev, int kind, const char *pin,
+    fido_blob_t *result, int *r, bool *lead)
+{
+	(void)dev;
+	(void)kind;
+	(void)pin;
+	(void)result;
+	(void)r;
+	*lead = false;
+
+	return (false);
+}
+
+void
+fido_sched_publish(fido_dev_t *dev, int kind, const unsigned char *ptr,
+    size_t len, int r)
+{
+	(void)dev;
+	(void)kind;
+	(void)ptr;
+	(void)len;
+	(void)r;
+}
+#endif /* HAVE_PTHREAD || _WIN32 */
@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <errno.h>
+
+#include "fido.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define SECPOOL_SLOTLEN		128	/* bytes per allocation */
+#define SECPOOL_MAXSLOTS	4096
+
+/*
+ * Memory for pins, pin hashes, pin/uv auth tokens and shared secrets.
+ * The pool is a single mapping with an inaccessible guard page at each
+ * end; the pages in between are locked in memory once, when the pool is
+ * created, and kept out of core dumps where possible. They are carved
+ * into fixed-size slots, which are wiped when released and reused.
+ * Requests that do not fit a slot, or find the pool full, are served
+ * from the heap.
+ */
+static struct secpool {
+	unsigned char	*map;    /* mapping, guard pages included */
+	size_t		 maplen; /* length of map */
+	unsigned char	*base;   /* first slot, one page into map */
+	size_t		 size;   /* slots */
+	size_t		*avail;  /* stack of free slots */
+	size_t		 navail; /* free slots */
+} secpool;
+
+#if defined(HAVE_PTHREAD)
+static pthread_mutex_t secpool_lock = PTHREAD_MUTEX_INITIALIZER;
+#define SECPOOL_LOCK()		pthread_mutex_lock(&secpool_lock)
+#define SECPOOL_UNLOCK()	pthread_mutex_unlock(&secpool_lock)
+#elif defined(_WIN32)
+static SRWLOCK secpool_lock = SRWLOCK_INIT;
+#define SECPOOL_LOCK()		AcquireSRWLockExclusive(&secpool_lock)
+#define SECPOOL_UNLOCK()	ReleaseSRWLockExclusive(&secpool_lock)
+#else
+#define SECPOOL_LOCK()		do { } while (0)
+#define SECPOOL_UNLOCK()	do { } while (0)
+#endif
+
+#if defined(HAVE_SYS_MMAN_H)
+static unsigned char *
+secpool_map(size_t maplen, size_t off, size_t len)
+{
+	unsigned char *map;
+
+	if ((map = mmap(NULL, maplen, PROT_NONE, MAP_PRIVATE | MAP_ANON, -1,
+	    0)) == MAP_FAILED) {
+		fido_log_error(errno, "%s: mmap", __func__);
+		return (NULL);
+	}
+	if (mprotect(map + off, len, PROT_READ | PROT_WRITE) != 0 ||
+	    mlock(map + off, len) != 0) {
+		fido_log_error(errno, "%s: mprotect/mlock", __func__);
+		munmap(map, maplen);
+		return (NULL);
+	}
+#ifdef MADV_DONTDUMP
+	(void)madvise(map + off, len, MADV_DONTDUMP);
+#endif
+
+	return (map);
+}
+
+static void
+secpool_unmap(unsigned char *map, size_t maplen, size_t off, size_t len)
+{
+	munlock(map + off, len);
+	munmap(map, maplen);
+}
+#elif defined(_WIN32)
+static unsigned char *
+secpool_map(size_t maplen, size_t off, size_t len)
+{
+	unsigned char	*map;
+	DWORD		 prot;
+
+	if ((map = VirtualAlloc(NULL, maplen, MEM_RESERVE | MEM_COMMIT,
+	    PAGE_NOACCESS)) == NULL) {
+		fido_log_debug("%s: VirtualAlloc", __func__);
+		return (NULL);
+	}
+	if (VirtualProtect(map + off, len, PAGE_READWRITE, &prot) == 0 ||
+	    VirtualLock(map + off, len) == 0) {
+		fido_log_debug("%s: VirtualProtect/VirtualLock", __func__);
+		VirtualFree(map, 0, MEM_RELEASE);
+		return (NULL);
+	}
+
+	return (map);
+}
+
+static void
+secpool_unmap(unsigned char *map, size_t maplen, size_t off, size_t len)
+{
+	(void)maplen;
+	VirtualUnlock(map + off, len);
+	VirtualFree(map, 0, MEM_RELEASE);
+}
+#else
+static unsigned char *
+secpool_map(size_t maplen, size_t off, size_t len)
+{
+	(void)maplen;
+	(void)off;
+	(void)len;
+	fido_log_debug("%s: not supported", __func__);
+
+	return (NULL);
+}
+
+static void
+secpool_unmap(unsigned char *map, size_t maplen, size_t off, size_t len)
+{
+	(void)map;
+	(void)maplen;
+	(void)off;
+	(void)len;
+}
+#endif
+
+static size_t
+secpool_pagelen(void)
+{
+	int n;
+
+	return ((n = getpagesize()) > 0 ? (size_t)n : 4096);
+}
+
+static int
+secpool_new(struct secpool *p, size_t size)
+{
+	size_t page, len;
+
+	page = secpool_pagelen();
+	len = (size * SECPOOL_SLOTLEN + page - 1) / page * page;
+
+	memset(p, 0, sizeof(*p));
+	if ((p->avail = fido_calloc(size, sizeof(*p->avail))) == NULL)
+		return (-1);
+	p->maplen = len + 2 * page;
+	if ((p->map = secpool_map(p->maplen, page, len)) == NULL) {
+		fido_free(p->avail);
+		memset(p, 0, sizeof(*p));
+		return (-1);
+	}
+	p->base = p->map + page;
+	p->size = size;
+	/* hand out the lowest slots first */
+	for (size_t i = 0; i < size; i++)
+		p->avail[p->navail++] = size - 1 - i;
+
+	return (0);
+}
+
+static void
+secpool_free(struct secpool *p)
+{
+	size_t page, len;
+
+	if (p->map == NULL)
+		return;
+
+	page = (size_t)(p->base - p->map);
+	len = p->maplen - 2 * page;
+	explicit_bzero(p->base, len);
+	secpool_unmap(p->map, p->maplen, page, len);
+	fido_free(p->avail);
+	memset(p, 0, sizeof(*p));
+}
+
+/* zeroed memory for a secret of len bytes; release with fido_free() */
+void *
+fido_secure_alloc(size_t len)
+{
+	void *ptr = NULL;
+
+	if (len != 0 && len <= SECPOOL_SLOTLEN) {
+		SECPOOL_LOCK();
+		if (secpool.navail > 0)
+			ptr = secpool.base +
+			    secpool.avail[--secpool.navail] * SECPOOL_SLOTLEN;
+		SECPOOL_UNLOCK();
+	}
+
+	return (ptr != NULL ? ptr : fido_calloc(1, len));
+}
+
+/* whether ptr belongs to the pool */
+bool
+fido_secure_owns(const void *ptr)
+{
+	uintptr_t	p = (uintptr_t)ptr, base;
+	bool		owned;
+
+	SECPOOL_LOCK();
+	base = (uintptr_t)secpool.base;
+	owned = base != 0 && p >= base &&
+	    p - base < secpool.size * SECPOOL_SLOTLEN;
+	SECPOOL_UNLOCK();
+
+	return (owned);
+}
+
+/* release a slot; ptr must be owned by the pool */
+void
+fido_secure_free(void *ptr)
+{
+	size_t i;
+
+	SECPOOL_LOCK();
+	i = (size_t)((unsigned char *)ptr - secpool.base) / SECPOOL_SLOTLEN;
+	explicit_bzero(secpool.base + i * SECPOOL_SLOTLEN, SECPOOL_SLOTLEN);
+	secpool.avail[secpool.navail++] = i;
+	SECPOOL_UNLOCK();
+}
+
+/* move a slot to the heap if size no longer fits it */
+void *
+fido_secure_realloc(void *ptr, size_t size)
+{
+	void *newptr;
+
+	if (size <= SECPOOL_SLOTLEN)
+		return (ptr);
+	if ((newptr = fido_malloc(size)) == NULL)
+		return (NULL);
+	memcpy(newptr, ptr, SECPOOL_SLOTLEN);
+	fido_secure_free(ptr);
+
+	return (newptr);
+}
+
+int
+fido_secure_pool_set_size(size_t size)
+{
+	struct secpool	p, old;
+	int		r;
+
+	if (size > SECPOOL_MAXSLOTS) {
+		fido_log_debug("%s: size=%zu", __func__, size);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	/*
+	 * Pools are made and released outside the lock: releasing one
+	 * goes through fido_free(), which takes it.
+	 */
+	memset(&p, 0, sizeof(p));
+	if (size != 0 && secpool_new(&p, size) < 0)
+		return (FIDO_ERR_INTERNAL);
+
+	SECPOOL_LOCK();
+	if (secpool.navail != secpool.size) {
+		fido_log_debug("%s: %zu slots in use", __func__,
+		    secpool.size - secpool.navail);
+		r = FIDO_ERR_INTERNAL;
+	} else {
+		old = secpool;
+		secpool = p;
+		p = old;
+		r = FIDO_OK;
+	}
+	SECPOOL_UNLOCK();
+
+	secpool_free(&p);
+
+	return (r);
+}
+
+size_t
+fido_secure_pool_size(void)
+{
+	size_t size;
+
+	SECPOOL_LOCK();
+	size = secpool.size;
+	SECPOOL_UNLOCK();
+
+	return (size);
+}
+
+size_t
+fido_secure_pool_len(void)
+{
+	size_t len;
+
+	SECPOOL_LOCK();
+	len = secpool.size - secpool.navail;
+	SECPOOL_UNLOCK();
+
+	return (len);
+}
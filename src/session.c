@@ -0,0 +1,374 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "fido.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define SESSION_CACHE_MAXLEN	256
+
+struct session_entry {
+	char		*path;     /* device path */
+	uint8_t		 ident[5]; /* ctaphid protocol, version and flags */
+	fido_blob_t	 info;     /* cbor-encoded getinfo reply */
+	fido_blob_t	 largeblob; /* large-blob array last seen, if any */
+	uint64_t	 used;     /* tick of last lookup */
+};
+
+static struct session_cache {
+	struct session_entry	*entry;  /* cached sessions */
+	size_t			 size;   /* capacity of entry[] */
+	size_t			 len;    /* entries in use */
+	uint64_t		 tick;   /* lookup counter */
+	uint64_t		 hits;   /* opens that skipped getinfo */
+	uint64_t		 misses; /* opens that issued getinfo */
+} session_cache;
+
+#if defined(HAVE_PTHREAD)
+static pthread_mutex_t session_lock = PTHREAD_MUTEX_INITIALIZER;
+#define SESSION_LOCK()		pthread_mutex_lock(&session_lock)
+#define SESSION_UNLOCK()	pthread_mutex_unlock(&session_lock)
+#elif defined(_WIN32)
+static SRWLOCK session_lock = SRWLOCK_INIT;
+#define SESSION_LOCK()		AcquireSRWLockExclusive(&session_lock)
+#define SESSION_UNLOCK()	ReleaseSRWLockExclusive(&session_lock)
+#else
+#define SESSION_LOCK()		do { } while (0)
+#define SESSION_UNLOCK()	do { } while (0)
+#endif
+
+/*
+ * A device is identified by its path and the fixed part of its
+ * CTAPHID_INIT reply; a different authenticator (or firmware) behind the
+ * same path misses the cache.
+ */
+static void
+session_ident(const fido_dev_t *dev, uint8_t ident[5])
+{
+	ident[0] = dev->attr.protocol;
+	ident[1] = dev->attr.major;
+	ident[2] = dev->attr.minor;
+	ident[3] = dev->attr.build;
+	ident[4] = dev->attr.flags;
+}
+
+static void
+session_entry_reset(struct session_entry *e)
+{
+	fido_free(e->path);
+	fido_blob_reset(&e->info);
+	fido_blob_reset(&e->largeblob);
+	memset(e, 0, sizeof(*e));
+}
+
+/* caller must hold session_lock */
+static void
+session_cache_remove(size_t i)
+{
+	session_entry_reset(&session_cache.entry[i]);
+	if (i != --session_cache.len) {
+		session_cache.entry[i] = session_cache.entry[session_cache.len];
+		memset(&session_cache.entry[session_cache.len], 0,
+		    sizeof(*session_cache.entry));
+	}
+}
+
+/* caller must hold session_lock */
+static void
+session_cache_trim(size_t len)
+{
+	while (session_cache.len > len)
+		session_entry_reset(&session_cache.entry[--session_cache.len]);
+}
+
+/* caller must hold session_lock */
+static struct session_entry *
+session_cache_find(const char *path, size_t *idx)
+{
+	for (size_t i = 0; i < session_cache.len; i++)
+		if (strcmp(session_cache.entry[i].path, path) == 0) {
+			if (idx != NULL)
+				*idx = i;
+			return (&session_cache.entry[i]);
+		}
+
+	return (NULL);
+}
+
+/* caller must hold session_lock */
+static struct session_entry *
+session_cache_slot(void)
+{
+	struct session_entry *e;
+
+	if (session_cache.len < session_cache.size)
+		return (&session_cache.entry[session_cache.len++]);
+
+	/* evict the least recently used entry */
+	e = &session_cache.entry[0];
+	for (size_t i = 1; i < session_cache.len; i++)
+		if (session_cache.entry[i].used < e->used)
+			e = &session_cache.entry[i];
+	session_entry_reset(e);
+
+	return (e);
+}
+
+/*
+ * Decode the cached getinfo reply of the device at path into ci. Returns
+ * 0 on a hit, -1 otherwise.
+ */
+int
+fido_session_lookup(const fido_dev_t *dev, const char *path,
+    fido_cbor_info_t *ci)
+{
+	struct session_entry	*e;
+	fido_blob_t		 info;
+	uint8_t			 ident[5];
+	int			 ok = -1;
+
+	memset(&info, 0, sizeof(info));
+	session_ident(dev, ident);
+
+	SESSION_LOCK();
+	if (session_cache.size == 0) {
+		SESSION_UNLOCK();
+		return (-1);
+	}
+	if ((e = session_cache_find(path, NULL)) != NULL &&
+	    memcmp(e->ident, ident, sizeof(ident)) == 0 &&
+	    fido_blob_set(&info, e->info.ptr, e->info.len) == 0) {
+		e->used = ++session_cache.tick;
+		session_cache.hits++;
+		ok = 0;
+	} else
+		session_cache.misses++;
+	SESSION_UNLOCK();
+
+	/* decode outside the lock */
+	if (ok == 0 && fido_cbor_info_decode(ci, &info) != FIDO_OK) {
+		fido_log_debug("%s: fido_cbor_info_decode", __func__);
+		fido_session_drop(path);
+		ok = -1;
+	}
+	fido_blob_reset(&info);
+
+	return (ok);
+}
+
+void
+fido_session_store(const fido_dev_t *dev, const char *path,
+    const fido_blob_t *info)
+{
+	struct session_entry	*e;
+	struct session_entry	 n;
+
+	memset(&n, 0, sizeof(n));
+	session_ident(dev, n.ident);
+
+	if ((n.path = fido_strdup(path)) == NULL ||
+	    fido_blob_set(&n.info, info->ptr, info->len) < 0) {
+		fido_log_debug("%s: strdup/fido_blob_set", __func__);
+		session_entry_reset(&n);
+		return;
+	}
+
+	SESSION_LOCK();
+	if (session_cache.size == 0) {
+		SESSION_UNLOCK();
+		session_entry_reset(&n);
+		return;
+	}
+	if ((e = session_cache_find(path, NULL)) != NULL)
+		session_entry_reset(e);
+	else
+		e = session_cache_slot();
+	*e = n;
+	e->used = ++session_cache.tick;
+	SESSION_UNLOCK();
+}
+
+void
+fido_session_drop(const char *path)
+{
+	size_t i;
+
+	SESSION_LOCK();
+	if (session_cache_find(path, &i) != NULL)
+		session_cache_remove(i);
+	SESSION_UNLOCK();
+}
+
+/*
+ * Copy the large-blob array last seen on dev, an open device, into array.
+ * Returns 0 if one is kept, -1 otherwise.
+ */
+int
+fido_session_largeblob_get(const fido_dev_t *dev, fido_blob_t *array)
+{
+	struct session_entry	*e;
+	uint8_t			 ident[5];
+	int			 ok = -1;
+
+	if (dev->session_path == NULL)
+		return (-1);
+	session_ident(dev, ident);
+
+	SESSION_LOCK();
+	if ((e = session_cache_find(dev->session_path, NULL)) != NULL &&
+	    memcmp(e->ident, ident, sizeof(ident)) == 0 &&
+	    e->largeblob.ptr != NULL &&
+	    fido_blob_set(array, e->largeblob.ptr, e->largeblob.len) == 0)
+		ok = 0;
+	SESSION_UNLOCK();
+
+	return (ok);
+}
+
+/* remember the large-blob array of dev; NULL forgets it */
+void
+fido_session_largeblob_set(const fido_dev_t *dev, const fido_blob_t *array)
+{
+	struct session_entry	*e;
+	fido_blob_t		 n;
+	uint8_t			 ident[5];
+
+	if (dev->session_path == NULL)
+		return;
+	memset(&n, 0, sizeof(n));
+	session_ident(dev, ident);
+
+	/* on failure, the old array is forgotten */
+	if (array != NULL && fido_blob_set(&n, array->ptr, array->len) < 0)
+		fido_log_debug("%s: fido_blob_set", __func__);
+
+	SESSION_LOCK();
+	if ((e = session_cache_find(dev->session_path, NULL)) != NULL &&
+	    memcmp(e->ident, ident, sizeof(ident)) == 0) {
+		fido_blob_reset(&e->largeblob);
+		e->largeblob = n;
+		memset(&n, 0, sizeof(n));
+	}
+	SESSION_UNLOCK();
+
+	fido_blob_reset(&n);
+}
+
+/* drop entries whose path is not in a complete device list */
+void
+fido_session_prune(const fido_dev_info_t *devlist, size_t ndevs)
+{
+	size_t i = 0, j;
+
+	SESSION_LOCK();
+	while (i < session_cache.len) {
+		for (j = 0; j < ndevs; j++)
+			if (devlist[j].path != NULL &&
+			    strcmp(devlist[j].path,
+			    session_cache.entry[i].path) == 0)
+				break;
+		if (j < ndevs)
+			i++;
+		else {
+			fido_log_debug("%s: %s gone", __func__,
+			    session_cache.entry[i].path);
+			session_cache_remove(i);
+		}
+	}
+	SESSION_UNLOCK();
+}
+
+int
+fido_session_cache_set_size(size_t size)
+{
+	struct session_entry *entry;
+
+	if (size > SESSION_CACHE_MAXLEN) {
+		fido_log_debug("%s: size=%zu", __func__, size);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	SESSION_LOCK();
+	session_cache_trim(size);
+	if (size == 0) {
+		fido_free(session_cache.entry);
+		session_cache.entry = NULL;
+	} else if ((entry = fido_recallocarray(session_cache.entry,
+	    session_cache.size, size, sizeof(*entry))) == NULL) {
+		SESSION_UNLOCK();
+		return (FIDO_ERR_INTERNAL);
+	} else
+		session_cache.entry = entry;
+	session_cache.size = size;
+	SESSION_UNLOCK();
+
+	return (FIDO_OK);
+}
+
+void
+fido_session_cache_clear(void)
+{
+	SESSION_LOCK();
+	session_cache_trim(0);
+	session_cache.hits = 0;
+	session_cache.misses = 0;
+	SESSION_UNLOCK();
+}
+
+size_t
+fido_session_cache_size(void)
+{
+	size_t size;
+
+	SESSION_LOCK();
+	size = session_cache.size;
+	SESSION_UNLOCK();
+
+	return (size);
+}
+
+size_t
+fido_session_cache_len(void)
+{
+	size_t len;
+
+	SESSION_LOCK();
+	len = session_cache.len;
+	SESSION_UNLOCK();
+
+	return (len);
+}
+
+uint64_t
+fido_session_cache_hits(void)
+{
+	uint64_t hits;
+
+	SESSION_LOCK();
+	hits = session_cache.hits;
+	SESSION_UNLOCK();
+
+	return (hits);
+}
+
+uint64_t
+fido_session_cache_misses(void)
+{
+	uint64_t misses;
+
+	SESSION_LOCK();
+	misses = session_cache.misses;
+	SESSION_UNLOCK();
+
+	return (misses);
+}
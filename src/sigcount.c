@@ -0,0 +1,348 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include <openssl/hmac.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "fido.h"
+#include "fido/verify.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/*
+ * A table of the last signature counter seen for each credential,
+ * keyed by 64 bits of an HMAC of the credential id under the table's
+ * random seed. Slots are claimed and counters advanced with atomic
+ * compare-and-swap, so that any number of threads, or of processes
+ * sharing a mapped file, can check counters without locking. Slots are
+ * never freed; a full table refuses new credentials.
+ *
+ * A mapped file holds the header followed by the slots:
+ *
+ *	magic[4] version[1] reserved[3] nslot[8] seed[16] reserved[32]
+ */
+
+#define SIGCOUNT_MAGIC		"F2SC"
+#define SIGCOUNT_VERSION	1
+#define SIGCOUNT_HDRLEN		64
+#define SIGCOUNT_SEEDLEN	16
+#define SIGCOUNT_MAXSLOT	(SIZE_MAX / 2 / sizeof(struct sigcount_slot))
+
+struct sigcount_slot {
+	uint64_t key;   /* credential; zero if free */
+	uint32_t count; /* last counter seen */
+	uint32_t pad;
+};
+
+struct fido_sigcount_table {
+	struct sigcount_slot	*slot;   /* nslot slots */
+	size_t			 nslot;  /* a power of two */
+	unsigned char		 seed[SIGCOUNT_SEEDLEN];
+	unsigned char		*map;    /* mapped file, if any */
+	size_t			 maplen; /* length of map */
+};
+
+#ifdef _MSC_VER
+#define CAS64(p, o, n)	(InterlockedCompareExchange64((volatile LONG64 *)(p), \
+			    (LONG64)(n), (LONG64)(o)) == (LONG64)(o))
+#define CAS32(p, o, n)	(InterlockedCompareExchange((volatile LONG *)(p), \
+			    (LONG)(n), (LONG)(o)) == (LONG)(o))
+#define LOAD64(p)	((uint64_t)InterlockedCompareExchange64( \
+			    (volatile LONG64 *)(p), 0, 0))
+#define LOAD32(p)	((uint32_t)InterlockedCompareExchange( \
+			    (volatile LONG *)(p), 0, 0))
+#else
+#define CAS64(p, o, n)	__atomic_compare_exchange_n((p), &(uint64_t){ (o) }, \
+			    (n), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define CAS32(p, o, n)	__atomic_compare_exchange_n((p), &(uint32_t){ (o) }, \
+			    (n), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define LOAD64(p)	__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define LOAD32(p)	__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#endif
+
+fido_sigcount_table_t *
+fido_sigcount_table_new(void)
+{
+	return (fido_calloc(1, sizeof(fido_sigcount_table_t)));
+}
+
+static void
+sigcount_reset(fido_sigcount_table_t *t)
+{
+#ifdef HAVE_SYS_MMAN_H
+	if (t->map != NULL)
+		munmap(t->map, t->maplen);
+	else
+#endif
+		fido_free(t->slot);
+	explicit_bzero(t, sizeof(*t));
+}
+
+void
+fido_sigcount_table_free(fido_sigcount_table_t **t_p)
+{
+	fido_sigcount_table_t *t;
+
+	if (t_p == NULL || (t = *t_p) == NULL)
+		return;
+	sigcount_reset(t);
+	fido_free(t);
+	*t_p = NULL;
+}
+
+static bool
+sigcount_nslot_ok(size_t nslot)
+{
+	return (nslot > 0 && nslot <= SIGCOUNT_MAXSLOT &&
+	    (nslot & (nslot - 1)) == 0);
+}
+
+int
+fido_sigcount_table_alloc(fido_sigcount_table_t *t, size_t nslot)
+{
+	struct sigcount_slot *slot;
+
+	if (!sigcount_nslot_ok(nslot))
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if ((slot = fido_calloc(nslot, sizeof(*slot))) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	sigcount_reset(t);
+	if (fido_get_random(t->seed, sizeof(t->seed)) < 0) {
+		fido_free(slot);
+		return (FIDO_ERR_INTERNAL);
+	}
+	t->slot = slot;
+	t->nslot = nslot;
+
+	return (FIDO_OK);
+}
+
+#ifdef HAVE_SYS_MMAN_H
+/* create a table file at path, unless one already exists */
+static int
+sigcount_create(const char *path, size_t nslot)
+{
+	unsigned char	 hdr[SIGCOUNT_HDRLEN];
+	char		*tmp = NULL;
+	int		 fd = -1;
+	int		 ok = -1;
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, SIGCOUNT_MAGIC, 4);
+	hdr[4] = SIGCOUNT_VERSION;
+	for (size_t i = 0; i < 8; i++)
+		hdr[8 + i] = (unsigned char)((uint64_t)nslot >> (56 - 8 * i));
+	if (fido_get_random(hdr + 16, SIGCOUNT_SEEDLEN) < 0 ||
+	    fido_asprintf(&tmp, "%s.XXXXXX", path) == -1) {
+		tmp = NULL;
+		goto fail;
+	}
+	if ((fd = mkstemp(tmp)) == -1) {
+		fido_log_error(errno, "%s: mkstemp", __func__);
+		goto fail;
+	}
+	/* the slots are zeroed by ftruncate() */
+	if (write(fd, hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr) ||
+	    ftruncate(fd, (off_t)(SIGCOUNT_HDRLEN +
+	    nslot * sizeof(struct sigcount_slot))) == -1 || fsync(fd) == -1) {
+		fido_log_error(errno, "%s: write", __func__);
+		goto fail;
+	}
+	/* a table created meanwhile by someone else wins */
+	if (link(tmp, path) == -1 && errno != EEXIST) {
+		fido_log_error(errno, "%s: link", __func__);
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+	if (fd != -1) {
+		close(fd);
+		unlink(tmp);
+	}
+	fido_free(tmp);
+
+	return (ok);
+}
+
+int
+fido_sigcount_table_map(fido_sigcount_table_t *t, const char *path,
+    size_t nslot)
+{
+	struct stat	 st;
+	unsigned char	*map = MAP_FAILED;
+	uint64_t	 n = 0;
+	int		 fd = -1;
+	int		 r = FIDO_ERR_INVALID_ARGUMENT;
+
+	if (path == NULL || (nslot != 0 && !sigcount_nslot_ok(nslot)))
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	if ((fd = open(path, O_RDWR | O_CLOEXEC)) == -1 && errno == ENOENT &&
+	    nslot != 0) {
+		if (sigcount_create(path, nslot) < 0) {
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+		fd = open(path, O_RDWR | O_CLOEXEC);
+	}
+	if (fd == -1) {
+		fido_log_error(errno, "%s: open %s", __func__, path);
+		goto fail;
+	}
+	if (fstat(fd, &st) == -1 || st.st_size < SIGCOUNT_HDRLEN ||
+	    (uintmax_t)st.st_size > SIZE_MAX) {
+		fido_log_debug("%s: fstat", __func__);
+		goto fail;
+	}
+	if ((map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		fido_log_error(errno, "%s: mmap", __func__);
+		goto fail;
+	}
+	for (size_t i = 0; i < 8; i++)
+		n = n << 8 | map[8 + i];
+	if (memcmp(map, SIGCOUNT_MAGIC, 4) != 0 ||
+	    map[4] != SIGCOUNT_VERSION || n > SIZE_MAX ||
+	    !sigcount_nslot_ok((size_t)n) || (size_t)n !=
+	    ((size_t)st.st_size - SIGCOUNT_HDRLEN) /
+	    sizeof(struct sigcount_slot) || (nslot != 0 && n != nslot)) {
+		fido_log_debug("%s: invalid header, nslot=%llu", __func__,
+		    (unsigned long long)n);
+		goto fail;
+	}
+
+	sigcount_reset(t);
+	memcpy(t->seed, map + 16, sizeof(t->seed));
+	t->slot = (struct sigcount_slot *)(void *)(map + SIGCOUNT_HDRLEN);
+	t->nslot = (size_t)n;
+	t->map = map;
+	t->maplen = (size_t)st.st_size;
+	map = MAP_FAILED;
+
+	r = FIDO_OK;
+fail:
+	if (map != MAP_FAILED)
+		munmap(map, (size_t)st.st_size);
+	if (fd != -1)
+		close(fd);
+
+	return (r);
+}
+#else
+int
+fido_sigcount_table_map(fido_sigcount_table_t *t, const char *path,
+    size_t nslot)
+{
+	(void)t;
+	(void)path;
+	(void)nslot;
+
+	return (FIDO_ERR_UNSUPPORTED_OPTION);
+}
+#endif /* HAVE_SYS_MMAN_H */
+
+/* the slot of id, claimed if the credential has not been seen */
+static struct sigcount_slot *
+sigcount_slot(fido_sigcount_table_t *t, const unsigned char *id,
+    size_t id_len, bool claim)
+{
+	const EVP_MD	*md;
+	unsigned char	 dgst[EVP_MAX_MD_SIZE];
+	unsigned int	 dgst_len;
+	uint64_t	 key = 0, k;
+	size_t		 h = 0;
+
+	if ((md = fido_evp_sha256()) == NULL || HMAC(md, t->seed,
+	    sizeof(t->seed), id, id_len, dgst, &dgst_len) == NULL ||
+	    dgst_len < 16) {
+		fido_log_debug("%s: hmac", __func__);
+		return (NULL);
+	}
+	for (size_t i = 0; i < 8; i++) {
+		key = key << 8 | dgst[i];
+		h = h << 8 | dgst[8 + i];
+	}
+	if (key == 0)
+		key = 1;
+
+	for (size_t i = 0; i < t->nslot; i++) {
+		h &= t->nslot - 1;
+		if ((k = LOAD64(&t->slot[h].key)) == key)
+			return (&t->slot[h]);
+		if (k == 0) {
+			if (!claim)
+				return (NULL);
+			if (CAS64(&t->slot[h].key, 0, key) ||
+			    LOAD64(&t->slot[h].key) == key)
+				return (&t->slot[h]);
+		}
+		h++;
+	}
+	fido_log_debug("%s: table full", __func__);
+
+	return (NULL);
+}
+
+int
+fido_sigcount_table_advance(fido_sigcount_table_t *t,
+    const unsigned char *id, size_t id_len, uint32_t sigcount)
+{
+	struct sigcount_slot	*slot;
+	uint32_t		 count;
+
+	if (id == NULL || id_len == 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if (t->nslot == 0 || (slot = sigcount_slot(t, id, id_len,
+	    true)) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	do {
+		count = LOAD32(&slot->count);
+		/* both zero: the authenticator keeps no counter */
+		if (sigcount == 0 && count == 0)
+			return (FIDO_OK);
+		if (sigcount <= count) {
+			fido_log_debug("%s: sigcount=%u, last=%u", __func__,
+			    sigcount, count);
+			return (FIDO_ERR_SIGCOUNT);
+		}
+	} while (!CAS32(&slot->count, count, sigcount));
+
+	return (FIDO_OK);
+}
+
+int
+fido_sigcount_table_get(fido_sigcount_table_t *t, const unsigned char *id,
+    size_t id_len, uint32_t *sigcount)
+{
+	struct sigcount_slot *slot;
+
+	if (id == NULL || id_len == 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if (t->nslot == 0 || (slot = sigcount_slot(t, id, id_len,
+	    false)) == NULL)
+		return (FIDO_ERR_NOTFOUND);
+	*sigcount = LOAD32(&slot->count);
+
+	return (FIDO_OK);
+}
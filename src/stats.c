@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+
+#include "fido.h"
+#include "fido/stats.h"
+
+#define STATS_MAXCMD	32 /* distinct commands with a histogram */
+
+struct stats_cmd {
+	uint8_t		ctaphid;
+	uint8_t		cbor;
+	uint64_t	rtt[FIDO_STATS_NBUCKETS];
+};
+
+/*
+ * Counters and log2 latency histograms of a device, updated from the
+ * same points that report trace events. Updates are plain increments
+ * made by the thread operating the device; no locks are taken.
+ */
+struct fido_dev_stats {
+	uint64_t		counter[FIDO_STATS_NCOUNTERS];
+	struct stats_cmd	cmd[STATS_MAXCMD];
+	size_t			ncmd;
+	uint64_t		up_wait[FIDO_STATS_NBUCKETS];
+	uint64_t		start_ns; /* CMD_START of the message in flight */
+	uint64_t		up_ns;    /* first UPNEEDED keepalive, or 0 */
+};
+
+static void
+stats_histogram_add(uint64_t *h, uint64_t start_ns, uint64_t end_ns)
+{
+	uint64_t	us;
+	size_t		i = 0;
+
+	if (start_ns == 0 || end_ns < start_ns)
+		return;
+
+	us = (end_ns - start_ns) / 1000;
+	while (us > 1 && i < FIDO_STATS_NBUCKETS - 1) {
+		us >>= 1;
+		i++;
+	}
+	h[i]++;
+}
+
+static struct stats_cmd *
+stats_cmd(struct fido_dev_stats *st, uint8_t ctaphid, uint8_t cbor)
+{
+	for (size_t i = 0; i < st->ncmd; i++)
+		if (st->cmd[i].ctaphid == ctaphid && st->cmd[i].cbor == cbor)
+			return (&st->cmd[i]);
+	if (st->ncmd == STATS_MAXCMD)
+		return (NULL);
+	st->cmd[st->ncmd].ctaphid = ctaphid;
+	st->cmd[st->ncmd].cbor = cbor;
+
+	return (&st->cmd[st->ncmd++]);
+}
+
+static uint64_t
+stats_reports(size_t len, size_t report_len)
+{
+	if (report_len == 0 || len < report_len)
+		return (1);
+
+	return (len / report_len);
+}
+
+void
+fido_stats_update(const fido_dev_t *dev, const fido_trace_event_t *ev)
+{
+	struct fido_dev_stats	*st = dev->stats;
+	struct stats_cmd	*c;
+
+	switch (ev->type) {
+	case FIDO_TRACE_CMD_START:
+		st->counter[FIDO_STATS_COMMANDS]++;
+		st->start_ns = ev->ns;
+		st->up_ns = 0;
+		break;
+	case FIDO_TRACE_TX:
+		if (ev->result < 0)
+			break;
+		st->counter[FIDO_STATS_TX_BYTES] += (uint64_t)ev->result;
+		st->counter[FIDO_STATS_TX_REPORTS] += stats_reports(ev->len,
+		    dev->transport.tx != NULL ? 0 : dev->tx_len + 1);
+		break;
+	case FIDO_TRACE_RX:
+		if (ev->result < 0)
+			break;
+		st->counter[FIDO_STATS_RX_BYTES] += (uint64_t)ev->result;
+		st->counter[FIDO_STATS_RX_REPORTS]++;
+		break;
+	case FIDO_TRACE_KEEPALIVE:
+		st->counter[FIDO_STATS_KEEPALIVES]++;
+		if (ev->result == FIDO_KEEPALIVE_UPNEEDED && st->up_ns == 0)
+			st->up_ns = ev->ns;
+		break;
+	case FIDO_TRACE_CMD_END:
+		if (ev->result == FIDO_ERR_RX) {
+			st->counter[FIDO_STATS_RX_ERRORS]++;
+			break;
+		}
+		st->counter[FIDO_STATS_REPLIES]++;
+		if ((c = stats_cmd(st, ev->cmd, ev->cbor)) != NULL)
+			stats_histogram_add(c->rtt, st->start_ns, ev->ns);
+		stats_histogram_add(st->up_wait, st->up_ns, ev->ns);
+		st->start_ns = st->up_ns = 0;
+		break;
+	}
+}
+
+fido_dev_stats_t *
+fido_dev_stats_new(void)
+{
+	return (fido_calloc(1, sizeof(fido_dev_stats_t)));
+}
+
+void
+fido_dev_stats_free(fido_dev_stats_t **st_p)
+{
+	fido_dev_stats_t *st;
+
+	if (st_p == NULL || (st = *st_p) == NULL)
+		return;
+	fido_free(st);
+	*st_p = NULL;
+}
+
+/* enabling resets the statistics */
+int
+fido_dev_set_stats(fido_dev_t *dev, bool enable)
+{
+	fido_free(dev->stats);
+	dev->stats = NULL;
+
+	if (enable && (dev->stats = fido_calloc(1,
+	    sizeof(*dev->stats))) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	return (FIDO_OK);
+}
+
+int
+fido_dev_stats(const fido_dev_t *dev, fido_dev_stats_t *st)
+{
+	if (dev->stats == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	memcpy(st, dev->stats, sizeof(*st));
+
+	return (FIDO_OK);
+}
+
+size_t
+fido_dev_stats_cmd_len(const fido_dev_stats_t *st)
+{
+	return (st->ncmd);
+}
+
+uint8_t
+fido_dev_stats_cmd_ctaphid(const fido_dev_stats_t *st, size_t idx)
+{
+	if (idx >= st->ncmd)
+		return (0);
+
+	return (st->cmd[idx].ctaphid);
+}
+
+uint8_t
+fido_dev_stats_cmd_cbor(const fido_dev_stats_t *st, size_t idx)
+{
+	if (idx >= st->ncmd)
+		return (0);
+
+	return (st->cmd[idx].cbor);
+}
+
+uint64_t
+fido_dev_stats_counter(const fido_dev_stats_t *st, int which)
+{
+	if (which < 0 || which >= FIDO_STATS_NCOUNTERS)
+		return (0);
+
+	return (st->counter[which]);
+}
+
+uint64_t
+fido_dev_stats_rtt(const fido_dev_stats_t *st, size_t idx, size_t bucket)
+{
+	if (idx >= st->ncmd || bucket >= FIDO_STATS_NBUCKETS)
+		return (0);
+
+	return (st->cmd[idx].rtt[bucket]);
+}
+
+uint64_t
+fido_dev_stats_up_wait(const fido_dev_stats_t *st, size_t bucket)
+{
+	if (bucket >= FIDO_STATS_NBUCKETS)
+		return (0);
+
+	return (st->up_wait[bucket]);
+}
@@ -0,0 +1,529 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include <openssl/hmac.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "fido.h"
+#include "fido/verify.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/*
+ * A file of credential records, indexed by credential id. All integers
+ * are big-endian.
+ *
+ *	magic[4] version[1] reserved[3] nrec[4] nbucket[4] seed[16]
+ *	bucket[nbucket * 4]	record number + 1, or zero if empty
+ *	off[nrec * 8]		offset of each record in the file
+ *	records, back to back
+ *
+ * The index is an open-addressing hash table with linear probing,
+ * keyed by an HMAC of the credential id under the file's random seed.
+ * A file is never modified once written: fido_cred_store_write()
+ * writes a new one next to it and renames it into place, so that
+ * readers can keep using the file they have open, without locking.
+ */
+
+#define STORE_MAGIC	"F2CS"
+#define STORE_VERSION	1
+#define STORE_HDRLEN	32
+#define STORE_SEEDLEN	16
+#define STORE_MAXREC	(1UL << 30)
+
+struct fido_cred_store {
+	const unsigned char	*map;     /* file contents */
+	size_t			 maplen;  /* length of map */
+	bool			 mapped;  /* map was mmap()ed */
+	const unsigned char	*seed;    /* hash seed, in map */
+	const unsigned char	*bucket;  /* hash table, in map */
+	const unsigned char	*off;     /* record offsets, in map */
+	size_t			 nbucket; /* entries in bucket, a power of 2 */
+	size_t			 nrec;    /* entries in off */
+};
+
+struct store_ent {
+	const unsigned char	*ptr;    /* record */
+	size_t			 len;    /* length of record */
+	const unsigned char	*id;     /* credential id, in ptr */
+	size_t			 id_len; /* length of id */
+	uint32_t		 n;      /* record number + 1; 0 if replaced */
+};
+
+static uint32_t
+get_be32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	    (uint32_t)p[2] << 8 | (uint32_t)p[3]);
+}
+
+static uint64_t
+get_be64(const unsigned char *p)
+{
+	return ((uint64_t)get_be32(p) << 32 | (uint64_t)get_be32(p + 4));
+}
+
+static void
+put_be32(unsigned char *p, uint32_t v)
+{
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+
+static void
+put_be64(unsigned char *p, uint64_t v)
+{
+	put_be32(p, (uint32_t)(v >> 32));
+	put_be32(p + 4, (uint32_t)v);
+}
+
+/* first bucket of id in a table of nbucket entries */
+static int
+store_hash(const unsigned char *seed, const unsigned char *id, size_t id_len,
+    size_t nbucket, size_t *h)
+{
+	const EVP_MD	*md;
+	unsigned char	 dgst[EVP_MAX_MD_SIZE];
+	unsigned int	 dgst_len;
+
+	if ((md = fido_evp_sha256()) == NULL || HMAC(md, seed, STORE_SEEDLEN,
+	    id, id_len, dgst, &dgst_len) == NULL || dgst_len < 4) {
+		fido_log_debug("%s: hmac", __func__);
+		return (-1);
+	}
+	*h = (size_t)get_be32(dgst) & (nbucket - 1);
+
+	return (0);
+}
+
+fido_cred_store_t *
+fido_cred_store_new(void)
+{
+	return (fido_calloc(1, sizeof(fido_cred_store_t)));
+}
+
+#ifdef HAVE_SYS_MMAN_H
+static int
+store_map(const char *path, const unsigned char **map, size_t *maplen,
+    bool *mapped)
+{
+	struct stat	 st;
+	void		*p;
+	int		 fd;
+	int		 ok = -1;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+		fido_log_error(errno, "%s: open %s", __func__, path);
+		return (-1);
+	}
+	if (fstat(fd, &st) == -1) {
+		fido_log_error(errno, "%s: fstat", __func__);
+		goto fail;
+	}
+	if (st.st_size < STORE_HDRLEN || (uintmax_t)st.st_size > SIZE_MAX) {
+		fido_log_debug("%s: st_size=%jd", __func__,
+		    (intmax_t)st.st_size);
+		goto fail;
+	}
+	if ((p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd,
+	    0)) == MAP_FAILED) {
+		fido_log_error(errno, "%s: mmap", __func__);
+		goto fail;
+	}
+
+	*map = p;
+	*maplen = (size_t)st.st_size;
+	*mapped = true;
+
+	ok = 0;
+fail:
+	close(fd);
+
+	return (ok);
+}
+#else
+/* without mmap(), the file is read into memory */
+static int
+store_map(const char *path, const unsigned char **map, size_t *maplen,
+    bool *mapped)
+{
+	FILE		*fp;
+	unsigned char	*buf = NULL;
+	long		 len;
+	int		 ok = -1;
+
+	if ((fp = fopen(path, "rb")) == NULL) {
+		fido_log_error(errno, "%s: fopen %s", __func__, path);
+		return (-1);
+	}
+	if (fseek(fp, 0, SEEK_END) != 0 || (len = ftell(fp)) < STORE_HDRLEN ||
+	    (unsigned long)len > SIZE_MAX || fseek(fp, 0, SEEK_SET) != 0) {
+		fido_log_debug("%s: size", __func__);
+		goto fail;
+	}
+	if ((buf = fido_malloc((size_t)len)) == NULL ||
+	    fread(buf, 1, (size_t)len, fp) != (size_t)len) {
+		fido_log_debug("%s: fread", __func__);
+		goto fail;
+	}
+
+	*map = buf;
+	*maplen = (size_t)len;
+	*mapped = false;
+	buf = NULL;
+
+	ok = 0;
+fail:
+	fclose(fp);
+	fido_free(buf);
+
+	return (ok);
+}
+#endif /* HAVE_SYS_MMAN_H */
+
+static void
+store_reset(fido_cred_store_t *store)
+{
+#ifdef HAVE_SYS_MMAN_H
+	if (store->mapped)
+		munmap((void *)(uintptr_t)store->map, store->maplen);
+	else
+#endif
+		fido_free((void *)(uintptr_t)store->map);
+	memset(store, 0, sizeof(*store));
+}
+
+void
+fido_cred_store_free(fido_cred_store_t **store_p)
+{
+	fido_cred_store_t *store;
+
+	if (store_p == NULL || (store = *store_p) == NULL)
+		return;
+	store_reset(store);
+	fido_free(store);
+	*store_p = NULL;
+}
+
+int
+fido_cred_store_open(fido_cred_store_t *store, const char *path)
+{
+	fido_cred_store_t	s;
+	const unsigned char	*p;
+	size_t			 avail;
+
+	memset(&s, 0, sizeof(s));
+
+	if (path == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if (store_map(path, &s.map, &s.maplen, &s.mapped) < 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	p = s.map;
+	s.nrec = get_be32(p + 8);
+	s.nbucket = get_be32(p + 12);
+	s.seed = p + 16;
+	avail = s.maplen - STORE_HDRLEN;
+
+	if (memcmp(p, STORE_MAGIC, 4) != 0 || p[4] != STORE_VERSION ||
+	    s.nbucket == 0 || (s.nbucket & (s.nbucket - 1)) != 0 ||
+	    s.nrec >= s.nbucket || s.nbucket > avail / 4 ||
+	    s.nrec > (avail - s.nbucket * 4) / 8) {
+		fido_log_debug("%s: invalid header", __func__);
+		store_reset(&s);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+	s.bucket = p + STORE_HDRLEN;
+	s.off = s.bucket + s.nbucket * 4;
+
+	store_reset(store);
+	*store = s;
+
+	return (FIDO_OK);
+}
+
+size_t
+fido_cred_store_len(const fido_cred_store_t *store)
+{
+	return (store->nrec);
+}
+
+int
+fido_cred_store_get(const fido_cred_store_t *store, size_t idx,
+    const unsigned char **ptr, size_t *len)
+{
+	uint64_t start, end;
+
+	if (idx >= store->nrec)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	start = get_be64(store->off + idx * 8);
+	end = idx + 1 < store->nrec ? get_be64(store->off + idx * 8 + 8) :
+	    store->maplen;
+	if (start < (uint64_t)(store->off + store->nrec * 8 - store->map) ||
+	    start > end || end > store->maplen) {
+		fido_log_debug("%s: idx=%zu, start=%llu, end=%llu", __func__,
+		    idx, (unsigned long long)start, (unsigned long long)end);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	*ptr = store->map + start;
+	*len = (size_t)(end - start);
+
+	return (FIDO_OK);
+}
+
+int
+fido_cred_store_lookup(const fido_cred_store_t *store,
+    const unsigned char *id, size_t id_len, const unsigned char **ptr,
+    size_t *len)
+{
+	const unsigned char	*rec_id;
+	size_t			 rec_id_len, h;
+	uint32_t		 n;
+	int			 type;
+	int			 r;
+
+	if (id == NULL || id_len == 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if (store->nbucket == 0)
+		return (FIDO_ERR_NOTFOUND);
+	if (store_hash(store->seed, id, id_len, store->nbucket, &h) < 0)
+		return (FIDO_ERR_INTERNAL);
+
+	for (size_t i = 0; i < store->nbucket; i++) {
+		if ((n = get_be32(store->bucket + h * 4)) == 0)
+			break;
+		if ((r = fido_cred_store_get(store, n - 1, ptr,
+		    len)) != FIDO_OK)
+			return (r);
+		if ((r = fido_cred_record_parse(*ptr, *len, &type, &rec_id,
+		    &rec_id_len)) != FIDO_OK)
+			return (r);
+		if (rec_id_len == id_len && memcmp(rec_id, id, id_len) == 0)
+			return (FIDO_OK);
+		h = (h + 1) & (store->nbucket - 1);
+	}
+
+	*ptr = NULL;
+	*len = 0;
+
+	return (FIDO_ERR_NOTFOUND);
+}
+
+/* add ent to a table of nbucket entries, replacing any with the same id */
+static int
+store_insert(struct store_ent *ent, size_t i, uint32_t *bucket,
+    size_t nbucket, const unsigned char *seed)
+{
+	struct store_ent	*old;
+	size_t			 h;
+
+	if (store_hash(seed, ent[i].id, ent[i].id_len, nbucket, &h) < 0)
+		return (-1);
+
+	for (; bucket[h] != 0; h = (h + 1) & (nbucket - 1)) {
+		old = &ent[bucket[h] - 1];
+		if (old->id_len == ent[i].id_len &&
+		    memcmp(old->id, ent[i].id, ent[i].id_len) == 0) {
+			old->n = 0;
+			break;
+		}
+	}
+	bucket[h] = (uint32_t)i + 1;
+	ent[i].n = (uint32_t)i + 1;
+
+	return (0);
+}
+
+static int
+store_ent_set(struct store_ent *ent, const unsigned char *ptr, size_t len)
+{
+	int type;
+	int r;
+
+	if ((r = fido_cred_record_parse(ptr, len, &type, &ent->id,
+	    &ent->id_len)) != FIDO_OK)
+		return (r);
+	ent->ptr = ptr;
+	ent->len = len;
+
+	return (FIDO_OK);
+}
+
+static int
+store_emit(FILE *fp, const struct store_ent *ent, size_t nent,
+    const uint32_t *bucket, size_t nbucket, size_t nrec,
+    const unsigned char *seed)
+{
+	unsigned char	hdr[STORE_HDRLEN];
+	unsigned char	buf[8];
+	uint64_t	off;
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, STORE_MAGIC, 4);
+	hdr[4] = STORE_VERSION;
+	put_be32(hdr + 8, (uint32_t)nrec);
+	put_be32(hdr + 12, (uint32_t)nbucket);
+	memcpy(hdr + 16, seed, STORE_SEEDLEN);
+	if (fwrite(hdr, 1, sizeof(hdr), fp) != sizeof(hdr))
+		return (-1);
+
+	for (size_t i = 0; i < nbucket; i++) {
+		put_be32(buf, bucket[i] ? ent[bucket[i] - 1].n : 0);
+		if (fwrite(buf, 1, 4, fp) != 4)
+			return (-1);
+	}
+
+	off = STORE_HDRLEN + (uint64_t)nbucket * 4 + (uint64_t)nrec * 8;
+	for (size_t i = 0; i < nent; i++) {
+		if (ent[i].n == 0)
+			continue;
+		put_be64(buf, off);
+		if (fwrite(buf, 1, 8, fp) != 8)
+			return (-1);
+		off += ent[i].len;
+	}
+
+	for (size_t i = 0; i < nent; i++)
+		if (ent[i].n != 0 &&
+		    fwrite(ent[i].ptr, 1, ent[i].len, fp) != ent[i].len)
+			return (-1);
+
+	return (0);
+}
+
+static int
+store_rename(const char *from, const char *to)
+{
+#ifdef _WIN32
+	if (MoveFileExA(from, to, MOVEFILE_REPLACE_EXISTING) == 0) {
+		fido_log_debug("%s: MoveFileExA", __func__);
+		return (-1);
+	}
+#else
+	if (rename(from, to) == -1) {
+		fido_log_error(errno, "%s: rename", __func__);
+		return (-1);
+	}
+#endif
+
+	return (0);
+}
+
+int
+fido_cred_store_write(const char *path, const fido_cred_store_t *base,
+    const unsigned char *const *rec, const size_t *rec_len, size_t n)
+{
+	struct store_ent	*ent = NULL;
+	uint32_t		*bucket = NULL;
+	const unsigned char	*ptr;
+	unsigned char		 seed[STORE_SEEDLEN];
+	char			*tmp = NULL;
+	FILE			*fp = NULL;
+	size_t			 len, nent, nbucket, nrec;
+	int			 r;
+
+	if (path == NULL || (n > 0 && (rec == NULL || rec_len == NULL)))
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	nent = base != NULL ? base->nrec : 0;
+	if (n > STORE_MAXREC || nent > STORE_MAXREC - n) {
+		fido_log_debug("%s: nent=%zu, n=%zu", __func__, nent, n);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+	for (nbucket = 8; nbucket < (nent + n) * 2; nbucket *= 2)
+		continue;
+
+	if ((ent = fido_calloc(nent + n, sizeof(*ent))) == NULL ||
+	    (bucket = fido_calloc(nbucket, sizeof(*bucket))) == NULL ||
+	    fido_get_random(seed, sizeof(seed)) < 0 ||
+	    fido_asprintf(&tmp, "%s.tmp", path) == -1) {
+		tmp = NULL;
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	/* later records replace earlier ones with the same id */
+	for (size_t i = 0; i < nent + n; i++) {
+		if (i >= nent) {
+			ptr = rec[i - nent];
+			len = rec_len[i - nent];
+		} else if ((r = fido_cred_store_get(base, i, &ptr,
+		    &len)) != FIDO_OK)
+			goto fail;
+		if ((r = store_ent_set(&ent[i], ptr, len)) != FIDO_OK) {
+			fido_log_debug("%s: record %zu", __func__, i);
+			goto fail;
+		}
+		if (store_insert(ent, i, bucket, nbucket, seed) < 0) {
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+	}
+
+	/* number the records that are left */
+	nrec = 0;
+	for (size_t i = 0; i < nent + n; i++)
+		if (ent[i].n != 0)
+			ent[i].n = (uint32_t)++nrec;
+
+	if ((fp = fopen(tmp, "wb")) == NULL) {
+		fido_log_error(errno, "%s: fopen %s", __func__, tmp);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+	if (store_emit(fp, ent, nent + n, bucket, nbucket, nrec, seed) < 0 ||
+	    fflush(fp) != 0
+#ifndef _WIN32
+	    || fsync(fileno(fp)) == -1
+#endif
+	    ) {
+		fido_log_error(errno, "%s: write %s", __func__, tmp);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+	if (fclose(fp) != 0) {
+		fp = NULL;
+		fido_log_error(errno, "%s: fclose %s", __func__, tmp);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+	fp = NULL;
+	if (store_rename(tmp, path) < 0) {
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	r = FIDO_OK;
+fail:
+	if (fp != NULL)
+		fclose(fp);
+	if (r != FIDO_OK && tmp != NULL)
+		(void)remove(tmp);
+	fido_free(tmp);
+	fido_free(bucket);
+	fido_free(ent);
+
+	return (r);
+}
@@ -8,6 +8,17 @@
 #include <errno.h>
 #include "fido.h"
 
+/*
+ * Deadlines only need millisecond precision; where the platform has a
+ * coarse monotonic clock, which is read without a system call even on
+ * hosts whose clock source is not accelerated, use it for them.
+ */
+#ifdef CLOCK_MONOTONIC_COARSE
+#define DEADLINE_CLOCK	CLOCK_MONOTONIC_COARSE
+#else
+#define DEADLINE_CLOCK	CLOCK_MONOTONIC
+#endif
+
 static int
 timespec_to_ms(const struct timespec *ts)
 {
@@ -66,10 +77,77 @@ fido_time_delta(const struct timespec *ts_start, int *ms_remain)
 		return -1;
 	}
 
-	if (ms > *ms_remain)
+	if (ms >= *ms_remain) {
+		if (*ms_remain > 0)
+			fido_trace(NULL, FIDO_TRACE_TIMEOUT, 0, 0, ms);
 		ms = *ms_remain;
+	}
 
 	*ms_remain -= ms;
 
 	return 0;
 }
+
+/*
+ * Set dl to ms milliseconds from now; if ms is negative, dl is none and
+ * the clock is not read.
+ */
+int
+fido_time_deadline(struct timespec *dl, int ms)
+{
+	struct timespec ts;
+
+	if (ms < 0) {
+		dl->tv_sec = -1;
+		dl->tv_nsec = 0;
+		return 0;
+	}
+
+	if (clock_gettime(DEADLINE_CLOCK, dl) != 0) {
+		fido_log_error(errno, "%s: clock_gettime", __func__);
+		return -1;
+	}
+
+	ts.tv_sec = ms / 1000;
+	ts.tv_nsec = (ms % 1000) * 1000000L;
+	timespecadd(dl, &ts, dl);
+
+	return 0;
+}
+
+/*
+ * Store the time left before dl, in milliseconds, in *ms: 0 if dl has
+ * passed, -1 if dl is none.
+ */
+int
+fido_time_left(const struct timespec *dl, int *ms)
+{
+	struct timespec ts_now, ts_left;
+
+	if (dl->tv_sec < 0) {
+		*ms = -1;
+		return 0;
+	}
+
+	if (clock_gettime(DEADLINE_CLOCK, &ts_now) != 0) {
+		fido_log_error(errno, "%s: clock_gettime", __func__);
+		return -1;
+	}
+
+	if (timespeccmp(&ts_now, dl, >=)) {
+		*ms = 0;
+		return 0;
+	}
+
+	timespecsub(dl, &ts_now, &ts_left);
+
+	/* round up, so that a read is never given 0 before dl */
+	if ((*ms = timespec_to_ms(&ts_left)) < 0) {
+		fido_log_debug("%s: timespec_to_ms", __func__);
+		return -1;
+	}
+	if (ts_left.tv_nsec % 1000000 != 0 && *ms < INT_MAX)
+		(*ms)++;
+
+	return 0;
+}
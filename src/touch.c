@@ -5,38 +5,41 @@
  * SPDX-License-Identifier: BSD-2-Clause
  */
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <poll.h>
+#endif
+
 #include <openssl/sha.h>
+
 #include "fido.h"
 
-int
-fido_dev_get_touch_begin(fido_dev_t *dev)
+/* a makeCredential nobody will use; its encoding is kept in dev */
+static int
+touch_req_encode(const fido_dev_t *dev, fido_blob_t *f)
 {
-	fido_blob_t	 f;
 	cbor_item_t	*argv[9];
 	const char	*clientdata = FIDO_DUMMY_CLIENTDATA;
 	const uint8_t	 user_id = FIDO_DUMMY_USER_ID;
 	unsigned char	 cdh[SHA256_DIGEST_LENGTH];
 	fido_rp_t	 rp;
 	fido_user_t	 user;
-	int		 ms = dev->timeout_ms;
 	int		 r = FIDO_ERR_INTERNAL;
 
-	memset(&f, 0, sizeof(f));
 	memset(argv, 0, sizeof(argv));
 	memset(cdh, 0, sizeof(cdh));
 	memset(&rp, 0, sizeof(rp));
 	memset(&user, 0, sizeof(user));
 
-	if (fido_dev_is_fido2(dev) == false)
-		return (u2f_get_touch_begin(dev, &ms));
-
 	if (SHA256((const void *)clientdata, strlen(clientdata), cdh) != cdh) {
 		fido_log_debug("%s: sha256", __func__);
 		return (FIDO_ERR_INTERNAL);
 	}
 
-	if ((rp.id = strdup(FIDO_DUMMY_RP_ID)) == NULL ||
-	    (user.name = strdup(FIDO_DUMMY_USER_NAME)) == NULL) {
+	if ((rp.id = fido_strdup(FIDO_DUMMY_RP_ID)) == NULL ||
+	    (user.name = fido_strdup(FIDO_DUMMY_USER_NAME)) == NULL) {
 		fido_log_debug("%s: strdup", __func__);
 		goto fail;
 	}
@@ -62,24 +65,59 @@ fido_dev_get_touch_begin(fido_dev_t *dev)
 		}
 	}
 
-	if (cbor_build_frame(CTAP_CBOR_MAKECRED, argv, nitems(argv), &f) < 0 ||
-	    fido_tx(dev, CTAP_CMD_CBOR, f.ptr, f.len, &ms) < 0) {
-		fido_log_debug("%s: fido_tx", __func__);
-		r = FIDO_ERR_TX;
+	if (cbor_build_frame(CTAP_CBOR_MAKECRED, argv, nitems(argv), f) < 0) {
+		fido_log_debug("%s: cbor_build_frame", __func__);
 		goto fail;
 	}
 
 	r = FIDO_OK;
 fail:
 	cbor_vector_free(argv, nitems(argv));
-	free(f.ptr);
-	free(rp.id);
-	free(user.name);
-	free(user.id.ptr);
+	fido_free(rp.id);
+	fido_free(user.name);
+	fido_free(user.id.ptr);
 
 	return (r);
 }
 
+/*
+ * CTAP 2.1 authenticators have a command for the purpose; older ones
+ * are sent a dummy makeCredential, encoded once per device.
+ */
+int
+fido_dev_get_touch_begin(fido_dev_t *dev)
+{
+	const unsigned char	 selection[] = { CTAP_CBOR_SELECTION };
+	int			 ms = dev->timeout_ms;
+	int			 r;
+
+	if (fido_dev_is_fido2(dev) == false)
+		return (u2f_get_touch_begin(dev, &ms));
+
+	if (dev->flags & FIDO_DEV_SELECTION) {
+		if (fido_tx(dev, CTAP_CMD_CBOR, selection, sizeof(selection),
+		    &ms) < 0) {
+			fido_log_debug("%s: fido_tx", __func__);
+			return (FIDO_ERR_TX);
+		}
+		return (FIDO_OK);
+	}
+
+	if (fido_blob_is_empty(&dev->touch_req) &&
+	    (r = touch_req_encode(dev, &dev->touch_req)) != FIDO_OK) {
+		fido_log_debug("%s: touch_req_encode", __func__);
+		return (r);
+	}
+
+	if (fido_tx(dev, CTAP_CMD_CBOR, dev->touch_req.ptr, dev->touch_req.len,
+	    &ms) < 0) {
+		fido_log_debug("%s: fido_tx", __func__);
+		return (FIDO_ERR_TX);
+	}
+
+	return (FIDO_OK);
+}
+
 int
 fido_dev_get_touch_status(fido_dev_t *dev, int *touched, int ms)
 {
@@ -107,3 +145,179 @@ fido_dev_get_touch_status(fido_dev_t *dev, int *touched, int ms)
 
 	return (FIDO_OK);
 }
+
+#define SELECT_TICK_MS	20 /* how often to step devices without an fd */
+
+#ifdef _WIN32
+typedef struct select_pollfd {
+	int   fd;
+	short events;
+	short revents;
+} select_pollfd_t;
+#ifndef POLLIN
+#define POLLIN	0x0100
+#endif
+#else
+typedef struct pollfd select_pollfd_t;
+#endif
+
+static int
+select_wait(select_pollfd_t *pfd, size_t n, int ms)
+{
+	for (size_t i = 0; i < n; i++)
+		pfd[i].revents = 0;
+#ifdef _WIN32
+	/* no pollable descriptors; devices are stepped every tick */
+	if (ms > 0)
+		Sleep((DWORD)ms);
+
+	return (0);
+#else
+	if (poll(pfd, (nfds_t)n, ms) == -1 && errno != EINTR) {
+		fido_log_error(errno, "%s: poll", __func__);
+		return (-1);
+	}
+
+	return (0);
+#endif
+}
+
+static int
+min_ms(int a, int b)
+{
+	if (a < 0)
+		return (b);
+	if (b < 0)
+		return (a);
+
+	return (a < b ? a : b);
+}
+
+/*
+ * Touch requests are sent to every device at once, and their replies
+ * awaited together: on the devices' descriptors, when they have one,
+ * and on a timer otherwise. U2F devices, whose request is answered at
+ * once and must be repeated, are looked at on the schedule of their
+ * backoff.
+ */
+int
+fido_dev_select(fido_dev_t *const *dev, size_t ndev, int ms, size_t *idx)
+{
+	select_pollfd_t	*pfd = NULL;
+	struct timespec	*due = NULL;
+	struct timespec	 dl;
+	bool		*on = NULL;
+	size_t		 non = 0;
+	int		 touched = 0;
+	int		 wait_ms, left;
+	int		 r, last = FIDO_ERR_INVALID_ARGUMENT;
+
+	if (dev == NULL || ndev == 0 || ndev > UINT_MAX || idx == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	*idx = 0;
+
+	if ((pfd = fido_calloc(ndev, sizeof(*pfd))) == NULL ||
+	    (due = fido_calloc(ndev, sizeof(*due))) == NULL ||
+	    (on = fido_calloc(ndev, sizeof(*on))) == NULL ||
+	    fido_time_deadline(&dl, ms) != 0) {
+		r = FIDO_ERR_INTERNAL;
+		goto out;
+	}
+
+	for (size_t i = 0; i < ndev; i++) {
+		if (dev[i] == NULL)
+			continue;
+		if ((r = fido_dev_get_touch_begin(dev[i])) != FIDO_OK ||
+		    (!fido_dev_is_fido2(dev[i]) && fido_time_deadline(&due[i],
+		    u2f_get_touch_pace(dev[i])) != 0)) {
+			fido_log_debug("%s: fido_dev_get_touch_begin %zu",
+			    __func__, i);
+			last = r;
+			continue;
+		}
+		on[i] = true;
+		non++;
+	}
+
+	while (non > 0) {
+		wait_ms = -1;
+		for (size_t i = 0; i < ndev; i++) {
+			memset(&pfd[i], 0, sizeof(pfd[i]));
+			pfd[i].fd = -1;
+			pfd[i].events = POLLIN;
+			if (!on[i])
+				continue;
+			if (!fido_dev_is_fido2(dev[i])) {
+				if (fido_time_left(&due[i], &left) != 0) {
+					r = FIDO_ERR_INTERNAL;
+					goto out;
+				}
+				wait_ms = min_ms(wait_ms, left);
+			} else if ((pfd[i].fd = fido_dev_poll_fd(dev[i])) == -1)
+				wait_ms = min_ms(wait_ms, SELECT_TICK_MS);
+			else if (fido_dev_rx_pending(dev[i])) {
+				/* already read ahead; step without polling */
+				pfd[i].fd = -1;
+				wait_ms = 0;
+			}
+		}
+
+		if (fido_time_left(&dl, &left) != 0 ||
+		    select_wait(pfd, ndev, min_ms(wait_ms, left)) < 0) {
+			r = FIDO_ERR_INTERNAL;
+			goto out;
+		}
+
+		for (size_t i = 0; i < ndev; i++) {
+			if (!on[i] || (pfd[i].fd != -1 && pfd[i].revents == 0))
+				continue;
+			if (!fido_dev_is_fido2(dev[i]) &&
+			    (fido_time_left(&due[i], &left) != 0 || left > 0))
+				continue;
+			if ((r = fido_dev_get_touch_status(dev[i], &touched,
+			    0)) != FIDO_OK) {
+				fido_log_debug("%s: fido_dev_get_touch_status "
+				    "%zu", __func__, i);
+				last = r;
+				on[i] = false;
+				non--;
+				continue;
+			}
+			if (touched) {
+				*idx = i;
+				on[i] = false;
+				r = FIDO_OK;
+				goto out;
+			}
+			if (!fido_dev_is_fido2(dev[i]) &&
+			    fido_time_deadline(&due[i],
+			    u2f_get_touch_pace(dev[i])) != 0) {
+				r = FIDO_ERR_INTERNAL;
+				goto out;
+			}
+		}
+
+		if (fido_time_left(&dl, &left) != 0) {
+			r = FIDO_ERR_INTERNAL;
+			goto out;
+		}
+		if (left == 0 && non > 0) {
+			r = FIDO_ERR_TIMEOUT;
+			goto out;
+		}
+	}
+
+	r = last;
+out:
+	/* the requests still pending */
+	for (size_t i = 0; on != NULL && i < ndev; i++)
+		if (on[i])
+			fido_dev_cancel(dev[i]);
+
+	fido_free(pfd);
+	fido_free(due);
+	fido_free(on);
+
+	return (r);
+}
@@ -12,7 +12,6 @@
 
 #include <openssl/sha.h>
 
-#include "packed.h"
 #include "fido.h"
 
 /* Part 1, 4.89: TPM_GENERATED_VALUE */
@@ -38,126 +37,93 @@
 #define TPMA_SENSITIVE	0x00000020	/* data originates within tpm */
 #define TPMA_SIGN	0x00040000	/* object may sign */
 
-/* Part 2, 10.4.2: TPM2B_DIGEST */
-PACKED_TYPE(tpm_sha256_digest_t,
-struct tpm_sha256_digest {
-	uint16_t size; /* sizeof(body) */
-	uint8_t  body[32];
-})
-
-/* Part 2, 10.4.3: TPM2B_DATA */
-PACKED_TYPE(tpm_sha1_data_t,
-struct tpm_sha1_data {
-	uint16_t size; /* sizeof(body */
-	uint8_t  body[20];
-})
-
-/* Part 2, 10.5.3: TPM2B_NAME */
-PACKED_TYPE(tpm_sha256_name_t,
-struct tpm_sha256_name {
-	uint16_t size; /* sizeof(alg) + sizeof(body) */
-	uint16_t alg;  /* TPM_ALG_SHA256 */
-	uint8_t  body[32];
-})
-
-/* Part 2, 10.11.1: TPMS_CLOCK_INFO */
-PACKED_TYPE(tpm_clock_info_t,
-struct tpm_clock_info {
-	uint64_t timestamp_ms;
-	uint32_t reset_count;   /* obfuscated by tpm */
-	uint32_t restart_count; /* obfuscated by tpm */
-	uint8_t  safe;          /* 1 if timestamp_ms is current */
-})
-
-/* Part 2, 10.12.8 TPMS_ATTEST */
-PACKED_TYPE(tpm_sha1_attest_t,
-struct tpm_sha1_attest {
-	uint32_t          magic;     /* TPM_MAGIC */
-	uint16_t          type;      /* TPM_ST_ATTEST_CERTIFY */
-	tpm_sha256_name_t signer;    /* full tpm path of signing key */
-	tpm_sha1_data_t   data;      /* signed sha1 */
-	tpm_clock_info_t  clock;
-	uint64_t          fwversion; /* obfuscated by tpm */
-	tpm_sha256_name_t name;      /* sha256 of tpm_rs256_pubarea_t */
-	tpm_sha256_name_t qual_name; /* full tpm path of attested key */
-})
-
-/* Part 2, 11.2.4.5: TPM2B_PUBLIC_KEY_RSA */
-PACKED_TYPE(tpm_rs256_key_t,
-struct tpm_rs256_key {
-	uint16_t size; /* sizeof(body) */
-	uint8_t  body[256];
-})
-
-/* Part 2, 11.2.5.1: TPM2B_ECC_PARAMETER */
-PACKED_TYPE(tpm_es256_coord_t,
-struct tpm_es256_coord {
-	uint16_t size; /* sizeof(body) */
-	uint8_t  body[32];
-})
-
-/* Part 2, 11.2.5.2: TPMS_ECC_POINT */
-PACKED_TYPE(tpm_es256_point_t,
-struct tpm_es256_point {
-	tpm_es256_coord_t x;
-	tpm_es256_coord_t y;
-})
-
-/* Part 2, 12.2.3.5: TPMS_RSA_PARMS */
-PACKED_TYPE(tpm_rs256_param_t,
-struct tpm_rs256_param {
-	uint16_t symmetric; /* TPM_ALG_NULL */
-	uint16_t scheme;    /* TPM_ALG_NULL */
-	uint16_t keybits;   /* 2048 */
-	uint32_t exponent;  /* zero (meaning 2^16 + 1) */
-})
-
-/* Part 2, 12.2.3.6: TPMS_ECC_PARMS */
-PACKED_TYPE(tpm_es256_param_t,
-struct tpm_es256_param {
-	uint16_t symmetric; /* TPM_ALG_NULL */
-	uint16_t scheme;    /* TPM_ALG_NULL */
-	uint16_t curve_id;  /* TPM_ECC_P256 */
-	uint16_t kdf;       /* TPM_ALG_NULL */
-})
-
-/* Part 2, 12.2.4: TPMT_PUBLIC */
-PACKED_TYPE(tpm_rs256_pubarea_t,
-struct tpm_rs256_pubarea {
-	uint16_t            alg;    /* TPM_ALG_RSA */
-	uint16_t            hash;   /* TPM_ALG_SHA256 */
-	uint32_t            attr;
-	tpm_sha256_digest_t policy; /* must be present? */
-	tpm_rs256_param_t   param;
-	tpm_rs256_key_t     key;
-})
-
-/* Part 2, 12.2.4: TPMT_PUBLIC */
-PACKED_TYPE(tpm_es256_pubarea_t,
-struct tpm_es256_pubarea {
-	uint16_t            alg;    /* TPM_ALG_ECC */
-	uint16_t            hash;   /* TPM_ALG_SHA256 */
-	uint32_t            attr;
-	tpm_sha256_digest_t policy; /* must be present? */
-	tpm_es256_param_t   param;
-	tpm_es256_point_t   point;
-})
+/*
+ * pubArea and certInfo are validated where they lie, reading each
+ * big-endian field in turn; nothing is copied or byte-swapped.
+ */
+struct tpm_reader {
+	const unsigned char	*p;
+	size_t			 len;
+	bool			 bad;    /* a check failed */
+};
+
+static void
+tpm_reader_init(struct tpm_reader *r, const fido_blob_t *buf)
+{
+	r->p = buf->ptr;
+	r->len = buf->len;
+	r->bad = buf->ptr == NULL;
+}
+
+static const unsigned char *
+tpm_skip(struct tpm_reader *r, size_t n)
+{
+	const unsigned char *p = r->p;
+
+	if (r->bad || r->len < n) {
+		r->bad = true;
+		return NULL;
+	}
+	r->p += n;
+	r->len -= n;
+
+	return p;
+}
+
+static uint32_t
+tpm_get(struct tpm_reader *r, size_t n)
+{
+	const unsigned char	*p;
+	uint32_t		 v = 0;
+
+	if ((p = tpm_skip(r, n)) == NULL)
+		return 0;
+	for (size_t i = 0; i < n; i++)
+		v = v << 8 | p[i];
+
+	return v;
+}
+
+/* an n-byte field, which must equal v */
+static void
+tpm_expect(struct tpm_reader *r, size_t n, uint32_t v)
+{
+	if (tpm_get(r, n) != v)
+		r->bad = true;
+}
+
+/* a TPM2B of len bytes, which must equal body */
+static void
+tpm_expect_2b(struct tpm_reader *r, const void *body, size_t len)
+{
+	const unsigned char *p;
+
+	tpm_expect(r, 2, (uint32_t)len);
+	if ((p = tpm_skip(r, len)) != NULL && timingsafe_bcmp(p, body,
+	    len) != 0)
+		r->bad = true;
+}
+
+static int
+tpm_end(const struct tpm_reader *r)
+{
+	return (r->bad || r->len != 0) ? -1 : 0;
+}
 
 static int
-get_signed_sha1(tpm_sha1_data_t *dgst, const fido_blob_t *authdata,
+get_signed_sha1(unsigned char *dgst, const fido_blob_t *authdata,
     const fido_blob_t *clientdata)
 {
 	const EVP_MD	*md = NULL;
 	EVP_MD_CTX	*ctx = NULL;
 	int		 ok = -1;
 
-	if ((dgst->size = sizeof(dgst->body)) != SHA_DIGEST_LENGTH ||
-	    (md = EVP_sha1()) == NULL ||
+	if ((md = fido_evp_sha1()) == NULL ||
 	    (ctx = EVP_MD_CTX_new()) == NULL ||
 	    EVP_DigestInit_ex(ctx, md, NULL) != 1 ||
 	    EVP_DigestUpdate(ctx, authdata->ptr, authdata->len) != 1 ||
 	    EVP_DigestUpdate(ctx, clientdata->ptr, clientdata->len) != 1 ||
-	    EVP_DigestFinal_ex(ctx, dgst->body, NULL) != 1) {
+	    EVP_DigestFinal_ex(ctx, dgst, NULL) != 1) {
 		fido_log_debug("%s: sha1", __func__);
 		goto fail;
 	}
@@ -169,176 +135,121 @@ fail:
 	return (ok);
 }
 
-static int
-get_signed_name(tpm_sha256_name_t *name, const fido_blob_t *pubarea)
-{
-	name->alg = TPM_ALG_SHA256;
-	name->size = sizeof(name->alg) + sizeof(name->body);
-	if (sizeof(name->body) != SHA256_DIGEST_LENGTH ||
-	    SHA256(pubarea->ptr, pubarea->len, name->body) != name->body) {
-		fido_log_debug("%s: sha256", __func__);
-		return -1;
-	}
-
-	return 0;
-}
-
-static void
-bswap_rs256_pubarea(tpm_rs256_pubarea_t *x)
-{
-	x->alg = htobe16(x->alg);
-	x->hash = htobe16(x->hash);
-	x->attr = htobe32(x->attr);
-	x->policy.size = htobe16(x->policy.size);
-	x->param.symmetric = htobe16(x->param.symmetric);
-	x->param.scheme = htobe16(x->param.scheme);
-	x->param.keybits = htobe16(x->param.keybits);
-	x->key.size = htobe16(x->key.size);
-}
-
+/* Part 2, 12.2.4: TPMT_PUBLIC, up to its parameters */
 static void
-bswap_es256_pubarea(tpm_es256_pubarea_t *x)
+check_pubarea_head(struct tpm_reader *r, uint16_t alg)
 {
-	x->alg = htobe16(x->alg);
-	x->hash = htobe16(x->hash);
-	x->attr = htobe32(x->attr);
-	x->policy.size = htobe16(x->policy.size);
-	x->param.symmetric = htobe16(x->param.symmetric);
-	x->param.scheme = htobe16(x->param.scheme);
-	x->param.curve_id = htobe16(x->param.curve_id);
-	x->param.kdf = htobe16(x->param.kdf);
-	x->point.x.size = htobe16(x->point.x.size);
-	x->point.y.size = htobe16(x->point.y.size);
-}
-
-static void
-bswap_sha1_certinfo(tpm_sha1_attest_t *x)
-{
-	x->magic = htobe32(x->magic);
-	x->type = htobe16(x->type);
-	x->signer.size = htobe16(x->signer.size);
-	x->data.size = htobe16(x->data.size);
-	x->name.alg = htobe16(x->name.alg);
-	x->name.size = htobe16(x->name.size);
+	uint32_t attr;
+
+	tpm_expect(r, 2, alg);
+	tpm_expect(r, 2, TPM_ALG_SHA256);
+	/* Part 2, 8.3: TPMA_OBJECT; the tpm may or may not persist it */
+	attr = tpm_get(r, 4);
+	if ((attr & TPMA_RESERVED) != 0 || (attr & (TPMA_FIXED|TPMA_FIXED_P|
+	    TPMA_SENSITIVE|TPMA_SIGN)) != (TPMA_FIXED|TPMA_FIXED_P|
+	    TPMA_SENSITIVE|TPMA_SIGN))
+		r->bad = true;
+	/* Part 2, 10.4.2: TPM2B_DIGEST; the policy itself is not checked */
+	tpm_expect(r, 2, SHA256_DIGEST_LENGTH);
+	tpm_skip(r, SHA256_DIGEST_LENGTH);
 }
 
 static int
 check_rs256_pubarea(const fido_blob_t *buf, const rs256_pk_t *pk)
 {
-	const tpm_rs256_pubarea_t	*actual;
-	tpm_rs256_pubarea_t		 expected;
-	int				 ok;
-
-	if (buf->len != sizeof(*actual)) {
+	struct tpm_reader r;
+
+	tpm_reader_init(&r, buf);
+	check_pubarea_head(&r, TPM_ALG_RSA);
+	/* Part 2, 12.2.3.5: TPMS_RSA_PARMS */
+	tpm_expect(&r, 2, TPM_ALG_NULL);	/* symmetric */
+	tpm_expect(&r, 2, TPM_ALG_NULL);	/* scheme */
+	tpm_expect(&r, 2, 2048);		/* keybits */
+	tpm_expect(&r, 4, 0);			/* exponent, meaning 2^16+1 */
+	/* Part 2, 11.2.4.5: TPM2B_PUBLIC_KEY_RSA */
+	tpm_expect_2b(&r, pk->n, sizeof(pk->n));
+
+	if (tpm_end(&r) < 0) {
 		fido_log_debug("%s: buf->len=%zu", __func__, buf->len);
 		return -1;
 	}
-	actual = (const void *)buf->ptr;
-
-	memset(&expected, 0, sizeof(expected));
-	expected.alg = TPM_ALG_RSA;
-	expected.hash = TPM_ALG_SHA256;
-	expected.attr = be32toh(actual->attr);
-	expected.attr &= ~(TPMA_RESERVED|TPMA_CLEAR);
-	expected.attr |= (TPMA_FIXED|TPMA_FIXED_P|TPMA_SENSITIVE|TPMA_SIGN);
-	expected.policy = actual->policy;
-	expected.policy.size = sizeof(expected.policy.body);
-	expected.param.symmetric = TPM_ALG_NULL;
-	expected.param.scheme = TPM_ALG_NULL;
-	expected.param.keybits = 2048;
-	expected.param.exponent = 0; /* meaning 2^16+1 */
-	expected.key.size = sizeof(expected.key.body);
-	memcpy(&expected.key.body, &pk->n, sizeof(expected.key.body));
-	bswap_rs256_pubarea(&expected);
-
-	ok = timingsafe_bcmp(&expected, actual, sizeof(expected));
-	explicit_bzero(&expected, sizeof(expected));
-
-	return ok != 0 ? -1 : 0;
+
+	return 0;
 }
 
 static int
 check_es256_pubarea(const fido_blob_t *buf, const es256_pk_t *pk)
 {
-	const tpm_es256_pubarea_t	*actual;
-	tpm_es256_pubarea_t		 expected;
-	int				 ok;
-
-	if (buf->len != sizeof(*actual)) {
+	struct tpm_reader r;
+
+	tpm_reader_init(&r, buf);
+	check_pubarea_head(&r, TPM_ALG_ECC);
+	/* Part 2, 12.2.3.6: TPMS_ECC_PARMS */
+	tpm_expect(&r, 2, TPM_ALG_NULL);	/* symmetric */
+	tpm_expect(&r, 2, TPM_ALG_NULL);	/* scheme; TCG Alg. Reg., 5.2.4 */
+	tpm_expect(&r, 2, TPM_ECC_P256);	/* curve_id */
+	tpm_expect(&r, 2, TPM_ALG_NULL);	/* kdf */
+	/* Part 2, 11.2.5.2: TPMS_ECC_POINT */
+	tpm_expect_2b(&r, pk->x, sizeof(pk->x));
+	tpm_expect_2b(&r, pk->y, sizeof(pk->y));
+
+	if (tpm_end(&r) < 0) {
 		fido_log_debug("%s: buf->len=%zu", __func__, buf->len);
 		return -1;
 	}
-	actual = (const void *)buf->ptr;
-
-	memset(&expected, 0, sizeof(expected));
-	expected.alg = TPM_ALG_ECC;
-	expected.hash = TPM_ALG_SHA256;
-	expected.attr = be32toh(actual->attr);
-	expected.attr &= ~(TPMA_RESERVED|TPMA_CLEAR);
-	expected.attr |= (TPMA_FIXED|TPMA_FIXED_P|TPMA_SENSITIVE|TPMA_SIGN);
-	expected.policy = actual->policy;
-	expected.policy.size = sizeof(expected.policy.body);
-	expected.param.symmetric = TPM_ALG_NULL;
-	expected.param.scheme = TPM_ALG_NULL; /* TCG Alg. Registry, 5.2.4 */
-	expected.param.curve_id = TPM_ECC_P256;
-	expected.param.kdf = TPM_ALG_NULL;
-	expected.point.x.size = sizeof(expected.point.x.body);
-	expected.point.y.size = sizeof(expected.point.y.body);
-	memcpy(&expected.point.x.body, &pk->x, sizeof(expected.point.x.body));
-	memcpy(&expected.point.y.body, &pk->y, sizeof(expected.point.y.body));
-	bswap_es256_pubarea(&expected);
-
-	ok = timingsafe_bcmp(&expected, actual, sizeof(expected));
-	explicit_bzero(&expected, sizeof(expected));
-
-	return ok != 0 ? -1 : 0;
+
+	return 0;
 }
 
+/* Part 2, 10.12.8 TPMS_ATTEST, of a TPMS_CERTIFY_INFO */
 static int
 check_sha1_certinfo(const fido_blob_t *buf, const fido_blob_t *clientdata_hash,
     const fido_blob_t *authdata_raw, const fido_blob_t *pubarea)
 {
-	const tpm_sha1_attest_t	*actual;
-	tpm_sha1_attest_t	 expected;
-	tpm_sha1_data_t		 signed_data;
-	tpm_sha256_name_t	 signed_name;
-	int			 ok = -1;
-
-	memset(&signed_data, 0, sizeof(signed_data));
-	memset(&signed_name, 0, sizeof(signed_name));
+	struct tpm_reader	r;
+	unsigned char		signed_data[SHA_DIGEST_LENGTH];
+	unsigned char		signed_name[SHA256_DIGEST_LENGTH];
+	int			ok = -1;
 
-	if (get_signed_sha1(&signed_data, authdata_raw, clientdata_hash) < 0 ||
-	    get_signed_name(&signed_name, pubarea) < 0) {
+	if (get_signed_sha1(signed_data, authdata_raw, clientdata_hash) < 0 ||
+	    SHA256(pubarea->ptr, pubarea->len, signed_name) != signed_name) {
 		fido_log_debug("%s: get_signed_sha1/name", __func__);
 		goto fail;
 	}
-	if (buf->len != sizeof(*actual)) {
+
+	tpm_reader_init(&r, buf);
+	tpm_expect(&r, 4, TPM_MAGIC);
+	tpm_expect(&r, 2, TPM_ST_CERTIFY);
+	/* Part 2, 10.5.3: TPM2B_NAME; full tpm path of signing key */
+	tpm_expect(&r, 2, 2 + SHA256_DIGEST_LENGTH);
+	tpm_skip(&r, 2 + SHA256_DIGEST_LENGTH);
+	/* Part 2, 10.4.3: TPM2B_DATA; signed sha1 */
+	tpm_expect_2b(&r, signed_data, sizeof(signed_data));
+	/* Part 2, 10.11.1: TPMS_CLOCK_INFO; counters obfuscated by tpm */
+	tpm_skip(&r, 8 + 4 + 4);
+	tpm_expect(&r, 1, 1);			/* safe */
+	tpm_skip(&r, 8);			/* fwversion; obfuscated */
+	/* TPM2B_NAME; sha256 of pubarea */
+	tpm_expect(&r, 2, 2 + SHA256_DIGEST_LENGTH);
+	tpm_expect(&r, 2, TPM_ALG_SHA256);
+	if ((r.len < sizeof(signed_name) || timingsafe_bcmp(r.p, signed_name,
+	    sizeof(signed_name)) != 0))
+		r.bad = true;
+	tpm_skip(&r, sizeof(signed_name));
+	/* TPM2B_NAME; full tpm path of attested key, not checked */
+	tpm_skip(&r, 2 + 2 + SHA256_DIGEST_LENGTH);
+
+	if (tpm_end(&r) < 0) {
 		fido_log_debug("%s: buf->len=%zu", __func__, buf->len);
 		goto fail;
 	}
-	actual = (const void *)buf->ptr;
-
-	memset(&expected, 0, sizeof(expected));
-	expected.magic = TPM_MAGIC;
-	expected.type = TPM_ST_CERTIFY;
-	expected.signer = actual->signer;
-	expected.signer.size = sizeof(expected.signer.alg) +
-	    sizeof(expected.signer.body);
-	expected.data = signed_data;
-	expected.clock = actual->clock;
-	expected.clock.safe = 1;
-	expected.fwversion = actual->fwversion;
-	expected.name = signed_name;
-	expected.qual_name = actual->qual_name;
-	bswap_sha1_certinfo(&expected);
-
-	ok = timingsafe_bcmp(&expected, actual, sizeof(expected));
+
+	ok = 0;
 fail:
-	explicit_bzero(&expected, sizeof(expected));
-	explicit_bzero(&signed_data, sizeof(signed_data));
-	explicit_bzero(&signed_name, sizeof(signed_name));
+	explicit_bzero(signed_data, sizeof(signed_data));
+	explicit_bzero(signed_name, sizeof(signed_name));
 
-	return ok != 0 ? -1 : 0;
+	return ok;
 }
 
 int
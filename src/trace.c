@@ -0,0 +1,200 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "fido.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/*
+ * Structured counterpart of fido_log_debug(). The handler and its
+ * argument are read together under a shared lock, so that they may be
+ * replaced while other threads are tracing; when no handler is installed
+ * and the device keeps no statistics, events are dropped before the
+ * clock is read.
+ */
+static fido_trace_handler_t	*trace_handler;
+static void			*trace_arg;
+
+#if defined(HAVE_PTHREAD)
+static pthread_rwlock_t trace_lock = PTHREAD_RWLOCK_INITIALIZER;
+#define TRACE_RDLOCK()		pthread_rwlock_rdlock(&trace_lock)
+#define TRACE_WRLOCK()		pthread_rwlock_wrlock(&trace_lock)
+#define TRACE_RDUNLOCK()	pthread_rwlock_unlock(&trace_lock)
+#define TRACE_WRUNLOCK()	pthread_rwlock_unlock(&trace_lock)
+#elif defined(_WIN32)
+static SRWLOCK trace_lock = SRWLOCK_INIT;
+#define TRACE_RDLOCK()		AcquireSRWLockShared(&trace_lock)
+#define TRACE_WRLOCK()		AcquireSRWLockExclusive(&trace_lock)
+#define TRACE_RDUNLOCK()	ReleaseSRWLockShared(&trace_lock)
+#define TRACE_WRUNLOCK()	ReleaseSRWLockExclusive(&trace_lock)
+#else
+#define TRACE_RDLOCK()		do { } while (0)
+#define TRACE_WRLOCK()		do { } while (0)
+#define TRACE_RDUNLOCK()	do { } while (0)
+#define TRACE_WRUNLOCK()	do { } while (0)
+#endif
+
+static void
+trace_emit(fido_trace_event_t *ev)
+{
+	fido_trace_handler_t	*handler;
+	void			*arg;
+	const fido_dev_t	*dev = ev->dev;
+	struct timespec		 ts;
+
+	TRACE_RDLOCK();
+	handler = trace_handler;
+	arg = trace_arg;
+	TRACE_RDUNLOCK();
+	if (handler == NULL && (dev == NULL || dev->stats == NULL))
+		return;
+
+	if (fido_time_now(&ts) == 0)
+		ev->ns = (uint64_t)ts.tv_sec * 1000000000ULL +
+		    (uint64_t)ts.tv_nsec;
+
+	if (dev != NULL && dev->stats != NULL)
+		fido_stats_update(dev, ev);
+	if (handler != NULL)
+		handler(arg, ev);
+}
+
+void
+fido_trace(const fido_dev_t *dev, int type, uint8_t cmd, size_t len,
+    int result)
+{
+	fido_trace_event_t ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = type;
+	ev.dev = dev;
+	ev.cmd = cmd;
+	ev.cbor = dev != NULL ? dev->trace_cbor : 0;
+	ev.len = len;
+	ev.result = result;
+	ev.span_id = dev != NULL ? dev->trace_span : 0;
+
+	trace_emit(&ev);
+}
+
+/* the transport of dev, being opened at path, as reported by spans */
+const char *
+fido_trace_transport(const fido_dev_t *dev, const char *path)
+{
+#ifdef USE_WINHELLO
+	if (strcmp(path, FIDO_WINHELLO_PATH) == 0)
+		return ("winhello");
+#endif
+#ifdef USE_NFC
+	if (fido_is_nfc(path))
+		return ("nfc");
+#endif
+#ifdef USE_PCSC
+	if (fido_is_pcsc(path))
+		return ("pcsc");
+#endif
+#ifdef USE_BLE
+	if (fido_is_ble(path))
+		return ("ble");
+#endif
+#ifdef USE_BROKER
+	if (fido_is_broker(path))
+		return ("broker");
+#endif
+	if (dev->transport.tx != NULL)
+		return (NULL); /* fido_dev_set_transport_functions() */
+
+	return ("usb");
+}
+
+static void
+trace_span(const fido_dev_t *dev, int type, const fido_trace_span_t *s,
+    size_t len, int result)
+{
+	fido_trace_event_t ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.type = type;
+	ev.dev = dev;
+	ev.len = len;
+	ev.result = result;
+	ev.span = s->type;
+	ev.span_id = s->id;
+	ev.parent_id = s->parent;
+	ev.transport = dev->trace_transport;
+	if (dev->info != NULL)
+		ev.aaguid = dev->info->aaguid;
+
+	trace_emit(&ev);
+}
+
+/*
+ * Spans nest: the one opened last on a device is the parent of those
+ * opened after it, and of its command events, until it is closed. The
+ * span is kept by the caller; ids are issued whether or not a handler
+ * is installed, so that one installed midway sees consistent parents.
+ */
+void
+fido_trace_span_begin(fido_dev_t *dev, fido_trace_span_t *s, int type)
+{
+	s->type = type;
+	s->id = ++dev->trace_seq;
+	s->parent = dev->trace_span;
+	s->bytes = dev->trace_bytes;
+	dev->trace_span = s->id;
+
+	trace_span(dev, FIDO_TRACE_SPAN_BEGIN, s, 0, FIDO_OK);
+}
+
+/* close s, with the message bytes exchanged since it was opened */
+void
+fido_trace_span_end(fido_dev_t *dev, fido_trace_span_t *s, int result)
+{
+	if (s->type == 0)
+		return;
+	if (s != &dev->trace_up && dev->trace_up.type != 0 &&
+	    dev->trace_span == dev->trace_up.id)
+		fido_trace_up_end(dev, result);
+
+	trace_span(dev, FIDO_TRACE_SPAN_END, s, (size_t)(dev->trace_bytes -
+	    s->bytes), result);
+	dev->trace_span = s->parent;
+	s->type = 0;
+}
+
+/*
+ * The user presence span opens at the first report that the
+ * authenticator is waiting for the user, and closes with the reply of
+ * the CTAP2 command, or with the span it is nested in.
+ */
+void
+fido_trace_up_begin(fido_dev_t *dev)
+{
+	if (dev->trace_up.type == 0)
+		fido_trace_span_begin(dev, &dev->trace_up, FIDO_SPAN_UP);
+}
+
+void
+fido_trace_up_end(fido_dev_t *dev, int result)
+{
+	fido_trace_span_end(dev, &dev->trace_up, result);
+}
+
+void
+fido_set_trace_handler(fido_trace_handler_t *handler, void *arg)
+{
+	TRACE_WRLOCK();
+	trace_handler = handler;
+	trace_arg = arg;
+	TRACE_WRUNLOCK();
+}
@@ -6,7 +6,6 @@
  */
 
 #include <openssl/sha.h>
-#include <openssl/x509.h>
 
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
@@ -14,10 +13,9 @@
 #include <errno.h>
 
 #include "fido.h"
-#include "fido/es256.h"
-#include "fallthrough.h"
 
-#define U2F_PACE_MS (100)
+#define U2F_PACE_MIN_MS	(10)
+#define U2F_PACE_MAX_MS	(200)
 
 #if defined(_MSC_VER)
 static int
@@ -51,11 +49,188 @@ delay_ms(unsigned int ms, int *ms_remain)
 	return (0);
 }
 
+/* ms elapsed since t0, or -1 */
+static int
+elapsed_ms(const struct timespec *t0)
+{
+	struct timespec now, delta;
+
+	if (fido_time_now(&now) != 0 || timespeccmp(&now, t0, <))
+		return (-1);
+
+	timespecsub(&now, t0, &delta);
+	if (delta.tv_sec >= INT_MAX / 1000)
+		return (INT_MAX);
+
+	return ((int)(delta.tv_sec * 1000 + delta.tv_nsec / 1000000));
+}
+
+/*
+ * The delay before a request is repeated: a quarter of the time waited
+ * so far, so that a prompt touch is noticed within a few ms, and an
+ * authenticator left unattended is not asked more than a few times a
+ * second.
+ */
+static unsigned int
+pace_ms(int elapsed)
+{
+	if (elapsed < 4 * U2F_PACE_MIN_MS)
+		return (U2F_PACE_MIN_MS);
+	if (elapsed > 4 * U2F_PACE_MAX_MS)
+		return (U2F_PACE_MAX_MS);
+
+	return ((unsigned int)elapsed / 4);
+}
+
+/*
+ * A U2F authenticator waiting for user presence answers a register or
+ * sign request with SW_CONDITIONS_NOT_SATISFIED, and the request has to
+ * be repeated. Report the wait to the keepalive callback, as a CTAP2
+ * authenticator would, keep it within the budget of FIDO_TIMEOUT_UP,
+ * and return the delay before the next attempt.
+ */
+static int
+up_pace(fido_dev_t *dev, const struct timespec *t0, unsigned int *pace)
+{
+	int elapsed = elapsed_ms(t0);
+	int budget;
+
+	fido_trace(dev, FIDO_TRACE_KEEPALIVE, CTAP_CMD_MSG, 0,
+	    FIDO_KEEPALIVE_UPNEEDED);
+	fido_trace_up_begin(dev);
+	if (dev->keepalive_cb != NULL && dev->keepalive_cb(dev->keepalive_arg,
+	    FIDO_KEEPALIVE_UPNEEDED, elapsed) != 0) {
+		fido_log_debug("%s: cancelled", __func__);
+		return (FIDO_ERR_KEEPALIVE_CANCEL);
+	}
+
+	*pace = pace_ms(elapsed);
+
+	if ((budget = fido_dev_cmd_timeout(dev, FIDO_TIMEOUT_UP)) >= 0) {
+		if (elapsed < 0 || elapsed >= budget) {
+			fido_log_debug("%s: budget %d ms expired", __func__,
+			    budget);
+			return (FIDO_ERR_RX);
+		}
+		if ((unsigned int)(budget - elapsed) < *pace)
+			*pace = (unsigned int)(budget - elapsed);
+	}
+
+	return (FIDO_OK);
+}
+
+static int
+up_wait(fido_dev_t *dev, const struct timespec *t0, int *ms)
+{
+	unsigned int	pace;
+	int		r;
+
+	if ((r = up_pace(dev, t0, &pace)) != FIDO_OK)
+		return (r);
+
+	if (delay_ms(pace, ms) != 0) {
+		fido_log_debug("%s: delay_ms", __func__);
+		return (FIDO_ERR_RX);
+	}
+
+	return (FIDO_OK);
+}
+
+/*
+ * Send apdu, and receive its reply into reply, repeating the request
+ * for as long as the authenticator waits for user presence.
+ */
+static int
+up_request(fido_dev_t *dev, const iso7816_apdu_t *apdu, unsigned char *reply,
+    size_t replysiz, int *reply_len, int *ms)
+{
+	struct timespec	t0;
+	int		r;
+
+	if (fido_time_now(&t0) != 0)
+		return (FIDO_ERR_INTERNAL);
+
+	for (;;) {
+		if (fido_tx(dev, CTAP_CMD_MSG, iso7816_ptr(apdu),
+		    iso7816_len(apdu), ms) < 0) {
+			fido_log_debug("%s: fido_tx", __func__);
+			return (FIDO_ERR_TX);
+		}
+		if ((*reply_len = fido_rx(dev, CTAP_CMD_MSG, reply, replysiz,
+		    ms)) < 2) {
+			fido_log_debug("%s: fido_rx", __func__);
+			return (FIDO_ERR_RX);
+		}
+		if (((reply[0] << 8) | reply[1]) != SW_CONDITIONS_NOT_SATISFIED)
+			return (FIDO_OK);
+		if ((r = up_wait(dev, &t0, ms)) != FIDO_OK) {
+			fido_log_debug("%s: up_wait", __func__);
+			return (r);
+		}
+	}
+}
+
+static iso7816_apdu_t *
+register_apdu(const unsigned char *challenge, const unsigned char *application)
+{
+	iso7816_apdu_t *apdu;
+
+	if ((apdu = iso7816_new(0, U2F_CMD_REGISTER, 0, 2 *
+	    SHA256_DIGEST_LENGTH)) == NULL ||
+	    iso7816_add(apdu, challenge, SHA256_DIGEST_LENGTH) < 0 ||
+	    iso7816_add(apdu, application, SHA256_DIGEST_LENGTH) < 0) {
+		fido_log_debug("%s: iso7816", __func__);
+		iso7816_free(&apdu);
+		return (NULL);
+	}
+
+	return (apdu);
+}
+
+/* dummy challenge & application */
+static iso7816_apdu_t *
+dummy_register_apdu(void)
+{
+	unsigned char dummy[SHA256_DIGEST_LENGTH];
+
+	memset(&dummy, 0xff, sizeof(dummy));
+
+	return (register_apdu(dummy, dummy));
+}
+
+static iso7816_apdu_t *
+auth_apdu(uint8_t p1, const unsigned char *challenge,
+    const unsigned char *rp_id_hash, const fido_blob_t *key_id)
+{
+	iso7816_apdu_t	*apdu;
+	uint8_t		 key_id_len;
+
+	if (key_id->len > UINT8_MAX) {
+		fido_log_debug("%s: key_id->len=%zu", __func__, key_id->len);
+		return (NULL);
+	}
+
+	key_id_len = (uint8_t)key_id->len;
+
+	if ((apdu = iso7816_new(0, U2F_CMD_AUTH, p1, (uint16_t)(2 *
+	    SHA256_DIGEST_LENGTH + sizeof(key_id_len) + key_id_len))) == NULL ||
+	    iso7816_add(apdu, challenge, SHA256_DIGEST_LENGTH) < 0 ||
+	    iso7816_add(apdu, rp_id_hash, SHA256_DIGEST_LENGTH) < 0 ||
+	    iso7816_add(apdu, &key_id_len, sizeof(key_id_len)) < 0 ||
+	    iso7816_add(apdu, key_id->ptr, key_id_len) < 0) {
+		fido_log_debug("%s: iso7816", __func__);
+		iso7816_free(&apdu);
+		return (NULL);
+	}
+
+	return (apdu);
+}
+
 static int
 sig_get(fido_blob_t *sig, const unsigned char **buf, size_t *len)
 {
 	sig->len = *len; /* consume the whole buffer */
-	if ((sig->ptr = calloc(1, sig->len)) == NULL ||
+	if ((sig->ptr = fido_calloc(1, sig->len)) == NULL ||
 	    fido_buf_read(buf, len, sig->ptr, sig->len) < 0) {
 		fido_log_debug("%s: fido_buf_read", __func__);
 		fido_blob_reset(sig);
@@ -65,58 +240,59 @@ sig_get(fido_blob_t *sig, const unsigned char **buf, size_t *len)
 	return (0);
 }
 
+/*
+ * The attestation certificate is delimited by its DER header alone; it is
+ * parsed if and when the attestation is verified.
+ */
 static int
-x5c_get(fido_blob_t *x5c, const unsigned char **buf, size_t *len)
+x5c_get(const unsigned char **x5c, size_t *x5c_len, const unsigned char **buf,
+    size_t *len)
 {
-	X509	*cert = NULL;
-	int	 ok = -1;
-
-	if (*len > LONG_MAX) {
-		fido_log_debug("%s: invalid len %zu", __func__, *len);
-		goto fail;
-	}
+	const unsigned char	*p = *buf;
+	size_t			 hdr, n, nb;
 
-	/* find out the certificate's length */
-	const unsigned char *end = *buf;
-	if ((cert = d2i_X509(NULL, &end, (long)*len)) == NULL || end <= *buf ||
-	    (x5c->len = (size_t)(end - *buf)) >= *len) {
-		fido_log_debug("%s: d2i_X509", __func__);
-		goto fail;
+	/* SEQUENCE, definite length */
+	if (*len < 2 || p[0] != 0x30) {
+		fido_log_debug("%s: tag", __func__);
+		return (-1);
 	}
-
-	/* read accordingly */
-	if ((x5c->ptr = calloc(1, x5c->len)) == NULL ||
-	    fido_buf_read(buf, len, x5c->ptr, x5c->len) < 0) {
-		fido_log_debug("%s: fido_buf_read", __func__);
-		goto fail;
+	if (p[1] < 0x80) {
+		hdr = 2;
+		n = p[1];
+	} else {
+		if ((nb = p[1] & 0x7f) == 0 || nb > 3 || nb > *len - 2) {
+			fido_log_debug("%s: nb=%zu", __func__, nb);
+			return (-1);
+		}
+		hdr = 2 + nb;
+		n = 0;
+		for (size_t i = 0; i < nb; i++)
+			n = n << 8 | p[2 + i];
+	}
+	/* the signature follows */
+	if (n >= *len - hdr) {
+		fido_log_debug("%s: n=%zu, len=%zu", __func__, n, *len);
+		return (-1);
 	}
 
-	ok = 0;
-fail:
-	if (cert != NULL)
-		X509_free(cert);
+	*x5c = p;
+	*x5c_len = hdr + n;
+	*buf += *x5c_len;
+	*len -= *x5c_len;
 
-	if (ok < 0)
-		fido_blob_reset(x5c);
-
-	return (ok);
+	return (0);
 }
 
 static int
-authdata_fake(const char *rp_id, uint8_t flags, uint32_t sigcount,
-    fido_blob_t *fake_cbor_ad)
+authdata_fake(const unsigned char *rp_id_hash, uint8_t flags,
+    uint32_t sigcount, fido_blob_t *fake_cbor_ad)
 {
 	fido_authdata_t	 ad;
 	cbor_item_t	*item = NULL;
 	size_t		 alloc_len;
 
 	memset(&ad, 0, sizeof(ad));
-
-	if (SHA256((const void *)rp_id, strlen(rp_id),
-	    ad.rp_id_hash) != ad.rp_id_hash) {
-		fido_log_debug("%s: sha256", __func__);
-		return (-1);
-	}
+	memcpy(ad.rp_id_hash, rp_id_hash, sizeof(ad.rp_id_hash));
 
 	ad.flags = flags; /* XXX translate? */
 	ad.sigcount = sigcount;
@@ -146,99 +322,79 @@ send_dummy_register(fido_dev_t *dev, int *ms)
 {
 	iso7816_apdu_t	*apdu = NULL;
 	unsigned char	*reply = NULL;
-	unsigned char	 challenge[SHA256_DIGEST_LENGTH];
-	unsigned char	 application[SHA256_DIGEST_LENGTH];
+	size_t		 replysiz = 0;
+	int		 reply_len;
 	int		 r;
 
-	/* dummy challenge & application */
-	memset(&challenge, 0xff, sizeof(challenge));
-	memset(&application, 0xff, sizeof(application));
-
-	if ((apdu = iso7816_new(0, U2F_CMD_REGISTER, 0, 2 *
-	    SHA256_DIGEST_LENGTH)) == NULL ||
-	    iso7816_add(apdu, &challenge, sizeof(challenge)) < 0 ||
-	    iso7816_add(apdu, &application, sizeof(application)) < 0) {
-		fido_log_debug("%s: iso7816", __func__);
+	if ((apdu = dummy_register_apdu()) == NULL) {
+		fido_log_debug("%s: dummy_register_apdu", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
-	if ((reply = malloc(FIDO_MAXMSG)) == NULL) {
-		fido_log_debug("%s: malloc", __func__);
+	if ((reply = fido_rx_buf_get(dev, FIDO_MAXMSG, &replysiz)) == NULL) {
+		fido_log_debug("%s: fido_rx_buf_get", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
-	do {
-		if (fido_tx(dev, CTAP_CMD_MSG, iso7816_ptr(apdu),
-		    iso7816_len(apdu), ms) < 0) {
-			fido_log_debug("%s: fido_tx", __func__);
-			r = FIDO_ERR_TX;
-			goto fail;
-		}
-		if (fido_rx(dev, CTAP_CMD_MSG, reply, FIDO_MAXMSG, ms) < 2) {
-			fido_log_debug("%s: fido_rx", __func__);
-			r = FIDO_ERR_RX;
-			goto fail;
-		}
-		if (delay_ms(U2F_PACE_MS, ms) != 0) {
-			fido_log_debug("%s: delay_ms", __func__);
-			r = FIDO_ERR_RX;
-			goto fail;
-		}
-	} while (((reply[0] << 8) | reply[1]) == SW_CONDITIONS_NOT_SATISFIED);
-
-	r = FIDO_OK;
+	if ((r = up_request(dev, apdu, reply, replysiz, &reply_len,
+	    ms)) != FIDO_OK) {
+		fido_log_debug("%s: up_request", __func__);
+		goto fail;
+	}
 fail:
 	iso7816_free(&apdu);
-	freezero(reply, FIDO_MAXMSG);
+	fido_rx_buf_put(dev, reply, replysiz);
 
 	return (r);
 }
 
 static int
-key_lookup(fido_dev_t *dev, const char *rp_id, const fido_blob_t *key_id,
-    int *found, int *ms)
+get_rp_id_hash(const char *rp_id, unsigned char *rp_id_hash)
+{
+	if (rp_id == NULL) {
+		fido_log_debug("%s: rp_id=NULL", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	if (SHA256((const void *)rp_id, strlen(rp_id),
+	    rp_id_hash) != rp_id_hash) {
+		fido_log_debug("%s: sha256", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	return (FIDO_OK);
+}
+
+/* check-only: never waits for user presence */
+static int
+key_lookup(fido_dev_t *dev, const unsigned char *rp_id_hash,
+    const fido_blob_t *key_id, int *found, int *ms)
 {
 	iso7816_apdu_t	*apdu = NULL;
 	unsigned char	*reply = NULL;
+	size_t		 replysiz = 0;
 	unsigned char	 challenge[SHA256_DIGEST_LENGTH];
-	unsigned char	 rp_id_hash[SHA256_DIGEST_LENGTH];
-	uint8_t		 key_id_len;
 	int		 r;
 
-	if (key_id->len > UINT8_MAX || rp_id == NULL) {
-		fido_log_debug("%s: key_id->len=%zu, rp_id=%p", __func__,
-		    key_id->len, (const void *)rp_id);
+	if (key_id->len > UINT8_MAX) {
+		fido_log_debug("%s: key_id->len=%zu", __func__, key_id->len);
 		r = FIDO_ERR_INVALID_ARGUMENT;
 		goto fail;
 	}
 
 	memset(&challenge, 0xff, sizeof(challenge));
-	memset(&rp_id_hash, 0, sizeof(rp_id_hash));
-
-	if (SHA256((const void *)rp_id, strlen(rp_id),
-	    rp_id_hash) != rp_id_hash) {
-		fido_log_debug("%s: sha256", __func__);
-		r = FIDO_ERR_INTERNAL;
-		goto fail;
-	}
 
-	key_id_len = (uint8_t)key_id->len;
-
-	if ((apdu = iso7816_new(0, U2F_CMD_AUTH, U2F_AUTH_CHECK, (uint16_t)(2 *
-	    SHA256_DIGEST_LENGTH + sizeof(key_id_len) + key_id_len))) == NULL ||
-	    iso7816_add(apdu, &challenge, sizeof(challenge)) < 0 ||
-	    iso7816_add(apdu, &rp_id_hash, sizeof(rp_id_hash)) < 0 ||
-	    iso7816_add(apdu, &key_id_len, sizeof(key_id_len)) < 0 ||
-	    iso7816_add(apdu, key_id->ptr, key_id_len) < 0) {
-		fido_log_debug("%s: iso7816", __func__);
+	if ((apdu = auth_apdu(U2F_AUTH_CHECK, challenge, rp_id_hash,
+	    key_id)) == NULL) {
+		fido_log_debug("%s: auth_apdu", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
-	if ((reply = malloc(FIDO_MAXMSG)) == NULL) {
-		fido_log_debug("%s: malloc", __func__);
+	if ((reply = fido_rx_buf_get(dev, FIDO_MAXMSG, &replysiz)) == NULL) {
+		fido_log_debug("%s: fido_rx_buf_get", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
@@ -249,7 +405,7 @@ key_lookup(fido_dev_t *dev, const char *rp_id, const fido_blob_t *key_id,
 		r = FIDO_ERR_TX;
 		goto fail;
 	}
-	if (fido_rx(dev, CTAP_CMD_MSG, reply, FIDO_MAXMSG, ms) != 2) {
+	if (fido_rx(dev, CTAP_CMD_MSG, reply, replysiz, ms) != 2) {
 		fido_log_debug("%s: fido_rx", __func__);
 		r = FIDO_ERR_RX;
 		goto fail;
@@ -271,14 +427,14 @@ key_lookup(fido_dev_t *dev, const char *rp_id, const fido_blob_t *key_id,
 	r = FIDO_OK;
 fail:
 	iso7816_free(&apdu);
-	freezero(reply, FIDO_MAXMSG);
+	fido_rx_buf_put(dev, reply, replysiz);
 
 	return (r);
 }
 
 static int
-parse_auth_reply(fido_blob_t *sig, fido_blob_t *ad, const char *rp_id,
-    const unsigned char *reply, size_t len)
+parse_auth_reply(fido_blob_t *sig, fido_blob_t *ad,
+    const unsigned char *rp_id_hash, const unsigned char *reply, size_t len)
 {
 	uint8_t		flags;
 	uint32_t	sigcount;
@@ -301,7 +457,7 @@ parse_auth_reply(fido_blob_t *sig, fido_blob_t *ad, const char *rp_id,
 		return (FIDO_ERR_RX);
 	}
 
-	if (authdata_fake(rp_id, flags, sigcount, ad) < 0) {
+	if (authdata_fake(rp_id_hash, flags, sigcount, ad) < 0) {
 		fido_log_debug("%s; authdata_fake", __func__);
 		return (FIDO_ERR_RX);
 	}
@@ -309,213 +465,168 @@ parse_auth_reply(fido_blob_t *sig, fido_blob_t *ad, const char *rp_id,
 	return (FIDO_OK);
 }
 
+/* decode a sign reply into fa's statement idx */
+static int
+auth_reply_set(fido_assert_t *fa, size_t idx, const unsigned char *rp_id_hash,
+    const unsigned char *reply, size_t len)
+{
+	fido_blob_t	sig;
+	fido_blob_t	ad;
+	int		r;
+
+	memset(&sig, 0, sizeof(sig));
+	memset(&ad, 0, sizeof(ad));
+
+	if ((r = parse_auth_reply(&sig, &ad, rp_id_hash, reply,
+	    len)) != FIDO_OK) {
+		fido_log_debug("%s: parse_auth_reply", __func__);
+		goto fail;
+	}
+
+	if (fido_assert_set_authdata(fa, idx, ad.ptr, ad.len) != FIDO_OK ||
+	    fido_assert_set_sig(fa, idx, sig.ptr, sig.len) != FIDO_OK) {
+		fido_log_debug("%s: fido_assert_set", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	r = FIDO_OK;
+fail:
+	fido_blob_reset(&sig);
+	fido_blob_reset(&ad);
+
+	return (r);
+}
+
 static int
-do_auth(fido_dev_t *dev, const fido_blob_t *cdh, const char *rp_id,
-    const fido_blob_t *key_id, fido_blob_t *sig, fido_blob_t *ad, int *ms)
+do_auth(fido_dev_t *dev, fido_assert_t *fa, size_t idx,
+    const unsigned char *rp_id_hash, const fido_blob_t *key_id, int *ms)
 {
 	iso7816_apdu_t	*apdu = NULL;
 	unsigned char	*reply = NULL;
-	unsigned char	 rp_id_hash[SHA256_DIGEST_LENGTH];
+	size_t		 replysiz = 0;
 	int		 reply_len;
-	uint8_t		 key_id_len;
 	int		 r;
 
 #ifdef FIDO_FUZZ
 	*ms = 0; /* XXX */
 #endif
 
-	if (cdh->len != SHA256_DIGEST_LENGTH || key_id->len > UINT8_MAX ||
-	    rp_id == NULL) {
+	if (fa->cdh.len != SHA256_DIGEST_LENGTH || key_id->len > UINT8_MAX) {
 		r = FIDO_ERR_INVALID_ARGUMENT;
 		goto fail;
 	}
 
-	memset(&rp_id_hash, 0, sizeof(rp_id_hash));
-
-	if (SHA256((const void *)rp_id, strlen(rp_id),
-	    rp_id_hash) != rp_id_hash) {
-		fido_log_debug("%s: sha256", __func__);
+	if ((apdu = auth_apdu(U2F_AUTH_SIGN, fa->cdh.ptr, rp_id_hash,
+	    key_id)) == NULL) {
+		fido_log_debug("%s: auth_apdu", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
-	key_id_len = (uint8_t)key_id->len;
-
-	if ((apdu = iso7816_new(0, U2F_CMD_AUTH, U2F_AUTH_SIGN, (uint16_t)(2 *
-	    SHA256_DIGEST_LENGTH + sizeof(key_id_len) + key_id_len))) == NULL ||
-	    iso7816_add(apdu, cdh->ptr, cdh->len) < 0 ||
-	    iso7816_add(apdu, &rp_id_hash, sizeof(rp_id_hash)) < 0 ||
-	    iso7816_add(apdu, &key_id_len, sizeof(key_id_len)) < 0 ||
-	    iso7816_add(apdu, key_id->ptr, key_id_len) < 0) {
-		fido_log_debug("%s: iso7816", __func__);
+	if ((reply = fido_rx_buf_get(dev, FIDO_MAXMSG, &replysiz)) == NULL) {
+		fido_log_debug("%s: fido_rx_buf_get", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
-	if ((reply = malloc(FIDO_MAXMSG)) == NULL) {
-		fido_log_debug("%s: malloc", __func__);
-		r = FIDO_ERR_INTERNAL;
+	if ((r = up_request(dev, apdu, reply, replysiz, &reply_len,
+	    ms)) != FIDO_OK) {
+		fido_log_debug("%s: up_request", __func__);
 		goto fail;
 	}
 
-	do {
-		if (fido_tx(dev, CTAP_CMD_MSG, iso7816_ptr(apdu),
-		    iso7816_len(apdu), ms) < 0) {
-			fido_log_debug("%s: fido_tx", __func__);
-			r = FIDO_ERR_TX;
-			goto fail;
-		}
-		if ((reply_len = fido_rx(dev, CTAP_CMD_MSG, reply,
-		    FIDO_MAXMSG, ms)) < 2) {
-			fido_log_debug("%s: fido_rx", __func__);
-			r = FIDO_ERR_RX;
-			goto fail;
-		}
-		if (delay_ms(U2F_PACE_MS, ms) != 0) {
-			fido_log_debug("%s: delay_ms", __func__);
-			r = FIDO_ERR_RX;
-			goto fail;
-		}
-	} while (((reply[0] << 8) | reply[1]) == SW_CONDITIONS_NOT_SATISFIED);
-
-	if ((r = parse_auth_reply(sig, ad, rp_id, reply,
+	if ((r = auth_reply_set(fa, idx, rp_id_hash, reply,
 	    (size_t)reply_len)) != FIDO_OK) {
-		fido_log_debug("%s: parse_auth_reply", __func__);
+		fido_log_debug("%s: auth_reply_set", __func__);
 		goto fail;
 	}
-
 fail:
 	iso7816_free(&apdu);
-	freezero(reply, FIDO_MAXMSG);
+	fido_rx_buf_put(dev, reply, replysiz);
 
 	return (r);
 }
 
+#define U2F_COSE_KEYLEN	77 /* es256_pk_encode() of a point */
+
+/* the COSE_Key of an uncompressed P-256 point, as es256_pk_encode() has it */
 static int
-cbor_blob_from_ec_point(const uint8_t *ec_point, size_t ec_point_len,
-    fido_blob_t *cbor_blob)
+cose_key_from_ec_point(const uint8_t *ec_point, size_t ec_point_len,
+    unsigned char *cose_key)
 {
-	es256_pk_t	*pk = NULL;
-	cbor_item_t	*pk_cbor = NULL;
-	size_t		 alloc_len;
-	int		 ok = -1;
+	static const unsigned char hdr[] = {
+		0xa5,			/* map(5) */
+		0x01, 0x02,		/* kty: EC2 */
+		0x03, 0x26,		/* alg: ES256 */
+		0x20, 0x01,		/* crv: P-256 */
+		0x21, 0x58, 0x20,	/* x: bytes(32) */
+	};
+	static const unsigned char y[] = {
+		0x22, 0x58, 0x20,	/* y: bytes(32) */
+	};
 
 	/* only handle uncompressed points */
 	if (ec_point_len != 65 || ec_point[0] != 0x04) {
 		fido_log_debug("%s: unexpected format", __func__);
-		goto fail;
+		return (-1);
 	}
 
-	if ((pk = es256_pk_new()) == NULL ||
-	    es256_pk_set_x(pk, &ec_point[1]) < 0 ||
-	    es256_pk_set_y(pk, &ec_point[33]) < 0) {
-		fido_log_debug("%s: es256_pk_set", __func__);
-		goto fail;
-	}
+	memcpy(cose_key, hdr, sizeof(hdr));
+	memcpy(cose_key + sizeof(hdr), &ec_point[1], 32);
+	memcpy(cose_key + sizeof(hdr) + 32, y, sizeof(y));
+	memcpy(cose_key + sizeof(hdr) + 32 + sizeof(y), &ec_point[33], 32);
 
-	if ((pk_cbor = es256_pk_encode(pk, 0)) == NULL) {
-		fido_log_debug("%s: es256_pk_encode", __func__);
-		goto fail;
-	}
+	return (0);
+}
 
-	if ((cbor_blob->len = cbor_serialize_alloc(pk_cbor, &cbor_blob->ptr,
-	    &alloc_len)) != 77) {
-		fido_log_debug("%s: cbor_serialize_alloc", __func__);
-		goto fail;
+static int
+encode_cred_attstmt(int cose_alg, const unsigned char *x5c, size_t x5c_len,
+    const unsigned char *sig, size_t sig_len, fido_blob_t *out)
+{
+	cbor_writer_t w;
+
+	memset(out, 0, sizeof(*out));
+
+	if (sig_len == 0) {
+		fido_log_debug("%s: sig_len=%zu", __func__, sig_len);
+		return (-1);
 	}
 
-	ok = 0;
-fail:
-	es256_pk_free(&pk);
+	/* a bare encoding, without a command byte */
+	memset(&w, 0, sizeof(w));
+	cbor_write_map(&w, 3);
+	cbor_write_text(&w, "alg");
+	cbor_write_int(&w, cose_alg);
+	cbor_write_text(&w, "sig");
+	cbor_write_bytes(&w, sig, sig_len);
+	cbor_write_text(&w, "x5c");
+	cbor_write_array(&w, 1);
+	cbor_write_bytes(&w, x5c, x5c_len);
 
-	if (pk_cbor)
-		cbor_decref(&pk_cbor);
+	if (cbor_writer_finish(&w, out) < 0) {
+		fido_log_debug("%s: cbor_writer_finish", __func__);
+		return (-1);
+	}
 
-	return (ok);
+	return (0);
 }
 
 static int
-encode_cred_attstmt(int cose_alg, const fido_blob_t *x5c,
-    const fido_blob_t *sig, fido_blob_t *out)
-{
-	cbor_item_t		*item = NULL;
-	cbor_item_t		*x5c_cbor = NULL;
-	const uint8_t		 alg_cbor = (uint8_t)(-cose_alg - 1);
-	struct cbor_pair	 kv[3];
-	size_t			 alloc_len;
+encode_cred_authdata(const char *rp_id, const uint8_t *kh, uint8_t kh_len,
+    const uint8_t *pubkey, size_t pubkey_len, fido_blob_t *out)
+{
+	fido_authdata_t		 authdata;
+	fido_attcred_raw_t	 attcred_raw;
+	unsigned char		 buf[sizeof(authdata) + sizeof(attcred_raw) +
+				     UINT8_MAX + U2F_COSE_KEYLEN];
+	unsigned char		*ptr = buf;
+	size_t			 len = sizeof(buf);
+	cbor_writer_t		 w;
 	int			 ok = -1;
 
-	memset(&kv, 0, sizeof(kv));
-	memset(out, 0, sizeof(*out));
-
-	if ((item = cbor_new_definite_map(3)) == NULL) {
-		fido_log_debug("%s: cbor_new_definite_map", __func__);
-		goto fail;
-	}
-
-	if ((kv[0].key = cbor_build_string("alg")) == NULL ||
-	    (kv[0].value = cbor_build_negint8(alg_cbor)) == NULL ||
-	    !cbor_map_add(item, kv[0])) {
-		fido_log_debug("%s: alg", __func__);
-		goto fail;
-	}
-
-	if ((kv[1].key = cbor_build_string("sig")) == NULL ||
-	    (kv[1].value = fido_blob_encode(sig)) == NULL ||
-	    !cbor_map_add(item, kv[1])) {
-		fido_log_debug("%s: sig", __func__);
-		goto fail;
-	}
-
-	if ((kv[2].key = cbor_build_string("x5c")) == NULL ||
-	    (kv[2].value = cbor_new_definite_array(1)) == NULL ||
-	    (x5c_cbor = fido_blob_encode(x5c)) == NULL ||
-	    !cbor_array_push(kv[2].value, x5c_cbor) ||
-	    !cbor_map_add(item, kv[2])) {
-		fido_log_debug("%s: x5c", __func__);
-		goto fail;
-	}
-
-	if ((out->len = cbor_serialize_alloc(item, &out->ptr,
-	    &alloc_len)) == 0) {
-		fido_log_debug("%s: cbor_serialize_alloc", __func__);
-		goto fail;
-	}
-
-	ok = 0;
-fail:
-	if (item != NULL)
-		cbor_decref(&item);
-	if (x5c_cbor != NULL)
-		cbor_decref(&x5c_cbor);
-
-	for (size_t i = 0; i < nitems(kv); i++) {
-		if (kv[i].key)
-			cbor_decref(&kv[i].key);
-		if (kv[i].value)
-			cbor_decref(&kv[i].value);
-	}
-
-	return (ok);
-}
-
-static int
-encode_cred_authdata(const char *rp_id, const uint8_t *kh, uint8_t kh_len,
-    const uint8_t *pubkey, size_t pubkey_len, fido_blob_t *out)
-{
-	fido_authdata_t	 	 authdata;
-	fido_attcred_raw_t	 attcred_raw;
-	fido_blob_t		 pk_blob;
-	fido_blob_t		 authdata_blob;
-	cbor_item_t		*authdata_cbor = NULL;
-	unsigned char		*ptr;
-	size_t			 len;
-	size_t			 alloc_len;
-	int			 ok = -1;
-
-	memset(&pk_blob, 0, sizeof(pk_blob));
-	memset(&authdata, 0, sizeof(authdata));
-	memset(&authdata_blob, 0, sizeof(authdata_blob));
+	memset(&authdata, 0, sizeof(authdata));
+	memset(&attcred_raw, 0, sizeof(attcred_raw));
 	memset(out, 0, sizeof(*out));
 
 	if (rp_id == NULL) {
@@ -523,11 +634,6 @@ encode_cred_authdata(const char *rp_id, const uint8_t *kh, uint8_t kh_len,
 		goto fail;
 	}
 
-	if (cbor_blob_from_ec_point(pubkey, pubkey_len, &pk_blob) < 0) {
-		fido_log_debug("%s: cbor_blob_from_ec_point", __func__);
-		goto fail;
-	}
-
 	if (SHA256((const void *)rp_id, strlen(rp_id),
 	    authdata.rp_id_hash) != authdata.rp_id_hash) {
 		fido_log_debug("%s: sha256", __func__);
@@ -536,45 +642,31 @@ encode_cred_authdata(const char *rp_id, const uint8_t *kh, uint8_t kh_len,
 
 	authdata.flags = (CTAP_AUTHDATA_ATT_CRED | CTAP_AUTHDATA_USER_PRESENT);
 	authdata.sigcount = 0;
-
-	memset(&attcred_raw.aaguid, 0, sizeof(attcred_raw.aaguid));
 	attcred_raw.id_len = htobe16(kh_len);
 
-	len = authdata_blob.len = sizeof(authdata) + sizeof(attcred_raw) +
-	    kh_len + pk_blob.len;
-	ptr = authdata_blob.ptr = calloc(1, authdata_blob.len);
-
-	fido_log_debug("%s: ptr=%p, len=%zu", __func__, (void *)ptr, len);
-
-	if (authdata_blob.ptr == NULL)
-		goto fail;
-
 	if (fido_buf_write(&ptr, &len, &authdata, sizeof(authdata)) < 0 ||
 	    fido_buf_write(&ptr, &len, &attcred_raw, sizeof(attcred_raw)) < 0 ||
 	    fido_buf_write(&ptr, &len, kh, kh_len) < 0 ||
-	    fido_buf_write(&ptr, &len, pk_blob.ptr, pk_blob.len) < 0) {
+	    len < U2F_COSE_KEYLEN) {
 		fido_log_debug("%s: fido_buf_write", __func__);
 		goto fail;
 	}
-
-	if ((authdata_cbor = fido_blob_encode(&authdata_blob)) == NULL) {
-		fido_log_debug("%s: fido_blob_encode", __func__);
+	if (cose_key_from_ec_point(pubkey, pubkey_len, ptr) < 0) {
+		fido_log_debug("%s: cose_key_from_ec_point", __func__);
 		goto fail;
 	}
+	len -= U2F_COSE_KEYLEN;
 
-	if ((out->len = cbor_serialize_alloc(authdata_cbor, &out->ptr,
-	    &alloc_len)) == 0) {
-		fido_log_debug("%s: cbor_serialize_alloc", __func__);
+	memset(&w, 0, sizeof(w));
+	cbor_write_bytes(&w, buf, sizeof(buf) - len);
+	if (cbor_writer_finish(&w, out) < 0) {
+		fido_log_debug("%s: cbor_writer_finish", __func__);
 		goto fail;
 	}
 
 	ok = 0;
 fail:
-	if (authdata_cbor)
-		cbor_decref(&authdata_cbor);
-
-	fido_blob_reset(&pk_blob);
-	fido_blob_reset(&authdata_blob);
+	explicit_bzero(buf, sizeof(buf));
 
 	return (ok);
 }
@@ -582,18 +674,16 @@ fail:
 static int
 parse_register_reply(fido_cred_t *cred, const unsigned char *reply, size_t len)
 {
-	fido_blob_t	 x5c;
-	fido_blob_t	 sig;
-	fido_blob_t	 ad;
-	fido_blob_t	 stmt;
-	uint8_t		 dummy;
-	uint8_t		 pubkey[65];
-	uint8_t		 kh_len = 0;
-	uint8_t		*kh = NULL;
-	int		 r;
+	const unsigned char	*x5c;
+	size_t			 x5c_len;
+	fido_blob_t		 ad;
+	fido_blob_t		 stmt;
+	uint8_t			 dummy;
+	uint8_t			 pubkey[65];
+	uint8_t			 kh_len = 0;
+	uint8_t			*kh = NULL;
+	int			 r;
 
-	memset(&x5c, 0, sizeof(x5c));
-	memset(&sig, 0, sizeof(sig));
 	memset(&ad, 0, sizeof(ad));
 	memset(&stmt, 0, sizeof(stmt));
 	r = FIDO_ERR_RX;
@@ -616,21 +706,21 @@ parse_register_reply(fido_cred_t *cred, const unsigned char *reply, size_t len)
 	/* pubkey + key handle */
 	if (fido_buf_read(&reply, &len, &pubkey, sizeof(pubkey)) < 0 ||
 	    fido_buf_read(&reply, &len, &kh_len, sizeof(kh_len)) < 0 ||
-	    (kh = calloc(1, kh_len)) == NULL ||
+	    (kh = fido_calloc(1, kh_len)) == NULL ||
 	    fido_buf_read(&reply, &len, kh, kh_len) < 0) {
 		fido_log_debug("%s: fido_buf_read", __func__);
 		goto fail;
 	}
 
-	/* x5c + sig */
-	if (x5c_get(&x5c, &reply, &len) < 0 ||
-	    sig_get(&sig, &reply, &len) < 0) {
-		fido_log_debug("%s: x5c || sig", __func__);
+	/* x5c, then sig: the rest of the reply */
+	if (x5c_get(&x5c, &x5c_len, &reply, &len) < 0) {
+		fido_log_debug("%s: x5c_get", __func__);
 		goto fail;
 	}
 
 	/* attstmt */
-	if (encode_cred_attstmt(COSE_ES256, &x5c, &sig, &stmt) < 0) {
+	if (encode_cred_attstmt(COSE_ES256, x5c, x5c_len, reply, len,
+	    &stmt) < 0) {
 		fido_log_debug("%s: encode_cred_attstmt", __func__);
 		goto fail;
 	}
@@ -652,24 +742,20 @@ parse_register_reply(fido_cred_t *cred, const unsigned char *reply, size_t len)
 
 	r = FIDO_OK;
 fail:
-	freezero(kh, kh_len);
-	fido_blob_reset(&x5c);
-	fido_blob_reset(&sig);
+	fido_freezero(kh, kh_len);
 	fido_blob_reset(&ad);
 	fido_blob_reset(&stmt);
 
 	return (r);
 }
 
-int
-u2f_register(fido_dev_t *dev, fido_cred_t *cred, int *ms)
+static int
+register_probe(fido_dev_t *dev, const fido_cred_t *cred,
+    unsigned char *rp_id_hash, int *excluded, int *ms)
 {
-	iso7816_apdu_t	*apdu = NULL;
-	unsigned char	 rp_id_hash[SHA256_DIGEST_LENGTH];
-	unsigned char	*reply = NULL;
-	int		 reply_len;
-	int		 found;
-	int		 r;
+	int r;
+
+	*excluded = 0;
 
 	if (cred->rk == FIDO_OPT_TRUE || cred->uv == FIDO_OPT_TRUE) {
 		fido_log_debug("%s: rk=%d, uv=%d", __func__, cred->rk,
@@ -684,64 +770,64 @@ u2f_register(fido_dev_t *dev, fido_cred_t *cred, int *ms)
 		return (FIDO_ERR_INVALID_ARGUMENT);
 	}
 
-	for (size_t i = 0; i < cred->excl.len; i++) {
-		if ((r = key_lookup(dev, cred->rp.id, &cred->excl.ptr[i],
-		    &found, ms)) != FIDO_OK) {
+	if ((r = get_rp_id_hash(cred->rp.id, rp_id_hash)) != FIDO_OK) {
+		fido_log_debug("%s: get_rp_id_hash", __func__);
+		return (r);
+	}
+
+	for (size_t i = 0; i < cred->excl.len && !*excluded; i++) {
+		if ((r = key_lookup(dev, rp_id_hash, &cred->excl.ptr[i],
+		    excluded, ms)) != FIDO_OK) {
 			fido_log_debug("%s: key_lookup", __func__);
 			return (r);
 		}
-		if (found) {
-			if ((r = send_dummy_register(dev, ms)) != FIDO_OK) {
-				fido_log_debug("%s: send_dummy_register",
-				    __func__);
-				return (r);
-			}
-			return (FIDO_ERR_CREDENTIAL_EXCLUDED);
-		}
 	}
 
-	memset(&rp_id_hash, 0, sizeof(rp_id_hash));
+	return (FIDO_OK);
+}
 
-	if (SHA256((const void *)cred->rp.id, strlen(cred->rp.id),
-	    rp_id_hash) != rp_id_hash) {
-		fido_log_debug("%s: sha256", __func__);
-		return (FIDO_ERR_INTERNAL);
+int
+u2f_register(fido_dev_t *dev, fido_cred_t *cred, int *ms)
+{
+	iso7816_apdu_t	*apdu = NULL;
+	unsigned char	 rp_id_hash[SHA256_DIGEST_LENGTH];
+	unsigned char	*reply = NULL;
+	size_t		 replysiz = 0;
+	int		 reply_len;
+	int		 excluded;
+	int		 r;
+
+	if ((r = register_probe(dev, cred, rp_id_hash, &excluded,
+	    ms)) != FIDO_OK) {
+		fido_log_debug("%s: register_probe", __func__);
+		return (r);
 	}
 
-	if ((apdu = iso7816_new(0, U2F_CMD_REGISTER, 0, 2 *
-	    SHA256_DIGEST_LENGTH)) == NULL ||
-	    iso7816_add(apdu, cred->cdh.ptr, cred->cdh.len) < 0 ||
-	    iso7816_add(apdu, rp_id_hash, sizeof(rp_id_hash)) < 0) {
-		fido_log_debug("%s: iso7816", __func__);
+	if (excluded) {
+		if ((r = send_dummy_register(dev, ms)) != FIDO_OK) {
+			fido_log_debug("%s: send_dummy_register", __func__);
+			return (r);
+		}
+		return (FIDO_ERR_CREDENTIAL_EXCLUDED);
+	}
+
+	if ((apdu = register_apdu(cred->cdh.ptr, rp_id_hash)) == NULL) {
+		fido_log_debug("%s: register_apdu", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
-	if ((reply = malloc(FIDO_MAXMSG)) == NULL) {
-		fido_log_debug("%s: malloc", __func__);
+	if ((reply = fido_rx_buf_get(dev, FIDO_MAXMSG, &replysiz)) == NULL) {
+		fido_log_debug("%s: fido_rx_buf_get", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
-	do {
-		if (fido_tx(dev, CTAP_CMD_MSG, iso7816_ptr(apdu),
-		    iso7816_len(apdu), ms) < 0) {
-			fido_log_debug("%s: fido_tx", __func__);
-			r = FIDO_ERR_TX;
-			goto fail;
-		}
-		if ((reply_len = fido_rx(dev, CTAP_CMD_MSG, reply,
-		    FIDO_MAXMSG, ms)) < 2) {
-			fido_log_debug("%s: fido_rx", __func__);
-			r = FIDO_ERR_RX;
-			goto fail;
-		}
-		if (delay_ms(U2F_PACE_MS, ms) != 0) {
-			fido_log_debug("%s: delay_ms", __func__);
-			r = FIDO_ERR_RX;
-			goto fail;
-		}
-	} while (((reply[0] << 8) | reply[1]) == SW_CONDITIONS_NOT_SATISFIED);
+	if ((r = up_request(dev, apdu, reply, replysiz, &reply_len,
+	    ms)) != FIDO_OK) {
+		fido_log_debug("%s: up_request", __func__);
+		goto fail;
+	}
 
 	if ((r = parse_register_reply(cred, reply,
 	    (size_t)reply_len)) != FIDO_OK) {
@@ -750,121 +836,481 @@ u2f_register(fido_dev_t *dev, fido_cred_t *cred, int *ms)
 	}
 fail:
 	iso7816_free(&apdu);
-	freezero(reply, FIDO_MAXMSG);
+	fido_rx_buf_put(dev, reply, replysiz);
 
 	return (r);
 }
 
+/*
+ * The allow list is probed with check-only requests first, back to back,
+ * so that user presence is only waited for on the handles the
+ * authenticator holds. Their positions in the allow list are returned
+ * in found, and their ids are set in fa's first nfound statements.
+ */
 static int
-u2f_authenticate_single(fido_dev_t *dev, const fido_blob_t *key_id,
-    fido_assert_t *fa, size_t idx, int *ms)
+auth_probe(fido_dev_t *dev, fido_assert_t *fa, unsigned char *rp_id_hash,
+    size_t **found, size_t *nfound, int *ms)
 {
-	fido_blob_t	sig;
-	fido_blob_t	ad;
-	int		found;
-	int		r;
+	int	exists;
+	int	r;
 
-	memset(&sig, 0, sizeof(sig));
-	memset(&ad, 0, sizeof(ad));
+	*found = NULL;
+	*nfound = 0;
 
-	if ((r = key_lookup(dev, fa->rp_id, key_id, &found, ms)) != FIDO_OK) {
-		fido_log_debug("%s: key_lookup", __func__);
-		goto fail;
+	if (fa->uv == FIDO_OPT_TRUE || fa->allow_list.ptr == NULL) {
+		fido_log_debug("%s: uv=%d, allow_list=%p", __func__, fa->uv,
+		    (void *)fa->allow_list.ptr);
+		return (FIDO_ERR_UNSUPPORTED_OPTION);
 	}
 
-	if (!found) {
-		fido_log_debug("%s: not found", __func__);
-		r = FIDO_ERR_CREDENTIAL_EXCLUDED;
-		goto fail;
+	if ((r = get_rp_id_hash(fa->rp_id, rp_id_hash)) != FIDO_OK) {
+		fido_log_debug("%s: get_rp_id_hash", __func__);
+		return (r);
 	}
 
-	if (fido_blob_set(&fa->stmt[idx].id, key_id->ptr, key_id->len) < 0) {
-		fido_log_debug("%s: fido_blob_set", __func__);
-		r = FIDO_ERR_INTERNAL;
-		goto fail;
+	if ((r = fido_assert_set_count(fa, fa->allow_list.len)) != FIDO_OK) {
+		fido_log_debug("%s: fido_assert_set_count", __func__);
+		return (r);
+	}
+
+	if ((*found = fido_calloc(fa->allow_list.len,
+	    sizeof(**found))) == NULL) {
+		fido_log_debug("%s: calloc", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	for (size_t i = 0; i < fa->allow_list.len; i++) {
+		if ((r = key_lookup(dev, rp_id_hash, &fa->allow_list.ptr[i],
+		    &exists, ms)) != FIDO_OK) {
+			fido_log_debug("%s: key_lookup", __func__);
+			goto fail;
+		}
+		if (!exists)
+			continue; /* ignore credentials that don't exist */
+		if (fido_blob_set(&fa->stmt[*nfound].id,
+		    fa->allow_list.ptr[i].ptr, fa->allow_list.ptr[i].len) < 0) {
+			fido_log_debug("%s: fido_blob_set", __func__);
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+		(*found)[(*nfound)++] = i;
+	}
+
+	return (FIDO_OK);
+fail:
+	fido_free(*found);
+	*found = NULL;
+	*nfound = 0;
+
+	return (r);
+}
+
+int
+u2f_authenticate(fido_dev_t *dev, fido_assert_t *fa, int *ms)
+{
+	unsigned char	 rp_id_hash[SHA256_DIGEST_LENGTH];
+	size_t		*found = NULL;
+	size_t		 nfound = 0;
+	int		 r;
+
+	if ((r = auth_probe(dev, fa, rp_id_hash, &found, &nfound,
+	    ms)) != FIDO_OK) {
+		fido_log_debug("%s: auth_probe", __func__);
+		return (r);
 	}
 
-	if (fa->up == FIDO_OPT_FALSE) {
+	if (fa->up == FIDO_OPT_FALSE)
 		fido_log_debug("%s: checking for key existence only", __func__);
+
+	for (size_t i = 0; i < nfound && fa->up != FIDO_OPT_FALSE; i++) {
+		if ((r = do_auth(dev, fa, i, rp_id_hash,
+		    &fa->allow_list.ptr[found[i]], ms)) != FIDO_OK) {
+			fido_log_debug("%s: do_auth", __func__);
+			goto fail;
+		}
+	}
+
+	fa->stmt_len = nfound;
+
+	if (nfound == 0)
+		r = FIDO_ERR_NO_CREDENTIALS;
+	else if (fa->up == FIDO_OPT_FALSE)
 		r = FIDO_ERR_USER_PRESENCE_REQUIRED;
+	else
+		r = FIDO_OK;
+fail:
+	fido_free(found);
+
+	return (r);
+}
+
+/*
+ * Asynchronous U2F operations. The allow list, or the exclude list, is
+ * probed when the operation begins; the sign or register request is
+ * then sent, and each step reads a reply. While the authenticator waits
+ * for user presence, the request is repeated on the schedule of
+ * up_pace(), and fido_dev_poll_timeout() tells the application when the
+ * next step is due.
+ */
+#define U2F_ASYNC_AUTH		1
+#define U2F_ASYNC_REGISTER	2
+#define U2F_ASYNC_EXCLUDED	3
+
+struct u2f_async {
+	int		 kind;     /* U2F_ASYNC_* */
+	iso7816_apdu_t  *apdu;     /* request in flight */
+	unsigned char	 rp_id_hash[SHA256_DIGEST_LENGTH];
+	size_t		*found;    /* allow list entries held */
+	size_t		 nfound;   /* entries in found */
+	size_t		 pos;      /* entry being signed with */
+	struct timespec	 t0;       /* apdu first sent */
+	struct timespec	 retry;    /* when to send apdu again */
+	bool		 waiting;  /* for retry */
+	bool		 cancel;   /* fido_dev_cancel() called */
+};
+
+void
+u2f_async_free(struct u2f_async **u_p)
+{
+	struct u2f_async *u;
+
+	if (u_p == NULL || (u = *u_p) == NULL)
+		return;
+	iso7816_free(&u->apdu);
+	fido_free(u->found);
+	fido_free(u);
+	*u_p = NULL;
+}
+
+static int
+async_tx(fido_dev_t *dev)
+{
+	struct fido_dev_async	*a = dev->async;
+	int			 ms = dev->timeout_ms;
+
+	/* rearm reassembly for the reply */
+	a->init = false;
+	a->len = 0;
+	a->off = 0;
+	a->seq = 0;
+	a->u2f->waiting = false;
+
+	if (fido_tx(dev, CTAP_CMD_MSG, iso7816_ptr(a->u2f->apdu),
+	    iso7816_len(a->u2f->apdu), &ms) < 0) {
+		fido_log_debug("%s: fido_tx", __func__);
+		return (FIDO_ERR_TX);
+	}
+
+	return (FIDO_OK);
+}
+
+/* send a new request */
+static int
+async_start(fido_dev_t *dev)
+{
+	if (fido_time_now(&dev->async->u2f->t0) != 0)
+		return (FIDO_ERR_INTERNAL);
+
+	return (async_tx(dev));
+}
+
+/*
+ * Advance the request in flight. *ready is set once a reply other than
+ * SW_CONDITIONS_NOT_SATISFIED has been received; the step waits for at
+ * most ms, and returns with *ready = 0 if the reply is not yet in.
+ */
+static int
+async_reply(fido_dev_t *dev, int *ready, int ms)
+{
+	struct fido_dev_async	*a = dev->async;
+	struct u2f_async	*u = a->u2f;
+	struct timespec		 dl;
+	unsigned int		 pace;
+	int			 left;
+	int			 got;
+	int			 r;
+
+	*ready = 0;
+
+	if (fido_time_deadline(&dl, ms) != 0)
+		return (FIDO_ERR_INTERNAL);
+
+	for (;;) {
+		if (u->waiting) {
+			if (u->cancel) {
+				fido_log_debug("%s: cancelled", __func__);
+				return (FIDO_ERR_KEEPALIVE_CANCEL);
+			}
+			if (fido_time_left(&u->retry, &left) != 0 ||
+			    fido_time_left(&dl, &ms) != 0)
+				return (FIDO_ERR_INTERNAL);
+			if (left > 0) {
+				if (ms == 0)
+					return (FIDO_OK); /* not yet */
+				if (delay_ms((unsigned int)left, &ms) != 0)
+					return (FIDO_ERR_RX);
+				continue;
+			}
+			if ((r = async_tx(dev)) != FIDO_OK)
+				return (r);
+		}
+		if (fido_time_left(&dl, &ms) != 0)
+			return (FIDO_ERR_INTERNAL);
+		if ((r = fido_rx_async_step(dev, &got, ms)) != FIDO_OK) {
+			fido_log_debug("%s: fido_rx_async_step", __func__);
+			return (r);
+		}
+		if (got == 0)
+			return (FIDO_OK); /* not yet */
+		if (u->cancel) {
+			fido_log_debug("%s: cancelled", __func__);
+			return (FIDO_ERR_KEEPALIVE_CANCEL);
+		}
+		if (a->len < 2 || ((a->buf[0] << 8) | a->buf[1]) !=
+		    SW_CONDITIONS_NOT_SATISFIED) {
+			*ready = 1;
+			return (FIDO_OK);
+		}
+		if ((r = up_pace(dev, &u->t0, &pace)) != FIDO_OK) {
+			fido_log_debug("%s: up_pace", __func__);
+			return (r);
+		}
+		if (fido_time_deadline(&u->retry, (int)pace) != 0)
+			return (FIDO_ERR_INTERNAL);
+		u->waiting = true;
+	}
+}
+
+/* ms until the pending operation must be stepped, or -1 */
+int
+u2f_async_timeout(const fido_dev_t *dev)
+{
+	const struct u2f_async	*u;
+	int			 ms;
+
+	if (dev->async == NULL || (u = dev->async->u2f) == NULL ||
+	    u->waiting == false)
+		return (-1);
+	if (u->cancel || fido_time_left(&u->retry, &ms) != 0)
+		return (0);
+
+	return (ms);
+}
+
+int
+u2f_async_cancel(fido_dev_t *dev)
+{
+	if (dev->async == NULL || dev->async->u2f == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	dev->async->u2f->cancel = true;
+
+	return (FIDO_OK);
+}
+
+static int
+async_begin(fido_dev_t *dev, int op, int kind)
+{
+	struct u2f_async	*u;
+	int			 r;
+
+	if ((r = fido_rx_async_begin(dev, op, CTAP_CMD_MSG,
+	    FIDO_MAXMSG)) != FIDO_OK) {
+		fido_log_debug("%s: fido_rx_async_begin", __func__);
+		return (r);
+	}
+
+	if ((u = fido_calloc(1, sizeof(*u))) == NULL) {
+		fido_log_debug("%s: calloc", __func__);
+		fido_rx_async_end(dev);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	u->kind = kind;
+	dev->async->u2f = u;
+
+	return (FIDO_OK);
+}
+
+static int
+auth_next(fido_dev_t *dev, const fido_assert_t *fa)
+{
+	struct u2f_async *u = dev->async->u2f;
+
+	if (fa->cdh.len != SHA256_DIGEST_LENGTH) {
+		fido_log_debug("%s: cdh.len=%zu", __func__, fa->cdh.len);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	iso7816_free(&u->apdu);
+	if ((u->apdu = auth_apdu(U2F_AUTH_SIGN, fa->cdh.ptr, u->rp_id_hash,
+	    &fa->allow_list.ptr[u->found[u->pos]])) == NULL) {
+		fido_log_debug("%s: auth_apdu", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	return (async_start(dev));
+}
+
+int
+u2f_authenticate_begin(fido_dev_t *dev, fido_assert_t *fa)
+{
+	struct u2f_async	*u;
+	int			 ms = dev->timeout_ms;
+	int			 r;
+
+	if ((r = async_begin(dev, FIDO_DEV_ASYNC_ASSERT,
+	    U2F_ASYNC_AUTH)) != FIDO_OK)
+		return (r);
+
+	u = dev->async->u2f;
+
+	if ((r = auth_probe(dev, fa, u->rp_id_hash, &u->found, &u->nfound,
+	    &ms)) != FIDO_OK) {
+		fido_log_debug("%s: auth_probe", __func__);
 		goto fail;
 	}
 
-	if ((r = do_auth(dev, &fa->cdh, fa->rp_id, key_id, &sig, &ad,
-	    ms)) != FIDO_OK) {
-		fido_log_debug("%s: do_auth", __func__);
+	/* nothing to wait for */
+	if (u->nfound == 0 || fa->up == FIDO_OPT_FALSE) {
+		fa->stmt_len = u->nfound;
+		r = u->nfound == 0 ? FIDO_ERR_NO_CREDENTIALS :
+		    FIDO_ERR_USER_PRESENCE_REQUIRED;
 		goto fail;
 	}
 
-	if (fido_assert_set_authdata(fa, idx, ad.ptr, ad.len) != FIDO_OK ||
-	    fido_assert_set_sig(fa, idx, sig.ptr, sig.len) != FIDO_OK) {
-		fido_log_debug("%s: fido_assert_set", __func__);
-		r = FIDO_ERR_INTERNAL;
+	if ((r = auth_next(dev, fa)) != FIDO_OK) {
+		fido_log_debug("%s: auth_next", __func__);
 		goto fail;
 	}
 
 	r = FIDO_OK;
 fail:
-	fido_blob_reset(&sig);
-	fido_blob_reset(&ad);
+	if (r != FIDO_OK)
+		fido_rx_async_end(dev);
 
 	return (r);
 }
 
 int
-u2f_authenticate(fido_dev_t *dev, fido_assert_t *fa, int *ms)
+u2f_authenticate_step(fido_dev_t *dev, fido_assert_t *fa, int *done, int ms)
 {
-	size_t	nfound = 0;
-	size_t	nauth_ok = 0;
-	int	r;
+	struct fido_dev_async	*a = dev->async;
+	struct u2f_async	*u = a->u2f;
+	int			 ready;
+	int			 r;
 
-	if (fa->uv == FIDO_OPT_TRUE || fa->allow_list.ptr == NULL) {
-		fido_log_debug("%s: uv=%d, allow_list=%p", __func__, fa->uv,
-		    (void *)fa->allow_list.ptr);
-		return (FIDO_ERR_UNSUPPORTED_OPTION);
+	*done = 0;
+
+	if ((r = async_reply(dev, &ready, ms)) != FIDO_OK) {
+		fido_log_debug("%s: async_reply", __func__);
+		goto fail;
 	}
+	if (ready == 0)
+		return (FIDO_OK); /* keep waiting */
 
-	if ((r = fido_assert_set_count(fa, fa->allow_list.len)) != FIDO_OK) {
-		fido_log_debug("%s: fido_assert_set_count", __func__);
-		return (r);
+	if ((r = auth_reply_set(fa, u->pos, u->rp_id_hash, a->buf,
+	    a->len)) != FIDO_OK) {
+		fido_log_debug("%s: auth_reply_set", __func__);
+		goto fail;
 	}
 
-	for (size_t i = 0; i < fa->allow_list.len; i++) {
-		switch ((r = u2f_authenticate_single(dev,
-		    &fa->allow_list.ptr[i], fa, nfound, ms))) {
-		case FIDO_OK:
-			nauth_ok++;
-			FALLTHROUGH
-		case FIDO_ERR_USER_PRESENCE_REQUIRED:
-			nfound++;
-			break;
-		default:
-			if (r != FIDO_ERR_CREDENTIAL_EXCLUDED) {
-				fido_log_debug("%s: u2f_authenticate_single",
-				    __func__);
-				return (r);
-			}
-			/* ignore credentials that don't exist */
+	if (++u->pos < u->nfound) {
+		if ((r = auth_next(dev, fa)) != FIDO_OK) {
+			fido_log_debug("%s: auth_next", __func__);
+			goto fail;
 		}
+		return (FIDO_OK); /* next handle */
 	}
 
-	fa->stmt_len = nfound;
+	fa->stmt_len = u->nfound;
+	r = FIDO_OK;
+fail:
+	fido_rx_async_end(dev);
+	*done = r == FIDO_OK;
 
-	if (nfound == 0)
-		return (FIDO_ERR_NO_CREDENTIALS);
-	if (nauth_ok == 0)
-		return (FIDO_ERR_USER_PRESENCE_REQUIRED);
+	return (r);
+}
 
-	return (FIDO_OK);
+int
+u2f_register_begin(fido_dev_t *dev, fido_cred_t *cred)
+{
+	struct u2f_async	*u;
+	int			 ms = dev->timeout_ms;
+	int			 excluded;
+	int			 r;
+
+	if ((r = async_begin(dev, FIDO_DEV_ASYNC_CRED,
+	    U2F_ASYNC_REGISTER)) != FIDO_OK)
+		return (r);
+
+	u = dev->async->u2f;
+
+	if ((r = register_probe(dev, cred, u->rp_id_hash, &excluded,
+	    &ms)) != FIDO_OK) {
+		fido_log_debug("%s: register_probe", __func__);
+		goto fail;
+	}
+
+	/* an excluded credential still waits for user presence */
+	if (excluded) {
+		u->kind = U2F_ASYNC_EXCLUDED;
+		u->apdu = dummy_register_apdu();
+	} else
+		u->apdu = register_apdu(cred->cdh.ptr, u->rp_id_hash);
+
+	if (u->apdu == NULL) {
+		fido_log_debug("%s: apdu", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+
+	if ((r = async_start(dev)) != FIDO_OK) {
+		fido_log_debug("%s: async_start", __func__);
+		goto fail;
+	}
+
+	r = FIDO_OK;
+fail:
+	if (r != FIDO_OK)
+		fido_rx_async_end(dev);
+
+	return (r);
 }
 
 int
-u2f_get_touch_begin(fido_dev_t *dev, int *ms)
+u2f_register_step(fido_dev_t *dev, fido_cred_t *cred, int *done, int ms)
+{
+	struct fido_dev_async	*a = dev->async;
+	int			 ready;
+	int			 r;
+
+	*done = 0;
+
+	if ((r = async_reply(dev, &ready, ms)) != FIDO_OK) {
+		fido_log_debug("%s: async_reply", __func__);
+		goto fail;
+	}
+	if (ready == 0)
+		return (FIDO_OK); /* keep waiting */
+
+	if (a->u2f->kind == U2F_ASYNC_EXCLUDED)
+		r = FIDO_ERR_CREDENTIAL_EXCLUDED;
+	else if ((r = parse_register_reply(cred, a->buf, a->len)) != FIDO_OK)
+		fido_log_debug("%s: parse_register_reply", __func__);
+fail:
+	fido_rx_async_end(dev);
+	*done = r == FIDO_OK;
+
+	return (r);
+}
+
+static int
+touch_tx(fido_dev_t *dev, int *ms)
 {
 	iso7816_apdu_t	*apdu = NULL;
 	const char	*clientdata = FIDO_DUMMY_CLIENTDATA;
 	const char	*rp_id = FIDO_DUMMY_RP_ID;
-	unsigned char	*reply = NULL;
 	unsigned char	 clientdata_hash[SHA256_DIGEST_LENGTH];
 	unsigned char	 rp_id_hash[SHA256_DIGEST_LENGTH];
 	int		 r;
@@ -879,26 +1325,12 @@ u2f_get_touch_begin(fido_dev_t *dev, int *ms)
 		return (FIDO_ERR_INTERNAL);
 	}
 
-	if ((apdu = iso7816_new(0, U2F_CMD_REGISTER, 0, 2 *
-	    SHA256_DIGEST_LENGTH)) == NULL ||
-	    iso7816_add(apdu, clientdata_hash, sizeof(clientdata_hash)) < 0 ||
-	    iso7816_add(apdu, rp_id_hash, sizeof(rp_id_hash)) < 0) {
-		fido_log_debug("%s: iso7816", __func__);
+	if ((apdu = register_apdu(clientdata_hash, rp_id_hash)) == NULL) {
+		fido_log_debug("%s: register_apdu", __func__);
 		r = FIDO_ERR_INTERNAL;
 		goto fail;
 	}
 
-	if ((reply = malloc(FIDO_MAXMSG)) == NULL) {
-		fido_log_debug("%s: malloc", __func__);
-		r =  FIDO_ERR_INTERNAL;
-		goto fail;
-	}
-
-	if (dev->attr.flags & FIDO_CAP_WINK) {
-		fido_tx(dev, CTAP_CMD_WINK, NULL, 0, ms);
-		fido_rx(dev, CTAP_CMD_WINK, reply, FIDO_MAXMSG, ms);
-	}
-
 	if (fido_tx(dev, CTAP_CMD_MSG, iso7816_ptr(apdu),
 	    iso7816_len(apdu), ms) < 0) {
 		fido_log_debug("%s: fido_tx", __func__);
@@ -909,25 +1341,55 @@ u2f_get_touch_begin(fido_dev_t *dev, int *ms)
 	r = FIDO_OK;
 fail:
 	iso7816_free(&apdu);
-	freezero(reply, FIDO_MAXMSG);
 
 	return (r);
 }
 
+int
+u2f_get_touch_begin(fido_dev_t *dev, int *ms)
+{
+	unsigned char	*reply = NULL;
+	size_t		 replysiz = 0;
+
+	if (dev->attr.flags & FIDO_CAP_WINK) {
+		if ((reply = fido_rx_buf_get(dev, FIDO_MAXMSG,
+		    &replysiz)) == NULL) {
+			fido_log_debug("%s: fido_rx_buf_get", __func__);
+			return (FIDO_ERR_INTERNAL);
+		}
+		fido_tx(dev, CTAP_CMD_WINK, NULL, 0, ms);
+		fido_rx(dev, CTAP_CMD_WINK, reply, replysiz, ms);
+		fido_rx_buf_put(dev, reply, replysiz);
+	}
+
+	if (fido_time_now(&dev->u2f_touch_ts) != 0)
+		return (FIDO_ERR_INTERNAL);
+
+	return (touch_tx(dev, ms));
+}
+
+/* ms before a pending touch request should be looked at again */
+int
+u2f_get_touch_pace(const fido_dev_t *dev)
+{
+	return ((int)pace_ms(elapsed_ms(&dev->u2f_touch_ts)));
+}
+
 int
 u2f_get_touch_status(fido_dev_t *dev, int *touched, int *ms)
 {
 	unsigned char	*reply;
+	size_t		 replysiz;
 	int		 reply_len;
 	int		 r;
 
-	if ((reply = malloc(FIDO_MAXMSG)) == NULL) {
-		fido_log_debug("%s: malloc", __func__);
+	if ((reply = fido_rx_buf_get(dev, FIDO_MAXMSG, &replysiz)) == NULL) {
+		fido_log_debug("%s: fido_rx_buf_get", __func__);
 		r =  FIDO_ERR_INTERNAL;
 		goto out;
 	}
 
-	if ((reply_len = fido_rx(dev, CTAP_CMD_MSG, reply, FIDO_MAXMSG,
+	if ((reply_len = fido_rx(dev, CTAP_CMD_MSG, reply, replysiz,
 	    ms)) < 2) {
 		fido_log_debug("%s: fido_rx", __func__);
 		r = FIDO_OK; /* ignore */
@@ -936,8 +1398,15 @@ u2f_get_touch_status(fido_dev_t *dev, int *touched, int *ms)
 
 	switch ((reply[reply_len - 2] << 8) | reply[reply_len - 1]) {
 	case SW_CONDITIONS_NOT_SATISFIED:
-		if ((r = u2f_get_touch_begin(dev, ms)) != FIDO_OK) {
-			fido_log_debug("%s: u2f_get_touch_begin", __func__);
+		/* pace the next request, within the caller's timeout */
+		if (delay_ms(pace_ms(elapsed_ms(&dev->u2f_touch_ts)),
+		    ms) != 0) {
+			fido_log_debug("%s: delay_ms", __func__);
+			r = FIDO_ERR_RX;
+			goto out;
+		}
+		if ((r = touch_tx(dev, ms)) != FIDO_OK) {
+			fido_log_debug("%s: touch_tx", __func__);
 			goto out;
 		}
 		*touched = 0;
@@ -953,7 +1422,7 @@ u2f_get_touch_status(fido_dev_t *dev, int *touched, int *ms)
 
 	r = FIDO_OK;
 out:
-	freezero(reply, FIDO_MAXMSG);
+	fido_rx_buf_put(dev, reply, replysiz);
 
 	return (r);
 }
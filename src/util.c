@@ -9,6 +9,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include <openssl/sha.h>
+
 #include "fido.h"
 
 int
@@ -29,3 +31,31 @@ fido_to_uint64(const char *str, int base, uint64_t *out)
 
 	return 0;
 }
+
+int
+fido_sha256(fido_blob_t *digest, const u_char *data, size_t data_len)
+{
+	if ((digest->ptr = fido_calloc(1, SHA256_DIGEST_LENGTH)) == NULL)
+		return -1;
+
+	digest->len = SHA256_DIGEST_LENGTH;
+
+	if (SHA256(data, data_len, digest->ptr) != digest->ptr) {
+		fido_blob_reset(digest);
+		return -1;
+	}
+
+	return 0;
+}
+
+#ifdef FIDO_VERIFY_ONLY
+/* fido_init() for libfido2_verify, which has no devices to configure */
+void
+fido_init(int flags)
+{
+	if (flags & FIDO_DEBUG || getenv("FIDO_DEBUG") != NULL)
+		fido_log_init();
+	if (flags & FIDO_PRELOAD_CRYPTO)
+		fido_evp_preload();
+}
+#endif
@@ -0,0 +1,500 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include <openssl/sha.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "fido.h"
+#include "fido/verify.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/*
+ * A bounded cache of signature verification results, so that an
+ * assertion delivered more than once, by a retrying client or a proxy,
+ * costs a hash and a lookup. Entries are keyed by SHA-256 over the
+ * algorithm, the key, the authenticator data, the client data hash and
+ * the signature, hold FIDO_OK or FIDO_ERR_INVALID_SIG, and expire ttl
+ * milliseconds after they were stored. Slots are grouped in sets of
+ * VCACHE_WAYS; a full set evicts the entry closest to expiry.
+ *
+ * The slots may be in a file mapped by several processes, which then
+ * share the entries. Each slot is guarded by a sequence number, odd
+ * while the slot is written: a writer claims the slot by making it odd
+ * with compare-and-swap, and gives up, as it is only a cache, if it is
+ * odd already; a reader copies the slot and discards the copy unless the
+ * number was even and unchanged throughout. No process ever waits for
+ * another. A writer that dies mid-write leaves its slot unused. A mapped
+ * file holds the header followed by the slots:
+ *
+ *	magic[4] version[1] reserved[3] nslot[8] reserved[48]
+ *
+ * A cached result depends on nothing but its key, so entries need not be
+ * invalidated. Expiry is taken from CLOCK_REALTIME, which all processes
+ * on a host share and which, unlike CLOCK_MONOTONIC, does not start over
+ * when the host reboots and leaves the file behind; version 1 files held
+ * monotonic times.
+ */
+
+#define VCACHE_MAGIC	"F2VC"
+#define VCACHE_VERSION	2
+#define VCACHE_HDRLEN	64
+#define VCACHE_WAYS	4
+#ifdef HAVE_SYS_MMAN_H
+#define VCACHE_CLOCK	CLOCK_REALTIME
+#else
+/* no cache files; compat clock_gettime() only has CLOCK_MONOTONIC */
+#define VCACHE_CLOCK	CLOCK_MONOTONIC
+#endif
+#define VCACHE_MAXSLOT	(SIZE_MAX / 2 / sizeof(struct vcache_slot))
+
+struct vcache_slot {
+	uint32_t	seq;    /* odd while being written */
+	int32_t		result;
+	uint64_t	expiry; /* ms since the epoch; zero if free */
+	unsigned char	dgst[SHA256_DIGEST_LENGTH];
+};
+
+struct fido_verify_cache {
+	struct vcache_slot	*slot;   /* nslot slots */
+	size_t			 nslot;  /* a power of two */
+	uint64_t		 ttl;    /* ms */
+	uint64_t		 hits;   /* lookups answered */
+	uint64_t		 misses; /* lookups not answered */
+	unsigned char		*map;    /* mapped file, if any */
+	size_t			 maplen; /* length of map */
+#if defined(HAVE_PTHREAD)
+	pthread_mutex_t		 lock;
+#elif defined(_WIN32)
+	SRWLOCK			 lock;
+#endif
+};
+
+#if defined(HAVE_PTHREAD)
+#define VCACHE_LOCK_INIT(c)	pthread_mutex_init(&(c)->lock, NULL)
+#define VCACHE_LOCK_FREE(c)	pthread_mutex_destroy(&(c)->lock)
+#define VCACHE_LOCK(c)		pthread_mutex_lock(&(c)->lock)
+#define VCACHE_UNLOCK(c)	pthread_mutex_unlock(&(c)->lock)
+#elif defined(_WIN32)
+#define VCACHE_LOCK_INIT(c)	(InitializeSRWLock(&(c)->lock), 0)
+#define VCACHE_LOCK_FREE(c)	do { } while (0)
+#define VCACHE_LOCK(c)		AcquireSRWLockExclusive(&(c)->lock)
+#define VCACHE_UNLOCK(c)	ReleaseSRWLockExclusive(&(c)->lock)
+#else
+#define VCACHE_LOCK_INIT(c)	0
+#define VCACHE_LOCK_FREE(c)	do { } while (0)
+#define VCACHE_LOCK(c)		do { } while (0)
+#define VCACHE_UNLOCK(c)	do { } while (0)
+#endif
+
+#ifdef _MSC_VER
+#define CAS32(p, o, n)	(InterlockedCompareExchange((volatile LONG *)(p), \
+			    (LONG)(n), (LONG)(o)) == (LONG)(o))
+#define LOAD32(p)	((uint32_t)InterlockedCompareExchange( \
+			    (volatile LONG *)(p), 0, 0))
+#define STORE32(p, v)	InterlockedExchange((volatile LONG *)(p), (LONG)(v))
+#define FENCE()		MemoryBarrier()
+#else
+#define CAS32(p, o, n)	__atomic_compare_exchange_n((p), &(uint32_t){ (o) }, \
+			    (n), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#define LOAD32(p)	__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define STORE32(p, v)	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define FENCE()		__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#endif
+
+fido_verify_cache_t *
+fido_verify_cache_new(void)
+{
+	fido_verify_cache_t *c;
+
+	if ((c = fido_calloc(1, sizeof(*c))) == NULL)
+		return (NULL);
+	if (VCACHE_LOCK_INIT(c) != 0) {
+		fido_free(c);
+		return (NULL);
+	}
+
+	return (c);
+}
+
+static void
+vcache_unmap(unsigned char *map, size_t maplen, struct vcache_slot *slot)
+{
+#ifdef HAVE_SYS_MMAN_H
+	if (map != NULL) {
+		munmap(map, maplen);
+		return;
+	}
+#else
+	(void)map;
+	(void)maplen;
+#endif
+	fido_free(slot);
+}
+
+void
+fido_verify_cache_free(fido_verify_cache_t **c_p)
+{
+	fido_verify_cache_t *c;
+
+	if (c_p == NULL || (c = *c_p) == NULL)
+		return;
+	VCACHE_LOCK_FREE(c);
+	vcache_unmap(c->map, c->maplen, c->slot);
+	fido_free(c);
+	*c_p = NULL;
+}
+
+static bool
+vcache_nslot_ok(size_t nslot)
+{
+	return (nslot >= VCACHE_WAYS && nslot <= VCACHE_MAXSLOT &&
+	    (nslot & (nslot - 1)) == 0);
+}
+
+static void
+vcache_set_slots(fido_verify_cache_t *c, struct vcache_slot *slot,
+    size_t nslot, int ttl_ms, unsigned char *map, size_t maplen)
+{
+	struct vcache_slot	*old_slot;
+	unsigned char		*old_map;
+	size_t			 old_maplen;
+
+	VCACHE_LOCK(c);
+	old_slot = c->slot;
+	old_map = c->map;
+	old_maplen = c->maplen;
+	c->slot = slot;
+	c->nslot = nslot;
+	c->map = map;
+	c->maplen = maplen;
+	c->ttl = (uint64_t)ttl_ms;
+	c->hits = 0;
+	c->misses = 0;
+	VCACHE_UNLOCK(c);
+
+	vcache_unmap(old_map, old_maplen, old_slot);
+}
+
+int
+fido_verify_cache_alloc(fido_verify_cache_t *c, size_t nslot, int ttl_ms)
+{
+	struct vcache_slot *slot;
+
+	if (!vcache_nslot_ok(nslot) || ttl_ms <= 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if ((slot = fido_calloc(nslot, sizeof(*slot))) == NULL)
+		return (FIDO_ERR_INTERNAL);
+
+	vcache_set_slots(c, slot, nslot, ttl_ms, NULL, 0);
+
+	return (FIDO_OK);
+}
+
+#ifdef HAVE_SYS_MMAN_H
+/* create a cache file at path, unless one already exists */
+static int
+vcache_create(const char *path, size_t nslot)
+{
+	unsigned char	 hdr[VCACHE_HDRLEN];
+	char		*tmp = NULL;
+	int		 fd = -1;
+	int		 ok = -1;
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr, VCACHE_MAGIC, 4);
+	hdr[4] = VCACHE_VERSION;
+	for (size_t i = 0; i < 8; i++)
+		hdr[8 + i] = (unsigned char)((uint64_t)nslot >> (56 - 8 * i));
+	if (fido_asprintf(&tmp, "%s.XXXXXX", path) == -1) {
+		tmp = NULL;
+		goto fail;
+	}
+	if ((fd = mkstemp(tmp)) == -1) {
+		fido_log_error(errno, "%s: mkstemp", __func__);
+		goto fail;
+	}
+	/* the slots are zeroed by ftruncate() */
+	if (write(fd, hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr) ||
+	    ftruncate(fd, (off_t)(VCACHE_HDRLEN +
+	    nslot * sizeof(struct vcache_slot))) == -1) {
+		fido_log_error(errno, "%s: write", __func__);
+		goto fail;
+	}
+	/* a cache created meanwhile by someone else wins */
+	if (link(tmp, path) == -1 && errno != EEXIST) {
+		fido_log_error(errno, "%s: link", __func__);
+		goto fail;
+	}
+
+	ok = 0;
+fail:
+	if (fd != -1) {
+		close(fd);
+		unlink(tmp);
+	}
+	fido_free(tmp);
+
+	return (ok);
+}
+
+int
+fido_verify_cache_map(fido_verify_cache_t *c, const char *path, size_t nslot,
+    int ttl_ms)
+{
+	struct stat	 st;
+	unsigned char	*map = MAP_FAILED;
+	uint64_t	 n = 0;
+	int		 fd = -1;
+	int		 r = FIDO_ERR_INVALID_ARGUMENT;
+
+	if (path == NULL || (nslot != 0 && !vcache_nslot_ok(nslot)) ||
+	    ttl_ms <= 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	if ((fd = open(path, O_RDWR | O_CLOEXEC)) == -1 && errno == ENOENT &&
+	    nslot != 0) {
+		if (vcache_create(path, nslot) < 0) {
+			r = FIDO_ERR_INTERNAL;
+			goto fail;
+		}
+		fd = open(path, O_RDWR | O_CLOEXEC);
+	}
+	if (fd == -1) {
+		fido_log_error(errno, "%s: open %s", __func__, path);
+		goto fail;
+	}
+	if (fstat(fd, &st) == -1 || st.st_size < VCACHE_HDRLEN ||
+	    (uintmax_t)st.st_size > SIZE_MAX) {
+		fido_log_debug("%s: fstat", __func__);
+		goto fail;
+	}
+	if ((map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE,
+	    MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		fido_log_error(errno, "%s: mmap", __func__);
+		goto fail;
+	}
+	for (size_t i = 0; i < 8; i++)
+		n = n << 8 | map[8 + i];
+	if (memcmp(map, VCACHE_MAGIC, 4) != 0 || map[4] != VCACHE_VERSION ||
+	    n > SIZE_MAX || !vcache_nslot_ok((size_t)n) || (size_t)n !=
+	    ((size_t)st.st_size - VCACHE_HDRLEN) / sizeof(struct vcache_slot) ||
+	    (nslot != 0 && n != nslot)) {
+		fido_log_debug("%s: invalid header, nslot=%llu", __func__,
+		    (unsigned long long)n);
+		goto fail;
+	}
+
+	vcache_set_slots(c, (struct vcache_slot *)(void *)(map +
+	    VCACHE_HDRLEN), (size_t)n, ttl_ms, map, (size_t)st.st_size);
+	map = MAP_FAILED;
+
+	r = FIDO_OK;
+fail:
+	if (map != MAP_FAILED)
+		munmap(map, (size_t)st.st_size);
+	if (fd != -1)
+		close(fd);
+
+	return (r);
+}
+#else
+int
+fido_verify_cache_map(fido_verify_cache_t *c, const char *path, size_t nslot,
+    int ttl_ms)
+{
+	(void)c;
+	(void)path;
+	(void)nslot;
+	(void)ttl_ms;
+
+	return (FIDO_ERR_UNSUPPORTED_OPTION);
+}
+#endif /* HAVE_SYS_MMAN_H */
+
+void
+fido_verify_cache_stats(fido_verify_cache_t *c, uint64_t *hits,
+    uint64_t *misses)
+{
+	VCACHE_LOCK(c);
+	if (hits != NULL)
+		*hits = c->hits;
+	if (misses != NULL)
+		*misses = c->misses;
+	VCACHE_UNLOCK(c);
+}
+
+static int
+vcache_now(uint64_t *ms)
+{
+	struct timespec ts;
+
+	/* not fido_time_now(), which the verification-only library lacks */
+	if (clock_gettime(VCACHE_CLOCK, &ts) != 0) {
+		fido_log_debug("%s: clock_gettime", __func__);
+		return (-1);
+	}
+	*ms = (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+
+	return (0);
+}
+
+static void
+vcache_update_len(SHA256_CTX *ctx, size_t len)
+{
+	unsigned char	buf[8];
+	uint64_t	v = len;
+
+	for (size_t i = 0; i < sizeof(buf); i++)
+		buf[i] = (unsigned char)(v >> (8 * (7 - i)));
+	SHA256_Update(ctx, buf, sizeof(buf));
+}
+
+/* the cache key of a verification; each input is prefixed by its length */
+int
+fido_verify_cache_digest(const fido_verify_key_t *key,
+    const fido_blob_t *authdata, const fido_blob_t *cdh,
+    const fido_blob_t *sig, unsigned char *dgst)
+{
+	SHA256_CTX	ctx;
+	unsigned char	type[4];
+
+	type[0] = (unsigned char)((uint32_t)key->type >> 24);
+	type[1] = (unsigned char)((uint32_t)key->type >> 16);
+	type[2] = (unsigned char)((uint32_t)key->type >> 8);
+	type[3] = (unsigned char)key->type;
+
+	if (SHA256_Init(&ctx) != 1)
+		return (-1);
+	SHA256_Update(&ctx, type, sizeof(type));
+	SHA256_Update(&ctx, key->id, sizeof(key->id));
+	vcache_update_len(&ctx, authdata->len);
+	SHA256_Update(&ctx, authdata->ptr, authdata->len);
+	vcache_update_len(&ctx, cdh->len);
+	SHA256_Update(&ctx, cdh->ptr, cdh->len);
+	vcache_update_len(&ctx, sig->len);
+	SHA256_Update(&ctx, sig->ptr, sig->len);
+	if (SHA256_Final(dgst, &ctx) != 1)
+		return (-1);
+
+	return (0);
+}
+
+static size_t
+vcache_set(const fido_verify_cache_t *c, const unsigned char *dgst)
+{
+	size_t h = 0;
+
+	for (size_t i = 0; i < sizeof(h); i++)
+		h = h << 8 | dgst[i];
+
+	return (h & (c->nslot - 1) & ~(size_t)(VCACHE_WAYS - 1));
+}
+
+/* a consistent copy of s, or false if it is being written */
+static bool
+vcache_read(const struct vcache_slot *s, struct vcache_slot *copy)
+{
+	uint32_t seq;
+
+	if ((seq = LOAD32(&s->seq)) & 1)
+		return (false);
+	memcpy(copy, s, sizeof(*copy));
+	FENCE();
+
+	return (LOAD32(&s->seq) == seq);
+}
+
+int
+fido_verify_cache_get(fido_verify_cache_t *c, const unsigned char *dgst,
+    int *result)
+{
+	struct vcache_slot	*s, e;
+	uint64_t		 now;
+	int			 r = FIDO_ERR_NOTFOUND;
+
+	if (vcache_now(&now) < 0)
+		return (FIDO_ERR_INTERNAL);
+
+	VCACHE_LOCK(c);
+	if (c->nslot == 0)
+		goto out;
+	s = &c->slot[vcache_set(c, dgst)];
+	for (size_t i = 0; i < VCACHE_WAYS; i++)
+		if (vcache_read(&s[i], &e) && e.expiry > now &&
+		    memcmp(e.dgst, dgst, sizeof(e.dgst)) == 0) {
+			*result = e.result;
+			r = FIDO_OK;
+			break;
+		}
+	if (r == FIDO_OK)
+		c->hits++;
+	else
+		c->misses++;
+out:
+	VCACHE_UNLOCK(c);
+
+	return (r);
+}
+
+void
+fido_verify_cache_put(fido_verify_cache_t *c, const unsigned char *dgst,
+    int result)
+{
+	struct vcache_slot	*s, *victim, e;
+	uint64_t		 now, expiry = UINT64_MAX;
+	uint32_t		 seq;
+
+	if (vcache_now(&now) < 0)
+		return;
+
+	VCACHE_LOCK(c);
+	if (c->nslot == 0)
+		goto out;
+	s = &c->slot[vcache_set(c, dgst)];
+	victim = &s[0];
+	for (size_t i = 0; i < VCACHE_WAYS; i++) {
+		if (!vcache_read(&s[i], &e))
+			continue;
+		if (memcmp(e.dgst, dgst, sizeof(e.dgst)) == 0) {
+			victim = &s[i];
+			break;
+		}
+		if (e.expiry < expiry) {
+			victim = &s[i];
+			expiry = e.expiry;
+		}
+	}
+	/* another writer has the slot; drop the entry */
+	if ((seq = LOAD32(&victim->seq)) & 1 || !CAS32(&victim->seq, seq,
+	    seq + 1))
+		goto out;
+	FENCE();
+	memcpy(victim->dgst, dgst, sizeof(victim->dgst));
+	victim->expiry = now + c->ttl;
+	victim->result = result;
+	STORE32(&victim->seq, seq + 2);
+out:
+	VCACHE_UNLOCK(c);
+}
@@ -0,0 +1,436 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "fido.h"
+#include "fido/verify.h"
+
+#define VERIFIER_JOB_ASSERT	1
+#define VERIFIER_JOB_CRED	2
+#define VERIFIER_MAXTHREADS	256
+
+struct verifier_job {
+	struct verifier_job		*next;
+	int				 type;   /* VERIFIER_JOB_* */
+	fido_assert_verify_item_t	 assert; /* if type == JOB_ASSERT */
+	const fido_cred_t		*cred;   /* if type == JOB_CRED */
+	void				*cookie; /* caller's cookie */
+	size_t				 idx;    /* position in the batch */
+	int				 result; /* outcome of verification */
+};
+
+struct verifier_queue {
+	struct verifier_job *head;
+	struct verifier_job *tail;
+};
+
+struct fido_verifier {
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t		 lock;
+	pthread_cond_t		 work;     /* jobs queued or stop set */
+	pthread_cond_t		 done;     /* results queued or job finished */
+	pthread_t		*thread;   /* worker threads */
+#endif
+	size_t			 nthreads; /* number of worker threads */
+	struct verifier_queue	 jobs;     /* submitted jobs */
+	struct verifier_queue	 results;  /* completed jobs */
+	size_t			 pending;  /* jobs not yet handed back */
+	fido_verifier_cb_t	*cb;       /* completion callback */
+	bool			 stop;     /* workers should exit */
+};
+
+static void
+queue_push(struct verifier_queue *q, struct verifier_job *job)
+{
+	job->next = NULL;
+	if (q->tail != NULL)
+		q->tail->next = job;
+	else
+		q->head = job;
+	q->tail = job;
+}
+
+static struct verifier_job *
+queue_pop(struct verifier_queue *q)
+{
+	struct verifier_job *job;
+
+	if ((job = q->head) != NULL) {
+		if ((q->head = job->next) == NULL)
+			q->tail = NULL;
+		job->next = NULL;
+	}
+
+	return (job);
+}
+
+static void
+queue_free(struct verifier_queue *q)
+{
+	struct verifier_job *job;
+
+	while ((job = queue_pop(q)) != NULL)
+		fido_free(job);
+}
+
+static void
+run_job(struct verifier_job *job)
+{
+	const fido_assert_verify_item_t *a = &job->assert;
+
+	switch (job->type) {
+	case VERIFIER_JOB_ASSERT:
+		if (a->assert == NULL)
+			job->result = FIDO_ERR_INVALID_ARGUMENT;
+		else
+			job->result = fido_assert_verify(a->assert, a->idx,
+			    a->cose_alg, a->pk);
+		break;
+	case VERIFIER_JOB_CRED:
+		if (job->cred == NULL)
+			job->result = FIDO_ERR_INVALID_ARGUMENT;
+		else
+			job->result = fido_cred_verify(job->cred);
+		break;
+	default:
+		job->result = FIDO_ERR_INTERNAL;
+		break;
+	}
+}
+
+#ifdef HAVE_PTHREAD
+static void *
+verifier_worker(void *arg)
+{
+	fido_verifier_t		*v = arg;
+	struct verifier_job	*job;
+	fido_verifier_cb_t	*cb;
+
+	pthread_mutex_lock(&v->lock);
+	for (;;) {
+		while (v->jobs.head == NULL && v->stop == false)
+			pthread_cond_wait(&v->work, &v->lock);
+		if ((job = queue_pop(&v->jobs)) == NULL)
+			break; /* stop set and no work left */
+		cb = v->cb;
+		pthread_mutex_unlock(&v->lock);
+		run_job(job);
+		if (cb != NULL) {
+			cb(job->cookie, job->idx, job->result);
+			fido_free(job);
+			job = NULL;
+		}
+		pthread_mutex_lock(&v->lock);
+		if (job != NULL)
+			queue_push(&v->results, job);
+		else
+			v->pending--;
+		pthread_cond_broadcast(&v->done);
+	}
+	pthread_mutex_unlock(&v->lock);
+
+	return (NULL);
+}
+
+static void
+verifier_stop(fido_verifier_t *v, size_t nthreads)
+{
+	pthread_mutex_lock(&v->lock);
+	v->stop = true;
+	pthread_cond_broadcast(&v->work);
+	pthread_mutex_unlock(&v->lock);
+
+	for (size_t i = 0; i < nthreads; i++)
+		pthread_join(v->thread[i], NULL);
+}
+
+static int
+verifier_start(fido_verifier_t *v)
+{
+	size_t i;
+
+	if ((v->thread = fido_calloc(v->nthreads, sizeof(*v->thread))) == NULL)
+		return (-1);
+	if (pthread_mutex_init(&v->lock, NULL) != 0) {
+		fido_free(v->thread);
+		return (-1);
+	}
+	if (pthread_cond_init(&v->work, NULL) != 0) {
+		pthread_mutex_destroy(&v->lock);
+		fido_free(v->thread);
+		return (-1);
+	}
+	if (pthread_cond_init(&v->done, NULL) != 0) {
+		pthread_cond_destroy(&v->work);
+		pthread_mutex_destroy(&v->lock);
+		fido_free(v->thread);
+		return (-1);
+	}
+
+	for (i = 0; i < v->nthreads; i++) {
+		if (pthread_create(&v->thread[i], NULL, verifier_worker,
+		    v) != 0) {
+			fido_log_debug("%s: pthread_create", __func__);
+			verifier_stop(v, i);
+			pthread_cond_destroy(&v->done);
+			pthread_cond_destroy(&v->work);
+			pthread_mutex_destroy(&v->lock);
+			fido_free(v->thread);
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+#endif /* HAVE_PTHREAD */
+
+static size_t
+online_cpus(void)
+{
+#if defined(HAVE_SYSCONF) && defined(_SC_NPROCESSORS_ONLN)
+	long n;
+
+	if ((n = sysconf(_SC_NPROCESSORS_ONLN)) > 0)
+		return (n > VERIFIER_MAXTHREADS ? VERIFIER_MAXTHREADS :
+		    (size_t)n);
+#endif
+	return (1);
+}
+
+fido_verifier_t *
+fido_verifier_new(size_t nthreads)
+{
+	fido_verifier_t *v;
+
+	if (nthreads > VERIFIER_MAXTHREADS) {
+		fido_log_debug("%s: nthreads=%zu", __func__, nthreads);
+		return (NULL);
+	}
+	if ((v = fido_calloc(1, sizeof(*v))) == NULL)
+		return (NULL);
+	v->nthreads = nthreads ? nthreads : online_cpus();
+#ifdef HAVE_PTHREAD
+	if (verifier_start(v) < 0) {
+		fido_log_debug("%s: verifier_start", __func__);
+		fido_free(v);
+		return (NULL);
+	}
+#endif
+
+	return (v);
+}
+
+void
+fido_verifier_free(fido_verifier_t **v_p)
+{
+	fido_verifier_t *v;
+
+	if (v_p == NULL || (v = *v_p) == NULL)
+		return;
+#ifdef HAVE_PTHREAD
+	verifier_stop(v, v->nthreads);
+	pthread_cond_destroy(&v->done);
+	pthread_cond_destroy(&v->work);
+	pthread_mutex_destroy(&v->lock);
+	fido_free(v->thread);
+#endif
+	queue_free(&v->jobs);
+	queue_free(&v->results);
+	fido_free(v);
+	*v_p = NULL;
+}
+
+int
+fido_verifier_set_callback(fido_verifier_t *v, fido_verifier_cb_t *cb)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&v->lock);
+#endif
+	v->cb = cb;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&v->lock);
+#endif
+
+	return (FIDO_OK);
+}
+
+static void
+verifier_enqueue(fido_verifier_t *v, struct verifier_queue *batch, size_t n)
+{
+	struct verifier_job *job;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&v->lock);
+	while ((job = queue_pop(batch)) != NULL)
+		queue_push(&v->jobs, job);
+	v->pending += n;
+	pthread_cond_broadcast(&v->work);
+	pthread_mutex_unlock(&v->lock);
+#else
+	/* no worker threads; verify inline */
+	while ((job = queue_pop(batch)) != NULL) {
+		run_job(job);
+		if (v->cb != NULL) {
+			v->cb(job->cookie, job->idx, job->result);
+			fido_free(job);
+		} else {
+			queue_push(&v->results, job);
+			v->pending++;
+		}
+	}
+	(void)n;
+#endif
+}
+
+int
+fido_verifier_submit_assert(fido_verifier_t *v,
+    const fido_assert_verify_item_t *item, size_t n, void *cookie)
+{
+	struct verifier_queue	 batch;
+	struct verifier_job	*job;
+
+	memset(&batch, 0, sizeof(batch));
+
+	if (item == NULL || n == 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	for (size_t i = 0; i < n; i++) {
+		if ((job = fido_calloc(1, sizeof(*job))) == NULL) {
+			queue_free(&batch);
+			return (FIDO_ERR_INTERNAL);
+		}
+		job->type = VERIFIER_JOB_ASSERT;
+		job->assert = item[i];
+		job->cookie = cookie;
+		job->idx = i;
+		queue_push(&batch, job);
+	}
+
+	verifier_enqueue(v, &batch, n);
+
+	return (FIDO_OK);
+}
+
+int
+fido_verifier_submit_cred(fido_verifier_t *v, const fido_cred_t * const *cred,
+    size_t n, void *cookie)
+{
+	struct verifier_queue	 batch;
+	struct verifier_job	*job;
+
+	memset(&batch, 0, sizeof(batch));
+
+	if (cred == NULL || n == 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	for (size_t i = 0; i < n; i++) {
+		if ((job = fido_calloc(1, sizeof(*job))) == NULL) {
+			queue_free(&batch);
+			return (FIDO_ERR_INTERNAL);
+		}
+		job->type = VERIFIER_JOB_CRED;
+		job->cred = cred[i];
+		job->cookie = cookie;
+		job->idx = i;
+		queue_push(&batch, job);
+	}
+
+	verifier_enqueue(v, &batch, n);
+
+	return (FIDO_OK);
+}
+
+#ifdef HAVE_PTHREAD
+static int
+verifier_deadline(struct timespec *ts, int ms)
+{
+	long nsec;
+
+	if (clock_gettime(CLOCK_REALTIME, ts) != 0) {
+		fido_log_debug("%s: clock_gettime", __func__);
+		return (-1);
+	}
+
+	nsec = ts->tv_nsec + (long)(ms % 1000) * 1000000L;
+	ts->tv_sec += ms / 1000 + nsec / 1000000000L;
+	ts->tv_nsec = nsec % 1000000000L;
+
+	return (0);
+}
+#endif
+
+int
+fido_verifier_poll(fido_verifier_t *v, void **cookie, size_t *idx,
+    int *result, int ms)
+{
+	struct verifier_job	*job;
+	int			 r;
+#ifdef HAVE_PTHREAD
+	struct timespec		 ts;
+#endif
+
+	if (cookie == NULL || idx == NULL || result == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+#ifdef HAVE_PTHREAD
+	if (ms > 0 && verifier_deadline(&ts, ms) < 0)
+		return (FIDO_ERR_INTERNAL);
+
+	pthread_mutex_lock(&v->lock);
+	while ((job = queue_pop(&v->results)) == NULL && v->pending > 0) {
+		if (ms == 0)
+			break;
+		if (ms < 0)
+			pthread_cond_wait(&v->done, &v->lock);
+		else if (pthread_cond_timedwait(&v->done, &v->lock, &ts) != 0) {
+			job = queue_pop(&v->results);
+			break;
+		}
+	}
+#else
+	(void)ms;
+	job = queue_pop(&v->results);
+#endif
+	if (job != NULL) {
+		v->pending--;
+		*cookie = job->cookie;
+		*idx = job->idx;
+		*result = job->result;
+		r = FIDO_OK;
+	} else if (v->pending == 0)
+		r = FIDO_ERR_NOTFOUND;
+	else
+		r = FIDO_ERR_TIMEOUT;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&v->lock);
+#endif
+	fido_free(job);
+
+	return (r);
+}
+
+size_t
+fido_verifier_pending(fido_verifier_t *v)
+{
+	size_t n;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&v->lock);
+#endif
+	n = v->pending;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&v->lock);
+#endif
+
+	return (n);
+}
@@ -0,0 +1,511 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <openssl/sha.h>
+#include <openssl/x509.h>
+
+#include "fido.h"
+#include "fido/es256.h"
+#include "fido/es384.h"
+#include "fido/rs256.h"
+#include "fido/eddsa.h"
+#include "fido/verify.h"
+#include "fallthrough.h"
+
+fido_verify_key_t *
+fido_verify_key_new(void)
+{
+	return (fido_calloc(1, sizeof(fido_verify_key_t)));
+}
+
+static void
+fido_verify_key_reset(fido_verify_key_t *key)
+{
+	EVP_PKEY_free(key->pkey);
+	key->pkey = NULL;
+	key->type = COSE_UNSPEC;
+	memset(key->id, 0, sizeof(key->id));
+}
+
+void
+fido_verify_key_free(fido_verify_key_t **key_p)
+{
+	fido_verify_key_t *key;
+
+	if (key_p == NULL || (key = *key_p) == NULL)
+		return;
+	fido_verify_key_reset(key);
+	fido_free(key);
+	*key_p = NULL;
+}
+
+/* what a fido_verify_cache_t knows a key by */
+static int
+verify_key_id(EVP_PKEY *pkey, unsigned char *id)
+{
+	unsigned char	*der = NULL;
+	int		 der_len, ok = -1;
+
+	if ((der_len = i2d_PUBKEY(pkey, &der)) <= 0 || der == NULL)
+		goto fail;
+	if (SHA256(der, (size_t)der_len, id) != id)
+		goto fail;
+
+	ok = 0;
+fail:
+	OPENSSL_free(der);
+
+	return (ok);
+}
+
+int
+fido_verify_key_from_pk(fido_verify_key_t *key, int cose_alg, const void *pk)
+{
+	EVP_PKEY	*pkey = NULL;
+	unsigned char	 id[SHA256_DIGEST_LENGTH];
+
+	if (pk == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	switch (cose_alg) {
+	case COSE_ES256:
+		pkey = es256_pk_to_EVP_PKEY(pk);
+		break;
+	case COSE_ES384:
+		pkey = es384_pk_to_EVP_PKEY(pk);
+		break;
+	case COSE_RS256:
+		pkey = rs256_pk_to_EVP_PKEY(pk);
+		break;
+	case COSE_EDDSA:
+		pkey = eddsa_pk_to_EVP_PKEY(pk);
+		break;
+	default:
+		fido_log_debug("%s: unsupported cose_alg %d", __func__,
+		    cose_alg);
+		return (FIDO_ERR_UNSUPPORTED_OPTION);
+	}
+
+	if (pkey == NULL) {
+		fido_log_debug("%s: pk_to_EVP_PKEY", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	if (verify_key_id(pkey, id) < 0) {
+		fido_log_debug("%s: verify_key_id", __func__);
+		EVP_PKEY_free(pkey);
+		return (FIDO_ERR_INTERNAL);
+	}
+
+	fido_verify_key_reset(key);
+	key->type = cose_alg;
+	key->pkey = pkey;
+	memcpy(key->id, id, sizeof(key->id));
+
+	return (FIDO_OK);
+}
+
+int
+fido_verify_key_from_cose(fido_verify_key_t *key, const unsigned char *ptr,
+    size_t len)
+{
+	cbor_item_t		*item = NULL;
+	struct cbor_load_result	 cbor;
+	union {
+		es256_pk_t es256;
+		es384_pk_t es384;
+		rs256_pk_t rs256;
+		eddsa_pk_t eddsa;
+	} pk;
+	int			 type;
+	int			 r;
+
+	memset(&pk, 0, sizeof(pk));
+
+	if (ptr == NULL || len == 0)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+
+	if ((item = cbor_load(ptr, len, &cbor)) == NULL) {
+		fido_log_debug("%s: cbor_load", __func__);
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto fail;
+	}
+
+	if (cbor_decode_pubkey(item, &type, &pk) < 0) {
+		fido_log_debug("%s: cbor_decode_pubkey", __func__);
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto fail;
+	}
+
+	r = fido_verify_key_from_pk(key, type, &pk);
+fail:
+	if (item != NULL)
+		cbor_decref(&item);
+
+	return (r);
+}
+
+/*
+ * Check the credential record of len bytes at ptr; on success, the
+ * record's cose algorithm and credential id are returned through type
+ * and id, id_len. The public key starts sizeof(fido_cred_record_t)
+ * bytes into the record.
+ */
+int
+fido_cred_record_parse(const unsigned char *ptr, size_t len, int *type,
+    const unsigned char **id, size_t *id_len)
+{
+	fido_cred_record_t	rec;
+	size_t			pk_len, want;
+
+	if (ptr == NULL || len < sizeof(rec)) {
+		fido_log_debug("%s: len=%zu", __func__, len);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	/* ptr need not be aligned */
+	memcpy(&rec, ptr, sizeof(rec));
+	if (memcmp(rec.magic, FIDO_CRED_RECORD_MAGIC, sizeof(rec.magic)) != 0 ||
+	    rec.version != FIDO_CRED_RECORD_VERSION) {
+		fido_log_debug("%s: version=%u", __func__, rec.version);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	*type = (int)(int32_t)be32toh(rec.type);
+	pk_len = be16toh(rec.pk_len);
+	*id_len = be16toh(rec.id_len);
+
+	switch (*type) {
+	case COSE_ES256:
+		want = sizeof(es256_pk_t);
+		break;
+	case COSE_ES384:
+		want = sizeof(es384_pk_t);
+		break;
+	case COSE_RS256:
+		want = sizeof(rs256_pk_t);
+		break;
+	case COSE_EDDSA:
+		want = sizeof(eddsa_pk_t);
+		break;
+	default:
+		fido_log_debug("%s: unsupported cose_alg %d", __func__, *type);
+		return (FIDO_ERR_UNSUPPORTED_OPTION);
+	}
+
+	if (pk_len != want || len != sizeof(rec) + pk_len + *id_len) {
+		fido_log_debug("%s: pk_len=%zu, id_len=%zu, len=%zu", __func__,
+		    pk_len, *id_len, len);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+	*id = ptr + sizeof(rec) + pk_len;
+
+	return (FIDO_OK);
+}
+
+int
+fido_verify_key_from_record(fido_verify_key_t *key, const unsigned char *ptr,
+    size_t len)
+{
+	const unsigned char	*id;
+	size_t			 id_len;
+	int			 type;
+	int			 r;
+
+	if ((r = fido_cred_record_parse(ptr, len, &type, &id,
+	    &id_len)) != FIDO_OK)
+		return (r);
+
+	/* the public key types are byte arrays, and may be used in place */
+	return (fido_verify_key_from_pk(key, type,
+	    ptr + sizeof(fido_cred_record_t)));
+}
+
+int
+fido_verify_key_type(const fido_verify_key_t *key)
+{
+	return (key->type);
+}
+
+fido_rp_verifier_t *
+fido_rp_verifier_new(void)
+{
+	return (fido_calloc(1, sizeof(fido_rp_verifier_t)));
+}
+
+void
+fido_rp_verifier_free(fido_rp_verifier_t **v_p)
+{
+	if (v_p == NULL || *v_p == NULL)
+		return;
+	fido_free(*v_p);
+	*v_p = NULL;
+}
+
+int
+fido_rp_verifier_set_cache(fido_rp_verifier_t *v, fido_verify_cache_t *c)
+{
+	v->cache = c;
+
+	return (FIDO_OK);
+}
+
+int
+fido_rp_verifier_set_rp(fido_rp_verifier_t *v, const char *id)
+{
+	v->rp_id_set = false;
+
+	if (id == NULL)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if (SHA256((const unsigned char *)id, strlen(id),
+	    v->rp_id_hash) != v->rp_id_hash) {
+		fido_log_debug("%s: sha256", __func__);
+		return (FIDO_ERR_INTERNAL);
+	}
+	v->rp_id_set = true;
+
+	return (FIDO_OK);
+}
+
+int
+fido_rp_verifier_set_up(fido_rp_verifier_t *v, fido_opt_t up)
+{
+	if (up != FIDO_OPT_OMIT && up != FIDO_OPT_FALSE &&
+	    up != FIDO_OPT_TRUE)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	v->up = up;
+
+	return (FIDO_OK);
+}
+
+int
+fido_rp_verifier_set_uv(fido_rp_verifier_t *v, fido_opt_t uv)
+{
+	if (uv != FIDO_OPT_OMIT && uv != FIDO_OPT_FALSE &&
+	    uv != FIDO_OPT_TRUE)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	v->uv = uv;
+
+	return (FIDO_OK);
+}
+
+int
+fido_rp_verifier_set_extensions(fido_rp_verifier_t *v, int ext)
+{
+	if ((ext & FIDO_EXT_ASSERT_MASK) != ext)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	v->ext = ext;
+
+	return (FIDO_OK);
+}
+
+int
+fido_rp_verifier_allow_type(fido_rp_verifier_t *v, int cose_alg)
+{
+	switch (cose_alg) {
+	case COSE_ES256:
+	case COSE_ES384:
+	case COSE_RS256:
+	case COSE_EDDSA:
+		break;
+	default:
+		fido_log_debug("%s: unsupported cose_alg %d", __func__,
+		    cose_alg);
+		return (FIDO_ERR_UNSUPPORTED_OPTION);
+	}
+
+	for (size_t i = 0; i < v->ntype; i++)
+		if (v->type[i] == cose_alg)
+			return (FIDO_OK);
+	if (v->ntype == nitems(v->type))
+		return (FIDO_ERR_INTERNAL);
+	v->type[v->ntype++] = cose_alg;
+
+	return (FIDO_OK);
+}
+
+#define VIEW_CBOR_MAXDEPTH	16
+
+/* read the head of a definite-length cbor item; no allocation */
+static int
+view_cbor_head(const unsigned char **buf, size_t *len, uint8_t *type,
+    uint64_t *arg)
+{
+	uint8_t	ib;
+	size_t	n;
+
+	if (*len < 1)
+		return (-1);
+
+	ib = **buf;
+	*buf += 1;
+	*len -= 1;
+	*type = ib >> 5;
+	*arg = ib & 0x1f;
+
+	switch (*arg) {
+	case 24:
+		n = 1;
+		break;
+	case 25:
+		n = 2;
+		break;
+	case 26:
+		n = 4;
+		break;
+	case 27:
+		n = 8;
+		break;
+	default:
+		/* reject reserved values and indefinite lengths */
+		return (*arg < 24 ? 0 : -1);
+	}
+
+	if (*len < n)
+		return (-1);
+	for (*arg = 0; n > 0; n--, (*buf)++, (*len)--)
+		*arg = (*arg << 8) | **buf;
+
+	return (0);
+}
+
+static int
+view_cbor_skip(const unsigned char **buf, size_t *len, int depth)
+{
+	uint8_t		type;
+	uint64_t	arg;
+
+	if (depth > VIEW_CBOR_MAXDEPTH ||
+	    view_cbor_head(buf, len, &type, &arg) < 0)
+		return (-1);
+
+	switch (type) {
+	case 2: /* byte string */
+	case 3: /* text string */
+		if (arg > *len)
+			return (-1);
+		*buf += arg;
+		*len -= (size_t)arg;
+		break;
+	case 5: /* map */
+		if (arg > *len / 2)
+			return (-1);
+		arg *= 2;
+		FALLTHROUGH
+	case 4: /* array */
+		if (arg > *len)
+			return (-1);
+		while (arg-- > 0)
+			if (view_cbor_skip(buf, len, depth + 1) < 0)
+				return (-1);
+		break;
+	case 6: /* tag */
+		return (view_cbor_skip(buf, len, depth + 1));
+	default: /* integers, simple values, floats */
+		break;
+	}
+
+	return (0);
+}
+
+/* mirrors decode_assert_extensions() in cbor.c, without copying */
+static int
+view_decode_ext(fido_authdata_view_t *view)
+{
+	const unsigned char	*buf = view->ext_ptr;
+	size_t			 len = view->ext_len;
+	const unsigned char	*key;
+	size_t			 key_len;
+	uint8_t			 type;
+	uint64_t		 n, arg;
+	int			 ext;
+
+	if (view_cbor_head(&buf, &len, &type, &n) < 0 || type != 5 ||
+	    n > len / 2)
+		return (-1);
+
+	while (n-- > 0) {
+		ext = 0;
+		key = buf;
+		key_len = len;
+		if (view_cbor_head(&key, &key_len, &type, &arg) == 0 &&
+		    type == 3 && arg <= key_len) {
+			if (arg == 11 && memcmp(key, "hmac-secret", 11) == 0)
+				ext = FIDO_EXT_HMAC_SECRET;
+			else if (arg == 8 && memcmp(key, "credBlob", 8) == 0)
+				ext = FIDO_EXT_CRED_BLOB;
+		}
+		if (view_cbor_skip(&buf, &len, 1) < 0)
+			return (-1);
+		/* known extensions carry a byte string */
+		if (ext != 0 && (len < 1 || (*buf >> 5) != 2))
+			return (-1);
+		if (view_cbor_skip(&buf, &len, 1) < 0)
+			return (-1);
+		view->ext |= ext;
+	}
+
+	view->ext_len = (size_t)(buf - view->ext_ptr);
+
+	return (0);
+}
+
+int
+fido_authdata_view_set(fido_authdata_view_t *view, const unsigned char *ptr,
+    size_t len)
+{
+	fido_authdata_view_t v;
+
+	memset(&v, 0, sizeof(v));
+
+	if (ptr == NULL || len < sizeof(fido_authdata_t)) {
+		fido_log_debug("%s: len=%zu", __func__, len);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	v.ptr = ptr;
+	v.len = len;
+	v.rp_id_hash = ptr;
+	v.flags = ptr[32];
+	v.sigcount = (uint32_t)ptr[33] << 24 | (uint32_t)ptr[34] << 16 |
+	    (uint32_t)ptr[35] << 8 | (uint32_t)ptr[36];
+
+	if (v.flags & CTAP_AUTHDATA_ATT_CRED) {
+		/* attested credential data does not belong in an assertion */
+		fido_log_debug("%s: flags=0x%02x", __func__, v.flags);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	if (v.flags & CTAP_AUTHDATA_EXT_DATA) {
+		v.ext_ptr = ptr + sizeof(fido_authdata_t);
+		v.ext_len = len - sizeof(fido_authdata_t);
+		if (view_decode_ext(&v) < 0) {
+			fido_log_debug("%s: view_decode_ext", __func__);
+			return (FIDO_ERR_INVALID_ARGUMENT);
+		}
+	}
+
+	*view = v;
+
+	return (FIDO_OK);
+}
+
+int
+fido_authdata_view_set_cbor(fido_authdata_view_t *view,
+    const unsigned char *ptr, size_t len)
+{
+	uint8_t		type;
+	uint64_t	n;
+
+	if (ptr == NULL || view_cbor_head(&ptr, &len, &type, &n) < 0 ||
+	    type != 2 || n != len) {
+		fido_log_debug("%s: cbor type", __func__);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	return (fido_authdata_view_set(view, ptr, len));
+}
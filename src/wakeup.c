@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "fido.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+/*
+ * Something a thread waiting on a device can be woken up by, from any
+ * thread: a manual-reset event on Windows, and a pipe elsewhere. It
+ * stays signalled until cleared, so that a wakeup sent just before the
+ * wait begins is not lost.
+ */
+struct fido_wakeup {
+#ifdef _WIN32
+	HANDLE		event;
+#else
+	int		fd[2];   /* read end, write end */
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t	lock;
+#endif
+	bool		pending; /* a byte is in the pipe */
+#endif
+};
+
+#if !defined(_WIN32) && defined(HAVE_PTHREAD)
+#define WAKEUP_LOCK(w)		pthread_mutex_lock(&(w)->lock)
+#define WAKEUP_UNLOCK(w)	pthread_mutex_unlock(&(w)->lock)
+#else
+#define WAKEUP_LOCK(w)		do { } while (0)
+#define WAKEUP_UNLOCK(w)	do { } while (0)
+#endif
+
+#ifdef _WIN32
+fido_wakeup_t *
+fido_wakeup_new(void)
+{
+	fido_wakeup_t *w;
+
+	if ((w = fido_calloc(1, sizeof(*w))) == NULL)
+		return (NULL);
+	if ((w->event = CreateEventA(NULL, TRUE, FALSE, NULL)) == NULL) {
+		fido_log_debug("%s: CreateEventA", __func__);
+		fido_free(w);
+		return (NULL);
+	}
+
+	return (w);
+}
+
+void
+fido_wakeup_free(fido_wakeup_t **wp)
+{
+	fido_wakeup_t *w;
+
+	if (wp == NULL || (w = *wp) == NULL)
+		return;
+	CloseHandle(w->event);
+	fido_free(w);
+	*wp = NULL;
+}
+
+void
+fido_wakeup_signal(fido_wakeup_t *w)
+{
+	if (SetEvent(w->event) == 0)
+		fido_log_debug("%s: SetEvent", __func__);
+}
+
+void
+fido_wakeup_clear(fido_wakeup_t *w)
+{
+	if (ResetEvent(w->event) == 0)
+		fido_log_debug("%s: ResetEvent", __func__);
+}
+
+bool
+fido_wakeup_pending(fido_wakeup_t *w)
+{
+	return (WaitForSingleObject(w->event, 0) == WAIT_OBJECT_0);
+}
+
+void *
+fido_wakeup_event(const fido_wakeup_t *w)
+{
+	return (w->event);
+}
+#else
+static int
+set_nonblock_cloexec(int fd)
+{
+	int flags;
+
+	if ((flags = fcntl(fd, F_GETFL)) == -1 ||
+	    fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1 ||
+	    (flags = fcntl(fd, F_GETFD)) == -1 ||
+	    fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == -1) {
+		fido_log_error(errno, "%s: fcntl", __func__);
+		return (-1);
+	}
+
+	return (0);
+}
+
+fido_wakeup_t *
+fido_wakeup_new(void)
+{
+	fido_wakeup_t *w;
+
+	if ((w = fido_calloc(1, sizeof(*w))) == NULL)
+		return (NULL);
+	if (pipe(w->fd) == -1) {
+		fido_log_error(errno, "%s: pipe", __func__);
+		fido_free(w);
+		return (NULL);
+	}
+	if (set_nonblock_cloexec(w->fd[0]) < 0 ||
+	    set_nonblock_cloexec(w->fd[1]) < 0)
+		goto fail;
+#ifdef HAVE_PTHREAD
+	if (pthread_mutex_init(&w->lock, NULL) != 0) {
+		fido_log_debug("%s: pthread_mutex_init", __func__);
+		goto fail;
+	}
+#endif
+
+	return (w);
+fail:
+	close(w->fd[0]);
+	close(w->fd[1]);
+	fido_free(w);
+
+	return (NULL);
+}
+
+void
+fido_wakeup_free(fido_wakeup_t **wp)
+{
+	fido_wakeup_t *w;
+
+	if (wp == NULL || (w = *wp) == NULL)
+		return;
+	close(w->fd[0]);
+	close(w->fd[1]);
+#ifdef HAVE_PTHREAD
+	pthread_mutex_destroy(&w->lock);
+#endif
+	fido_free(w);
+	*wp = NULL;
+}
+
+void
+fido_wakeup_signal(fido_wakeup_t *w)
+{
+	const unsigned char b = 0;
+
+	WAKEUP_LOCK(w);
+	if (w->pending == false) {
+		if (write(w->fd[1], &b, sizeof(b)) != sizeof(b))
+			fido_log_error(errno, "%s: write", __func__);
+		else
+			w->pending = true;
+	}
+	WAKEUP_UNLOCK(w);
+}
+
+void
+fido_wakeup_clear(fido_wakeup_t *w)
+{
+	unsigned char b;
+
+	WAKEUP_LOCK(w);
+	if (w->pending) {
+		if (read(w->fd[0], &b, sizeof(b)) != sizeof(b))
+			fido_log_error(errno, "%s: read", __func__);
+		w->pending = false;
+	}
+	WAKEUP_UNLOCK(w);
+}
+
+bool
+fido_wakeup_pending(fido_wakeup_t *w)
+{
+	bool pending;
+
+	WAKEUP_LOCK(w);
+	pending = w->pending;
+	WAKEUP_UNLOCK(w);
+
+	return (pending);
+}
+
+/* readable while the wakeup is signalled */
+int
+fido_wakeup_fd(const fido_wakeup_t *w)
+{
+	return (w->fd[0]);
+}
+#endif /* _WIN32 */
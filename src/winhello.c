@@ -28,12 +28,13 @@
 #define MAXMSEC		6000 * 1000
 #define VENDORID	0x045e
 #define PRODID		0x0001
+#define MAX(x, y)	((x) > (y) ? (x) : (y))
 
 struct winhello_assert {
 	WEBAUTHN_CLIENT_DATA				 cd;
 	WEBAUTHN_AUTHENTICATOR_GET_ASSERTION_OPTIONS	 opt;
 	WEBAUTHN_ASSERTION				*assert;
-	wchar_t						*rp_id;
+	wchar_t						 rp_id[MAXCHARS];
 };
 
 struct winhello_cred {
@@ -44,11 +45,11 @@ struct winhello_cred {
 	WEBAUTHN_CLIENT_DATA				 cd;
 	WEBAUTHN_AUTHENTICATOR_MAKE_CREDENTIAL_OPTIONS	 opt;
 	WEBAUTHN_CREDENTIAL_ATTESTATION			*att;
-	wchar_t						*rp_id;
-	wchar_t						*rp_name;
-	wchar_t						*user_name;
-	wchar_t						*user_icon;
-	wchar_t						*display_name;
+	wchar_t						 rp_id[MAXCHARS];
+	wchar_t						 rp_name[MAXCHARS];
+	wchar_t						 user_name[MAXCHARS];
+	wchar_t						 user_icon[MAXCHARS];
+	wchar_t						 display_name[MAXCHARS];
 };
 
 typedef DWORD	WINAPI	webauthn_get_api_version_t(void);
@@ -66,28 +67,55 @@ typedef HRESULT	WINAPI	webauthn_make_cred_t(HWND,
 			    PWEBAUTHN_CREDENTIAL_ATTESTATION *);
 typedef void	WINAPI	webauthn_free_assert_t(PWEBAUTHN_ASSERTION);
 typedef void	WINAPI	webauthn_free_attest_t(PWEBAUTHN_CREDENTIAL_ATTESTATION);
+typedef HRESULT	WINAPI	webauthn_get_cancel_id_t(GUID *);
+typedef HRESULT	WINAPI	webauthn_cancel_t(const GUID *);
 
-static TLS BOOL				 webauthn_loaded;
-static TLS HMODULE			 webauthn_handle;
-static TLS webauthn_get_api_version_t	*webauthn_get_api_version;
-static TLS webauthn_strerr_t		*webauthn_strerr;
-static TLS webauthn_get_assert_t	*webauthn_get_assert;
-static TLS webauthn_make_cred_t		*webauthn_make_cred;
-static TLS webauthn_free_assert_t	*webauthn_free_assert;
-static TLS webauthn_free_attest_t	*webauthn_free_attest;
+/*
+ * A request started by fido_dev_get_assert_begin() or
+ * fido_dev_make_cred_begin() runs on a worker thread, as webauthn.dll
+ * only offers blocking calls; event is set once it returns.
+ */
+struct winhello_async {
+	HANDLE			 thread;    /* worker */
+	HANDLE			 event;     /* set once the request returns */
+	HWND			 w;         /* parent of the prompt */
+	GUID			 cancel_id; /* if cancellable */
+	bool			 cancellable;
+	bool			 cancel;    /* fido_dev_cancel() called */
+	int			 r;         /* result, once event is set */
+	struct winhello_assert	*assert;
+	struct winhello_cred	*cred;
+};
 
-static int
-webauthn_load(void)
+/*
+ * webauthn.dll is loaded once per process, and stays loaded; its entry
+ * points and API version are resolved then, and shared by all threads.
+ */
+static INIT_ONCE			 webauthn_once = INIT_ONCE_STATIC_INIT;
+static BOOL				 webauthn_loaded;
+static HMODULE				 webauthn_handle;
+static DWORD				 webauthn_api;
+static webauthn_get_api_version_t	*webauthn_get_api_version;
+static webauthn_strerr_t		*webauthn_strerr;
+static webauthn_get_assert_t		*webauthn_get_assert;
+static webauthn_make_cred_t		*webauthn_make_cred;
+static webauthn_free_assert_t		*webauthn_free_assert;
+static webauthn_free_attest_t		*webauthn_free_attest;
+static webauthn_get_cancel_id_t		*webauthn_get_cancel_id;
+static webauthn_cancel_t		*webauthn_cancel;
+
+static BOOL CALLBACK
+webauthn_load(PINIT_ONCE once, PVOID arg, PVOID *ctx)
 {
-	DWORD n = 1;
+	DWORD n = WEBAUTHN_API_VERSION_1;
+
+	(void)once;
+	(void)arg;
+	(void)ctx;
 
-	if (webauthn_loaded || webauthn_handle != NULL) {
-		fido_log_debug("%s: already loaded", __func__);
-		return -1;
-	}
 	if ((webauthn_handle = LoadLibrary("webauthn.dll")) == NULL) {
 		fido_log_debug("%s: LoadLibrary", __func__);
-		return -1;
+		return TRUE; /* not retried */
 	}
 
 	if ((webauthn_get_api_version =
@@ -136,9 +164,21 @@ webauthn_load(void)
 		goto fail;
 	}
 
+	/* optional; without them, requests cannot be cancelled */
+	if ((webauthn_get_cancel_id =
+	    (webauthn_get_cancel_id_t *)GetProcAddress(webauthn_handle,
+	    "WebAuthNGetCancellationId")) == NULL ||
+	    (webauthn_cancel = (webauthn_cancel_t *)GetProcAddress(
+	    webauthn_handle, "WebAuthNCancelCurrentOperation")) == NULL) {
+		fido_log_debug("%s: WebAuthNGetCancellationId", __func__);
+		webauthn_get_cancel_id = NULL;
+		webauthn_cancel = NULL;
+	}
+
+	webauthn_api = n;
 	webauthn_loaded = true;
 
-	return 0;
+	return TRUE;
 fail:
 	fido_log_debug("%s: GetProcAddress", __func__);
 	webauthn_get_api_version = NULL;
@@ -150,33 +190,35 @@ fail:
 	FreeLibrary(webauthn_handle);
 	webauthn_handle = NULL;
 
-	return -1;
+	return TRUE; /* not retried */
 }
 
+static int
+webauthn_init(void)
+{
+	if (!InitOnceExecuteOnce(&webauthn_once, webauthn_load, NULL, NULL)) {
+		fido_log_debug("%s: InitOnceExecuteOnce", __func__);
+		return -1;
+	}
+
+	return webauthn_loaded ? 0 : -1;
+}
+
+/* utf16 has room for MAXCHARS, including the terminator */
 static wchar_t *
-to_utf16(const char *utf8)
+to_utf16(const char *utf8, wchar_t *utf16)
 {
 	int nch;
-	wchar_t *utf16;
 
 	if (utf8 == NULL) {
 		fido_log_debug("%s: NULL", __func__);
 		return NULL;
 	}
-	if ((nch = MultiByteToWideChar(CP_UTF8, 0, utf8, -1, NULL, 0)) < 1 ||
-	    (size_t)nch > MAXCHARS) {
+	if ((nch = MultiByteToWideChar(CP_UTF8, 0, utf8, -1, utf16,
+	    MAXCHARS)) < 1) {
 		fido_log_debug("%s: MultiByteToWideChar %d", __func__, nch);
 		return NULL;
 	}
-	if ((utf16 = calloc((size_t)nch, sizeof(*utf16))) == NULL) {
-		fido_log_debug("%s: calloc", __func__);
-		return NULL;
-	}
-	if (MultiByteToWideChar(CP_UTF8, 0, utf8, -1, utf16, nch) != nch) {
-		fido_log_debug("%s: MultiByteToWideChar", __func__);
-		free(utf16);
-		return NULL;
-	}
 
 	return utf16;
 }
@@ -231,7 +273,7 @@ pack_credlist(WEBAUTHN_CREDENTIALS *out, const fido_blob_array_t *in)
 		fido_log_debug("%s: in->len=%zu", __func__, in->len);
 		return -1;
 	}
-	if ((out->pCredentials = calloc(in->len, sizeof(*c))) == NULL) {
+	if ((out->pCredentials = fido_calloc(in->len, sizeof(*c))) == NULL) {
 		fido_log_debug("%s: calloc", __func__);
 		return -1;
 	}
@@ -296,16 +338,15 @@ set_assert_uv(DWORD *out, fido_opt_t uv, const char *pin)
 }
 
 static int
-pack_rp(wchar_t **id, wchar_t **name, WEBAUTHN_RP_ENTITY_INFORMATION *out,
+pack_rp(wchar_t *id, wchar_t *name, WEBAUTHN_RP_ENTITY_INFORMATION *out,
     const fido_rp_t *in)
 {
-	/* keep non-const copies of pwsz* for free() */
 	out->dwVersion = WEBAUTHN_RP_ENTITY_INFORMATION_CURRENT_VERSION;
-	if ((out->pwszId = *id = to_utf16(in->id)) == NULL) {
+	if ((out->pwszId = to_utf16(in->id, id)) == NULL) {
 		fido_log_debug("%s: id", __func__);
 		return -1;
 	}
-	if (in->name && (out->pwszName = *name = to_utf16(in->name)) == NULL) {
+	if (in->name && (out->pwszName = to_utf16(in->name, name)) == NULL) {
 		fido_log_debug("%s: name", __func__);
 		return -1;
 	}
@@ -313,7 +354,7 @@ pack_rp(wchar_t **id, wchar_t **name, WEBAUTHN_RP_ENTITY_INFORMATION *out,
 }
 
 static int
-pack_user(wchar_t **name, wchar_t **icon, wchar_t **display_name,
+pack_user(wchar_t *name, wchar_t *icon, wchar_t *display_name,
     WEBAUTHN_USER_ENTITY_INFORMATION *out, const fido_user_t *in)
 {
 	if (in->id.ptr == NULL || in->id.len > ULONG_MAX) {
@@ -323,22 +364,21 @@ pack_user(wchar_t **name, wchar_t **icon, wchar_t **display_name,
 	out->dwVersion = WEBAUTHN_USER_ENTITY_INFORMATION_CURRENT_VERSION;
 	out->cbId = (DWORD)in->id.len;
 	out->pbId = in->id.ptr;
-	/* keep non-const copies of pwsz* for free() */
 	if (in->name != NULL) {
-		if ((out->pwszName = *name = to_utf16(in->name)) == NULL) {
+		if ((out->pwszName = to_utf16(in->name, name)) == NULL) {
 			fido_log_debug("%s: name", __func__);
 			return -1;
 		}
 	}
 	if (in->icon != NULL) {
-		if ((out->pwszIcon = *icon = to_utf16(in->icon)) == NULL) {
+		if ((out->pwszIcon = to_utf16(in->icon, icon)) == NULL) {
 			fido_log_debug("%s: icon", __func__);
 			return -1;
 		}
 	}
 	if (in->display_name != NULL) {
-		if ((out->pwszDisplayName = *display_name =
-		    to_utf16(in->display_name)) == NULL) {
+		if ((out->pwszDisplayName = to_utf16(in->display_name,
+		    display_name)) == NULL) {
 			fido_log_debug("%s: display_name", __func__);
 			return -1;
 		}
@@ -391,17 +431,23 @@ pack_cred_ext(WEBAUTHN_EXTENSIONS *out, const fido_cred_ext_t *in)
 		fido_log_debug("%s: mask 0x%x", __func__, in->mask);
 		return -1;
 	}
+	if (in->mask & FIDO_EXT_CRED_PROTECT &&
+	    webauthn_api < WEBAUTHN_API_VERSION_2) {
+		fido_log_debug("%s: credProtect, api %lu", __func__,
+		    (u_long)webauthn_api);
+		return -1;
+	}
 	if (in->mask & FIDO_EXT_HMAC_SECRET)
 		n++;
 	if (in->mask & FIDO_EXT_CRED_PROTECT)
 		n++;
-	if ((out->pExtensions = calloc(n, sizeof(*e))) == NULL) {
+	if ((out->pExtensions = fido_calloc(n, sizeof(*e))) == NULL) {
 		fido_log_debug("%s: calloc", __func__);
 		return -1;
 	}
 	out->cExtensions = (DWORD)n;
 	if (in->mask & FIDO_EXT_HMAC_SECRET) {
-		if ((b = calloc(1, sizeof(*b))) == NULL) {
+		if ((b = fido_calloc(1, sizeof(*b))) == NULL) {
 			fido_log_debug("%s: calloc", __func__);
 			return -1;
 		}
@@ -414,7 +460,7 @@ pack_cred_ext(WEBAUTHN_EXTENSIONS *out, const fido_cred_ext_t *in)
 		i++;
 	}
 	if (in->mask & FIDO_EXT_CRED_PROTECT) {
-		if ((p = calloc(1, sizeof(*p))) == NULL) {
+		if ((p = fido_calloc(1, sizeof(*p))) == NULL) {
 			fido_log_debug("%s: calloc", __func__);
 			return -1;
 		}
@@ -445,15 +491,21 @@ pack_assert_ext(WEBAUTHN_AUTHENTICATOR_GET_ASSERTION_OPTIONS *out,
 		fido_log_debug("%s: mask 0x%x", __func__, in->mask);
 		return -1;
 	}
+	/* salts need WEBAUTHN_AUTHENTICATOR_GET_ASSERTION_OPTIONS_VERSION_6 */
+	if (webauthn_api < WEBAUTHN_API_VERSION_4) {
+		fido_log_debug("%s: hmac-secret, api %lu", __func__,
+		    (u_long)webauthn_api);
+		return -1;
+	}
 	if (in->hmac_salt.ptr == NULL ||
 	    in->hmac_salt.len != WEBAUTHN_CTAP_ONE_HMAC_SECRET_LENGTH) {
 		fido_log_debug("%s: salt %p/%zu", __func__,
 		    (const void *)in->hmac_salt.ptr, in->hmac_salt.len);
 		return -1;
 	}
-	if ((v = calloc(1, sizeof(*v))) == NULL ||
-	    (s = calloc(1, sizeof(*s))) == NULL) {
-		free(v);
+	if ((v = fido_calloc(1, sizeof(*v))) == NULL ||
+	    (s = fido_calloc(1, sizeof(*s))) == NULL) {
+		fido_free(v);
 		fido_log_debug("%s: calloc", __func__);
 		return -1;
 	}
@@ -583,7 +635,7 @@ translate_fido_assert(struct winhello_assert *ctx, const fido_assert_t *assert,
 		fido_log_debug("%s: up %d", __func__, assert->up);
 		return FIDO_ERR_UNSUPPORTED_OPTION;
 	}
-	if ((ctx->rp_id = to_utf16(assert->rp_id)) == NULL) {
+	if (to_utf16(assert->rp_id, ctx->rp_id) == NULL) {
 		fido_log_debug("%s: rp_id", __func__);
 		return FIDO_ERR_INTERNAL;
 	}
@@ -657,11 +709,11 @@ translate_fido_cred(struct winhello_cred *ctx, const fido_cred_t *cred,
 {
 	WEBAUTHN_AUTHENTICATOR_MAKE_CREDENTIAL_OPTIONS *opt;
 
-	if (pack_rp(&ctx->rp_id, &ctx->rp_name, &ctx->rp, &cred->rp) < 0) {
+	if (pack_rp(ctx->rp_id, ctx->rp_name, &ctx->rp, &cred->rp) < 0) {
 		fido_log_debug("%s: pack_rp", __func__);
 		return FIDO_ERR_INTERNAL;
 	}
-	if (pack_user(&ctx->user_name, &ctx->user_icon, &ctx->display_name,
+	if (pack_user(ctx->user_name, ctx->user_icon, ctx->display_name,
 	    &ctx->user, &cred->user) < 0) {
 		fido_log_debug("%s: pack_user", __func__);
 		return FIDO_ERR_INTERNAL;
@@ -700,50 +752,6 @@ translate_fido_cred(struct winhello_cred *ctx, const fido_cred_t *cred,
 	return FIDO_OK;
 }
 
-static int
-decode_attobj(const cbor_item_t *key, const cbor_item_t *val, void *arg)
-{
-	fido_cred_t *cred = arg;
-	char *name = NULL;
-	int ok = -1;
-
-	if (cbor_string_copy(key, &name) < 0) {
-		fido_log_debug("%s: cbor type", __func__);
-		ok = 0; /* ignore */
-		goto fail;
-	}
-
-	if (!strcmp(name, "fmt")) {
-		if (cbor_decode_fmt(val, &cred->fmt) < 0) {
-			fido_log_debug("%s: cbor_decode_fmt", __func__);
-			goto fail;
-		}
-	} else if (!strcmp(name, "attStmt")) {
-		if (cbor_decode_attstmt(val, &cred->attstmt) < 0) {
-			fido_log_debug("%s: cbor_decode_attstmt", __func__);
-			goto fail;
-		}
-	} else if (!strcmp(name, "authData")) {
-		if (fido_blob_decode(val, &cred->authdata_raw) < 0) {
-			fido_log_debug("%s: fido_blob_decode", __func__);
-			goto fail;
-		}
-		if (cbor_decode_cred_authdata(val, cred->type,
-		    &cred->authdata_cbor, &cred->authdata, &cred->attcred,
-		    &cred->authdata_ext) < 0) {
-			fido_log_debug("%s: cbor_decode_cred_authdata",
-			    __func__);
-			goto fail;
-		}
-	}
-
-	ok = 0;
-fail:
-	free(name);
-
-	return (ok);
-}
-
 static int
 translate_winhello_cred(fido_cred_t *cred,
     const WEBAUTHN_CREDENTIAL_ATTESTATION *att)
@@ -762,10 +770,8 @@ translate_winhello_cred(fido_cred_t *cred,
 		fido_log_debug("%s: cbor_load", __func__);
 		goto fail;
 	}
-	if (cbor_isa_map(item) == false ||
-	    cbor_map_is_definite(item) == false ||
-	    cbor_map_iter(item, cred, decode_attobj) < 0) {
-		fido_log_debug("%s: cbor type", __func__);
+	if (cbor_decode_attobj(item, cred) < 0) {
+		fido_log_debug("%s: cbor_decode_attobj", __func__);
 		goto fail;
 	}
 
@@ -817,12 +823,11 @@ winhello_assert_free(struct winhello_assert *ctx)
 	if (ctx->assert != NULL)
 		webauthn_free_assert(ctx->assert);
 
-	free(ctx->rp_id);
-	free(ctx->opt.CredentialList.pCredentials);
+	fido_free(ctx->opt.CredentialList.pCredentials);
 	if (ctx->opt.pHmacSecretSaltValues != NULL)
-		free(ctx->opt.pHmacSecretSaltValues->pGlobalHmacSalt);
-	free(ctx->opt.pHmacSecretSaltValues);
-	free(ctx);
+		fido_free(ctx->opt.pHmacSecretSaltValues->pGlobalHmacSalt);
+	fido_free(ctx->opt.pHmacSecretSaltValues);
+	fido_free(ctx);
 }
 
 static void
@@ -833,19 +838,150 @@ winhello_cred_free(struct winhello_cred *ctx)
 	if (ctx->att != NULL)
 		webauthn_free_attest(ctx->att);
 
-	free(ctx->rp_id);
-	free(ctx->rp_name);
-	free(ctx->user_name);
-	free(ctx->user_icon);
-	free(ctx->display_name);
-	free(ctx->opt.CredentialList.pCredentials);
+	fido_free(ctx->opt.CredentialList.pCredentials);
 	for (size_t i = 0; i < ctx->opt.Extensions.cExtensions; i++) {
 		WEBAUTHN_EXTENSION *e;
 		e = &ctx->opt.Extensions.pExtensions[i];
-		free(e->pvExtension);
+		fido_free(e->pvExtension);
+	}
+	fido_free(ctx->opt.Extensions.pExtensions);
+	fido_free(ctx);
+}
+
+static int
+winhello_window(HWND *w)
+{
+	if ((*w = GetForegroundWindow()) == NULL) {
+		fido_log_debug("%s: GetForegroundWindow", __func__);
+		if ((*w = GetTopWindow(NULL)) == NULL) {
+			fido_log_debug("%s: GetTopWindow", __func__);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static DWORD WINAPI
+winhello_async_run(LPVOID arg)
+{
+	struct winhello_async *wa = arg;
+
+	if (wa->assert != NULL)
+		wa->r = winhello_get_assert(wa->w, wa->assert);
+	else
+		wa->r = winhello_make_cred(wa->w, wa->cred);
+	SetEvent(wa->event);
+
+	return 0;
+}
+
+void
+fido_winhello_async_free(struct winhello_async **wa_p)
+{
+	struct winhello_async *wa;
+
+	if (wa_p == NULL || (wa = *wa_p) == NULL)
+		return;
+	if (wa->thread != NULL) {
+		if (WaitForSingleObject(wa->event, 0) != WAIT_OBJECT_0 &&
+		    wa->cancellable && webauthn_cancel(&wa->cancel_id) != S_OK)
+			fido_log_debug("%s: webauthn_cancel", __func__);
+		/* the prompt may outlive a failed cancellation */
+		WaitForSingleObject(wa->thread, INFINITE);
+		CloseHandle(wa->thread);
+	}
+	if (wa->event != NULL)
+		CloseHandle(wa->event);
+	winhello_assert_free(wa->assert);
+	winhello_cred_free(wa->cred);
+	fido_free(wa);
+
+	*wa_p = NULL;
+}
+
+static int
+winhello_async_new(fido_dev_t *dev, int op, struct winhello_async **wa)
+{
+	struct fido_dev_async *a;
+
+	*wa = NULL;
+
+	if (dev->async != NULL) {
+		fido_log_debug("%s: op=%d pending", __func__, dev->async->op);
+		return FIDO_ERR_INVALID_ARGUMENT;
+	}
+	if ((a = fido_calloc(1, sizeof(*a))) == NULL ||
+	    (*wa = fido_calloc(1, sizeof(**wa))) == NULL) {
+		fido_log_debug("%s: calloc", __func__);
+		fido_free(a);
+		return FIDO_ERR_INTERNAL;
+	}
+	if (winhello_window(&(*wa)->w) < 0) {
+		fido_free(*wa);
+		fido_free(a);
+		*wa = NULL;
+		return FIDO_ERR_INTERNAL;
+	}
+	a->op = op;
+	a->winhello = *wa;
+	dev->async = a;
+
+	return FIDO_OK;
+}
+
+static GUID *
+winhello_async_cancel_id(struct winhello_async *wa)
+{
+	if (webauthn_get_cancel_id == NULL ||
+	    webauthn_get_cancel_id(&wa->cancel_id) != S_OK) {
+		fido_log_debug("%s: webauthn_get_cancel_id", __func__);
+		return NULL;
+	}
+	wa->cancellable = true;
+
+	return &wa->cancel_id;
+}
+
+static int
+winhello_async_start(struct winhello_async *wa)
+{
+	if ((wa->event = CreateEvent(NULL, TRUE, FALSE, NULL)) == NULL) {
+		fido_log_debug("%s: CreateEvent", __func__);
+		return FIDO_ERR_INTERNAL;
+	}
+	if ((wa->thread = CreateThread(NULL, 0, winhello_async_run, wa, 0,
+	    NULL)) == NULL) {
+		fido_log_debug("%s: CreateThread", __func__);
+		return FIDO_ERR_INTERNAL;
+	}
+
+	return FIDO_OK;
+}
+
+/* the pending request, once it has returned; NULL if still running */
+static int
+winhello_async_wait(fido_dev_t *dev, int ms, struct winhello_async **wa)
+{
+	struct fido_dev_async *a = dev->async;
+
+	*wa = NULL;
+
+	switch (WaitForSingleObject(a->winhello->event,
+	    ms < 0 ? INFINITE : (DWORD)ms)) {
+	case WAIT_OBJECT_0:
+		break;
+	case WAIT_TIMEOUT:
+		return FIDO_OK;
+	default:
+		fido_log_debug("%s: WaitForSingleObject", __func__);
+		return FIDO_ERR_INTERNAL;
 	}
-	free(ctx->opt.Extensions.pExtensions);
-	free(ctx);
+	*wa = a->winhello;
+	if ((*wa)->cancel && (*wa)->r != FIDO_OK)
+		(*wa)->r = FIDO_ERR_KEEPALIVE_CANCEL;
+
+	return FIDO_OK;
 }
 
 int
@@ -859,23 +995,23 @@ fido_winhello_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
 	if (devlist == NULL) {
 		return FIDO_ERR_INVALID_ARGUMENT;
 	}
-	if (!webauthn_loaded && webauthn_load() < 0) {
-		fido_log_debug("%s: webauthn_load", __func__);
+	if (webauthn_init() < 0) {
+		fido_log_debug("%s: webauthn_init", __func__);
 		return FIDO_OK; /* not an error */
 	}
 
 	di = &devlist[*olen];
 	memset(di, 0, sizeof(*di));
-	di->path = strdup(FIDO_WINHELLO_PATH);
-	di->manufacturer = strdup("Microsoft Corporation");
-	di->product = strdup("Windows Hello");
+	di->path = fido_strdup(FIDO_WINHELLO_PATH);
+	di->manufacturer = fido_strdup("Microsoft Corporation");
+	di->product = fido_strdup("Windows Hello");
 	di->vendor_id = VENDORID;
 	di->product_id = PRODID;
 	if (di->path == NULL || di->manufacturer == NULL ||
 	    di->product == NULL) {
-		free(di->path);
-		free(di->manufacturer);
-		free(di->product);
+		fido_free(di->path);
+		fido_free(di->manufacturer);
+		fido_free(di->product);
 		explicit_bzero(di, sizeof(*di));
 		return FIDO_ERR_INTERNAL;
 	}
@@ -887,14 +1023,16 @@ fido_winhello_manifest(fido_dev_info_t *devlist, size_t ilen, size_t *olen)
 int
 fido_winhello_open(fido_dev_t *dev)
 {
-	if (!webauthn_loaded && webauthn_load() < 0) {
-		fido_log_debug("%s: webauthn_load", __func__);
+	if (webauthn_init() < 0) {
+		fido_log_debug("%s: webauthn_init", __func__);
 		return FIDO_ERR_INTERNAL;
 	}
 	if (dev->flags != 0)
 		return FIDO_ERR_INVALID_ARGUMENT;
 	dev->attr.flags = FIDO_CAP_CBOR | FIDO_CAP_WINK;
-	dev->flags = FIDO_DEV_WINHELLO | FIDO_DEV_CRED_PROT | FIDO_DEV_PIN_SET;
+	dev->flags = FIDO_DEV_WINHELLO | FIDO_DEV_PIN_SET;
+	if (webauthn_api >= WEBAUTHN_API_VERSION_2)
+		dev->flags |= FIDO_DEV_CRED_PROT;
 
 	return FIDO_OK;
 }
@@ -910,9 +1048,32 @@ fido_winhello_close(fido_dev_t *dev)
 int
 fido_winhello_cancel(fido_dev_t *dev)
 {
-	(void)dev;
+	struct winhello_async *wa;
+
+	if (dev->async == NULL || (wa = dev->async->winhello) == NULL) {
+		fido_log_debug("%s: no request pending", __func__);
+		return FIDO_ERR_INVALID_ARGUMENT;
+	}
+	if (!wa->cancellable) {
+		fido_log_debug("%s: not cancellable", __func__);
+		return FIDO_ERR_UNSUPPORTED_OPTION;
+	}
+	wa->cancel = true;
+	if (webauthn_cancel(&wa->cancel_id) != S_OK) {
+		fido_log_debug("%s: webauthn_cancel", __func__);
+		return FIDO_ERR_INTERNAL;
+	}
 
-	return FIDO_ERR_INTERNAL;
+	return FIDO_OK;
+}
+
+void *
+fido_winhello_poll_event(const fido_dev_t *dev)
+{
+	if (dev->async == NULL || dev->async->winhello == NULL)
+		return NULL;
+
+	return dev->async->winhello->event;
 }
 
 int
@@ -927,17 +1088,12 @@ fido_winhello_get_assert(fido_dev_t *dev, fido_assert_t *assert,
 
 	fido_assert_reset_rx(assert);
 
-	if ((ctx = calloc(1, sizeof(*ctx))) == NULL) {
+	if ((ctx = fido_calloc(1, sizeof(*ctx))) == NULL) {
 		fido_log_debug("%s: calloc", __func__);
 		goto fail;
 	}
-	if ((w = GetForegroundWindow()) == NULL) {
-		fido_log_debug("%s: GetForegroundWindow", __func__);
-		if ((w = GetTopWindow(NULL)) == NULL) {
-			fido_log_debug("%s: GetTopWindow", __func__);
-			goto fail;
-		}
-	}
+	if (winhello_window(&w) < 0)
+		goto fail;
 	if ((r = translate_fido_assert(ctx, assert, pin, ms)) != FIDO_OK) {
 		fido_log_debug("%s: translate_fido_assert", __func__);
 		goto fail;
@@ -957,31 +1113,112 @@ fail:
 	return r;
 }
 
+int
+fido_winhello_get_assert_begin(fido_dev_t *dev, fido_assert_t *assert,
+    const char *pin)
+{
+	WEBAUTHN_AUTHENTICATOR_GET_ASSERTION_OPTIONS	*opt;
+	struct winhello_async				*wa;
+	int						 r;
+
+	fido_assert_reset_rx(assert);
+
+	if ((r = winhello_async_new(dev, FIDO_DEV_ASYNC_ASSERT,
+	    &wa)) != FIDO_OK) {
+		fido_log_debug("%s: winhello_async_new", __func__);
+		return r;
+	}
+	if ((wa->assert = fido_calloc(1, sizeof(*wa->assert))) == NULL) {
+		fido_log_debug("%s: calloc", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+	if ((r = translate_fido_assert(wa->assert, assert, pin,
+	    dev->timeout_ms)) != FIDO_OK) {
+		fido_log_debug("%s: translate_fido_assert", __func__);
+		goto fail;
+	}
+	opt = &wa->assert->opt;
+	if ((opt->pCancellationId = winhello_async_cancel_id(wa)) != NULL)
+		opt->dwVersion = MAX(opt->dwVersion,
+		    WEBAUTHN_AUTHENTICATOR_GET_ASSERTION_OPTIONS_VERSION_3);
+	if ((r = winhello_async_start(wa)) != FIDO_OK) {
+		fido_log_debug("%s: winhello_async_start", __func__);
+		goto fail;
+	}
+
+	r = FIDO_OK;
+fail:
+	if (r != FIDO_OK)
+		fido_rx_async_end(dev);
+
+	return r;
+}
+
+int
+fido_winhello_get_assert_step(fido_dev_t *dev, fido_assert_t *assert,
+    int *done, int ms)
+{
+	struct winhello_async	*wa;
+	int			 r;
+
+	*done = 0;
+
+	if ((r = winhello_async_wait(dev, ms, &wa)) != FIDO_OK) {
+		fido_log_debug("%s: winhello_async_wait", __func__);
+		goto fail;
+	}
+	if (wa == NULL)
+		return FIDO_OK; /* keep waiting */
+	if ((r = wa->r) != FIDO_OK) {
+		fido_log_debug("%s: winhello_get_assert", __func__);
+		goto fail;
+	}
+	if ((r = translate_winhello_assert(assert,
+	    wa->assert->assert)) != FIDO_OK) {
+		fido_log_debug("%s: translate_winhello_assert", __func__);
+		goto fail;
+	}
+
+	r = FIDO_OK;
+fail:
+	fido_rx_async_end(dev);
+	*done = r == FIDO_OK;
+
+	return r;
+}
+
 int
 fido_winhello_get_cbor_info(fido_dev_t *dev, fido_cbor_info_t *ci)
 {
 	const char *v[3] = { "U2F_V2", "FIDO_2_0", "FIDO_2_1_PRE" };
-	const char *e[2] = { "credProtect", "hmac-secret" };
+	const char *e[2];
 	const char *t[2] = { "nfc", "usb" };
 	const char *o[4] = { "rk", "up", "uv", "plat" };
+	size_t ne = 0;
 
 	(void)dev;
 
 	fido_cbor_info_reset(ci);
 
+	if (webauthn_api >= WEBAUTHN_API_VERSION_2)
+		e[ne++] = "credProtect";
+	e[ne++] = "hmac-secret";
 	if (fido_str_array_pack(&ci->versions, v, nitems(v)) < 0 ||
-	    fido_str_array_pack(&ci->extensions, e, nitems(e)) < 0 ||
+	    fido_str_array_pack(&ci->extensions, e, ne) < 0 ||
 	    fido_str_array_pack(&ci->transports, t, nitems(t)) < 0) {
 		fido_log_debug("%s: fido_str_array_pack", __func__);
 		return FIDO_ERR_INTERNAL;
 	}
-	if ((ci->options.name = calloc(nitems(o), sizeof(char *))) == NULL ||
-	    (ci->options.value = calloc(nitems(o), sizeof(bool))) == NULL) {
+	if ((ci->options.name = fido_calloc(nitems(o),
+	    sizeof(char *))) == NULL ||
+	    (ci->options.value = fido_calloc(nitems(o),
+	    sizeof(bool))) == NULL) {
 		fido_log_debug("%s: calloc", __func__);
 		return FIDO_ERR_INTERNAL;
 	}
 	for (size_t i = 0; i < nitems(o); i++) {
-		if ((ci->options.name[i] = strdup(o[i])) == NULL) {
+		if ((ci->options.name[i] = fido_strdup(o[i])) == NULL) {
 			fido_log_debug("%s: strdup", __func__);
 			return FIDO_ERR_INTERNAL;
 		}
@@ -1004,17 +1241,12 @@ fido_winhello_make_cred(fido_dev_t *dev, fido_cred_t *cred, const char *pin,
 
 	fido_cred_reset_rx(cred);
 
-	if ((ctx = calloc(1, sizeof(*ctx))) == NULL) {
+	if ((ctx = fido_calloc(1, sizeof(*ctx))) == NULL) {
 		fido_log_debug("%s: calloc", __func__);
 		goto fail;
 	}
-	if ((w = GetForegroundWindow()) == NULL) {
-		fido_log_debug("%s: GetForegroundWindow", __func__);
-		if ((w = GetTopWindow(NULL)) == NULL) {
-			fido_log_debug("%s: GetTopWindow", __func__);
-			goto fail;
-		}
-	}
+	if (winhello_window(&w) < 0)
+		goto fail;
 	if ((r = translate_fido_cred(ctx, cred, pin, ms)) != FIDO_OK) {
 		fido_log_debug("%s: translate_fido_cred", __func__);
 		goto fail;
@@ -1034,3 +1266,77 @@ fail:
 
 	return r;
 }
+
+int
+fido_winhello_make_cred_begin(fido_dev_t *dev, fido_cred_t *cred,
+    const char *pin)
+{
+	WEBAUTHN_AUTHENTICATOR_MAKE_CREDENTIAL_OPTIONS	*opt;
+	struct winhello_async				*wa;
+	int						 r;
+
+	fido_cred_reset_rx(cred);
+
+	if ((r = winhello_async_new(dev, FIDO_DEV_ASYNC_CRED,
+	    &wa)) != FIDO_OK) {
+		fido_log_debug("%s: winhello_async_new", __func__);
+		return r;
+	}
+	if ((wa->cred = fido_calloc(1, sizeof(*wa->cred))) == NULL) {
+		fido_log_debug("%s: calloc", __func__);
+		r = FIDO_ERR_INTERNAL;
+		goto fail;
+	}
+	if ((r = translate_fido_cred(wa->cred, cred, pin,
+	    dev->timeout_ms)) != FIDO_OK) {
+		fido_log_debug("%s: translate_fido_cred", __func__);
+		goto fail;
+	}
+	opt = &wa->cred->opt;
+	if ((opt->pCancellationId = winhello_async_cancel_id(wa)) != NULL)
+		opt->dwVersion = MAX(opt->dwVersion,
+		    WEBAUTHN_AUTHENTICATOR_MAKE_CREDENTIAL_OPTIONS_VERSION_2);
+	if ((r = winhello_async_start(wa)) != FIDO_OK) {
+		fido_log_debug("%s: winhello_async_start", __func__);
+		goto fail;
+	}
+
+	r = FIDO_OK;
+fail:
+	if (r != FIDO_OK)
+		fido_rx_async_end(dev);
+
+	return r;
+}
+
+int
+fido_winhello_make_cred_step(fido_dev_t *dev, fido_cred_t *cred, int *done,
+    int ms)
+{
+	struct winhello_async	*wa;
+	int			 r;
+
+	*done = 0;
+
+	if ((r = winhello_async_wait(dev, ms, &wa)) != FIDO_OK) {
+		fido_log_debug("%s: winhello_async_wait", __func__);
+		goto fail;
+	}
+	if (wa == NULL)
+		return FIDO_OK; /* keep waiting */
+	if ((r = wa->r) != FIDO_OK) {
+		fido_log_debug("%s: winhello_make_cred", __func__);
+		goto fail;
+	}
+	if ((r = translate_winhello_cred(cred, wa->cred->att)) != FIDO_OK) {
+		fido_log_debug("%s: translate_winhello_cred", __func__);
+		goto fail;
+	}
+
+	r = FIDO_OK;
+fail:
+	fido_rx_async_end(dev);
+	*done = r == FIDO_OK;
+
+	return r;
+}
@@ -0,0 +1,612 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <openssl/err.h>
+#include <openssl/pem.h>
+#include <openssl/sha.h>
+#include <openssl/x509.h>
+
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
+#include "fido.h"
+#include "fido/verify.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define X5C_CACHE_MAXLEN	1024
+
+struct x5c_entry {
+	unsigned char	 digest[SHA256_DIGEST_LENGTH]; /* sha256(x5c) */
+	size_t		 len;  /* length of x5c */
+	EVP_PKEY	*pkey; /* attestation public key */
+	uint64_t	 used; /* tick of last lookup */
+};
+
+static struct x5c_cache {
+	struct x5c_entry	*entry;  /* cached keys */
+	size_t			 size;   /* capacity of entry[] */
+	size_t			 len;    /* entries in use */
+	uint64_t		 tick;   /* lookup counter */
+	uint64_t		 hits;   /* lookups served from the cache */
+	uint64_t		 misses; /* lookups that parsed the certificate */
+} x5c_cache;
+
+#if defined(HAVE_PTHREAD)
+static pthread_mutex_t x5c_lock = PTHREAD_MUTEX_INITIALIZER;
+#define X5C_LOCK()	pthread_mutex_lock(&x5c_lock)
+#define X5C_UNLOCK()	pthread_mutex_unlock(&x5c_lock)
+#elif defined(_WIN32)
+static SRWLOCK x5c_lock = SRWLOCK_INIT;
+#define X5C_LOCK()	AcquireSRWLockExclusive(&x5c_lock)
+#define X5C_UNLOCK()	ReleaseSRWLockExclusive(&x5c_lock)
+#else
+#define X5C_LOCK()	do { } while (0)
+#define X5C_UNLOCK()	do { } while (0)
+#endif
+
+static EVP_PKEY *
+x5c_parse(const fido_blob_t *x5c)
+{
+	BIO		*rawcert = NULL;
+	X509		*cert = NULL;
+	EVP_PKEY	*pkey = NULL;
+
+	/* openssl needs ints */
+	if (x5c->len > INT_MAX) {
+		fido_log_debug("%s: x5c->len=%zu", __func__, x5c->len);
+		return (NULL);
+	}
+
+	if ((rawcert = BIO_new_mem_buf(x5c->ptr, (int)x5c->len)) == NULL ||
+	    (cert = d2i_X509_bio(rawcert, NULL)) == NULL ||
+	    (pkey = X509_get_pubkey(cert)) == NULL)
+		fido_log_debug("%s: x509 key", __func__);
+
+	BIO_free(rawcert);
+	X509_free(cert);
+
+	return (pkey);
+}
+
+/* caller must hold x5c_lock */
+static void
+x5c_cache_trim(size_t len)
+{
+	while (x5c_cache.len > len) {
+		struct x5c_entry *e = &x5c_cache.entry[--x5c_cache.len];
+		EVP_PKEY_free(e->pkey);
+		memset(e, 0, sizeof(*e));
+	}
+}
+
+/* caller must hold x5c_lock */
+static struct x5c_entry *
+x5c_cache_find(const unsigned char *digest, size_t len)
+{
+	struct x5c_entry *e;
+
+	for (size_t i = 0; i < x5c_cache.len; i++) {
+		e = &x5c_cache.entry[i];
+		if (e->len == len && memcmp(e->digest, digest,
+		    sizeof(e->digest)) == 0)
+			return (e);
+	}
+
+	return (NULL);
+}
+
+/* caller must hold x5c_lock */
+static struct x5c_entry *
+x5c_cache_slot(void)
+{
+	struct x5c_entry *e;
+
+	if (x5c_cache.len < x5c_cache.size)
+		return (&x5c_cache.entry[x5c_cache.len++]);
+
+	/* evict the least recently used entry */
+	e = &x5c_cache.entry[0];
+	for (size_t i = 1; i < x5c_cache.len; i++)
+		if (x5c_cache.entry[i].used < e->used)
+			e = &x5c_cache.entry[i];
+	EVP_PKEY_free(e->pkey);
+	e->pkey = NULL;
+
+	return (e);
+}
+
+/*
+ * Return the public key of the DER-encoded certificate in x5c. The
+ * caller owns a reference to the returned key and must free it.
+ */
+EVP_PKEY *
+fido_x5c_pubkey(const fido_blob_t *x5c)
+{
+	unsigned char		 digest[SHA256_DIGEST_LENGTH];
+	struct x5c_entry	*e;
+	EVP_PKEY		*pkey = NULL;
+
+	if (x5c->ptr == NULL || x5c->len == 0)
+		return (NULL);
+
+	X5C_LOCK();
+	if (x5c_cache.size == 0) {
+		X5C_UNLOCK();
+		return (x5c_parse(x5c));
+	}
+	X5C_UNLOCK();
+
+	if (SHA256(x5c->ptr, x5c->len, digest) != digest) {
+		fido_log_debug("%s: sha256", __func__);
+		return (NULL);
+	}
+
+	X5C_LOCK();
+	if ((e = x5c_cache_find(digest, x5c->len)) != NULL &&
+	    EVP_PKEY_up_ref(e->pkey) == 1) {
+		e->used = ++x5c_cache.tick;
+		x5c_cache.hits++;
+		pkey = e->pkey;
+	} else
+		x5c_cache.misses++;
+	X5C_UNLOCK();
+
+	if (pkey != NULL)
+		return (pkey);
+
+	/* parse outside the lock */
+	if ((pkey = x5c_parse(x5c)) == NULL || EVP_PKEY_up_ref(pkey) != 1)
+		return (pkey);
+
+	X5C_LOCK();
+	if (x5c_cache.size == 0 || x5c_cache_find(digest, x5c->len) != NULL) {
+		/* cache disabled or entry added meanwhile */
+		X5C_UNLOCK();
+		EVP_PKEY_free(pkey);
+		return (pkey);
+	}
+	e = x5c_cache_slot();
+	memcpy(e->digest, digest, sizeof(e->digest));
+	e->len = x5c->len;
+	e->pkey = pkey;
+	e->used = ++x5c_cache.tick;
+	X5C_UNLOCK();
+
+	return (pkey);
+}
+
+int
+fido_x5c_cache_set_size(size_t size)
+{
+	struct x5c_entry *entry;
+
+	if (size > X5C_CACHE_MAXLEN) {
+		fido_log_debug("%s: size=%zu", __func__, size);
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	}
+
+	X5C_LOCK();
+	x5c_cache_trim(size);
+	if (size == 0) {
+		fido_free(x5c_cache.entry);
+		x5c_cache.entry = NULL;
+	} else if ((entry = fido_recallocarray(x5c_cache.entry, x5c_cache.size,
+	    size, sizeof(*entry))) == NULL) {
+		X5C_UNLOCK();
+		return (FIDO_ERR_INTERNAL);
+	} else
+		x5c_cache.entry = entry;
+	x5c_cache.size = size;
+	X5C_UNLOCK();
+
+	return (FIDO_OK);
+}
+
+void
+fido_x5c_cache_clear(void)
+{
+	X5C_LOCK();
+	x5c_cache_trim(0);
+	x5c_cache.hits = 0;
+	x5c_cache.misses = 0;
+	X5C_UNLOCK();
+}
+
+size_t
+fido_x5c_cache_size(void)
+{
+	size_t size;
+
+	X5C_LOCK();
+	size = x5c_cache.size;
+	X5C_UNLOCK();
+
+	return (size);
+}
+
+size_t
+fido_x5c_cache_len(void)
+{
+	size_t len;
+
+	X5C_LOCK();
+	len = x5c_cache.len;
+	X5C_UNLOCK();
+
+	return (len);
+}
+
+uint64_t
+fido_x5c_cache_hits(void)
+{
+	uint64_t hits;
+
+	X5C_LOCK();
+	hits = x5c_cache.hits;
+	X5C_UNLOCK();
+
+	return (hits);
+}
+
+uint64_t
+fido_x5c_cache_misses(void)
+{
+	uint64_t misses;
+
+	X5C_LOCK();
+	misses = x5c_cache.misses;
+	X5C_UNLOCK();
+
+	return (misses);
+}
+
+/*
+ * Trust stores. Roots are parsed once, when added; chains built from them
+ * are remembered by the SHA-256 digest of their leaf, until the earliest
+ * expiry in the chain, and the intermediates they went through are kept
+ * for chains presented without them.
+ */
+
+#define TRUST_CACHE_LEN	256
+#define TRUST_MAXINTER	64
+
+struct trust_entry {
+	unsigned char	 digest[SHA256_DIGEST_LENGTH]; /* sha256(leaf) */
+	size_t		 len;       /* length of leaf */
+	ASN1_TIME	*not_after; /* earliest expiry in the chain */
+};
+
+struct fido_trust_store {
+	X509_STORE		*store; /* trust anchors */
+	STACK_OF(X509)		*inter; /* intermediates of verified chains */
+	struct trust_entry	*entry; /* verified leaves, allocated on use */
+	size_t			 len;   /* entries in use */
+	size_t			 next;  /* entry to replace when full */
+#if defined(HAVE_PTHREAD)
+	pthread_mutex_t		 lock;
+#elif defined(_WIN32)
+	SRWLOCK			 lock;
+#endif
+};
+
+#if defined(HAVE_PTHREAD)
+#define TRUST_LOCK(ts)		pthread_mutex_lock(&(ts)->lock)
+#define TRUST_UNLOCK(ts)	pthread_mutex_unlock(&(ts)->lock)
+#elif defined(_WIN32)
+#define TRUST_LOCK(ts)		AcquireSRWLockExclusive(&(ts)->lock)
+#define TRUST_UNLOCK(ts)	ReleaseSRWLockExclusive(&(ts)->lock)
+#else
+#define TRUST_LOCK(ts)		do { } while (0)
+#define TRUST_UNLOCK(ts)	do { } while (0)
+#endif
+
+fido_trust_store_t *
+fido_trust_store_new(void)
+{
+	fido_trust_store_t *ts;
+
+	if ((ts = fido_calloc(1, sizeof(*ts))) == NULL)
+		return (NULL);
+	if ((ts->store = X509_STORE_new()) == NULL ||
+	    (ts->inter = sk_X509_new_null()) == NULL) {
+		fido_log_debug("%s: x509 store", __func__);
+		goto fail;
+	}
+#if defined(HAVE_PTHREAD)
+	if (pthread_mutex_init(&ts->lock, NULL) != 0) {
+		fido_log_debug("%s: pthread_mutex_init", __func__);
+		goto fail;
+	}
+#elif defined(_WIN32)
+	InitializeSRWLock(&ts->lock);
+#endif
+
+	return (ts);
+fail:
+	sk_X509_free(ts->inter);
+	X509_STORE_free(ts->store);
+	fido_free(ts);
+
+	return (NULL);
+}
+
+void
+fido_trust_store_free(fido_trust_store_t **ts_p)
+{
+	fido_trust_store_t *ts;
+
+	if (ts_p == NULL || (ts = *ts_p) == NULL)
+		return;
+	for (size_t i = 0; i < ts->len; i++)
+		ASN1_TIME_free(ts->entry[i].not_after);
+	fido_free(ts->entry);
+	sk_X509_pop_free(ts->inter, X509_free);
+	X509_STORE_free(ts->store);
+#if defined(HAVE_PTHREAD)
+	pthread_mutex_destroy(&ts->lock);
+#endif
+	fido_free(ts);
+
+	*ts_p = NULL;
+}
+
+/* caller must hold ts->lock */
+static void
+trust_cache_clear(fido_trust_store_t *ts)
+{
+	for (size_t i = 0; i < ts->len; i++) {
+		ASN1_TIME_free(ts->entry[i].not_after);
+		memset(&ts->entry[i], 0, sizeof(ts->entry[i]));
+	}
+	ts->len = 0;
+	ts->next = 0;
+}
+
+static int
+trust_add(fido_trust_store_t *ts, X509 *cert)
+{
+	int ok = -1;
+
+	TRUST_LOCK(ts);
+	if (X509_STORE_add_cert(ts->store, cert) != 1)
+		fido_log_debug("%s: X509_STORE_add_cert", __func__);
+	else {
+		/* chains verified before may now end elsewhere */
+		trust_cache_clear(ts);
+		ok = 0;
+	}
+	TRUST_UNLOCK(ts);
+
+	return (ok);
+}
+
+int
+fido_trust_store_add_der(fido_trust_store_t *ts, const unsigned char *ptr,
+    size_t len)
+{
+	const unsigned char	*p = ptr;
+	X509			*cert = NULL;
+	int			 r;
+
+	if (ts == NULL || ptr == NULL || len == 0 || len > LONG_MAX)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if ((cert = d2i_X509(NULL, &p, (long)len)) == NULL ||
+	    p != ptr + len) {
+		fido_log_debug("%s: d2i_X509", __func__);
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto out;
+	}
+
+	r = trust_add(ts, cert) < 0 ? FIDO_ERR_INTERNAL : FIDO_OK;
+out:
+	X509_free(cert);
+
+	return (r);
+}
+
+int
+fido_trust_store_add_pem(fido_trust_store_t *ts, const char *ptr, size_t len)
+{
+	BIO	*bio = NULL;
+	X509	*cert = NULL;
+	size_t	 n = 0;
+	int	 r = FIDO_ERR_INTERNAL;
+
+	/* openssl needs ints */
+	if (ts == NULL || ptr == NULL || len == 0 || len > INT_MAX)
+		return (FIDO_ERR_INVALID_ARGUMENT);
+	if ((bio = BIO_new_mem_buf(ptr, (int)len)) == NULL) {
+		fido_log_debug("%s: BIO_new_mem_buf", __func__);
+		goto out;
+	}
+	while ((cert = PEM_read_bio_X509(bio, NULL, NULL, NULL)) != NULL) {
+		if (trust_add(ts, cert) < 0)
+			goto out;
+		X509_free(cert);
+		cert = NULL;
+		n++;
+	}
+	ERR_clear_error(); /* end of input */
+	if (n == 0) {
+		fido_log_debug("%s: no certificates", __func__);
+		r = FIDO_ERR_INVALID_ARGUMENT;
+		goto out;
+	}
+
+	r = FIDO_OK;
+out:
+	X509_free(cert);
+	BIO_free(bio);
+
+	return (r);
+}
+
+static X509 *
+trust_parse(const fido_blob_t *der)
+{
+	const unsigned char *p = der->ptr;
+
+	if (der->ptr == NULL || der->len == 0 || der->len > LONG_MAX)
+		return (NULL);
+
+	return (d2i_X509(NULL, &p, (long)der->len));
+}
+
+/* caller must hold ts->lock */
+static bool
+trust_cache_hit(const fido_trust_store_t *ts, const unsigned char *digest,
+    size_t len)
+{
+	const struct trust_entry *e;
+
+	for (size_t i = 0; i < ts->len; i++) {
+		e = &ts->entry[i];
+		if (e->len == len && memcmp(e->digest, digest,
+		    sizeof(e->digest)) == 0)
+			return (X509_cmp_current_time(e->not_after) > 0);
+	}
+
+	return (false);
+}
+
+/* caller must hold ts->lock */
+static bool
+trust_has_inter(const fido_trust_store_t *ts, const X509 *cert)
+{
+	for (int i = 0; i < sk_X509_num(ts->inter); i++)
+		if (X509_cmp(sk_X509_value(ts->inter, i), cert) == 0)
+			return (true);
+
+	return (false);
+}
+
+/* caller must hold ts->lock */
+static void
+trust_cache_put(fido_trust_store_t *ts, const unsigned char *digest,
+    size_t len, STACK_OF(X509) *chain)
+{
+	struct trust_entry	*e;
+	const ASN1_TIME		*t, *not_after = NULL;
+	X509			*cert;
+	int			 n = sk_X509_num(chain);
+
+	for (int i = 0; i < n; i++) {
+		cert = sk_X509_value(chain, i);
+		t = X509_get0_notAfter(cert);
+		if (not_after == NULL || ASN1_TIME_compare(t, not_after) < 0)
+			not_after = t;
+		/* the leaf and the anchor are not intermediates */
+		if (i == 0 || i == n - 1 || sk_X509_num(ts->inter) >=
+		    TRUST_MAXINTER || trust_has_inter(ts, cert))
+			continue;
+		if (X509_up_ref(cert) != 1 || sk_X509_push(ts->inter,
+		    cert) == 0) {
+			fido_log_debug("%s: sk_X509_push", __func__);
+			X509_free(cert);
+		}
+	}
+
+	if (ts->entry == NULL && (ts->entry = fido_calloc(TRUST_CACHE_LEN,
+	    sizeof(*ts->entry))) == NULL)
+		return;
+	if (ts->len < TRUST_CACHE_LEN)
+		e = &ts->entry[ts->len++];
+	else {
+		e = &ts->entry[ts->next];
+		ts->next = (ts->next + 1) % TRUST_CACHE_LEN;
+		ASN1_TIME_free(e->not_after);
+	}
+	memcpy(e->digest, digest, sizeof(e->digest));
+	e->len = len;
+	if (not_after == NULL || (e->not_after =
+	    ASN1_STRING_dup(not_after)) == NULL)
+		e->len = 0; /* never matches */
+}
+
+/*
+ * Verify that the attestation certificate in x5c chains to a root in ts,
+ * through the intermediates in chain or those kept from earlier chains.
+ */
+int
+fido_trust_store_verify(fido_trust_store_t *ts, const fido_blob_t *x5c,
+    const fido_blob_array_t *chain)
+{
+	unsigned char		 digest[SHA256_DIGEST_LENGTH];
+	X509_STORE_CTX		*ctx = NULL;
+	STACK_OF(X509)		*untrusted = NULL, *verified = NULL;
+	X509			*leaf = NULL, *cert;
+	bool			 hit;
+	int			 ok = -1;
+
+	if (x5c->ptr == NULL || x5c->len == 0 ||
+	    SHA256(x5c->ptr, x5c->len, digest) != digest) {
+		fido_log_debug("%s: sha256", __func__);
+		return (-1);
+	}
+
+	TRUST_LOCK(ts);
+	hit = trust_cache_hit(ts, digest, x5c->len);
+	TRUST_UNLOCK(ts);
+	if (hit)
+		return (0);
+
+	if ((leaf = trust_parse(x5c)) == NULL ||
+	    (untrusted = sk_X509_new_null()) == NULL) {
+		fido_log_debug("%s: x509", __func__);
+		goto fail;
+	}
+	for (size_t i = 0; i < chain->len; i++) {
+		if ((cert = trust_parse(&chain->ptr[i])) == NULL) {
+			fido_log_debug("%s: x5c[%zu]", __func__, i + 1);
+			goto fail;
+		}
+		if (sk_X509_push(untrusted, cert) == 0) {
+			X509_free(cert);
+			goto fail;
+		}
+	}
+	TRUST_LOCK(ts);
+	for (int i = 0; i < sk_X509_num(ts->inter); i++) {
+		cert = sk_X509_value(ts->inter, i);
+		if (X509_up_ref(cert) != 1)
+			continue;
+		if (sk_X509_push(untrusted, cert) == 0) {
+			X509_free(cert);
+			break;
+		}
+	}
+	TRUST_UNLOCK(ts);
+
+	if ((ctx = X509_STORE_CTX_new()) == NULL ||
+	    X509_STORE_CTX_init(ctx, ts->store, leaf, untrusted) != 1) {
+		fido_log_debug("%s: X509_STORE_CTX_init", __func__);
+		goto fail;
+	}
+	if (X509_verify_cert(ctx) != 1) {
+		fido_log_debug("%s: X509_verify_cert: %s", __func__,
+		    X509_verify_cert_error_string(X509_STORE_CTX_get_error(ctx)));
+		goto fail;
+	}
+	if ((verified = X509_STORE_CTX_get1_chain(ctx)) != NULL) {
+		TRUST_LOCK(ts);
+		trust_cache_put(ts, digest, x5c->len, verified);
+		TRUST_UNLOCK(ts);
+	}
+
+	ok = 0;
+fail:
+	sk_X509_pop_free(verified, X509_free);
+	X509_STORE_CTX_free(ctx);
+	sk_X509_pop_free(untrusted, X509_free);
+	X509_free(leaf);
+
+	return (ok);
+}
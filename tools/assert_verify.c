@@ -10,6 +10,7 @@
 #include <fido/es384.h>
 #include <fido/rs256.h>
 #include <fido/eddsa.h>
+#include <fido/verify.h>
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -21,6 +22,33 @@
 #include "../openbsd-compat/openbsd-compat.h"
 #include "extern.h"
 
+static int
+set_assert(fido_assert_t *assert, const struct blob *cdh, const char *rpid,
+    const struct blob *authdata, const struct blob *sig, int flags)
+{
+	int r;
+
+	if ((r = fido_assert_set_count(assert, 1)) != FIDO_OK ||
+	    (r = fido_assert_set_clientdata_hash(assert, cdh->ptr,
+	    cdh->len)) != FIDO_OK ||
+	    (r = fido_assert_set_rp(assert, rpid)) != FIDO_OK ||
+	    (r = fido_assert_set_authdata(assert, 0, authdata->ptr,
+	    authdata->len)) != FIDO_OK ||
+	    (r = fido_assert_set_sig(assert, 0, sig->ptr, sig->len)) != FIDO_OK)
+		return (r);
+	if ((flags & FLAG_UP) &&
+	    (r = fido_assert_set_up(assert, FIDO_OPT_TRUE)) != FIDO_OK)
+		return (r);
+	if ((flags & FLAG_UV) &&
+	    (r = fido_assert_set_uv(assert, FIDO_OPT_TRUE)) != FIDO_OK)
+		return (r);
+	if ((flags & FLAG_HMAC) && (r = fido_assert_set_extensions(assert,
+	    FIDO_EXT_HMAC_SECRET)) != FIDO_OK)
+		return (r);
+
+	return (FIDO_OK);
+}
+
 static fido_assert_t *
 prepare_assert(FILE *in_f, int flags)
 {
@@ -54,32 +82,10 @@ prepare_assert(FILE *in_f, int flags)
 
 	if ((assert = fido_assert_new()) == NULL)
 		errx(1, "fido_assert_new");
-	if ((r = fido_assert_set_count(assert, 1)) != FIDO_OK)
-		errx(1, "fido_assert_count: %s", fido_strerr(r));
-
-	if ((r = fido_assert_set_clientdata_hash(assert, cdh.ptr,
-	    cdh.len)) != FIDO_OK ||
-	    (r = fido_assert_set_rp(assert, rpid)) != FIDO_OK ||
-	    (r = fido_assert_set_authdata(assert, 0, authdata.ptr,
-	    authdata.len)) != FIDO_OK ||
-	    (r = fido_assert_set_sig(assert, 0, sig.ptr, sig.len)) != FIDO_OK)
+	if ((r = set_assert(assert, &cdh, rpid, &authdata, &sig,
+	    flags)) != FIDO_OK)
 		errx(1, "fido_assert_set: %s", fido_strerr(r));
 
-	if (flags & FLAG_UP) {
-		if ((r = fido_assert_set_up(assert, FIDO_OPT_TRUE)) != FIDO_OK)
-			errx(1, "fido_assert_set_up: %s", fido_strerr(r));
-	}
-	if (flags & FLAG_UV) {
-		if ((r = fido_assert_set_uv(assert, FIDO_OPT_TRUE)) != FIDO_OK)
-			errx(1, "fido_assert_set_uv: %s", fido_strerr(r));
-	}
-	if (flags & FLAG_HMAC) {
-		if ((r = fido_assert_set_extensions(assert,
-		    FIDO_EXT_HMAC_SECRET)) != FIDO_OK)
-			errx(1, "fido_assert_set_extensions: %s",
-			    fido_strerr(r));
-	}
-
 	free(cdh.ptr);
 	free(authdata.ptr);
 	free(sig.ptr);
@@ -89,7 +95,7 @@ prepare_assert(FILE *in_f, int flags)
 }
 
 static void *
-load_pubkey(int type, const char *file)
+pubkey_new(int type, const char *file)
 {
 	EC_KEY *ec = NULL;
 	RSA *rsa = NULL;
@@ -102,52 +108,351 @@ load_pubkey(int type, const char *file)
 
 	switch (type) {
 	case COSE_ES256:
-		if ((ec = read_ec_pubkey(file)) == NULL)
-			errx(1, "read_ec_pubkey");
+		if ((ec = read_ec_pubkey(file)) == NULL) {
+			warnx("read_ec_pubkey");
+			break;
+		}
 		if ((es256_pk = es256_pk_new()) == NULL)
 			errx(1, "es256_pk_new");
-		if (es256_pk_from_EC_KEY(es256_pk, ec) != FIDO_OK)
-			errx(1, "es256_pk_from_EC_KEY");
+		if (es256_pk_from_EC_KEY(es256_pk, ec) != FIDO_OK) {
+			warnx("es256_pk_from_EC_KEY");
+			es256_pk_free(&es256_pk);
+		}
 		pk = es256_pk;
 		EC_KEY_free(ec);
 		break;
 	case COSE_ES384:
-		if ((ec = read_ec_pubkey(file)) == NULL)
-			errx(1, "read_ec_pubkey");
+		if ((ec = read_ec_pubkey(file)) == NULL) {
+			warnx("read_ec_pubkey");
+			break;
+		}
 		if ((es384_pk = es384_pk_new()) == NULL)
 			errx(1, "es384_pk_new");
-		if (es384_pk_from_EC_KEY(es384_pk, ec) != FIDO_OK)
-			errx(1, "es384_pk_from_EC_KEY");
+		if (es384_pk_from_EC_KEY(es384_pk, ec) != FIDO_OK) {
+			warnx("es384_pk_from_EC_KEY");
+			es384_pk_free(&es384_pk);
+		}
 		pk = es384_pk;
 		EC_KEY_free(ec);
 		break;
 	case COSE_RS256:
-		if ((rsa = read_rsa_pubkey(file)) == NULL)
-			errx(1, "read_rsa_pubkey");
+		if ((rsa = read_rsa_pubkey(file)) == NULL) {
+			warnx("read_rsa_pubkey");
+			break;
+		}
 		if ((rs256_pk = rs256_pk_new()) == NULL)
 			errx(1, "rs256_pk_new");
-		if (rs256_pk_from_RSA(rs256_pk, rsa) != FIDO_OK)
-			errx(1, "rs256_pk_from_RSA");
+		if (rs256_pk_from_RSA(rs256_pk, rsa) != FIDO_OK) {
+			warnx("rs256_pk_from_RSA");
+			rs256_pk_free(&rs256_pk);
+		}
 		pk = rs256_pk;
 		RSA_free(rsa);
 		break;
 	case COSE_EDDSA:
-		if ((eddsa = read_eddsa_pubkey(file)) == NULL)
-			errx(1, "read_eddsa_pubkey");
+		if ((eddsa = read_eddsa_pubkey(file)) == NULL) {
+			warnx("read_eddsa_pubkey");
+			break;
+		}
 		if ((eddsa_pk = eddsa_pk_new()) == NULL)
 			errx(1, "eddsa_pk_new");
-		if (eddsa_pk_from_EVP_PKEY(eddsa_pk, eddsa) != FIDO_OK)
-			errx(1, "eddsa_pk_from_EVP_PKEY");
+		if (eddsa_pk_from_EVP_PKEY(eddsa_pk, eddsa) != FIDO_OK) {
+			warnx("eddsa_pk_from_EVP_PKEY");
+			eddsa_pk_free(&eddsa_pk);
+		}
 		pk = eddsa_pk;
 		EVP_PKEY_free(eddsa);
 		break;
 	default:
-		errx(1, "invalid type %d", type);
+		warnx("invalid type %d", type);
 	}
 
 	return (pk);
 }
 
+static void
+pubkey_free(int type, void *pk)
+{
+	es256_pk_t *es256_pk;
+	es384_pk_t *es384_pk;
+	rs256_pk_t *rs256_pk;
+	eddsa_pk_t *eddsa_pk;
+
+	switch (type) {
+	case COSE_ES256:
+		es256_pk = pk;
+		es256_pk_free(&es256_pk);
+		break;
+	case COSE_ES384:
+		es384_pk = pk;
+		es384_pk_free(&es384_pk);
+		break;
+	case COSE_RS256:
+		rs256_pk = pk;
+		rs256_pk_free(&rs256_pk);
+		break;
+	case COSE_EDDSA:
+		eddsa_pk = pk;
+		eddsa_pk_free(&eddsa_pk);
+		break;
+	}
+}
+
+static void *
+load_pubkey(int type, const char *file)
+{
+	void *pk;
+
+	if ((pk = pubkey_new(type, file)) == NULL)
+		exit(1);
+
+	return (pk);
+}
+
+/*
+ * Batch mode: records are read, and their keys loaded, on the calling
+ * thread, while the previous BATCH_LEN records are verified by a
+ * fido_verifier_t. Results are printed in input order.
+ */
+
+#define BATCH_LEN	1024
+
+struct batch_key {
+	char	*name;
+	int	 type;
+	void	*pk; /* NULL if the key could not be loaded */
+};
+
+struct batch_rec {
+	fido_assert_t	*assert;
+	const char	*error; /* set if the record was not verified */
+};
+
+struct batch {
+	struct batch_rec		rec[BATCH_LEN];
+	fido_assert_verify_item_t	item[BATCH_LEN];
+	int				result[BATCH_LEN];
+	size_t				n;
+	size_t				first; /* number of rec[0] */
+};
+
+struct batch_keys {
+	struct batch_key	**key; /* sorted by name, then type */
+	size_t			  n;
+	const char		 *dir;
+};
+
+static int
+batch_key_cmp(const struct batch_key *k, const char *name, int type)
+{
+	int r;
+
+	if ((r = strcmp(k->name, name)) != 0)
+		return (r);
+
+	return ((k->type > type) - (k->type < type));
+}
+
+static const struct batch_key *
+batch_key_get(struct batch_keys *keys, const char *name, int type)
+{
+	struct batch_key *k, **p;
+	char *path;
+	size_t lo = 0, hi = keys->n, mid, len;
+	int r;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if ((r = batch_key_cmp(keys->key[mid], name, type)) == 0)
+			return (keys->key[mid]);
+		if (r < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if ((k = calloc(1, sizeof(*k))) == NULL ||
+	    (k->name = strdup(name)) == NULL)
+		err(1, "calloc");
+	k->type = type;
+	len = strlen(keys->dir) + strlen(name) + 2;
+	if ((path = malloc(len)) == NULL)
+		err(1, "malloc");
+	if ((r = snprintf(path, len, "%s/%s", keys->dir, name)) < 0 ||
+	    (size_t)r >= len)
+		errx(1, "snprintf");
+	if ((k->pk = pubkey_new(type, path)) == NULL)
+		warnx("%s: could not load key", path);
+	free(path);
+
+	if ((p = realloc(keys->key, (keys->n + 1) * sizeof(*p))) == NULL)
+		err(1, "realloc");
+	memmove(&p[lo + 1], &p[lo], (keys->n - lo) * sizeof(*p));
+	p[lo] = k;
+	keys->key = p;
+	keys->n++;
+
+	return (k);
+}
+
+static void
+batch_keys_free(struct batch_keys *keys)
+{
+	for (size_t i = 0; i < keys->n; i++) {
+		pubkey_free(keys->key[i]->type, keys->key[i]->pk);
+		free(keys->key[i]->name);
+		free(keys->key[i]);
+	}
+	free(keys->key);
+}
+
+/*
+ * Parse a record's key line, "name [type]". Names are relative to the key
+ * directory, and may not contain a path separator or start with a dot.
+ */
+static const struct batch_key *
+batch_key_parse(struct batch_keys *keys, char *line, int type)
+{
+	char *name, *alg;
+
+	name = strsep(&line, " \t");
+	alg = line;
+	if (*name == '\0' || *name == '.' || strchr(name, '/') != NULL ||
+	    strchr(name, '\\') != NULL) {
+		warnx("invalid key name '%s'", name);
+		return (NULL);
+	}
+	if (alg != NULL && cose_type(alg, &type) < 0) {
+		warnx("unknown type %s", alg);
+		return (NULL);
+	}
+
+	return (batch_key_get(keys, name, type));
+}
+
+/* returns the number of records read; 0 on end of input */
+static size_t
+batch_read(struct batch *b, FILE *in_f, struct batch_keys *keys, int type,
+    int flags)
+{
+	struct batch_rec *rec;
+	const struct batch_key *key;
+	struct blob cdh, authdata, sig;
+	char *line, *rpid;
+	int r;
+
+	for (b->n = 0; b->n < BATCH_LEN; b->n++) {
+		if (string_read(in_f, &line) < 0) {
+			if (!feof(in_f))
+				errx(1, "record %zu: input error",
+				    b->first + b->n);
+			break;
+		}
+		r = base64_read(in_f, &cdh);
+		r |= string_read(in_f, &rpid);
+		r |= base64_read(in_f, &authdata);
+		r |= base64_read(in_f, &sig);
+		if (r < 0)
+			errx(1, "record %zu: input error", b->first + b->n);
+
+		rec = &b->rec[b->n];
+		memset(rec, 0, sizeof(*rec));
+		memset(&b->item[b->n], 0, sizeof(b->item[b->n]));
+		b->result[b->n] = FIDO_ERR_INTERNAL;
+
+		if ((key = batch_key_parse(keys, line, type)) == NULL ||
+		    key->pk == NULL)
+			rec->error = "invalid key";
+		else if ((rec->assert = fido_assert_new()) == NULL)
+			errx(1, "fido_assert_new");
+		else if ((r = set_assert(rec->assert, &cdh, rpid, &authdata,
+		    &sig, flags)) != FIDO_OK)
+			rec->error = fido_strerr(r);
+		else {
+			b->item[b->n].assert = rec->assert;
+			b->item[b->n].cose_alg = key->type;
+			b->item[b->n].pk = key->pk;
+		}
+
+		free(line);
+		free(cdh.ptr);
+		free(rpid);
+		free(authdata.ptr);
+		free(sig.ptr);
+	}
+
+	return (b->n);
+}
+
+/* returns the number of records that failed verification */
+static size_t
+batch_print(struct batch *b)
+{
+	const char *status;
+	size_t nfail = 0;
+
+	for (size_t i = 0; i < b->n; i++) {
+		if ((status = b->rec[i].error) == NULL)
+			status = b->result[i] == FIDO_OK ? "ok" :
+			    fido_strerr(b->result[i]);
+		if (b->rec[i].error != NULL || b->result[i] != FIDO_OK)
+			nfail++;
+		printf("%zu %s\n", b->first + i, status);
+		fido_assert_free(&b->rec[i].assert);
+	}
+	fflush(stdout);
+
+	return (nfail);
+}
+
+static int
+assert_verify_batch(FILE *in_f, const char *dir, int type, int jobs,
+    int flags)
+{
+	fido_verifier_t *v;
+	struct batch_keys keys;
+	struct batch *cur, *next, *tmp;
+	void *cookie;
+	size_t idx, nfail = 0;
+	int r, result;
+
+	memset(&keys, 0, sizeof(keys));
+	keys.dir = dir;
+
+	if ((v = fido_verifier_new((size_t)jobs)) == NULL)
+		errx(1, "fido_verifier_new");
+	if ((cur = calloc(1, sizeof(*cur))) == NULL ||
+	    (next = calloc(1, sizeof(*next))) == NULL)
+		err(1, "calloc");
+
+	cur->first = 1;
+	batch_read(cur, in_f, &keys, type, flags);
+	while (cur->n > 0) {
+		if ((r = fido_verifier_submit_assert(v, cur->item, cur->n,
+		    cur)) != FIDO_OK)
+			errx(1, "fido_verifier_submit_assert: %s",
+			    fido_strerr(r));
+		next->first = cur->first + cur->n;
+		batch_read(next, in_f, &keys, type, flags);
+		while ((r = fido_verifier_poll(v, &cookie, &idx, &result,
+		    -1)) == FIDO_OK)
+			cur->result[idx] = result;
+		if (r != FIDO_ERR_NOTFOUND)
+			errx(1, "fido_verifier_poll: %s", fido_strerr(r));
+		nfail += batch_print(cur);
+		tmp = cur;
+		cur = next;
+		next = tmp;
+	}
+
+	fido_verifier_free(&v);
+	batch_keys_free(&keys);
+	free(cur);
+	free(next);
+
+	return (nfail == 0 ? 0 : 1);
+}
+
 int
 assert_verify(int argc, char **argv)
 {
@@ -157,11 +462,16 @@ assert_verify(int argc, char **argv)
 	FILE *in_f = NULL;
 	int type = COSE_ES256;
 	int flags = 0;
+	int batch = 0;
+	int jobs = 0;
 	int ch;
 	int r;
 
-	while ((ch = getopt(argc, argv, "dhi:pv")) != -1) {
+	while ((ch = getopt(argc, argv, "Bdhi:j:pv")) != -1) {
 		switch (ch) {
+		case 'B':
+			batch = 1;
+			break;
 		case 'd':
 			flags |= FLAG_DEBUG;
 			break;
@@ -171,6 +481,10 @@ assert_verify(int argc, char **argv)
 		case 'i':
 			in_path = optarg;
 			break;
+		case 'j':
+			if ((jobs = base10(optarg)) < 1)
+				errx(1, "-j: invalid argument '%s'", optarg);
+			break;
 		case 'p':
 			flags |= FLAG_UP;
 			break;
@@ -185,7 +499,7 @@ assert_verify(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
-	if (argc < 1 || argc > 2)
+	if (argc < 1 || argc > 2 || (jobs && !batch))
 		usage();
 
 	in_f = open_read(in_path);
@@ -195,6 +509,12 @@ assert_verify(int argc, char **argv)
 
 	fido_init((flags & FLAG_DEBUG) ? FIDO_DEBUG : 0);
 
+	if (batch) {
+		r = assert_verify_batch(in_f, argv[0], type, jobs, flags);
+		fclose(in_f);
+		exit(r);
+	}
+
 	pk = load_pubkey(type, argv[0]);
 	assert = prepare_assert(in_f, flags);
 	if ((r = fido_assert_verify(assert, 0, type, pk)) != FIDO_OK)
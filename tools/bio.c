@@ -153,6 +153,19 @@ enroll_strerr(uint8_t n)
 	}
 }
 
+static int
+enroll_cb(uint8_t status, uint8_t remaining, void *arg)
+{
+	(void)arg;
+
+	printf("%s.\n", enroll_strerr(status));
+	if (remaining > 0)
+		printf("Touch your security key (%u sample%s left).\n",
+		    (unsigned)remaining, plural(remaining));
+
+	return (0);
+}
+
 int
 bio_enroll(const char *path)
 {
@@ -171,28 +184,14 @@ bio_enroll(const char *path)
 	if ((pin = get_pin(path)) == NULL)
 		goto out;
 	printf("Touch your security key.\n");
-	r = fido_bio_dev_enroll_begin(dev, t, e, 10000, pin);
+	r = fido_bio_dev_enroll(dev, t, e, 10000, pin, enroll_cb, NULL);
 	freezero(pin, PINBUF_LEN);
 	pin = NULL;
 	if (r != FIDO_OK) {
-		warnx("fido_bio_dev_enroll_begin: %s", fido_strerr(r));
+		fido_dev_cancel(dev);
+		warnx("fido_bio_dev_enroll: %s", fido_strerr(r));
 		goto out;
 	}
-	printf("%s.\n", enroll_strerr(fido_bio_enroll_last_status(e)));
-
-	while (fido_bio_enroll_remaining_samples(e) > 0) {
-		printf("Touch your security key (%u sample%s left).\n",
-		    (unsigned)fido_bio_enroll_remaining_samples(e),
-		    plural(fido_bio_enroll_remaining_samples(e)));
-		if ((r = fido_bio_dev_enroll_continue(dev, t, e,
-		    10000)) != FIDO_OK) {
-			fido_dev_cancel(dev);
-			warnx("fido_bio_dev_enroll_continue: %s",
-			    fido_strerr(r));
-			goto out;
-		}
-		printf("%s.\n", enroll_strerr(fido_bio_enroll_last_status(e)));
-	}
 
 	ok = 0;
 out:
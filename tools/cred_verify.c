@@ -5,7 +5,15 @@
  * SPDX-License-Identifier: BSD-2-Clause
  */
 
+#include <openssl/x509.h>
+
 #include <fido.h>
+#include <fido/es256.h>
+#include <fido/es384.h>
+#include <fido/rs256.h>
+#include <fido/eddsa.h>
+#include <fido/verify.h>
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,6 +24,35 @@
 #include "../openbsd-compat/openbsd-compat.h"
 #include "extern.h"
 
+static int
+set_cred(fido_cred_t *cred, int type, const struct blob *cdh,
+    const char *rpid, const char *fmt, const struct blob *authdata,
+    const struct blob *sig, const struct blob *x5c, int flags)
+{
+	int r;
+
+	if ((r = fido_cred_set_type(cred, type)) != FIDO_OK ||
+	    (r = fido_cred_set_clientdata_hash(cred, cdh->ptr,
+	    cdh->len)) != FIDO_OK ||
+	    (r = fido_cred_set_rp(cred, rpid, NULL)) != FIDO_OK ||
+	    (r = fido_cred_set_authdata(cred, authdata->ptr,
+	    authdata->len)) != FIDO_OK ||
+	    (r = fido_cred_set_sig(cred, sig->ptr, sig->len)) != FIDO_OK ||
+	    (r = fido_cred_set_fmt(cred, fmt)) != FIDO_OK)
+		return (r);
+	if (x5c->ptr != NULL &&
+	    (r = fido_cred_set_x509(cred, x5c->ptr, x5c->len)) != FIDO_OK)
+		return (r);
+	if ((flags & FLAG_UV) &&
+	    (r = fido_cred_set_uv(cred, FIDO_OPT_TRUE)) != FIDO_OK)
+		return (r);
+	if ((flags & FLAG_HMAC) && (r = fido_cred_set_extensions(cred,
+	    FIDO_EXT_HMAC_SECRET)) != FIDO_OK)
+		return (r);
+
+	return (FIDO_OK);
+}
+
 static fido_cred_t *
 prepare_cred(FILE *in_f, int type, int flags)
 {
@@ -63,32 +100,10 @@ prepare_cred(FILE *in_f, int type, int flags)
 
 	if ((cred = fido_cred_new()) == NULL)
 		errx(1, "fido_cred_new");
-
-	if ((r = fido_cred_set_type(cred, type)) != FIDO_OK ||
-	    (r = fido_cred_set_clientdata_hash(cred, cdh.ptr,
-	    cdh.len)) != FIDO_OK ||
-	    (r = fido_cred_set_rp(cred, rpid, NULL)) != FIDO_OK ||
-	    (r = fido_cred_set_authdata(cred, authdata.ptr,
-	    authdata.len)) != FIDO_OK ||
-	    (r = fido_cred_set_sig(cred, sig.ptr, sig.len)) != FIDO_OK ||
-	    (r = fido_cred_set_fmt(cred, fmt)) != FIDO_OK)
+	if ((r = set_cred(cred, type, &cdh, rpid, fmt, &authdata, &sig, &x5c,
+	    flags)) != FIDO_OK)
 		errx(1, "fido_cred_set: %s", fido_strerr(r));
 
-	if (x5c.ptr != NULL) {
-		if ((r = fido_cred_set_x509(cred, x5c.ptr, x5c.len)) != FIDO_OK)
-			errx(1, "fido_cred_set_x509: %s", fido_strerr(r));
-	}
-
-	if (flags & FLAG_UV) {
-		if ((r = fido_cred_set_uv(cred, FIDO_OPT_TRUE)) != FIDO_OK)
-			errx(1, "fido_cred_set_uv: %s", fido_strerr(r));
-	}
-	if (flags & FLAG_HMAC) {
-		if ((r = fido_cred_set_extensions(cred,
-		    FIDO_EXT_HMAC_SECRET)) != FIDO_OK)
-			errx(1, "fido_cred_set_extensions: %s", fido_strerr(r));
-	}
-
 	free(cdh.ptr);
 	free(authdata.ptr);
 	free(id.ptr);
@@ -100,6 +115,241 @@ prepare_cred(FILE *in_f, int type, int flags)
 	return (cred);
 }
 
+/*
+ * Batch mode: records are read on the calling thread, while the previous
+ * BATCH_LEN records are verified by a fido_verifier_t. Self-attested
+ * credentials, which fido_cred_verify() does not handle, are verified as
+ * they are read. Results are printed in input order.
+ */
+
+#define BATCH_LEN	1024
+#define X5C_CACHE_LEN	64
+
+struct batch_rec {
+	fido_cred_t	*cred;
+	const char	*error; /* set if the record was not verified */
+	int		 self;  /* verified as it was read */
+	int		 r;     /* outcome, if self */
+};
+
+struct batch {
+	struct batch_rec	 rec[BATCH_LEN];
+	const fido_cred_t	*item[BATCH_LEN];
+	int			 result[BATCH_LEN];
+	size_t			 n;
+	size_t			 first; /* number of rec[0] */
+};
+
+/* the credential's public key, as base64-encoded SubjectPublicKeyInfo */
+static char *
+pubkey_b64(const fido_cred_t *cred)
+{
+	const unsigned char *ptr = fido_cred_pubkey_ptr(cred);
+	size_t len = fido_cred_pubkey_len(cred);
+	EVP_PKEY *pkey = NULL;
+	es256_pk_t *es256_pk = NULL;
+	es384_pk_t *es384_pk = NULL;
+	rs256_pk_t *rs256_pk = NULL;
+	eddsa_pk_t *eddsa_pk = NULL;
+	unsigned char *der = NULL;
+	char *b64 = NULL;
+	int n;
+
+	switch (fido_cred_type(cred)) {
+	case COSE_ES256:
+		if ((es256_pk = es256_pk_new()) != NULL &&
+		    es256_pk_from_ptr(es256_pk, ptr, len) == FIDO_OK)
+			pkey = es256_pk_to_EVP_PKEY(es256_pk);
+		es256_pk_free(&es256_pk);
+		break;
+	case COSE_ES384:
+		if ((es384_pk = es384_pk_new()) != NULL &&
+		    es384_pk_from_ptr(es384_pk, ptr, len) == FIDO_OK)
+			pkey = es384_pk_to_EVP_PKEY(es384_pk);
+		es384_pk_free(&es384_pk);
+		break;
+	case COSE_RS256:
+		if ((rs256_pk = rs256_pk_new()) != NULL &&
+		    rs256_pk_from_ptr(rs256_pk, ptr, len) == FIDO_OK)
+			pkey = rs256_pk_to_EVP_PKEY(rs256_pk);
+		rs256_pk_free(&rs256_pk);
+		break;
+	case COSE_EDDSA:
+		if ((eddsa_pk = eddsa_pk_new()) != NULL &&
+		    eddsa_pk_from_ptr(eddsa_pk, ptr, len) == FIDO_OK)
+			pkey = eddsa_pk_to_EVP_PKEY(eddsa_pk);
+		eddsa_pk_free(&eddsa_pk);
+		break;
+	}
+
+	if (pkey == NULL || (n = i2d_PUBKEY(pkey, &der)) <= 0 ||
+	    base64_encode(der, (size_t)n, &b64) < 0)
+		b64 = NULL;
+
+	EVP_PKEY_free(pkey);
+	OPENSSL_free(der);
+
+	return (b64);
+}
+
+/* like base64_read(), but an empty line yields an empty blob */
+static int
+base64_read_opt(FILE *in_f, struct blob *out)
+{
+	char *line;
+	int r;
+
+	out->ptr = NULL;
+	out->len = 0;
+
+	if (string_read(in_f, &line) < 0)
+		return (-1);
+	r = *line == '\0' ? 0 : base64_decode(line, (void **)&out->ptr,
+	    &out->len);
+	free(line);
+
+	return (r);
+}
+
+/* returns the number of records read; 0 on end of input */
+static size_t
+batch_read(struct batch *b, FILE *in_f, int type, int cred_prot, int flags)
+{
+	struct batch_rec *rec;
+	struct blob cdh, authdata, id, sig, x5c;
+	char *alg, *rpid, *fmt;
+	int r, t;
+
+	for (b->n = 0; b->n < BATCH_LEN; b->n++) {
+		if (string_read(in_f, &alg) < 0) {
+			if (!feof(in_f))
+				errx(1, "record %zu: input error",
+				    b->first + b->n);
+			break;
+		}
+		r = base64_read(in_f, &cdh);
+		r |= string_read(in_f, &rpid);
+		r |= string_read(in_f, &fmt);
+		r |= base64_read(in_f, &authdata);
+		r |= base64_read(in_f, &id);
+		r |= base64_read(in_f, &sig);
+		r |= base64_read_opt(in_f, &x5c);
+		if (r < 0)
+			errx(1, "record %zu: input error", b->first + b->n);
+
+		rec = &b->rec[b->n];
+		memset(rec, 0, sizeof(*rec));
+		b->item[b->n] = NULL;
+		b->result[b->n] = FIDO_ERR_INTERNAL;
+
+		t = type;
+		if (*alg != '\0' && cose_type(alg, &t) < 0)
+			rec->error = "unknown type";
+		else if ((rec->cred = fido_cred_new()) == NULL)
+			errx(1, "fido_cred_new");
+		else if ((r = set_cred(rec->cred, t, &cdh, rpid, fmt,
+		    &authdata, &sig, &x5c, flags)) != FIDO_OK ||
+		    (cred_prot > 0 &&
+		    (r = fido_cred_set_prot(rec->cred, cred_prot)) != FIDO_OK))
+			rec->error = fido_strerr(r);
+		else if (x5c.ptr == NULL) {
+			rec->self = 1;
+			rec->r = fido_cred_verify_self(rec->cred);
+		} else
+			b->item[b->n] = rec->cred;
+
+		free(alg);
+		free(cdh.ptr);
+		free(rpid);
+		free(fmt);
+		free(authdata.ptr);
+		free(id.ptr);
+		free(sig.ptr);
+		free(x5c.ptr);
+	}
+
+	return (b->n);
+}
+
+/* returns the number of records that failed verification */
+static size_t
+batch_print(FILE *out_f, struct batch *b)
+{
+	const struct batch_rec *rec;
+	char *id, *pk;
+	size_t nfail = 0;
+	int r;
+
+	for (size_t i = 0; i < b->n; i++) {
+		rec = &b->rec[i];
+		r = rec->self ? rec->r : b->result[i];
+		if (rec->error != NULL || r != FIDO_OK) {
+			fprintf(out_f, "%zu %s\n", b->first + i, rec->error ?
+			    rec->error : fido_strerr(r));
+			nfail++;
+		} else if (base64_encode(fido_cred_id_ptr(rec->cred),
+		    fido_cred_id_len(rec->cred), &id) < 0 ||
+		    (pk = pubkey_b64(rec->cred)) == NULL)
+			errx(1, "output error");
+		else {
+			fprintf(out_f, "%zu ok %s %s %s\n", b->first + i,
+			    cose_string(fido_cred_type(rec->cred)), id, pk);
+			free(id);
+			free(pk);
+		}
+		fido_cred_free(&b->rec[i].cred);
+	}
+	fflush(out_f);
+
+	return (nfail);
+}
+
+static int
+cred_verify_batch(FILE *in_f, FILE *out_f, int type, int cred_prot,
+    int jobs, int flags)
+{
+	fido_verifier_t *v;
+	struct batch *cur, *next, *tmp;
+	void *cookie;
+	size_t idx, nfail = 0;
+	int r, result;
+
+	if ((v = fido_verifier_new((size_t)jobs)) == NULL)
+		errx(1, "fido_verifier_new");
+	if ((r = fido_x5c_cache_set_size(X5C_CACHE_LEN)) != FIDO_OK)
+		errx(1, "fido_x5c_cache_set_size: %s", fido_strerr(r));
+	if ((cur = calloc(1, sizeof(*cur))) == NULL ||
+	    (next = calloc(1, sizeof(*next))) == NULL)
+		err(1, "calloc");
+
+	cur->first = 1;
+	batch_read(cur, in_f, type, cred_prot, flags);
+	while (cur->n > 0) {
+		if ((r = fido_verifier_submit_cred(v, cur->item, cur->n,
+		    cur)) != FIDO_OK)
+			errx(1, "fido_verifier_submit_cred: %s",
+			    fido_strerr(r));
+		next->first = cur->first + cur->n;
+		batch_read(next, in_f, type, cred_prot, flags);
+		while ((r = fido_verifier_poll(v, &cookie, &idx, &result,
+		    -1)) == FIDO_OK)
+			cur->result[idx] = result;
+		if (r != FIDO_ERR_NOTFOUND)
+			errx(1, "fido_verifier_poll: %s", fido_strerr(r));
+		nfail += batch_print(out_f, cur);
+		tmp = cur;
+		cur = next;
+		next = tmp;
+	}
+
+	fido_verifier_free(&v);
+	fido_x5c_cache_clear();
+	free(cur);
+	free(next);
+
+	return (nfail == 0 ? 0 : 1);
+}
+
 int
 cred_verify(int argc, char **argv)
 {
@@ -111,11 +361,16 @@ cred_verify(int argc, char **argv)
 	int type = COSE_ES256;
 	int flags = 0;
 	int cred_prot = -1;
+	int batch = 0;
+	int jobs = 0;
 	int ch;
 	int r;
 
-	while ((ch = getopt(argc, argv, "c:dhi:o:v")) != -1) {
+	while ((ch = getopt(argc, argv, "Bc:dhi:j:o:v")) != -1) {
 		switch (ch) {
+		case 'B':
+			batch = 1;
+			break;
 		case 'c':
 			if ((cred_prot = base10(optarg)) < 0)
 				errx(1, "-c: invalid argument '%s'", optarg);
@@ -129,6 +384,10 @@ cred_verify(int argc, char **argv)
 		case 'i':
 			in_path = optarg;
 			break;
+		case 'j':
+			if ((jobs = base10(optarg)) < 1)
+				errx(1, "-j: invalid argument '%s'", optarg);
+			break;
 		case 'o':
 			out_path = optarg;
 			break;
@@ -143,7 +402,7 @@ cred_verify(int argc, char **argv)
 	argc -= optind;
 	argv += optind;
 
-	if (argc > 1)
+	if (argc > 1 || (jobs && !batch))
 		usage();
 
 	in_f = open_read(in_path);
@@ -153,6 +412,15 @@ cred_verify(int argc, char **argv)
 		errx(1, "unknown type %s", argv[0]);
 
 	fido_init((flags & FLAG_DEBUG) ? FIDO_DEBUG : 0);
+
+	if (batch) {
+		r = cred_verify_batch(in_f, out_f, type, cred_prot, jobs,
+		    flags);
+		fclose(in_f);
+		fclose(out_f);
+		exit(r);
+	}
+
 	cred = prepare_cred(in_f, type, flags);
 
 	if (cred_prot > 0) {
@@ -19,8 +19,9 @@
 #include "extern.h"
 
 int
-credman_get_metadata(fido_dev_t *dev, const char *path)
+credman_get_metadata(fido_dev_t *dev, const char *path, int json)
 {
+	struct json j;
 	fido_credman_metadata_t *metadata = NULL;
 	char *pin = NULL;
 	int r, ok = 1;
@@ -42,10 +43,20 @@ credman_get_metadata(fido_dev_t *dev, const char *path)
 		goto out;
 	}
 
-	printf("existing rk(s): %u\n",
-	    (unsigned)fido_credman_rk_existing(metadata));
-	printf("remaining rk(s): %u\n",
-	    (unsigned)fido_credman_rk_remaining(metadata));
+	if (json) {
+		json_init(&j, stdout);
+		json_obj(&j, NULL);
+		json_uint(&j, "existing_rk",
+		    fido_credman_rk_existing(metadata));
+		json_uint(&j, "remaining_rk",
+		    fido_credman_rk_remaining(metadata));
+		json_close(&j);
+	} else {
+		printf("existing rk(s): %u\n",
+		    (unsigned)fido_credman_rk_existing(metadata));
+		printf("remaining rk(s): %u\n",
+		    (unsigned)fido_credman_rk_remaining(metadata));
+	}
 
 	ok = 0;
 out:
@@ -56,11 +67,30 @@ out:
 	exit(ok);
 }
 
+static void
+print_rp_json(fido_credman_rp_t *rp, size_t idx)
+{
+	struct json j;
+
+	json_init(&j, stdout);
+	json_obj(&j, NULL);
+	json_str(&j, "rp_id", fido_credman_rp_id(rp, idx));
+	json_str(&j, "rp_name", fido_credman_rp_name(rp, idx));
+	json_b64(&j, "rp_id_hash", fido_credman_rp_id_hash_ptr(rp, idx),
+	    fido_credman_rp_id_hash_len(rp, idx));
+	json_close(&j);
+}
+
 static int
-print_rp(fido_credman_rp_t *rp, size_t idx)
+print_rp(fido_credman_rp_t *rp, size_t idx, int json)
 {
 	char *rp_id_hash = NULL;
 
+	if (json) {
+		print_rp_json(rp, idx);
+		return 0;
+	}
+
 	if (base64_encode(fido_credman_rp_id_hash_ptr(rp, idx),
 	    fido_credman_rp_id_hash_len(rp, idx), &rp_id_hash) < 0) {
 		warnx("output error");
@@ -74,7 +104,7 @@ print_rp(fido_credman_rp_t *rp, size_t idx)
 }
 
 int
-credman_list_rp(const char *path)
+credman_list_rp(const char *path, int json)
 {
 	fido_credman_rp_t *rp = NULL;
 	fido_dev_t *dev = NULL;
@@ -99,7 +129,7 @@ credman_list_rp(const char *path)
 		goto out;
 	}
 	for (size_t i = 0; i < fido_credman_rp_count(rp); i++)
-		if (print_rp(rp, i) < 0)
+		if (print_rp(rp, i, json) < 0)
 			goto out;
 
 	ok = 0;
@@ -111,8 +141,27 @@ out:
 	exit(ok);
 }
 
+static void
+print_rk_json(const fido_cred_t *cred, const char *rp_id)
+{
+	struct json j;
+
+	json_init(&j, stdout);
+	json_obj(&j, NULL);
+	json_str(&j, "rp_id", rp_id);
+	json_b64(&j, "id", fido_cred_id_ptr(cred), fido_cred_id_len(cred));
+	json_b64(&j, "user_id", fido_cred_user_id_ptr(cred),
+	    fido_cred_user_id_len(cred));
+	json_str(&j, "user_name", fido_cred_user_name(cred));
+	json_str(&j, "display_name", fido_cred_display_name(cred));
+	json_str(&j, "type", cose_string(fido_cred_type(cred)));
+	json_str(&j, "prot", prot_string(fido_cred_prot(cred)));
+	json_close(&j);
+}
+
 static int
-print_rk(const fido_credman_rk_t *rk, size_t idx)
+print_rk(const fido_credman_rk_t *rk, size_t idx, const char *rp_id,
+    int json)
 {
 	const fido_cred_t *cred;
 	char *id = NULL;
@@ -124,6 +173,10 @@ print_rk(const fido_credman_rk_t *rk, size_t idx)
 		warnx("fido_credman_rk");
 		return -1;
 	}
+	if (json) {
+		print_rk_json(cred, rp_id);
+		return 0;
+	}
 	if (base64_encode(fido_cred_id_ptr(cred), fido_cred_id_len(cred),
 	    &id) < 0 || base64_encode(fido_cred_user_id_ptr(cred),
 	    fido_cred_user_id_len(cred), &user_id) < 0) {
@@ -134,8 +187,11 @@ print_rk(const fido_credman_rk_t *rk, size_t idx)
 	type = cose_string(fido_cred_type(cred));
 	prot = prot_string(fido_cred_prot(cred));
 
-	printf("%02u: %s %s %s %s %s\n", (unsigned)idx, id,
+	printf("%02u: %s %s %s %s %s", (unsigned)idx, id,
 	    fido_cred_display_name(cred), user_id, type, prot);
+	if (rp_id != NULL)
+		printf(" %s", rp_id);
+	printf("\n");
 
 	free(user_id);
 	free(id);
@@ -144,7 +200,7 @@ print_rk(const fido_credman_rk_t *rk, size_t idx)
 }
 
 int
-credman_list_rk(const char *path, const char *rp_id)
+credman_list_rk(const char *path, const char *rp_id, int json)
 {
 	fido_dev_t *dev = NULL;
 	fido_credman_rk_t *rk = NULL;
@@ -169,12 +225,61 @@ credman_list_rk(const char *path, const char *rp_id)
 		goto out;
 	}
 	for (size_t i = 0; i < fido_credman_rk_count(rk); i++)
-		if (print_rk(rk, i) < 0)
+		if (print_rk(rk, i, json ? rp_id : NULL, json) < 0)
+			goto out;
+
+	ok = 0;
+out:
+	fido_credman_rk_free(&rk);
+	fido_dev_close(dev);
+	fido_dev_free(&dev);
+
+	exit(ok);
+}
+
+int
+credman_list_all_rk(const char *path, int json)
+{
+	fido_dev_t *dev = NULL;
+	fido_credman_rp_t *rp = NULL;
+	fido_credman_rk_t *rk = NULL;
+	const char *rp_id;
+	char *pin = NULL;
+	int r, ok = 1;
+
+	dev = open_dev(path);
+	if ((rp = fido_credman_rp_new()) == NULL) {
+		warnx("fido_credman_rp_new");
+		goto out;
+	}
+	if ((rk = fido_credman_rk_new()) == NULL) {
+		warnx("fido_credman_rk_new");
+		goto out;
+	}
+	if ((r = fido_credman_get_dev_all_rk(dev, rp, rk, NULL)) != FIDO_OK &&
+	    should_retry_with_pin(dev, r)) {
+		if ((pin = get_pin(path)) == NULL)
+			goto out;
+		r = fido_credman_get_dev_all_rk(dev, rp, rk, pin);
+		freezero(pin, PINBUF_LEN);
+		pin = NULL;
+	}
+	if (r != FIDO_OK) {
+		warnx("fido_credman_get_dev_all_rk: %s", fido_strerr(r));
+		goto out;
+	}
+	for (size_t i = 0; i < fido_credman_rk_count(rk); i++) {
+		if ((rp_id = fido_credman_rp_id(rp,
+		    fido_credman_rk_rp_idx(rk, i))) == NULL)
+			rp_id = json ? NULL : "<unknown>";
+		if (print_rk(rk, i, rp_id, json) < 0)
 			goto out;
+	}
 
 	ok = 0;
 out:
 	fido_credman_rk_free(&rk);
+	fido_credman_rp_free(&rp);
 	fido_dev_close(dev);
 	fido_dev_free(&dev);
 
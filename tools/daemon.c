@@ -0,0 +1,496 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * fido2-token -A: serve fido2-token requests on a UNIX socket.
+ *
+ * A client connects, passes its stdin, stdout and stderr, and sends its
+ * arguments. The daemon forks, and the child runs the request as
+ * fido2-token would, on the client's descriptors. The daemon keeps HID
+ * devices open between requests, and the child is handed the daemon's
+ * handle by open_dev(), so that a request does not issue CTAPHID_INIT or
+ * authenticatorGetInfo. Other devices are opened by the child. The child's
+ * exit status is sent back to the client, which exits with it.
+ *
+ * Request:	uint32_t len, with the client's descriptors attached,
+ *		followed by len bytes of NUL-terminated arguments.
+ * Reply:	int32_t status.
+ */
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#endif
+
+#include <fido.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "../openbsd-compat/openbsd-compat.h"
+#include "extern.h"
+
+#ifdef _WIN32
+int
+token_daemon(const char *path, int flags)
+{
+	(void)path;
+	(void)flags;
+
+	errx(1, "-A: not supported on this platform");
+
+	return (1); /* NOTREACHED */
+}
+
+int
+token_remote(const char *path, int argc, char **argv)
+{
+	(void)path;
+	(void)argc;
+	(void)argv;
+
+	errx(1, "%s: not supported on this platform", DAEMON_SOCK_ENV);
+
+	return (1); /* NOTREACHED */
+}
+#else
+
+#define DAEMON_MAXREQ	65536	/* length of a request's arguments */
+#define DAEMON_MAXARG	128	/* number of arguments in a request */
+#define DAEMON_MAXDEV	16	/* devices kept open */
+#define DAEMON_NFD	3	/* stdin, stdout, stderr */
+
+struct daemon_dev {
+	char		*path;
+	fido_dev_t	*dev;
+};
+
+static struct daemon_dev	ddev[DAEMON_MAXDEV];
+static volatile sig_atomic_t	got_signal;
+static char			progname[] = "fido2-token";
+
+/* requests that cannot change the state of a device */
+static int
+readonly(int action)
+{
+	return (action == 'G' || action == 'I' || action == 'L');
+}
+
+static void
+sighandler(int signo)
+{
+	got_signal = signo;
+}
+
+/*
+ * Whether a device's handle may be used by a forked child. HID nodes are
+ * plain descriptors; NFC, PC/SC, BLE and IOKit handles are not.
+ */
+static int
+shareable(const char *path)
+{
+#ifdef __APPLE__
+	(void)path;
+
+	return (0);
+#else
+	return (strncmp(path, "nfc:", 4) != 0 &&
+	    strncmp(path, "pcsc:", 5) != 0 &&
+	    strncmp(path, "ble:", 4) != 0 &&
+	    strncmp(path, "windows:", 8) != 0);
+#endif
+}
+
+static struct daemon_dev *
+dev_lookup(const char *path)
+{
+	for (size_t i = 0; i < DAEMON_MAXDEV; i++)
+		if (ddev[i].path != NULL && strcmp(ddev[i].path, path) == 0)
+			return (&ddev[i]);
+
+	return (NULL);
+}
+
+static void
+dev_drop(struct daemon_dev *d)
+{
+	fido_dev_close(d->dev);
+	fido_dev_free(&d->dev);
+	free(d->path);
+	d->path = NULL;
+}
+
+/* the daemon's handle for path, opening it if needed; NULL on error */
+static fido_dev_t *
+dev_get(const char *path)
+{
+	struct daemon_dev *d;
+	fido_dev_t *dev;
+	size_t i;
+
+	if ((d = dev_lookup(path)) != NULL)
+		return (d->dev);
+
+	for (i = 0; i < DAEMON_MAXDEV; i++)
+		if (ddev[i].path == NULL)
+			break;
+	if (i == DAEMON_MAXDEV)
+		dev_drop(&ddev[i = 0]);
+
+	if ((dev = fido_dev_new()) == NULL)
+		return (NULL);
+	if (fido_dev_open(dev, path) != FIDO_OK) {
+		/* left for the request to report */
+		fido_dev_free(&dev);
+		return (NULL);
+	}
+	if ((ddev[i].path = strdup(path)) == NULL) {
+		fido_dev_close(dev);
+		fido_dev_free(&dev);
+		return (NULL);
+	}
+	/* kept for the duration of each request */
+	(void)fido_dev_set_uv_token_cache(dev, true);
+	(void)fido_dev_set_ecdh_cache(dev, true);
+	ddev[i].dev = dev;
+
+	return (dev);
+}
+
+static int
+read_full(int fd, void *buf, size_t len)
+{
+	unsigned char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = read(fd, p, len)) < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return (-1);
+		p += n;
+		len -= (size_t)n;
+	}
+
+	return (0);
+}
+
+static int
+write_full(int fd, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(fd, p, len)) < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return (-1);
+		p += n;
+		len -= (size_t)n;
+	}
+
+	return (0);
+}
+
+static void
+close_fds(int *fd)
+{
+	for (size_t i = 0; i < DAEMON_NFD; i++)
+		if (fd[i] >= 0) {
+			close(fd[i]);
+			fd[i] = -1;
+		}
+}
+
+/* receive a request's header and descriptors */
+static int
+recv_hdr(int s, uint32_t *len, int *fd)
+{
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	ssize_t n;
+	union {
+		struct cmsghdr	hdr;
+		unsigned char	buf[CMSG_SPACE(DAEMON_NFD * sizeof(int))];
+	} cmsgbuf;
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&cmsgbuf, 0, sizeof(cmsgbuf));
+	iov.iov_base = len;
+	iov.iov_len = sizeof(*len);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf.buf;
+	msg.msg_controllen = sizeof(cmsgbuf.buf);
+
+	if ((n = recvmsg(s, &msg, 0)) != (ssize_t)sizeof(*len) ||
+	    (msg.msg_flags & MSG_CTRUNC) != 0)
+		goto fail;
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+	    cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS ||
+		    cmsg->cmsg_len != CMSG_LEN(DAEMON_NFD * sizeof(int)))
+			continue;
+		memcpy(fd, CMSG_DATA(cmsg), DAEMON_NFD * sizeof(int));
+		return (0);
+	}
+fail:
+	warnx("%s: invalid request", __func__);
+
+	return (-1);
+}
+
+/* split a request's arguments into argv; argv[0] is ours */
+static int
+split_args(char *buf, size_t len, char **argv, int *argc)
+{
+	char *p = buf;
+
+	if (len == 0 || buf[len - 1] != '\0')
+		return (-1);
+
+	argv[0] = progname;
+	*argc = 1;
+	while (p < buf + len) {
+		if (*argc == DAEMON_MAXARG)
+			return (-1);
+		argv[(*argc)++] = p;
+		p += strlen(p) + 1;
+	}
+	argv[*argc] = NULL;
+
+	return (0);
+}
+
+static int
+run_child(int lsock, int s, int *fd, const char *path, fido_dev_t *dev,
+    int argc, char **argv)
+{
+	pid_t pid;
+	int status;
+
+	if ((pid = fork()) < 0) {
+		warn("fork");
+		return (1);
+	}
+	if (pid == 0) {
+		close(lsock);
+		close(s);
+		signal(SIGINT, SIG_DFL);
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGPIPE, SIG_DFL);
+		/* no controlling tty: get_pin() reads the client's stdin */
+		(void)setsid();
+		for (int i = 0; i < DAEMON_NFD; i++)
+			if (dup2(fd[i], i) < 0)
+				_exit(1);
+		for (int i = 0; i < DAEMON_NFD; i++)
+			if (fd[i] >= DAEMON_NFD)
+				close(fd[i]);
+		open_dev_path = path;
+		open_dev_handle = dev;
+		exit(token_exec(argc, argv));
+	}
+
+	while (waitpid(pid, &status, 0) < 0)
+		if (errno != EINTR) {
+			warn("waitpid");
+			return (1);
+		}
+
+	if (WIFEXITED(status))
+		return (WEXITSTATUS(status));
+
+	return (1);
+}
+
+static void
+serve(int lsock, int s)
+{
+	struct daemon_dev *d;
+	fido_dev_t *dev = NULL;
+	char *buf = NULL, *argv[DAEMON_MAXARG + 1], *device;
+	uint32_t len;
+	int32_t status = 1;
+	int fd[DAEMON_NFD] = { -1, -1, -1 };
+	int action, flags = 0, argc;
+
+	if (recv_hdr(s, &len, fd) < 0)
+		goto out;
+	if (len == 0 || len > DAEMON_MAXREQ || (buf = malloc(len)) == NULL ||
+	    read_full(s, buf, len) < 0 ||
+	    split_args(buf, len, argv, &argc) < 0) {
+		warnx("%s: invalid request", __func__);
+		goto out;
+	}
+
+	opterr = 0;
+	action = token_parse(argc, argv, &flags, &device);
+	opterr = 1;
+	if (action > 0 && action != 'A' && device != NULL &&
+	    shareable(device))
+		dev = dev_get(device);
+
+	status = run_child(lsock, s, fd, device, dev, argc, argv);
+
+	/*
+	 * Anything but getting, listing and inspecting may have changed
+	 * the device's state.
+	 */
+	if (device != NULL && (status != 0 || !readonly(action)) &&
+	    (d = dev_lookup(device)) != NULL)
+		dev_drop(d);
+	if (!readonly(action))
+		fido_session_cache_clear();
+out:
+	close_fds(fd);
+	free(buf);
+	if (write_full(s, &status, sizeof(status)) < 0)
+		warnx("%s: could not reply", __func__);
+}
+
+int
+token_daemon(const char *path, int flags)
+{
+	struct sockaddr_un sun;
+	struct sigaction sa;
+	mode_t mask;
+	int lsock, s, r;
+
+	if (path == NULL)
+		usage();
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlcpy(sun.sun_path, path, sizeof(sun.sun_path)) >=
+	    sizeof(sun.sun_path))
+		errx(1, "%s: path too long", path);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = sighandler; /* no SA_RESTART: interrupt accept() */
+	if (sigaction(SIGINT, &sa, NULL) < 0 ||
+	    sigaction(SIGTERM, &sa, NULL) < 0)
+		err(1, "sigaction");
+	signal(SIGPIPE, SIG_IGN);
+
+	if ((r = fido_session_cache_set_size(DAEMON_MAXDEV)) != FIDO_OK)
+		errx(1, "fido_session_cache_set_size: %s", fido_strerr(r));
+
+	if ((lsock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		err(1, "socket");
+	mask = umask(077);
+	if (bind(lsock, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+		err(1, "bind %s", path);
+	umask(mask);
+	if (listen(lsock, 16) < 0)
+		err(1, "listen");
+
+	if (flags & FIDO_DEBUG)
+		fprintf(stderr, "fido2-token: listening on %s\n", path);
+
+	/* one request at a time: the devices are shared */
+	while (got_signal == 0) {
+		if ((s = accept(lsock, NULL, NULL)) < 0) {
+			if (errno != EINTR)
+				warn("accept");
+			continue;
+		}
+		serve(lsock, s);
+		close(s);
+	}
+
+	close(lsock);
+	unlink(path);
+	for (size_t i = 0; i < DAEMON_MAXDEV; i++)
+		if (ddev[i].path != NULL)
+			dev_drop(&ddev[i]);
+
+	exit(0);
+}
+
+/* run argv through the daemon listening on path */
+int
+token_remote(const char *path, int argc, char **argv)
+{
+	struct sockaddr_un sun;
+	struct msghdr msg;
+	struct cmsghdr *cmsg;
+	struct iovec iov;
+	char *buf;
+	size_t len = 0, n;
+	uint32_t hdr;
+	int32_t status;
+	int fd[DAEMON_NFD] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+	int s;
+	union {
+		struct cmsghdr	hdr;
+		unsigned char	buf[CMSG_SPACE(DAEMON_NFD * sizeof(int))];
+	} cmsgbuf;
+
+	for (int i = 1; i < argc; i++)
+		len += strlen(argv[i]) + 1;
+	if (len == 0 || len > DAEMON_MAXREQ || argc > DAEMON_MAXARG)
+		usage();
+	if ((buf = malloc(len)) == NULL)
+		err(1, "malloc");
+	for (int i = 1, off = 0; i < argc; i++) {
+		n = strlen(argv[i]) + 1;
+		memcpy(buf + off, argv[i], n);
+		off += (int)n;
+	}
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlcpy(sun.sun_path, path, sizeof(sun.sun_path)) >=
+	    sizeof(sun.sun_path))
+		errx(1, "%s: path too long", path);
+	if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		err(1, "socket");
+	if (connect(s, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+		err(1, "connect %s", path);
+
+	memset(&msg, 0, sizeof(msg));
+	memset(&cmsgbuf, 0, sizeof(cmsgbuf));
+	hdr = (uint32_t)len;
+	iov.iov_base = &hdr;
+	iov.iov_len = sizeof(hdr);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf.buf;
+	msg.msg_controllen = sizeof(cmsgbuf.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fd));
+	memcpy(CMSG_DATA(cmsg), fd, sizeof(fd));
+
+	signal(SIGPIPE, SIG_IGN);
+	if (sendmsg(s, &msg, 0) != (ssize_t)sizeof(hdr) ||
+	    write_full(s, buf, len) < 0)
+		errx(1, "%s: could not send request", path);
+	if (read_full(s, &status, sizeof(status)) < 0)
+		errx(1, "%s: no reply", path);
+
+	close(s);
+	free(buf);
+
+	exit(status);
+}
+#endif /* _WIN32 */
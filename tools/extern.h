@@ -21,7 +21,16 @@ struct blob {
 	size_t len;
 };
 
-#define TOKEN_OPT	"CDGILPRSVabcdefi:k:l:m:n:p:ru"
+#define JSON_DEPTH	8
+
+struct json {
+	FILE *fp;
+	int depth;
+	char close[JSON_DEPTH];
+	bool more[JSON_DEPTH];
+};
+
+#define TOKEN_OPT	"ACDGILMPRSVabcdefi:jk:l:m:n:p:ru"
 
 #define FLAG_DEBUG	0x01
 #define FLAG_QUIET	0x02
@@ -34,6 +43,13 @@ struct blob {
 
 #define PINBUF_LEN	256
 
+#define DAEMON_SOCK_ENV	"FIDO2_TOKEN_SOCK"
+
+extern const char *open_dev_path;
+extern fido_dev_t *open_dev_handle;
+extern int multi_child;
+extern int pin_lock_fd[2];
+
 EC_KEY *read_ec_pubkey(const char *);
 fido_dev_t *open_dev(const char *);
 FILE *open_read(const char *);
@@ -70,20 +86,38 @@ int cred_verify(int, char **);
 int credman_delete_rk(const char *, const char *);
 int credman_update_rk(const char *, const char *, const char *, const char *,
     const char *);
-int credman_get_metadata(fido_dev_t *, const char *);
-int credman_list_rk(const char *, const char *);
-int credman_list_rp(const char *);
+int credman_get_metadata(fido_dev_t *, const char *, int);
+int credman_list_all_rk(const char *, int);
+int credman_list_rk(const char *, const char *, int);
+int credman_list_rp(const char *, int);
 int credman_print_rk(fido_dev_t *, const char *, const char *, const char *);
 int get_devopt(fido_dev_t *, const char *, int *);
+void json_arr(struct json *, const char *);
+void json_b64(struct json *, const char *, const unsigned char *, size_t);
+void json_bool(struct json *, const char *, bool);
+void json_close(struct json *);
+void json_hex(struct json *, const char *, const unsigned char *, size_t);
+void json_init(struct json *, FILE *);
+void json_int(struct json *, const char *, int64_t);
+void json_null(struct json *, const char *);
+void json_obj(struct json *, const char *);
+void json_quote(FILE *, const char *);
+void json_str(struct json *, const char *, const char *);
+void json_uint(struct json *, const char *, uint64_t);
 int pin_change(char *);
 int pin_set(char *);
 int should_retry_with_pin(const fido_dev_t *, int);
 int string_read(FILE *, char **);
 int token_config(int, char **, char *);
+int token_daemon(const char *, int);
 int token_delete(int, char **, char *);
 int token_get(int, char **, char *);
 int token_info(int, char **, char *);
+int token_exec(int, char **);
 int token_list(int, char **, char *);
+int token_multi(int (*)(int, char **, char *), int, int, char **);
+int token_parse(int, char **, int *, char **);
+int token_remote(const char *, int, char **);
 int token_reset(char *);
 int token_set(int, char **, char *);
 int write_es256_pubkey(FILE *, const void *, size_t);
@@ -0,0 +1,534 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * Repeatedly run CTAP operations against an authenticator and report
+ * their throughput and latency, with the time of each operation split
+ * into transport phases using the events of fido_set_trace_handler().
+ */
+
+#include <openssl/rand.h>
+
+#include <fido.h>
+#include <fido/credman.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../openbsd-compat/openbsd-compat.h"
+#include "extern.h"
+
+#define BENCH_OPT	"Vdn:o:r:"
+#define BENCH_OPS	"info,assert"
+#define BENCH_N		100
+#define BENCH_MAX_N	1000000
+
+enum {
+	PHASE_TX,	/* from the start of a message to its last report */
+	PHASE_WAIT,	/* from there to the first report of the reply */
+	PHASE_RX,	/* from there to the end of the reply */
+	PHASE_HOST,	/* everything else: encoding, parsing, cryptography */
+	PHASE_MAX,
+};
+
+struct trace {
+	const fido_dev_t	*dev;
+	uint64_t		 start;
+	uint64_t		 last_tx;
+	uint64_t		 first_rx;
+	uint64_t		 last_rx;
+	uint64_t		 ns[PHASE_MAX];
+	size_t			 msgs;
+};
+
+struct bench {
+	fido_dev_t	*dev;
+	const char	*path;
+	const char	*rp_id;
+	char		*pin;
+	struct blob	 cred_id;
+	struct blob	 array;
+};
+
+struct op {
+	const char	*name;
+	const char	*option; /* getInfo option required, if any */
+	int		(*prepare)(struct bench *);
+	int		(*run)(struct bench *);
+};
+
+static struct trace trace;
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) != 0)
+		err(1, "clock_gettime");
+
+	return ((uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+}
+
+static void
+trace_handler(void *arg, const fido_trace_event_t *ev)
+{
+	struct trace *t = arg;
+
+	if (ev->dev == NULL || ev->dev != t->dev)
+		return;
+
+	switch (ev->type) {
+	case FIDO_TRACE_CMD_START:
+		t->start = t->last_tx = ev->ns;
+		t->first_rx = t->last_rx = 0;
+		break;
+	case FIDO_TRACE_TX:
+		t->last_tx = ev->ns;
+		break;
+	case FIDO_TRACE_RX:
+		if (t->first_rx == 0)
+			t->first_rx = ev->ns;
+		t->last_rx = ev->ns;
+		break;
+	case FIDO_TRACE_KEEPALIVE:
+		/* the authenticator is still busy; keep waiting */
+		if (t->first_rx == t->last_rx)
+			t->first_rx = 0;
+		break;
+	case FIDO_TRACE_CMD_END:
+		if (t->start == 0)
+			break;
+		if (t->first_rx < t->last_tx)
+			t->first_rx = ev->ns;
+		t->ns[PHASE_TX] += t->last_tx - t->start;
+		t->ns[PHASE_WAIT] += t->first_rx - t->last_tx;
+		t->ns[PHASE_RX] += ev->ns - t->first_rx;
+		t->msgs++;
+		t->start = 0;
+		break;
+	}
+}
+
+static int
+need_pin(struct bench *b, int r)
+{
+	if (b->pin != NULL || !should_retry_with_pin(b->dev, r))
+		return (0);
+	if ((b->pin = get_pin(b->path)) == NULL)
+		errx(1, "get_pin");
+
+	return (1);
+}
+
+static int
+make_cred(struct bench *b, fido_cred_t *cred)
+{
+	unsigned char	cdh[32], uid[32];
+	int		r;
+
+	if (RAND_bytes(cdh, sizeof(cdh)) != 1 ||
+	    RAND_bytes(uid, sizeof(uid)) != 1)
+		errx(1, "RAND_bytes");
+	if ((r = fido_cred_set_type(cred, COSE_ES256)) != FIDO_OK ||
+	    (r = fido_cred_set_clientdata_hash(cred, cdh,
+	    sizeof(cdh))) != FIDO_OK ||
+	    (r = fido_cred_set_rp(cred, b->rp_id, NULL)) != FIDO_OK ||
+	    (r = fido_cred_set_user(cred, uid, sizeof(uid), "fido2-bench",
+	    NULL, NULL)) != FIDO_OK)
+		errx(1, "fido_cred_set: %s", fido_strerr(r));
+
+	if ((r = fido_dev_make_cred(b->dev, cred, b->pin)) != FIDO_OK &&
+	    need_pin(b, r))
+		r = fido_dev_make_cred(b->dev, cred, b->pin);
+	if (r != FIDO_OK)
+		warnx("fido_dev_make_cred: %s", fido_strerr(r));
+
+	return (r);
+}
+
+static int
+run_info(struct bench *b)
+{
+	fido_cbor_info_t	*ci;
+	int			 r;
+
+	if ((ci = fido_cbor_info_new()) == NULL)
+		errx(1, "fido_cbor_info_new");
+	if ((r = fido_dev_get_cbor_info(b->dev, ci)) != FIDO_OK)
+		warnx("fido_dev_get_cbor_info: %s", fido_strerr(r));
+	fido_cbor_info_free(&ci);
+
+	return (r);
+}
+
+static int
+prepare_make(struct bench *b)
+{
+	(void)b;
+
+	fprintf(stderr, "make: touch the authenticator for every "
+	    "credential\n");
+
+	return (0);
+}
+
+static int
+run_make(struct bench *b)
+{
+	fido_cred_t	*cred;
+	int		 r;
+
+	if ((cred = fido_cred_new()) == NULL)
+		errx(1, "fido_cred_new");
+	r = make_cred(b, cred);
+	fido_cred_free(&cred);
+
+	return (r);
+}
+
+/* make the credential that assertions are requested for */
+static int
+prepare_assert(struct bench *b)
+{
+	fido_cred_t	*cred;
+	int		 ok = -1;
+
+	if (b->cred_id.ptr != NULL)
+		return (0);
+	if ((cred = fido_cred_new()) == NULL)
+		errx(1, "fido_cred_new");
+
+	fprintf(stderr, "assert: touch the authenticator to make a "
+	    "credential\n");
+	if (make_cred(b, cred) != FIDO_OK)
+		goto out;
+	if ((b->cred_id.len = fido_cred_id_len(cred)) == 0 ||
+	    (b->cred_id.ptr = malloc(b->cred_id.len)) == NULL)
+		errx(1, "fido_cred_id");
+	memcpy(b->cred_id.ptr, fido_cred_id_ptr(cred), b->cred_id.len);
+
+	ok = 0;
+out:
+	fido_cred_free(&cred);
+
+	return (ok);
+}
+
+static int
+run_assert(struct bench *b)
+{
+	fido_assert_t	*assert;
+	unsigned char	 cdh[32];
+	int		 r;
+
+	if ((assert = fido_assert_new()) == NULL)
+		errx(1, "fido_assert_new");
+	if (RAND_bytes(cdh, sizeof(cdh)) != 1)
+		errx(1, "RAND_bytes");
+	if ((r = fido_assert_set_clientdata_hash(assert, cdh,
+	    sizeof(cdh))) != FIDO_OK ||
+	    (r = fido_assert_set_rp(assert, b->rp_id)) != FIDO_OK ||
+	    (r = fido_assert_allow_cred(assert, b->cred_id.ptr,
+	    b->cred_id.len)) != FIDO_OK)
+		errx(1, "fido_assert_set: %s", fido_strerr(r));
+	/* u2f cannot sign without user presence */
+	if (fido_dev_is_fido2(b->dev) &&
+	    (r = fido_assert_set_up(assert, FIDO_OPT_FALSE)) != FIDO_OK)
+		errx(1, "fido_assert_set_up: %s", fido_strerr(r));
+
+	if ((r = fido_dev_get_assert(b->dev, assert, NULL)) != FIDO_OK)
+		warnx("fido_dev_get_assert: %s", fido_strerr(r));
+	fido_assert_free(&assert);
+
+	return (r);
+}
+
+static int
+prepare_credman(struct bench *b)
+{
+	if (b->pin == NULL && (b->pin = get_pin(b->path)) == NULL)
+		errx(1, "get_pin");
+
+	return (0);
+}
+
+static int
+run_credman(struct bench *b)
+{
+	fido_credman_rp_t	*rp;
+	fido_credman_rk_t	*rk;
+	int			 r;
+
+	if ((rp = fido_credman_rp_new()) == NULL ||
+	    (rk = fido_credman_rk_new()) == NULL)
+		errx(1, "fido_credman_new");
+	if ((r = fido_credman_get_dev_all_rk(b->dev, rp, rk,
+	    b->pin)) != FIDO_OK)
+		warnx("fido_credman_get_dev_all_rk: %s", fido_strerr(r));
+	fido_credman_rp_free(&rp);
+	fido_credman_rk_free(&rk);
+
+	return (r);
+}
+
+static int
+run_blob_read(struct bench *b)
+{
+	unsigned char	*ptr = NULL;
+	size_t		 len = 0;
+	int		 r;
+
+	if ((r = fido_dev_largeblob_get_array(b->dev, &ptr,
+	    &len)) != FIDO_OK)
+		warnx("fido_dev_largeblob_get_array: %s", fido_strerr(r));
+	free(ptr);
+
+	return (r);
+}
+
+/* blob-write writes back the array it finds, leaving it unchanged */
+static int
+prepare_blob_write(struct bench *b)
+{
+	int r;
+
+	if (b->array.ptr != NULL)
+		return (0);
+	if ((r = fido_dev_largeblob_get_array(b->dev, &b->array.ptr,
+	    &b->array.len)) != FIDO_OK) {
+		warnx("fido_dev_largeblob_get_array: %s", fido_strerr(r));
+		return (-1);
+	}
+
+	return (0);
+}
+
+static int
+run_blob_write(struct bench *b)
+{
+	int r;
+
+	if ((r = fido_dev_largeblob_set_array(b->dev, b->array.ptr,
+	    b->array.len, b->pin)) != FIDO_OK && need_pin(b, r))
+		r = fido_dev_largeblob_set_array(b->dev, b->array.ptr,
+		    b->array.len, b->pin);
+	if (r != FIDO_OK)
+		warnx("fido_dev_largeblob_set_array: %s", fido_strerr(r));
+
+	return (r);
+}
+
+static const struct op ops[] = {
+	{ "info", NULL, NULL, run_info },
+	{ "make", NULL, prepare_make, run_make },
+	{ "assert", NULL, prepare_assert, run_assert },
+	{ "credman", "credMgmt", prepare_credman, run_credman },
+	{ "blob-read", "largeBlobs", NULL, run_blob_read },
+	{ "blob-write", "largeBlobs", prepare_blob_write, run_blob_write },
+};
+
+static const struct op *
+lookup_op(const char *name)
+{
+	for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++)
+		if (strcmp(ops[i].name, name) == 0)
+			return (&ops[i]);
+
+	return (NULL);
+}
+
+static int
+cmp_ns(const void *a, const void *b)
+{
+	const uint64_t x = *(const uint64_t *)a;
+	const uint64_t y = *(const uint64_t *)b;
+
+	return ((x > y) - (x < y));
+}
+
+static double
+ms(uint64_t ns)
+{
+	return ((double)ns / 1e6);
+}
+
+/* nearest-rank percentile of sorted ns[n] */
+static uint64_t
+percentile(const uint64_t *ns, size_t n, unsigned int p)
+{
+	size_t i = (n * p + 99) / 100;
+
+	return (ns[i > 0 ? i - 1 : 0]);
+}
+
+static void
+print_header(void)
+{
+	printf("%-10s %7s %9s %9s %9s %9s %9s %9s %8s %8s %8s %8s %5s\n",
+	    "op", "n", "ops/s", "min", "p50", "p90", "p99", "max", "tx",
+	    "wait", "rx", "host", "msgs");
+}
+
+static int
+has_option(struct bench *b, const char *name)
+{
+	int val;
+
+	if (get_devopt(b->dev, name, &val) < 0)
+		return (-1);
+	/* authenticators predating ctap 2.1 name it differently */
+	if (val != true && strcmp(name, "credMgmt") == 0 &&
+	    get_devopt(b->dev, "credentialMgmtPreview", &val) < 0)
+		return (-1);
+
+	return (val == true);
+}
+
+static int
+run_op(struct bench *b, const struct op *op, size_t n)
+{
+	uint64_t	*ns, t0, total = 0;
+	int		 r;
+
+	if (op->option != NULL) {
+		if ((r = has_option(b, op->option)) < 0)
+			return (-1);
+		if (r == 0) {
+			warnx("%s: %s not supported, skipping", op->name,
+			    op->option);
+			return (0);
+		}
+	}
+	if (op->prepare != NULL && op->prepare(b) < 0)
+		return (-1);
+
+	/* one untimed run, to settle caches and sessions */
+	if (op->run(b) != FIDO_OK)
+		return (-1);
+
+	if ((ns = calloc(n, sizeof(*ns))) == NULL)
+		err(1, "calloc");
+	memset(&trace, 0, sizeof(trace));
+	trace.dev = b->dev;
+	fido_set_trace_handler(trace_handler, &trace);
+	for (size_t i = 0; i < n; i++) {
+		t0 = now_ns();
+		if (op->run(b) != FIDO_OK) {
+			fido_set_trace_handler(NULL, NULL);
+			free(ns);
+			return (-1);
+		}
+		total += ns[i] = now_ns() - t0;
+	}
+	fido_set_trace_handler(NULL, NULL);
+
+	trace.ns[PHASE_HOST] = total - trace.ns[PHASE_TX] -
+	    trace.ns[PHASE_WAIT] - trace.ns[PHASE_RX];
+	qsort(ns, n, sizeof(*ns), cmp_ns);
+	printf("%-10s %7zu %9.1f %9.3f %9.3f %9.3f %9.3f %9.3f %8.3f %8.3f "
+	    "%8.3f %8.3f %5.1f\n", op->name, n, (double)n / (ms(total) / 1e3),
+	    ms(ns[0]), ms(percentile(ns, n, 50)), ms(percentile(ns, n, 90)),
+	    ms(percentile(ns, n, 99)), ms(ns[n - 1]),
+	    ms(trace.ns[PHASE_TX] / n), ms(trace.ns[PHASE_WAIT] / n),
+	    ms(trace.ns[PHASE_RX] / n), ms(trace.ns[PHASE_HOST] / n),
+	    (double)trace.msgs / (double)n);
+	fflush(stdout);
+	free(ns);
+
+	return (0);
+}
+
+void
+usage(void)
+{
+	fprintf(stderr,
+"usage: fido2-bench [-d] [-n count] [-o op[,op...]] [-r rp_id] device\n"
+"       fido2-bench -V\n"
+	);
+
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct bench	 b;
+	const struct op	*op;
+	char		*list, *s, *name;
+	const char	*oplist = BENCH_OPS;
+	int		 ch, n = BENCH_N, flags = 0, status = 0;
+
+	memset(&b, 0, sizeof(b));
+	b.rp_id = "localhost";
+
+	while ((ch = getopt(argc, argv, BENCH_OPT)) != -1) {
+		switch (ch) {
+		case 'V':
+			fprintf(stderr, "%d.%d.%d\n", _FIDO_MAJOR, _FIDO_MINOR,
+			    _FIDO_PATCH);
+			exit(0);
+		case 'd':
+			flags = FIDO_DEBUG;
+			break;
+		case 'n':
+			if ((n = base10(optarg)) < 1 || n > BENCH_MAX_N)
+				errx(1, "-n: invalid count");
+			break;
+		case 'o':
+			oplist = optarg;
+			break;
+		case 'r':
+			b.rp_id = optarg;
+			break;
+		default:
+			usage();
+		}
+	}
+
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 1)
+		usage();
+
+	/* check the list before touching the device */
+	if ((list = strdup(oplist)) == NULL)
+		err(1, "strdup");
+	for (s = list; (name = strsep(&s, ",")) != NULL; )
+		if (lookup_op(name) == NULL)
+			errx(1, "-o: unknown op %s", name);
+	free(list);
+
+	fido_init(flags);
+
+	b.path = argv[0];
+	b.dev = open_dev(b.path);
+
+	print_header();
+	if ((list = strdup(oplist)) == NULL)
+		err(1, "strdup");
+	for (s = list; (name = strsep(&s, ",")) != NULL; ) {
+		op = lookup_op(name);
+		if (run_op(&b, op, (size_t)n) < 0) {
+			warnx("%s: failed", op->name);
+			status = 1;
+		}
+	}
+	free(list);
+
+	fido_dev_close(b.dev);
+	fido_dev_free(&b.dev);
+	freezero(b.pin, PINBUF_LEN);
+	free(b.cred_id.ptr);
+	free(b.array.ptr);
+
+	exit(status);
+}
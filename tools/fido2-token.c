@@ -12,19 +12,20 @@
 #include "../openbsd-compat/openbsd-compat.h"
 #include "extern.h"
 
-static int action;
-
 void
 usage(void)
 {
 	fprintf(stderr,
-"usage: fido2-token -C [-d] device\n"
+"usage: fido2-token -A [-d] socket\n"
+"       fido2-token -C [-d] device\n"
 "       fido2-token -Db [-k key_path] [-i cred_id -n rp_id] device\n"
 "       fido2-token -Dei template_id device\n"
 "       fido2-token -Du device\n"
 "       fido2-token -Gb [-k key_path] [-i cred_id -n rp_id] blob_path device\n"
-"       fido2-token -I [-cd] [-k rp_id -i cred_id]  device\n"
-"       fido2-token -L [-bder] [-k rp_id] [device]\n"
+"       fido2-token -I [-cdj] [-k rp_id -i cred_id]  device\n"
+"       fido2-token -IM [-cdj] [-k rp_id -i cred_id]\n"
+"       fido2-token -L [-abdejr] [-k rp_id] [device]\n"
+"       fido2-token -LM [-abdejr] [-k rp_id]\n"
 "       fido2-token -R [-d] device\n"
 "       fido2-token -S [-adefu] [-l pin_length] [-i template_id -n template_name] device\n"
 "       fido2-token -Sb [-k key_path] [-i cred_id -n rp_id] blob_path device\n"
@@ -36,20 +37,17 @@ usage(void)
 	exit(1);
 }
 
-static void
-setaction(int ch)
-{
-	if (action)
-		usage();
-	action = ch;
-}
-
+/*
+ * Returns the action requested by argv, or -1 if more than one was
+ * requested; sets *flags and *device.
+ */
 int
-main(int argc, char **argv)
+token_parse(int argc, char **argv, int *flags, char **device)
 {
 	int ch;
-	int flags = 0;
-	char *device;
+	int action = 0;
+
+	optind = 1;
 
 	while ((ch = getopt(argc, argv, TOKEN_OPT)) != -1) {
 		switch (ch) {
@@ -59,8 +57,10 @@ main(int argc, char **argv)
 		case 'e':
 		case 'f':
 		case 'i':
+		case 'j':
 		case 'k':
 		case 'l':
+		case 'M':
 		case 'm':
 		case 'n':
 		case 'p':
@@ -68,21 +68,27 @@ main(int argc, char **argv)
 		case 'u':
 			break; /* ignore */
 		case 'd':
-			flags = FIDO_DEBUG;
+			*flags = FIDO_DEBUG;
 			break;
 		default:
-			setaction(ch);
+			if (action)
+				return (-1);
+			action = ch;
 			break;
 		}
 	}
 
 	if (argc - optind < 1)
-		device = NULL;
+		*device = NULL;
 	else
-		device = argv[argc - 1];
+		*device = argv[argc - 1];
 
-	fido_init(flags);
+	return (action);
+}
 
+static int
+run(int action, int argc, char **argv, char *device)
+{
 	switch (action) {
 	case 'C':
 		return (pin_change(device));
@@ -106,5 +112,43 @@ main(int argc, char **argv)
 
 	usage();
 
-	/* NOTREACHED */
+	return (1); /* NOTREACHED */
+}
+
+/* run a request received by fido2-token -A */
+int
+token_exec(int argc, char **argv)
+{
+	char *device;
+	int flags = 0;
+	int action;
+
+	if ((action = token_parse(argc, argv, &flags, &device)) < 0 ||
+	    action == 'A')
+		usage();
+
+	fido_init(flags);
+
+	return (run(action, argc, argv, device));
+}
+
+int
+main(int argc, char **argv)
+{
+	char *device;
+	char *sock;
+	int flags = 0;
+	int action;
+
+	if ((action = token_parse(argc, argv, &flags, &device)) < 0)
+		usage();
+
+	fido_init(flags);
+
+	if (action == 'A')
+		return (token_daemon(device, flags));
+	if ((sock = getenv(DAEMON_SOCK_ENV)) != NULL && *sock != '\0')
+		return (token_remote(sock, argc, argv));
+
+	return (run(action, argc, argv, device));
 }
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * A minimal streaming JSON writer. Values are written as they are
+ * produced; each top-level value is terminated by a newline and flushed,
+ * so that a listing can be consumed one object per line as it is read
+ * from the authenticator.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../openbsd-compat/openbsd-compat.h"
+#include "extern.h"
+
+static void
+json_sep(struct json *j, const char *key)
+{
+	if (j->depth > 0 && j->more[j->depth - 1])
+		fputc(',', j->fp);
+	if (j->depth > 0)
+		j->more[j->depth - 1] = true;
+	if (key != NULL) {
+		json_quote(j->fp, key);
+		fputc(':', j->fp);
+	}
+}
+
+static void
+json_push(struct json *j, const char *key, char open, char close)
+{
+	json_sep(j, key);
+	if (j->depth == JSON_DEPTH)
+		errx(1, "%s: too deep", __func__);
+	fputc(open, j->fp);
+	j->close[j->depth] = close;
+	j->more[j->depth++] = false;
+}
+
+void
+json_init(struct json *j, FILE *fp)
+{
+	j->fp = fp;
+	j->depth = 0;
+}
+
+void
+json_quote(FILE *fp, const char *s)
+{
+	unsigned char c;
+
+	fputc('"', fp);
+	while ((c = (unsigned char)*s++) != '\0') {
+		if (c == '"' || c == '\\')
+			fprintf(fp, "\\%c", c);
+		else if (c < 0x20)
+			fprintf(fp, "\\u%04x", c);
+		else
+			fputc(c, fp);
+	}
+	fputc('"', fp);
+}
+
+void
+json_obj(struct json *j, const char *key)
+{
+	json_push(j, key, '{', '}');
+}
+
+void
+json_arr(struct json *j, const char *key)
+{
+	json_push(j, key, '[', ']');
+}
+
+void
+json_close(struct json *j)
+{
+	if (j->depth == 0)
+		errx(1, "%s: not open", __func__);
+	fputc(j->close[--j->depth], j->fp);
+	if (j->depth == 0) {
+		fputc('\n', j->fp);
+		if (fflush(j->fp) != 0 || ferror(j->fp))
+			errx(1, "output error");
+	}
+}
+
+void
+json_str(struct json *j, const char *key, const char *s)
+{
+	json_sep(j, key);
+	if (s == NULL)
+		fputs("null", j->fp);
+	else
+		json_quote(j->fp, s);
+}
+
+void
+json_int(struct json *j, const char *key, int64_t v)
+{
+	json_sep(j, key);
+	fprintf(j->fp, "%lld", (long long)v);
+}
+
+void
+json_uint(struct json *j, const char *key, uint64_t v)
+{
+	json_sep(j, key);
+	fprintf(j->fp, "%llu", (unsigned long long)v);
+}
+
+void
+json_bool(struct json *j, const char *key, bool v)
+{
+	json_sep(j, key);
+	fputs(v ? "true" : "false", j->fp);
+}
+
+void
+json_null(struct json *j, const char *key)
+{
+	json_sep(j, key);
+	fputs("null", j->fp);
+}
+
+void
+json_hex(struct json *j, const char *key, const unsigned char *ptr,
+    size_t len)
+{
+	json_sep(j, key);
+	fputc('"', j->fp);
+	for (size_t i = 0; i < len; i++)
+		fprintf(j->fp, "%02x", ptr[i]);
+	fputc('"', j->fp);
+}
+
+/* base64, as the text listings print ids and hashes */
+void
+json_b64(struct json *j, const char *key, const unsigned char *ptr,
+    size_t len)
+{
+	char *b64 = NULL;
+
+	if (ptr == NULL || len == 0) {
+		json_str(j, key, "");
+		return;
+	}
+	if (base64_encode(ptr, len, &b64) < 0)
+		errx(1, "base64_encode");
+	json_str(j, key, b64);
+	free(b64);
+}
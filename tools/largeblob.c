@@ -8,6 +8,10 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 #include <fido.h>
 #include <fido/credman.h>
 
@@ -26,63 +30,38 @@
 #include "extern.h"
 
 struct rkmap {
-	fido_credman_rp_t  *rp; /* known rps */
-	fido_credman_rk_t **rk; /* rk per rp */
+	fido_credman_rp_t *rp; /* known rps */
+	fido_credman_rk_t *rk; /* rks of all rps */
 };
 
 static void
 free_rkmap(struct rkmap *map)
 {
-	if (map->rp != NULL) {
-		for (size_t i = 0; i < fido_credman_rp_count(map->rp); i++)
-			fido_credman_rk_free(&map->rk[i]);
-		fido_credman_rp_free(&map->rp);
-	}
-	free(map->rk);
+	fido_credman_rp_free(&map->rp);
+	fido_credman_rk_free(&map->rk);
 }
 
 static int
 map_known_rps(fido_dev_t *dev, const char *path, struct rkmap *map)
 {
-	const char *rp_id;
 	char *pin = NULL;
-	size_t n;
 	int r, ok = -1;
 
 	if ((map->rp = fido_credman_rp_new()) == NULL) {
 		warnx("%s: fido_credman_rp_new", __func__);
 		goto out;
 	}
-	if ((pin = get_pin(path)) == NULL)
-		goto out;
-	if ((r = fido_credman_get_dev_rp(dev, map->rp, pin)) != FIDO_OK) {
-		warnx("fido_credman_get_dev_rp: %s", fido_strerr(r));
+	if ((map->rk = fido_credman_rk_new()) == NULL) {
+		warnx("%s: fido_credman_rk_new", __func__);
 		goto out;
 	}
-	if ((n = fido_credman_rp_count(map->rp)) > UINT8_MAX) {
-		warnx("%s: fido_credman_rp_count > UINT8_MAX", __func__);
+	if ((pin = get_pin(path)) == NULL)
 		goto out;
-	}
-	if ((map->rk = calloc(n, sizeof(*map->rk))) == NULL) {
-		warnx("%s: calloc", __func__);
+	if ((r = fido_credman_get_dev_all_rk(dev, map->rp, map->rk,
+	    pin)) != FIDO_OK) {
+		warnx("fido_credman_get_dev_all_rk: %s", fido_strerr(r));
 		goto out;
 	}
-	for (size_t i = 0; i < n; i++) {
-		if ((rp_id = fido_credman_rp_id(map->rp, i)) == NULL) {
-			warnx("%s: fido_credman_rp_id %zu", __func__, i);
-			goto out;
-		}
-		if ((map->rk[i] = fido_credman_rk_new()) == NULL) {
-			warnx("%s: fido_credman_rk_new", __func__);
-			goto out;
-		}
-		if ((r = fido_credman_get_dev_rk(dev, rp_id, map->rk[i],
-		    pin)) != FIDO_OK) {
-			warnx("%s: fido_credman_get_dev_rk %s: %s", __func__,
-			    rp_id, fido_strerr(r));
-			goto out;
-		}
-	}
 
 	ok = 0;
 out:
@@ -302,41 +281,64 @@ out:
 	exit(ok);
 }
 
+/*
+ * Check that plaintext inflates to origsiz bytes, in the zlib (RFC1950)
+ * or raw (RFC1951) format. The output is discarded, and the inflate
+ * state is kept across calls.
+ */
 static int
-decompress(const struct blob *plaintext, uint64_t origsiz)
+inflate_check(z_stream *zs, int wbits, const struct blob *plaintext,
+    uint64_t origsiz)
 {
-	struct blob inflated;
-	u_long ilen, plen;
-	int ok = -1;
-
-	memset(&inflated, 0, sizeof(inflated));
+	unsigned char buf[1024];
+	int z;
 
-	if (plaintext->len > ULONG_MAX)
-		return -1;
-	if (origsiz > ULONG_MAX || origsiz > SIZE_MAX)
-		return -1;
-	plen = (u_long)plaintext->len;
-	ilen = (u_long)origsiz;
-	inflated.len = (size_t)origsiz;
-	if ((inflated.ptr = calloc(1, inflated.len)) == NULL)
+	if (inflateReset2(zs, wbits) != Z_OK)
 		return -1;
-	if (uncompress(inflated.ptr, &ilen, plaintext->ptr, plen) != Z_OK ||
-	    ilen > SIZE_MAX || (size_t)ilen != (size_t)origsiz)
-		goto out;
+	zs->next_in = plaintext->ptr;
+	zs->avail_in = (u_int)plaintext->len;
+	do {
+		zs->next_out = buf;
+		zs->avail_out = sizeof(buf);
+		if ((z = inflate(zs, Z_NO_FLUSH)) != Z_OK &&
+		    z != Z_STREAM_END)
+			break;
+	} while (z != Z_STREAM_END && zs->total_out <= origsiz);
+	explicit_bzero(buf, sizeof(buf));
 
-	ok = 0; /* success */
-out:
-	freezero(inflated.ptr, inflated.len);
+	return z == Z_STREAM_END && zs->total_out == origsiz ? 0 : -1;
+}
 
-	return ok;
+/* per-thread state of blob_list(), kept across entries */
+struct list_worker {
+	EVP_CIPHER_CTX	*ctx;
+	z_stream	 zs;
+	int		 zinit;
+};
+
+static int
+decompress(struct list_worker *w, const struct blob *plaintext,
+    uint64_t origsiz)
+{
+	if (plaintext->len > UINT_MAX)
+		return -1;
+	if (!w->zinit) {
+		if (inflateInit2(&w->zs, MAX_WBITS) != Z_OK)
+			return -1;
+		w->zinit = 1;
+	}
+	if (inflate_check(&w->zs, MAX_WBITS, plaintext, origsiz) == 0 ||
+	    inflate_check(&w->zs, -MAX_WBITS, plaintext, origsiz) == 0)
+		return 0;
+
+	return -1;
 }
 
 static int
-decode(const struct blob *ciphertext, const struct blob *nonce,
-    uint64_t origsiz, const fido_cred_t *cred)
+decode(struct list_worker *w, const struct blob *ciphertext,
+    const struct blob *nonce, uint64_t origsiz, const fido_cred_t *cred)
 {
 	uint8_t aad[4 + sizeof(uint64_t)];
-	EVP_CIPHER_CTX *ctx = NULL;
 	const EVP_CIPHER *cipher;
 	struct blob plaintext;
 	uint64_t tmp;
@@ -357,12 +359,12 @@ decode(const struct blob *ciphertext, const struct blob *nonce,
 	plaintext.len = ciphertext->len - 16;
 	if ((plaintext.ptr = calloc(1, plaintext.len)) == NULL)
 		return -1;
-	if ((ctx = EVP_CIPHER_CTX_new()) == NULL ||
+	if ((w->ctx == NULL && (w->ctx = EVP_CIPHER_CTX_new()) == NULL) ||
 	    (cipher = EVP_aes_256_gcm()) == NULL ||
-	    EVP_CipherInit(ctx, cipher, fido_cred_largeblob_key_ptr(cred),
+	    EVP_CipherInit(w->ctx, cipher, fido_cred_largeblob_key_ptr(cred),
 	    nonce->ptr, 0) == 0)
 		goto out;
-	if (EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, 16,
+	if (EVP_CIPHER_CTX_ctrl(w->ctx, EVP_CTRL_GCM_SET_TAG, 16,
 	    ciphertext->ptr + ciphertext->len - 16) == 0)
 		goto out;
 	aad[0] = 0x62; /* b */
@@ -371,38 +373,21 @@ decode(const struct blob *ciphertext, const struct blob *nonce,
 	aad[3] = 0x62; /* b */
 	tmp = htole64(origsiz);
 	memcpy(&aad[4], &tmp, sizeof(uint64_t));
-	if (EVP_Cipher(ctx, NULL, aad, (u_int)sizeof(aad)) < 0 ||
-	    EVP_Cipher(ctx, plaintext.ptr, ciphertext->ptr,
+	if (EVP_Cipher(w->ctx, NULL, aad, (u_int)sizeof(aad)) < 0 ||
+	    EVP_Cipher(w->ctx, plaintext.ptr, ciphertext->ptr,
 	    (u_int)plaintext.len) < 0 ||
-	    EVP_Cipher(ctx, NULL, NULL, 0) < 0)
+	    EVP_Cipher(w->ctx, NULL, NULL, 0) < 0)
 		goto out;
-	if (decompress(&plaintext, origsiz) < 0)
+	if (decompress(w, &plaintext, origsiz) < 0)
 		goto out;
 
 	ok = 0;
 out:
 	freezero(plaintext.ptr, plaintext.len);
 
-	if (ctx != NULL)
-		EVP_CIPHER_CTX_free(ctx);
-
 	return ok;
 }
 
-static const fido_cred_t *
-try_rp(const fido_credman_rk_t *rk, const struct blob *ciphertext,
-    const struct blob *nonce, uint64_t origsiz)
-{
-	const fido_cred_t *cred;
-
-	for (size_t i = 0; i < fido_credman_rk_count(rk); i++)
-		if ((cred = fido_credman_rk(rk, i)) != NULL &&
-		    decode(ciphertext, nonce, origsiz, cred) == 0)
-			return cred;
-
-	return NULL;
-}
-
 static int
 decode_cbor_blob(struct blob *out, const cbor_item_t *item)
 {
@@ -459,52 +444,6 @@ decode_blob_entry(const cbor_item_t *item, struct blob *ciphertext,
 	return 0;
 }
 
-static void
-print_blob_entry(size_t idx, const cbor_item_t *item, const struct rkmap *map)
-{
-	struct blob ciphertext, nonce;
-	const fido_cred_t *cred = NULL;
-	const char *rp_id = NULL;
-	char *cred_id = NULL;
-	uint64_t origsiz = 0;
-
-	memset(&ciphertext, 0, sizeof(ciphertext));
-	memset(&nonce, 0, sizeof(nonce));
-
-	if (decode_blob_entry(item, &ciphertext, &nonce, &origsiz) < 0) {
-		printf("%02zu: <skipped: bad cbor>\n", idx);
-		goto out;
-	}
-	for (size_t i = 0; i < fido_credman_rp_count(map->rp); i++) {
-		if ((cred = try_rp(map->rk[i], &ciphertext, &nonce,
-		    origsiz)) != NULL) {
-			rp_id = fido_credman_rp_id(map->rp, i);
-			break;
-		}
-	}
-	if (cred == NULL) {
-		if ((cred_id = strdup("<unknown>")) == NULL) {
-			printf("%02zu: <skipped: strdup failed>\n", idx);
-			goto out;
-		}
-	} else {
-		if (base64_encode(fido_cred_id_ptr(cred),
-		    fido_cred_id_len(cred), &cred_id) < 0) {
-			printf("%02zu: <skipped: base64_encode failed>\n", idx);
-			goto out;
-		}
-	}
-	if (rp_id == NULL)
-		rp_id = "<unknown>";
-
-	printf("%02zu: %4zu %4zu %s %s\n", idx, ciphertext.len,
-	    (size_t)origsiz, cred_id, rp_id);
-out:
-	free(ciphertext.ptr);
-	free(nonce.ptr);
-	free(cred_id);
-}
-
 static cbor_item_t *
 get_cbor_array(fido_dev_t *dev)
 {
@@ -556,6 +495,213 @@ out:
 	return item;
 }
 
+/*
+ * fido2-token -L -b: the entries of the large-blob array are decrypted by
+ * up to LIST_MAXJOBS threads, each trying the keys of the resident
+ * credentials in turn. A key opens at most one entry, so a key is claimed
+ * once it matches, and not tried against the entries that remain. Entries
+ * are printed in array order, as soon as those before them are done.
+ */
+
+#define LIST_MAXJOBS	4
+
+struct list_entry {
+	const char	*error;   /* reason the entry was skipped, or NULL */
+	size_t		 len;     /* of the ciphertext */
+	uint64_t	 origsiz;
+	size_t		 rk;      /* credential that opened it, or SIZE_MAX */
+	int		 done;
+};
+
+struct list_job {
+	const struct rkmap	 *map;
+	cbor_item_t		**v;
+	struct list_entry	 *entry;
+	size_t			  n;       /* entries */
+	unsigned char		 *claimed; /* per credential */
+	size_t			  next;    /* next entry to decode */
+	size_t			  printed; /* entries printed */
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t		  lock;
+#endif
+};
+
+#ifdef HAVE_PTHREAD
+#define LIST_LOCK(j)	pthread_mutex_lock(&(j)->lock)
+#define LIST_UNLOCK(j)	pthread_mutex_unlock(&(j)->lock)
+#else
+#define LIST_LOCK(j)	do { } while (0)
+#define LIST_UNLOCK(j)	do { } while (0)
+#endif
+
+/* whether credential i is unclaimed; if so and claim is set, claim it */
+static int
+list_claim(struct list_job *job, size_t i, int claim)
+{
+	int r;
+
+	LIST_LOCK(job);
+	if ((r = !job->claimed[i]) && claim)
+		job->claimed[i] = 1;
+	LIST_UNLOCK(job);
+
+	return r;
+}
+
+static void
+list_decode(struct list_job *job, struct list_worker *w, size_t idx)
+{
+	struct list_entry *e = &job->entry[idx];
+	struct blob ciphertext, nonce;
+	const fido_cred_t *cred;
+
+	memset(&ciphertext, 0, sizeof(ciphertext));
+	memset(&nonce, 0, sizeof(nonce));
+	e->rk = SIZE_MAX;
+
+	if (decode_blob_entry(job->v[idx], &ciphertext, &nonce,
+	    &e->origsiz) < 0) {
+		e->error = "bad cbor";
+		goto out;
+	}
+	e->len = ciphertext.len;
+	for (size_t i = 0; i < fido_credman_rk_count(job->map->rk); i++) {
+		if (!list_claim(job, i, 0) ||
+		    (cred = fido_credman_rk(job->map->rk, i)) == NULL ||
+		    decode(w, &ciphertext, &nonce, e->origsiz, cred) < 0)
+			continue;
+		if (list_claim(job, i, 1)) {
+			e->rk = i;
+			break;
+		}
+	}
+out:
+	free(ciphertext.ptr);
+	free(nonce.ptr);
+}
+
+static void
+print_blob_entry(size_t idx, const struct list_entry *e,
+    const struct rkmap *map)
+{
+	const fido_cred_t *cred;
+	const char *rp_id = NULL;
+	char *cred_id = NULL;
+
+	if (e->error != NULL) {
+		printf("%02zu: <skipped: %s>\n", idx, e->error);
+		return;
+	}
+	if (e->rk == SIZE_MAX ||
+	    (cred = fido_credman_rk(map->rk, e->rk)) == NULL) {
+		if ((cred_id = strdup("<unknown>")) == NULL) {
+			printf("%02zu: <skipped: strdup failed>\n", idx);
+			return;
+		}
+	} else {
+		rp_id = fido_credman_rp_id(map->rp,
+		    fido_credman_rk_rp_idx(map->rk, e->rk));
+		if (base64_encode(fido_cred_id_ptr(cred),
+		    fido_cred_id_len(cred), &cred_id) < 0) {
+			printf("%02zu: <skipped: base64_encode failed>\n", idx);
+			return;
+		}
+	}
+	if (rp_id == NULL)
+		rp_id = "<unknown>";
+
+	printf("%02zu: %4zu %4zu %s %s\n", idx, e->len, (size_t)e->origsiz,
+	    cred_id, rp_id);
+	free(cred_id);
+}
+
+static void *
+list_worker(void *arg)
+{
+	struct list_job *job = arg;
+	struct list_worker w;
+	size_t idx;
+
+	memset(&w, 0, sizeof(w));
+
+	for (;;) {
+		LIST_LOCK(job);
+		idx = job->next < job->n ? job->next++ : job->n;
+		LIST_UNLOCK(job);
+		if (idx == job->n)
+			break;
+		list_decode(job, &w, idx);
+		LIST_LOCK(job);
+		job->entry[idx].done = 1;
+		while (job->printed < job->n &&
+		    job->entry[job->printed].done) {
+			print_blob_entry(job->printed,
+			    &job->entry[job->printed], job->map);
+			job->printed++;
+		}
+		fflush(stdout);
+		LIST_UNLOCK(job);
+	}
+
+	if (w.ctx != NULL)
+		EVP_CIPHER_CTX_free(w.ctx);
+	if (w.zinit)
+		inflateEnd(&w.zs);
+
+	return NULL;
+}
+
+static int
+list_entries(const struct rkmap *map, cbor_item_t **v, size_t n)
+{
+	struct list_job job;
+#ifdef HAVE_PTHREAD
+	pthread_t thread[LIST_MAXJOBS - 1];
+	size_t i, nthreads = 0;
+#endif
+	int ok = -1;
+
+	memset(&job, 0, sizeof(job));
+	job.map = map;
+	job.v = v;
+	job.n = n;
+
+	if ((job.entry = calloc(n, sizeof(*job.entry))) == NULL ||
+	    (job.claimed = calloc(fido_credman_rk_count(map->rk) + 1,
+	    sizeof(*job.claimed))) == NULL) {
+		warnx("%s: calloc", __func__);
+		goto out;
+	}
+#ifdef HAVE_PTHREAD
+	if (pthread_mutex_init(&job.lock, NULL) != 0) {
+		warnx("%s: pthread_mutex_init", __func__);
+		goto out;
+	}
+	/* the calling thread decodes entries too */
+	for (i = 1; i < n && i < LIST_MAXJOBS; i++) {
+		if (pthread_create(&thread[nthreads], NULL, list_worker,
+		    &job) != 0) {
+			warnx("%s: pthread_create", __func__);
+			break;
+		}
+		nthreads++;
+	}
+	list_worker(&job);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(thread[i], NULL);
+	pthread_mutex_destroy(&job.lock);
+#else
+	list_worker(&job);
+#endif
+
+	ok = 0;
+out:
+	free(job.entry);
+	free(job.claimed);
+
+	return ok;
+}
+
 int
 blob_list(const char *path)
 {
@@ -577,8 +723,8 @@ blob_list(const char *path)
 		warnx("%s: cbor_array_handle", __func__);
 		goto out;
 	}
-	for (size_t i = 0; i < cbor_array_size(item); i++)
-		print_blob_entry(i, v[i], &map);
+	if (list_entries(&map, v, cbor_array_size(item)) < 0)
+		goto out;
 
 	ok = 0; /* success */
 out:
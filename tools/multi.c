@@ -0,0 +1,273 @@
+/*
+ * Copyright (c) 2022 Yubico AB. All rights reserved.
+ * Use of this source code is governed by a BSD-style
+ * license that can be found in the LICENSE file.
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+/*
+ * fido2-token -M: run -I or -L on every authenticator found by the
+ * operating system.
+ *
+ * Each device is handled by a child process, which runs the request as
+ * fido2-token would with the device's path, so that slow authenticators
+ * are queried concurrently. The children's output is collected, and
+ * printed in the order of fido_dev_info_manifest(), each line prefixed
+ * by the device's path; with -j, the path is added to each object as
+ * its "path" member instead. PIN prompts are serialised, so that one
+ * device is asked for at a time.
+ */
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <poll.h>
+#endif
+
+#include <fido.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "../openbsd-compat/openbsd-compat.h"
+#include "extern.h"
+
+#define MULTI_MAXDEV	64
+
+int multi_child;
+
+#ifdef _WIN32
+int
+token_multi(int (*fn)(int, char **, char *), int json, int argc, char **argv)
+{
+	(void)fn;
+	(void)json;
+	(void)argc;
+	(void)argv;
+
+	errx(1, "-M: not supported on this platform");
+
+	return (1); /* NOTREACHED */
+}
+#else
+struct multi_dev {
+	char		*path;
+	pid_t		 pid;
+	int		 fd[2];		/* child's stdout, stderr */
+	struct blob	 buf[2];
+	int		 status;
+};
+
+static int
+append(struct blob *b, const unsigned char *ptr, size_t len)
+{
+	unsigned char *p;
+
+	if ((p = realloc(b->ptr, b->len + len)) == NULL)
+		return (-1);
+	memcpy(p + b->len, ptr, len);
+	b->ptr = p;
+	b->len += len;
+
+	return (0);
+}
+
+static void
+spawn(struct multi_dev *d, struct multi_dev *dev, size_t ndev,
+    int (*fn)(int, char **, char *), int argc, char **argv)
+{
+	int out[2], errout[2];
+
+	d->pid = -1;
+	d->fd[0] = d->fd[1] = -1;
+	d->status = 1;
+
+	if (pipe(out) < 0) {
+		warn("pipe");
+		return;
+	}
+	if (pipe(errout) < 0) {
+		warn("pipe");
+		close(out[0]);
+		close(out[1]);
+		return;
+	}
+	fflush(stdout);
+	fflush(stderr);
+	if ((d->pid = fork()) < 0) {
+		warn("fork");
+		close(out[0]);
+		close(out[1]);
+		close(errout[0]);
+		close(errout[1]);
+		return;
+	}
+	if (d->pid == 0) {
+		for (size_t i = 0; i < ndev; i++) {
+			if (dev[i].fd[0] != -1)
+				close(dev[i].fd[0]);
+			if (dev[i].fd[1] != -1)
+				close(dev[i].fd[1]);
+		}
+		close(out[0]);
+		close(errout[0]);
+		if (dup2(out[1], STDOUT_FILENO) < 0 ||
+		    dup2(errout[1], STDERR_FILENO) < 0)
+			_exit(1);
+		close(out[1]);
+		close(errout[1]);
+		multi_child = 1;
+		exit(fn(argc, argv, d->path));
+	}
+	close(out[1]);
+	close(errout[1]);
+	d->fd[0] = out[0];
+	d->fd[1] = errout[0];
+}
+
+static void
+collect(struct multi_dev *dev, size_t ndev)
+{
+	struct pollfd *pfd;
+	unsigned char buf[1024];
+	ssize_t n;
+	size_t npfd;
+	int *fd;
+
+	if ((pfd = calloc(ndev * 2, sizeof(*pfd))) == NULL)
+		err(1, "calloc");
+
+	for (;;) {
+		npfd = 0;
+		for (size_t i = 0; i < ndev * 2; i++) {
+			pfd[i].fd = dev[i / 2].fd[i % 2];
+			pfd[i].events = POLLIN;
+			pfd[i].revents = 0;
+			if (pfd[i].fd != -1)
+				npfd++;
+		}
+		if (npfd == 0)
+			break;
+		if (poll(pfd, (nfds_t)(ndev * 2), -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			err(1, "poll");
+		}
+		for (size_t i = 0; i < ndev * 2; i++) {
+			if (pfd[i].fd == -1 || pfd[i].revents == 0)
+				continue;
+			fd = &dev[i / 2].fd[i % 2];
+			if ((n = read(*fd, buf, sizeof(buf))) < 0 &&
+			    errno == EINTR)
+				continue;
+			if (n > 0 && append(&dev[i / 2].buf[i % 2], buf,
+			    (size_t)n) == 0)
+				continue;
+			if (n < 0)
+				warn("read");
+			close(*fd);
+			*fd = -1;
+		}
+	}
+
+	free(pfd);
+
+	for (size_t i = 0; i < ndev; i++) {
+		int status;
+
+		if (dev[i].pid <= 0)
+			continue;
+		while (waitpid(dev[i].pid, &status, 0) < 0)
+			if (errno != EINTR)
+				err(1, "waitpid");
+		if (WIFEXITED(status))
+			dev[i].status = WEXITSTATUS(status);
+	}
+}
+
+static void
+print_lines(FILE *fp, const char *path, const struct blob *b, int json)
+{
+	const unsigned char *p = b->ptr, *end = b->ptr + b->len, *nl;
+	size_t len;
+
+	while (p < end) {
+		if ((nl = memchr(p, '\n', (size_t)(end - p))) == NULL)
+			nl = end;
+		len = (size_t)(nl - p);
+		if (json && len > 0 && p[0] == '{') {
+			fputs("{\"path\":", fp);
+			json_quote(fp, path);
+			if (len > 1 && p[1] != '}')
+				fputc(',', fp);
+			fwrite(p + 1, 1, len - 1, fp);
+		} else {
+			fprintf(fp, "%s: ", path);
+			fwrite(p, 1, len, fp);
+		}
+		fputc('\n', fp);
+		p = nl + 1;
+	}
+}
+
+int
+token_multi(int (*fn)(int, char **, char *), int json, int argc, char **argv)
+{
+	fido_dev_info_t *devlist;
+	struct multi_dev *dev;
+	size_t ndevs;
+	int r, ok = 0;
+
+	if ((devlist = fido_dev_info_new(MULTI_MAXDEV)) == NULL)
+		errx(1, "fido_dev_info_new");
+	if ((r = fido_dev_info_manifest(devlist, MULTI_MAXDEV,
+	    &ndevs)) != FIDO_OK)
+		errx(1, "fido_dev_info_manifest: %s (0x%x)", fido_strerr(r), r);
+	if (ndevs == 0) {
+		fido_dev_info_free(&devlist, ndevs);
+		exit(0);
+	}
+	if ((dev = calloc(ndevs, sizeof(*dev))) == NULL)
+		err(1, "calloc");
+	for (size_t i = 0; i < ndevs; i++) {
+		dev[i].fd[0] = dev[i].fd[1] = -1;
+		if ((dev[i].path = strdup(fido_dev_info_path(
+		    fido_dev_info_ptr(devlist, i)))) == NULL)
+			err(1, "strdup");
+	}
+	fido_dev_info_free(&devlist, ndevs);
+
+	/* the token get_pin() takes before prompting */
+	if (pipe(pin_lock_fd) < 0)
+		err(1, "pipe");
+	if (write(pin_lock_fd[1], "", 1) != 1)
+		err(1, "write");
+
+	for (size_t i = 0; i < ndevs; i++)
+		spawn(&dev[i], dev, i, fn, argc, argv);
+
+	close(pin_lock_fd[0]);
+	close(pin_lock_fd[1]);
+	pin_lock_fd[0] = pin_lock_fd[1] = -1;
+
+	collect(dev, ndevs);
+
+	for (size_t i = 0; i < ndevs; i++) {
+		print_lines(stdout, dev[i].path, &dev[i].buf[0], json);
+		print_lines(stderr, dev[i].path, &dev[i].buf[1], 0);
+		if (dev[i].status != 0)
+			ok = 1;
+		free(dev[i].buf[0].ptr);
+		free(dev[i].buf[1].ptr);
+		free(dev[i].path);
+	}
+	free(dev);
+
+	exit(ok);
+}
+#endif /* _WIN32 */
@@ -296,6 +296,125 @@ print_byte_array(const char *label, const uint8_t *ba, size_t len)
 	printf("\n");
 }
 
+static void
+json_str_array(struct json *j, const char *key, char * const *sa, size_t len)
+{
+	json_arr(j, key);
+	for (size_t i = 0; i < len; i++)
+		json_str(j, NULL, sa[i]);
+	json_close(j);
+}
+
+static void
+json_algorithms(struct json *j, const fido_cbor_info_t *ci)
+{
+	json_arr(j, "algorithms");
+	for (size_t i = 0; i < fido_cbor_info_algorithm_count(ci); i++) {
+		json_obj(j, NULL);
+		json_str(j, "type", fido_cbor_info_algorithm_type(ci, i));
+		json_int(j, "alg", fido_cbor_info_algorithm_cose(ci, i));
+		json_close(j);
+	}
+	json_close(j);
+}
+
+static void
+json_retries(struct json *j, const char *key, int r, int retrycnt)
+{
+	if (r != FIDO_OK)
+		json_null(j, key);
+	else
+		json_int(j, key, retrycnt);
+}
+
+/*
+ * The fields of -I as a single JSON object, named after the getInfo
+ * accessors; absent authenticator fields are reported as 0 or null.
+ */
+static void
+print_info_json(fido_dev_t *dev)
+{
+	struct json		 j;
+	fido_cbor_info_t	*ci = NULL;
+	char * const		*name;
+	const bool		*opt;
+	const uint64_t		*cert;
+	const uint8_t		*proto;
+	int			 r;
+	int			 retrycnt;
+
+	json_init(&j, stdout);
+	json_obj(&j, NULL);
+	json_uint(&j, "proto", fido_dev_protocol(dev));
+	json_uint(&j, "major", fido_dev_major(dev));
+	json_uint(&j, "minor", fido_dev_minor(dev));
+	json_uint(&j, "build", fido_dev_build(dev));
+	json_uint(&j, "caps", fido_dev_flags(dev));
+	json_bool(&j, "fido2", fido_dev_is_fido2(dev));
+
+	if (fido_dev_is_fido2(dev) == false)
+		goto end;
+	if ((ci = fido_cbor_info_new()) == NULL)
+		errx(1, "fido_cbor_info_new");
+	if ((r = fido_dev_get_cbor_info(dev, ci)) != FIDO_OK)
+		errx(1, "fido_dev_get_cbor_info: %s (0x%x)", fido_strerr(r), r);
+
+	json_str_array(&j, "versions", fido_cbor_info_versions_ptr(ci),
+	    fido_cbor_info_versions_len(ci));
+	json_str_array(&j, "extensions", fido_cbor_info_extensions_ptr(ci),
+	    fido_cbor_info_extensions_len(ci));
+	json_str_array(&j, "transports", fido_cbor_info_transports_ptr(ci),
+	    fido_cbor_info_transports_len(ci));
+	json_algorithms(&j, ci);
+	json_hex(&j, "aaguid", fido_cbor_info_aaguid_ptr(ci),
+	    fido_cbor_info_aaguid_len(ci));
+
+	name = fido_cbor_info_options_name_ptr(ci);
+	opt = fido_cbor_info_options_value_ptr(ci);
+	json_obj(&j, "options");
+	for (size_t i = 0; i < fido_cbor_info_options_len(ci); i++)
+		json_bool(&j, name[i], opt[i]);
+	json_close(&j);
+
+	name = fido_cbor_info_certs_name_ptr(ci);
+	cert = fido_cbor_info_certs_value_ptr(ci);
+	json_obj(&j, "certifications");
+	for (size_t i = 0; i < fido_cbor_info_certs_len(ci); i++)
+		json_uint(&j, name[i], cert[i]);
+	json_close(&j);
+
+	json_uint(&j, "fwversion", fido_cbor_info_fwversion(ci));
+	json_uint(&j, "maxmsgsiz", fido_cbor_info_maxmsgsiz(ci));
+	json_uint(&j, "maxcredcntlst", fido_cbor_info_maxcredcntlst(ci));
+	json_uint(&j, "maxcredidlen", fido_cbor_info_maxcredidlen(ci));
+	json_uint(&j, "maxlargeblob", fido_cbor_info_maxlargeblob(ci));
+	json_uint(&j, "maxrpid_minpinlen",
+	    fido_cbor_info_maxrpid_minpinlen(ci));
+	if (fido_cbor_info_rk_remaining(ci) == -1)
+		json_null(&j, "rk_remaining");
+	else
+		json_int(&j, "rk_remaining", fido_cbor_info_rk_remaining(ci));
+	json_uint(&j, "minpinlen", fido_cbor_info_minpinlen(ci));
+
+	proto = fido_cbor_info_protocols_ptr(ci);
+	json_arr(&j, "pin_protocols");
+	for (size_t i = 0; i < fido_cbor_info_protocols_len(ci); i++)
+		json_uint(&j, NULL, proto[i]);
+	json_close(&j);
+
+	r = fido_dev_get_retry_count(dev, &retrycnt);
+	json_retries(&j, "pin_retries", r, retrycnt);
+	json_bool(&j, "new_pin_required", fido_cbor_info_new_pin_required(ci));
+	r = fido_dev_get_uv_retry_count(dev, &retrycnt);
+	json_retries(&j, "uv_retries", r, retrycnt);
+	json_uint(&j, "uv_attempts", fido_cbor_info_uv_attempts(ci));
+	json_uint(&j, "uv_modality", fido_cbor_info_uv_modality(ci));
+
+	fido_cbor_info_free(&ci);
+end:
+	json_close(&j);
+}
+
 int
 token_info(int argc, char **argv, char *path)
 {
@@ -305,6 +424,8 @@ token_info(int argc, char **argv, char *path)
 	fido_dev_t		*dev = NULL;
 	int			 ch;
 	int			 credman = 0;
+	int			 json = 0;
+	int			 multi = 0;
 	int			 r;
 	int			 retrycnt;
 
@@ -318,26 +439,44 @@ token_info(int argc, char **argv, char *path)
 		case 'i':
 			cred_id = optarg;
 			break;
+		case 'j':
+			json = 1;
+			break;
 		case 'k':
 			rp_id = optarg;
 			break;
+		case 'M':
+			multi = 1;
+			break;
 		default:
 			break; /* ignore */
 		}
 	}
 
+	if (multi && !multi_child) {
+		if (path != NULL)
+			usage();
+		return (token_multi(token_info, json, argc, argv));
+	}
 	if (path == NULL || (credman && (cred_id != NULL || rp_id != NULL)))
 		usage();
+	if (json && (cred_id != NULL || rp_id != NULL))
+		usage();
 
 	dev = open_dev(path);
 
 	if (credman)
-		return (credman_get_metadata(dev, path));
+		return (credman_get_metadata(dev, path, json));
 	if (cred_id && rp_id)
 		return (credman_print_rk(dev, path, rp_id, cred_id));
 	if (cred_id || rp_id)
 		usage();
 
+	if (json) {
+		print_info_json(dev);
+		goto end;
+	}
+
 	print_attr(dev);
 
 	if (fido_dev_is_fido2(dev) == false)
@@ -601,15 +740,33 @@ token_set(int argc, char **argv, char *path)
 	return (pin_set(path));
 }
 
+static void
+print_dev_json(const fido_dev_info_t *di)
+{
+	struct json j;
+
+	json_init(&j, stdout);
+	json_obj(&j, NULL);
+	json_str(&j, "path", fido_dev_info_path(di));
+	json_uint(&j, "vendor", (uint16_t)fido_dev_info_vendor(di));
+	json_uint(&j, "product", (uint16_t)fido_dev_info_product(di));
+	json_str(&j, "manufacturer", fido_dev_info_manufacturer_string(di));
+	json_str(&j, "product_string", fido_dev_info_product_string(di));
+	json_close(&j);
+}
+
 int
 token_list(int argc, char **argv, char *path)
 {
 	fido_dev_info_t *devlist;
 	size_t ndevs;
 	const char *rp_id = NULL;
+	int allkeys = 0;
 	int blobs = 0;
 	int enrolls = 0;
+	int json = 0;
 	int keys = 0;
+	int multi = 0;
 	int rplist = 0;
 	int ch;
 	int r;
@@ -618,16 +775,25 @@ token_list(int argc, char **argv, char *path)
 
 	while ((ch = getopt(argc, argv, TOKEN_OPT)) != -1) {
 		switch (ch) {
+		case 'a':
+			allkeys = 1;
+			break;
 		case 'b':
 			blobs = 1;
 			break;
 		case 'e':
 			enrolls = 1;
 			break;
+		case 'j':
+			json = 1;
+			break;
 		case 'k':
 			keys = 1;
 			rp_id = optarg;
 			break;
+		case 'M':
+			multi = 1;
+			break;
 		case 'r':
 			rplist = 1;
 			break;
@@ -636,17 +802,26 @@ token_list(int argc, char **argv, char *path)
 		}
 	}
 
-	if (blobs || enrolls || keys || rplist) {
-		if (path == NULL)
+	if (multi && !multi_child) {
+		if (path != NULL ||
+		    !(allkeys || blobs || enrolls || keys || rplist))
 			usage();
+		return (token_multi(token_list, json, argc, argv));
+	}
+
+	if (allkeys || blobs || enrolls || keys || rplist) {
+		if (path == NULL || (json && (blobs || enrolls)))
+			usage();
+		if (allkeys)
+			return (credman_list_all_rk(path, json));
 		if (blobs)
 			return (blob_list(path));
 		if (enrolls)
 			return (bio_list(path));
 		if (keys)
-			return (credman_list_rk(path, rp_id));
+			return (credman_list_rk(path, rp_id, json));
 		if (rplist)
-			return (credman_list_rp(path));
+			return (credman_list_rp(path, json));
 		/* NOTREACHED */
 	}
 
@@ -657,6 +832,10 @@ token_list(int argc, char **argv, char *path)
 
 	for (size_t i = 0; i < ndevs; i++) {
 		const fido_dev_info_t *di = fido_dev_info_ptr(devlist, i);
+		if (json) {
+			print_dev_json(di);
+			continue;
+		}
 		printf("%s: vendor=0x%04x, product=0x%04x (%s %s)\n",
 		    fido_dev_info_path(di),
 		    (uint16_t)fido_dev_info_vendor(di),
@@ -34,6 +34,33 @@
 
 #include "extern.h"
 
+/* set by fido2-token -M, whose children pass a token to take turns prompting */
+int pin_lock_fd[2] = { -1, -1 };
+
+static void
+pin_lock(void)
+{
+	char c;
+
+	if (pin_lock_fd[0] < 0)
+		return;
+	while (read(pin_lock_fd[0], &c, 1) < 0)
+		if (errno != EINTR)
+			return;
+}
+
+static void
+pin_unlock(void)
+{
+	char c = 0;
+
+	if (pin_lock_fd[1] < 0)
+		return;
+	while (write(pin_lock_fd[1], &c, 1) < 0)
+		if (errno != EINTR)
+			return;
+}
+
 char *
 get_pin(const char *path)
 {
@@ -50,10 +77,13 @@ get_pin(const char *path)
 		warn("%s: snprintf", __func__);
 		goto out;
 	}
+	pin_lock();
 	if (!readpassphrase(prompt, pin, PINBUF_LEN, RPP_ECHO_OFF)) {
+		pin_unlock();
 		warnx("%s: readpassphrase", __func__);
 		goto out;
 	}
+	pin_unlock();
 
 	ok = 0;
 out:
@@ -159,12 +189,22 @@ string_read(FILE *f, char **out)
 	return (0);
 }
 
+/* set by fido2-token -A to hand a request the daemon's handle for a path */
+const char *open_dev_path;
+fido_dev_t *open_dev_handle;
+
 fido_dev_t *
 open_dev(const char *path)
 {
 	fido_dev_t *dev;
 	int r;
 
+	if (open_dev_handle != NULL && strcmp(path, open_dev_path) == 0) {
+		dev = open_dev_handle;
+		open_dev_handle = NULL;
+		return (dev);
+	}
+
 	if ((dev = fido_dev_new()) == NULL)
 		errx(1, "fido_dev_new");
 
@@ -74,6 +74,8 @@ Function Package-StaticPDBs(${SRC}, ${DEST}) {
 Function Package-Tools(${SRC}, ${DEST}) {
 	Copy-Item "${SRC}\tools\${Config}\fido2-assert.exe" `
 	    "${DEST}\fido2-assert.exe"
+	Copy-Item "${SRC}\tools\${Config}\fido2-bench.exe" `
+	    "${DEST}\fido2-bench.exe"
 	Copy-Item "${SRC}\tools\${Config}\fido2-cred.exe" `
 	    "${DEST}\fido2-cred.exe"
 	Copy-Item "${SRC}\tools\${Config}\fido2-token.exe" `